@@ -36,10 +36,14 @@ extern "C" {
 #include "re_main.h"
 #include "re_md5.h"
 #include "re_mem.h"
+#include "re_metric.h"
 #include "re_mod.h"
 #include "re_mqueue.h"
+#include "re_async.h"
 #include "re_net.h"
 #include "re_odict.h"
+#include "re_rbtree.h"
+#include "re_reactor.h"
 #include "re_json.h"
 #include "re_rtmp.h"
 #include "re_rtp.h"
@@ -49,14 +53,17 @@ extern "C" {
 #include "re_sipevent.h"
 #include "re_sipreg.h"
 #include "re_sipsess.h"
+#include "re_snap.h"
 #include "re_stun.h"
 #include "re_natbd.h"
+#include "re_probe.h"
 #include "re_srtp.h"
 #include "re_sys.h"
 #include "re_tcp.h"
 #include "re_telev.h"
 #include "re_tmr.h"
 #include "re_tls.h"
+#include "re_trace.h"
 #include "re_turn.h"
 #include "re_udp.h"
 #include "re_websock.h"
@@ -13,15 +13,26 @@
 enum aes_mode {
 	AES_MODE_CTR,  /**< AES Counter mode (CTR) */
 	AES_MODE_GCM,  /**< AES Galois Counter Mode (GCM) */
+	AES_MODE_ECB,  /**< AES Electronic Codebook (ECB), no padding */
 };
 
 struct aes;
 
+/** One stream of a multi-buffer operation */
+struct aes_stream {
+	struct aes *aes;     /**< AES context, with the IV set       */
+	uint8_t *out;        /**< Output buffer, may be the input    */
+	const uint8_t *in;   /**< Input buffer                       */
+	size_t len;          /**< Number of bytes                    */
+	int err;             /**< Result of the stream, on return    */
+};
+
 int  aes_alloc(struct aes **stp, enum aes_mode mode,
 	       const uint8_t *key, size_t key_bits,
 	       const uint8_t *iv);
 void aes_set_iv(struct aes *aes, const uint8_t *iv);
 int  aes_encr(struct aes *aes, uint8_t *out, const uint8_t *in, size_t len);
 int  aes_decr(struct aes *aes, uint8_t *out, const uint8_t *in, size_t len);
+int  aes_encr_multi(struct aes_stream *strmv, size_t strmc);
 int  aes_get_authtag(struct aes *aes, uint8_t *tag, size_t taglen);
 int  aes_authenticate(struct aes *aes, const uint8_t *tag, size_t taglen);
@@ -0,0 +1,28 @@
+/**
+ * @file re_async.h  Interface to the pool of worker threads
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+
+/**
+ * Defines the work handler, called from a worker thread
+ *
+ * @param arg Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+typedef int  (re_async_work_h)(void *arg);
+
+/**
+ * Defines the completion handler, called from the main loop of the
+ * thread that submitted the work
+ *
+ * @param err Result of the work handler, or ECANCELED
+ * @param arg Handler argument
+ */
+typedef void (re_async_h)(int err, void *arg);
+
+int  re_async_init(unsigned workers);
+void re_async_close(void);
+int  re_async(re_async_work_h *workh, re_async_h *cb, void *arg);
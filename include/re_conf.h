@@ -10,6 +10,7 @@ struct conf;
 typedef int (conf_h)(const struct pl *val, void *arg);
 
 int conf_alloc(struct conf **confp, const char *filename);
+int conf_alloc_mmap(struct conf **confp, const char *filename);
 int conf_alloc_buf(struct conf **confp, const uint8_t *buf, size_t sz);
 int conf_get(const struct conf *conf, const char *name, struct pl *pl);
 int conf_get_str(const struct conf *conf, const char *name, char *str,
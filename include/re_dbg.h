@@ -43,6 +43,16 @@ enum {
 #define DEBUG_LEVEL 7
 #endif
 
+/**
+ * @def DEBUG_LEVEL_MAX
+ *
+ * Highest debug level that is compiled in, for all modules
+ */
+
+#ifndef DEBUG_LEVEL_MAX
+#define DEBUG_LEVEL_MAX 7
+#endif
+
 
 /**
  * @def DEBUG_WARNING(...)
@@ -73,30 +83,34 @@ enum {
 #if (defined(__STDC_VERSION__) && __STDC_VERSION__ >= 199901L)	\
 	|| (__GNUC__ >= 3)
 
-#if (DEBUG_LEVEL >= 4)
-#define DEBUG_WARNING(...) \
-	dbg_printf(DBG_WARNING, DEBUG_MODULE ": " __VA_ARGS__)
+#if (DEBUG_LEVEL >= 4) && (DEBUG_LEVEL_MAX >= 4)
+#define DEBUG_WARNING(...)						\
+	(dbg_enabled(DBG_WARNING, DEBUG_MODULE) ?			\
+	 dbg_printf(DBG_WARNING, DEBUG_MODULE ": " __VA_ARGS__) : (void)0)
 #else
 #define DEBUG_WARNING(...)
 #endif
 
-#if (DEBUG_LEVEL >= 5)
-#define DEBUG_NOTICE(...) \
-	dbg_printf(DBG_NOTICE, DEBUG_MODULE ": " __VA_ARGS__)
+#if (DEBUG_LEVEL >= 5) && (DEBUG_LEVEL_MAX >= 5)
+#define DEBUG_NOTICE(...)						\
+	(dbg_enabled(DBG_NOTICE, DEBUG_MODULE) ?			\
+	 dbg_printf(DBG_NOTICE, DEBUG_MODULE ": " __VA_ARGS__) : (void)0)
 #else
 #define DEBUG_NOTICE(...)
 #endif
 
-#if (DEBUG_LEVEL >= 6)
-#define DEBUG_INFO(...) \
-	dbg_printf(DBG_INFO, DEBUG_MODULE ": " __VA_ARGS__)
+#if (DEBUG_LEVEL >= 6) && (DEBUG_LEVEL_MAX >= 6)
+#define DEBUG_INFO(...)						\
+	(dbg_enabled(DBG_INFO, DEBUG_MODULE) ?			\
+	 dbg_printf(DBG_INFO, DEBUG_MODULE ": " __VA_ARGS__) : (void)0)
 #else
 #define DEBUG_INFO(...)
 #endif
 
-#if (DEBUG_LEVEL >= 7)
-#define DEBUG_PRINTF(...) \
-	dbg_printf(DBG_DEBUG, DEBUG_MODULE ": " __VA_ARGS__)
+#if (DEBUG_LEVEL >= 7) && (DEBUG_LEVEL_MAX >= 7)
+#define DEBUG_PRINTF(...)						\
+	(dbg_enabled(DBG_DEBUG, DEBUG_MODULE) ?			\
+	 dbg_printf(DBG_DEBUG, DEBUG_MODULE ": " __VA_ARGS__) : (void)0)
 #else
 #define DEBUG_PRINTF(...)
 #endif
@@ -104,26 +118,34 @@ enum {
 /* GNU extensions for variable argument macros */
 #elif defined(__GNUC__)
 
-#if (DEBUG_LEVEL >= 4)
-#define DEBUG_WARNING(a...) dbg_printf(DBG_WARNING, DEBUG_MODULE ": " a)
+#if (DEBUG_LEVEL >= 4) && (DEBUG_LEVEL_MAX >= 4)
+#define DEBUG_WARNING(a...)						\
+	(dbg_enabled(DBG_WARNING, DEBUG_MODULE) ?			\
+	 dbg_printf(DBG_WARNING, DEBUG_MODULE ": " a) : (void)0)
 #else
 #define DEBUG_WARNING(a...)
 #endif
 
-#if (DEBUG_LEVEL >= 5)
-#define DEBUG_NOTICE(a...) dbg_printf(DBG_NOTICE, DEBUG_MODULE ": " a)
+#if (DEBUG_LEVEL >= 5) && (DEBUG_LEVEL_MAX >= 5)
+#define DEBUG_NOTICE(a...)						\
+	(dbg_enabled(DBG_NOTICE, DEBUG_MODULE) ?			\
+	 dbg_printf(DBG_NOTICE, DEBUG_MODULE ": " a) : (void)0)
 #else
 #define DEBUG_NOTICE(a...)
 #endif
 
-#if (DEBUG_LEVEL >= 6)
-#define DEBUG_INFO(a...) dbg_printf(DBG_INFO, DEBUG_MODULE ": " a)
+#if (DEBUG_LEVEL >= 6) && (DEBUG_LEVEL_MAX >= 6)
+#define DEBUG_INFO(a...)						\
+	(dbg_enabled(DBG_INFO, DEBUG_MODULE) ?			\
+	 dbg_printf(DBG_INFO, DEBUG_MODULE ": " a) : (void)0)
 #else
 #define DEBUG_INFO(a...)
 #endif
 
-#if (DEBUG_LEVEL >= 7)
-#define DEBUG_PRINTF(a...) dbg_printf(DBG_DEBUG, DEBUG_MODULE ": " a)
+#if (DEBUG_LEVEL >= 7) && (DEBUG_LEVEL_MAX >= 7)
+#define DEBUG_PRINTF(a...)						\
+	(dbg_enabled(DBG_DEBUG, DEBUG_MODULE) ?			\
+	 dbg_printf(DBG_DEBUG, DEBUG_MODULE ": " a) : (void)0)
 #else
 #define DEBUG_PRINTF(a...)
 #endif
@@ -131,25 +153,25 @@ enum {
 /* No variable argument macros */
 #else
 
-#if (DEBUG_LEVEL >= 4)
+#if (DEBUG_LEVEL >= 4) && (DEBUG_LEVEL_MAX >= 4)
 #define DEBUG_WARNING dbg_warning
 #else
 #define DEBUG_WARNING dbg_noprintf
 #endif
 
-#if (DEBUG_LEVEL >= 5)
+#if (DEBUG_LEVEL >= 5) && (DEBUG_LEVEL_MAX >= 5)
 #define DEBUG_NOTICE dbg_notice
 #else
 #define DEBUG_NOTICE dbg_noprintf
 #endif
 
-#if (DEBUG_LEVEL >= 6)
+#if (DEBUG_LEVEL >= 6) && (DEBUG_LEVEL_MAX >= 6)
 #define DEBUG_INFO dbg_info
 #else
 #define DEBUG_INFO dbg_noprintf
 #endif
 
-#if (DEBUG_LEVEL >= 7)
+#if (DEBUG_LEVEL >= 7) && (DEBUG_LEVEL_MAX >= 7)
 #define DEBUG_PRINTF dbg_noprintf
 #else
 #define DEBUG_PRINTF dbg_noprintf
@@ -181,12 +203,36 @@ void dbg_init(int level, enum dbg_flags flags);
 void dbg_close(void);
 int  dbg_logfile_set(const char *name);
 void dbg_handler_set(dbg_print_h *ph, void *arg);
+int  dbg_module_level_set(const char *module, int level);
+int  dbg_async_enable(bool enable);
+uint64_t dbg_async_dropped(void);
 void dbg_printf(int level, const char *fmt, ...);
 void dbg_noprintf(const char *fmt, ...);
 void dbg_warning(const char *fmt, ...);
 void dbg_notice(const char *fmt, ...);
 void dbg_info(const char *fmt, ...);
 const char *dbg_level_str(int level);
+bool dbg_module_enabled(int level, const char *module);
+
+
+/** Highest debug level enabled for any module */
+extern int dbg_level_any;
+
+
+/**
+ * Check if a debug level is enabled for a module, before the arguments
+ * of the message are evaluated
+ *
+ * @param level  Debug level
+ * @param module Module name
+ *
+ * @return True if enabled, otherwise false
+ */
+static inline bool dbg_enabled(int level, const char *module)
+{
+	return level <= dbg_level_any && dbg_module_enabled(level, module);
+}
+
 
 #ifdef __cplusplus
 }
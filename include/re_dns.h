@@ -44,6 +44,7 @@ enum {
 	DNS_TYPE_AAAA  = 0x001c,
 	DNS_TYPE_SRV   = 0x0021,
 	DNS_TYPE_NAPTR = 0x0023,
+	DNS_TYPE_OPT   = 0x0029,
 	DNS_QTYPE_IXFR = 0x00fb,
 	DNS_QTYPE_AXFR = 0x00fc,
 	DNS_QTYPE_ANY  = 0x00ff
@@ -75,6 +76,8 @@ struct dnshdr {
 };
 
 
+struct dns_arena;
+
 /** Defines a DNS Resource Record (RR) */
 struct dnsrr {
 	struct le le;
@@ -130,7 +133,14 @@ struct dnsrr {
 			char *regexp;
 			char *replace;
 		} naptr;
+		struct {
+			uint16_t udp_size;  /**< Requestor's payload size */
+			uint8_t ercode;     /**< Upper bits of the RCODE  */
+			uint8_t version;
+			uint16_t flags;     /**< DO bit and Z             */
+		} opt;
 	} rdata;
+	struct dns_arena *arena;  /**< Storage of the strings, if shared */
 };
 
 struct hash;
@@ -167,6 +177,9 @@ struct dnsrr *dns_rr_alloc(void);
 int  dns_rr_encode(struct mbuf *mb, const struct dnsrr *rr, int64_t ttl_offs,
 		   struct hash *ht_dname, size_t start);
 int  dns_rr_decode(struct mbuf *mb, struct dnsrr **rr, size_t start);
+int  dns_rr_decode_arena(struct mbuf *mb, struct dnsrr **rr, size_t start,
+			 struct dns_arena *arena);
+int  dns_arena_alloc(struct dns_arena **arenap, size_t size);
 bool dns_rr_cmp(const struct dnsrr *rr1, const struct dnsrr *rr2, bool rdata);
 const char *dns_rr_typename(uint16_t type);
 const char *dns_rr_classname(uint16_t dnsclass);
@@ -200,6 +213,18 @@ struct dnsc_conf {
 	uint32_t tcp_hash_size;
 	uint32_t conn_timeout;  /* in [ms] */
 	uint32_t idle_timeout;  /* in [ms] */
+	uint32_t cache_size;    /* max cached answers, 0 to disable */
+	uint32_t cache_stale;   /* serve expired answers for [s], 0 = off */
+	bool race;              /* ask the next server after the p95 RTT  */
+	uint16_t edns_size;     /* EDNS0 UDP payload size, 0 = off */
+};
+
+/** DNS Client cache statistics */
+struct dnsc_cache_stat {
+	uint32_t hits;    /**< Number of queries answered from the cache */
+	uint32_t misses;  /**< Number of queries sent to a server        */
+	uint32_t count;   /**< Number of cached answers                  */
+	uint32_t stale;   /**< Number of expired answers served          */
 };
 
 int  dnsc_alloc(struct dnsc **dcpp, const struct dnsc_conf *conf,
@@ -216,6 +241,12 @@ int  dnsc_notify(struct dns_query **qp, struct dnsc *dnsc, const char *name,
 		 uint16_t type, uint16_t dnsclass, const struct dnsrr *ans_rr,
 		 int proto, const struct sa *srvv, const uint32_t *srvc,
 		 dns_query_h *qh, void *arg);
+void dnsc_cache_flush(struct dnsc *dnsc);
+int  dnsc_cache_stats(const struct dnsc *dnsc, struct dnsc_cache_stat *stat);
+struct snap;
+int  dnsc_cache_snap(const struct dnsc *dnsc, struct snap *snap);
+uint32_t dnsc_cache_restore(struct dnsc *dnsc, const struct snap *snap);
+int  dnsc_debug(struct re_printf *pf, const struct dnsc *dnsc);
 
 
 /* DNS System functions */
@@ -97,6 +97,41 @@ int re_sdprintf(char **strp, const char *fmt, ...);
 /* Regular expressions */
 int re_regex(const char *ptr, size_t len, const char *expr, ...);
 
+enum {
+	RE_REGEX_OPS = 48,
+	RE_REGEX_CLS = 16,
+};
+
+/** Compiled basic regular expression, without heap allocation */
+struct regex {
+	struct {
+		uint8_t c;       /**< Literal character, lowercase  */
+		uint8_t cls;     /**< Class number, 0 for a literal */
+		uint8_t nmin;    /**< Minimum matches of the class  */
+		uint8_t nmax;    /**< Maximum matches, 0 for any    */
+	} opv[RE_REGEX_OPS];
+	struct {
+		uint8_t map[32]; /**< Bit for each matching byte    */
+		bool qesc;       /**< Quoted strings are skipped    */
+	} clsv[RE_REGEX_CLS];
+	uint8_t opc;
+	uint8_t clsc;
+	bool ok;
+};
+
+int re_regex_compile(struct regex *re, const char *expr);
+int re_regex_exec(const struct regex *re, const char *ptr, size_t len, ...);
+int re_regex_cached(struct regex *re, const char *ptr, size_t len,
+		    const char *expr, ...);
+
+/** Match with an expression that is compiled on first use at a call site */
+#define RE_REGEX(err, ptr, len, expr, ...)				\
+	do {								\
+		static struct regex re_regex_;				\
+		(err) = re_regex_cached(&re_regex_, (ptr), (len),	\
+					(expr), __VA_ARGS__);		\
+	} while (0)
+
 
 /* Character functions */
 uint8_t ch_hex(char ch);
@@ -146,3 +181,5 @@ void fmt_param_apply(const struct pl *pl, fmt_param_h *ph, void *arg);
 int utf8_encode(struct re_printf *pf, const char *str);
 int utf8_decode(struct re_printf *pf, const struct pl *pl);
 size_t utf8_byteseq(char u[4], unsigned cp);
+bool utf8_validate(const char *str, size_t len);
+size_t utf8_tail(const char *str, size_t len);
@@ -9,7 +9,31 @@ struct hash;
 struct pl;
 
 
+/**
+ * Defines the element key handler of an auto-resizing hashmap table
+ *
+ * @param le List element
+ *
+ * @return Hash key of the element
+ */
+typedef uint32_t (hash_key_h)(const struct le *le);
+
+/** Number of chain lengths in the hashmap statistics */
+enum {
+	HASH_STAT_CHAINS = 8,
+};
+
+/** Hashmap table statistics, the last chain length counts longer chains */
+struct hash_stat {
+	uint32_t bsize;                     /**< Number of buckets        */
+	uint32_t count;                     /**< Number of elements       */
+	uint32_t max;                       /**< Longest chain            */
+	uint32_t chainv[HASH_STAT_CHAINS];  /**< Buckets per chain length */
+};
+
+
 int  hash_alloc(struct hash **hp, uint32_t bsize);
+int  hash_alloc_auto(struct hash **hp, uint32_t bsize, hash_key_h *keyh);
 void hash_append(struct hash *h, uint32_t key, struct le *le, void *data);
 void hash_unlink(struct le *le);
 struct le *hash_lookup(const struct hash *h, uint32_t key, list_apply_h *ah,
@@ -20,6 +44,7 @@ uint32_t hash_bsize(const struct hash *h);
 void hash_flush(struct hash *h);
 void hash_clear(struct hash *h);
 uint32_t hash_valid_size(uint32_t size);
+int  hash_stats(const struct hash *h, struct hash_stat *stat);
 
 
 /* Hash functions */
@@ -30,4 +55,52 @@ uint32_t hash_joaat_str_ci(const char *str);
 uint32_t hash_joaat_pl(const struct pl *pl);
 uint32_t hash_joaat_pl_ci(const struct pl *pl);
 uint32_t hash_fast(const char *k, size_t len);
+uint32_t hash_fast_ci(const char *str, size_t len);
 uint32_t hash_fast_str(const char *str);
+uint32_t hash_fast_pl(const struct pl *pl);
+uint32_t hash_fast_pl_ci(const struct pl *pl);
+
+
+/* Open-addressing map */
+struct hmap;
+
+/**
+ * Defines the compare handler of a hash map entry
+ *
+ * @param val Value of an entry with a matching key
+ * @param arg Handler argument
+ *
+ * @return True if the entry matches
+ */
+typedef bool (hmap_cmp_h)(const void *val, void *arg);
+
+int   hmap_alloc(struct hmap **mapp, uint32_t size);
+int   hmap_insert(struct hmap *map, uint32_t key, void *val);
+void  hmap_remove(struct hmap *map, uint32_t key, const void *val);
+void *hmap_lookup(const struct hmap *map, uint32_t key, hmap_cmp_h *cmph,
+		  void *arg);
+uint32_t hmap_count(const struct hmap *map);
+
+
+/* Concurrent hash table */
+struct chash;
+
+/**
+ * Defines the apply handler of a concurrent hash table
+ *
+ * @param val Value
+ * @param arg Handler argument
+ *
+ * @return True to stop the iteration
+ */
+typedef bool (chash_apply_h)(void *val, void *arg);
+
+int   chash_alloc(struct chash **hp, uint32_t bsize);
+int   chash_insert(struct chash *h, uint32_t key, void *val);
+bool  chash_remove(struct chash *h, uint32_t key, const void *val);
+void *chash_lookup(struct chash *h, uint32_t key, hmap_cmp_h *cmph,
+		   void *arg);
+void *chash_take(struct chash *h, uint32_t key, hmap_cmp_h *cmph, void *arg);
+void *chash_apply(struct chash *h, chash_apply_h *ah, void *arg);
+void  chash_flush(struct chash *h);
+uint32_t chash_count(const struct chash *h);
@@ -67,6 +67,7 @@ enum http_hdrid {
 /** HTTP Header */
 struct http_hdr {
 	struct le le;          /**< Linked-list element     */
+	struct le he;          /**< Header index element    */
 	struct pl name;        /**< HTTP Header name        */
 	struct pl val;         /**< HTTP Header value       */
 	enum http_hdrid id;    /**< HTTP Header id (unique) */
@@ -124,7 +125,27 @@ typedef int  (http_data_h)(const uint8_t *buf, size_t size,
 typedef void (http_conn_h)(struct tcp_conn *tc, struct tls_conn *sc,
 			   void *arg);
 
+/** HTTP Client configuration */
+struct http_conf {
+	uint32_t conn_timeout;  /**< Connect timeout in [ms]              */
+	uint32_t recv_timeout;  /**< Response timeout in [ms]             */
+	uint32_t idle_timeout;  /**< Keep-alive timeout in [ms]           */
+	uint32_t max_conn;      /**< Connections per host, 0 for no limit */
+	bool http2;             /**< Offer HTTP/2 on TLS connections      */
+};
+
+/** HTTP Client connection statistics */
+struct http_cli_stat {
+	uint32_t conns;     /**< Open and connecting connections     */
+	uint32_t idle;      /**< Idle connections                    */
+	uint32_t queued;    /**< Requests waiting for a connection   */
+	uint32_t connects;  /**< Number of new connections           */
+	uint32_t reused;    /**< Number of requests on idle conns    */
+};
+
 int http_client_alloc(struct http_cli **clip, struct dnsc *dnsc);
+int http_client_set_config(struct http_cli *cli, const struct http_conf *conf);
+int http_client_stats(const struct http_cli *cli, struct http_cli_stat *stat);
 int http_client_add_ca(struct http_cli *cli, const char *tls_ca);
 int http_client_set_tls_hostname(struct http_cli *cli,
 				 const struct pl *hostname);
@@ -132,6 +153,7 @@ int http_request(struct http_req **reqp, struct http_cli *cli, const char *met,
 		 const char *uri, http_resp_h *resph, http_data_h *datah,
 		 void *arg, const char *fmt, ...);
 void http_req_set_conn_handler(struct http_req *req, http_conn_h *connh);
+int  http_req_chunk(struct http_req *req, const uint8_t *buf, size_t len);
 
 
 /* Server */
@@ -140,11 +162,16 @@ struct http_conn;
 
 typedef void (http_req_h)(struct http_conn *conn, const struct http_msg *msg,
 			  void *arg);
+typedef int  (http_body_h)(struct http_conn *conn, const struct http_msg *msg,
+			   const uint8_t *buf, size_t size, void *arg);
 
 int  http_listen(struct http_sock **sockp, const struct sa *laddr,
 		 http_req_h *reqh, void *arg);
 int  https_listen(struct http_sock **sockp, const struct sa *laddr,
 		  const char *cert, http_req_h *reqh, void *arg);
+void http_sock_set_body_handler(struct http_sock *sock, http_body_h *bodyh);
+int  http_sock_set_headers(struct http_sock *sock, const char *fmt, ...);
+int  http_sock_set_http2(struct http_sock *sock, bool enable);
 struct tcp_sock *http_sock_tcp(struct http_sock *sock);
 const struct sa *http_conn_peer(const struct http_conn *conn);
 struct tcp_conn *http_conn_tcp(struct http_conn *conn);
@@ -155,6 +182,40 @@ int  http_reply(struct http_conn *conn, uint16_t scode, const char *reason,
 int  http_creply(struct http_conn *conn, uint16_t scode, const char *reason,
 		 const char *ctype, const char *fmt, ...);
 int  http_ereply(struct http_conn *conn, uint16_t scode, const char *reason);
+int  http_reply_metrics(struct http_conn *conn);
+int  http_reply_chunked(struct http_conn *conn, uint16_t scode,
+			const char *reason, const char *fmt, ...);
+int  http_reply_chunk(struct http_conn *conn, const uint8_t *buf, size_t len);
+int  http_reply_file(struct http_conn *conn, const struct http_msg *msg,
+		     const char *path, const char *ctype);
+
+
+/* Router */
+enum {
+	HTTP_ROUTE_PARAMS_MAX = 16,
+};
+
+/** Parameters of a route, pointing into the request path */
+struct http_route_params {
+	struct pl namev[HTTP_ROUTE_PARAMS_MAX];  /**< Parameter names      */
+	struct pl valv[HTTP_ROUTE_PARAMS_MAX];   /**< Parameter values     */
+	uint32_t n;                              /**< Number of parameters */
+};
+
+struct http_router;
+
+typedef void (http_route_h)(struct http_conn *conn, const struct http_msg *msg,
+			    const struct http_route_params *prm, void *arg);
+
+int  http_router_alloc(struct http_router **rp, http_req_h *defh, void *arg);
+int  http_router_add(struct http_router *r, const char *met, const char *path,
+		     http_route_h *h, void *arg);
+int  http_router_route(struct http_router *r, struct http_conn *conn,
+		       const struct http_msg *msg);
+void http_router_handler(struct http_conn *conn, const struct http_msg *msg,
+			 void *arg);
+int  http_route_param(const struct http_route_params *prm, const char *name,
+		      struct pl *val);
 
 
 /* Authentication */
@@ -52,6 +52,7 @@ struct ice;
 struct ice_cand;
 struct icem;
 struct turnc;
+struct stun_kasched;
 
 /** ICE Configuration */
 struct ice_conf {
@@ -73,6 +74,7 @@ enum ice_role icem_local_role(const struct icem *icem);
 void icem_set_conf(struct icem *icem, const struct ice_conf *conf);
 void icem_set_role(struct icem *icem, enum ice_role role);
 void icem_set_name(struct icem *icem, const char *name);
+void icem_set_kasched(struct icem *icem, struct stun_kasched *ks);
 int  icem_comp_add(struct icem *icem, unsigned compid, void *sock);
 int  icem_cand_add(struct icem *icem, unsigned compid, uint16_t lprio,
 		   const char *ifname, const struct sa *addr);
@@ -118,6 +120,28 @@ const struct sa *icem_lcand_addr(const struct ice_cand *cand);
 enum ice_cand_type icem_cand_type(const struct ice_cand *cand);
 
 
+/* ICE-lite server */
+struct ice_lite;
+struct ice_lite_peer;
+struct udp_sock;
+
+typedef void (ice_lite_estab_h)(struct ice_lite_peer *peer,
+				const struct sa *raddr, void *arg);
+typedef void (ice_lite_recv_h)(struct ice_lite_peer *peer,
+			       const struct sa *src, struct mbuf *mb,
+			       void *arg);
+
+int  ice_lite_alloc(struct ice_lite **litep, const struct sa *laddr);
+struct udp_sock *ice_lite_sock(const struct ice_lite *lite);
+int  ice_lite_peer_add(struct ice_lite_peer **peerp, struct ice_lite *lite,
+		       const char *lufrag, const char *lpwd,
+		       const char *rufrag, ice_lite_estab_h *estabh,
+		       ice_lite_recv_h *recvh, void *arg);
+int  ice_lite_send(struct ice_lite_peer *peer, struct mbuf *mb);
+const struct sa *ice_lite_peer_raddr(const struct ice_lite_peer *peer);
+bool ice_lite_peer_nominated(const struct ice_lite_peer *peer);
+
+
 extern const char ice_attr_cand[];
 extern const char ice_attr_lite[];
 extern const char ice_attr_mismatch[];
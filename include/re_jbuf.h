@@ -5,6 +5,7 @@
  */
 struct jbuf;
 struct rtp_header;
+struct rtp_sock;
 
 /** Jitter buffer statistics */
 struct jbuf_stat {
@@ -17,12 +18,29 @@ struct jbuf_stat {
 	uint32_t n_overflow;   /**< Number of overflows                     */
 	uint32_t n_underflow;  /**< Number of underflows                    */
 	uint32_t n_flush;      /**< Number of times jitter buffer flushed   */
+	uint32_t target;       /**< Current target depth [frames]           */
+	uint32_t late_ratio;   /**< Recent late-loss ratio [per mille]      */
 };
 
 
 int  jbuf_alloc(struct jbuf **jbp, uint32_t min, uint32_t max);
+int  jbuf_ring_alloc(struct jbuf **jbp, uint32_t min, uint32_t max);
 int  jbuf_put(struct jbuf *jb, const struct rtp_header *hdr, void *mem);
 int  jbuf_get(struct jbuf *jb, struct rtp_header *hdr, void **mem);
+int  jbuf_set_adaptive(struct jbuf *jb, struct rtp_sock *rs);
 void jbuf_flush(struct jbuf *jb);
 int  jbuf_stats(const struct jbuf *jb, struct jbuf_stat *jstat);
 int  jbuf_debug(struct re_printf *pf, const struct jbuf *jb);
+
+
+/* Lock-free single-producer/single-consumer jitter buffer */
+struct jbuf_spsc;
+
+int  jbuf_spsc_alloc(struct jbuf_spsc **jbp, uint32_t min, uint32_t max,
+		     size_t frame_size);
+int  jbuf_spsc_put(struct jbuf_spsc *jb, const struct rtp_header *hdr,
+		   const uint8_t *data, size_t len);
+int  jbuf_spsc_get(struct jbuf_spsc *jb, struct rtp_header *hdr,
+		   uint8_t *buf, size_t size, size_t *len);
+void jbuf_spsc_flush(struct jbuf_spsc *jb);
+int  jbuf_spsc_stats(const struct jbuf_spsc *jb, struct jbuf_stat *jstat);
@@ -45,6 +45,69 @@ int json_decode(const char *str, size_t len, unsigned maxdepth,
 		json_object_h *oh, json_array_h *ah,
 		json_object_entry_h *oeh, json_array_entry_h *aeh, void *arg);
 
+struct json_decoder;
+
+int  json_decoder_alloc(struct json_decoder **decp, unsigned maxdepth,
+			json_object_h *oh, json_array_h *ah,
+			json_object_entry_h *oeh, json_array_entry_h *aeh,
+			void *arg);
+int  json_decoder_feed(struct json_decoder *dec, const char *str,
+		       size_t len);
+bool json_decoder_done(const struct json_decoder *dec);
+
+/** Type of a struct member to decode into */
+enum json_field_type {
+	JSON_FIELD_STR,     /**< char pointer, allocated          */
+	JSON_FIELD_CHARS,   /**< char array of the member size    */
+	JSON_FIELD_INT,     /**< int64_t                          */
+	JSON_FIELD_DOUBLE,  /**< double                           */
+	JSON_FIELD_BOOL,    /**< bool                             */
+	JSON_FIELD_OBJECT,  /**< struct described by fields       */
+};
+
+/** Field descriptor of a struct to decode into */
+struct json_field {
+	const char *name;
+	enum json_field_type type;
+	size_t offset;
+	size_t size;
+	const struct json_field *fields;
+};
+
+#define JSON_FIELD(name, type, st, m)					\
+	{name, type, offsetof(st, m), sizeof(((st *)0)->m), NULL}
+#define JSON_FIELD_OBJ(name, st, m, fields)				\
+	{name, JSON_FIELD_OBJECT, offsetof(st, m),			\
+	 sizeof(((st *)0)->m), fields}
+
+int json_decode_struct(void *st, const struct json_field *fields,
+		       const char *str, size_t len);
 int json_decode_odict(struct odict **op, uint32_t hash_size, const char *str,
 		      size_t len, unsigned maxdepth);
 int json_encode_odict(struct re_printf *pf, const struct odict *o);
+
+
+/** JSON writer */
+struct json_writer {
+	struct mbuf *mb;
+	uint64_t comma;   /**< Bit for each level with a first value   */
+	uint64_t obj;     /**< Bit for each level that is an object    */
+	unsigned depth;
+	bool key;         /**< A key was written, its value is next    */
+	int err;
+};
+
+void json_writer_init(struct json_writer *w, struct mbuf *mb);
+int  json_writer_begin_object(struct json_writer *w);
+int  json_writer_end_object(struct json_writer *w);
+int  json_writer_begin_array(struct json_writer *w);
+int  json_writer_end_array(struct json_writer *w);
+int  json_writer_key(struct json_writer *w, const char *key);
+int  json_writer_str(struct json_writer *w, const char *str);
+int  json_writer_pl(struct json_writer *w, const struct pl *pl);
+int  json_writer_u64(struct json_writer *w, uint64_t v);
+int  json_writer_i64(struct json_writer *w, int64_t v);
+int  json_writer_double(struct json_writer *w, double v);
+int  json_writer_bool(struct json_writer *w, bool v);
+int  json_writer_null(struct json_writer *w);
+int  json_writer_odict(struct json_writer *w, const struct odict *o);
@@ -19,12 +19,13 @@ struct le {
 
 /** Defines a linked list */
 struct list {
-	struct le *head;  /**< First list element */
-	struct le *tail;  /**< Last list element  */
+	struct le *head;  /**< First list element        */
+	struct le *tail;  /**< Last list element         */
+	uint32_t count;   /**< Number of list elements   */
 };
 
 /** Linked list Initializer */
-#define LIST_INIT {NULL, NULL}
+#define LIST_INIT {NULL, NULL, 0}
 
 
 /**
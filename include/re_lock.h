@@ -16,3 +16,159 @@ int  lock_read_try(struct lock *l);
 int  lock_write_try(struct lock *l);
 
 void lock_rel(struct lock *l);
+
+
+/*
+ * Lightweight primitives for short critical sections and read-mostly
+ * data, built on the GCC/clang atomic builtins
+ */
+
+#if defined (__ATOMIC_RELAXED)
+
+/* Atomic counters */
+#define re_atomic_load(p)      __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define re_atomic_store(p, v)  __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define re_atomic_add(p, n)    __atomic_add_fetch((p), (n), __ATOMIC_RELAXED)
+#define re_atomic_sub(p, n)    __atomic_sub_fetch((p), (n), __ATOMIC_RELAXED)
+
+
+/**
+ * Take a reference on an atomic reference counter
+ *
+ * @param ref Reference counter
+ */
+static inline void re_atomic_ref_get(uint32_t *ref)
+{
+	(void)__atomic_add_fetch(ref, 1, __ATOMIC_RELAXED);
+}
+
+
+/**
+ * Release a reference on an atomic reference counter
+ *
+ * @param ref Reference counter
+ *
+ * @return True if this was the last reference
+ */
+static inline bool re_atomic_ref_put(uint32_t *ref)
+{
+	return 0 == __atomic_sub_fetch(ref, 1, __ATOMIC_ACQ_REL);
+}
+
+
+/** Defines an adaptive spinlock, initialised to zero */
+struct spinlock {
+	int locked;
+};
+
+#define SPINLOCK_INIT {0}
+
+void spinlock_wait(struct spinlock *s);
+
+
+/**
+ * Try to take a spinlock without waiting
+ *
+ * @param s Spinlock
+ *
+ * @return True if the lock was taken
+ */
+static inline bool spinlock_try(struct spinlock *s)
+{
+	return !__atomic_exchange_n(&s->locked, 1, __ATOMIC_ACQUIRE);
+}
+
+
+/**
+ * Take a spinlock. A waiter spins for a short while, and then yields the
+ * CPU until the lock is released.
+ *
+ * @param s Spinlock
+ */
+static inline void spinlock_get(struct spinlock *s)
+{
+	if (!spinlock_try(s))
+		spinlock_wait(s);
+}
+
+
+/**
+ * Release a spinlock
+ *
+ * @param s Spinlock
+ */
+static inline void spinlock_rel(struct spinlock *s)
+{
+	__atomic_store_n(&s->locked, 0, __ATOMIC_RELEASE);
+}
+
+
+/**
+ * Defines a sequence lock, initialised to zero. Readers never block the
+ * writer, and retry when the data changed while they read it. Writers
+ * must be serialized, e.g. with a spinlock.
+ */
+struct seqlock {
+	uint32_t seq;
+};
+
+#define SEQLOCK_INIT {0}
+
+
+/**
+ * Begin to read data protected by a sequence lock
+ *
+ * @param s Sequence lock
+ *
+ * @return Sequence to pass to seqlock_read_retry()
+ */
+static inline uint32_t seqlock_read_begin(const struct seqlock *s)
+{
+	uint32_t seq;
+
+	while ((seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE)) & 1)
+		;
+
+	return seq;
+}
+
+
+/**
+ * Check if the data must be read again
+ *
+ * @param s   Sequence lock
+ * @param seq Sequence from seqlock_read_begin()
+ *
+ * @return True if a writer changed the data
+ */
+static inline bool seqlock_read_retry(const struct seqlock *s, uint32_t seq)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+	return seq != __atomic_load_n(&s->seq, __ATOMIC_RELAXED);
+}
+
+
+/**
+ * Begin to change data protected by a sequence lock
+ *
+ * @param s Sequence lock
+ */
+static inline void seqlock_write_begin(struct seqlock *s)
+{
+	__atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+
+/**
+ * End a change of data protected by a sequence lock
+ *
+ * @param s Sequence lock
+ */
+static inline void seqlock_write_end(struct seqlock *s)
+{
+	__atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+}
+
+#endif
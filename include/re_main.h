@@ -12,7 +12,8 @@ enum {
 #ifndef FD_WRITE
 	FD_WRITE  = 1<<1,
 #endif
-	FD_EXCEPT = 1<<2
+	FD_EXCEPT = 1<<2,
+	FD_EDGE   = 1<<3   /**< Edge-triggered, with epoll and kqueue */
 };
 
 
@@ -31,17 +32,40 @@ typedef void (fd_h)(int flags, void *arg);
  */
 typedef void (re_signal_h)(int sig);
 
+/**
+ * Completion handler for submitted I/O requests
+ *
+ * @param err  0 if success, otherwise errorcode
+ * @param len  Number of bytes transferred
+ * @param arg  Handler argument
+ */
+typedef void (fd_compl_h)(int err, size_t len, void *arg);
+
+struct sa;
+struct mbuf;
+
 
 int   fd_listen(int fd, int flags, fd_h *fh, void *arg);
 void  fd_close(int fd);
+void  fd_ready(int fd);
 int   fd_setsize(int maxfds);
 void  fd_debug(void);
+int   fd_send(int fd, struct mbuf *mb, const struct sa *dst,
+	      fd_compl_h *ch, void *arg);
+int   fd_recv(int fd, struct mbuf *mb, struct sa *src,
+	      fd_compl_h *ch, void *arg);
 
 int   libre_init(void);
 void  libre_close(void);
 
 int   re_main(re_signal_h *signalh);
 void  re_cancel(void);
+void  re_busy_poll_set(uint32_t usec);
+uint32_t re_busy_poll(void);
+
+struct re_sig;
+int   re_sig_listen(struct re_sig **rsp, const int *sigv, size_t sigc,
+		    re_signal_h *sigh);
 int   re_debug(struct re_printf *pf, void *unused);
 
 int  re_thread_init(void);
@@ -52,6 +76,28 @@ void re_thread_leave(void);
 void re_set_mutex(void *mutexp);
 
 
+/** Number of buckets in the handler time histogram */
+enum { RE_HSTAT_BUCKETS = 24 };
+
+/** Generic handler function, for accounting only */
+typedef void (re_hstat_fn)(void);
+
+/** Event handler cost statistics */
+struct re_hstat {
+	re_hstat_fn *h;      /**< Handler function (fd_h or tmr_h)     */
+	bool tmr;            /**< Timer handler, otherwise fd handler  */
+	uint64_t count;      /**< Number of calls                      */
+	uint64_t total;      /**< Cumulative time in [us]              */
+	uint64_t max;        /**< Maximum time in [us]                 */
+	uint64_t hist[RE_HSTAT_BUCKETS]; /**< Calls per [2^(i-1), 2^i) us */
+};
+
+int    re_hstat_enable(bool enable);
+size_t re_hstat_get(struct re_hstat *v, size_t n);
+void   re_hstat_reset(void);
+uint64_t re_hstat_percentile(const struct re_hstat *st, unsigned pct);
+
+
 /** Polling methods */
 enum poll_method {
 	METHOD_NULL = 0,
@@ -59,6 +105,7 @@ enum poll_method {
 	METHOD_SELECT,
 	METHOD_EPOLL,
 	METHOD_KQUEUE,
+	METHOD_IO_URING,
 	/* sep */
 	METHOD_MAX
 };
@@ -42,16 +42,19 @@ struct re_printf;
 
 struct mbuf *mbuf_alloc(size_t size);
 struct mbuf *mbuf_alloc_ref(struct mbuf *mbr);
+struct mbuf *mbuf_slice(struct mbuf *mb, size_t off, size_t len);
 void     mbuf_init(struct mbuf *mb);
 void     mbuf_reset(struct mbuf *mb);
 int      mbuf_resize(struct mbuf *mb, size_t size);
 void     mbuf_trim(struct mbuf *mb);
 int      mbuf_shift(struct mbuf *mb, ssize_t shift);
 int      mbuf_write_mem(struct mbuf *mb, const uint8_t *buf, size_t size);
+uint8_t *mbuf_reserve(struct mbuf *mb, size_t size);
 int      mbuf_write_u8(struct mbuf *mb, uint8_t v);
 int      mbuf_write_u16(struct mbuf *mb, uint16_t v);
 int      mbuf_write_u32(struct mbuf *mb, uint32_t v);
 int      mbuf_write_u64(struct mbuf *mb, uint64_t v);
+int      mbuf_write_dec(struct mbuf *mb, uint64_t v);
 int      mbuf_write_str(struct mbuf *mb, const char *str);
 int      mbuf_write_pl(struct mbuf *mb, const struct pl *pl);
 int      mbuf_read_mem(struct mbuf *mb, uint8_t *buf, size_t size);
@@ -69,6 +72,31 @@ int      mbuf_fill(struct mbuf *mb, uint8_t c, size_t n);
 int      mbuf_debug(struct re_printf *pf, const struct mbuf *mb);
 
 
+/** Maximum number of segments in a memory buffer chain */
+enum { MBUF_CHAIN_MAX = 8 };
+
+/** Defines a segment of a memory buffer chain */
+struct mbuf_seg {
+	uint8_t *buf;   /**< Referenced buffer memory */
+	size_t pos;     /**< Start of the segment     */
+	size_t len;     /**< Length of the segment    */
+};
+
+/** Defines a chain of memory buffer segments */
+struct mbuf_chain {
+	struct mbuf_seg segv[MBUF_CHAIN_MAX];  /**< Segments          */
+	size_t segc;                           /**< Number of segments */
+	size_t len;                            /**< Total length       */
+};
+
+void mbuf_chain_init(struct mbuf_chain *mc);
+void mbuf_chain_reset(struct mbuf_chain *mc);
+int  mbuf_chain_prepend(struct mbuf_chain *mc, const struct mbuf *mb);
+int  mbuf_chain_append(struct mbuf_chain *mc, const struct mbuf *mb);
+int  mbuf_chain_linearize(struct mbuf **mbp, const struct mbuf_chain *mc,
+			  size_t headroom);
+
+
 /**
  * Get the buffer from the current position
  *
@@ -167,3 +195,52 @@ static inline void mbuf_skip_to_end(struct mbuf *mb)
 {
 	mb->pos = mb->end;
 }
+
+
+/**
+ * Store an 8-bit value at a write cursor from mbuf_reserve()
+ *
+ * @param p Write cursor
+ * @param v 8-bit value
+ *
+ * @return Write cursor after the value
+ */
+static inline uint8_t *mbuf_store_u8(uint8_t *p, uint8_t v)
+{
+	*p = v;
+	return p + 1;
+}
+
+
+/**
+ * Store a 16-bit value in network byte order at a write cursor
+ *
+ * @param p Write cursor
+ * @param v 16-bit value in host byte order
+ *
+ * @return Write cursor after the value
+ */
+static inline uint8_t *mbuf_store_u16(uint8_t *p, uint16_t v)
+{
+	p[0] = (uint8_t)(v >> 8);
+	p[1] = (uint8_t)v;
+	return p + 2;
+}
+
+
+/**
+ * Store a 32-bit value in network byte order at a write cursor
+ *
+ * @param p Write cursor
+ * @param v 32-bit value in host byte order
+ *
+ * @return Write cursor after the value
+ */
+static inline uint8_t *mbuf_store_u32(uint8_t *p, uint32_t v)
+{
+	p[0] = (uint8_t)(v >> 24);
+	p[1] = (uint8_t)(v >> 16);
+	p[2] = (uint8_t)(v >> 8);
+	p[3] = (uint8_t)v;
+	return p + 4;
+}
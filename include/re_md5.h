@@ -11,5 +11,13 @@ enum {
 	MD5_STR_SIZE = 2*MD5_SIZE + 1  /**< Number of bytes in MD5 string */
 };
 
+/** One buffer of md5_multi() */
+struct md5_buf {
+	const uint8_t *d;       /**< Data buffer (input)          */
+	size_t n;               /**< Number of input bytes        */
+	uint8_t md[MD5_SIZE];   /**< Calculated MD5 hash (output) */
+};
+
 void md5(const uint8_t *d, size_t n, uint8_t *md);
 int  md5_printf(uint8_t *md, const char *fmt, ...);
+void md5_multi(struct md5_buf *bufv, size_t bufc);
@@ -13,6 +13,9 @@
  */
 typedef void (mem_destroy_h)(void *data);
 
+/** Number of size classes in the slab allocator */
+enum { MEM_SLAB_CLASSES = 20 };
+
 /** Memory Statistics */
 struct memstat {
 	size_t bytes_cur;    /**< Current bytes allocated      */
@@ -21,10 +24,28 @@ struct memstat {
 	size_t blocks_peak;  /**< Peak blocks allocated        */
 	size_t size_min;     /**< Lowest block size allocated  */
 	size_t size_max;     /**< Largest block size allocated */
+
+	/** Slab allocator statistics per size class */
+	struct {
+		size_t size;     /**< Object size of the class     */
+		size_t slabs;    /**< Number of slabs allocated    */
+		size_t blocks;   /**< Number of blocks in slabs    */
+		size_t cached;   /**< Number of free blocks        */
+		size_t allocs;   /**< Total allocations served     */
+	} slab[MEM_SLAB_CLASSES];
+
+	/** Huge-page arena of the slabs */
+	struct {
+		size_t size;     /**< Size of the arena            */
+		size_t used;     /**< Bytes given to slabs         */
+		bool huge;       /**< Explicit huge pages          */
+	} arena;
 };
 
 void    *mem_alloc(size_t size, mem_destroy_h *dh);
 void    *mem_zalloc(size_t size, mem_destroy_h *dh);
+void    *mem_alloc_shared(size_t size, mem_destroy_h *dh);
+void    *mem_share(void *data);
 void    *mem_realloc(void *data, size_t size);
 void    *mem_reallocarray(void *ptr, size_t nmemb,
 			  size_t membsize, mem_destroy_h *dh);
@@ -34,9 +55,32 @@ uint32_t mem_nrefs(const void *data);
 
 void     mem_debug(void);
 void     mem_threshold_set(ssize_t n);
+void     mem_pool_enable(bool enable);
 struct re_printf;
 int      mem_status(struct re_printf *pf, void *unused);
 int      mem_get_stat(struct memstat *mstat);
+void     mem_profile_enable(bool enable);
+int      mem_arena_enable(size_t size);
+int      mem_arena_debug(struct re_printf *pf, void *unused);
+int      mem_profile_print(struct re_printf *pf, unsigned n);
+
+
+/* Pools of fixed-size memory objects */
+struct mem_pool;
+
+int   mem_pool_alloc(struct mem_pool **poolp, size_t nobj, size_t objsize,
+		     mem_destroy_h *dh);
+void *mem_pool_get(struct mem_pool *pool);
+int   mem_pool_debug(struct re_printf *pf, const struct mem_pool *pool);
+
+
+/* Accounting of memory objects, e.g. per call, also in release builds */
+struct mem_acct;
+
+int   mem_acct_alloc(struct mem_acct **acctp, const char *name);
+struct mem_acct *mem_acct_set(struct mem_acct *acct);
+int   mem_acct_stat(const struct mem_acct *acct, struct memstat *mstat);
+int   mem_acct_debug(struct re_printf *pf, const struct mem_acct *acct);
 
 
 /* Secure memory functions */
@@ -0,0 +1,89 @@
+/**
+ * @file re_metric.h  Interface to the metrics registry
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+
+/** Metric types */
+enum re_metric_type {
+	RE_METRIC_COUNTER = 0,
+	RE_METRIC_GAUGE,
+	RE_METRIC_HISTOGRAM,
+};
+
+enum {
+	RE_METRIC_SHARDS = 8,    /**< Storage shards, power of two     */
+	RE_METRIC_LINE   = 8,    /**< Values per cache line            */
+};
+
+/**
+ * Defines a metric. Metrics are static objects, defined with the
+ * RE_METRIC_* macros, and are added to the registry when they are first
+ * updated. Counters and histograms have one shard per RE_METRIC_LINE
+ * values, and a thread only updates its own shard.
+ */
+struct re_metric {
+	struct re_metric *next;  /**< Registry, set on first update    */
+	const char *name;        /**< Prometheus metric name           */
+	const char *labels;      /**< Labels, e.g. state="trying"      */
+	const char *help;        /**< Help text                        */
+	const uint64_t *boundv;  /**< Upper bounds of the buckets      */
+	uint32_t boundc;         /**< Number of bounds                 */
+	uint32_t stride;         /**< Values per shard                 */
+	uint64_t *shardv;        /**< Shards of stride values          */
+	enum re_metric_type type;
+	int reg;                 /**< Added to the registry            */
+};
+
+
+/** Number of values per shard of a histogram with n bounds */
+#define RE_METRIC_STRIDE(n) \
+	(((n) + 2 + RE_METRIC_LINE - 1) / RE_METRIC_LINE * RE_METRIC_LINE)
+
+#if defined(__GNUC__)
+#define RE_METRIC_ALIGNED __attribute__((aligned(64)))
+#else
+#define RE_METRIC_ALIGNED
+#endif
+
+/** Define a static counter, with optional labels */
+#define RE_METRIC_COUNTER_DEFINE(var, name, labels, help)                \
+	static uint64_t var##_shardv[RE_METRIC_SHARDS * RE_METRIC_LINE]  \
+		RE_METRIC_ALIGNED;                                       \
+	static struct re_metric var = {NULL, name, labels, help, NULL,   \
+				       0, RE_METRIC_LINE, var##_shardv,  \
+				       RE_METRIC_COUNTER, 0}
+
+/** Define a static gauge, with optional labels */
+#define RE_METRIC_GAUGE_DEFINE(var, name, labels, help)                  \
+	static uint64_t var##_shardv[RE_METRIC_LINE] RE_METRIC_ALIGNED;  \
+	static struct re_metric var = {NULL, name, labels, help, NULL,   \
+				       0, RE_METRIC_LINE, var##_shardv,  \
+				       RE_METRIC_GAUGE, 0}
+
+/** Define a static histogram, with an array of increasing upper bounds */
+#define RE_METRIC_HISTOGRAM_DEFINE(var, name, labels, help, bounds)      \
+	static uint64_t var##_shardv[RE_METRIC_SHARDS *                  \
+				     RE_METRIC_STRIDE(ARRAY_SIZE(bounds))] \
+		RE_METRIC_ALIGNED;                                       \
+	static struct re_metric var = {NULL, name, labels, help, bounds, \
+				       ARRAY_SIZE(bounds),               \
+				       RE_METRIC_STRIDE(ARRAY_SIZE(bounds)), \
+				       var##_shardv, RE_METRIC_HISTOGRAM, 0}
+
+
+void     re_metric_add(struct re_metric *m, uint64_t n);
+void     re_metric_gauge_add(struct re_metric *m, int64_t n);
+void     re_metric_gauge_set(struct re_metric *m, int64_t v);
+void     re_metric_observe(struct re_metric *m, uint64_t v);
+uint64_t re_metric_value(const struct re_metric *m);
+void     re_metric_register(struct re_metric *m);
+int      re_metrics_print(struct re_printf *pf, void *unused);
+
+
+/** Increment a counter */
+static inline void re_metric_inc(struct re_metric *m)
+{
+	re_metric_add(m, 1);
+}
@@ -72,4 +72,6 @@ int         mod_add(struct mod **mp, const struct mod_export *me);
 struct mod *mod_find(const char *name);
 const struct mod_export *mod_export(const struct mod *m);
 struct list *mod_list(void);
+void        mod_static_set(const struct mod_export *const *mev);
+void        mod_lazy_enable(bool enable);
 int         mod_debug(struct re_printf *pf, void *unused);
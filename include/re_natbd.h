@@ -126,3 +126,36 @@ int nat_genalg_alloc(struct nat_genalg **ngp, const struct sa *srv, int proto,
 		     const struct stun_conf *conf,
 		     nat_genalg_h *gh, void *arg);
 int nat_genalg_start(struct nat_genalg *ng);
+
+
+/*
+ * Combined NAT Behaviour Discovery
+ */
+struct nat_discovery;
+
+/** Defines the results of a combined NAT Behaviour Discovery */
+struct nat_discovery_result {
+	int maperr;                             /**< Mapping errorcode     */
+	enum nat_type mapping;                  /**< NAT Mapping type      */
+	int filterr;                            /**< Filtering errorcode   */
+	enum nat_type filtering;                /**< NAT Filtering type    */
+	int hperr;                              /**< Hairpinning errorcode */
+	bool hairpinning;                       /**< Hairpinning supported */
+	int lterr;                              /**< Lifetime errorcode    */
+	struct nat_lifetime_interval lifetime;  /**< Lifetime intervals    */
+};
+
+/**
+ * Defines the combined NAT Behaviour Discovery handler
+ *
+ * @param res Discovery results
+ * @param arg Handler argument
+ */
+typedef void (nat_discovery_h)(const struct nat_discovery_result *res,
+			       void *arg);
+
+int nat_discovery_alloc(struct nat_discovery **ndp, const struct sa *laddr,
+			const struct sa *srv, uint32_t lifetime,
+			const struct stun_conf *conf,
+			nat_discovery_h *dh, void *arg);
+int nat_discovery_start(struct nat_discovery *nd);
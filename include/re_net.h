@@ -52,6 +52,9 @@ void net_sock_close(void);
 /* Net socket options */
 int net_sockopt_blocking_set(int fd, bool blocking);
 int net_sockopt_reuse_set(int fd, bool reuse);
+int net_sockopt_reuseport_set(int fd, bool reuse);
+int net_sockopt_incoming_cpu_set(int fd, int cpu);
+int net_sockopt_busy_poll_set(int fd, uint32_t usec);
 
 
 /* Net interface (if.c) */
@@ -102,6 +105,21 @@ int net_rt_default_get(int af, char *ifname, size_t size);
 int net_rt_debug(struct re_printf *pf, void *unused);
 
 
+/* Net monitor */
+
+struct net_mon;
+
+/**
+ * Defines the network change handler, called after interfaces, addresses
+ * or routes changed
+ *
+ * @param arg Handler argument
+ */
+typedef void (net_change_h)(void *arg);
+
+int net_mon_alloc(struct net_mon **nmp, net_change_h *changeh, void *arg);
+
+
 /* Net strings */
 const char *net_proto2name(int proto);
 const char *net_af2name(int af);
@@ -16,7 +16,12 @@ enum odict_type {
 
 struct odict {
 	struct list lst;
-	struct hash *ht;
+	struct hash *ht;   /**< Only for more than ODICT_SMALL entries */
+	uint32_t hsize;
+};
+
+enum {
+	ODICT_SMALL = 8,   /**< Entries that are looked up linearly */
 };
 
 struct odict_entry {
@@ -0,0 +1,26 @@
+/**
+ * @file re_probe.h  Static probe points (USDT)
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+
+/*
+ * The probes in the library are compiled in with RE_USDT_ENABLED, and
+ * are then listed by e.g. "bpftrace -l 'usdt:libre.so:re:*'". A probe
+ * that is not attached costs a single nop. The arguments must be
+ * integers or pointers.
+ */
+
+#ifdef RE_USDT_ENABLED
+#include <sys/sdt.h>
+#define RE_PROBE0(n)              DTRACE_PROBE(re, n)
+#define RE_PROBE1(n, a)           DTRACE_PROBE1(re, n, a)
+#define RE_PROBE2(n, a, b)        DTRACE_PROBE2(re, n, a, b)
+#define RE_PROBE3(n, a, b, c)     DTRACE_PROBE3(re, n, a, b, c)
+#else
+#define RE_PROBE0(n)
+#define RE_PROBE1(n, a)
+#define RE_PROBE2(n, a, b)
+#define RE_PROBE3(n, a, b, c)
+#endif
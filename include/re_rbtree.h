@@ -0,0 +1,107 @@
+/**
+ * @file re_rbtree.h  Interface to Red-black tree
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+
+struct rbtree;
+
+/** Red-black tree node, embedded in the user-data */
+struct rbnode {
+	struct rbnode *parent;  /**< Parent node (NULL for the root)     */
+	struct rbnode *left;    /**< Left child                          */
+	struct rbnode *right;   /**< Right child                         */
+	struct rbtree *tree;    /**< Parent tree (NULL if not linked-in) */
+	void *data;             /**< User-data                           */
+	bool red;               /**< Node colour                         */
+};
+
+/** Red-black tree node Initializer */
+#define RBNODE_INIT {NULL, NULL, NULL, NULL, NULL, false}
+
+
+/** Defines a red-black tree */
+struct rbtree {
+	struct rbnode *root;  /**< Root node               */
+	uint32_t count;       /**< Number of nodes         */
+};
+
+/** Red-black tree Initializer */
+#define RBTREE_INIT {NULL, 0}
+
+
+/**
+ * Defines the red-black tree compare handler
+ *
+ * @param a   First node
+ * @param b   Second node
+ * @param arg Handler argument
+ *
+ * @return Less than, equal to or greater than zero if a is ordered before,
+ *         together with or after b
+ */
+typedef int (rbtree_cmp_h)(const struct rbnode *a, const struct rbnode *b,
+			   void *arg);
+
+/**
+ * Defines the red-black tree find handler
+ *
+ * @param node Node
+ * @param arg  Handler argument
+ *
+ * @return Less than, equal to or greater than zero if the key that is
+ *         looked for is ordered before, at or after the node
+ */
+typedef int (rbtree_find_h)(const struct rbnode *node, void *arg);
+
+/**
+ * Defines the red-black tree apply handler
+ *
+ * @param node Node
+ * @param arg  Handler argument
+ *
+ * @return true to stop traversing, false to continue
+ */
+typedef bool (rbtree_apply_h)(struct rbnode *node, void *arg);
+
+
+void rbtree_init(struct rbtree *tree);
+void rbtree_flush(struct rbtree *tree);
+void rbtree_clear(struct rbtree *tree);
+void rbtree_insert(struct rbtree *tree, struct rbnode *node,
+		   rbtree_cmp_h *cmph, void *arg, void *data);
+void rbtree_unlink(struct rbnode *node);
+struct rbnode *rbtree_find(const struct rbtree *tree, rbtree_find_h *fh,
+			   void *arg);
+struct rbnode *rbtree_apply(const struct rbtree *tree, bool fwd,
+			    rbtree_apply_h *ah, void *arg);
+struct rbnode *rbtree_first(const struct rbtree *tree);
+struct rbnode *rbtree_last(const struct rbtree *tree);
+struct rbnode *rbnode_next(const struct rbnode *node);
+struct rbnode *rbnode_prev(const struct rbnode *node);
+uint32_t rbtree_count(const struct rbtree *tree);
+
+
+/**
+ * Get the user-data from a red-black tree node
+ *
+ * @param node Node
+ *
+ * @return Pointer to user-data
+ */
+static inline void *rbnode_data(const struct rbnode *node)
+{
+	return node ? node->data : NULL;
+}
+
+
+static inline bool rbtree_isempty(const struct rbtree *tree)
+{
+	return tree ? tree->root == NULL : true;
+}
+
+
+#define RBTREE_FOREACH(tree, node)				\
+	for ((node) = rbtree_first((tree)); (node);		\
+	     (node) = rbnode_next((node)))
@@ -0,0 +1,48 @@
+/**
+ * @file re_reactor.h  Interface to a pool of event loop threads
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+struct reactor;
+struct reactor_pool;
+
+/**
+ * Defines the reactor init handler, called from the reactor thread before
+ * its main loop is started
+ *
+ * @param r   Reactor
+ * @param arg Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+typedef int  (reactor_init_h)(struct reactor *r, void *arg);
+
+/**
+ * Defines the reactor close handler, called from the reactor thread after
+ * its main loop has stopped
+ *
+ * @param r   Reactor
+ * @param arg Handler argument
+ */
+typedef void (reactor_close_h)(struct reactor *r, void *arg);
+
+/**
+ * Defines a work handler, called from the reactor thread
+ *
+ * @param arg Handler argument
+ */
+typedef void (reactor_work_h)(void *arg);
+
+int  reactor_pool_alloc(struct reactor_pool **poolp, unsigned n, bool pin,
+			reactor_init_h *inith, reactor_close_h *closeh,
+			void *arg);
+unsigned reactor_pool_count(const struct reactor_pool *pool);
+struct reactor *reactor_pool_get(const struct reactor_pool *pool,
+				 unsigned idx);
+int  reactor_pool_post(struct reactor_pool *pool, unsigned idx,
+		       reactor_work_h *h, void *arg);
+int  reactor_post(struct reactor *r, reactor_work_h *h, void *arg);
+unsigned reactor_index(const struct reactor *r);
+int  reactor_cpu(const struct reactor *r);
+struct reactor *reactor_current(void);
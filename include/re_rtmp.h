@@ -107,6 +107,18 @@ int rtmp_amf_reply(struct rtmp_conn *conn, uint32_t stream_id, bool success,
 int rtmp_amf_data(const struct rtmp_conn *conn, uint32_t stream_id,
 		  const char *command, unsigned body_propc, ...);
 
+/** Defines a decoded AMF0 value, that points into the buffer */
+struct rtmp_amf_value {
+	enum rtmp_amf_type type;  /**< Value type                          */
+	double num;               /**< Number, or strict array length      */
+	bool boolean;             /**< Boolean                             */
+	struct pl str;            /**< String, or object and array members */
+};
+
+int rtmp_amf_next(struct rtmp_amf_value *val, struct mbuf *mb);
+int rtmp_amf_prop_next(struct pl *key, struct rtmp_amf_value *val,
+		       struct mbuf *mb);
+
 
 /* stream */
 struct rtmp_stream;
@@ -140,3 +152,13 @@ struct rtmp_stream *rtmp_stream_find(const struct rtmp_conn *conn,
 
 
 const char *rtmp_event_name(enum rtmp_event_type event);
+
+
+/* relay */
+struct rtmp_relay;
+
+int  rtmp_relay_alloc(struct rtmp_relay **relayp);
+int  rtmp_relay_add(struct rtmp_relay *relay, struct rtmp_stream *strm);
+void rtmp_relay_remove(struct rtmp_stream *strm);
+int  rtmp_relay_send(struct rtmp_relay *relay, enum rtmp_packet_type type,
+		     uint32_t timestamp, const uint8_t *pld, size_t len);
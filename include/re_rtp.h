@@ -31,6 +31,31 @@ struct rtp_header {
 	} x;
 };
 
+enum {
+	RTP_EXT_SLOTS = 16  /**< Slots of rtp_ext_slots(), for IDs 0-15 */
+};
+
+/** Defines an RTP header extension element (RFC 8285) */
+struct rtp_ext {
+	uint8_t id;            /**< Extension ID            */
+	uint8_t len;           /**< Length of data          */
+	const uint8_t *data;   /**< Data, in the RTP packet */
+};
+
+/** Iterator over the header extension elements of an RTP packet */
+struct rtp_ext_iter {
+	const uint8_t *p;
+	const uint8_t *end;
+	bool twobyte;
+};
+
+/** Header extension block encoder */
+struct rtp_ext_enc {
+	struct mbuf *mb;
+	size_t start;
+	bool twobyte;
+};
+
 /** RTCP Packet Types */
 enum rtcp_type {
 	RTCP_FIR   = 192,  /**< Full INTRA-frame Request (RFC 2032)    */
@@ -61,7 +86,8 @@ enum rtcp_sdes_type {
 
 /** Transport Layer Feedback Messages */
 enum rtcp_rtpfb {
-	RTCP_RTPFB_GNACK = 1  /**< Generic NACK */
+	RTCP_RTPFB_GNACK = 1,  /**< Generic NACK                */
+	RTCP_RTPFB_TWCC  = 15  /**< Transport-wide CC feedback  */
 };
 
 /** Payload-Specific Feedback Messages */
@@ -167,12 +193,31 @@ struct rtcp_msg {
 					uint8_t picid;
 				} *sliv;
 				struct mbuf *afb;
+				struct mbuf *twcc;
 				void *p;
 			} fci;
 		} fb;
 	} r;
 };
 
+/**
+ * One RTCP Message decoded in place, without allocations. The report
+ * blocks, BYE sources and reason are kept in the view, and APP data
+ * points into the buffer. SDES and feedback messages are not decoded;
+ * their body is in body/len and complete is false.
+ */
+struct rtcp_view {
+	struct rtcp_msg msg;              /**< Message, points into the view */
+	union {
+		struct rtcp_rr rrv[31];   /**< Reception report blocks       */
+		uint32_t srcv[31];        /**< BYE sources                   */
+	} u;
+	char reason[256];                 /**< BYE reason                    */
+	const uint8_t *body;              /**< Message body after the header */
+	size_t len;                       /**< Length of body                */
+	bool complete;                    /**< True if msg is fully decoded  */
+};
+
 /** RTCP Statistics */
 struct rtcp_stats {
 	struct {
@@ -191,17 +236,37 @@ struct rtcp_stats {
 struct sa;
 struct re_printf;
 struct rtp_sock;
+struct rtp_portpool;
 
 typedef void (rtp_recv_h)(const struct sa *src, const struct rtp_header *hdr,
 			  struct mbuf *mb, void *arg);
 typedef void (rtcp_recv_h)(const struct sa *src, struct rtcp_msg *msg,
 			   void *arg);
 
+/** Defines a received RTP packet in a batch */
+struct rtp_pkt {
+	struct sa src;          /**< Source address            */
+	struct rtp_header hdr;  /**< Decoded RTP header         */
+	struct mbuf *mb;        /**< Payload, at mb->pos        */
+};
+
+/**
+ * Defines the batched RTP Receive handler
+ *
+ * @param pktv Array of received RTP packets, in order of arrival
+ * @param n    Number of packets
+ * @param arg  Handler argument
+ */
+typedef void (rtp_batch_h)(const struct rtp_pkt *pktv, size_t n, void *arg);
+
 /* RTP api */
 int   rtp_alloc(struct rtp_sock **rsp);
 int   rtp_listen(struct rtp_sock **rsp, int proto, const struct sa *ip,
 		 uint16_t min_port, uint16_t max_port, bool enable_rtcp,
 		 rtp_recv_h *recvh, rtcp_recv_h *rtcph, void *arg);
+int   rtp_listen_pool(struct rtp_sock **rsp, int proto, const struct sa *ip,
+		      struct rtp_portpool *pool, bool enable_rtcp,
+		      rtp_recv_h *recvh, rtcp_recv_h *rtcph, void *arg);
 int   rtp_hdr_encode(struct mbuf *mb, const struct rtp_header *hdr);
 int   rtp_hdr_decode(struct rtp_header *hdr, struct mbuf *mb);
 int   rtp_encode(struct rtp_sock *rs, bool ext, bool marker, uint8_t pt,
@@ -209,18 +274,88 @@ int   rtp_encode(struct rtp_sock *rs, bool ext, bool marker, uint8_t pt,
 int   rtp_decode(struct rtp_sock *rs, struct mbuf *mb, struct rtp_header *hdr);
 int   rtp_send(struct rtp_sock *rs, const struct sa *dst, bool ext,
 	       bool marker, uint8_t pt, uint32_t ts, struct mbuf *mb);
+int   rtp_fastpath_set(struct rtp_sock *rs, const struct sa *peer);
+int   rtp_batch_handler_set(struct rtp_sock *rs, rtp_batch_h *batchh,
+			    unsigned max);
+int   rtp_history_set(struct rtp_sock *rs, uint32_t size);
+void  rtp_rtx_set(struct rtp_sock *rs, bool enable, uint8_t pt,
+		  uint32_t ssrc);
+int   rtp_resend(struct rtp_sock *rs, const struct sa *dst, uint16_t seq);
+int   rtp_nack_resend(struct rtp_sock *rs, const struct sa *dst,
+		      const struct rtcp_msg *msg);
+size_t rtp_headroom(const struct rtp_sock *rs);
+struct mbuf *rtp_mbuf_alloc(const struct rtp_sock *rs, size_t size);
 int   rtp_debug(struct re_printf *pf, const struct rtp_sock *rs);
 void *rtp_sock(const struct rtp_sock *rs);
 uint32_t rtp_sess_ssrc(const struct rtp_sock *rs);
 const struct sa *rtp_local(const struct rtp_sock *rs);
 
+/* RTP header extensions */
+int   rtp_ext_iter_init(struct rtp_ext_iter *it,
+			const struct rtp_header *hdr, const struct mbuf *mb);
+bool  rtp_ext_next(struct rtp_ext_iter *it, struct rtp_ext *ext);
+unsigned rtp_ext_slots(struct rtp_ext *slotv, const struct rtp_header *hdr,
+		       const struct mbuf *mb);
+bool  rtp_ext_find(struct rtp_ext *ext, const struct rtp_header *hdr,
+		   const struct mbuf *mb, uint8_t id);
+int   rtp_ext_begin(struct rtp_ext_enc *enc, struct mbuf *mb, bool twobyte);
+int   rtp_ext_write(struct rtp_ext_enc *enc, uint8_t id, const void *data,
+		    size_t len);
+int   rtp_ext_end(struct rtp_ext_enc *enc);
+int   rtp_ext_write_abs_send_time(struct rtp_ext_enc *enc, uint8_t id,
+				  uint64_t us);
+int   rtp_ext_write_twcc(struct rtp_ext_enc *enc, uint8_t id, uint16_t seq);
+int   rtp_ext_write_audio_level(struct rtp_ext_enc *enc, uint8_t id,
+				bool vad, uint8_t level);
+int   rtp_ext_write_mid(struct rtp_ext_enc *enc, uint8_t id,
+			const char *mid);
+
+/* RTP BUNDLE demultiplexing */
+struct rtp_stream;
+
+int   rtp_stream_alloc(struct rtp_stream **stp, struct rtp_sock *rs,
+		       const char *mid, rtp_recv_h *recvh, void *arg);
+int   rtp_stream_ssrc_add(struct rtp_stream *st, uint32_t ssrc);
+int   rtp_stream_mid_extid_set(struct rtp_sock *rs, uint8_t id);
+int   rtp_stream_stats(const struct rtp_stream *st,
+		       struct rtcp_stats *stats);
+uint32_t rtp_stream_ssrc(const struct rtp_stream *st);
+
+/* Transport-wide congestion control */
+struct rtp_twcc;
+
+int   rtp_twcc_alloc(struct rtp_twcc **twp, struct rtp_sock *rs,
+		     uint8_t extid);
+int   rtp_twcc_ext_write(struct rtp_twcc *tw, struct rtp_ext_enc *enc);
+void  rtp_twcc_bitrate_set(struct rtp_twcc *tw, uint32_t start,
+			   uint32_t rmin, uint32_t rmax);
+uint32_t rtp_twcc_bitrate(const struct rtp_twcc *tw);
+int   rtp_twcc_debug(struct re_printf *pf, const struct rtp_twcc *tw);
+
+/* RTP pacer */
+struct rtp_pacer;
+
+int   rtp_pacer_alloc(struct rtp_pacer **pacerp, struct rtp_sock *rs,
+		      uint32_t bitrate, uint32_t burst);
+void  rtp_pacer_set(struct rtp_pacer *pacer, uint32_t bitrate,
+		    uint32_t burst);
+int   rtp_pacer_send(struct rtp_pacer *pacer, const struct sa *dst,
+		     bool ext, bool marker, uint8_t pt, uint32_t ts,
+		     struct mbuf *mb);
+uint32_t rtp_pacer_qlen(const struct rtp_pacer *pacer);
+
 /* RTCP session api */
+struct rtcp_sched;
+
+int   rtcp_sched_alloc(struct rtcp_sched **schedp);
 void  rtcp_start(struct rtp_sock *rs, const char *cname,
 		 const struct sa *peer);
 void  rtcp_enable_mux(struct rtp_sock *rs, bool enabled);
 void  rtcp_set_srate(struct rtp_sock *rs, uint32_t sr_tx, uint32_t sr_rx);
 void  rtcp_set_srate_tx(struct rtp_sock *rs, uint32_t srate_tx);
 void  rtcp_set_srate_rx(struct rtp_sock *rs, uint32_t srate_rx);
+void  rtcp_set_max_members(struct rtp_sock *rs, uint32_t max);
+void  rtcp_set_sched(struct rtp_sock *rs, struct rtcp_sched *sched);
 int   rtcp_send_app(struct rtp_sock *rs, const char name[4],
 		    const uint8_t *data, size_t len);
 int   rtcp_send_fir(struct rtp_sock *rs, uint32_t ssrc);
@@ -230,9 +365,16 @@ int   rtcp_debug(struct re_printf *pf, const struct rtp_sock *rs);
 void *rtcp_sock(const struct rtp_sock *rs);
 int   rtcp_stats(struct rtp_sock *rs, uint32_t ssrc, struct rtcp_stats *stats);
 
+/* Port pool */
+int      rtp_portpool_alloc(struct rtp_portpool **poolp, uint16_t min_port,
+			    uint16_t max_port);
+uint32_t rtp_portpool_count(const struct rtp_portpool *pool);
+
+
 /* RTCP utils */
 int   rtcp_encode(struct mbuf *mb, enum rtcp_type type, uint32_t count, ...);
 int   rtcp_decode(struct rtcp_msg **msgp, struct mbuf *mb);
+int   rtcp_view_decode(struct rtcp_view *v, struct mbuf *mb);
 int   rtcp_msg_print(struct re_printf *pf, const struct rtcp_msg *msg);
 int   rtcp_sdes_encode(struct mbuf *mb, uint32_t src, uint32_t itemc, ...);
 const char *rtcp_type_name(enum rtcp_type type);
@@ -200,7 +200,6 @@ struct sip_msg {
 	struct pl maxfwd;      /**< Cached Max-Forwards header           */
 	struct pl expires;     /**< Cached Expires header                */
 	struct pl clen;        /**< Cached Content-Length header         */
-	struct hash *hdrht;    /**< Hash-table with all SIP headers      */
 	struct mbuf *mb;       /**< Buffer containing the SIP message    */
 	void *sock;            /**< Transport socket                     */
 	uint64_t tag;          /**< Opaque tag                           */
@@ -225,6 +224,7 @@ struct sip;
 struct sip_lsnr;
 struct sip_request;
 struct sip_strans;
+struct sip_rtmpl;
 struct sip_auth;
 struct sip_dialog;
 struct sip_keepalive;
@@ -259,6 +259,8 @@ int  sip_debug(struct re_printf *pf, const struct sip *sip);
 int  sip_send(struct sip *sip, void *sock, enum sip_transp tp,
 	      const struct sa *dst, struct mbuf *mb);
 void sip_set_trace_handler(struct sip *sip, sip_trace_h *traceh);
+void sip_set_lazy(struct sip *sip, bool lazy);
+int  sip_set_compact(struct sip *sip, enum sip_transp tp, bool enable);
 
 
 /* transport */
@@ -287,11 +289,23 @@ int sip_drequestf(struct sip_request **reqp, struct sip *sip, bool stateful,
 		  const char *met, struct sip_dialog *dlg, uint32_t cseq,
 		  struct sip_auth *auth, sip_send_h *sendh, sip_resp_h *resph,
 		  void *arg, const char *fmt, ...);
+int sip_drequestf_route(struct sip_request **reqp, struct sip *sip,
+			bool stateful, const char *met,
+			struct sip_dialog *dlg, uint32_t cseq,
+			struct sip_auth *auth, const struct uri *route,
+			sip_send_h *sendh, sip_resp_h *resph, void *arg,
+			const char *fmt, ...);
 void sip_request_cancel(struct sip_request *req);
 bool sip_request_loops(struct sip_loopstate *ls, uint16_t scode);
 void sip_loopstate_reset(struct sip_loopstate *ls);
 
 
+/* forward */
+int  sip_forward_stateless(struct sip *sip, const struct sip_msg *msg,
+			   enum sip_transp tp, const struct sa *dst,
+			   const char *ruri, bool route_pop);
+
+
 /* reply */
 int  sip_strans_alloc(struct sip_strans **stp, struct sip *sip,
 		      const struct sip_msg *msg, sip_cancel_h *cancelh,
@@ -309,6 +323,13 @@ int  sip_replyf(struct sip *sip, const struct sip_msg *msg, uint16_t scode,
 int  sip_reply(struct sip *sip, const struct sip_msg *msg, uint16_t scode,
 	       const char *reason);
 void sip_reply_addr(struct sa *addr, const struct sip_msg *msg, bool rport);
+int  sip_rtmpl_alloc(struct sip_rtmpl **tmplp, struct sip *sip,
+		     bool rec_route, uint16_t scode, const char *reason,
+		     const char *fmt, ...);
+int  sip_rtmpl_treply(struct sip_strans **stp, struct sip *sip,
+		      const struct sip_rtmpl *tmpl, const struct sip_msg *msg);
+int  sip_rtmpl_reply(struct sip *sip, const struct sip_rtmpl *tmpl,
+		     const struct sip_msg *msg);
 
 
 /* auth */
@@ -316,6 +337,9 @@ int  sip_auth_authenticate(struct sip_auth *auth, const struct sip_msg *msg);
 int  sip_auth_alloc(struct sip_auth **authp, sip_auth_h *authh,
 		    void *arg, bool ref);
 void sip_auth_reset(struct sip_auth *auth);
+int  sip_auth_import(struct sip_auth *auth, const struct sip_auth *src);
+int  sip_auth_snap_encode(struct mbuf *mb, const struct sip_auth *auth);
+int  sip_auth_snap_decode(struct sip_auth *auth, struct mbuf *mb);
 
 
 /* contact */
@@ -325,6 +349,13 @@ int  sip_contact_print(struct re_printf *pf,
 		       const struct sip_contact *contact);
 
 
+/* overload */
+int  sip_overload_set(struct sip *sip, uint32_t lag_max, uint32_t strans_max,
+		      uint32_t retry_after, bool via_oc);
+uint32_t sip_overload_get(const struct sip *sip, uint64_t *lag,
+			  uint64_t *rejected);
+
+
 /* dialog */
 int  sip_dialog_alloc(struct sip_dialog **dlgp,
 		      const char *uri, const char *to_uri,
@@ -342,10 +373,20 @@ bool sip_dialog_established(const struct sip_dialog *dlg);
 bool sip_dialog_cmp(const struct sip_dialog *dlg, const struct sip_msg *msg);
 bool sip_dialog_cmp_half(const struct sip_dialog *dlg,
 			 const struct sip_msg *msg);
+uint32_t sip_dialog_key(const struct sip_dialog *dlg);
+uint32_t sip_dialog_msg_key(const struct sip_msg *msg, bool full);
+struct snap;
+int  sip_dialog_snap(struct snap *snap, const struct sip_dialog *dlg);
+int  sip_dialog_snap_encode(struct mbuf *mb, const struct sip_dialog *dlg);
+int  sip_dialog_snap_decode(struct sip_dialog **dlgp, struct mbuf *mb);
 
 
 /* msg */
 int sip_msg_decode(struct sip_msg **msgp, struct mbuf *mb);
+int sip_msg_decode_lazy(struct sip_msg **msgp, struct mbuf *mb);
+const struct sip_taddr *sip_msg_to(const struct sip_msg *msg);
+const struct sip_taddr *sip_msg_from(const struct sip_msg *msg);
+const struct msg_ctype *sip_msg_ctype(const struct sip_msg *msg);
 const struct sip_hdr *sip_msg_hdr(const struct sip_msg *msg,
 				  enum sip_hdrid id);
 const struct sip_hdr *sip_msg_hdr_apply(const struct sip_msg *msg,
@@ -72,6 +72,7 @@ int sipevent_notify(struct sipnot *sipnot, struct mbuf *mb,
 int sipevent_notifyf(struct sipnot *sipnot, struct mbuf **mbp,
 		     enum sipevent_subst state, enum sipevent_reason reason,
 		     uint32_t retry_after, const char *fmt, ...);
+int sipevent_notify_interval(struct sipnot *sipnot, uint32_t interval);
 
 
 /* Subscriber */
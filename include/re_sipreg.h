@@ -5,6 +5,7 @@
  */
 
 struct sipreg;
+struct sipreg_group;
 
 
 int sipreg_register(struct sipreg **regp, struct sip *sip, const char *reg_uri,
@@ -20,3 +21,19 @@ int sipreg_set_rwait(struct sipreg *reg, uint32_t rwait);
 const struct sa *sipreg_laddr(const struct sipreg *reg);
 
 uint32_t sipreg_proxy_expires(const struct sipreg *reg);
+
+int sipreg_group_alloc(struct sipreg_group **grpp, struct sip *sip,
+		       uint32_t rate, uint32_t jitter);
+int sipreg_group_register(struct sipreg **regp, struct sipreg_group *grp,
+			  const char *reg_uri, const char *to_uri,
+			  const char *from_name, const char *from_uri,
+			  uint32_t expires, const char *cuser,
+			  const char *routev[], uint32_t routec, int regid,
+			  sip_auth_h *authh, void *aarg, bool aref,
+			  sip_resp_h *resph, void *arg,
+			  const char *params, const char *fmt, ...);
+
+struct snap;
+int      sipreg_snap(const struct sipreg *reg, struct snap *snap);
+uint32_t sipreg_group_restore(struct sipreg_group *grp,
+			      const struct snap *snap);
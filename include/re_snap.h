@@ -0,0 +1,43 @@
+/**
+ * @file re_snap.h  Interface to state snapshots for warm restarts
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+
+/** Snapshot record types */
+enum snap_type {
+	SNAP_DNS_CACHE = 1,       /**< DNS Client cached answer        */
+	SNAP_TLS_SESS  = 2,       /**< TLS client session              */
+	SNAP_SIPREG    = 3,       /**< SIP Registration binding        */
+	SNAP_DIALOG    = 4,       /**< SIP Dialog                      */
+	SNAP_APP       = 0x8000,  /**< First application record type   */
+};
+
+struct snap;
+struct mbuf;
+
+/**
+ * Defines the snapshot record handler
+ *
+ * @param type Record type
+ * @param mb   Record contents, only valid in the handler
+ * @param arg  Handler argument
+ *
+ * @return True to stop traversing, False to continue
+ */
+typedef bool (snap_record_h)(uint16_t type, struct mbuf *mb, void *arg);
+
+int      snap_alloc(struct snap **snapp);
+int      snap_record_begin(struct snap *snap, uint16_t type,
+			   struct mbuf **mbp);
+int      snap_record_end(struct snap *snap, int err);
+int      snap_save(const struct snap *snap, const char *path);
+int      snap_load(struct snap **snapp, const char *path);
+int      snap_apply(const struct snap *snap, uint16_t type,
+		    snap_record_h *rh, void *arg);
+uint32_t snap_count(const struct snap *snap);
+uint32_t snap_age(const struct snap *snap);
+
+int      snap_str_encode(struct mbuf *mb, const char *str);
+int      snap_str_decode(struct mbuf *mb, char **strp);
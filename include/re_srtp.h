@@ -24,7 +24,13 @@ int srtp_alloc(struct srtp **srtpp, enum srtp_suite suite,
 	       const uint8_t *key, size_t key_bytes, int flags);
 int srtp_encrypt(struct srtp *srtp, struct mbuf *mb);
 int srtp_decrypt(struct srtp *srtp, struct mbuf *mb);
+int srtp_encrypt_batch(struct srtp *srtp, struct mbuf * const *mbv,
+		       size_t n, int *errv);
+int srtp_decrypt_batch(struct srtp *srtp, struct mbuf * const *mbv,
+		       size_t n, int *errv);
 int srtcp_encrypt(struct srtp *srtp, struct mbuf *mb);
 int srtcp_decrypt(struct srtp *srtp, struct mbuf *mb);
+void srtp_max_streams_set(struct srtp *srtp, uint32_t n);
+int srtp_replay_window_set(struct srtp *srtp, uint32_t size);
 
 const char *srtp_suite_name(enum srtp_suite suite);
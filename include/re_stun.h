@@ -154,6 +154,28 @@ struct stun_attr {
 };
 
 
+/** Number of known STUN attributes, see enum stun_attrib */
+enum {
+	STUN_VIEW_ATTRS = 30
+};
+
+/** STUN attribute of a STUN message view, pointing into the packet */
+struct stun_vattr {
+	const uint8_t *p;  /**< Attribute value, NULL if not present */
+	size_t len;        /**< Number of bytes in attribute value   */
+};
+
+/** STUN message decoded in place, without any allocations */
+struct stun_view {
+	uint8_t *buf;                /**< Start of STUN message           */
+	uint16_t type;               /**< Message type                    */
+	uint16_t len;                /**< Payload length                  */
+	uint32_t cookie;             /**< Magic cookie                    */
+	const uint8_t *tid;          /**< Transaction ID                  */
+	struct stun_vattr attrv[STUN_VIEW_ATTRS];  /**< Known attributes */
+};
+
+
 /** STUN Configuration */
 struct stun_conf {
 	uint32_t rto;  /**< RTO Retransmission TimeOut [ms]        */
@@ -168,6 +190,8 @@ extern const char *stun_software;
 struct stun;
 struct stun_msg;
 struct stun_ctrans;
+struct hmac;
+struct pl;
 
 typedef void(stun_resp_h)(int err, uint16_t scode, const char *reason,
 			  const struct stun_msg *msg, void *arg);
@@ -219,9 +243,29 @@ struct stun_attr *stun_msg_attr_apply(const struct stun_msg *msg,
 				      stun_attr_h *h, void *arg);
 int  stun_msg_chk_mi(const struct stun_msg *msg, const uint8_t *key,
 		     size_t keylen);
+int  stun_msg_chk_mi_hmac(const struct stun_msg *msg, struct hmac *hmac);
 int  stun_msg_chk_fingerprint(const struct stun_msg *msg);
 void stun_msg_dump(const struct stun_msg *msg);
 
+int  stun_view_decode(struct stun_view *view, struct mbuf *mb,
+		      struct stun_unknown_attr *ua);
+uint16_t stun_view_class(const struct stun_view *view);
+uint16_t stun_view_method(const struct stun_view *view);
+const struct stun_vattr *stun_view_attr(const struct stun_view *view,
+					uint16_t type);
+int  stun_view_addr(const struct stun_view *view, uint16_t type,
+		    struct sa *sa);
+int  stun_view_u32(const struct stun_view *view, uint16_t type,
+		   uint32_t *v);
+int  stun_view_u64(const struct stun_view *view, uint16_t type,
+		   uint64_t *v);
+int  stun_view_str(const struct stun_view *view, uint16_t type,
+		   struct pl *pl);
+int  stun_view_chk_mi(const struct stun_view *view, const uint8_t *key,
+		      size_t keylen);
+int  stun_view_chk_mi_hmac(const struct stun_view *view, struct hmac *hmac);
+int  stun_view_chk_fingerprint(const struct stun_view *view);
+
 const char *stun_class_name(uint16_t cls);
 const char *stun_method_name(uint16_t method);
 const char *stun_attr_name(uint16_t type);
@@ -259,6 +303,7 @@ int  stun_server_discover(struct stun_dns **dnsp, struct dnsc *dnsc,
 
 /* NAT Keepalives */
 struct stun_keepalive;
+struct stun_kasched;
 
 /**
  * Defines the STUN Keepalive Mapped-Address handler
@@ -275,6 +320,27 @@ int  stun_keepalive_alloc(struct stun_keepalive **skap,
 			  const struct sa *dst, const struct stun_conf *conf,
 			  stun_mapped_addr_h *mah, void *arg);
 void stun_keepalive_enable(struct stun_keepalive *ska, uint32_t interval);
+int  stun_keepalive_sched(struct stun_keepalive *ska,
+			  struct stun_kasched *ks);
+
+
+/* Shared keepalive scheduler */
+struct stun_kaent;
+struct udp_sock;
+
+/**
+ * Defines the handler of a keepalive scheduler entry
+ *
+ * @param arg Handler argument
+ */
+typedef void (stun_kasched_h)(void *arg);
+
+int  stun_kasched_alloc(struct stun_kasched **ksp, uint32_t interval,
+			uint32_t slotc);
+int  stun_kasched_add(struct stun_kaent **entp, struct stun_kasched *ks,
+		      stun_kasched_h *h, void *arg);
+int  stun_kasched_send(struct stun_kasched *ks, struct udp_sock *us,
+		       const struct sa *dst, struct mbuf *mb);
 
 
 /* STUN Reason Phrase */
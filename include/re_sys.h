@@ -66,8 +66,17 @@ uint64_t rand_u64(void);
 char     rand_char(void);
 void     rand_str(char *str, size_t size);
 void     rand_bytes(uint8_t *p, size_t size);
+uint16_t rand_fast_u16(void);
+uint32_t rand_fast_u32(void);
+uint64_t rand_fast_u64(void);
 
 
 /* File-System */
 int  fs_mkdir(const char *path, uint16_t mode);
 int  fs_gethome(char *path, size_t sz);
+
+
+/* Threads */
+int  sys_thread_affinity_set(int cpu);
+int  sys_thread_numa_local(void);
+int  sys_thread_priority_set(int prio);
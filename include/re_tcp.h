@@ -3,6 +3,7 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
+struct mbuf_chain;
 struct sa;
 struct tcp_sock;
 struct tcp_conn;
@@ -51,6 +52,9 @@ typedef void (tcp_close_h)(int err, void *arg);
 int  tcp_sock_alloc(struct tcp_sock **tsp, const struct sa *local,
 		    tcp_conn_h *ch, void *arg);
 struct tcp_sock *tcp_sock_dup(struct tcp_sock *tso);
+int  tcp_sock_reuseport_set(struct tcp_sock *ts, bool reuse);
+int  tcp_sock_fastopen_set(struct tcp_sock *ts, int qlen);
+void tcp_sock_accept_max_set(struct tcp_sock *ts, unsigned n);
 int  tcp_sock_bind(struct tcp_sock *ts, const struct sa *local);
 int  tcp_sock_listen(struct tcp_sock *ts, int backlog);
 int  tcp_accept(struct tcp_conn **tcp, struct tcp_sock *ts, tcp_estab_h *eh,
@@ -59,6 +63,13 @@ void tcp_reject(struct tcp_sock *ts);
 int  tcp_sock_local_get(const struct tcp_sock *ts, struct sa *local);
 
 
+/** Defines a slice of data to send with tcp_sendv() */
+struct tcp_vec {
+	const uint8_t *p;  /**< Data   */
+	size_t len;        /**< Length */
+};
+
+
 /* TCP Connection */
 int  tcp_conn_alloc(struct tcp_conn **tcp, const struct sa *peer,
 		    tcp_estab_h *eh, tcp_recv_h *rh, tcp_close_h *ch,
@@ -66,11 +77,19 @@ int  tcp_conn_alloc(struct tcp_conn **tcp, const struct sa *peer,
 int  tcp_conn_bind(struct tcp_conn *tc, const struct sa *local);
 int  tcp_conn_connect(struct tcp_conn *tc, const struct sa *peer);
 int  tcp_send(struct tcp_conn *tc, struct mbuf *mb);
+int  tcp_sendv(struct tcp_conn *tc, const struct tcp_vec *vv, size_t vc);
+int  tcp_send_chain(struct tcp_conn *tc, const struct mbuf_chain *mc);
+int  tcp_send_file(struct tcp_conn *tc, int fd, uint64_t offset, size_t len,
+		   size_t *sentp);
 int  tcp_set_send(struct tcp_conn *tc, tcp_send_h *sendh);
 void tcp_set_handlers(struct tcp_conn *tc, tcp_estab_h *eh, tcp_recv_h *rh,
 		      tcp_close_h *ch, void *arg);
 void tcp_conn_rxsz_set(struct tcp_conn *tc, size_t rxsz);
 void tcp_conn_txqsz_set(struct tcp_conn *tc, size_t txqsz);
+void tcp_conn_txref_set(struct tcp_conn *tc, bool enable);
+int  tcp_conn_zerocopy_set(struct tcp_conn *tc, bool enable);
+int  tcp_conn_cork(struct tcp_conn *tc, bool cork);
+int  tcp_conn_fastopen_set(struct tcp_conn *tc, bool enable);
 int  tcp_conn_local_get(const struct tcp_conn *tc, struct sa *local);
 int  tcp_conn_peer_get(const struct tcp_conn *tc, struct sa *peer);
 int  tcp_conn_fd(const struct tcp_conn *tc);
@@ -80,6 +99,8 @@ size_t tcp_conn_txqsz(const struct tcp_conn *tc);
 /* High-level API */
 int  tcp_listen(struct tcp_sock **tsp, const struct sa *local,
 		tcp_conn_h *ch, void *arg);
+int  tcp_listen_reuseport(struct tcp_sock **tsp, const struct sa *local,
+			  tcp_conn_h *ch, void *arg);
 int  tcp_connect(struct tcp_conn **tcp, const struct sa *peer,
 		 tcp_estab_h *eh, tcp_recv_h *rh, tcp_close_h *ch, void *arg);
 int  tcp_local_get(const struct tcp_sock *ts, struct sa *local);
@@ -98,5 +119,42 @@ int tcp_register_helper(struct tcp_helper **thp, struct tcp_conn *tc,
 			int layer,
 			tcp_helper_estab_h *eh, tcp_helper_send_h *sh,
 			tcp_helper_recv_h *rh, void *arg);
+void tcp_helper_set_passthru(struct tcp_helper *th, bool passthru);
 int tcp_send_helper(struct tcp_conn *tc, struct mbuf *mb,
 		    struct tcp_helper *th);
+int tcp_recv_helper(struct tcp_conn *tc, struct tcp_helper *th);
+
+
+/* Happy Eyeballs */
+struct tcp_he;
+
+/**
+ * Defines the Happy Eyeballs prepare handler, called for each connection
+ * attempt before it is established, e.g. to start TLS on it
+ *
+ * @param ctxp Pointer to an optional context object for the attempt
+ * @param tc   TCP Connection of the attempt
+ * @param peer Network address of peer
+ * @param arg  Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+typedef int (tcp_he_prep_h)(void **ctxp, struct tcp_conn *tc,
+			    const struct sa *peer, void *arg);
+
+/**
+ * Defines the Happy Eyeballs handler, called once with the first
+ * established connection or with an error when all attempts failed
+ *
+ * @param err  0 if connected, otherwise errorcode
+ * @param tc   Established TCP Connection, referenced by the caller
+ * @param ctx  Context object of the attempt, referenced by the caller
+ * @param peer Network address of peer
+ * @param arg  Handler argument
+ */
+typedef void (tcp_he_h)(int err, struct tcp_conn *tc, void *ctx,
+			const struct sa *peer, void *arg);
+
+int  tcp_he_connect(struct tcp_he **hep, const struct sa *addrv,
+		    uint32_t addrc, tcp_he_prep_h *preph, tcp_he_h *heh,
+		    void *arg);
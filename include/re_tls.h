@@ -59,7 +59,18 @@ int tls_srtp_keyinfo(const struct tls_conn *tc, enum srtp_suite *suite,
 const char *tls_cipher_name(const struct tls_conn *tc);
 int tls_set_ciphers(struct tls *tls, const char *cipherv[], size_t count);
 int tls_set_servername(struct tls_conn *tc, const char *servername);
+int tls_set_ktls(struct tls *tls, bool enable);
+bool tls_ktls_active(const struct tls_conn *tc);
+int tls_set_coalesce(struct tls *tls, bool enable);
+int tls_set_async(struct tls *tls, bool enable);
+int tls_set_alpn(struct tls *tls, const char *protov[], size_t protoc);
+int tls_alpn_get(const struct tls_conn *tc, struct pl *proto);
 int tls_set_verify_server(struct tls_conn *tc, const char *host);
+int tls_set_verify_cache(struct tls *tls, uint32_t ttl);
+
+struct snap;
+int      tls_sess_snap(struct tls *tls, struct snap *snap);
+uint32_t tls_sess_restore(struct tls *tls, const struct snap *snap);
 
 int tls_get_issuer(struct tls *tls, struct mbuf *mb);
 int tls_get_subject(struct tls *tls, struct mbuf *mb);
@@ -84,6 +95,8 @@ int dtls_listen(struct dtls_sock **sockp, const struct sa *laddr,
 		dtls_conn_h *connh, void *arg);
 struct udp_sock *dtls_udp_sock(struct dtls_sock *sock);
 void dtls_set_mtu(struct dtls_sock *sock, size_t mtu);
+int  dtls_set_offload(struct dtls_sock *sock, bool enable);
+int  dtls_set_cookie(struct dtls_sock *sock, bool enable);
 int dtls_connect(struct tls_conn **ptc, struct tls *tls,
 		 struct dtls_sock *sock, const struct sa *peer,
 		 dtls_estab_h *estabh, dtls_recv_h *recvh,
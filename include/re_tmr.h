@@ -17,18 +17,23 @@ struct tmr {
 	struct le le;       /**< Linked list element */
 	tmr_h *th;          /**< Timeout handler     */
 	void *arg;          /**< Handler argument    */
-	uint64_t jfs;       /**< Jiffies for timeout */
+	uint64_t jfs;       /**< Jiffies for timeout, [us] for tmr_start_us */
 };
 
 
 void     tmr_poll(struct list *tmrl);
+void     tmr_budget_set(uint32_t count, uint32_t usec);
 uint64_t tmr_jiffies(void);
+uint64_t tmr_jiffies_usec(void);
 uint64_t tmr_next_timeout(struct list *tmrl);
+uint64_t tmr_next_timeout_us(struct list *tmrl);
 void     tmr_debug(void);
 int      tmr_status(struct re_printf *pf, void *unused);
 
 void     tmr_init(struct tmr *tmr);
 void     tmr_start(struct tmr *tmr, uint64_t delay, tmr_h *th, void *arg);
+void     tmr_start_us(struct tmr *tmr, uint64_t delay, tmr_h *th,
+		      void *arg);
 void     tmr_cancel(struct tmr *tmr);
 uint64_t tmr_get_expire(const struct tmr *tmr);
 
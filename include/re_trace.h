@@ -0,0 +1,37 @@
+/**
+ * @file re_trace.h  Interface to event tracing
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+
+int  re_trace_init(const char *json_file);
+int  re_trace_close(void);
+int  re_trace_flush(void);
+void re_trace_begin(const char *cat, const char *name);
+void re_trace_end(const char *cat, const char *name);
+void re_trace_instant(const char *cat, const char *name);
+void re_trace_async_begin(const char *cat, const char *name, const void *id);
+void re_trace_async_end(const char *cat, const char *name, const void *id);
+uint64_t re_trace_dropped(void);
+
+
+/*
+ * The trace points in the library are compiled in with RE_TRACE_ENABLED.
+ * Category and name must be string literals, as they are written out
+ * later.
+ */
+
+#ifdef RE_TRACE_ENABLED
+#define RE_TRACE_BEGIN(c, n)            re_trace_begin((c), (n))
+#define RE_TRACE_END(c, n)              re_trace_end((c), (n))
+#define RE_TRACE_INSTANT(c, n)          re_trace_instant((c), (n))
+#define RE_TRACE_ASYNC_BEGIN(c, n, id)  re_trace_async_begin((c), (n), (id))
+#define RE_TRACE_ASYNC_END(c, n, id)    re_trace_async_end((c), (n), (id))
+#else
+#define RE_TRACE_BEGIN(c, n)
+#define RE_TRACE_END(c, n)
+#define RE_TRACE_INSTANT(c, n)
+#define RE_TRACE_ASYNC_BEGIN(c, n, id)
+#define RE_TRACE_ASYNC_END(c, n, id)
+#endif
@@ -31,3 +31,29 @@ int turnc_add_perm(struct turnc *turnc, const struct sa *peer,
 		   turnc_perm_h *ph, void *arg);
 int turnc_add_chan(struct turnc *turnc, const struct sa *peer,
 		   turnc_chan_h *ch, void *arg);
+void turnc_set_autochan(struct turnc *turnc, uint32_t pktc);
+
+
+/* TURN client manager */
+struct turnc_mgr;
+
+int turnc_mgr_alloc(struct turnc_mgr **mgrp, const struct stun_conf *conf);
+int turnc_mgr_add(struct turnc **turncp, struct turnc_mgr *mgr, int proto,
+		  void *sock, int layer, const struct sa *srv,
+		  const char *username, const char *password,
+		  uint32_t lifetime, turnc_h *th, void *arg);
+
+
+/* TURN Server */
+struct turnsrv;
+
+/* the key of a username is MD5(username:realm:password) */
+typedef int (turnsrv_auth_h)(const char *username, const char *realm,
+			     uint8_t *ha1, void *arg);
+
+int turnsrv_alloc(struct turnsrv **tsp, const struct sa *laddr,
+		  const struct sa *relay, const char *realm, bool reuseport,
+		  turnsrv_auth_h *authh, void *arg);
+int turnsrv_rxbatch_set(struct turnsrv *ts, unsigned n);
+struct udp_sock *turnsrv_sock(const struct turnsrv *ts);
+uint32_t turnsrv_nallocs(const struct turnsrv *ts);
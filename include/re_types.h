@@ -5,6 +5,7 @@
  */
 
 #include <sys/types.h>
+#include <stddef.h>
 
 #ifdef _MSC_VER
 #include <stdlib.h>
@@ -5,6 +5,7 @@
  */
 
 
+struct mbuf_chain;
 struct sa;
 struct udp_sock;
 
@@ -19,20 +20,72 @@ struct udp_sock;
 typedef void (udp_recv_h)(const struct sa *src, struct mbuf *mb, void *arg);
 typedef void (udp_error_h)(int err, void *arg);
 
+/**
+ * Defines the UDP end of burst handler
+ *
+ * @param arg Handler argument
+ */
+typedef void (udp_burst_h)(void *arg);
+
+/**
+ * Defines the timestamped UDP Receive handler
+ *
+ * @param src Source address
+ * @param mb  Datagram buffer
+ * @param ts  Kernel receive time in [ns] since the epoch, 0 if unknown
+ * @param arg Handler argument
+ */
+typedef void (udp_recv_ts_h)(const struct sa *src, struct mbuf *mb,
+			     uint64_t ts, void *arg);
+
+/** Defines a UDP Datagram for batched sending */
+struct udp_dgram {
+	const struct sa *dst;  /**< Destination network address */
+	struct mbuf *mb;       /**< Buffer to send              */
+	uint16_t segsz;        /**< Segment size, 0 for none    */
+};
+
+/** Steering of datagrams between the sockets of a SO_REUSEPORT group */
+enum udp_steer {
+	UDP_STEER_HASH = 0,  /**< Kernel hash of the address 4-tuple    */
+	UDP_STEER_CPU,       /**< CPU that received the datagram        */
+	UDP_STEER_ID,        /**< RTP/RTCP SSRC or STUN username prefix */
+};
+
 
 int  udp_listen(struct udp_sock **usp, const struct sa *local,
 		udp_recv_h *rh, void *arg);
+int  udp_listen_reuseport(struct udp_sock **usp, const struct sa *local,
+			  udp_recv_h *rh, void *arg);
+int  udp_reuseport_steer(struct udp_sock *us, enum udp_steer steer,
+			 unsigned n);
+unsigned udp_steer_index(uint32_t id, unsigned n);
 int  udp_connect(struct udp_sock *us, const struct sa *peer);
+int  udp_fastpath_set(struct udp_sock *us, const struct sa *peer);
 int  udp_send(struct udp_sock *us, const struct sa *dst, struct mbuf *mb);
+int  udp_send_gso(struct udp_sock *us, const struct sa *dst,
+		  struct mbuf *mb, uint16_t segsz);
+int  udp_send_batch(struct udp_sock *us, const struct udp_dgram *dv,
+		    size_t n, size_t *sentp);
 int  udp_send_anon(const struct sa *dst, struct mbuf *mb);
+int  udp_send_chain(struct udp_sock *us, const struct sa *dst,
+		    const struct mbuf_chain *mc);
+int  udp_set_cork(struct udp_sock *us, bool cork);
 int  udp_local_get(const struct udp_sock *us, struct sa *local);
 int  udp_setsockopt(struct udp_sock *us, int level, int optname,
 		    const void *optval, uint32_t optlen);
 int  udp_sockbuf_set(struct udp_sock *us, int size);
 void udp_rxsz_set(struct udp_sock *us, size_t rxsz);
+int  udp_gro_set(struct udp_sock *us, bool enable);
+int  udp_rxts_enable(struct udp_sock *us, udp_recv_ts_h *rh, void *arg);
+uint32_t udp_rx_drops(const struct udp_sock *us);
+int  udp_rxbatch_set(struct udp_sock *us, unsigned n);
+int  udp_rxbudget_set(struct udp_sock *us, unsigned budget);
 void udp_rxbuf_presz_set(struct udp_sock *us, size_t rx_presz);
+void udp_rxbuf_recycle_set(struct udp_sock *us, bool enable);
 void udp_handler_set(struct udp_sock *us, udp_recv_h *rh, void *arg);
 void udp_error_handler_set(struct udp_sock *us, udp_error_h *eh);
+void udp_burst_handler_set(struct udp_sock *us, udp_burst_h *bh);
 int  udp_thread_attach(struct udp_sock *us);
 void udp_thread_detach(struct udp_sock *us);
 int  udp_sock_fd(const struct udp_sock *us, int af);
@@ -57,3 +110,7 @@ int udp_register_helper(struct udp_helper **uhp, struct udp_sock *us,
 int udp_send_helper(struct udp_sock *us, const struct sa *dst,
 		    struct mbuf *mb, struct udp_helper *uh);
 struct udp_helper *udp_helper_find(const struct udp_sock *us, int layer);
+void udp_helper_room_set(struct udp_helper *uh, size_t headroom,
+			 size_t tailroom);
+size_t udp_headroom(const struct udp_sock *us);
+size_t udp_tailroom(const struct udp_sock *us);
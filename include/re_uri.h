@@ -18,6 +18,17 @@ struct uri {
 	struct pl headers;   /**< Optional URI-headers              */
 };
 
+enum {
+	URI_PARAMS_MAX = 16
+};
+
+/** Defines the decoded URI-parameters of a URI */
+struct uri_params {
+	struct pl namev[URI_PARAMS_MAX];  /**< Parameter names       */
+	struct pl valv[URI_PARAMS_MAX];   /**< Parameter values      */
+	uint32_t n;                       /**< Number of parameters  */
+};
+
 typedef int (uri_apply_h)(const struct pl *name, const struct pl *val,
 			  void *arg);
 
@@ -29,6 +40,9 @@ int  uri_decode_hostport(const struct pl *hostport, struct pl *host,
 int  uri_param_get(const struct pl *pl, const struct pl *pname,
 		   struct pl *pvalue);
 int  uri_params_apply(const struct pl *pl, uri_apply_h *ah, void *arg);
+int  uri_params_decode(struct uri_params *up, const struct pl *pl);
+int  uri_params_find(const struct uri_params *up, const struct pl *pname,
+		     struct pl *pvalue);
 int  uri_header_get(const struct pl *pl, const struct pl *hname,
 		    struct pl *hvalue);
 int  uri_headers_apply(const struct pl *pl, uri_apply_h *ah, void *arg);
@@ -43,6 +43,14 @@ struct websock_hdr {
 	uint8_t mkey[4];
 };
 
+/** permessage-deflate configuration (RFC 7692) */
+struct websock_deflate_conf {
+	bool no_context_takeover;      /**< Reset own compressor per message */
+	bool peer_no_context_takeover; /**< Ask the peer to do the same      */
+	size_t mem_max;                /**< zlib memory limit, 0 for none    */
+	size_t msg_max;                /**< Inflated size limit, 0 for 1 MB  */
+};
+
 struct websock;
 struct websock_conn;
 
@@ -63,12 +71,19 @@ int websock_accept(struct websock_conn **connp, struct websock *sock,
 		   websock_close_h *closeh, void *arg);
 int websock_send(struct websock_conn *conn, enum websock_opcode opcode,
 		 const char *fmt, ...);
+int websock_send_frame(struct websock_conn *conn, enum websock_opcode opcode,
+		       bool fin, const uint8_t *buf, size_t len);
+int websock_broadcast(struct websock_conn * const *connv, size_t connc,
+		      enum websock_opcode opcode, const char *fmt, ...);
 int websock_close(struct websock_conn *conn, enum websock_scode scode,
 		  const char *fmt, ...);
 const struct sa *websock_peer(const struct websock_conn *conn);
+void websock_set_recv_partial(struct websock_conn *conn, bool enable);
 
 typedef void (websock_shutdown_h)(void *arg);
 
 int  websock_alloc(struct websock **sockp, websock_shutdown_h *shuth,
 		   void *arg);
 void websock_shutdown(struct websock *sock);
+int  websock_set_deflate(struct websock *sock,
+			const struct websock_deflate_conf *conf);
@@ -8,6 +8,7 @@
 #   ARCH           Target architecture
 #   CC             Compiler
 #   CROSS_COMPILE  Cross-compiler prefix (optional)
+#   DEBUG_LEVEL_MAX Highest debug level compiled in (optional)
 #   EXTRA_CFLAGS   Extra compiler flags appended to CFLAGS
 #   EXTRA_LFLAGS   Extra linker flags appended to LFLAGS
 #   GCOV           If non-empty, enable GNU Coverage testing
@@ -18,6 +19,8 @@
 #   RELEASE        Release build
 #   SYSROOT        System root of library and include files
 #   SYSROOT_ALT    Alternative system root of library and include files
+#   TRACE          If non-empty, compile in the trace points
+#   USDT           If non-empty, compile in the static probe points
 #   USE_OPENSSL    If non-empty, link to libssl library
 #   USE_ZLIB       If non-empty, link to libz library
 #   VERSION        Version number
@@ -41,6 +44,18 @@
 #
 
 
+ifneq ($(DEBUG_LEVEL_MAX),)
+CFLAGS  += -DDEBUG_LEVEL_MAX=$(DEBUG_LEVEL_MAX)
+endif
+
+ifneq ($(TRACE),)
+CFLAGS  += -DRE_TRACE_ENABLED
+endif
+
+ifneq ($(USDT),)
+CFLAGS  += -DRE_USDT_ENABLED
+endif
+
 ifneq ($(RELEASE),)
 CFLAGS  += -DRELEASE
 OPT_SPEED=1
@@ -558,6 +573,27 @@ HAVE_EPOLL   := $(shell [ -f $(SYSROOT)/include/sys/epoll.h ] || \
 			&& echo "1")
 endif
 
+ifeq ($(OS),linux)
+HAVE_IO_URING := $(shell [ -f $(SYSROOT)/include/linux/io_uring.h ] \
+			&& echo "1")
+HAVE_EVENTFD  := $(shell [ -f $(SYSROOT)/include/sys/eventfd.h ] || \
+			[ -f $(SYSROOT)/include/$(MACHINE)/sys/eventfd.h ] \
+			&& echo "1")
+HAVE_MMSG     := $(shell grep -qs sendmmsg \
+			$(SYSROOT)/include/sys/socket.h \
+			$(SYSROOT)/include/$(MACHINE)/sys/socket.h \
+			&& echo "1")
+HAVE_KTLS     := $(shell [ -f $(SYSROOT)/include/linux/tls.h ] \
+			&& echo "1")
+HAVE_SIGNALFD := $(shell [ -f $(SYSROOT)/include/sys/signalfd.h ] || \
+			[ -f $(SYSROOT)/include/$(MACHINE)/sys/signalfd.h ] \
+			&& echo "1")
+HAVE_EPOLL_PWAIT2 := $(shell grep -qs epoll_pwait2 \
+			$(SYSROOT)/include/sys/epoll.h \
+			$(SYSROOT)/include/$(MACHINE)/sys/epoll.h \
+			&& echo "1")
+endif
+
 HAVE_RESOLV := $(shell [ -f $(SYSROOT)/include/resolv.h ] && echo "1")
 
 ifneq ($(HAVE_RESOLV),)
@@ -574,6 +610,7 @@ CFLAGS  += -DHAVE_FORK
 ifneq ($(HAVE_INET_NTOP),)
 CFLAGS  += -DHAVE_INET_NTOP
 endif
+CFLAGS  += -DHAVE_MMAP
 CFLAGS  += -DHAVE_PWD_H
 ifneq ($(OS),darwin)
 CFLAGS  += -DHAVE_POLL	# Darwin: poll() does not support devices
@@ -589,6 +626,24 @@ CFLAGS  += -DHAVE_SYS_TIME_H
 ifneq ($(HAVE_EPOLL),)
 CFLAGS  += -DHAVE_EPOLL
 endif
+ifneq ($(HAVE_EPOLL_PWAIT2),)
+CFLAGS  += -DHAVE_EPOLL_PWAIT2
+endif
+ifneq ($(HAVE_IO_URING),)
+CFLAGS  += -DHAVE_IO_URING
+endif
+ifneq ($(HAVE_EVENTFD),)
+CFLAGS  += -DHAVE_EVENTFD
+endif
+ifneq ($(HAVE_SIGNALFD),)
+CFLAGS  += -DHAVE_SIGNALFD
+endif
+ifneq ($(HAVE_MMSG),)
+CFLAGS  += -DHAVE_MMSG
+endif
+ifneq ($(HAVE_KTLS),)
+CFLAGS  += -DHAVE_KTLS
+endif
 ifneq ($(HAVE_KQUEUE),)
 CFLAGS  += -DHAVE_KQUEUE
 endif
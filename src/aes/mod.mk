@@ -6,8 +6,10 @@
 
 ifneq ($(USE_OPENSSL_AES),)
 SRCS	+= aes/openssl/aes.c
+SRCS	+= aes/multi.c
 else ifneq ($(USE_APPLE_COMMONCRYPTO),)
 SRCS	+= aes/apple/aes.c
+SRCS	+= aes/multi.c
 else
-SRCS	+= aes/stub.c
+SRCS	+= aes/native/aes.c
 endif
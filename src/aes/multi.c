@@ -0,0 +1,38 @@
+/**
+ * @file aes/multi.c  AES multi-buffer operations, one stream at a time
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <re_types.h>
+#include <re_aes.h>
+
+
+/**
+ * Encrypt the buffers of several independent streams
+ *
+ * @param strmv Streams, with the result of each stream on return
+ * @param strmc Number of streams
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int aes_encr_multi(struct aes_stream *strmv, size_t strmc)
+{
+	size_t i;
+
+	if (!strmv && strmc)
+		return EINVAL;
+
+	for (i=0; i<strmc; i++) {
+
+		struct aes_stream *s = &strmv[i];
+
+		if (!s->out) {
+			s->err = EINVAL;
+			continue;
+		}
+
+		s->err = aes_encr(s->aes, s->out, s->in, s->len);
+	}
+
+	return 0;
+}
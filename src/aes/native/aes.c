@@ -0,0 +1,1022 @@
+/**
+ * @file native/aes.c  AES (Advanced Encryption Standard), built-in
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re_types.h>
+#include <re_mem.h>
+#include <re_aes.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define AES_NI 1
+#include <cpuid.h>
+#include <immintrin.h>
+#elif defined(__GNUC__) && defined(__aarch64__) && defined(__linux__)
+#define AES_ARMV8 1
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#include <arm_neon.h>
+#endif
+
+
+/*
+ * The block functions use the AES instructions of the CPU when it has
+ * them. The portable code uses table lookups, and is not constant-time.
+ */
+
+
+enum {
+	MAX_ROUNDS = 14,
+	BATCH      = 8,
+	GCM_IV_LEN = 12,
+};
+
+struct aes_rk {
+	uint8_t k[MAX_ROUNDS + 1][AES_BLOCK_SIZE];
+};
+
+/* Encrypt n blocks in place, block i with round keys rkv[i] */
+typedef void (aes_blocks_h)(const struct aes_rk *rkv[], uint8_t *blk, size_t n,
+			    unsigned nr);
+
+/* x = x * H in GF(2^128) */
+typedef void (ghash_mul_h)(const struct aes *aes, uint8_t x[16]);
+
+struct aes {
+	struct aes_rk rk;
+	unsigned nr;
+	enum aes_mode mode;
+	uint8_t ctr[AES_BLOCK_SIZE];
+	uint8_t ks[AES_BLOCK_SIZE];
+	size_t ks_off;
+
+	/* GCM */
+	uint8_t h[AES_BLOCK_SIZE];
+	uint64_t hl[16], hh[16];
+	uint8_t ej0[AES_BLOCK_SIZE];
+	uint8_t x[AES_BLOCK_SIZE];
+	size_t partlen;
+	uint64_t aad_len;
+	uint64_t ct_len;
+};
+
+
+static const uint8_t sbox[256] = {
+	0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5,
+	0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+	0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0,
+	0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+	0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc,
+	0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+	0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a,
+	0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+	0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0,
+	0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+	0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b,
+	0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+	0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85,
+	0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+	0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5,
+	0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+	0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17,
+	0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+	0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88,
+	0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+	0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c,
+	0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+	0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9,
+	0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+	0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6,
+	0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+	0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e,
+	0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+	0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94,
+	0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+	0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68,
+	0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16
+};
+
+
+static aes_blocks_h *blocksh;
+static ghash_mul_h  *ghashh;
+
+
+static void key_expand(struct aes *aes, const uint8_t *key, size_t nk)
+{
+	static const uint8_t rcon[11] = {
+		0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80,
+		0x1b, 0x36
+	};
+	uint8_t *w = aes->rk.k[0];
+	size_t i;
+
+	aes->nr = (unsigned)nk + 6;
+
+	memcpy(w, key, nk * 4);
+
+	for (i = nk; i < 4 * (aes->nr + 1); i++) {
+
+		uint8_t t[4];
+
+		memcpy(t, &w[(i - 1) * 4], 4);
+
+		if (i % nk == 0) {
+			const uint8_t t0 = t[0];
+
+			t[0] = sbox[t[1]] ^ rcon[i / nk];
+			t[1] = sbox[t[2]];
+			t[2] = sbox[t[3]];
+			t[3] = sbox[t0];
+		}
+		else if (nk > 6 && i % nk == 4) {
+			t[0] = sbox[t[0]];
+			t[1] = sbox[t[1]];
+			t[2] = sbox[t[2]];
+			t[3] = sbox[t[3]];
+		}
+
+		w[i * 4 + 0] = w[(i - nk) * 4 + 0] ^ t[0];
+		w[i * 4 + 1] = w[(i - nk) * 4 + 1] ^ t[1];
+		w[i * 4 + 2] = w[(i - nk) * 4 + 2] ^ t[2];
+		w[i * 4 + 3] = w[(i - nk) * 4 + 3] ^ t[3];
+	}
+}
+
+
+static inline uint8_t xtime(uint8_t x)
+{
+	return (uint8_t)((x << 1) ^ ((x >> 7) * 0x1b));
+}
+
+
+static void block_sw(const struct aes_rk *rk, uint8_t *s, unsigned nr)
+{
+	uint8_t t[16];
+	unsigned r;
+	int i;
+
+	for (i=0; i<16; i++)
+		s[i] ^= rk->k[0][i];
+
+	for (r=1; r<=nr; r++) {
+
+		/* SubBytes and ShiftRows */
+		for (i=0; i<16; i++)
+			t[i] = sbox[s[(i + 4 * (i & 3)) & 15]];
+
+		if (r == nr) {
+			memcpy(s, t, 16);
+		}
+		else {
+			/* MixColumns */
+			for (i=0; i<16; i+=4) {
+				const uint8_t a0 = t[i],   a1 = t[i+1];
+				const uint8_t a2 = t[i+2], a3 = t[i+3];
+				const uint8_t x = a0 ^ a1 ^ a2 ^ a3;
+
+				s[i]   = a0 ^ x ^ xtime(a0 ^ a1);
+				s[i+1] = a1 ^ x ^ xtime(a1 ^ a2);
+				s[i+2] = a2 ^ x ^ xtime(a2 ^ a3);
+				s[i+3] = a3 ^ x ^ xtime(a3 ^ a0);
+			}
+		}
+
+		for (i=0; i<16; i++)
+			s[i] ^= rk->k[r][i];
+	}
+}
+
+
+static void blocks_sw(const struct aes_rk *rkv[], uint8_t *blk, size_t n,
+		      unsigned nr)
+{
+	size_t i;
+
+	for (i=0; i<n; i++)
+		block_sw(rkv[i], blk + 16 * i, nr);
+}
+
+
+static inline uint64_t get_be64(const uint8_t *p)
+{
+	return (uint64_t)p[0] << 56 | (uint64_t)p[1] << 48 |
+		(uint64_t)p[2] << 40 | (uint64_t)p[3] << 32 |
+		(uint64_t)p[4] << 24 | (uint64_t)p[5] << 16 |
+		(uint64_t)p[6] << 8  | (uint64_t)p[7];
+}
+
+
+static inline void put_be64(uint8_t *p, uint64_t v)
+{
+	int i;
+
+	for (i=7; i>=0; i--) {
+		p[i] = (uint8_t)v;
+		v >>= 8;
+	}
+}
+
+
+/* out = in ^ ks, for n blocks */
+static inline void xor_blocks(uint8_t *out, const uint8_t *in,
+			      const uint8_t *ks, size_t n)
+{
+	size_t i;
+
+	for (i=0; i<2*n; i++) {
+		uint64_t a, b;
+
+		memcpy(&a, in + 8*i, 8);
+		memcpy(&b, ks + 8*i, 8);
+		a ^= b;
+		memcpy(out + 8*i, &a, 8);
+	}
+}
+
+
+/* 4-bit tables of multiples of H (Shoup) */
+static void ghash_table(struct aes *aes)
+{
+	uint64_t vh = get_be64(aes->h), vl = get_be64(aes->h + 8);
+	int i, j;
+
+	aes->hl[8] = vl;
+	aes->hh[8] = vh;
+	aes->hl[0] = 0;
+	aes->hh[0] = 0;
+
+	for (i=4; i>0; i>>=1) {
+		const uint64_t t = (vl & 1) * 0xe1000000u;
+
+		vl = (vh << 63) | (vl >> 1);
+		vh = (vh >> 1) ^ (t << 32);
+
+		aes->hl[i] = vl;
+		aes->hh[i] = vh;
+	}
+
+	for (i=2; i<=8; i*=2) {
+
+		vh = aes->hh[i];
+		vl = aes->hl[i];
+
+		for (j=1; j<i; j++) {
+			aes->hh[i + j] = vh ^ aes->hh[j];
+			aes->hl[i + j] = vl ^ aes->hl[j];
+		}
+	}
+}
+
+
+static void ghash_mul_sw(const struct aes *aes, uint8_t x[16])
+{
+	static const uint64_t last4[16] = {
+		0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+		0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0
+	};
+	uint64_t zh, zl;
+	unsigned lo, hi, rem;
+	int i;
+
+	lo = x[15] & 0xf;
+	zh = aes->hh[lo];
+	zl = aes->hl[lo];
+
+	for (i=15; i>=0; i--) {
+
+		lo = x[i] & 0xf;
+		hi = x[i] >> 4;
+
+		if (i != 15) {
+			rem = (unsigned)zl & 0xf;
+			zl  = (zh << 60) | (zl >> 4);
+			zh  = (zh >> 4) ^ (last4[rem] << 48);
+			zh ^= aes->hh[lo];
+			zl ^= aes->hl[lo];
+		}
+
+		rem = (unsigned)zl & 0xf;
+		zl  = (zh << 60) | (zl >> 4);
+		zh  = (zh >> 4) ^ (last4[rem] << 48);
+		zh ^= aes->hh[hi];
+		zl ^= aes->hl[hi];
+	}
+
+	put_be64(x, zh);
+	put_be64(x + 8, zl);
+}
+
+
+#ifdef AES_NI
+#define NI_ROUNDS(n)							\
+	for (i=0; i<(n); i++) {						\
+		s[i] = _mm_xor_si128(_mm_loadu_si128(			\
+			(const __m128i *)(void *)(blk + 16*i)),		\
+			_mm_loadu_si128(				\
+				(const __m128i *)rkv[i]->k[0]));	\
+	}								\
+	for (r=1; r<nr; r++) {						\
+		for (i=0; i<(n); i++) {					\
+			s[i] = _mm_aesenc_si128(s[i], _mm_loadu_si128(	\
+				(const __m128i *)rkv[i]->k[r]));	\
+		}							\
+	}								\
+	for (i=0; i<(n); i++) {						\
+		s[i] = _mm_aesenclast_si128(s[i], _mm_loadu_si128(	\
+			(const __m128i *)rkv[i]->k[nr]));		\
+		_mm_storeu_si128((__m128i *)(void *)(blk + 16*i),	\
+				 s[i]);					\
+	}
+
+
+__attribute__((target("aes,sse2")))
+static void blocks_ni(const struct aes_rk *rkv[], uint8_t *blk, size_t n,
+		      unsigned nr)
+{
+	__m128i s[BATCH];
+	unsigned r;
+	size_t i;
+
+	/* a full batch with a constant count, kept in registers */
+	if (n == BATCH) {
+		NI_ROUNDS(BATCH);
+	}
+	else {
+		NI_ROUNDS(n);
+	}
+}
+
+
+/* Carry-less multiplication and reduction, on bit-reflected operands */
+__attribute__((target("pclmul,ssse3")))
+static void ghash_mul_clmul(const struct aes *aes, uint8_t x[16])
+{
+	const __m128i bswap = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8,
+					    7, 6, 5, 4, 3, 2, 1, 0);
+	__m128i a, b, t2, t3, t4, t5, t6, t7, t8, t9;
+
+	a = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *)(void *)x), bswap);
+	b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)aes->h), bswap);
+
+	t3 = _mm_clmulepi64_si128(a, b, 0x00);
+	t4 = _mm_clmulepi64_si128(a, b, 0x10);
+	t5 = _mm_clmulepi64_si128(a, b, 0x01);
+	t6 = _mm_clmulepi64_si128(a, b, 0x11);
+
+	t4 = _mm_xor_si128(t4, t5);
+	t5 = _mm_slli_si128(t4, 8);
+	t4 = _mm_srli_si128(t4, 8);
+	t3 = _mm_xor_si128(t3, t5);
+	t6 = _mm_xor_si128(t6, t4);
+
+	/* shift the 256-bit product left by one */
+	t7 = _mm_srli_epi32(t3, 31);
+	t8 = _mm_srli_epi32(t6, 31);
+	t3 = _mm_slli_epi32(t3, 1);
+	t6 = _mm_slli_epi32(t6, 1);
+	t9 = _mm_srli_si128(t7, 12);
+	t8 = _mm_slli_si128(t8, 4);
+	t7 = _mm_slli_si128(t7, 4);
+	t3 = _mm_or_si128(t3, t7);
+	t6 = _mm_or_si128(t6, t8);
+	t6 = _mm_or_si128(t6, t9);
+
+	/* reduce modulo x^128 + x^7 + x^2 + x + 1 */
+	t7 = _mm_slli_epi32(t3, 31);
+	t8 = _mm_slli_epi32(t3, 30);
+	t9 = _mm_slli_epi32(t3, 25);
+	t7 = _mm_xor_si128(t7, t8);
+	t7 = _mm_xor_si128(t7, t9);
+	t8 = _mm_srli_si128(t7, 4);
+	t7 = _mm_slli_si128(t7, 12);
+	t3 = _mm_xor_si128(t3, t7);
+
+	t2 = _mm_srli_epi32(t3, 1);
+	t4 = _mm_srli_epi32(t3, 2);
+	t5 = _mm_srli_epi32(t3, 7);
+	t2 = _mm_xor_si128(t2, t4);
+	t2 = _mm_xor_si128(t2, t5);
+	t2 = _mm_xor_si128(t2, t8);
+	t3 = _mm_xor_si128(t3, t2);
+	t6 = _mm_xor_si128(t6, t3);
+
+	_mm_storeu_si128((__m128i *)(void *)x, _mm_shuffle_epi8(t6, bswap));
+}
+
+
+static void engine_select(void)
+{
+	unsigned a, b, c, d;
+
+	if (!__get_cpuid(1, &a, &b, &c, &d))
+		c = 0;
+
+	ghashh = ((c & bit_PCLMUL) && (c & bit_SSSE3)) ?
+		ghash_mul_clmul : ghash_mul_sw;
+	blocksh = (c & bit_AES) ? blocks_ni : blocks_sw;
+}
+#endif
+
+
+#ifdef AES_ARMV8
+__attribute__((target("+crypto")))
+static void blocks_armv8(const struct aes_rk *rkv[], uint8_t *blk, size_t n,
+			 unsigned nr)
+{
+	uint8x16_t s[BATCH];
+	unsigned r;
+	size_t i;
+
+	for (i=0; i<n; i++)
+		s[i] = vld1q_u8(blk + 16*i);
+
+	for (r=0; r<nr-1; r++) {
+		for (i=0; i<n; i++) {
+			s[i] = vaesmcq_u8(vaeseq_u8(s[i],
+						    vld1q_u8(rkv[i]->k[r])));
+		}
+	}
+
+	for (i=0; i<n; i++) {
+		s[i] = vaeseq_u8(s[i], vld1q_u8(rkv[i]->k[nr-1]));
+		s[i] = veorq_u8(s[i], vld1q_u8(rkv[i]->k[nr]));
+		vst1q_u8(blk + 16*i, s[i]);
+	}
+}
+
+
+static void engine_select(void)
+{
+	ghashh  = ghash_mul_sw;
+	blocksh = (getauxval(AT_HWCAP) & HWCAP_AES) ? blocks_armv8 : blocks_sw;
+}
+#endif
+
+
+#if !defined(AES_NI) && !defined(AES_ARMV8)
+static void engine_select(void)
+{
+	ghashh  = ghash_mul_sw;
+	blocksh = blocks_sw;
+}
+#endif
+
+
+static void encrypt_block(const struct aes *aes, uint8_t *blk)
+{
+	const struct aes_rk *rkv[1];
+
+	rkv[0] = &aes->rk;
+
+	blocksh(rkv, blk, 1, aes->nr);
+}
+
+
+/* Increment the whole counter for CTR, the last 32 bits for GCM */
+static inline void ctr_inc(struct aes *aes)
+{
+	const int last = aes->mode == AES_MODE_GCM ? 12 : 0;
+	int i;
+
+	if (++aes->ctr[15])
+		return;
+
+	for (i=14; i>=last; i--) {
+		if (++aes->ctr[i])
+			break;
+	}
+}
+
+
+/* Encrypt whole blocks of counters, and xor with the input */
+static void ctr_blocks(struct aes *aes, uint8_t *out, const uint8_t *in,
+		       size_t n)
+{
+	const struct aes_rk *rkv[BATCH];
+	uint8_t blk[BATCH * AES_BLOCK_SIZE];
+	size_t i;
+
+	for (i=0; i<BATCH; i++)
+		rkv[i] = &aes->rk;
+
+	while (n) {
+		const size_t m = min(n, (size_t)BATCH);
+
+		for (i=0; i<m; i++) {
+			memcpy(&blk[16 * i], aes->ctr, 16);
+			ctr_inc(aes);
+		}
+
+		blocksh(rkv, blk, m, aes->nr);
+
+		xor_blocks(out, in, blk, m);
+
+		in  += 16 * m;
+		out += 16 * m;
+		n   -= m;
+	}
+}
+
+
+static void ctr_crypt(struct aes *aes, uint8_t *out, const uint8_t *in,
+		      size_t len)
+{
+	size_t n;
+
+	/* the rest of the keystream block of the last call */
+	for (; len && aes->ks_off < AES_BLOCK_SIZE; --len)
+		*out++ = *in++ ^ aes->ks[aes->ks_off++];
+
+	n = len / AES_BLOCK_SIZE;
+
+	ctr_blocks(aes, out, in, n);
+
+	in  += n * AES_BLOCK_SIZE;
+	out += n * AES_BLOCK_SIZE;
+	len -= n * AES_BLOCK_SIZE;
+
+	if (len) {
+		memcpy(aes->ks, aes->ctr, AES_BLOCK_SIZE);
+		ctr_inc(aes);
+		encrypt_block(aes, aes->ks);
+
+		for (aes->ks_off = 0; aes->ks_off < len; aes->ks_off++)
+			out[aes->ks_off] = in[aes->ks_off] ^
+				aes->ks[aes->ks_off];
+	}
+}
+
+
+static void ghash_update(struct aes *aes, const uint8_t *p, size_t len)
+{
+	size_t i;
+
+	while (len) {
+		const size_t n = min(len, AES_BLOCK_SIZE - aes->partlen);
+
+		if (n == AES_BLOCK_SIZE) {
+			xor_blocks(aes->x, aes->x, p, 1);
+			ghashh(aes, aes->x);
+			p   += n;
+			len -= n;
+			continue;
+		}
+
+		for (i=0; i<n; i++)
+			aes->x[aes->partlen + i] ^= p[i];
+
+		aes->partlen += n;
+		p   += n;
+		len -= n;
+
+		if (aes->partlen == AES_BLOCK_SIZE) {
+			ghashh(aes, aes->x);
+			aes->partlen = 0;
+		}
+	}
+}
+
+
+/* Complete a partial block, padded with zeros */
+static void ghash_flush(struct aes *aes)
+{
+	if (aes->partlen) {
+		ghashh(aes, aes->x);
+		aes->partlen = 0;
+	}
+}
+
+
+static int gcm_crypt(struct aes *aes, uint8_t *out, const uint8_t *in,
+		     size_t len, bool encr)
+{
+	/* additional authenticated data */
+	if (!out) {
+		if (aes->ct_len)
+			return EPROTO;
+
+		ghash_update(aes, in, len);
+		aes->aad_len += len;
+
+		return 0;
+	}
+
+	if (!aes->ct_len)
+		ghash_flush(aes);
+
+	aes->ct_len += len;
+
+	if (encr) {
+		ctr_crypt(aes, out, in, len);
+		ghash_update(aes, out, len);
+	}
+	else {
+		/* the input may be the output */
+		while (len) {
+			const size_t n = min(len, (size_t)256);
+
+			ghash_update(aes, in, n);
+			ctr_crypt(aes, out, in, n);
+
+			in  += n;
+			out += n;
+			len -= n;
+		}
+	}
+
+	return 0;
+}
+
+
+static void gcm_tag(struct aes *aes, uint8_t tag[AES_BLOCK_SIZE])
+{
+	uint8_t lens[AES_BLOCK_SIZE];
+	int i;
+
+	ghash_flush(aes);
+
+	put_be64(lens, aes->aad_len * 8);
+	put_be64(lens + 8, aes->ct_len * 8);
+
+	ghash_update(aes, lens, sizeof(lens));
+
+	for (i=0; i<AES_BLOCK_SIZE; i++)
+		tag[i] = aes->x[i] ^ aes->ej0[i];
+}
+
+
+static void destructor(void *arg)
+{
+	struct aes *aes = arg;
+
+	/* wipe the key schedule */
+	memset(&aes->rk, 0, sizeof(aes->rk));
+	memset(aes->h, 0, sizeof(aes->h));
+	memset(aes->hl, 0, sizeof(aes->hl));
+	memset(aes->hh, 0, sizeof(aes->hh));
+}
+
+
+/**
+ * Allocate a new AES context
+ *
+ * @param aesp     Pointer to allocated AES context
+ * @param mode     AES mode
+ * @param key      Encryption key
+ * @param key_bits Key size in bits; 128, 192 or 256. GCM: 128 or 256
+ * @param iv       Initial counter block, or GCM IV of 12 bytes (optional)
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int aes_alloc(struct aes **aesp, enum aes_mode mode,
+	      const uint8_t *key, size_t key_bits,
+	      const uint8_t *iv)
+{
+	struct aes *aes;
+
+	if (!aesp || !key)
+		return EINVAL;
+
+	switch (mode) {
+
+	case AES_MODE_CTR:
+	case AES_MODE_ECB:
+		if (key_bits != 128 && key_bits != 192 && key_bits != 256)
+			return ENOTSUP;
+		break;
+
+	case AES_MODE_GCM:
+		if (key_bits != 128 && key_bits != 256)
+			return ENOTSUP;
+		break;
+
+	default:
+		return ENOTSUP;
+	}
+
+	if (!blocksh)
+		engine_select();
+
+	aes = mem_zalloc(sizeof(*aes), destructor);
+	if (!aes)
+		return ENOMEM;
+
+	aes->mode   = mode;
+	aes->ks_off = AES_BLOCK_SIZE;
+
+	key_expand(aes, key, key_bits / 32);
+
+	if (mode == AES_MODE_GCM) {
+		encrypt_block(aes, aes->h);
+		ghash_table(aes);
+	}
+
+	aes_set_iv(aes, iv);
+
+	*aesp = aes;
+
+	return 0;
+}
+
+
+/**
+ * Set the initial counter block, or the GCM IV of 12 bytes, and start a
+ * new message
+ *
+ * @param aes AES context
+ * @param iv  Initial counter block or IV
+ */
+void aes_set_iv(struct aes *aes, const uint8_t *iv)
+{
+	if (!aes || !iv)
+		return;
+
+	aes->ks_off = AES_BLOCK_SIZE;
+
+	if (aes->mode != AES_MODE_GCM) {
+		memcpy(aes->ctr, iv, AES_BLOCK_SIZE);
+		return;
+	}
+
+	memcpy(aes->ctr, iv, GCM_IV_LEN);
+	aes->ctr[12] = 0;
+	aes->ctr[13] = 0;
+	aes->ctr[14] = 0;
+	aes->ctr[15] = 1;
+
+	memcpy(aes->ej0, aes->ctr, AES_BLOCK_SIZE);
+	encrypt_block(aes, aes->ej0);
+	ctr_inc(aes);
+
+	memset(aes->x, 0, sizeof(aes->x));
+	aes->partlen = 0;
+	aes->aad_len = 0;
+	aes->ct_len  = 0;
+}
+
+
+static int ecb_encr(struct aes *aes, uint8_t *out, const uint8_t *in,
+		    size_t len)
+{
+	const struct aes_rk *rkv[BATCH];
+	size_t i;
+
+	if (!out || len % AES_BLOCK_SIZE)
+		return EINVAL;
+
+	for (i=0; i<BATCH; i++)
+		rkv[i] = &aes->rk;
+
+	if (out != in)
+		memmove(out, in, len);
+
+	for (; len; ) {
+		const size_t n = min(len / AES_BLOCK_SIZE, (size_t)BATCH);
+
+		blocksh(rkv, out, n, aes->nr);
+
+		out += n * AES_BLOCK_SIZE;
+		len -= n * AES_BLOCK_SIZE;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Encrypt a buffer. With GCM, a NULL output gives authenticated data,
+ * which must come before the plaintext.
+ *
+ * @param aes AES context
+ * @param out Output buffer, may be the input buffer
+ * @param in  Input buffer
+ * @param len Number of bytes; a multiple of the block size for ECB
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int aes_encr(struct aes *aes, uint8_t *out, const uint8_t *in, size_t len)
+{
+	if (!aes || !in)
+		return EINVAL;
+
+	switch (aes->mode) {
+
+	case AES_MODE_CTR:
+		if (!out)
+			return EINVAL;
+
+		ctr_crypt(aes, out, in, len);
+		return 0;
+
+	case AES_MODE_GCM:
+		return gcm_crypt(aes, out, in, len, true);
+
+	case AES_MODE_ECB:
+		return ecb_encr(aes, out, in, len);
+
+	default:
+		return ENOTSUP;
+	}
+}
+
+
+/**
+ * Decrypt a buffer. With GCM, a NULL output gives authenticated data,
+ * which must come before the ciphertext. ECB decryption is not
+ * supported.
+ *
+ * @param aes AES context
+ * @param out Output buffer, may be the input buffer
+ * @param in  Input buffer
+ * @param len Number of bytes
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int aes_decr(struct aes *aes, uint8_t *out, const uint8_t *in, size_t len)
+{
+	if (!aes || !in)
+		return EINVAL;
+
+	switch (aes->mode) {
+
+	case AES_MODE_CTR:
+		if (!out)
+			return EINVAL;
+
+		ctr_crypt(aes, out, in, len);
+		return 0;
+
+	case AES_MODE_GCM:
+		return gcm_crypt(aes, out, in, len, false);
+
+	default:
+		return ENOTSUP;
+	}
+}
+
+
+/**
+ * Get the authentication tag for an AEAD cipher (e.g. GCM)
+ *
+ * @param aes    AES Context
+ * @param tag    Authentication tag
+ * @param taglen Length of Authentication tag
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int aes_get_authtag(struct aes *aes, uint8_t *tag, size_t taglen)
+{
+	uint8_t t[AES_BLOCK_SIZE];
+
+	if (!aes || !tag || !taglen || taglen > sizeof(t))
+		return EINVAL;
+
+	if (aes->mode != AES_MODE_GCM)
+		return ENOTSUP;
+
+	gcm_tag(aes, t);
+	memcpy(tag, t, taglen);
+
+	return 0;
+}
+
+
+/**
+ * Authenticate a decryption tag for an AEAD cipher (e.g. GCM)
+ *
+ * @param aes    AES Context
+ * @param tag    Authentication tag
+ * @param taglen Length of Authentication tag
+ *
+ * @return 0 if success, otherwise errorcode
+ *
+ * @retval EAUTH if authentication failed
+ */
+int aes_authenticate(struct aes *aes, const uint8_t *tag, size_t taglen)
+{
+	uint8_t t[AES_BLOCK_SIZE], diff = 0;
+	size_t i;
+
+	if (!aes || !tag || !taglen || taglen > sizeof(t))
+		return EINVAL;
+
+	if (aes->mode != AES_MODE_GCM)
+		return ENOTSUP;
+
+	gcm_tag(aes, t);
+
+	for (i=0; i<taglen; i++)
+		diff |= t[i] ^ tag[i];
+
+	return diff ? EAUTH : 0;
+}
+
+
+/* Counter blocks of several streams, encrypted together */
+struct batch {
+	const struct aes_rk *rkv[BATCH];
+	uint8_t blk[BATCH * AES_BLOCK_SIZE];
+	uint8_t *outv[BATCH];
+	const uint8_t *inv[BATCH];
+	size_t n;
+	unsigned nr;
+};
+
+
+static void batch_flush(struct batch *b)
+{
+	size_t i;
+
+	if (!b->n)
+		return;
+
+	blocksh(b->rkv, b->blk, b->n, b->nr);
+
+	for (i=0; i<b->n; i++)
+		xor_blocks(b->outv[i], b->inv[i], &b->blk[16 * i], 1);
+
+	b->n = 0;
+}
+
+
+static void batch_ctr(struct batch *b, struct aes *aes, uint8_t *out,
+		      const uint8_t *in, size_t n)
+{
+	if (b->n && b->nr != aes->nr)
+		batch_flush(b);
+
+	b->nr = aes->nr;
+
+	for (; n; --n) {
+
+		if (b->n == BATCH)
+			batch_flush(b);
+
+		memcpy(&b->blk[16 * b->n], aes->ctr, AES_BLOCK_SIZE);
+		ctr_inc(aes);
+
+		b->rkv[b->n]  = &aes->rk;
+		b->outv[b->n] = out;
+		b->inv[b->n]  = in;
+		++b->n;
+
+		in  += AES_BLOCK_SIZE;
+		out += AES_BLOCK_SIZE;
+	}
+}
+
+
+/**
+ * Encrypt the buffers of several independent streams. Blocks of CTR
+ * streams are interleaved, to keep the AES instructions busy; other
+ * streams are handled as with aes_encr().
+ *
+ * @param strmv Streams, with the result of each stream on return
+ * @param strmc Number of streams
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int aes_encr_multi(struct aes_stream *strmv, size_t strmc)
+{
+	struct batch b;
+	size_t i;
+
+	if (!strmv && strmc)
+		return EINVAL;
+
+	b.n  = 0;
+	b.nr = 0;
+
+	for (i=0; i<strmc; i++) {
+
+		struct aes_stream *s = &strmv[i];
+		size_t pre, n;
+
+		if (!s->aes || !s->in || !s->out) {
+			s->err = EINVAL;
+			continue;
+		}
+
+		if (s->aes->mode != AES_MODE_CTR) {
+			s->err = aes_encr(s->aes, s->out, s->in, s->len);
+			continue;
+		}
+
+		s->err = 0;
+
+		/* the rest of the keystream block of the last call */
+		pre = min(s->len, AES_BLOCK_SIZE - s->aes->ks_off);
+		ctr_crypt(s->aes, s->out, s->in, pre);
+
+		n = (s->len - pre) / AES_BLOCK_SIZE;
+		batch_ctr(&b, s->aes, s->out + pre, s->in + pre, n);
+
+		/* the counters of the partial last block follow */
+		pre += n * AES_BLOCK_SIZE;
+		ctr_crypt(s->aes, s->out + pre, s->in + pre, s->len - pre);
+	}
+
+	batch_flush(&b);
+
+	return 0;
+}
@@ -43,6 +43,17 @@ static const EVP_CIPHER *aes_cipher(enum aes_mode mode, size_t key_bits)
 			return NULL;
 		}
 	}
+	else if (mode == AES_MODE_ECB) {
+
+		switch (key_bits) {
+
+		case 128: return EVP_aes_128_ecb();
+		case 192: return EVP_aes_192_ecb();
+		case 256: return EVP_aes_256_ecb();
+		default:
+			return NULL;
+		}
+	}
 	else {
 		return NULL;
 	}
@@ -128,6 +139,10 @@ int aes_alloc(struct aes **aesp, enum aes_mode mode,
 		err = EPROTO;
 	}
 
+	/* ECB is used on whole blocks only */
+	if (!err && mode == AES_MODE_ECB)
+		EVP_CIPHER_CTX_set_padding(st->ctx, 0);
+
  out:
 	if (err)
 		mem_deref(st);
@@ -0,0 +1,460 @@
+/**
+ * @file async.c  Pool of worker threads for blocking work
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <pthread.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include <re_types.h>
+#include <re_fmt.h>
+#include <re_mem.h>
+#include <re_list.h>
+#include <re_main.h>
+#include <re_mqueue.h>
+#include <re_async.h>
+
+
+#define DEBUG_MODULE "async"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+/*
+ * Each worker has its own queue, and work is added to the queues in
+ * turn. A worker that finds its own queue empty takes work from the
+ * queues of the others, so one long job does not hold up the jobs that
+ * were queued behind it. The number of queued jobs is kept with the
+ * pool lock, and each worker that is woken up takes exactly one job.
+ *
+ * Finished work is linked to the completion queue of the thread that
+ * submitted it, and a message queue wakes up its main loop, which calls
+ * the completion handlers.
+ */
+
+
+/** Completion queue of a submitting thread */
+struct async_q {
+	struct mqueue *mq;           /**< NULL when the thread has exited  */
+	struct list donel;           /**< Finished work                    */
+};
+
+/** Submitted work */
+struct async_work {
+	struct le le;
+	re_async_work_h *workh;
+	re_async_h *cb;
+	void *arg;
+	struct async_q *q;           /**< Shared reference                 */
+	int err;
+};
+
+/** Worker thread and its queue */
+struct worker {
+	pthread_t tid;
+	pthread_mutex_t mutex;       /**< Protects the queue               */
+	struct list workl;
+	unsigned idx;
+};
+
+/** Worker pool state, protected by the pool lock */
+static struct {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct worker *wv;
+	unsigned n;
+	unsigned next;               /**< Next queue to add work to        */
+	unsigned pending;            /**< Queued work not yet taken        */
+	bool run;
+} pool = {
+	PTHREAD_MUTEX_INITIALIZER,
+	PTHREAD_COND_INITIALIZER,
+	NULL,
+	0,
+	0,
+	0,
+	false
+};
+
+static pthread_once_t pt_once = PTHREAD_ONCE_INIT;
+static pthread_key_t  pt_key;
+
+
+static void work_destructor(void *data)
+{
+	struct async_work *w = data;
+
+	mem_deref(w->q);
+}
+
+
+/* Call the completion handlers of the finished work */
+static void q_drain(struct async_q *q, bool call)
+{
+	for (;;) {
+		struct async_work *w;
+
+		pthread_mutex_lock(&pool.mutex);
+		w = list_ledata(list_head(&q->donel));
+		if (w)
+			list_unlink(&w->le);
+		pthread_mutex_unlock(&pool.mutex);
+
+		if (!w)
+			break;
+
+		if (call && w->cb)
+			w->cb(w->err, w->arg);
+
+		mem_deref(w);
+	}
+}
+
+
+/* Called from the thread that owns the completion queue */
+static void q_close(struct async_q *q, bool call)
+{
+	struct mqueue *mq;
+
+	pthread_mutex_lock(&pool.mutex);
+	mq = q->mq;
+	q->mq = NULL;
+	pthread_mutex_unlock(&pool.mutex);
+
+	mem_deref(mq);
+
+	q_drain(q, call);
+
+	mem_deref(q);
+}
+
+
+static void thread_destructor(void *arg)
+{
+	q_close(arg, false);
+}
+
+
+static void async_once(void)
+{
+	pthread_key_create(&pt_key, thread_destructor);
+}
+
+
+static void mqueue_handler(int id, void *data, void *arg)
+{
+	(void)id;
+	(void)data;
+
+	q_drain(arg, true);
+}
+
+
+/* Get the completion queue of the current thread */
+static struct async_q *q_get(void)
+{
+	struct async_q *q;
+	int err;
+
+	pthread_once(&pt_once, async_once);
+
+	q = pthread_getspecific(pt_key);
+	if (q)
+		return q;
+
+	q = mem_alloc_shared(sizeof(*q), NULL);
+	if (!q)
+		return NULL;
+
+	list_init(&q->donel);
+
+	err = mqueue_alloc(&q->mq, mqueue_handler, q);
+	if (err)
+		goto out;
+
+	err = pthread_setspecific(pt_key, q);
+
+ out:
+	if (err) {
+		mem_deref(q->mq);
+		q = mem_deref(q);
+	}
+
+	return q;
+}
+
+
+/* Send the result back to the submitting thread, or drop it */
+static void complete(struct async_work *w)
+{
+	struct async_q *q = w->q;
+	bool drop = false;
+
+	pthread_mutex_lock(&pool.mutex);
+
+	if (!q->mq) {
+		drop = true;
+	}
+	else {
+		/* Only the first finished work wakes up the loop */
+		if (!q->donel.head)
+			(void)mqueue_push(q->mq, 0, NULL);
+
+		list_append(&q->donel, &w->le, w);
+	}
+
+	pthread_mutex_unlock(&pool.mutex);
+
+	if (drop)
+		mem_deref(w);
+}
+
+
+/* Take a job from the queue of worker idx */
+static struct async_work *work_take(unsigned idx)
+{
+	struct worker *wk = &pool.wv[idx];
+	struct async_work *w;
+
+	pthread_mutex_lock(&wk->mutex);
+	w = list_ledata(list_head(&wk->workl));
+	if (w)
+		list_unlink(&w->le);
+	pthread_mutex_unlock(&wk->mutex);
+
+	return w;
+}
+
+
+static void *worker_thread(void *arg)
+{
+	struct worker *wk = arg;
+
+	for (;;) {
+		struct async_work *w = NULL;
+		unsigned i;
+
+		pthread_mutex_lock(&pool.mutex);
+
+		while (pool.run && !pool.pending)
+			pthread_cond_wait(&pool.cond, &pool.mutex);
+
+		if (!pool.run) {
+			pthread_mutex_unlock(&pool.mutex);
+			break;
+		}
+
+		--pool.pending;
+		pthread_mutex_unlock(&pool.mutex);
+
+		/* Own queue first, then the others */
+		for (i=0; !w; i = (i + 1) % pool.n)
+			w = work_take((wk->idx + i) % pool.n);
+
+		w->err = w->workh(w->arg);
+
+		complete(w);
+	}
+
+	return NULL;
+}
+
+
+static unsigned cpu_count(void)
+{
+#if defined (HAVE_UNISTD_H) && defined (_SC_NPROCESSORS_ONLN)
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return n > 0 ? (unsigned)n : 1;
+#else
+	return 1;
+#endif
+}
+
+
+/**
+ * Start the pool of worker threads. It is started with one worker per
+ * online CPU by the first call to re_async(), if not started before.
+ *
+ * @param workers Number of worker threads, 0 for one per online CPU
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int re_async_init(unsigned workers)
+{
+	struct worker *wv;
+	unsigned i;
+	int err = 0;
+
+	if (!workers)
+		workers = cpu_count();
+
+	pthread_mutex_lock(&pool.mutex);
+
+	if (pool.wv) {
+		err = EALREADY;
+		goto out;
+	}
+
+	wv = mem_zalloc(workers * sizeof(*wv), NULL);
+	if (!wv) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	pool.wv      = wv;
+	pool.n       = workers;
+	pool.next    = 0;
+	pool.pending = 0;
+	pool.run     = true;
+
+	for (i=0; i<workers; i++) {
+		wv[i].idx = i;
+		list_init(&wv[i].workl);
+		pthread_mutex_init(&wv[i].mutex, NULL);
+	}
+
+	for (i=0; i<workers; i++) {
+
+		err = pthread_create(&wv[i].tid, NULL, worker_thread, &wv[i]);
+		if (err)
+			break;
+	}
+
+	/* Run with the workers that could be started */
+	if (err && i) {
+		DEBUG_WARNING("started %u of %u workers (%m)\n",
+			      i, workers, err);
+		pool.n = i;
+		err = 0;
+	}
+	else if (err) {
+		pool.wv  = mem_deref(wv);
+		pool.n   = 0;
+		pool.run = false;
+	}
+
+ out:
+	pthread_mutex_unlock(&pool.mutex);
+
+	return err;
+}
+
+
+/**
+ * Stop the pool of worker threads. Running work is finished first, and
+ * work that was not started completes with ECANCELED. The completion
+ * queue of the calling thread is closed, after the completion handlers
+ * of its finished work are called.
+ *
+ * @note Must not be called from a worker thread
+ */
+void re_async_close(void)
+{
+	struct async_q *self;
+	struct worker *wv;
+	unsigned i, n;
+
+	pthread_mutex_lock(&pool.mutex);
+	wv = pool.wv;
+	n  = pool.n;
+	pool.run = false;
+	pthread_cond_broadcast(&pool.cond);
+	pthread_mutex_unlock(&pool.mutex);
+
+	for (i=0; i<n; i++)
+		pthread_join(wv[i].tid, NULL);
+
+	pthread_once(&pt_once, async_once);
+	self = pthread_getspecific(pt_key);
+
+	for (i=0; i<n; i++) {
+
+		struct async_work *w;
+
+		while ((w = list_ledata(list_head(&wv[i].workl)))) {
+
+			list_unlink(&w->le);
+			w->err = ECANCELED;
+			complete(w);
+		}
+
+		pthread_mutex_destroy(&wv[i].mutex);
+	}
+
+	pthread_mutex_lock(&pool.mutex);
+	pool.wv      = NULL;
+	pool.n       = 0;
+	pool.pending = 0;
+	pthread_mutex_unlock(&pool.mutex);
+
+	mem_deref(wv);
+
+	/* The finished work of this thread completes now */
+	if (self) {
+		(void)pthread_setspecific(pt_key, NULL);
+		q_close(self, true);
+	}
+}
+
+
+/**
+ * Run a work handler on a worker thread, and call the completion handler
+ * from the main loop of the calling thread when it is done. The work
+ * handler must not use the objects of the main loop, e.g. timers or
+ * sockets, and the argument must stay valid until the completion.
+ *
+ * @param workh Work handler, called from a worker thread
+ * @param cb    Optional completion handler, called from this thread
+ * @param arg   Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int re_async(re_async_work_h *workh, re_async_h *cb, void *arg)
+{
+	struct async_work *w;
+	struct worker *wk;
+	struct async_q *q;
+	int err;
+
+	if (!workh)
+		return EINVAL;
+
+	err = re_async_init(0);
+	if (err && err != EALREADY)
+		return err;
+
+	q = q_get();
+	if (!q)
+		return ENOMEM;
+
+	w = mem_zalloc(sizeof(*w), work_destructor);
+	if (!w)
+		return ENOMEM;
+
+	w->workh = workh;
+	w->cb    = cb;
+	w->arg   = arg;
+	w->q     = mem_ref(q);
+
+	pthread_mutex_lock(&pool.mutex);
+
+	if (!pool.run) {
+		pthread_mutex_unlock(&pool.mutex);
+		mem_deref(w);
+		return ESHUTDOWN;
+	}
+
+	wk = &pool.wv[pool.next++ % pool.n];
+
+	pthread_mutex_lock(&wk->mutex);
+	list_append(&wk->workl, &w->le, w);
+	pthread_mutex_unlock(&wk->mutex);
+
+	++pool.pending;
+	pthread_cond_signal(&pool.cond);
+	pthread_mutex_unlock(&pool.mutex);
+
+	return 0;
+}
@@ -3,9 +3,18 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
+#include <string.h>
 #include <re_types.h>
 #include <re_fmt.h>
 #include <re_base64.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define B64_SSSE3 1
+#include <cpuid.h>
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define B64_NEON 1
+#include <arm_neon.h>
+#endif
 
 
 static const char b64_table[65] =
@@ -13,6 +22,316 @@ static const char b64_table[65] =
 	"abcdefghijklmnopqrstuvwxyz"
 	"0123456789+/";
 
+/* 6-bit value of each character, 0x40 for '=' and 0xff if invalid */
+static const uint8_t b64_dec[256] = {
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0x3e, 0xff, 0xff, 0xff, 0x3f,
+	0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b,
+	0x3c, 0x3d, 0xff, 0xff, 0xff, 0x40, 0xff, 0xff,
+	0xff, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+	0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+	0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16,
+	0x17, 0x18, 0x19, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20,
+	0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+	0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30,
+	0x31, 0x32, 0x33, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+};
+
+
+/*
+ * Encode and decode as many whole blocks as the SIMD code handles, and
+ * give the number of input bytes done. Decoding stops at a block with
+ * characters that are not base64, or '=', and leaves it to the scalar code.
+ */
+typedef size_t (b64_enc_h)(const uint8_t *in, size_t ilen, char *out);
+typedef size_t (b64_dec_h)(const char *in, size_t ilen, uint8_t *out);
+
+
+#ifndef B64_NEON
+static size_t enc_none(const uint8_t *in, size_t ilen, char *out)
+{
+	(void)in;
+	(void)ilen;
+	(void)out;
+
+	return 0;
+}
+
+
+static size_t dec_none(const char *in, size_t ilen, uint8_t *out)
+{
+	(void)in;
+	(void)ilen;
+	(void)out;
+
+	return 0;
+}
+#endif
+
+
+#ifdef B64_SSSE3
+/* 12 bytes to 16 characters, loading 16 bytes */
+__attribute__((target("ssse3")))
+static size_t enc_ssse3(const uint8_t *in, size_t ilen, char *out)
+{
+	const __m128i spread = _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4,
+					     7, 6, 8, 7, 10, 9, 11, 10);
+	const __m128i shift = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52,
+					    '0' - 52, '0' - 52, '0' - 52,
+					    '0' - 52, '0' - 52, '0' - 52,
+					    '0' - 52, '0' - 52, '+' - 62,
+					    '/' - 63, 'A', 0, 0);
+	size_t n = 0;
+
+	for (; ilen - n >= 16; n += 12, out += 16) {
+
+		__m128i x, i1, i2, r;
+
+		x = _mm_loadu_si128((const __m128i *)(const void *)(in + n));
+		x = _mm_shuffle_epi8(x, spread);
+
+		/* the four 6-bit indexes of each 32-bit lane */
+		i1 = _mm_mulhi_epu16(_mm_and_si128(x,
+				     _mm_set1_epi32(0x0fc0fc00)),
+				     _mm_set1_epi32(0x04000040));
+		i2 = _mm_mullo_epi16(_mm_and_si128(x,
+				     _mm_set1_epi32(0x003f03f0)),
+				     _mm_set1_epi32(0x01000010));
+		x  = _mm_or_si128(i1, i2);
+
+		/* 0-25 -> 13, 26-51 -> 0, 52-61 -> 1-10, 62 -> 11, 63 -> 12 */
+		r = _mm_subs_epu8(x, _mm_set1_epi8(51));
+		r = _mm_or_si128(r, _mm_and_si128(_mm_cmpgt_epi8(
+				 _mm_set1_epi8(26), x), _mm_set1_epi8(13)));
+		r = _mm_add_epi8(x, _mm_shuffle_epi8(shift, r));
+
+		_mm_storeu_si128((__m128i *)(void *)out, r);
+	}
+
+	return n;
+}
+
+
+/* 16 characters to 12 bytes, storing 16 bytes */
+__attribute__((target("ssse3")))
+static size_t dec_ssse3(const char *in, size_t ilen, uint8_t *out)
+{
+	const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8,
+					   14, 13, 12, -1, -1, -1, -1);
+	size_t n = 0;
+
+	for (; ilen - n >= 24; n += 16, out += 12) {
+
+		__m128i c, m, ok, sh;
+
+		c = _mm_loadu_si128((const __m128i *)(const void *)(in + n));
+
+		m  = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('A' - 1)),
+				   _mm_cmpgt_epi8(_mm_set1_epi8('Z' + 1), c));
+		ok = m;
+		sh = _mm_and_si128(m, _mm_set1_epi8(-'A'));
+
+		m  = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('a' - 1)),
+				   _mm_cmpgt_epi8(_mm_set1_epi8('z' + 1), c));
+		ok = _mm_or_si128(ok, m);
+		sh = _mm_or_si128(sh, _mm_and_si128(m,
+				  _mm_set1_epi8(26 - 'a')));
+
+		m  = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)),
+				   _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), c));
+		ok = _mm_or_si128(ok, m);
+		sh = _mm_or_si128(sh, _mm_and_si128(m,
+				  _mm_set1_epi8(52 - '0')));
+
+		m  = _mm_cmpeq_epi8(c, _mm_set1_epi8('+'));
+		ok = _mm_or_si128(ok, m);
+		sh = _mm_or_si128(sh, _mm_and_si128(m,
+				  _mm_set1_epi8(62 - '+')));
+
+		m  = _mm_cmpeq_epi8(c, _mm_set1_epi8('/'));
+		ok = _mm_or_si128(ok, m);
+		sh = _mm_or_si128(sh, _mm_and_si128(m,
+				  _mm_set1_epi8(63 - '/')));
+
+		if (_mm_movemask_epi8(ok) != 0xffff)
+			break;
+
+		c = _mm_add_epi8(c, sh);
+
+		/* merge the 6-bit values into three bytes per lane */
+		c = _mm_maddubs_epi16(c, _mm_set1_epi32(0x01400140));
+		c = _mm_madd_epi16(c, _mm_set1_epi32(0x00011000));
+		c = _mm_shuffle_epi8(c, pack);
+
+		_mm_storeu_si128((__m128i *)(void *)out, c);
+	}
+
+	return n;
+}
+
+
+static b64_enc_h *ench;
+static b64_dec_h *dech;
+
+
+static void b64_select(void)
+{
+	unsigned a, b, c, d;
+
+	if (__get_cpuid(1, &a, &b, &c, &d) && (c & bit_SSSE3)) {
+		dech = dec_ssse3;
+		ench = enc_ssse3;
+	}
+	else {
+		dech = dec_none;
+		ench = enc_none;
+	}
+}
+#endif
+
+
+#ifdef B64_NEON
+/* 48 bytes to 64 characters */
+static size_t enc_neon(const uint8_t *in, size_t ilen, char *out)
+{
+	uint8x16x4_t tab, r;
+	size_t n = 0;
+
+	tab.val[0] = vld1q_u8((const uint8_t *)b64_table);
+	tab.val[1] = vld1q_u8((const uint8_t *)b64_table + 16);
+	tab.val[2] = vld1q_u8((const uint8_t *)b64_table + 32);
+	tab.val[3] = vld1q_u8((const uint8_t *)b64_table + 48);
+
+	for (; ilen - n >= 48; n += 48, out += 64) {
+
+		const uint8x16x3_t x = vld3q_u8(in + n);
+
+		r.val[0] = vshrq_n_u8(x.val[0], 2);
+		r.val[1] = vorrq_u8(vshrq_n_u8(x.val[1], 4),
+				    vandq_u8(vshlq_n_u8(x.val[0], 4),
+					     vdupq_n_u8(0x3f)));
+		r.val[2] = vorrq_u8(vshrq_n_u8(x.val[2], 6),
+				    vandq_u8(vshlq_n_u8(x.val[1], 2),
+					     vdupq_n_u8(0x3f)));
+		r.val[3] = vandq_u8(x.val[2], vdupq_n_u8(0x3f));
+
+		r.val[0] = vqtbl4q_u8(tab, r.val[0]);
+		r.val[1] = vqtbl4q_u8(tab, r.val[1]);
+		r.val[2] = vqtbl4q_u8(tab, r.val[2]);
+		r.val[3] = vqtbl4q_u8(tab, r.val[3]);
+
+		vst4q_u8((uint8_t *)out, r);
+	}
+
+	return n;
+}
+
+
+static inline uint8x16_t dec_lookup(const uint8x16x4_t lo,
+				    const uint8x16x4_t hi, uint8x16_t c)
+{
+	/* out of range indexes give zero */
+	return vorrq_u8(vqtbl4q_u8(lo, c),
+			vqtbl4q_u8(hi, vsubq_u8(c, vdupq_n_u8(64))));
+}
+
+
+/* 64 characters to 48 bytes */
+static size_t dec_neon(const char *in, size_t ilen, uint8_t *out)
+{
+	uint8x16x4_t lo, hi, v;
+	uint8x16x3_t r;
+	size_t n = 0;
+	int i;
+
+	for (i=0; i<4; i++) {
+		lo.val[i] = vld1q_u8(b64_dec + 16 * i);
+		hi.val[i] = vld1q_u8(b64_dec + 64 + 16 * i);
+	}
+
+	for (; ilen - n >= 64; n += 64, out += 48) {
+
+		const uint8x16x4_t c = vld4q_u8((const uint8_t *)in + n);
+		uint8x16_t bad;
+
+		v.val[0] = dec_lookup(lo, hi, c.val[0]);
+		v.val[1] = dec_lookup(lo, hi, c.val[1]);
+		v.val[2] = dec_lookup(lo, hi, c.val[2]);
+		v.val[3] = dec_lookup(lo, hi, c.val[3]);
+
+		/* non-ASCII, invalid or '=' */
+		bad = vandq_u8(vorrq_u8(vorrq_u8(c.val[0], c.val[1]),
+					vorrq_u8(c.val[2], c.val[3])),
+			       vdupq_n_u8(0x80));
+		bad = vorrq_u8(bad, vorrq_u8(vorrq_u8(v.val[0], v.val[1]),
+					     vorrq_u8(v.val[2], v.val[3])));
+		if (vmaxvq_u8(bad) & 0xc0)
+			break;
+
+		r.val[0] = vorrq_u8(vshlq_n_u8(v.val[0], 2),
+				    vshrq_n_u8(v.val[1], 4));
+		r.val[1] = vorrq_u8(vshlq_n_u8(v.val[1], 4),
+				    vshrq_n_u8(v.val[2], 2));
+		r.val[2] = vorrq_u8(vshlq_n_u8(v.val[2], 6), v.val[3]);
+
+		vst3q_u8(out, r);
+	}
+
+	return n;
+}
+#endif
+
+
+static size_t enc_blocks(const uint8_t *in, size_t ilen, char *out)
+{
+#if defined(B64_SSSE3)
+	if (!ench)
+		b64_select();
+
+	return ench(in, ilen, out);
+#elif defined(B64_NEON)
+	return enc_neon(in, ilen, out);
+#else
+	return enc_none(in, ilen, out);
+#endif
+}
+
+
+static size_t dec_blocks(const char *in, size_t ilen, uint8_t *out)
+{
+#if defined(B64_SSSE3)
+	if (!dech)
+		b64_select();
+
+	return dech(in, ilen, out);
+#elif defined(B64_NEON)
+	return dec_neon(in, ilen, out);
+#else
+	return dec_none(in, ilen, out);
+#endif
+}
+
 
 /**
  * Base-64 encode a buffer
@@ -28,6 +347,7 @@ int base64_encode(const uint8_t *in, size_t ilen, char *out, size_t *olen)
 {
 	const uint8_t *in_end = in + ilen;
 	const char *o = out;
+	size_t n;
 
 	if (!in || !out || !olen)
 		return EINVAL;
@@ -35,6 +355,10 @@ int base64_encode(const uint8_t *in, size_t ilen, char *out, size_t *olen)
 	if (*olen < 4 * ((ilen+2)/3))
 		return EOVERFLOW;
 
+	n = enc_blocks(in, ilen, out);
+	in  += n;
+	out += n / 3 * 4;
+
 	for (; in < in_end; ) {
 		uint32_t v;
 		int pad = 0;
@@ -97,17 +421,11 @@ int base64_print(struct re_printf *pf, const uint8_t *ptr, size_t len)
 /* convert char -> 6-bit value */
 static inline uint32_t b64val(char c)
 {
-	if ('A' <= c && c <= 'Z')
-		return c - 'A' + 0;
-	else if ('a' <= c && c <= 'z')
-		return c - 'a' + 26;
-	else if ('0' <= c && c <= '9')
-		return c - '0' + 52;
-	else if ('+' == c)
-		return 62;
-	else if ('/' == c)
-		return 63;
-	else if ('=' == c)
+	const uint8_t v = b64_dec[(uint8_t)c];
+
+	if (v < 0x40)
+		return v;
+	else if (v == 0x40)
 		return 1<<24; /* special trick */
 	else
 		return 0;
@@ -128,6 +446,7 @@ int base64_decode(const char *in, size_t ilen, uint8_t *out, size_t *olen)
 {
 	const char *in_end = in + ilen;
 	const uint8_t *o = out;
+	size_t n;
 
 	if (!in || !out || !olen)
 		return EINVAL;
@@ -135,6 +454,10 @@ int base64_decode(const char *in, size_t ilen, uint8_t *out, size_t *olen)
 	if (*olen < 3 * (ilen/4))
 		return EOVERFLOW;
 
+	n = dec_blocks(in, ilen, out);
+	in  += n;
+	out += n / 4 * 3;
+
 	for (;in+3 < in_end; ) {
 		uint32_t v;
 
@@ -20,38 +20,23 @@ enum {
 };
 
 
-static void destructor(void *arg)
+/* Zeroed memory from the decode arena, aligned for any attribute value */
+static void *arena_alloc(struct bfcp_arena *arena, size_t size)
 {
-	struct bfcp_attr *attr = arg;
+	void *p;
 
-	switch (attr->type) {
-
-	case BFCP_ERROR_CODE:
-		mem_deref(attr->v.errcode.details);
-		break;
+	size = (size + 7) & ~(size_t)7;
 
-	case BFCP_ERROR_INFO:
-	case BFCP_PART_PROV_INFO:
-	case BFCP_STATUS_INFO:
-	case BFCP_USER_DISP_NAME:
-	case BFCP_USER_URI:
-		mem_deref(attr->v.str);
-		break;
+	if (size > arena->left)
+		return NULL;
 
-	case BFCP_SUPPORTED_ATTRS:
-		mem_deref(attr->v.supattr.attrv);
-		break;
+	p = arena->p;
+	arena->p    += size;
+	arena->left -= size;
 
-	case BFCP_SUPPORTED_PRIMS:
-		mem_deref(attr->v.supprim.primv);
-		break;
+	memset(p, 0, size);
 
-	default:
-		break;
-	}
-
-	list_flush(&attr->attrl);
-	list_unlink(&attr->le);
+	return p;
 }
 
 
@@ -229,7 +214,7 @@ int bfcp_attrs_encode(struct mbuf *mb, unsigned attrc, ...)
 
 
 static int attr_decode(struct bfcp_attr **attrp, struct mbuf *mb,
-		       struct bfcp_unknown_attr *uma)
+		       struct bfcp_unknown_attr *uma, struct bfcp_arena *arena)
 {
 	struct bfcp_attr *attr;
 	union bfcp_union *v;
@@ -240,7 +225,7 @@ static int attr_decode(struct bfcp_attr **attrp, struct mbuf *mb,
 	if (mbuf_get_left(mb) < BFCP_ATTR_HDR_SIZE)
 		return EBADMSG;
 
-	attr = mem_zalloc(sizeof(*attr), destructor);
+	attr = arena_alloc(arena, sizeof(*attr));
 	if (!attr)
 		return ENOMEM;
 
@@ -298,11 +283,9 @@ static int attr_decode(struct bfcp_attr **attrp, struct mbuf *mb,
 		if (v->errcode.len == 0)
 			break;
 
-		v->errcode.details = mem_alloc(v->errcode.len, NULL);
-		if (!v->errcode.details) {
-			err = ENOMEM;
-			goto error;
-		}
+		v->errcode.details = arena_alloc(arena, v->errcode.len);
+		if (!v->errcode.details)
+			return ENOMEM;
 
 		(void)mbuf_read_mem(mb, v->errcode.details,
 				    v->errcode.len);
@@ -313,17 +296,19 @@ static int attr_decode(struct bfcp_attr **attrp, struct mbuf *mb,
 	case BFCP_STATUS_INFO:
 	case BFCP_USER_DISP_NAME:
 	case BFCP_USER_URI:
-		err = mbuf_strdup(mb, &v->str, len);
+		v->str = arena_alloc(arena, len + 1);
+		if (!v->str)
+			return ENOMEM;
+
+		(void)mbuf_read_mem(mb, (uint8_t *)v->str, len);
 		break;
 
 	case BFCP_SUPPORTED_ATTRS:
 		v->supattr.attrc = len;
-		v->supattr.attrv = mem_alloc(len*sizeof(*v->supattr.attrv),
-					     NULL);
-		if (!v->supattr.attrv) {
-			err = ENOMEM;
-			goto error;
-		}
+		v->supattr.attrv = arena_alloc(arena, len *
+					       sizeof(*v->supattr.attrv));
+		if (!v->supattr.attrv)
+			return ENOMEM;
 
 		for (i=0; i<len; i++)
 			v->supattr.attrv[i] = mbuf_read_u8(mb) >> 1;
@@ -331,12 +316,10 @@ static int attr_decode(struct bfcp_attr **attrp, struct mbuf *mb,
 
 	case BFCP_SUPPORTED_PRIMS:
 		v->supprim.primc = len;
-		v->supprim.primv = mem_alloc(len * sizeof(*v->supprim.primv),
-					     NULL);
-		if (!v->supprim.primv) {
-			err = ENOMEM;
-			goto error;
-		}
+		v->supprim.primv = arena_alloc(arena, len *
+					       sizeof(*v->supprim.primv));
+		if (!v->supprim.primv)
+			return ENOMEM;
 
 		for (i=0; i<len; i++)
 			v->supprim.primv[i] = mbuf_read_u8(mb);
@@ -353,7 +336,8 @@ static int attr_decode(struct bfcp_attr **attrp, struct mbuf *mb,
 			goto badmsg;
 
 		v->u16 = ntohs(mbuf_read_u16(mb));
-		err = bfcp_attrs_decode(&attr->attrl, mb, len - 2, uma);
+		err = bfcp_attrs_decode(&attr->attrl, mb, len - 2, uma,
+					arena);
 		break;
 
 	default:
@@ -368,7 +352,10 @@ static int attr_decode(struct bfcp_attr **attrp, struct mbuf *mb,
 	}
 
 	if (err)
-		goto error;
+		return err;
+
+	/* skip any value bytes that were not decoded */
+	mb->pos = start + BFCP_ATTR_HDR_SIZE + len;
 
 	/* padding */
 	while (((mb->pos - start) & 0x03) && mbuf_get_left(mb))
@@ -379,21 +366,98 @@ static int attr_decode(struct bfcp_attr **attrp, struct mbuf *mb,
 	return 0;
 
  badmsg:
-	err = EBADMSG;
- error:
-	mem_deref(attr);
+	return EBADMSG;
+}
 
-	return err;
+
+/* Arena size of the attributes in p[0..len), grouped ones included */
+static size_t attrs_size(const uint8_t *p, size_t len)
+{
+	size_t size = 0;
+
+	while (len >= BFCP_ATTR_HDR_SIZE) {
+
+		const enum bfcp_attrib type = p[0] >> 1;
+		const size_t alen = p[1];
+		size_t vlen, plen;
+
+		/* also for a bad attribute, which is allocated first */
+		size += (sizeof(struct bfcp_attr) + 7) & ~(size_t)7;
+
+		if (alen < BFCP_ATTR_HDR_SIZE || alen > len)
+			break;
+
+		vlen = alen - BFCP_ATTR_HDR_SIZE;
+		plen = (alen + 3) & ~(size_t)3;
+
+		switch (type) {
+
+		case BFCP_ERROR_CODE:
+			size += vlen + 7;
+			break;
+
+		case BFCP_ERROR_INFO:
+		case BFCP_PART_PROV_INFO:
+		case BFCP_STATUS_INFO:
+		case BFCP_USER_DISP_NAME:
+		case BFCP_USER_URI:
+			size += vlen + 1 + 7;
+			break;
+
+		case BFCP_SUPPORTED_ATTRS:
+			size += vlen * sizeof(enum bfcp_attrib) + 7;
+			break;
+
+		case BFCP_SUPPORTED_PRIMS:
+			size += vlen * sizeof(enum bfcp_prim) + 7;
+			break;
+
+		case BFCP_BENEFICIARY_INFO:
+		case BFCP_FLOOR_REQ_INFO:
+		case BFCP_REQUESTED_BY_INFO:
+		case BFCP_FLOOR_REQ_STATUS:
+		case BFCP_OVERALL_REQ_STATUS:
+			if (vlen >= 2)
+				size += attrs_size(p + 4, vlen - 2);
+			break;
+
+		default:
+			break;
+		}
+
+		plen = min(plen, len);
+		p   += plen;
+		len -= plen;
+	}
+
+	return size;
+}
+
+
+/**
+ * Get the arena size needed to decode a set of attributes
+ *
+ * @param mb  Mbuf positioned at the first attribute
+ * @param len Length of the attributes in bytes
+ *
+ * @return Arena size in bytes
+ */
+size_t bfcp_attrs_size(const struct mbuf *mb, size_t len)
+{
+	if (!mb)
+		return 0;
+
+	return attrs_size(mbuf_buf(mb), min(len, mbuf_get_left(mb)));
 }
 
 
 int bfcp_attrs_decode(struct list *attrl, struct mbuf *mb, size_t len,
-		      struct bfcp_unknown_attr *uma)
+		      struct bfcp_unknown_attr *uma, struct bfcp_arena *arena)
 {
 	int err = 0;
 	size_t end;
 
-	if (!attrl || !mb || mbuf_get_left(mb) < len)
+	if (!attrl || !mb || !arena || mbuf_get_left(mb) < len)
 		return EINVAL;
 
 	end     = mb->end;
@@ -403,7 +467,7 @@ int bfcp_attrs_decode(struct list *attrl, struct mbuf *mb, size_t len,
 
 		struct bfcp_attr *attr;
 
-		err = attr_decode(&attr, mb, uma);
+		err = attr_decode(&attr, mb, uma, arena);
 		if (err)
 			break;
 
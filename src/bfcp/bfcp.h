@@ -26,9 +26,17 @@ struct bfcp_conn {
 };
 
 
+/** Memory for decoded attributes, carved from the message object */
+struct bfcp_arena {
+	uint8_t *p;
+	size_t left;
+};
+
+
 /* attributes */
+size_t bfcp_attrs_size(const struct mbuf *mb, size_t len);
 int bfcp_attrs_decode(struct list *attrl, struct mbuf *mb, size_t len,
-		      struct bfcp_unknown_attr *uma);
+		      struct bfcp_unknown_attr *uma, struct bfcp_arena *arena);
 struct bfcp_attr *bfcp_attrs_find(const struct list *attrl,
 				  enum bfcp_attrib type);
 struct bfcp_attr *bfcp_attrs_apply(const struct list *attrl,
@@ -20,14 +20,6 @@ enum {
 };
 
 
-static void destructor(void *arg)
-{
-	struct bfcp_msg *msg = arg;
-
-	list_flush(&msg->attrl);
-}
-
-
 static int hdr_encode(struct mbuf *mb, uint8_t ver, bool r,
 		      enum bfcp_prim prim, uint16_t len, uint32_t confid,
 		      uint16_t tid, uint16_t userid)
@@ -151,7 +143,9 @@ int bfcp_msg_encode(struct mbuf *mb, uint8_t ver, bool r, enum bfcp_prim prim,
 
 
 /**
- * Decode a BFCP message from a buffer
+ * Decode a BFCP message from a buffer. The message and all its
+ * attributes are decoded into one memory object; attribute values are
+ * valid for the lifetime of the message.
  *
  * @param msgp Pointer to allocated and decoded BFCP message
  * @param mb   Mbuf to decode from
@@ -160,26 +154,35 @@ int bfcp_msg_encode(struct mbuf *mb, uint8_t ver, bool r, enum bfcp_prim prim,
  */
 int bfcp_msg_decode(struct bfcp_msg **msgp, struct mbuf *mb)
 {
-	struct bfcp_msg *msg;
+	struct bfcp_arena arena;
+	struct bfcp_msg hdr, *msg;
 	size_t start;
 	int err;
 
 	if (!msgp || !mb)
 		return EINVAL;
 
-	msg = mem_zalloc(sizeof(*msg), destructor);
-	if (!msg)
-		return ENOMEM;
-
 	start = mb->pos;
 
-	err = hdr_decode(msg, mb);
+	memset(&hdr, 0, sizeof(hdr));
+
+	err = hdr_decode(&hdr, mb);
 	if (err) {
 		mb->pos = start;
-		goto out;
+		return err;
 	}
 
-	err = bfcp_attrs_decode(&msg->attrl, mb, 4*msg->len, &msg->uma);
+	arena.left = bfcp_attrs_size(mb, 4*hdr.len);
+
+	msg = mem_alloc(sizeof(*msg) + arena.left, NULL);
+	if (!msg)
+		return ENOMEM;
+
+	*msg = hdr;
+	arena.p = (uint8_t *)(msg + 1);
+
+	err = bfcp_attrs_decode(&msg->attrl, mb, 4*msg->len, &msg->uma,
+				&arena);
 	if (err)
 		goto out;
 
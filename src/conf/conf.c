@@ -6,6 +6,9 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
@@ -16,6 +19,8 @@
 #include <re_fmt.h>
 #include <re_mem.h>
 #include <re_mbuf.h>
+#include <re_list.h>
+#include <re_hash.h>
 #include <re_conf.h>
 
 
@@ -26,26 +31,57 @@
 #endif
 
 
+/*
+ * The keys are indexed when the configuration is loaded, so that a
+ * lookup is a hash map probe instead of a scan of the whole buffer. All
+ * items with the same key are chained in the order of the file.
+ */
+
+
+/** Defines a configuration item, as a key and value in the buffer */
+struct conf_item {
+	struct pl key;
+	struct pl val;
+	struct conf_item *next;  /**< Next item with the same key        */
+	struct conf_item *last;  /**< Last item with the same key, head  */
+};
+
 /**
  * Defines a Configuration state. The configuration data is stored in a
  * linear buffer which can be used for reading key-value pairs of
  * configuration data. The config data can be strings or numeric values.
  */
 struct conf {
-	struct mbuf *mb;
+	struct mbuf *mb;           /**< Copied configuration data         */
+	void *map;                 /**< Mapped configuration file         */
+	size_t mapsz;              /**< Size of mapped file               */
+	struct hmap *index;        /**< Head items, by key                */
+	struct conf_item *itemv;   /**< All items                         */
 };
 
 
 static int load_file(struct mbuf *mb, const char *filename)
 {
+	struct stat st;
 	int err = 0, fd = open(filename, O_RDONLY);
 	if (fd < 0)
 		return errno;
 
-	for (;;) {
-		uint8_t buf[1024];
+	/* one byte more, to see the end of the file without growing */
+	if (!fstat(fd, &st) && st.st_size > 0)
+		err = mbuf_resize(mb, mb->end + (size_t)st.st_size + 1);
+
+	while (!err) {
+
+		ssize_t n;
+
+		if (mb->end == mb->size) {
+			err = mbuf_resize(mb, mb->size * 2);
+			if (err)
+				break;
+		}
 
-		const ssize_t n = read(fd, (void *)buf, sizeof(buf));
+		n = read(fd, (void *)(mb->buf + mb->end), mb->size - mb->end);
 		if (n < 0) {
 			err = errno;
 			break;
@@ -53,7 +89,7 @@ static int load_file(struct mbuf *mb, const char *filename)
 		else if (n == 0)
 			break;
 
-		err |= mbuf_write_mem(mb, buf, n);
+		mb->end += n;
 	}
 
 	(void)close(fd);
@@ -62,23 +98,149 @@ static int load_file(struct mbuf *mb, const char *filename)
 }
 
 
+static inline bool is_space(char c)
+{
+	return c == ' ' || c == '\t';
+}
+
+
+static inline bool is_eol(char c)
+{
+	return c == '\r' || c == '\n';
+}
+
+
+/* Get the key and the first word of the value of the next line */
+static bool line_next(struct pl *rest, struct pl *key, struct pl *val)
+{
+	const char *p = rest->p, *e = rest->p + rest->l;
+
+	while (p < e) {
+
+		const char *ks, *ke, *vs, *ve;
+
+		while (p < e && (is_space(*p) || is_eol(*p)))
+			++p;
+
+		for (ks = p; p < e && !is_space(*p) && !is_eol(*p); p++)
+			;
+		ke = p;
+
+		while (p < e && is_space(*p))
+			++p;
+
+		for (vs = p; p < e && !is_space(*p) && !is_eol(*p); p++)
+			;
+		ve = p;
+
+		/* the rest of the line is ignored */
+		while (p < e && !is_eol(*p))
+			++p;
+
+		if (ke == ks || ve == vs)
+			continue;
+
+		key->p = ks;
+		key->l = ke - ks;
+		val->p = vs;
+		val->l = ve - vs;
+
+		rest->l = e - p;
+		rest->p = p;
+
+		return true;
+	}
+
+	return false;
+}
+
+
+static bool item_cmp_handler(const void *val, void *arg)
+{
+	const struct conf_item *item = val;
+
+	return 0 == pl_cmp(&item->key, arg);
+}
+
+
+static const struct conf_item *item_find(const struct conf *conf,
+					 const char *name)
+{
+	struct pl key;
+
+	pl_set_str(&key, name);
+
+	return hmap_lookup(conf->index, hash_joaat_pl(&key),
+			   item_cmp_handler, &key);
+}
+
+
+static int conf_index(struct conf *conf, const char *buf, size_t len)
+{
+	struct conf_item *item;
+	struct pl rest, key, val;
+	size_t i, n = 1;
+	int err;
+
+	/* at most one item per line */
+	for (i=0; i<len; i++) {
+		if (is_eol(buf[i]))
+			++n;
+	}
+
+	conf->itemv = mem_zalloc(n * sizeof(*conf->itemv), NULL);
+	if (!conf->itemv)
+		return ENOMEM;
+
+	err = hmap_alloc(&conf->index, (uint32_t)min(n, (size_t)65536));
+	if (err)
+		return err;
+
+	rest.p = buf;
+	rest.l = len;
+
+	for (item = conf->itemv; line_next(&rest, &key, &val); item++) {
+
+		struct conf_item *head;
+		const uint32_t hkey = hash_joaat_pl(&key);
+
+		item->key = key;
+		item->val = val;
+
+		head = hmap_lookup(conf->index, hkey, item_cmp_handler, &key);
+		if (head) {
+			head->last->next = item;
+			head->last = item;
+			continue;
+		}
+
+		item->last = item;
+
+		err = hmap_insert(conf->index, hkey, item);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+
 static void conf_destructor(void *data)
 {
 	struct conf *conf = data;
 
+	mem_deref(conf->index);
+	mem_deref(conf->itemv);
 	mem_deref(conf->mb);
+#ifdef HAVE_MMAP
+	if (conf->map)
+		(void)munmap(conf->map, conf->mapsz);
+#endif
 }
 
 
-/**
- * Load configuration from file
- *
- * @param confp    Configuration object to be allocated
- * @param filename Name of configuration file
- *
- * @return 0 if success, otherwise errorcode
- */
-int conf_alloc(struct conf **confp, const char *filename)
+static int conf_create(struct conf **confp, const uint8_t *buf, size_t sz,
+		       const char *filename)
 {
 	struct conf *conf;
 	int err = 0;
@@ -90,15 +252,20 @@ int conf_alloc(struct conf **confp, const char *filename)
 	if (!conf)
 		return ENOMEM;
 
-	conf->mb = mbuf_alloc(1024);
+	conf->mb = mbuf_alloc(sz ? sz : 1024);
 	if (!conf->mb) {
 		err = ENOMEM;
 		goto out;
 	}
 
-	err |= mbuf_write_u8(conf->mb, '\n');
-	if (filename)
-		err |= load_file(conf->mb, filename);
+	if (buf)
+		err = mbuf_write_mem(conf->mb, buf, sz);
+	else if (filename)
+		err = load_file(conf->mb, filename);
+	if (err)
+		goto out;
+
+	err = conf_index(conf, (const char *)conf->mb->buf, conf->mb->end);
 
  out:
 	if (err)
@@ -111,31 +278,101 @@ int conf_alloc(struct conf **confp, const char *filename)
 
 
 /**
- * Allocate configuration from a buffer
+ * Load configuration from file
  *
  * @param confp    Configuration object to be allocated
- * @param buf      Buffer containing configuration
- * @param sz       Size of configuration buffer
+ * @param filename Name of configuration file
  *
  * @return 0 if success, otherwise errorcode
  */
-int conf_alloc_buf(struct conf **confp, const uint8_t *buf, size_t sz)
+int conf_alloc(struct conf **confp, const char *filename)
+{
+	return conf_create(confp, NULL, 0, filename);
+}
+
+
+/**
+ * Load configuration from file, by mapping it into memory instead of
+ * copying it. The file must not be truncated while the configuration
+ * object exists. Where mmap() is not available, the file is copied.
+ *
+ * @param confp    Configuration object to be allocated
+ * @param filename Name of configuration file
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int conf_alloc_mmap(struct conf **confp, const char *filename)
 {
+#ifdef HAVE_MMAP
 	struct conf *conf;
-	int err;
+	struct stat st;
+	int fd, err = 0;
 
-	err = conf_alloc(&conf, NULL);
-	if (err)
+	if (!confp || !filename)
+		return EINVAL;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return errno;
+
+	if (fstat(fd, &st)) {
+		err = errno;
+		(void)close(fd);
 		return err;
+	}
+
+	/* an empty or special file cannot be mapped */
+	if (!S_ISREG(st.st_mode) || st.st_size <= 0) {
+		(void)close(fd);
+		return conf_alloc(confp, filename);
+	}
+
+	conf = mem_zalloc(sizeof(*conf), conf_destructor);
+	if (!conf) {
+		(void)close(fd);
+		return ENOMEM;
+	}
+
+	conf->mapsz = (size_t)st.st_size;
+	conf->map = mmap(NULL, conf->mapsz, PROT_READ, MAP_PRIVATE, fd, 0);
+	(void)close(fd);
 
-	err = mbuf_write_mem(conf->mb, buf, sz);
+	if (conf->map == MAP_FAILED) {
+		err = errno;
+		conf->map = NULL;
+		goto out;
+	}
 
+	err = conf_index(conf, conf->map, conf->mapsz);
+
+ out:
 	if (err)
 		mem_deref(conf);
 	else
 		*confp = conf;
 
 	return err;
+#else
+	return conf_alloc(confp, filename);
+#endif
+}
+
+
+/**
+ * Allocate configuration from a buffer
+ *
+ * @param confp    Configuration object to be allocated
+ * @param buf      Buffer containing configuration
+ * @param sz       Size of configuration buffer
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int conf_alloc_buf(struct conf **confp, const uint8_t *buf, size_t sz)
+{
+	if (!buf)
+		return EINVAL;
+
+	return conf_create(confp, buf, sz, NULL);
 }
 
 
@@ -150,19 +387,18 @@ int conf_alloc_buf(struct conf **confp, const uint8_t *buf, size_t sz)
  */
 int conf_get(const struct conf *conf, const char *name, struct pl *pl)
 {
-	char expr[512];
-	struct pl spl;
+	const struct conf_item *item;
 
 	if (!conf || !name || !pl)
 		return EINVAL;
 
-	spl.p = (const char *)conf->mb->buf;
-	spl.l = conf->mb->end;
+	item = item_find(conf, name);
+	if (!item)
+		return ENOENT;
 
-	(void)re_snprintf(expr, sizeof(expr),
-			  "[\r\n]+[ \t]*%s[ \t]+[~ \t\r\n]+", name);
+	*pl = item->val;
 
-	return re_regex(spl.p, spl.l, expr, NULL, NULL, NULL, pl);
+	return 0;
 }
 
 
@@ -267,27 +503,17 @@ int conf_get_bool(const struct conf *conf, const char *name, bool *val)
 int conf_apply(const struct conf *conf, const char *name,
 	       conf_h *ch, void *arg)
 {
-	char expr[512];
-	struct pl pl, val;
+	const struct conf_item *item;
 	int err = 0;
 
 	if (!conf || !name || !ch)
 		return EINVAL;
 
-	pl.p = (const char *)conf->mb->buf;
-	pl.l = conf->mb->end;
-
-	(void)re_snprintf(expr, sizeof(expr),
-			  "[\r\n]+[ \t]*%s[ \t]+[~ \t\r\n]+", name);
+	for (item = item_find(conf, name); item; item = item->next) {
 
-	while (!re_regex(pl.p, pl.l, expr, NULL, NULL, NULL, &val)) {
-
-		err = ch(&val, arg);
+		err = ch(&item->val, arg);
 		if (err)
 			break;
-
-		pl.l -= val.p + val.l - pl.p;
-		pl.p  = val.p + val.l;
 	}
 
 	return err;
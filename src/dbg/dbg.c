@@ -4,6 +4,7 @@
  * Copyright (C) 2010 Creytiv.com
  */
 #include <stdio.h>
+#include <string.h>
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
@@ -47,6 +48,23 @@ static struct {
 };
 
 
+enum {
+	MODULE_MAX     = 32,
+	MODULE_NAME_SZ = 16,
+};
+
+/** Debug level of a module */
+struct dbg_module {
+	char name[MODULE_NAME_SZ];
+	int level;
+};
+
+static struct dbg_module modulev[MODULE_MAX];
+static size_t modulec;
+
+int dbg_level_any = DBG_INFO;
+
+
 #ifdef HAVE_PTHREAD
 static inline void dbg_lock(void)
 {
@@ -64,6 +82,238 @@ static inline void dbg_unlock(void)
 #endif
 
 
+#if defined (HAVE_PTHREAD) && defined (__ATOMIC_RELAXED)
+#define DBG_ASYNC 1
+#endif
+
+
+#ifdef DBG_ASYNC
+
+/*
+ * In async mode each thread formats its messages into its own ring, and
+ * a writer thread does the output. The rings have a single producer and
+ * a single consumer, so no lock is taken when a message is queued. The
+ * arguments are formatted by the caller, since they may point to objects
+ * that are gone when the writer gets to the message. Messages that do
+ * not fit in a full ring are dropped and counted. The writer sleeps when
+ * all rings are empty, and the next message wakes it up, which is the
+ * only time a producer takes a lock.
+ */
+
+enum {
+	ASYNC_SLOTS   = 128,    /**< Messages per thread, power of two  */
+	ASYNC_MSG_SZ  = 256,    /**< Maximum message length             */
+};
+
+/** A formatted message */
+struct dbg_msg {
+	uint64_t ticks;
+	int level;
+	size_t len;
+	char buf[ASYNC_MSG_SZ];
+};
+
+/** Message ring of one thread */
+struct dbg_ring {
+	struct dbg_ring *next;
+	uint32_t head;         /**< Written by the producer */
+	uint32_t tail;         /**< Written by the writer   */
+	bool dead;             /**< The thread has exited   */
+	struct dbg_msg msgv[ASYNC_SLOTS];
+};
+
+static pthread_mutex_t async_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t  async_once = PTHREAD_ONCE_INIT;
+static pthread_key_t   async_key;
+static bool            async_key_ok;
+static pthread_mutex_t wake_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  wake_cond = PTHREAD_COND_INITIALIZER;
+
+/** Async state, the list of rings is protected by the async lock */
+static struct {
+	pthread_t thread;
+	struct dbg_ring *ringl;
+	uint64_t dropped;
+	uint64_t reported;
+	bool run;
+	bool idle;             /**< The writer is waiting for messages */
+} async;
+
+
+static void ring_free(struct dbg_ring *ring)
+{
+	struct dbg_ring **rp;
+
+	for (rp = &async.ringl; *rp; rp = &(*rp)->next) {
+
+		if (*rp == ring) {
+			*rp = ring->next;
+			break;
+		}
+	}
+
+	free(ring);
+}
+
+
+static void ring_destructor(void *arg)
+{
+	struct dbg_ring *ring = arg;
+
+	pthread_mutex_lock(&async_mutex);
+
+	/* the writer frees it when it has been drained */
+	if (__atomic_load_n(&async.run, __ATOMIC_ACQUIRE))
+		__atomic_store_n(&ring->dead, true, __ATOMIC_RELEASE);
+	else
+		ring_free(ring);
+
+	pthread_mutex_unlock(&async_mutex);
+}
+
+
+static void async_init(void)
+{
+	async_key_ok = (0 == pthread_key_create(&async_key, ring_destructor));
+}
+
+
+static struct dbg_ring *ring_get(void)
+{
+	struct dbg_ring *ring;
+
+	pthread_once(&async_once, async_init);
+
+	if (!async_key_ok)
+		return NULL;
+
+	ring = pthread_getspecific(async_key);
+	if (ring)
+		return ring;
+
+	ring = calloc(1, sizeof(*ring));
+	if (!ring)
+		return NULL;
+
+	if (pthread_setspecific(async_key, ring)) {
+		free(ring);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&async_mutex);
+	ring->next  = async.ringl;
+	async.ringl = ring;
+	pthread_mutex_unlock(&async_mutex);
+
+	return ring;
+}
+
+
+/* Queue a message, returns false if async mode is off */
+static bool async_push(int level, const char *fmt, va_list ap)
+{
+	struct dbg_ring *ring;
+	struct dbg_msg *msg;
+	uint32_t head;
+	int len;
+
+	if (!__atomic_load_n(&async.run, __ATOMIC_ACQUIRE))
+		return false;
+
+	ring = ring_get();
+	if (!ring)
+		return false;
+
+	head = ring->head;
+
+	if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)
+	    >= ASYNC_SLOTS) {
+		__atomic_add_fetch(&async.dropped, 1, __ATOMIC_RELAXED);
+		return true;
+	}
+
+	msg = &ring->msgv[head % ASYNC_SLOTS];
+
+	len = re_vsnprintf(msg->buf, sizeof(msg->buf), fmt, ap);
+	if (len <= 0)
+		return true;
+
+	msg->len   = (size_t)len;
+	msg->level = level;
+	msg->ticks = (dbg.flags & DBG_TIME) ? tmr_jiffies() : 0;
+
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_SEQ_CST);
+
+	if (__atomic_exchange_n(&async.idle, false, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&wake_mutex);
+		pthread_cond_signal(&wake_cond);
+		pthread_mutex_unlock(&wake_mutex);
+	}
+
+	return true;
+}
+#endif
+
+
+static const char *ansi_color(int level)
+{
+	switch (level) {
+
+	case DBG_WARNING: return "\x1b[31m"; /* Red */
+	case DBG_NOTICE:  return "\x1b[33m"; /* Yellow */
+	case DBG_INFO:    return "\x1b[32m"; /* Green */
+	default:          return NULL;
+	}
+}
+
+
+static void update_level_any(void)
+{
+	int level = dbg.level;
+	size_t i;
+
+	for (i=0; i<modulec; i++) {
+
+		if (modulev[i].level > level)
+			level = modulev[i].level;
+	}
+
+	dbg_level_any = level;
+}
+
+
+static const struct dbg_module *module_find(const char *name, size_t len)
+{
+	size_t i;
+
+	for (i=0; i<modulec; i++) {
+
+		const struct dbg_module *mod = &modulev[i];
+
+		if (!strncmp(mod->name, name, len) && !mod->name[len])
+			return mod;
+	}
+
+	return NULL;
+}
+
+
+/* The level of a message, with the module name as prefix of the format */
+static bool fmt_enabled(int level, const char *fmt)
+{
+	const struct dbg_module *mod = NULL;
+	const char *p;
+
+	if (modulec) {
+		p = strchr(fmt, ':');
+		if (p && p > fmt && (size_t)(p - fmt) < MODULE_NAME_SZ)
+			mod = module_find(fmt, p - fmt);
+	}
+
+	return level <= (mod ? mod->level : dbg.level);
+}
+
+
 /**
  * Initialise debug printing
  *
@@ -75,6 +325,8 @@ void dbg_init(int level, enum dbg_flags flags)
 	dbg.tick  = tmr_jiffies();
 	dbg.level = level;
 	dbg.flags = flags;
+
+	update_level_any();
 }
 
 
@@ -118,6 +370,76 @@ int dbg_logfile_set(const char *name)
 }
 
 
+/**
+ * Set the debug level of one module, e.g. "sip", which is the value of
+ * DEBUG_MODULE. The module level is used instead of the global level,
+ * up to the level that the module was compiled with.
+ *
+ * @param module Module name
+ * @param level  Debug level, or -1 to use the global level again
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int dbg_module_level_set(const char *module, int level)
+{
+	struct dbg_module *mod;
+	size_t len;
+	int err = 0;
+
+	if (!module)
+		return EINVAL;
+
+	len = strlen(module);
+	if (!len || len >= MODULE_NAME_SZ)
+		return EINVAL;
+
+	dbg_lock();
+
+	mod = (struct dbg_module *)module_find(module, len);
+
+	if (level < 0) {
+		if (mod)
+			*mod = modulev[--modulec];
+	}
+	else if (mod) {
+		mod->level = level;
+	}
+	else if (modulec < MODULE_MAX) {
+		mod = &modulev[modulec++];
+		memcpy(mod->name, module, len + 1);
+		mod->level = level;
+	}
+	else {
+		err = ENOMEM;
+	}
+
+	update_level_any();
+
+	dbg_unlock();
+
+	return err;
+}
+
+
+/**
+ * Check if a debug level is enabled for a module, see dbg_enabled()
+ *
+ * @param level  Debug level
+ * @param module Module name
+ *
+ * @return True if enabled, otherwise false
+ */
+bool dbg_module_enabled(int level, const char *module)
+{
+	const struct dbg_module *mod = NULL;
+
+	if (modulec && module)
+		mod = module_find(module, strlen(module));
+
+	return level <= (mod ? mod->level : dbg.level);
+}
+
+
 /**
  * Set optional debug print handler
  *
@@ -134,35 +456,14 @@ void dbg_handler_set(dbg_print_h *ph, void *arg)
 /* NOTE: This function should not allocate memory */
 static void dbg_vprintf(int level, const char *fmt, va_list ap)
 {
-	if (level > dbg.level)
-		return;
-
 	/* Print handler? */
 	if (dbg.ph)
 		return;
 
 	dbg_lock();
 
-	if (dbg.flags & DBG_ANSI) {
-
-		switch (level) {
-
-		case DBG_WARNING:
-			(void)re_fprintf(stderr, "\x1b[31m"); /* Red */
-			break;
-
-		case DBG_NOTICE:
-			(void)re_fprintf(stderr, "\x1b[33m"); /* Yellow */
-			break;
-
-		case DBG_INFO:
-			(void)re_fprintf(stderr, "\x1b[32m"); /* Green */
-			break;
-
-		default:
-			break;
-		}
-	}
+	if (dbg.flags & DBG_ANSI && ansi_color(level))
+		(void)re_fprintf(stderr, "%s", ansi_color(level));
 
 	if (dbg.flags & DBG_TIME) {
 		const uint64_t ticks = tmr_jiffies();
@@ -188,9 +489,6 @@ static void dbg_fmt_vprintf(int level, const char *fmt, va_list ap)
 	char buf[256];
 	int len;
 
-	if (level > dbg.level)
-		return;
-
 	if (!dbg.ph && !dbg.f)
 		return;
 
@@ -216,6 +514,226 @@ static void dbg_fmt_vprintf(int level, const char *fmt, va_list ap)
 }
 
 
+#ifdef DBG_ASYNC
+/* Output of a queued message, called with the debug lock held */
+static void async_output(const struct dbg_msg *msg)
+{
+	if (dbg.ph) {
+		dbg.ph(msg->level, msg->buf, msg->len, dbg.arg);
+	}
+	else {
+		const char *col = ansi_color(msg->level);
+
+		if (dbg.flags & DBG_ANSI && col)
+			(void)fputs(col, stderr);
+
+		if (dbg.flags & DBG_TIME) {
+
+			if (0 == dbg.tick)
+				dbg.tick = msg->ticks;
+
+			(void)re_fprintf(stderr, "[%09llu] ",
+					 msg->ticks - dbg.tick);
+		}
+
+		(void)fwrite(msg->buf, 1, msg->len, stderr);
+
+		if (dbg.flags & DBG_ANSI && msg->level < DBG_DEBUG)
+			(void)fputs("\x1b[;m", stderr);
+	}
+
+	if (dbg.f)
+		(void)fwrite(msg->buf, 1, msg->len, dbg.f);
+}
+
+
+/* Write all queued messages, returns the number of messages */
+static size_t async_drain(void)
+{
+	struct dbg_ring *ring, *next;
+	uint64_t dropped;
+	size_t n = 0;
+
+	pthread_mutex_lock(&async_mutex);
+	dbg_lock();
+
+	for (ring = async.ringl; ring; ring = next) {
+
+		const bool dead = __atomic_load_n(&ring->dead,
+						  __ATOMIC_ACQUIRE);
+		const uint32_t head = __atomic_load_n(&ring->head,
+						      __ATOMIC_ACQUIRE);
+		uint32_t tail = ring->tail;
+
+		next = ring->next;
+
+		for (; tail != head; ++tail, ++n) {
+
+			async_output(&ring->msgv[tail % ASYNC_SLOTS]);
+
+			__atomic_store_n(&ring->tail, tail + 1,
+					 __ATOMIC_RELEASE);
+		}
+
+		if (dead)
+			ring_free(ring);
+	}
+
+	dropped = __atomic_load_n(&async.dropped, __ATOMIC_RELAXED);
+	if (dropped != async.reported) {
+
+		struct dbg_msg msg;
+
+		msg.level = DBG_WARNING;
+		msg.ticks = tmr_jiffies();
+		msg.len   = re_snprintf(msg.buf, sizeof(msg.buf),
+					"dbg: %llu messages dropped\n",
+					dropped - async.reported);
+
+		async_output(&msg);
+
+		async.reported = dropped;
+	}
+
+	if (n) {
+		(void)fflush(stderr);
+		if (dbg.f)
+			(void)fflush(dbg.f);
+	}
+
+	dbg_unlock();
+	pthread_mutex_unlock(&async_mutex);
+
+	return n;
+}
+
+
+static bool async_pending(void)
+{
+	const struct dbg_ring *ring;
+	bool pending = false;
+
+	pthread_mutex_lock(&async_mutex);
+
+	for (ring = async.ringl; ring && !pending; ring = ring->next) {
+
+		pending = ring->tail != __atomic_load_n(&ring->head,
+							__ATOMIC_SEQ_CST);
+	}
+
+	pthread_mutex_unlock(&async_mutex);
+
+	return pending;
+}
+
+
+static void *async_thread(void *arg)
+{
+	(void)arg;
+
+	while (__atomic_load_n(&async.run, __ATOMIC_ACQUIRE)) {
+
+		if (async_drain())
+			continue;
+
+		pthread_mutex_lock(&wake_mutex);
+
+		/* a producer either sees the flag, or its message is seen */
+		__atomic_store_n(&async.idle, true, __ATOMIC_SEQ_CST);
+
+		if (!async_pending() && __atomic_load_n(&async.run,
+							__ATOMIC_SEQ_CST))
+			pthread_cond_wait(&wake_cond, &wake_mutex);
+
+		__atomic_store_n(&async.idle, false, __ATOMIC_SEQ_CST);
+
+		pthread_mutex_unlock(&wake_mutex);
+	}
+
+	/* the messages that were queued before the stop */
+	(void)async_drain();
+
+	return NULL;
+}
+#endif
+
+
+/**
+ * Enable or disable asynchronous debug output. In async mode messages
+ * are queued by the calling thread, and written to stderr, the logfile
+ * and the print handler by a writer thread. Messages are limited to
+ * 256 bytes, and are dropped if the queue of the thread is full.
+ *
+ * @param enable True to start the writer thread, False to stop it
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int dbg_async_enable(bool enable)
+{
+#ifdef DBG_ASYNC
+	int err;
+
+	if (enable == __atomic_load_n(&async.run, __ATOMIC_ACQUIRE))
+		return 0;
+
+	if (!enable) {
+		pthread_mutex_lock(&wake_mutex);
+		__atomic_store_n(&async.run, false, __ATOMIC_SEQ_CST);
+		pthread_cond_signal(&wake_cond);
+		pthread_mutex_unlock(&wake_mutex);
+
+		(void)pthread_join(async.thread, NULL);
+		return 0;
+	}
+
+	__atomic_store_n(&async.run, true, __ATOMIC_RELEASE);
+
+	err = pthread_create(&async.thread, NULL, async_thread, NULL);
+	if (err)
+		__atomic_store_n(&async.run, false, __ATOMIC_RELEASE);
+
+	return err;
+#else
+	return enable ? ENOSYS : 0;
+#endif
+}
+
+
+/**
+ * Get the number of messages dropped in async mode
+ *
+ * @return Number of dropped messages
+ */
+uint64_t dbg_async_dropped(void)
+{
+#ifdef DBG_ASYNC
+	return __atomic_load_n(&async.dropped, __ATOMIC_RELAXED);
+#else
+	return 0;
+#endif
+}
+
+
+static void dbg_vlog(int level, const char *fmt, va_list ap)
+{
+	va_list aq;
+
+	if (level > dbg_level_any || !fmt_enabled(level, fmt))
+		return;
+
+#ifdef DBG_ASYNC
+	if (async_push(level, fmt, ap))
+		return;
+#endif
+
+	va_copy(aq, ap);
+	dbg_vprintf(level, fmt, aq);
+	va_end(aq);
+
+	dbg_fmt_vprintf(level, fmt, ap);
+}
+
+
 /**
  * Print a formatted debug message
  *
@@ -227,11 +745,7 @@ void dbg_printf(int level, const char *fmt, ...)
 	va_list ap;
 
 	va_start(ap, fmt);
-	dbg_vprintf(level, fmt, ap);
-	va_end(ap);
-
-	va_start(ap, fmt);
-	dbg_fmt_vprintf(level, fmt, ap);
+	dbg_vlog(level, fmt, ap);
 	va_end(ap);
 }
 
@@ -257,11 +771,7 @@ void dbg_warning(const char *fmt, ...)
 	va_list ap;
 
 	va_start(ap, fmt);
-	dbg_vprintf(DBG_WARNING, fmt, ap);
-	va_end(ap);
-
-	va_start(ap, fmt);
-	dbg_fmt_vprintf(DBG_WARNING, fmt, ap);
+	dbg_vlog(DBG_WARNING, fmt, ap);
 	va_end(ap);
 }
 
@@ -276,11 +786,7 @@ void dbg_notice(const char *fmt, ...)
 	va_list ap;
 
 	va_start(ap, fmt);
-	dbg_vprintf(DBG_NOTICE, fmt, ap);
-	va_end(ap);
-
-	va_start(ap, fmt);
-	dbg_fmt_vprintf(DBG_NOTICE, fmt, ap);
+	dbg_vlog(DBG_NOTICE, fmt, ap);
 	va_end(ap);
 }
 
@@ -295,11 +801,7 @@ void dbg_info(const char *fmt, ...)
 	va_list ap;
 
 	va_start(ap, fmt);
-	dbg_vprintf(DBG_INFO, fmt, ap);
-	va_end(ap);
-
-	va_start(ap, fmt);
-	dbg_fmt_vprintf(DBG_INFO, fmt, ap);
+	dbg_vlog(DBG_INFO, fmt, ap);
 	va_end(ap);
 }
 
@@ -0,0 +1,137 @@
+/**
+ * @file dns/arena.c  Shared storage for decoded DNS records
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re_types.h>
+#include <re_fmt.h>
+#include <re_mem.h>
+#include <re_mbuf.h>
+#include <re_list.h>
+#include <re_dns.h>
+#include "dns.h"
+
+
+/*
+ * The strings of all records decoded from one message are stored in a few
+ * large chunks, instead of one memory object per string. Each record holds
+ * a reference to the arena, which is freed with the last record. Names that
+ * were stored recently are shared, since the records of a reply mostly
+ * have the same owner name.
+ */
+
+
+enum {
+	ARENA_MIN    = 256,
+	ARENA_RECENT = 4,
+};
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size;
+	size_t used;
+};
+
+/** Defines a DNS arena */
+struct dns_arena {
+	struct arena_chunk *chunk;           /**< Chunks, newest first   */
+	const char *recentv[ARENA_RECENT];   /**< Recently stored names  */
+	uint32_t recent;                     /**< Next recent slot       */
+	size_t size;                         /**< Default chunk size     */
+};
+
+
+static void destructor(void *arg)
+{
+	struct dns_arena *arena = arg;
+
+	while (arena->chunk) {
+		struct arena_chunk *c = arena->chunk;
+
+		arena->chunk = c->next;
+		mem_deref(c);
+	}
+}
+
+
+/**
+ * Allocate a DNS arena, for decoding the records of one message with
+ * dns_rr_decode_arena()
+ *
+ * @param arenap Pointer to allocated arena
+ * @param size   Expected size of all strings, e.g. the message size
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int dns_arena_alloc(struct dns_arena **arenap, size_t size)
+{
+	struct dns_arena *arena;
+
+	if (!arenap)
+		return EINVAL;
+
+	arena = mem_zalloc(sizeof(*arena), destructor);
+	if (!arena)
+		return ENOMEM;
+
+	arena->size = max(size, (size_t)ARENA_MIN);
+
+	*arenap = arena;
+
+	return 0;
+}
+
+
+/* Get memory that lives as long as the arena */
+char *dns_arena_get(struct dns_arena *arena, size_t size)
+{
+	struct arena_chunk *c = arena->chunk;
+	char *p;
+
+	if (!c || c->size - c->used < size) {
+
+		const size_t csize = max(arena->size, size);
+
+		c = mem_alloc(sizeof(*c) + csize, NULL);
+		if (!c)
+			return NULL;
+
+		c->size = csize;
+		c->used = 0;
+		c->next = arena->chunk;
+		arena->chunk = c;
+	}
+
+	p = (char *)(c + 1) + c->used;
+	c->used += size;
+
+	return p;
+}
+
+
+/* Store a string, or share a recent one that is the same */
+char *dns_arena_strdup(struct dns_arena *arena, const char *str, size_t len)
+{
+	uint32_t i;
+	char *p;
+
+	for (i=0; i<ARENA_RECENT; i++) {
+
+		const char *s = arena->recentv[i];
+
+		if (s && !strncmp(s, str, len) && strlen(s) == len)
+			return (char *)s;
+	}
+
+	p = dns_arena_get(arena, len + 1);
+	if (!p)
+		return NULL;
+
+	memcpy(p, str, len);
+	p[len] = '\0';
+
+	arena->recentv[arena->recent++ % ARENA_RECENT] = p;
+
+	return p;
+}
@@ -0,0 +1,462 @@
+/**
+ * @file dns/cache.c  DNS Client answer cache
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re_types.h>
+#include <re_fmt.h>
+#include <re_mem.h>
+#include <re_mbuf.h>
+#include <re_list.h>
+#include <re_hash.h>
+#include <re_tmr.h>
+#include <re_sa.h>
+#include <re_snap.h>
+#include <re_dns.h>
+#include "dns.h"
+
+
+/*
+ * A reply is cached as it was received, and the records are decoded again
+ * for every hit, so each query gets its own records. The entries are kept
+ * in a list in the order they were used, and the least recently used entry
+ * is dropped when the cache is full. Expired entries are dropped when
+ * they are looked up.
+ *
+ * A hit after 90% of the TTL asks the caller to query the name again, so
+ * that a popular entry is refreshed before it expires. An expired entry
+ * may be kept for a while longer and served stale (RFC 8767), while it is
+ * refreshed or when the servers do not answer.
+ *
+ * A snapshot of the cache stores the age and the TTL of the entries, so
+ * the restored entries expire when they would have in the old process.
+ */
+
+
+enum {
+	REFRESH_RETRY = 10000,  /**< Time between refreshes of an entry [ms] */
+};
+
+
+/** Defines a DNS answer cache */
+struct dns_cache {
+	struct list lrul;     /**< Entries, least recently used first */
+	struct hash *ht;      /**< Entries by name                    */
+	uint32_t size;        /**< Maximum number of entries          */
+	uint64_t stale;       /**< Time to keep expired entries [ms]  */
+	uint32_t hits;        /**< Number of lookups found            */
+	uint32_t misses;      /**< Number of lookups not found        */
+	uint32_t nstale;      /**< Number of stale entries found      */
+};
+
+/** Cached reply */
+struct cache_ent {
+	struct le le;         /**< LRU list element                   */
+	struct le he;         /**< Hash element                       */
+	struct dnshdr hdr;    /**< DNS Header of the reply            */
+	struct mbuf *mb;      /**< Reply message                      */
+	size_t pos;           /**< Position of the first record       */
+	char *name;           /**< Query name                         */
+	uint64_t ts;          /**< Time the reply was stored [ms]     */
+	uint64_t refresh;     /**< Time of next refresh [ms]          */
+	uint64_t expires;     /**< Expiry time [ms]                   */
+	uint16_t type;        /**< Query type                         */
+	uint16_t dnsclass;    /**< Query class                        */
+};
+
+struct cache_key {
+	const char *name;
+	uint16_t type;
+	uint16_t dnsclass;
+};
+
+
+static void cache_destructor(void *data)
+{
+	struct dns_cache *cache = data;
+
+	dns_cache_flush(cache);
+	mem_deref(cache->ht);
+}
+
+
+static void ent_destructor(void *data)
+{
+	struct cache_ent *ent = data;
+
+	list_unlink(&ent->le);
+	hash_unlink(&ent->he);
+	mem_deref(ent->mb);
+	mem_deref(ent->name);
+}
+
+
+static inline uint32_t name_hash(const char *name)
+{
+	return hash_fast_ci(name, str_len(name));
+}
+
+
+static uint32_t ent_key(const struct le *le)
+{
+	const struct cache_ent *ent = le->data;
+
+	return name_hash(ent->name);
+}
+
+
+static bool ent_cmp_handler(struct le *le, void *arg)
+{
+	const struct cache_ent *ent = le->data;
+	const struct cache_key *key = arg;
+
+	return ent->type == key->type && ent->dnsclass == key->dnsclass &&
+		!str_casecmp(ent->name, key->name);
+}
+
+
+static struct cache_ent *ent_find(const struct dns_cache *cache,
+				  const char *name, uint16_t type,
+				  uint16_t dnsclass)
+{
+	struct cache_key key;
+
+	key.name     = name;
+	key.type     = type;
+	key.dnsclass = dnsclass;
+
+	return list_ledata(hash_lookup(cache->ht, name_hash(name),
+				       ent_cmp_handler, &key));
+}
+
+
+static int ent_add(struct dns_cache *cache, const char *name, uint16_t type,
+		   uint16_t dnsclass, const struct dnshdr *hdr,
+		   const uint8_t *msg, size_t len, size_t pos, uint64_t ts,
+		   uint64_t ttl)
+{
+	struct cache_ent *ent;
+	int err;
+
+	mem_deref(ent_find(cache, name, type, dnsclass));
+
+	ent = mem_zalloc(sizeof(*ent), ent_destructor);
+	if (!ent)
+		return ENOMEM;
+
+	err = str_dup(&ent->name, name);
+	if (err)
+		goto out;
+
+	ent->mb = mbuf_alloc(len);
+	if (!ent->mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = mbuf_write_mem(ent->mb, msg, len);
+	if (err)
+		goto out;
+
+	ent->hdr      = *hdr;
+	ent->pos      = pos;
+	ent->type     = type;
+	ent->dnsclass = dnsclass;
+	ent->ts       = ts;
+	ent->refresh  = ts + ttl * 9 / 10;
+	ent->expires  = ts + ttl;
+
+	list_append(&cache->lrul, &ent->le, ent);
+	hash_append(cache->ht, name_hash(name), &ent->he, ent);
+
+	while (list_count(&cache->lrul) > cache->size)
+		mem_deref(list_ledata(list_head(&cache->lrul)));
+
+ out:
+	if (err)
+		mem_deref(ent);
+
+	return err;
+}
+
+
+int dns_cache_alloc(struct dns_cache **cachep, uint32_t size,
+		    uint32_t stale)
+{
+	struct dns_cache *cache;
+	int err;
+
+	if (!cachep || !size)
+		return EINVAL;
+
+	cache = mem_zalloc(sizeof(*cache), cache_destructor);
+	if (!cache)
+		return ENOMEM;
+
+	list_init(&cache->lrul);
+	cache->size  = size;
+	cache->stale = (uint64_t)stale * 1000;
+
+	err = hash_alloc_auto(&cache->ht, 16, ent_key);
+	if (err)
+		mem_deref(cache);
+	else
+		*cachep = cache;
+
+	return err;
+}
+
+
+/**
+ * Store a reply in the cache. The message is copied.
+ *
+ * @param cache    DNS answer cache
+ * @param name     Query name
+ * @param type     Query type
+ * @param dnsclass Query class
+ * @param hdr      DNS Header of the reply
+ * @param mb       Reply message, starting at offset zero
+ * @param pos      Position of the first record in the message
+ * @param ttl      Time to keep the reply in [seconds]
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int dns_cache_store(struct dns_cache *cache, const char *name, uint16_t type,
+		    uint16_t dnsclass, const struct dnshdr *hdr,
+		    const struct mbuf *mb, size_t pos, uint32_t ttl)
+{
+	if (!cache || !name || !hdr || !mb || pos > mb->end || !ttl)
+		return EINVAL;
+
+	return ent_add(cache, name, type, dnsclass, hdr, mb->buf, mb->end,
+		       pos, tmr_jiffies(), (uint64_t)ttl * 1000);
+}
+
+
+/**
+ * Look up a reply in the cache
+ *
+ * @param cache    DNS answer cache
+ * @param name     Query name
+ * @param type     Query type
+ * @param dnsclass Query class
+ * @param hdr      Returned DNS Header of the reply
+ * @param age      Returned time since the reply was stored in [seconds]
+ * @param flags    Returned lookup flags (DNS_CACHE_*)
+ *
+ * @return Reply message positioned at the first record, or NULL if not found
+ */
+struct mbuf *dns_cache_lookup(struct dns_cache *cache, const char *name,
+			      uint16_t type, uint16_t dnsclass,
+			      struct dnshdr *hdr, uint32_t *age,
+			      unsigned *flags)
+{
+	struct cache_ent *ent;
+	uint64_t now;
+
+	if (!cache || !name || !hdr || !age || !flags)
+		return NULL;
+
+	ent = ent_find(cache, name, type, dnsclass);
+	if (!ent) {
+		++cache->misses;
+		return NULL;
+	}
+
+	now = tmr_jiffies();
+
+	if (now >= ent->expires + cache->stale) {
+		mem_deref(ent);
+		++cache->misses;
+		return NULL;
+	}
+
+	*flags = 0;
+
+	if (now >= ent->expires) {
+		*flags |= DNS_CACHE_STALE;
+		++cache->nstale;
+	}
+
+	/* one refresh at a time, the next one if it did not succeed */
+	if (now >= ent->refresh) {
+		*flags |= DNS_CACHE_REFRESH;
+		ent->refresh = now + REFRESH_RETRY;
+	}
+
+	/* most recently used */
+	list_unlink(&ent->le);
+	list_append(&cache->lrul, &ent->le, ent);
+
+	++cache->hits;
+
+	*hdr = ent->hdr;
+	*age = (uint32_t)((now - ent->ts) / 1000);
+
+	ent->mb->pos = ent->pos;
+
+	return ent->mb;
+}
+
+
+void dns_cache_flush(struct dns_cache *cache)
+{
+	if (!cache)
+		return;
+
+	list_flush(&cache->lrul);
+}
+
+
+void dns_cache_stats(const struct dns_cache *cache,
+		     struct dnsc_cache_stat *stat)
+{
+	if (!cache || !stat)
+		return;
+
+	stat->hits   = cache->hits;
+	stat->misses = cache->misses;
+	stat->stale  = cache->nstale;
+	stat->count  = list_count(&cache->lrul);
+}
+
+
+/**
+ * Add the entries of the cache to a snapshot, least recently used first
+ *
+ * @param cache DNS answer cache
+ * @param snap  Snapshot
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int dns_cache_snap(const struct dns_cache *cache, struct snap *snap)
+{
+	const uint64_t now = tmr_jiffies();
+	struct le *le;
+	int err = 0;
+
+	if (!cache || !snap)
+		return EINVAL;
+
+	for (le = cache->lrul.head; le && !err; le = le->next) {
+
+		const struct cache_ent *ent = le->data;
+		struct mbuf *mb;
+
+		if (now >= ent->expires + cache->stale)
+			continue;
+
+		err = snap_record_begin(snap, SNAP_DNS_CACHE, &mb);
+		if (err)
+			break;
+
+		err  = snap_str_encode(mb, ent->name);
+		err |= mbuf_write_u16(mb, htons(ent->type));
+		err |= mbuf_write_u16(mb, htons(ent->dnsclass));
+		err |= mbuf_write_u32(mb, htonl((uint32_t)min(now - ent->ts,
+						(uint64_t)UINT32_MAX)));
+		err |= mbuf_write_u32(mb, htonl((uint32_t)min(ent->expires
+							      - ent->ts,
+						(uint64_t)UINT32_MAX)));
+		err |= dns_hdr_encode(mb, &ent->hdr);
+		err |= mbuf_write_u32(mb, htonl((uint32_t)ent->pos));
+		err |= mbuf_write_u32(mb, htonl((uint32_t)ent->mb->end));
+		err |= mbuf_write_mem(mb, ent->mb->buf, ent->mb->end);
+
+		err = snap_record_end(snap, err);
+	}
+
+	return err;
+}
+
+
+struct restore {
+	struct dns_cache *cache;
+	uint64_t now;
+	uint64_t age;         /**< Age of the snapshot [ms]           */
+	uint32_t n;           /**< Number of restored entries         */
+};
+
+
+static bool restore_handler(uint16_t type, struct mbuf *mb, void *arg)
+{
+	struct restore *r = arg;
+	uint64_t age, ttl, ts;
+	uint16_t qtype, dnsclass;
+	struct dnshdr hdr;
+	char *name = NULL;
+	size_t pos, len;
+	int err;
+	(void)type;
+
+	err = snap_str_decode(mb, &name);
+	if (err || !name || mbuf_get_left(mb) < 12)
+		goto out;
+
+	qtype    = ntohs(mbuf_read_u16(mb));
+	dnsclass = ntohs(mbuf_read_u16(mb));
+	age      = ntohl(mbuf_read_u32(mb)) + r->age;
+	ttl      = ntohl(mbuf_read_u32(mb));
+
+	if (dns_hdr_decode(mb, &hdr) || mbuf_get_left(mb) < 8)
+		goto out;
+
+	pos = ntohl(mbuf_read_u32(mb));
+	len = ntohl(mbuf_read_u32(mb));
+
+	if (mbuf_get_left(mb) < len || pos > len)
+		goto out;
+
+	/* expired for good while the process was down */
+	if (age >= ttl + r->cache->stale)
+		goto out;
+
+	if (age <= r->now) {
+		ts = r->now - age;
+	}
+	else {
+		/* the clock started again, keep the time to expiry */
+		if (ttl <= age - r->now)
+			goto out;
+
+		ttl -= age - r->now;
+		ts   = 0;
+	}
+
+	if (!ent_add(r->cache, name, qtype, dnsclass, &hdr, mbuf_buf(mb),
+		     len, pos, ts, ttl))
+		++r->n;
+
+ out:
+	mem_deref(name);
+
+	return false;
+}
+
+
+/**
+ * Restore the entries of a snapshot into the cache. Entries that have
+ * expired since the snapshot was taken are skipped.
+ *
+ * @param cache DNS answer cache
+ * @param snap  Snapshot
+ *
+ * @return Number of restored entries
+ */
+uint32_t dns_cache_restore(struct dns_cache *cache, const struct snap *snap)
+{
+	struct restore r;
+
+	if (!cache || !snap)
+		return 0;
+
+	r.cache = cache;
+	r.now   = tmr_jiffies();
+	r.age   = (uint64_t)snap_age(snap) * 1000;
+	r.n     = 0;
+
+	(void)snap_apply(snap, SNAP_DNS_CACHE, restore_handler, &r);
+
+	return r.n;
+}
@@ -16,6 +16,9 @@
 #include <re_tcp.h>
 #include <re_sys.h>
 #include <re_dns.h>
+#include <re_trace.h>
+#include <re_metric.h>
+#include "dns.h"
 
 
 #define DEBUG_MODULE "dnsc"
@@ -30,6 +33,29 @@ enum {
 	CONN_TIMEOUT = 10 * 1000,
 	IDLE_TIMEOUT = 30 * 1000,
 	SRVC_MAX = 32,
+	CACHE_SIZE = 256,
+	CACHE_STALE = 0,
+	STALE_TTL = 30,
+	CACHE_TTL_MAX = 86400,
+	UDP_TIMEOUT = 500,
+	RACE_MIN = 20,
+	FAIL_MAX = 3,
+	FAIL_HOLDOFF = 30 * 1000,
+	EDNS_SIZE = 1232,
+	UDP_SIZE = 512,
+	OPT_SIZE = 11,
+};
+
+
+/** Nameserver statistics */
+struct srv_stat {
+	uint64_t tfail;    /**< Time of last failure [ms]        */
+	uint32_t srtt;     /**< Smoothed round-trip time [us]    */
+	uint32_t rttvar;   /**< Round-trip time variation [us]   */
+	uint32_t nsent;    /**< Number of queries sent           */
+	uint32_t nans;     /**< Number of answers                */
+	uint32_t nfail;    /**< Number of timeouts and failures  */
+	uint32_t fails;    /**< Consecutive failures             */
 };
 
 
@@ -40,6 +66,7 @@ struct tcpconn {
 	struct sa srv;
 	struct tcp_conn *conn;
 	struct mbuf *mb;
+	uint32_t nrx;
 	bool connected;
 	uint16_t flen;
 	struct dnsc *dnsc; /* parent */
@@ -49,12 +76,18 @@ struct tcpconn {
 struct dns_query {
 	struct le le;
 	struct le le_tc;
+	struct le le_wait;
+	struct list waitl;
 	struct tmr tmr;
 	struct mbuf mb;
+	struct dnshdr hdr;
 	struct list rrlv[3];
 	char *name;
 	const struct sa *srvv;
 	const uint32_t *srvc;
+	uint64_t txv[2];         /* send time to the first two servers */
+	uint8_t srvo[SRVC_MAX];  /* servers in the order tried */
+	uint8_t srvn;
 	struct tcpconn *tc;
 	struct dnsc *dnsc;     /* parent  */
 	struct dns_query **qp; /* app ref */
@@ -63,6 +96,12 @@ struct dns_query {
 	uint16_t type;
 	uint16_t dnsclass;
 	uint8_t opcode;
+	int proto;
+	int err;
+	bool rd;
+	bool shared;
+	bool racing;
+	bool edns;               /* the query ends with an OPT record */
 	dns_query_h *qh;
 	void *arg;
 };
@@ -81,7 +120,9 @@ struct dnsc {
 	struct hash *ht_query;
 	struct hash *ht_tcpconn;
 	struct udp_sock *us;
+	struct dns_cache *cache;
 	struct sa srvv[SRVC_MAX];
+	struct srv_stat statv[SRVC_MAX];
 	uint32_t srvc;
 };
 
@@ -91,12 +132,183 @@ static const struct dnsc_conf default_conf = {
 	TCP_HASH_SIZE,
 	CONN_TIMEOUT,
 	IDLE_TIMEOUT,
+	CACHE_SIZE,
+	CACHE_STALE,
+	false,
+	EDNS_SIZE,
 };
 
 
+RE_METRIC_COUNTER_DEFINE(m_cache_hits, "re_dns_cache_hits_total", NULL,
+			 "DNS queries answered from the cache");
+RE_METRIC_COUNTER_DEFINE(m_cache_misses, "re_dns_cache_misses_total", NULL,
+			 "DNS queries not found in the cache");
+
+
 static void tcpconn_close(struct tcpconn *tc, int err);
 static int  send_tcp(struct dns_query *q);
+static void tcp_retry(struct dns_query *q, int err, bool same);
 static void udp_timeout_handler(void *arg);
+static int  query_start(struct dns_query *q);
+static void answer_handler(void *arg);
+static int  query(struct dns_query **qp, struct dnsc *dnsc, uint8_t opcode,
+		  const char *name, uint16_t type, uint16_t dnsclass,
+		  const struct dnsrr *ans_rr, int proto,
+		  const struct sa *srvv, const uint32_t *srvc,
+		  bool aa, bool rd, dns_query_h *qh, void *arg);
+
+
+static bool srv_healthy(const struct srv_stat *st, uint64_t now)
+{
+	return st->fails < FAIL_MAX || now > st->tfail + FAIL_HOLDOFF;
+}
+
+
+/* Healthy servers first, then the fastest. Untried servers are tried. */
+static bool srv_before(const struct srv_stat *a, const struct srv_stat *b,
+		       uint64_t now)
+{
+	const bool ha = srv_healthy(a, now), hb = srv_healthy(b, now);
+
+	if (ha != hb)
+		return ha;
+
+	return a->srtt < b->srtt;
+}
+
+
+static void srv_order(struct dns_query *q)
+{
+	const struct dnsc *dnsc = q->dnsc;
+	const uint64_t now = tmr_jiffies();
+	uint32_t i, j;
+
+	if (q->srvv != dnsc->srvv)
+		return;
+
+	q->srvn = (uint8_t)dnsc->srvc;
+
+	for (i=0; i<q->srvn; i++) {
+
+		const struct srv_stat *st = &dnsc->statv[i];
+
+		for (j=i; j>0; j--) {
+
+			if (!srv_before(st, &dnsc->statv[q->srvo[j-1]], now))
+				break;
+
+			q->srvo[j] = q->srvo[j-1];
+		}
+
+		q->srvo[j] = (uint8_t)i;
+	}
+}
+
+
+/* Server index of the n-th transmission */
+static uint32_t srv_index(const struct dns_query *q, uint32_t n)
+{
+	n %= *q->srvc;
+
+	if (n < q->srvn && q->srvo[n] < *q->srvc)
+		return q->srvo[n];
+
+	return n;
+}
+
+
+static struct srv_stat *srv_stat(struct dns_query *q, uint32_t n)
+{
+	if (q->srvv != q->dnsc->srvv || !q->srvn)
+		return NULL;
+
+	return &q->dnsc->statv[srv_index(q, n)];
+}
+
+
+static void srv_fail(struct srv_stat *st)
+{
+	if (!st)
+		return;
+
+	++st->nfail;
+	++st->fails;
+	st->tfail = tmr_jiffies();
+}
+
+
+/* Smoothed round-trip time as in RFC 6298 */
+static void srv_rtt(struct srv_stat *st, uint64_t rtt)
+{
+	if (!st || !rtt)
+		return;
+
+	rtt = min(rtt, (uint64_t)UINT32_MAX);
+
+	if (!st->srtt) {
+		st->srtt   = (uint32_t)rtt;
+		st->rttvar = (uint32_t)rtt / 2;
+	}
+	else {
+		const uint32_t d = st->srtt > rtt ?
+			st->srtt - (uint32_t)rtt : (uint32_t)rtt - st->srtt;
+
+		st->rttvar = (3 * st->rttvar + d) / 4;
+		st->srtt   = (uint32_t)((7 * (uint64_t)st->srtt + rtt) / 8);
+	}
+}
+
+
+static void srv_answer(struct dns_query *q, uint32_t n, uint64_t rtt)
+{
+	struct srv_stat *st = srv_stat(q, n);
+	uint32_t i;
+
+	if (!st)
+		return;
+
+	++st->nans;
+	st->fails = 0;
+
+	srv_rtt(st, rtt);
+
+	/* a server that was asked first is at least this slow */
+	for (i=0; i<n && i<ARRAY_SIZE(q->txv); i++) {
+
+		const uint64_t t = tmr_jiffies_usec() - q->txv[i];
+
+		st = srv_stat(q, i);
+		st->srtt = (uint32_t)max((uint64_t)st->srtt,
+					 min(t, (uint64_t)UINT32_MAX));
+	}
+}
+
+
+/* Find the transmission that got a reply from src, zero if unknown */
+static uint32_t reply_srv(const struct dns_query *q, const struct sa *src,
+			  uint64_t *rtt)
+{
+	uint32_t n;
+
+	*rtt = 0;
+
+	if (!src || q->srvv != q->dnsc->srvv)
+		return 0;
+
+	for (n=0; n<q->ntx && n<*q->srvc; n++) {
+
+		if (!sa_cmp(&q->srvv[srv_index(q, n)], src, SA_ALL))
+			continue;
+
+		/* only replies to the first two servers are timed */
+		if (n < ARRAY_SIZE(q->txv) && q->ntx <= *q->srvc)
+			*rtt = tmr_jiffies_usec() - q->txv[n];
+
+		return n + 1;
+	}
+
+	return 0;
+}
 
 
 static bool rr_unlink_handler(struct le *le, void *arg)
@@ -120,6 +332,38 @@ static void query_abort(struct dns_query *q)
 
 	tmr_cancel(&q->tmr);
 	hash_unlink(&q->le);
+	list_unlink(&q->le_wait);
+}
+
+
+/* Complete a query later, from the main loop */
+static void query_defer(struct dns_query *q, int err)
+{
+	q->err = err;
+	tmr_start(&q->tmr, 0, answer_handler, q);
+}
+
+
+/* The queries that wait for this one are handed to the first of them */
+static void query_promote(struct dns_query *q)
+{
+	struct dns_query *w = list_ledata(list_head(&q->waitl));
+	struct le *le;
+	int err;
+
+	if (!w)
+		return;
+
+	list_unlink(&w->le_wait);
+
+	while ((le = list_head(&q->waitl))) {
+		list_unlink(le);
+		list_append(&w->waitl, le, le->data);
+	}
+
+	err = query_start(w);
+	if (err)
+		query_defer(w, err);
 }
 
 
@@ -128,7 +372,10 @@ static void query_destructor(void *data)
 	struct dns_query *q = data;
 	uint32_t i;
 
+	RE_TRACE_ASYNC_END("dns", "query", q);
+
 	query_abort(q);
+	query_promote(q);
 	mbuf_reset(&q->mb);
 	mem_deref(q->name);
 
@@ -141,6 +388,16 @@ static void query_handler(struct dns_query *q, int err,
 			  const struct dnshdr *hdr, struct list *ansl,
 			  struct list *authl, struct list *addl)
 {
+	struct le *le;
+
+	/* the waiting queries get the same error */
+	while ((le = list_head(&q->waitl))) {
+		struct dns_query *w = le->data;
+
+		list_unlink(le);
+		query_defer(w, err ? err : ECONNABORTED);
+	}
+
 	/* deref here - before calling handler */
 	if (q->qp)
 		*q->qp = NULL;
@@ -192,11 +449,245 @@ static bool query_cmp_handler(struct le *le, void *arg)
 }
 
 
-static int reply_recv(struct dnsc *dnsc, struct mbuf *mb)
+static int rr_decode(struct dns_query *q, struct mbuf *mb,
+		     const struct dnshdr *hdr)
 {
-	struct dns_query *q = NULL;
+	struct dns_arena *arena;
 	uint32_t i, j, nv[3];
+	int err = 0;
+
+	nv[0] = hdr->nans;
+	nv[1] = hdr->nauth;
+	nv[2] = hdr->nadd;
+
+	/* the strings of all records go in one arena */
+	err = dns_arena_alloc(&arena, mbuf_get_left(mb));
+	if (err)
+		return err;
+
+	for (i=0; i<ARRAY_SIZE(nv); i++) {
+
+		for (j=0; j<nv[i]; j++) {
+
+			struct dnsrr *rr = NULL;
+
+			err = dns_rr_decode_arena(mb, &rr, 0, arena);
+			if (err)
+				goto out;
+
+			list_append(&q->rrlv[i], &rr->le_priv, rr);
+		}
+	}
+
+ out:
+	mem_deref(arena);
+
+	return err;
+}
+
+
+/* Time to cache a reply in [seconds], zero to not cache it (RFC 2308) */
+static uint32_t cache_ttl(const struct dns_query *q, const struct dnshdr *hdr)
+{
+	int64_t ttl = CACHE_TTL_MAX;
+	struct le *le;
+
+	if (hdr->tc)
+		return 0;
+
+	if (hdr->rcode == DNS_RCODE_OK && hdr->nans) {
+
+		LIST_FOREACH(&q->rrlv[0], le) {
+			const struct dnsrr *rr = le->data;
+
+			ttl = min(ttl, rr->ttl);
+		}
+
+		return ttl > 0 ? (uint32_t)ttl : 0;
+	}
+
+	if (hdr->rcode != DNS_RCODE_OK && hdr->rcode != DNS_RCODE_NAME_ERR)
+		return 0;
+
+	/* negative answer, cached for the SOA minimum */
+	LIST_FOREACH(&q->rrlv[1], le) {
+		const struct dnsrr *rr = le->data;
+
+		if (rr->type != DNS_TYPE_SOA)
+			continue;
+
+		ttl = min(ttl, rr->ttl);
+		ttl = min(ttl, (int64_t)rr->rdata.soa.ttlmin);
+
+		return ttl > 0 ? (uint32_t)ttl : 0;
+	}
+
+	return 0;
+}
+
+
+static int cache_lookup(struct dns_query *q)
+{
+	struct mbuf *mb;
+	uint32_t i, age;
+	unsigned flags;
+	struct le *le;
+	int err;
+
+	mb = dns_cache_lookup(q->dnsc->cache, q->name, q->type, q->dnsclass,
+			      &q->hdr, &age, &flags);
+	if (!mb) {
+		re_metric_inc(&m_cache_misses);
+		return ENOENT;
+	}
+
+	re_metric_inc(&m_cache_hits);
+
+	err = rr_decode(q, mb, &q->hdr);
+	if (err) {
+		for (i=0; i<ARRAY_SIZE(q->rrlv); i++)
+			(void)list_apply(&q->rrlv[i], true,
+					 rr_unlink_handler, NULL);
+		return err;
+	}
+
+	/* the records are as old as the cached reply */
+	for (i=0; i<ARRAY_SIZE(q->rrlv); i++) {
+
+		LIST_FOREACH(&q->rrlv[i], le) {
+			struct dnsrr *rr = le->data;
+
+			if (rr->type == DNS_TYPE_OPT)
+				continue;
+
+			if (flags & DNS_CACHE_STALE)
+				rr->ttl = STALE_TTL;
+			else
+				rr->ttl = max(rr->ttl - (int64_t)age,
+					      (int64_t)0);
+		}
+	}
+
+	q->hdr.id = q->id;
+	q->shared = false;
+
+	/* refresh in the background, the reply updates the cache */
+	if (flags & DNS_CACHE_REFRESH) {
+		(void)query(NULL, q->dnsc, q->opcode, q->name, q->type,
+			    q->dnsclass, NULL, q->proto, q->srvv, q->srvc,
+			    false, q->rd, NULL, NULL);
+	}
+
+	return 0;
+}
+
+
+/* Each waiting query decodes its own records from the reply */
+static void waiters_answer(struct dns_query *q, const struct dnshdr *hdr,
+			   struct mbuf *mb, size_t pos)
+{
+	struct le *le;
+
+	while ((le = list_head(&q->waitl))) {
+		struct dns_query *w = le->data;
+
+		list_unlink(le);
+
+		mb->pos = pos;
+		w->hdr = *hdr;
+		w->hdr.id = w->id;
+
+		query_defer(w, rr_decode(w, mb, hdr));
+	}
+}
+
+
+static void answer_handler(void *arg)
+{
+	struct dns_query *q = arg;
+
+	if (q->err)
+		query_handler(q, q->err, NULL, NULL, NULL, NULL);
+	else
+		query_handler(q, 0, &q->hdr, &q->rrlv[0], &q->rrlv[1],
+			      &q->rrlv[2]);
+
+	mem_deref(q);
+}
+
+
+static bool leader_cmp_handler(struct le *le, void *arg)
+{
+	const struct dns_query *q = le->data;
+	const struct dns_query *nq = arg;
+
+	if (q == nq || !q->shared || !q->qh || q->le_wait.list)
+		return false;
+
+	if (q->type != nq->type || q->dnsclass != nq->dnsclass)
+		return false;
+
+	if (q->proto != nq->proto || q->rd != nq->rd)
+		return false;
+
+	return !str_casecmp(q->name, nq->name);
+}
+
+
+/* Send a query again over TCP, to the server that sent a truncated reply */
+static int tcp_fallback(struct dns_query *q)
+{
+	const size_t len = q->mb.end;
+	int err;
+
+	err = mbuf_resize(&q->mb, len + 2);
+	if (err)
+		return err;
+
+	memmove(q->mb.buf + 2, q->mb.buf, len);
+	q->mb.end = len + 2;
+	q->mb.pos = 0;
+	(void)mbuf_write_u16(&q->mb, htons(len));
+
+	tmr_cancel(&q->tmr);
+
+	q->proto = IPPROTO_TCP;
+	q->ntx   = (q->ntx - 1) % *q->srvc;
+
+	return query_start(q);
+}
+
+
+/*
+ * A server without EDNS answers FORMERR or NOTIMP (RFC 6891 7), ask it
+ * again without the OPT record
+ */
+static int edns_fallback(struct dns_query *q)
+{
+	uint8_t *nadd = q->mb.buf + 10;
+
+	DEBUG_INFO("no EDNS for %s, trying without\n", q->name);
+
+	q->mb.end -= OPT_SIZE;
+	q->edns = false;
+	(void)mbuf_store_u16(nadd, 0);
+
+	tmr_cancel(&q->tmr);
+
+	q->ntx = (q->ntx - 1) % *q->srvc;
+
+	return query_start(q);
+}
+
+
+static int reply_recv(struct dnsc *dnsc, struct mbuf *mb,
+		      const struct sa *src)
+{
+	struct dns_query *q = NULL;
 	struct dnsquery dq;
+	uint64_t rtt;
+	uint32_t n;
+	size_t pos;
 	int err = 0;
 
 	if (!dnsc || !mb)
@@ -228,35 +719,60 @@ static int reply_recv(struct dnsc *dnsc, struct mbuf *mb)
 		goto out;
 	}
 
+	n = reply_srv(q, src, &rtt);
+
+	if (q->edns && q->proto == IPPROTO_UDP &&
+	    (dq.hdr.rcode == DNS_RCODE_FMT_ERR ||
+	     dq.hdr.rcode == DNS_RCODE_NOT_IMPL)) {
+
+		err = edns_fallback(q);
+		if (err) {
+			query_handler(q, err, NULL, NULL, NULL, NULL);
+			mem_deref(q);
+		}
+
+		goto out;
+	}
+
 	/* try next server */
 	if (dq.hdr.rcode == DNS_RCODE_SRV_FAIL && q->ntx < *q->srvc) {
 
+		if (n)
+			srv_fail(srv_stat(q, n - 1));
+
 		if (!q->tc) /* try next UDP server immediately */
 			tmr_start(&q->tmr, 0, udp_timeout_handler, q);
+		else /* the connection is kept for the other queries */
+			tcp_retry(q, EPROTO, false);
 
 		err = EPROTO;
 		goto out;
 	}
 
-	nv[0] = dq.hdr.nans;
-	nv[1] = dq.hdr.nauth;
-	nv[2] = dq.hdr.nadd;
+	/* truncated reply, ask again over TCP (RFC 7766) */
+	if (dq.hdr.tc && q->proto == IPPROTO_UDP) {
 
-	for (i=0; i<ARRAY_SIZE(nv); i++) {
+		DEBUG_INFO("truncated reply for %s, trying tcp\n", q->name);
 
-		for (j=0; j<nv[i]; j++) {
+		err = tcp_fallback(q);
+		if (err) {
+			query_handler(q, err, NULL, NULL, NULL, NULL);
+			mem_deref(q);
+		}
 
-			struct dnsrr *rr = NULL;
+		goto out;
+	}
 
-			err = dns_rr_decode(mb, &rr, 0);
-			if (err) {
-				query_handler(q, err, NULL, NULL, NULL, NULL);
-				mem_deref(q);
-				goto out;
-			}
+	if (n)
+		srv_answer(q, n - 1, rtt);
 
-			list_append(&q->rrlv[i], &rr->le_priv, rr);
-		}
+	pos = mb->pos;
+
+	err = rr_decode(q, mb, &dq.hdr);
+	if (err) {
+		query_handler(q, err, NULL, NULL, NULL, NULL);
+		mem_deref(q);
+		goto out;
 	}
 
 	if (q->type == DNS_QTYPE_AXFR) {
@@ -274,6 +790,22 @@ static int reply_recv(struct dnsc *dnsc, struct mbuf *mb)
 		}
 	}
 
+	if (q->shared) {
+		const size_t end = mb->pos;
+
+		waiters_answer(q, &dq.hdr, mb, pos);
+		mb->pos = end;
+	}
+
+	if (q->shared && dnsc->cache) {
+		const uint32_t ttl = cache_ttl(q, &dq.hdr);
+
+		if (ttl)
+			(void)dns_cache_store(dnsc->cache, q->name, q->type,
+					      q->dnsclass, &dq.hdr, mb, pos,
+					      ttl);
+	}
+
 	query_handler(q, 0, &dq.hdr, &q->rrlv[0], &q->rrlv[1], &q->rrlv[2]);
 	mem_deref(q);
 
@@ -286,8 +818,25 @@ static int reply_recv(struct dnsc *dnsc, struct mbuf *mb)
 
 static void udp_recv_handler(const struct sa *src, struct mbuf *mb, void *arg)
 {
-	(void)src;
-	(void)reply_recv(arg, mb);
+	(void)reply_recv(arg, mb, src);
+}
+
+
+static void tcpconn_timeout_handler(void *arg)
+{
+	struct tcpconn *tc = arg;
+
+	/* the pending queries have their own timeout */
+	if (tc->connected && !list_isempty(&tc->ql)) {
+		tmr_start(&tc->tmr, tc->dnsc->conf.idle_timeout,
+			  tcpconn_timeout_handler, tc);
+		return;
+	}
+
+	DEBUG_NOTICE("tcp (%J) %s timeout \n", &tc->srv,
+		     tc->connected ? "idle" : "connect");
+
+	tcpconn_close(tc, ETIMEDOUT);
 }
 
 
@@ -333,10 +882,17 @@ static void tcp_recv_handler(struct mbuf *mbrx, void *arg)
 
 	mb->pos = 0;
 
-	err = reply_recv(tc->dnsc, mb);
-	if (err)
+	++tc->nrx;
+
+	/* a late or retried reply does not affect the other queries */
+	err = reply_recv(tc->dnsc, mb, NULL);
+	if (err && err != ENOENT && err != EPROTO)
 		goto error;
 
+	if (tc->connected)
+		tmr_start(&tc->tmr, tc->dnsc->conf.idle_timeout,
+			  tcpconn_timeout_handler, tc);
+
 	/* reset tcp buffer */
 	tc->flen = 0;
 	mb->pos = 0;
@@ -355,17 +911,6 @@ static void tcp_recv_handler(struct mbuf *mbrx, void *arg)
 }
 
 
-static void tcpconn_timeout_handler(void *arg)
-{
-	struct tcpconn *tc = arg;
-
-	DEBUG_NOTICE("tcp (%J) %s timeout \n", &tc->srv,
-		     tc->connected ? "idle" : "connect");
-
-	tcpconn_close(tc, ETIMEDOUT);
-}
-
-
 static void tcp_estab_handler(void *arg)
 {
 	struct tcpconn *tc = arg;
@@ -419,14 +964,15 @@ static bool tcpconn_cmp_handler(struct le *le, void *arg)
 }
 
 
-static bool tcpconn_fail_handler(struct le *le, void *arg)
+/* Move a query from its connection to the next or to the same server */
+static void tcp_retry(struct dns_query *q, int err, bool same)
 {
-	struct dns_query *q = le->data;
-	int err = *((int *)arg);
-
 	list_unlink(&q->le_tc);
 	q->tc = mem_deref(q->tc);
 
+	if (same)
+		--q->ntx;
+
 	if (q->ntx >= *q->srvc) {
 		DEBUG_WARNING("all servers failed, giving up!!\n");
 		err = err ? err : ECONNREFUSED;
@@ -445,6 +991,17 @@ static bool tcpconn_fail_handler(struct le *le, void *arg)
 		query_handler(q, err, NULL, NULL, NULL, NULL);
 		mem_deref(q);
 	}
+}
+
+
+static bool tcpconn_fail_handler(struct le *le, void *arg)
+{
+	struct dns_query *q = le->data;
+	int err = *((int *)arg);
+
+	/* a connection that was kept open may be closed by the server
+	 * at any time (RFC 7766), so try the same server again */
+	tcp_retry(q, err, q->tc->nrx > 0 && err != EBADMSG);
 
 	return false;
 }
@@ -522,7 +1079,7 @@ static int send_tcp(struct dns_query *q)
 
 	while (q->ntx < *q->srvc) {
 
-		srv = &q->srvv[q->ntx++];
+		srv = &q->srvv[srv_index(q, q->ntx++)];
 
 		DEBUG_NOTICE("trying tcp server#%u: %J\n", q->ntx-1, srv);
 
@@ -540,7 +1097,14 @@ static int send_tcp(struct dns_query *q)
 			q->mb.pos = 0;
 			err = tcp_send(tc->conn, &q->mb);
 			if (err) {
+				const bool kept = tc->nrx > 0;
+
 				tcpconn_close(tc, err);
+
+				/* closed by the server, connect again */
+				if (kept)
+					--q->ntx;
+
 				continue;
 			}
 
@@ -551,6 +1115,7 @@ static int send_tcp(struct dns_query *q)
 
 		list_append(&tc->ql, &q->le_tc, q);
 		q->tc = mem_ref(tc);
+		err = 0;
 		break;
 	}
 
@@ -578,14 +1143,22 @@ static int send_udp(struct dns_query *q)
 
 	for (i=0; i<*q->srvc; i++) {
 
-		srv = &q->srvv[q->ntx++%*q->srvc];
+		struct srv_stat *st = srv_stat(q, q->ntx);
+
+		if (q->ntx < ARRAY_SIZE(q->txv))
+			q->txv[q->ntx] = tmr_jiffies_usec();
+
+		srv = &q->srvv[srv_index(q, q->ntx++)];
 
 		DEBUG_INFO("trying udp server#%u: %J\n", i, srv);
 
 		q->mb.pos = 0;
 		err = udp_send(q->dnsc->us, srv, &q->mb);
-		if (!err)
+		if (!err) {
+			if (st)
+				++st->nsent;
 			break;
+		}
 	}
 
 	return err;
@@ -597,6 +1170,12 @@ static void udp_timeout_handler(void *arg)
 	struct dns_query *q = arg;
 	int err = ETIMEDOUT;
 
+	/* a slow answer is not a failure, ask the next server too */
+	if (q->racing)
+		q->racing = false;
+	else
+		srv_fail(srv_stat(q, q->ntx - 1));
+
 	if (q->ntx >= NTX_MAX)
 		goto out;
 
@@ -615,6 +1194,57 @@ static void udp_timeout_handler(void *arg)
 }
 
 
+/*
+ * First timeout of a UDP query. When racing, the next server is asked when
+ * no answer came within the 95th percentile of the round-trip times of the
+ * first server, about two deviations above the mean.
+ */
+static uint32_t udp_timeout(struct dns_query *q)
+{
+	const struct srv_stat *st = srv_stat(q, 0);
+	uint32_t t;
+
+	if (!q->dnsc->conf.race || !st || !st->srtt || *q->srvc < 2)
+		return UDP_TIMEOUT;
+
+	t = (st->srtt + 2 * st->rttvar) / 1000;
+
+	q->racing = true;
+
+	return min(max(t, (uint32_t)RACE_MIN), (uint32_t)UDP_TIMEOUT);
+}
+
+
+static int query_start(struct dns_query *q)
+{
+	int err;
+
+	switch (q->proto) {
+
+	case IPPROTO_TCP:
+		err = send_tcp(q);
+		if (err)
+			return err;
+
+		tmr_start(&q->tmr, 60 * 1000, tcp_timeout_handler, q);
+		break;
+
+	case IPPROTO_UDP:
+		err = send_udp(q);
+		if (err)
+			return err;
+
+		tmr_start(&q->tmr, udp_timeout(q), udp_timeout_handler, q);
+		break;
+
+	default:
+		return EPROTONOSUPPORT;
+	}
+
+	return 0;
+}
+
+
 static int query(struct dns_query **qp, struct dnsc *dnsc, uint8_t opcode,
 		 const char *name, uint16_t type, uint16_t dnsclass,
 		 const struct dnsrr *ans_rr, int proto,
@@ -636,6 +1266,8 @@ static int query(struct dns_query **qp, struct dnsc *dnsc, uint8_t opcode,
 	if (!q)
 		goto nmerr;
 
+	RE_TRACE_ASYNC_BEGIN("dns", "query", q);
+
 	hash_append(dnsc->ht_query, hash_joaat_str_ci(name), &q->le, q);
 	tmr_init(&q->tmr);
 	mbuf_init(&q->mb);
@@ -654,6 +1286,22 @@ static int query(struct dns_query **qp, struct dnsc *dnsc, uint8_t opcode,
 	q->opcode = opcode;
 	q->dnsclass = dnsclass;
 	q->dnsc = dnsc;
+	q->proto = proto;
+	q->rd  = rd;
+	q->qh  = qh;
+	q->arg = arg;
+
+	srv_order(q);
+
+	/* answers from the configured servers can be shared */
+	q->shared = opcode == DNS_OPCODE_QUERY && !ans_rr &&
+		srvv == dnsc->srvv && type != DNS_QTYPE_AXFR;
+
+	/* a query without a handler only refreshes the cache */
+	if (q->shared && dnsc->cache && qh && !cache_lookup(q)) {
+		query_defer(q, 0);
+		goto out;
+	}
 
 	memset(&hdr, 0, sizeof(hdr));
 
@@ -664,6 +1312,11 @@ static int query(struct dns_query **qp, struct dnsc *dnsc, uint8_t opcode,
 	hdr.nq = 1;
 	hdr.nans = ans_rr ? 1 : 0;
 
+	/* a larger UDP payload avoids most truncated replies */
+	q->edns = opcode == DNS_OPCODE_QUERY && !ans_rr &&
+		dnsc->conf.edns_size > UDP_SIZE;
+	hdr.nadd = q->edns ? 1 : 0;
+
 	if (proto == IPPROTO_TCP)
 		q->mb.pos += 2;
 
@@ -686,35 +1339,43 @@ static int query(struct dns_query **qp, struct dnsc *dnsc, uint8_t opcode,
 			goto error;
 	}
 
-	q->qh  = qh;
-	q->arg = arg;
+	if (q->edns) {
+		struct dnsrr opt;
 
-	switch (proto) {
+		memset(&opt, 0, sizeof(opt));
 
-	case IPPROTO_TCP:
-		q->mb.pos = 0;
-		(void)mbuf_write_u16(&q->mb, htons(q->mb.end - 2));
+		opt.name = "";
+		opt.type = DNS_TYPE_OPT;
+		opt.rdata.opt.udp_size = dnsc->conf.edns_size;
 
-		err = send_tcp(q);
+		err = dns_rr_encode(&q->mb, &opt, 0, NULL, 0);
 		if (err)
 			goto error;
+	}
 
-		tmr_start(&q->tmr, 60 * 1000, tcp_timeout_handler, q);
-		break;
+	if (proto == IPPROTO_TCP) {
+		q->mb.pos = 0;
+		(void)mbuf_write_u16(&q->mb, htons(q->mb.end - 2));
+	}
 
-	case IPPROTO_UDP:
-		err = send_udp(q);
-		if (err)
-			goto error;
+	/* wait for the same query that is already in progress */
+	if (q->shared) {
+		struct dns_query *lq;
 
-		tmr_start(&q->tmr, 500, udp_timeout_handler, q);
-		break;
+		lq = list_ledata(hash_lookup(dnsc->ht_query,
+					     hash_joaat_str_ci(name),
+					     leader_cmp_handler, q));
+		if (lq) {
+			list_append(&lq->waitl, &q->le_wait, q);
+			goto out;
+		}
+	}
 
-	default:
-		err = EPROTONOSUPPORT;
+	err = query_start(q);
+	if (err)
 		goto error;
-	}
 
+ out:
 	if (qp) {
 		q->qp = qp;
 		*qp = q;
@@ -818,6 +1479,7 @@ static void dnsc_destructor(void *data)
 	(void)hash_apply(dnsc->ht_query, query_close_handler, NULL);
 	hash_flush(dnsc->ht_tcpconn);
 
+	mem_deref(dnsc->cache);
 	mem_deref(dnsc->ht_tcpconn);
 	mem_deref(dnsc->ht_query);
 	mem_deref(dnsc->us);
@@ -868,6 +1530,13 @@ int dnsc_alloc(struct dnsc **dcpp, const struct dnsc_conf *conf,
 	if (err)
 		goto out;
 
+	if (dnsc->conf.cache_size) {
+		err = dns_cache_alloc(&dnsc->cache, dnsc->conf.cache_size,
+				      dnsc->conf.cache_stale);
+		if (err)
+			goto out;
+	}
+
  out:
 	if (err)
 		mem_deref(dnsc);
@@ -896,10 +1565,136 @@ int dnsc_srv_set(struct dnsc *dnsc, const struct sa *srvv, uint32_t srvc)
 
 	dnsc->srvc = min((uint32_t)ARRAY_SIZE(dnsc->srvv), srvc);
 
+	memset(dnsc->statv, 0, sizeof(dnsc->statv));
+
 	if (srvv) {
 		for (i=0; i<dnsc->srvc; i++)
 			dnsc->srvv[i] = srvv[i];
 	}
 
+	/* the cached answers are from the old servers */
+	dns_cache_flush(dnsc->cache);
+
 	return 0;
 }
+
+
+/**
+ * Flush the answer cache of a DNS Client
+ *
+ * @param dnsc DNS Client
+ */
+void dnsc_cache_flush(struct dnsc *dnsc)
+{
+	if (!dnsc)
+		return;
+
+	dns_cache_flush(dnsc->cache);
+}
+
+
+/**
+ * Get the answer cache statistics of a DNS Client. Positive and negative
+ * answers from the configured DNS servers are cached for their TTL, and
+ * queried again in the background when they are used late in their TTL.
+ * With cache_stale set, expired answers are served for that long while
+ * they are refreshed.
+ *
+ * @param dnsc DNS Client
+ * @param stat Pointer to statistics storage
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int dnsc_cache_stats(const struct dnsc *dnsc, struct dnsc_cache_stat *stat)
+{
+	if (!dnsc || !stat)
+		return EINVAL;
+
+	memset(stat, 0, sizeof(*stat));
+
+	dns_cache_stats(dnsc->cache, stat);
+
+	return 0;
+}
+
+
+/**
+ * Add the cached answers of a DNS Client to a snapshot, so that a
+ * restarted process does not have to resolve every name again
+ *
+ * @param dnsc DNS Client
+ * @param snap Snapshot
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int dnsc_cache_snap(const struct dnsc *dnsc, struct snap *snap)
+{
+	if (!dnsc || !snap)
+		return EINVAL;
+
+	if (!dnsc->cache)
+		return 0;
+
+	return dns_cache_snap(dnsc->cache, snap);
+}
+
+
+/**
+ * Restore the cached answers of a DNS Client from a snapshot. The
+ * answers keep the TTL they had left, less the age of the snapshot.
+ *
+ * @param dnsc DNS Client
+ * @param snap Snapshot
+ *
+ * @return Number of restored answers
+ */
+uint32_t dnsc_cache_restore(struct dnsc *dnsc, const struct snap *snap)
+{
+	if (!dnsc)
+		return 0;
+
+	return dns_cache_restore(dnsc->cache, snap);
+}
+
+
+/**
+ * Print the nameserver and cache statistics of a DNS Client
+ *
+ * @param pf   Print function
+ * @param dnsc DNS Client
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int dnsc_debug(struct re_printf *pf, const struct dnsc *dnsc)
+{
+	struct dnsc_cache_stat cst;
+	const uint64_t now = tmr_jiffies();
+	uint32_t i;
+	int err = 0;
+
+	if (!dnsc)
+		return 0;
+
+	err |= re_hprintf(pf, "--- DNS Client ---\n");
+
+	for (i=0; i<dnsc->srvc; i++) {
+
+		const struct srv_stat *st = &dnsc->statv[i];
+
+		err |= re_hprintf(pf, " %J: srtt=%u.%03ums rttvar=%u.%03ums"
+				  " sent=%u answers=%u failures=%u%s\n",
+				  &dnsc->srvv[i],
+				  st->srtt / 1000, st->srtt % 1000,
+				  st->rttvar / 1000, st->rttvar % 1000,
+				  st->nsent, st->nans, st->nfail,
+				  srv_healthy(st, now) ? "" : " (down)");
+	}
+
+	if (dnsc->cache && !dnsc_cache_stats(dnsc, &cst)) {
+		err |= re_hprintf(pf, " cache: count=%u hits=%u misses=%u"
+				  " stale=%u\n",
+				  cst.count, cst.hits, cst.misses, cst.stale);
+	}
+
+	return err;
+}
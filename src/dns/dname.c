@@ -3,6 +3,7 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
+#include <string.h>
 #include <re_types.h>
 #include <re_fmt.h>
 #include <re_list.h>
@@ -11,6 +12,7 @@
 #include <re_mbuf.h>
 #include <re_net.h>
 #include <re_dns.h>
+#include "dns.h"
 
 
 #define COMP_MASK   0xc0
@@ -150,43 +152,30 @@ int dns_dname_encode(struct mbuf *mb, const char *name,
 }
 
 
-/**
- * Decode a DNS domain name from a memory buffer
- *
- * @param mb    Memory buffer to decode from
- * @param name  Pointer to allocated string with domain name
- * @param start Start position
- *
- * @return 0 if success, otherwise errorcode
- */
-int dns_dname_decode(struct mbuf *mb, char **name, size_t start)
+/* Decode a domain name into a buffer, len is without the terminating NUL */
+int dns_dname_decode_buf(struct mbuf *mb, char *buf, size_t size,
+			 size_t *len, size_t start)
 {
-	uint32_t i = 0, loopc = 0;
+	uint32_t loopc = 0;
 	bool comp = false;
-	size_t pos = 0;
-	char buf[256];
+	size_t i = 0, pos = 0;
 
-	if (!mb || !name)
+	if (!mb || !buf || !size || !len)
 		return EINVAL;
 
 	while (mb->pos < mb->end) {
 
-		uint8_t len = mb->buf[mb->pos++];
-		if (!len) {
+		uint8_t n = mb->buf[mb->pos++];
+		if (!n) {
 			if (comp)
 				mb->pos = pos;
 
-			buf[i++] = '\0';
-
-			*name = mem_alloc(i, NULL);
-			if (!*name)
-				return ENOMEM;
-
-			str_ncpy(*name, buf, i);
+			buf[i] = '\0';
+			*len = i;
 
 			return 0;
 		}
-		else if ((len & COMP_MASK) == COMP_MASK) {
+		else if ((n & COMP_MASK) == COMP_MASK) {
 			uint16_t offset;
 
 			if (loopc++ > COMP_LOOP)
@@ -206,17 +195,49 @@ int dns_dname_decode(struct mbuf *mb, char **name, size_t start)
 			mb->pos = offset + start;
 			continue;
 		}
-		else if (len > mbuf_get_left(mb))
+		else if (n > mbuf_get_left(mb))
 			break;
-		else if (len + i + 2 > sizeof(buf))
+		else if (n + i + 2 > size)
 			break;
 
 		if (i > 0)
 			buf[i++] = '.';
 
-		while (len--)
+		while (n--)
 			buf[i++] = mb->buf[mb->pos++];
 	}
 
 	return EINVAL;
 }
+
+
+/**
+ * Decode a DNS domain name from a memory buffer
+ *
+ * @param mb    Memory buffer to decode from
+ * @param name  Pointer to allocated string with domain name
+ * @param start Start position
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int dns_dname_decode(struct mbuf *mb, char **name, size_t start)
+{
+	char buf[256];
+	size_t len;
+	int err;
+
+	if (!mb || !name)
+		return EINVAL;
+
+	err = dns_dname_decode_buf(mb, buf, sizeof(buf), &len, start);
+	if (err)
+		return err;
+
+	*name = mem_alloc(len + 1, NULL);
+	if (!*name)
+		return ENOMEM;
+
+	memcpy(*name, buf, len + 1);
+
+	return 0;
+}
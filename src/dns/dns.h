@@ -14,3 +14,35 @@ int get_windns(char *domain, size_t dsize, struct sa *nav, uint32_t *n);
 #ifdef DARWIN
 int get_darwin_dns(char *domain, size_t dsize, struct sa *nsv, uint32_t *n);
 #endif
+
+
+/* Arena */
+char *dns_arena_get(struct dns_arena *arena, size_t size);
+char *dns_arena_strdup(struct dns_arena *arena, const char *str, size_t len);
+int   dns_dname_decode_buf(struct mbuf *mb, char *buf, size_t size,
+			   size_t *len, size_t start);
+
+
+/* Answer cache */
+struct dns_cache;
+
+/** Cache lookup flags */
+enum {
+	DNS_CACHE_STALE   = 1<<0,  /**< Reply has expired                */
+	DNS_CACHE_REFRESH = 1<<1,  /**< Reply should be queried again    */
+};
+
+int  dns_cache_alloc(struct dns_cache **cachep, uint32_t size,
+		     uint32_t stale);
+int  dns_cache_store(struct dns_cache *cache, const char *name, uint16_t type,
+		     uint16_t dnsclass, const struct dnshdr *hdr,
+		     const struct mbuf *mb, size_t pos, uint32_t ttl);
+struct mbuf *dns_cache_lookup(struct dns_cache *cache, const char *name,
+			      uint16_t type, uint16_t dnsclass,
+			      struct dnshdr *hdr, uint32_t *age,
+			      unsigned *flags);
+void dns_cache_flush(struct dns_cache *cache);
+void dns_cache_stats(const struct dns_cache *cache,
+		     struct dnsc_cache_stat *stat);
+int  dns_cache_snap(const struct dns_cache *cache, struct snap *snap);
+uint32_t dns_cache_restore(struct dns_cache *cache, const struct snap *snap);
@@ -4,6 +4,8 @@
 # Copyright (C) 2010 Creytiv.com
 #
 
+SRCS	+= dns/arena.c
+SRCS	+= dns/cache.c
 SRCS	+= dns/client.c
 SRCS	+= dns/cstr.c
 SRCS	+= dns/dname.c
@@ -12,12 +12,19 @@
 #include <re_net.h>
 #include <re_sa.h>
 #include <re_dns.h>
+#include "dns.h"
 
 
 static void rr_destructor(void *data)
 {
 	struct dnsrr *rr = data;
 
+	/* the strings are in the arena */
+	if (rr->arena) {
+		mem_deref(rr->arena);
+		return;
+	}
+
 	mem_deref(rr->name);
 
 	switch (rr->type) {
@@ -87,6 +94,7 @@ int dns_rr_encode(struct mbuf *mb, const struct dnsrr *rr, int64_t ttl_offs,
 		  struct hash *ht_dname, size_t start)
 {
 	uint32_t ttl;
+	uint16_t dnsclass;
 	size_t start_rdata, dlen, len;
 	char *ptr;
 	int err = 0;
@@ -95,10 +103,19 @@ int dns_rr_encode(struct mbuf *mb, const struct dnsrr *rr, int64_t ttl_offs,
 		return EINVAL;
 
 	ttl = (uint32_t)((rr->ttl > ttl_offs) ? (rr->ttl - ttl_offs) : 0);
+	dnsclass = rr->dnsclass;
+
+	/* The class and TTL of the OPT pseudo-RR are EDNS fields */
+	if (rr->type == DNS_TYPE_OPT) {
+		dnsclass = rr->rdata.opt.udp_size;
+		ttl = (uint32_t)rr->rdata.opt.ercode << 24 |
+			(uint32_t)rr->rdata.opt.version << 16 |
+			rr->rdata.opt.flags;
+	}
 
 	err |= dns_dname_encode(mb, rr->name, ht_dname, start, true);
 	err |= mbuf_write_u16(mb, htons(rr->type));
-	err |= mbuf_write_u16(mb, htons(rr->dnsclass));
+	err |= mbuf_write_u16(mb, htons(dnsclass));
 	err |= mbuf_write_u32(mb, htonl(ttl));
 	err |= mbuf_write_u16(mb, htons(rr->rdlen));
 
@@ -180,6 +197,10 @@ int dns_rr_encode(struct mbuf *mb, const struct dnsrr *rr, int64_t ttl_offs,
 					ht_dname, start, false);
 		break;
 
+	case DNS_TYPE_OPT:
+		/* no options */
+		break;
+
 	default:
 		err = EINVAL;
 		break;
@@ -198,16 +219,53 @@ int dns_rr_encode(struct mbuf *mb, const struct dnsrr *rr, int64_t ttl_offs,
 }
 
 
-/**
- * Decode a DNS Resource Record (RR) from a memory buffer
- *
- * @param mb    Memory buffer to decode from
- * @param rr    Pointer to allocated Resource Record
- * @param start Start position
- *
- * @return 0 if success, otherwise errorcode
- */
-int dns_rr_decode(struct mbuf *mb, struct dnsrr **rr, size_t start)
+static int rr_dname(struct mbuf *mb, char **name, size_t start,
+		    struct dns_arena *arena)
+{
+	char buf[256];
+	size_t len;
+	int err;
+
+	if (!arena)
+		return dns_dname_decode(mb, name, start);
+
+	err = dns_dname_decode_buf(mb, buf, sizeof(buf), &len, start);
+	if (err)
+		return err;
+
+	*name = dns_arena_strdup(arena, buf, len);
+
+	return *name ? 0 : ENOMEM;
+}
+
+
+static int rr_cstr(struct mbuf *mb, char **str, struct dns_arena *arena)
+{
+	uint8_t len;
+
+	if (!arena)
+		return dns_cstr_decode(mb, str);
+
+	if (mbuf_get_left(mb) < 1)
+		return EINVAL;
+
+	len = mbuf_read_u8(mb);
+
+	if (mbuf_get_left(mb) < len)
+		return EBADMSG;
+
+	*str = dns_arena_strdup(arena, (const char *)mbuf_buf(mb), len);
+	if (!*str)
+		return ENOMEM;
+
+	mb->pos += len;
+
+	return 0;
+}
+
+
+static int rr_decode(struct mbuf *mb, struct dnsrr **rr, size_t start,
+		     struct dns_arena *arena)
 {
 	int err = 0;
 	struct dnsrr *lrr;
@@ -221,7 +279,9 @@ int dns_rr_decode(struct mbuf *mb, struct dnsrr **rr, size_t start)
 	if (!lrr)
 		return ENOMEM;
 
-	err = dns_dname_decode(mb, &lrr->name, start);
+	lrr->arena = mem_ref(arena);
+
+	err = rr_dname(mb, &lrr->name, start, arena);
 	if (err)
 		goto error;
 
@@ -246,25 +306,29 @@ int dns_rr_decode(struct mbuf *mb, struct dnsrr **rr, size_t start)
 		break;
 
 	case DNS_TYPE_NS:
-		err = dns_dname_decode(mb, &lrr->rdata.ns.nsdname, start);
+		err = rr_dname(mb, &lrr->rdata.ns.nsdname, start,
+			       arena);
 		if (err)
 			goto error;
 
 		break;
 
 	case DNS_TYPE_CNAME:
-		err = dns_dname_decode(mb, &lrr->rdata.cname.cname, start);
+		err = rr_dname(mb, &lrr->rdata.cname.cname, start,
+			       arena);
 		if (err)
 			goto error;
 
 		break;
 
 	case DNS_TYPE_SOA:
-		err = dns_dname_decode(mb, &lrr->rdata.soa.mname, start);
+		err = rr_dname(mb, &lrr->rdata.soa.mname, start,
+			       arena);
 		if (err)
 			goto error;
 
-		err = dns_dname_decode(mb, &lrr->rdata.soa.rname, start);
+		err = rr_dname(mb, &lrr->rdata.soa.rname, start,
+			       arena);
 		if (err)
 			goto error;
 
@@ -279,7 +343,8 @@ int dns_rr_decode(struct mbuf *mb, struct dnsrr **rr, size_t start)
 		break;
 
 	case DNS_TYPE_PTR:
-		err = dns_dname_decode(mb, &lrr->rdata.ptr.ptrdname, start);
+		err = rr_dname(mb, &lrr->rdata.ptr.ptrdname, start,
+			       arena);
 		if (err)
 			goto error;
 
@@ -291,14 +356,20 @@ int dns_rr_decode(struct mbuf *mb, struct dnsrr **rr, size_t start)
 
 		lrr->rdata.mx.pref = ntohs(mbuf_read_u16(mb));
 
-		err = dns_dname_decode(mb, &lrr->rdata.mx.exchange, start);
+		err = rr_dname(mb, &lrr->rdata.mx.exchange, start,
+			       arena);
 		if (err)
 			goto error;
 
 		break;
 
 	case DNS_TYPE_TXT:
-		ptr = lrr->rdata.txt.data = mem_alloc(lrr->rdlen + 1, NULL);
+		if (arena)
+			ptr = dns_arena_get(arena, lrr->rdlen + 1);
+		else
+			ptr = mem_alloc(lrr->rdlen + 1, NULL);
+
+		lrr->rdata.txt.data = ptr;
 		if (!lrr->rdata.txt.data) {
 			err = ENOMEM;
 			goto error;
@@ -339,7 +410,8 @@ int dns_rr_decode(struct mbuf *mb, struct dnsrr **rr, size_t start)
 		lrr->rdata.srv.weight = ntohs(mbuf_read_u16(mb));
 		lrr->rdata.srv.port   = ntohs(mbuf_read_u16(mb));
 
-		err = dns_dname_decode(mb, &lrr->rdata.srv.target, start);
+		err = rr_dname(mb, &lrr->rdata.srv.target, start,
+			       arena);
 		if (err)
 			goto error;
 
@@ -352,24 +424,35 @@ int dns_rr_decode(struct mbuf *mb, struct dnsrr **rr, size_t start)
 		lrr->rdata.naptr.order = ntohs(mbuf_read_u16(mb));
 		lrr->rdata.naptr.pref  = ntohs(mbuf_read_u16(mb));
 
-		err = dns_cstr_decode(mb, &lrr->rdata.naptr.flags);
+		err = rr_cstr(mb, &lrr->rdata.naptr.flags, arena);
 		if (err)
 			goto error;
 
-		err = dns_cstr_decode(mb, &lrr->rdata.naptr.services);
+		err = rr_cstr(mb, &lrr->rdata.naptr.services, arena);
 		if (err)
 			goto error;
 
-		err = dns_cstr_decode(mb, &lrr->rdata.naptr.regexp);
+		err = rr_cstr(mb, &lrr->rdata.naptr.regexp, arena);
 		if (err)
 			goto error;
 
-		err = dns_dname_decode(mb, &lrr->rdata.naptr.replace, start);
+		err = rr_dname(mb, &lrr->rdata.naptr.replace, start,
+			       arena);
 		if (err)
 			goto error;
 
 		break;
 
+	case DNS_TYPE_OPT:
+		lrr->rdata.opt.udp_size = lrr->dnsclass;
+		lrr->rdata.opt.ercode   = (uint8_t)(lrr->ttl >> 24);
+		lrr->rdata.opt.version  = (uint8_t)(lrr->ttl >> 16);
+		lrr->rdata.opt.flags    = (uint16_t)lrr->ttl;
+
+		/* the options are skipped */
+		mb->pos += lrr->rdlen;
+		break;
+
 	default:
 		mb->pos += lrr->rdlen;
 		break;
@@ -388,6 +471,43 @@ int dns_rr_decode(struct mbuf *mb, struct dnsrr **rr, size_t start)
 }
 
 
+/**
+ * Decode a DNS Resource Record (RR) from a memory buffer
+ *
+ * @param mb    Memory buffer to decode from
+ * @param rr    Pointer to allocated Resource Record
+ * @param start Start position
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int dns_rr_decode(struct mbuf *mb, struct dnsrr **rr, size_t start)
+{
+	return rr_decode(mb, rr, start, NULL);
+}
+
+
+/**
+ * Decode a DNS Resource Record, with its strings in an arena. This needs
+ * fewer memory allocations than dns_rr_decode(), and the records can be
+ * used in the same way. The strings must not be replaced or freed.
+ *
+ * @param mb    Memory buffer to decode from
+ * @param rr    Pointer to allocated Resource Record
+ * @param start Start position
+ * @param arena Arena for the strings, referenced by the record
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int dns_rr_decode_arena(struct mbuf *mb, struct dnsrr **rr, size_t start,
+			struct dns_arena *arena)
+{
+	if (!arena)
+		return EINVAL;
+
+	return rr_decode(mb, rr, start, arena);
+}
+
+
 /**
  * Compare two DNS Resource Records
  *
@@ -565,6 +685,7 @@ const char *dns_rr_typename(uint16_t type)
 	case DNS_TYPE_AAAA:  return "AAAA";
 	case DNS_TYPE_SRV:   return "SRV";
 	case DNS_TYPE_NAPTR: return "NAPTR";
+	case DNS_TYPE_OPT:   return "OPT";
 	case DNS_QTYPE_IXFR: return "IXFR";
 	case DNS_QTYPE_AXFR: return "AXFR";
 	case DNS_QTYPE_ANY:  return "ANY";
@@ -683,6 +804,13 @@ int dns_rr_print(struct re_printf *pf, const struct dnsrr *rr)
 				  rr->rdata.naptr.replace);
 		break;
 
+	case DNS_TYPE_OPT:
+		err |= re_hprintf(pf, "udp=%u version=%u flags=0x%04x",
+				  rr->rdata.opt.udp_size,
+				  rr->rdata.opt.version,
+				  rr->rdata.opt.flags);
+		break;
+
 	default:
 		err |= re_hprintf(pf, "?");
 		break;
@@ -11,6 +11,11 @@
 #endif
 #include <string.h>
 #include <stdlib.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 #include <re_types.h>
 #include <re_mem.h>
 #include <re_mbuf.h>
@@ -21,6 +26,70 @@
 const struct pl pl_null = {NULL, 0};
 
 
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define DIGITS8 1
+
+/* True if all the 8 bytes are decimal digits */
+static inline bool is_digits8(uint64_t x)
+{
+	return ((x & 0xf0f0f0f0f0f0f0f0ULL) |
+		(((x + 0x0606060606060606ULL) & 0xf0f0f0f0f0f0f0f0ULL) >> 4))
+		== 0x3333333333333333ULL;
+}
+
+
+/* Value of 8 decimal digits, the first in the lowest byte */
+static inline uint32_t digits8(uint64_t x)
+{
+	const uint64_t mask = 0x000000ff000000ffULL;
+	const uint64_t mul1 = 100 + (1000000ULL << 32);
+	const uint64_t mul2 = 1 + (10000ULL << 32);
+
+	x -= 0x3030303030303030ULL;
+	x  = x * 10 + (x >> 8);
+	x  = (((x & mask) * mul1) + (((x >> 16) & mask) * mul2)) >> 32;
+
+	return (uint32_t)x;
+}
+#endif
+
+
+/*
+ * Decode decimal digits, up to 8 at a time. The value wraps around like
+ * the digit-by-digit sum, and is 0 if there are other characters.
+ */
+static uint64_t decimal(const char *p, size_t l)
+{
+	uint64_t v = 0;
+
+#ifdef DIGITS8
+	for (; l >= 8; p += 8, l -= 8) {
+
+		uint64_t x;
+
+		memcpy(&x, p, sizeof(x));
+
+		if (!is_digits8(x))
+			return 0;
+
+		v = v * 100000000 + digits8(x);
+	}
+#endif
+
+	for (; l; ++p, --l) {
+
+		const uint8_t c = *p - '0';
+
+		if (c > 9)
+			return 0;
+
+		v = v * 10 + c;
+	}
+
+	return v;
+}
+
+
 /**
  * Initialise a pointer-length object from a NULL-terminated string
  *
@@ -63,22 +132,10 @@ void pl_set_mbuf(struct pl *pl, const struct mbuf *mb)
  */
 uint32_t pl_u32(const struct pl *pl)
 {
-	uint32_t v=0, mul=1;
-	const char *p;
-
 	if (!pl || !pl->p)
 		return 0;
 
-	p = &pl->p[pl->l];
-	while (p > pl->p) {
-		const uint8_t c = *--p - '0';
-		if (c > 9)
-			return 0;
-		v += mul * c;
-		mul *= 10;
-	}
-
-	return v;
+	return (uint32_t)decimal(pl->p, pl->l);
 }
 
 
@@ -129,22 +186,10 @@ uint32_t pl_x32(const struct pl *pl)
  */
 uint64_t pl_u64(const struct pl *pl)
 {
-	uint64_t v=0, mul=1;
-	const char *p;
-
 	if (!pl || !pl->p)
 		return 0;
 
-	p = &pl->p[pl->l];
-	while (p > pl->p) {
-		const uint8_t c = *--p - '0';
-		if (c > 9)
-			return 0;
-		v += mul * c;
-		mul *= 10;
-	}
-
-	return v;
+	return decimal(pl->p, pl->l);
 }
 
 
@@ -406,31 +451,97 @@ int pl_cmp(const struct pl *pl1, const struct pl *pl2)
 
 
 #ifndef HAVE_STRINGS_H
-static int casecmp(const struct pl *pl, const char *str)
+/* Fold the ASCII upper case letters of 8 bytes to lower case */
+static inline uint64_t lower8(uint64_t x)
+{
+	const uint64_t hept  = x & 0x7f7f7f7f7f7f7f7fULL;
+	const uint64_t ge_a  = hept + 0x3f3f3f3f3f3f3f3fULL;  /* >= 'A' */
+	const uint64_t gt_z  = hept + 0x2525252525252525ULL;  /* >  'Z' */
+	const uint64_t upper = ~x & (ge_a ^ gt_z) & 0x8080808080808080ULL;
+
+	return x | (upper >> 2);
+}
+
+
+#if defined(__SSE2__)
+static inline __m128i lower16(__m128i x)
+{
+	const __m128i m = _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8('@')),
+					_mm_cmpgt_epi8(_mm_set1_epi8('['), x));
+
+	return _mm_or_si128(x, _mm_and_si128(m, _mm_set1_epi8(0x20)));
+}
+#elif defined(__ARM_NEON)
+static inline uint8x16_t lower16(uint8x16_t x)
+{
+	const uint8x16_t m = vandq_u8(vcgeq_u8(x, vdupq_n_u8('A')),
+				      vcleq_u8(x, vdupq_n_u8('Z')));
+
+	return vorrq_u8(x, vandq_u8(m, vdupq_n_u8(0x20)));
+}
+#endif
+
+
+static inline uint8_t lower(uint8_t c)
+{
+	return ('A' <= c && c <= 'Z') ? c | 0x20 : c;
+}
+
+
+/* Compare ASCII case-insensitive, 16 or 8 bytes at a time */
+static int casecmp(const char *p1, const char *p2, size_t len)
 {
 	size_t i = 0;
 
-#define LOWER(d) ((d) | 0x20202020)
-	const uint32_t *p1 = (uint32_t *)pl->p;
-	const uint32_t *p2 = (uint32_t *)str;
-	const size_t len = pl->l & ~0x3;
+#if defined(__SSE2__)
+	for (; i + 16 <= len; i += 16) {
 
-	/* Skip any unaligned pointers */
-	if (((size_t)pl->p) & (sizeof(void *) - 1))
-		goto next;
-	if (((size_t)str) & (sizeof(void *) - 1))
-		goto next;
+		const __m128i x = _mm_loadu_si128((const __m128i *)(p1 + i));
+		const __m128i y = _mm_loadu_si128((const __m128i *)(p2 + i));
 
-	/* Compare word-wise */
-	for (; i<len; i+=4) {
-		if (LOWER(*p1++) != LOWER(*p2++))
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(lower16(x),
+						     lower16(y))) != 0xffff)
 			return EINVAL;
 	}
+#elif defined(__ARM_NEON)
+	for (; i + 16 <= len; i += 16) {
 
- next:
-	/* Compare byte-wise */
-	for (; i<pl->l; i++) {
-		if (tolower(pl->p[i]) != tolower(str[i]))
+		const uint8x16_t x = vld1q_u8((const uint8_t *)p1 + i);
+		const uint8x16_t y = vld1q_u8((const uint8_t *)p2 + i);
+		const uint64x2_t eq =
+			vreinterpretq_u64_u8(vceqq_u8(lower16(x), lower16(y)));
+
+		if ((vgetq_lane_u64(eq, 0) & vgetq_lane_u64(eq, 1)) !=
+		    ~(uint64_t)0)
+			return EINVAL;
+	}
+#endif
+
+	if (len >= 8) {
+
+		uint64_t x, y;
+
+		for (; i + 8 <= len; i += 8) {
+
+			memcpy(&x, p1 + i, sizeof(x));
+			memcpy(&y, p2 + i, sizeof(y));
+
+			if (lower8(x) != lower8(y))
+				return EINVAL;
+		}
+
+		if (i == len)
+			return 0;
+
+		/* the last 8 bytes, overlapping the ones compared */
+		memcpy(&x, p1 + len - 8, sizeof(x));
+		memcpy(&y, p2 + len - 8, sizeof(y));
+
+		return lower8(x) == lower8(y) ? 0 : EINVAL;
+	}
+
+	for (; i < len; i++) {
+		if (lower(p1[i]) != lower(p2[i]))
 			return EINVAL;
 	}
 
@@ -475,7 +586,7 @@ int pl_casecmp(const struct pl *pl1, const struct pl *pl2)
 #ifdef HAVE_STRINGS_H
 	return 0 == strncasecmp(pl1->p, pl2->p, pl1->l) ? 0 : EINVAL;
 #else
-	return casecmp(pl1, pl2->p);
+	return casecmp(pl1->p, pl2->p, pl1->l);
 #endif
 }
 
@@ -490,18 +601,10 @@ int pl_casecmp(const struct pl *pl1, const struct pl *pl2)
  */
 const char *pl_strchr(const struct pl *pl, char c)
 {
-	const char *p, *end;
-
-	if (!pl)
+	if (!pl || !pl->p)
 		return NULL;
 
-	end = pl->p + pl->l;
-	for (p = pl->p; p < end; p++) {
-		if (*p == c)
-			return p;
-	}
-
-	return NULL;
+	return memchr(pl->p, c, pl->l);
 }
 
 
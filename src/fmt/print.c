@@ -44,6 +44,36 @@ static const char prfx_hex[]  = "0x";
 static const char str_nil[]  = "(nil)";
 
 
+static const char hex_lc[] = "0123456789abcdef";
+static const char hex_uc[] = "0123456789ABCDEF";
+
+/* Two decimal digits for each of 0-99 */
+static const char digits_tab[] =
+	"0001020304050607080910111213141516171819"
+	"2021222324252627282930313233343536373839"
+	"4041424344454647484950515253545556575859"
+	"6061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+
+static int write_pad(char pch, size_t n, re_vprintf_h *vph, void *arg)
+{
+	char buf[16];
+	int err = 0;
+
+	memset(buf, pch, MIN(n, sizeof(buf)));
+
+	while (n) {
+		const size_t sz = MIN(n, sizeof(buf));
+
+		err |= vph(buf, sz, arg);
+		n -= sz;
+	}
+
+	return err;
+}
+
+
 static int write_padded(const char *p, size_t sz, size_t pad, char pch,
 			bool plr, const char *prfx, re_vprintf_h *vph,
 			void *arg)
@@ -56,8 +86,8 @@ static int write_padded(const char *p, size_t sz, size_t pad, char pch,
 	if (prfx && pch == '0')
 		err |= vph(prfx, prfx_len, arg);
 
-	while (!plr && (pad-- > sz))
-		err |= vph(&pch, 1, arg);
+	if (!plr && pad > sz)
+		err |= write_pad(pch, pad - sz, vph, arg);
 
 	if (prfx && pch != '0')
 		err |= vph(prfx, prfx_len, arg);
@@ -65,39 +95,53 @@ static int write_padded(const char *p, size_t sz, size_t pad, char pch,
 	if (p && sz)
 		err |= vph(p, sz, arg);
 
-	while (plr && pad-- > sz)
-		err |= vph(&pch, 1, arg);
+	if (plr && pad > sz)
+		err |= write_pad(pch, pad - sz, vph, arg);
 
 	return err;
 }
 
 
+/* Format in base 10 or 16 */
 static uint32_t local_itoa(char *buf, uint64_t n, uint8_t base, bool uc)
 {
-	char c, *p = buf + NUM_SIZE;
-	uint32_t len = 1;
-	const char a = uc ? 'A' : 'a';
+	char *p = buf + NUM_SIZE;
+	uint32_t len;
+
+	if (base == 10) {
 
-	*--p = '\0';
-	do {
-		const uint64_t dv  = n / base;
-		const uint64_t mul = dv * base;
+		/* two digits per division */
+		while (n >= 100) {
+			const size_t i = (size_t)(n % 100) * 2;
 
-		c = (char)(n - mul);
+			n /= 100;
+			p -= 2;
+			memcpy(p, &digits_tab[i], 2);
+		}
 
-		if (c < 10)
-			*--p = '0' + c;
-		else
-			*--p = a + (c - 10);
+		if (n >= 10) {
+			p -= 2;
+			memcpy(p, &digits_tab[n * 2], 2);
+		}
+		else {
+			*--p = '0' + (char)n;
+		}
+	}
+	else {
+		const char *hex = uc ? hex_uc : hex_lc;
 
-		n = dv;
-		++len;
+		do {
+			*--p = hex[n & 0xf];
+			n >>= 4;
+		} while (n != 0);
+	}
 
-	} while (n != 0);
+	len = (uint32_t)(buf + NUM_SIZE - p);
 
 	memmove(buf, p, len);
+	buf[len] = '\0';
 
-	return len - 1;
+	return len;
 }
 
 
@@ -163,7 +207,7 @@ static size_t local_ftoa(char *buf, double n, size_t dp)
 int re_vhprintf(const char *fmt, va_list ap, re_vprintf_h *vph, void *arg)
 {
 	uint8_t base, *bptr;
-	char pch, ch, num[NUM_SIZE], addr[64], msg[256];
+	char pch = ' ', ch, num[NUM_SIZE], addr[64], msg[256];
 	enum length_modifier lenmod = LENMOD_NONE;
 	struct re_printf pf;
 	bool fm = false, plr = false;
@@ -408,18 +452,26 @@ int re_vhprintf(const char *fmt, va_list ap, re_vprintf_h *vph, void *arg)
 			len = bptr ? len : 0;
 			pch = plr ? ' ' : pch;
 
-			while (!plr && pad-- > (len * 2))
-				err |= vph(&pch, 1, arg);
+			if (!plr && pad > len * 2)
+				err |= write_pad(pch, pad - len * 2, vph, arg);
+
+			for (i=0; i<len;) {
+				const char *hex = uc ? hex_uc : hex_lc;
+				size_t l = 0;
+
+				/* a buffer of hex digits per call */
+				for (; i<len && l<sizeof(num); i++) {
+					const uint8_t v = *bptr++;
+
+					num[l++] = hex[v >> 4];
+					num[l++] = hex[v & 0xf];
+				}
 
-			for (i=0; i<len; i++) {
-				const uint8_t v = *bptr++;
-				uint32_t l = local_itoa(num, v, 16, uc);
-				err |= write_padded(num, l, 2, '0',
-						    false, NULL, vph, arg);
+				err |= vph(num, l, arg);
 			}
 
-			while (plr && pad-- > (len * 2))
-				err |= vph(&pch, 1, arg);
+			if (plr && pad > len * 2)
+				err |= write_pad(pch, pad - len * 2, vph, arg);
 
 			break;
 
@@ -4,6 +4,7 @@
  * Copyright (C) 2010 Creytiv.com
  */
 #include <ctype.h>
+#include <string.h>
 #include <re_types.h>
 #include <re_fmt.h>
 
@@ -258,3 +259,343 @@ int re_regex(const char *ptr, size_t len, const char *expr, ...)
 
 	return *ep ? ENOENT : 0;
 }
+
+
+static int class_add(struct regex *re, const struct chr *chrv, uint32_t n,
+		     bool neg, bool qesc)
+{
+	unsigned c;
+
+	if (re->clsc >= RE_REGEX_CLS)
+		return EOVERFLOW;
+
+	for (c=0; c<256; c++) {
+
+		if (expr_match(chrv, n, tolower(c), neg))
+			re->clsv[re->clsc].map[c>>3] |= 1 << (c & 7);
+	}
+
+	re->clsv[re->clsc].qesc = qesc;
+
+	return 0;
+}
+
+
+/**
+ * Compile a basic regular expression, as used by re_regex(). The matching
+ * is done by re_regex_exec() without parsing the expression again.
+ *
+ * @param re   Compiled expression
+ * @param expr Regular expressions string
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int re_regex_compile(struct regex *re, const char *expr)
+{
+	bool fm = false, range = false, ec = false, neg = false, qesc = false;
+	bool eesc = false;
+	struct chr chrv[64];
+	const char *ep;
+	uint32_t n = 0;
+	int err;
+
+	if (!re || !expr)
+		return EINVAL;
+
+	memset(re, 0, sizeof(*re));
+
+	for (ep = expr; *ep; ep++) {
+
+		if ('\\' == *ep && !eesc) {
+			eesc = true;
+			continue;
+		}
+
+		if (!fm) {
+
+			/* Start of character class */
+			if ('[' == *ep && !eesc) {
+				n     = 0;
+				fm    = true;
+				ec    = false;
+				neg   = false;
+				range = false;
+				qesc  = false;
+				continue;
+			}
+
+			if (re->opc >= RE_REGEX_OPS)
+				return EOVERFLOW;
+
+			re->opv[re->opc++].c = tolower(*ep);
+
+			eesc = false;
+			continue;
+		}
+		/* End of character class */
+		else if (ec) {
+
+			uint8_t nmin, nmax;
+
+			if ('*' == *ep) {
+				nmin = 0;
+				nmax = 0;
+			}
+			else if ('+' == *ep) {
+				nmin = 1;
+				nmax = 0;
+			}
+			else if ('1' <= *ep && *ep <= '9') {
+				nmin = *ep - '0';
+				nmax = *ep - '0';
+			}
+			else
+				return EINVAL;
+
+			if (re->opc >= RE_REGEX_OPS)
+				return EOVERFLOW;
+
+			err = class_add(re, chrv, n, neg, qesc);
+			if (err)
+				return err;
+
+			re->opv[re->opc].cls  = ++re->clsc;
+			re->opv[re->opc].nmin = nmin;
+			re->opv[re->opc].nmax = nmax;
+			++re->opc;
+
+			fm = false;
+			eesc = false;
+			continue;
+		}
+
+		if (eesc) {
+			eesc = false;
+			goto chr;
+		}
+
+		switch (*ep) {
+
+			/* End of character class */
+		case ']':
+			ec = true;
+			continue;
+
+			/* Negate with quote escape */
+		case '~':
+			if (n)
+				break;
+
+			qesc = true;
+			neg  = true;
+			continue;
+
+			/* Negate */
+		case '^':
+			if (n)
+				break;
+
+			neg = true;
+			continue;
+
+			/* Range */
+		case '-':
+			if (!n || range)
+				break;
+
+			range = true;
+			--n;
+			continue;
+		}
+
+	chr:
+		if (n >= ARRAY_SIZE(chrv))
+			return EINVAL;
+
+		chrv[n].max = tolower(*ep);
+
+		if (range)
+			range = false;
+		else
+			chrv[n].min = tolower(*ep);
+
+		++n;
+	}
+
+	if (fm)
+		return EINVAL;
+
+	re->ok = true;
+
+	return 0;
+}
+
+
+/* Match the expression at the start of a string, ENOENT if it can't */
+static int regex_match(const struct regex *re, const char *p, size_t l,
+		       va_list ap)
+{
+	uint8_t i;
+
+	for (i=0; i<re->opc; i++) {
+
+		const uint8_t cls = re->opv[i].cls;
+		const uint8_t *map;
+		uint32_t nm, nmax;
+		bool quote = false, esc = false, qesc;
+		struct pl lpl, *pl;
+
+		if (!cls) {
+			if (!l)
+				return ENOENT;
+
+			if (re->opv[i].c != tolower(*p))
+				return EAGAIN;
+
+			++p;
+			--l;
+			continue;
+		}
+
+		pl   = va_arg(ap, struct pl *);
+		map  = re->clsv[cls - 1].map;
+		qesc = re->clsv[cls - 1].qesc;
+		nmax = re->opv[i].nmax ? re->opv[i].nmax : (uint32_t)-1;
+
+		lpl.p = p;
+		lpl.l = 0;
+
+		for (nm = 0; l && nm < nmax; nm++, p++, l--, lpl.l++) {
+
+			const uint8_t c = *p;
+
+			if (qesc) {
+
+				if (esc) {
+					esc = false;
+					continue;
+				}
+
+				switch (c) {
+
+				case '\\':
+					esc = true;
+					continue;
+
+				case '"':
+					quote = !quote;
+					continue;
+				}
+
+				if (quote)
+					continue;
+			}
+
+			if (!(map[c>>3] & (1 << (c & 7))))
+				break;
+		}
+
+		/* Strip quotes */
+		if (qesc && lpl.l > 1 &&
+		    lpl.p[0] == '"' && lpl.p[lpl.l - 1] == '"') {
+
+			lpl.p += 1;
+			lpl.l -= 2;
+			nm    -= 2;
+		}
+
+		if ((nm < re->opv[i].nmin) || (nm > nmax))
+			return EAGAIN;
+
+		if (pl)
+			*pl = lpl;
+	}
+
+	return 0;
+}
+
+
+static int regex_vexec(const struct regex *re, const char *ptr, size_t len,
+		       va_list ap)
+{
+	for (;; ptr++, len--) {
+
+		va_list aq;
+		int err;
+
+		if (!len)
+			return re->opc ? ENOENT : 0;
+
+		va_copy(aq, ap);
+		err = regex_match(re, ptr, len, aq);
+		va_end(aq);
+
+		if (err != EAGAIN)
+			return err;
+	}
+}
+
+
+/**
+ * Parse a string with a compiled regular expression, as re_regex() does
+ *
+ * @param re  Compiled expression
+ * @param ptr String to parse
+ * @param len Length of string
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int re_regex_exec(const struct regex *re, const char *ptr, size_t len, ...)
+{
+	va_list ap;
+	int err;
+
+	if (!re || !re->ok || !ptr)
+		return EINVAL;
+
+	va_start(ap, len);
+	err = regex_vexec(re, ptr, len, ap);
+	va_end(ap);
+
+	return err;
+}
+
+
+/**
+ * Parse a string using basic regular expressions, compiled on the first
+ * call into a buffer that is kept by the caller, usually a static one.
+ * See also the RE_REGEX() macro.
+ *
+ * @param re   Compiled expression, zeroed before the first call
+ * @param ptr  String to parse
+ * @param len  Length of string
+ * @param expr Regular expressions string, the same for each call
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int re_regex_cached(struct regex *re, const char *ptr, size_t len,
+		    const char *expr, ...)
+{
+	va_list ap;
+	int err;
+
+	if (!re || !ptr || !expr)
+		return EINVAL;
+
+	if (!re->ok) {
+		struct regex tmp;
+
+		/* compiled aside, since other threads may be matching */
+		err = re_regex_compile(&tmp, expr);
+		if (err)
+			return err;
+
+		*re = tmp;
+	}
+
+	va_start(ap, expr);
+	err = regex_vexec(re, ptr, len, ap);
+	va_end(ap);
+
+	return err;
+}
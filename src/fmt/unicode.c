@@ -4,6 +4,12 @@
  * Copyright (C) 2010 Creytiv.com
  */
 #include <ctype.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 #include <re_types.h>
 #include <re_fmt.h>
 
@@ -228,3 +234,159 @@ size_t utf8_byteseq(char u[4], unsigned cp)
 		return 3;
 	}
 }
+
+
+/* Length of the ASCII run at the start of p */
+static size_t ascii_span(const uint8_t *p, size_t len)
+{
+	size_t i = 0;
+
+#if defined(__SSE2__)
+	for (; i + 16 <= len; i += 16) {
+
+		const __m128i x = _mm_loadu_si128((const __m128i *)(p + i));
+
+		if (_mm_movemask_epi8(x))
+			break;
+	}
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+	for (; i + 16 <= len; i += 16) {
+
+		if (vmaxvq_u8(vld1q_u8(p + i)) >= 0x80)
+			break;
+	}
+#endif
+
+	for (; i + 8 <= len; i += 8) {
+
+		uint64_t w;
+
+		memcpy(&w, p + i, sizeof(w));
+		if (w & 0x8080808080808080ULL)
+			break;
+	}
+
+	while (i < len && p[i] < 0x80)
+		++i;
+
+	return i;
+}
+
+
+/*
+ * Length of the well-formed sequence at the start of p (Unicode 3.9,
+ * table 3-7), or 0 if it is ill-formed or incomplete
+ */
+static size_t seq_len(const uint8_t *p, size_t len)
+{
+	uint8_t lo = 0x80, hi = 0xbf;
+	size_t n, i;
+
+	if (p[0] >= 0xc2 && p[0] <= 0xdf)
+		n = 2;
+	else if (p[0] >= 0xe0 && p[0] <= 0xef)
+		n = 3;
+	else if (p[0] >= 0xf0 && p[0] <= 0xf4)
+		n = 4;
+	else
+		return 0;
+
+	if (len < n)
+		return 0;
+
+	/* No overlongs, surrogates or code points above U+10FFFF */
+	switch (p[0]) {
+
+	case 0xe0: lo = 0xa0; break;
+	case 0xed: hi = 0x9f; break;
+	case 0xf0: lo = 0x90; break;
+	case 0xf4: hi = 0x8f; break;
+	default:   break;
+	}
+
+	if (p[1] < lo || p[1] > hi)
+		return 0;
+
+	for (i=2; i<n; i++) {
+		if ((p[i] & 0xc0) != 0x80)
+			return 0;
+	}
+
+	return n;
+}
+
+
+/**
+ * Check that a buffer is well-formed UTF-8. Runs of ASCII characters are
+ * checked a vector or a word at a time.
+ *
+ * @param str Input buffer
+ * @param len Length of buffer
+ *
+ * @return True if valid, otherwise false
+ */
+bool utf8_validate(const char *str, size_t len)
+{
+	const uint8_t *p = (const uint8_t *)str;
+	size_t i = 0;
+
+	if (!str)
+		return len == 0;
+
+	while (i < len) {
+
+		size_t n;
+
+		i += ascii_span(p + i, len - i);
+		if (i == len)
+			break;
+
+		n = seq_len(p + i, len - i);
+		if (!n)
+			return false;
+
+		i += n;
+	}
+
+	return true;
+}
+
+
+/**
+ * Get the length of an incomplete UTF-8 sequence at the end of a buffer,
+ * e.g. of a message that continues in the next fragment
+ *
+ * @param str Input buffer
+ * @param len Length of buffer
+ *
+ * @return Number of bytes of a started sequence at the end, 0-3
+ */
+size_t utf8_tail(const char *str, size_t len)
+{
+	const uint8_t *p = (const uint8_t *)str;
+	size_t i, n;
+
+	if (!str)
+		return 0;
+
+	for (i=1; i<=3 && i<=len; i++) {
+
+		const uint8_t c = p[len - i];
+
+		if ((c & 0xc0) == 0x80)
+			continue;
+
+		if (c >= 0xf0)
+			n = 4;
+		else if (c >= 0xe0)
+			n = 3;
+		else if (c >= 0xc0)
+			n = 2;
+		else
+			return 0;
+
+		return i < n ? i : 0;
+	}
+
+	return 0;
+}
@@ -0,0 +1,415 @@
+/**
+ * @file chash.c  Concurrent hash table
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <re_types.h>
+#include <re_mem.h>
+#include <re_list.h>
+#include <re_lock.h>
+#include <re_hash.h>
+
+
+/*
+ * The buckets are guarded by a set of read/write locks, bucket i by lock
+ * i modulo the number of locks, so threads that use different buckets
+ * rarely meet on a lock, and lookups of the same bucket run in parallel.
+ *
+ * The table holds a reference to each value, and a lookup returns a new
+ * reference, taken while the bucket is locked. Values are dereferenced
+ * after the lock is released, so their destructors may use the table.
+ * The handler of chash_apply() is called without any lock held, on
+ * references taken bucket by bucket; it may change the table, and sees
+ * a value that is inserted or removed meanwhile, or not.
+ */
+
+
+enum {
+	STRIPES_MAX = 64,
+	APPLY_STACK = 16,
+};
+
+
+/** Defines an entry of the concurrent hash table */
+struct chash_ent {
+	struct le le;
+	void *val;           /**< Referenced value */
+	uint32_t key;
+};
+
+/** Defines a concurrent hash table */
+struct chash {
+	struct list *bucket;
+	struct lock **lockv;
+	uint32_t bsize;      /**< Number of buckets, power of two */
+	uint32_t nlocks;     /**< Number of locks, power of two   */
+	uint32_t count;      /**< Number of entries               */
+};
+
+
+#if defined (__ATOMIC_RELAXED)
+#define count_add(p, n) __atomic_add_fetch((p), (n), __ATOMIC_RELAXED)
+#define count_get(p)    __atomic_load_n((p), __ATOMIC_RELAXED)
+#else
+#define count_add(p, n) (*(p) += (n))
+#define count_get(p)    (*(p))
+#endif
+
+
+static void destructor(void *arg)
+{
+	struct chash *h = arg;
+	uint32_t i;
+
+	chash_flush(h);
+
+	for (i=0; h->lockv && i<h->nlocks; i++)
+		mem_deref(h->lockv[i]);
+
+	mem_deref(h->lockv);
+	mem_deref(h->bucket);
+}
+
+
+static void ent_destructor(void *arg)
+{
+	struct chash_ent *ent = arg;
+
+	mem_deref(ent->val);
+}
+
+
+static inline struct lock *bucket_lock(const struct chash *h, uint32_t b)
+{
+	return h->lockv[b & (h->nlocks - 1)];
+}
+
+
+/**
+ * Allocate a concurrent hash table, for values that are shared by
+ * threads. The values are memory objects that the table references.
+ *
+ * @param hp    Pointer to allocated table
+ * @param bsize Number of buckets, rounded up to a power of two
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int chash_alloc(struct chash **hp, uint32_t bsize)
+{
+	struct chash *h;
+	uint32_t i;
+	int err = 0;
+
+	if (!hp || !bsize)
+		return EINVAL;
+
+	h = mem_zalloc(sizeof(*h), destructor);
+	if (!h)
+		return ENOMEM;
+
+	h->bsize = hash_valid_size(bsize);
+	h->nlocks = min(h->bsize, (uint32_t)STRIPES_MAX);
+
+	h->bucket = mem_zalloc(h->bsize * sizeof(*h->bucket), NULL);
+	h->lockv  = mem_zalloc(h->nlocks * sizeof(*h->lockv), NULL);
+	if (!h->bucket || !h->lockv) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	for (i=0; i<h->nlocks && !err; i++)
+		err = lock_alloc(&h->lockv[i]);
+
+ out:
+	if (err)
+		mem_deref(h);
+	else
+		*hp = h;
+
+	return err;
+}
+
+
+/**
+ * Insert a value into a concurrent hash table. The table takes a new
+ * reference to the value, and makes its reference count atomic with
+ * mem_share().
+ *
+ * @param h   Concurrent hash table
+ * @param key Hash key
+ * @param val Value, a memory object
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int chash_insert(struct chash *h, uint32_t key, void *val)
+{
+	struct chash_ent *ent;
+	uint32_t b;
+
+	if (!h || !val)
+		return EINVAL;
+
+	ent = mem_zalloc(sizeof(*ent), ent_destructor);
+	if (!ent)
+		return ENOMEM;
+
+	/* the value is now referenced by other threads */
+	ent->val = mem_ref(mem_share(val));
+	ent->key = key;
+
+	b = key & (h->bsize - 1);
+
+	lock_write_get(bucket_lock(h, b));
+	list_append(&h->bucket[b], &ent->le, ent);
+	lock_rel(bucket_lock(h, b));
+
+	count_add(&h->count, 1);
+
+	return 0;
+}
+
+
+/**
+ * Remove a value from a concurrent hash table, and release the
+ * reference of the table
+ *
+ * @param h   Concurrent hash table
+ * @param key Hash key
+ * @param val Value to remove
+ *
+ * @return True if the value was found
+ */
+bool chash_remove(struct chash *h, uint32_t key, const void *val)
+{
+	struct chash_ent *ent = NULL;
+	struct le *le;
+	uint32_t b;
+
+	if (!h || !val)
+		return false;
+
+	b = key & (h->bsize - 1);
+
+	lock_write_get(bucket_lock(h, b));
+
+	for (le = h->bucket[b].head; le; le = le->next) {
+
+		struct chash_ent *e = le->data;
+
+		if (e->key == key && e->val == val) {
+			list_unlink(&e->le);
+			ent = e;
+			break;
+		}
+	}
+
+	lock_rel(bucket_lock(h, b));
+
+	if (!ent)
+		return false;
+
+	count_add(&h->count, (uint32_t)-1);
+	mem_deref(ent);
+
+	return true;
+}
+
+
+static void *bucket_find(struct chash *h, uint32_t key, hmap_cmp_h *cmph,
+			 void *arg, bool take)
+{
+	struct chash_ent *ent = NULL;
+	void *val = NULL;
+	struct le *le;
+	uint32_t b;
+
+	if (!h)
+		return NULL;
+
+	b = key & (h->bsize - 1);
+
+	if (take)
+		lock_write_get(bucket_lock(h, b));
+	else
+		lock_read_get(bucket_lock(h, b));
+
+	for (le = h->bucket[b].head; le; le = le->next) {
+
+		struct chash_ent *e = le->data;
+
+		if (e->key != key || (cmph && !cmph(e->val, arg)))
+			continue;
+
+		if (take) {
+			list_unlink(&e->le);
+			ent = e;
+		}
+		else {
+			val = mem_ref(e->val);
+		}
+
+		break;
+	}
+
+	lock_rel(bucket_lock(h, b));
+
+	if (ent) {
+		val = ent->val;
+		ent->val = NULL;
+
+		count_add(&h->count, (uint32_t)-1);
+		mem_deref(ent);
+	}
+
+	return val;
+}
+
+
+/**
+ * Look up a value in a concurrent hash table
+ *
+ * @param h    Concurrent hash table
+ * @param key  Hash key
+ * @param cmph Compare handler, NULL to match the first value of the key
+ * @param arg  Handler argument
+ *
+ * @return New reference to the value, to be dereferenced by the caller,
+ *         or NULL if not found
+ *
+ * @note The compare handler is called with the bucket locked, and must
+ *       not use the table
+ */
+void *chash_lookup(struct chash *h, uint32_t key, hmap_cmp_h *cmph,
+		   void *arg)
+{
+	return bucket_find(h, key, cmph, arg, false);
+}
+
+
+/**
+ * Remove a value from a concurrent hash table, and return it. Only one
+ * of several threads that take the same value gets it.
+ *
+ * @param h    Concurrent hash table
+ * @param key  Hash key
+ * @param cmph Compare handler, NULL to match the first value of the key
+ * @param arg  Handler argument
+ *
+ * @return Reference of the table to the value, to be dereferenced by the
+ *         caller, or NULL if not found
+ */
+void *chash_take(struct chash *h, uint32_t key, hmap_cmp_h *cmph, void *arg)
+{
+	return bucket_find(h, key, cmph, arg, true);
+}
+
+
+/**
+ * Call a handler for the values of a concurrent hash table, until it
+ * returns true. The handler is called without a lock held, and may
+ * change the table.
+ *
+ * @param h   Concurrent hash table
+ * @param ah  Apply handler
+ * @param arg Handler argument
+ *
+ * @return New reference to the value that stopped the iteration, to be
+ *         dereferenced by the caller, or NULL
+ */
+void *chash_apply(struct chash *h, chash_apply_h *ah, void *arg)
+{
+	void *stackv[APPLY_STACK];
+	void *found = NULL;
+	uint32_t b;
+
+	if (!h || !ah)
+		return NULL;
+
+	for (b=0; b<h->bsize && !found; b++) {
+
+		void **valv = stackv;
+		uint32_t i, n;
+		struct le *le;
+
+		lock_read_get(bucket_lock(h, b));
+
+		n = list_count(&h->bucket[b]);
+		if (n > APPLY_STACK) {
+			valv = mem_alloc(n * sizeof(*valv), NULL);
+			if (!valv)
+				n = 0;
+		}
+
+		i = 0;
+		for (le = h->bucket[b].head; le && i < n; le = le->next) {
+
+			const struct chash_ent *e = le->data;
+
+			valv[i++] = mem_ref(e->val);
+		}
+
+		lock_rel(bucket_lock(h, b));
+
+		for (i=0; i<n; i++) {
+
+			if (!found && ah(valv[i], arg))
+				found = valv[i];
+			else
+				mem_deref(valv[i]);
+		}
+
+		if (valv != stackv)
+			mem_deref(valv);
+	}
+
+	return found;
+}
+
+
+/**
+ * Remove all values from a concurrent hash table
+ *
+ * @param h Concurrent hash table
+ */
+void chash_flush(struct chash *h)
+{
+	uint32_t b;
+
+	if (!h || !h->bucket || !h->lockv)
+		return;
+
+	for (b=0; b<h->bsize; b++) {
+
+		struct list l;
+		uint32_t n;
+
+		lock_write_get(bucket_lock(h, b));
+
+		n = list_count(&h->bucket[b]);
+
+		/* the list is moved out, and flushed without the lock */
+		l = h->bucket[b];
+		list_init(&h->bucket[b]);
+
+		lock_rel(bucket_lock(h, b));
+
+		if (!n)
+			continue;
+
+		count_add(&h->count, (uint32_t)-n);
+		list_flush(&l);
+	}
+}
+
+
+/**
+ * Get the number of values in a concurrent hash table
+ *
+ * @param h Concurrent hash table
+ *
+ * @return Number of values
+ */
+uint32_t chash_count(const struct chash *h)
+{
+	return h ? count_get(&h->count) : 0;
+}
@@ -4,6 +4,7 @@
  * Copyright (C) 2010 Creytiv.com
  */
 #include <ctype.h>
+#include <string.h>
 #include <re_types.h>
 #include <re_fmt.h>
 #include <re_list.h>
@@ -137,203 +138,134 @@ uint32_t hash_joaat_pl_ci(const struct pl *pl)
 
 
 /*
- * My best guess at if you are big-endian or little-endian.  This may
- * need adjustment.
+ * The fast hash reads the key eight bytes at a time and mixes the words
+ * with 64-bit multiplications, in the style of wyhash. The loads do not
+ * need to be aligned. A key of up to 16 bytes is read with two or four
+ * overlapping loads, so there is no byte loop at all.
+ *
+ * The case-insensitive variant folds the ASCII letters of a whole word at
+ * once, and gives the same value as hash_fast() of the lower-case key.
  */
-#if (defined(__BYTE_ORDER) && defined(__LITTLE_ENDIAN) && \
-     __BYTE_ORDER == __LITTLE_ENDIAN) ||			\
-	(defined(i386) || defined(__i386__) || defined(__i486__) ||	\
-	 defined(__i586__) || defined(__i686__) || \
-	 defined(vax) || defined(MIPSEL))
-# define HASH_LITTLE_ENDIAN 1
-# define HASH_BIG_ENDIAN 0
-#elif (defined(__BYTE_ORDER) && defined(__BIG_ENDIAN) &&	\
-       __BYTE_ORDER == __BIG_ENDIAN) ||					\
-	(defined(sparc) || defined(POWERPC) || \
-	 defined(mc68000) || defined(sel))
-# define HASH_LITTLE_ENDIAN 0
-# define HASH_BIG_ENDIAN 1
-#else
-# define HASH_LITTLE_ENDIAN 0
-# define HASH_BIG_ENDIAN 0
+
+
+#define FAST_SEED 0x304a0012ULL
+#define FAST_P0   0xa0761d6478bd642fULL
+#define FAST_P1   0xe7037ed1a0b428dbULL
+#define ONES      0x0101010101010101ULL
+
+
+#ifdef __SIZEOF_INT128__
+__extension__ typedef unsigned __int128 hash_u128;
 #endif
 
-#define hashsize(n) ((uint32_t)1<<(n))
-#define hashmask(n) (hashsize(n)-1)
-#define rot(x,k) (((x)<<(k)) | ((x)>>(32-(k))))
-
-#define mix(a,b,c) {					\
-		a -= c;  a ^= rot(c, 4);  c += b;	\
-		b -= a;  b ^= rot(a, 6);  a += c;	\
-		c -= b;  c ^= rot(b, 8);  b += a;	\
-		a -= c;  a ^= rot(c,16);  c += b;	\
-		b -= a;  b ^= rot(a,19);  a += c;	\
-		c -= b;  c ^= rot(b, 4);  b += a;	\
-	}
 
+static inline uint64_t load64(const uint8_t *p)
+{
+	uint64_t v;
 
-#define final(a,b,c)	  \
-	{					\
-		c ^= b; c -= rot(b,14);		\
-		a ^= c; a -= rot(c,11);		\
-		b ^= a; b -= rot(a,25);		\
-		c ^= b; c -= rot(b,16);		\
-		a ^= c; a -= rot(c,4);		\
-		b ^= a; b -= rot(a,14);		\
-		c ^= b; c -= rot(b,24);		\
-	}
+	memcpy(&v, p, sizeof(v));
 
+	return v;
+}
 
-static uint32_t hashlittle( const void *key, size_t length, uint32_t initval)
+
+static inline uint64_t load32(const uint8_t *p)
 {
-	uint32_t a,b,c;
-	union { const void *ptr; size_t i; } u;
-
-	/* Set up the internal state */
-	a = b = c = 0xdeadbeef + ((uint32_t)length) + initval;
-
-	u.ptr = key;
-	if (HASH_LITTLE_ENDIAN && ((u.i & 0x3) == 0)) {
-		const uint32_t *k = (const uint32_t *)key;
-
-		while (length > 12) {
-			a += k[0];
-			b += k[1];
-			c += k[2];
-			mix(a,b,c);
-			length -= 12;
-			k += 3;
-		}
+	uint32_t v;
 
-#ifndef VALGRIND
-		switch (length) {
-
-		case 12: c+=k[2]; b+=k[1]; a+=k[0]; break;
-		case 11: c+=k[2]&0xffffff; b+=k[1]; a+=k[0]; break;
-		case 10: c+=k[2]&0xffff; b+=k[1]; a+=k[0]; break;
-		case 9 : c+=k[2]&0xff; b+=k[1]; a+=k[0]; break;
-		case 8 : b+=k[1]; a+=k[0]; break;
-		case 7 : b+=k[1]&0xffffff; a+=k[0]; break;
-		case 6 : b+=k[1]&0xffff; a+=k[0]; break;
-		case 5 : b+=k[1]&0xff; a+=k[0]; break;
-		case 4 : a+=k[0]; break;
-		case 3 : a+=k[0]&0xffffff; break;
-		case 2 : a+=k[0]&0xffff; break;
-		case 1 : a+=k[0]&0xff; break;
-		case 0 : return c;
-		}
+	memcpy(&v, p, sizeof(v));
 
-#else /* make valgrind happy */
-
-		const uint8_t  *k8 = (const uint8_t *)k;
-		switch (length) {
-
-		case 12: c+=k[2]; b+=k[1]; a+=k[0]; break;
-		case 11: c+=((uint32_t)k8[10])<<16;  /* fall through */
-		case 10: c+=((uint32_t)k8[9])<<8;    /* fall through */
-		case 9 : c+=k8[8];                   /* fall through */
-		case 8 : b+=k[1]; a+=k[0]; break;
-		case 7 : b+=((uint32_t)k8[6])<<16;   /* fall through */
-		case 6 : b+=((uint32_t)k8[5])<<8;    /* fall through */
-		case 5 : b+=k8[4];                   /* fall through */
-		case 4 : a+=k[0]; break;
-		case 3 : a+=((uint32_t)k8[2])<<16;   /* fall through */
-		case 2 : a+=((uint32_t)k8[1])<<8;    /* fall through */
-		case 1 : a+=k8[0]; break;
-		case 0 : return c;
-		}
+	return v;
+}
 
-#endif /* !valgrind */
 
-	}
-	else if (HASH_LITTLE_ENDIAN && ((u.i & 0x1) == 0)) {
-		const uint16_t *k = (const uint16_t *)key;
-		const uint8_t  *k8;
-
-		while (length > 12) {
-			a += k[0] + (((uint32_t)k[1])<<16);
-			b += k[2] + (((uint32_t)k[3])<<16);
-			c += k[4] + (((uint32_t)k[5])<<16);
-			mix(a,b,c);
-			length -= 12;
-			k += 6;
+/* Upper-case ASCII letters to lower-case, in every byte of the word */
+static inline uint64_t fold_case(uint64_t w)
+{
+	const uint64_t h = w & (ONES * 0x7f);
+	const uint64_t ge_a = h + ONES * (0x80 - 'A');
+	const uint64_t gt_z = h + ONES * (0x80 - 'Z' - 1);
+
+	return w | (((ge_a ^ gt_z) & ~w & (ONES * 0x80)) >> 2);
+}
+
+
+/* Fold the 128-bit product of a and b to 64 bits */
+static inline uint64_t mum(uint64_t a, uint64_t b)
+{
+#ifdef __SIZEOF_INT128__
+	const hash_u128 r = (hash_u128)a * b;
+
+	return (uint64_t)r ^ (uint64_t)(r >> 64);
+#else
+	const uint64_t ha = a >> 32, la = (uint32_t)a;
+	const uint64_t hb = b >> 32, lb = (uint32_t)b;
+	const uint64_t rm0 = ha * lb, rm1 = hb * la;
+	const uint64_t rl = la * lb;
+	uint64_t t, lo, hi, c;
+
+	t  = rl + (rm0 << 32);
+	c  = t < rl;
+	lo = t + (rm1 << 32);
+	c += lo < t;
+	hi = ha * hb + (rm0 >> 32) + (rm1 >> 32) + c;
+
+	return lo ^ hi;
+#endif
+}
+
+
+static inline uint64_t load(const uint8_t *p, bool ci)
+{
+	return ci ? fold_case(load64(p)) : load64(p);
+}
+
+
+static inline uint32_t fast_hash(const uint8_t *p, size_t len, bool ci)
+{
+	uint64_t seed = FAST_SEED ^ FAST_P0;
+	uint64_t a, b;
+
+	if (len <= 16) {
+
+		if (len >= 4) {
+			const size_t d = (len >> 3) << 2;
+
+			a = load32(p) << 32 | load32(p + d);
+			b = load32(p + len - 4) << 32 |
+				load32(p + len - 4 - d);
+		}
+		else if (len > 0) {
+			a = (uint64_t)p[0] << 16 | (uint64_t)p[len >> 1] << 8 |
+				p[len - 1];
+			b = 0;
+		}
+		else {
+			a = b = 0;
 		}
 
-		k8 = (const uint8_t *)k;
-
-		switch (length) {
-
-		case 12: c+=k[4]+(((uint32_t)k[5])<<16);
-			b+=k[2]+(((uint32_t)k[3])<<16);
-			a+=k[0]+(((uint32_t)k[1])<<16);
-			break;
-		case 11: c+=((uint32_t)k8[10])<<16;     /* fall through */
-		case 10: c+=k[4];
-			b+=k[2]+(((uint32_t)k[3])<<16);
-			a+=k[0]+(((uint32_t)k[1])<<16);
-			break;
-		case 9 : c+=k8[8];                      /* fall through */
-		case 8 : b+=k[2]+(((uint32_t)k[3])<<16);
-			a+=k[0]+(((uint32_t)k[1])<<16);
-			break;
-		case 7 : b+=((uint32_t)k8[6])<<16;      /* fall through */
-		case 6 : b+=k[2];
-			a+=k[0]+(((uint32_t)k[1])<<16);
-			break;
-		case 5 : b+=k8[4];                      /* fall through */
-		case 4 : a+=k[0]+(((uint32_t)k[1])<<16);
-			break;
-		case 3 : a+=((uint32_t)k8[2])<<16;      /* fall through */
-		case 2 : a+=k[0];
-			break;
-		case 1 : a+=k8[0];
-			break;
-		case 0 : return c;
+		if (ci) {
+			a = fold_case(a);
+			b = fold_case(b);
 		}
 	}
 	else {
-		const uint8_t *k = (const uint8_t *)key;
-
-		while (length > 12) {
-			a += k[0];
-			a += ((uint32_t)k[1])<<8;
-			a += ((uint32_t)k[2])<<16;
-			a += ((uint32_t)k[3])<<24;
-			b += k[4];
-			b += ((uint32_t)k[5])<<8;
-			b += ((uint32_t)k[6])<<16;
-			b += ((uint32_t)k[7])<<24;
-			c += k[8];
-			c += ((uint32_t)k[9])<<8;
-			c += ((uint32_t)k[10])<<16;
-			c += ((uint32_t)k[11])<<24;
-			mix(a,b,c);
-			length -= 12;
-			k += 12;
-		}
+		size_t i = len;
 
-		/* all the case statements fall through */
-		switch (length) {
-
-		case 12: c+=((uint32_t)k[11])<<24;
-		case 11: c+=((uint32_t)k[10])<<16;
-		case 10: c+=((uint32_t)k[9])<<8;
-		case 9 : c+=k[8];
-		case 8 : b+=((uint32_t)k[7])<<24;
-		case 7 : b+=((uint32_t)k[6])<<16;
-		case 6 : b+=((uint32_t)k[5])<<8;
-		case 5 : b+=k[4];
-		case 4 : a+=((uint32_t)k[3])<<24;
-		case 3 : a+=((uint32_t)k[2])<<16;
-		case 2 : a+=((uint32_t)k[1])<<8;
-		case 1 : a+=k[0];
-			break;
-		case 0 : return c;
+		while (i > 16) {
+			seed = mum(load(p, ci) ^ FAST_P1,
+				   load(p + 8, ci) ^ seed);
+			p += 16;
+			i -= 16;
 		}
+
+		a = load(p + i - 16, ci);
+		b = load(p + i - 8, ci);
 	}
 
-	final(a,b,c);
-	return c;
+	a = mum(FAST_P1 ^ len, mum(a ^ FAST_P1, b ^ seed));
+
+	return (uint32_t)(a ^ (a >> 32));
 }
 
 
@@ -347,12 +279,28 @@ static uint32_t hashlittle( const void *key, size_t length, uint32_t initval)
  */
 uint32_t hash_fast(const char *k, size_t len)
 {
-	static volatile int random_seed = 0x304a0012;
-
 	if (!k)
 		return 0;
 
-	return hashlittle(k, len, random_seed);
+	return fast_hash((const uint8_t *)k, len, false);
+}
+
+
+/**
+ * Calculate hash-value for a case-insensitive string, using fast hash
+ * algorithm. Only the ASCII letters are folded.
+ *
+ * @param str  String
+ * @param len  Length of string
+ *
+ * @return Calculated hash-value
+ */
+uint32_t hash_fast_ci(const char *str, size_t len)
+{
+	if (!str)
+		return 0;
+
+	return fast_hash((const uint8_t *)str, len, true);
 }
 
 
@@ -367,3 +315,31 @@ uint32_t hash_fast_str(const char *str)
 {
 	return hash_fast(str, str_len(str));
 }
+
+
+/**
+ * Calculate hash-value for a pointer-length object, using fast hash
+ * algorithm
+ *
+ * @param pl Pointer-length object
+ *
+ * @return Calculated hash-value
+ */
+uint32_t hash_fast_pl(const struct pl *pl)
+{
+	return pl ? hash_fast(pl->p, pl->l) : 0;
+}
+
+
+/**
+ * Calculate hash-value for a case-insensitive pointer-length object, using
+ * fast hash algorithm
+ *
+ * @param pl Pointer-length object
+ *
+ * @return Calculated hash-value
+ */
+uint32_t hash_fast_pl_ci(const struct pl *pl)
+{
+	return pl ? hash_fast_ci(pl->p, pl->l) : 0;
+}
@@ -3,6 +3,7 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
+#include <string.h>
 #include <re_types.h>
 #include <re_mem.h>
 #include <re_mbuf.h>
@@ -10,21 +11,159 @@
 #include <re_hash.h>
 
 
+/*
+ * A table allocated with hash_alloc_auto() grows by linear hashing: when
+ * the load is too high, one bucket is split in two before the next element
+ * is added. The extra buckets are allocated in segments of the initial
+ * size that never move, since the list elements point to their bucket.
+ *
+ * The elements are not counted when they are unlinked, so the table
+ * counts them again after as many appends as there are buckets.
+ */
+
+
+enum {
+	HASH_LOAD = 2,        /**< Maximum mean chain length  */
+	HASH_MAX  = 1 << 24,  /**< Maximum number of buckets  */
+};
+
+
 /** Defines a hashmap table */
 struct hash {
 	struct list *bucket;  /**< Bucket with linked lists */
 	uint32_t bsize;       /**< Bucket size              */
+
+	/* Auto-resizing tables only */
+	struct list **segv;   /**< Bucket segments           */
+	hash_key_h *keyh;     /**< Element key handler       */
+	uint32_t segc;        /**< Size of segment vector    */
+	uint32_t shift;       /**< log2 of segment size      */
+	uint32_t level;       /**< Buckets at start of round */
+	uint32_t count;       /**< Elements at last count    */
+	uint32_t since;       /**< Appends since last count  */
 };
 
 
 static void hash_destructor(void *data)
 {
 	struct hash *h = data;
+	uint32_t i;
 
+	for (i=1; i<h->segc; i++)
+		mem_deref(h->segv[i]);
+
+	mem_deref(h->segv);
 	mem_deref(h->bucket);
 }
 
 
+static inline struct list *bucket_at(const struct hash *h, uint32_t i)
+{
+	if (!h->segv)
+		return &h->bucket[i];
+
+	return &h->segv[i >> h->shift][i & (((uint32_t)1 << h->shift) - 1)];
+}
+
+
+static inline struct list *bucket(const struct hash *h, uint32_t key)
+{
+	uint32_t i;
+
+	if (!h->segv)
+		return &h->bucket[key & (h->bsize-1)];
+
+	i = key & (2*h->level - 1);
+	if (i >= h->bsize)
+		i = key & (h->level - 1);
+
+	return bucket_at(h, i);
+}
+
+
+static uint32_t count_all(const struct hash *h)
+{
+	uint32_t i, n = 0;
+
+	for (i=0; i<h->bsize; i++)
+		n += list_count(bucket_at(h, i));
+
+	return n;
+}
+
+
+static int add_segment(struct hash *h, uint32_t seg)
+{
+	const uint32_t ssize = (uint32_t)1 << h->shift;
+
+	if (seg >= h->segc) {
+
+		struct list **segv;
+
+		segv = mem_realloc(h->segv, 2 * h->segc * sizeof(*segv));
+		if (!segv)
+			return ENOMEM;
+
+		memset(segv + h->segc, 0, h->segc * sizeof(*segv));
+
+		h->segv  = segv;
+		h->segc *= 2;
+	}
+
+	if (!h->segv[seg]) {
+		h->segv[seg] = mem_zalloc(ssize * sizeof(struct list), NULL);
+		if (!h->segv[seg])
+			return ENOMEM;
+	}
+
+	return 0;
+}
+
+
+/* Split the bucket at the split pointer */
+static void split(struct hash *h)
+{
+	const uint32_t level = h->level;
+	const uint32_t p = h->bsize - level;
+	struct list *old, *nl;
+	struct le *le;
+
+	if (add_segment(h, h->bsize >> h->shift))
+		return;
+
+	old = bucket_at(h, p);
+	nl  = bucket_at(h, h->bsize);
+
+	if (++h->bsize == 2*level)
+		h->level = 2*level;
+
+	le = old->head;
+	while (le) {
+
+		struct le *next = le->next;
+
+		if ((h->keyh(le) & (2*level - 1)) != p) {
+			list_unlink(le);
+			list_append(nl, le, le->data);
+		}
+
+		le = next;
+	}
+}
+
+
+static void grow(struct hash *h)
+{
+	if (++h->since >= h->bsize) {
+		h->count = count_all(h);
+		h->since = 0;
+	}
+
+	if (h->count + h->since > HASH_LOAD * h->bsize && h->bsize < HASH_MAX)
+		split(h);
+}
+
+
 /**
  * Allocate a new hashmap table
  *
@@ -67,6 +206,50 @@ int hash_alloc(struct hash **hp, uint32_t bsize)
 }
 
 
+/**
+ * Allocate a new hashmap table that grows with the number of elements.
+ * The key handler must return the same key that the element was added
+ * with. The table may be resized in hash_append(), before the new element
+ * is added.
+ *
+ * @param hp     Address of hashmap pointer
+ * @param bsize  Initial bucket size
+ * @param keyh   Element key handler
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int hash_alloc_auto(struct hash **hp, uint32_t bsize, hash_key_h *keyh)
+{
+	struct hash *h;
+	int err;
+
+	if (!keyh)
+		return EINVAL;
+
+	err = hash_alloc(&h, bsize);
+	if (err)
+		return err;
+
+	h->segv = mem_zalloc(sizeof(*h->segv), NULL);
+	if (!h->segv) {
+		mem_deref(h);
+		return ENOMEM;
+	}
+
+	h->segv[0] = h->bucket;
+	h->segc    = 1;
+	h->keyh    = keyh;
+	h->level   = bsize;
+
+	while (((uint32_t)1 << h->shift) < bsize)
+		++h->shift;
+
+	*hp = h;
+
+	return 0;
+}
+
+
 /**
  * Add an element to the hashmap table
  *
@@ -80,7 +263,10 @@ void hash_append(struct hash *h, uint32_t key, struct le *le, void *data)
 	if (!h || !le)
 		return;
 
-	list_append(&h->bucket[key & (h->bsize-1)], le, data);
+	if (h->keyh)
+		grow(h);
+
+	list_append(bucket(h, key), le, data);
 }
 
 
@@ -111,7 +297,7 @@ struct le *hash_lookup(const struct hash *h, uint32_t key, list_apply_h *ah,
 	if (!h || !ah)
 		return NULL;
 
-	return list_apply(&h->bucket[key & (h->bsize-1)], true, ah, arg);
+	return list_apply(bucket(h, key), true, ah, arg);
 }
 
 
@@ -133,7 +319,7 @@ struct le *hash_apply(const struct hash *h, list_apply_h *ah, void *arg)
 		return NULL;
 
 	for (i=0; (i<h->bsize) && !le; i++)
-		le = list_apply(&h->bucket[i], true, ah, arg);
+		le = list_apply(bucket_at(h, i), true, ah, arg);
 
 	return le;
 }
@@ -149,12 +335,13 @@ struct le *hash_apply(const struct hash *h, list_apply_h *ah, void *arg)
  */
 struct list *hash_list(const struct hash *h, uint32_t key)
 {
-	return h ? &h->bucket[key & (h->bsize - 1)] : NULL;
+	return h ? bucket(h, key) : NULL;
 }
 
 
 /**
- * Get hash bucket size
+ * Get hash bucket size. The bucket size of a table that grows is not
+ * always a power of two.
  *
  * @param h Hashmap table
  *
@@ -179,7 +366,7 @@ void hash_flush(struct hash *h)
 		return;
 
 	for (i=0; i<h->bsize; i++)
-		list_flush(&h->bucket[i]);
+		list_flush(bucket_at(h, i));
 }
 
 
@@ -196,7 +383,39 @@ void hash_clear(struct hash *h)
 		return;
 
 	for (i=0; i<h->bsize; i++)
-		list_clear(&h->bucket[i]);
+		list_clear(bucket_at(h, i));
+}
+
+
+/**
+ * Get the chain length distribution of a hashmap table
+ *
+ * @param h    Hashmap table
+ * @param stat Pointer to statistics storage
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int hash_stats(const struct hash *h, struct hash_stat *stat)
+{
+	uint32_t i;
+
+	if (!h || !stat)
+		return EINVAL;
+
+	memset(stat, 0, sizeof(*stat));
+
+	stat->bsize = h->bsize;
+
+	for (i=0; i<h->bsize; i++) {
+
+		const uint32_t n = list_count(bucket_at(h, i));
+
+		stat->count += n;
+		stat->max    = max(stat->max, n);
+		++stat->chainv[min(n, HASH_STAT_CHAINS - 1)];
+	}
+
+	return 0;
 }
 
 
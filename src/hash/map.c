@@ -0,0 +1,264 @@
+/**
+ * @file map.c  Open-addressing hash map
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <re_types.h>
+#include <re_mem.h>
+#include <re_list.h>
+#include <re_hash.h>
+
+
+/*
+ * The keys and the values are kept in two arrays, so a lookup walks a
+ * short run of keys in one or two cache lines and only looks at a value
+ * when its key matches. Collisions go to the next free slot (linear
+ * probing), and a removed entry is filled by shifting the following
+ * entries back, so there are no tombstones.
+ *
+ * Key zero marks an empty slot, so a zero key is stored as another value.
+ * The map holds at most half as many entries as it has slots.
+ */
+
+
+enum {
+	MAP_MIN  = 8,
+	MAP_ZERO = 0x5bd1e995,  /**< Stored instead of key zero */
+};
+
+
+/** Defines an open-addressing hash map */
+struct hmap {
+	uint32_t *keyv;   /**< Keys, zero for an empty slot  */
+	void **valv;      /**< Values                        */
+	uint32_t mask;    /**< Number of slots minus one     */
+	uint32_t shift;   /**< 32 minus log2 of slots        */
+	uint32_t count;   /**< Number of entries             */
+};
+
+
+static void destructor(void *arg)
+{
+	struct hmap *map = arg;
+
+	mem_deref(map->keyv);
+	mem_deref(map->valv);
+}
+
+
+static inline uint32_t map_key(uint32_t key)
+{
+	return key ? key : MAP_ZERO;
+}
+
+
+/* Fibonacci hashing, so that sequential keys are spread too */
+static inline uint32_t map_slot(const struct hmap *map, uint32_t key)
+{
+	return (uint32_t)(key * 2654435769u) >> map->shift;
+}
+
+
+static int map_resize(struct hmap *map, uint32_t size)
+{
+	uint32_t *keyv, *okeyv = map->keyv;
+	void **valv, **ovalv = map->valv;
+	uint32_t i, osize = map->keyv ? map->mask + 1 : 0;
+
+	keyv = mem_zalloc(size * sizeof(*keyv), NULL);
+	valv = mem_zalloc(size * sizeof(*valv), NULL);
+	if (!keyv || !valv) {
+		mem_deref(keyv);
+		mem_deref(valv);
+		return ENOMEM;
+	}
+
+	map->keyv  = keyv;
+	map->valv  = valv;
+	map->mask  = size - 1;
+	map->shift = 32;
+
+	while (size > 1) {
+		--map->shift;
+		size >>= 1;
+	}
+
+	for (i=0; i<osize; i++) {
+
+		uint32_t j;
+
+		if (!okeyv[i])
+			continue;
+
+		for (j = map_slot(map, okeyv[i]); keyv[j];
+		     j = (j + 1) & map->mask)
+			;
+
+		keyv[j] = okeyv[i];
+		valv[j] = ovalv[i];
+	}
+
+	mem_deref(okeyv);
+	mem_deref(ovalv);
+
+	return 0;
+}
+
+
+/**
+ * Allocate an open-addressing hash map. The map grows when needed.
+ *
+ * @param mapp Pointer to allocated hash map
+ * @param size Expected number of entries
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int hmap_alloc(struct hmap **mapp, uint32_t size)
+{
+	struct hmap *map;
+	int err;
+
+	if (!mapp || size > (1u << 30))
+		return EINVAL;
+
+	map = mem_zalloc(sizeof(*map), destructor);
+	if (!map)
+		return ENOMEM;
+
+	size = max(hash_valid_size(2 * size), (uint32_t)MAP_MIN);
+
+	err = map_resize(map, size);
+	if (err)
+		mem_deref(map);
+	else
+		*mapp = map;
+
+	return err;
+}
+
+
+/**
+ * Add an entry to a hash map. Several entries may have the same key.
+ *
+ * @param map Hash map
+ * @param key Hash key
+ * @param val Value, not referenced by the map
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int hmap_insert(struct hmap *map, uint32_t key, void *val)
+{
+	uint32_t i;
+
+	if (!map || !val)
+		return EINVAL;
+
+	if (2 * (map->count + 1) > map->mask + 1) {
+
+		int err = map_resize(map, 2 * (map->mask + 1));
+		if (err)
+			return err;
+	}
+
+	key = map_key(key);
+
+	for (i = map_slot(map, key); map->keyv[i]; i = (i + 1) & map->mask)
+		;
+
+	map->keyv[i] = key;
+	map->valv[i] = val;
+	++map->count;
+
+	return 0;
+}
+
+
+/**
+ * Remove an entry from a hash map. Nothing is done if the entry is not in
+ * the map.
+ *
+ * @param map Hash map
+ * @param key Hash key
+ * @param val Value
+ */
+void hmap_remove(struct hmap *map, uint32_t key, const void *val)
+{
+	uint32_t i, j;
+
+	if (!map || !val)
+		return;
+
+	key = map_key(key);
+
+	for (i = map_slot(map, key); map->keyv[i]; i = (i + 1) & map->mask) {
+
+		if (map->keyv[i] == key && map->valv[i] == val)
+			break;
+	}
+
+	if (!map->keyv[i])
+		return;
+
+	/* Shift back the entries that cannot be found past the hole */
+	for (j = (i + 1) & map->mask; map->keyv[j]; j = (j + 1) & map->mask) {
+
+		const uint32_t k = map_slot(map, map->keyv[j]);
+
+		if (((j - k) & map->mask) < ((j - i) & map->mask))
+			continue;
+
+		map->keyv[i] = map->keyv[j];
+		map->valv[i] = map->valv[j];
+		i = j;
+	}
+
+	map->keyv[i] = 0;
+	map->valv[i] = NULL;
+	--map->count;
+}
+
+
+/**
+ * Find an entry in a hash map
+ *
+ * @param map  Hash map
+ * @param key  Hash key
+ * @param cmph Compare handler for entries with a matching key, or NULL
+ * @param arg  Handler argument
+ *
+ * @return Value of the first matching entry, or NULL if not found
+ */
+void *hmap_lookup(const struct hmap *map, uint32_t key, hmap_cmp_h *cmph,
+		  void *arg)
+{
+	uint32_t i;
+
+	if (!map)
+		return NULL;
+
+	key = map_key(key);
+
+	for (i = map_slot(map, key); map->keyv[i]; i = (i + 1) & map->mask) {
+
+		if (map->keyv[i] != key)
+			continue;
+
+		if (!cmph || cmph(map->valv[i], arg))
+			return map->valv[i];
+	}
+
+	return NULL;
+}
+
+
+/**
+ * Get the number of entries in a hash map
+ *
+ * @param map Hash map
+ *
+ * @return Number of entries
+ */
+uint32_t hmap_count(const struct hmap *map)
+{
+	return map ? map->count : 0;
+}
@@ -6,3 +6,5 @@
 
 SRCS	+= hash/hash.c
 SRCS	+= hash/func.c
+SRCS	+= hash/map.c
+SRCS	+= hash/chash.c
@@ -10,9 +10,20 @@
 #include <re_hmac.h>
 
 
+/** SHA-1 Block size */
+#ifndef SHA_BLOCKSIZE
+#define SHA_BLOCKSIZE   64
+#endif
+
+
+/*
+ * The inner and outer digests are keyed once, when the context is
+ * created. Each digest then starts from a copy of the keyed state, which
+ * saves hashing the two padded key blocks per message.
+ */
 struct hmac {
-	uint8_t key[SHA_DIGEST_LENGTH];
-	size_t key_len;
+	SHA_CTX ictx;   /**< Inner digest state, after the key block */
+	SHA_CTX octx;   /**< Outer digest state, after the key block */
 };
 
 
@@ -24,9 +35,28 @@ static void destructor(void *arg)
 }
 
 
+static void key_pad(SHA_CTX *ctx, const uint8_t *key, size_t key_len,
+		    uint8_t pad)
+{
+	uint8_t buf[SHA_BLOCKSIZE];
+	size_t i;
+
+	for (i=0; i<key_len; i++)
+		buf[i] = key[i] ^ pad;
+	for (; i<SHA_BLOCKSIZE; i++)
+		buf[i] = pad;
+
+	SHA1_Init(ctx);
+	SHA1_Update(ctx, buf, sizeof(buf));
+
+	memset(buf, 0, sizeof(buf));
+}
+
+
 int hmac_create(struct hmac **hmacp, enum hmac_hash hash,
 		const uint8_t *key, size_t key_len)
 {
+	uint8_t khash[SHA_DIGEST_LENGTH];
 	struct hmac *hmac;
 
 	if (!hmacp || !key || !key_len)
@@ -35,15 +65,26 @@ int hmac_create(struct hmac **hmacp, enum hmac_hash hash,
 	if (hash != HMAC_HASH_SHA1)
 		return ENOTSUP;
 
-	if (key_len > SHA_DIGEST_LENGTH)
-		return EINVAL;
-
 	hmac = mem_zalloc(sizeof(*hmac), destructor);
 	if (!hmac)
 		return ENOMEM;
 
-	memcpy(hmac->key, key, key_len);
-	hmac->key_len = key_len;
+	/* Keys longer than the block size are hashed first */
+	if (key_len > SHA_BLOCKSIZE) {
+		SHA_CTX ctx;
+
+		SHA1_Init(&ctx);
+		SHA1_Update(&ctx, key, key_len);
+		SHA1_Final(khash, &ctx);
+
+		key     = khash;
+		key_len = sizeof(khash);
+	}
+
+	key_pad(&hmac->ictx, key, key_len, 0x36);
+	key_pad(&hmac->octx, key, key_len, 0x5c);
+
+	memset(khash, 0, sizeof(khash));
 
 	*hmacp = hmac;
 
@@ -54,10 +95,21 @@ int hmac_create(struct hmac **hmacp, enum hmac_hash hash,
 int hmac_digest(struct hmac *hmac, uint8_t *md, size_t md_len,
 		const uint8_t *data, size_t data_len)
 {
+	uint8_t digest[SHA_DIGEST_LENGTH];
+	SHA_CTX ctx;
+
 	if (!hmac || !md || !md_len || !data || !data_len)
 		return EINVAL;
 
-	hmac_sha1(hmac->key, hmac->key_len, data, data_len, md, md_len);
+	ctx = hmac->ictx;
+	SHA1_Update(&ctx, data, data_len);
+	SHA1_Final(digest, &ctx);
+
+	ctx = hmac->octx;
+	SHA1_Update(&ctx, digest, sizeof(digest));
+	SHA1_Final(digest, &ctx);
+
+	memcpy(md, digest, min(md_len, sizeof(digest)));
 
 	return 0;
 }
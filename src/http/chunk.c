@@ -7,6 +7,8 @@
 #include <re_types.h>
 #include <re_mem.h>
 #include <re_mbuf.h>
+#include <re_sa.h>
+#include <re_tcp.h>
 #include "http.h"
 
 
@@ -109,3 +111,46 @@ int http_chunk_decode(struct http_chunk *chunk, struct mbuf *mb, size_t *size)
 
 	return 0;
 }
+
+
+/*
+ * A chunk is sent as three slices, the size line, the data and the CRLF
+ * after it, so the data is not copied on a plain TCP connection. A length
+ * of zero sends the last chunk, without trailers.
+ */
+int http_chunk_send(struct tcp_conn *tc, const uint8_t *buf, size_t len)
+{
+	static const uint8_t crlf[] = "\r\n";
+	static const uint8_t last[] = "0\r\n\r\n";
+	static const char hex[] = "0123456789abcdef";
+	struct tcp_vec vv[3];
+	uint8_t line[2 * sizeof(size_t) + 2];
+	size_t i = sizeof(line), v = len;
+
+	if (!tc || (!buf && len))
+		return EINVAL;
+
+	if (!len) {
+		vv[0].p   = last;
+		vv[0].len = sizeof(last) - 1;
+
+		return tcp_sendv(tc, vv, 1);
+	}
+
+	line[--i] = '\n';
+	line[--i] = '\r';
+
+	do {
+		line[--i] = hex[v & 0xf];
+		v >>= 4;
+	} while (v);
+
+	vv[0].p   = line + i;
+	vv[0].len = sizeof(line) - i;
+	vv[1].p   = buf;
+	vv[1].len = len;
+	vv[2].p   = crlf;
+	vv[2].len = sizeof(crlf) - 1;
+
+	return tcp_sendv(tc, vv, 3);
+}
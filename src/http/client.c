@@ -8,6 +8,7 @@
 #include <re_types.h>
 #include <re_mem.h>
 #include <re_mbuf.h>
+#include <re_net.h>
 #include <re_sa.h>
 #include <re_list.h>
 #include <re_hash.h>
@@ -28,14 +29,30 @@ enum {
 	IDLE_TIMEOUT = 900000,
 	BUFSIZE_MAX  = 524288,
 	CONN_BSIZE   = 256,
+	POOL_BSIZE   = 64,
 };
 
 struct http_cli {
 	struct list reql;
 	struct hash *ht_conn;
+	struct hash *ht_pool;
 	struct dnsc *dnsc;
 	struct tls *tls;
 	char *tls_hostname;
+	struct http_conf conf;
+	struct http_cli_stat stat;
+};
+
+/** Connections to one host */
+struct pool {
+	struct le he;
+	struct list waitq;     /**< Requests waiting for a connection */
+	struct tmr tmr;
+	struct http_cli *cli;
+	char *host;
+	uint32_t nconn;        /**< Open and connecting connections   */
+	uint16_t port;
+	bool secure;
 };
 
 struct conn;
@@ -44,12 +61,18 @@ struct http_req {
 	struct http_chunk chunk;
 	struct sa srvv[16];
 	struct le le;
+	struct le qle;
 	struct http_req **reqp;
 	struct http_cli *cli;
+	struct pool *pool;
 	struct http_msg *msg;
 	struct dns_query *dq;
+	struct dns_query *dq6;
 	struct conn *conn;
+	struct conn *h2c;
+	struct h2_strm *strm;
 	struct mbuf *mbreq;
+	struct mbuf *mbtx;     /**< Body parts given before sending   */
 	struct mbuf *mb;
 	char *host;
 	http_resp_h *resph;
@@ -62,6 +85,11 @@ struct http_req {
 	bool chunked;
 	bool secure;
 	bool close;
+	bool refused;
+	bool txchunked;        /**< Body is sent with http_req_chunk() */
+	bool txsent;           /**< Request was sent                   */
+	bool txdirect;         /**< Body parts were sent after it      */
+	bool txend;            /**< Last body part was given           */
 };
 
 
@@ -70,16 +98,40 @@ struct conn {
 	struct sa addr;
 	struct le he;
 	struct http_req *req;
+	struct tcp_he *tcphe;
 	struct tls_conn *sc;
 	struct tcp_conn *tc;
+	struct pool *pool;
+	struct h2_sess *h2;
 	uint64_t usec;
+	bool idle;
+};
+
+struct conn_key {
+	const struct sa *addr;
+	bool secure;
 };
 
 
 static void req_close(struct http_req *req, int err,
 		      const struct http_msg *msg);
 static int req_connect(struct http_req *req);
+static void req_h2_release(struct http_req *req);
 static void timeout_handler(void *arg);
+static void pool_handler(void *arg);
+
+
+static const struct http_conf default_conf = {
+	CONN_TIMEOUT,
+	RECV_TIMEOUT,
+	IDLE_TIMEOUT,
+	0,
+	false,
+};
+
+#ifdef USE_TLS
+static const char *alpnv[] = {"h2", "http/1.1"};
+#endif
 
 
 static void cli_destructor(void *arg)
@@ -96,6 +148,7 @@ static void cli_destructor(void *arg)
 
 	hash_flush(cli->ht_conn);
 	mem_deref(cli->ht_conn);
+	mem_deref(cli->ht_pool);
 	mem_deref(cli->dnsc);
 	mem_deref(cli->tls);
 	mem_deref(cli->tls_hostname);
@@ -107,10 +160,21 @@ static void req_destructor(void *arg)
 	struct http_req *req = arg;
 
 	list_unlink(&req->le);
+
+	if (req->qle.list) {
+		list_unlink(&req->qle);
+		--req->cli->stat.queued;
+	}
+
+	mem_deref(req->pool);
 	mem_deref(req->msg);
 	mem_deref(req->dq);
+	mem_deref(req->dq6);
+	mem_deref(req->strm);
+	mem_deref(req->h2c);
 	mem_deref(req->conn);
 	mem_deref(req->mbreq);
+	mem_deref(req->mbtx);
 	mem_deref(req->mb);
 	mem_deref(req->host);
 }
@@ -122,15 +186,190 @@ static void conn_destructor(void *arg)
 
 	tmr_cancel(&conn->tmr);
 	hash_unlink(&conn->he);
+	mem_deref(conn->tcphe);
+	mem_deref(conn->h2);
 	mem_deref(conn->sc);
 	mem_deref(conn->tc);
+
+	if (conn->pool) {
+		struct pool *pool = conn->pool;
+
+		--pool->nconn;
+		--pool->cli->stat.conns;
+		if (conn->idle)
+			--pool->cli->stat.idle;
+
+		/* a waiting request may connect now */
+		if (pool->waitq.head)
+			tmr_start(&pool->tmr, 0, pool_handler, pool);
+
+		mem_deref(pool);
+	}
+}
+
+
+static void pool_destructor(void *arg)
+{
+	struct pool *pool = arg;
+
+	hash_unlink(&pool->he);
+	tmr_cancel(&pool->tmr);
+	mem_deref(pool->host);
+}
+
+
+static bool pool_cmp(struct le *le, void *arg)
+{
+	const struct pool *pool = le->data;
+	const struct http_req *req = arg;
+
+	return pool->port == req->port && pool->secure == req->secure &&
+		!str_casecmp(pool->host, req->host);
+}
+
+
+static int pool_get(struct http_req *req)
+{
+	const uint32_t key = hash_joaat_str_ci(req->host) ^ req->port;
+	struct http_cli *cli = req->cli;
+	struct pool *pool;
+	int err;
+
+	pool = list_ledata(hash_lookup(cli->ht_pool, key, pool_cmp, req));
+	if (pool) {
+		req->pool = mem_ref(pool);
+		return 0;
+	}
+
+	pool = mem_zalloc(sizeof(*pool), pool_destructor);
+	if (!pool)
+		return ENOMEM;
+
+	err = str_dup(&pool->host, req->host);
+	if (err) {
+		mem_deref(pool);
+		return err;
+	}
+
+	pool->cli    = cli;
+	pool->port   = req->port;
+	pool->secure = req->secure;
+
+	hash_append(cli->ht_pool, key, &pool->he, pool);
+
+	req->pool = pool;
+
+	return 0;
+}
+
+
+static bool pool_full(const struct pool *pool)
+{
+	const uint32_t max = pool->cli->conf.max_conn;
+
+	return max && pool->nconn >= max;
+}
+
+
+/* Connect the requests that are waiting, in order */
+static void pool_handler(void *arg)
+{
+	struct pool *pool = arg;
+
+	mem_ref(pool);
+
+	while (pool->waitq.head && !pool_full(pool)) {
+
+		struct http_req *req = pool->waitq.head->data;
+		int err;
+
+		list_unlink(&req->qle);
+		--pool->cli->stat.queued;
+
+		err = req_connect(req);
+		if (err)
+			req_close(req, err, NULL);
+	}
+
+	mem_deref(pool);
+}
+
+
+/* Send the request, with the body parts that were given so far */
+static int req_send(struct http_req *req, struct tcp_conn *tc)
+{
+	int err;
+
+	err = tcp_send(tc, req->mbreq);
+	if (err || !req->txchunked)
+		return err;
+
+	if (mbuf_get_left(req->mbtx))
+		err = http_chunk_send(tc, mbuf_buf(req->mbtx),
+				      mbuf_get_left(req->mbtx));
+	if (!err && req->txend)
+		err = http_chunk_send(tc, NULL, 0);
+
+	req->txsent = !err;
+
+	return err;
+}
+
+
+/* Send a request on a connection that was idle */
+static int conn_assign(struct conn *conn, struct http_req *req)
+{
+	int err;
+
+	err = req_send(req, conn->tc);
+	if (err)
+		return err;
+
+	tmr_start(&conn->tmr, req->cli->conf.recv_timeout, timeout_handler,
+		  conn);
+
+	req->conn = conn;
+	conn->req = req;
+
+	conn->idle = false;
+	--req->cli->stat.idle;
+	++req->cli->stat.reused;
+
+	++conn->usec;
+
+	return 0;
 }
 
 
 static void conn_idle(struct conn *conn)
 {
-	tmr_start(&conn->tmr, IDLE_TIMEOUT, timeout_handler, conn);
-	conn->req = NULL;
+	struct pool *pool = conn->pool;
+	struct http_cli *cli = pool->cli;
+	struct http_req *req;
+
+	conn->req  = NULL;
+	conn->idle = true;
+	++cli->stat.idle;
+
+	/* the first waiting request takes the connection */
+	req = list_ledata(pool->waitq.head);
+	if (req) {
+
+		list_unlink(&req->qle);
+		--cli->stat.queued;
+
+		if (!conn_assign(conn, req))
+			return;
+
+		/* the request waits for a new connection */
+		list_prepend(&pool->waitq, &req->qle, req);
+		++cli->stat.queued;
+
+		mem_deref(conn);
+		return;
+	}
+
+	tmr_start(&conn->tmr, cli->conf.idle_timeout, timeout_handler, conn);
 }
 
 
@@ -138,9 +377,18 @@ static void req_close(struct http_req *req, int err,
 		      const struct http_msg *msg)
 {
 	list_unlink(&req->le);
-	req->dq = mem_deref(req->dq);
+
+	if (req->qle.list) {
+		list_unlink(&req->qle);
+		--req->cli->stat.queued;
+	}
+
+	req->dq  = mem_deref(req->dq);
+	req->dq6 = mem_deref(req->dq6);
 	req->datah = NULL;
 
+	req_h2_release(req);
+
 	if (req->conn) {
 		if (req->connh)
 			req->connh(req->conn->tc, req->conn->sc, req->arg);
@@ -172,11 +420,19 @@ static void req_close(struct http_req *req, int err,
 }
 
 
+
 static void try_next(struct conn *conn, int err)
 {
 	struct http_req *req = conn->req;
 	bool retry = conn->usec > 1;
 
+	/* the requests on the connection are closed with it */
+	if (conn->h2) {
+		h2_sess_close(conn->h2, err);
+		mem_deref(conn);
+		return;
+	}
+
 	mem_deref(conn);
 
 	if (!req)
@@ -184,10 +440,10 @@ static void try_next(struct conn *conn, int err)
 
 	req->conn = NULL;
 
-	if (retry)
-		++req->srvc;
+	/* an idle connection was closed by the server, connect again */
+	if (retry && !req->msg && !req->txdirect) {
 
-	if (req->srvc > 0 && !req->msg) {
+		req->txsent = false;
 
 		err = req_connect(req);
 		if (!err)
@@ -280,6 +536,207 @@ static void timeout_handler(void *arg)
 }
 
 
+static void conn_h2_tmr(struct conn *conn)
+{
+	const struct http_conf *conf = &conn->pool->cli->conf;
+
+	if (h2_sess_nstrm(conn->h2))
+		tmr_start(&conn->tmr, conf->recv_timeout, timeout_handler,
+			  conn);
+	else
+		tmr_start(&conn->tmr, conf->idle_timeout, timeout_handler,
+			  conn);
+}
+
+
+/* Release the stream of a request on an HTTP/2 connection */
+static void req_h2_release(struct http_req *req)
+{
+	struct conn *conn = req->h2c;
+
+	req->strm = mem_deref(req->strm);
+	req->h2c  = NULL;
+
+	if (!conn)
+		return;
+
+	if (conn->h2)
+		conn_h2_tmr(conn);
+
+	mem_deref(conn);
+}
+
+
+static void h2_head_handler(struct mbuf *mb, bool end, void *arg)
+{
+	struct http_req *req = arg;
+	int err = 0;
+
+	/* trailers are ignored */
+	if (!req->msg) {
+		err = http_msg_decode(&req->msg, mb, false);
+		if (err)
+			goto out;
+	}
+
+	if (!end)
+		return;
+
+ out:
+	req_close(req, err, req->msg);
+}
+
+
+static void h2_data_handler(const uint8_t *buf, size_t len, bool end,
+			    void *arg)
+{
+	struct http_req *req = arg;
+	int err = 0;
+
+	if (len) {
+		if (req->datah)
+			err = req->datah(buf, len, req->msg, req->arg);
+		else
+			err = write_body_buf(req->msg, buf, len);
+
+		if (err)
+			goto out;
+	}
+
+	if (!end)
+		return;
+
+ out:
+	req_close(req, err, req->msg);
+}
+
+
+static void h2_close_handler(int err, void *arg)
+{
+	struct http_req *req = arg;
+
+	/* not processed by the server, send it once more */
+	if (err == ECONNREFUSED && !req->msg && !req->refused) {
+
+		req->refused = true;
+		req_h2_release(req);
+
+		err = req_connect(req);
+		if (!err)
+			return;
+	}
+
+	req_close(req, err ? err : ECONNRESET, NULL);
+}
+
+
+/* Send a request as a new stream on an HTTP/2 connection */
+static int h2_assign(struct conn *conn, struct http_req *req)
+{
+	int err;
+
+	err = h2_strm_alloc(&req->strm, conn->h2);
+	if (err)
+		return err;
+
+	h2_strm_set_handlers(req->strm, h2_head_handler, h2_data_handler,
+			     NULL, h2_close_handler, req);
+
+	err = h2_strm_send_msg(req->strm, req->mbreq, !req->txchunked ||
+			       (req->txend && !mbuf_get_left(req->mbtx)));
+	if (!err && mbuf_get_left(req->mbtx))
+		err = h2_strm_send_data(req->strm, mbuf_buf(req->mbtx),
+					mbuf_get_left(req->mbtx), req->txend);
+	if (err) {
+		req->strm = mem_deref(req->strm);
+		return err;
+	}
+
+	req->txsent = true;
+
+	req->h2c = mem_ref(conn);
+	conn_h2_tmr(conn);
+
+	return 0;
+}
+
+
+static bool conn_alpn_h2(const struct conn *conn)
+{
+#ifdef USE_TLS
+	struct pl proto;
+
+	if (!conn->sc || tls_alpn_get(conn->sc, &proto))
+		return false;
+
+	return 0 == pl_strcmp(&proto, "h2");
+#else
+	(void)conn;
+
+	return false;
+#endif
+}
+
+
+/* The server selected HTTP/2, the connection is shared from now on */
+static int conn_h2_start(struct conn *conn)
+{
+	struct http_req *req = conn->req;
+	struct pool *pool = conn->pool;
+	struct http_cli *cli = pool->cli;
+	int err;
+
+	err = h2_sess_alloc(&conn->h2, conn->tc, true, false, NULL, conn);
+	if (err)
+		return err;
+
+	conn->req = NULL;
+	req->conn = NULL;
+
+	err = h2_assign(conn, req);
+	if (err)
+		req_close(req, err, NULL);
+
+	while (pool->waitq.head && h2_sess_avail(conn->h2)) {
+
+		req = pool->waitq.head->data;
+
+		list_unlink(&req->qle);
+		--cli->stat.queued;
+
+		err = h2_assign(conn, req);
+		if (err)
+			req_close(req, err, NULL);
+		else
+			++cli->stat.reused;
+	}
+
+	conn_h2_tmr(conn);
+
+	return 0;
+}
+
+
+static void conn_h2_recv(struct conn *conn, struct mbuf *mb)
+{
+	int err;
+
+	mem_ref(conn);
+
+	err = h2_sess_recv(conn->h2, mb);
+
+	/* the connection may be released from a response handler */
+	if (mem_nrefs(conn) == 1)
+		;
+	else if (err)
+		try_next(conn, err);
+	else
+		conn_h2_tmr(conn);
+
+	mem_deref(conn);
+}
+
+
 static void estab_handler(void *arg)
 {
 	struct conn *conn = arg;
@@ -289,13 +746,21 @@ static void estab_handler(void *arg)
 	if (!req)
 		return;
 
-	err = tcp_send(conn->tc, req->mbreq);
+	if (conn_alpn_h2(conn)) {
+		err = conn_h2_start(conn);
+		if (err)
+			try_next(conn, err);
+		return;
+	}
+
+	err = req_send(req, conn->tc);
 	if (err) {
 		try_next(conn, err);
 		return;
 	}
 
-	tmr_start(&conn->tmr, RECV_TIMEOUT, timeout_handler, conn);
+	tmr_start(&conn->tmr, req->cli->conf.recv_timeout, timeout_handler,
+		  conn);
 }
 
 
@@ -308,6 +773,11 @@ static void recv_handler(struct mbuf *mb, void *arg)
 	bool last;
 	int err;
 
+	if (conn->h2) {
+		conn_h2_recv(conn, mb);
+		return;
+	}
+
 	if (!req)
 		return;
 
@@ -387,106 +857,170 @@ static void close_handler(int err, void *arg)
 static bool conn_cmp(struct le *le, void *arg)
 {
 	const struct conn *conn = le->data;
-	const struct http_req *req = arg;
+	const struct conn_key *key = arg;
 
-	if (!sa_cmp(&req->srvv[req->srvc], &conn->addr, SA_ALL))
+	if (!sa_cmp(key->addr, &conn->addr, SA_ALL))
 		return false;
 
-	if (req->secure != !!conn->sc)
+	if (key->secure != !!conn->sc)
 		return false;
 
+	if (conn->h2)
+		return h2_sess_avail(conn->h2);
+
 	return conn->req == NULL;
 }
 
 
-static int conn_connect(struct http_req *req)
+static int conn_reuse(struct http_req *req, const struct sa *addr)
 {
-	const struct sa *addr = &req->srvv[req->srvc];
+	struct conn_key key;
 	struct conn *conn;
 	int err;
 
-	conn = list_ledata(hash_lookup(req->cli->ht_conn,
-				       sa_hash(addr, SA_ALL), conn_cmp, req));
-	if (conn) {
-		err = tcp_send(conn->tc, req->mbreq);
-		if (!err) {
-			tmr_start(&conn->tmr, RECV_TIMEOUT,
-				  timeout_handler, conn);
+	key.addr   = addr;
+	key.secure = req->secure;
 
-			req->conn = conn;
-			conn->req = req;
+	conn = list_ledata(hash_lookup(req->cli->ht_conn,
+				       sa_hash(addr, SA_ALL), conn_cmp, &key));
+	if (!conn)
+		return ENOENT;
 
-			++conn->usec;
+	if (conn->h2) {
+		err = h2_assign(conn, req);
+		if (!err)
+			++req->cli->stat.reused;
 
-			return 0;
-		}
+		return err;
+	}
 
+	err = conn_assign(conn, req);
+	if (err)
 		mem_deref(conn);
-	}
 
-	conn = mem_zalloc(sizeof(*conn), conn_destructor);
-	if (!conn)
-		return ENOMEM;
+	return err;
+}
 
-	hash_append(req->cli->ht_conn, sa_hash(addr, SA_ALL), &conn->he, conn);
 
-	conn->addr = *addr;
-	conn->usec = 1;
+static int he_prep_handler(void **ctxp, struct tcp_conn *tc,
+			   const struct sa *peer, void *arg)
+{
+#ifdef USE_TLS
+	struct conn *conn = arg;
+	struct http_req *req = conn->req;
+	struct tls_conn *sc;
+	int err;
+	(void)peer;
 
-	err = tcp_connect(&conn->tc, addr, estab_handler, recv_handler,
-			  close_handler, conn);
+	if (!req->secure)
+		return 0;
+
+	err = tls_start_tcp(&sc, req->cli->tls, tc, 0);
 	if (err)
-		goto out;
+		return err;
 
-#ifdef USE_TLS
-	if (req->secure) {
+	if (req->cli->tls_hostname)
+		err = tls_peer_set_verify_host(sc, req->cli->tls_hostname);
 
-		err = tls_start_tcp(&conn->sc, req->cli->tls, conn->tc, 0);
-		if (err)
-			goto out;
+	if (!err)
+		err = tls_set_servername(sc, req->host);
 
-		if (req->cli->tls_hostname)
-			err = tls_peer_set_verify_host(conn->sc,
-				req->cli->tls_hostname);
+	if (err)
+		mem_deref(sc);
+	else
+		*ctxp = sc;
 
-		if (err)
-			goto out;
+	return err;
+#else
+	(void)ctxp;
+	(void)tc;
+	(void)peer;
+	(void)arg;
 
-		err = tls_set_servername(conn->sc, req->host);
-		if (err)
-			goto out;
-	}
+	return 0;
 #endif
+}
 
-	tmr_start(&conn->tmr, CONN_TIMEOUT, timeout_handler, conn);
 
-	req->conn = conn;
-	conn->req = req;
+static void he_handler(int err, struct tcp_conn *tc, void *ctx,
+		       const struct sa *peer, void *arg)
+{
+	struct conn *conn = arg;
 
- out:
-	if (err)
+	conn->tcphe = mem_deref(conn->tcphe);
+
+	if (err) {
+		try_next(conn, err);
+		return;
+	}
+
+	conn->tc   = tc;
+	conn->sc   = ctx;
+	conn->addr = *peer;
+
+	hash_append(conn->req->cli->ht_conn, sa_hash(peer, SA_ALL),
+		    &conn->he, conn);
+
+	tcp_set_handlers(tc, estab_handler, recv_handler, close_handler,
+			 conn);
+
+	estab_handler(conn);
+}
+
+
+/* Race new connections to all addresses (Happy Eyeballs) */
+static int conn_connect(struct http_req *req)
+{
+	struct conn *conn;
+	int err;
+
+	conn = mem_zalloc(sizeof(*conn), conn_destructor);
+	if (!conn)
+		return ENOMEM;
+
+	conn->usec = 1;
+	conn->req  = req;
+	conn->pool = mem_ref(req->pool);
+
+	++conn->pool->nconn;
+	++req->cli->stat.conns;
+	++req->cli->stat.connects;
+
+	err = tcp_he_connect(&conn->tcphe, req->srvv, req->srvc,
+			     he_prep_handler, he_handler, conn);
+	if (err) {
 		mem_deref(conn);
+		return err;
+	}
 
-	return err;
+	tmr_start(&conn->tmr, req->cli->conf.conn_timeout, timeout_handler,
+		  conn);
+
+	req->conn = conn;
+
+	return 0;
 }
 
 
 static int req_connect(struct http_req *req)
 {
-	int err = EINVAL;
+	unsigned i;
 
-	while (req->srvc > 0) {
+	req->mb = mem_deref(req->mb);
 
-		--req->srvc;
+	for (i=0; i<req->srvc; i++) {
 
-		req->mb = mem_deref(req->mb);
+		if (!conn_reuse(req, &req->srvv[i]))
+			return 0;
+	}
 
-		err = conn_connect(req);
-		if (!err)
-			break;
+	if (pool_full(req->pool)) {
+		list_append(&req->pool->waitq, &req->qle, req);
+		++req->cli->stat.queued;
+		return 0;
 	}
 
-	return err;
+	return conn_connect(req);
 }
 
 
@@ -524,6 +1058,11 @@ static void query_handler(int err, const struct dnshdr *hdr, struct list *ansl,
 
 	dns_rrlist_apply2(ansl, req->host, DNS_TYPE_A, DNS_TYPE_AAAA,
 			  DNS_CLASS_IN, true, rr_handler, req);
+
+	/* wait for other (A/AAAA) query to complete */
+	if (req->dq || req->dq6)
+		return;
+
 	if (req->srvc == 0) {
 		err = err ? err : EDESTADDRREQ;
 		goto fail;
@@ -604,6 +1143,10 @@ int http_request(struct http_req **reqp, struct http_cli *cli, const char *met,
 	if (err)
 		goto out;
 
+	err = pool_get(req);
+	if (err)
+		goto out;
+
 	req->mbreq = mbuf_alloc(1024);
 	if (!req->mbreq) {
 		err = ENOMEM;
@@ -627,6 +1170,20 @@ int http_request(struct http_req **reqp, struct http_cli *cli, const char *met,
 
 	req->mbreq->pos = 0;
 
+	if (fmt) {
+		struct http_msg *msg;
+
+		err = http_msg_decode(&msg, req->mbreq, true);
+		if (err)
+			goto out;
+
+		req->txchunked = http_msg_hdr_has_value(msg,
+						HTTP_HDR_TRANSFER_ENCODING,
+						"chunked");
+		req->mbreq->pos = 0;
+		mem_deref(msg);
+	}
+
 	if (!sa_set_str(&req->srvv[0], req->host, req->port)) {
 
 		req->srvc = 1;
@@ -636,11 +1193,26 @@ int http_request(struct http_req **reqp, struct http_cli *cli, const char *met,
 			goto out;
 	}
 	else {
+#ifdef HAVE_INET6
+		struct sa tmp;
+#endif
+
 		err = dnsc_query(&req->dq, cli->dnsc, req->host,
 				 DNS_TYPE_A, DNS_CLASS_IN, true,
 				 query_handler, req);
 		if (err)
 			goto out;
+
+#ifdef HAVE_INET6
+		if (0 == net_default_source_addr_get(AF_INET6, &tmp)) {
+
+			err = dnsc_query(&req->dq6, cli->dnsc, req->host,
+					 DNS_TYPE_AAAA, DNS_CLASS_IN, true,
+					 query_handler, req);
+			if (err)
+				goto out;
+		}
+#endif
 	}
 
  out:
@@ -656,7 +1228,60 @@ int http_request(struct http_req **reqp, struct http_cli *cli, const char *met,
 
 
 /**
- * Set HTTP request connection handler
+ * Send a part of the body of a request that has a Transfer-Encoding:
+ * chunked header. The parts that are given before the request is sent
+ * are sent with it. The body is ended with a part of length zero. On
+ * HTTP/2 the parts are sent as DATA frames, without chunked encoding.
+ *
+ * @param req HTTP request object
+ * @param buf Data to send
+ * @param len Length of data, 0 to end the body
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int http_req_chunk(struct http_req *req, const uint8_t *buf, size_t len)
+{
+	int err;
+
+	if (!req || (!buf && len))
+		return EINVAL;
+
+	if (!req->txchunked || req->txend)
+		return EPROTO;
+
+	if (!len)
+		req->txend = true;
+
+	if (!req->txsent) {
+
+		if (!len)
+			return 0;
+
+		if (!req->mbtx) {
+			req->mbtx = mbuf_alloc(len);
+			if (!req->mbtx)
+				return ENOMEM;
+		}
+
+		return mbuf_write_mem(req->mbtx, buf, len);
+	}
+
+	req->txdirect = true;
+
+	if (req->strm)
+		err = h2_strm_send_data(req->strm, buf, len, !len);
+	else if (req->conn && req->conn->tc)
+		err = http_chunk_send(req->conn->tc, buf, len);
+	else
+		err = ENOTCONN;
+
+	return err;
+}
+
+
+/**
+ * Set HTTP request connection handler. The handler is only called for
+ * HTTP/1.1 connections, as HTTP/2 connections are shared by the requests.
  *
  * @param req   HTTP request object
  * @param connh Connection handler
@@ -670,6 +1295,51 @@ void http_req_set_conn_handler(struct http_req *req, http_conn_h *connh)
 }
 
 
+/**
+ * Set the configuration of an HTTP client. A request to a host that has
+ * max_conn connections waits for one of them, in the order of the
+ * requests.
+ *
+ * @param cli  HTTP client
+ * @param conf Configuration, or NULL for the defaults
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int http_client_set_config(struct http_cli *cli, const struct http_conf *conf)
+{
+	if (!cli)
+		return EINVAL;
+
+	cli->conf = conf ? *conf : default_conf;
+
+#ifdef USE_TLS
+	return tls_set_alpn(cli->tls, alpnv,
+			    cli->conf.http2 ? ARRAY_SIZE(alpnv) : 0);
+#else
+	return 0;
+#endif
+}
+
+
+/**
+ * Get the connection statistics of an HTTP client
+ *
+ * @param cli  HTTP client
+ * @param stat Returned statistics
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int http_client_stats(const struct http_cli *cli, struct http_cli_stat *stat)
+{
+	if (!cli || !stat)
+		return EINVAL;
+
+	*stat = cli->stat;
+
+	return 0;
+}
+
+
 /**
  * Allocate an HTTP client instance
  *
@@ -694,6 +1364,12 @@ int http_client_alloc(struct http_cli **clip, struct dnsc *dnsc)
 	if (err)
 		goto out;
 
+	err = hash_alloc(&cli->ht_pool, POOL_BSIZE);
+	if (err)
+		goto out;
+
+	cli->conf = default_conf;
+
 #ifdef USE_TLS
 	err = tls_alloc(&cli->tls, TLS_METHOD_SSLV23, NULL, NULL);
 	if (err)
@@ -0,0 +1,1777 @@
+/**
+ * @file http/h2.c  HTTP/2 Framing and Streams (RFC 9113)
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re_types.h>
+#include <re_mem.h>
+#include <re_mbuf.h>
+#include <re_sa.h>
+#include <re_list.h>
+#include <re_fmt.h>
+#include <re_tmr.h>
+#include <re_tcp.h>
+#include <re_msg.h>
+#include <re_http.h>
+#include "http.h"
+
+
+#define DEBUG_MODULE "h2"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+/*
+ * A session runs HTTP/2 on one TCP connection, for the client or for the
+ * server. The header blocks of a stream are given to the owner of the
+ * stream as an HTTP/1.1 style message head, so that they are decoded with
+ * http_msg_decode(), and the messages to send are given in the same form.
+ *
+ * Data is sent as the flow control windows of the peer allow, and the
+ * rest is kept in the stream until the peer opens the window. Received
+ * data is given to the owner at once, so the receive windows are opened
+ * again as the data arrives.
+ *
+ * The session only links the streams, the owner of a stream holds the
+ * reference to it. A stream that is released before it was closed is
+ * reset.
+ */
+
+
+enum {
+	H2_HDR_SIZE   = 9,
+	H2_FRAME_MAX  = 16384,       /**< Maximum frame size we receive  */
+	H2_WINDOW     = 1048576,     /**< Our receive windows [bytes]    */
+	H2_WINDOW_DEF = 65535,       /**< Initial window size [bytes]    */
+	H2_WINDOW_MAX = 0x7fffffff,
+	H2_STREAMS    = 100,         /**< Concurrent streams we accept   */
+	H2_HDRS_MAX   = 65536,       /**< Maximum header block [bytes]   */
+};
+
+/** Frame types */
+enum h2_type {
+	H2_DATA          = 0x0,
+	H2_HEADERS       = 0x1,
+	H2_PRIORITY      = 0x2,
+	H2_RST_STREAM    = 0x3,
+	H2_SETTINGS      = 0x4,
+	H2_PUSH_PROMISE  = 0x5,
+	H2_PING          = 0x6,
+	H2_GOAWAY        = 0x7,
+	H2_WINDOW_UPDATE = 0x8,
+	H2_CONTINUATION  = 0x9,
+};
+
+/** Frame flags */
+enum {
+	H2_END_STREAM  = 0x01,
+	H2_ACK         = 0x01,
+	H2_END_HEADERS = 0x04,
+	H2_PADDED      = 0x08,
+	H2_PRIO        = 0x20,
+};
+
+/** Error codes */
+enum h2_error {
+	H2_NO_ERROR           = 0x0,
+	H2_PROTOCOL_ERROR     = 0x1,
+	H2_INTERNAL_ERROR     = 0x2,
+	H2_FLOW_CONTROL_ERROR = 0x3,
+	H2_STREAM_CLOSED      = 0x5,
+	H2_FRAME_SIZE_ERROR   = 0x6,
+	H2_REFUSED_STREAM     = 0x7,
+	H2_CANCEL             = 0x8,
+	H2_COMPRESSION_ERROR  = 0x9,
+};
+
+/** Settings */
+enum {
+	H2_SET_ENABLE_PUSH            = 0x2,
+	H2_SET_MAX_CONCURRENT_STREAMS = 0x3,
+	H2_SET_INITIAL_WINDOW_SIZE    = 0x4,
+	H2_SET_MAX_FRAME_SIZE         = 0x5,
+};
+
+/** Pseudo-header fields */
+enum {
+	PS_METHOD,
+	PS_SCHEME,
+	PS_AUTHORITY,
+	PS_PATH,
+	PS_STATUS,
+	PS_NUM
+};
+
+/** Defines an HTTP/2 session */
+struct h2_sess {
+	struct list strml;       /**< Open streams                       */
+	struct tmr tmr;          /**< Closes the streams that are done   */
+	struct hpack *hpack;     /**< Header decoder                     */
+	struct mbuf *rxb;        /**< Received data not yet handled      */
+	struct mbuf *hb;         /**< Header block being received        */
+	struct tcp_conn *tc;     /**< TCP connection, not referenced     */
+	h2_strm_h *strmh;        /**< New stream handler (server)        */
+	void *arg;               /**< Handler argument                   */
+	int64_t swin;            /**< Connection send window             */
+	int64_t rwin;            /**< Connection receive window          */
+	uint32_t strm_win;       /**< Initial stream window of the peer  */
+	uint32_t frame_max;      /**< Maximum frame size of the peer     */
+	uint32_t strm_max;       /**< Concurrent streams of the peer     */
+	uint32_t nstrm;          /**< Number of open streams             */
+	uint32_t next_id;        /**< Next stream identifier (client)    */
+	uint32_t last_id;        /**< Last stream of the peer (server)   */
+	uint32_t hb_id;          /**< Stream of the header block         */
+	bool hb_end;             /**< Header block ends the stream       */
+	bool preface;            /**< Connection preface was received    */
+	bool goaway;             /**< No new streams                     */
+	bool closed;             /**< Session is closed                  */
+	bool secure;             /**< Runs on TLS                        */
+	bool server;             /**< Server side of the connection      */
+};
+
+/** Defines an HTTP/2 stream */
+struct h2_strm {
+	struct le le;
+	struct h2_sess *sess;    /**< Session, NULL when closed          */
+	struct mbuf *txb;        /**< Data waiting for the send window   */
+	h2_head_h *headh;
+	h2_data_h *datah;
+	h2_send_h *sendh;
+	h2_close_h *closeh;
+	void *arg;
+	int64_t swin;            /**< Stream send window                 */
+	int64_t rwin;            /**< Stream receive window              */
+	uint32_t id;             /**< Stream identifier                  */
+	uint32_t rcode;          /**< Error code if it is reset          */
+	bool open;               /**< Known to the peer                  */
+	bool hsent;              /**< Header block was sent              */
+	bool head;               /**< Final header block was received    */
+	bool lend;               /**< End of stream is to be sent        */
+	bool lsent;              /**< End of stream was sent             */
+	bool rend;               /**< End of stream was received         */
+	bool wake;               /**< Send window was opened or done     */
+};
+
+/** Header block being decoded */
+struct hdr_ctx {
+	struct mbuf *hmb;        /**< Header fields as text              */
+	struct mbuf *pmb;        /**< Values of pseudo-header fields     */
+	size_t offv[PS_NUM];
+	size_t lenv[PS_NUM];
+	bool setv[PS_NUM];
+	bool host;               /**< Host header field was seen         */
+	bool regular;            /**< Regular header field was seen      */
+};
+
+
+static const char *pseudov[PS_NUM] = {
+	":method", ":scheme", ":authority", ":path", ":status"
+};
+
+
+static inline uint32_t get_u32(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+		(uint32_t)p[2] << 8 | p[3];
+}
+
+
+static inline void put_u32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+
+static void strm_close(struct h2_strm *strm, int err);
+
+
+static void sess_destructor(void *arg)
+{
+	struct h2_sess *sess = arg;
+	struct le *le;
+
+	while ((le = sess->strml.head)) {
+
+		struct h2_strm *strm = le->data;
+
+		list_unlink(&strm->le);
+		strm->sess = NULL;
+	}
+
+	tmr_cancel(&sess->tmr);
+	mem_deref(sess->hpack);
+	mem_deref(sess->rxb);
+	mem_deref(sess->hb);
+}
+
+
+static int frame_hdr(struct mbuf *mb, uint8_t type, uint8_t flags,
+		     uint32_t id, size_t len)
+{
+	uint8_t hdr[H2_HDR_SIZE];
+
+	hdr[0] = (uint8_t)(len >> 16);
+	hdr[1] = (uint8_t)(len >> 8);
+	hdr[2] = (uint8_t)len;
+	hdr[3] = type;
+	hdr[4] = flags;
+	put_u32(&hdr[5], id & 0x7fffffff);
+
+	return mbuf_write_mem(mb, hdr, sizeof(hdr));
+}
+
+
+static int frame_send(struct h2_sess *sess, uint8_t type, uint8_t flags,
+		      uint32_t id, const uint8_t *p, size_t len)
+{
+	struct mbuf *mb;
+	int err;
+
+	if (!sess->tc)
+		return ENOTCONN;
+
+	mb = mbuf_alloc(H2_HDR_SIZE + len);
+	if (!mb)
+		return ENOMEM;
+
+	err = frame_hdr(mb, type, flags, id, len);
+	if (len)
+		err |= mbuf_write_mem(mb, p, len);
+	if (err)
+		goto out;
+
+	mb->pos = 0;
+
+	err = tcp_send(sess->tc, mb);
+
+ out:
+	mem_deref(mb);
+
+	return err;
+}
+
+
+static int u32_send(struct h2_sess *sess, uint8_t type, uint32_t id,
+		    uint32_t v)
+{
+	uint8_t p[4];
+
+	put_u32(p, v);
+
+	return frame_send(sess, type, 0, id, p, sizeof(p));
+}
+
+
+static int goaway_send(struct h2_sess *sess, enum h2_error code)
+{
+	uint8_t p[8];
+
+	put_u32(&p[0], sess->last_id);
+	put_u32(&p[4], code);
+
+	return frame_send(sess, H2_GOAWAY, 0, 0, p, sizeof(p));
+}
+
+
+static int conn_error(struct h2_sess *sess, enum h2_error code)
+{
+	DEBUG_INFO("connection error 0x%x\n", code);
+
+	(void)goaway_send(sess, code);
+	sess->goaway = true;
+
+	return EPROTO;
+}
+
+
+static void strm_destructor(void *arg)
+{
+	struct h2_strm *strm = arg;
+	struct h2_sess *sess = strm->sess;
+
+	if (sess) {
+		if (strm->open && !(strm->lsent && strm->rend))
+			(void)u32_send(sess, H2_RST_STREAM, strm->id,
+				       strm->rcode);
+
+		list_unlink(&strm->le);
+		--sess->nstrm;
+	}
+
+	mem_deref(strm->txb);
+}
+
+
+static int strm_new(struct h2_strm **strmp, struct h2_sess *sess,
+		    uint32_t id)
+{
+	struct h2_strm *strm;
+
+	strm = mem_zalloc(sizeof(*strm), strm_destructor);
+	if (!strm)
+		return ENOMEM;
+
+	strm->sess  = sess;
+	strm->id    = id;
+	strm->swin  = sess->strm_win;
+	strm->rwin  = H2_WINDOW;
+	strm->rcode = H2_CANCEL;
+
+	list_append(&sess->strml, &strm->le, strm);
+	++sess->nstrm;
+
+	*strmp = strm;
+
+	return 0;
+}
+
+
+static struct h2_strm *strm_find(const struct h2_sess *sess, uint32_t id)
+{
+	struct le *le;
+
+	for (le = sess->strml.head; le; le = le->next) {
+
+		struct h2_strm *strm = le->data;
+
+		if (strm->id == id)
+			return strm;
+	}
+
+	return NULL;
+}
+
+
+/* The close handler may release the stream */
+static void strm_close(struct h2_strm *strm, int err)
+{
+	struct h2_sess *sess = strm->sess;
+	h2_close_h *closeh = strm->closeh;
+
+	if (!sess)
+		return;
+
+	list_unlink(&strm->le);
+	--sess->nstrm;
+
+	strm->sess   = NULL;
+	strm->headh  = NULL;
+	strm->datah  = NULL;
+	strm->sendh  = NULL;
+	strm->closeh = NULL;
+
+	if (closeh)
+		closeh(err, strm->arg);
+}
+
+
+static void strm_reset(struct h2_strm *strm, enum h2_error code, int err)
+{
+	(void)u32_send(strm->sess, H2_RST_STREAM, strm->id, code);
+
+	strm->open = false;
+	strm_close(strm, err);
+}
+
+
+static void strm_done(struct h2_strm *strm)
+{
+	if (strm->sess && strm->lsent && strm->rend)
+		strm_close(strm, 0);
+}
+
+
+/*
+ * The handlers are called with a reference, and false is returned if the
+ * owner released or closed the stream in the handler.
+ */
+static bool strm_head(struct h2_strm *strm, struct mbuf *mb, bool end)
+{
+	bool alive;
+
+	if (!strm->headh)
+		return true;
+
+	mem_ref(strm);
+	strm->headh(mb, end, strm->arg);
+	alive = mem_nrefs(strm) > 1 && strm->sess;
+	mem_deref(strm);
+
+	return alive;
+}
+
+
+static bool strm_data(struct h2_strm *strm, const uint8_t *buf, size_t len,
+		      bool end)
+{
+	bool alive;
+
+	if (!strm->datah)
+		return true;
+
+	mem_ref(strm);
+	strm->datah(buf, len, end, strm->arg);
+	alive = mem_nrefs(strm) > 1 && strm->sess;
+	mem_deref(strm);
+
+	return alive;
+}
+
+
+static bool strm_send(struct h2_strm *strm)
+{
+	bool alive;
+
+	if (!strm->sendh)
+		return true;
+
+	mem_ref(strm);
+	strm->sendh(strm->arg);
+	alive = mem_nrefs(strm) > 1 && strm->sess;
+	mem_deref(strm);
+
+	return alive;
+}
+
+
+/* Send the data that the windows allow */
+static int strm_flush(struct h2_strm *strm)
+{
+	struct h2_sess *sess = strm->sess;
+	int err = 0;
+
+	while (sess && strm->open && !strm->lsent) {
+
+		const size_t left = h2_strm_txlen(strm);
+		size_t n = min(left, (size_t)sess->frame_max);
+		const int64_t win = min(strm->swin, sess->swin);
+		bool fin;
+
+		if (!left && !strm->lend)
+			break;
+
+		if (left && win <= 0)
+			break;
+
+		n = min(n, (size_t)max(win, 0));
+		fin = strm->lend && n == left;
+
+		err = frame_send(sess, H2_DATA, fin ? H2_END_STREAM : 0,
+				 strm->id, n ? mbuf_buf(strm->txb) : NULL, n);
+		if (err)
+			break;
+
+		if (n) {
+			strm->txb->pos += n;
+			strm->swin     -= (int64_t)n;
+			sess->swin     -= (int64_t)n;
+		}
+
+		if (fin)
+			strm->lsent = true;
+	}
+
+	if (strm->txb && !mbuf_get_left(strm->txb))
+		mbuf_rewind(strm->txb);
+
+	return err;
+}
+
+
+/* Send on all streams, wake the streams that sent all their data */
+static int sess_flush(struct h2_sess *sess)
+{
+	struct le *le;
+
+	for (le = sess->strml.head; le; le = le->next) {
+
+		struct h2_strm *strm = le->data;
+		const bool pending = h2_strm_txlen(strm) > 0;
+		int err;
+
+		err = strm_flush(strm);
+		if (err)
+			return err;
+
+		if (pending && !h2_strm_txlen(strm))
+			strm->wake = true;
+	}
+
+	return 0;
+}
+
+
+/* Ask for more data, or close the streams that are done */
+static void sess_wake(struct h2_sess *sess)
+{
+	for (;;) {
+
+		struct h2_strm *strm = NULL;
+		struct le *le;
+
+		for (le = sess->strml.head; le; le = le->next) {
+
+			struct h2_strm *s = le->data;
+
+			if (s->wake) {
+				strm = s;
+				break;
+			}
+		}
+
+		if (!strm)
+			break;
+
+		strm->wake = false;
+
+		if (!strm->lsent && !h2_strm_txlen(strm) && !strm_send(strm))
+			continue;
+
+		strm_done(strm);
+	}
+}
+
+
+static void tmr_handler(void *arg)
+{
+	struct h2_sess *sess = arg;
+
+	mem_ref(sess);
+	sess_wake(sess);
+	mem_deref(sess);
+}
+
+
+/* Called after the owner sent on a stream */
+static void strm_sent(struct h2_strm *strm)
+{
+	if (!strm->lsent || !strm->rend)
+		return;
+
+	strm->wake = true;
+	tmr_start(&strm->sess->tmr, 0, tmr_handler, strm->sess);
+}
+
+
+static int pad_strip(const uint8_t **pp, size_t *lenp, uint8_t flags)
+{
+	size_t pad;
+
+	if (!(flags & H2_PADDED))
+		return 0;
+
+	if (!*lenp)
+		return EBADMSG;
+
+	pad = (*pp)[0];
+	++*pp;
+	--*lenp;
+
+	if (pad > *lenp)
+		return EBADMSG;
+
+	*lenp -= pad;
+
+	return 0;
+}
+
+
+static bool field_valid(const struct pl *pl)
+{
+	size_t i;
+
+	for (i=0; i<pl->l; i++) {
+
+		switch (pl->p[i]) {
+
+		case '\0':
+		case '\r':
+		case '\n':
+			return false;
+
+		default:
+			break;
+		}
+	}
+
+	return true;
+}
+
+
+static int hdr_handler(const struct pl *name, const struct pl *val,
+		       void *arg)
+{
+	struct hdr_ctx *ctx = arg;
+	int i;
+
+	if (!name->l || !field_valid(name) || !field_valid(val))
+		return EPROTO;
+
+	if (name->p[0] == ':') {
+
+		if (ctx->regular)
+			return EPROTO;
+
+		for (i=0; i<PS_NUM; i++) {
+			if (!pl_strcmp(name, pseudov[i]))
+				break;
+		}
+
+		if (i == PS_NUM || ctx->setv[i])
+			return EPROTO;
+
+		ctx->setv[i] = true;
+		ctx->offv[i] = ctx->pmb->end;
+		ctx->lenv[i] = val->l;
+
+		return mbuf_write_mem(ctx->pmb, (const uint8_t *)val->p,
+				      val->l);
+	}
+
+	ctx->regular = true;
+
+	if (!pl_strcasecmp(name, "host"))
+		ctx->host = true;
+
+	if (ctx->hmb->end + name->l + val->l > H2_HDRS_MAX)
+		return EOVERFLOW;
+
+	return mbuf_printf(ctx->hmb, "%r: %r\r\n", name, val);
+}
+
+
+static struct pl *ps_get(const struct hdr_ctx *ctx, int i, struct pl *pl)
+{
+	pl->p = (const char *)ctx->pmb->buf + ctx->offv[i];
+	pl->l = ctx->lenv[i];
+
+	return pl;
+}
+
+
+/* HTTP/1.1 style message head of a header block */
+static int head_encode(struct mbuf *mb, const struct hdr_ctx *ctx)
+{
+	struct pl a, b;
+	int err = 0;
+
+	if (ctx->setv[PS_STATUS]) {
+		err = mbuf_printf(mb, "HTTP/2 %r \r\n",
+				  ps_get(ctx, PS_STATUS, &a));
+	}
+	else if (ctx->setv[PS_METHOD]) {
+		err = mbuf_printf(mb, "%r %r HTTP/2\r\n",
+				  ps_get(ctx, PS_METHOD, &a),
+				  ps_get(ctx, PS_PATH, &b));
+
+		if (!ctx->host && ctx->setv[PS_AUTHORITY])
+			err |= mbuf_printf(mb, "Host: %r\r\n",
+					   ps_get(ctx, PS_AUTHORITY, &a));
+	}
+
+	err |= mbuf_write_mem(mb, ctx->hmb->buf, ctx->hmb->end);
+	err |= mbuf_write_str(mb, "\r\n");
+
+	mb->pos = 0;
+
+	return err;
+}
+
+
+/* A new stream from the client */
+static int strm_accept(struct h2_strm **strmp, struct h2_sess *sess,
+		       uint32_t id)
+{
+	struct h2_strm *strm;
+	int err;
+
+	if (!(id & 1))
+		return conn_error(sess, H2_PROTOCOL_ERROR);
+
+	sess->last_id = id;
+
+	if (sess->goaway || sess->nstrm >= H2_STREAMS)
+		return u32_send(sess, H2_RST_STREAM, id, H2_REFUSED_STREAM);
+
+	err = strm_new(&strm, sess, id);
+	if (err)
+		return err;
+
+	strm->open = true;
+
+	/* the handler takes the reference */
+	err = sess->strmh ? sess->strmh(strm, sess->arg) : ENOSYS;
+	if (err) {
+		strm->rcode = H2_REFUSED_STREAM;
+		mem_deref(strm);
+		return 0;
+	}
+
+	*strmp = strm;
+
+	return 0;
+}
+
+
+static int hb_handle(struct h2_sess *sess)
+{
+	const uint32_t id = sess->hb_id;
+	const bool end = sess->hb_end;
+	struct h2_strm *strm = NULL;
+	struct mbuf *mb = NULL;
+	struct hdr_ctx ctx;
+	bool interim;
+	int err;
+
+	sess->hb_id = 0;
+
+	memset(&ctx, 0, sizeof(ctx));
+
+	ctx.hmb = mbuf_alloc(512);
+	ctx.pmb = mbuf_alloc(256);
+	if (!ctx.hmb || !ctx.pmb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	/* the block is always decoded, to keep the table in sync */
+	sess->hb->pos = 0;
+	err = hpack_decode(sess->hpack, sess->hb, hdr_handler, &ctx);
+	mbuf_rewind(sess->hb);
+	if (err) {
+		err = conn_error(sess, err == EPROTO ? H2_PROTOCOL_ERROR :
+				 H2_COMPRESSION_ERROR);
+		goto out;
+	}
+
+	strm = strm_find(sess, id);
+	if (!strm) {
+		/* a stream that was closed */
+		if (!sess->server || id <= sess->last_id)
+			goto out;
+
+		err = strm_accept(&strm, sess, id);
+		if (err || !strm)
+			goto out;
+	}
+
+	if (strm->rend) {
+		strm_reset(strm, H2_STREAM_CLOSED, EPROTO);
+		goto out;
+	}
+
+	interim = false;
+
+	if (!strm->head) {
+
+		if (sess->server) {
+			if (!ctx.setv[PS_METHOD] || !ctx.setv[PS_PATH]) {
+				strm_reset(strm, H2_PROTOCOL_ERROR, EPROTO);
+				goto out;
+			}
+		}
+		else {
+			struct pl st;
+
+			if (!ctx.setv[PS_STATUS]) {
+				strm_reset(strm, H2_PROTOCOL_ERROR, EPROTO);
+				goto out;
+			}
+
+			/* 1xx responses come before the final response */
+			interim = pl_u32(ps_get(&ctx, PS_STATUS, &st)) < 200;
+		}
+	}
+
+	mb = mbuf_alloc(ctx.hmb->end + ctx.pmb->end + 64);
+	if (!mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = head_encode(mb, &ctx);
+	if (err)
+		goto out;
+
+	if (interim && end) {
+		strm_reset(strm, H2_PROTOCOL_ERROR, EPROTO);
+		goto out;
+	}
+
+	if (interim)
+		goto out;
+
+	strm->head = true;
+	strm->rend = end;
+
+	if (strm_head(strm, mb, end))
+		strm_done(strm);
+
+ out:
+	mem_deref(mb);
+	mem_deref(ctx.hmb);
+	mem_deref(ctx.pmb);
+
+	return err;
+}
+
+
+static int headers_handle(struct h2_sess *sess, uint8_t flags, uint32_t id,
+			  const uint8_t *p, size_t len)
+{
+	int err;
+
+	if (!id || pad_strip(&p, &len, flags))
+		return conn_error(sess, H2_PROTOCOL_ERROR);
+
+	if (flags & H2_PRIO) {
+
+		if (len < 5)
+			return conn_error(sess, H2_FRAME_SIZE_ERROR);
+
+		p   += 5;
+		len -= 5;
+	}
+
+	mbuf_rewind(sess->hb);
+
+	err = mbuf_write_mem(sess->hb, p, len);
+	if (err)
+		return err;
+
+	sess->hb_id  = id;
+	sess->hb_end = (flags & H2_END_STREAM) != 0;
+
+	if (flags & H2_END_HEADERS)
+		return hb_handle(sess);
+
+	return 0;
+}
+
+
+static int continuation_handle(struct h2_sess *sess, uint8_t flags,
+			       uint32_t id, const uint8_t *p, size_t len)
+{
+	int err;
+
+	if (!sess->hb_id || id != sess->hb_id)
+		return conn_error(sess, H2_PROTOCOL_ERROR);
+
+	if (sess->hb->end + len > H2_HDRS_MAX)
+		return conn_error(sess, H2_PROTOCOL_ERROR);
+
+	err = mbuf_write_mem(sess->hb, p, len);
+	if (err)
+		return err;
+
+	if (flags & H2_END_HEADERS)
+		return hb_handle(sess);
+
+	return 0;
+}
+
+
+static int data_handle(struct h2_sess *sess, uint8_t flags, uint32_t id,
+		       const uint8_t *p, size_t len)
+{
+	const bool end = (flags & H2_END_STREAM) != 0;
+	const size_t flen = len;
+	struct h2_strm *strm;
+	int err;
+
+	if (!id)
+		return conn_error(sess, H2_PROTOCOL_ERROR);
+
+	/* the whole frame counts for flow control, also on closed streams */
+	sess->rwin -= (int64_t)flen;
+	if (sess->rwin < 0)
+		return conn_error(sess, H2_FLOW_CONTROL_ERROR);
+
+	if (sess->rwin < H2_WINDOW / 2) {
+
+		err = u32_send(sess, H2_WINDOW_UPDATE, 0,
+			       (uint32_t)(H2_WINDOW - sess->rwin));
+		if (err)
+			return err;
+
+		sess->rwin = H2_WINDOW;
+	}
+
+	if (pad_strip(&p, &len, flags))
+		return conn_error(sess, H2_PROTOCOL_ERROR);
+
+	strm = strm_find(sess, id);
+	if (!strm)
+		return 0;
+
+	if (!strm->head || strm->rend) {
+		strm_reset(strm, H2_STREAM_CLOSED, EPROTO);
+		return 0;
+	}
+
+	strm->rwin -= (int64_t)flen;
+	if (strm->rwin < 0) {
+		strm_reset(strm, H2_FLOW_CONTROL_ERROR, EPROTO);
+		return 0;
+	}
+
+	if (!end && strm->rwin < H2_WINDOW / 2) {
+
+		err = u32_send(sess, H2_WINDOW_UPDATE, id,
+			       (uint32_t)(H2_WINDOW - strm->rwin));
+		if (err)
+			return err;
+
+		strm->rwin = H2_WINDOW;
+	}
+
+	strm->rend = end;
+
+	if (strm_data(strm, p, len, end))
+		strm_done(strm);
+
+	return 0;
+}
+
+
+static int settings_handle(struct h2_sess *sess, uint8_t flags, uint32_t id,
+			   const uint8_t *p, size_t len)
+{
+	struct le *le;
+	size_t i;
+	int err;
+
+	if (id)
+		return conn_error(sess, H2_PROTOCOL_ERROR);
+
+	if (flags & H2_ACK)
+		return len ? conn_error(sess, H2_FRAME_SIZE_ERROR) : 0;
+
+	if (len % 6)
+		return conn_error(sess, H2_FRAME_SIZE_ERROR);
+
+	for (i=0; i<len; i+=6) {
+
+		const uint16_t key = (uint16_t)(p[i] << 8 | p[i+1]);
+		const uint32_t val = get_u32(&p[i+2]);
+
+		switch (key) {
+
+		case H2_SET_ENABLE_PUSH:
+			if (val > 1)
+				return conn_error(sess, H2_PROTOCOL_ERROR);
+			break;
+
+		case H2_SET_MAX_CONCURRENT_STREAMS:
+			sess->strm_max = val;
+			break;
+
+		case H2_SET_INITIAL_WINDOW_SIZE:
+			if (val > H2_WINDOW_MAX)
+				return conn_error(sess,
+						  H2_FLOW_CONTROL_ERROR);
+
+			for (le = sess->strml.head; le; le = le->next) {
+
+				struct h2_strm *strm = le->data;
+
+				strm->swin += (int64_t)val - sess->strm_win;
+			}
+
+			sess->strm_win = val;
+			break;
+
+		case H2_SET_MAX_FRAME_SIZE:
+			if (val < 16384 || val > 16777215)
+				return conn_error(sess, H2_PROTOCOL_ERROR);
+
+			sess->frame_max = val;
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	err = frame_send(sess, H2_SETTINGS, H2_ACK, 0, NULL, 0);
+	if (err)
+		return err;
+
+	return sess_flush(sess);
+}
+
+
+static int window_update_handle(struct h2_sess *sess, uint32_t id,
+				const uint8_t *p, size_t len)
+{
+	struct h2_strm *strm;
+	uint32_t inc;
+	bool pending;
+	int err;
+
+	if (len != 4)
+		return conn_error(sess, H2_FRAME_SIZE_ERROR);
+
+	inc = get_u32(p) & 0x7fffffff;
+
+	if (!id) {
+		if (!inc)
+			return conn_error(sess, H2_PROTOCOL_ERROR);
+
+		if (sess->swin + inc > H2_WINDOW_MAX)
+			return conn_error(sess, H2_FLOW_CONTROL_ERROR);
+
+		sess->swin += inc;
+
+		return sess_flush(sess);
+	}
+
+	strm = strm_find(sess, id);
+	if (!strm)
+		return 0;
+
+	if (!inc) {
+		strm_reset(strm, H2_PROTOCOL_ERROR, EPROTO);
+		return 0;
+	}
+
+	if (strm->swin + inc > H2_WINDOW_MAX) {
+		strm_reset(strm, H2_FLOW_CONTROL_ERROR, EPROTO);
+		return 0;
+	}
+
+	strm->swin += inc;
+
+	pending = h2_strm_txlen(strm) > 0;
+
+	err = strm_flush(strm);
+	if (err)
+		return err;
+
+	if (pending && !h2_strm_txlen(strm))
+		strm->wake = true;
+
+	return 0;
+}
+
+
+static int rst_stream_handle(struct h2_sess *sess, uint32_t id,
+			     const uint8_t *p, size_t len)
+{
+	struct h2_strm *strm;
+
+	if (!id)
+		return conn_error(sess, H2_PROTOCOL_ERROR);
+
+	if (len != 4)
+		return conn_error(sess, H2_FRAME_SIZE_ERROR);
+
+	strm = strm_find(sess, id);
+	if (!strm)
+		return 0;
+
+	strm->open = false;
+
+	switch (get_u32(p)) {
+
+	case H2_REFUSED_STREAM:
+		strm_close(strm, ECONNREFUSED);
+		break;
+
+	case H2_CANCEL:
+		strm_close(strm, ECANCELED);
+		break;
+
+	default:
+		strm_close(strm, ECONNRESET);
+		break;
+	}
+
+	return 0;
+}
+
+
+static int goaway_handle(struct h2_sess *sess, uint32_t id,
+			 const uint8_t *p, size_t len)
+{
+	uint32_t last;
+
+	if (id)
+		return conn_error(sess, H2_PROTOCOL_ERROR);
+
+	if (len < 8)
+		return conn_error(sess, H2_FRAME_SIZE_ERROR);
+
+	last = get_u32(p) & 0x7fffffff;
+
+	DEBUG_INFO("goaway: last=%u error=0x%x\n", last, get_u32(&p[4]));
+
+	sess->goaway = true;
+
+	if (sess->server)
+		return 0;
+
+	/* the streams after the last one were not processed */
+	for (;;) {
+
+		struct h2_strm *strm = NULL;
+		struct le *le;
+
+		for (le = sess->strml.head; le; le = le->next) {
+
+			struct h2_strm *s = le->data;
+
+			if (s->id > last) {
+				strm = s;
+				break;
+			}
+		}
+
+		if (!strm)
+			break;
+
+		strm->open = false;
+		strm_close(strm, ECONNREFUSED);
+	}
+
+	return 0;
+}
+
+
+static int frame_handle(struct h2_sess *sess, uint8_t type, uint8_t flags,
+			uint32_t id, const uint8_t *p, size_t len)
+{
+	/* a header block is not interrupted */
+	if (sess->hb_id && type != H2_CONTINUATION)
+		return conn_error(sess, H2_PROTOCOL_ERROR);
+
+	switch (type) {
+
+	case H2_DATA:
+		return data_handle(sess, flags, id, p, len);
+
+	case H2_HEADERS:
+		return headers_handle(sess, flags, id, p, len);
+
+	case H2_CONTINUATION:
+		return continuation_handle(sess, flags, id, p, len);
+
+	case H2_SETTINGS:
+		return settings_handle(sess, flags, id, p, len);
+
+	case H2_WINDOW_UPDATE:
+		return window_update_handle(sess, id, p, len);
+
+	case H2_RST_STREAM:
+		return rst_stream_handle(sess, id, p, len);
+
+	case H2_PING:
+		if (id)
+			return conn_error(sess, H2_PROTOCOL_ERROR);
+
+		if (len != 8)
+			return conn_error(sess, H2_FRAME_SIZE_ERROR);
+
+		if (flags & H2_ACK)
+			return 0;
+
+		return frame_send(sess, H2_PING, H2_ACK, 0, p, len);
+
+	case H2_GOAWAY:
+		return goaway_handle(sess, id, p, len);
+
+	case H2_PUSH_PROMISE:
+		/* push is disabled in our settings */
+		return conn_error(sess, H2_PROTOCOL_ERROR);
+
+	case H2_PRIORITY:
+	default:
+		return 0;
+	}
+}
+
+
+static int rx_append(struct h2_sess *sess, struct mbuf *mb)
+{
+	struct mbuf *rxb = sess->rxb;
+	const size_t left = rxb ? mbuf_get_left(rxb) : 0;
+	int err;
+
+	if (!left) {
+		mem_deref(sess->rxb);
+		sess->rxb = mem_ref(mb);
+		return 0;
+	}
+
+	/* keep only the part of a frame that is not handled yet */
+	if (rxb->pos) {
+		memmove(rxb->buf, mbuf_buf(rxb), left);
+		rxb->pos = 0;
+		rxb->end = left;
+	}
+
+	rxb->pos = rxb->end;
+	err = mbuf_write_mem(rxb, mbuf_buf(mb), mbuf_get_left(mb));
+	rxb->pos = 0;
+
+	return err;
+}
+
+
+static int sess_start(struct h2_sess *sess)
+{
+	struct mbuf *mb;
+	uint8_t set[6];
+	int err = 0;
+
+	mb = mbuf_alloc(128);
+	if (!mb)
+		return ENOMEM;
+
+	if (!sess->server)
+		err |= mbuf_write_str(mb, H2_PREFACE);
+
+	err |= frame_hdr(mb, H2_SETTINGS, 0, 0, 2 * sizeof(set));
+
+	set[0] = 0;
+	set[1] = sess->server ? H2_SET_MAX_CONCURRENT_STREAMS :
+		H2_SET_ENABLE_PUSH;
+	put_u32(&set[2], sess->server ? H2_STREAMS : 0);
+	err |= mbuf_write_mem(mb, set, sizeof(set));
+
+	set[1] = H2_SET_INITIAL_WINDOW_SIZE;
+	put_u32(&set[2], H2_WINDOW);
+	err |= mbuf_write_mem(mb, set, sizeof(set));
+
+	/* open the connection window too */
+	err |= frame_hdr(mb, H2_WINDOW_UPDATE, 0, 0, 4);
+	put_u32(set, H2_WINDOW - H2_WINDOW_DEF);
+	err |= mbuf_write_mem(mb, set, 4);
+	if (err)
+		goto out;
+
+	mb->pos = 0;
+
+	err = tcp_send(sess->tc, mb);
+	if (err)
+		goto out;
+
+	sess->rwin = H2_WINDOW;
+
+ out:
+	mem_deref(mb);
+
+	return err;
+}
+
+
+/**
+ * Allocate an HTTP/2 session on a TCP connection. The connection preface
+ * and the settings are sent at once. The TCP connection is not
+ * referenced, and the session must be closed before the connection.
+ *
+ * @param sessp  Pointer to allocated session
+ * @param tc     TCP connection
+ * @param secure True if the connection runs TLS
+ * @param server True for the server side
+ * @param strmh  New stream handler, for the server side
+ * @param arg    Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int h2_sess_alloc(struct h2_sess **sessp, struct tcp_conn *tc, bool secure,
+		  bool server, h2_strm_h *strmh, void *arg)
+{
+	struct h2_sess *sess;
+	int err;
+
+	if (!sessp || !tc)
+		return EINVAL;
+
+	sess = mem_zalloc(sizeof(*sess), sess_destructor);
+	if (!sess)
+		return ENOMEM;
+
+	err = hpack_alloc(&sess->hpack);
+	if (err)
+		goto out;
+
+	sess->hb = mbuf_alloc(1024);
+	if (!sess->hb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	tmr_init(&sess->tmr);
+
+	sess->tc        = tc;
+	sess->secure    = secure;
+	sess->server    = server;
+	sess->strmh     = strmh;
+	sess->arg       = arg;
+	sess->swin      = H2_WINDOW_DEF;
+	sess->rwin      = H2_WINDOW_DEF;
+	sess->strm_win  = H2_WINDOW_DEF;
+	sess->frame_max = H2_FRAME_MAX;
+	sess->strm_max  = H2_STREAMS;
+	sess->next_id   = 1;
+
+	err = sess_start(sess);
+
+ out:
+	if (err)
+		mem_deref(sess);
+	else
+		*sessp = sess;
+
+	return err;
+}
+
+
+/**
+ * Handle data received on the TCP connection of an HTTP/2 session. The
+ * TCP connection must be closed if an error is returned.
+ *
+ * @param sess HTTP/2 session
+ * @param mb   Received data
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int h2_sess_recv(struct h2_sess *sess, struct mbuf *mb)
+{
+	struct mbuf *rxb;
+	int err;
+
+	if (!sess || !mb)
+		return EINVAL;
+
+	if (sess->closed)
+		return ENOTCONN;
+
+	err = rx_append(sess, mb);
+	if (err)
+		return err;
+
+	mem_ref(sess);
+
+	rxb = sess->rxb;
+
+	if (sess->server && !sess->preface) {
+
+		const size_t n = min(mbuf_get_left(rxb), strlen(H2_PREFACE));
+
+		if (memcmp(mbuf_buf(rxb), H2_PREFACE, n)) {
+			err = EPROTO;
+			goto out;
+		}
+
+		if (n < strlen(H2_PREFACE))
+			goto out;
+
+		rxb->pos += n;
+		sess->preface = true;
+	}
+
+	while (!sess->closed && mbuf_get_left(rxb) >= H2_HDR_SIZE) {
+
+		const uint8_t *p = mbuf_buf(rxb);
+		const size_t len = (size_t)p[0] << 16 | p[1] << 8 | p[2];
+
+		if (len > H2_FRAME_MAX) {
+			err = conn_error(sess, H2_FRAME_SIZE_ERROR);
+			break;
+		}
+
+		if (mbuf_get_left(rxb) < H2_HDR_SIZE + len)
+			break;
+
+		rxb->pos += H2_HDR_SIZE + len;
+
+		err = frame_handle(sess, p[3], p[4],
+				   get_u32(&p[5]) & 0x7fffffff,
+				   p + H2_HDR_SIZE, len);
+		if (err)
+			break;
+	}
+
+	if (!err && !sess->closed)
+		sess_wake(sess);
+
+ out:
+	if (sess->rxb && !mbuf_get_left(sess->rxb))
+		sess->rxb = mem_deref(sess->rxb);
+
+	mem_deref(sess);
+
+	return err;
+}
+
+
+/**
+ * Close an HTTP/2 session. The open streams are closed with the error,
+ * and nothing more is sent on the TCP connection.
+ *
+ * @param sess HTTP/2 session
+ * @param err  Error code for the streams
+ */
+void h2_sess_close(struct h2_sess *sess, int err)
+{
+	struct le *le;
+
+	if (!sess)
+		return;
+
+	sess->closed = true;
+	sess->tc     = NULL;
+	tmr_cancel(&sess->tmr);
+
+	while ((le = sess->strml.head))
+		strm_close(le->data, err);
+}
+
+
+/**
+ * Check if a new stream can be started on an HTTP/2 session
+ *
+ * @param sess HTTP/2 session
+ *
+ * @return True if a stream can be started, otherwise false
+ */
+bool h2_sess_avail(const struct h2_sess *sess)
+{
+	if (!sess || sess->closed || sess->goaway || sess->server)
+		return false;
+
+	return sess->nstrm < sess->strm_max && sess->next_id < 0x7fffffff;
+}
+
+
+/**
+ * Get the number of open streams of an HTTP/2 session
+ *
+ * @param sess HTTP/2 session
+ *
+ * @return Number of open streams
+ */
+uint32_t h2_sess_nstrm(const struct h2_sess *sess)
+{
+	return sess ? sess->nstrm : 0;
+}
+
+
+/**
+ * Allocate a new stream on the client side of an HTTP/2 session
+ *
+ * @param strmp Pointer to allocated stream
+ * @param sess  HTTP/2 session
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int h2_strm_alloc(struct h2_strm **strmp, struct h2_sess *sess)
+{
+	int err;
+
+	if (!strmp || !sess)
+		return EINVAL;
+
+	if (!h2_sess_avail(sess))
+		return EBUSY;
+
+	err = strm_new(strmp, sess, sess->next_id);
+	if (err)
+		return err;
+
+	sess->next_id += 2;
+
+	return 0;
+}
+
+
+/**
+ * Set the handlers of an HTTP/2 stream
+ *
+ * @param strm   HTTP/2 stream
+ * @param headh  Header block handler
+ * @param datah  Data handler
+ * @param sendh  Handler called when the queued data was sent (optional)
+ * @param closeh Close handler
+ * @param arg    Handler argument
+ */
+void h2_strm_set_handlers(struct h2_strm *strm, h2_head_h *headh,
+			  h2_data_h *datah, h2_send_h *sendh,
+			  h2_close_h *closeh, void *arg)
+{
+	if (!strm)
+		return;
+
+	strm->headh  = headh;
+	strm->datah  = datah;
+	strm->sendh  = sendh;
+	strm->closeh = closeh;
+	strm->arg    = arg;
+}
+
+
+/* Connection-specific fields are not used in HTTP/2 */
+static bool hdr_skip(const struct http_hdr *hdr)
+{
+	switch (hdr->id) {
+
+	case HTTP_HDR_CONNECTION:
+	case HTTP_HDR_HOST:
+	case HTTP_HDR_TRANSFER_ENCODING:
+	case HTTP_HDR_UPGRADE:
+		return true;
+
+	case HTTP_HDR_TE:
+		return pl_strcasecmp(&hdr->val, "trailers") != 0;
+
+	default:
+		return !pl_strcasecmp(&hdr->name, "keep-alive") ||
+			!pl_strcasecmp(&hdr->name, "proxy-connection");
+	}
+}
+
+
+static int pseudo_encode(struct mbuf *hb, const struct h2_sess *sess,
+			 const struct http_msg *msg)
+{
+	const struct http_hdr *host;
+	struct pl name, val;
+	char buf[8];
+	int err;
+
+	if (sess->server) {
+		(void)re_snprintf(buf, sizeof(buf), "%u", msg->scode);
+
+		pl_set_str(&name, pseudov[PS_STATUS]);
+		pl_set_str(&val, buf);
+
+		return hpack_encode(hb, &name, &val);
+	}
+
+	pl_set_str(&name, pseudov[PS_METHOD]);
+	err = hpack_encode(hb, &name, &msg->met);
+
+	pl_set_str(&name, pseudov[PS_SCHEME]);
+	pl_set_str(&val, sess->secure ? "https" : "http");
+	err |= hpack_encode(hb, &name, &val);
+
+	host = http_msg_hdr(msg, HTTP_HDR_HOST);
+	if (host) {
+		pl_set_str(&name, pseudov[PS_AUTHORITY]);
+		err |= hpack_encode(hb, &name, &host->val);
+	}
+
+	/* the path with the parameters */
+	val = msg->path;
+	if (pl_isset(&msg->prm))
+		val.l = msg->prm.p + msg->prm.l - msg->path.p;
+
+	pl_set_str(&name, pseudov[PS_PATH]);
+	err |= hpack_encode(hb, &name, &val);
+
+	return err;
+}
+
+
+static int hdrs_send(struct h2_sess *sess, uint32_t id,
+		     const struct mbuf *hb, bool end)
+{
+	const size_t len = hb->end;
+	struct mbuf *mb;
+	size_t off = 0;
+	int err = 0;
+
+	mb = mbuf_alloc(len + H2_HDR_SIZE * (len / sess->frame_max + 1));
+	if (!mb)
+		return ENOMEM;
+
+	do {
+		const size_t n = min(len - off, (size_t)sess->frame_max);
+		uint8_t flags = 0;
+
+		if (!off && end)
+			flags |= H2_END_STREAM;
+
+		if (off + n == len)
+			flags |= H2_END_HEADERS;
+
+		err |= frame_hdr(mb, off ? H2_CONTINUATION : H2_HEADERS,
+				 flags, id, n);
+		err |= mbuf_write_mem(mb, hb->buf + off, n);
+
+		off += n;
+
+	} while (off < len);
+
+	if (err)
+		goto out;
+
+	mb->pos = 0;
+
+	err = tcp_send(sess->tc, mb);
+
+ out:
+	mem_deref(mb);
+
+	return err;
+}
+
+
+/**
+ * Send an HTTP message on an HTTP/2 stream. The message is given as an
+ * HTTP/1.1 request on the client side, or as an HTTP/1.1 response on the
+ * server side, and the body is sent after the headers.
+ *
+ * @param strm HTTP/2 stream
+ * @param mb   HTTP message from mb->pos to mb->end
+ * @param end  True to end the stream after the message
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int h2_strm_send_msg(struct h2_strm *strm, struct mbuf *mb, bool end)
+{
+	const size_t pos = mb ? mb->pos : 0;
+	struct http_msg *msg = NULL;
+	struct h2_sess *sess;
+	struct mbuf *hb = NULL;
+	struct le *le;
+	size_t len;
+	int err;
+
+	if (!strm || !mb)
+		return EINVAL;
+
+	sess = strm->sess;
+	if (!sess || !sess->tc)
+		return ENOTCONN;
+
+	if (strm->hsent)
+		return EALREADY;
+
+	err = http_msg_decode(&msg, mb, !sess->server);
+	if (err)
+		goto out;
+
+	len = mbuf_get_left(mb);
+
+	hb = mbuf_alloc(256);
+	if (!hb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = pseudo_encode(hb, sess, msg);
+	if (err)
+		goto out;
+
+	for (le = msg->hdrl.head; le; le = le->next) {
+
+		const struct http_hdr *hdr = le->data;
+
+		if (hdr_skip(hdr))
+			continue;
+
+		err = hpack_encode(hb, &hdr->name, &hdr->val);
+		if (err)
+			goto out;
+	}
+
+	err = hdrs_send(sess, strm->id, hb, end && !len);
+	if (err)
+		goto out;
+
+	strm->open  = true;
+	strm->hsent = true;
+
+	if (len) {
+		err = h2_strm_send_data(strm, mbuf_buf(mb), len, end);
+	}
+	else if (end) {
+		strm->lend  = true;
+		strm->lsent = true;
+		strm_sent(strm);
+	}
+
+ out:
+	mb->pos = pos;
+	mem_deref(msg);
+	mem_deref(hb);
+
+	return err;
+}
+
+
+/**
+ * Send data on an HTTP/2 stream. The data that does not fit in the send
+ * windows is queued in the stream.
+ *
+ * @param strm HTTP/2 stream
+ * @param buf  Data to send
+ * @param len  Length of data
+ * @param end  True to end the stream after the data
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int h2_strm_send_data(struct h2_strm *strm, const uint8_t *buf, size_t len,
+		      bool end)
+{
+	int err;
+
+	if (!strm || (!buf && len))
+		return EINVAL;
+
+	if (!strm->sess || !strm->sess->tc)
+		return ENOTCONN;
+
+	if (!strm->hsent)
+		return EPROTO;
+
+	if (strm->lend)
+		return EALREADY;
+
+	if (len) {
+		size_t pos;
+
+		if (!strm->txb) {
+			strm->txb = mbuf_alloc(len);
+			if (!strm->txb)
+				return ENOMEM;
+		}
+
+		pos = strm->txb->pos;
+		strm->txb->pos = strm->txb->end;
+		err = mbuf_write_mem(strm->txb, buf, len);
+		strm->txb->pos = pos;
+		if (err)
+			return err;
+	}
+
+	strm->lend = end;
+
+	err = strm_flush(strm);
+	if (err)
+		return err;
+
+	strm_sent(strm);
+
+	return 0;
+}
+
+
+/**
+ * Get the number of bytes queued in an HTTP/2 stream
+ *
+ * @param strm HTTP/2 stream
+ *
+ * @return Number of bytes waiting for the send window
+ */
+size_t h2_strm_txlen(const struct h2_strm *strm)
+{
+	return strm && strm->txb ? mbuf_get_left(strm->txb) : 0;
+}
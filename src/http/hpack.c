@@ -0,0 +1,594 @@
+/**
+ * @file http/hpack.c  HPACK Header Compression for HTTP/2 (RFC 7541)
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <ctype.h>
+#include <string.h>
+#include <re_types.h>
+#include <re_mem.h>
+#include <re_mbuf.h>
+#include <re_list.h>
+#include <re_fmt.h>
+#include "http.h"
+
+
+/*
+ * The decoder keeps the dynamic table of the peer. The encoder does not
+ * insert into the dynamic table of the peer, it sends the header fields as
+ * literals without indexing, with the name from the static table where
+ * there is one, and without Huffman coding.
+ */
+
+
+enum {
+	HPACK_TBLSIZE = 4096,  /**< SETTINGS_HEADER_TABLE_SIZE         */
+	HPACK_STRMAX  = 65536, /**< Maximum length of a decoded string  */
+	HPACK_STATIC  = 61,    /**< Number of static table entries      */
+};
+
+/** Defines an HPACK decoder */
+struct hpack {
+	struct list tbl;       /**< Dynamic table, newest first         */
+	struct mbuf *smb;      /**< Decoded strings                     */
+	size_t size;           /**< Size of dynamic table [bytes]       */
+	size_t max;            /**< Maximum size of dynamic table       */
+};
+
+/** Dynamic table entry, with the name and value after it */
+struct hpack_ent {
+	struct le le;
+	struct pl name;
+	struct pl val;
+};
+
+
+/** Static table (RFC 7541 Appendix A) */
+static const struct {
+	const char *name;
+	const char *val;
+} static_tbl[] = {
+	{":authority", ""},
+	{":method", "GET"},
+	{":method", "POST"},
+	{":path", "/"},
+	{":path", "/index.html"},
+	{":scheme", "http"},
+	{":scheme", "https"},
+	{":status", "200"},
+	{":status", "204"},
+	{":status", "206"},
+	{":status", "304"},
+	{":status", "400"},
+	{":status", "404"},
+	{":status", "500"},
+	{"accept-charset", ""},
+	{"accept-encoding", "gzip, deflate"},
+	{"accept-language", ""},
+	{"accept-ranges", ""},
+	{"accept", ""},
+	{"access-control-allow-origin", ""},
+	{"age", ""},
+	{"allow", ""},
+	{"authorization", ""},
+	{"cache-control", ""},
+	{"content-disposition", ""},
+	{"content-encoding", ""},
+	{"content-language", ""},
+	{"content-length", ""},
+	{"content-location", ""},
+	{"content-range", ""},
+	{"content-type", ""},
+	{"cookie", ""},
+	{"date", ""},
+	{"etag", ""},
+	{"expect", ""},
+	{"expires", ""},
+	{"from", ""},
+	{"host", ""},
+	{"if-match", ""},
+	{"if-modified-since", ""},
+	{"if-none-match", ""},
+	{"if-range", ""},
+	{"if-unmodified-since", ""},
+	{"last-modified", ""},
+	{"link", ""},
+	{"location", ""},
+	{"max-forwards", ""},
+	{"proxy-authenticate", ""},
+	{"proxy-authorization", ""},
+	{"range", ""},
+	{"referer", ""},
+	{"refresh", ""},
+	{"retry-after", ""},
+	{"server", ""},
+	{"set-cookie", ""},
+	{"strict-transport-security", ""},
+	{"transfer-encoding", ""},
+	{"user-agent", ""},
+	{"vary", ""},
+	{"via", ""},
+	{"www-authenticate", ""},
+};
+
+
+/*
+ * Huffman code (RFC 7541 Appendix B) as a binary tree. A positive
+ * entry is the next node, a negative entry is the symbol plus one.
+ */
+static const int16_t huff_tree[256][2] = {
+	{66,1}, {93,2}, {104,3}, {119,4}, {144,5}, {75,6}, {123,7}, {71,8},
+	{77,9}, {73,10}, {11,13}, {12,102}, {-1,-37}, {127,14}, {128,15},
+	{98,16}, {-124,17}, {124,18}, {150,19}, {20,25}, {199,21}, {216,22},
+	{23,162}, {24,161}, {-2,-136}, {167,26}, {41,27}, {191,28}, {211,29},
+	{229,30}, {31,45}, {32,38}, {33,35}, {-255,34}, {-3,-4}, {36,37},
+	{-5,-6}, {-7,-8}, {39,52}, {40,51}, {-9,-12}, {208,42}, {43,165},
+	{-240,44}, {-10,-143}, {55,46}, {63,47}, {147,48}, {-250,49}, {50,59},
+	{-11,-14}, {-13,-15}, {53,54}, {-16,-17}, {-18,-19}, {56,60}, {57,58},
+	{-20,-21}, {-22,-24}, {-23,-257}, {61,62}, {-25,-26}, {-27,-28},
+	{64,65}, {-29,-30}, {-31,-32}, {85,67}, {68,82}, {143,69}, {70,81},
+	{-33,-38}, {72,79}, {-34,-35}, {-125,74}, {-36,-63}, {76,80},
+	{-39,-43}, {-64,78}, {-40,-44}, {-41,-42}, {-45,-60}, {-46,-47},
+	{83,90}, {84,89}, {-48,-52}, {86,130}, {87,88}, {-49,-50}, {-51,-98},
+	{-53,-54}, {91,92}, {-55,-56}, {-57,-58}, {99,94}, {138,95}, {142,96},
+	{97,103}, {-59,-67}, {-61,-97}, {100,132}, {101,129}, {-62,-66},
+	{-65,-92}, {-68,-69}, {105,112}, {106,109}, {107,108}, {-70,-71},
+	{-72,-73}, {110,111}, {-74,-75}, {-76,-77}, {113,116}, {114,115},
+	{-78,-79}, {-80,-81}, {117,118}, {-82,-83}, {-84,-85}, {120,136},
+	{121,122}, {-86,-87}, {-88,-90}, {-89,-91}, {125,155}, {126,148},
+	{-93,-196}, {-94,-127}, {-95,-126}, {-96,-99}, {131,135}, {-100,-102},
+	{133,134}, {-101,-103}, {-104,-105}, {-106,-112}, {137,141},
+	{-107,-108}, {139,140}, {-109,-110}, {-111,-113}, {-114,-119},
+	{-115,-118}, {-116,-117}, {145,146}, {-120,-121}, {-122,-123},
+	{-128,-221}, {-209,149}, {-129,-131}, {196,151}, {152,178}, {153,158},
+	{-231,154}, {-130,-133}, {156,175}, {157,204}, {-132,-163}, {159,160},
+	{-134,-135}, {-137,-147}, {-138,-139}, {163,164}, {-140,-141},
+	{-142,-144}, {166,171}, {-145,-146}, {168,185}, {169,173}, {170,172},
+	{-148,-150}, {-149,-160}, {-151,-152}, {174,181}, {-153,-156},
+	{241,176}, {177,188}, {-154,-162}, {179,183}, {180,182}, {-155,-157},
+	{-158,-159}, {-161,-164}, {184,190}, {-165,-170}, {186,194},
+	{187,189}, {-166,-167}, {-168,-173}, {-169,-175}, {-171,-174},
+	{192,218}, {193,234}, {-172,-207}, {195,203}, {-176,-181}, {197,235},
+	{198,202}, {-177,-178}, {200,206}, {201,205}, {-179,-182},
+	{-180,-210}, {-183,-184}, {-185,-195}, {-186,-187}, {207,210},
+	{-188,-190}, {209,215}, {-189,-192}, {-191,-197}, {212,224},
+	{213,222}, {214,221}, {-193,-194}, {-198,-232}, {217,243},
+	{-199,-229}, {245,219}, {220,244}, {-200,-208}, {-201,-202},
+	{223,228}, {-203,-206}, {237,225}, {248,226}, {-256,227}, {-204,-205},
+	{-211,-214}, {230,249}, {231,239}, {232,233}, {-212,-213},
+	{-215,-222}, {-216,-226}, {236,242}, {-217,-218}, {238,246},
+	{-219,-220}, {240,247}, {-223,-224}, {-225,-227}, {-228,-230},
+	{-233,-234}, {-235,-236}, {-237,-238}, {-239,-241}, {-242,-245},
+	{-243,-244}, {250,253}, {251,252}, {-246,-247}, {-248,-249},
+	{254,255}, {-251,-252}, {-253,-254},
+};
+
+
+static void destructor(void *arg)
+{
+	struct hpack *hp = arg;
+
+	list_flush(&hp->tbl);
+	mem_deref(hp->smb);
+}
+
+
+static void ent_destructor(void *arg)
+{
+	struct hpack_ent *ent = arg;
+
+	list_unlink(&ent->le);
+}
+
+
+static inline size_t ent_size(const struct pl *name, const struct pl *val)
+{
+	return 32 + name->l + val->l;
+}
+
+
+static void tbl_evict(struct hpack *hp, size_t max)
+{
+	while (hp->size > max && hp->tbl.tail) {
+
+		struct hpack_ent *ent = hp->tbl.tail->data;
+
+		hp->size -= ent_size(&ent->name, &ent->val);
+		mem_deref(ent);
+	}
+}
+
+
+static int tbl_add(struct hpack *hp, const struct pl *name,
+		   const struct pl *val)
+{
+	const size_t size = ent_size(name, val);
+	struct hpack_ent *ent;
+	char *p;
+
+	/* a larger entry empties the table */
+	if (size > hp->max) {
+		tbl_evict(hp, 0);
+		return 0;
+	}
+
+	ent = mem_zalloc(sizeof(*ent) + name->l + val->l, ent_destructor);
+	if (!ent)
+		return ENOMEM;
+
+	p = (char *)(ent + 1);
+
+	memcpy(p, name->p, name->l);
+	memcpy(p + name->l, val->p, val->l);
+
+	ent->name.p = p;
+	ent->name.l = name->l;
+	ent->val.p  = p + name->l;
+	ent->val.l  = val->l;
+
+	/* the name may be in an entry that is evicted */
+	tbl_evict(hp, hp->max - size);
+
+	list_prepend(&hp->tbl, &ent->le, ent);
+	hp->size += size;
+
+	return 0;
+}
+
+
+static int tbl_get(const struct hpack *hp, uint32_t idx, struct pl *name,
+		   struct pl *val)
+{
+	struct le *le;
+
+	if (!idx)
+		return EBADMSG;
+
+	if (idx <= HPACK_STATIC) {
+		pl_set_str(name, static_tbl[idx-1].name);
+		pl_set_str(val,  static_tbl[idx-1].val);
+		return 0;
+	}
+
+	idx -= HPACK_STATIC;
+
+	for (le = hp->tbl.head; le; le = le->next) {
+
+		const struct hpack_ent *ent = le->data;
+
+		if (--idx)
+			continue;
+
+		*name = ent->name;
+		*val  = ent->val;
+
+		return 0;
+	}
+
+	return EBADMSG;
+}
+
+
+static int int_decode(struct mbuf *mb, uint8_t prefix, uint32_t *vp)
+{
+	const uint32_t max = (1u << prefix) - 1;
+	uint32_t v, shift = 0;
+	uint8_t b;
+
+	if (!mbuf_get_left(mb))
+		return EBADMSG;
+
+	v = mbuf_read_u8(mb) & max;
+	if (v < max) {
+		*vp = v;
+		return 0;
+	}
+
+	do {
+		if (!mbuf_get_left(mb) || shift > 21)
+			return EBADMSG;
+
+		b = mbuf_read_u8(mb);
+		v += (uint32_t)(b & 0x7f) << shift;
+		shift += 7;
+
+	} while (b & 0x80);
+
+	*vp = v;
+
+	return 0;
+}
+
+
+static int huff_decode(struct mbuf *dst, const uint8_t *p, size_t len)
+{
+	unsigned node = 0, bits = 0;
+	bool ones = true;
+	size_t i;
+	int err;
+
+	for (i=0; i<len; i++) {
+
+		int b;
+
+		for (b=7; b>=0; b--) {
+
+			const unsigned bit = (p[i] >> b) & 1;
+			const int next = huff_tree[node][bit];
+
+			++bits;
+			ones = ones && bit;
+
+			if (next > 0) {
+				node = next;
+				continue;
+			}
+
+			/* EOS must not be decoded */
+			if (next == -257)
+				return EBADMSG;
+
+			err = mbuf_write_u8(dst, (uint8_t)(-next - 1));
+			if (err)
+				return err;
+
+			node = 0;
+			bits = 0;
+			ones = true;
+		}
+	}
+
+	/* padding is the start of EOS, shorter than a byte */
+	if (bits > 7 || !ones)
+		return EBADMSG;
+
+	return 0;
+}
+
+
+static int str_decode(struct hpack *hp, struct mbuf *mb, size_t *offp,
+		      size_t *lenp)
+{
+	const size_t start = hp->smb->end;
+	uint32_t len;
+	bool huff;
+	int err;
+
+	if (!mbuf_get_left(mb))
+		return EBADMSG;
+
+	huff = (mbuf_buf(mb)[0] & 0x80) != 0;
+
+	err = int_decode(mb, 7, &len);
+	if (err)
+		return err;
+
+	if (len > mbuf_get_left(mb) || len > HPACK_STRMAX)
+		return EBADMSG;
+
+	hp->smb->pos = hp->smb->end;
+
+	if (huff)
+		err = huff_decode(hp->smb, mbuf_buf(mb), len);
+	else
+		err = mbuf_write_mem(hp->smb, mbuf_buf(mb), len);
+	if (err)
+		return err;
+
+	mb->pos += len;
+
+	*offp = start;
+	*lenp = hp->smb->end - start;
+
+	return 0;
+}
+
+
+/**
+ * Allocate an HPACK decoder
+ *
+ * @param hpp Pointer to allocated HPACK decoder
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int hpack_alloc(struct hpack **hpp)
+{
+	struct hpack *hp;
+
+	if (!hpp)
+		return EINVAL;
+
+	hp = mem_zalloc(sizeof(*hp), destructor);
+	if (!hp)
+		return ENOMEM;
+
+	hp->smb = mbuf_alloc(512);
+	if (!hp->smb) {
+		mem_deref(hp);
+		return ENOMEM;
+	}
+
+	hp->max = HPACK_TBLSIZE;
+
+	*hpp = hp;
+
+	return 0;
+}
+
+
+/**
+ * Decode an HPACK header block. The name and value given to the header
+ * handler are only valid during the call.
+ *
+ * @param hp   HPACK decoder
+ * @param mb   Header block from mb->pos to mb->end
+ * @param hdrh Header field handler
+ * @param arg  Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int hpack_decode(struct hpack *hp, struct mbuf *mb, hpack_hdr_h *hdrh,
+		 void *arg)
+{
+	int err = 0;
+
+	if (!hp || !mb || !hdrh)
+		return EINVAL;
+
+	while (mbuf_get_left(mb)) {
+
+		const uint8_t b = mbuf_buf(mb)[0];
+		size_t noff = 0, nlen = 0, voff, vlen;
+		struct pl name, val;
+		uint32_t idx;
+		bool add = false;
+
+		mbuf_rewind(hp->smb);
+
+		if (b & 0x80) {
+
+			/* indexed header field */
+			err = int_decode(mb, 7, &idx);
+			if (!err)
+				err = tbl_get(hp, idx, &name, &val);
+			if (err)
+				return err;
+
+			err = hdrh(&name, &val, arg);
+			if (err)
+				return err;
+
+			continue;
+		}
+		else if ((b & 0xe0) == 0x20) {
+
+			/* dynamic table size update */
+			err = int_decode(mb, 5, &idx);
+			if (err)
+				return err;
+
+			if (idx > HPACK_TBLSIZE)
+				return EBADMSG;
+
+			hp->max = idx;
+			tbl_evict(hp, hp->max);
+
+			continue;
+		}
+
+		/* literal, with incremental indexing or not */
+		if (b & 0x40) {
+			add = true;
+			err = int_decode(mb, 6, &idx);
+		}
+		else {
+			err = int_decode(mb, 4, &idx);
+		}
+		if (err)
+			return err;
+
+		if (idx)
+			err = tbl_get(hp, idx, &name, &val);
+		else
+			err = str_decode(hp, mb, &noff, &nlen);
+		if (err)
+			return err;
+
+		err = str_decode(hp, mb, &voff, &vlen);
+		if (err)
+			return err;
+
+		/* the buffer does not move any more */
+		if (!idx) {
+			name.p = (const char *)hp->smb->buf + noff;
+			name.l = nlen;
+		}
+
+		val.p = (const char *)hp->smb->buf + voff;
+		val.l = vlen;
+
+		err = hdrh(&name, &val, arg);
+		if (err)
+			return err;
+
+		if (add) {
+			err = tbl_add(hp, &name, &val);
+			if (err)
+				return err;
+		}
+	}
+
+	return err;
+}
+
+
+static int int_encode(struct mbuf *mb, uint8_t first, uint8_t prefix,
+		      uint32_t v)
+{
+	const uint32_t max = (1u << prefix) - 1;
+	int err;
+
+	if (v < max)
+		return mbuf_write_u8(mb, first | (uint8_t)v);
+
+	err = mbuf_write_u8(mb, first | (uint8_t)max);
+	v -= max;
+
+	while (v >= 0x80) {
+		err |= mbuf_write_u8(mb, (uint8_t)(0x80 | (v & 0x7f)));
+		v >>= 7;
+	}
+
+	err |= mbuf_write_u8(mb, (uint8_t)v);
+
+	return err;
+}
+
+
+/**
+ * Encode a header field with HPACK. The name is encoded in lower case.
+ *
+ * @param mb   Buffer to encode into
+ * @param name Header name
+ * @param val  Header value
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int hpack_encode(struct mbuf *mb, const struct pl *name,
+		 const struct pl *val)
+{
+	uint32_t i, idx = 0;
+	int err;
+
+	if (!mb || !name || !val)
+		return EINVAL;
+
+	for (i=0; i<HPACK_STATIC; i++) {
+
+		if (pl_strcasecmp(name, static_tbl[i].name))
+			continue;
+
+		if (!pl_strcmp(val, static_tbl[i].val))
+			return int_encode(mb, 0x80, 7, i + 1);
+
+		if (!idx)
+			idx = i + 1;
+	}
+
+	/* literal header field without indexing */
+	err = int_encode(mb, 0x00, 4, idx);
+
+	if (!idx) {
+		size_t j;
+
+		err |= int_encode(mb, 0x00, 7, (uint32_t)name->l);
+
+		for (j=0; j<name->l; j++)
+			err |= mbuf_write_u8(mb, (uint8_t)tolower(name->p[j]));
+	}
+
+	err |= int_encode(mb, 0x00, 7, (uint32_t)val->l);
+	err |= mbuf_write_mem(mb, (const uint8_t *)val->p, val->l);
+
+	return err;
+}
@@ -14,4 +14,50 @@ struct http_chunk {
 };
 
 
+struct tcp_conn;
+
 int http_chunk_decode(struct http_chunk *chunk, struct mbuf *mb, size_t *size);
+int http_chunk_send(struct tcp_conn *tc, const uint8_t *buf, size_t len);
+
+
+/* HPACK */
+struct hpack;
+
+typedef int (hpack_hdr_h)(const struct pl *name, const struct pl *val,
+			  void *arg);
+
+int hpack_alloc(struct hpack **hpp);
+int hpack_decode(struct hpack *hp, struct mbuf *mb, hpack_hdr_h *hdrh,
+		 void *arg);
+int hpack_encode(struct mbuf *mb, const struct pl *name,
+		 const struct pl *val);
+
+
+/* HTTP/2 */
+#define H2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+
+struct h2_sess;
+struct h2_strm;
+
+typedef int  (h2_strm_h)(struct h2_strm *strm, void *arg);
+typedef void (h2_head_h)(struct mbuf *mb, bool end, void *arg);
+typedef void (h2_data_h)(const uint8_t *buf, size_t len, bool end,
+			 void *arg);
+typedef void (h2_send_h)(void *arg);
+typedef void (h2_close_h)(int err, void *arg);
+
+int  h2_sess_alloc(struct h2_sess **sessp, struct tcp_conn *tc, bool secure,
+		   bool server, h2_strm_h *strmh, void *arg);
+int  h2_sess_recv(struct h2_sess *sess, struct mbuf *mb);
+void h2_sess_close(struct h2_sess *sess, int err);
+bool h2_sess_avail(const struct h2_sess *sess);
+uint32_t h2_sess_nstrm(const struct h2_sess *sess);
+
+int  h2_strm_alloc(struct h2_strm **strmp, struct h2_sess *sess);
+void h2_strm_set_handlers(struct h2_strm *strm, h2_head_h *headh,
+			  h2_data_h *datah, h2_send_h *sendh,
+			  h2_close_h *closeh, void *arg);
+int  h2_strm_send_msg(struct h2_strm *strm, struct mbuf *mb, bool end);
+int  h2_strm_send_data(struct h2_strm *strm, const uint8_t *buf, size_t len,
+		       bool end);
+size_t h2_strm_txlen(const struct h2_strm *strm);
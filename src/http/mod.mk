@@ -7,5 +7,8 @@
 SRCS	+= http/auth.c
 SRCS	+= http/chunk.c
 SRCS	+= http/client.c
+SRCS	+= http/h2.c
+SRCS	+= http/hpack.c
 SRCS	+= http/msg.c
+SRCS	+= http/route.c
 SRCS	+= http/server.c
@@ -3,6 +3,12 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 #include <re_types.h>
 #include <re_mem.h>
 #include <re_mbuf.h>
@@ -15,25 +21,310 @@
 
 
 enum {
+	HDR_KNOWN     = 53,
+	HDR_BLOCK     = 32,
 	STARTLINE_MAX = 8192,
 };
 
 
-static void hdr_destructor(void *arg)
+/*
+ * The headers of a message are stored in blocks that belong to the
+ * message, and are kept in one list per known header ID, as for SIP.
+ * Index zero holds the headers with unknown IDs.
+ */
+
+
+/** Block of HTTP Headers */
+struct hdr_block {
+	struct hdr_block *next;          /**< Next block                    */
+	uint32_t n;                      /**< Number of headers in use      */
+	struct http_hdr hdrv[HDR_BLOCK]; /**< HTTP Headers                  */
+};
+
+/** HTTP Message with header storage */
+struct msg {
+	struct http_msg msg;             /**< HTTP Message, must be first   */
+	struct list hdrv[HDR_KNOWN];     /**< HTTP Headers by index         */
+	struct hdr_block blk;            /**< First block of headers        */
+	struct hdr_block *blkl;          /**< Other blocks, newest first    */
+};
+
+
+/** Index of the known HTTP Header IDs in the header table */
+static const uint8_t hdr_index[0x1000] = {
+	[HTTP_HDR_ACCEPT]                   =   1,
+	[HTTP_HDR_ACCEPT_CHARSET]           =   2,
+	[HTTP_HDR_ACCEPT_ENCODING]          =   3,
+	[HTTP_HDR_ACCEPT_LANGUAGE]          =   4,
+	[HTTP_HDR_ACCEPT_RANGES]            =   5,
+	[HTTP_HDR_AGE]                      =   6,
+	[HTTP_HDR_ALLOW]                    =   7,
+	[HTTP_HDR_AUTHORIZATION]            =   8,
+	[HTTP_HDR_CACHE_CONTROL]            =   9,
+	[HTTP_HDR_CONNECTION]               =  10,
+	[HTTP_HDR_CONTENT_ENCODING]         =  11,
+	[HTTP_HDR_CONTENT_LANGUAGE]         =  12,
+	[HTTP_HDR_CONTENT_LENGTH]           =  13,
+	[HTTP_HDR_CONTENT_LOCATION]         =  14,
+	[HTTP_HDR_CONTENT_MD5]              =  15,
+	[HTTP_HDR_CONTENT_RANGE]            =  16,
+	[HTTP_HDR_CONTENT_TYPE]             =  17,
+	[HTTP_HDR_DATE]                     =  18,
+	[HTTP_HDR_ETAG]                     =  19,
+	[HTTP_HDR_EXPECT]                   =  20,
+	[HTTP_HDR_EXPIRES]                  =  21,
+	[HTTP_HDR_FROM]                     =  22,
+	[HTTP_HDR_HOST]                     =  23,
+	[HTTP_HDR_IF_MATCH]                 =  24,
+	[HTTP_HDR_IF_MODIFIED_SINCE]        =  25,
+	[HTTP_HDR_IF_NONE_MATCH]            =  26,
+	[HTTP_HDR_IF_RANGE]                 =  27,
+	[HTTP_HDR_IF_UNMODIFIED_SINCE]      =  28,
+	[HTTP_HDR_LAST_MODIFIED]            =  29,
+	[HTTP_HDR_LOCATION]                 =  30,
+	[HTTP_HDR_MAX_FORWARDS]             =  31,
+	[HTTP_HDR_PRAGMA]                   =  32,
+	[HTTP_HDR_PROXY_AUTHENTICATE]       =  33,
+	[HTTP_HDR_PROXY_AUTHORIZATION]      =  34,
+	[HTTP_HDR_RANGE]                    =  35,
+	[HTTP_HDR_REFERER]                  =  36,
+	[HTTP_HDR_RETRY_AFTER]              =  37,
+	[HTTP_HDR_SEC_WEBSOCKET_ACCEPT]     =  38,
+	[HTTP_HDR_SEC_WEBSOCKET_EXTENSIONS] =  39,
+	[HTTP_HDR_SEC_WEBSOCKET_KEY]        =  40,
+	[HTTP_HDR_SEC_WEBSOCKET_PROTOCOL]   =  41,
+	[HTTP_HDR_SEC_WEBSOCKET_VERSION]    =  42,
+	[HTTP_HDR_SERVER]                   =  43,
+	[HTTP_HDR_TE]                       =  44,
+	[HTTP_HDR_TRAILER]                  =  45,
+	[HTTP_HDR_TRANSFER_ENCODING]        =  46,
+	[HTTP_HDR_UPGRADE]                  =  47,
+	[HTTP_HDR_USER_AGENT]               =  48,
+	[HTTP_HDR_VARY]                     =  49,
+	[HTTP_HDR_VIA]                      =  50,
+	[HTTP_HDR_WARNING]                  =  51,
+	[HTTP_HDR_WWW_AUTHENTICATE]         =  52,
+};
+
+
+/** Is c a byte that the header decoder must look at? */
+static inline bool hdr_special(char c)
 {
-	struct http_hdr *hdr = arg;
+	return (uint8_t)c <= ' ' || c == ':' || c == ',' || c == '"';
+}
+
 
-	list_unlink(&hdr->le);
+/* Length of the run of bytes that the header decoder can skip */
+static inline size_t hdr_run(const char *p, size_t l)
+{
+	size_t n = 0;
+
+#if defined(__SSE2__)
+	const __m128i sp = _mm_set1_epi8(' ');
+	const __m128i co = _mm_set1_epi8(':');
+	const __m128i cm = _mm_set1_epi8(',');
+	const __m128i qu = _mm_set1_epi8('"');
+
+	for (; n + 16 <= l; n += 16) {
+
+		const __m128i x = _mm_loadu_si128((const __m128i *)(p + n));
+		__m128i m;
+		int mask;
+
+		m = _mm_cmpeq_epi8(_mm_min_epu8(x, sp), x);
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(x, co));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(x, cm));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(x, qu));
+
+		mask = _mm_movemask_epi8(m);
+		if (mask)
+			return n + __builtin_ctz((unsigned)mask);
+	}
+#elif defined(__ARM_NEON)
+	const uint8x16_t sp = vdupq_n_u8(' ');
+	const uint8x16_t co = vdupq_n_u8(':');
+	const uint8x16_t cm = vdupq_n_u8(',');
+	const uint8x16_t qu = vdupq_n_u8('"');
+
+	for (; n + 16 <= l; n += 16) {
+
+		const uint8x16_t x = vld1q_u8((const uint8_t *)(p + n));
+		uint8x16_t m;
+		uint64_t mask;
+
+		m = vcleq_u8(x, sp);
+		m = vorrq_u8(m, vceqq_u8(x, co));
+		m = vorrq_u8(m, vceqq_u8(x, cm));
+		m = vorrq_u8(m, vceqq_u8(x, qu));
+
+		/* one nibble per byte */
+		mask = vget_lane_u64(vreinterpret_u64_u8(
+			     vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+		if (mask)
+			return n + __builtin_ctzll(mask) / 4;
+	}
+#endif
+
+	for (; n < l; n++) {
+		if (hdr_special(p[n]))
+			break;
+	}
+
+	return n;
+}
+
+
+static inline bool is_digit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+
+static inline bool is_alpha(char c)
+{
+	return (c | 0x20) >= 'a' && (c | 0x20) <= 'z';
+}
+
+
+/* Length of the run of [0-9.] at the start of p */
+static inline size_t span_ver(const char *p, const char *end)
+{
+	const char *q = p;
+
+	while (q < end && (is_digit(*q) || *q == '.'))
+		++q;
+
+	return q - p;
+}
+
+
+static inline bool is_http(const char *p, const char *end)
+{
+	return end - p >= 5 &&
+		(p[0] | 0x20) == 'h' && (p[1] | 0x20) == 't' &&
+		(p[2] | 0x20) == 't' && (p[3] | 0x20) == 'p' && p[4] == '/';
+}
+
+
+/*
+ * Decode a request line:
+ *
+ *   "[a-z]+ [^? ]+[^ ]* HTTP/[0-9.]+"
+ */
+static int reqline_decode(struct http_msg *msg, const char *p, size_t l)
+{
+	const char *end = p + l, *q = p;
+
+	while (q < end && is_alpha(*q))
+		++q;
+
+	msg->met.p = p;
+	msg->met.l = q - p;
+	if (!msg->met.l || q == end || *q != ' ')
+		return EBADMSG;
+
+	msg->path.p = ++q;
+	while (q < end && *q != '?' && *q != ' ')
+		++q;
+	msg->path.l = q - msg->path.p;
+	if (!msg->path.l)
+		return EBADMSG;
+
+	msg->prm.p = q;
+	while (q < end && *q != ' ')
+		++q;
+	msg->prm.l = q - msg->prm.p;
+
+	if (q == end || !is_http(q + 1, end))
+		return EBADMSG;
+
+	msg->ver.p = q + 6;
+	msg->ver.l = span_ver(msg->ver.p, end);
+
+	return msg->ver.l ? 0 : EBADMSG;
+}
+
+
+/*
+ * Decode a status line:
+ *
+ *   "HTTP/[0-9.]+ [0-9]+[ ]*[^]*"
+ */
+static int statusline_decode(struct http_msg *msg, const char *p, size_t l)
+{
+	const char *end = p + l, *q;
+	uint32_t scode = 0;
+
+	if (!is_http(p, end))
+		return EBADMSG;
+
+	msg->ver.p = p + 5;
+	msg->ver.l = span_ver(msg->ver.p, end);
+	q = msg->ver.p + msg->ver.l;
+	if (!msg->ver.l || q == end || *q != ' ')
+		return EBADMSG;
+
+	if (++q == end || !is_digit(*q))
+		return EBADMSG;
+
+	while (q < end && is_digit(*q))
+		scode = scode * 10 + (*q++ - '0');
+
+	while (q < end && *q == ' ')
+		++q;
+
+	msg->scode    = scode;
+	msg->reason.p = q;
+	msg->reason.l = end - q;
+
+	return 0;
 }
 
 
 static void destructor(void *arg)
 {
-	struct http_msg *msg = arg;
+	struct msg *m = arg;
+
+	while (m->blkl) {
+		struct hdr_block *blk = m->blkl;
+
+		m->blkl = blk->next;
+		mem_deref(blk);
+	}
+
+	mem_deref(m->msg._mb);
+	mem_deref(m->msg.mb);
+}
+
+
+static inline struct list *hdr_list(const struct http_msg *msg,
+				    enum http_hdrid id)
+{
+	struct msg *m = (struct msg *)msg;
 
-	list_flush(&msg->hdrl);
-	mem_deref(msg->_mb);
-	mem_deref(msg->mb);
+	if ((unsigned)id >= ARRAY_SIZE(hdr_index))
+		return &m->hdrv[0];
+
+	return &m->hdrv[hdr_index[id]];
+}
+
+
+static struct http_hdr *hdr_alloc(struct http_msg *msg)
+{
+	struct msg *m = (struct msg *)msg;
+	struct hdr_block *blk = m->blkl ? m->blkl : &m->blk;
+
+	if (blk->n >= HDR_BLOCK) {
+
+		blk = mem_zalloc(sizeof(*blk), NULL);
+		if (!blk)
+			return NULL;
+
+		blk->next = m->blkl;
+		m->blkl = blk;
+	}
+
+	return &blk->hdrv[blk->n++];
 }
 
 
@@ -98,7 +389,7 @@ static inline int hdr_add(struct http_msg *msg, const struct pl *name,
 	struct http_hdr *hdr;
 	int err = 0;
 
-	hdr = mem_zalloc(sizeof(*hdr), hdr_destructor);
+	hdr = hdr_alloc(msg);
 	if (!hdr)
 		return ENOMEM;
 
@@ -107,6 +398,7 @@ static inline int hdr_add(struct http_msg *msg, const struct pl *name,
 	hdr->val.l = MAX(l, 0);
 	hdr->id    = id;
 
+	list_append(hdr_list(msg, id), &hdr->he, hdr);
 	list_append(&msg->hdrl, &hdr->le, hdr);
 
 	/* parse common headers */
@@ -124,9 +416,6 @@ static inline int hdr_add(struct http_msg *msg, const struct pl *name,
 		break;
 	}
 
-	if (err)
-		mem_deref(hdr);
-
 	return err;
 }
 
@@ -142,13 +431,13 @@ static inline int hdr_add(struct http_msg *msg, const struct pl *name,
  */
 int http_msg_decode(struct http_msg **msgp, struct mbuf *mb, bool req)
 {
-	struct pl b, s, e, name, scode;
-	const char *p, *cv;
+	const char *p, *cv, *s, *e, *lf;
 	struct http_msg *msg;
+	struct pl name;
 	bool comsep, quote;
 	enum http_hdrid id = HTTP_HDR_NONE;
-	uint32_t ws, lf;
-	size_t l;
+	uint32_t ws, lf_n;
+	size_t l, n;
 	int err;
 
 	if (!msgp || !mb)
@@ -157,10 +446,21 @@ int http_msg_decode(struct http_msg **msgp, struct mbuf *mb, bool req)
 	p = (const char *)mbuf_buf(mb);
 	l = mbuf_get_left(mb);
 
-	if (re_regex(p, l, "[\r\n]*[^\r\n]+[\r]*[\n]1", &b, &s, NULL, &e))
+	/* empty lines before the start-line are skipped */
+	for (s = p; s < p + l && (*s == '\r' || *s == '\n'); s++)
+		;
+
+	lf = memchr(s, '\n', p + l - s);
+	if (!lf)
 		return (l > STARTLINE_MAX) ? EBADMSG : ENODATA;
 
-	msg = mem_zalloc(sizeof(*msg), destructor);
+	for (e = lf; e > s && e[-1] == '\r'; e--)
+		;
+
+	if (e == s || memchr(s, '\r', e - s))
+		return EBADMSG;
+
+	msg = mem_zalloc(sizeof(struct msg), destructor);
 	if (!msg)
 		return ENOMEM;
 
@@ -172,30 +472,18 @@ int http_msg_decode(struct http_msg **msgp, struct mbuf *mb, bool req)
 		goto out;
 	}
 
-	if (req) {
-		if (re_regex(s.p, s.l, "[a-z]+ [^? ]+[^ ]* HTTP/[0-9.]+",
-			     &msg->met, &msg->path, &msg->prm, &msg->ver) ||
-		    msg->met.p != s.p) {
-			err = EBADMSG;
-			goto out;
-		}
-	}
-	else {
-		if (re_regex(s.p, s.l, "HTTP/[0-9.]+ [0-9]+[ ]*[^]*",
-			     &msg->ver, &scode, NULL, &msg->reason) ||
-		    msg->ver.p != s.p + 5) {
-			err = EBADMSG;
-			goto out;
-		}
-
-		msg->scode = pl_u32(&scode);
-	}
+	if (req)
+		err = reqline_decode(msg, s, e - s);
+	else
+		err = statusline_decode(msg, s, e - s);
+	if (err)
+		goto out;
 
-	l -= e.p + e.l - p;
-	p = e.p + e.l;
+	l -= lf + 1 - p;
+	p = lf + 1;
 
 	name.p = cv = NULL;
-	name.l = ws = lf = 0;
+	name.l = ws = lf_n = 0;
 	comsep = false;
 	quote = false;
 
@@ -205,7 +493,7 @@ int http_msg_decode(struct http_msg **msgp, struct mbuf *mb, bool req)
 
 		case ' ':
 		case '\t':
-			lf = 0; /* folding */
+			lf_n = 0; /* folding */
 			++ws;
 			break;
 
@@ -222,7 +510,7 @@ int http_msg_decode(struct http_msg **msgp, struct mbuf *mb, bool req)
 				goto out;
 			}
 
-			if (!lf++)
+			if (!lf_n++)
 				break;
 
 			++p; --l; /* eoh */
@@ -230,7 +518,7 @@ int http_msg_decode(struct http_msg **msgp, struct mbuf *mb, bool req)
 			/*@fallthrough@*/
 
 		default:
-			if (lf || (*p == ',' && comsep && !quote)) {
+			if (lf_n || (*p == ',' && comsep && !quote)) {
 
 				if (!name.l) {
 					err = EBADMSG;
@@ -242,12 +530,12 @@ int http_msg_decode(struct http_msg **msgp, struct mbuf *mb, bool req)
 				if (err)
 					goto out;
 
-				if (!lf) { /* comma separated */
+				if (!lf_n) { /* comma separated */
 					cv = NULL;
 					break;
 				}
 
-				if (lf > 1) { /* eoh */
+				if (lf_n > 1) { /* eoh */
 					err = 0;
 					goto out;
 				}
@@ -255,7 +543,7 @@ int http_msg_decode(struct http_msg **msgp, struct mbuf *mb, bool req)
 				comsep = false;
 				name.p = NULL;
 				cv = NULL;
-				lf = 0;
+				lf_n = 0;
 			}
 
 			if (!name.p) {
@@ -267,6 +555,9 @@ int http_msg_decode(struct http_msg **msgp, struct mbuf *mb, bool req)
 			if (!name.l) {
 				if (*p != ':') {
 					ws = 0;
+					n = hdr_run(p + 1, l - 1);
+					p += n;
+					l -= n;
 					break;
 				}
 
@@ -290,6 +581,9 @@ int http_msg_decode(struct http_msg **msgp, struct mbuf *mb, bool req)
 				quote = !quote;
 
 			ws = 0;
+			n = hdr_run(p + 1, l - 1);
+			p += n;
+			l -= n;
 			break;
 		}
 	}
@@ -338,12 +632,15 @@ const struct http_hdr *http_msg_hdr_apply(const struct http_msg *msg,
 					  bool fwd, enum http_hdrid id,
 					  http_hdr_h *h, void *arg)
 {
+	struct list *lst;
 	struct le *le;
 
 	if (!msg)
 		return NULL;
 
-	le = fwd ? msg->hdrl.head : msg->hdrl.tail;
+	lst = hdr_list(msg, id);
+
+	le = fwd ? list_head(lst) : list_tail(lst);
 
 	while (le) {
 		const struct http_hdr *hdr = le->data;
@@ -391,6 +688,7 @@ const struct http_hdr *http_msg_xhdr_apply(const struct http_msg *msg,
 					   bool fwd, const char *name,
 					   http_hdr_h *h, void *arg)
 {
+	struct list *lst;
 	struct le *le;
 	struct pl pl;
 
@@ -399,7 +697,9 @@ const struct http_hdr *http_msg_xhdr_apply(const struct http_msg *msg,
 
 	pl_set_str(&pl, name);
 
-	le = fwd ? msg->hdrl.head : msg->hdrl.tail;
+	lst = hdr_list(msg, hdr_hash(&pl));
+
+	le = fwd ? list_head(lst) : list_tail(lst);
 
 	while (le) {
 		const struct http_hdr *hdr = le->data;
@@ -0,0 +1,498 @@
+/**
+ * @file http/route.c  HTTP request router
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re_types.h>
+#include <re_mem.h>
+#include <re_mbuf.h>
+#include <re_sa.h>
+#include <re_list.h>
+#include <re_fmt.h>
+#include <re_msg.h>
+#include <re_http.h>
+
+
+/*
+ * The paths of the routes are kept in a compressed radix trie. A node has
+ * a label of static bytes, the static child nodes, each with a different
+ * first byte, and one child for a parameter segment, which matches up to
+ * the next '/'. Static children are tried before the parameter child, so
+ * "/users/me" wins over "/users/:id". The names of the parameters belong
+ * to the routes, and the routes of a path are kept in the node where it
+ * ends, one per method.
+ */
+
+
+/** Node of the route trie */
+struct node {
+	struct le le;            /**< Member of the parent childl     */
+	struct list childl;      /**< Static children                 */
+	struct node *prm;        /**< Parameter child, or NULL        */
+	struct list routel;      /**< Routes that end here            */
+	char *label;             /**< Static bytes of the node        */
+	size_t len;              /**< Length of label                 */
+};
+
+/** HTTP route */
+struct route {
+	struct le le;            /**< Member of the node routel       */
+	char *met;               /**< Method, NULL for any method     */
+	char *path;              /**< Path, the names point into it   */
+	struct pl namev[HTTP_ROUTE_PARAMS_MAX];
+	uint32_t n;              /**< Number of parameters            */
+	http_route_h *h;
+	void *arg;
+};
+
+/** HTTP request router */
+struct http_router {
+	struct node *root;
+	http_req_h *defh;        /**< Handler of unrouted requests    */
+	void *arg;
+};
+
+
+static void node_destructor(void *arg)
+{
+	struct node *n = arg;
+
+	list_flush(&n->childl);
+	list_flush(&n->routel);
+	mem_deref(n->prm);
+	mem_deref(n->label);
+}
+
+
+static void route_destructor(void *arg)
+{
+	struct route *rt = arg;
+
+	mem_deref(rt->met);
+	mem_deref(rt->path);
+}
+
+
+static void router_destructor(void *arg)
+{
+	struct http_router *r = arg;
+
+	mem_deref(r->root);
+}
+
+
+static struct node *node_alloc(const char *label, size_t len)
+{
+	struct node *n;
+
+	n = mem_zalloc(sizeof(*n), node_destructor);
+	if (!n)
+		return NULL;
+
+	if (len) {
+		n->label = mem_alloc(len, NULL);
+		if (!n->label)
+			return mem_deref(n);
+
+		memcpy(n->label, label, len);
+		n->len = len;
+	}
+
+	return n;
+}
+
+
+static struct node *child_find(const struct node *n, char c)
+{
+	struct le *le;
+
+	for (le = n->childl.head; le; le = le->next) {
+
+		struct node *child = le->data;
+
+		if (child->label[0] == c)
+			return child;
+	}
+
+	return NULL;
+}
+
+
+/* Split a node after k bytes of its label; n keeps the rest */
+static struct node *node_split(struct node *parent, struct node *n, size_t k)
+{
+	struct node *mid;
+
+	mid = node_alloc(n->label, k);
+	if (!mid)
+		return NULL;
+
+	memmove(n->label, n->label + k, n->len - k);
+	n->len -= k;
+
+	list_insert_after(&parent->childl, &n->le, &mid->le, mid);
+	list_unlink(&n->le);
+	list_append(&mid->childl, &n->le, n);
+
+	return mid;
+}
+
+
+/* Add the static bytes p to the trie below n, returns the node of the end */
+static struct node *static_add(struct node *n, const char *p, size_t l)
+{
+	while (l) {
+
+		struct node *child = child_find(n, *p);
+		size_t k = 0;
+
+		if (!child) {
+			child = node_alloc(p, l);
+			if (!child)
+				return NULL;
+
+			list_append(&n->childl, &child->le, child);
+
+			return child;
+		}
+
+		while (k < child->len && k < l && child->label[k] == p[k])
+			++k;
+
+		if (k < child->len) {
+			child = node_split(n, child, k);
+			if (!child)
+				return NULL;
+		}
+
+		n  = child;
+		p += k;
+		l -= k;
+	}
+
+	return n;
+}
+
+
+/* A route of the method wins over a route of any method */
+static struct route *route_find(const struct node *n, const struct pl *met)
+{
+	struct route *any = NULL;
+	struct le *le;
+
+	for (le = n->routel.head; le; le = le->next) {
+
+		struct route *rt = le->data;
+
+		if (!rt->met)
+			any = rt;
+		else if (0 == pl_strcasecmp(met, rt->met))
+			return rt;
+	}
+
+	return any;
+}
+
+
+static bool route_exists(const struct node *n, const char *met)
+{
+	struct le *le;
+
+	for (le = n->routel.head; le; le = le->next) {
+
+		const struct route *rt = le->data;
+
+		if (!rt->met && !met)
+			return true;
+
+		if (rt->met && met && !str_casecmp(rt->met, met))
+			return true;
+	}
+
+	return false;
+}
+
+
+/*
+ * Find the route of a path below n, with the values of the parameters.
+ * A path that matches with another method sets *path.
+ */
+static struct route *node_match(const struct node *n, const char *p,
+				size_t l, const struct pl *met,
+				struct pl *valv, uint32_t depth, bool *path)
+{
+	const struct node *child;
+	struct route *rt;
+	size_t k;
+
+	if (!l) {
+		if (n->routel.head)
+			*path = true;
+
+		return route_find(n, met);
+	}
+
+	child = child_find(n, *p);
+	if (child && child->len <= l &&
+	    !memcmp(child->label, p, child->len)) {
+
+		rt = node_match(child, p + child->len, l - child->len, met,
+				valv, depth, path);
+		if (rt)
+			return rt;
+	}
+
+	if (!n->prm || depth >= HTTP_ROUTE_PARAMS_MAX)
+		return NULL;
+
+	for (k = 0; k < l && p[k] != '/'; k++)
+		;
+
+	if (!k)
+		return NULL;
+
+	valv[depth].p = p;
+	valv[depth].l = k;
+
+	return node_match(n->prm, p + k, l - k, met, valv, depth + 1, path);
+}
+
+
+/**
+ * Allocate an HTTP request router. Its handler http_router_handler() is
+ * given to http_listen() with the router as argument, and calls the
+ * handler of the route of each request.
+ *
+ * @param rp   Pointer to allocated router
+ * @param defh Handler of requests without a route, NULL to reply with
+ *             404 Not Found or 405 Method Not Allowed
+ * @param arg  Handler argument of defh
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int http_router_alloc(struct http_router **rp, http_req_h *defh, void *arg)
+{
+	struct http_router *r;
+
+	if (!rp)
+		return EINVAL;
+
+	r = mem_zalloc(sizeof(*r), router_destructor);
+	if (!r)
+		return ENOMEM;
+
+	r->root = node_alloc(NULL, 0);
+	if (!r->root) {
+		mem_deref(r);
+		return ENOMEM;
+	}
+
+	r->defh = defh;
+	r->arg  = arg;
+
+	*rp = r;
+
+	return 0;
+}
+
+
+/**
+ * Add a route to an HTTP request router. A segment of the path that
+ * starts with ':' is a parameter, which matches one segment of a
+ * request path, e.g. "/users/:id/posts/:post". Static segments take
+ * precedence over parameters.
+ *
+ * @param r    HTTP request router
+ * @param met  Request method, NULL for any method
+ * @param path Path of the route, starting with '/'
+ * @param h    Route handler
+ * @param arg  Handler argument
+ *
+ * @return 0 if success, EADDRINUSE if the route exists, otherwise
+ *         errorcode
+ */
+int http_router_add(struct http_router *r, const char *met, const char *path,
+		    http_route_h *h, void *arg)
+{
+	struct node *n;
+	struct route *rt;
+	const char *p, *q;
+	int err;
+
+	if (!r || !path || *path != '/' || !h)
+		return EINVAL;
+
+	rt = mem_zalloc(sizeof(*rt), route_destructor);
+	if (!rt)
+		return ENOMEM;
+
+	rt->h   = h;
+	rt->arg = arg;
+
+	err = str_dup(&rt->path, path);
+	if (err)
+		goto out;
+
+	if (met) {
+		err = str_dup(&rt->met, met);
+		if (err)
+			goto out;
+	}
+
+	n = r->root;
+	p = rt->path;
+
+	while (*p) {
+
+		q = strchr(p, ':');
+		if (!q)
+			q = p + strlen(p);
+
+		n = static_add(n, p, q - p);
+		if (!n) {
+			err = ENOMEM;
+			goto out;
+		}
+
+		if (!*q)
+			break;
+
+		/* a parameter takes a whole segment */
+		if (q[-1] != '/' || rt->n >= HTTP_ROUTE_PARAMS_MAX) {
+			err = EINVAL;
+			goto out;
+		}
+
+		for (p = ++q; *p && *p != '/'; p++)
+			;
+
+		rt->namev[rt->n].p = q;
+		rt->namev[rt->n].l = p - q;
+		++rt->n;
+
+		if (q == p) {
+			err = EINVAL;
+			goto out;
+		}
+
+		if (!n->prm) {
+			n->prm = node_alloc(NULL, 0);
+			if (!n->prm) {
+				err = ENOMEM;
+				goto out;
+			}
+		}
+
+		n = n->prm;
+	}
+
+	if (route_exists(n, met)) {
+		err = EADDRINUSE;
+		goto out;
+	}
+
+	list_append(&n->routel, &rt->le, rt);
+
+ out:
+	if (err)
+		mem_deref(rt);
+
+	return err;
+}
+
+
+/**
+ * Call the handler of the route of an HTTP request. The values of the
+ * parameters point into the path of the request.
+ *
+ * @param r    HTTP request router
+ * @param conn HTTP connection
+ * @param msg  HTTP request
+ *
+ * @return 0 if routed, ENOENT if no route has the path, EPERM if the
+ *         routes of the path have other methods, otherwise errorcode
+ */
+int http_router_route(struct http_router *r, struct http_conn *conn,
+		      const struct http_msg *msg)
+{
+	struct http_route_params prm;
+	struct route *rt;
+	bool path = false;
+	uint32_t i;
+
+	if (!r || !msg)
+		return EINVAL;
+
+	rt = node_match(r->root, msg->path.p, msg->path.l, &msg->met,
+			prm.valv, 0, &path);
+	if (!rt)
+		return path ? EPERM : ENOENT;
+
+	for (i=0; i<rt->n; i++)
+		prm.namev[i] = rt->namev[i];
+
+	prm.n = rt->n;
+
+	rt->h(conn, msg, &prm, rt->arg);
+
+	return 0;
+}
+
+
+/**
+ * Request handler of an HTTP request router, for http_listen() with the
+ * router as argument
+ *
+ * @param conn HTTP connection
+ * @param msg  HTTP request
+ * @param arg  HTTP request router
+ */
+void http_router_handler(struct http_conn *conn, const struct http_msg *msg,
+			 void *arg)
+{
+	struct http_router *r = arg;
+	int err;
+
+	err = http_router_route(r, conn, msg);
+	if (!err)
+		return;
+
+	if (r->defh)
+		r->defh(conn, msg, r->arg);
+	else if (err == EPERM)
+		(void)http_ereply(conn, 405, "Method Not Allowed");
+	else
+		(void)http_ereply(conn, 404, "Not Found");
+}
+
+
+/**
+ * Find the value of a route parameter by name
+ *
+ * @param prm  Route parameters
+ * @param name Parameter name, without the ':'
+ * @param val  Returned value
+ *
+ * @return 0 if found, otherwise errorcode
+ */
+int http_route_param(const struct http_route_params *prm, const char *name,
+		     struct pl *val)
+{
+	uint32_t i;
+
+	if (!prm || !name || !val)
+		return EINVAL;
+
+	for (i=0; i<prm->n; i++) {
+
+		if (pl_strcmp(&prm->namev[i], name))
+			continue;
+
+		*val = prm->valv[i];
+
+		return 0;
+	}
+
+	return ENOENT;
+}
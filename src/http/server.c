@@ -3,7 +3,17 @@
  *
  * Copyright (C) 2011 Creytiv.com
  */
-
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <time.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_IO_H
+#include <io.h>
+#endif
+#include <string.h>
 #include <re_types.h>
 #include <re_mem.h>
 #include <re_mbuf.h>
@@ -16,12 +26,24 @@
 #include <re_tls.h>
 #include <re_msg.h>
 #include <re_http.h>
+#include <re_metric.h>
+#include "http.h"
+
+
+#ifdef WIN32
+#define open _open
+#define read _read
+#define close _close
+#define lseek _lseek
+#endif
 
 
 enum {
 	TIMEOUT_IDLE = 600000,
 	TIMEOUT_INIT = 10000,
 	BUFSIZE_MAX  = 524288,
+	FILE_CHUNK   = 65536,
+	FILE_SENDMAX = 1 << 30,
 };
 
 struct http_sock {
@@ -29,7 +51,13 @@ struct http_sock {
 	struct tcp_sock *ts;
 	struct tls *tls;
 	http_req_h *reqh;
+	http_body_h *bodyh;
 	void *arg;
+	char *hdrs;          /**< Headers added to every response  */
+	size_t hdrs_len;     /**< Length of the added headers      */
+	time_t date_t;       /**< Time of the formatted Date       */
+	char date[40];       /**< Formatted Date header line       */
+	bool h2;
 };
 
 struct http_conn {
@@ -40,10 +68,32 @@ struct http_conn {
 	struct tcp_conn *tc;
 	struct tls_conn *sc;
 	struct mbuf *mb;
+	struct http_msg *msg;
+	struct http_chunk chunk;
+	size_t rx_len;
+	bool chunked;
+	bool proto;         /**< Protocol was selected                  */
+	struct http_file *file;
+	struct h2_sess *h2; /**< HTTP/2 session of the connection       */
+	struct h2_strm *strm; /**< HTTP/2 stream of a request             */
+};
+
+/** A file that is being sent in a response */
+struct http_file {
+	struct mbuf *mb;    /**< Read buffer, if not sent by the kernel */
+	uint64_t off;       /**< Offset of the next byte to send        */
+	uint64_t left;      /**< Number of bytes left to send           */
+	int fd;             /**< File descriptor                        */
 };
 
 
 static void conn_close(struct http_conn *conn);
+static void req_process(struct http_conn *conn);
+
+
+#ifdef USE_TLS
+static const char *alpnv[] = {"h2", "http/1.1"};
+#endif
 
 
 static void sock_destructor(void *arg)
@@ -63,6 +113,7 @@ static void sock_destructor(void *arg)
 
 	mem_deref(sock->tls);
 	mem_deref(sock->ts);
+	mem_deref(sock->hdrs);
 }
 
 
@@ -72,9 +123,24 @@ static void conn_destructor(void *arg)
 
 	list_unlink(&conn->le);
 	tmr_cancel(&conn->tmr);
+	mem_deref(conn->strm);
+	mem_deref(conn->h2);
 	mem_deref(conn->sc);
 	mem_deref(conn->tc);
 	mem_deref(conn->mb);
+	mem_deref(conn->msg);
+	mem_deref(conn->file);
+}
+
+
+static void file_destructor(void *arg)
+{
+	struct http_file *file = arg;
+
+	mem_deref(file->mb);
+
+	if (file->fd >= 0)
+		(void)close(file->fd);
 }
 
 
@@ -82,8 +148,17 @@ static void conn_close(struct http_conn *conn)
 {
 	list_unlink(&conn->le);
 	tmr_cancel(&conn->tmr);
+
+	/* the streams are closed with the connection */
+	if (conn->h2) {
+		h2_sess_close(conn->h2, ECONNRESET);
+		conn->h2 = mem_deref(conn->h2);
+	}
+
+	conn->strm = mem_deref(conn->strm);
 	conn->sc = mem_deref(conn->sc);
 	conn->tc = mem_deref(conn->tc);
+	conn->file = mem_deref(conn->file);
 	conn->sock = NULL;
 }
 
@@ -97,98 +172,471 @@ static void timeout_handler(void *arg)
 }
 
 
-static void recv_handler(struct mbuf *mb, void *arg)
+static int req_start(struct http_conn *conn)
 {
-	struct http_conn *conn = arg;
-	int err = 0;
+	struct http_msg *msg = conn->msg;
 
-	if (conn->mb) {
+	if (http_msg_hdr_has_value(msg, HTTP_HDR_TRANSFER_ENCODING,
+				   "chunked"))
+		conn->chunked = true;
+	else
+		conn->rx_len = msg->clen;
 
-		const size_t len = mbuf_get_left(mb), pos = conn->mb->pos;
+	if (conn->sock->bodyh)
+		return 0;
 
-		if ((mbuf_get_left(conn->mb) + len) > BUFSIZE_MAX) {
-			err = EOVERFLOW;
-			goto out;
+	if (msg->clen > BUFSIZE_MAX)
+		return EOVERFLOW;
+
+	if (msg->clen > msg->mb->size)
+		return mbuf_resize(msg->mb, msg->clen);
+
+	return 0;
+}
+
+
+static int body_write_buf(struct http_conn *conn, const uint8_t *buf,
+			  size_t size)
+{
+	struct http_msg *msg = conn->msg;
+
+	if (!conn->sock || !conn->tc)
+		return ENOTCONN;
+
+	if (conn->sock->bodyh)
+		return conn->sock->bodyh(conn, msg, buf, size,
+					 conn->sock->arg);
+	else if ((msg->mb->end + size) > BUFSIZE_MAX)
+		return EOVERFLOW;
+	else
+		return mbuf_write_mem(msg->mb, buf, size);
+}
+
+
+static int body_write(struct http_conn *conn, struct mbuf *mb)
+{
+	const size_t size = min(mbuf_get_left(mb), conn->rx_len);
+	int err;
+
+	if (size == 0)
+		return 0;
+
+	err = body_write_buf(conn, mbuf_buf(mb), size);
+	if (err)
+		return err;
+
+	conn->rx_len -= size;
+	mb->pos      += size;
+
+	return 0;
+}
+
+
+static int body_recv(struct http_conn *conn, struct mbuf *mb, bool *last)
+{
+	int err;
+
+	*last = false;
+
+	if (!conn->chunked) {
+
+		err = body_write(conn, mb);
+		if (err)
+			return err;
+
+		if (conn->rx_len == 0)
+			*last = true;
+
+		return 0;
+	}
+
+	while (mbuf_get_left(mb)) {
+
+		if (conn->rx_len == 0) {
+
+			err = http_chunk_decode(&conn->chunk, mb,
+						&conn->rx_len);
+			if (err == ENODATA)
+				return 0;
+			else if (err)
+				return err;
+			else if (conn->rx_len == 0) {
+				*last = true;
+				return 0;
+			}
 		}
 
+		err = body_write(conn, mb);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+
+static void req_handle(struct http_conn *conn)
+{
+	struct http_msg *msg = conn->msg;
+
+	conn->msg     = NULL;
+	conn->rx_len  = 0;
+	conn->chunked = false;
+	memset(&conn->chunk, 0, sizeof(conn->chunk));
+
+	msg->mb->pos = 0;
+
+	if (conn->sock)
+		conn->sock->reqh(conn, msg, conn->sock->arg);
+
+	mem_deref(msg);
+}
+
+
+/*
+ * Pipelined requests are decoded one after the other from the same
+ * buffer. The headers of a decoded request point into the buffer, so new
+ * data is only appended to it while no request refers to it.
+ */
+static int buf_append(struct http_conn *conn, struct mbuf *mb)
+{
+	const size_t len = mbuf_get_left(mb), left = mbuf_get_left(conn->mb);
+	struct mbuf *mbn;
+	size_t pos;
+	int err;
+
+	if ((left + len) > BUFSIZE_MAX)
+		return EOVERFLOW;
+
+	if (mem_nrefs(conn->mb) == 1) {
+
+		pos = conn->mb->pos;
+
 		conn->mb->pos = conn->mb->end;
 
 		err = mbuf_write_mem(conn->mb, mbuf_buf(mb), len);
 		if (err)
-			goto out;
+			return err;
 
 		conn->mb->pos = pos;
+
+		return 0;
 	}
-	else {
-		conn->mb = mem_ref(mb);
+
+	mbn = mbuf_alloc(left + len);
+	if (!mbn)
+		return ENOMEM;
+
+	err  = mbuf_write_mem(mbn, mbuf_buf(conn->mb), left);
+	err |= mbuf_write_mem(mbn, mbuf_buf(mb), len);
+	if (err) {
+		mem_deref(mbn);
+		return err;
 	}
 
-	while (conn->mb) {
-		size_t end, pos = conn->mb->pos;
-		struct http_msg *msg;
+	mbn->pos = 0;
 
-		err = http_msg_decode(&msg, conn->mb, true);
-		if (err) {
+	mem_deref(conn->mb);
+	conn->mb = mbn;
+
+	return 0;
+}
+
+
+static void req_process(struct http_conn *conn)
+{
+	bool last;
+	int err = 0;
+
+	/* the handlers may close the connection or the socket */
+	mem_ref(conn);
+
+	for (;;) {
+
+		if (!conn->msg) {
+
+			const size_t pos = conn->mb->pos;
+
+			/* the responses must be sent in order */
+			if (conn->file)
+				break;
+
+			err = http_msg_decode(&conn->msg, conn->mb, true);
 			if (err == ENODATA) {
 				conn->mb->pos = pos;
 				err = 0;
 				break;
 			}
+			else if (err)
+				goto out;
 
-			goto out;
+			err = req_start(conn);
+			if (err)
+				goto out;
 		}
 
-		if (mbuf_get_left(conn->mb) < msg->clen) {
-			conn->mb->pos = pos;
-			mem_deref(msg);
+		err = body_recv(conn, conn->mb, &last);
+		if (err)
+			goto out;
+
+		if (!last)
 			break;
+
+		req_handle(conn);
+
+		/* closed by the socket */
+		if (!conn->sock)
+			goto out;
+
+		if (!conn->tc) {
+			err = ENOTCONN;
+			goto out;
 		}
 
-		mem_deref(msg->mb);
-		msg->mb = mem_ref(msg->_mb);
+		tmr_start(&conn->tmr, TIMEOUT_IDLE, timeout_handler, conn);
+	}
 
-		mb = conn->mb;
+	/* a streamed body does not stay in the buffer */
+	if (!mbuf_get_left(conn->mb))
+		conn->mb = mem_deref(conn->mb);
 
-		end     = mb->end;
-		mb->end = mb->pos + msg->clen;
+ out:
+	if (err && conn->sock) {
+		conn_close(conn);
+		mem_deref(conn);
+	}
 
-		if (end > mb->end) {
-			struct mbuf *mbn = mbuf_alloc(end - mb->end);
-			if (!mbn) {
-				mem_deref(msg);
-				err = ENOMEM;
-				goto out;
-			}
+	mem_deref(conn);
+}
 
-			(void)mbuf_write_mem(mbn, mb->buf + mb->end,
-					     end - mb->end);
-			mbn->pos = 0;
 
-			mem_deref(conn->mb);
-			conn->mb = mbn;
-		}
-		else {
-			conn->mb = mem_deref(conn->mb);
-		}
+/* A request on an HTTP/2 stream holds a reference until it is closed */
+static void strm_conn_close(struct http_conn *conn)
+{
+	if (!conn->strm)
+		return;
+
+	conn_close(conn);
+	mem_deref(conn);
+}
 
-		if (conn->sock)
-			conn->sock->reqh(conn, msg, conn->sock->arg);
 
-		mem_deref(msg);
+static void strm_req_handle(struct http_conn *conn)
+{
+	mem_ref(conn);
+	req_handle(conn);
+	mem_deref(conn);
+}
 
-		if (!conn->tc) {
-			err = ENOTCONN;
-			goto out;
-		}
 
-		tmr_start(&conn->tmr, TIMEOUT_IDLE, timeout_handler, conn);
+static void strm_head_handler(struct mbuf *mb, bool end, void *arg)
+{
+	struct http_conn *conn = arg;
+	int err;
+
+	/* trailers are ignored */
+	if (conn->msg) {
+		if (end)
+			strm_req_handle(conn);
+		return;
 	}
 
- out:
+	err = http_msg_decode(&conn->msg, mb, true);
+	if (!err)
+		err = req_start(conn);
+	if (err) {
+		strm_conn_close(conn);
+		return;
+	}
+
+	if (end)
+		strm_req_handle(conn);
+}
+
+
+static void strm_data_handler(const uint8_t *buf, size_t len, bool end,
+			      void *arg)
+{
+	struct http_conn *conn = arg;
+	int err;
+
+	if (len) {
+		err = body_write_buf(conn, buf, len);
+		if (err) {
+			strm_conn_close(conn);
+			return;
+		}
+	}
+
+	if (end)
+		strm_req_handle(conn);
+}
+
+
+static void file_send_strm(struct http_conn *conn);
+
+
+static void strm_send_handler(void *arg)
+{
+	struct http_conn *conn = arg;
+
+	if (!conn->file)
+		return;
+
+	mem_ref(conn);
+	file_send_strm(conn);
+	mem_deref(conn);
+}
+
+
+static void strm_close_handler(int err, void *arg)
+{
+	struct http_conn *conn = arg;
+	(void)err;
+
+	strm_conn_close(conn);
+}
+
+
+static int strm_handler(struct h2_strm *strm, void *arg)
+{
+	struct http_conn *conn = arg, *sconn;
+
+	if (!conn->sock)
+		return ENOTCONN;
+
+	sconn = mem_zalloc(sizeof(*sconn), conn_destructor);
+	if (!sconn)
+		return ENOMEM;
+
+	sconn->peer = conn->peer;
+	sconn->sock = conn->sock;
+	sconn->tc   = mem_ref(conn->tc);
+	sconn->sc   = mem_ref(conn->sc);
+	sconn->strm = strm;
+
+	h2_strm_set_handlers(strm, strm_head_handler, strm_data_handler,
+			     strm_send_handler, strm_close_handler, sconn);
+
+	return 0;
+}
+
+
+static void h2_recv(struct http_conn *conn, struct mbuf *mb)
+{
+	int err;
+
+	mem_ref(conn);
+
+	err = h2_sess_recv(conn->h2, mb);
+
+	/* closed by the socket */
+	if (!conn->sock)
+		goto out;
+
 	if (err) {
 		conn_close(conn);
 		mem_deref(conn);
+		goto out;
+	}
+
+	tmr_start(&conn->tmr, TIMEOUT_IDLE, timeout_handler, conn);
+
+ out:
+	mem_deref(conn);
+}
+
+
+static bool alpn_h2(const struct http_conn *conn)
+{
+#ifdef USE_TLS
+	struct pl proto;
+
+	if (!conn->sc || tls_alpn_get(conn->sc, &proto))
+		return false;
+
+	return 0 == pl_strcmp(&proto, "h2");
+#else
+	(void)conn;
+
+	return false;
+#endif
+}
+
+
+/*
+ * HTTP/2 is selected with ALPN on TLS, and on plain TCP when the client
+ * starts with the connection preface (prior knowledge)
+ */
+static int proto_select(struct http_conn *conn)
+{
+	if (conn->sc) {
+		if (!alpn_h2(conn))
+			return 0;
+	}
+	else {
+		const size_t len = strlen(H2_PREFACE);
+		const size_t n = min(mbuf_get_left(conn->mb), len);
+
+		if (memcmp(mbuf_buf(conn->mb), H2_PREFACE, n))
+			return 0;
+
+		if (n < len)
+			return ENODATA;
+	}
+
+	return h2_sess_alloc(&conn->h2, conn->tc, conn->sc != NULL, true,
+			     strm_handler, conn);
+}
+
+
+static void recv_handler(struct mbuf *mb, void *arg)
+{
+	struct http_conn *conn = arg;
+	int err;
+
+	if (conn->h2) {
+		h2_recv(conn, mb);
+		return;
+	}
+
+	if (conn->mb) {
+		err = buf_append(conn, mb);
+		if (err)
+			goto error;
+	}
+	else {
+		conn->mb = mem_ref(mb);
+	}
+
+	if (!conn->proto && conn->sock && conn->sock->h2) {
+
+		err = proto_select(conn);
+		if (err == ENODATA)
+			return;
+		else if (err)
+			goto error;
+
+		conn->proto = true;
+
+		if (conn->h2) {
+			mb = conn->mb;
+			conn->mb = NULL;
+
+			h2_recv(conn, mb);
+			mem_deref(mb);
+			return;
+		}
 	}
+
+	conn->proto = true;
+
+	req_process(conn);
+	return;
+
+ error:
+	conn_close(conn);
+	mem_deref(conn);
 }
 
 
@@ -313,13 +761,98 @@ int https_listen(struct http_sock **sockp, const struct sa *laddr,
 	if (err)
 		goto out;
 
- out:
-	if (err)
-		mem_deref(sock);
-	else
-		*sockp = sock;
+ out:
+	if (err)
+		mem_deref(sock);
+	else
+		*sockp = sock;
+
+	return err;
+}
+
+
+/**
+ * Set a handler for the bodies of requests on an HTTP socket. The body is
+ * then not buffered, but given to the body handler while it is received,
+ * and the request handler is called with an empty body when all of it
+ * was received. Returning an error from the body handler closes the
+ * connection.
+ *
+ * @param sock  HTTP socket
+ * @param bodyh Body handler, or NULL to buffer the bodies
+ */
+void http_sock_set_body_handler(struct http_sock *sock, http_body_h *bodyh)
+{
+	if (!sock)
+		return;
+
+	sock->bodyh = bodyh;
+}
+
+
+/**
+ * Set headers that are added to every response on an HTTP socket, after
+ * the status line and the Date header. The headers are formatted once,
+ * and each of them must end with CRLF.
+ *
+ * @param sock HTTP socket
+ * @param fmt  Formatted HTTP headers, or NULL to remove them
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int http_sock_set_headers(struct http_sock *sock, const char *fmt, ...)
+{
+	char *hdrs = NULL;
+	va_list ap;
+	int err;
+
+	if (!sock)
+		return EINVAL;
+
+	if (fmt) {
+		va_start(ap, fmt);
+		err = re_vsdprintf(&hdrs, fmt, ap);
+		va_end(ap);
+		if (err)
+			return err;
+	}
+
+	mem_deref(sock->hdrs);
+	sock->hdrs     = hdrs;
+	sock->hdrs_len = str_len(hdrs);
+
+	return 0;
+}
+
+
+/**
+ * Enable HTTP/2 on an HTTP socket. On a secure socket it is offered with
+ * ALPN, on a plain socket it is used when the client starts with the
+ * HTTP/2 connection preface. The request handler is called in the same
+ * way for both protocols.
+ *
+ * @param sock   HTTP socket
+ * @param enable True to enable HTTP/2
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int http_sock_set_http2(struct http_sock *sock, bool enable)
+{
+	if (!sock)
+		return EINVAL;
+
+#ifdef USE_TLS
+	if (sock->tls) {
+		int err = tls_set_alpn(sock->tls, alpnv,
+				       enable ? ARRAY_SIZE(alpnv) : 0);
+		if (err)
+			return err;
+	}
+#endif
+
+	sock->h2 = enable;
 
-	return err;
+	return 0;
 }
 
 
@@ -385,13 +918,42 @@ void http_conn_close(struct http_conn *conn)
 	if (!conn)
 		return;
 
+	/* only the stream of the request is reset */
+	if (conn->strm) {
+		strm_conn_close(conn);
+		return;
+	}
+
 	conn->sc = mem_deref(conn->sc);
 	conn->tc = mem_deref(conn->tc);
 }
 
 
-static int http_vreply(struct http_conn *conn, uint16_t scode,
-		       const char *reason, const char *fmt, va_list ap)
+/* The Date header is formatted at most once per second */
+static const char *date_hdr(struct http_sock *sock)
+{
+	time_t t = time(NULL);
+
+	if (t == sock->date_t)
+		return sock->date;
+
+	if (re_snprintf(sock->date, sizeof(sock->date), "Date: %H\r\n",
+			fmt_gmtime, &t) < 0)
+		return "";
+
+	sock->date_t = t;
+
+	return sock->date;
+}
+
+
+/*
+ * On HTTP/2 the stream is ended after the message, if end is set. With
+ * chunked set the body is sent later with http_reply_chunk().
+ */
+static int http_vreply(struct http_conn *conn, bool end, bool chunked,
+		       uint16_t scode, const char *reason, const char *fmt,
+		       va_list ap)
 {
 	struct mbuf *mb;
 	int err;
@@ -407,8 +969,18 @@ static int http_vreply(struct http_conn *conn, uint16_t scode,
 		return ENOMEM;
 
 	err = mbuf_printf(mb, "HTTP/1.1 %u %s\r\n", scode, reason);
+	if (conn->sock) {
+		err |= mbuf_write_str(mb, date_hdr(conn->sock));
+		if (conn->sock->hdrs)
+			err |= mbuf_write_mem(mb, (uint8_t *)conn->sock->hdrs,
+					      conn->sock->hdrs_len);
+	}
+	if (chunked)
+		err |= mbuf_write_str(mb, "Transfer-Encoding: chunked\r\n");
 	if (fmt)
 		err |= mbuf_vprintf(mb, fmt, ap);
+	else if (chunked)
+		err |= mbuf_write_str(mb, "\r\n");
 	else
 		err |= mbuf_write_str(mb, "Content-Length: 0\r\n\r\n");
 	if (err)
@@ -416,7 +988,10 @@ static int http_vreply(struct http_conn *conn, uint16_t scode,
 
 	mb->pos = 0;
 
-	err = tcp_send(conn->tc, mb);
+	if (conn->strm)
+		err = h2_strm_send_msg(conn->strm, mb, end);
+	else
+		err = tcp_send(conn->tc, mb);
 	if (err)
 		goto out;
 
@@ -427,6 +1002,20 @@ static int http_vreply(struct http_conn *conn, uint16_t scode,
 }
 
 
+static int reply_head(struct http_conn *conn, bool end, uint16_t scode,
+		      const char *reason, const char *fmt, ...)
+{
+	va_list ap;
+	int err;
+
+	va_start(ap, fmt);
+	err = http_vreply(conn, end, false, scode, reason, fmt, ap);
+	va_end(ap);
+
+	return err;
+}
+
+
 /**
  * Send an HTTP response
  *
@@ -444,13 +1033,70 @@ int http_reply(struct http_conn *conn, uint16_t scode, const char *reason,
 	int err;
 
 	va_start(ap, fmt);
-	err = http_vreply(conn, scode, reason, fmt, ap);
+	err = http_vreply(conn, true, false, scode, reason, fmt, ap);
+	va_end(ap);
+
+	return err;
+}
+
+
+/**
+ * Send the head of an HTTP response with a chunked body, e.g. an event
+ * stream. The body is then sent in parts with http_reply_chunk(), and
+ * ended with a part of length zero. On HTTP/2 the parts are sent as DATA
+ * frames, without chunked encoding.
+ *
+ * @param conn   HTTP connection
+ * @param scode  Response status code
+ * @param reason Response reason phrase
+ * @param fmt    Formatted HTTP headers, ending with an empty line
+ *               (optional)
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int http_reply_chunked(struct http_conn *conn, uint16_t scode,
+		       const char *reason, const char *fmt, ...)
+{
+	va_list ap;
+	int err;
+
+	va_start(ap, fmt);
+	err = http_vreply(conn, false, true, scode, reason, fmt, ap);
 	va_end(ap);
 
 	return err;
 }
 
 
+/**
+ * Send a part of a response body that was started with
+ * http_reply_chunked(). The size line and the data are sent together,
+ * and on plain TCP the data is not copied if it can be sent at once.
+ *
+ * @param conn HTTP connection
+ * @param buf  Data to send
+ * @param len  Length of data, 0 to end the body
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int http_reply_chunk(struct http_conn *conn, const uint8_t *buf, size_t len)
+{
+	if (!conn || (!buf && len))
+		return EINVAL;
+
+	if (!conn->tc)
+		return ENOTCONN;
+
+	if (conn->strm)
+		return h2_strm_send_data(conn->strm, buf, len, !len);
+
+	/* a long response is not idle */
+	tmr_start(&conn->tmr, TIMEOUT_IDLE, timeout_handler, conn);
+
+	return http_chunk_send(conn->tc, buf, len);
+}
+
+
 /**
  * Send an HTTP response with content formatting
  *
@@ -520,3 +1166,403 @@ int http_ereply(struct http_conn *conn, uint16_t scode, const char *reason)
 			   scode, reason,
 			   scode, reason);
 }
+
+
+/**
+ * Send the registered metrics, in the Prometheus text format, e.g. from
+ * the request handler of /metrics
+ *
+ * @param conn HTTP connection
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int http_reply_metrics(struct http_conn *conn)
+{
+	return http_creply(conn, 200, "OK", "text/plain; version=0.0.4",
+			   "%H", re_metrics_print, NULL);
+}
+
+
+static int file_read(struct http_conn *conn, struct http_file *file,
+		     size_t *np)
+{
+	const size_t size = (size_t)min(file->left, (uint64_t)FILE_CHUNK);
+	ssize_t n;
+	int err;
+
+	/* the last buffer may still be queued */
+	if (!file->mb || mem_nrefs(file->mb) > 1) {
+
+		mem_deref(file->mb);
+
+		file->mb = mbuf_alloc(FILE_CHUNK);
+		if (!file->mb)
+			return ENOMEM;
+	}
+
+	n = read(file->fd, file->mb->buf, size);
+	if (n < 0)
+		return errno;
+	else if (n == 0)
+		return ENODATA;
+
+	file->mb->pos = 0;
+	file->mb->end = n;
+
+	err = tcp_send(conn->tc, file->mb);
+	if (err)
+		return err;
+
+	*np = n;
+
+	return 0;
+}
+
+
+static int file_read_start(struct http_conn *conn, struct http_file *file,
+			   size_t *np)
+{
+	if (lseek(file->fd, file->off, SEEK_SET) < 0)
+		return errno;
+
+	return file_read(conn, file, np);
+}
+
+
+static void file_send(struct http_conn *conn)
+{
+	struct http_file *file = conn->file;
+	int err = 0;
+
+	tmr_start(&conn->tmr, TIMEOUT_IDLE, timeout_handler, conn);
+
+	while (file->left) {
+
+		const uint64_t len = min(file->left, (uint64_t)FILE_SENDMAX);
+		size_t n = 0;
+
+		if (file->mb) {
+
+			/* the next part when the last one was sent */
+			if (tcp_conn_txqsz(conn->tc))
+				return;
+
+			err = file_read(conn, file, &n);
+		}
+		else {
+			err = tcp_send_file(conn->tc, file->fd, file->off,
+					    (size_t)len, &n);
+			if (err == EAGAIN)
+				return;
+
+			/* TLS in OpenSSL, or no sendfile on this platform */
+			if (err == ENOTSUP || err == ENOSYS)
+				err = file_read_start(conn, file, &n);
+		}
+
+		if (err)
+			break;
+
+		file->off  += n;
+		file->left -= n;
+	}
+
+	(void)tcp_set_send(conn->tc, NULL);
+	conn->file = mem_deref(conn->file);
+
+	if (err) {
+		conn_close(conn);
+		mem_deref(conn);
+	}
+}
+
+
+/* Queue parts of the file while the stream can take them */
+static void file_send_strm(struct http_conn *conn)
+{
+	struct http_file *file = conn->file;
+	int err = 0;
+
+	while (file->left && h2_strm_txlen(conn->strm) < FILE_CHUNK) {
+
+		const size_t size = (size_t)min(file->left,
+						(uint64_t)FILE_CHUNK);
+		ssize_t n;
+
+		if (!file->mb) {
+			file->mb = mbuf_alloc(FILE_CHUNK);
+			if (!file->mb) {
+				err = ENOMEM;
+				break;
+			}
+		}
+
+		n = read(file->fd, file->mb->buf, size);
+		if (n < 0) {
+			err = errno;
+			break;
+		}
+		else if (n == 0) {
+			err = ENODATA;
+			break;
+		}
+
+		file->off  += n;
+		file->left -= n;
+
+		err = h2_strm_send_data(conn->strm, file->mb->buf, n,
+					!file->left);
+		if (err)
+			break;
+	}
+
+	if (!err && file->left)
+		return;
+
+	conn->file = mem_deref(conn->file);
+
+	if (err)
+		strm_conn_close(conn);
+}
+
+
+static void file_send_handler(void *arg)
+{
+	struct http_conn *conn = arg;
+
+	if (!conn->file)
+		return;
+
+	mem_ref(conn);
+
+	file_send(conn);
+
+	/* handle the requests that came in meanwhile */
+	if (!conn->file && conn->sock && conn->mb)
+		req_process(conn);
+
+	mem_deref(conn);
+}
+
+
+static bool etag_handler(const struct http_hdr *hdr, void *arg)
+{
+	const char *etag = arg;
+	struct pl val = hdr->val;
+
+	if (!pl_strcmp(&val, "*"))
+		return true;
+
+	/* weak comparison */
+	if (val.l > 2 && !memcmp(val.p, "W/", 2)) {
+		val.p += 2;
+		val.l -= 2;
+	}
+
+	return 0 == pl_strcmp(&val, etag);
+}
+
+
+/* One byte range (RFC 7233), ENOENT if the whole file is to be sent */
+static int range_decode(const struct pl *val, uint64_t size,
+			uint64_t *first, uint64_t *last)
+{
+	struct pl a, b;
+
+	if (pl_strchr(val, ','))
+		return ENOENT;
+
+	if (re_regex(val->p, val->l, "bytes[ \t]*=[ \t]*[0-9]*-[0-9]*",
+		     NULL, NULL, &a, &b))
+		return ENOENT;
+
+	if (!pl_isset(&a)) {
+
+		const uint64_t n = pl_u64(&b);
+
+		if (!pl_isset(&b))
+			return ENOENT;
+
+		if (!n || !size)
+			return ERANGE;
+
+		*first = size > n ? size - n : 0;
+		*last  = size - 1;
+
+		return 0;
+	}
+
+	*first = pl_u64(&a);
+	*last  = pl_isset(&b) ? pl_u64(&b) : *first;
+
+	if (*last < *first)
+		return ENOENT;
+
+	if (*first >= size)
+		return ERANGE;
+
+	*last = pl_isset(&b) ? min(*last, size - 1) : size - 1;
+
+	return 0;
+}
+
+
+/**
+ * Send an HTTP response with the content of a file. On plain TCP, and on
+ * TLS with kernel TLS, the file is sent by the kernel without copying it.
+ * Otherwise it is read in parts as the connection can take them.
+ *
+ * A single byte range in a Range header is sent as 206 Partial Content,
+ * and 304 Not Modified is sent if If-None-Match matches the entity tag of
+ * the file. For a HEAD request only the headers are sent. Further requests
+ * on the connection are handled when the file was sent.
+ *
+ * @param conn  HTTP connection
+ * @param msg   HTTP request
+ * @param path  File path
+ * @param ctype Content type, or NULL for application/octet-stream
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int http_reply_file(struct http_conn *conn, const struct http_msg *msg,
+		    const char *path, const char *ctype)
+{
+	uint64_t size, first = 0, last = 0;
+	const struct http_hdr *hdr;
+	struct http_file *file;
+	char etag[40], crange[64] = "";
+	struct stat st;
+	uint16_t scode = 200;
+	const char *reason = "OK";
+	bool body;
+	int err;
+
+	if (!conn || !msg || !path)
+		return EINVAL;
+
+	if (!conn->tc)
+		return ENOTCONN;
+
+	if (conn->file)
+		return EBUSY;
+
+	file = mem_zalloc(sizeof(*file), file_destructor);
+	if (!file)
+		return ENOMEM;
+
+	file->fd = open(path, O_RDONLY);
+	if (file->fd < 0) {
+		err = errno;
+		goto out;
+	}
+
+	if (fstat(file->fd, &st) < 0) {
+		err = errno;
+		goto out;
+	}
+
+	if (!S_ISREG(st.st_mode)) {
+		err = EISDIR;
+		goto out;
+	}
+
+	size = st.st_size;
+
+	(void)re_snprintf(etag, sizeof(etag), "\"%llx-%llx\"",
+			  (unsigned long long)size,
+			  (unsigned long long)st.st_mtime);
+
+	if (http_msg_hdr_apply(msg, true, HTTP_HDR_IF_NONE_MATCH,
+			       etag_handler, etag)) {
+		err = http_reply(conn, 304, "Not Modified",
+				 "ETag: %s\r\n"
+				 "\r\n",
+				 etag);
+		goto out;
+	}
+
+	hdr = http_msg_hdr(msg, HTTP_HDR_RANGE);
+	if (hdr) {
+		const struct http_hdr *ifr;
+
+		ifr = http_msg_hdr(msg, HTTP_HDR_IF_RANGE);
+
+		if (ifr && pl_strcmp(&ifr->val, etag))
+			err = ENOENT;
+		else
+			err = range_decode(&hdr->val, size, &first, &last);
+	}
+	else {
+		err = ENOENT;
+	}
+
+	if (err == ERANGE) {
+		err = http_reply(conn, 416, "Range Not Satisfiable",
+				 "Content-Range: bytes */%llu\r\n"
+				 "Content-Length: 0\r\n"
+				 "\r\n",
+				 (unsigned long long)size);
+		goto out;
+	}
+	else if (err) {
+		file->off  = 0;
+		file->left = size;
+	}
+	else {
+		scode  = 206;
+		reason = "Partial Content";
+
+		file->off  = first;
+		file->left = last - first + 1;
+
+		(void)re_snprintf(crange, sizeof(crange),
+				  "Content-Range: bytes %llu-%llu/%llu\r\n",
+				  (unsigned long long)first,
+				  (unsigned long long)last,
+				  (unsigned long long)size);
+	}
+
+	body = pl_strcasecmp(&msg->met, "HEAD") && file->left;
+
+	err = reply_head(conn, !body, scode, reason,
+			 "Content-Type: %s\r\n"
+			 "Content-Length: %llu\r\n"
+			 "%s"
+			 "Accept-Ranges: bytes\r\n"
+			 "ETag: %s\r\n"
+			 "\r\n",
+			 ctype ? ctype : "application/octet-stream",
+			 (unsigned long long)file->left,
+			 crange,
+			 etag);
+	if (err || !body)
+		goto out;
+
+	if (conn->strm) {
+
+		if (lseek(file->fd, file->off, SEEK_SET) < 0) {
+			err = errno;
+			goto out;
+		}
+
+		conn->file = file;
+		file = NULL;
+
+		file_send_strm(conn);
+		goto out;
+	}
+
+	err = tcp_set_send(conn->tc, file_send_handler);
+	if (err)
+		goto out;
+
+	conn->file = file;
+	file = NULL;
+
+	file_send(conn);
+
+ out:
+	mem_deref(file);
+
+	return err;
+}
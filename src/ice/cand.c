@@ -74,8 +74,12 @@ static int cand_alloc(struct ice_cand **candp, struct icem *icem,
 
 	err = compute_foundation(cand);
 
+#if ICE_TRACE
 	if (ifname)
 		err |= str_dup(&cand->ifname, ifname);
+#else
+	(void)ifname;
+#endif
 
 	if (err)
 		mem_deref(cand);
@@ -160,7 +164,14 @@ int icem_rcand_add(struct icem *icem, enum ice_cand_type type, unsigned compid,
 	sa_cpy(&rcand->rel, rel_addr);
 
 	err = pl_strdup(&rcand->foundation, foundation);
+	if (err)
+		goto out;
 
+	/* trickled candidate, pair it with the local candidates */
+	if (icem->state == ICE_CHECKLIST_RUNNING)
+		err = icem_checklist_add_rcand(icem, rcand);
+
+ out:
 	if (err)
 		mem_deref(rcand);
 
@@ -189,7 +200,7 @@ int icem_rcand_add_prflx(struct ice_cand **rcp, struct icem *icem,
 	rcand->prio   = prio;
 	rcand->addr   = *addr;
 
-	err = re_sdprintf(&rcand->foundation, "%08x", rand_u32());
+	err = re_sdprintf(&rcand->foundation, "%08x", rand_fast_u32());
 	if (err)
 		goto out;
 
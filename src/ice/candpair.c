@@ -79,8 +79,8 @@ static void list_add_sorted(struct list *list, struct ice_candpair *cp)
 }
 
 
-int icem_candpair_alloc(struct ice_candpair **cpp, struct icem *icem,
-			struct ice_cand *lcand, struct ice_cand *rcand)
+static int candpair_create(struct ice_candpair **cpp, struct icem *icem,
+			   struct ice_cand *lcand, struct ice_cand *rcand)
 {
 	struct ice_candpair *cp;
 	struct icem_comp *comp;
@@ -105,6 +105,22 @@ int icem_candpair_alloc(struct ice_candpair **cpp, struct icem *icem,
 
 	candpair_set_pprio(cp);
 
+	*cpp = cp;
+
+	return 0;
+}
+
+
+int icem_candpair_alloc(struct ice_candpair **cpp, struct icem *icem,
+			struct ice_cand *lcand, struct ice_cand *rcand)
+{
+	struct ice_candpair *cp;
+	int err;
+
+	err = candpair_create(&cp, icem, lcand, rcand);
+	if (err)
+		return err;
+
 	list_add_sorted(&icem->checkl, cp);
 
 	if (cpp)
@@ -114,6 +130,37 @@ int icem_candpair_alloc(struct ice_candpair **cpp, struct icem *icem,
 }
 
 
+/**
+ * Allocate a candidate pair and prepend it to a list, without ordering.
+ * After ordering, the pairs that were added last go first on equal
+ * priority, as with icem_candpair_alloc().
+ *
+ * @param lst   List of new candidate pairs
+ * @param icem  ICE Media object
+ * @param lcand Local candidate
+ * @param rcand Remote candidate
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int icem_candpair_prepend(struct list *lst, struct icem *icem,
+			  struct ice_cand *lcand, struct ice_cand *rcand)
+{
+	struct ice_candpair *cp;
+	int err;
+
+	if (!lst)
+		return EINVAL;
+
+	err = candpair_create(&cp, icem, lcand, rcand);
+	if (err)
+		return err;
+
+	list_prepend(lst, &cp->le, cp);
+
+	return 0;
+}
+
+
 int icem_candpair_clone(struct ice_candpair **cpp, struct ice_candpair *cp0,
 			struct ice_cand *lcand, struct ice_cand *rcand)
 {
@@ -166,6 +213,41 @@ void icem_candpair_prio_order(struct list *lst)
 }
 
 
+/**
+ * Merge a list of new candidate pairs into a check-list. Both lists
+ * must be ordered by priority. On equal priority the pairs that were
+ * in the check-list go first.
+ *
+ * @param lst  Checklist (struct ice_candpair)
+ * @param newl New candidate pairs, empty on return
+ */
+void icem_candpairs_merge(struct list *lst, struct list *newl)
+{
+	struct le *pos, *le;
+
+	if (!lst || !newl)
+		return;
+
+	pos = list_head(lst);
+
+	while ((le = list_head(newl))) {
+
+		struct ice_candpair *cp = le->data;
+
+		while (pos && ((struct ice_candpair *)pos->data)->pprio
+		       >= cp->pprio)
+			pos = pos->next;
+
+		list_unlink(le);
+
+		if (pos)
+			list_insert_before(lst, pos, le, cp);
+		else
+			list_append(lst, le, cp);
+	}
+}
+
+
 /* cancel transaction */
 void icem_candpair_cancel(struct ice_candpair *cp)
 {
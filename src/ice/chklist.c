@@ -21,10 +21,76 @@
 #include <re_dbg.h>
 
 
+enum {
+	PAIR_TAB_MIN = 16,
+};
+
+
+/* Replace server reflexive candidates by its base */
+static const struct sa *cand_srflx_addr(const struct ice_cand *c)
+{
+	return (ICE_CAND_TYPE_SRFLX == c->type) ? &c->base->addr : &c->addr;
+}
+
+
+static uint32_t pair_hash(const struct ice_candpair *cp)
+{
+	uint32_t h;
+
+	h = cp->comp->id;
+	h = h * 31 + sa_hash(cand_srflx_addr(cp->lcand), SA_ALL);
+	h = h * 31 + sa_hash(&cp->rcand->addr, SA_ALL);
+
+	/* sa_hash() is a plain sum, mix the bits for open addressing */
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+
+	return h;
+}
+
+
+static bool pair_isdup(const struct ice_candpair *cp1,
+		       const struct ice_candpair *cp2)
+{
+	return cp1->comp->id == cp2->comp->id &&
+		sa_cmp(cand_srflx_addr(cp1->lcand),
+		       cand_srflx_addr(cp2->lcand), SA_ALL) &&
+		sa_cmp(&cp1->rcand->addr, &cp2->rcand->addr, SA_ALL);
+}
+
+
+/* Open addressing, returns the duplicate or NULL if cp was added */
+static struct ice_candpair *pair_tab_add(struct ice_candpair **tabv,
+					 size_t mask, struct ice_candpair *cp)
+{
+	size_t i = pair_hash(cp) & mask;
+
+	for (; tabv[i]; i = (i + 1) & mask) {
+
+		if (pair_isdup(tabv[i], cp))
+			return tabv[i];
+	}
+
+	tabv[i] = cp;
+
+	return NULL;
+}
+
+
 /**
  * Forming Candidate Pairs
+ *
+ * @param icem  ICE Media object
+ * @param newl  List of new candidate pairs
+ * @param rcand Remote candidate to pair, NULL for all
+ *
+ * @return 0 if success, otherwise errorcode
  */
-static int candpairs_form(struct icem *icem)
+static int candpairs_form(struct icem *icem, struct list *newl,
+			  struct ice_cand *rcand)
 {
 	struct le *le;
 	int err = 0;
@@ -33,7 +99,7 @@ static int candpairs_form(struct icem *icem)
 		return ENOENT;
 
 	if (list_isempty(&icem->rcandl)) {
-		DEBUG_WARNING("%s: no remote candidates\n", icem->name);
+		DEBUG_WARNING("%s: no remote candidates\n", ICEM_NAME(icem));
 		return ENOENT;
 	}
 
@@ -44,15 +110,18 @@ static int candpairs_form(struct icem *icem)
 
 		for (rle = icem->rcandl.head; rle; rle = rle->next) {
 
-			struct ice_cand *rcand = rle->data;
+			struct ice_cand *rc = rle->data;
+
+			if (rcand && rc != rcand)
+				continue;
 
-			if (lcand->compid != rcand->compid)
+			if (lcand->compid != rc->compid)
 				continue;
 
-			if (sa_af(&lcand->addr) != sa_af(&rcand->addr))
+			if (sa_af(&lcand->addr) != sa_af(&rc->addr))
 				continue;
 
-			err = icem_candpair_alloc(NULL, icem, lcand, rcand);
+			err = icem_candpair_prepend(newl, icem, lcand, rc);
 			if (err)
 				return err;
 		}
@@ -62,48 +131,90 @@ static int candpairs_form(struct icem *icem)
 }
 
 
-/* Replace server reflexive candidates by its base */
-static const struct sa *cand_srflx_addr(const struct ice_cand *c)
-{
-	return (ICE_CAND_TYPE_SRFLX == c->type) ? &c->base->addr : &c->addr;
-}
-
-
-/* return: NULL to keep, pointer to remove object */
-static void *unique_handler(struct le *le1, struct le *le2)
-{
-	struct ice_candpair *cp1 = le1->data, *cp2 = le2->data;
-
-	if (cp1->comp->id != cp2->comp->id)
-		return NULL;
-
-	if (!sa_cmp(cand_srflx_addr(cp1->lcand),
-		    cand_srflx_addr(cp2->lcand), SA_ALL) ||
-	    !sa_cmp(&cp1->rcand->addr, &cp2->rcand->addr, SA_ALL))
-		return NULL;
-
-	return cp1->pprio < cp2->pprio ? cp1 : cp2;
-}
-
-
 /**
  * Pruning the Pairs
+ *
+ * @param icem  ICE Media object
+ * @param newl  New candidate pairs, ordered by priority
+ *
+ * @return 0 if success, otherwise errorcode
  */
-static void candpair_prune(struct icem *icem)
+static int candpair_prune(struct icem *icem, struct list *newl)
 {
 	/* The agent MUST prune the list.
 	   This is done by removing a pair if its local and remote
 	   candidates are identical to the local and remote candidates
 	   of a pair higher up on the priority list.
 
-	   NOTE: This logic assumes the list is sorted by priority
+	   NOTE: Pairs that are in the check-list already are kept,
+	   only new pairs are removed.
 	*/
 
-	uint32_t n = ice_list_unique(&icem->checkl, unique_handler);
+	struct ice_candpair **tabv;
+	struct le *le;
+	size_t sz = PAIR_TAB_MIN;
+	uint32_t n = 0;
+
+	while (sz < 2 * (list_count(&icem->checkl) + list_count(newl)))
+		sz *= 2;
+
+	tabv = mem_zalloc(sz * sizeof(*tabv), NULL);
+	if (!tabv)
+		return ENOMEM;
+
+	for (le = icem->checkl.head; le; le = le->next)
+		(void)pair_tab_add(tabv, sz - 1, le->data);
+
+	le = newl->head;
+	while (le) {
+
+		struct ice_candpair *cp = le->data;
+
+		le = le->next;
+
+		if (pair_tab_add(tabv, sz - 1, cp)) {
+			mem_deref(cp);
+			++n;
+		}
+	}
+
+	mem_deref(tabv);
+
 	if (n > 0) {
 		DEBUG_NOTICE("%s: pruned candidate pairs: %u\n",
-			     icem->name, n);
+			     ICEM_NAME(icem), n);
 	}
+
+	return 0;
+}
+
+
+/* Form, order and prune new candidate pairs, and add to the check-list */
+static int checklist_add(struct icem *icem, struct ice_cand *rcand)
+{
+	struct list newl = LIST_INIT;
+	int err;
+
+	/* 1. form candidate pairs */
+	err = candpairs_form(icem, &newl, rcand);
+	if (err)
+		goto out;
+
+	/* 2. compute a candidate pair priority */
+	/* 3. order the pairs by priority */
+	icem_candpair_prio_order(&newl);
+
+	/* 4. prune the pairs */
+	err = candpair_prune(icem, &newl);
+	if (err)
+		goto out;
+
+	icem_candpairs_merge(&icem->checkl, &newl);
+
+ out:
+	list_flush(&newl);
+
+	return err;
 }
 
 
@@ -158,27 +269,41 @@ void ice_candpair_set_states(struct icem *icem)
  */
 int icem_checklist_form(struct icem *icem)
 {
-	int err;
-
 	if (!icem)
 		return EINVAL;
 
 	if (!list_isempty(&icem->checkl))
 		return EALREADY;
 
-	/* 1. form candidate pairs */
-	err = candpairs_form(icem);
+	return checklist_add(icem, NULL);
+}
+
+
+/**
+ * Add the candidate pairs of a remote candidate that was received
+ * after the check-list was formed. The new pairs are Frozen, and are
+ * checked when there are no Waiting pairs.
+ *
+ * @param icem  ICE Media object
+ * @param rcand Remote candidate
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int icem_checklist_add_rcand(struct icem *icem, struct ice_cand *rcand)
+{
+	int err;
+
+	if (!icem || !rcand)
+		return EINVAL;
+
+	err = checklist_add(icem, rcand);
 	if (err)
 		return err;
 
-	/* 2. compute a candidate pair priority */
-	/* 3. order the pairs by priority */
-	icem_candpair_prio_order(&icem->checkl);
-
-	/* 4. prune the pairs */
-	candpair_prune(icem);
+	if (icem->state == ICE_CHECKLIST_RUNNING)
+		icem_conncheck_continue(icem);
 
-	return err;
+	return 0;
 }
 
 
@@ -216,7 +341,7 @@ static void concluding_ice(struct icem_comp *comp)
 	if (!cp) {
 		DEBUG_WARNING("{%s.%u} conclude: no valid candpair found"
 			      " (validlist=%u)\n",
-			      comp->icem->name, comp->id,
+			      ICEM_NAME(comp->icem), comp->id,
 			      list_count(&comp->icem->validl));
 		return;
 	}
@@ -261,7 +386,7 @@ void icem_checklist_update(struct icem *icem)
 		if (!icem_candpair_find_compid(&icem->validl, comp->id)) {
 			DEBUG_WARNING("{%s.%u} no valid candidate pair"
 				      " (validlist=%u)\n",
-				      icem->name, comp->id,
+				      ICEM_NAME(icem), comp->id,
 				      list_count(&icem->validl));
 			err = ENOENT;
 			break;
@@ -68,6 +68,7 @@ static void destructor(void *arg)
 	struct icem_comp *comp = arg;
 
 	tmr_cancel(&comp->tmr_ka);
+	mem_deref(comp->kae);
 	mem_deref(comp->turnc);
 	mem_deref(comp->cp_sel);
 	mem_deref(comp->def_lcand);
@@ -201,7 +202,7 @@ void icem_comp_set_selected(struct icem_comp *comp, struct ice_candpair *cp)
 	if (cp->state != ICE_CANDPAIR_SUCCEEDED) {
 		DEBUG_WARNING("{%s.%u} set_selected: invalid state '%s'"
 			      " [%H]\n",
-			      comp->icem->name, comp->id,
+			      ICEM_NAME(comp->icem), comp->id,
 			      ice_candpair_state2name(cp->state),
 			      icem_candpair_debug, cp);
 	}
@@ -235,7 +236,8 @@ static void timeout(void *arg)
 	struct icem_comp *comp = arg;
 	struct ice_candpair *cp;
 
-	tmr_start(&comp->tmr_ka, ICE_DEFAULT_Tr * 1000 + rand_u16() % 1000,
+	tmr_start(&comp->tmr_ka,
+		  ICE_DEFAULT_Tr * 1000 + rand_fast_u16() % 1000,
 		  timeout, comp);
 
 	/* find selected candidate-pair */
@@ -249,16 +251,63 @@ static void timeout(void *arg)
 }
 
 
+static void sched_handler(void *arg)
+{
+	struct icem_comp *comp = arg;
+	struct ice_candpair *cp = comp->cp_sel;
+	uint8_t tid[STUN_TID_SIZE];
+	struct mbuf *mb;
+	size_t presz;
+	int err;
+
+	if (!cp)
+		return;
+
+	presz = (cp->lcand->type == ICE_CAND_TYPE_RELAY) ? 4 : 0;
+
+	if (comp->icem->proto != IPPROTO_UDP) {
+		(void)stun_indication(comp->icem->proto, comp->sock,
+				      &cp->rcand->addr, presz,
+				      STUN_METHOD_BINDING, NULL, 0, true, 0);
+		return;
+	}
+
+	mb = mbuf_alloc(presz + STUN_HEADER_SIZE + 8);
+	if (!mb)
+		return;
+
+	rand_bytes(tid, sizeof(tid));
+
+	mb->pos = presz;
+	err = stun_msg_encode(mb, STUN_METHOD_BINDING, STUN_CLASS_INDICATION,
+			      tid, NULL, NULL, 0, true, 0x00, 0);
+	if (!err) {
+		mb->pos = presz;
+		(void)stun_kasched_send(comp->icem->kasched, comp->sock,
+					&cp->rcand->addr, mb);
+	}
+
+	mem_deref(mb);
+}
+
+
 void icem_comp_keepalive(struct icem_comp *comp, bool enable)
 {
 	if (!comp)
 		return;
 
-	if (enable) {
-		tmr_start(&comp->tmr_ka, ICE_DEFAULT_Tr * 1000, timeout, comp);
+	tmr_cancel(&comp->tmr_ka);
+	comp->kae = mem_deref(comp->kae);
+
+	if (!enable)
+		return;
+
+	if (comp->icem->kasched) {
+		(void)stun_kasched_add(&comp->kae, comp->icem->kasched,
+				       sched_handler, comp);
 	}
 	else {
-		tmr_cancel(&comp->tmr_ka);
+		tmr_start(&comp->tmr_ka, ICE_DEFAULT_Tr * 1000, timeout, comp);
 	}
 }
 
@@ -271,7 +320,8 @@ void icecomp_printf(struct icem_comp *comp, const char *fmt, ...)
 		return;
 
 	va_start(ap, fmt);
-	(void)re_printf("{%11s.%u} %v", comp->icem->name, comp->id, fmt, &ap);
+	(void)re_printf("{%11s.%u} %v", ICEM_NAME(comp->icem), comp->id,
+			fmt, &ap);
 	va_end(ap);
 }
 
@@ -13,6 +13,7 @@
 #include <re_stun.h>
 #include <re_turn.h>
 #include <re_ice.h>
+#include <re_trace.h>
 #include "ice.h"
 
 
@@ -125,7 +126,7 @@ static void handle_success(struct icem *icem, struct ice_candpair *cp,
 	cp = construct_valid_pair(icem, cp, laddr, &cp->rcand->addr);
 	if (!cp) {
 		DEBUG_WARNING("{%s} no valid candidate pair for %J\n",
-			      icem->name, laddr);
+			      ICEM_NAME(icem), laddr);
 		return;
 	}
 
@@ -161,6 +162,8 @@ static void stunc_resp_handler(int err, uint16_t scode, const char *reason,
 
 	(void)reason;
 
+	RE_TRACE_ASYNC_END("ice", "check", cp);
+
 #if ICE_TRACE
 	icecomp_printf(cp->comp, "Rx %H <--- %H '%u %s'%H\n",
 		       icem_cand_print, cp->lcand,
@@ -193,7 +196,7 @@ static void stunc_resp_handler(int err, uint16_t scode, const char *reason,
 
 	default:
 		DEBUG_WARNING("{%s.%u} STUN Response: %u %s\n",
-			      icem->name, cp->comp->id, scode, reason);
+			      ICEM_NAME(icem), cp->comp->id, scode, reason);
 		icem_candpair_failed(cp, err, scode);
 		break;
 	}
@@ -283,6 +286,7 @@ int icem_conncheck_send(struct ice_candpair *cp, bool use_cand, bool trigged)
 	case ICE_CAND_TYPE_SRFLX:
 	case ICE_CAND_TYPE_PRFLX:
 		cp->ct_conn = mem_deref(cp->ct_conn);
+		RE_TRACE_ASYNC_BEGIN("ice", "check", cp);
 		err = stun_request(&cp->ct_conn, icem->stun, icem->proto,
 				   cp->comp->sock, &cp->rcand->addr, presz,
 				   STUN_METHOD_BINDING,
@@ -47,6 +47,7 @@ struct icem_comp {
 	bool concluded;              /**< Concluded flag                    */
 	struct turnc *turnc;         /**< TURN Client                       */
 	struct tmr tmr_ka;           /**< Keep-alive timer                  */
+	struct stun_kaent *kae;      /**< Shared keep-alive entry           */
 };
 
 /** Defines an ICE media-stream */
@@ -69,13 +70,24 @@ struct icem {
 	struct list compl;           /**< ICE media components               */
 	char *lufrag;                /**< Local Username fragment            */
 	char *lpwd;                  /**< Local Password                     */
+	struct hmac *lhmac;          /**< HMAC-SHA1 keyed by local password  */
+	struct stun_kasched *kasched;/**< Shared keep-alive scheduler        */
 	char *rufrag;                /**< Remote Username fragment           */
 	char *rpwd;                  /**< Remote Password                    */
 	ice_connchk_h *chkh;         /**< Connectivity check handler         */
 	void *arg;                   /**< Handler argument                   */
+#if ICE_TRACE
 	char name[32];               /**< Name of the media stream           */
+#endif
 };
 
+/** Name of the ICE Media object, only kept in debug builds */
+#if ICE_TRACE
+#define ICEM_NAME(icem) ((icem)->name)
+#else
+#define ICEM_NAME(icem) ""
+#endif
+
 /** Defines a candidate */
 struct ice_cand {
 	struct le le;                /**< List element                       */
@@ -89,7 +101,7 @@ struct ice_cand {
 
 	/* extra for local */
 	struct ice_cand *base;       /**< Links to base candidate, if any    */
-	char *ifname;                /**< Network interface, for diagnostics */
+	char *ifname;                /**< Network interface, debug builds    */
 };
 
 /** Defines a candidate pair */
@@ -131,7 +143,10 @@ int  icem_candpair_alloc(struct ice_candpair **cpp, struct icem *icem,
 			 struct ice_cand *lcand, struct ice_cand *rcand);
 int  icem_candpair_clone(struct ice_candpair **cpp, struct ice_candpair *cp0,
 			 struct ice_cand *lcand, struct ice_cand *rcand);
+int  icem_candpair_prepend(struct list *lst, struct icem *icem,
+			   struct ice_cand *lcand, struct ice_cand *rcand);
 void icem_candpair_prio_order(struct list *lst);
+void icem_candpairs_merge(struct list *lst, struct list *newl);
 void icem_candpair_cancel(struct ice_candpair *cp);
 void icem_candpair_make_valid(struct ice_candpair *cp);
 void icem_candpair_failed(struct ice_candpair *cp, int err, uint16_t scode);
@@ -170,6 +185,7 @@ void icem_printf(struct icem *icem, const char *fmt, ...);
 /* Checklist */
 int  icem_checklist_form(struct icem *icem);
 void icem_checklist_update(struct icem *icem);
+int  icem_checklist_add_rcand(struct icem *icem, struct ice_cand *rcand);
 
 
 /* component */
@@ -10,6 +10,7 @@
 #include <re_list.h>
 #include <re_tmr.h>
 #include <re_sa.h>
+#include <re_hmac.h>
 #include <re_stun.h>
 #include <re_turn.h>
 #include <re_ice.h>
@@ -58,6 +59,8 @@ static void icem_destructor(void *data)
 	list_flush(&icem->rcandl);
 	mem_deref(icem->lufrag);
 	mem_deref(icem->lpwd);
+	mem_deref(icem->lhmac);
+	mem_deref(icem->kasched);
 	mem_deref(icem->rufrag);
 	mem_deref(icem->rpwd);
 	mem_deref(icem->stun);
@@ -131,6 +134,11 @@ int  icem_alloc(struct icem **icemp,
 	if (err)
 		goto out;
 
+	err = hmac_create(&icem->lhmac, HMAC_HASH_SHA1,
+			  (uint8_t *)lpwd, str_len(lpwd));
+	if (err)
+		goto out;
+
 	ice_determine_role(icem, role);
 
 	err = stun_alloc(&icem->stun, NULL, NULL, NULL);
@@ -212,7 +220,29 @@ void icem_set_name(struct icem *icem, const char *name)
 	if (!icem)
 		return;
 
+#if ICE_TRACE
 	str_ncpy(icem->name, name, sizeof(icem->name));
+#else
+	(void)name;
+#endif
+}
+
+
+/**
+ * Send the keep-alives of all components from a shared scheduler,
+ * instead of a timer for each component. Must be set before the
+ * connectivity checks are completed.
+ *
+ * @param icem ICE Media object
+ * @param ks   Keep-alive scheduler, NULL for a timer per component
+ */
+void icem_set_kasched(struct icem *icem, struct stun_kasched *ks)
+{
+	if (!icem)
+		return;
+
+	mem_deref(icem->kasched);
+	icem->kasched = mem_ref(ks);
 }
 
 
@@ -370,7 +400,7 @@ int icem_add_chan(struct icem *icem, unsigned compid, const struct sa *raddr)
 
 	if (comp->turnc) {
 		DEBUG_NOTICE("{%s.%u} Add TURN Channel to peer %J\n",
-			     comp->icem->name, comp->id, raddr);
+			     ICEM_NAME(comp->icem), comp->id, raddr);
 
 		return turnc_add_chan(comp->turnc, raddr, NULL, NULL);
 	}
@@ -383,7 +413,7 @@ static void purge_relayed(struct icem *icem, struct icem_comp *comp)
 {
 	if (comp->turnc) {
 		DEBUG_NOTICE("{%s.%u} purge local RELAY candidates\n",
-			     icem->name, comp->id);
+			     ICEM_NAME(icem), comp->id);
 	}
 
 	/*
@@ -452,7 +482,8 @@ int icem_debug(struct re_printf *pf, const struct icem *icem)
 	if (!icem)
 		return 0;
 
-	err |= re_hprintf(pf, "----- ICE Media <%s> -----\n", icem->name);
+	err |= re_hprintf(pf, "----- ICE Media <%s> -----\n",
+			  ICEM_NAME(icem));
 
 	err |= re_hprintf(pf, " local_mode=Full, remote_mode=%s",
 			  ice_mode2name(icem->rmode));
@@ -568,6 +599,6 @@ void icem_printf(struct icem *icem, const char *fmt, ...)
 		return;
 
 	va_start(ap, fmt);
-	(void)re_printf("{%11s. } %v", icem->name, fmt, &ap);
+	(void)re_printf("{%11s. } %v", ICEM_NAME(icem), fmt, &ap);
 	va_end(ap);
 }
@@ -207,7 +207,7 @@ static int cand_decode(struct icem *icem, const char *val)
 	if (ICE_TRANSP_NONE == transp_resolve(&transp)) {
 		DEBUG_NOTICE("<%s> ignoring candidate with"
 			     " unknown transport=%r (%r:%r)\n",
-			     icem->name, &transp, &cand_type, &addr);
+			     ICEM_NAME(icem), &transp, &cand_type, &addr);
 		return 0;
 	}
 
@@ -0,0 +1,451 @@
+/**
+ * @file lite.c  ICE-lite server for many peers on one UDP socket
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re_types.h>
+#include <re_fmt.h>
+#include <re_mem.h>
+#include <re_mbuf.h>
+#include <re_list.h>
+#include <re_hash.h>
+#include <re_sa.h>
+#include <re_udp.h>
+#include <re_hmac.h>
+#include <re_stun.h>
+#include <re_ice.h>
+
+
+/*
+ * The server is always the controlled agent (RFC 8445 section 6.1.1).
+ * Binding requests are demultiplexed by the local ufrag in USERNAME,
+ * and answered at once, without keeping any state per request. Other
+ * packets are demultiplexed by the remote address that was learned
+ * from a successful check, or nominated with USE-CANDIDATE.
+ */
+
+
+enum {
+	HT_SIZE = 64,
+	RESP_SIZE = 128,
+};
+
+
+struct ice_lite {
+	struct udp_sock *us;
+	struct hash *ht_ufrag;
+	struct hash *ht_addr;
+	struct mbuf *mb;
+};
+
+struct ice_lite_peer {
+	struct le le_ufrag;
+	struct le le_addr;
+	struct ice_lite *lite;
+	struct hmac *hmac;
+	char *lufrag;
+	char *lpwd;
+	char *rufrag;
+	struct sa raddr;
+	bool nominated;
+	ice_lite_estab_h *estabh;
+	ice_lite_recv_h *recvh;
+	void *arg;
+};
+
+
+static inline uint32_t ufrag_key(const char *p, size_t l)
+{
+	return hash_joaat((const uint8_t *)p, l);
+}
+
+
+static uint32_t ufrag_key_handler(const struct le *le)
+{
+	const struct ice_lite_peer *peer = le->data;
+
+	return ufrag_key(peer->lufrag, strlen(peer->lufrag));
+}
+
+
+static uint32_t addr_key_handler(const struct le *le)
+{
+	const struct ice_lite_peer *peer = le->data;
+
+	return sa_hash(&peer->raddr, SA_ALL);
+}
+
+
+static bool ufrag_cmp_handler(struct le *le, void *arg)
+{
+	const struct ice_lite_peer *peer = le->data;
+
+	return 0 == pl_strcmp(arg, peer->lufrag);
+}
+
+
+static bool addr_cmp_handler(struct le *le, void *arg)
+{
+	const struct ice_lite_peer *peer = le->data;
+
+	return sa_cmp(&peer->raddr, arg, SA_ALL);
+}
+
+
+static void reply(struct ice_lite *lite, const struct sa *src,
+		  const struct stun_view *req,
+		  const struct ice_lite_peer *peer,
+		  uint16_t scode, const char *reason)
+{
+	struct stun_errcode ec;
+	const uint8_t *key = NULL;
+	size_t keylen = 0;
+	uint8_t cls;
+	int err;
+
+	/* one buffer is reused for all responses */
+	lite->mb->pos = 0;
+	lite->mb->end = 0;
+
+	if (peer) {
+		key    = (const uint8_t *)peer->lpwd;
+		keylen = strlen(peer->lpwd);
+	}
+
+	ec.code   = scode;
+	ec.reason = (char *)reason;
+
+	cls = scode ? STUN_CLASS_ERROR_RESP : STUN_CLASS_SUCCESS_RESP;
+
+	err = stun_msg_encode(lite->mb, STUN_METHOD_BINDING, cls, req->tid,
+			      scode ? &ec : NULL, key, keylen, true, 0x20, 1,
+			      STUN_ATTR_XOR_MAPPED_ADDR, scode ? NULL : src);
+	if (err)
+		return;
+
+	lite->mb->pos = 0;
+
+	(void)udp_send(lite->us, src, lite->mb);
+}
+
+
+static void peer_select(struct ice_lite_peer *peer, const struct sa *src,
+			bool use_cand)
+{
+	if (peer->nominated || sa_cmp(&peer->raddr, src, SA_ALL)) {
+
+		if (use_cand)
+			peer->nominated = true;
+
+		return;
+	}
+
+	hash_unlink(&peer->le_addr);
+
+	peer->raddr     = *src;
+	peer->nominated = use_cand;
+
+	hash_append(peer->lite->ht_addr, sa_hash(src, SA_ALL),
+		    &peer->le_addr, peer);
+
+	if (peer->estabh)
+		peer->estabh(peer, src, peer->arg);
+}
+
+
+static void stun_handler(struct ice_lite *lite, const struct sa *src,
+			 struct mbuf *mb)
+{
+	struct stun_unknown_attr ua;
+	struct ice_lite_peer *peer;
+	struct stun_view req;
+	struct pl user, lu, ru;
+	uint32_t prio;
+	bool use_cand;
+	const char *p;
+	int err;
+
+	if (stun_view_decode(&req, mb, &ua))
+		return;
+
+	if (stun_view_method(&req) != STUN_METHOD_BINDING ||
+	    stun_view_class(&req) != STUN_CLASS_REQUEST)
+		return;
+
+	/* RFC 5389: Fingerprint errors are silently discarded */
+	if (stun_view_chk_fingerprint(&req))
+		return;
+
+	if (ua.typec > 0)
+		goto badmsg;
+
+	if (stun_view_str(&req, STUN_ATTR_USERNAME, &user))
+		goto badmsg;
+
+	p = pl_strchr(&user, ':');
+	if (!p)
+		goto badmsg;
+
+	lu.p = user.p;
+	lu.l = p - user.p;
+	ru.p = p + 1;
+	ru.l = user.l - lu.l - 1;
+
+	/* requests for unknown peers are dropped, not answered */
+	peer = list_ledata(hash_lookup(lite->ht_ufrag, ufrag_key(lu.p, lu.l),
+				       ufrag_cmp_handler, &lu));
+	if (!peer)
+		return;
+
+	err = stun_view_chk_mi_hmac(&req, peer->hmac);
+	if (err == EBADMSG)
+		goto unauth;
+	else if (err)
+		goto badmsg;
+
+	if (peer->rufrag && pl_strcmp(&ru, peer->rufrag))
+		goto unauth;
+
+	/* the remote agent must be controlling */
+	if (stun_view_attr(&req, STUN_ATTR_CONTROLLED)) {
+		reply(lite, src, &req, peer, 487, "Role Conflict");
+		return;
+	}
+
+	if (stun_view_u32(&req, STUN_ATTR_PRIORITY, &prio))
+		goto badmsg;
+
+	use_cand = NULL != stun_view_attr(&req, STUN_ATTR_USE_CAND);
+
+	reply(lite, src, &req, peer, 0, NULL);
+
+	peer_select(peer, src, use_cand);
+	return;
+
+ badmsg:
+	reply(lite, src, &req, NULL, 400, "Bad Request");
+	return;
+
+ unauth:
+	reply(lite, src, &req, peer, 401, "Unauthorized");
+}
+
+
+static void udp_recv_handler(const struct sa *src, struct mbuf *mb,
+			     void *arg)
+{
+	struct ice_lite *lite = arg;
+	struct ice_lite_peer *peer;
+
+	if (!mbuf_get_left(mb))
+		return;
+
+	/* RFC 7983: the first byte of a STUN message is 0 to 3 */
+	if (mbuf_buf(mb)[0] < 4) {
+		stun_handler(lite, src, mb);
+		return;
+	}
+
+	peer = list_ledata(hash_lookup(lite->ht_addr, sa_hash(src, SA_ALL),
+				       addr_cmp_handler, (void *)src));
+	if (peer && peer->recvh)
+		peer->recvh(peer, src, mb, peer->arg);
+}
+
+
+static void lite_destructor(void *data)
+{
+	struct ice_lite *lite = data;
+
+	mem_deref(lite->us);
+	mem_deref(lite->ht_ufrag);
+	mem_deref(lite->ht_addr);
+	mem_deref(lite->mb);
+}
+
+
+static void peer_destructor(void *data)
+{
+	struct ice_lite_peer *peer = data;
+
+	hash_unlink(&peer->le_ufrag);
+	hash_unlink(&peer->le_addr);
+	mem_deref(peer->hmac);
+	mem_deref(peer->lufrag);
+	mem_deref(peer->lpwd);
+	mem_deref(peer->rufrag);
+	mem_deref(peer->lite);
+}
+
+
+/**
+ * Allocate an ICE-lite server, that serves many peers on one UDP socket
+ *
+ * @param litep Pointer to allocated ICE-lite server
+ * @param laddr Local address of UDP socket
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int ice_lite_alloc(struct ice_lite **litep, const struct sa *laddr)
+{
+	struct ice_lite *lite;
+	int err;
+
+	if (!litep || !laddr)
+		return EINVAL;
+
+	lite = mem_zalloc(sizeof(*lite), lite_destructor);
+	if (!lite)
+		return ENOMEM;
+
+	err  = hash_alloc_auto(&lite->ht_ufrag, HT_SIZE, ufrag_key_handler);
+	err |= hash_alloc_auto(&lite->ht_addr, HT_SIZE, addr_key_handler);
+	if (err)
+		goto out;
+
+	lite->mb = mbuf_alloc(RESP_SIZE);
+	if (!lite->mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = udp_listen(&lite->us, laddr, udp_recv_handler, lite);
+
+ out:
+	if (err)
+		mem_deref(lite);
+	else
+		*litep = lite;
+
+	return err;
+}
+
+
+/**
+ * Get the UDP socket of an ICE-lite server
+ *
+ * @param lite ICE-lite server
+ *
+ * @return UDP socket
+ */
+struct udp_sock *ice_lite_sock(const struct ice_lite *lite)
+{
+	return lite ? lite->us : NULL;
+}
+
+
+/**
+ * Add a peer to an ICE-lite server. The peer holds a reference to the
+ * server, and is removed when it is dereferenced.
+ *
+ * @param peerp  Pointer to allocated peer
+ * @param lite   ICE-lite server
+ * @param lufrag Local username fragment, unique for the server
+ * @param lpwd   Local password
+ * @param rufrag Remote username fragment (optional)
+ * @param estabh Handler called when the remote address is set (optional)
+ * @param recvh  Handler for packets from the remote address (optional)
+ * @param arg    Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int ice_lite_peer_add(struct ice_lite_peer **peerp, struct ice_lite *lite,
+		      const char *lufrag, const char *lpwd,
+		      const char *rufrag, ice_lite_estab_h *estabh,
+		      ice_lite_recv_h *recvh, void *arg)
+{
+	struct ice_lite_peer *peer;
+	struct pl pl;
+	int err;
+
+	if (!peerp || !lite || !str_isset(lufrag) || !str_isset(lpwd))
+		return EINVAL;
+
+	pl_set_str(&pl, lufrag);
+
+	if (hash_lookup(lite->ht_ufrag, ufrag_key(pl.p, pl.l),
+			ufrag_cmp_handler, &pl))
+		return EADDRINUSE;
+
+	peer = mem_zalloc(sizeof(*peer), peer_destructor);
+	if (!peer)
+		return ENOMEM;
+
+	err  = str_dup(&peer->lufrag, lufrag);
+	err |= str_dup(&peer->lpwd, lpwd);
+	if (rufrag)
+		err |= str_dup(&peer->rufrag, rufrag);
+	if (err)
+		goto out;
+
+	err = hmac_create(&peer->hmac, HMAC_HASH_SHA1,
+			  (uint8_t *)lpwd, strlen(lpwd));
+	if (err)
+		goto out;
+
+	peer->lite   = mem_ref(lite);
+	peer->estabh = estabh;
+	peer->recvh  = recvh;
+	peer->arg    = arg;
+
+	hash_append(lite->ht_ufrag, ufrag_key(pl.p, pl.l),
+		    &peer->le_ufrag, peer);
+
+ out:
+	if (err)
+		mem_deref(peer);
+	else
+		*peerp = peer;
+
+	return err;
+}
+
+
+/**
+ * Send a packet to the remote address of an ICE-lite peer
+ *
+ * @param peer ICE-lite peer
+ * @param mb   Buffer to send
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int ice_lite_send(struct ice_lite_peer *peer, struct mbuf *mb)
+{
+	if (!peer || !mb)
+		return EINVAL;
+
+	if (!sa_isset(&peer->raddr, SA_ALL))
+		return ENOTCONN;
+
+	return udp_send(peer->lite->us, &peer->raddr, mb);
+}
+
+
+/**
+ * Get the remote address of an ICE-lite peer
+ *
+ * @param peer ICE-lite peer
+ *
+ * @return Remote address if set, otherwise NULL
+ */
+const struct sa *ice_lite_peer_raddr(const struct ice_lite_peer *peer)
+{
+	if (!peer || !sa_isset(&peer->raddr, SA_ALL))
+		return NULL;
+
+	return &peer->raddr;
+}
+
+
+/**
+ * Check if the remote address of an ICE-lite peer was nominated
+ *
+ * @param peer ICE-lite peer
+ *
+ * @return True if nominated, otherwise false
+ */
+bool ice_lite_peer_nominated(const struct ice_lite_peer *peer)
+{
+	return peer ? peer->nominated : false;
+}
@@ -12,5 +12,6 @@ SRCS	+= ice/connchk.c
 SRCS	+= ice/icem.c
 SRCS	+= ice/icesdp.c
 SRCS	+= ice/icestr.c
+SRCS	+= ice/lite.c
 SRCS	+= ice/stunsrv.c
 SRCS	+= ice/util.c
@@ -116,7 +116,7 @@ static int handle_stun_full(struct icem *icem,
 	if (!lcand) {
 		DEBUG_WARNING("{%s.%u} local candidate not found"
 			      " (checklist=%u) (src=%J)\n",
-			      icem->name, comp->id,
+			      ICEM_NAME(icem), comp->id,
 			      list_count(&icem->checkl), src);
 		return 0;
 	}
@@ -128,7 +128,7 @@ static int handle_stun_full(struct icem *icem,
 		if (!cp) {
 			DEBUG_WARNING("{%s.%u} candidate pair not found:"
 				      " source=%J\n",
-				      icem->name, comp->id, src);
+				      ICEM_NAME(icem), comp->id, src);
 			return 0;
 		}
 	}
@@ -192,7 +192,7 @@ int icem_stund_recv(struct icem_comp *comp, const struct sa *src,
 	if (err)
 		return err;
 
-	err = stun_msg_chk_mi(req, (uint8_t *)icem->lpwd, strlen(icem->lpwd));
+	err = stun_msg_chk_mi_hmac(req, icem->lhmac);
 	if (err) {
 		if (err == EBADMSG)
 			goto unauth;
@@ -9,6 +9,8 @@
 #include <re_list.h>
 #include <re_mbuf.h>
 #include <re_mem.h>
+#include <re_tmr.h>
+#include <re_sa.h>
 #include <re_rtp.h>
 #include <re_jbuf.h>
 
@@ -23,6 +25,15 @@
 #endif
 
 
+/** Adaptive depth control */
+enum {
+	ADAPT_PERIOD = 16,    /**< Puts between target updates          */
+	ADAPT_SHRINK = 4,     /**< Periods between target decrements    */
+	ADAPT_JITTER = 4,     /**< Target delay in multiples of jitter  */
+	ADAPT_LATE   = 256000 /**< Late ratio of one [per mille x 256]  */
+};
+
+
 #if JBUF_STAT
 #define STAT_ADD(var, value)  (jb->stat.var) += (value) /**< Stats add */
 #define STAT_INC(var)         ++(jb->stat.var)          /**< Stats inc */
@@ -39,22 +50,44 @@ struct frame {
 	void *mem;              /**< Reference counted pointer */
 };
 
+/** Defines a frame slot in the ring buffer */
+struct slot {
+	struct rtp_header hdr;  /**< RTP Header                */
+	void *mem;              /**< Reference counted pointer */
+	bool used;              /**< Slot holds a frame        */
+};
+
 
 /**
  * Defines a jitter buffer
  *
  * The jitter buffer is for incoming RTP packets, which are sorted by
- * sequence number.
+ * sequence number. The frames are kept in a sorted list, or in a ring
+ * indexed by sequence number if allocated with jbuf_ring_alloc().
  */
 struct jbuf {
 	struct list pooll;   /**< List of free frames in pool               */
 	struct list framel;  /**< List of buffered frames                   */
+	struct slot *slotv;  /**< Ring of frame slots, or NULL              */
+	uint32_t mask;       /**< Ring size minus one                       */
+	uint16_t head;       /**< Sequence number of oldest frame in ring   */
+	uint16_t top;        /**< Sequence number of newest frame in ring   */
 	uint32_t n;          /**< [# frames] Current # of frames in buffer  */
 	uint32_t min;        /**< [# frames] Minimum # of frames to buffer  */
 	uint32_t max;        /**< [# frames] Maximum # of frames to buffer  */
 	uint16_t seq_put;    /**< Sequence number for last jbuf_put()       */
 	bool running;        /**< Jitter buffer is running                  */
 
+	/* Adaptive mode */
+	struct rtp_sock *rs; /**< RTP socket with jitter, or NULL           */
+	uint64_t ts_arrive;  /**< [us] Arrival time of last in-order frame  */
+	int32_t ival;        /**< [us] Mean frame interval                  */
+	int32_t late;        /**< [1/1000 x 256] Recent late ratio          */
+	uint32_t target;     /**< [# frames] Target number of frames        */
+	uint32_t nput;       /**< Number of puts in adaptive mode           */
+	uint32_t nget;       /**< Number of gets in adaptive mode           */
+	bool late_seen;      /**< A frame was late in this period           */
+
 #if JBUF_STAT
 	uint16_t seq_get;      /**< Timestamp of last played frame */
 	struct jbuf_stat stat; /**< Jitter buffer Statistics       */
@@ -120,6 +153,64 @@ static void jbuf_destructor(void *data)
 
 	/* Free all frames in the pool list */
 	list_flush(&jb->pooll);
+	mem_deref(jb->slotv);
+	mem_deref(jb->rs);
+}
+
+
+/* Move the target depth towards the jitter measured by RTCP */
+static void adapt_update(struct jbuf *jb, uint32_t ssrc)
+{
+	struct rtcp_stats stats;
+	uint32_t want = jb->target;
+
+	if (jb->ival > 0 && !rtcp_stats(jb->rs, ssrc, &stats)) {
+
+		want = (uint32_t)((ADAPT_JITTER * (uint64_t)stats.rx.jit +
+				   jb->ival - 1) / jb->ival);
+		want = max(want, jb->min);
+		want = min(want, jb->max);
+	}
+
+	if ((jb->late_seen || want > jb->target) && jb->target < jb->max) {
+		++jb->target;
+	}
+	else if (want < jb->target &&
+		 !(jb->nput % (ADAPT_PERIOD * ADAPT_SHRINK))) {
+		--jb->target;
+	}
+
+	jb->late_seen = false;
+}
+
+
+static void adapt_put(struct jbuf *jb, const struct rtp_header *hdr,
+		      bool late)
+{
+	const uint64_t now = tmr_jiffies_usec();
+
+	jb->late += ((late ? ADAPT_LATE : 0) - jb->late) / 64;
+	jb->late_seen |= late;
+
+	if (!late && jb->running && seq_less(jb->seq_put, hdr->seq)) {
+
+		const uint16_t k = hdr->seq - jb->seq_put;
+		const int32_t d = (int32_t)((now - jb->ts_arrive) / k);
+
+		/* Silence gaps are not part of the frame interval */
+		if (!jb->ival)
+			jb->ival = jb->ts_arrive ? d : 0;
+		else if (d < 4 * jb->ival)
+			jb->ival += (d - jb->ival) / 16;
+
+		jb->ts_arrive = now;
+	}
+	else if (!jb->running) {
+		jb->ts_arrive = now;
+	}
+
+	if (!(++jb->nput % ADAPT_PERIOD))
+		adapt_update(jb, hdr->ssrc);
 }
 
 
@@ -180,6 +271,178 @@ int jbuf_alloc(struct jbuf **jbp, uint32_t min, uint32_t max)
 }
 
 
+/**
+ * Allocate a new jitter buffer, where the frames are kept in a ring
+ * indexed by sequence number. Frames are put and got in constant time,
+ * but a frame that is more than twice the maximum delay away from the
+ * oldest frame does not fit in the ring; a newer frame makes room by
+ * dropping the oldest frames, and an older frame is late.
+ *
+ * @param jbp  Pointer to returned jitter buffer
+ * @param min  Minimum delay in [frames]
+ * @param max  Maximum delay in [frames]
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int jbuf_ring_alloc(struct jbuf **jbp, uint32_t min, uint32_t max)
+{
+	struct jbuf *jb;
+	uint32_t size = 2;
+
+	if (!jbp || !max || min > max || max > 16384)
+		return EINVAL;
+
+	DEBUG_INFO("alloc ring: delay=%u-%u frames\n", min, max);
+
+	while (size < 2 * max)
+		size <<= 1;
+
+	jb = mem_zalloc(sizeof(*jb), jbuf_destructor);
+	if (!jb)
+		return ENOMEM;
+
+	jb->slotv = mem_zalloc(size * sizeof(*jb->slotv), NULL);
+	if (!jb->slotv) {
+		mem_deref(jb);
+		return ENOMEM;
+	}
+
+	jb->mask = size - 1;
+	jb->min  = min;
+	jb->max  = max;
+
+	*jbp = jb;
+
+	return 0;
+}
+
+
+static inline struct slot *ring_slot(const struct jbuf *jb, uint16_t seq)
+{
+	return &jb->slotv[seq & jb->mask];
+}
+
+
+/* Release the oldest frame, and find the next one */
+static void ring_pop(struct jbuf *jb)
+{
+	struct slot *s = ring_slot(jb, jb->head);
+
+	s->mem  = mem_deref(s->mem);
+	s->used = false;
+
+	if (!--jb->n)
+		return;
+
+	do {
+		++jb->head;
+	} while (!ring_slot(jb, jb->head)->used);
+}
+
+
+static int ring_put(struct jbuf *jb, const struct rtp_header *hdr,
+		    void *mem)
+{
+	const uint16_t seq = hdr->seq;
+	struct slot *s;
+
+	if (jb->n) {
+
+		if (seq_less(seq, jb->head)) {
+
+			/* Too old to fit in the ring */
+			if ((uint16_t)(jb->top - seq) > jb->mask) {
+				STAT_INC(n_late);
+				DEBUG_INFO("packet too late: seq=%u"
+					   " (head=%u)\n", seq, jb->head);
+				return ETIMEDOUT;
+			}
+		}
+		else if (!seq_less(jb->top, seq)) {
+
+			s = ring_slot(jb, seq);
+
+			if (s->used && s->hdr.seq == seq) {
+				DEBUG_INFO("duplicate: seq=%u\n", seq);
+				STAT_INC(n_dups);
+				return EALREADY;
+			}
+		}
+	}
+
+	if (jb->n >= jb->max) {
+		STAT_INC(n_overflow);
+		DEBUG_INFO("drop 1 old frame seq=%u\n", jb->head);
+		ring_pop(jb);
+	}
+
+	if (!jb->n) {
+		jb->head = jb->top = seq;
+	}
+	else if (seq_less(jb->top, seq)) {
+
+		/* Make room in the ring for the new frame */
+		while (jb->n && (uint16_t)(seq - jb->head) > jb->mask) {
+			STAT_INC(n_overflow);
+			ring_pop(jb);
+		}
+
+		if (!jb->n)
+			jb->head = seq;
+
+		jb->top = seq;
+	}
+	else {
+		if (seq_less(seq, jb->head))
+			jb->head = seq;
+
+		STAT_INC(n_oos);
+	}
+
+	s = ring_slot(jb, seq);
+
+	s->hdr  = *hdr;
+	s->mem  = mem_ref(mem);
+	s->used = true;
+	++jb->n;
+
+	jb->running = true;
+	jb->seq_put = seq;
+
+	return 0;
+}
+
+
+/**
+ * Enable adaptive depth control. The target number of frames is kept
+ * between min and max, and follows the inter-arrival jitter that RTCP
+ * measures for the source of the frames. It is increased when frames
+ * arrive too late, and decreased slowly when the jitter goes down. The
+ * RTP socket must have RTCP enabled and the receive sampling rate set.
+ *
+ * @param jb Jitter buffer
+ * @param rs RTP socket of the received frames, NULL to disable
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int jbuf_set_adaptive(struct jbuf *jb, struct rtp_sock *rs)
+{
+	if (!jb)
+		return EINVAL;
+
+	mem_deref(jb->rs);
+	jb->rs = mem_ref(rs);
+
+	jb->target    = jb->min;
+	jb->late      = 0;
+	jb->nput      = 0;
+	jb->nget      = 0;
+	jb->late_seen = false;
+
+	return 0;
+}
+
+
 /**
  * Put one frame into the jitter buffer
  *
@@ -210,10 +473,22 @@ int jbuf_put(struct jbuf *jb, const struct rtp_header *hdr, void *mem)
 			STAT_INC(n_late);
 			DEBUG_INFO("packet too late: seq=%u (seq_put=%u)\n",
 				   seq, jb->seq_put);
+			if (jb->rs)
+				adapt_put(jb, hdr, true);
 			return ETIMEDOUT;
 		}
 	}
 
+	if (jb->rs)
+		adapt_put(jb, hdr, false);
+
+	if (jb->slotv) {
+		err = ring_put(jb, hdr, mem);
+		if (err == ETIMEDOUT && jb->rs)
+			jb->late_seen = true;
+		return err;
+	}
+
 	frame_alloc(jb, &f);
 
 	tail = jb->framel.tail;
@@ -282,48 +557,75 @@ int jbuf_put(struct jbuf *jb, const struct rtp_header *hdr, void *mem)
  */
 int jbuf_get(struct jbuf *jb, struct rtp_header *hdr, void **mem)
 {
-	struct frame *f;
+	const struct rtp_header *fhdr;
+	struct frame *f = NULL;
+	struct slot *s = NULL;
+	uint32_t depth;
 
 	if (!jb || !hdr || !mem)
 		return EINVAL;
 
 	STAT_INC(n_get);
 
-	if (jb->n <= jb->min || !jb->framel.head) {
+	depth = jb->rs ? jb->target : jb->min;
+
+	if (jb->n <= depth || (!jb->slotv && !jb->framel.head)) {
 		DEBUG_INFO("not enough buffer frames - wait.. (n=%u min=%u)\n",
-			   jb->n, jb->min);
+			   jb->n, depth);
 		STAT_INC(n_underflow);
 		return ENOENT;
 	}
 
+	/* Shrink towards the target, one frame per period */
+	if (jb->rs && !(++jb->nget % ADAPT_PERIOD) && jb->n > depth + 1) {
+		STAT_INC(n_overflow);
+		if (jb->slotv)
+			ring_pop(jb);
+		else
+			frame_deref(jb, jb->framel.head->data);
+	}
+
 	/* When we get one frame F[i], check that the next frame F[i+1]
 	   is present and have a seq no. of seq[i] + 1 !
 	   if not, we should consider that packet lost */
 
-	f = jb->framel.head->data;
+	if (jb->slotv) {
+		s = ring_slot(jb, jb->head);
+		fhdr = &s->hdr;
+	}
+	else {
+		f = jb->framel.head->data;
+		fhdr = &f->hdr;
+	}
 
 #if JBUF_STAT
 	/* Check timestamp of previously played frame */
 	if (jb->seq_get) {
-		const int16_t seq_diff = f->hdr.seq - jb->seq_get;
-		if (seq_less(f->hdr.seq, jb->seq_get)) {
-			DEBUG_WARNING("get: seq=%u too late\n", f->hdr.seq);
+		const int16_t seq_diff = fhdr->seq - jb->seq_get;
+		if (seq_less(fhdr->seq, jb->seq_get)) {
+			DEBUG_WARNING("get: seq=%u too late\n", fhdr->seq);
 		}
 		else if (seq_diff > 1) {
 			STAT_ADD(n_lost, 1);
 			DEBUG_INFO("get: n_lost: diff=%d,seq=%u,seq_get=%u\n",
-				   seq_diff, f->hdr.seq, jb->seq_get);
+				   seq_diff, fhdr->seq, jb->seq_get);
 		}
 	}
 
 	/* Update sequence number for 'get' */
-	jb->seq_get = f->hdr.seq;
+	jb->seq_get = fhdr->seq;
 #endif
 
-	*hdr = f->hdr;
-	*mem = mem_ref(f->mem);
+	*hdr = *fhdr;
 
-	frame_deref(jb, f);
+	if (s) {
+		*mem = mem_ref(s->mem);
+		ring_pop(jb);
+	}
+	else {
+		*mem = mem_ref(f->mem);
+		frame_deref(jb, f);
+	}
 
 	return 0;
 }
@@ -344,10 +646,13 @@ void jbuf_flush(struct jbuf *jb)
 	if (!jb)
 		return;
 
-	if (jb->framel.head) {
+	if (jb->n) {
 		DEBUG_INFO("flush: %u frames\n", jb->n);
 	}
 
+	while (jb->slotv && jb->n)
+		ring_pop(jb);
+
 	/* put all buffered frames back in free list */
 	for (le = jb->framel.head; le; le = jb->framel.head) {
 		DEBUG_INFO(" flush frame: seq=%u\n",
@@ -385,6 +690,9 @@ int jbuf_stats(const struct jbuf *jb, struct jbuf_stat *jstat)
 #if JBUF_STAT
 	*jstat = jb->stat;
 
+	jstat->target     = jb->rs ? jb->target : jb->min;
+	jstat->late_ratio = (uint32_t)(jb->late / 256);
+
 	return 0;
 #else
 	return ENOSYS;
@@ -413,6 +721,11 @@ int jbuf_debug(struct re_printf *pf, const struct jbuf *jb)
 	err |= re_hprintf(pf, " min=%u cur=%u max=%u [frames]\n",
 			  jb->min, jb->n, jb->max);
 	err |= re_hprintf(pf, " seq_put=%u\n", jb->seq_put);
+	if (jb->rs) {
+		err |= re_hprintf(pf, " adaptive: target=%u interval=%dus"
+				  " late=%d/1000\n", jb->target, jb->ival,
+				  jb->late / 256);
+	}
 
 #if JBUF_STAT
 	err |= re_hprintf(pf, " Stat: put=%u", jb->stat.n_put);
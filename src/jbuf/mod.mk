@@ -5,3 +5,4 @@
 #
 
 SRCS	+= jbuf/jbuf.c
+SRCS	+= jbuf/spsc.c
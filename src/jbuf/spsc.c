@@ -0,0 +1,382 @@
+/**
+ * @file spsc.c  Lock-free single-producer/single-consumer jitter buffer
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re_types.h>
+#include <re_fmt.h>
+#include <re_mem.h>
+#include <re_sa.h>
+#include <re_rtp.h>
+#include <re_jbuf.h>
+
+
+#define DEBUG_MODULE "jbuf_spsc"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+/*
+ * Frames are copied into a ring of slots indexed by sequence number, one
+ * thread puts frames and another thread gets them. A slot is owned by the
+ * producer while it is empty, and by the consumer while it is full; the
+ * flag is handed over with release/acquire ordering. The read position is
+ * only written by the consumer and the write position only by the
+ * producer, so there are no locks and no memory allocations after
+ * jbuf_spsc_alloc().
+ *
+ * A frame that is put while the consumer moves past its sequence number
+ * leaves a stale full slot behind, which the consumer clears the next time
+ * it gets to that slot.
+ */
+
+
+/** Cache line size, to keep producer and consumer state apart */
+#define CACHE_LINE 64
+
+
+/** Defines a frame slot */
+struct spsc_slot {
+	struct rtp_header hdr;  /**< RTP Header                   */
+	size_t len;             /**< Length of frame data         */
+	uint8_t *buf;           /**< Frame data                   */
+	uint32_t full;          /**< Slot holds a frame           */
+};
+
+/** Statistics updated by the producer */
+struct spsc_pstat {
+	uint32_t n_put;
+	uint32_t n_oos;
+	uint32_t n_dups;
+	uint32_t n_late;
+	uint32_t n_overflow;
+};
+
+/** Statistics updated by the consumer */
+struct spsc_cstat {
+	uint32_t n_get;
+	uint32_t n_lost;
+	uint32_t n_underflow;
+	uint32_t n_flush;
+};
+
+/** Defines a single-producer/single-consumer jitter buffer */
+struct jbuf_spsc {
+	struct spsc_slot *slotv;   /**< Ring of frame slots              */
+	uint8_t *data;             /**< Frame data of all slots          */
+	size_t frame_size;         /**< Maximum frame size [bytes]       */
+	uint32_t mask;             /**< Ring size minus one              */
+	uint32_t min;              /**< [# frames] Minimum to buffer     */
+	uint32_t started;          /**< First frame was put              */
+
+	/* Producer */
+	uint8_t pad0[CACHE_LINE];
+	uint32_t wr;               /**< Newest sequence number plus one  */
+	struct spsc_pstat pstat;   /**< Producer statistics              */
+
+	/* Consumer */
+	uint8_t pad1[CACHE_LINE];
+	uint32_t rd;               /**< Next sequence number to get      */
+	struct spsc_cstat cstat;   /**< Consumer statistics              */
+	uint8_t pad2[CACHE_LINE];
+};
+
+
+/** Is x less than y? */
+static inline bool seq_less(uint16_t x, uint16_t y)
+{
+	return ((int16_t)(x - y)) < 0;
+}
+
+
+/* Only called by the thread that owns the counter */
+static inline void stat_inc(uint32_t *v)
+{
+	__atomic_store_n(v, *v + 1, __ATOMIC_RELAXED);
+}
+
+
+static inline uint32_t stat_get(const uint32_t *v)
+{
+	return __atomic_load_n(v, __ATOMIC_RELAXED);
+}
+
+
+static void destructor(void *arg)
+{
+	struct jbuf_spsc *jb = arg;
+
+	mem_deref(jb->slotv);
+	mem_deref(jb->data);
+}
+
+
+/**
+ * Allocate a lock-free jitter buffer, for one thread that puts frames and
+ * one other thread that gets them. The frames are copied in and out, so
+ * no memory is allocated or freed while the buffer is in use.
+ *
+ * @param jbp        Pointer to returned jitter buffer
+ * @param min        Minimum delay in [frames]
+ * @param max        Maximum delay in [frames]
+ * @param frame_size Maximum frame size in [bytes]
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int jbuf_spsc_alloc(struct jbuf_spsc **jbp, uint32_t min, uint32_t max,
+		    size_t frame_size)
+{
+	struct jbuf_spsc *jb;
+	uint32_t i, size = 2;
+	int err = 0;
+
+	if (!jbp || !max || min > max || max > 16384 || !frame_size)
+		return EINVAL;
+
+	while (size < max)
+		size <<= 1;
+
+	jb = mem_zalloc(sizeof(*jb), destructor);
+	if (!jb)
+		return ENOMEM;
+
+	jb->slotv = mem_zalloc(size * sizeof(*jb->slotv), NULL);
+	jb->data  = mem_alloc(size * frame_size, NULL);
+	if (!jb->slotv || !jb->data) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	for (i=0; i<size; i++)
+		jb->slotv[i].buf = jb->data + i * frame_size;
+
+	jb->frame_size = frame_size;
+	jb->mask       = size - 1;
+	jb->min        = min;
+
+ out:
+	if (err)
+		mem_deref(jb);
+	else
+		*jbp = jb;
+
+	return err;
+}
+
+
+/**
+ * Put one frame into the jitter buffer, from the producer thread
+ *
+ * @param jb   Jitter buffer
+ * @param hdr  RTP Header
+ * @param data Frame data - will be copied
+ * @param len  Length of frame data
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int jbuf_spsc_put(struct jbuf_spsc *jb, const struct rtp_header *hdr,
+		  const uint8_t *data, size_t len)
+{
+	struct spsc_slot *s;
+	uint16_t seq, rd;
+
+	if (!jb || !hdr || (!data && len))
+		return EINVAL;
+
+	if (len > jb->frame_size)
+		return EOVERFLOW;
+
+	seq = hdr->seq;
+
+	stat_inc(&jb->pstat.n_put);
+
+	if (!__atomic_load_n(&jb->started, __ATOMIC_RELAXED)) {
+
+		/* The consumer does not touch rd before started is set */
+		jb->rd = seq;
+		jb->wr = seq;
+	}
+
+	rd = (uint16_t)__atomic_load_n(&jb->rd, __ATOMIC_ACQUIRE);
+
+	if (seq_less(seq, rd)) {
+		stat_inc(&jb->pstat.n_late);
+		DEBUG_INFO("packet too late: seq=%u (rd=%u)\n", seq, rd);
+		return ETIMEDOUT;
+	}
+
+	if ((uint16_t)(seq - rd) > jb->mask) {
+		stat_inc(&jb->pstat.n_overflow);
+		DEBUG_INFO("buffer full: drop seq=%u (rd=%u)\n", seq, rd);
+		return ENOSPC;
+	}
+
+	s = &jb->slotv[seq & jb->mask];
+
+	if (__atomic_load_n(&s->full, __ATOMIC_ACQUIRE)) {
+
+		if (s->hdr.seq == seq) {
+			stat_inc(&jb->pstat.n_dups);
+			return EALREADY;
+		}
+
+		stat_inc(&jb->pstat.n_overflow);
+		return ENOSPC;
+	}
+
+	s->hdr = *hdr;
+	s->len = len;
+	if (len)
+		memcpy(s->buf, data, len);
+
+	__atomic_store_n(&s->full, 1, __ATOMIC_RELEASE);
+
+	if (seq_less((uint16_t)(jb->wr - 1), seq) ||
+	    !__atomic_load_n(&jb->started, __ATOMIC_RELAXED)) {
+		__atomic_store_n(&jb->wr, (uint16_t)(seq + 1),
+				 __ATOMIC_RELEASE);
+	}
+	else {
+		stat_inc(&jb->pstat.n_oos);
+	}
+
+	__atomic_store_n(&jb->started, 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+
+/**
+ * Get one frame from the jitter buffer, from the consumer thread. This
+ * function does not block.
+ *
+ * @param jb   Jitter buffer
+ * @param hdr  Returned RTP Header
+ * @param buf  Buffer for the frame data
+ * @param size Size of buffer
+ * @param len  Returned length of frame data
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int jbuf_spsc_get(struct jbuf_spsc *jb, struct rtp_header *hdr,
+		  uint8_t *buf, size_t size, size_t *len)
+{
+	uint16_t rd, wr;
+
+	if (!jb || !hdr || !buf || !len)
+		return EINVAL;
+
+	stat_inc(&jb->cstat.n_get);
+
+	if (!__atomic_load_n(&jb->started, __ATOMIC_ACQUIRE)) {
+		stat_inc(&jb->cstat.n_underflow);
+		return ENOENT;
+	}
+
+	wr = (uint16_t)__atomic_load_n(&jb->wr, __ATOMIC_ACQUIRE);
+	rd = (uint16_t)jb->rd;
+
+	if ((uint16_t)(wr - rd) <= jb->min) {
+		stat_inc(&jb->cstat.n_underflow);
+		return ENOENT;
+	}
+
+	for (; rd != wr; rd++) {
+
+		struct spsc_slot *s = &jb->slotv[rd & jb->mask];
+
+		if (!__atomic_load_n(&s->full, __ATOMIC_ACQUIRE)) {
+			stat_inc(&jb->cstat.n_lost);
+			continue;
+		}
+
+		if (s->hdr.seq != rd) {
+			__atomic_store_n(&s->full, 0, __ATOMIC_RELEASE);
+			stat_inc(&jb->cstat.n_lost);
+			continue;
+		}
+
+		if (s->len > size) {
+			__atomic_store_n(&jb->rd, rd, __ATOMIC_RELEASE);
+			return EOVERFLOW;
+		}
+
+		*hdr = s->hdr;
+		*len = s->len;
+		if (s->len)
+			memcpy(buf, s->buf, s->len);
+
+		__atomic_store_n(&s->full, 0, __ATOMIC_RELEASE);
+		__atomic_store_n(&jb->rd, (uint16_t)(rd + 1),
+				 __ATOMIC_RELEASE);
+
+		return 0;
+	}
+
+	__atomic_store_n(&jb->rd, rd, __ATOMIC_RELEASE);
+	stat_inc(&jb->cstat.n_underflow);
+
+	return ENOENT;
+}
+
+
+/**
+ * Flush all frames in the jitter buffer, from the consumer thread
+ *
+ * @param jb Jitter buffer
+ */
+void jbuf_spsc_flush(struct jbuf_spsc *jb)
+{
+	uint16_t rd, wr;
+
+	if (!jb || !__atomic_load_n(&jb->started, __ATOMIC_ACQUIRE))
+		return;
+
+	wr = (uint16_t)__atomic_load_n(&jb->wr, __ATOMIC_ACQUIRE);
+
+	/* Empty slots are owned by the producer */
+	for (rd = (uint16_t)jb->rd; rd != wr; rd++) {
+
+		struct spsc_slot *s = &jb->slotv[rd & jb->mask];
+
+		if (__atomic_load_n(&s->full, __ATOMIC_ACQUIRE))
+			__atomic_store_n(&s->full, 0, __ATOMIC_RELEASE);
+	}
+
+	__atomic_store_n(&jb->rd, wr, __ATOMIC_RELEASE);
+
+	stat_inc(&jb->cstat.n_flush);
+}
+
+
+/**
+ * Get jitter buffer statistics, from any thread
+ *
+ * @param jb    Jitter buffer
+ * @param jstat Pointer to statistics storage
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int jbuf_spsc_stats(const struct jbuf_spsc *jb, struct jbuf_stat *jstat)
+{
+	if (!jb || !jstat)
+		return EINVAL;
+
+	memset(jstat, 0, sizeof(*jstat));
+
+	jstat->n_put       = stat_get(&jb->pstat.n_put);
+	jstat->n_oos       = stat_get(&jb->pstat.n_oos);
+	jstat->n_dups      = stat_get(&jb->pstat.n_dups);
+	jstat->n_late      = stat_get(&jb->pstat.n_late);
+	jstat->n_overflow  = stat_get(&jb->pstat.n_overflow);
+	jstat->n_get       = stat_get(&jb->cstat.n_get);
+	jstat->n_lost      = stat_get(&jb->cstat.n_lost);
+	jstat->n_underflow = stat_get(&jb->cstat.n_underflow);
+	jstat->n_flush     = stat_get(&jb->cstat.n_flush);
+	jstat->target      = jb->min;
+	jstat->late_ratio  = jstat->n_put ?
+		(uint32_t)(1000ULL * jstat->n_late / jstat->n_put) : 0;
+
+	return 0;
+}
@@ -4,13 +4,18 @@
  * Copyright (C) 2010 - 2015 Creytiv.com
  */
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include <re_types.h>
 #include <re_fmt.h>
 #include <re_mem.h>
+#include <re_mbuf.h>
 #include <re_list.h>
 #include <re_hash.h>
 #include <re_odict.h>
 #include <re_json.h>
+#include "json.h"
 
 
 static inline long double mypower10(uint64_t e)
@@ -29,6 +34,40 @@ static inline long double mypower10(uint64_t e)
 }
 
 
+/* Powers of ten that are exact in a double */
+static const double pow10_exact[] = {
+	1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10,
+	1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21,
+	1e22,
+};
+
+
+/* Length of string content before the next quote or escape */
+size_t json_str_span(const char *p, size_t len)
+{
+	size_t i = 0;
+
+#if defined(__SSE2__)
+	const __m128i q = _mm_set1_epi8('"');
+	const __m128i b = _mm_set1_epi8('\\');
+
+	for (; i + 16 <= len; i += 16) {
+
+		const __m128i x = _mm_loadu_si128((const __m128i *)(p + i));
+
+		if (_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x, q),
+						   _mm_cmpeq_epi8(x, b))))
+			break;
+	}
+#endif
+
+	while (i < len && p[i] != '"' && p[i] != '\\')
+		++i;
+
+	return i;
+}
+
+
 static bool is_string(struct pl *c, const struct pl *pl)
 {
 	if (pl->l < 2)
@@ -117,6 +156,111 @@ static bool is_number(long double *d, bool *isfloat, const struct pl *pl)
 }
 
 
+/*
+ * Decode a number with at most 19 significant digits, where a double
+ * value is exact when the decimal exponent is small (Clinger's fast path).
+ * Other numbers are left to is_number().
+ */
+static bool fast_number(struct json_value *val, const struct pl *pl)
+{
+	const char *p = pl->p, *end = pl->p + pl->l;
+	bool neg = false, isfloat = false, eneg = false;
+	unsigned digits = 0;
+	int e = 0, ex = 0;
+	uint64_t m = 0;
+	double d;
+
+	if (p < end && *p == '-') {
+		neg = true;
+		++p;
+	}
+
+	for (; p < end && '0' <= *p && *p <= '9'; ++p) {
+		if (++digits > 19)
+			return false;
+
+		m = m * 10 + (*p - '0');
+	}
+
+	if (!digits)
+		return false;
+
+	if (p < end && *p == '.') {
+
+		const char *frac = ++p;
+
+		for (; p < end && '0' <= *p && *p <= '9'; ++p, --e) {
+			if (++digits > 19)
+				return false;
+
+			m = m * 10 + (*p - '0');
+		}
+
+		if (p == frac)
+			return false;
+
+		isfloat = true;
+	}
+
+	if (p < end && (*p == 'e' || *p == 'E')) {
+
+		const char *exp;
+
+		if (++p < end && (*p == '-' || *p == '+'))
+			eneg = *p++ == '-';
+
+		for (exp = p; p < end && '0' <= *p && *p <= '9'; ++p) {
+			ex = ex * 10 + (*p - '0');
+			if (ex > 999)
+				return false;
+		}
+
+		if (p == exp)
+			return false;
+
+		isfloat = true;
+		e += eneg ? -ex : ex;
+	}
+
+	if (p != end)
+		return false;
+
+	if (!isfloat) {
+		if (digits > 18)
+			return false;
+
+		val->type      = JSON_INT;
+		val->v.integer = neg ? -(int64_t)m : (int64_t)m;
+
+		return true;
+	}
+
+	if (m > (uint64_t)1 << 53 || e < -22 || e > 22)
+		return false;
+
+	d = (double)m;
+	d = e < 0 ? d / pow10_exact[-e] : d * pow10_exact[e];
+
+	val->type  = JSON_DOUBLE;
+	val->v.dbl = neg ? -d : d;
+
+	return true;
+}
+
+
+/* Strings without escapes are copied as they are */
+int json_str_decode(char **str, const struct pl *pl)
+{
+	if (!utf8_validate(pl->p, pl->l))
+		return EBADMSG;
+
+	if (json_str_span(pl->p, pl->l) == pl->l)
+		return pl_strdup(str, pl);
+
+	return re_sdprintf(str, "%H", utf8_decode, pl);
+}
+
+
 static int decode_name(char **str, const struct pl *pl)
 {
 	struct pl pls;
@@ -127,15 +271,37 @@ static int decode_name(char **str, const struct pl *pl)
 	if (!is_string(&pls, pl))
 		return EBADMSG;
 
-	return re_sdprintf(str, "%H", utf8_decode, &pls);
+	return json_str_decode(str, &pls);
 }
 
 
-static int decode_value(struct json_value *val, const struct pl *pl)
+int json_num_decode(struct json_value *val, const struct pl *pl)
 {
 	long double dbl;
-	struct pl pls;
 	bool isfloat;
+
+	if (fast_number(val, pl))
+		return 0;
+
+	if (!is_number(&dbl, &isfloat, pl))
+		return EBADMSG;
+
+	if (isfloat) {
+		val->type  = JSON_DOUBLE;
+		val->v.dbl = dbl;
+	}
+	else {
+		val->type      = JSON_INT;
+		val->v.integer = dbl;
+	}
+
+	return 0;
+}
+
+
+static int decode_value(struct json_value *val, const struct pl *pl)
+{
+	struct pl pls;
 	int err = 0;
 
 	if (!pl->p)
@@ -143,20 +309,9 @@ static int decode_value(struct json_value *val, const struct pl *pl)
 
 	if (is_string(&pls, pl)) {
 
-		err = re_sdprintf(&val->v.str, "%H", utf8_decode, &pls);
+		err = json_str_decode(&val->v.str, &pls);
 		val->type = JSON_STRING;
 	}
-	else if (is_number(&dbl, &isfloat, pl)) {
-
-		if (isfloat) {
-			val->type  = JSON_DOUBLE;
-			val->v.dbl = dbl;
-		}
-		else {
-			val->type      = JSON_INT;
-			val->v.integer = dbl;
-		}
-	}
 	else if (!pl_strcasecmp(pl, "false")) {
 
 		val->v.boolean = false;
@@ -171,7 +326,7 @@ static int decode_value(struct json_value *val, const struct pl *pl)
 
 		val->type = JSON_NULL;
 	}
-	else {
+	else if (json_num_decode(val, pl)) {
 		re_printf("json: value of unknown type: <%r>\n", pl);
 		err = EBADMSG;
 	}
@@ -304,6 +459,12 @@ static int _json_decode(const char **str, size_t *len,
 				inquot = false;
 			else if (**str == '\\')
 				esc = true;
+			else {
+				const size_t n = json_str_span(*str, *len) - 1;
+
+				*str += n;
+				*len -= n;
+			}
 
 			continue;
 		}
@@ -467,3 +628,375 @@ int json_decode(const char *str, size_t len, unsigned maxdepth,
 
 	return _json_decode(&str, &len, 0, maxdepth, oh, ah, oeh, aeh, arg);
 }
+
+
+enum {
+	TOK_SIZE = 64,
+};
+
+struct json_frame {
+	struct json_handlers h;
+	unsigned idx;
+	bool inobj;
+};
+
+/** Incremental JSON decoder */
+struct json_decoder {
+	struct json_frame *stackv;  /**< One frame per open container */
+	unsigned maxdepth;
+	unsigned depth;
+	struct mbuf *tok;           /**< Current name or value          */
+	char *name;                 /**< Decoded name of the next entry */
+	int err;
+	bool inquot;
+	bool esc;
+	bool tokend;
+	bool done;
+};
+
+
+static void decoder_destructor(void *arg)
+{
+	struct json_decoder *dec = arg;
+
+	mem_deref(dec->stackv);
+	mem_deref(dec->tok);
+	mem_deref(dec->name);
+}
+
+
+static inline struct json_frame *dec_frame(struct json_decoder *dec)
+{
+	return &dec->stackv[dec->depth - 1];
+}
+
+
+static inline void tok_get(struct pl *pl, const struct json_decoder *dec)
+{
+	pl->p = (const char *)dec->tok->buf;
+	pl->l = dec->tok->end;
+}
+
+
+static inline void tok_reset(struct json_decoder *dec)
+{
+	mbuf_rewind(dec->tok);
+	dec->tokend = false;
+}
+
+
+static int dec_entry(struct json_decoder *dec)
+{
+	struct json_frame *f = dec_frame(dec);
+	struct json_value val;
+	struct pl pl;
+	int err;
+
+	if (f->inobj && !dec->name)
+		return EBADMSG;
+
+	tok_get(&pl, dec);
+
+	err = decode_value(&val, &pl);
+	if (err)
+		return err;
+
+	tok_reset(dec);
+
+	if (f->inobj) {
+		if (f->h.oeh)
+			err = f->h.oeh(dec->name, &val, f->h.arg);
+
+		dec->name = mem_deref(dec->name);
+	}
+	else {
+		if (f->h.aeh)
+			err = f->h.aeh(f->idx, &val, f->h.arg);
+
+		++f->idx;
+	}
+
+	if (val.type == JSON_STRING)
+		mem_deref(val.v.str);
+
+	return err;
+}
+
+
+static int dec_name(struct json_decoder *dec)
+{
+	struct pl pl;
+	int err;
+
+	if (!dec->depth || !dec_frame(dec)->inobj || dec->name ||
+	    !dec->tok->end)
+		return EBADMSG;
+
+	tok_get(&pl, dec);
+
+	err = decode_name(&dec->name, &pl);
+
+	tok_reset(dec);
+
+	return err;
+}
+
+
+static int dec_next(struct json_decoder *dec)
+{
+	if (!dec->depth)
+		return EBADMSG;
+
+	if (dec->tok->end)
+		return dec_entry(dec);
+
+	return dec->name ? EBADMSG : 0;
+}
+
+
+static int dec_push(struct json_decoder *dec, bool inobj)
+{
+	json_object_h *h;
+	struct json_frame *f, *nf;
+	int err = 0;
+
+	if (!dec->depth) {
+
+		if (dec->done)
+			return EBADMSG;
+
+		f = &dec->stackv[0];
+		f->idx   = 0;
+		f->inobj = inobj;
+		dec->depth = 1;
+
+		return 0;
+	}
+
+	f = dec_frame(dec);
+
+	if (dec->tok->end || (f->inobj && !dec->name))
+		return EBADMSG;
+
+	if (dec->depth > dec->maxdepth)
+		return EOVERFLOW;
+
+	nf = &dec->stackv[dec->depth];
+	nf->h     = f->h;
+	nf->idx   = 0;
+	nf->inobj = inobj;
+
+	h = inobj ? f->h.oh : f->h.ah;
+	if (h)
+		err = h(dec->name, f->idx, &nf->h);
+
+	dec->name = mem_deref(dec->name);
+
+	if (err)
+		return err;
+
+	if (!f->inobj)
+		++f->idx;
+
+	++dec->depth;
+
+	return 0;
+}
+
+
+static int dec_pop(struct json_decoder *dec, bool inobj)
+{
+	int err;
+
+	if (!dec->depth || dec_frame(dec)->inobj != inobj)
+		return EBADMSG;
+
+	err = dec_next(dec);
+	if (err)
+		return err;
+
+	if (--dec->depth == 0)
+		dec->done = true;
+
+	return 0;
+}
+
+
+/* Append the characters of a string up to a quote or an escape */
+static size_t dec_string(struct json_decoder *dec, const char *str,
+			 size_t len, int *errp)
+{
+	size_t n = 0;
+
+	if (dec->esc) {
+		dec->esc = false;
+		n = 1;
+	}
+
+	n += json_str_span(str + n, len - n);
+
+	if (n < len) {
+		if (str[n] == '\"') {
+			dec->inquot = false;
+			dec->tokend = true;
+		}
+		else {
+			dec->esc = true;
+		}
+
+		++n;
+	}
+
+	*errp = mbuf_write_mem(dec->tok, (const uint8_t *)str, n);
+
+	return n;
+}
+
+
+/**
+ * Allocate an incremental JSON decoder. The document is given in chunks
+ * of any size with json_decoder_feed(), and the handlers are called as
+ * the values are complete, as for json_decode(). Nesting is kept on an
+ * explicit stack of maxdepth levels.
+ *
+ * @param decp     Pointer to allocated JSON decoder
+ * @param maxdepth Maximum depth of nested objects and arrays
+ * @param oh       Object handler
+ * @param ah       Array handler
+ * @param oeh      Object entry handler
+ * @param aeh      Array entry handler
+ * @param arg      Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int json_decoder_alloc(struct json_decoder **decp, unsigned maxdepth,
+		       json_object_h *oh, json_array_h *ah,
+		       json_object_entry_h *oeh, json_array_entry_h *aeh,
+		       void *arg)
+{
+	struct json_decoder *dec;
+	struct json_frame *f;
+	int err = 0;
+
+	if (!decp)
+		return EINVAL;
+
+	dec = mem_zalloc(sizeof(*dec), decoder_destructor);
+	if (!dec)
+		return ENOMEM;
+
+	dec->stackv = mem_zalloc((maxdepth + 1) * sizeof(*dec->stackv), NULL);
+	dec->tok    = mbuf_alloc(TOK_SIZE);
+	if (!dec->stackv || !dec->tok) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	dec->maxdepth = maxdepth;
+
+	f = &dec->stackv[0];
+	f->h.oh  = oh;
+	f->h.ah  = ah;
+	f->h.oeh = oeh;
+	f->h.aeh = aeh;
+	f->h.arg = arg;
+
+ out:
+	if (err)
+		mem_deref(dec);
+	else
+		*decp = dec;
+
+	return err;
+}
+
+
+/**
+ * Decode the next chunk of a JSON document. A decoding error is kept,
+ * and returned for the next chunks too.
+ *
+ * @param dec JSON decoder
+ * @param str Chunk of the document
+ * @param len Length of chunk
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int json_decoder_feed(struct json_decoder *dec, const char *str, size_t len)
+{
+	int err = 0;
+
+	if (!dec || (!str && len))
+		return EINVAL;
+
+	if (dec->err)
+		return dec->err;
+
+	while (len && !err) {
+
+		size_t n = 1;
+
+		if (dec->inquot) {
+			n = dec_string(dec, str, len, &err);
+		}
+		else switch (*str) {
+
+		case ':':
+			err = dec_name(dec);
+			break;
+
+		case ',':
+			err = dec_next(dec);
+			break;
+
+		case '{':
+		case '[':
+			err = dec_push(dec, *str == '{');
+			break;
+
+		case '}':
+		case ']':
+			err = dec_pop(dec, *str == '}');
+			break;
+
+		case ' ':
+		case '\t':
+		case '\r':
+		case '\n':
+			if (dec->tok->end)
+				dec->tokend = true;
+			break;
+
+		default:
+			if (!dec->depth || dec->tokend) {
+				err = EBADMSG;
+				break;
+			}
+
+			if (*str == '\"' && !dec->tok->end)
+				dec->inquot = true;
+
+			err = mbuf_write_u8(dec->tok, *str);
+			break;
+		}
+
+		str += n;
+		len -= n;
+	}
+
+	dec->err = err;
+
+	return err;
+}
+
+
+/**
+ * Check if a JSON decoder has decoded the whole document
+ *
+ * @param dec JSON decoder
+ *
+ * @return True if the outermost object or array is complete
+ */
+bool json_decoder_done(const struct json_decoder *dec)
+{
+	return dec ? dec->done : false;
+}
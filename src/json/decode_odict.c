@@ -27,7 +27,7 @@ static int container_add(const char *name, unsigned idx,
 		name = index;
 	}
 
-	err = odict_alloc(&oc, hash_bsize(o->ht));
+	err = odict_alloc(&oc, o->hsize);
 	if (err)
 		return err;
 
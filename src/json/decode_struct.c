@@ -0,0 +1,358 @@
+/**
+ * @file json/decode_struct.c  JSON decode into C structs
+ *
+ * Copyright (C) 2010 - 2015 Creytiv.com
+ */
+#include <string.h>
+#include <re_types.h>
+#include <re_fmt.h>
+#include <re_mem.h>
+#include <re_list.h>
+#include <re_hash.h>
+#include <re_odict.h>
+#include <re_json.h>
+#include "json.h"
+
+
+enum {
+	NAME_SIZE = 64,
+};
+
+struct parser {
+	const char *p;
+	const char *end;
+};
+
+
+static inline void skip_ws(struct parser *ps)
+{
+	while (ps->p < ps->end && (*ps->p == ' ' || *ps->p == '\t' ||
+				   *ps->p == '\r' || *ps->p == '\n'))
+		++ps->p;
+}
+
+
+static inline bool expect(struct parser *ps, char ch)
+{
+	skip_ws(ps);
+
+	if (ps->p >= ps->end || *ps->p != ch)
+		return false;
+
+	++ps->p;
+
+	return true;
+}
+
+
+/* Scan a string, and give its content with the escapes left in */
+static int scan_string(struct parser *ps, struct pl *pl)
+{
+	const char *p;
+
+	if (!expect(ps, '"'))
+		return EBADMSG;
+
+	p = ps->p;
+
+	for (;;) {
+		p += json_str_span(p, ps->end - p);
+
+		if (p >= ps->end)
+			return EBADMSG;
+
+		if (*p == '"')
+			break;
+
+		/* skip the escaped character */
+		if (ps->end - p < 2)
+			return EBADMSG;
+
+		p += 2;
+	}
+
+	pl->p = ps->p;
+	pl->l = p - ps->p;
+
+	ps->p = p + 1;
+
+	return 0;
+}
+
+
+static int scan_scalar(struct parser *ps, struct pl *pl)
+{
+	skip_ws(ps);
+
+	pl->p = ps->p;
+
+	while (ps->p < ps->end && !strchr(",:{}[]\" \t\r\n", *ps->p))
+		++ps->p;
+
+	pl->l = ps->p - pl->p;
+
+	return pl->l ? 0 : EBADMSG;
+}
+
+
+/* Skip any value, nested objects and arrays without recursion */
+static int skip_value(struct parser *ps)
+{
+	struct pl pl;
+	unsigned depth = 0;
+
+	do {
+		skip_ws(ps);
+
+		if (ps->p >= ps->end)
+			return EBADMSG;
+
+		switch (*ps->p) {
+
+		case '"':
+			if (scan_string(ps, &pl))
+				return EBADMSG;
+			break;
+
+		case '{':
+		case '[':
+			++depth;
+			++ps->p;
+			break;
+
+		case '}':
+		case ']':
+			if (!depth)
+				return EBADMSG;
+
+			--depth;
+			++ps->p;
+			break;
+
+		case ',':
+		case ':':
+			if (!depth)
+				return EBADMSG;
+
+			++ps->p;
+			break;
+
+		default:
+			if (scan_scalar(ps, &pl))
+				return EBADMSG;
+			break;
+		}
+
+	} while (depth);
+
+	return 0;
+}
+
+
+static const struct json_field *field_find(const struct json_field *fields,
+					   const struct pl *name)
+{
+	char buf[NAME_SIZE];
+	struct pl pl = *name;
+
+	/* names with escapes are compared decoded */
+	if (json_str_span(name->p, name->l) < name->l) {
+
+		if (re_snprintf(buf, sizeof(buf), "%H", utf8_decode, name) < 0)
+			return NULL;
+
+		pl_set_str(&pl, buf);
+	}
+
+	for (; fields->name; ++fields) {
+
+		if (!pl_strcmp(&pl, fields->name))
+			return fields;
+	}
+
+	return NULL;
+}
+
+
+static int chars_decode(char *buf, size_t size, const struct pl *pl)
+{
+	if (!size)
+		return EOVERFLOW;
+
+	if (json_str_span(pl->p, pl->l) == pl->l) {
+
+		if (pl->l >= size)
+			return EOVERFLOW;
+
+		memcpy(buf, pl->p, pl->l);
+		buf[pl->l] = '\0';
+
+		return 0;
+	}
+
+	if (re_snprintf(buf, size, "%H", utf8_decode, pl) < 0)
+		return EOVERFLOW;
+
+	return 0;
+}
+
+
+static int decode_object(struct parser *ps, const struct json_field *fields,
+			 uint8_t *st);
+
+
+static int field_decode(struct parser *ps, const struct json_field *f,
+			uint8_t *p)
+{
+	struct json_value val;
+	struct pl pl;
+	char *str;
+	int err;
+
+	skip_ws(ps);
+
+	/* null leaves the member as it is */
+	if (ps->end - ps->p >= 4 && !memcmp(ps->p, "null", 4)) {
+		ps->p += 4;
+		return 0;
+	}
+
+	switch (f->type) {
+
+	case JSON_FIELD_STR:
+		err = scan_string(ps, &pl);
+		if (err)
+			return err;
+
+		err = json_str_decode(&str, &pl);
+		if (err)
+			return err;
+
+		mem_deref(*(char **)(void *)p);
+		*(char **)(void *)p = str;
+		return 0;
+
+	case JSON_FIELD_CHARS:
+		err = scan_string(ps, &pl);
+		if (err)
+			return err;
+
+		return chars_decode((char *)p, f->size, &pl);
+
+	case JSON_FIELD_INT:
+	case JSON_FIELD_DOUBLE:
+		err = scan_scalar(ps, &pl);
+		if (err)
+			return err;
+
+		err = json_num_decode(&val, &pl);
+		if (err)
+			return err;
+
+		if (f->type == JSON_FIELD_DOUBLE) {
+			*(double *)(void *)p = val.type == JSON_INT ?
+				(double)val.v.integer : val.v.dbl;
+		}
+		else if (val.type == JSON_INT) {
+			*(int64_t *)(void *)p = val.v.integer;
+		}
+		else {
+			return EBADMSG;
+		}
+
+		return 0;
+
+	case JSON_FIELD_BOOL:
+		err = scan_scalar(ps, &pl);
+		if (err)
+			return err;
+
+		if (!pl_strcmp(&pl, "true"))
+			*(bool *)p = true;
+		else if (!pl_strcmp(&pl, "false"))
+			*(bool *)p = false;
+		else
+			return EBADMSG;
+
+		return 0;
+
+	case JSON_FIELD_OBJECT:
+		if (!f->fields)
+			return EINVAL;
+
+		return decode_object(ps, f->fields, p);
+
+	default:
+		return EINVAL;
+	}
+}
+
+
+static int decode_object(struct parser *ps, const struct json_field *fields,
+			 uint8_t *st)
+{
+	if (!expect(ps, '{'))
+		return EBADMSG;
+
+	if (expect(ps, '}'))
+		return 0;
+
+	do {
+		const struct json_field *f;
+		struct pl name;
+		int err;
+
+		err = scan_string(ps, &name);
+		if (err)
+			return err;
+
+		if (!expect(ps, ':'))
+			return EBADMSG;
+
+		f = field_find(fields, &name);
+		if (f)
+			err = field_decode(ps, f, st + f->offset);
+		else
+			err = skip_value(ps);
+		if (err)
+			return err;
+
+	} while (expect(ps, ','));
+
+	return expect(ps, '}') ? 0 : EBADMSG;
+}
+
+
+/**
+ * Decode a JSON object into a C struct, as described by a table of
+ * fields. Members with unknown names are skipped, and members that are
+ * null or missing are not changed. Strings of JSON_FIELD_STR fields are
+ * allocated, and must be dereferenced by the caller.
+ *
+ * @param st     Struct to decode into
+ * @param fields Fields of the struct, ending with an empty name
+ * @param str    JSON document
+ * @param len    Length of document
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int json_decode_struct(void *st, const struct json_field *fields,
+		       const char *str, size_t len)
+{
+	struct parser ps;
+	int err;
+
+	if (!st || !fields || !str)
+		return EINVAL;
+
+	ps.p   = str;
+	ps.end = str + len;
+
+	err = decode_object(&ps, fields, st);
+	if (err)
+		return err;
+
+	skip_ws(&ps);
+
+	return ps.p == ps.end ? 0 : EBADMSG;
+}
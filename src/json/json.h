@@ -0,0 +1,10 @@
+/**
+ * @file json.h  JSON internal interface
+ *
+ * Copyright (C) 2010 - 2015 Creytiv.com
+ */
+
+
+size_t json_str_span(const char *p, size_t len);
+int    json_str_decode(char **str, const struct pl *pl);
+int    json_num_decode(struct json_value *val, const struct pl *pl);
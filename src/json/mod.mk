@@ -6,4 +6,6 @@
 
 SRCS	+= json/decode.c
 SRCS	+= json/decode_odict.c
+SRCS	+= json/decode_struct.c
 SRCS	+= json/encode.c
+SRCS	+= json/writer.c
@@ -0,0 +1,513 @@
+/**
+ * @file json/writer.c  JSON writer
+ *
+ * Copyright (C) 2010 - 2015 Creytiv.com
+ */
+#include <string.h>
+#include <math.h>
+#include <re_types.h>
+#include <re_fmt.h>
+#include <re_mbuf.h>
+#include <re_list.h>
+#include <re_hash.h>
+#include <re_odict.h>
+#include <re_json.h>
+
+
+enum {
+	DEPTH_MAX = 63,
+};
+
+
+/* Escape of each byte in a string, 'u' for \u00XX */
+static const char esc_tab[256] = {
+	'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+	'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+	'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+	'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+	['"'] = '"', ['/'] = '/', ['\\'] = '\\',
+};
+
+static const char hex_chars[] = "0123456789ABCDEF";
+
+/* Two decimal digits for each of 0-99 */
+static const char digits_tab[] =
+	"0001020304050607080910111213141516171819"
+	"2021222324252627282930313233343536373839"
+	"4041424344454647484950515253545556575859"
+	"6061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+
+static int str_write(struct mbuf *mb, const char *str, size_t len)
+{
+	size_t i, run = 0;
+	int err;
+
+	err = mbuf_write_u8(mb, '"');
+
+	for (i=0; i<len; i++) {
+
+		const uint8_t c = str[i];  /* NOTE: must be unsigned 8-bit */
+		uint8_t ebuf[6] = {'\\', 'u', '0', '0'};
+
+		if (!esc_tab[c])
+			continue;
+
+		err |= mbuf_write_mem(mb, (const uint8_t *)str + run, i - run);
+
+		if (esc_tab[c] == 'u') {
+			ebuf[4] = hex_chars[c>>4];
+			ebuf[5] = hex_chars[c & 0xf];
+
+			err |= mbuf_write_mem(mb, ebuf, sizeof(ebuf));
+		}
+		else {
+			ebuf[1] = esc_tab[c];
+
+			err |= mbuf_write_mem(mb, ebuf, 2);
+		}
+
+		run = i + 1;
+	}
+
+	if (len > run)
+		err |= mbuf_write_mem(mb, (const uint8_t *)str + run,
+				      len - run);
+
+	err |= mbuf_write_u8(mb, '"');
+
+	return err;
+}
+
+
+/* Format the decimal digits backwards from the end of a buffer */
+static char *u64_fmt(char *p, uint64_t v)
+{
+	while (v >= 100) {
+		const size_t i = (size_t)(v % 100) * 2;
+
+		v /= 100;
+		p -= 2;
+		memcpy(p, &digits_tab[i], 2);
+	}
+
+	if (v >= 10) {
+		p -= 2;
+		memcpy(p, &digits_tab[v * 2], 2);
+	}
+	else {
+		*--p = '0' + (char)v;
+	}
+
+	return p;
+}
+
+
+/* Write the separator before a key or a value */
+static int sep_write(struct json_writer *w, bool key)
+{
+	const uint64_t bit = (uint64_t)1 << w->depth;
+
+	if (w->err)
+		return w->err;
+
+	if ((w->obj & bit) && !key) {
+
+		if (!w->key)
+			return w->err = EINVAL;
+
+		w->key = false;
+		return 0;
+	}
+
+	if (key && (!(w->obj & bit) || w->key))
+		return w->err = EINVAL;
+
+	if (w->comma & bit)
+		return w->err = mbuf_write_u8(w->mb, ',');
+
+	w->comma |= bit;
+
+	return 0;
+}
+
+
+static int begin(struct json_writer *w, bool obj)
+{
+	uint64_t bit;
+	int err;
+
+	if (!w)
+		return EINVAL;
+
+	err = sep_write(w, false);
+	if (err)
+		return err;
+
+	if (w->depth >= DEPTH_MAX)
+		return w->err = EOVERFLOW;
+
+	err = mbuf_write_u8(w->mb, obj ? '{' : '[');
+	if (err)
+		return w->err = err;
+
+	bit = (uint64_t)1 << ++w->depth;
+
+	w->comma &= ~bit;
+	if (obj)
+		w->obj |= bit;
+	else
+		w->obj &= ~bit;
+
+	return 0;
+}
+
+
+static int end(struct json_writer *w, bool obj)
+{
+	if (!w)
+		return EINVAL;
+
+	if (w->err)
+		return w->err;
+
+	if (!w->depth || w->key ||
+	    !(w->obj & (uint64_t)1 << w->depth) != !obj)
+		return w->err = EINVAL;
+
+	--w->depth;
+
+	return w->err = mbuf_write_u8(w->mb, obj ? '}' : ']');
+}
+
+
+/**
+ * Initialise a JSON writer. Objects, arrays and values are written
+ * directly to the buffer, with commas and colons as needed. An error is
+ * kept and returned by the next calls too.
+ *
+ * @param w  JSON writer
+ * @param mb Buffer to write to, at the current position
+ */
+void json_writer_init(struct json_writer *w, struct mbuf *mb)
+{
+	if (!w)
+		return;
+
+	memset(w, 0, sizeof(*w));
+	w->mb  = mb;
+	w->err = mb ? 0 : EINVAL;
+}
+
+
+/**
+ * Begin a JSON object
+ *
+ * @param w JSON writer
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int json_writer_begin_object(struct json_writer *w)
+{
+	return begin(w, true);
+}
+
+
+/**
+ * End a JSON object
+ *
+ * @param w JSON writer
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int json_writer_end_object(struct json_writer *w)
+{
+	return end(w, true);
+}
+
+
+/**
+ * Begin a JSON array
+ *
+ * @param w JSON writer
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int json_writer_begin_array(struct json_writer *w)
+{
+	return begin(w, false);
+}
+
+
+/**
+ * End a JSON array
+ *
+ * @param w JSON writer
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int json_writer_end_array(struct json_writer *w)
+{
+	return end(w, false);
+}
+
+
+/**
+ * Write the key of the next object member
+ *
+ * @param w   JSON writer
+ * @param key Key
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int json_writer_key(struct json_writer *w, const char *key)
+{
+	int err;
+
+	if (!w || !key)
+		return EINVAL;
+
+	err = sep_write(w, true);
+	if (err)
+		return err;
+
+	err  = str_write(w->mb, key, strlen(key));
+	err |= mbuf_write_u8(w->mb, ':');
+
+	w->key = true;
+
+	return w->err = err;
+}
+
+
+/**
+ * Write a string value, or null
+ *
+ * @param w   JSON writer
+ * @param str String, or NULL
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int json_writer_str(struct json_writer *w, const char *str)
+{
+	struct pl pl;
+
+	if (!str)
+		return json_writer_null(w);
+
+	pl_set_str(&pl, str);
+
+	return json_writer_pl(w, &pl);
+}
+
+
+/**
+ * Write a string value from a pointer-length object
+ *
+ * @param w  JSON writer
+ * @param pl String
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int json_writer_pl(struct json_writer *w, const struct pl *pl)
+{
+	int err;
+
+	if (!w || !pl || (!pl->p && pl->l))
+		return EINVAL;
+
+	err = sep_write(w, false);
+	if (err)
+		return err;
+
+	return w->err = str_write(w->mb, pl->p, pl->l);
+}
+
+
+/**
+ * Write an unsigned integer value
+ *
+ * @param w JSON writer
+ * @param v Value
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int json_writer_u64(struct json_writer *w, uint64_t v)
+{
+	char buf[20], *p;
+	int err;
+
+	if (!w)
+		return EINVAL;
+
+	err = sep_write(w, false);
+	if (err)
+		return err;
+
+	p = u64_fmt(buf + sizeof(buf), v);
+
+	return w->err = mbuf_write_mem(w->mb, (uint8_t *)p,
+				       buf + sizeof(buf) - p);
+}
+
+
+/**
+ * Write a signed integer value
+ *
+ * @param w JSON writer
+ * @param v Value
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int json_writer_i64(struct json_writer *w, int64_t v)
+{
+	char buf[20], *p;
+	int err;
+
+	if (!w)
+		return EINVAL;
+
+	err = sep_write(w, false);
+	if (err)
+		return err;
+
+	p = u64_fmt(buf + sizeof(buf), v < 0 ? -(uint64_t)v : (uint64_t)v);
+	if (v < 0)
+		*--p = '-';
+
+	return w->err = mbuf_write_mem(w->mb, (uint8_t *)p,
+				       buf + sizeof(buf) - p);
+}
+
+
+/**
+ * Write a floating point value. Values that are not finite are written
+ * as null.
+ *
+ * @param w JSON writer
+ * @param v Value
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int json_writer_double(struct json_writer *w, double v)
+{
+	int err;
+
+	if (!isfinite(v))
+		return json_writer_null(w);
+
+	if (!w)
+		return EINVAL;
+
+	err = sep_write(w, false);
+	if (err)
+		return err;
+
+	return w->err = mbuf_printf(w->mb, "%f", v);
+}
+
+
+/**
+ * Write a boolean value
+ *
+ * @param w JSON writer
+ * @param v Value
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int json_writer_bool(struct json_writer *w, bool v)
+{
+	int err;
+
+	if (!w)
+		return EINVAL;
+
+	err = sep_write(w, false);
+	if (err)
+		return err;
+
+	return w->err = v ? mbuf_write_str(w->mb, "true")
+		: mbuf_write_str(w->mb, "false");
+}
+
+
+/**
+ * Write a null value
+ *
+ * @param w JSON writer
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int json_writer_null(struct json_writer *w)
+{
+	int err;
+
+	if (!w)
+		return EINVAL;
+
+	err = sep_write(w, false);
+	if (err)
+		return err;
+
+	return w->err = mbuf_write_str(w->mb, "null");
+}
+
+
+static int odict_write(struct json_writer *w, const struct odict *o,
+		       bool obj);
+
+
+static int entry_write(struct json_writer *w, const struct odict_entry *e)
+{
+	switch (e->type) {
+
+	case ODICT_OBJECT: return odict_write(w, e->u.odict, true);
+	case ODICT_ARRAY:  return odict_write(w, e->u.odict, false);
+	case ODICT_INT:    return json_writer_i64(w, e->u.integer);
+	case ODICT_DOUBLE: return json_writer_double(w, e->u.dbl);
+	case ODICT_STRING: return json_writer_str(w, e->u.str);
+	case ODICT_BOOL:   return json_writer_bool(w, e->u.boolean);
+	case ODICT_NULL:   return json_writer_null(w);
+	default:           return w->err = EINVAL;
+	}
+}
+
+
+static int odict_write(struct json_writer *w, const struct odict *o,
+		       bool obj)
+{
+	struct le *le;
+	int err;
+
+	err = begin(w, obj);
+
+	for (le = o ? o->lst.head : NULL; le && !err; le = le->next) {
+
+		const struct odict_entry *e = le->data;
+
+		if (obj)
+			err = json_writer_key(w, e->key);
+		if (!err)
+			err = entry_write(w, e);
+	}
+
+	return err ? err : end(w, obj);
+}
+
+
+/**
+ * Write a dictionary as a JSON object
+ *
+ * @param w JSON writer
+ * @param o Dictionary
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int json_writer_odict(struct json_writer *w, const struct odict *o)
+{
+	if (!w || !o)
+		return EINVAL;
+
+	return odict_write(w, o, true);
+}
@@ -23,8 +23,9 @@ void list_init(struct list *list)
 	if (!list)
 		return;
 
-	list->head = NULL;
-	list->tail = NULL;
+	list->head  = NULL;
+	list->tail  = NULL;
+	list->count = 0;
 }
 
 
@@ -109,6 +110,7 @@ void list_append(struct list *list, struct le *le, void *data)
 		list->tail->next = le;
 
 	list->tail = le;
+	++list->count;
 }
 
 
@@ -141,6 +143,7 @@ void list_prepend(struct list *list, struct le *le, void *data)
 		list->tail = le;
 
 	list->head = le;
+	++list->count;
 }
 
 
@@ -174,6 +177,7 @@ void list_insert_before(struct list *list, struct le *le, struct le *ile,
 	ile->data = data;
 
 	le->prev = ile;
+	++list->count;
 }
 
 
@@ -207,6 +211,7 @@ void list_insert_after(struct list *list, struct le *le, struct le *ile,
 	ile->data = data;
 
 	le->next = ile;
+	++list->count;
 }
 
 
@@ -234,14 +239,44 @@ void list_unlink(struct le *le)
 	else
 		list->tail = le->prev;
 
+	--list->count;
+
 	le->next = NULL;
 	le->prev = NULL;
 	le->list = NULL;
 }
 
 
+/* Merge two sorted chains, linked by next only */
+static struct le *merge(struct le *a, struct le *b, list_sort_h *sh,
+			void *arg)
+{
+	struct le *head = NULL, **tailp = &head;
+
+	while (a && b) {
+
+		/* the first chain goes first when in order (stable) */
+		if (sh(a, b, arg)) {
+			*tailp = a;
+			a = a->next;
+		}
+		else {
+			*tailp = b;
+			b = b->next;
+		}
+
+		tailp = &(*tailp)->next;
+	}
+
+	*tailp = a ? a : b;
+
+	return head;
+}
+
+
 /**
- * Sort a linked list in an order defined by the sort handler
+ * Sort a linked list in an order defined by the sort handler. The sort is
+ * a stable merge sort, elements that are in order are not moved.
  *
  * @param list  Linked list
  * @param sh    Sort handler
@@ -249,34 +284,45 @@ void list_unlink(struct le *le)
  */
 void list_sort(struct list *list, list_sort_h *sh, void *arg)
 {
-	struct le *le;
-	bool sort;
+	/* binv[i] holds a sorted chain of 2^i elements, or NULL */
+	struct le *binv[32] = {NULL};
+	struct le *le, *prev, *chain;
+	unsigned i, n = 0;
 
-	if (!list || !sh)
+	if (!list || !sh || !list->head)
 		return;
 
- retry:
 	le = list->head;
-	sort = false;
-
-	while (le && le->next) {
+	while (le) {
 
-		if (sh(le, le->next, arg)) {
+		chain = le;
+		le = le->next;
+		chain->next = NULL;
 
-			le = le->next;
+		for (i=0; binv[i]; i++) {
+			chain = merge(binv[i], chain, sh, arg);
+			binv[i] = NULL;
 		}
-		else {
-			struct le *tle = le->next;
 
-			list_unlink(le);
-			list_insert_after(list, tle, le, le->data);
-			sort = true;
-		}
+		binv[i] = chain;
+		if (i >= n)
+			n = i + 1;
 	}
 
-	if (sort) {
-		goto retry;
+	chain = NULL;
+	for (i=0; i<n; i++) {
+		if (!binv[i])
+			continue;
+
+		chain = chain ? merge(binv[i], chain, sh, arg) : binv[i];
 	}
+
+	/* restore the prev links and the tail */
+	list->head = chain;
+	for (prev = NULL, le = chain; le; prev = le, le = le->next)
+		le->prev = prev;
+
+	list->tail = prev;
 }
 
 
@@ -348,14 +394,5 @@ struct le *list_tail(const struct list *list)
  */
 uint32_t list_count(const struct list *list)
 {
-	uint32_t n = 0;
-	struct le *le;
-
-	if (!list)
-		return 0;
-
-	for (le = list->head; le; le = le->next)
-		++n;
-
-	return n;
+	return list ? list->count : 0;
 }
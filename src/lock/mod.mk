@@ -4,6 +4,8 @@
 # Copyright (C) 2010 Creytiv.com
 #
 
+SRCS	+= lock/spin.c
+
 ifdef HAVE_PTHREAD_RWLOCK
 SRCS	+= lock/rwlock.c
 else
@@ -0,0 +1,73 @@
+/**
+ * @file spin.c  Adaptive spinlock
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <sched.h>
+#endif
+#include <re_types.h>
+#include <re_lock.h>
+
+
+#if defined (__ATOMIC_RELAXED)
+
+
+enum {
+	SPIN_ROUNDS = 10,   /**< Rounds of spinning before yielding  */
+};
+
+
+static inline void cpu_relax(void)
+{
+#if defined (__i386__) || defined (__x86_64__)
+	__builtin_ia32_pause();
+#elif defined (__aarch64__) || defined (__arm__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+
+static inline void cpu_yield(void)
+{
+#ifdef WIN32
+	(void)SwitchToThread();
+#else
+	(void)sched_yield();
+#endif
+}
+
+
+/**
+ * Wait for a spinlock and take it. The wait between attempts doubles for
+ * each round, and then the CPU is yielded between attempts.
+ *
+ * @param s Spinlock
+ */
+void spinlock_wait(struct spinlock *s)
+{
+	unsigned round = 0, i;
+
+	for (;;) {
+
+		/* only try the exchange when the lock looks free */
+		if (!__atomic_load_n(&s->locked, __ATOMIC_RELAXED) &&
+		    spinlock_try(s))
+			return;
+
+		if (round < SPIN_ROUNDS) {
+
+			for (i=0; i<(1u << round); i++)
+				cpu_relax();
+
+			++round;
+		}
+		else {
+			cpu_yield();
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,278 @@
+/**
+ * @file hstat.c  Event handler cost accounting
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#define _GNU_SOURCE 1
+#include <string.h>
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#include <time.h>
+#include <re_types.h>
+#include <re_fmt.h>
+#include <re_mem.h>
+#include <re_list.h>
+#include <re_hash.h>
+#include <re_tmr.h>
+#include <re_main.h>
+#include "main.h"
+
+
+/** Handler accounting */
+struct hstats {
+	struct hash *ht;       /**< Handler entries, keyed by function */
+	uint32_t n;            /**< Number of entries                  */
+};
+
+/** Accounting entry for one handler */
+struct hentry {
+	struct le he;          /**< Hash element                       */
+	struct re_hstat st;    /**< Statistics                         */
+};
+
+struct hkey {
+	re_hstat_fn *h;
+	bool tmr;
+};
+
+
+static void hstats_destructor(void *data)
+{
+	struct hstats *hs = data;
+
+	hash_flush(hs->ht);
+	mem_deref(hs->ht);
+}
+
+
+static uint32_t hkey_hash(re_hstat_fn *h)
+{
+	uint8_t key[sizeof(h)];
+
+	memcpy(key, &h, sizeof(h));
+
+	return hash_joaat(key, sizeof(key));
+}
+
+
+static bool hkey_cmp(struct le *le, void *arg)
+{
+	const struct hentry *e = le->data;
+	const struct hkey *key = arg;
+
+	return e->st.h == key->h && e->st.tmr == key->tmr;
+}
+
+
+int hstats_alloc(struct hstats **hsp)
+{
+	struct hstats *hs;
+	int err;
+
+	if (!hsp)
+		return EINVAL;
+
+	hs = mem_zalloc(sizeof(*hs), hstats_destructor);
+	if (!hs)
+		return ENOMEM;
+
+	err = hash_alloc(&hs->ht, 64);
+	if (err)
+		mem_deref(hs);
+	else
+		*hsp = hs;
+
+	return err;
+}
+
+
+/**
+ * Get a monotonic time stamp
+ *
+ * @return Time in [us]
+ */
+uint64_t hstats_usec(void)
+{
+	return tmr_jiffies_usec();
+}
+
+
+/**
+ * Account one handler call
+ *
+ * @param hs   Handler accounting
+ * @param h    Handler function
+ * @param tmr  True for a timer handler, false for a fd handler
+ * @param usec Time spent in the handler [us]
+ */
+void hstats_add(struct hstats *hs, re_hstat_fn *h, bool tmr, uint64_t usec)
+{
+	struct hkey key;
+	struct hentry *e;
+	struct le *le;
+	unsigned b = 0;
+
+	if (!hs || !h)
+		return;
+
+	key.h   = h;
+	key.tmr = tmr;
+
+	le = hash_lookup(hs->ht, hkey_hash(h), hkey_cmp, &key);
+	if (le) {
+		e = le->data;
+	}
+	else {
+		e = mem_zalloc(sizeof(*e), NULL);
+		if (!e)
+			return;
+
+		e->st.h   = h;
+		e->st.tmr = tmr;
+
+		hash_append(hs->ht, hkey_hash(h), &e->he, e);
+		++hs->n;
+	}
+
+	/* Bucket i holds calls taking [2^(i-1), 2^i) us */
+	while (b < RE_HSTAT_BUCKETS-1 && (usec >> b))
+		++b;
+
+	++e->st.count;
+	e->st.total += usec;
+	e->st.max    = max(e->st.max, usec);
+	++e->st.hist[b];
+}
+
+
+void hstats_reset(struct hstats *hs)
+{
+	if (!hs)
+		return;
+
+	hash_flush(hs->ht);
+	hs->n = 0;
+}
+
+
+struct hcopy {
+	struct re_hstat *v;
+	size_t n;
+	size_t max;
+};
+
+
+static bool copy_handler(struct le *le, void *arg)
+{
+	const struct hentry *e = le->data;
+	struct hcopy *hc = arg;
+	size_t i;
+
+	/* Keep the vector sorted by cumulative time, largest first */
+	for (i = hc->n; i > 0; i--) {
+		if (hc->v[i-1].total >= e->st.total)
+			break;
+
+		if (i < hc->max)
+			hc->v[i] = hc->v[i-1];
+	}
+
+	if (i < hc->max) {
+		hc->v[i] = e->st;
+		hc->n = min(hc->n + 1, hc->max);
+	}
+
+	return false;
+}
+
+
+/**
+ * Copy the handler statistics, sorted by cumulative time
+ *
+ * @param hs  Handler accounting
+ * @param v   Vector of statistics
+ * @param max Number of elements in vector
+ *
+ * @return Number of elements copied
+ */
+size_t hstats_copy(const struct hstats *hs, struct re_hstat *v, size_t max)
+{
+	struct hcopy hc;
+
+	if (!hs || !v || !max)
+		return 0;
+
+	hc.v   = v;
+	hc.n   = 0;
+	hc.max = max;
+
+	(void)hash_apply(hs->ht, copy_handler, &hc);
+
+	return hc.n;
+}
+
+
+/**
+ * Get an upper bound of a percentile of the handler time
+ *
+ * @param st  Handler statistics
+ * @param pct Percentile (0-100)
+ *
+ * @return Time in [us]
+ */
+uint64_t re_hstat_percentile(const struct re_hstat *st, unsigned pct)
+{
+	uint64_t sum = 0, lim;
+	unsigned i;
+
+	if (!st || !st->count)
+		return 0;
+
+	lim = (st->count * min(pct, 100) + 99) / 100;
+
+	for (i=0; i<RE_HSTAT_BUCKETS; i++) {
+
+		sum += st->hist[i];
+
+		if (sum >= lim)
+			return min((uint64_t)1 << i, st->max);
+	}
+
+	return st->max;
+}
+
+
+int hstats_debug(struct re_printf *pf, const struct hstats *hs)
+{
+	struct re_hstat *v;
+	size_t i, n;
+	int err;
+
+	if (!hs)
+		return 0;
+
+	v = mem_alloc(hs->n * sizeof(*v), NULL);
+	if (hs->n && !v)
+		return ENOMEM;
+
+	n = hstats_copy(hs, v, hs->n);
+
+	err = re_hprintf(pf, "  handlers: %u (time in [us])\n", hs->n);
+
+	for (i=0; i<n; i++) {
+
+		const struct re_hstat *st = &v[i];
+
+		err |= re_hprintf(pf, "    %s %p: calls=%llu total=%llu"
+				  " avg=%llu p99<=%llu max=%llu\n",
+				  st->tmr ? "tmr" : "fd ", st->h,
+				  st->count, st->total,
+				  st->total / st->count,
+				  re_hstat_percentile(st, 99), st->max);
+	}
+
+	mem_deref(v);
+
+	return err;
+}
@@ -9,6 +9,7 @@
 #include <sys/types.h>
 #undef _STRICT_ANSI
 #include <string.h>
+#include <limits.h>
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
@@ -41,6 +42,8 @@
 #include <re_list.h>
 #include <re_tmr.h>
 #include <re_main.h>
+#include <re_probe.h>
+#include <re_trace.h>
 #include "main.h"
 #ifdef HAVE_PTHREAD
 #define __USE_GNU 1
@@ -64,7 +67,7 @@
 
   - The polling method is selectable both in compile-time and run-time
   - The polling method can be changed in run time. this is cool!
-  - Maximum number of fds can be set from application, but only once!
+  - The fd table grows on demand, fd_setsize() only sets its initial size
   - Look at howto optimise main loop
  */
 
@@ -91,14 +94,23 @@ struct re {
 		int flags;           /**< Polling flags (Read, Write, etc.) */
 		fd_h *fh;            /**< Event handler                     */
 		void *arg;           /**< Handler argument                  */
+		int rnext;           /**< Next fd in the ready list         */
+		bool ready;          /**< In the ready list                 */
 	} *fhs;
-	int maxfds;                  /**< Maximum number of polling fds     */
+	int maxfds;                  /**< Size of the fd table, grows       */
+	int maxev;                   /**< Size of the event sets            */
 	int nfds;                    /**< Number of active file descriptors */
+	int readyh;                  /**< First fd with unread input        */
+	int readyt;                  /**< Last fd with unread input         */
+	int readyc;                  /**< Number of fds with unread input   */
+	uint32_t busy;               /**< Busy-poll time in [us]            */
 	enum poll_method method;     /**< The current polling method        */
 	bool update;                 /**< File descriptor set need updating */
 	bool polling;                /**< Is polling flag                   */
 	int sig;                     /**< Last caught signal                */
-	struct list tmrl;            /**< List of timers                    */
+	struct list tmrl;            /**< List of expired timers            */
+	struct tmrw *tmrw;           /**< Timer wheel                       */
+	struct hstats *hstats;       /**< Handler accounting, if enabled    */
 
 #ifdef HAVE_POLL
 	struct pollfd *fds;          /**< Event set for poll()              */
@@ -114,6 +126,11 @@ struct re {
 	int kqfd;
 #endif
 
+#ifdef HAVE_IO_URING
+	struct uring *uring;         /**< io_uring instance                 */
+	struct uring_event *uevents; /**< Event set for io_uring            */
+#endif
+
 #ifdef HAVE_PTHREAD
 	pthread_mutex_t mutex;       /**< Mutex for thread synchronization  */
 	pthread_mutex_t *mutexp;     /**< Pointer to active mutex           */
@@ -124,11 +141,18 @@ static struct re global_re = {
 	NULL,
 	0,
 	0,
+	0,
+	0,
+	0,
+	0,
+	0,
 	METHOD_NULL,
 	false,
 	false,
 	0,
 	LIST_INIT,
+	NULL,
+	NULL,
 #ifdef HAVE_POLL
 	NULL,
 #endif
@@ -140,6 +164,10 @@ static struct re global_re = {
 	NULL,
 	-1,
 #endif
+#ifdef HAVE_IO_URING
+	NULL,
+	NULL,
+#endif
 #ifdef HAVE_PTHREAD
 #if MAIN_DEBUG && defined (PTHREAD_ERRORCHECK_MUTEX_INITIALIZER_NP)
 	PTHREAD_ERRORCHECK_MUTEX_INITIALIZER_NP,
@@ -151,6 +179,12 @@ static struct re global_re = {
 };
 
 
+#ifdef HAVE_EPOLL_PWAIT2
+/* Set if the kernel is older than the C library */
+static bool pwait2_nosys;
+#endif
+
+
 #ifdef HAVE_PTHREAD
 
 static void poll_close(struct re *re);
@@ -161,8 +195,12 @@ static pthread_key_t  pt_key;
 
 static void thread_destructor(void *arg)
 {
-	poll_close(arg);
-	free(arg);
+	struct re *re = arg;
+
+	poll_close(re);
+	mem_deref(re->tmrw);
+	mem_deref(re->hstats);
+	free(re);
 }
 
 
@@ -296,6 +334,8 @@ static int set_epoll_fds(struct re *re, int fd, int flags)
 			event.events |= EPOLLOUT;
 		if (flags & FD_EXCEPT)
 			event.events |= EPOLLERR;
+		if (flags & FD_EDGE)
+			event.events |= EPOLLET;
 
 		/* Try to add it first */
 		if (-1 == epoll_ctl(re->epfd, EPOLL_CTL_ADD, fd, &event)) {
@@ -336,6 +376,7 @@ static int set_epoll_fds(struct re *re, int fd, int flags)
 #ifdef HAVE_KQUEUE
 static int set_kqueue_fds(struct re *re, int fd, int flags)
 {
+	const unsigned short clr = (flags & FD_EDGE) ? EV_CLEAR : 0;
 	struct kevent kev[2];
 	int r, n = 0;
 
@@ -349,11 +390,11 @@ static int set_kqueue_fds(struct re *re, int fd, int flags)
 	memset(kev, 0, sizeof(kev));
 
 	if (flags & FD_WRITE) {
-		EV_SET(&kev[n], fd, EVFILT_WRITE, EV_ADD, 0, 0, 0);
+		EV_SET(&kev[n], fd, EVFILT_WRITE, EV_ADD | clr, 0, 0, 0);
 		++n;
 	}
 	if (flags & FD_READ) {
-		EV_SET(&kev[n], fd, EVFILT_READ, EV_ADD, 0, 0, 0);
+		EV_SET(&kev[n], fd, EVFILT_READ, EV_ADD | clr, 0, 0, 0);
 		++n;
 	}
 
@@ -407,6 +448,12 @@ static int rebuild_fds(struct re *re)
 			break;
 #endif
 
+#ifdef HAVE_IO_URING
+		case METHOD_IO_URING:
+			err = uring_fd_set(re->uring, i, re->fhs[i].flags);
+			break;
+#endif
+
 		default:
 			break;
 		}
@@ -433,10 +480,15 @@ static int poll_init(struct re *re)
 #ifdef HAVE_POLL
 	case METHOD_POLL:
 		if (!re->fds) {
+			int i;
+
 			re->fds = mem_zalloc(re->maxfds * sizeof(*re->fds),
 					    NULL);
 			if (!re->fds)
 				return ENOMEM;
+
+			for (i=0; i<re->maxfds; i++)
+				re->fds[i].fd = -1;
 		}
 		break;
 #endif
@@ -444,8 +496,8 @@ static int poll_init(struct re *re)
 	case METHOD_EPOLL:
 		if (!re->events) {
 			DEBUG_INFO("allocate %u bytes for epoll set\n",
-				   re->maxfds * sizeof(*re->events));
-			re->events = mem_zalloc(re->maxfds*sizeof(*re->events),
+				   re->maxev * sizeof(*re->events));
+			re->events = mem_zalloc(re->maxev*sizeof(*re->events),
 					      NULL);
 			if (!re->events)
 				return ENOMEM;
@@ -468,7 +520,7 @@ static int poll_init(struct re *re)
 	case METHOD_KQUEUE:
 
 		if (!re->evlist) {
-			size_t sz = re->maxfds * sizeof(*re->evlist);
+			size_t sz = re->maxev * sizeof(*re->evlist);
 			re->evlist = mem_zalloc(sz, NULL);
 			if (!re->evlist)
 				return ENOMEM;
@@ -484,6 +536,25 @@ static int poll_init(struct re *re)
 		break;
 #endif
 
+#ifdef HAVE_IO_URING
+	case METHOD_IO_URING:
+		if (!re->uevents) {
+			size_t sz = re->maxev * sizeof(*re->uevents);
+			re->uevents = mem_zalloc(sz, NULL);
+			if (!re->uevents)
+				return ENOMEM;
+		}
+
+		if (!re->uring) {
+			int err = uring_alloc(&re->uring, re->maxfds);
+			if (err) {
+				DEBUG_WARNING("io_uring setup: %m\n", err);
+				return err;
+			}
+		}
+		break;
+#endif
+
 	default:
 		break;
 	}
@@ -498,6 +569,8 @@ static void poll_close(struct re *re)
 
 	re->fhs = mem_deref(re->fhs);
 	re->maxfds = 0;
+	re->maxev  = 0;
+	re->readyc = 0;
 
 #ifdef HAVE_POLL
 	re->fds = mem_deref(re->fds);
@@ -521,6 +594,11 @@ static void poll_close(struct re *re)
 
 	re->evlist = mem_deref(re->evlist);
 #endif
+
+#ifdef HAVE_IO_URING
+	re->uring   = mem_deref(re->uring);
+	re->uevents = mem_deref(re->uevents);
+#endif
 }
 
 
@@ -551,6 +629,68 @@ static int poll_setup(struct re *re)
 }
 
 
+/* Grow the fd table to hold a file descriptor, by doubling its size */
+static int fd_grow(struct re *re, int fd)
+{
+	int maxfds = re->maxfds;
+	void *p;
+
+	if (maxfds <= 0 || !re->fhs)
+		return EMFILE;
+
+	while (maxfds <= fd) {
+		if (maxfds > INT_MAX / 2)
+			return EMFILE;
+		maxfds *= 2;
+	}
+
+#ifdef HAVE_SELECT
+	/* an fd_set has a fixed size */
+	if (re->method == METHOD_SELECT)
+		return EMFILE;
+#endif
+
+	p = mem_reallocarray(re->fhs, maxfds, sizeof(*re->fhs), NULL);
+	if (!p)
+		return ENOMEM;
+
+	re->fhs = p;
+	memset(&re->fhs[re->maxfds], 0,
+	       (maxfds - re->maxfds) * sizeof(*re->fhs));
+
+#ifdef HAVE_POLL
+	if (re->fds) {
+		int i;
+
+		p = mem_reallocarray(re->fds, maxfds, sizeof(*re->fds), NULL);
+		if (!p)
+			return ENOMEM;
+
+		re->fds = p;
+		memset(&re->fds[re->maxfds], 0,
+		       (maxfds - re->maxfds) * sizeof(*re->fds));
+
+		for (i=re->maxfds; i<maxfds; i++)
+			re->fds[i].fd = -1;
+	}
+#endif
+
+#ifdef HAVE_IO_URING
+	if (re->uring) {
+		int err = uring_resize(re->uring, maxfds);
+		if (err)
+			return err;
+	}
+#endif
+
+	DEBUG_INFO("fd table grows from %d to %d\n", re->maxfds, maxfds);
+
+	re->maxfds = maxfds;
+
+	return 0;
+}
+
+
 /**
  * Listen for events on a file descriptor
  *
@@ -580,12 +720,18 @@ int fd_listen(int fd, int flags, fd_h *fh, void *arg)
 	}
 
 	if (fd >= re->maxfds) {
-		if (flags) {
+
+		/* there is nothing to remove */
+		if (!flags)
+			return 0;
+
+		err = fd_grow(re, fd);
+		if (err) {
 			DEBUG_WARNING("fd_listen: fd=%d flags=0x%02x"
-				      " - Max %d fds\n",
-				      fd, flags, re->maxfds);
+				      " - Max %d fds (%m)\n",
+				      fd, flags, re->maxfds, err);
+			return err;
 		}
-		return EMFILE;
 	}
 
 	/* Update fh set */
@@ -619,6 +765,12 @@ int fd_listen(int fd, int flags, fd_h *fh, void *arg)
 		break;
 #endif
 
+#ifdef HAVE_IO_URING
+	case METHOD_IO_URING:
+		err = uring_fd_set(re->uring, fd, flags);
+		break;
+#endif
+
 	default:
 		break;
 	}
@@ -646,6 +798,116 @@ void fd_close(int fd)
 }
 
 
+/**
+ * Mark an edge-triggered file descriptor as still readable. A handler
+ * that stops reading before EAGAIN, e.g. when its budget is spent, calls
+ * this so that it is called again with FD_READ in the next iteration of
+ * the main loop, since no new event is reported for the unread input.
+ *
+ * @param fd     File descriptor, that was listened to with FD_EDGE
+ */
+void fd_ready(int fd)
+{
+	struct re *re = re_get();
+
+	if (fd < 0 || fd >= re->maxfds || !re->fhs)
+		return;
+
+	if (!(re->fhs[fd].flags & FD_EDGE) || re->fhs[fd].ready)
+		return;
+
+	/* The other methods report the fd again */
+	if (re->method != METHOD_EPOLL && re->method != METHOD_KQUEUE)
+		return;
+
+	re->fhs[fd].ready = true;
+	re->fhs[fd].rnext = -1;
+
+	if (re->readyc)
+		re->fhs[re->readyt].rnext = fd;
+	else
+		re->readyh = fd;
+
+	re->readyt = fd;
+	++re->readyc;
+}
+
+
+#ifdef HAVE_EPOLL
+/* Wait without sleeping, for the busy-poll time or until the next timer */
+static int epoll_spin(struct re *re, uint64_t to)
+{
+	const uint64_t t0 = tmr_jiffies_usec();
+	const uint64_t end = t0 + (to ? min(to, re->busy) : re->busy);
+	int n;
+
+	do {
+		n = epoll_wait(re->epfd, re->events, re->maxev, 0);
+		if (n)
+			return n;
+
+	} while (tmr_jiffies_usec() < end);
+
+	return 0;
+}
+#endif
+
+
+static void fd_call(struct re *re, int fd, int flags)
+{
+	fd_h *fh = re->fhs[fd].fh;
+	uint64_t t0;
+
+	if (!fh)
+		return;
+
+	t0 = re->hstats ? hstats_usec() : 0;
+
+	RE_TRACE_BEGIN("re", "fd");
+	RE_PROBE2(fd_begin, fd, flags);
+
+#if MAIN_DEBUG
+	fd_handler(re, fd, flags);
+#else
+	fh(flags, re->fhs[fd].arg);
+#endif
+
+	RE_PROBE1(fd_end, fd);
+	RE_TRACE_END("re", "fd");
+
+	/* The handler may have disabled the accounting */
+	if (t0 && re->hstats) {
+		hstats_add(re->hstats, (re_hstat_fn *)fh, false,
+			   hstats_usec() - t0);
+	}
+}
+
+
+/*
+ * Call the handlers of edge-triggered fds that stopped reading before
+ * EAGAIN. Handlers that mark their fd again are called in the next
+ * iteration, after the next wait for events.
+ */
+static void ready_dispatch(struct re *re)
+{
+	int fd = re->readyh, c = re->readyc;
+
+	re->readyc = 0;
+
+	while (c-- > 0 && re->fhs) {
+
+		const int next = re->fhs[fd].rnext;
+
+		re->fhs[fd].ready = false;
+
+		if (re->fhs[fd].flags & FD_EDGE)
+			fd_call(re, fd, FD_READ);
+
+		fd = next;
+	}
+}
+
+
 /**
  * Polling loop
  *
@@ -655,13 +917,18 @@ void fd_close(int fd)
  */
 static int fd_poll(struct re *re)
 {
-	const uint64_t to = tmr_next_timeout(&re->tmrl);
-	int i, n;
+	uint64_t to = tmr_next_timeout_us(&re->tmrl);
+	int to_ms = re->readyc ? 0 : to ? (int)((to + 999) / 1000) : -1;
+	int i, n, nev;
 #ifdef HAVE_SELECT
 	fd_set rfds, wfds, efds;
 #endif
 
-	DEBUG_INFO("next timer: %llu ms\n", to);
+	/* Due timers were deferred by the timer budget */
+	if (!list_isempty(&re->tmrl))
+		to_ms = 0;
+
+	DEBUG_INFO("next timer: %llu us\n", to);
 
 	/* Wait for I/O */
 	switch (re->method) {
@@ -669,7 +936,7 @@ static int fd_poll(struct re *re)
 #ifdef HAVE_POLL
 	case METHOD_POLL:
 		re_unlock(re);
-		n = poll(re->fds, re->nfds, to ? (int)to : -1);
+		n = poll(re->fds, re->nfds, to_ms);
 		re_lock(re);
 		break;
 #endif
@@ -695,11 +962,11 @@ static int fd_poll(struct re *re)
 		}
 
 #ifdef WIN32
-		tv.tv_sec  = (long) to / 1000;
+		tv.tv_sec  = (long) (to / 1000000);
 #else
-		tv.tv_sec  = (time_t) to / 1000;
+		tv.tv_sec  = (time_t) (to / 1000000);
 #endif
-		tv.tv_usec = (uint32_t) (to % 1000) * 1000;
+		tv.tv_usec = (uint32_t) (to % 1000000);
 		re_unlock(re);
 		n = select(re->nfds, &rfds, &wfds, &efds, to ? &tv : NULL);
 		re_lock(re);
@@ -709,8 +976,47 @@ static int fd_poll(struct re *re)
 #ifdef HAVE_EPOLL
 	case METHOD_EPOLL:
 		re_unlock(re);
-		n = epoll_wait(re->epfd, re->events, re->maxfds,
-			       to ? (int)to : -1);
+
+		if (re->busy && !re->readyc) {
+			const uint64_t t0 = tmr_jiffies_usec();
+			uint64_t spent;
+
+			n = epoll_spin(re, to);
+			spent = tmr_jiffies_usec() - t0;
+
+			if (n || (to && spent >= to)) {
+				re_lock(re);
+				break;
+			}
+
+			if (to) {
+				to   -= spent;
+				to_ms = (int)((to + 999) / 1000);
+			}
+		}
+
+#ifdef HAVE_EPOLL_PWAIT2
+		if (!pwait2_nosys) {
+			struct timespec ts;
+
+			ts.tv_sec  = (time_t) (to / 1000000);
+			ts.tv_nsec = (long) (to % 1000000) * 1000;
+
+			if (re->readyc)
+				memset(&ts, 0, sizeof(ts));
+
+			n = epoll_pwait2(re->epfd, re->events, re->maxev,
+					 (to || re->readyc) ? &ts : NULL,
+					 NULL);
+			if (n >= 0 || errno != ENOSYS) {
+				re_lock(re);
+				break;
+			}
+
+			pwait2_nosys = true;
+		}
+#endif
+		n = epoll_wait(re->epfd, re->events, re->maxev, to_ms);
 		re_lock(re);
 		break;
 #endif
@@ -719,19 +1025,33 @@ static int fd_poll(struct re *re)
 	case METHOD_KQUEUE: {
 		struct timespec timeout;
 
-		timeout.tv_sec = (time_t) (to / 1000);
-		timeout.tv_nsec = (to % 1000) * 1000000;
+		timeout.tv_sec = (time_t) (to / 1000000);
+		timeout.tv_nsec = (to % 1000000) * 1000;
+
+		if (re->readyc)
+			memset(&timeout, 0, sizeof(timeout));
 
 		re_unlock(re);
-		n = kevent(re->kqfd, NULL, 0, re->evlist, re->maxfds,
-			   to ? &timeout : NULL);
+		n = kevent(re->kqfd, NULL, 0, re->evlist, re->maxev,
+			   (to || re->readyc) ? &timeout : NULL);
 		re_lock(re);
 		}
 		break;
 #endif
 
+#ifdef HAVE_IO_URING
+	case METHOD_IO_URING:
+		re_unlock(re);
+		n = uring_wait(re->uring, to, re->uevents, re->maxev);
+		re_lock(re);
+		if (n < 0)
+			return -n;
+		break;
+#endif
+
 	default:
 		(void)to;
+		(void)to_ms;
 		DEBUG_WARNING("no polling method set\n");
 		return EINVAL;
 	}
@@ -739,8 +1059,19 @@ static int fd_poll(struct re *re)
 	if (n < 0)
 		return errno;
 
-	/* Check for events */
-	for (i=0; (n > 0) && (i < re->nfds); i++) {
+	/*
+	 * Check for events. poll() and select() mark the ready fds in the
+	 * whole set, the other methods return a list of n events.
+	 */
+	if (re->method != METHOD_POLL && re->method != METHOD_SELECT)
+		nev = n;
+	else
+		nev = re->nfds;
+
+	/* Only a method change by one of the handlers ends the loop */
+	re->update = false;
+
+	for (i=0; (n > 0) && (i < nev); i++) {
 		int fd, flags = 0;
 
 		switch (re->method) {
@@ -831,6 +1162,13 @@ static int fd_poll(struct re *re)
 			break;
 #endif
 
+#ifdef HAVE_IO_URING
+		case METHOD_IO_URING:
+			fd    = re->uevents[i].fd;
+			flags = re->uevents[i].flags;
+			break;
+#endif
+
 		default:
 			return EINVAL;
 		}
@@ -838,13 +1176,13 @@ static int fd_poll(struct re *re)
 		if (!flags)
 			continue;
 
-		if (re->fhs[fd].fh) {
-#if MAIN_DEBUG
-			fd_handler(re, fd, flags);
-#else
-			re->fhs[fd].fh(flags, re->fhs[fd].arg);
+		fd_call(re, fd, flags);
+
+#ifdef HAVE_IO_URING
+		/* Poll requests are one-shot, and re-armed after dispatch */
+		if (re->method == METHOD_IO_URING)
+			uring_fd_rearm(re->uring, fd, re->fhs[fd].flags);
 #endif
-		}
 
 		/* Check if polling method was changed */
 		if (re->update) {
@@ -855,12 +1193,17 @@ static int fd_poll(struct re *re)
 		--n;
 	}
 
+	ready_dispatch(re);
+
 	return 0;
 }
 
 
 /**
- * Set the maximum number of file descriptors
+ * Set the initial size of the file descriptor table, and of the event
+ * set that is passed to the polling method. The table grows when
+ * fd_listen() is called for a larger file descriptor, except for
+ * select() which is limited to FD_SETSIZE.
  *
  * @param maxfds Max FDs. 0 to free.
  *
@@ -873,11 +1216,15 @@ int fd_setsize(int maxfds)
 	if (!maxfds) {
 		fd_debug();
 		poll_close(re);
+		re->tmrw   = mem_deref(re->tmrw);
+		re->hstats = mem_deref(re->hstats);
 		return 0;
 	}
 
-	if (!re->maxfds)
+	if (!re->maxfds) {
 		re->maxfds = maxfds;
+		re->maxev  = maxfds;
+	}
 
 	if (!re->fhs) {
 		DEBUG_INFO("fd_setsize: maxfds=%d, allocating %u bytes\n",
@@ -1001,6 +1348,32 @@ int re_main(re_signal_h *signalh)
 }
 
 
+/**
+ * Set the busy-poll time of the main loop in the current thread. With
+ * epoll, the loop then polls without sleeping for up to this time before
+ * it blocks, which avoids the wakeup latency of a sleeping thread at the
+ * cost of a busy core. UDP Sockets that are attached to the thread later
+ * also get the busy-poll time as a socket option (SO_BUSY_POLL).
+ *
+ * @param usec Busy-poll time in [us], 0 to disable
+ */
+void re_busy_poll_set(uint32_t usec)
+{
+	re_get()->busy = usec;
+}
+
+
+/**
+ * Get the busy-poll time of the main loop in the current thread
+ *
+ * @return Busy-poll time in [us], 0 if disabled
+ */
+uint32_t re_busy_poll(void)
+{
+	return re_get()->busy;
+}
+
+
 /**
  * Cancel the main polling loop
  */
@@ -1032,11 +1405,59 @@ int re_debug(struct re_printf *pf, void *unused)
 	err |= re_hprintf(pf, "  nfds:    %d\n", re->nfds);
 	err |= re_hprintf(pf, "  method:  %d (%s)\n", re->method,
 			  poll_method_name(re->method));
+	err |= hstats_debug(pf, re->hstats);
 
 	return err;
 }
 
 
+/**
+ * Enable or disable accounting of the time spent in fd and timer handlers
+ * of this thread. Disabling the accounting discards all statistics.
+ *
+ * @param enable True to enable, false to disable
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int re_hstat_enable(bool enable)
+{
+	struct re *re = re_get();
+
+	if (!enable) {
+		re->hstats = mem_deref(re->hstats);
+		return 0;
+	}
+
+	if (re->hstats)
+		return 0;
+
+	return hstats_alloc(&re->hstats);
+}
+
+
+/**
+ * Get the handler statistics of this thread, sorted by cumulative time
+ *
+ * @param v Vector of returned statistics
+ * @param n Number of elements in vector
+ *
+ * @return Number of handlers returned
+ */
+size_t re_hstat_get(struct re_hstat *v, size_t n)
+{
+	return hstats_copy(re_get()->hstats, v, n);
+}
+
+
+/**
+ * Reset the handler statistics of this thread
+ */
+void re_hstat_reset(void)
+{
+	hstats_reset(re_get()->hstats);
+}
+
+
 /**
  * Set async I/O polling method. This function can also be called while the
  * program is running.
@@ -1077,6 +1498,12 @@ int poll_method_set(enum poll_method method)
 #ifdef HAVE_KQUEUE
 	case METHOD_KQUEUE:
 		break;
+#endif
+#ifdef HAVE_IO_URING
+	case METHOD_IO_URING:
+		if (!uring_check())
+			return EINVAL;
+		break;
 #endif
 	default:
 		DEBUG_WARNING("poll method not supported: '%s'\n",
@@ -1154,6 +1581,8 @@ void re_thread_close(void)
 	re = pthread_getspecific(pt_key);
 	if (re) {
 		poll_close(re);
+		mem_deref(re->tmrw);
+		mem_deref(re->hstats);
 		free(re);
 		pthread_setspecific(pt_key, NULL);
 	}
@@ -1212,3 +1641,69 @@ struct list *tmrl_get(void)
 {
 	return &re_get()->tmrl;
 }
+
+
+/**
+ * Get the timer wheel for this thread
+ *
+ * @return Pointer to timer wheel
+ *
+ * @note only used by tmr module
+ */
+struct tmrw **tmrw_get(void);
+struct tmrw **tmrw_get(void)
+{
+	return &re_get()->tmrw;
+}
+
+
+/**
+ * Get the handler accounting for this thread
+ *
+ * @return Handler accounting, or NULL if not enabled
+ *
+ * @note only used by tmr module
+ */
+struct hstats *hstats_get(void);
+struct hstats *hstats_get(void)
+{
+	return re_get()->hstats;
+}
+
+
+#ifdef HAVE_IO_URING
+struct uring *uring_get(void)
+{
+	struct re *re = re_get();
+
+	if (re->method != METHOD_IO_URING)
+		return NULL;
+
+	return re->uring;
+}
+#else
+int fd_send(int fd, struct mbuf *mb, const struct sa *dst,
+	    fd_compl_h *ch, void *arg)
+{
+	(void)fd;
+	(void)mb;
+	(void)dst;
+	(void)ch;
+	(void)arg;
+
+	return ENOSYS;
+}
+
+
+int fd_recv(int fd, struct mbuf *mb, struct sa *src,
+	    fd_compl_h *ch, void *arg)
+{
+	(void)fd;
+	(void)mb;
+	(void)src;
+	(void)ch;
+	(void)arg;
+
+	return ENOSYS;
+}
+#endif
@@ -10,6 +10,38 @@ bool epoll_check(void);
 #endif
 
 
+struct hstats;
+struct re_hstat;
+struct re_printf;
+
+int  hstats_alloc(struct hstats **hsp);
+uint64_t hstats_usec(void);
+void hstats_add(struct hstats *hs, void (*h)(void), bool tmr, uint64_t usec);
+void hstats_reset(struct hstats *hs);
+size_t hstats_copy(const struct hstats *hs, struct re_hstat *v, size_t max);
+int  hstats_debug(struct re_printf *pf, const struct hstats *hs);
+
+
+#ifdef HAVE_IO_URING
+struct uring;
+
+/** File descriptor event from io_uring */
+struct uring_event {
+	int fd;       /**< File descriptor */
+	int flags;    /**< Event flags     */
+};
+
+bool uring_check(void);
+int  uring_alloc(struct uring **urp, int maxfds);
+int  uring_resize(struct uring *ur, int maxfds);
+int  uring_fd_set(struct uring *ur, int fd, int flags);
+void uring_fd_rearm(struct uring *ur, int fd, int flags);
+int  uring_wait(struct uring *ur, uint64_t to, struct uring_event *ev,
+		int max);
+struct uring *uring_get(void);
+#endif
+
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -4,14 +4,20 @@
 # Copyright (C) 2010 Creytiv.com
 #
 
+SRCS	+= main/hstat.c
 SRCS	+= main/init.c
 SRCS	+= main/main.c
 SRCS	+= main/method.c
+SRCS	+= main/sig.c
 
 ifneq ($(HAVE_EPOLL),)
 SRCS	+= main/epoll.c
 endif
 
+ifneq ($(HAVE_IO_URING),)
+SRCS	+= main/uring.c
+endif
+
 ifneq ($(USE_OPENSSL),)
 SRCS    += main/openssl.c
 endif
@@ -0,0 +1,254 @@
+/**
+ * @file sig.c  Signals as file descriptor events
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#define _DEFAULT_SOURCE 1
+#include <signal.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#ifdef HAVE_SIGNALFD
+#include <sys/signalfd.h>
+#endif
+#ifdef HAVE_KQUEUE
+#include <sys/types.h>
+#include <sys/event.h>
+#include <sys/time.h>
+#endif
+#include <re_types.h>
+#include <re_fmt.h>
+#include <re_mem.h>
+#include <re_main.h>
+
+
+#define DEBUG_MODULE "sig"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+/*
+ * The signals are received by the main loop of the thread that listens,
+ * with signalfd() on Linux and EVFILT_SIGNAL on kqueue, instead of by an
+ * asynchronous handler in whichever thread the kernel chooses.
+ */
+
+
+enum {
+	SIG_BATCH = 8,
+};
+
+
+/** Defines a signal listener */
+struct re_sig {
+	sigset_t set;
+	re_signal_h *sigh;
+	int fd;
+};
+
+
+#if defined (HAVE_SIGNALFD) || defined (HAVE_KQUEUE)
+static void destructor(void *data)
+{
+	struct re_sig *rs = data;
+
+	if (rs->fd >= 0) {
+		fd_close(rs->fd);
+		(void)close(rs->fd);
+	}
+
+#if defined (HAVE_SIGNALFD)
+#ifdef HAVE_PTHREAD
+	(void)pthread_sigmask(SIG_UNBLOCK, &rs->set, NULL);
+#else
+	(void)sigprocmask(SIG_UNBLOCK, &rs->set, NULL);
+#endif
+#else
+	{
+		int sig;
+
+		for (sig=1; sig<NSIG; sig++) {
+			if (sigismember(&rs->set, sig) == 1)
+				(void)signal(sig, SIG_DFL);
+		}
+	}
+#endif
+}
+#endif
+
+
+#if defined (HAVE_SIGNALFD)
+static void read_handler(int flags, void *arg)
+{
+	struct re_sig *rs = arg;
+	struct signalfd_siginfo siv[SIG_BATCH];
+	ssize_t n;
+	size_t i;
+
+	(void)flags;
+
+	n = read(rs->fd, siv, sizeof(siv));
+	if (n <= 0)
+		return;
+
+	/* The listener may be destroyed by the handler */
+	mem_ref(rs);
+
+	for (i=0; i<(size_t)n / sizeof(siv[0]); i++) {
+
+		rs->sigh((int)siv[i].ssi_signo);
+
+		if (mem_nrefs(rs) == 1)
+			break;
+	}
+
+	mem_deref(rs);
+}
+
+
+static int sig_open(struct re_sig *rs)
+{
+	int err;
+
+#ifdef HAVE_PTHREAD
+	err = pthread_sigmask(SIG_BLOCK, &rs->set, NULL);
+	if (err)
+		return err;
+#else
+	if (sigprocmask(SIG_BLOCK, &rs->set, NULL))
+		return errno;
+#endif
+
+	rs->fd = signalfd(-1, &rs->set, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (rs->fd < 0)
+		return errno;
+
+	return 0;
+}
+#elif defined (HAVE_KQUEUE)
+static void read_handler(int flags, void *arg)
+{
+	struct re_sig *rs = arg;
+	struct kevent evv[SIG_BATCH];
+	struct timespec ts = {0, 0};
+	int n, i;
+
+	(void)flags;
+
+	n = kevent(rs->fd, NULL, 0, evv, SIG_BATCH, &ts);
+	if (n <= 0)
+		return;
+
+	/* The listener may be destroyed by the handler */
+	mem_ref(rs);
+
+	for (i=0; i<n; i++) {
+
+		rs->sigh((int)evv[i].ident);
+
+		if (mem_nrefs(rs) == 1)
+			break;
+	}
+
+	mem_deref(rs);
+}
+
+
+static int sig_open(struct re_sig *rs)
+{
+	int sig, err = 0;
+
+	rs->fd = kqueue();
+	if (rs->fd < 0)
+		return errno;
+
+	for (sig=1; sig<NSIG; sig++) {
+
+		struct kevent kev;
+
+		if (sigismember(&rs->set, sig) != 1)
+			continue;
+
+		/* EVFILT_SIGNAL also sees ignored signals */
+		(void)signal(sig, SIG_IGN);
+
+		EV_SET(&kev, sig, EVFILT_SIGNAL, EV_ADD, 0, 0, 0);
+
+		if (kevent(rs->fd, &kev, 1, NULL, 0, NULL) < 0) {
+			err = errno;
+			break;
+		}
+	}
+
+	return err;
+}
+#endif
+
+
+/**
+ * Listen for signals in the main loop of the current thread. The signals
+ * are blocked in the calling thread (Linux), so it should be called
+ * before other threads are created, which inherit the signal mask.
+ * The listener is removed, and the signals restored, when it is
+ * dereferenced.
+ *
+ * @param rsp  Pointer to allocated signal listener
+ * @param sigv Array of signal numbers, e.g. SIGHUP or SIGCHLD
+ * @param sigc Number of signals
+ * @param sigh Signal handler, called from the main loop
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int re_sig_listen(struct re_sig **rsp, const int *sigv, size_t sigc,
+		  re_signal_h *sigh)
+{
+#if defined (HAVE_SIGNALFD) || defined (HAVE_KQUEUE)
+	struct re_sig *rs;
+	sigset_t set;
+	size_t i;
+	int err;
+
+	if (!rsp || !sigv || !sigc || !sigh)
+		return EINVAL;
+
+	sigemptyset(&set);
+
+	for (i=0; i<sigc; i++) {
+		if (sigaddset(&set, sigv[i]))
+			return EINVAL;
+	}
+
+	rs = mem_zalloc(sizeof(*rs), destructor);
+	if (!rs)
+		return ENOMEM;
+
+	rs->set  = set;
+	rs->sigh = sigh;
+	rs->fd   = -1;
+
+	err = sig_open(rs);
+	if (err)
+		goto out;
+
+	err = fd_listen(rs->fd, FD_READ, read_handler, rs);
+
+ out:
+	if (err) {
+		DEBUG_WARNING("listen: %m\n", err);
+		mem_deref(rs);
+	}
+	else
+		*rsp = rs;
+
+	return err;
+#else
+	(void)rsp;
+	(void)sigv;
+	(void)sigc;
+	(void)sigh;
+	return ENOSYS;
+#endif
+}
@@ -0,0 +1,700 @@
+/**
+ * @file uring.c  Linux io_uring specific routines
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#define _GNU_SOURCE 1
+#include <unistd.h>
+#include <string.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include <re_types.h>
+#include <re_fmt.h>
+#include <re_mem.h>
+#include <re_mbuf.h>
+#include <re_list.h>
+#include <re_hash.h>
+#include <re_sa.h>
+#include <re_main.h>
+#include "main.h"
+
+
+#define DEBUG_MODULE "uring"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+/** User data tags, stored in the lower bits of the CQE user_data */
+enum {
+	UD_POLL    = 0,
+	UD_IGNORE  = 1,
+	UD_TIMEOUT = 2,
+	UD_REQ     = 3,
+	UD_MASK    = 3,
+	UD_SHIFT   = 2,
+};
+
+/** Per file descriptor poll state */
+struct urfd {
+	uint32_t gen;         /**< Generation of the armed poll request */
+	bool armed;           /**< Poll request is outstanding          */
+};
+
+/** Submitted I/O request */
+struct uring_req {
+	struct le le;         /**< Linked list element               */
+	struct msghdr msg;    /**< Message header                    */
+	struct iovec iov;     /**< Buffer vector                     */
+	struct sa sa;         /**< Source or destination address     */
+	struct sa *src;       /**< Returned source address           */
+	struct mbuf *mb;      /**< Referenced buffer                 */
+	fd_compl_h *ch;       /**< Completion handler                */
+	void *arg;            /**< Handler argument                  */
+	int res;              /**< Completion result                 */
+	bool recv;            /**< Receive request                   */
+};
+
+/** Defines an io_uring instance */
+struct uring {
+	int fd;                       /**< io_uring file descriptor    */
+	void *sq_ring;                /**< Mapped submission ring      */
+	void *cq_ring;                /**< Mapped completion ring      */
+	size_t sq_ring_sz;            /**< Submission ring size        */
+	size_t cq_ring_sz;            /**< Completion ring size        */
+	struct io_uring_sqe *sqes;    /**< Submission queue entries    */
+	size_t sqes_sz;               /**< Size of SQE array           */
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned sq_entries;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+	struct __kernel_timespec ts;  /**< Wait timeout                */
+	struct urfd *fds;             /**< Poll state per fd           */
+	int maxfds;                   /**< Size of poll state table    */
+	struct list reql;             /**< Outstanding I/O requests    */
+};
+
+
+static int sys_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+
+static int sys_uring_enter(int fd, unsigned to_submit, unsigned min_compl,
+			   unsigned flags)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_compl,
+			    flags, NULL, 0);
+}
+
+
+static void req_destructor(void *data)
+{
+	struct uring_req *req = data;
+
+	list_unlink(&req->le);
+	mem_deref(req->mb);
+}
+
+
+static void uring_destructor(void *data)
+{
+	struct uring *ur = data;
+
+	if (ur->fd >= 0)
+		(void)close(ur->fd);
+
+	if (ur->sqes)
+		(void)munmap(ur->sqes, ur->sqes_sz);
+	if (ur->cq_ring && ur->cq_ring != ur->sq_ring)
+		(void)munmap(ur->cq_ring, ur->cq_ring_sz);
+	if (ur->sq_ring)
+		(void)munmap(ur->sq_ring, ur->sq_ring_sz);
+
+	list_flush(&ur->reql);
+	mem_deref(ur->fds);
+}
+
+
+/**
+ * Check for working io_uring kernel support
+ *
+ * @return true if support, false if not
+ */
+bool uring_check(void)
+{
+	struct io_uring_params p;
+	int fd;
+
+	memset(&p, 0, sizeof(p));
+
+	fd = sys_uring_setup(2, &p);
+	if (fd < 0) {
+		DEBUG_INFO("io_uring_setup: %m\n", errno);
+		return false;
+	}
+
+	(void)close(fd);
+
+	return true;
+}
+
+
+/**
+ * Allocate a new io_uring instance
+ *
+ * @param urp     Pointer to allocated io_uring
+ * @param maxfds  Maximum number of file descriptors
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int uring_alloc(struct uring **urp, int maxfds)
+{
+	struct io_uring_params p;
+	struct uring *ur;
+	uint8_t *sq, *cq;
+	int err = 0;
+
+	if (!urp || maxfds <= 0)
+		return EINVAL;
+
+	ur = mem_zalloc(sizeof(*ur), uring_destructor);
+	if (!ur)
+		return ENOMEM;
+
+	ur->fd = -1;
+	list_init(&ur->reql);
+
+	ur->fds = mem_zalloc(maxfds * sizeof(*ur->fds), NULL);
+	if (!ur->fds) {
+		err = ENOMEM;
+		goto out;
+	}
+	ur->maxfds = maxfds;
+
+	memset(&p, 0, sizeof(p));
+
+	ur->fd = sys_uring_setup(hash_valid_size(min(maxfds, 4096)), &p);
+	if (ur->fd < 0) {
+		err = errno;
+		DEBUG_WARNING("io_uring_setup: %m\n", err);
+		goto out;
+	}
+
+	ur->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ur->cq_ring_sz = p.cq_off.cqes
+		+ p.cq_entries * sizeof(struct io_uring_cqe);
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ur->sq_ring_sz = max(ur->sq_ring_sz, ur->cq_ring_sz);
+		ur->cq_ring_sz = ur->sq_ring_sz;
+	}
+
+	ur->sq_ring = mmap(NULL, ur->sq_ring_sz, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_POPULATE, ur->fd,
+			   IORING_OFF_SQ_RING);
+	if (ur->sq_ring == MAP_FAILED) {
+		ur->sq_ring = NULL;
+		err = errno;
+		goto out;
+	}
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ur->cq_ring = ur->sq_ring;
+	}
+	else {
+		ur->cq_ring = mmap(NULL, ur->cq_ring_sz,
+				   PROT_READ | PROT_WRITE,
+				   MAP_SHARED | MAP_POPULATE, ur->fd,
+				   IORING_OFF_CQ_RING);
+		if (ur->cq_ring == MAP_FAILED) {
+			ur->cq_ring = NULL;
+			err = errno;
+			goto out;
+		}
+	}
+
+	ur->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+	ur->sqes = mmap(NULL, ur->sqes_sz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_SQES);
+	if (ur->sqes == MAP_FAILED) {
+		ur->sqes = NULL;
+		err = errno;
+		goto out;
+	}
+
+	sq = ur->sq_ring;
+	cq = ur->cq_ring;
+
+	ur->sq_head    = (unsigned *)(void *)(sq + p.sq_off.head);
+	ur->sq_tail    = (unsigned *)(void *)(sq + p.sq_off.tail);
+	ur->sq_mask    = (unsigned *)(void *)(sq + p.sq_off.ring_mask);
+	ur->sq_array   = (unsigned *)(void *)(sq + p.sq_off.array);
+	ur->sq_entries = p.sq_entries;
+	ur->cq_head    = (unsigned *)(void *)(cq + p.cq_off.head);
+	ur->cq_tail    = (unsigned *)(void *)(cq + p.cq_off.tail);
+	ur->cq_mask    = (unsigned *)(void *)(cq + p.cq_off.ring_mask);
+	ur->cqes = (struct io_uring_cqe *)(void *)(cq + p.cq_off.cqes);
+
+	DEBUG_INFO("io_uring: fd=%d sq=%u cq=%u features=0x%x\n",
+		   ur->fd, p.sq_entries, p.cq_entries, p.features);
+
+ out:
+	if (err)
+		mem_deref(ur);
+	else
+		*urp = ur;
+
+	return err;
+}
+
+
+/**
+ * Grow the poll state table of an io_uring instance
+ *
+ * @param ur      io_uring instance
+ * @param maxfds  New number of file descriptors
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int uring_resize(struct uring *ur, int maxfds)
+{
+	struct urfd *fds;
+
+	if (!ur)
+		return EINVAL;
+
+	if (maxfds <= ur->maxfds)
+		return 0;
+
+	fds = mem_reallocarray(ur->fds, maxfds, sizeof(*fds), NULL);
+	if (!fds)
+		return ENOMEM;
+
+	memset(&fds[ur->maxfds], 0, (maxfds - ur->maxfds) * sizeof(*fds));
+
+	ur->fds    = fds;
+	ur->maxfds = maxfds;
+
+	return 0;
+}
+
+
+static inline unsigned sq_pending(const struct uring *ur)
+{
+	return *ur->sq_tail - __atomic_load_n(ur->sq_head, __ATOMIC_ACQUIRE);
+}
+
+
+static int submit(struct uring *ur, unsigned min_compl)
+{
+	unsigned flags = min_compl ? IORING_ENTER_GETEVENTS : 0;
+
+	if (0 > sys_uring_enter(ur->fd, sq_pending(ur), min_compl, flags))
+		return errno;
+
+	return 0;
+}
+
+
+static struct io_uring_sqe *sqe_get(struct uring *ur)
+{
+	struct io_uring_sqe *sqe;
+	unsigned tail, idx;
+
+	if (sq_pending(ur) >= ur->sq_entries) {
+
+		/* Submission queue is full, flush it */
+		if (submit(ur, 0) || sq_pending(ur) >= ur->sq_entries)
+			return NULL;
+	}
+
+	tail = *ur->sq_tail;
+	idx  = tail & *ur->sq_mask;
+	sqe  = &ur->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+
+	/* The ring is only consumed by io_uring_enter() in this thread */
+	ur->sq_array[idx] = idx;
+	__atomic_store_n(ur->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	return sqe;
+}
+
+
+static int poll_add(struct uring *ur, int fd, int flags)
+{
+	struct io_uring_sqe *sqe;
+	uint16_t events = 0;
+
+	sqe = sqe_get(ur);
+	if (!sqe)
+		return ENOSPC;
+
+	if (flags & FD_READ)
+		events |= POLLIN;
+	if (flags & FD_WRITE)
+		events |= POLLOUT;
+	if (flags & FD_EXCEPT)
+		events |= POLLERR;
+
+	sqe->opcode      = IORING_OP_POLL_ADD;
+	sqe->fd          = fd;
+	sqe->poll_events = events;
+	sqe->user_data   = (uint64_t)ur->fds[fd].gen << 32
+		| (uint64_t)fd << UD_SHIFT | UD_POLL;
+
+	ur->fds[fd].armed = true;
+
+	return 0;
+}
+
+
+/**
+ * Update the wanted events for a file descriptor
+ *
+ * @param ur     io_uring instance
+ * @param fd     File descriptor
+ * @param flags  Wanted event flags, 0 to remove
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int uring_fd_set(struct uring *ur, int fd, int flags)
+{
+	struct urfd *ufd;
+
+	if (!ur)
+		return EBADFD;
+
+	if (fd < 0 || fd >= ur->maxfds)
+		return EBADF;
+
+	ufd = &ur->fds[fd];
+
+	if (ufd->armed) {
+		struct io_uring_sqe *sqe = sqe_get(ur);
+
+		if (!sqe)
+			return ENOSPC;
+
+		sqe->opcode    = IORING_OP_POLL_REMOVE;
+		sqe->fd        = -1;
+		sqe->addr      = (uint64_t)ufd->gen << 32
+			| (uint64_t)fd << UD_SHIFT | UD_POLL;
+		sqe->user_data = UD_IGNORE;
+
+		ufd->armed = false;
+	}
+
+	/* Completions of the old poll request are now stale */
+	++ufd->gen;
+
+	if (!flags)
+		return 0;
+
+	return poll_add(ur, fd, flags);
+}
+
+
+/**
+ * Re-arm the one-shot poll request of a file descriptor, after its
+ * event was dispatched
+ *
+ * @param ur     io_uring instance
+ * @param fd     File descriptor
+ * @param flags  Wanted event flags
+ */
+void uring_fd_rearm(struct uring *ur, int fd, int flags)
+{
+	if (!ur || !flags || fd < 0 || fd >= ur->maxfds)
+		return;
+
+	if (ur->fds[fd].armed)
+		return;
+
+	if (poll_add(ur, fd, flags))
+		DEBUG_WARNING("rearm: fd=%d: submission queue full\n", fd);
+}
+
+
+static void req_complete(struct uring_req *req, int res)
+{
+	fd_compl_h *ch = req->ch;
+	void *arg = req->arg;
+	size_t len = 0;
+	int err = 0;
+
+	list_unlink(&req->le);
+
+	if (res < 0) {
+		err = -res;
+	}
+	else {
+		len = res;
+
+		if (req->recv) {
+			req->mb->end = req->mb->pos + len;
+
+			if (req->src) {
+				*req->src = req->sa;
+				req->src->len = req->msg.msg_namelen;
+			}
+		}
+	}
+
+	mem_deref(req);
+
+	if (ch)
+		ch(err, len, arg);
+}
+
+
+/**
+ * Submit all pending requests and wait for events
+ *
+ * @param ur   io_uring instance
+ * @param to   Timeout in [us], 0 for infinite
+ * @param ev   Array of returned file descriptor events
+ * @param max  Size of event array
+ *
+ * @return Number of file descriptor events, or negative errorcode
+ */
+int uring_wait(struct uring *ur, uint64_t to, struct uring_event *ev, int max)
+{
+	struct list done = LIST_INIT;
+	unsigned head, tail;
+	int n = 0, err = 0;
+
+	if (!ur || !ev)
+		return -EINVAL;
+
+	head = *ur->cq_head;
+	tail = __atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE);
+
+	if (head == tail) {
+
+		if (to) {
+			struct io_uring_sqe *sqe = sqe_get(ur);
+
+			if (!sqe)
+				return -ENOSPC;
+
+			ur->ts.tv_sec  = to / 1000000;
+			ur->ts.tv_nsec = (to % 1000000) * 1000;
+
+			/* Completes on timeout or with any other completion */
+			sqe->opcode    = IORING_OP_TIMEOUT;
+			sqe->fd        = -1;
+			sqe->addr      = (uint64_t)(uintptr_t)&ur->ts;
+			sqe->len       = 1;
+			sqe->off       = 1;
+			sqe->user_data = UD_TIMEOUT;
+		}
+
+		err = submit(ur, 1);
+		if (err)
+			return -err;
+
+		tail = __atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE);
+	}
+	else if (sq_pending(ur)) {
+		err = submit(ur, 0);
+		if (err)
+			return -err;
+	}
+
+	while (head != tail && n < max) {
+
+		const struct io_uring_cqe *cqe;
+		uint64_t ud;
+		int res;
+
+		cqe = &ur->cqes[head & *ur->cq_mask];
+		ud  = cqe->user_data;
+		res = cqe->res;
+
+		++head;
+
+		switch (ud & UD_MASK) {
+
+		case UD_POLL: {
+			const int fd = (int)((ud >> UD_SHIFT) & 0x3fffffff);
+			int flags = 0;
+
+			if (fd >= ur->maxfds)
+				break;
+
+			/* Stale completion of a removed poll request */
+			if ((uint32_t)(ud >> 32) != ur->fds[fd].gen)
+				break;
+
+			ur->fds[fd].armed = false;
+
+			if (res < 0) {
+				flags = FD_EXCEPT;
+			}
+			else {
+				if (res & POLLIN)
+					flags |= FD_READ;
+				if (res & POLLOUT)
+					flags |= FD_WRITE;
+				if (res & (POLLERR|POLLHUP|POLLNVAL))
+					flags |= FD_EXCEPT;
+			}
+
+			ev[n].fd    = fd;
+			ev[n].flags = flags;
+			++n;
+		}
+			break;
+
+		case UD_REQ: {
+			struct uring_req *req;
+
+			req = (void *)(uintptr_t)(ud & ~(uint64_t)UD_MASK);
+			req->res = res;
+
+			/* Completion handlers are called when the ring
+			   has been consumed */
+			list_unlink(&req->le);
+			list_append(&done, &req->le, req);
+		}
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	__atomic_store_n(ur->cq_head, head, __ATOMIC_RELEASE);
+
+	while (done.head) {
+		struct uring_req *req = done.head->data;
+
+		req_complete(req, req->res);
+	}
+
+	return n;
+}
+
+
+static int req_submit(struct uring *ur, int fd, struct mbuf *mb,
+		      const struct sa *dst, struct sa *src, bool recv,
+		      fd_compl_h *ch, void *arg)
+{
+	struct io_uring_sqe *sqe;
+	struct uring_req *req;
+
+	req = mem_zalloc(sizeof(*req), req_destructor);
+	if (!req)
+		return ENOMEM;
+
+	req->mb   = mem_ref(mb);
+	req->src  = src;
+	req->ch   = ch;
+	req->arg  = arg;
+	req->recv = recv;
+
+	if (recv) {
+		req->iov.iov_base = mbuf_buf(mb);
+		req->iov.iov_len  = mbuf_get_space(mb);
+
+		req->msg.msg_name    = &req->sa.u.sa;
+		req->msg.msg_namelen = sizeof(req->sa.u);
+	}
+	else {
+		req->iov.iov_base = mbuf_buf(mb);
+		req->iov.iov_len  = mbuf_get_left(mb);
+
+		if (dst) {
+			req->sa = *dst;
+			req->msg.msg_name    = &req->sa.u.sa;
+			req->msg.msg_namelen = dst->len;
+		}
+	}
+
+	req->msg.msg_iov    = &req->iov;
+	req->msg.msg_iovlen = 1;
+
+	sqe = sqe_get(ur);
+	if (!sqe) {
+		mem_deref(req);
+		return ENOSPC;
+	}
+
+	sqe->opcode    = recv ? IORING_OP_RECVMSG : IORING_OP_SENDMSG;
+	sqe->fd        = fd;
+	sqe->addr      = (uint64_t)(uintptr_t)&req->msg;
+	sqe->len       = 1;
+	sqe->user_data = (uint64_t)(uintptr_t)req | UD_REQ;
+
+	list_append(&ur->reql, &req->le, req);
+
+	return 0;
+}
+
+
+/**
+ * Send data on a file descriptor using the io_uring of the current thread.
+ * The request is submitted together with the next batch of requests, and
+ * the completion handler is called from the main loop.
+ *
+ * @param fd   File descriptor
+ * @param mb   Buffer to send, referenced until completion
+ * @param dst  Optional destination address
+ * @param ch   Optional completion handler
+ * @param arg  Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ *
+ * @note The buffer must not be modified until the request has completed
+ */
+int fd_send(int fd, struct mbuf *mb, const struct sa *dst,
+	    fd_compl_h *ch, void *arg)
+{
+	struct uring *ur = uring_get();
+
+	if (fd < 0 || !mb)
+		return EINVAL;
+
+	if (!ur)
+		return ENOTSUP;
+
+	return req_submit(ur, fd, mb, dst, NULL, false, ch, arg);
+}
+
+
+/**
+ * Receive data on a file descriptor using the io_uring of the current
+ * thread. The data is written from the current position of the buffer.
+ *
+ * @param fd   File descriptor
+ * @param mb   Buffer to receive into, referenced until completion
+ * @param src  Optional returned source address
+ * @param ch   Completion handler
+ * @param arg  Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int fd_recv(int fd, struct mbuf *mb, struct sa *src,
+	    fd_compl_h *ch, void *arg)
+{
+	struct uring *ur = uring_get();
+
+	if (fd < 0 || !mb || !ch)
+		return EINVAL;
+
+	if (!ur)
+		return ENOTSUP;
+
+	return req_submit(ur, fd, mb, NULL, src, true, ch, arg);
+}
@@ -0,0 +1,158 @@
+/**
+ * @file chain.c  Chains of memory buffer segments
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re_types.h>
+#include <re_mem.h>
+#include <re_mbuf.h>
+
+
+/*
+ * A chain refers to the buffer memory of the memory buffers it was built
+ * from, so a header and a payload can be sent together with one
+ * sendmsg() without copying either of them. The segments stay valid if
+ * the memory buffers are changed or freed after they were added.
+ */
+
+
+/**
+ * Initialize a memory buffer chain
+ *
+ * @param mc Memory buffer chain
+ */
+void mbuf_chain_init(struct mbuf_chain *mc)
+{
+	if (!mc)
+		return;
+
+	memset(mc, 0, sizeof(*mc));
+}
+
+
+/**
+ * Release the segments of a memory buffer chain, and make it empty
+ *
+ * @param mc Memory buffer chain
+ */
+void mbuf_chain_reset(struct mbuf_chain *mc)
+{
+	size_t i;
+
+	if (!mc)
+		return;
+
+	for (i=0; i<mc->segc; i++)
+		mem_deref(mc->segv[i].buf);
+
+	mbuf_chain_init(mc);
+}
+
+
+static int chain_add(struct mbuf_chain *mc, const struct mbuf *mb,
+		     bool head)
+{
+	struct mbuf_seg *seg;
+
+	if (!mc || !mb)
+		return EINVAL;
+
+	if (!mbuf_get_left(mb))
+		return 0;
+
+	if (mc->segc >= MBUF_CHAIN_MAX)
+		return EOVERFLOW;
+
+	if (head) {
+		memmove(&mc->segv[1], &mc->segv[0],
+			mc->segc * sizeof(mc->segv[0]));
+		seg = &mc->segv[0];
+	}
+	else {
+		seg = &mc->segv[mc->segc];
+	}
+
+	seg->buf = mem_ref(mb->buf);
+	seg->pos = mb->pos;
+	seg->len = mbuf_get_left(mb);
+
+	++mc->segc;
+	mc->len += seg->len;
+
+	return 0;
+}
+
+
+/**
+ * Add the data of a memory buffer, from the current position, in front
+ * of a memory buffer chain, e.g. a protocol header
+ *
+ * @param mc Memory buffer chain
+ * @param mb Memory buffer, referenced by the chain
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int mbuf_chain_prepend(struct mbuf_chain *mc, const struct mbuf *mb)
+{
+	return chain_add(mc, mb, true);
+}
+
+
+/**
+ * Add the data of a memory buffer, from the current position, at the
+ * end of a memory buffer chain, e.g. a payload
+ *
+ * @param mc Memory buffer chain
+ * @param mb Memory buffer, referenced by the chain
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int mbuf_chain_append(struct mbuf_chain *mc, const struct mbuf *mb)
+{
+	return chain_add(mc, mb, false);
+}
+
+
+/**
+ * Copy the segments of a memory buffer chain to one memory buffer
+ *
+ * @param mbp      Pointer to allocated memory buffer
+ * @param mc       Memory buffer chain
+ * @param headroom Number of free bytes in front of the data
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int mbuf_chain_linearize(struct mbuf **mbp, const struct mbuf_chain *mc,
+			 size_t headroom)
+{
+	struct mbuf *mb;
+	size_t i;
+	int err = 0;
+
+	if (!mbp || !mc)
+		return EINVAL;
+
+	mb = mbuf_alloc(headroom + mc->len);
+	if (!mb)
+		return ENOMEM;
+
+	mb->pos = mb->end = headroom;
+
+	for (i=0; i<mc->segc && !err; i++) {
+
+		const struct mbuf_seg *seg = &mc->segv[i];
+
+		err = mbuf_write_mem(mb, seg->buf + seg->pos, seg->len);
+	}
+
+	if (err) {
+		mem_deref(mb);
+		return err;
+	}
+
+	mb->pos = headroom;
+	*mbp = mb;
+
+	return 0;
+}
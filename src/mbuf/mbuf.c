@@ -18,6 +18,22 @@
 enum {DEFAULT_SIZE=512};
 
 
+/* Two decimal digits for each of 0-99 */
+static const char digits_tab[] =
+	"0001020304050607080910111213141516171819"
+	"2021222324252627282930313233343536373839"
+	"4041424344454647484950515253545556575859"
+	"6061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+
+/** Defines a read-only view of a part of a memory buffer */
+struct mbuf_view {
+	struct mbuf mb;         /**< View, must be first */
+	struct mbuf *parent;    /**< Referenced parent   */
+};
+
+
 static void mbuf_destructor(void *data)
 {
 	struct mbuf *mb = data;
@@ -26,6 +42,14 @@ static void mbuf_destructor(void *data)
 }
 
 
+static void view_destructor(void *data)
+{
+	struct mbuf_view *v = data;
+
+	mem_deref(v->parent);
+}
+
+
 /**
  * Allocate a new memory buffer
  *
@@ -75,6 +99,40 @@ struct mbuf *mbuf_alloc_ref(struct mbuf *mbr)
 }
 
 
+/**
+ * Allocate a read-only view of the bytes [off, off+len) of a memory
+ * buffer, without copying them. The view starts at position 0, and holds
+ * a reference to the parent. The view must not be written to, resized
+ * or passed to mbuf_alloc_ref(), and the parent must not be resized
+ * while it has views. A view of a view is allowed.
+ *
+ * @param mb  Parent memory buffer
+ * @param off Offset of the view in the parent
+ * @param len Length of the view
+ *
+ * @return New memory buffer view, NULL if no memory or out of range
+ */
+struct mbuf *mbuf_slice(struct mbuf *mb, size_t off, size_t len)
+{
+	struct mbuf_view *v;
+
+	if (!mb || off > mb->end || len > mb->end - off)
+		return NULL;
+
+	v = mem_zalloc(sizeof(*v), view_destructor);
+	if (!v)
+		return NULL;
+
+	v->parent  = mem_ref(mb);
+	v->mb.buf  = mb->buf + off;
+	v->mb.size = len;
+	v->mb.pos  = 0;
+	v->mb.end  = len;
+
+	return &v->mb;
+}
+
+
 /**
  * Initialize a memory buffer
  *
@@ -232,6 +290,43 @@ int mbuf_write_mem(struct mbuf *mb, const uint8_t *buf, size_t size)
 }
 
 
+/**
+ * Reserve a number of bytes at the current position of a memory buffer,
+ * to be written with the mbuf_store_*() functions without any further
+ * capacity checks. The position is advanced past the reserved bytes.
+ *
+ * @param mb   Memory buffer
+ * @param size Number of bytes to reserve
+ *
+ * @return Write cursor at the reserved bytes, NULL if no memory
+ */
+uint8_t *mbuf_reserve(struct mbuf *mb, size_t size)
+{
+	size_t rsize;
+	uint8_t *p;
+
+	if (!mb)
+		return NULL;
+
+	rsize = mb->pos + size;
+
+	if (rsize > mb->size) {
+		const size_t dsize = mb->size ? (mb->size * 2)
+			: DEFAULT_SIZE;
+
+		if (mbuf_resize(mb, MAX(rsize, dsize)))
+			return NULL;
+	}
+
+	p = mb->buf + mb->pos;
+
+	mb->pos += size;
+	mb->end  = MAX(mb->end, mb->pos);
+
+	return p;
+}
+
+
 /**
  * Write an 8-bit value to a memory buffer
  *
@@ -288,6 +383,38 @@ int mbuf_write_u64(struct mbuf *mb, uint64_t v)
 }
 
 
+/**
+ * Write a value as decimal digits to a memory buffer, like "%llu"
+ *
+ * @param mb Memory buffer
+ * @param v  Value to write
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int mbuf_write_dec(struct mbuf *mb, uint64_t v)
+{
+	char buf[20], *p = buf + sizeof(buf);
+
+	while (v >= 100) {
+		const size_t i = (size_t)(v % 100) * 2;
+
+		v /= 100;
+		p -= 2;
+		memcpy(p, &digits_tab[i], 2);
+	}
+
+	if (v >= 10) {
+		p -= 2;
+		memcpy(p, &digits_tab[v * 2], 2);
+	}
+	else {
+		*--p = '0' + (char)v;
+	}
+
+	return mbuf_write_mem(mb, (uint8_t *)p, buf + sizeof(buf) - p);
+}
+
+
 /**
  * Write a null-terminated string to a memory buffer
  *
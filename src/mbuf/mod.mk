@@ -4,4 +4,5 @@
 # Copyright (C) 2010 Creytiv.com
 #
 
+SRCS	+= mbuf/chain.c
 SRCS	+= mbuf/mbuf.c
@@ -8,4 +8,5 @@ ifeq ($(USE_OPENSSL),)
 SRCS	+= md5/md5.c
 endif
 
+SRCS	+= md5/multi.c
 SRCS	+= md5/wrap.c
@@ -0,0 +1,402 @@
+/**
+ * @file md5/multi.c  Multi-buffer MD5
+ *
+ * Independent messages are hashed in parallel, one message per 32-bit
+ * SIMD lane. Each lane takes the next pending message as soon as its
+ * current message is finished, so messages of different lengths can
+ * be mixed.
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re_types.h>
+#include <re_md5.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define MD5_SSE2 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define MD5_NEON 1
+#endif
+
+
+enum {
+	LANES = 4,
+	BLOCK = 64,
+};
+
+
+#if defined(MD5_SSE2)
+
+typedef __m128i vec;
+
+#define vset1(x)     _mm_set1_epi32((int)(x))
+#define vload(p)     _mm_loadu_si128((const __m128i *)(const void *)(p))
+#define vstore(p, v) _mm_storeu_si128((__m128i *)(void *)(p), (v))
+#define vadd(a, b)   _mm_add_epi32((a), (b))
+#define vand(a, b)   _mm_and_si128((a), (b))
+#define vor(a, b)    _mm_or_si128((a), (b))
+#define vxor(a, b)   _mm_xor_si128((a), (b))
+#define vrol(x, s)   _mm_or_si128(_mm_slli_epi32((x), (s)), \
+				  _mm_srli_epi32((x), 32 - (s)))
+
+#elif defined(MD5_NEON)
+
+typedef uint32x4_t vec;
+
+#define vset1(x)     vdupq_n_u32(x)
+#define vload(p)     vld1q_u32(p)
+#define vstore(p, v) vst1q_u32((p), (v))
+#define vadd(a, b)   vaddq_u32((a), (b))
+#define vand(a, b)   vandq_u32((a), (b))
+#define vor(a, b)    vorrq_u32((a), (b))
+#define vxor(a, b)   veorq_u32((a), (b))
+#define vrol(x, s)   vsliq_n_u32(vshrq_n_u32((x), 32 - (s)), (x), (s))
+
+#else
+
+typedef struct {
+	uint32_t v[LANES];
+} vec;
+
+
+static inline vec vset1(uint32_t x)
+{
+	vec r;
+	int i;
+
+	for (i=0; i<LANES; i++)
+		r.v[i] = x;
+
+	return r;
+}
+
+
+static inline vec vload(const uint32_t *p)
+{
+	vec r;
+
+	memcpy(r.v, p, sizeof(r.v));
+
+	return r;
+}
+
+
+static inline void vstore(uint32_t *p, vec a)
+{
+	memcpy(p, a.v, sizeof(a.v));
+}
+
+
+#define VOP(name, expr)						\
+	static inline vec name(vec a, vec b)			\
+	{							\
+		vec r;						\
+		int i;						\
+								\
+		for (i=0; i<LANES; i++)				\
+			r.v[i] = (expr);			\
+								\
+		return r;					\
+	}
+
+VOP(vadd, a.v[i] + b.v[i])
+VOP(vand, a.v[i] & b.v[i])
+VOP(vor,  a.v[i] | b.v[i])
+VOP(vxor, a.v[i] ^ b.v[i])
+
+
+static inline vec vrol(vec a, int s)
+{
+	vec r;
+	int i;
+
+	for (i=0; i<LANES; i++)
+		r.v[i] = a.v[i] << s | a.v[i] >> (32 - s);
+
+	return r;
+}
+
+#endif
+
+
+#define F(b, c, d) vxor(d, vand(b, vxor(c, d)))
+#define G(b, c, d) vxor(c, vand(d, vxor(b, c)))
+#define H(b, c, d) vxor(vxor(b, c), d)
+#define I(b, c, d) vxor(c, vor(b, vxor(d, ones)))
+
+#define STEP(f, a, b, c, d, k, t, s)					\
+	a = vadd(b, vrol(vadd(vadd(a, f(b, c, d)),			\
+			      vadd(w[k], vset1(t))), s))
+
+
+struct lane {
+	struct md5_buf *buf;
+	size_t off;
+	size_t blocks;
+	uint8_t pad[BLOCK];
+};
+
+
+static void load_words(vec w[16], const uint8_t *const blk[LANES])
+{
+#if defined(MD5_SSE2)
+	int j;
+
+	for (j=0; j<16; j+=4) {
+
+		const vec r0 = vload(blk[0] + 4*j);
+		const vec r1 = vload(blk[1] + 4*j);
+		const vec r2 = vload(blk[2] + 4*j);
+		const vec r3 = vload(blk[3] + 4*j);
+		const vec t0 = _mm_unpacklo_epi32(r0, r1);
+		const vec t1 = _mm_unpacklo_epi32(r2, r3);
+		const vec t2 = _mm_unpackhi_epi32(r0, r1);
+		const vec t3 = _mm_unpackhi_epi32(r2, r3);
+
+		w[j]   = _mm_unpacklo_epi64(t0, t1);
+		w[j+1] = _mm_unpackhi_epi64(t0, t1);
+		w[j+2] = _mm_unpacklo_epi64(t2, t3);
+		w[j+3] = _mm_unpackhi_epi64(t2, t3);
+	}
+#else
+	uint32_t t[LANES];
+	int i, j;
+
+	for (j=0; j<16; j++) {
+
+		for (i=0; i<LANES; i++) {
+
+			const uint8_t *p = blk[i] + 4*j;
+
+			t[i] = (uint32_t)p[0]       | (uint32_t)p[1] << 8 |
+			       (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+		}
+
+		w[j] = vload(t);
+	}
+#endif
+}
+
+
+static void transform(uint32_t st[4][LANES], const uint8_t *const blk[LANES])
+{
+	const vec ones = vset1(0xffffffff);
+	vec a, b, c, d, aa, bb, cc, dd;
+	vec w[16];
+
+	load_words(w, blk);
+
+	a = aa = vload(st[0]);
+	b = bb = vload(st[1]);
+	c = cc = vload(st[2]);
+	d = dd = vload(st[3]);
+
+	STEP(F, a, b, c, d,  0, 0xd76aa478,  7);
+	STEP(F, d, a, b, c,  1, 0xe8c7b756, 12);
+	STEP(F, c, d, a, b,  2, 0x242070db, 17);
+	STEP(F, b, c, d, a,  3, 0xc1bdceee, 22);
+	STEP(F, a, b, c, d,  4, 0xf57c0faf,  7);
+	STEP(F, d, a, b, c,  5, 0x4787c62a, 12);
+	STEP(F, c, d, a, b,  6, 0xa8304613, 17);
+	STEP(F, b, c, d, a,  7, 0xfd469501, 22);
+	STEP(F, a, b, c, d,  8, 0x698098d8,  7);
+	STEP(F, d, a, b, c,  9, 0x8b44f7af, 12);
+	STEP(F, c, d, a, b, 10, 0xffff5bb1, 17);
+	STEP(F, b, c, d, a, 11, 0x895cd7be, 22);
+	STEP(F, a, b, c, d, 12, 0x6b901122,  7);
+	STEP(F, d, a, b, c, 13, 0xfd987193, 12);
+	STEP(F, c, d, a, b, 14, 0xa679438e, 17);
+	STEP(F, b, c, d, a, 15, 0x49b40821, 22);
+
+	STEP(G, a, b, c, d,  1, 0xf61e2562,  5);
+	STEP(G, d, a, b, c,  6, 0xc040b340,  9);
+	STEP(G, c, d, a, b, 11, 0x265e5a51, 14);
+	STEP(G, b, c, d, a,  0, 0xe9b6c7aa, 20);
+	STEP(G, a, b, c, d,  5, 0xd62f105d,  5);
+	STEP(G, d, a, b, c, 10, 0x02441453,  9);
+	STEP(G, c, d, a, b, 15, 0xd8a1e681, 14);
+	STEP(G, b, c, d, a,  4, 0xe7d3fbc8, 20);
+	STEP(G, a, b, c, d,  9, 0x21e1cde6,  5);
+	STEP(G, d, a, b, c, 14, 0xc33707d6,  9);
+	STEP(G, c, d, a, b,  3, 0xf4d50d87, 14);
+	STEP(G, b, c, d, a,  8, 0x455a14ed, 20);
+	STEP(G, a, b, c, d, 13, 0xa9e3e905,  5);
+	STEP(G, d, a, b, c,  2, 0xfcefa3f8,  9);
+	STEP(G, c, d, a, b,  7, 0x676f02d9, 14);
+	STEP(G, b, c, d, a, 12, 0x8d2a4c8a, 20);
+
+	STEP(H, a, b, c, d,  5, 0xfffa3942,  4);
+	STEP(H, d, a, b, c,  8, 0x8771f681, 11);
+	STEP(H, c, d, a, b, 11, 0x6d9d6122, 16);
+	STEP(H, b, c, d, a, 14, 0xfde5380c, 23);
+	STEP(H, a, b, c, d,  1, 0xa4beea44,  4);
+	STEP(H, d, a, b, c,  4, 0x4bdecfa9, 11);
+	STEP(H, c, d, a, b,  7, 0xf6bb4b60, 16);
+	STEP(H, b, c, d, a, 10, 0xbebfbc70, 23);
+	STEP(H, a, b, c, d, 13, 0x289b7ec6,  4);
+	STEP(H, d, a, b, c,  0, 0xeaa127fa, 11);
+	STEP(H, c, d, a, b,  3, 0xd4ef3085, 16);
+	STEP(H, b, c, d, a,  6, 0x04881d05, 23);
+	STEP(H, a, b, c, d,  9, 0xd9d4d039,  4);
+	STEP(H, d, a, b, c, 12, 0xe6db99e5, 11);
+	STEP(H, c, d, a, b, 15, 0x1fa27cf8, 16);
+	STEP(H, b, c, d, a,  2, 0xc4ac5665, 23);
+
+	STEP(I, a, b, c, d,  0, 0xf4292244,  6);
+	STEP(I, d, a, b, c,  7, 0x432aff97, 10);
+	STEP(I, c, d, a, b, 14, 0xab9423a7, 15);
+	STEP(I, b, c, d, a,  5, 0xfc93a039, 21);
+	STEP(I, a, b, c, d, 12, 0x655b59c3,  6);
+	STEP(I, d, a, b, c,  3, 0x8f0ccc92, 10);
+	STEP(I, c, d, a, b, 10, 0xffeff47d, 15);
+	STEP(I, b, c, d, a,  1, 0x85845dd1, 21);
+	STEP(I, a, b, c, d,  8, 0x6fa87e4f,  6);
+	STEP(I, d, a, b, c, 15, 0xfe2ce6e0, 10);
+	STEP(I, c, d, a, b,  6, 0xa3014314, 15);
+	STEP(I, b, c, d, a, 13, 0x4e0811a1, 21);
+	STEP(I, a, b, c, d,  4, 0xf7537e82,  6);
+	STEP(I, d, a, b, c, 11, 0xbd3af235, 10);
+	STEP(I, c, d, a, b,  2, 0x2ad7d2bb, 15);
+	STEP(I, b, c, d, a,  9, 0xeb86d391, 21);
+
+	vstore(st[0], vadd(a, aa));
+	vstore(st[1], vadd(b, bb));
+	vstore(st[2], vadd(c, cc));
+	vstore(st[3], vadd(d, dd));
+}
+
+
+static void lane_start(uint32_t st[4][LANES], int i, struct lane *ln,
+		       struct md5_buf *buf)
+{
+	st[0][i] = 0x67452301;
+	st[1][i] = 0xefcdab89;
+	st[2][i] = 0x98badcfe;
+	st[3][i] = 0x10325476;
+
+	ln->buf    = buf;
+	ln->off    = 0;
+	ln->blocks = buf ? (buf->n + 8) / BLOCK + 1 : 0;
+}
+
+
+/* The next block of a lane, with the MD5 padding added at the end */
+static const uint8_t *lane_block(struct lane *ln)
+{
+	const struct md5_buf *buf = ln->buf;
+	uint64_t bits;
+
+	if (!buf)
+		return ln->pad;
+
+	if (ln->off <= buf->n && buf->n - ln->off >= BLOCK)
+		return buf->d + ln->off;
+
+	memset(ln->pad, 0, sizeof(ln->pad));
+
+	if (ln->off <= buf->n) {
+
+		const size_t rem = buf->n - ln->off;
+
+		if (rem)
+			memcpy(ln->pad, buf->d + ln->off, rem);
+
+		ln->pad[rem] = 0x80;
+	}
+
+	if (ln->blocks == 1) {
+
+		bits = (uint64_t)buf->n << 3;
+
+		ln->pad[56] = (uint8_t)bits;
+		ln->pad[57] = (uint8_t)(bits >> 8);
+		ln->pad[58] = (uint8_t)(bits >> 16);
+		ln->pad[59] = (uint8_t)(bits >> 24);
+		ln->pad[60] = (uint8_t)(bits >> 32);
+		ln->pad[61] = (uint8_t)(bits >> 40);
+		ln->pad[62] = (uint8_t)(bits >> 48);
+		ln->pad[63] = (uint8_t)(bits >> 56);
+	}
+
+	return ln->pad;
+}
+
+
+static void lane_finish(uint32_t st[4][LANES], int i,
+			const struct lane *ln)
+{
+	uint8_t *md = ln->buf->md;
+	int j;
+
+	for (j=0; j<4; j++) {
+		md[4*j]   = (uint8_t)st[j][i];
+		md[4*j+1] = (uint8_t)(st[j][i] >> 8);
+		md[4*j+2] = (uint8_t)(st[j][i] >> 16);
+		md[4*j+3] = (uint8_t)(st[j][i] >> 24);
+	}
+}
+
+
+/**
+ * Calculate the MD5 hashes of several independent buffers. The buffers
+ * are hashed in parallel, which is faster than calling md5() once for
+ * each of them.
+ *
+ * @param bufv Array of buffers, each with data (input) and hash (output)
+ * @param bufc Number of buffers
+ */
+void md5_multi(struct md5_buf *bufv, size_t bufc)
+{
+	uint32_t st[4][LANES];
+	struct lane lanev[LANES];
+	const uint8_t *blk[LANES];
+	size_t next = 0;
+	int i, active = 0;
+
+	if (!bufv)
+		return;
+
+	for (i=0; i<LANES; i++) {
+
+		struct md5_buf *buf = next < bufc ? &bufv[next++] : NULL;
+
+		lane_start(st, i, &lanev[i], buf);
+
+		if (buf)
+			++active;
+		else
+			memset(lanev[i].pad, 0, sizeof(lanev[i].pad));
+	}
+
+	while (active) {
+
+		for (i=0; i<LANES; i++)
+			blk[i] = lane_block(&lanev[i]);
+
+		transform(st, blk);
+
+		for (i=0; i<LANES; i++) {
+
+			struct lane *ln = &lanev[i];
+
+			if (!ln->buf)
+				continue;
+
+			ln->off += BLOCK;
+
+			if (--ln->blocks)
+				continue;
+
+			lane_finish(st, i, ln);
+
+			if (next < bufc) {
+				lane_start(st, i, ln, &bufv[next++]);
+			}
+			else {
+				ln->buf = NULL;
+				--active;
+			}
+		}
+	}
+}
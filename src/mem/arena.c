@@ -0,0 +1,202 @@
+/**
+ * @file arena.c  Huge-page backed arena for slabs
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#define _BSD_SOURCE 1
+#define _DEFAULT_SOURCE 1
+#include <string.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+#include <re_types.h>
+#include <re_list.h>
+#include <re_fmt.h>
+#include <re_mem.h>
+#include "mem.h"
+
+
+/*
+ * The arena is one mapping of 2 MB huge pages, from which the slab
+ * allocator carves its slabs before it falls back to malloc(). Packet
+ * buffers of the same size class are then packed into a few huge pages,
+ * which take one TLB entry each instead of 512. Explicit huge pages
+ * (MAP_HUGETLB) are used if the system has them reserved, and otherwise
+ * transparent huge pages are asked for with madvise(). The pages are
+ * faulted in when the arena is enabled, not on the packet path.
+ *
+ * Like the slabs, the arena is never returned to the system.
+ */
+
+
+enum {
+	ARENA_HUGE  = 2 * 1024 * 1024,
+	ARENA_PAGE  = 4096,
+	ARENA_ALIGN = 64,    /**< Slabs start on a cache line */
+};
+
+
+static struct {
+	uint8_t *base;
+	size_t size;
+	size_t used;
+	bool huge;          /**< Explicit huge pages, not THP */
+} arena;
+
+
+#if defined (HAVE_MMAP) && defined (MAP_ANONYMOUS)
+static void *arena_map(size_t size, bool *huge)
+{
+	const int prot  = PROT_READ | PROT_WRITE;
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+	void *p;
+
+#ifdef MAP_POPULATE
+	flags |= MAP_POPULATE;
+#endif
+
+#ifdef MAP_HUGETLB
+	p = mmap(NULL, size, prot, flags | MAP_HUGETLB, -1, 0);
+	if (p != MAP_FAILED) {
+		*huge = true;
+		return p;
+	}
+#endif
+
+	*huge = false;
+
+	p = mmap(NULL, size, prot, flags, -1, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+
+#ifdef MADV_HUGEPAGE
+	(void)madvise(p, size, MADV_HUGEPAGE);
+#endif
+
+	return p;
+}
+#endif
+
+
+/**
+ * Enable the huge-page arena of the slab allocator, which is used for
+ * the slabs of memory objects up to 16 KB, such as the buffers of
+ * packet-sized mbufs. It should be enabled at start-up, together with
+ * mem_pool_enable(). Slabs come from malloc() when the arena is full.
+ *
+ * @param size Size of the arena in bytes, rounded up to 2 MB
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int mem_arena_enable(size_t size)
+{
+#if defined (HAVE_MMAP) && defined (MAP_ANONYMOUS)
+	size_t off;
+	bool huge;
+	void *p;
+
+	if (!size)
+		return EINVAL;
+
+	if (arena.base)
+		return EALREADY;
+
+	size = (size + ARENA_HUGE - 1) / ARENA_HUGE * ARENA_HUGE;
+
+	p = arena_map(size, &huge);
+	if (!p)
+		return ENOMEM;
+
+	/* Fault in the pages now, if MAP_POPULATE did not */
+	for (off = 0; off < size; off += ARENA_PAGE)
+		((volatile uint8_t *)p)[off] = 0;
+
+	arena.base = p;
+	arena.size = size;
+	arena.huge = huge;
+
+	return 0;
+#else
+	(void)size;
+	return ENOSYS;
+#endif
+}
+
+
+/**
+ * Take memory for a slab from the arena. Called with the slab lock held.
+ *
+ * @param size Size of the slab
+ *
+ * @return Pointer to the slab, or NULL if the arena is disabled or full
+ */
+void *mem_arena_get(size_t size)
+{
+	void *p;
+
+	if (!arena.base)
+		return NULL;
+
+	size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+	if (size > arena.size - arena.used)
+		return NULL;
+
+	p = arena.base + arena.used;
+	arena.used += size;
+
+	return p;
+}
+
+
+/**
+ * Get the arena statistics
+ *
+ * @param mstat Memory statistics
+ */
+void mem_arena_stat(struct memstat *mstat)
+{
+	mstat->arena.size = arena.size;
+	mstat->arena.used = arena.used;
+	mstat->arena.huge = arena.huge;
+}
+
+
+/**
+ * Print the occupancy of the huge-page arena, and of the slabs of each
+ * size class
+ *
+ * @param pf     Print handler
+ * @param unused Unused parameter
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int mem_arena_debug(struct re_printf *pf, void *unused)
+{
+	struct memstat stat;
+	int i, err;
+	(void)unused;
+
+	(void)mem_get_stat(&stat);
+
+	if (!stat.arena.size)
+		return re_hprintf(pf, "Arena: disabled\n");
+
+	err = re_hprintf(pf, "Arena: %zu of %zu KB used (%u%%), %s pages\n",
+			 stat.arena.used / 1024, stat.arena.size / 1024,
+			 (unsigned)(stat.arena.used * 100 / stat.arena.size),
+			 stat.arena.huge ? "huge" : "transparent huge");
+
+	for (i=0; i<MEM_SLAB_CLASSES && !err; i++) {
+
+		if (!stat.slab[i].slabs)
+			continue;
+
+		err = re_hprintf(pf, " %5zu bytes: %zu slabs, %zu blocks,"
+				 " %zu free\n",
+				 stat.slab[i].size, stat.slab[i].slabs,
+				 stat.slab[i].blocks, stat.slab[i].cached);
+	}
+
+	return err;
+}
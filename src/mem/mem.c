@@ -14,6 +14,8 @@
 #include <re_fmt.h>
 #include <re_mbuf.h>
 #include <re_mem.h>
+#include <re_probe.h>
+#include "mem.h"
 
 
 #define DEBUG_MODULE "mem"
@@ -29,17 +31,44 @@
 /** Defines a reference-counting memory object */
 struct mem {
 	uint32_t nrefs;     /**< Number of references  */
+	uint16_t cls;       /**< Slab class, 0 for heap */
+	uint16_t flags;     /**< Object flags          */
 	mem_destroy_h *dh;  /**< Destroy handler       */
 #if MEM_DEBUG
 	struct le le;       /**< Linked list element   */
 	uint32_t magic;     /**< Magic number          */
+	uint32_t site;      /**< Allocation site       */
 	size_t size;        /**< Size of memory object */
 #endif
 };
 
+/** Memory object flags */
+enum {
+	MEM_SHARED = 1 << 0,  /**< Reference count is atomic */
+	MEM_TAGGED = 1 << 1,  /**< Has an accounting prefix  */
+};
+
+/** Accounting prefix of a memory object, in front of the header */
+struct mem_tag {
+	struct mem_acct *acct;  /**< Accounting tag         */
+	size_t size;            /**< Size of memory object  */
+};
+
+/** Allocation site of the caller */
+#if defined (__GNUC__)
+#define MEM_SITE() __builtin_return_address(0)
+#else
+#define MEM_SITE() NULL
+#endif
+
+/** Size of the pool object prefix, keeping the header aligned */
+#define POBJ_SIZE ((sizeof(struct mem_pobj) + 15) & ~(size_t)15)
+
+/** Size of the accounting prefix, keeping the header aligned */
+#define TAG_SIZE ((sizeof(struct mem_tag) + 15) & ~(size_t)15)
+
 #if MEM_DEBUG
 /* Memory debugging */
-static struct list meml = LIST_INIT;
 static const uint32_t mem_magic = 0xe7fb9ac4;
 static ssize_t threshold = -1;  /**< Memory threshold, disabled by default */
 
@@ -47,57 +76,242 @@ static struct memstat memstat = {
 	0,0,0,0,~0,0
 };
 
+/** Number of memory list shards, must be a power of two */
+#define MEM_SHARDS 16
+
+/**
+ * The list of allocated memory objects is split in shards, selected by
+ * the object address, so that threads rarely contend for the same lock.
+ */
+struct mshard {
+	struct list meml;         /**< Allocated memory objects */
 #ifdef HAVE_PTHREAD
+	pthread_mutex_t mutex;    /**< Protects the list        */
+#endif
+};
 
-static pthread_mutex_t mem_mutex = PTHREAD_MUTEX_INITIALIZER;
+#ifdef HAVE_PTHREAD
+#define MSHARD_INIT {LIST_INIT, PTHREAD_MUTEX_INITIALIZER}
+#else
+#define MSHARD_INIT {LIST_INIT}
+#endif
+
+static struct mshard shardv[MEM_SHARDS] = {
+	MSHARD_INIT, MSHARD_INIT, MSHARD_INIT, MSHARD_INIT,
+	MSHARD_INIT, MSHARD_INIT, MSHARD_INIT, MSHARD_INIT,
+	MSHARD_INIT, MSHARD_INIT, MSHARD_INIT, MSHARD_INIT,
+	MSHARD_INIT, MSHARD_INIT, MSHARD_INIT, MSHARD_INIT,
+};
+
+
+static inline struct mshard *mshard(const struct mem *m)
+{
+	const uintptr_t a = (uintptr_t)m;
+
+	return &shardv[((a >> 4) ^ (a >> 12)) & (MEM_SHARDS - 1)];
+}
+
+
+#ifdef HAVE_PTHREAD
 
-static inline void mem_lock(void)
+static inline void shard_lock(struct mshard *sh)
 {
-	pthread_mutex_lock(&mem_mutex);
+	pthread_mutex_lock(&sh->mutex);
 }
 
 
-static inline void mem_unlock(void)
+static inline void shard_unlock(struct mshard *sh)
 {
-	pthread_mutex_unlock(&mem_mutex);
+	pthread_mutex_unlock(&sh->mutex);
 }
 
 #else
 
-#define mem_lock()    /**< Stub */
-#define mem_unlock()  /**< Stub */
+#define shard_lock(sh)    (void)(sh)  /**< Stub */
+#define shard_unlock(sh)  (void)(sh)  /**< Stub */
 
 #endif
 
+
+static void meml_append(struct mem *m)
+{
+	struct mshard *sh = mshard(m);
+
+	shard_lock(sh);
+	list_append(&sh->meml, &m->le, m);
+	shard_unlock(sh);
+}
+
+
+static void meml_unlink(struct mem *m)
+{
+	struct mshard *sh = mshard(m);
+
+	shard_lock(sh);
+	list_unlink(&m->le);
+	shard_unlock(sh);
+}
+
+
+static uint32_t meml_count(void)
+{
+	uint32_t i, n = 0;
+
+	for (i=0; i<MEM_SHARDS; i++) {
+		shard_lock(&shardv[i]);
+		n += list_count(&shardv[i].meml);
+		shard_unlock(&shardv[i]);
+	}
+
+	return n;
+}
+#endif
+
+
+/*
+ * The statistics counters are updated with atomic operations where the
+ * compiler supports them, otherwise with a global lock.
+ */
+#if defined (__ATOMIC_RELAXED)
+
+#define stat_lock()    /**< Stub */
+#define stat_unlock()  /**< Stub */
+
+static inline void stat_add(size_t *v, size_t n)
+{
+	__atomic_add_fetch(v, n, __ATOMIC_RELAXED);
+}
+
+
+static inline void stat_sub(size_t *v, size_t n)
+{
+	__atomic_sub_fetch(v, n, __ATOMIC_RELAXED);
+}
+
+
+static inline size_t stat_get(const size_t *v)
+{
+	return __atomic_load_n(v, __ATOMIC_RELAXED);
+}
+
+
+static inline void stat_max(size_t *v, size_t n)
+{
+	size_t cur = __atomic_load_n(v, __ATOMIC_RELAXED);
+
+	while (n > cur && !__atomic_compare_exchange_n(v, &cur, n, true,
+						       __ATOMIC_RELAXED,
+						       __ATOMIC_RELAXED))
+		;
+}
+
+
+static inline void stat_min(size_t *v, size_t n)
+{
+	size_t cur = __atomic_load_n(v, __ATOMIC_RELAXED);
+
+	while (n < cur && !__atomic_compare_exchange_n(v, &cur, n, true,
+						       __ATOMIC_RELAXED,
+						       __ATOMIC_RELAXED))
+		;
+}
+
+
+#if MEM_DEBUG
+static inline ssize_t threshold_get(void)
+{
+	return __atomic_load_n(&threshold, __ATOMIC_RELAXED);
+}
+
+
+static inline void threshold_put(ssize_t n)
+{
+	__atomic_store_n(&threshold, n, __ATOMIC_RELAXED);
+}
+#endif
+
+#else
+
+#ifdef HAVE_PTHREAD
+
+static pthread_mutex_t stat_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static inline void stat_lock(void)
+{
+	pthread_mutex_lock(&stat_mutex);
+}
+
+
+static inline void stat_unlock(void)
+{
+	pthread_mutex_unlock(&stat_mutex);
+}
+
+#else
+
+#define stat_lock()    /**< Stub */
+#define stat_unlock()  /**< Stub */
+
+#endif
+
+#define stat_add(v, n)  (*(v) += (n))
+#define stat_sub(v, n)  (*(v) -= (n))
+#define stat_get(v)     (*(v))
+#define stat_max(v, n)  (*(v) = max(*(v), (n)))
+#define stat_min(v, n)  (*(v) = min(*(v), (n)))
+#define threshold_get() (threshold)
+#define threshold_put(n) (threshold = (n))
+
+#endif
+
+
+#if MEM_DEBUG
+/* Read a consistent-enough copy of the global counters */
+static void stat_read(struct memstat *st)
+{
+	stat_lock();
+	st->bytes_cur   = stat_get(&memstat.bytes_cur);
+	st->bytes_peak  = stat_get(&memstat.bytes_peak);
+	st->blocks_cur  = stat_get(&memstat.blocks_cur);
+	st->blocks_peak = stat_get(&memstat.blocks_peak);
+	st->size_min    = stat_get(&memstat.size_min);
+	st->size_max    = stat_get(&memstat.size_max);
+	stat_unlock();
+}
+
+
 /** Update statistics for mem_zalloc() */
-#define STAT_ALLOC(m, size) \
-	mem_lock(); \
-	memstat.bytes_cur += (size); \
-	memstat.bytes_peak = max(memstat.bytes_cur, memstat.bytes_peak); \
-	++memstat.blocks_cur; \
-	memstat.blocks_peak = max(memstat.blocks_cur, memstat.blocks_peak); \
-	memstat.size_min = min(memstat.size_min, size);	\
-	memstat.size_max = max(memstat.size_max, size);	\
-	mem_unlock(); \
+#define STAT_ALLOC(m, size, site) \
+	stat_lock(); \
+	stat_add(&memstat.bytes_cur, (size)); \
+	stat_max(&memstat.bytes_peak, stat_get(&memstat.bytes_cur)); \
+	stat_add(&memstat.blocks_cur, 1); \
+	stat_max(&memstat.blocks_peak, stat_get(&memstat.blocks_cur)); \
+	stat_min(&memstat.size_min, (size)); \
+	stat_max(&memstat.size_max, (size)); \
+	stat_unlock(); \
+	(m)->site = mem_prof_alloc((site), (size)); \
 	(m)->size = (size); \
 	(m)->magic = mem_magic;
 
 /** Update statistics for mem_realloc() */
 #define STAT_REALLOC(m, size) \
-	mem_lock(); \
-	memstat.bytes_cur += ((size) - (m)->size); \
-	memstat.bytes_peak = max(memstat.bytes_cur, memstat.bytes_peak); \
-	memstat.size_min = min(memstat.size_min, size);	\
-	memstat.size_max = max(memstat.size_max, size); \
-	mem_unlock(); \
+	stat_lock(); \
+	stat_add(&memstat.bytes_cur, ((size) - (m)->size)); \
+	stat_max(&memstat.bytes_peak, stat_get(&memstat.bytes_cur)); \
+	stat_min(&memstat.size_min, (size)); \
+	stat_max(&memstat.size_max, (size)); \
+	stat_unlock(); \
+	mem_prof_resize((m)->site, (m)->size, (size)); \
 	(m)->size = (size)
 
 /** Update statistics for mem_deref() */
 #define STAT_DEREF(m) \
-	mem_lock(); \
-	memstat.bytes_cur -= (m)->size; \
-	--memstat.blocks_cur; \
-	mem_unlock(); \
+	stat_lock(); \
+	stat_sub(&memstat.bytes_cur, (m)->size); \
+	stat_sub(&memstat.blocks_cur, 1); \
+	stat_unlock(); \
+	mem_prof_free((m)->site, (m)->size); \
 	memset((m), 0xb5, sizeof(struct mem) + (m)->size)
 
 /** Check magic number in memory object */
@@ -108,54 +322,311 @@ static inline void mem_unlock(void)
 		BREAKPOINT;					      \
 	}
 #else
-#define STAT_ALLOC(m, size)
+#define STAT_ALLOC(m, size, site)
 #define STAT_REALLOC(m, size)
 #define STAT_DEREF(m)
 #define MAGIC_CHECK(m)
 #endif
 
 
-/**
- * Allocate a new reference-counted memory object
- *
- * @param size Size of memory object
- * @param dh   Optional destructor, called when destroyed
- *
- * @return Pointer to allocated object
+/*
+ * The reference count of a shared object is changed with atomic
+ * operations, or under a global lock where they are not available.
+ * Other objects are only used by one thread at a time.
  */
-void *mem_alloc(size_t size, mem_destroy_h *dh)
+#if defined (__ATOMIC_RELAXED)
+
+static inline void nrefs_inc(struct mem *m)
+{
+	if (m->flags & MEM_SHARED)
+		(void)__atomic_add_fetch(&m->nrefs, 1, __ATOMIC_RELAXED);
+	else
+		++m->nrefs;
+}
+
+
+static inline uint32_t nrefs_dec(struct mem *m)
+{
+	if (m->flags & MEM_SHARED)
+		return __atomic_sub_fetch(&m->nrefs, 1, __ATOMIC_ACQ_REL);
+
+	return --m->nrefs;
+}
+
+
+static inline uint32_t nrefs_get(const struct mem *m)
+{
+	if (m->flags & MEM_SHARED)
+		return __atomic_load_n(&m->nrefs, __ATOMIC_ACQUIRE);
+
+	return m->nrefs;
+}
+
+#elif defined (HAVE_PTHREAD)
+
+static pthread_mutex_t ref_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+static inline void nrefs_inc(struct mem *m)
+{
+	if (!(m->flags & MEM_SHARED)) {
+		++m->nrefs;
+		return;
+	}
+
+	pthread_mutex_lock(&ref_mutex);
+	++m->nrefs;
+	pthread_mutex_unlock(&ref_mutex);
+}
+
+
+static inline uint32_t nrefs_dec(struct mem *m)
+{
+	uint32_t n;
+
+	if (!(m->flags & MEM_SHARED))
+		return --m->nrefs;
+
+	pthread_mutex_lock(&ref_mutex);
+	n = --m->nrefs;
+	pthread_mutex_unlock(&ref_mutex);
+
+	return n;
+}
+
+
+static inline uint32_t nrefs_get(const struct mem *m)
+{
+	uint32_t n;
+
+	if (!(m->flags & MEM_SHARED))
+		return m->nrefs;
+
+	pthread_mutex_lock(&ref_mutex);
+	n = m->nrefs;
+	pthread_mutex_unlock(&ref_mutex);
+
+	return n;
+}
+
+#else
+
+#define nrefs_inc(m)  (++(m)->nrefs)
+#define nrefs_dec(m)  (--(m)->nrefs)
+#define nrefs_get(m)  ((m)->nrefs)
+
+#endif
+
+/** Defines a memory accounting tag */
+struct mem_acct {
+	size_t bytes_cur;    /**< Current bytes allocated  */
+	size_t bytes_peak;   /**< Peak bytes allocated     */
+	size_t blocks_cur;   /**< Current blocks allocated */
+	size_t blocks_peak;  /**< Peak blocks allocated    */
+	char *name;          /**< Name of the tag          */
+};
+
+
+/*
+ * While the calling thread has an accounting tag, its objects are
+ * allocated from the heap with a prefix that holds the tag and the object
+ * size, also in release builds. The tag is charged for every such object
+ * and is referenced until the object is freed, so the objects of a call
+ * may outlive the call itself. Objects of memory pools are not charged,
+ * and other objects have no prefix.
+ */
+
+static bool acct_used;  /**< An accounting tag has been set */
+
+#ifdef HAVE_PTHREAD
+
+static pthread_once_t acct_once = PTHREAD_ONCE_INIT;
+static pthread_key_t  acct_key;
+static bool           acct_key_ok;
+
+
+static void acct_init(void)
 {
+	acct_key_ok = (0 == pthread_key_create(&acct_key, NULL));
+}
+
+#else
+
+static struct mem_acct *acct_cur;
+
+#endif
+
+
+static struct mem_acct *acct_get(void)
+{
+	if (!acct_used)
+		return NULL;
+
+#ifdef HAVE_PTHREAD
+	return acct_key_ok ? pthread_getspecific(acct_key) : NULL;
+#else
+	return acct_cur;
+#endif
+}
+
+
+static void acct_charge(struct mem_acct *acct, size_t size)
+{
+	stat_lock();
+	stat_add(&acct->bytes_cur, size);
+	stat_max(&acct->bytes_peak, stat_get(&acct->bytes_cur));
+	stat_add(&acct->blocks_cur, 1);
+	stat_max(&acct->blocks_peak, stat_get(&acct->blocks_cur));
+	stat_unlock();
+}
+
+
+static void acct_resize(struct mem_acct *acct, size_t oldsize,
+			size_t newsize)
+{
+	stat_lock();
+	stat_add(&acct->bytes_cur, newsize - oldsize);
+	stat_max(&acct->bytes_peak, stat_get(&acct->bytes_cur));
+	stat_unlock();
+}
+
+
+static void acct_release(struct mem_acct *acct, size_t size)
+{
+	stat_lock();
+	stat_sub(&acct->bytes_cur, size);
+	stat_sub(&acct->blocks_cur, 1);
+	stat_unlock();
+}
+
+
+static inline struct mem_tag *mem_tag(struct mem *m)
+{
+	return (struct mem_tag *)(void *)((uint8_t *)m - TAG_SIZE);
+}
+
+
+/* Allocate an object with an accounting prefix, and charge the tag */
+static struct mem *alloc_tagged(struct mem_acct *acct, size_t size)
+{
+	struct mem_tag *t;
+
+	t = malloc(TAG_SIZE + sizeof(struct mem) + size);
+	if (!t)
+		return NULL;
+
+	t->acct = mem_ref(acct);
+	t->size = size;
+
+	acct_charge(acct, size);
+
+	return (struct mem *)(void *)((uint8_t *)t + TAG_SIZE);
+}
+
+
+static struct mem *realloc_tagged(struct mem *m, size_t size)
+{
+	struct mem_tag *t;
+
+	t = realloc(mem_tag(m), TAG_SIZE + sizeof(*m) + size);
+	if (!t)
+		return NULL;
+
+	acct_resize(t->acct, t->size, size);
+	t->size = size;
+
+	return (struct mem *)(void *)((uint8_t *)t + TAG_SIZE);
+}
+
+
+static struct mem *alloc_block(size_t size, uint16_t *clsp)
+{
+	uint8_t *p;
+
+	if (*clsp == MEM_CLS_POOL) {
+		p = malloc(POBJ_SIZE + sizeof(struct mem) + size);
+		return p ? (struct mem *)(void *)(p + POBJ_SIZE) : NULL;
+	}
+
+	p = mem_slab_alloc(sizeof(struct mem), size, clsp);
+	if (p)
+		return (struct mem *)(void *)p;
+
+	return malloc(sizeof(struct mem) + size);
+}
+
+
+static void free_block(struct mem *m, uint16_t cls)
+{
+	if (cls == MEM_CLS_POOL)
+		free((uint8_t *)m - POBJ_SIZE);
+	else if (cls)
+		mem_slab_free(m, cls);
+	else
+		free(m);
+}
+
+
+static void *alloc_obj(size_t size, mem_destroy_h *dh, uint16_t cls,
+		       const void *site)
+{
+	struct mem_acct *acct = NULL;
 	struct mem *m;
 
 #if MEM_DEBUG
-	mem_lock();
-	if (-1 != threshold && (memstat.blocks_cur >= (size_t)threshold)) {
-		mem_unlock();
+	if (-1 != threshold_get() &&
+	    stat_get(&memstat.blocks_cur) >= (size_t)threshold_get())
 		return NULL;
-	}
-	mem_unlock();
 #endif
 
-	m = malloc(sizeof(*m) + size);
+	if (cls != MEM_CLS_POOL)
+		acct = acct_get();
+
+	if (acct) {
+		cls = 0;
+		m = alloc_tagged(acct, size);
+	}
+	else {
+		m = alloc_block(size, &cls);
+	}
 	if (!m)
 		return NULL;
 
 #if MEM_DEBUG
 	memset(&m->le, 0, sizeof(struct le));
-	mem_lock();
-	list_append(&meml, &m->le, m);
-	mem_unlock();
+	meml_append(m);
 #endif
 
 	m->nrefs = 1;
+	m->cls   = cls;
+	m->flags = acct ? MEM_TAGGED : 0;
 	m->dh    = dh;
 
-	STAT_ALLOC(m, size);
+	STAT_ALLOC(m, size, site);
+#if !MEM_DEBUG
+	(void)site;
+#endif
+
+	RE_PROBE2(mem_alloc, size, m + 1);
 
 	return (void *)(m + 1);
 }
 
 
+/**
+ * Allocate a new reference-counted memory object
+ *
+ * @param size Size of memory object
+ * @param dh   Optional destructor, called when destroyed
+ *
+ * @return Pointer to allocated object
+ */
+void *mem_alloc(size_t size, mem_destroy_h *dh)
+{
+	return alloc_obj(size, dh, 0, MEM_SITE());
+}
+
+
 /**
  * Allocate a new reference-counted memory object. Memory is zeroed.
  *
@@ -168,7 +639,7 @@ void *mem_zalloc(size_t size, mem_destroy_h *dh)
 {
 	void *p;
 
-	p = mem_alloc(size, dh);
+	p = alloc_obj(size, dh, 0, MEM_SITE());
 	if (!p)
 		return NULL;
 
@@ -178,6 +649,89 @@ void *mem_zalloc(size_t size, mem_destroy_h *dh)
 }
 
 
+/**
+ * Allocate a new reference-counted memory object that may be referenced
+ * and dereferenced from several threads at the same time
+ *
+ * @param size Size of memory object
+ * @param dh   Optional destructor, called when destroyed
+ *
+ * @return Pointer to allocated object
+ */
+void *mem_alloc_shared(size_t size, mem_destroy_h *dh)
+{
+	void *p;
+
+	p = alloc_obj(size, dh, 0, MEM_SITE());
+	if (!p)
+		return NULL;
+
+	(((struct mem *)p) - 1)->flags |= MEM_SHARED;
+
+	return p;
+}
+
+
+/**
+ * Make the reference count of a memory object atomic, so it can be handed
+ * to other threads without a copy, e.g. a received mbuf. This must be
+ * done while only one thread uses the object. The contents of the object
+ * are not protected.
+ *
+ * @param data Memory object
+ *
+ * @return Memory object (same as data)
+ */
+void *mem_share(void *data)
+{
+	struct mem *m;
+
+	if (!data)
+		return NULL;
+
+	m = ((struct mem *)data) - 1;
+
+	MAGIC_CHECK(m);
+
+	m->flags |= MEM_SHARED;
+
+	return data;
+}
+
+
+/* Re-allocate a memory object, which may be in a slab */
+static struct mem *slab_realloc(struct mem *m, size_t size)
+{
+	const size_t cap = mem_slab_size(m->cls);
+	struct mem *m2;
+	uint16_t cls = 0;
+
+	if (!m->cls)
+		return realloc(m, sizeof(*m) + size);
+
+	/* Pool objects have a fixed size */
+	if (m->cls == MEM_CLS_POOL)
+		return NULL;
+
+	if (size <= cap)
+		return m;
+
+	m2 = mem_slab_alloc(sizeof(*m2), size, &cls);
+	if (!m2) {
+		m2 = malloc(sizeof(*m2) + size);
+		if (!m2)
+			return NULL;
+	}
+
+	memcpy(m2, m, sizeof(*m) + cap);
+	m2->cls = cls;
+
+	mem_slab_free(m, m->cls);
+
+	return m2;
+}
+
+
 /**
  * Re-allocate a reference-counted memory object
  *
@@ -200,26 +754,22 @@ void *mem_realloc(void *data, size_t size)
 	MAGIC_CHECK(m);
 
 #if MEM_DEBUG
-	mem_lock();
-
 	/* Simulate OOM */
-	if (-1 != threshold && size > m->size) {
-		if (memstat.blocks_cur >= (size_t)threshold) {
-			mem_unlock();
+	if (-1 != threshold_get() && size > m->size) {
+		if (stat_get(&memstat.blocks_cur) >= (size_t)threshold_get())
 			return NULL;
-		}
 	}
 
-	list_unlink(&m->le);
-	mem_unlock();
+	meml_unlink(m);
 #endif
 
-	m2 = realloc(m, sizeof(*m2) + size);
+	if (m->flags & MEM_TAGGED)
+		m2 = realloc_tagged(m, size);
+	else
+		m2 = slab_realloc(m, size);
 
 #if MEM_DEBUG
-	mem_lock();
-	list_append(&meml, m2 ? &m2->le : &m->le, m2 ? m2 : m);
-	mem_unlock();
+	meml_append(m2 ? m2 : m);
 #endif
 
 	if (!m2) {
@@ -267,6 +817,52 @@ void *mem_reallocarray(void *ptr, size_t nmemb, size_t membsize,
 }
 
 
+/**
+ * Allocate a memory object for a memory pool
+ *
+ * @param size Size of memory object
+ * @param dh   Optional destructor, called when released
+ *
+ * @return Pointer to allocated object
+ */
+void *mem_pobj_alloc(size_t size, mem_destroy_h *dh)
+{
+	return alloc_obj(size, dh, MEM_CLS_POOL, NULL);
+}
+
+
+/**
+ * Get the prefix of a memory pool object
+ *
+ * @param data Memory object
+ *
+ * @return Pool object prefix
+ */
+struct mem_pobj *mem_pobj(void *data)
+{
+	return (struct mem_pobj *)(void *)((uint8_t *)data
+					   - sizeof(struct mem) - POBJ_SIZE);
+}
+
+
+/**
+ * Hand out a released memory pool object again
+ *
+ * @param data Memory object
+ * @param dh   Optional destructor, called when released
+ */
+void mem_pobj_reuse(void *data, mem_destroy_h *dh)
+{
+	struct mem *m = ((struct mem *)data) - 1;
+
+	MAGIC_CHECK(m);
+
+	m->nrefs = 1;
+	m->flags = 0;
+	m->dh    = dh;
+}
+
+
 /**
  * Reference a reference-counted memory object
  *
@@ -285,7 +881,7 @@ void *mem_ref(void *data)
 
 	MAGIC_CHECK(m);
 
-	++m->nrefs;
+	nrefs_inc(m);
 
 	return data;
 }
@@ -302,7 +898,10 @@ void *mem_ref(void *data)
  */
 void *mem_deref(void *data)
 {
+	struct mem_acct *acct = NULL;
+	struct mem_tag *t = NULL;
 	struct mem *m;
+	uint16_t cls;
 
 	if (!data)
 		return NULL;
@@ -311,25 +910,40 @@ void *mem_deref(void *data)
 
 	MAGIC_CHECK(m);
 
-	if (--m->nrefs > 0)
+	if (nrefs_dec(m) > 0)
 		return NULL;
 
 	if (m->dh)
 		m->dh(data);
 
 	/* NOTE: check if the destructor called mem_ref() */
-	if (m->nrefs > 0)
+	if (nrefs_get(m) > 0)
+		return NULL;
+
+	/* Pool objects are kept allocated while their pool is alive */
+	if (m->cls == MEM_CLS_POOL && mem_pool_put(data))
 		return NULL;
 
 #if MEM_DEBUG
-	mem_lock();
-	list_unlink(&m->le);
-	mem_unlock();
+	meml_unlink(m);
 #endif
 
+	if (m->flags & MEM_TAGGED) {
+		t    = mem_tag(m);
+		acct = t->acct;
+		acct_release(acct, t->size);
+	}
+
+	cls = m->cls;
+
 	STAT_DEREF(m);
 
-	free(m);
+	if (t)
+		free(t);
+	else
+		free_block(m, cls);
+
+	mem_deref(acct);
 
 	return NULL;
 }
@@ -353,7 +967,7 @@ uint32_t mem_nrefs(const void *data)
 
 	MAGIC_CHECK(m);
 
-	return m->nrefs;
+	return nrefs_get(m);
 }
 
 
@@ -406,20 +1020,19 @@ static bool debug_handler(struct le *le, void *arg)
 void mem_debug(void)
 {
 #if MEM_DEBUG
-	uint32_t n;
-
-	mem_lock();
-	n = list_count(&meml);
-	mem_unlock();
+	uint32_t i, n;
 
+	n = meml_count();
 	if (!n)
 		return;
 
 	DEBUG_WARNING("Memory leaks (%u):\n", n);
 
-	mem_lock();
-	(void)list_apply(&meml, true, debug_handler, NULL);
-	mem_unlock();
+	for (i=0; i<MEM_SHARDS; i++) {
+		shard_lock(&shardv[i]);
+		(void)list_apply(&shardv[i].meml, true, debug_handler, NULL);
+		shard_unlock(&shardv[i]);
+	}
 #endif
 }
 
@@ -433,9 +1046,7 @@ void mem_debug(void)
 void mem_threshold_set(ssize_t n)
 {
 #if MEM_DEBUG
-	mem_lock();
-	threshold = n;
-	mem_unlock();
+	threshold_put(n);
 #else
 	(void)n;
 #endif
@@ -459,10 +1070,8 @@ int mem_status(struct re_printf *pf, void *unused)
 
 	(void)unused;
 
-	mem_lock();
-	memcpy(&stat, &memstat, sizeof(stat));
-	c = list_count(&meml);
-	mem_unlock();
+	stat_read(&stat);
+	c = meml_count();
 
 	err |= re_hprintf(pf, "Memory status: (%u bytes overhead pr block)\n",
 			  sizeof(struct mem));
@@ -499,11 +1108,150 @@ int mem_get_stat(struct memstat *mstat)
 	if (!mstat)
 		return EINVAL;
 #if MEM_DEBUG
-	mem_lock();
-	memcpy(mstat, &memstat, sizeof(*mstat));
-	mem_unlock();
+	memset(mstat, 0, sizeof(*mstat));
+	stat_read(mstat);
+	mem_slab_stat(mstat);
+	mem_arena_stat(mstat);
 	return 0;
 #else
+	memset(mstat, 0, sizeof(*mstat));
+	mem_slab_stat(mstat);
+	mem_arena_stat(mstat);
 	return ENOSYS;
 #endif
 }
+
+
+static void acct_destructor(void *data)
+{
+	struct mem_acct *acct = data;
+
+	mem_deref(acct->name);
+}
+
+
+/**
+ * Allocate a memory accounting tag, e.g. for one call. The objects that
+ * a thread allocates while the tag is set with mem_acct_set() are charged
+ * to the tag until they are freed. Accounting also works in release
+ * builds. While a tag is set, objects are allocated from the heap and not
+ * from the slabs, with a 16 byte prefix each.
+ *
+ * @param acctp Pointer to allocated accounting tag
+ * @param name  Name of the tag, e.g. the Call-ID (optional)
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int mem_acct_alloc(struct mem_acct **acctp, const char *name)
+{
+	struct mem_acct *acct;
+	int err = 0;
+
+	if (!acctp)
+		return EINVAL;
+
+	acct = mem_alloc_shared(sizeof(*acct), acct_destructor);
+	if (!acct)
+		return ENOMEM;
+
+	memset(acct, 0, sizeof(*acct));
+
+	if (name)
+		err = str_dup(&acct->name, name);
+
+	if (err)
+		mem_deref(acct);
+	else
+		*acctp = acct;
+
+	return err;
+}
+
+
+/**
+ * Set the accounting tag of the calling thread. The caller must keep a
+ * reference to the tag while it is set.
+ *
+ * @param acct Accounting tag, or NULL to stop accounting
+ *
+ * @return The previous accounting tag of the thread, for restoring it
+ */
+struct mem_acct *mem_acct_set(struct mem_acct *acct)
+{
+	struct mem_acct *prev;
+
+#ifdef HAVE_PTHREAD
+	pthread_once(&acct_once, acct_init);
+
+	if (!acct_key_ok)
+		return NULL;
+
+	prev = pthread_getspecific(acct_key);
+	(void)pthread_setspecific(acct_key, acct);
+#else
+	prev = acct_cur;
+	acct_cur = acct;
+#endif
+
+	if (acct)
+		acct_used = true;
+
+	return prev;
+}
+
+
+/**
+ * Get the statistics of a memory accounting tag. Only the byte and block
+ * counters are set.
+ *
+ * @param acct  Accounting tag
+ * @param mstat Returned memory statistics
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int mem_acct_stat(const struct mem_acct *acct, struct memstat *mstat)
+{
+	if (!acct || !mstat)
+		return EINVAL;
+
+	memset(mstat, 0, sizeof(*mstat));
+
+	stat_lock();
+	mstat->bytes_cur   = stat_get(&acct->bytes_cur);
+	mstat->bytes_peak  = stat_get(&acct->bytes_peak);
+	mstat->blocks_cur  = stat_get(&acct->blocks_cur);
+	mstat->blocks_peak = stat_get(&acct->blocks_peak);
+	stat_unlock();
+
+	return 0;
+}
+
+
+/**
+ * Print the memory charged to an accounting tag
+ *
+ * @param pf   Print handler for debug output
+ * @param acct Accounting tag
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int mem_acct_debug(struct re_printf *pf, const struct mem_acct *acct)
+{
+	struct memstat stat;
+	int err;
+
+	if (!acct)
+		return 0;
+
+	err = mem_acct_stat(acct, &stat);
+	if (err)
+		return err;
+
+	return re_hprintf(pf, "%s: %zu blocks, %zu bytes"
+			  " (total %zu bytes, peak %zu bytes)\n",
+			  acct->name ? acct->name : "mem_acct",
+			  stat.blocks_cur, stat.bytes_cur,
+			  stat.bytes_cur
+			  + stat.blocks_cur * (TAG_SIZE + sizeof(struct mem)),
+			  stat.bytes_peak);
+}
@@ -0,0 +1,35 @@
+/**
+ * @file mem.h  Memory management -- Internal API
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+
+void  *mem_slab_alloc(size_t hdr, size_t size, uint16_t *clsp);
+void   mem_slab_free(void *p, uint16_t cls);
+size_t mem_slab_size(uint16_t cls);
+void   mem_slab_stat(struct memstat *mstat);
+
+void  *mem_arena_get(size_t size);
+void   mem_arena_stat(struct memstat *mstat);
+
+
+/** Size class of memory objects that belong to a memory pool */
+enum { MEM_CLS_POOL = 0xffff };
+
+struct pool_core;
+
+/** Prefix of memory objects that belong to a memory pool */
+struct mem_pobj {
+	struct le le;             /**< Free-list element */
+	struct pool_core *core;   /**< Owning pool       */
+};
+
+void *mem_pobj_alloc(size_t size, mem_destroy_h *dh);
+struct mem_pobj *mem_pobj(void *data);
+void  mem_pobj_reuse(void *data, mem_destroy_h *dh);
+bool  mem_pool_put(void *data);
+
+uint32_t mem_prof_alloc(const void *site, size_t size);
+void     mem_prof_resize(uint32_t id, size_t oldsize, size_t newsize);
+void     mem_prof_free(uint32_t id, size_t size);
@@ -6,3 +6,7 @@
 
 SRCS	+= mem/mem.c
 SRCS	+= mem/secure.c
+SRCS	+= mem/slab.c
+SRCS	+= mem/pool.c
+SRCS	+= mem/profile.c
+SRCS	+= mem/arena.c
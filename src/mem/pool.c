@@ -0,0 +1,232 @@
+/**
+ * @file pool.c  Pools of fixed-size memory objects
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re_types.h>
+#include <re_fmt.h>
+#include <re_list.h>
+#include <re_mem.h>
+#include "mem.h"
+
+
+/*
+ * A memory pool hands out pre-allocated memory objects of a fixed size.
+ * The objects are normal reference-counted objects; when the last
+ * reference is dropped with mem_deref(), the object destructor is called
+ * and the object is put back on the free-list of the pool instead of
+ * being freed.
+ *
+ * Each object holds a reference to the pool state, so objects can outlive
+ * the pool handle. When the handle is destroyed, the free objects are
+ * freed, and objects still in use are freed when they are released.
+ *
+ * A pool and its objects must be used from one thread only.
+ */
+
+
+/** Pool state, shared by the pool handle and all objects */
+struct pool_core {
+	struct list freel;      /**< Free objects                      */
+	mem_destroy_h *dh;      /**< Object destructor                 */
+	size_t objsize;         /**< Object size in bytes              */
+	uint32_t nobj;          /**< Number of objects allocated       */
+	uint32_t nfree;         /**< Number of free objects            */
+	uint64_t nget;          /**< Number of objects handed out      */
+	uint64_t nmiss;         /**< Number of gets with empty pool    */
+	bool closed;            /**< Pool handle was destroyed         */
+};
+
+/** Defines a pool of fixed-size memory objects */
+struct mem_pool {
+	struct pool_core *core;
+};
+
+
+static void pool_destructor(void *data)
+{
+	struct mem_pool *pool = data;
+	struct pool_core *core = pool->core;
+	struct le *le;
+
+	core->closed = true;
+
+	/* Free objects are released once more, now without a pool */
+	while ((le = list_head(&core->freel))) {
+
+		void *obj = le->data;
+
+		list_unlink(le);
+		--core->nfree;
+
+		mem_pobj_reuse(obj, NULL);
+		mem_deref(obj);
+	}
+
+	mem_deref(core);
+}
+
+
+static int obj_alloc(struct pool_core *core)
+{
+	struct mem_pobj *po;
+	void *obj;
+
+	obj = mem_pobj_alloc(core->objsize, core->dh);
+	if (!obj)
+		return ENOMEM;
+
+	po = mem_pobj(obj);
+	memset(&po->le, 0, sizeof(po->le));
+	po->core = mem_ref(core);
+
+	list_append(&core->freel, &po->le, obj);
+	++core->nobj;
+	++core->nfree;
+
+	return 0;
+}
+
+
+/**
+ * Put a released memory object back to its pool
+ *
+ * @param data Memory object
+ *
+ * @return True if the object was put back, false if it must be freed
+ */
+bool mem_pool_put(void *data)
+{
+	struct mem_pobj *po = mem_pobj(data);
+	struct pool_core *core = po->core;
+
+	if (core->closed) {
+		--core->nobj;
+		po->core = mem_deref(core);
+		return false;
+	}
+
+	list_append(&core->freel, &po->le, data);
+	++core->nfree;
+
+	return true;
+}
+
+
+/**
+ * Allocate a pool of fixed-size memory objects
+ *
+ * @param poolp   Pointer to allocated memory pool
+ * @param nobj    Number of objects to pre-allocate
+ * @param objsize Size of each object in bytes
+ * @param dh      Optional object destructor, called when released
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int mem_pool_alloc(struct mem_pool **poolp, size_t nobj, size_t objsize,
+		   mem_destroy_h *dh)
+{
+	struct mem_pool *pool;
+	struct pool_core *core;
+	size_t i;
+	int err = 0;
+
+	if (!poolp || !objsize)
+		return EINVAL;
+
+	core = mem_zalloc(sizeof(*core), NULL);
+	if (!core)
+		return ENOMEM;
+
+	core->objsize = objsize;
+	core->dh      = dh;
+
+	pool = mem_zalloc(sizeof(*pool), pool_destructor);
+	if (!pool) {
+		mem_deref(core);
+		return ENOMEM;
+	}
+
+	pool->core = core;
+
+	for (i=0; i<nobj; i++) {
+
+		err = obj_alloc(core);
+		if (err)
+			goto out;
+	}
+
+ out:
+	if (err)
+		mem_deref(pool);
+	else
+		*poolp = pool;
+
+	return err;
+}
+
+
+/**
+ * Get a zeroed memory object from a pool. The object is released with
+ * mem_deref(), and the pool is grown if it is empty.
+ *
+ * @param pool Memory pool
+ *
+ * @return Memory object, or NULL if out of memory
+ */
+void *mem_pool_get(struct mem_pool *pool)
+{
+	struct pool_core *core;
+	struct le *le;
+	void *obj;
+
+	if (!pool)
+		return NULL;
+
+	core = pool->core;
+
+	if (!core->freel.head) {
+
+		++core->nmiss;
+
+		if (obj_alloc(core))
+			return NULL;
+	}
+
+	le  = list_head(&core->freel);
+	obj = le->data;
+
+	list_unlink(le);
+	--core->nfree;
+	++core->nget;
+
+	mem_pobj_reuse(obj, core->dh);
+	memset(obj, 0, core->objsize);
+
+	return obj;
+}
+
+
+/**
+ * Print the status of a memory pool
+ *
+ * @param pf   Print handler for debug output
+ * @param pool Memory pool
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int mem_pool_debug(struct re_printf *pf, const struct mem_pool *pool)
+{
+	const struct pool_core *core;
+
+	if (!pool)
+		return 0;
+
+	core = pool->core;
+
+	return re_hprintf(pf, "mem_pool: objsize=%zu objects=%u free=%u"
+			  " gets=%llu misses=%llu\n",
+			  core->objsize, core->nobj, core->nfree,
+			  core->nget, core->nmiss);
+}
@@ -0,0 +1,303 @@
+/**
+ * @file profile.c  Allocation-site profiling of memory objects
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include <re_types.h>
+#include <re_fmt.h>
+#include <re_list.h>
+#include <re_mem.h>
+#include <re_tmr.h>
+#include "mem.h"
+
+
+/*
+ * When enabled, each memory object records the address of the code that
+ * allocated it, and live bytes, live blocks and allocations are counted
+ * per allocation site. Sites are kept in a fixed-size open-addressing
+ * table, so profiling never allocates memory itself.
+ *
+ * The site is the return address of mem_alloc()/mem_zalloc(), which can
+ * be resolved with addr2line(1) or a debugger. Objects allocated through
+ * a module's own allocation function are accounted to that function.
+ */
+
+
+/** Number of allocation sites, must be a power of two */
+#define PROF_SITES 4096
+
+/** Allocation site */
+struct site {
+	const void *site;    /**< Return address of the allocation */
+	size_t bytes;        /**< Live bytes                       */
+	size_t blocks;       /**< Live blocks                      */
+	size_t allocs;       /**< Total allocations                */
+	size_t allocs_last;  /**< Allocations at the last print    */
+};
+
+static struct site sitev[PROF_SITES];
+static bool prof_enabled;
+static uint64_t prof_ts;
+
+
+#if defined (__ATOMIC_RELAXED)
+
+#define prof_lock()    /**< Stub */
+#define prof_unlock()  /**< Stub */
+
+#define prof_add(v, n) __atomic_add_fetch((v), (n), __ATOMIC_RELAXED)
+#define prof_sub(v, n) __atomic_sub_fetch((v), (n), __ATOMIC_RELAXED)
+#define prof_get(v)    __atomic_load_n((v), __ATOMIC_RELAXED)
+
+
+static bool site_claim(struct site *s, const void *site)
+{
+	const void *expected = NULL;
+
+	return __atomic_compare_exchange_n(&s->site, &expected, site, false,
+					   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+		|| expected == site;
+}
+
+#else
+
+#ifdef HAVE_PTHREAD
+
+static pthread_mutex_t prof_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static inline void prof_lock(void)
+{
+	pthread_mutex_lock(&prof_mutex);
+}
+
+
+static inline void prof_unlock(void)
+{
+	pthread_mutex_unlock(&prof_mutex);
+}
+
+#else
+
+#define prof_lock()    /**< Stub */
+#define prof_unlock()  /**< Stub */
+
+#endif
+
+#define prof_add(v, n) (*(v) += (n))
+#define prof_sub(v, n) (*(v) -= (n))
+#define prof_get(v)    (*(v))
+
+
+static bool site_claim(struct site *s, const void *site)
+{
+	if (!s->site)
+		s->site = site;
+
+	return s->site == site;
+}
+
+#endif
+
+
+static uint32_t site_hash(const void *site)
+{
+	uintptr_t a = (uintptr_t)site;
+
+	a ^= a >> 17;
+	a *= 0x9e3779b1u;
+
+	return (uint32_t)(a ^ (a >> 15));
+}
+
+
+/**
+ * Account the allocation of a memory object
+ *
+ * @param site Allocation site
+ * @param size Size of memory object
+ *
+ * @return Site identifier, or 0 if not profiled
+ */
+uint32_t mem_prof_alloc(const void *site, size_t size)
+{
+	uint32_t h, i;
+
+	if (!prof_enabled || !site)
+		return 0;
+
+	h = site_hash(site);
+
+	prof_lock();
+
+	for (i=0; i<PROF_SITES; i++) {
+
+		const uint32_t id = (h + i) & (PROF_SITES - 1);
+		struct site *s = &sitev[id];
+
+		if (!site_claim(s, site))
+			continue;
+
+		prof_add(&s->bytes, size);
+		prof_add(&s->blocks, 1);
+		prof_add(&s->allocs, 1);
+
+		prof_unlock();
+
+		return id + 1;
+	}
+
+	prof_unlock();
+
+	/* Table is full */
+	return 0;
+}
+
+
+/**
+ * Account a size change of a memory object
+ *
+ * @param id      Site identifier
+ * @param oldsize Previous size of memory object
+ * @param newsize New size of memory object
+ */
+void mem_prof_resize(uint32_t id, size_t oldsize, size_t newsize)
+{
+	struct site *s;
+
+	if (!id || id > PROF_SITES)
+		return;
+
+	s = &sitev[id - 1];
+
+	prof_lock();
+	prof_add(&s->bytes, newsize);
+	prof_sub(&s->bytes, oldsize);
+	prof_unlock();
+}
+
+
+/**
+ * Account the release of a memory object
+ *
+ * @param id   Site identifier
+ * @param size Size of memory object
+ */
+void mem_prof_free(uint32_t id, size_t size)
+{
+	struct site *s;
+
+	if (!id || id > PROF_SITES)
+		return;
+
+	s = &sitev[id - 1];
+
+	prof_lock();
+	prof_sub(&s->bytes, size);
+	prof_sub(&s->blocks, 1);
+	prof_unlock();
+}
+
+
+/**
+ * Enable or disable allocation-site profiling. Only memory objects that
+ * are allocated while profiling is enabled are accounted. Profiling is
+ * only available if memory debugging is enabled.
+ *
+ * @param enable True to enable, false to disable
+ */
+void mem_profile_enable(bool enable)
+{
+	if (enable && !prof_enabled)
+		prof_ts = tmr_jiffies();
+
+	prof_enabled = enable;
+}
+
+
+static int site_cmp(const void *p1, const void *p2)
+{
+	const struct site *s1 = p1, *s2 = p2;
+
+	if (s1->bytes != s2->bytes)
+		return s1->bytes < s2->bytes ? 1 : -1;
+
+	return s1->blocks < s2->blocks ? 1 : s1->blocks > s2->blocks ? -1 : 0;
+}
+
+
+/**
+ * Print the allocation sites with the most live bytes. The allocation
+ * rate is calculated since the previous call.
+ *
+ * @param pf Print handler for debug output
+ * @param n  Maximum number of sites to print, 0 for all
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int mem_profile_print(struct re_printf *pf, unsigned n)
+{
+	struct site *v;
+	const uint64_t now = tmr_jiffies();
+	const uint64_t ms = max(now - prof_ts, (uint64_t)1);
+	size_t i, c = 0;
+	int err;
+
+	if (!pf)
+		return EINVAL;
+
+	v = malloc(PROF_SITES * sizeof(*v));
+	if (!v)
+		return ENOMEM;
+
+	prof_lock();
+
+	for (i=0; i<PROF_SITES; i++) {
+
+		struct site *s = &sitev[i];
+		size_t allocs;
+
+		if (!prof_get(&s->site))
+			continue;
+
+		allocs = prof_get(&s->allocs);
+
+		v[c].site        = s->site;
+		v[c].bytes       = prof_get(&s->bytes);
+		v[c].blocks      = prof_get(&s->blocks);
+		v[c].allocs      = allocs;
+		v[c].allocs_last = allocs - s->allocs_last;
+
+		s->allocs_last = allocs;
+		++c;
+	}
+
+	prof_unlock();
+
+	prof_ts = now;
+
+	qsort(v, c, sizeof(*v), site_cmp);
+
+	if (n)
+		c = min(c, (size_t)n);
+
+	err = re_hprintf(pf, "Memory profile: (%s)\n",
+			 prof_enabled ? "enabled" : "disabled");
+
+	for (i=0; i<c; i++) {
+
+		err |= re_hprintf(pf, "  %p: bytes=%-9zu blocks=%-7zu"
+				  " allocs=%-9zu rate=%llu/s\n",
+				  v[i].site, v[i].bytes, v[i].blocks,
+				  v[i].allocs,
+				  (uint64_t)v[i].allocs_last * 1000 / ms);
+	}
+
+	free(v);
+
+	return err;
+}
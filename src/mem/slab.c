@@ -0,0 +1,389 @@
+/**
+ * @file slab.c  Size-class slab allocator for memory objects
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include <re_types.h>
+#include <re_list.h>
+#include <re_mem.h>
+#include "mem.h"
+
+
+/*
+ * Small memory objects are carved from slabs, one slab size per class.
+ * Free blocks are kept in a free-list per thread and size class, so the
+ * fast path of mem_alloc()/mem_deref() takes no locks. When a thread
+ * cache grows too large, half of it is moved to a global depot, where
+ * other threads can pick it up. This keeps producer/consumer patterns
+ * (allocate in one thread, free in another) from growing without bounds.
+ *
+ * Slabs are taken from the huge-page arena while it has room, see
+ * arena.c, and are never returned to the system.
+ */
+
+
+/** Slab allocator values */
+enum {
+	SLAB_SIZE   = 65536,  /**< Target size of a slab in bytes   */
+	SLAB_MINBLK = 8,      /**< Minimum number of blocks in slab */
+	CACHE_MAX   = 256,    /**< Maximum free blocks per thread   */
+	CACHE_BATCH = 64,     /**< Blocks moved from/to the depot   */
+};
+
+/** Object sizes of the size classes, excluding the object header */
+static const uint32_t class_size[MEM_SLAB_CLASSES] = {
+	16, 32, 48, 64, 96, 128, 192, 256, 384, 512,
+	768, 1024, 1536, 2048, 3072, 4096, 6144, 8192, 12288, 16384
+};
+
+/** Free block */
+struct blk {
+	struct blk *next;
+};
+
+/** Free-list */
+struct flist {
+	struct blk *head;
+	uint32_t n;
+};
+
+/** Per-thread cache */
+struct cache {
+	struct cache *next;                  /**< Next in cache list     */
+	struct cache *prev;                  /**< Previous in cache list */
+	struct flist fl[MEM_SLAB_CLASSES];   /**< Free blocks            */
+	uint64_t allocs[MEM_SLAB_CLASSES];   /**< Allocations served     */
+};
+
+/** Global slab state, protected by the slab lock */
+static struct {
+	struct flist depot[MEM_SLAB_CLASSES];  /**< Free blocks          */
+	size_t slabs[MEM_SLAB_CLASSES];        /**< Slabs allocated      */
+	size_t blocks[MEM_SLAB_CLASSES];       /**< Blocks carved        */
+	uint64_t allocs[MEM_SLAB_CLASSES];     /**< From retired caches  */
+	struct cache *cachel;                  /**< All thread caches    */
+} slab;
+
+static bool slab_enabled;
+
+
+#ifdef HAVE_PTHREAD
+
+static pthread_mutex_t slab_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t  slab_once = PTHREAD_ONCE_INIT;
+static pthread_key_t   slab_key;
+static bool            slab_key_ok;
+
+
+static inline void slab_lock(void)
+{
+	pthread_mutex_lock(&slab_mutex);
+}
+
+
+static inline void slab_unlock(void)
+{
+	pthread_mutex_unlock(&slab_mutex);
+}
+
+#else
+
+#define slab_lock()    /**< Stub */
+#define slab_unlock()  /**< Stub */
+
+static struct cache global_cache;
+
+#endif
+
+
+static int size_class(size_t size)
+{
+	int lo = 0, hi = MEM_SLAB_CLASSES - 1;
+
+	if (size > class_size[hi])
+		return -1;
+
+	while (lo < hi) {
+		const int mid = (lo + hi) / 2;
+
+		if (class_size[mid] < size)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+
+static void flist_push(struct flist *fl, struct blk *b)
+{
+	b->next  = fl->head;
+	fl->head = b;
+	++fl->n;
+}
+
+
+/* Move up to n blocks from one free-list to another */
+static void flist_move(struct flist *dst, struct flist *src, uint32_t n)
+{
+	while (n-- && src->head) {
+		struct blk *b = src->head;
+
+		src->head = b->next;
+		--src->n;
+
+		flist_push(dst, b);
+	}
+}
+
+
+#ifdef HAVE_PTHREAD
+static void cache_destructor(void *arg)
+{
+	struct cache *c = arg;
+	int i;
+
+	slab_lock();
+
+	for (i=0; i<MEM_SLAB_CLASSES; i++) {
+		flist_move(&slab.depot[i], &c->fl[i], c->fl[i].n);
+		slab.allocs[i] += c->allocs[i];
+	}
+
+	if (c->prev)
+		c->prev->next = c->next;
+	else
+		slab.cachel = c->next;
+	if (c->next)
+		c->next->prev = c->prev;
+
+	slab_unlock();
+
+	free(c);
+}
+
+
+static void slab_init(void)
+{
+	slab_key_ok = (0 == pthread_key_create(&slab_key, cache_destructor));
+}
+#endif
+
+
+static struct cache *cache_get(void)
+{
+#ifdef HAVE_PTHREAD
+	struct cache *c;
+
+	pthread_once(&slab_once, slab_init);
+
+	if (!slab_key_ok)
+		return NULL;
+
+	c = pthread_getspecific(slab_key);
+	if (c)
+		return c;
+
+	c = calloc(1, sizeof(*c));
+	if (!c)
+		return NULL;
+
+	if (pthread_setspecific(slab_key, c)) {
+		free(c);
+		return NULL;
+	}
+
+	slab_lock();
+	c->next = slab.cachel;
+	if (slab.cachel)
+		slab.cachel->prev = c;
+	slab.cachel = c;
+	slab_unlock();
+
+	return c;
+#else
+	if (!slab.cachel)
+		slab.cachel = &global_cache;
+
+	return &global_cache;
+#endif
+}
+
+
+/* Refill a thread cache from the depot, or from a new slab */
+static int refill(struct cache *c, int cls, size_t hdr)
+{
+	const size_t bsize = hdr + class_size[cls];
+	size_t i, nblk;
+	uint8_t *p;
+
+	slab_lock();
+	flist_move(&c->fl[cls], &slab.depot[cls], CACHE_BATCH);
+	slab_unlock();
+
+	if (c->fl[cls].head)
+		return 0;
+
+	nblk = max(SLAB_SIZE / bsize, (size_t)SLAB_MINBLK);
+
+	slab_lock();
+	p = mem_arena_get(nblk * bsize);
+	slab_unlock();
+
+	if (!p)
+		p = malloc(nblk * bsize);
+	if (!p)
+		return ENOMEM;
+
+	for (i=0; i<nblk; i++)
+		flist_push(&c->fl[cls], (struct blk *)(void *)(p + i*bsize));
+
+	slab_lock();
+	++slab.slabs[cls];
+	slab.blocks[cls] += nblk;
+	slab_unlock();
+
+	return 0;
+}
+
+
+/**
+ * Allocate a block from the slab allocator
+ *
+ * @param hdr  Size of the object header, must be constant
+ * @param size Size of the object
+ * @param clsp Returned size class, starting at 1
+ *
+ * @return Pointer to block, or NULL if the caller should use malloc()
+ */
+void *mem_slab_alloc(size_t hdr, size_t size, uint16_t *clsp)
+{
+	struct cache *c;
+	struct blk *b;
+	int cls;
+
+	if (!slab_enabled)
+		return NULL;
+
+	cls = size_class(size);
+	if (cls < 0)
+		return NULL;
+
+	c = cache_get();
+	if (!c)
+		return NULL;
+
+	if (!c->fl[cls].head && refill(c, cls, hdr))
+		return NULL;
+
+	b = c->fl[cls].head;
+	c->fl[cls].head = b->next;
+	--c->fl[cls].n;
+	++c->allocs[cls];
+
+	*clsp = (uint16_t)(cls + 1);
+
+	return b;
+}
+
+
+/**
+ * Return a block to the slab allocator
+ *
+ * @param p   Pointer to block
+ * @param cls Size class of the block, starting at 1
+ */
+void mem_slab_free(void *p, uint16_t cls)
+{
+	struct cache *c;
+	struct flist *fl;
+
+	if (!p || !cls || cls > MEM_SLAB_CLASSES)
+		return;
+
+	--cls;
+
+	c = cache_get();
+	if (!c) {
+		slab_lock();
+		flist_push(&slab.depot[cls], p);
+		slab_unlock();
+		return;
+	}
+
+	fl = &c->fl[cls];
+
+	flist_push(fl, p);
+
+	if (fl->n > CACHE_MAX) {
+		slab_lock();
+		flist_move(&slab.depot[cls], fl, CACHE_MAX / 2);
+		slab_unlock();
+	}
+}
+
+
+/**
+ * Get the object size of a size class
+ *
+ * @param cls Size class, starting at 1
+ *
+ * @return Object size, excluding the object header
+ */
+size_t mem_slab_size(uint16_t cls)
+{
+	if (!cls || cls > MEM_SLAB_CLASSES)
+		return 0;
+
+	return class_size[cls - 1];
+}
+
+
+/**
+ * Get the slab allocator statistics
+ *
+ * @param mstat Memory statistics
+ */
+void mem_slab_stat(struct memstat *mstat)
+{
+	const struct cache *c;
+	int i;
+
+	slab_lock();
+
+	for (i=0; i<MEM_SLAB_CLASSES; i++) {
+		mstat->slab[i].size   = class_size[i];
+		mstat->slab[i].slabs  = slab.slabs[i];
+		mstat->slab[i].blocks = slab.blocks[i];
+		mstat->slab[i].cached = slab.depot[i].n;
+		mstat->slab[i].allocs = (size_t)slab.allocs[i];
+
+		/* Thread caches are read without locking */
+		for (c = slab.cachel; c; c = c->next) {
+			mstat->slab[i].cached += c->fl[i].n;
+			mstat->slab[i].allocs += (size_t)c->allocs[i];
+		}
+	}
+
+	slab_unlock();
+}
+
+
+/**
+ * Enable or disable the slab allocator for small memory objects. The slab
+ * allocator should be enabled at start-up, before any memory objects are
+ * allocated. Objects allocated from slabs are still freed correctly after
+ * it has been disabled.
+ *
+ * @param enable True to enable, false to disable
+ */
+void mem_pool_enable(bool enable)
+{
+	slab_enabled = enable;
+}
@@ -0,0 +1,361 @@
+/**
+ * @file metric.c  Metrics registry, in the Prometheus text format
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include <re_types.h>
+#include <re_fmt.h>
+#include <re_metric.h>
+
+
+/*
+ * A metric is added to the registry list with a compare-and-swap, the
+ * first time it is updated, so that updates never take a lock. Counters
+ * and histograms are split into shards on their own cache lines, and
+ * the shard of a thread is picked from its thread ID; the shards are
+ * summed when the metrics are printed. A histogram shard holds the
+ * bucket counts, with the +Inf bucket last, followed by the sum.
+ */
+
+
+#if defined (__ATOMIC_RELAXED)
+#define metric_add_u64(p, n) __atomic_add_fetch((p), (n), __ATOMIC_RELAXED)
+#define metric_load(p)       __atomic_load_n((p), __ATOMIC_RELAXED)
+#define metric_store(p, v)   __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#else
+#define metric_add_u64(p, n) (*(p) += (n))
+#define metric_load(p)       (*(p))
+#define metric_store(p, v)   (*(p) = (v))
+#endif
+
+
+static struct re_metric *metricl;
+
+
+static void metric_push(struct re_metric *m)
+{
+#if defined (__ATOMIC_RELAXED)
+	int expected = 0;
+
+	if (!__atomic_compare_exchange_n(&m->reg, &expected, 1, false,
+					 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		return;
+
+	m->next = __atomic_load_n(&metricl, __ATOMIC_ACQUIRE);
+
+	while (!__atomic_compare_exchange_n(&metricl, &m->next, m, true,
+					    __ATOMIC_RELEASE,
+					    __ATOMIC_ACQUIRE))
+		;
+#else
+	if (m->reg)
+		return;
+
+	m->reg  = 1;
+	m->next = metricl;
+	metricl = m;
+#endif
+}
+
+
+static inline void metric_check(struct re_metric *m)
+{
+	if (!metric_load(&m->reg))
+		metric_push(m);
+}
+
+
+static inline uint64_t *shard_get(const struct re_metric *m)
+{
+#ifdef HAVE_PTHREAD
+	uint64_t id = (uint64_t)(uintptr_t)pthread_self();
+
+	id *= 0x9e3779b97f4a7c15ULL;
+
+	return m->shardv + (id >> 32 & (RE_METRIC_SHARDS - 1)) * m->stride;
+#else
+	return m->shardv;
+#endif
+}
+
+
+/**
+ * Add to a counter
+ *
+ * @param m Counter
+ * @param n Amount to add
+ */
+void re_metric_add(struct re_metric *m, uint64_t n)
+{
+	if (!m)
+		return;
+
+	metric_check(m);
+
+	metric_add_u64(shard_get(m), n);
+}
+
+
+/**
+ * Add to a gauge
+ *
+ * @param m Gauge
+ * @param n Amount to add, may be negative
+ */
+void re_metric_gauge_add(struct re_metric *m, int64_t n)
+{
+	if (!m)
+		return;
+
+	metric_check(m);
+
+	metric_add_u64(m->shardv, (uint64_t)n);
+}
+
+
+/**
+ * Set the value of a gauge
+ *
+ * @param m Gauge
+ * @param v Value
+ */
+void re_metric_gauge_set(struct re_metric *m, int64_t v)
+{
+	if (!m)
+		return;
+
+	metric_check(m);
+
+	metric_store(m->shardv, (uint64_t)v);
+}
+
+
+/**
+ * Add an observation to a histogram
+ *
+ * @param m Histogram
+ * @param v Observed value
+ */
+void re_metric_observe(struct re_metric *m, uint64_t v)
+{
+	uint64_t *shard;
+	uint32_t i;
+
+	if (!m)
+		return;
+
+	metric_check(m);
+
+	for (i=0; i<m->boundc; i++) {
+
+		if (v <= m->boundv[i])
+			break;
+	}
+
+	shard = shard_get(m);
+
+	metric_add_u64(&shard[i], 1);
+	metric_add_u64(&shard[m->boundc + 1], v);
+}
+
+
+static uint64_t shard_sum(const struct re_metric *m, uint32_t i)
+{
+	uint64_t v = 0;
+	uint32_t s;
+
+	for (s=0; s<RE_METRIC_SHARDS; s++)
+		v += metric_load(&m->shardv[s * m->stride + i]);
+
+	return v;
+}
+
+
+/**
+ * Get the value of a metric, the number of observations of a histogram
+ *
+ * @param m Metric
+ *
+ * @return Value, a gauge is returned as two's complement
+ */
+uint64_t re_metric_value(const struct re_metric *m)
+{
+	uint64_t v = 0;
+	uint32_t i;
+
+	if (!m)
+		return 0;
+
+	switch (m->type) {
+
+	case RE_METRIC_COUNTER:
+		return shard_sum(m, 0);
+
+	case RE_METRIC_GAUGE:
+		return metric_load(m->shardv);
+
+	case RE_METRIC_HISTOGRAM:
+		for (i=0; i<=m->boundc; i++)
+			v += shard_sum(m, i);
+
+		return v;
+
+	default:
+		return 0;
+	}
+}
+
+
+/**
+ * Add a metric to the registry before its first update, so that it is
+ * printed with a zero value
+ *
+ * @param m Metric
+ */
+void re_metric_register(struct re_metric *m)
+{
+	if (!m)
+		return;
+
+	metric_check(m);
+}
+
+
+static const char *type_name(enum re_metric_type type)
+{
+	switch (type) {
+
+	case RE_METRIC_COUNTER:   return "counter";
+	case RE_METRIC_GAUGE:     return "gauge";
+	case RE_METRIC_HISTOGRAM: return "histogram";
+	default:                  return "untyped";
+	}
+}
+
+
+static int labels_print(struct re_printf *pf, const struct re_metric *m,
+			const char *le)
+{
+	const bool lbl = m->labels && *m->labels;
+
+	if (!lbl && !le)
+		return 0;
+
+	return re_hprintf(pf, "{%s%s%s%s%s}",
+			  lbl ? m->labels : "",
+			  lbl && le ? "," : "",
+			  le ? "le=\"" : "", le ? le : "", le ? "\"" : "");
+}
+
+
+static int histogram_print(struct re_printf *pf, const struct re_metric *m)
+{
+	uint64_t cum = 0;
+	char le[24];
+	uint32_t i;
+	int err = 0;
+
+	for (i=0; i<=m->boundc && !err; i++) {
+
+		cum += shard_sum(m, i);
+
+		if (i < m->boundc)
+			(void)re_snprintf(le, sizeof(le), "%llu",
+					  m->boundv[i]);
+		else
+			str_ncpy(le, "+Inf", sizeof(le));
+
+		err  = re_hprintf(pf, "%s_bucket", m->name);
+		err |= labels_print(pf, m, le);
+		err |= re_hprintf(pf, " %llu\n", cum);
+	}
+
+	err |= re_hprintf(pf, "%s_sum", m->name);
+	err |= labels_print(pf, m, NULL);
+	err |= re_hprintf(pf, " %llu\n", shard_sum(m, m->boundc + 1));
+
+	err |= re_hprintf(pf, "%s_count", m->name);
+	err |= labels_print(pf, m, NULL);
+	err |= re_hprintf(pf, " %llu\n", cum);
+
+	return err;
+}
+
+
+static int metric_print(struct re_printf *pf, const struct re_metric *m)
+{
+	int err;
+
+	if (m->type == RE_METRIC_HISTOGRAM)
+		return histogram_print(pf, m);
+
+	err  = re_hprintf(pf, "%s", m->name);
+	err |= labels_print(pf, m, NULL);
+
+	if (m->type == RE_METRIC_GAUGE)
+		err |= re_hprintf(pf, " %lld\n", (int64_t)re_metric_value(m));
+	else
+		err |= re_hprintf(pf, " %llu\n", re_metric_value(m));
+
+	return err;
+}
+
+
+/* The first metric of a name in the registry has its HELP and TYPE */
+static bool name_first(const struct re_metric *head,
+		       const struct re_metric *m)
+{
+	const struct re_metric *p;
+
+	for (p = head; p != m; p = p->next) {
+
+		if (!str_cmp(p->name, m->name))
+			return false;
+	}
+
+	return true;
+}
+
+
+/**
+ * Print the registered metrics in the Prometheus text exposition format.
+ * The metrics of a name are printed together, in one family.
+ *
+ * @param pf     Print handler
+ * @param unused Unused parameter
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int re_metrics_print(struct re_printf *pf, void *unused)
+{
+	const struct re_metric *head, *m, *p;
+	int err = 0;
+	(void)unused;
+
+#if defined (__ATOMIC_RELAXED)
+	head = __atomic_load_n(&metricl, __ATOMIC_ACQUIRE);
+#else
+	head = metricl;
+#endif
+
+	for (m = head; m && !err; m = m->next) {
+
+		if (!name_first(head, m))
+			continue;
+
+		err = re_hprintf(pf, "# HELP %s %s\n# TYPE %s %s\n",
+				 m->name, m->help ? m->help : "",
+				 m->name, type_name(m->type));
+
+		for (p = m; p && !err; p = p->next) {
+
+			if (!str_cmp(p->name, m->name))
+				err = metric_print(pf, p);
+		}
+	}
+
+	return err;
+}
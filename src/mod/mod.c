@@ -24,10 +24,13 @@ struct mod {
 	struct le le;                 /**< Linked list element */
 	void *h;                      /**< Module handler      */
 	const struct mod_export *me;  /**< Module exports      */
+	bool ready;                   /**< Init handler called */
 };
 
 
 static struct list modl;  /* struct mod */
+static const struct mod_export *const *statv;  /* Static modules */
+static bool lazy;
 
 
 /**
@@ -54,7 +57,7 @@ static void mod_destructor(void *data)
 	const struct mod_export *me = m->me;
 	int err;
 
-	if (me && me->close && (err = me->close())) {
+	if (m->ready && me->close && (err = me->close())) {
 		DEBUG_NOTICE("close: error (%m)\n", err);
 	}
 
@@ -64,8 +67,68 @@ static void mod_destructor(void *data)
 }
 
 
+/* Module name of a path, with or without extension */
+static void mod_name(struct pl *x, const char *name)
+{
+	if (re_regex(name, strlen(name), "[/]*[^./]+" MOD_EXT, NULL, x))
+		pl_set_str(x, name);
+}
+
+
+static struct mod *lookup(const char *name)
+{
+	struct le *le;
+	struct pl x;
+
+	mod_name(&x, name);
+
+	for (le = modl.head; le; le = le->next) {
+		struct mod *m = le->data;
+
+		if (0 == pl_strcasecmp(&x, m->me->name))
+			return m;
+	}
+
+	return NULL;
+}
+
+
+/* Call the init handler, unless the module is initialised lazily */
+static int mod_start(struct mod *m)
+{
+	if (lazy)
+		return 0;
+
+	m->ready = true;
+
+	return m->me->init ? m->me->init() : 0;
+}
+
+
+static const struct mod_export *static_find(const char *name)
+{
+	const struct mod_export *const *mev;
+	struct pl x;
+
+	if (!statv)
+		return NULL;
+
+	mod_name(&x, name);
+
+	for (mev = statv; *mev; mev++) {
+
+		if (0 == pl_strcasecmp(&x, (*mev)->name))
+			return *mev;
+	}
+
+	return NULL;
+}
+
+
 /**
- * Find a module by name in the list of loaded modules
+ * Find a module by name in the list of loaded modules. If lazy
+ * initialisation is enabled, the module is initialised on the first
+ * lookup, and removed from the list if that fails.
  *
  * @param name Name of module to find
  *
@@ -73,28 +136,34 @@ static void mod_destructor(void *data)
  */
 struct mod *mod_find(const char *name)
 {
-	struct le *le;
-	struct pl x;
+	struct mod *m;
+	int err;
 
 	if (!name)
 		return NULL;
 
-	if (re_regex(name, strlen(name), "[/]*[^./]+" MOD_EXT, NULL, &x))
-		return NULL;
+	m = lookup(name);
+	if (!m || m->ready)
+		return m;
 
-	for (le = modl.head; le; le = le->next) {
-		struct mod *m = le->data;
+	m->ready = true;
 
-		if (0 == pl_strcasecmp(&x, m->me->name))
-			return m;
+	err = m->me->init ? m->me->init() : 0;
+	if (err) {
+		DEBUG_WARNING("%s: lazy init failed (%m)\n", m->me->name, err);
+
+		/* the module object is still owned by the caller of load */
+		list_unlink(&m->le);
+		return NULL;
 	}
 
-	return NULL;
+	return m;
 }
 
 
 /**
- * Load and initialise a loadable module by name
+ * Load and initialise a loadable module by name. Modules of the static
+ * module table are used without loading a shared object.
  *
  * @param mp   Pointer to allocated module object
  * @param name Name of loadable module
@@ -110,7 +179,7 @@ int mod_load(struct mod **mp, const char *name)
 		return EINVAL;
 
 	/* check if already loaded */
-	m = mod_find(name);
+	m = lookup(name);
 	if (m) {
 		DEBUG_NOTICE("module already loaded: %s\n", name);
 		return EALREADY;
@@ -122,20 +191,23 @@ int mod_load(struct mod **mp, const char *name)
 
 	list_append(&modl, &m->le, m);
 
-	m->h = _mod_open(name);
-	if (!m->h) {
-		err = ENOENT;
-		goto out;
-	}
-
-	m->me = _mod_sym(m->h, "exports");
+	m->me = static_find(name);
 	if (!m->me) {
-		err = ELIBBAD;
-		goto out;
+
+		m->h = _mod_open(name);
+		if (!m->h) {
+			err = ENOENT;
+			goto out;
+		}
+
+		m->me = _mod_sym(m->h, "exports");
+		if (!m->me) {
+			err = ELIBBAD;
+			goto out;
+		}
 	}
 
-	if (m->me->init && (err = m->me->init()))
-		goto out;
+	err = mod_start(m);
 
  out:
 	if (err)
@@ -164,7 +236,7 @@ int mod_add(struct mod **mp, const struct mod_export *me)
 		return EINVAL;
 
 	/* check if already loaded */
-	m = mod_find(me->name);
+	m = lookup(me->name);
 	if (m) {
 		DEBUG_NOTICE("module already loaded: %s\n", me->name);
 		return EALREADY;
@@ -178,8 +250,7 @@ int mod_add(struct mod **mp, const struct mod_export *me)
 
 	m->me = me;
 
-	if (m->me->init)
-		err = m->me->init();
+	err = mod_start(m);
 
 	if (err)
 		mem_deref(m);
@@ -190,6 +261,32 @@ int mod_add(struct mod **mp, const struct mod_export *me)
 }
 
 
+/**
+ * Set the static module table, of modules that are linked into the
+ * application. mod_load() looks up a module in this table before it
+ * tries to load a shared object.
+ *
+ * @param mev NULL-terminated array of module exports, or NULL
+ */
+void mod_static_set(const struct mod_export *const *mev)
+{
+	statv = mev;
+}
+
+
+/**
+ * Enable or disable lazy initialisation of modules. If enabled, the
+ * init handler of a module is called on the first mod_find() of it,
+ * instead of by mod_load() or mod_add().
+ *
+ * @param enable True to enable, false to disable
+ */
+void mod_lazy_enable(bool enable)
+{
+	lazy = enable;
+}
+
+
 /**
  * Get module export from a loadable module
  *
@@ -235,8 +332,10 @@ int mod_debug(struct re_printf *pf, void *unused)
 		const struct mod *m = le->data;
 		const struct mod_export *me = m->me;
 
-		err = re_hprintf(pf, " %16s type=%-12s ref=%u\n",
-				 me->name, me->type, mem_nrefs(m));
+		err = re_hprintf(pf, " %16s type=%-12s ref=%u%s%s\n",
+				 me->name, me->type, mem_nrefs(m),
+				 m->h ? "" : " static",
+				 m->ready ? "" : " (not initialised)");
 	}
 
 	err |= re_hprintf(pf, "\n");
@@ -6,6 +6,10 @@
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
+#if defined (HAVE_EVENTFD) && defined (__ATOMIC_ACQUIRE)
+#include <sys/eventfd.h>
+#define MQUEUE_MPSC 1  /**< Use lock-free queue with eventfd wakeup */
+#endif
 #include <re_types.h>
 #include <re_fmt.h>
 #include <re_mem.h>
@@ -25,6 +29,239 @@
 #endif
 
 
+#ifdef MQUEUE_MPSC
+
+enum {
+	MAX_DRAIN = 4096,  /**< Maximum messages handled per wakeup */
+};
+
+/** Queued message */
+struct mnode {
+	struct mnode *next;     /**< Next node, towards the head       */
+	void *data;             /**< Application data                  */
+	int id;                 /**< General purpose identifier        */
+};
+
+/**
+ * Defines a Thread-safe Message Queue
+ *
+ * The Message Queue can be used to communicate between two threads. The
+ * receiving thread must run the re_main() loop which will be woken up on
+ * incoming messages from other threads. The sender thread can be any thread.
+ *
+ * Messages are linked into a lock-free multi-producer single-consumer
+ * queue. Only the first push after the queue was drained signals the
+ * eventfd, and the receiving thread drains all queued messages at once.
+ */
+struct mqueue {
+	struct mnode *head;     /**< Last pushed node (producers)      */
+	struct mnode *tail;     /**< Next node to pop (consumer)       */
+	struct mnode stub;      /**< Stub node, keeps the queue linked */
+	int signalled;          /**< Wakeup is pending                 */
+	int efd;                /**< eventfd for wakeup                */
+	mqueue_h *h;
+	void *arg;
+};
+
+
+static void node_push(struct mqueue *mq, struct mnode *n)
+{
+	struct mnode *prev;
+
+	__atomic_store_n(&n->next, NULL, __ATOMIC_RELAXED);
+
+	prev = __atomic_exchange_n(&mq->head, n, __ATOMIC_ACQ_REL);
+	__atomic_store_n(&prev->next, n, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Pop the oldest node, or NULL if the queue is empty or a producer is
+ * in the middle of linking a node. The producer signals again when done.
+ */
+static struct mnode *node_pop(struct mqueue *mq)
+{
+	struct mnode *tail = mq->tail;
+	struct mnode *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+	if (tail == &mq->stub) {
+		if (!next)
+			return NULL;
+
+		mq->tail = next;
+		tail = next;
+		next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+	}
+
+	if (next) {
+		mq->tail = next;
+		return tail;
+	}
+
+	if (tail != __atomic_load_n(&mq->head, __ATOMIC_ACQUIRE))
+		return NULL;
+
+	node_push(mq, &mq->stub);
+
+	next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+	if (next) {
+		mq->tail = next;
+		return tail;
+	}
+
+	return NULL;
+}
+
+
+static void destructor(void *arg)
+{
+	struct mqueue *mq = arg;
+	struct mnode *n;
+
+	if (mq->efd >= 0) {
+		fd_close(mq->efd);
+		(void)close(mq->efd);
+	}
+
+	while ((n = node_pop(mq)))
+		mem_deref(n);
+}
+
+
+static void signal_wakeup(struct mqueue *mq)
+{
+	const uint64_t one = 1;
+
+	if (__atomic_exchange_n(&mq->signalled, 1, __ATOMIC_SEQ_CST))
+		return;
+
+	(void)write(mq->efd, &one, sizeof(one));
+}
+
+
+static void event_handler(int flags, void *arg)
+{
+	struct mqueue *mq = arg;
+	struct mnode *n;
+	uint64_t cnt;
+	unsigned i;
+
+	if (!(flags & FD_READ))
+		return;
+
+	if (read(mq->efd, &cnt, sizeof(cnt)) < 0)
+		return;
+
+	/* Pushes from now on must signal again */
+	__atomic_store_n(&mq->signalled, 0, __ATOMIC_SEQ_CST);
+
+	/* The handler may dereference the queue */
+	mem_ref(mq);
+
+	for (i=0; i<MAX_DRAIN; i++) {
+
+		if (mem_nrefs(mq) == 1)
+			break;
+
+		n = node_pop(mq);
+		if (!n)
+			break;
+
+		mq->h(n->id, n->data, mq->arg);
+		mem_deref(n);
+	}
+
+	/* Let the main loop run other handlers before draining the rest */
+	if (i == MAX_DRAIN)
+		signal_wakeup(mq);
+
+	mem_deref(mq);
+}
+
+
+/**
+ * Allocate a new Message Queue
+ *
+ * @param mqp Pointer to allocated Message Queue
+ * @param h   Message handler
+ * @param arg Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int mqueue_alloc(struct mqueue **mqp, mqueue_h *h, void *arg)
+{
+	struct mqueue *mq;
+	int err = 0;
+
+	if (!mqp || !h)
+		return EINVAL;
+
+	mq = mem_zalloc(sizeof(*mq), destructor);
+	if (!mq)
+		return ENOMEM;
+
+	mq->h    = h;
+	mq->arg  = arg;
+	mq->head = &mq->stub;
+	mq->tail = &mq->stub;
+
+	mq->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (mq->efd < 0) {
+		err = errno;
+		goto out;
+	}
+
+	err = fd_listen(mq->efd, FD_READ, event_handler, mq);
+	if (err)
+		goto out;
+
+ out:
+	if (err)
+		mem_deref(mq);
+	else
+		*mqp = mq;
+
+	return err;
+}
+
+
+/**
+ * Push a new message onto the Message Queue
+ *
+ * @param mq   Message Queue
+ * @param id   General purpose Identifier
+ * @param data Application data
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int mqueue_push(struct mqueue *mq, int id, void *data)
+{
+	struct mnode *n;
+	const uint64_t one = 1;
+
+	if (!mq)
+		return EINVAL;
+
+	n = mem_alloc(sizeof(*n), NULL);
+	if (!n)
+		return ENOMEM;
+
+	n->id   = id;
+	n->data = data;
+
+	node_push(mq, n);
+
+	if (__atomic_exchange_n(&mq->signalled, 1, __ATOMIC_SEQ_CST))
+		return 0;
+
+	if (write(mq->efd, &one, sizeof(one)) < 0)
+		return errno;
+
+	return 0;
+}
+
+#else
+
 /**
  * Defines a Thread-safe Message Queue
  *
@@ -166,3 +403,5 @@ int mqueue_push(struct mqueue *mq, int id, void *data)
 
 	return (n != sizeof(msg)) ? EPIPE : 0;
 }
+
+#endif
@@ -8,6 +8,12 @@
 #include <re_msg.h>
 
 
+static inline bool is_lws(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+
 /**
  * Decode a pointer-length string into Content-Type header
  *
@@ -18,21 +24,47 @@
  */
 int msg_ctype_decode(struct msg_ctype *ctype, const struct pl *pl)
 {
-	struct pl ws;
+	const char *p, *end;
 
 	if (!ctype || !pl)
 		return EINVAL;
 
-	if (re_regex(pl->p, pl->l,
-		     "[ \t\r\n]*[^ \t\r\n;/]+[ \t\r\n]*/[ \t\r\n]*[^ \t\r\n;]+"
-		     "[^]*",
-		     &ws, &ctype->type, NULL, NULL, &ctype->subtype,
-		     &ctype->params))
+	/*
+	 * "[ \t\r\n]*[^ \t\r\n;/]+[ \t\r\n]*" "/"
+	 * "[ \t\r\n]*[^ \t\r\n;]+[^]*"
+	 */
+	p   = pl->p;
+	end = pl->p + pl->l;
+
+	while (p < end && is_lws(*p))
+		++p;
+
+	ctype->type.p = p;
+	while (p < end && !is_lws(*p) && *p != ';' && *p != '/')
+		++p;
+	ctype->type.l = p - ctype->type.p;
+
+	while (p < end && is_lws(*p))
+		++p;
+
+	if (!ctype->type.l || p == end || *p != '/')
 		return EBADMSG;
 
-	if (ws.p != pl->p)
+	++p;
+	while (p < end && is_lws(*p))
+		++p;
+
+	ctype->subtype.p = p;
+	while (p < end && !is_lws(*p) && *p != ';')
+		++p;
+	ctype->subtype.l = p - ctype->subtype.p;
+
+	if (!ctype->subtype.l)
 		return EBADMSG;
 
+	ctype->params.p = p;
+	ctype->params.l = end - p;
+
 	return 0;
 }
 
@@ -0,0 +1,464 @@
+/**
+ * @file discover.c  Combined NAT Behaviour Discovery
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <re_types.h>
+#include <re_fmt.h>
+#include <re_mem.h>
+#include <re_mbuf.h>
+#include <re_list.h>
+#include <re_tmr.h>
+#include <re_sa.h>
+#include <re_udp.h>
+#include <re_stun.h>
+#include <re_natbd.h>
+
+
+#define DEBUG_MODULE "natbd_discover"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+/*
+ * The mapping, filtering and hairpinning tests do not depend on each
+ * other, so they are started at the same time, each on its own socket
+ * as RFC 5780 asks for. The lifetime is not searched for one interval
+ * at a time, but probed at several intervals in parallel, every probe
+ * with its own pair of sockets (X and Y) on a shared STUN instance:
+ *
+ *   X: Binding Request -> mapped address, wait the probe interval
+ *   Y: Binding Request with RESPONSE-PORT set to the mapped port of X
+ *
+ * If the response arrives on X, the binding of X was still alive after
+ * the interval. The discovery is thus done after the longest interval,
+ * instead of after the sum of the intervals of a binary search.
+ */
+
+
+enum {
+	PROBE_MAX = 8,
+};
+
+/** Defaults, one transaction times out after 3.5 seconds */
+static const struct stun_conf conf_default = {
+	STUN_DEFAULT_RTO,
+	3,
+	4,
+	STUN_DEFAULT_TI,
+	0x00
+};
+
+enum probe_state {
+	PROBE_IDLE = 0,
+	PROBE_MAPPING,
+	PROBE_WAITING,
+	PROBE_PROBING,
+	PROBE_ALIVE,
+	PROBE_EXPIRED,
+	PROBE_FAILED,
+};
+
+struct nat_discovery;
+
+/** Lifetime probe at one interval */
+struct probe {
+	struct nat_discovery *nd;   /**< Parent discovery session     */
+	struct stun_ctrans *ct;     /**< Pending STUN transaction     */
+	struct udp_sock *us_x;      /**< Socket of the tested binding */
+	struct udp_sock *us_y;      /**< Socket of the probe request  */
+	struct sa map;              /**< Mapped address of X          */
+	struct tmr tmr;             /**< Interval timer               */
+	uint32_t interval;          /**< Probe interval in [seconds]  */
+	enum probe_state state;     /**< Probe state                  */
+};
+
+/** Defines a combined NAT Behaviour Discovery session */
+struct nat_discovery {
+	struct nat_mapping *nm;
+	struct nat_filtering *nf;
+	struct nat_hairpinning *nh;
+	struct stun *stun;                     /**< STUN for the probes  */
+	struct sa srv;                         /**< Server address/port  */
+	struct probe probev[PROBE_MAX];        /**< Lifetime probes      */
+	uint32_t probec;                       /**< Number of probes     */
+	uint32_t pending;                      /**< Unfinished tests     */
+	bool map_done;
+	bool filt_done;
+	bool hp_done;
+	struct nat_discovery_result res;       /**< Results so far       */
+	nat_discovery_h *dh;                   /**< Result handler       */
+	void *arg;                             /**< Handler argument     */
+};
+
+
+static void test_done(struct nat_discovery *nd)
+{
+	if (!nd->pending || --nd->pending)
+		return;
+
+	nd->dh(&nd->res, nd->arg);
+}
+
+
+static void mapping_handler(int err, enum nat_type map, void *arg)
+{
+	struct nat_discovery *nd = arg;
+
+	if (nd->map_done)
+		return;
+
+	nd->map_done = true;
+	nd->res.maperr  = err;
+	nd->res.mapping = map;
+
+	test_done(nd);
+}
+
+
+static void filtering_handler(int err, enum nat_type filt, void *arg)
+{
+	struct nat_discovery *nd = arg;
+
+	if (nd->filt_done)
+		return;
+
+	nd->filt_done = true;
+	nd->res.filterr   = err;
+	nd->res.filtering = filt;
+
+	test_done(nd);
+}
+
+
+static void hairpinning_handler(int err, bool supported, void *arg)
+{
+	struct nat_discovery *nd = arg;
+
+	if (nd->hp_done)
+		return;
+
+	nd->hp_done = true;
+	nd->res.hperr       = err;
+	nd->res.hairpinning = supported;
+
+	test_done(nd);
+}
+
+
+/* The longest alive interval below the shortest expired interval */
+static void lifetime_result(struct nat_discovery *nd)
+{
+	struct nat_lifetime_interval *li = &nd->res.lifetime;
+	bool alive = false;
+	uint32_t i;
+
+	li->min = 1;
+	li->max = 0;
+
+	for (i=0; i<nd->probec; i++) {
+
+		const struct probe *p = &nd->probev[i];
+
+		if (p->state != PROBE_EXPIRED)
+			continue;
+
+		if (!li->max || p->interval < li->max)
+			li->max = p->interval;
+	}
+
+	for (i=0; i<nd->probec; i++) {
+
+		const struct probe *p = &nd->probev[i];
+
+		if (p->state != PROBE_ALIVE)
+			continue;
+
+		alive = true;
+
+		if (li->max && p->interval >= li->max)
+			continue;
+
+		li->min = max(li->min, p->interval);
+	}
+
+	li->cur = li->max ? (li->min + li->max) / 2 : li->min;
+
+	if (!alive && !li->max)
+		nd->res.lterr = ETIMEDOUT;
+}
+
+
+static void probe_done(struct probe *p, enum probe_state state)
+{
+	struct nat_discovery *nd = p->nd;
+	uint32_t i;
+
+	if (p->state >= PROBE_ALIVE)
+		return;
+
+	p->state = state;
+	tmr_cancel(&p->tmr);
+	p->ct = mem_deref(p->ct);
+
+	for (i=0; i<nd->probec; i++) {
+		if (nd->probev[i].state < PROBE_ALIVE)
+			return;
+	}
+
+	lifetime_result(nd);
+	test_done(nd);
+}
+
+
+static void udp_recv_handler_x(const struct sa *src, struct mbuf *mb,
+			       void *arg)
+{
+	struct probe *p = arg;
+	int err;
+	(void)src;
+
+	err = stun_recv(p->nd->stun, mb);
+	if (err && ENOENT != err) {
+		DEBUG_WARNING("probe: stun_recv(): (%m)\n", err);
+	}
+}
+
+
+static void udp_recv_handler_y(const struct sa *src, struct mbuf *mb,
+			       void *arg)
+{
+	struct probe *p = arg;
+	(void)src;
+	(void)mb;
+
+	/* The response came back on Y, not on the binding of X */
+	if (p->state == PROBE_PROBING)
+		probe_done(p, PROBE_EXPIRED);
+}
+
+
+static void probe_response_handler(int err, uint16_t scode,
+				   const char *reason,
+				   const struct stun_msg *msg, void *arg)
+{
+	struct probe *p = arg;
+	(void)reason;
+	(void)msg;
+
+	if (err)
+		probe_done(p, PROBE_EXPIRED);
+	else
+		probe_done(p, scode ? PROBE_FAILED : PROBE_ALIVE);
+}
+
+
+static void probe_timeout(void *arg)
+{
+	struct probe *p = arg;
+	const uint16_t rp = sa_port(&p->map);
+	int err;
+
+	p->state = PROBE_PROBING;
+
+	err = stun_request(&p->ct, p->nd->stun, IPPROTO_UDP, p->us_y,
+			   &p->nd->srv, 0, STUN_METHOD_BINDING, NULL, 0,
+			   false, probe_response_handler, p, 2,
+			   STUN_ATTR_RESP_PORT, &rp,
+			   STUN_ATTR_SOFTWARE, stun_software);
+	if (err) {
+		DEBUG_WARNING("probe %us: stun_request: (%m)\n",
+			      p->interval, err);
+		probe_done(p, PROBE_FAILED);
+	}
+}
+
+
+static void mapped_handler(int err, uint16_t scode, const char *reason,
+			   const struct stun_msg *msg, void *arg)
+{
+	struct probe *p = arg;
+	struct stun_attr *attr;
+	(void)reason;
+
+	attr = stun_msg_attr(msg, STUN_ATTR_XOR_MAPPED_ADDR);
+	if (err || scode || !attr) {
+		probe_done(p, PROBE_FAILED);
+		return;
+	}
+
+	p->map   = attr->v.xor_mapped_addr;
+	p->state = PROBE_WAITING;
+
+	tmr_start(&p->tmr, p->interval * 1000, probe_timeout, p);
+}
+
+
+static int probe_alloc(struct probe *p, struct nat_discovery *nd,
+		       uint32_t interval)
+{
+	int err;
+
+	p->nd = nd;
+	p->interval = interval;
+	tmr_init(&p->tmr);
+
+	err = udp_listen(&p->us_x, NULL, udp_recv_handler_x, p);
+	if (err)
+		return err;
+
+	return udp_listen(&p->us_y, NULL, udp_recv_handler_y, p);
+}
+
+
+static int probe_start(struct probe *p)
+{
+	p->state = PROBE_MAPPING;
+
+	return stun_request(&p->ct, p->nd->stun, IPPROTO_UDP, p->us_x,
+			    &p->nd->srv, 0, STUN_METHOD_BINDING, NULL, 0,
+			    false, mapped_handler, p, 1,
+			    STUN_ATTR_SOFTWARE, stun_software);
+}
+
+
+static void discovery_destructor(void *data)
+{
+	struct nat_discovery *nd = data;
+	uint32_t i;
+
+	for (i=0; i<nd->probec; i++) {
+
+		struct probe *p = &nd->probev[i];
+
+		tmr_cancel(&p->tmr);
+		mem_deref(p->ct);
+		mem_deref(p->us_x);
+		mem_deref(p->us_y);
+	}
+
+	mem_deref(nd->nm);
+	mem_deref(nd->nf);
+	mem_deref(nd->nh);
+	mem_deref(nd->stun);
+}
+
+
+/**
+ * Allocate a combined NAT Behaviour Discovery session, which runs the
+ * mapping, filtering, hairpinning and (optionally) lifetime tests in
+ * parallel over UDP
+ *
+ * @param ndp       Pointer to allocated NAT Discovery object
+ * @param laddr     Local IP address
+ * @param srv       STUN Server IP address and port number
+ * @param lifetime  Longest binding lifetime to probe in [seconds],
+ *                  or 0 to skip the lifetime test
+ * @param conf      STUN configuration (Optional)
+ * @param dh        Result handler - called once, when all tests are done
+ * @param arg       Handler argument
+ *
+ * @return 0 if success, errorcode if failure
+ *
+ * @note The lifetime probes are spread out by halving the interval,
+ *       from the given lifetime down to 1 second
+ */
+int nat_discovery_alloc(struct nat_discovery **ndp, const struct sa *laddr,
+			const struct sa *srv, uint32_t lifetime,
+			const struct stun_conf *conf,
+			nat_discovery_h *dh, void *arg)
+{
+	struct nat_discovery *nd;
+	uint32_t ival;
+	int err;
+
+	if (!ndp || !laddr || !srv || !dh)
+		return EINVAL;
+
+	nd = mem_zalloc(sizeof(*nd), discovery_destructor);
+	if (!nd)
+		return ENOMEM;
+
+	if (!conf)
+		conf = &conf_default;
+
+	sa_cpy(&nd->srv, srv);
+
+	err = nat_mapping_alloc(&nd->nm, laddr, srv, IPPROTO_UDP, conf,
+				mapping_handler, nd);
+	if (err)
+		goto out;
+
+	err = nat_filtering_alloc(&nd->nf, srv, conf, filtering_handler, nd);
+	if (err)
+		goto out;
+
+	err = nat_hairpinning_alloc(&nd->nh, srv, IPPROTO_UDP, conf,
+				    hairpinning_handler, nd);
+	if (err)
+		goto out;
+
+	if (lifetime) {
+		err = stun_alloc(&nd->stun, conf, NULL, NULL);
+		if (err)
+			goto out;
+	}
+
+	for (ival = lifetime; ival && nd->probec < PROBE_MAX; ival /= 2) {
+
+		err = probe_alloc(&nd->probev[nd->probec++], nd, ival);
+		if (err)
+			goto out;
+	}
+
+	nd->dh  = dh;
+	nd->arg = arg;
+
+ out:
+	if (err)
+		mem_deref(nd);
+	else
+		*ndp = nd;
+
+	return err;
+}
+
+
+/**
+ * Start a combined NAT Behaviour Discovery session
+ *
+ * @param nd NAT Discovery object
+ *
+ * @return 0 if success, errorcode if failure
+ */
+int nat_discovery_start(struct nat_discovery *nd)
+{
+	uint32_t i;
+	int err;
+
+	if (!nd)
+		return EINVAL;
+
+	nd->pending = 3 + (nd->probec ? 1 : 0);
+
+	err = nat_mapping_start(nd->nm);
+	if (err)
+		goto out;
+
+	err = nat_filtering_start(nd->nf);
+	if (err)
+		goto out;
+
+	err = nat_hairpinning_start(nd->nh);
+	if (err)
+		goto out;
+
+	for (i=0; i<nd->probec && !err; i++)
+		err = probe_start(&nd->probev[i]);
+
+ out:
+	if (err)
+		nd->pending = 0;
+
+	return err;
+}
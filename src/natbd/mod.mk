@@ -4,6 +4,7 @@
 # Copyright (C) 2010 Creytiv.com
 #
 
+SRCS	+= natbd/discover.c
 SRCS	+= natbd/filtering.c
 SRCS	+= natbd/genalg.c
 SRCS	+= natbd/hairpinning.c
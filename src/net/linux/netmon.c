@@ -0,0 +1,445 @@
+/**
+ * @file linux/netmon.c  Network change monitor and cache. See rtnetlink(7)
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#define _BSD_SOURCE 1
+#define _DEFAULT_SOURCE 1
+#include <string.h>
+#include <unistd.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#define __USE_MISC 1
+#include <net/if.h>
+#undef __STRICT_ANSI__
+#include <linux/types.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <re_types.h>
+#include <re_fmt.h>
+#include <re_mem.h>
+#include <re_mbuf.h>
+#include <re_list.h>
+#include <re_tmr.h>
+#include <re_main.h>
+#include <re_sa.h>
+#include <re_net.h>
+#include "../net.h"
+
+
+#define DEBUG_MODULE "netmon"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+/*
+ * While a network monitor exists, the interface addresses and routes
+ * are kept in a snapshot, which net_if_apply() and net_rt_list() use
+ * instead of asking the kernel. A netlink socket that is subscribed to
+ * link, address and route changes marks the snapshot stale, and after a
+ * short delay, which merges bursts of changes, it is built again and the
+ * change handlers are called.
+ *
+ * The snapshot is immutable once built and has an atomic reference
+ * count, so other threads can use it while it is replaced.
+ */
+
+
+/* Override macro to avoid casting alignment warning */
+#undef NLMSG_NEXT
+#define NLMSG_NEXT(nlh, len) ((len) -= NLMSG_ALIGN((nlh)->nlmsg_len), \
+		(void *)(((char *)(nlh)) + NLMSG_ALIGN((nlh)->nlmsg_len)))
+
+
+enum {
+	NETMON_DELAY = 50,      /**< Change merge delay in [ms] */
+	NETMON_BUFSZ = 8192,
+};
+
+
+/** Defines an interface address of the snapshot */
+struct net_ifent {
+	char ifname[IFNAMSIZ];
+	struct sa addr;
+};
+
+/** Defines a route of the snapshot */
+struct net_rtent {
+	char ifname[IFNAMSIZ];
+	struct sa dst;
+	int dstlen;
+	struct sa gw;
+};
+
+/** Defines a snapshot of the interface addresses and routes */
+struct net_snap {
+	struct net_ifent *ifv;
+	size_t ifc;
+	struct net_rtent *rtv;
+	size_t rtc;
+};
+
+/** Defines a network monitor */
+struct net_mon {
+	struct tmr tmr;
+	int fd;
+	net_change_h *changeh;
+	void *arg;
+};
+
+
+static struct {
+	struct net_snap *snap;
+	unsigned monc;
+} netmon;
+
+
+#ifdef HAVE_PTHREAD
+
+static pthread_mutex_t netmon_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+static inline void netmon_lock(void)
+{
+	pthread_mutex_lock(&netmon_mutex);
+}
+
+
+static inline void netmon_unlock(void)
+{
+	pthread_mutex_unlock(&netmon_mutex);
+}
+
+#else
+
+#define netmon_lock()    /**< Stub */
+#define netmon_unlock()  /**< Stub */
+
+#endif
+
+
+static void snap_destructor(void *data)
+{
+	struct net_snap *snap = data;
+
+	mem_deref(snap->ifv);
+	mem_deref(snap->rtv);
+}
+
+
+static bool snap_if_handler(const char *ifname, const struct sa *sa,
+			    void *arg)
+{
+	struct net_snap *snap = arg;
+	struct net_ifent *ent, *ifv;
+
+	ifv = mem_reallocarray(snap->ifv, snap->ifc + 1, sizeof(*ifv), NULL);
+	if (!ifv)
+		return true;
+
+	snap->ifv = ifv;
+	ent = &ifv[snap->ifc++];
+
+	str_ncpy(ent->ifname, ifname, sizeof(ent->ifname));
+	ent->addr = *sa;
+
+	return false;
+}
+
+
+static bool snap_rt_handler(const char *ifname, const struct sa *dst,
+			    int dstlen, const struct sa *gw, void *arg)
+{
+	struct net_snap *snap = arg;
+	struct net_rtent *ent, *rtv;
+
+	rtv = mem_reallocarray(snap->rtv, snap->rtc + 1, sizeof(*rtv), NULL);
+	if (!rtv)
+		return true;
+
+	snap->rtv = rtv;
+	ent = &rtv[snap->rtc++];
+
+	str_ncpy(ent->ifname, ifname, sizeof(ent->ifname));
+	ent->dst    = *dst;
+	ent->dstlen = dstlen;
+	ent->gw     = *gw;
+
+	return false;
+}
+
+
+static int snap_build(void)
+{
+	struct net_snap *snap, *old;
+	int err;
+
+	snap = mem_alloc_shared(sizeof(*snap), snap_destructor);
+	if (!snap)
+		return ENOMEM;
+
+	memset(snap, 0, sizeof(*snap));
+
+#ifdef HAVE_GETIFADDRS
+	err = net_getifaddrs(snap_if_handler, snap);
+#else
+	err = net_if_list(snap_if_handler, snap);
+#endif
+	if (err)
+		goto out;
+
+	err = net_rt_dump(snap_rt_handler, snap);
+	if (err)
+		goto out;
+
+	netmon_lock();
+	if (netmon.monc) {
+		old = netmon.snap;
+		netmon.snap = snap;
+	}
+	else {
+		/* the last monitor is gone */
+		old = snap;
+	}
+	netmon_unlock();
+
+	mem_deref(old);
+
+	return 0;
+
+ out:
+	mem_deref(snap);
+	return err;
+}
+
+
+static struct net_snap *snap_get(void)
+{
+	struct net_snap *snap;
+
+	netmon_lock();
+	snap = mem_ref(netmon.snap);
+	netmon_unlock();
+
+	return snap;
+}
+
+
+static void tmr_handler(void *arg)
+{
+	struct net_mon *nm = arg;
+	int err;
+
+	err = snap_build();
+	if (err) {
+		DEBUG_WARNING("could not update the network cache (%m)\n",
+			      err);
+	}
+
+	if (nm->changeh)
+		nm->changeh(nm->arg);
+}
+
+
+static bool is_change(uint16_t type)
+{
+	switch (type) {
+
+	case RTM_NEWLINK:
+	case RTM_DELLINK:
+	case RTM_NEWADDR:
+	case RTM_DELADDR:
+	case RTM_NEWROUTE:
+	case RTM_DELROUTE:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+
+static void read_handler(int flags, void *arg)
+{
+	struct net_mon *nm = arg;
+	union {
+		uint8_t buf[NETMON_BUFSZ];
+		struct nlmsghdr msg[1];
+	} u;
+	bool change = false;
+
+	(void)flags;
+
+	for (;;) {
+
+		const struct nlmsghdr *nlh = u.msg;
+		int len = (int)recv(nm->fd, u.buf, sizeof(u.buf), 0);
+
+		if (len < 0) {
+			/* the kernel dropped notifications */
+			if (errno == ENOBUFS)
+				change = true;
+
+			break;
+		}
+
+		for (; NLMSG_OK(nlh, (uint32_t)len);
+		     nlh = NLMSG_NEXT(nlh, len)) {
+
+			if (is_change(nlh->nlmsg_type))
+				change = true;
+		}
+	}
+
+	if (change && !tmr_isrunning(&nm->tmr))
+		tmr_start(&nm->tmr, NETMON_DELAY, tmr_handler, nm);
+}
+
+
+static void destructor(void *data)
+{
+	struct net_mon *nm = data;
+	struct net_snap *old = NULL;
+
+	tmr_cancel(&nm->tmr);
+
+	if (nm->fd >= 0) {
+		fd_close(nm->fd);
+		(void)close(nm->fd);
+	}
+
+	netmon_lock();
+	if (nm->fd >= 0 && !--netmon.monc) {
+		old = netmon.snap;
+		netmon.snap = NULL;
+	}
+	netmon_unlock();
+
+	mem_deref(old);
+}
+
+
+/**
+ * Allocate a network monitor. While a monitor exists, net_if_apply() and
+ * net_rt_list() are served from a cache, which the monitor keeps up to
+ * date from kernel notifications. The monitor is polled by the main loop
+ * of the calling thread.
+ *
+ * @param nmp     Pointer to allocated network monitor
+ * @param changeh Optional handler, called after the network changed
+ * @param arg     Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int net_mon_alloc(struct net_mon **nmp, net_change_h *changeh, void *arg)
+{
+	struct sockaddr_nl snl;
+	struct net_mon *nm;
+	int err = 0;
+
+	if (!nmp)
+		return EINVAL;
+
+	nm = mem_zalloc(sizeof(*nm), destructor);
+	if (!nm)
+		return ENOMEM;
+
+	tmr_init(&nm->tmr);
+	nm->changeh = changeh;
+	nm->arg     = arg;
+
+	nm->fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+	if (nm->fd < 0) {
+		err = errno;
+		goto out;
+	}
+
+	memset(&snl, 0, sizeof(snl));
+	snl.nl_family = AF_NETLINK;
+	snl.nl_groups = RTMGRP_LINK |
+		RTMGRP_IPV4_IFADDR | RTMGRP_IPV4_ROUTE |
+		RTMGRP_IPV6_IFADDR | RTMGRP_IPV6_ROUTE;
+
+	if (bind(nm->fd, (struct sockaddr *)&snl, sizeof(snl)) < 0) {
+		err = errno;
+		goto close;
+	}
+
+	err = net_sockopt_blocking_set(nm->fd, false);
+	if (err)
+		goto close;
+
+	err = fd_listen(nm->fd, FD_READ, read_handler, nm);
+	if (err)
+		goto close;
+
+	netmon_lock();
+	++netmon.monc;
+	netmon_unlock();
+
+	/* subscribed first, so that no change is missed */
+	err = snap_build();
+
+	goto out;
+
+ close:
+	(void)close(nm->fd);
+	nm->fd = -1;
+
+ out:
+	if (err) {
+		DEBUG_WARNING("alloc: %m\n", err);
+		mem_deref(nm);
+	}
+	else
+		*nmp = nm;
+
+	return err;
+}
+
+
+/* Apply a handler to the cached interface addresses, ENOENT if none */
+int net_mon_if_apply(net_ifaddr_h *ifh, void *arg)
+{
+	struct net_snap *snap = snap_get();
+	size_t i;
+
+	if (!snap)
+		return ENOENT;
+
+	for (i=0; i<snap->ifc; i++) {
+
+		const struct net_ifent *ent = &snap->ifv[i];
+
+		if (ifh(ent->ifname, &ent->addr, arg))
+			break;
+	}
+
+	mem_deref(snap);
+
+	return 0;
+}
+
+
+/* Apply a handler to the cached routes, ENOENT if none */
+int net_mon_rt_apply(net_rt_h *rth, void *arg)
+{
+	struct net_snap *snap = snap_get();
+	size_t i;
+
+	if (!snap)
+		return ENOENT;
+
+	for (i=0; i<snap->rtc; i++) {
+
+		const struct net_rtent *ent = &snap->rtv[i];
+
+		if (rth(ent->ifname, &ent->dst, ent->dstlen, &ent->gw, arg))
+			break;
+	}
+
+	mem_deref(snap);
+
+	return 0;
+}
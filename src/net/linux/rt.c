@@ -20,6 +20,7 @@
 #include <re_fmt.h>
 #include <re_sa.h>
 #include <re_net.h>
+#include "../net.h"
 
 
 #define DEBUG_MODULE "linuxrt"
@@ -175,15 +176,8 @@ static int rt_parse(const struct nlmsghdr *nlhdr, struct net_rt *rt)
 }
 
 
-/**
- * List all entries in the routing table
- *
- * @param rth Route entry handler
- * @param arg Handler argument
- *
- * @return 0 if success, otherwise errorcode
- */
-int net_rt_list(net_rt_h *rth, void *arg)
+/* Get all entries of the routing table from the kernel */
+int net_rt_dump(net_rt_h *rth, void *arg)
 {
 	union {
 		uint8_t buf[BUFSIZE];
@@ -251,3 +245,23 @@ int net_rt_list(net_rt_h *rth, void *arg)
 
 	return err;
 }
+
+
+/**
+ * List all entries in the routing table
+ *
+ * @param rth Route entry handler
+ * @param arg Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int net_rt_list(net_rt_h *rth, void *arg)
+{
+	if (!rth)
+		return EINVAL;
+
+	if (!net_mon_rt_apply(rth, arg))
+		return 0;
+
+	return net_rt_dump(rth, arg);
+}
@@ -23,8 +23,10 @@ endif
 
 # Routing
 ifeq ($(OS),linux)
+SRCS	+= net/linux/netmon.c
 SRCS	+= net/linux/rt.c
 CFLAGS  += -DHAVE_ROUTE_LIST
+CFLAGS  += -DHAVE_NET_MON
 else
 
 ifneq ($(HAVE_SYS_SYSCTL_H),)
@@ -17,6 +17,7 @@
 #include <re_mbuf.h>
 #include <re_sa.h>
 #include <re_net.h>
+#include "net.h"
 
 
 #define DEBUG_MODULE "net"
@@ -100,6 +101,11 @@ int net_default_source_addr_get(int af, struct sa *ip)
  */
 int net_if_apply(net_ifaddr_h *ifh, void *arg)
 {
+#ifdef HAVE_NET_MON
+	if (ifh && !net_mon_if_apply(ifh, arg))
+		return 0;
+#endif
+
 #ifdef HAVE_GETIFADDRS
 	return net_getifaddrs(ifh, arg);
 #else
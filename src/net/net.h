@@ -0,0 +1,10 @@
+/**
+ * @file net.h  Networking -- Internal API
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+
+int net_rt_dump(net_rt_h *rth, void *arg);
+int net_mon_if_apply(net_ifaddr_h *ifh, void *arg);
+int net_mon_rt_apply(net_rt_h *rth, void *arg);
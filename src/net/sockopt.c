@@ -12,6 +12,32 @@
 #include <re_net.h>
 
 
+/* SO_REUSEPORT is not exported by glibc in strict C99 mode */
+#if defined (SO_REUSEPORT)
+#define SOCKOPT_REUSEPORT SO_REUSEPORT
+#elif defined (LINUX)
+#define SOCKOPT_REUSEPORT 15
+#endif
+
+#if defined (SO_INCOMING_CPU)
+#define SOCKOPT_INCOMING_CPU SO_INCOMING_CPU
+#elif defined (LINUX)
+#define SOCKOPT_INCOMING_CPU 49
+#endif
+
+#if defined (SO_BUSY_POLL)
+#define SOCKOPT_BUSY_POLL SO_BUSY_POLL
+#elif defined (LINUX)
+#define SOCKOPT_BUSY_POLL 46
+#endif
+
+#if defined (SO_PREFER_BUSY_POLL)
+#define SOCKOPT_PREFER_BUSY_POLL SO_PREFER_BUSY_POLL
+#elif defined (LINUX)
+#define SOCKOPT_PREFER_BUSY_POLL 69
+#endif
+
+
 #define DEBUG_MODULE "sockopt"
 #define DEBUG_LEVEL 5
 #include <re_dbg.h>
@@ -110,3 +136,100 @@ int net_sockopt_reuse_set(int fd, bool reuse)
 	return 0;
 #endif
 }
+
+
+/**
+ * Set socket option to share the local port between several sockets,
+ * with the kernel distributing the incoming traffic between them
+ *
+ * @param fd     Socket file descriptor
+ * @param reuse  true for reuse, false for no reuse
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int net_sockopt_reuseport_set(int fd, bool reuse)
+{
+#ifdef SOCKOPT_REUSEPORT
+	int r = reuse;
+
+	if (-1 == setsockopt(fd, SOL_SOCKET, SOCKOPT_REUSEPORT,
+			     BUF_CAST &r, sizeof(r))) {
+		DEBUG_WARNING("SO_REUSEPORT: %m\n", errno);
+		return errno;
+	}
+
+	return 0;
+#else
+	(void)fd;
+	(void)reuse;
+	return ENOSYS;
+#endif
+}
+
+
+/**
+ * Set the CPU that a socket prefers to be served on (SO_INCOMING_CPU).
+ * Of a group of sockets that share a port, the kernel prefers the socket
+ * whose CPU handles the incoming packet, e.g. the CPU of its RSS queue.
+ *
+ * @param fd  Socket file descriptor
+ * @param cpu CPU number
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int net_sockopt_incoming_cpu_set(int fd, int cpu)
+{
+#ifdef SOCKOPT_INCOMING_CPU
+	if (-1 == setsockopt(fd, SOL_SOCKET, SOCKOPT_INCOMING_CPU,
+			     BUF_CAST &cpu, sizeof(cpu))) {
+		DEBUG_WARNING("SO_INCOMING_CPU: %m\n", errno);
+		return errno;
+	}
+
+	return 0;
+#else
+	(void)fd;
+	(void)cpu;
+	return ENOSYS;
+#endif
+}
+
+
+/**
+ * Set the busy-poll time of a socket (SO_BUSY_POLL), and prefer busy
+ * polling to interrupts (SO_PREFER_BUSY_POLL) if supported. A blocking
+ * receive then polls the device queue for up to usec before it sleeps.
+ * Raising the time above net.core.busy_read needs CAP_NET_ADMIN.
+ *
+ * @param fd   Socket file descriptor
+ * @param usec Busy-poll time in [us], 0 to disable
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int net_sockopt_busy_poll_set(int fd, uint32_t usec)
+{
+#ifdef SOCKOPT_BUSY_POLL
+	int val = (int)usec;
+	int prefer = usec ? 1 : 0;
+
+	if (-1 == setsockopt(fd, SOL_SOCKET, SOCKOPT_BUSY_POLL,
+			     BUF_CAST &val, sizeof(val))) {
+		DEBUG_INFO("SO_BUSY_POLL: %m\n", errno);
+		return errno;
+	}
+
+#ifdef SOCKOPT_PREFER_BUSY_POLL
+	/* Linux 5.11 and later */
+	(void)setsockopt(fd, SOL_SOCKET, SOCKOPT_PREFER_BUSY_POLL,
+			 BUF_CAST &prefer, sizeof(prefer));
+#else
+	(void)prefer;
+#endif
+
+	return 0;
+#else
+	(void)fd;
+	(void)usec;
+	return ENOSYS;
+#endif
+}
@@ -37,6 +37,27 @@ static void destructor(void *arg)
 }
 
 
+/* Move the entries to a hash table when the dictionary is not small */
+static int hash_grow(struct odict *o)
+{
+	struct le *le;
+	int err;
+
+	err = hash_alloc(&o->ht, o->hsize);
+	if (err)
+		return err;
+
+	for (le=o->lst.head; le; le=le->next) {
+
+		struct odict_entry *e = le->data;
+
+		hash_append(o->ht, hash_fast_str(e->key), &e->he, e);
+	}
+
+	return 0;
+}
+
+
 int odict_entry_add(struct odict *o, const char *key,
 		    int type, ...)
 {
@@ -95,8 +116,15 @@ int odict_entry_add(struct odict *o, const char *key,
 	if (err)
 		goto out;
 
+	if (!o->ht && list_count(&o->lst) >= ODICT_SMALL) {
+		err = hash_grow(o);
+		if (err)
+			goto out;
+	}
+
 	list_append(&o->lst, &e->le, e);
-	hash_append(o->ht, hash_fast_str(e->key), &e->he, e);
+	if (o->ht)
+		hash_append(o->ht, hash_fast_str(e->key), &e->he, e);
 
  out:
 	if (err)
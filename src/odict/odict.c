@@ -21,10 +21,19 @@ static void destructor(void *arg)
 }
 
 
+/**
+ * Allocate an ordered dictionary. The hash table is only allocated when
+ * the dictionary grows above ODICT_SMALL entries, a smaller one is looked
+ * up linearly.
+ *
+ * @param op        Pointer to allocated dictionary
+ * @param hash_size Size of the hash table
+ *
+ * @return 0 if success, otherwise errorcode
+ */
 int odict_alloc(struct odict **op, uint32_t hash_size)
 {
 	struct odict *o;
-	int err;
 
 	if (!op || !hash_size)
 		return EINVAL;
@@ -33,17 +42,11 @@ int odict_alloc(struct odict **op, uint32_t hash_size)
 	if (!o)
 		return ENOMEM;
 
-	err = hash_alloc(&o->ht, hash_valid_size(hash_size));
-	if (err)
-		goto out;
+	o->hsize = hash_valid_size(hash_size);
 
- out:
-	if (err)
-		mem_deref(o);
-	else
-		*op = o;
+	*op = o;
 
-	return err;
+	return 0;
 }
 
 
@@ -54,7 +57,10 @@ const struct odict_entry *odict_lookup(const struct odict *o, const char *key)
 	if (!o || !key)
 		return NULL;
 
-	le = list_head(hash_list(o->ht, hash_fast_str(key)));
+	if (o->ht)
+		le = list_head(hash_list(o->ht, hash_fast_str(key)));
+	else
+		le = list_head(&o->lst);
 
 	while (le) {
 		const struct odict_entry *e = le->data;
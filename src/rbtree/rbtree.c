@@ -0,0 +1,582 @@
+/**
+ * @file rbtree.c  Red-black tree implementation
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <re_types.h>
+#include <re_mem.h>
+#include <re_rbtree.h>
+
+
+#define DEBUG_MODULE "rbtree"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+/*
+ * The nodes are embedded in the user-data, like list elements, so the
+ * tree does not allocate any memory. Nodes that compare equal are kept in
+ * the order they were inserted. Insert, unlink and find are O(log n),
+ * and getting the next or previous node is O(1) on average.
+ */
+
+
+static inline bool is_red(const struct rbnode *node)
+{
+	return node && node->red;
+}
+
+
+static void replace_child(struct rbtree *tree, struct rbnode *old,
+			  struct rbnode *node)
+{
+	struct rbnode *parent = old->parent;
+
+	if (!parent)
+		tree->root = node;
+	else if (parent->left == old)
+		parent->left = node;
+	else
+		parent->right = node;
+}
+
+
+static void rotate_left(struct rbtree *tree, struct rbnode *x)
+{
+	struct rbnode *y = x->right;
+
+	x->right = y->left;
+	if (y->left)
+		y->left->parent = x;
+
+	y->parent = x->parent;
+	replace_child(tree, x, y);
+
+	y->left = x;
+	x->parent = y;
+}
+
+
+static void rotate_right(struct rbtree *tree, struct rbnode *x)
+{
+	struct rbnode *y = x->left;
+
+	x->left = y->right;
+	if (y->right)
+		y->right->parent = x;
+
+	y->parent = x->parent;
+	replace_child(tree, x, y);
+
+	y->right = x;
+	x->parent = y;
+}
+
+
+static void insert_fixup(struct rbtree *tree, struct rbnode *node)
+{
+	struct rbnode *parent, *gparent, *uncle;
+
+	while ((parent = node->parent) && parent->red) {
+
+		/* a red node is never the root */
+		gparent = parent->parent;
+
+		if (parent == gparent->left) {
+
+			uncle = gparent->right;
+
+			if (is_red(uncle)) {
+				parent->red = false;
+				uncle->red  = false;
+				gparent->red = true;
+				node = gparent;
+				continue;
+			}
+
+			if (node == parent->right) {
+				rotate_left(tree, parent);
+				node = parent;
+				parent = node->parent;
+			}
+
+			parent->red  = false;
+			gparent->red = true;
+			rotate_right(tree, gparent);
+		}
+		else {
+			uncle = gparent->left;
+
+			if (is_red(uncle)) {
+				parent->red = false;
+				uncle->red  = false;
+				gparent->red = true;
+				node = gparent;
+				continue;
+			}
+
+			if (node == parent->left) {
+				rotate_right(tree, parent);
+				node = parent;
+				parent = node->parent;
+			}
+
+			parent->red  = false;
+			gparent->red = true;
+			rotate_left(tree, gparent);
+		}
+	}
+
+	tree->root->red = false;
+}
+
+
+/* Node is the child that replaced a black node, and may be NULL */
+static void unlink_fixup(struct rbtree *tree, struct rbnode *node,
+			 struct rbnode *parent)
+{
+	struct rbnode *sib;
+
+	while (node != tree->root && !is_red(node)) {
+
+		if (node == parent->left) {
+
+			sib = parent->right;
+
+			if (sib->red) {
+				sib->red = false;
+				parent->red = true;
+				rotate_left(tree, parent);
+				sib = parent->right;
+			}
+
+			if (!is_red(sib->left) && !is_red(sib->right)) {
+				sib->red = true;
+				node = parent;
+				parent = node->parent;
+				continue;
+			}
+
+			if (!is_red(sib->right)) {
+				sib->left->red = false;
+				sib->red = true;
+				rotate_right(tree, sib);
+				sib = parent->right;
+			}
+
+			sib->red = parent->red;
+			parent->red = false;
+			sib->right->red = false;
+			rotate_left(tree, parent);
+		}
+		else {
+			sib = parent->left;
+
+			if (sib->red) {
+				sib->red = false;
+				parent->red = true;
+				rotate_right(tree, parent);
+				sib = parent->left;
+			}
+
+			if (!is_red(sib->left) && !is_red(sib->right)) {
+				sib->red = true;
+				node = parent;
+				parent = node->parent;
+				continue;
+			}
+
+			if (!is_red(sib->left)) {
+				sib->right->red = false;
+				sib->red = true;
+				rotate_left(tree, sib);
+				sib = parent->left;
+			}
+
+			sib->red = parent->red;
+			parent->red = false;
+			sib->left->red = false;
+			rotate_right(tree, parent);
+		}
+
+		node = tree->root;
+	}
+
+	if (node)
+		node->red = false;
+}
+
+
+static void tree_detach(struct rbtree *tree, bool flush)
+{
+	struct rbnode *node;
+
+	if (!tree)
+		return;
+
+	node = tree->root;
+	rbtree_init(tree);
+
+	/* post-order, so a node is detached after its children */
+	while (node) {
+
+		struct rbnode *parent;
+		void *data;
+
+		if (node->left) {
+			node = node->left;
+			continue;
+		}
+
+		if (node->right) {
+			node = node->right;
+			continue;
+		}
+
+		parent = node->parent;
+		if (parent) {
+			if (parent->left == node)
+				parent->left = NULL;
+			else
+				parent->right = NULL;
+		}
+
+		data = node->data;
+
+		node->parent = NULL;
+		node->tree   = NULL;
+		node->data   = NULL;
+		node->red    = false;
+
+		if (flush)
+			mem_deref(data);
+
+		node = parent;
+	}
+}
+
+
+/**
+ * Initialise a red-black tree
+ *
+ * @param tree Red-black tree
+ */
+void rbtree_init(struct rbtree *tree)
+{
+	if (!tree)
+		return;
+
+	tree->root  = NULL;
+	tree->count = 0;
+}
+
+
+/**
+ * Flush a red-black tree and free all nodes
+ *
+ * @param tree Red-black tree
+ */
+void rbtree_flush(struct rbtree *tree)
+{
+	tree_detach(tree, true);
+}
+
+
+/**
+ * Clear a red-black tree without dereferencing the nodes
+ *
+ * @param tree Red-black tree
+ */
+void rbtree_clear(struct rbtree *tree)
+{
+	tree_detach(tree, false);
+}
+
+
+/**
+ * Insert a node into a red-black tree. A node that compares equal to
+ * other nodes is put after them.
+ *
+ * @param tree Red-black tree
+ * @param node Node
+ * @param cmph Compare handler
+ * @param arg  Handler argument
+ * @param data Node data
+ */
+void rbtree_insert(struct rbtree *tree, struct rbnode *node,
+		   rbtree_cmp_h *cmph, void *arg, void *data)
+{
+	struct rbnode **link, *parent = NULL;
+
+	if (!tree || !node || !cmph)
+		return;
+
+	if (node->tree) {
+		DEBUG_WARNING("insert: node linked to %p\n", node->tree);
+		return;
+	}
+
+	node->data = data;
+
+	link = &tree->root;
+	while (*link) {
+		parent = *link;
+		link = cmph(node, parent, arg) < 0 ?
+			&parent->left : &parent->right;
+	}
+
+	node->parent = parent;
+	node->left   = NULL;
+	node->right  = NULL;
+	node->tree   = tree;
+	node->red    = true;
+
+	*link = node;
+	++tree->count;
+
+	insert_fixup(tree, node);
+}
+
+
+/**
+ * Remove a node from a red-black tree
+ *
+ * @param node Node to remove
+ */
+void rbtree_unlink(struct rbnode *node)
+{
+	struct rbnode *y, *child, *parent;
+	struct rbtree *tree;
+	bool red;
+
+	if (!node || !node->tree)
+		return;
+
+	tree = node->tree;
+
+	/* y is the node that is taken out of its place */
+	if (node->left && node->right) {
+		for (y = node->right; y->left; y = y->left)
+			;
+	}
+	else {
+		y = node;
+	}
+
+	child  = y->left ? y->left : y->right;
+	parent = y->parent;
+	red    = y->red;
+
+	if (child)
+		child->parent = parent;
+
+	replace_child(tree, y, child);
+
+	/* put the successor in the place of the node */
+	if (y != node) {
+
+		if (parent == node)
+			parent = y;
+
+		y->parent = node->parent;
+		y->left   = node->left;
+		y->right  = node->right;
+		y->red    = node->red;
+
+		replace_child(tree, node, y);
+
+		if (y->left)
+			y->left->parent = y;
+		if (y->right)
+			y->right->parent = y;
+	}
+
+	if (!red)
+		unlink_fixup(tree, child, parent);
+
+	--tree->count;
+
+	node->parent = NULL;
+	node->left   = NULL;
+	node->right  = NULL;
+	node->tree   = NULL;
+	node->red    = false;
+}
+
+
+/**
+ * Find the first node that matches a key
+ *
+ * @param tree Red-black tree
+ * @param fh   Find handler
+ * @param arg  Handler argument
+ *
+ * @return First matching node, or NULL if not found
+ */
+struct rbnode *rbtree_find(const struct rbtree *tree, rbtree_find_h *fh,
+			   void *arg)
+{
+	struct rbnode *node, *found = NULL;
+
+	if (!tree || !fh)
+		return NULL;
+
+	node = tree->root;
+	while (node) {
+
+		const int c = fh(node, arg);
+
+		if (c == 0) {
+			found = node;
+			node = node->left;
+		}
+		else {
+			node = c < 0 ? node->left : node->right;
+		}
+	}
+
+	return found;
+}
+
+
+/**
+ * Call the apply handler for each node in a red-black tree, in order. The
+ * handler may unlink the current node.
+ *
+ * @param tree Red-black tree
+ * @param fwd  true to traverse from first to last, false for reverse
+ * @param ah   Apply handler
+ * @param arg  Handler argument
+ *
+ * @return Current node if handler returned true
+ */
+struct rbnode *rbtree_apply(const struct rbtree *tree, bool fwd,
+			    rbtree_apply_h *ah, void *arg)
+{
+	struct rbnode *node;
+
+	if (!tree || !ah)
+		return NULL;
+
+	node = fwd ? rbtree_first(tree) : rbtree_last(tree);
+
+	while (node) {
+		struct rbnode *cur = node;
+
+		node = fwd ? rbnode_next(node) : rbnode_prev(node);
+
+		if (ah(cur, arg))
+			return cur;
+	}
+
+	return NULL;
+}
+
+
+/**
+ * Get the first node in a red-black tree
+ *
+ * @param tree Red-black tree
+ *
+ * @return First node (NULL if empty)
+ */
+struct rbnode *rbtree_first(const struct rbtree *tree)
+{
+	struct rbnode *node;
+
+	if (!tree || !tree->root)
+		return NULL;
+
+	for (node = tree->root; node->left; node = node->left)
+		;
+
+	return node;
+}
+
+
+/**
+ * Get the last node in a red-black tree
+ *
+ * @param tree Red-black tree
+ *
+ * @return Last node (NULL if empty)
+ */
+struct rbnode *rbtree_last(const struct rbtree *tree)
+{
+	struct rbnode *node;
+
+	if (!tree || !tree->root)
+		return NULL;
+
+	for (node = tree->root; node->right; node = node->right)
+		;
+
+	return node;
+}
+
+
+/**
+ * Get the next node in a red-black tree
+ *
+ * @param node Node
+ *
+ * @return Next node (NULL if last)
+ */
+struct rbnode *rbnode_next(const struct rbnode *node)
+{
+	struct rbnode *n;
+
+	if (!node || !node->tree)
+		return NULL;
+
+	if (node->right) {
+		for (n = node->right; n->left; n = n->left)
+			;
+		return n;
+	}
+
+	while (node->parent && node == node->parent->right)
+		node = node->parent;
+
+	return node->parent;
+}
+
+
+/**
+ * Get the previous node in a red-black tree
+ *
+ * @param node Node
+ *
+ * @return Previous node (NULL if first)
+ */
+struct rbnode *rbnode_prev(const struct rbnode *node)
+{
+	struct rbnode *n;
+
+	if (!node || !node->tree)
+		return NULL;
+
+	if (node->left) {
+		for (n = node->left; n->right; n = n->right)
+			;
+		return n;
+	}
+
+	while (node->parent && node == node->parent->left)
+		node = node->parent;
+
+	return node->parent;
+}
+
+
+/**
+ * Get the number of nodes in a red-black tree
+ *
+ * @param tree Red-black tree
+ *
+ * @return Number of nodes
+ */
+uint32_t rbtree_count(const struct rbtree *tree)
+{
+	return tree ? tree->count : 0;
+}
@@ -0,0 +1,439 @@
+/**
+ * @file reactor.c  Pool of event loop threads
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#define _GNU_SOURCE 1
+#include <pthread.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include <re_types.h>
+#include <re_fmt.h>
+#include <re_mem.h>
+#include <re_main.h>
+#include <re_mqueue.h>
+#include <re_sys.h>
+#include <re_reactor.h>
+
+
+#define DEBUG_MODULE "reactor"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+/** Message identifiers */
+enum {
+	MSG_WORK = 1,
+	MSG_STOP = 2,
+};
+
+/**
+ * Defines a reactor, a thread running its own re_main() loop
+ *
+ * Sockets that are created from a reactor thread are polled by that
+ * reactor only. Use udp_listen_reuseport() and tcp_listen_reuseport()
+ * from the init handler to open one socket per reactor on the same port.
+ * For a pinned reactor, net_sockopt_incoming_cpu_set() with reactor_cpu()
+ * lines its socket up with the RSS queue of that CPU, and the init
+ * handler may raise the thread to real-time with
+ * sys_thread_priority_set().
+ */
+struct reactor {
+	struct reactor_pool *pool;   /**< Parent pool                      */
+	pthread_t tid;               /**< Thread identifier                */
+	struct mqueue *mq;           /**< Message queue for posted work    */
+	unsigned idx;                /**< Reactor index                    */
+	int cpu;                     /**< Pinned CPU, or -1                */
+	int err;                     /**< Result of thread start-up        */
+	bool ready;                  /**< Start-up is done                 */
+	bool run;                    /**< Thread was started               */
+};
+
+/** Defines a pool of reactors */
+struct reactor_pool {
+	struct reactor *rv;          /**< Vector of reactors               */
+	unsigned n;                  /**< Number of reactors               */
+	reactor_init_h *inith;       /**< Reactor init handler             */
+	reactor_close_h *closeh;     /**< Reactor close handler            */
+	void *arg;                   /**< Handler argument                 */
+	pthread_mutex_t mutex;       /**< Protects start-up state          */
+	pthread_cond_t cond;         /**< Signalled when a reactor is up   */
+};
+
+/** Posted work item */
+struct work {
+	reactor_work_h *h;
+	void *arg;
+};
+
+
+static pthread_once_t pt_once = PTHREAD_ONCE_INIT;
+static pthread_key_t  pt_key;
+
+
+static void reactor_once(void)
+{
+	pthread_key_create(&pt_key, NULL);
+}
+
+
+static void pool_destructor(void *data)
+{
+	struct reactor_pool *pool = data;
+	unsigned i;
+
+	for (i=0; i<pool->n; i++) {
+
+		struct reactor *r = &pool->rv[i];
+
+		if (!r->run)
+			continue;
+
+		/* a reactor that failed to start has stopped by itself */
+		if (!r->err)
+			(void)mqueue_push(r->mq, MSG_STOP, NULL);
+
+		(void)pthread_join(r->tid, NULL);
+	}
+
+	mem_deref(pool->rv);
+
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->mutex);
+}
+
+
+static void mqueue_handler(int id, void *data, void *arg)
+{
+	struct work *work = data;
+	(void)arg;
+
+	switch (id) {
+
+	case MSG_WORK:
+		work->h(work->arg);
+		mem_deref(work);
+		break;
+
+	case MSG_STOP:
+		re_cancel();
+		break;
+
+	default:
+		break;
+	}
+}
+
+
+static void pin_cpu(struct reactor *r)
+{
+	int err;
+
+	err = sys_thread_affinity_set(r->cpu);
+	if (err) {
+		DEBUG_WARNING("reactor %u: could not pin to cpu %d (%m)\n",
+			      r->idx, r->cpu, err);
+		return;
+	}
+
+	/* keep the loop state on the memory node of its CPU */
+	(void)sys_thread_numa_local();
+}
+
+
+static void started(struct reactor *r, int err)
+{
+	struct reactor_pool *pool = r->pool;
+
+	pthread_mutex_lock(&pool->mutex);
+	r->err   = err;
+	r->ready = true;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+
+static void *reactor_thread(void *arg)
+{
+	struct reactor *r = arg;
+	struct reactor_pool *pool = r->pool;
+	int err;
+
+	if (r->cpu >= 0)
+		pin_cpu(r);
+
+	err = re_thread_init();
+	if (err) {
+		started(r, err);
+		return NULL;
+	}
+
+	pthread_setspecific(pt_key, r);
+
+	err = mqueue_alloc(&r->mq, mqueue_handler, r);
+	if (err)
+		goto out;
+
+	if (pool->inith) {
+		err = pool->inith(r, pool->arg);
+		if (err)
+			goto out;
+	}
+
+	started(r, 0);
+
+	err = re_main(NULL);
+	if (err) {
+		DEBUG_WARNING("reactor %u: main loop stopped (%m)\n",
+			      r->idx, err);
+	}
+
+	if (pool->closeh)
+		pool->closeh(r, pool->arg);
+
+ out:
+	if (err && !r->ready)
+		started(r, err);
+
+	r->mq = mem_deref(r->mq);
+
+	pthread_setspecific(pt_key, NULL);
+	re_thread_close();
+
+	return NULL;
+}
+
+
+static unsigned cpu_count(void)
+{
+#if defined (HAVE_UNISTD_H) && defined (_SC_NPROCESSORS_ONLN)
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return n > 0 ? (unsigned)n : 1;
+#else
+	return 1;
+#endif
+}
+
+
+/**
+ * Allocate a pool of reactors, each running re_main() in its own thread.
+ * The function returns when all reactors have been initialized.
+ *
+ * @param poolp  Pointer to allocated reactor pool
+ * @param n      Number of reactors, 0 for one per online CPU
+ * @param pin    Pin reactor number i to CPU number i
+ * @param inith  Optional init handler, called from each reactor thread
+ * @param closeh Optional close handler, called from each reactor thread
+ * @param arg    Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ *
+ * @note The pool must be dereferenced from a non-reactor thread
+ */
+int reactor_pool_alloc(struct reactor_pool **poolp, unsigned n, bool pin,
+		       reactor_init_h *inith, reactor_close_h *closeh,
+		       void *arg)
+{
+	struct reactor_pool *pool;
+	const unsigned ncpu = cpu_count();
+	unsigned i;
+	int err = 0;
+
+	if (!poolp)
+		return EINVAL;
+
+	if (!n)
+		n = ncpu;
+
+	pool = mem_zalloc(sizeof(*pool), pool_destructor);
+	if (!pool)
+		return ENOMEM;
+
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+
+	pool->rv = mem_zalloc(n * sizeof(*pool->rv), NULL);
+	if (!pool->rv) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	pool->n      = n;
+	pool->inith  = inith;
+	pool->closeh = closeh;
+	pool->arg    = arg;
+
+	pthread_once(&pt_once, reactor_once);
+
+	for (i=0; i<n; i++) {
+
+		struct reactor *r = &pool->rv[i];
+
+		r->pool = pool;
+		r->idx  = i;
+		r->cpu  = pin ? (int)(i % ncpu) : -1;
+
+		err = pthread_create(&r->tid, NULL, reactor_thread, r);
+		if (err) {
+			DEBUG_WARNING("reactor %u: thread create (%m)\n",
+				      i, err);
+			break;
+		}
+
+		r->run = true;
+	}
+
+	/*
+	 * Wait for the started reactors to be up and running, also if one
+	 * could not be created, so that the pool can stop them again
+	 */
+	pthread_mutex_lock(&pool->mutex);
+	for (i=0; i<n; i++) {
+
+		struct reactor *r = &pool->rv[i];
+
+		if (!r->run)
+			continue;
+
+		while (!r->ready)
+			pthread_cond_wait(&pool->cond, &pool->mutex);
+
+		if (r->err && !err)
+			err = r->err;
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+ out:
+	if (err)
+		mem_deref(pool);
+	else
+		*poolp = pool;
+
+	return err;
+}
+
+
+/**
+ * Get the number of reactors in a pool
+ *
+ * @param pool Reactor pool
+ *
+ * @return Number of reactors
+ */
+unsigned reactor_pool_count(const struct reactor_pool *pool)
+{
+	return pool ? pool->n : 0;
+}
+
+
+/**
+ * Get a reactor from a pool
+ *
+ * @param pool Reactor pool
+ * @param idx  Reactor index
+ *
+ * @return Reactor if found, otherwise NULL
+ */
+struct reactor *reactor_pool_get(const struct reactor_pool *pool,
+				 unsigned idx)
+{
+	if (!pool || idx >= pool->n)
+		return NULL;
+
+	return &pool->rv[idx];
+}
+
+
+/**
+ * Post work to a reactor of a pool. The work handler is called from the
+ * reactor thread.
+ *
+ * @param pool Reactor pool
+ * @param idx  Reactor index
+ * @param h    Work handler
+ * @param arg  Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int reactor_pool_post(struct reactor_pool *pool, unsigned idx,
+		      reactor_work_h *h, void *arg)
+{
+	return reactor_post(reactor_pool_get(pool, idx), h, arg);
+}
+
+
+/**
+ * Post work to a reactor. The work handler is called from the reactor
+ * thread. This function can be called from any thread.
+ *
+ * @param r   Reactor
+ * @param h   Work handler
+ * @param arg Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int reactor_post(struct reactor *r, reactor_work_h *h, void *arg)
+{
+	struct work *work;
+	int err;
+
+	if (!r || !h)
+		return EINVAL;
+
+	if (!r->mq)
+		return ENOTCONN;
+
+	work = mem_zalloc(sizeof(*work), NULL);
+	if (!work)
+		return ENOMEM;
+
+	work->h   = h;
+	work->arg = arg;
+
+	err = mqueue_push(r->mq, MSG_WORK, work);
+	if (err)
+		mem_deref(work);
+
+	return err;
+}
+
+
+/**
+ * Get the index of a reactor in its pool
+ *
+ * @param r Reactor
+ *
+ * @return Reactor index
+ */
+unsigned reactor_index(const struct reactor *r)
+{
+	return r ? r->idx : 0;
+}
+
+
+/**
+ * Get the CPU that a reactor is pinned to
+ *
+ * @param r Reactor
+ *
+ * @return CPU number, or -1 if not pinned
+ */
+int reactor_cpu(const struct reactor *r)
+{
+	return r ? r->cpu : -1;
+}
+
+
+/**
+ * Get the reactor of the calling thread
+ *
+ * @return Reactor, or NULL if not called from a reactor thread
+ */
+struct reactor *reactor_current(void)
+{
+	pthread_once(&pt_once, reactor_once);
+
+	return pthread_getspecific(pt_key);
+}
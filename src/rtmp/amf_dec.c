@@ -233,3 +233,211 @@ int rtmp_amf_decode(struct odict **msgp, struct mbuf *mb)
 
 	return err;
 }
+
+
+static int amf_skip_value(struct mbuf *mb);
+
+
+static int amf_skip_object(struct mbuf *mb)
+{
+	uint16_t len;
+	int err;
+
+	for (;;) {
+
+		if (mbuf_get_left(mb) < 2)
+			return ENODATA;
+
+		len = ntohs(mbuf_read_u16(mb));
+
+		if (len == 0) {
+
+			if (mbuf_get_left(mb) < 1)
+				return ENODATA;
+
+			if (mbuf_read_u8(mb) != RTMP_AMF_TYPE_OBJECT_END)
+				return EBADMSG;
+
+			return 0;
+		}
+
+		if (mbuf_get_left(mb) < len)
+			return ENODATA;
+
+		mbuf_advance(mb, len);
+
+		err = amf_skip_value(mb);
+		if (err)
+			return err;
+	}
+}
+
+
+static int amf_skip_value(struct mbuf *mb)
+{
+	struct rtmp_amf_value val;
+
+	return rtmp_amf_next(&val, mb);
+}
+
+
+/**
+ * Decode the next AMF0 value of a buffer, without allocating memory.
+ * Strings point into the buffer. For an object or an array the value
+ * is skipped, and str points to its members, which can be read with
+ * rtmp_amf_prop_next() or rtmp_amf_next() respectively.
+ *
+ * @param val Decoded value
+ * @param mb  Buffer to decode from
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtmp_amf_next(struct rtmp_amf_value *val, struct mbuf *mb)
+{
+	union {
+		uint64_t i;
+		double f;
+	} num;
+	uint32_t i, array_len;
+	uint16_t len;
+	size_t start;
+	int err = 0;
+
+	if (!val || !mb)
+		return EINVAL;
+
+	if (mbuf_get_left(mb) < 1)
+		return ENODATA;
+
+	memset(val, 0, sizeof(*val));
+
+	val->type = mbuf_read_u8(mb);
+
+	switch (val->type) {
+
+	case RTMP_AMF_TYPE_NUMBER:
+		if (mbuf_get_left(mb) < 8)
+			return ENODATA;
+
+		num.i = sys_ntohll(mbuf_read_u64(mb));
+		val->num = num.f;
+		break;
+
+	case RTMP_AMF_TYPE_BOOLEAN:
+		if (mbuf_get_left(mb) < 1)
+			return ENODATA;
+
+		val->boolean = !!mbuf_read_u8(mb);
+		break;
+
+	case RTMP_AMF_TYPE_STRING:
+		if (mbuf_get_left(mb) < 2)
+			return ENODATA;
+
+		len = ntohs(mbuf_read_u16(mb));
+
+		if (mbuf_get_left(mb) < len)
+			return ENODATA;
+
+		val->str.p = (const char *)mbuf_buf(mb);
+		val->str.l = len;
+		mbuf_advance(mb, len);
+		break;
+
+	case RTMP_AMF_TYPE_NULL:
+		break;
+
+	case RTMP_AMF_TYPE_ECMA_ARRAY:
+		if (mbuf_get_left(mb) < 4)
+			return ENODATA;
+
+		(void)mbuf_read_u32(mb);  /* ignore array length */
+
+		/* fallthrough */
+
+	case RTMP_AMF_TYPE_OBJECT:
+		start = mb->pos;
+
+		err = amf_skip_object(mb);
+		if (err)
+			return err;
+
+		val->str.p = (const char *)mb->buf + start;
+		val->str.l = mb->pos - start;
+		break;
+
+	case RTMP_AMF_TYPE_STRICT_ARRAY:
+		if (mbuf_get_left(mb) < 4)
+			return ENODATA;
+
+		array_len = ntohl(mbuf_read_u32(mb));
+		if (!array_len)
+			return EPROTO;
+
+		start = mb->pos;
+
+		for (i=0; i<array_len; i++) {
+
+			err = amf_skip_value(mb);
+			if (err)
+				return err;
+		}
+
+		val->num   = array_len;
+		val->str.p = (const char *)mb->buf + start;
+		val->str.l = mb->pos - start;
+		break;
+
+	default:
+		err = EPROTO;
+		break;
+	}
+
+	return err;
+}
+
+
+/**
+ * Decode the next property of an AMF0 object, without allocating memory
+ *
+ * @param key Property name, pointing into the buffer
+ * @param val Decoded value
+ * @param mb  Buffer with the members of an object
+ *
+ * @return 0 if success, ENOENT at the end of the object, otherwise
+ *         errorcode
+ */
+int rtmp_amf_prop_next(struct pl *key, struct rtmp_amf_value *val,
+		       struct mbuf *mb)
+{
+	uint16_t len;
+
+	if (!key || !val || !mb)
+		return EINVAL;
+
+	if (mbuf_get_left(mb) < 2)
+		return ENODATA;
+
+	len = ntohs(mbuf_read_u16(mb));
+
+	if (len == 0) {
+
+		if (mbuf_get_left(mb) < 1)
+			return ENODATA;
+
+		if (mbuf_read_u8(mb) != RTMP_AMF_TYPE_OBJECT_END)
+			return EBADMSG;
+
+		return ENOENT;
+	}
+
+	if (mbuf_get_left(mb) < len)
+		return ENODATA;
+
+	key->p = (const char *)mbuf_buf(mb);
+	key->l = len;
+	mbuf_advance(mb, len);
+
+	return rtmp_amf_next(val, mb);
+}
+
@@ -16,6 +16,19 @@
 #include "rtmp.h"
 
 
+/*
+ * The chunk headers are encoded into a small buffer, and sent together
+ * with slices of the payload, so the payload is not copied when it can
+ * be sent at once. Each group of chunks is sent with one system call.
+ */
+
+
+enum {
+	HDR_SIZE_MAX = 18,  /* basic header, header type 0 and ext ts */
+	VEC_CHUNKS   = 32,
+};
+
+
 /*
  * Stateless RTMP chunker
  */
@@ -26,15 +39,16 @@ int rtmp_chunker(unsigned format, uint32_t chunk_id,
 		 size_t max_chunk_sz, struct tcp_conn *tc)
 {
 	const uint8_t *pend = payload + payload_len;
+	struct tcp_vec vv[VEC_CHUNKS * 2];
 	struct rtmp_header hdr;
 	struct mbuf *mb;
-	size_t chunk_sz;
-	int err;
+	int err = 0;
 
 	if (!payload || !payload_len || !max_chunk_sz || !tc)
 		return EINVAL;
 
-	mb = mbuf_alloc(payload_len + 256);
+	/* big enough for the headers of one group, so it never moves */
+	mb = mbuf_alloc(VEC_CHUNKS * HDR_SIZE_MAX);
 	if (!mb)
 		return ENOMEM;
 
@@ -49,39 +63,85 @@ int rtmp_chunker(unsigned format, uint32_t chunk_id,
 	hdr.type_id         = msg_type_id;
 	hdr.stream_id       = msg_stream_id;
 
-	chunk_sz = min(payload_len, max_chunk_sz);
+	while (payload < pend && !err) {
 
-	err  = rtmp_header_encode(mb, &hdr);
-	err |= mbuf_write_mem(mb, payload, chunk_sz);
-	if (err)
-		goto out;
+		size_t vc = 0;
 
-	payload += chunk_sz;
+		mb->pos = 0;
+		mb->end = 0;
 
-	hdr.format = 3;
+		while (payload < pend && vc < ARRAY_SIZE(vv)) {
 
-	while (payload < pend) {
+			const size_t chunk_sz = min((size_t)(pend - payload),
+						    max_chunk_sz);
+			const size_t pos = mb->end;
 
-		const size_t len = pend - payload;
+			err = rtmp_header_encode(mb, &hdr);
+			if (err)
+				goto out;
 
-		chunk_sz = min(len, max_chunk_sz);
+			hdr.format = 3;
 
-		err  = rtmp_header_encode(mb, &hdr);
-		err |= mbuf_write_mem(mb, payload, chunk_sz);
-		if (err)
-			goto out;
+			vv[vc].p   = mb->buf + pos;
+			vv[vc].len = mb->end - pos;
+			++vc;
 
-		payload += chunk_sz;
-	}
+			vv[vc].p   = payload;
+			vv[vc].len = chunk_sz;
+			++vc;
 
-	mb->pos = 0;
+			payload += chunk_sz;
+		}
 
-	err = tcp_send(tc, mb);
-	if (err)
-		goto out;
+		err = tcp_sendv(tc, vv, vc);
+	}
 
  out:
 	mem_deref(mb);
 
 	return err;
 }
+
+
+/*
+ * Encode all chunks of a message into a buffer
+ */
+int rtmp_chunk_encode(struct mbuf *mb, unsigned format, uint32_t chunk_id,
+		      uint32_t timestamp, uint32_t timestamp_delta,
+		      uint8_t msg_type_id, uint32_t msg_stream_id,
+		      const uint8_t *payload, size_t payload_len,
+		      size_t max_chunk_sz)
+{
+	const uint8_t *pend = payload + payload_len;
+	struct rtmp_header hdr;
+	int err = 0;
+
+	if (!mb || !payload || !payload_len || !max_chunk_sz)
+		return EINVAL;
+
+	memset(&hdr, 0, sizeof(hdr));
+
+	hdr.format = format;
+	hdr.chunk_id = chunk_id;
+
+	hdr.timestamp       = timestamp;
+	hdr.timestamp_delta = timestamp_delta;
+	hdr.length          = (uint32_t)payload_len;
+	hdr.type_id         = msg_type_id;
+	hdr.stream_id       = msg_stream_id;
+
+	while (payload < pend && !err) {
+
+		const size_t chunk_sz = min((size_t)(pend - payload),
+					    max_chunk_sz);
+
+		err  = rtmp_header_encode(mb, &hdr);
+		err |= mbuf_write_mem(mb, payload, chunk_sz);
+
+		hdr.format = 3;
+		payload += chunk_sz;
+	}
+
+	return err;
+}
+
@@ -27,9 +27,6 @@ enum {
 };
 
 
-static int req_connect(struct rtmp_conn *conn);
-
-
 static void conn_destructor(void *data)
 {
 	struct rtmp_conn *conn = data;
@@ -40,6 +37,7 @@ static void conn_destructor(void *data)
 	mem_deref(conn->dnsq6);
 	mem_deref(conn->dnsq4);
 	mem_deref(conn->dnsc);
+	mem_deref(conn->tcphe);
 	mem_deref(conn->sc);
 	mem_deref(conn->tc);
 	mem_deref(conn->mb);
@@ -51,42 +49,82 @@ static void conn_destructor(void *data)
 }
 
 
+/* Read the command name and transaction id, without decoding the rest */
+static int amf_command_peek(struct pl *name, uint64_t *tid,
+			    const struct mbuf *mb)
+{
+	struct rtmp_amf_value val;
+	struct mbuf view = *mb;
+	int err;
+
+	err = rtmp_amf_next(&val, &view);
+	if (err)
+		return err;
+
+	if (val.type != RTMP_AMF_TYPE_STRING)
+		return EPROTO;
+
+	*name = val.str;
+	*tid  = 0;
+
+	if (!rtmp_amf_next(&val, &view) && val.type == RTMP_AMF_TYPE_NUMBER)
+		*tid = (uint64_t)val.num;
+
+	return 0;
+}
+
+
 static int handle_amf_command(struct rtmp_conn *conn, uint32_t stream_id,
 			      struct mbuf *mb)
 {
+	rtmp_command_h *cmdh = NULL;
 	struct odict *msg = NULL;
-	const char *name;
+	struct pl name;
+	uint64_t tid;
+	void *arg = NULL;
+	bool resp;
 	int err;
 
-	err = rtmp_amf_decode(&msg, mb);
+	err = amf_command_peek(&name, &tid, mb);
 	if (err)
 		return err;
 
-	name = odict_string(msg, "0");
-
-	if (conn->is_client &&
-	    (0 == str_casecmp(name, "_result") ||
-	     0 == str_casecmp(name, "_error"))) {
+	resp = conn->is_client &&
+		(0 == pl_strcasecmp(&name, "_result") ||
+		 0 == pl_strcasecmp(&name, "_error"));
 
-		/* forward response to transaction layer */
-		rtmp_ctrans_response(&conn->ctransl, msg);
+	/* messages that nobody waits for are not decoded */
+	if (resp) {
+		if (!rtmp_ctrans_find(&conn->ctransl, tid))
+			return 0;
+	}
+	else if (stream_id == 0) {
+		cmdh = conn->cmdh;
+		arg  = conn->arg;
 	}
 	else {
-		struct rtmp_stream *strm;
+		struct rtmp_stream *strm = rtmp_stream_find(conn, stream_id);
 
-		if (stream_id == 0) {
-			if (conn->cmdh)
-				conn->cmdh(msg, conn->arg);
-		}
-		else {
-			strm = rtmp_stream_find(conn, stream_id);
-			if (strm) {
-				if (strm->cmdh)
-					strm->cmdh(msg, strm->arg);
-			}
+		if (strm) {
+			cmdh = strm->cmdh;
+			arg  = strm->arg;
 		}
 	}
 
+	if (!resp && !cmdh)
+		return 0;
+
+	err = rtmp_amf_decode(&msg, mb);
+	if (err)
+		return err;
+
+	if (resp) {
+		/* forward response to transaction layer */
+		rtmp_ctrans_response(&conn->ctransl, msg);
+	}
+	else
+		cmdh(msg, arg);
+
 	mem_deref(msg);
 
 	return 0;
@@ -145,13 +183,15 @@ static int handle_data_message(struct rtmp_conn *conn, uint32_t stream_id,
 	struct odict *msg;
 	int err;
 
+	strm = rtmp_stream_find(conn, stream_id);
+	if (!strm || !strm->datah)
+		return 0;
+
 	err = rtmp_amf_decode(&msg, mb);
 	if (err)
 		return err;
 
-	strm = rtmp_stream_find(conn, stream_id);
-	if (strm && strm->datah)
-		strm->datah(msg, strm->arg);
+	strm->datah(msg, strm->arg);
 
 	mem_deref(msg);
 
@@ -665,57 +705,83 @@ static void tcp_close_handler(int err, void *arg)
 {
 	struct rtmp_conn *conn = arg;
 
-	if (conn->is_client && !conn->connected && conn->srvc > 0) {
-		err = req_connect(conn);
-		if (!err)
-			return;
-	}
-
 	conn_close(conn, err);
 }
 
 
-static int req_connect(struct rtmp_conn *conn)
+static int he_prep_handler(void **ctxp, struct tcp_conn *tc,
+			   const struct sa *peer, void *arg)
 {
-	const struct sa *addr;
-	int err = EINVAL;
+#ifdef USE_TLS
+	struct rtmp_conn *conn = arg;
+	struct tls_conn *sc;
+	int err;
+	(void)peer;
 
-	while (conn->srvc > 0) {
+	if (!conn->tls)
+		return 0;
 
-		--conn->srvc;
+	err = tls_start_tcp(&sc, conn->tls, tc, 0);
+	if (err)
+		return err;
 
-		addr = &conn->srvv[conn->srvc];
+	err = tls_set_verify_server(sc, conn->host);
+	if (err)
+		mem_deref(sc);
+	else
+		*ctxp = sc;
 
-		conn->send_chunk_size = RTMP_DEFAULT_CHUNKSIZE;
-		conn->window_ack_size = WINDOW_ACK_SIZE;
-		conn->state = RTMP_STATE_UNINITIALIZED;
-		conn->last_ack = 0;
-		conn->total_bytes = 0;
-		conn->mb = mem_deref(conn->mb);
-		conn->sc = mem_deref(conn->sc);
-		conn->tc = mem_deref(conn->tc);
+	return err;
+#else
+	(void)ctxp;
+	(void)tc;
+	(void)peer;
+	(void)arg;
 
-		rtmp_dechunker_set_chunksize(conn->dechunk,
-					     RTMP_DEFAULT_CHUNKSIZE);
+	return 0;
+#endif
+}
 
-		err = tcp_connect(&conn->tc, addr, tcp_estab_handler,
-				  tcp_recv_handler, tcp_close_handler, conn);
 
-#ifdef USE_TLS
-		if (conn->tls && !err) {
-			err = tls_start_tcp(&conn->sc, conn->tls,
-					    conn->tc, 0);
-			if (!err)
-				err = tls_set_verify_server(conn->sc,
-							    conn->host);
-		}
-#endif
+static void he_handler(int err, struct tcp_conn *tc, void *ctx,
+		       const struct sa *peer, void *arg)
+{
+	struct rtmp_conn *conn = arg;
+	(void)peer;
 
-		if (!err)
-			break;
+	conn->tcphe = mem_deref(conn->tcphe);
+
+	if (err) {
+		conn_close(conn, err);
+		return;
 	}
 
-	return err;
+	conn->tc = tc;
+	conn->sc = ctx;
+
+	tcp_set_handlers(tc, tcp_estab_handler, tcp_recv_handler,
+			 tcp_close_handler, conn);
+
+	tcp_estab_handler(conn);
+}
+
+
+/* Race the connections to all addresses (Happy Eyeballs) */
+static int req_connect(struct rtmp_conn *conn)
+{
+	conn->send_chunk_size = RTMP_DEFAULT_CHUNKSIZE;
+	conn->window_ack_size = WINDOW_ACK_SIZE;
+	conn->state = RTMP_STATE_UNINITIALIZED;
+	conn->last_ack = 0;
+	conn->total_bytes = 0;
+	conn->mb = mem_deref(conn->mb);
+	conn->sc = mem_deref(conn->sc);
+	conn->tc = mem_deref(conn->tc);
+
+	rtmp_dechunker_set_chunksize(conn->dechunk, RTMP_DEFAULT_CHUNKSIZE);
+
+	return tcp_he_connect(&conn->tcphe, conn->srvv, conn->srvc,
+			      he_prep_handler, he_handler, conn);
 }
 
 
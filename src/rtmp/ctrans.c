@@ -34,8 +34,8 @@ static void ctrans_destructor(void *data)
 }
 
 
-static struct rtmp_ctrans *rtmp_ctrans_find(const struct list *ctransl,
-					    uint64_t tid)
+struct rtmp_ctrans *rtmp_ctrans_find(const struct list *ctransl,
+				     uint64_t tid)
 {
 	struct le *le;
 
@@ -7,6 +7,7 @@
 #include <re_types.h>
 #include <re_fmt.h>
 #include <re_list.h>
+#include <re_hash.h>
 #include <re_mem.h>
 #include <re_mbuf.h>
 #include <re_net.h>
@@ -15,20 +16,34 @@
 #include "rtmp.h"
 
 
+/*
+ * Chunk streams with a one-byte chunk id are found in an array, and the
+ * others in a hash table. The message buffer of a chunk stream is kept
+ * for the next message, unless the handler holds a reference to it.
+ */
+
+
 enum {
 	MAX_CHUNKS = 64,
+	CHUNK_DIRECT = 64,
+	CHUNK_HASH_SIZE = 16,
 };
 
 
 struct rtmp_chunk {
 	struct le le;
+	struct le le_hash;
 	struct rtmp_header hdr;
 	struct mbuf *mb;
+	bool pending;
 };
 
 /** Defines the RTMP Dechunker */
 struct rtmp_dechunker {
 	struct list chunkl;      /* struct rtmp_chunk */
+	struct rtmp_chunk *chunkv[CHUNK_DIRECT];
+	struct hash *ht_chunk;
+	uint32_t chunkc;
 	size_t chunk_sz;
 	rtmp_dechunk_h *chunkh;
 	void *arg;
@@ -40,6 +55,7 @@ static void destructor(void *data)
 	struct rtmp_dechunker *rd = data;
 
 	list_flush(&rd->chunkl);
+	mem_deref(rd->ht_chunk);
 }
 
 
@@ -48,14 +64,23 @@ static void chunk_destructor(void *data)
 	struct rtmp_chunk *chunk = data;
 
 	list_unlink(&chunk->le);
+	hash_unlink(&chunk->le_hash);
 	mem_deref(chunk->mb);
 }
 
 
-static struct rtmp_chunk *create_chunk(struct list *chunkl,
+static struct rtmp_chunk *create_chunk(struct rtmp_dechunker *rd,
 				       const struct rtmp_header *hdr)
 {
 	struct rtmp_chunk *chunk;
+	int err;
+
+	if (hdr->chunk_id >= CHUNK_DIRECT && !rd->ht_chunk) {
+
+		err = hash_alloc(&rd->ht_chunk, CHUNK_HASH_SIZE);
+		if (err)
+			return NULL;
+	}
 
 	chunk = mem_zalloc(sizeof(*chunk), chunk_destructor);
 	if (!chunk)
@@ -63,26 +88,60 @@ static struct rtmp_chunk *create_chunk(struct list *chunkl,
 
 	chunk->hdr = *hdr;
 
-	list_append(chunkl, &chunk->le, chunk);
+	list_append(&rd->chunkl, &chunk->le, chunk);
+
+	if (hdr->chunk_id < CHUNK_DIRECT)
+		rd->chunkv[hdr->chunk_id] = chunk;
+	else
+		hash_append(rd->ht_chunk, hdr->chunk_id, &chunk->le_hash,
+			    chunk);
+
+	++rd->chunkc;
 
 	return chunk;
 }
 
 
-static struct rtmp_chunk *find_chunk(const struct list *chunkl,
+static bool chunk_cmp_handler(struct le *le, void *arg)
+{
+	const struct rtmp_chunk *chunk = le->data;
+
+	return chunk->hdr.chunk_id == *(const uint32_t *)arg;
+}
+
+
+static struct rtmp_chunk *find_chunk(const struct rtmp_dechunker *rd,
 				     uint32_t chunk_id)
 {
-	struct le *le;
+	if (chunk_id < CHUNK_DIRECT)
+		return rd->chunkv[chunk_id];
 
-	for (le = list_head(chunkl); le; le = le->next) {
+	return list_ledata(hash_lookup(rd->ht_chunk, chunk_id,
+				       chunk_cmp_handler, &chunk_id));
+}
 
-		struct rtmp_chunk *chunk = le->data;
 
-		if (chunk_id == chunk->hdr.chunk_id)
-			return chunk;
+/* Start a message in the buffer of a chunk stream */
+static int chunk_begin(struct rtmp_chunk *chunk)
+{
+	const size_t msg_len = chunk->hdr.length;
+
+	if (!chunk->mb) {
+		chunk->mb = mbuf_alloc(msg_len);
+		if (!chunk->mb)
+			return ENOMEM;
 	}
+	else if (chunk->mb->size < msg_len) {
+		int err = mbuf_resize(chunk->mb, msg_len);
+		if (err)
+			return err;
+	}
+
+	chunk->mb->pos = 0;
+	chunk->mb->end = 0;
+	chunk->pending = true;
 
-	return NULL;
+	return 0;
 }
 
 
@@ -127,15 +186,15 @@ int rtmp_dechunker_receive(struct rtmp_dechunker *rd, struct mbuf *mb)
 		return err;
 
 	/* find preceding chunk, from chunk id */
-	chunk = find_chunk(&rd->chunkl, hdr.chunk_id);
+	chunk = find_chunk(rd, hdr.chunk_id);
 	if (!chunk) {
 
 		/* only type 0 can create a new chunk stream */
 		if (hdr.format == 0) {
-			if (list_count(&rd->chunkl) > MAX_CHUNKS)
+			if (rd->chunkc > MAX_CHUNKS)
 				return EOVERFLOW;
 
-			chunk = create_chunk(&rd->chunkl, &hdr);
+			chunk = create_chunk(rd, &hdr);
 			if (!chunk)
 				return ENOMEM;
 		}
@@ -171,10 +230,9 @@ int rtmp_dechunker_receive(struct rtmp_dechunker *rd, struct mbuf *mb)
 		if (mbuf_get_left(mb) < chunk_sz)
 			return ENODATA;
 
-		mem_deref(chunk->mb);
-		chunk->mb = mbuf_alloc(msg_len);
-		if (!chunk->mb)
-			return ENOMEM;
+		err = chunk_begin(chunk);
+		if (err)
+			return err;
 
 		err = mbuf_read_mem(mb, chunk->mb->buf, chunk_sz);
 		if (err)
@@ -206,11 +264,11 @@ int rtmp_dechunker_receive(struct rtmp_dechunker *rd, struct mbuf *mb)
 				chunk->hdr.timestamp_delta = ext_ts;
 		}
 
-		if (!chunk->mb) {
+		if (!chunk->pending) {
 
-			chunk->mb = mbuf_alloc(chunk->hdr.length);
-			if (!chunk->mb)
-				return ENOMEM;
+			err = chunk_begin(chunk);
+			if (err)
+				return err;
 
 			if (chunk->hdr.format == 0) {
 				chunk->hdr.timestamp_delta =
@@ -220,7 +278,7 @@ int rtmp_dechunker_receive(struct rtmp_dechunker *rd, struct mbuf *mb)
 			chunk->hdr.timestamp += chunk->hdr.timestamp_delta;
 		}
 
-		left = mbuf_get_space(chunk->mb);
+		left = chunk->hdr.length - chunk->mb->end;
 
 		chunk_sz = min(left, rd->chunk_sz);
 
@@ -239,18 +297,22 @@ int rtmp_dechunker_receive(struct rtmp_dechunker *rd, struct mbuf *mb)
 		return EPROTO;
 	}
 
-	if (chunk->mb->pos >= chunk->mb->size) {
+	if (chunk->mb->end >= chunk->hdr.length) {
 
-		struct mbuf *buf;
+		struct mbuf *buf = chunk->mb;
 
 		chunk->mb->pos = 0;
+		chunk->pending = false;
 
-		buf = chunk->mb;
-		chunk->mb = NULL;
+		/* the handler may close the connection */
+		mem_ref(rd);
 
 		err = rd->chunkh(&chunk->hdr, buf, rd->arg);
 
-		mem_deref(buf);
+		if (mem_nrefs(buf) > 1)
+			chunk->mb = mem_deref(chunk->mb);
+
+		mem_deref(rd);
 	}
 
 	return err;
@@ -276,7 +338,7 @@ int rtmp_dechunker_debug(struct re_printf *pf, const struct rtmp_dechunker *rd)
 
 	err  = re_hprintf(pf, "Dechunker Debug:\n");
 
-	err |= re_hprintf(pf, "chunk list: (%u)\n", list_count(&rd->chunkl));
+	err |= re_hprintf(pf, "chunk list: (%u)\n", rd->chunkc);
 
 	for (le = rd->chunkl.head; le; le = le->next) {
 
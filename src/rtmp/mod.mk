@@ -13,4 +13,5 @@ SRCS	+= rtmp/control.c
 SRCS	+= rtmp/ctrans.c
 SRCS	+= rtmp/dechunk.c
 SRCS	+= rtmp/hdr.c
+SRCS	+= rtmp/relay.c
 SRCS	+= rtmp/stream.c
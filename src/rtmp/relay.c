@@ -0,0 +1,228 @@
+/**
+ * @file rtmp/relay.c  Real Time Messaging Protocol (RTMP) -- Relay
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re_types.h>
+#include <re_fmt.h>
+#include <re_mem.h>
+#include <re_mbuf.h>
+#include <re_net.h>
+#include <re_sa.h>
+#include <re_list.h>
+#include <re_tcp.h>
+#include <re_rtmp.h>
+#include "rtmp.h"
+
+
+/*
+ * A message is chunked once for each distinct chunk size, chunk id and
+ * stream id of the outputs, which is usually once per chunk size. The
+ * chunked buffer is sent to all outputs that match, and the send queue
+ * of a connection keeps a reference to it instead of a copy.
+ */
+
+
+enum {
+	MAX_ENCODINGS = 8,
+	HDR_OVERHEAD  = 64,
+};
+
+
+/** Defines an RTMP Relay */
+struct rtmp_relay {
+	struct list outl;        /* struct rtmp_stream */
+};
+
+struct encoding {
+	struct mbuf *mb;
+	uint32_t chunk_sz;
+	uint32_t chunk_id;
+	uint32_t stream_id;
+};
+
+
+static void destructor(void *data)
+{
+	struct rtmp_relay *relay = data;
+
+	/* the streams are owned by the application */
+	list_clear(&relay->outl);
+}
+
+
+/**
+ * Allocate an RTMP Relay, that forwards media messages to many outputs
+ *
+ * @param relayp Pointer to allocated RTMP Relay
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtmp_relay_alloc(struct rtmp_relay **relayp)
+{
+	struct rtmp_relay *relay;
+
+	if (!relayp)
+		return EINVAL;
+
+	relay = mem_zalloc(sizeof(*relay), destructor);
+	if (!relay)
+		return ENOMEM;
+
+	*relayp = relay;
+
+	return 0;
+}
+
+
+/**
+ * Add an output stream to an RTMP Relay. The stream is removed when it
+ * is dereferenced. The send queue of its connection is set to keep
+ * references to sent buffers (see tcp_conn_txref_set()).
+ *
+ * @param relay RTMP Relay
+ * @param strm  RTMP Stream to send on
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtmp_relay_add(struct rtmp_relay *relay, struct rtmp_stream *strm)
+{
+	if (!relay || !strm)
+		return EINVAL;
+
+	if (strm->le_relay.list)
+		return EALREADY;
+
+	tcp_conn_txref_set(strm->conn->tc, true);
+
+	list_append(&relay->outl, &strm->le_relay, strm);
+
+	return 0;
+}
+
+
+/**
+ * Remove an output stream from its RTMP Relay
+ *
+ * @param strm RTMP Stream
+ */
+void rtmp_relay_remove(struct rtmp_stream *strm)
+{
+	if (!strm)
+		return;
+
+	list_unlink(&strm->le_relay);
+}
+
+
+static unsigned stream_chunk_id(const struct rtmp_stream *strm,
+				enum rtmp_packet_type type)
+{
+	switch (type) {
+
+	case RTMP_TYPE_AUDIO: return strm->chunk_id_audio;
+	case RTMP_TYPE_VIDEO: return strm->chunk_id_video;
+	default:              return strm->chunk_id_data;
+	}
+}
+
+
+static int encode(struct encoding *enc, const struct rtmp_stream *strm,
+		  uint32_t chunk_id, enum rtmp_packet_type type,
+		  uint32_t timestamp, const uint8_t *pld, size_t len)
+{
+	const uint32_t chunk_sz = strm->conn->send_chunk_size;
+	int err;
+
+	enc->mb = mbuf_alloc(len + HDR_OVERHEAD + len / chunk_sz * 4);
+	if (!enc->mb)
+		return ENOMEM;
+
+	err = rtmp_chunk_encode(enc->mb, 0, chunk_id, timestamp, 0, type,
+				strm->stream_id, pld, len, chunk_sz);
+	if (err) {
+		enc->mb = mem_deref(enc->mb);
+		return err;
+	}
+
+	enc->chunk_sz  = chunk_sz;
+	enc->chunk_id  = chunk_id;
+	enc->stream_id = strm->stream_id;
+
+	return 0;
+}
+
+
+/**
+ * Send a media message to all outputs of an RTMP Relay, e.g. from the
+ * audio or video handler of the input stream
+ *
+ * @param relay     RTMP Relay
+ * @param type      Message type, audio, video or data
+ * @param timestamp Timestamp in [milliseconds]
+ * @param pld       Message payload
+ * @param len       Payload length
+ *
+ * @return 0 if success, otherwise errorcode of the first failed output
+ */
+int rtmp_relay_send(struct rtmp_relay *relay, enum rtmp_packet_type type,
+		    uint32_t timestamp, const uint8_t *pld, size_t len)
+{
+	struct encoding encv[MAX_ENCODINGS];
+	size_t encc = 0, i;
+	struct le *le;
+	int err = 0;
+
+	if (!relay || !pld || !len)
+		return EINVAL;
+
+	if (type != RTMP_TYPE_AUDIO && type != RTMP_TYPE_VIDEO &&
+	    type != RTMP_TYPE_DATA)
+		return EINVAL;
+
+	for (le = relay->outl.head; le; le = le->next) {
+
+		const struct rtmp_stream *strm = le->data;
+		const struct rtmp_conn *conn = strm->conn;
+		const uint32_t chunk_id = stream_chunk_id(strm, type);
+		struct encoding *enc = NULL;
+		int e = 0;
+
+		for (i=0; i<encc; i++) {
+
+			if (encv[i].chunk_sz == conn->send_chunk_size &&
+			    encv[i].chunk_id == chunk_id &&
+			    encv[i].stream_id == strm->stream_id) {
+				enc = &encv[i];
+				break;
+			}
+		}
+
+		if (!enc) {
+			/* the last slot is reused when all are taken */
+			if (encc == ARRAY_SIZE(encv))
+				mem_deref(encv[--encc].mb);
+
+			enc = &encv[encc];
+
+			e = encode(enc, strm, chunk_id, type, timestamp,
+				   pld, len);
+			if (!e)
+				++encc;
+		}
+
+		if (!e) {
+			enc->mb->pos = 0;
+			e = tcp_send(conn->tc, enc->mb);
+		}
+
+		if (e && !err)
+			err = e;
+	}
+
+	for (i=0; i<encc; i++)
+		mem_deref(encv[i].mb);
+
+	return err;
+}
@@ -52,6 +52,7 @@ struct rtmp_conn {
 	struct dnsc *dnsc;
 	struct dns_query *dnsq4;
 	struct dns_query *dnsq6;
+	struct tcp_he *tcphe;
 	struct list ctransl;
 	struct sa srvv[16];
 	struct tls *tls;
@@ -82,6 +83,7 @@ struct rtmp_stream {
 	rtmp_resp_h *resph;
 	rtmp_control_h *ctrlh;
 	void *arg;
+	struct le le_relay;              /**< Member of an RTMP Relay      */
 };
 
 struct rtmp_header {
@@ -124,6 +126,8 @@ uint64_t rtmp_conn_assign_tid(struct rtmp_conn *conn);
 
 struct rtmp_ctrans;
 
+struct rtmp_ctrans *rtmp_ctrans_find(const struct list *ctransl,
+				     uint64_t tid);
 int  rtmp_ctrans_response(const struct list *ctransl,
 			  const struct odict *msg);
 
@@ -137,6 +141,11 @@ int rtmp_chunker(unsigned format, uint32_t chunk_id,
 		 uint8_t msg_type_id, uint32_t msg_stream_id,
 		 const uint8_t *payload, size_t payload_len,
 		 size_t max_chunk_sz, struct tcp_conn *tc);
+int rtmp_chunk_encode(struct mbuf *mb, unsigned format, uint32_t chunk_id,
+		      uint32_t timestamp, uint32_t timestamp_delta,
+		      uint8_t msg_type_id, uint32_t msg_stream_id,
+		      const uint8_t *payload, size_t payload_len,
+		      size_t max_chunk_sz);
 
 
 /*
@@ -23,6 +23,7 @@ static void destructor(void *data)
 	struct rtmp_stream *strm = data;
 
 	list_unlink(&strm->le);
+	list_unlink(&strm->le_relay);
 
 	if (strm->created) {
 
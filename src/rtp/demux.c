@@ -0,0 +1,371 @@
+/**
+ * @file demux.c  RTP demultiplexing of BUNDLE streams by SSRC and MID
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re_types.h>
+#include <re_fmt.h>
+#include <re_mem.h>
+#include <re_mbuf.h>
+#include <re_list.h>
+#include <re_hash.h>
+#include <re_sa.h>
+#include <re_rtp.h>
+#include "rtcp.h"
+
+
+/*
+ * The streams of an RTP Socket are found by the SSRC of a packet, in a
+ * hash table. A packet with an unknown SSRC is matched by the value of
+ * its MID header extension (RFC 8843), if the extension ID is known, and
+ * its SSRC is then added to the stream. Packets that match no stream go
+ * to the receive handler of the socket.
+ */
+
+
+enum {
+	SSRC_HASH_SIZE = 4,    /**< Initial size, grows with the SSRCs */
+	SSRC_MAX       = 32,   /**< Learned SSRCs per stream */
+};
+
+
+/** Defines the RTP demultiplexer of an RTP Socket */
+struct rtp_demux {
+	struct list streaml;     /**< Streams                     */
+	struct hash *ht_ssrc;    /**< SSRC entries                */
+	struct ssrc_ent *last;   /**< Last matched SSRC entry     */
+	struct rtp_sock *rs;     /**< Parent RTP Socket           */
+	uint8_t mid_id;          /**< MID extension ID, 0 for none */
+};
+
+/** Defines a stream of a BUNDLE group */
+struct rtp_stream {
+	struct le le;            /**< Member of demux streaml     */
+	struct list ssrcl;       /**< SSRC entries of the stream  */
+	struct rtp_demux *dmx;   /**< NULL if the socket is gone  */
+	char *mid;
+	rtp_recv_h *recvh;
+	void *arg;
+	uint32_t ssrc;           /**< Latest SSRC                 */
+};
+
+/** SSRC of a stream */
+struct ssrc_ent {
+	struct le he;            /**< Member of demux hash table  */
+	struct le le;            /**< Member of stream ssrcl      */
+	struct rtp_stream *st;
+	uint32_t ssrc;
+};
+
+
+static void ssrc_destructor(void *data)
+{
+	struct ssrc_ent *ent = data;
+
+	if (ent->st->dmx && ent->st->dmx->last == ent)
+		ent->st->dmx->last = NULL;
+
+	hash_unlink(&ent->he);
+	list_unlink(&ent->le);
+}
+
+
+static void stream_destructor(void *data)
+{
+	struct rtp_stream *st = data;
+
+	list_flush(&st->ssrcl);
+	list_unlink(&st->le);
+	mem_deref(st->mid);
+}
+
+
+static void demux_destructor(void *data)
+{
+	struct rtp_demux *dmx = data;
+	struct le *le;
+
+	dmx->last = NULL;
+
+	/* the streams are owned by the application */
+	for (le = dmx->streaml.head; le; le = le->next) {
+
+		struct rtp_stream *st = le->data;
+
+		list_flush(&st->ssrcl);
+		st->dmx = NULL;
+	}
+
+	list_clear(&dmx->streaml);
+	mem_deref(dmx->ht_ssrc);
+}
+
+
+static uint32_t ssrc_key(const struct le *le)
+{
+	const struct ssrc_ent *ent = le->data;
+
+	return ent->ssrc;
+}
+
+
+int rtp_demux_alloc(struct rtp_demux **dmxp, struct rtp_sock *rs)
+{
+	struct rtp_demux *dmx;
+	int err;
+
+	if (!dmxp || !rs)
+		return EINVAL;
+
+	dmx = mem_zalloc(sizeof(*dmx), demux_destructor);
+	if (!dmx)
+		return ENOMEM;
+
+	dmx->rs = rs;
+
+	err = hash_alloc_auto(&dmx->ht_ssrc, SSRC_HASH_SIZE, ssrc_key);
+	if (err)
+		mem_deref(dmx);
+	else
+		*dmxp = dmx;
+
+	return err;
+}
+
+
+static bool ssrc_cmp_handler(struct le *le, void *arg)
+{
+	const struct ssrc_ent *ent = le->data;
+
+	return ent->ssrc == *(uint32_t *)arg;
+}
+
+
+static struct ssrc_ent *ssrc_find(struct rtp_demux *dmx, uint32_t ssrc)
+{
+	struct ssrc_ent *ent = dmx->last;
+
+	if (ent && ent->ssrc == ssrc)
+		return ent;
+
+	ent = list_ledata(hash_lookup(dmx->ht_ssrc, ssrc,
+				      ssrc_cmp_handler, &ssrc));
+	if (ent)
+		dmx->last = ent;
+
+	return ent;
+}
+
+
+static int ssrc_add(struct rtp_stream *st, uint32_t ssrc)
+{
+	struct rtp_demux *dmx = st->dmx;
+	struct ssrc_ent *ent;
+
+	ent = ssrc_find(dmx, ssrc);
+	if (ent && ent->st == st)
+		return 0;
+
+	/* An SSRC belongs to one stream; a MID may move it */
+	mem_deref(ent);
+
+	/* The oldest learned SSRC is replaced */
+	if (list_count(&st->ssrcl) >= SSRC_MAX)
+		mem_deref(list_ledata(st->ssrcl.head));
+
+	ent = mem_zalloc(sizeof(*ent), ssrc_destructor);
+	if (!ent)
+		return ENOMEM;
+
+	ent->st   = st;
+	ent->ssrc = ssrc;
+
+	hash_append(dmx->ht_ssrc, ssrc, &ent->he, ent);
+	list_append(&st->ssrcl, &ent->le, ent);
+
+	st->ssrc = ssrc;
+
+	return 0;
+}
+
+
+static struct rtp_stream *mid_match(struct rtp_demux *dmx,
+				    const struct pl *mid)
+{
+	struct le *le;
+
+	for (le = dmx->streaml.head; le; le = le->next) {
+
+		struct rtp_stream *st = le->data;
+
+		if (st->mid && 0 == pl_strcmp(mid, st->mid))
+			return st;
+	}
+
+	return NULL;
+}
+
+
+/* Deliver a packet to its stream; returns false if it has none */
+bool rtp_demux_recv(struct rtp_demux *dmx, const struct sa *src,
+		    const struct rtp_header *hdr, struct mbuf *mb)
+{
+	struct rtp_stream *st;
+	struct ssrc_ent *ent;
+	struct rtp_ext ext;
+	struct pl mid;
+
+	ent = ssrc_find(dmx, hdr->ssrc);
+	if (ent) {
+		st = ent->st;
+	}
+	else {
+		if (!dmx->mid_id || !rtp_ext_find(&ext, hdr, mb, dmx->mid_id))
+			return false;
+
+		mid.p = (const char *)ext.data;
+		mid.l = ext.len;
+
+		st = mid_match(dmx, &mid);
+		if (!st)
+			return false;
+
+		(void)ssrc_add(st, hdr->ssrc);
+	}
+
+	if (st->recvh)
+		st->recvh(src, hdr, mb, st->arg);
+
+	return true;
+}
+
+
+/**
+ * Add a stream to the BUNDLE demultiplexer of an RTP Socket. Packets
+ * with an SSRC of the stream, or with its MID, are delivered to the
+ * stream's receive handler instead of the socket's. The stream is
+ * removed when it is dereferenced.
+ *
+ * @param stp   Pointer to allocated stream
+ * @param rs    RTP Socket
+ * @param mid   Optional media identification (MID) of the stream
+ * @param recvh RTP Receive handler of the stream
+ * @param arg   Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtp_stream_alloc(struct rtp_stream **stp, struct rtp_sock *rs,
+		     const char *mid, rtp_recv_h *recvh, void *arg)
+{
+	struct rtp_stream *st;
+	struct rtp_demux *dmx;
+	int err;
+
+	if (!stp || !rs || !recvh)
+		return EINVAL;
+
+	err = rtp_demux_get(&dmx, rs);
+	if (err)
+		return err;
+
+	st = mem_zalloc(sizeof(*st), stream_destructor);
+	if (!st)
+		return ENOMEM;
+
+	if (mid) {
+		err = str_dup(&st->mid, mid);
+		if (err) {
+			mem_deref(st);
+			return err;
+		}
+	}
+
+	st->dmx   = dmx;
+	st->recvh = recvh;
+	st->arg   = arg;
+
+	list_append(&dmx->streaml, &st->le, st);
+
+	*stp = st;
+
+	return 0;
+}
+
+
+/**
+ * Add a known SSRC to a stream, e.g. from the a=ssrc lines of its SDP
+ * media description
+ *
+ * @param st   Stream
+ * @param ssrc Synchronization source
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtp_stream_ssrc_add(struct rtp_stream *st, uint32_t ssrc)
+{
+	if (!st || !st->dmx)
+		return EINVAL;
+
+	return ssrc_add(st, ssrc);
+}
+
+
+/**
+ * Set the ID of the MID header extension of an RTP Socket, as
+ * negotiated with a=extmap for urn:ietf:params:rtp-hdrext:sdes:mid
+ *
+ * @param rs RTP Socket
+ * @param id Extension ID 1-255, 0 to not match by MID
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtp_stream_mid_extid_set(struct rtp_sock *rs, uint8_t id)
+{
+	struct rtp_demux *dmx;
+	int err;
+
+	if (!rs)
+		return EINVAL;
+
+	err = rtp_demux_get(&dmx, rs);
+	if (err)
+		return err;
+
+	dmx->mid_id = id;
+
+	return 0;
+}
+
+
+/**
+ * Get the RTCP statistics of the latest SSRC of a stream
+ *
+ * @param st    Stream
+ * @param stats Returned RTCP statistics
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtp_stream_stats(const struct rtp_stream *st, struct rtcp_stats *stats)
+{
+	if (!st || !stats || !st->dmx)
+		return EINVAL;
+
+	if (list_isempty(&st->ssrcl))
+		return ENOENT;
+
+	return rtcp_stats(st->dmx->rs, st->ssrc, stats);
+}
+
+
+/**
+ * Get the latest SSRC of a stream
+ *
+ * @param st Stream
+ *
+ * @return Synchronization source, 0 if none is known
+ */
+uint32_t rtp_stream_ssrc(const struct rtp_stream *st)
+{
+	return st && !list_isempty(&st->ssrcl) ? st->ssrc : 0;
+}
@@ -0,0 +1,387 @@
+/**
+ * @file ext.c  RTP header extensions (RFC 8285)
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re_types.h>
+#include <re_fmt.h>
+#include <re_mem.h>
+#include <re_mbuf.h>
+#include <re_sa.h>
+#include <re_rtp.h>
+
+
+/*
+ * The elements are read in place from the received buffer, and written
+ * in place to the buffer that is sent, in front of the payload. The
+ * one-byte form has IDs 1-14 and 1-16 bytes of data, the two-byte form
+ * IDs 1-255 and 0-255 bytes.
+ */
+
+
+enum {
+	EXT_ONEBYTE  = 0xbede,
+	EXT_TWOBYTE  = 0x1000,
+	ID_RESERVED  = 15,
+};
+
+
+/**
+ * Start iterating over the header extension elements of an RTP packet
+ *
+ * @param it  Iterator
+ * @param hdr Decoded RTP header
+ * @param mb  Buffer, positioned after the RTP header
+ *
+ * @return 0 if success, ENOENT if there are no RFC 8285 elements
+ */
+int rtp_ext_iter_init(struct rtp_ext_iter *it, const struct rtp_header *hdr,
+		      const struct mbuf *mb)
+{
+	const size_t len = hdr ? hdr->x.len * 4 : 0;
+
+	if (!it || !hdr || !mb)
+		return EINVAL;
+
+	it->p = it->end = NULL;
+
+	if (!hdr->ext)
+		return ENOENT;
+
+	if (hdr->x.type == EXT_ONEBYTE)
+		it->twobyte = false;
+	else if ((hdr->x.type & 0xfff0) == EXT_TWOBYTE)
+		it->twobyte = true;
+	else
+		return ENOENT;
+
+	if (mb->pos < len)
+		return EINVAL;
+
+	it->end = mb->buf + mb->pos;
+	it->p   = it->end - len;
+
+	return 0;
+}
+
+
+/**
+ * Get the next header extension element
+ *
+ * @param it  Iterator
+ * @param ext Returned element, pointing into the buffer
+ *
+ * @return True if an element was returned, false at the end
+ */
+bool rtp_ext_next(struct rtp_ext_iter *it, struct rtp_ext *ext)
+{
+	if (!it || !ext)
+		return false;
+
+	while (it->p < it->end) {
+
+		const uint8_t *p = it->p;
+		uint8_t id;
+		size_t len;
+
+		/* Padding */
+		if (*p == 0) {
+			++it->p;
+			continue;
+		}
+
+		if (it->twobyte) {
+			if (it->end - p < 2)
+				break;
+
+			id  = p[0];
+			len = p[1];
+			p  += 2;
+		}
+		else {
+			id  = *p >> 4;
+			len = (*p & 0x0f) + 1;
+
+			/* The rest of the block is not elements */
+			if (id == ID_RESERVED)
+				break;
+
+			++p;
+		}
+
+		if ((size_t)(it->end - p) < len)
+			break;
+
+		ext->id   = id;
+		ext->len  = (uint8_t)len;
+		ext->data = p;
+
+		it->p = p + len;
+
+		return true;
+	}
+
+	it->p = it->end;
+
+	return false;
+}
+
+
+/**
+ * Look up the header extension elements of an RTP packet by ID. The
+ * elements with IDs below RTP_EXT_SLOTS are returned in slotv, indexed
+ * by ID; the length of a missing element is 0 and its data NULL.
+ *
+ * @param slotv Array of RTP_EXT_SLOTS elements
+ * @param hdr   Decoded RTP header
+ * @param mb    Buffer, positioned after the RTP header
+ *
+ * @return Number of elements found
+ */
+unsigned rtp_ext_slots(struct rtp_ext *slotv, const struct rtp_header *hdr,
+		       const struct mbuf *mb)
+{
+	struct rtp_ext_iter it;
+	struct rtp_ext ext;
+	unsigned n = 0;
+
+	if (!slotv)
+		return 0;
+
+	memset(slotv, 0, RTP_EXT_SLOTS * sizeof(*slotv));
+
+	if (rtp_ext_iter_init(&it, hdr, mb))
+		return 0;
+
+	while (rtp_ext_next(&it, &ext)) {
+
+		if (ext.id >= RTP_EXT_SLOTS || slotv[ext.id].data)
+			continue;
+
+		slotv[ext.id] = ext;
+		++n;
+	}
+
+	return n;
+}
+
+
+/**
+ * Find a header extension element of an RTP packet by ID
+ *
+ * @param ext Returned element, pointing into the buffer
+ * @param hdr Decoded RTP header
+ * @param mb  Buffer, positioned after the RTP header
+ * @param id  Extension ID
+ *
+ * @return True if found, otherwise false
+ */
+bool rtp_ext_find(struct rtp_ext *ext, const struct rtp_header *hdr,
+		  const struct mbuf *mb, uint8_t id)
+{
+	struct rtp_ext_iter it;
+
+	if (!ext || !id || rtp_ext_iter_init(&it, hdr, mb))
+		return false;
+
+	while (rtp_ext_next(&it, ext)) {
+
+		if (ext->id == id)
+			return true;
+	}
+
+	return false;
+}
+
+
+/**
+ * Start writing a header extension block at the current position of a
+ * buffer, e.g. at the start of the payload from rtp_mbuf_alloc(). The
+ * packet is then sent with the extension bit set.
+ *
+ * @param enc     Encoder state
+ * @param mb      Buffer to write to
+ * @param twobyte True for the two-byte form
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtp_ext_begin(struct rtp_ext_enc *enc, struct mbuf *mb, bool twobyte)
+{
+	int err;
+
+	if (!enc || !mb)
+		return EINVAL;
+
+	enc->mb      = mb;
+	enc->start   = mb->pos;
+	enc->twobyte = twobyte;
+
+	err  = mbuf_write_u16(mb, htons(twobyte ? EXT_TWOBYTE : EXT_ONEBYTE));
+	err |= mbuf_write_u16(mb, 0);
+
+	return err;
+}
+
+
+/**
+ * Write a header extension element
+ *
+ * @param enc  Encoder state
+ * @param id   Extension ID
+ * @param data Element data
+ * @param len  Length of data
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtp_ext_write(struct rtp_ext_enc *enc, uint8_t id, const void *data,
+		  size_t len)
+{
+	struct mbuf *mb = enc ? enc->mb : NULL;
+	uint8_t *p;
+
+	if (!mb || !id || (len && !data))
+		return EINVAL;
+
+	if (enc->twobyte) {
+		if (len > 255)
+			return ERANGE;
+
+		p = mbuf_reserve(mb, 2 + len);
+		if (!p)
+			return ENOMEM;
+
+		*p++ = id;
+		*p++ = (uint8_t)len;
+	}
+	else {
+		if (id >= ID_RESERVED || !len || len > 16)
+			return ERANGE;
+
+		p = mbuf_reserve(mb, 1 + len);
+		if (!p)
+			return ENOMEM;
+
+		*p++ = (uint8_t)(id << 4 | (len - 1));
+	}
+
+	memcpy(p, data, len);
+
+	return 0;
+}
+
+
+/**
+ * Finish a header extension block, with padding and its length
+ *
+ * @param enc Encoder state
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtp_ext_end(struct rtp_ext_enc *enc)
+{
+	struct mbuf *mb = enc ? enc->mb : NULL;
+	size_t len, words;
+	uint8_t *p;
+
+	if (!mb || mb->pos < enc->start + 4)
+		return EINVAL;
+
+	len   = mb->pos - enc->start - 4;
+	words = (len + 3) / 4;
+
+	if (words > 0xffff)
+		return ERANGE;
+
+	if (words * 4 > len) {
+		p = mbuf_reserve(mb, words * 4 - len);
+		if (!p)
+			return ENOMEM;
+
+		memset(p, 0, words * 4 - len);
+	}
+
+	(void)mbuf_store_u16(mb->buf + enc->start + 2, (uint16_t)words);
+
+	return 0;
+}
+
+
+/**
+ * Write an abs-send-time element, 6.18 fixed point seconds
+ *
+ * @param enc Encoder state
+ * @param id  Extension ID
+ * @param us  Send time in [us]
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtp_ext_write_abs_send_time(struct rtp_ext_enc *enc, uint8_t id,
+				uint64_t us)
+{
+	/* The field wraps every 64 seconds */
+	const uint32_t v = (uint32_t)(((us % 64000000) << 18) / 1000000);
+	uint8_t buf[3];
+
+	buf[0] = v >> 16;
+	buf[1] = v >> 8;
+	buf[2] = v;
+
+	return rtp_ext_write(enc, id, buf, sizeof(buf));
+}
+
+
+/**
+ * Write a transport-wide sequence number element
+ *
+ * @param enc Encoder state
+ * @param id  Extension ID
+ * @param seq Transport-wide sequence number
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtp_ext_write_twcc(struct rtp_ext_enc *enc, uint8_t id, uint16_t seq)
+{
+	uint8_t buf[2];
+
+	(void)mbuf_store_u16(buf, seq);
+
+	return rtp_ext_write(enc, id, buf, sizeof(buf));
+}
+
+
+/**
+ * Write an audio level element (RFC 6464)
+ *
+ * @param enc   Encoder state
+ * @param id    Extension ID
+ * @param vad   Voice activity flag
+ * @param level Audio level in -dBov, 0-127
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtp_ext_write_audio_level(struct rtp_ext_enc *enc, uint8_t id, bool vad,
+			      uint8_t level)
+{
+	const uint8_t v = (vad ? 0x80 : 0) | (level & 0x7f);
+
+	return rtp_ext_write(enc, id, &v, 1);
+}
+
+
+/**
+ * Write a MID element (RFC 8843)
+ *
+ * @param enc Encoder state
+ * @param id  Extension ID
+ * @param mid Media identification
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtp_ext_write_mid(struct rtp_ext_enc *enc, uint8_t id, const char *mid)
+{
+	if (!mid)
+		return EINVAL;
+
+	return rtp_ext_write(enc, id, mid, strlen(mid));
+}
@@ -22,7 +22,17 @@
 
 enum {
 	GNACK_SIZE = 4,
-	SLI_SIZE   = 4
+	SLI_SIZE   = 4,
+	TWCC_SIZE  = 8,
+	TWCC_RUN   = 7,     /**< Shortest run-length chunk          */
+	TWCC_RMAX  = 8191,  /**< Longest run-length chunk           */
+};
+
+/** Transport-wide CC packet status symbols */
+enum twcc_sym {
+	SYM_LOST  = 0,  /**< Not received                    */
+	SYM_SMALL = 1,  /**< Received, 8-bit delta           */
+	SYM_LARGE = 2,  /**< Received, signed 16-bit delta   */
 };
 
 
@@ -47,6 +57,88 @@ int rtcp_rtpfb_gnack_encode(struct mbuf *mb, uint16_t pid, uint16_t blp)
 }
 
 
+/**
+ * Encode an RTCP Transport-wide CC feedback message, of packets base to
+ * base + n - 1 (draft-holmer-rmcat-transport-wide-cc-extensions)
+ *
+ * @param mb      Buffer to encode into
+ * @param base    Sequence number of the first packet
+ * @param fbc     Feedback packet count
+ * @param reftime Reference time in [64 ms]
+ * @param deltav  Receive time of each packet in [250 us] from the
+ *                reference time, or TWCC_LOST
+ * @param n       Number of packets
+ *
+ * @return 0 for success, otherwise errorcode
+ */
+int rtcp_rtpfb_twcc_encode(struct mbuf *mb, uint16_t base, uint8_t fbc,
+			   int32_t reftime, const int32_t *deltav,
+			   uint16_t n)
+{
+	uint8_t symv[TWCC_MAX];
+	int16_t dv[TWCC_MAX];
+	int32_t prev = 0;
+	uint16_t i;
+	int err;
+
+	if (!mb || !deltav || !n || n > TWCC_MAX)
+		return EINVAL;
+
+	for (i=0; i<n; i++) {
+
+		const int32_t d = deltav[i] - prev;
+
+		/* A delta that does not fit is reported as lost */
+		if (deltav[i] == TWCC_LOST || d < INT16_MIN || d > INT16_MAX) {
+			symv[i] = SYM_LOST;
+			continue;
+		}
+
+		symv[i] = (d >= 0 && d <= 255) ? SYM_SMALL : SYM_LARGE;
+		dv[i]   = (int16_t)d;
+		prev    = deltav[i];
+	}
+
+	err  = mbuf_write_u16(mb, htons(base));
+	err |= mbuf_write_u16(mb, htons(n));
+	err |= mbuf_write_u32(mb, htonl((uint32_t)reftime << 8 | fbc));
+
+	for (i=0; i<n && !err; ) {
+
+		uint16_t run = 1, chunk = 0, k;
+
+		while (i + run < n && run < TWCC_RMAX &&
+		       symv[i + run] == symv[i])
+			++run;
+
+		if (run >= TWCC_RUN) {
+			chunk = symv[i] << 13 | run;
+			i += run;
+		}
+		else {
+			/* Status vector of seven 2-bit symbols */
+			chunk = 0xc000;
+			for (k=0; k<7; k++, i++) {
+				if (i < n)
+					chunk |= symv[i] << (2 * (6 - k));
+			}
+		}
+
+		err = mbuf_write_u16(mb, htons(chunk));
+	}
+
+	for (i=0; i<n && !err; i++) {
+
+		if (symv[i] == SYM_SMALL)
+			err = mbuf_write_u8(mb, (uint8_t)dv[i]);
+		else if (symv[i] == SYM_LARGE)
+			err = mbuf_write_u16(mb, htons((uint16_t)dv[i]));
+	}
+
+	return err;
+}
+
+
 /**
  * Encode an RTCP Slice Loss Indication (SLI) message
  *
@@ -68,6 +160,104 @@ int rtcp_psfb_sli_encode(struct mbuf *mb, uint16_t first, uint16_t number,
 /* Decode functions */
 
 
+/**
+ * Decode an RTCP Transport-wide CC feedback message
+ *
+ * @param mb       Buffer with the FCI to decode
+ * @param basep    Returned sequence number of the first packet
+ * @param fbcp     Returned feedback packet count
+ * @param reftimep Returned reference time in [64 ms]
+ * @param deltav   Returned receive time of each packet in [250 us] from
+ *                 the reference time, or TWCC_LOST
+ * @param np       Size of deltav, returned number of packets
+ *
+ * @return 0 for success, otherwise errorcode
+ */
+int rtcp_rtpfb_twcc_decode(struct mbuf *mb, uint16_t *basep, uint8_t *fbcp,
+			   int32_t *reftimep, int32_t *deltav, uint16_t *np)
+{
+	uint8_t symv[TWCC_MAX];
+	uint16_t n, c = 0, i;
+	uint32_t v;
+	int32_t t = 0;
+
+	if (!mb || !basep || !fbcp || !reftimep || !deltav || !np)
+		return EINVAL;
+
+	if (mbuf_get_left(mb) < TWCC_SIZE)
+		return EBADMSG;
+
+	*basep = ntohs(mbuf_read_u16(mb));
+	n      = ntohs(mbuf_read_u16(mb));
+	v      = ntohl(mbuf_read_u32(mb));
+
+	/* 24-bit signed */
+	*reftimep = (int32_t)(v & 0xffffff00) >> 8;
+	*fbcp     = v & 0xff;
+
+	if (!n || n > *np || n > TWCC_MAX)
+		return ERANGE;
+
+	while (c < n) {
+
+		uint16_t chunk, k;
+
+		if (mbuf_get_left(mb) < 2)
+			return EBADMSG;
+
+		chunk = ntohs(mbuf_read_u16(mb));
+
+		if (!(chunk & 0x8000)) {
+			const uint16_t run = chunk & 0x1fff;
+
+			for (k=0; k<run && c<n; k++)
+				symv[c++] = chunk >> 13 & 0x3;
+		}
+		else if (chunk & 0x4000) {
+			for (k=0; k<7 && c<n; k++)
+				symv[c++] = chunk >> (2 * (6 - k)) & 0x3;
+		}
+		else {
+			for (k=0; k<14 && c<n; k++)
+				symv[c++] = chunk >> (13 - k) & 0x1;
+		}
+	}
+
+	for (i=0; i<n; i++) {
+
+		switch (symv[i]) {
+
+		case SYM_LOST:
+			deltav[i] = TWCC_LOST;
+			continue;
+
+		case SYM_SMALL:
+			if (mbuf_get_left(mb) < 1)
+				return EBADMSG;
+
+			t += mbuf_read_u8(mb);
+			break;
+
+		case SYM_LARGE:
+			if (mbuf_get_left(mb) < 2)
+				return EBADMSG;
+
+			t += (int16_t)ntohs(mbuf_read_u16(mb));
+			break;
+
+		default:
+			return EBADMSG;
+		}
+
+		deltav[i] = t;
+	}
+
+	*np = n;
+
+	return 0;
+}
+
+
 /**
  * Decode an RTCP Transport Layer Feedback Message
  *
@@ -99,6 +289,20 @@ int rtcp_rtpfb_decode(struct mbuf *mb, struct rtcp_msg *msg)
 		}
 		break;
 
+	case RTCP_RTPFB_TWCC:
+		sz = msg->r.fb.n * 4;
+
+		if (mbuf_get_left(mb) < sz)
+			return EBADMSG;
+
+		msg->r.fb.fci.twcc = mbuf_alloc_ref(mb);
+		if (!msg->r.fb.fci.twcc)
+			return ENOMEM;
+
+		msg->r.fb.fci.twcc->end = msg->r.fb.fci.twcc->pos + sz;
+		mbuf_advance(mb, sz);
+		break;
+
 	default:
 		DEBUG_NOTICE("unknown RTPFB fmt %d\n", msg->hdr.count);
 		break;
@@ -32,8 +32,8 @@ struct rtp_member *member_add(struct hash *ht, uint32_t src)
 	if (!mbr)
 		return NULL;
 
-	hash_append(ht, src, &mbr->le, mbr);
 	mbr->src = src;
+	hash_append(ht, src, &mbr->le, mbr);
 
 	return mbr;
 }
@@ -51,3 +51,11 @@ struct rtp_member *member_find(struct hash *ht, uint32_t src)
 {
 	return list_ledata(hash_lookup(ht, src, hash_cmp_handler, &src));
 }
+
+
+uint32_t member_key(const struct le *le)
+{
+	const struct rtp_member *mbr = le->data;
+
+	return mbr->src;
+}
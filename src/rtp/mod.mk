@@ -4,13 +4,20 @@
 # Copyright (C) 2010 Creytiv.com
 #
 
+SRCS	+= rtp/demux.c
+SRCS	+= rtp/ext.c
 SRCS	+= rtp/fb.c
 SRCS	+= rtp/member.c
 SRCS	+= rtp/ntp.c
+SRCS	+= rtp/pace.c
 SRCS	+= rtp/pkt.c
+SRCS	+= rtp/port.c
 SRCS	+= rtp/rr.c
 SRCS	+= rtp/rtcp.c
 SRCS	+= rtp/rtp.c
+SRCS	+= rtp/rtx.c
+SRCS	+= rtp/sched.c
 SRCS	+= rtp/sdes.c
 SRCS	+= rtp/sess.c
 SRCS	+= rtp/source.c
+SRCS	+= rtp/twcc.c
@@ -0,0 +1,282 @@
+/**
+ * @file rtp/pace.c  Send-side RTP pacer
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <re_types.h>
+#include <re_fmt.h>
+#include <re_mem.h>
+#include <re_mbuf.h>
+#include <re_list.h>
+#include <re_tmr.h>
+#include <re_sa.h>
+#include <re_rtp.h>
+#include "rtcp.h"
+
+
+#define DEBUG_MODULE "rtp_pace"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+/*
+ * The pacer is a token bucket that is filled at the target bitrate, up to
+ * the burst size. A packet is sent when the bucket is not empty, and its
+ * size is taken from the bucket, which may go below zero. Other packets
+ * are queued until the bucket is refilled.
+ *
+ * The bucket is accounted in microseconds, and the release timer has
+ * microsecond resolution where the polling method supports it.
+ */
+
+
+/** Pacer values */
+enum {
+	PACE_QMAX  = 1024,      /**< Maximum number of queued packets */
+	PACE_IDLE  = 10000000,  /**< Refill limit for idle time [us]  */
+};
+
+/** Defines a send-side RTP pacer */
+struct rtp_pacer {
+	struct list pktl;       /**< Queued packets               */
+	struct tmr tmr;         /**< Release timer                */
+	struct rtp_sock *rs;    /**< RTP Socket                   */
+	uint64_t ts;            /**< Time of last refill [us]     */
+	int64_t tokens;         /**< Bucket level [bits x 10^6]   */
+	int64_t burst;          /**< Bucket size [bits x 10^6]    */
+	uint32_t bitrate;       /**< Target bitrate [bit/s]       */
+	uint32_t qlen;          /**< Number of queued packets     */
+};
+
+/** Queued RTP packet */
+struct pace_pkt {
+	struct le le;           /**< Linked list element          */
+	struct sa dst;          /**< Destination address          */
+	struct mbuf *mb;        /**< RTP payload                  */
+	uint32_t ts;            /**< RTP timestamp                */
+	uint8_t pt;             /**< RTP payload type             */
+	bool ext;               /**< Extension bit                */
+	bool marker;            /**< Marker bit                   */
+};
+
+
+static void pacer_release(struct rtp_pacer *pacer);
+
+
+static void destructor(void *arg)
+{
+	struct rtp_pacer *pacer = arg;
+
+	tmr_cancel(&pacer->tmr);
+	list_flush(&pacer->pktl);
+	mem_deref(pacer->rs);
+}
+
+
+static void pkt_destructor(void *arg)
+{
+	struct pace_pkt *pkt = arg;
+
+	list_unlink(&pkt->le);
+	mem_deref(pkt->mb);
+}
+
+
+static inline int64_t pkt_cost(const struct mbuf *mb)
+{
+	return (int64_t)(RTP_HEADER_SIZE + mbuf_get_left(mb)) * 8 * 1000000;
+}
+
+
+static void refill(struct rtp_pacer *pacer)
+{
+	const uint64_t now = tmr_jiffies_usec();
+	uint64_t dt = now - pacer->ts;
+
+	if (dt > PACE_IDLE)
+		dt = PACE_IDLE;
+
+	pacer->tokens += (int64_t)dt * pacer->bitrate;
+	if (pacer->tokens > pacer->burst)
+		pacer->tokens = pacer->burst;
+
+	pacer->ts = now;
+}
+
+
+static void tmr_handler(void *arg)
+{
+	struct rtp_pacer *pacer = arg;
+
+	pacer_release(pacer);
+}
+
+
+static void pacer_release(struct rtp_pacer *pacer)
+{
+	uint64_t delay;
+
+	refill(pacer);
+
+	while (pacer->pktl.head && pacer->tokens > 0) {
+
+		struct pace_pkt *pkt = pacer->pktl.head->data;
+		int err;
+
+		pacer->tokens -= pkt_cost(pkt->mb);
+
+		err = rtp_send(pacer->rs, &pkt->dst, pkt->ext, pkt->marker,
+			       pkt->pt, pkt->ts, pkt->mb);
+		if (err) {
+			DEBUG_WARNING("pace: rtp_send failed (%m)\n", err);
+		}
+
+		--pacer->qlen;
+		mem_deref(pkt);
+	}
+
+	if (!pacer->pktl.head)
+		return;
+
+	/* time until the bucket is no longer empty [us] */
+	delay = (uint64_t)(1 - pacer->tokens) / pacer->bitrate + 1;
+
+	tmr_start_us(&pacer->tmr, delay, tmr_handler, pacer);
+}
+
+
+/**
+ * Allocate a send-side RTP pacer. Packets sent through the pacer are
+ * spread out at the target bitrate, after an initial burst.
+ *
+ * @param pacerp  Pointer to allocated RTP pacer
+ * @param rs      RTP Socket
+ * @param bitrate Target bitrate in [bit/s]
+ * @param burst   Burst allowance in [bytes]
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtp_pacer_alloc(struct rtp_pacer **pacerp, struct rtp_sock *rs,
+		    uint32_t bitrate, uint32_t burst)
+{
+	struct rtp_pacer *pacer;
+
+	if (!pacerp || !rs || !bitrate)
+		return EINVAL;
+
+	pacer = mem_zalloc(sizeof(*pacer), destructor);
+	if (!pacer)
+		return ENOMEM;
+
+	list_init(&pacer->pktl);
+	tmr_init(&pacer->tmr);
+
+	pacer->rs = mem_ref(rs);
+	pacer->ts = tmr_jiffies_usec();
+
+	rtp_pacer_set(pacer, bitrate, burst);
+
+	pacer->tokens = pacer->burst;
+
+	*pacerp = pacer;
+
+	return 0;
+}
+
+
+/**
+ * Set the target bitrate and burst allowance of an RTP pacer
+ *
+ * @param pacer   RTP pacer
+ * @param bitrate Target bitrate in [bit/s]
+ * @param burst   Burst allowance in [bytes]
+ */
+void rtp_pacer_set(struct rtp_pacer *pacer, uint32_t bitrate, uint32_t burst)
+{
+	if (!pacer || !bitrate)
+		return;
+
+	refill(pacer);
+
+	pacer->bitrate = bitrate;
+	pacer->burst   = (int64_t)burst * 8 * 1000000;
+
+	if (pacer->tokens > pacer->burst)
+		pacer->tokens = pacer->burst;
+
+	if (tmr_isrunning(&pacer->tmr)) {
+		tmr_cancel(&pacer->tmr);
+		pacer_release(pacer);
+	}
+}
+
+
+/**
+ * Send an RTP packet through the pacer. The packet is sent now if the
+ * pacer allows it, otherwise it is queued and the pacer keeps a
+ * reference to the buffer until it was sent.
+ *
+ * @param pacer  RTP pacer
+ * @param dst    Destination address
+ * @param ext    Extension bit
+ * @param marker Marker bit
+ * @param pt     Payload type
+ * @param ts     Timestamp
+ * @param mb     Payload buffer, with headroom for the RTP header
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtp_pacer_send(struct rtp_pacer *pacer, const struct sa *dst, bool ext,
+		   bool marker, uint8_t pt, uint32_t ts, struct mbuf *mb)
+{
+	struct pace_pkt *pkt;
+
+	if (!pacer || !dst || !mb)
+		return EINVAL;
+
+	if (!pacer->pktl.head) {
+
+		refill(pacer);
+
+		if (pacer->tokens > 0) {
+			pacer->tokens -= pkt_cost(mb);
+			return rtp_send(pacer->rs, dst, ext, marker, pt, ts,
+					mb);
+		}
+	}
+
+	if (pacer->qlen >= PACE_QMAX)
+		return ENOBUFS;
+
+	pkt = mem_zalloc(sizeof(*pkt), pkt_destructor);
+	if (!pkt)
+		return ENOMEM;
+
+	pkt->dst    = *dst;
+	pkt->mb     = mem_ref(mb);
+	pkt->ts     = ts;
+	pkt->pt     = pt;
+	pkt->ext    = ext;
+	pkt->marker = marker;
+
+	list_append(&pacer->pktl, &pkt->le, pkt);
+	++pacer->qlen;
+
+	if (!tmr_isrunning(&pacer->tmr))
+		pacer_release(pacer);
+
+	return 0;
+}
+
+
+/**
+ * Get the number of packets queued in an RTP pacer
+ *
+ * @param pacer RTP pacer
+ *
+ * @return Number of queued packets
+ */
+uint32_t rtp_pacer_qlen(const struct rtp_pacer *pacer)
+{
+	return pacer ? pacer->qlen : 0;
+}
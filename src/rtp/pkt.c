@@ -85,16 +85,20 @@ static void rtcp_destructor(void *data)
 int rtcp_hdr_encode(struct mbuf *mb, uint8_t count, enum rtcp_type type,
 		    uint16_t length)
 {
-	int err;
+	uint8_t *p;
 
 	if (!mb)
 		return EINVAL;
 
-	err  = mbuf_write_u8(mb, RTCP_VERSION<<6 | count);
-	err |= mbuf_write_u8(mb, type);
-	err |= mbuf_write_u16(mb, htons(length));
+	p = mbuf_reserve(mb, RTCP_HDR_SIZE);
+	if (!p)
+		return ENOMEM;
+
+	p = mbuf_store_u8(p, RTCP_VERSION<<6 | count);
+	p = mbuf_store_u8(p, type);
+	(void)mbuf_store_u16(p, length);
 
-	return err;
+	return 0;
 }
 
 
@@ -461,3 +465,144 @@ int rtcp_decode(struct rtcp_msg **msgp, struct mbuf *mb)
 	mem_deref(msg);
 	return EBADMSG;
 }
+
+
+/**
+ * Decode one RTCP message from a buffer in place, without allocating
+ * memory. The view is valid until the buffer is changed or freed, and
+ * is overwritten by the next call.
+ *
+ * @param v  RTCP view to decode into
+ * @param mb Buffer to decode from
+ *
+ * @return 0 for success, otherwise errorcode
+ */
+int rtcp_view_decode(struct rtcp_view *v, struct mbuf *mb)
+{
+	struct rtcp_msg *msg;
+	size_t start, i, count, rem, len;
+	int err = 0;
+
+	if (!v)
+		return EINVAL;
+	if (mbuf_get_left(mb) < RTCP_HDR_SIZE)
+		return EBADMSG;
+
+	msg = &v->msg;
+	memset(msg, 0, sizeof(*msg));
+
+	start = mb->pos;
+
+	err = rtcp_hdr_decode(mb, &msg->hdr);
+	if (err)
+		return err;
+
+	if (msg->hdr.version != RTCP_VERSION)
+		return EBADMSG;
+
+	rem = msg->hdr.length * sizeof(uint32_t);
+	if (mbuf_get_left(mb) < rem)
+		return EBADMSG;
+
+	count       = msg->hdr.count;
+	v->body     = mbuf_buf(mb);
+	v->len      = rem;
+	v->complete = true;
+
+	switch (msg->hdr.pt) {
+
+	case RTCP_SR:
+		if (rem < RTCP_SRC_SIZE + RTCP_SR_SIZE + count * RTCP_RR_SIZE)
+			return EBADMSG;
+		msg->r.sr.ssrc     = ntohl(mbuf_read_u32(mb));
+		msg->r.sr.ntp_sec  = ntohl(mbuf_read_u32(mb));
+		msg->r.sr.ntp_frac = ntohl(mbuf_read_u32(mb));
+		msg->r.sr.rtp_ts   = ntohl(mbuf_read_u32(mb));
+		msg->r.sr.psent    = ntohl(mbuf_read_u32(mb));
+		msg->r.sr.osent    = ntohl(mbuf_read_u32(mb));
+		msg->r.sr.rrv      = v->u.rrv;
+
+		for (i=0; i<count && !err; i++)
+			err = rtcp_rr_decode(mb, &v->u.rrv[i]);
+		break;
+
+	case RTCP_RR:
+		if (rem < RTCP_SRC_SIZE + count * RTCP_RR_SIZE)
+			return EBADMSG;
+		msg->r.rr.ssrc = ntohl(mbuf_read_u32(mb));
+		msg->r.rr.rrv  = v->u.rrv;
+
+		for (i=0; i<count && !err; i++)
+			err = rtcp_rr_decode(mb, &v->u.rrv[i]);
+		break;
+
+	case RTCP_BYE:
+		if (rem < count * sizeof(uint32_t))
+			return EBADMSG;
+		for (i=0; i<count; i++)
+			v->u.srcv[i] = ntohl(mbuf_read_u32(mb));
+		msg->r.bye.srcv = v->u.srcv;
+
+		/* decode reason (optional) */
+		if (rem > count*sizeof(uint32_t)) {
+			len = mbuf_read_u8(mb);
+			if (rem < count*sizeof(uint32_t) + 1 + len)
+				return EBADMSG;
+
+			(void)mbuf_read_mem(mb, (uint8_t *)v->reason, len);
+			v->reason[len] = '\0';
+			msg->r.bye.reason = v->reason;
+		}
+		break;
+
+	case RTCP_APP:
+		if (rem < RTCP_APP_SIZE)
+			return EBADMSG;
+		msg->r.app.src = ntohl(mbuf_read_u32(mb));
+		(void)mbuf_read_mem(mb, (uint8_t *)msg->r.app.name,
+				    sizeof(msg->r.app.name));
+		if (rem > RTCP_APP_SIZE) {
+			msg->r.app.data_len = rem - RTCP_APP_SIZE;
+			msg->r.app.data = mbuf_buf(mb);
+		}
+		break;
+
+	case RTCP_FIR:
+		if (rem < RTCP_FIR_SIZE)
+			return EBADMSG;
+		msg->r.fir.ssrc = ntohl(mbuf_read_u32(mb));
+		break;
+
+	case RTCP_NACK:
+		if (rem < RTCP_NACK_SIZE)
+			return EBADMSG;
+		msg->r.nack.ssrc = ntohl(mbuf_read_u32(mb));
+		msg->r.nack.fsn  = ntohs(mbuf_read_u16(mb));
+		msg->r.nack.blp  = ntohs(mbuf_read_u16(mb));
+		break;
+
+	case RTCP_RTPFB:
+	case RTCP_PSFB:
+		if (rem < RTCP_FB_SIZE)
+			return EBADMSG;
+		msg->r.fb.ssrc_packet = ntohl(mbuf_read_u32(mb));
+		msg->r.fb.ssrc_media  = ntohl(mbuf_read_u32(mb));
+		msg->r.fb.n           = msg->hdr.length - 2;
+
+		/* the FCI is left in the body */
+		v->complete = false;
+		break;
+
+	default:
+		/* SDES and unknown types are left in the body */
+		v->complete = false;
+		break;
+	}
+	if (err)
+		return err;
+
+	/* skip the rest of the message, and padding */
+	mb->pos = start + RTCP_HDR_SIZE + rem;
+
+	return 0;
+}
@@ -0,0 +1,168 @@
+/**
+ * @file port.c  Pool of RTP/RTCP port pairs
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re_types.h>
+#include <re_fmt.h>
+#include <re_mem.h>
+#include <re_mbuf.h>
+#include <re_list.h>
+#include <re_bitv.h>
+#include <re_lock.h>
+#include <re_sa.h>
+#include <re_rtp.h>
+#include "rtcp.h"
+
+
+/*
+ * The pool has one bit per pair of an even RTP port and the next odd
+ * RTCP port, set while the pair is free. A pair is found by skipping
+ * words with no free pairs, starting from the word of the last pair
+ * that was handed out, so a full word is passed over with one test.
+ */
+
+
+/** Defines a pool of RTP/RTCP port pairs */
+struct rtp_portpool {
+	struct lock *lock;      /**< Pools may be shared by threads */
+	bitv_t *freev;          /**< Free pairs                     */
+	uint32_t n;             /**< Number of pairs                */
+	uint32_t nfree;         /**< Number of free pairs           */
+	uint32_t next;          /**< Word to search from            */
+	uint16_t base;          /**< RTP port of the first pair     */
+};
+
+
+static void pool_destructor(void *data)
+{
+	struct rtp_portpool *pool = data;
+
+	mem_deref(pool->freev);
+	mem_deref(pool->lock);
+}
+
+
+/**
+ * Allocate a pool of RTP/RTCP port pairs, for use with
+ * rtp_listen_pool(). The RTP port of each pair is even.
+ *
+ * @param poolp    Pointer to allocated pool
+ * @param min_port Minimum port of the range
+ * @param max_port Maximum port of the range
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtp_portpool_alloc(struct rtp_portpool **poolp, uint16_t min_port,
+		       uint16_t max_port)
+{
+	struct rtp_portpool *pool;
+	uint32_t base = (min_port + 1u) & ~1u;
+	int err;
+
+	if (!poolp || !min_port || base >= max_port)
+		return EINVAL;
+
+	pool = mem_zalloc(sizeof(*pool), pool_destructor);
+	if (!pool)
+		return ENOMEM;
+
+	pool->base  = base;
+	pool->n     = (max_port - base + 1) / 2;
+	pool->nfree = pool->n;
+
+	err = lock_alloc(&pool->lock);
+	if (err)
+		goto out;
+
+	pool->freev = mem_alloc(BITV_NELEM(pool->n) * sizeof(bitv_t), NULL);
+	if (!pool->freev) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	bitv_init(pool->freev, pool->n, false);
+	bitv_assign_range(pool->freev, 0, pool->n, true);
+
+ out:
+	if (err)
+		mem_deref(pool);
+	else
+		*poolp = pool;
+
+	return err;
+}
+
+
+/**
+ * Get the number of free port pairs of a pool
+ *
+ * @param pool Port pool
+ *
+ * @return Number of free pairs
+ */
+uint32_t rtp_portpool_count(const struct rtp_portpool *pool)
+{
+	return pool ? pool->nfree : 0;
+}
+
+
+/* Take a free pair; returns the RTP port */
+int rtp_portpool_get(struct rtp_portpool *pool, uint16_t *portp)
+{
+	const uint32_t words = BITV_NELEM(pool->n);
+	uint32_t i, w = 0;
+	bitv_t v;
+	int err = 0;
+
+	lock_write_get(pool->lock);
+
+	if (!pool->nfree) {
+		err = EADDRINUSE;
+		goto out;
+	}
+
+	for (i=0; i<words; i++) {
+
+		w = (pool->next + i) % words;
+		if (pool->freev[w])
+			break;
+	}
+
+	v = pool->freev[w];
+	for (i=0; !(v & 1); i++)
+		v >>= 1;
+
+	i += w * BITS_SZ;
+
+	bitv_clr(pool->freev, i);
+	--pool->nfree;
+	pool->next = w;
+
+	*portp = pool->base + 2 * i;
+
+ out:
+	lock_rel(pool->lock);
+
+	return err;
+}
+
+
+/* Return a pair that was taken with rtp_portpool_get() */
+void rtp_portpool_put(struct rtp_portpool *pool, uint16_t port)
+{
+	const uint32_t i = (uint32_t)(port - pool->base) / 2;
+
+	if (port < pool->base || i >= pool->n)
+		return;
+
+	lock_write_get(pool->lock);
+
+	if (!bitv_val(pool->freev, i)) {
+		bitv_set(pool->freev, i);
+		++pool->nfree;
+	}
+
+	lock_rel(pool->lock);
+}
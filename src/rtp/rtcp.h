@@ -17,6 +17,13 @@ enum {
 	RTCP_FB_SIZE   =   8,  /**< Size of Feedback packets     */
 	RTCP_MAX_SDES  = 255,  /**< Maximum text length for SDES */
 	RTCP_HEADROOM  =   4,  /**< Headroom in RTCP packets     */
+	RTCP_INTERVAL  = 5000, /**< Report interval in [ms]      */
+};
+
+/** Transport-wide CC feedback values */
+enum {
+	TWCC_MAX  = 1024,       /**< Maximum packets per feedback */
+	TWCC_LOST = INT32_MIN,  /**< Packet was not received      */
 };
 
 /** NTP Time */
@@ -56,12 +63,18 @@ struct rtp_member {
 	int cum_lost;             /**< Cumulative number of packets lost   */
 	uint32_t jit;             /**< Jitter in [us]                      */
 	uint32_t rtt;             /**< Round-trip time in [us]             */
+	uint32_t epoch;           /**< Report interval of last activity    */
 };
 
 
+/* Port pool */
+int  rtp_portpool_get(struct rtp_portpool *pool, uint16_t *portp);
+void rtp_portpool_put(struct rtp_portpool *pool, uint16_t port);
+
 /* Member */
 struct rtp_member *member_add(struct hash *ht, uint32_t src);
 struct rtp_member *member_find(struct hash *ht, uint32_t src);
+uint32_t member_key(const struct le *le);
 
 /* Source */
 void source_init_seq(struct rtp_source *s, uint16_t seq);
@@ -81,6 +94,12 @@ int rtcp_sdes_decode(struct mbuf *mb, struct rtcp_sdes *sdes);
 
 /* RTCP Feedback */
 int rtcp_rtpfb_gnack_encode(struct mbuf *mb, uint16_t pid, uint16_t blp);
+int rtcp_rtpfb_twcc_encode(struct mbuf *mb, uint16_t base, uint8_t fbc,
+			   int32_t reftime, const int32_t *deltav,
+			   uint16_t n);
+int rtcp_rtpfb_twcc_decode(struct mbuf *mb, uint16_t *basep, uint8_t *fbcp,
+			   int32_t *reftimep, int32_t *deltav,
+			   uint16_t *np);
 int rtcp_psfb_sli_encode(struct mbuf *mb, uint16_t first, uint16_t number,
 			 uint8_t picid);
 int rtcp_rtpfb_decode(struct mbuf *mb, struct rtcp_msg *msg);
@@ -95,7 +114,22 @@ uint32_t ntp_compact(const struct ntp_time *ntp);
 uint64_t ntp_compact2us(uint32_t ntpc);
 
 /* RTP Socket */
+struct rtp_demux;
+
 struct rtcp_sess *rtp_rtcp_sess(const struct rtp_sock *rs);
+int  rtp_demux_get(struct rtp_demux **dmxp, struct rtp_sock *rs);
+
+/* Transport-wide congestion control */
+void rtp_sock_twcc_set(struct rtp_sock *rs, struct rtp_twcc *tw);
+void rtp_twcc_rx(struct rtp_twcc *tw, const struct rtp_header *hdr,
+		 const struct mbuf *mb);
+void rtp_twcc_tx(struct rtp_twcc *tw, const struct mbuf *mb);
+void rtp_twcc_feedback(struct rtp_twcc *tw, const struct rtcp_msg *msg);
+
+/* RTP demultiplexer */
+int  rtp_demux_alloc(struct rtp_demux **dmxp, struct rtp_sock *rs);
+bool rtp_demux_recv(struct rtp_demux *dmx, const struct sa *src,
+		    const struct rtp_header *hdr, struct mbuf *mb);
 
 /* RTCP message */
 typedef int (rtcp_encode_h)(struct mbuf *mb, void *arg);
@@ -118,3 +152,18 @@ void rtcp_sess_tx_rtp(struct rtcp_sess *sess, uint32_t ts,
 void rtcp_sess_rx_rtp(struct rtcp_sess *sess, uint16_t seq, uint32_t ts,
 		      uint32_t src, size_t payload_size,
 		      const struct sa *peer);
+void rtcp_sess_report(struct rtcp_sess *sess);
+
+/* RTP history */
+struct rtp_hist;
+
+int  rtp_hist_alloc(struct rtp_hist **histp, uint32_t size);
+void rtp_hist_put(struct rtp_hist *hist, uint16_t seq, struct mbuf *mb);
+struct mbuf *rtp_hist_get(const struct rtp_hist *hist, uint16_t seq);
+int  rtp_rtx_encode(struct mbuf **mbp, struct mbuf *orig, size_t headroom,
+		    uint8_t pt, uint16_t seq, uint32_t ssrc);
+
+/* RTCP Scheduler */
+void rtcp_sched_add(struct rtcp_sched *sched, struct le *le,
+		    struct rtcp_sess *sess);
+void rtcp_sched_remove(struct rtcp_sched *sched, struct le *le);
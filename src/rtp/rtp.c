@@ -35,9 +35,25 @@ struct rtp_sock {
 	struct sa local;        /**< Local RTP Address     */
 	struct sa rtcp_peer;    /**< RTCP address of Peer  */
 	rtp_recv_h *recvh;      /**< RTP Receive handler   */
+	rtp_batch_h *batchh;    /**< Batch Receive handler */
+	struct rtp_pkt *pktv;   /**< Pending batch         */
+	unsigned pktn;          /**< Size of batch         */
+	unsigned pktc;          /**< Packets in batch      */
 	rtcp_recv_h *rtcph;     /**< RTCP Receive handler  */
 	void *arg;              /**< Handler argument      */
 	struct rtcp_sess *rtcp; /**< RTCP Session          */
+	struct rtp_hist *hist;  /**< Sent packet history   */
+	struct rtp_demux *dmx;  /**< BUNDLE demultiplexer  */
+	struct rtp_twcc *twcc;  /**< Transport-wide CC     */
+	struct rtp_portpool *pool; /**< Port pool, or NULL */
+	uint16_t pool_port;     /**< RTP port from pool    */
+	/** Retransmission (RTX) */
+	struct {
+		uint32_t ssrc;  /**< RTX SSRC              */
+		uint16_t seq;   /**< RTX sequence number   */
+		uint8_t pt;     /**< RTX payload type      */
+		bool enabled;   /**< RTX is enabled        */
+	} rtx;
 	bool rtcp_mux;          /**< RTP/RTCP multiplexing */
 };
 
@@ -52,29 +68,29 @@ struct rtp_sock {
  */
 int rtp_hdr_encode(struct mbuf *mb, const struct rtp_header *hdr)
 {
-	uint8_t buf[2];
-	int err, i;
+	const int cc = hdr ? (hdr->cc & 0x0f) : 0;
+	uint8_t *p;
+	int i;
 
 	if (!mb || !hdr)
 		return EINVAL;
 
-	buf[0]  = (hdr->ver & 0x02) << 6;
-	buf[0] |= (hdr->pad & 0x01) << 5;
-	buf[0] |= (hdr->ext & 0x01) << 4;
-	buf[0] |= (hdr->cc  & 0x0f) << 0;
-	buf[1]  = (hdr->m   & 0x01) << 7;
-	buf[1] |= (hdr->pt  & 0x7f) << 0;
+	p = mbuf_reserve(mb, RTP_HEADER_SIZE + 4*cc);
+	if (!p)
+		return ENOMEM;
 
-	err  = mbuf_write_mem(mb, buf, sizeof(buf));
-	err |= mbuf_write_u16(mb, htons(hdr->seq));
-	err |= mbuf_write_u32(mb, htonl(hdr->ts));
-	err |= mbuf_write_u32(mb, htonl(hdr->ssrc));
+	p = mbuf_store_u8(p, (hdr->ver & 0x02) << 6 |
+			  (hdr->pad & 0x01) << 5 |
+			  (hdr->ext & 0x01) << 4 | cc);
+	p = mbuf_store_u8(p, (hdr->m & 0x01) << 7 | (hdr->pt & 0x7f));
+	p = mbuf_store_u16(p, hdr->seq);
+	p = mbuf_store_u32(p, hdr->ts);
+	p = mbuf_store_u32(p, hdr->ssrc);
 
-	for (i=0; i<hdr->cc; i++) {
-		err |= mbuf_write_u32(mb, htonl(hdr->csrc[i]));
-	}
+	for (i=0; i<cc; i++)
+		p = mbuf_store_u32(p, hdr->csrc[i]);
 
-	return err;
+	return 0;
 }
 
 
@@ -146,6 +162,7 @@ static void destructor(void *data)
 
 	case IPPROTO_UDP:
 		udp_handler_set(rs->sock_rtp, NULL, NULL);
+		udp_burst_handler_set(rs->sock_rtp, NULL);
 		udp_handler_set(rs->sock_rtcp, NULL, NULL);
 		break;
 
@@ -155,9 +172,53 @@ static void destructor(void *data)
 
 	/* Destroy RTCP Session now */
 	mem_deref(rs->rtcp);
+	mem_deref(rs->hist);
+	mem_deref(rs->dmx);
+
+	while (rs->pktc)
+		mem_deref(rs->pktv[--rs->pktc].mb);
+	mem_deref(rs->pktv);
 
 	mem_deref(rs->sock_rtp);
 	mem_deref(rs->sock_rtcp);
+
+	if (rs->pool) {
+		rtp_portpool_put(rs->pool, rs->pool_port);
+		mem_deref(rs->pool);
+	}
+}
+
+
+/* Without an application handler, the messages are decoded in place */
+static void rtcp_view_recv(struct rtp_sock *rs, struct mbuf *mb)
+{
+	struct rtcp_view v;
+	struct rtcp_msg *msg;
+
+	for (;;) {
+		const size_t pos = mb->pos;
+		size_t end;
+
+		if (rtcp_view_decode(&v, mb))
+			break;
+
+		rtcp_handler(rs->rtcp, &v.msg);
+
+		if (!rs->twcc || v.msg.hdr.pt != RTCP_RTPFB ||
+		    v.msg.hdr.count != RTCP_RTPFB_TWCC)
+			continue;
+
+		/* the feedback needs the decoded FCI */
+		end = mb->pos;
+		mb->pos = pos;
+
+		if (0 == rtcp_decode(&msg, mb)) {
+			rtp_twcc_feedback(rs->twcc, msg);
+			mem_deref(msg);
+		}
+
+		mb->pos = end;
+	}
 }
 
 
@@ -166,11 +227,20 @@ static void rtcp_recv_handler(const struct sa *src, struct mbuf *mb, void *arg)
 	struct rtp_sock *rs = arg;
 	struct rtcp_msg *msg;
 
+	if (!rs->rtcph) {
+		rtcp_view_recv(rs, mb);
+		return;
+	}
+
 	while (0 == rtcp_decode(&msg, mb)) {
 
 		/* handle internally first */
 		rtcp_handler(rs->rtcp, msg);
 
+		if (rs->twcc && msg->hdr.pt == RTCP_RTPFB &&
+		    msg->hdr.count == RTCP_RTPFB_TWCC)
+			rtp_twcc_feedback(rs->twcc, msg);
+
 		/* then relay to application */
 		if (rs->rtcph)
 			rs->rtcph(src, msg, rs->arg);
@@ -180,6 +250,36 @@ static void rtcp_recv_handler(const struct sa *src, struct mbuf *mb, void *arg)
 }
 
 
+/* Deliver the pending batch; the handler may destroy the socket */
+static void batch_flush(struct rtp_sock *rs)
+{
+	struct rtp_pkt *pktv;
+	unsigned i, n = rs->pktc;
+
+	if (!n)
+		return;
+
+	pktv = mem_ref(rs->pktv);
+	rs->pktc = 0;
+
+	rs->batchh(pktv, n, rs->arg);
+
+	for (i=0; i<n; i++)
+		mem_deref(pktv[i].mb);
+
+	mem_deref(pktv);
+}
+
+
+static void udp_burst_handler(void *arg)
+{
+	struct rtp_sock *rs = arg;
+
+	if (rs)
+		batch_flush(rs);
+}
+
+
 static void udp_recv_handler(const struct sa *src, struct mbuf *mb, void *arg)
 {
 	struct rtp_sock *rs = arg;
@@ -210,7 +310,23 @@ static void udp_recv_handler(const struct sa *src, struct mbuf *mb, void *arg)
 				 hdr.ssrc, mbuf_get_left(mb), src);
 	}
 
-	if (rs->recvh)
+	if (rs->twcc && hdr.ext)
+		rtp_twcc_rx(rs->twcc, &hdr, mb);
+
+	if (rs->dmx && rtp_demux_recv(rs->dmx, src, &hdr, mb))
+		return;
+
+	if (rs->batchh) {
+		struct rtp_pkt *pkt = &rs->pktv[rs->pktc++];
+
+		pkt->src = *src;
+		pkt->hdr = hdr;
+		pkt->mb  = mem_ref(mb);
+
+		if (rs->pktc == rs->pktn)
+			batch_flush(rs);
+	}
+	else if (rs->recvh)
 		rs->recvh(src, &hdr, mb, rs->arg);
 }
 
@@ -229,7 +345,7 @@ static int udp_range_listen(struct rtp_sock *rs, const struct sa *ip,
 		struct udp_sock *us_rtp, *us_rtcp;
 		uint16_t port;
 
-		port = (min_port + (rand_u16() % (max_port - min_port)));
+		port = (min_port + (rand_fast_u16() % (max_port - min_port)));
 		port &= 0xfffe;
 
 		sa_set_port(&rs->local, port);
@@ -254,6 +370,55 @@ static int udp_range_listen(struct rtp_sock *rs, const struct sa *ip,
 }
 
 
+static int udp_pool_listen(struct rtp_sock *rs, const struct sa *ip,
+			   struct rtp_portpool *pool)
+{
+	uint16_t failv[64];
+	unsigned i, failc = 0;
+	struct sa rtcp;
+	int err = 0;
+
+	rs->local = rtcp = *ip;
+
+	while (failc < ARRAY_SIZE(failv)) {
+		struct udp_sock *us_rtp, *us_rtcp;
+		uint16_t port;
+
+		err = rtp_portpool_get(pool, &port);
+		if (err)
+			break;
+
+		sa_set_port(&rs->local, port);
+		err = udp_listen(&us_rtp, &rs->local, udp_recv_handler, rs);
+		if (err) {
+			failv[failc++] = port;
+			continue;
+		}
+
+		sa_set_port(&rtcp, port + 1);
+		err = udp_listen(&us_rtcp, &rtcp, rtcp_recv_handler, rs);
+		if (err) {
+			mem_deref(us_rtp);
+			failv[failc++] = port;
+			continue;
+		}
+
+		/* OK */
+		rs->sock_rtp  = us_rtp;
+		rs->sock_rtcp = us_rtcp;
+		rs->pool      = mem_ref(pool);
+		rs->pool_port = port;
+		break;
+	}
+
+	/* Pairs in use outside the pool are returned, to be tried later */
+	for (i=0; i<failc; i++)
+		rtp_portpool_put(pool, failv[i]);
+
+	return err;
+}
+
+
 /**
  * Allocate a new RTP socket
  *
@@ -283,31 +448,15 @@ int rtp_alloc(struct rtp_sock **rsp)
 }
 
 
-/**
- * Listen on an RTP/RTCP Socket
- *
- * @param rsp         Pointer to returned RTP socket
- * @param proto       Transport protocol
- * @param ip          Local IP address
- * @param min_port    Minimum port range
- * @param max_port    Maximum port range
- * @param enable_rtcp True to enable RTCP Session
- * @param recvh       RTP Receive handler
- * @param rtcph       RTCP Receive handler
- * @param arg         Handler argument
- *
- * @return 0 for success, otherwise errorcode
- */
-int rtp_listen(struct rtp_sock **rsp, int proto, const struct sa *ip,
-	       uint16_t min_port, uint16_t max_port, bool enable_rtcp,
-	       rtp_recv_h *recvh, rtcp_recv_h *rtcph, void *arg)
+/* Ports are taken from the pool if given, otherwise from the range */
+static int sock_listen(struct rtp_sock **rsp, int proto, const struct sa *ip,
+		       uint16_t min_port, uint16_t max_port,
+		       struct rtp_portpool *pool, bool enable_rtcp,
+		       rtp_recv_h *recvh, rtcp_recv_h *rtcph, void *arg)
 {
 	struct rtp_sock *rs;
 	int err;
 
-	if (!ip || min_port >= max_port || !recvh)
-		return EINVAL;
-
 	err = rtp_alloc(&rs);
 	if (err)
 		return err;
@@ -327,7 +476,10 @@ int rtp_listen(struct rtp_sock **rsp, int proto, const struct sa *ip,
 	switch (proto) {
 
 	case IPPROTO_UDP:
-		err = udp_range_listen(rs, ip, min_port, max_port);
+		if (pool)
+			err = udp_pool_listen(rs, ip, pool);
+		else
+			err = udp_range_listen(rs, ip, min_port, max_port);
 		break;
 
 	default:
@@ -345,6 +497,61 @@ int rtp_listen(struct rtp_sock **rsp, int proto, const struct sa *ip,
 }
 
 
+/**
+ * Listen on an RTP/RTCP Socket
+ *
+ * @param rsp         Pointer to returned RTP socket
+ * @param proto       Transport protocol
+ * @param ip          Local IP address
+ * @param min_port    Minimum port range
+ * @param max_port    Maximum port range
+ * @param enable_rtcp True to enable RTCP Session
+ * @param recvh       RTP Receive handler
+ * @param rtcph       RTCP Receive handler
+ * @param arg         Handler argument
+ *
+ * @return 0 for success, otherwise errorcode
+ */
+int rtp_listen(struct rtp_sock **rsp, int proto, const struct sa *ip,
+	       uint16_t min_port, uint16_t max_port, bool enable_rtcp,
+	       rtp_recv_h *recvh, rtcp_recv_h *rtcph, void *arg)
+{
+	if (!ip || min_port >= max_port || !recvh)
+		return EINVAL;
+
+	return sock_listen(rsp, proto, ip, min_port, max_port, NULL,
+			   enable_rtcp, recvh, rtcph, arg);
+}
+
+
+/**
+ * Listen on an RTP/RTCP Socket, with a port pair from a pool. The pair
+ * is returned to the pool when the socket is destroyed.
+ *
+ * @param rsp         Pointer to returned RTP socket
+ * @param proto       Transport protocol
+ * @param ip          Local IP address
+ * @param pool        Port pool
+ * @param enable_rtcp True to enable RTCP Session
+ * @param recvh       RTP Receive handler
+ * @param rtcph       RTCP Receive handler
+ * @param arg         Handler argument
+ *
+ * @return 0 for success, EADDRINUSE if the pool is exhausted, otherwise
+ *         errorcode
+ */
+int rtp_listen_pool(struct rtp_sock **rsp, int proto, const struct sa *ip,
+		    struct rtp_portpool *pool, bool enable_rtcp,
+		    rtp_recv_h *recvh, rtcp_recv_h *rtcph, void *arg)
+{
+	if (!ip || !pool || !recvh)
+		return EINVAL;
+
+	return sock_listen(rsp, proto, ip, 0, 0, pool, enable_rtcp,
+			   recvh, rtcph, arg);
+}
+
+
 /**
  * Encode a new RTP header into the beginning of the buffer
  *
@@ -452,10 +659,245 @@ int rtp_send(struct rtp_sock *rs, const struct sa *dst, bool ext,
 
 	mb->pos = pos;
 
+	if (rs->twcc && ext)
+		rtp_twcc_tx(rs->twcc, mb);
+
+	if (rs->hist)
+		rtp_hist_put(rs->hist, rs->enc.seq - 1, mb);
+
 	return udp_send(rs->sock_rtp, dst, mb);
 }
 
 
+/**
+ * Set a batch receive handler on an RTP Socket, instead of the receive
+ * handler. The RTP packets of one socket read burst are delivered
+ * together, at most max at a time, and the socket is set to receive
+ * max datagrams per system call where supported. Packets that are
+ * pending when the handler is changed are delivered first.
+ *
+ * @param rs     RTP Socket
+ * @param batchh Batch receive handler, NULL to use the receive handler
+ * @param max    Maximum number of packets per batch
+ *
+ * @return 0 if success, otherwise errorcode
+ *
+ * @note The buffers are only valid during the call, unless referenced
+ */
+int rtp_batch_handler_set(struct rtp_sock *rs, rtp_batch_h *batchh,
+			  unsigned max)
+{
+	struct rtp_pkt *pktv = NULL;
+	int err;
+
+	if (!rs || rs->proto != IPPROTO_UDP || (batchh && !max))
+		return EINVAL;
+
+	if (batchh) {
+		err = udp_rxbatch_set(rs->sock_rtp, max);
+		if (err && err != ENOSYS)
+			return err;
+
+		pktv = mem_zalloc(max * sizeof(*pktv), NULL);
+		if (!pktv)
+			return ENOMEM;
+	}
+
+	batch_flush(rs);
+
+	mem_deref(rs->pktv);
+	rs->pktv   = pktv;
+	rs->pktn   = batchh ? max : 0;
+	rs->batchh = batchh;
+
+	udp_burst_handler_set(rs->sock_rtp,
+			      batchh ? udp_burst_handler : NULL);
+
+	return 0;
+}
+
+
+/**
+ * Keep a history of sent RTP packets, for retransmission. The history
+ * holds references to the sent buffers, so a buffer must not be changed
+ * or reused after it was sent with rtp_send().
+ *
+ * @param rs   RTP Socket
+ * @param size Number of packets, a power of two up to 32768, 0 to disable
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtp_history_set(struct rtp_sock *rs, uint32_t size)
+{
+	struct rtp_hist *hist = NULL;
+	int err;
+
+	if (!rs)
+		return EINVAL;
+
+	if (size) {
+		err = rtp_hist_alloc(&hist, size);
+		if (err)
+			return err;
+	}
+
+	mem_deref(rs->hist);
+	rs->hist = hist;
+
+	return 0;
+}
+
+
+/**
+ * Send retransmissions as RTX packets (RFC 4588) instead of resending the
+ * original packets
+ *
+ * @param rs     RTP Socket
+ * @param enable True to send RTX packets, false to resend the originals
+ * @param pt     RTX payload type
+ * @param ssrc   RTX SSRC
+ */
+void rtp_rtx_set(struct rtp_sock *rs, bool enable, uint8_t pt, uint32_t ssrc)
+{
+	if (!rs)
+		return;
+
+	if (enable && (!rs->rtx.enabled || rs->rtx.ssrc != ssrc))
+		rs->rtx.seq = rand_u16() & 0x7fff;
+
+	rs->rtx.enabled = enable;
+	rs->rtx.pt      = pt & 0x7f;
+	rs->rtx.ssrc    = ssrc;
+}
+
+
+/**
+ * Retransmit a sent RTP packet from the history
+ *
+ * @param rs  RTP Socket
+ * @param dst Destination address
+ * @param seq Sequence number of the packet
+ *
+ * @return 0 if success, ENOENT if not in history, otherwise errorcode
+ */
+int rtp_resend(struct rtp_sock *rs, const struct sa *dst, uint16_t seq)
+{
+	struct mbuf *mb;
+	int err;
+
+	if (!rs || !dst)
+		return EINVAL;
+
+	mb = rtp_hist_get(rs->hist, seq);
+	if (!mb)
+		return ENOENT;
+
+	if (!rs->rtx.enabled)
+		return udp_send(rs->sock_rtp, dst, mb);
+
+	err = rtp_rtx_encode(&mb, mb, udp_headroom(rs->sock_rtp),
+			     rs->rtx.pt, rs->rtx.seq, rs->rtx.ssrc);
+	if (err)
+		return err;
+
+	++rs->rtx.seq;
+
+	err = udp_send(rs->sock_rtp, dst, mb);
+
+	mem_deref(mb);
+
+	return err;
+}
+
+
+/**
+ * Answer a Generic NACK (RFC 4585) with retransmissions from the history.
+ * Packets that are no longer in the history are skipped.
+ *
+ * @param rs  RTP Socket
+ * @param dst Destination address
+ * @param msg Received RTCP message
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtp_nack_resend(struct rtp_sock *rs, const struct sa *dst,
+		    const struct rtcp_msg *msg)
+{
+	uint32_t i;
+	int err = 0;
+
+	if (!rs || !dst || !msg)
+		return EINVAL;
+
+	if (msg->hdr.pt != RTCP_RTPFB || msg->hdr.count != RTCP_RTPFB_GNACK)
+		return EPROTO;
+
+	for (i=0; i<msg->r.fb.n && !err; i++) {
+
+		const struct gnack *gn = &msg->r.fb.fci.gnackv[i];
+		unsigned j;
+
+		err = rtp_resend(rs, dst, gn->pid);
+
+		for (j=0; j<16 && (!err || err == ENOENT); j++) {
+
+			if (gn->blp & (1 << j))
+				err = rtp_resend(rs, dst, gn->pid + j + 1);
+		}
+
+		if (err == ENOENT)
+			err = 0;
+	}
+
+	return err;
+}
+
+
+/**
+ * Get the headroom needed in front of an RTP payload, for the RTP header
+ * and the UDP-helpers of the RTP transport socket
+ *
+ * @param rs RTP Socket
+ *
+ * @return Headroom in bytes
+ */
+size_t rtp_headroom(const struct rtp_sock *rs)
+{
+	if (!rs)
+		return 0;
+
+	return RTP_HEADER_SIZE + udp_headroom(rs->sock_rtp);
+}
+
+
+/**
+ * Allocate a buffer for an RTP payload, with room for all headers and
+ * trailers that are added when the packet is sent with rtp_send(). The
+ * payload is written from the current position of the buffer.
+ *
+ * @param rs   RTP Socket
+ * @param size Maximum payload size in bytes
+ *
+ * @return Allocated buffer, or NULL if out of memory
+ */
+struct mbuf *rtp_mbuf_alloc(const struct rtp_sock *rs, size_t size)
+{
+	const size_t headroom = rtp_headroom(rs);
+	struct mbuf *mb;
+
+	if (!rs)
+		return NULL;
+
+	mb = mbuf_alloc(headroom + size + udp_tailroom(rs->sock_rtp));
+	if (!mb)
+		return NULL;
+
+	mb->pos = mb->end = headroom;
+
+	return mb;
+}
+
+
 /**
  * Get the RTP transport socket from an RTP/RTCP Socket
  *
@@ -521,6 +963,30 @@ struct rtcp_sess *rtp_rtcp_sess(const struct rtp_sock *rs)
 }
 
 
+void rtp_sock_twcc_set(struct rtp_sock *rs, struct rtp_twcc *tw)
+{
+	if (rs)
+		rs->twcc = tw;
+}
+
+
+/* Get the BUNDLE demultiplexer, allocated on first use */
+int rtp_demux_get(struct rtp_demux **dmxp, struct rtp_sock *rs)
+{
+	int err;
+
+	if (!rs->dmx) {
+		err = rtp_demux_alloc(&rs->dmx, rs);
+		if (err)
+			return err;
+	}
+
+	*dmxp = rs->dmx;
+
+	return 0;
+}
+
+
 /**
  * Start the RTCP Session
  *
@@ -574,6 +1040,39 @@ int rtcp_send(struct rtp_sock *rs, struct mbuf *mb)
 }
 
 
+/**
+ * Send to and receive from a latched peer, or the pair selected by ICE,
+ * on connected sibling sockets. The RTCP socket is connected to the
+ * RTCP peer from rtcp_start(), if it is set and RTCP is not multiplexed.
+ *
+ * @param rs   RTP Socket
+ * @param peer RTP address of the peer, NULL to stop
+ *
+ * @return 0 for success, otherwise errorcode
+ */
+int rtp_fastpath_set(struct rtp_sock *rs, const struct sa *peer)
+{
+	const struct sa *rtcp_peer = NULL;
+	int err;
+
+	if (!rs || rs->proto != IPPROTO_UDP)
+		return EINVAL;
+
+	err = udp_fastpath_set(rs->sock_rtp, peer);
+	if (err)
+		return err;
+
+	if (peer && !rs->rtcp_mux && sa_isset(&rs->rtcp_peer, SA_ALL))
+		rtcp_peer = &rs->rtcp_peer;
+
+	err = udp_fastpath_set(rs->sock_rtcp, rtcp_peer);
+	if (err)
+		(void)udp_fastpath_set(rs->sock_rtp, NULL);
+
+	return err;
+}
+
+
 /**
  * RTP Debug handler, use with fmt %H
  *
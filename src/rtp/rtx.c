@@ -0,0 +1,186 @@
+/**
+ * @file rtx.c  RTP packet history and retransmission (RFC 4588)
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re_types.h>
+#include <re_fmt.h>
+#include <re_mem.h>
+#include <re_mbuf.h>
+#include <re_list.h>
+#include <re_sa.h>
+#include <re_rtp.h>
+#include "rtcp.h"
+
+
+/*
+ * The history is a ring of sent packets, indexed by the low bits of the
+ * sequence number. Each entry holds a reference to the buffer that was
+ * sent, and the position of the RTP packet in it. The packets are not
+ * copied, so the buffers must not be changed after they were sent.
+ */
+
+
+/** History entry */
+struct hist_ent {
+	struct mbuf *mb;   /**< Sent buffer                 */
+	size_t pos;        /**< Start of the RTP packet     */
+	size_t end;        /**< End of the RTP packet       */
+	uint16_t seq;      /**< RTP sequence number         */
+};
+
+/** Defines an RTP packet history */
+struct rtp_hist {
+	struct hist_ent *entv;  /**< Ring of sent packets    */
+	uint32_t mask;          /**< Ring size minus one     */
+};
+
+
+static void hist_destructor(void *data)
+{
+	struct rtp_hist *hist = data;
+	uint32_t i;
+
+	for (i=0; i<=hist->mask; i++)
+		mem_deref(hist->entv[i].mb);
+
+	mem_deref(hist->entv);
+}
+
+
+int rtp_hist_alloc(struct rtp_hist **histp, uint32_t size)
+{
+	struct rtp_hist *hist;
+
+	if (!histp || !size || size > 32768 || (size & (size - 1)))
+		return EINVAL;
+
+	hist = mem_zalloc(sizeof(*hist), hist_destructor);
+	if (!hist)
+		return ENOMEM;
+
+	hist->entv = mem_zalloc(size * sizeof(*hist->entv), NULL);
+	if (!hist->entv) {
+		mem_deref(hist);
+		return ENOMEM;
+	}
+
+	hist->mask = size - 1;
+
+	*histp = hist;
+
+	return 0;
+}
+
+
+/**
+ * Store a sent RTP packet in the history
+ *
+ * @param hist History
+ * @param seq  RTP sequence number
+ * @param mb   Buffer with the RTP packet from mb->pos to mb->end
+ */
+void rtp_hist_put(struct rtp_hist *hist, uint16_t seq, struct mbuf *mb)
+{
+	struct hist_ent *ent;
+
+	if (!hist || !mb)
+		return;
+
+	ent = &hist->entv[seq & hist->mask];
+
+	mem_deref(ent->mb);
+
+	ent->mb  = mem_ref(mb);
+	ent->pos = mb->pos;
+	ent->end = mb->end;
+	ent->seq = seq;
+}
+
+
+/**
+ * Get a sent RTP packet from the history
+ *
+ * @param hist History
+ * @param seq  RTP sequence number
+ *
+ * @return Buffer with the RTP packet from mb->pos to mb->end, or NULL
+ */
+struct mbuf *rtp_hist_get(const struct rtp_hist *hist, uint16_t seq)
+{
+	const struct hist_ent *ent;
+
+	if (!hist)
+		return NULL;
+
+	ent = &hist->entv[seq & hist->mask];
+
+	if (!ent->mb || ent->seq != seq)
+		return NULL;
+
+	ent->mb->pos = ent->pos;
+	ent->mb->end = ent->end;
+
+	return ent->mb;
+}
+
+
+/**
+ * Encode an RTX packet from an original RTP packet (RFC 4588)
+ *
+ * @param mbp      Pointer to allocated RTX packet
+ * @param orig     Original RTP packet from orig->pos to orig->end
+ * @param headroom Headroom to reserve in front of the RTX packet
+ * @param pt       RTX payload type
+ * @param seq      RTX sequence number
+ * @param ssrc     RTX SSRC
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtp_rtx_encode(struct mbuf **mbp, struct mbuf *orig, size_t headroom,
+		   uint8_t pt, uint16_t seq, uint32_t ssrc)
+{
+	struct rtp_header hdr;
+	const size_t start = orig->pos;
+	size_t hdr_len;
+	struct mbuf *mb;
+	int err;
+
+	err = rtp_hdr_decode(&hdr, orig);
+	hdr_len = orig->pos - start;
+	orig->pos = start;
+	if (err)
+		return err;
+
+	mb = mbuf_alloc(headroom + mbuf_get_left(orig) + 2);
+	if (!mb)
+		return ENOMEM;
+
+	mb->pos = mb->end = headroom;
+
+	/* Same header, CSRC list and extension, then the original SEQ */
+	err  = mbuf_write_mem(mb, mbuf_buf(orig), hdr_len);
+	err |= mbuf_write_u16(mb, htons(hdr.seq));
+	err |= mbuf_write_mem(mb, mbuf_buf(orig) + hdr_len,
+			      mbuf_get_left(orig) - hdr_len);
+	if (err)
+		goto out;
+
+	mb->buf[headroom + 1] = (mb->buf[headroom + 1] & 0x80) | (pt & 0x7f);
+
+	mb->pos = headroom + 2;
+	err  = mbuf_write_u16(mb, htons(seq));
+	mb->pos = headroom + 8;
+	err |= mbuf_write_u32(mb, htonl(ssrc));
+
+	mb->pos = headroom;
+
+ out:
+	if (err)
+		mem_deref(mb);
+	else
+		*mbp = mb;
+
+	return err;
+}
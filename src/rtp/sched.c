@@ -0,0 +1,140 @@
+/**
+ * @file rtp/sched.c  Shared RTCP report scheduler
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <re_types.h>
+#include <re_fmt.h>
+#include <re_mem.h>
+#include <re_mbuf.h>
+#include <re_list.h>
+#include <re_tmr.h>
+#include <re_sa.h>
+#include <re_rtp.h>
+#include "rtcp.h"
+
+
+/*
+ * The report interval is divided into slots, and each RTCP session is
+ * put in the slot with the fewest sessions. One timer visits the slots in
+ * turn and sends the reports of all sessions in the slot, so the reports
+ * are spread evenly over the interval.
+ *
+ * Slots with equal load are taken in steps of about 0.618 intervals,
+ * so a few sessions are spread over the whole interval too.
+ */
+
+
+/** Scheduler values */
+enum {
+	SCHED_SLOTS = 250,                          /**< Slots per interval */
+	SCHED_TICK  = RTCP_INTERVAL / SCHED_SLOTS,  /**< Slot length [ms]   */
+	SCHED_STEP  = 153,                          /**< Coprime to slots   */
+};
+
+/** Defines a shared RTCP report scheduler */
+struct rtcp_sched {
+	struct list slotv[SCHED_SLOTS];  /**< RTCP sessions per slot        */
+	uint32_t slotc[SCHED_SLOTS];     /**< Number of sessions per slot   */
+	struct tmr tmr;                  /**< Slot timer                    */
+	uint32_t slot;                   /**< Current slot                  */
+	uint32_t n;                      /**< Number of sessions            */
+};
+
+
+static void destructor(void *arg)
+{
+	struct rtcp_sched *sched = arg;
+
+	tmr_cancel(&sched->tmr);
+}
+
+
+static void tmr_handler(void *arg)
+{
+	struct rtcp_sched *sched = arg;
+	struct le *le;
+
+	tmr_start(&sched->tmr, SCHED_TICK, tmr_handler, sched);
+
+	le = sched->slotv[sched->slot].head;
+
+	while (le) {
+		struct rtcp_sess *sess = le->data;
+
+		le = le->next;
+
+		rtcp_sess_report(sess);
+	}
+
+	sched->slot = (sched->slot + 1) % SCHED_SLOTS;
+}
+
+
+/**
+ * Allocate a shared RTCP report scheduler. The scheduler timer runs in
+ * the thread that allocated it, so it must only be used for RTP sockets
+ * of the same thread.
+ *
+ * @param schedp Pointer to allocated RTCP scheduler
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtcp_sched_alloc(struct rtcp_sched **schedp)
+{
+	struct rtcp_sched *sched;
+
+	if (!schedp)
+		return EINVAL;
+
+	sched = mem_zalloc(sizeof(*sched), destructor);
+	if (!sched)
+		return ENOMEM;
+
+	tmr_init(&sched->tmr);
+
+	*schedp = sched;
+
+	return 0;
+}
+
+
+void rtcp_sched_add(struct rtcp_sched *sched, struct le *le,
+		    struct rtcp_sess *sess)
+{
+	uint32_t i, slot = 0;
+
+	if (!sched || !le || le->list)
+		return;
+
+	for (i=1; i<SCHED_SLOTS; i++) {
+
+		const uint32_t j = i * SCHED_STEP % SCHED_SLOTS;
+
+		if (sched->slotc[j] < sched->slotc[slot])
+			slot = j;
+	}
+
+	list_append(&sched->slotv[slot], le, sess);
+	++sched->slotc[slot];
+
+	if (!sched->n++)
+		tmr_start(&sched->tmr, SCHED_TICK, tmr_handler, sched);
+}
+
+
+void rtcp_sched_remove(struct rtcp_sched *sched, struct le *le)
+{
+	uint32_t slot;
+
+	if (!sched || !le || !le->list)
+		return;
+
+	slot = (uint32_t)(le->list - sched->slotv);
+
+	list_unlink(le);
+	--sched->slotc[slot];
+
+	if (!--sched->n)
+		tmr_cancel(&sched->tmr);
+}
@@ -31,8 +31,10 @@
 
 /** RTP protocol values */
 enum {
-	RTCP_INTERVAL = 5000,  /**< Interval in [ms] between sending reports */
-	MAX_MEMBERS   = 8,
+	MAX_MEMBERS   = 256,   /**< Default maximum number of members        */
+	MEMBER_HASH   = 4,     /**< Initial size of the member table         */
+	RTCP_RR_MAX   = 31,    /**< Maximum report blocks per SR             */
+	MEMBER_IDLE   = 2,     /**< Intervals before a member can be evicted */
 };
 
 /** RTP Transmit stats */
@@ -48,10 +50,17 @@ struct txstat {
 struct rtcp_sess {
 	struct rtp_sock *rs;        /**< RTP Socket                          */
 	struct hash *members;       /**< Member table                        */
+	struct rtp_member *last;    /**< Most recently used member           */
 	struct tmr tmr;             /**< Event sender timer                  */
+	struct rtcp_sched *sched;   /**< Shared report scheduler (optional)  */
+	struct le sched_le;         /**< Scheduler slot element              */
 	char *cname;                /**< Canonical Name                      */
 	uint32_t memberc;           /**< Number of members                   */
 	uint32_t senderc;           /**< Number of senders                   */
+	uint32_t member_max;        /**< Maximum number of members           */
+	uint32_t rr_offset;         /**< First sender of the next report     */
+	uint32_t epoch;             /**< Number of report intervals          */
+	uint32_t evict_epoch;       /**< Interval of the last failed evict   */
 	uint32_t srate_tx;          /**< Transmit sampling rate              */
 	uint32_t srate_rx;          /**< Receive sampling rate               */
 
@@ -74,7 +83,9 @@ static void sess_destructor(void *data)
 		(void)send_bye_packet(sess);
 
 	tmr_cancel(&sess->tmr);
+	rtcp_sched_remove(sess->sched, &sess->sched_le);
 
+	mem_deref(sess->sched);
 	mem_deref(sess->cname);
 	hash_flush(sess->members);
 	mem_deref(sess->members);
@@ -82,21 +93,106 @@ static void sess_destructor(void *data)
 }
 
 
-static struct rtp_member *get_member(struct rtcp_sess *sess, uint32_t src)
+static struct rtp_member *find_member(struct rtcp_sess *sess, uint32_t src)
 {
-	struct rtp_member *mbr;
+	struct rtp_member *mbr = sess->last;
+
+	if (mbr && mbr->src == src)
+		return mbr;
 
 	mbr = member_find(sess->members, src);
 	if (mbr)
+		sess->last = mbr;
+
+	return mbr;
+}
+
+
+static void remove_member(struct rtcp_sess *sess, struct rtp_member *mbr)
+{
+	if (mbr->s)
+		--sess->senderc;
+
+	if (sess->last == mbr)
+		sess->last = NULL;
+
+	--sess->memberc;
+	mem_deref(mbr);
+}
+
+
+struct evict {
+	struct rtp_member *mbr;
+	uint32_t epoch;
+	uint32_t idle;
+};
+
+
+static bool evict_handler(struct le *le, void *arg)
+{
+	struct rtp_member *mbr = le->data;
+	struct evict *ev = arg;
+	const uint32_t idle = ev->epoch - mbr->epoch;
+
+	if (!ev->mbr || idle > ev->idle) {
+		ev->mbr  = mbr;
+		ev->idle = idle;
+	}
+
+	return false;
+}
+
+
+/*
+ * Remove the member that was idle for the longest time, if it was idle
+ * for at least MEMBER_IDLE report intervals. The table is scanned at
+ * most once per interval when no member can be removed.
+ */
+static bool evict_member(struct rtcp_sess *sess)
+{
+	struct evict ev;
+
+	if (sess->evict_epoch == sess->epoch)
+		return false;
+
+	ev.mbr   = NULL;
+	ev.epoch = sess->epoch;
+	ev.idle  = 0;
+
+	(void)hash_apply(sess->members, evict_handler, &ev);
+
+	if (!ev.mbr || ev.idle < MEMBER_IDLE) {
+		sess->evict_epoch = sess->epoch;
+		return false;
+	}
+
+	remove_member(sess, ev.mbr);
+
+	return true;
+}
+
+
+static struct rtp_member *get_member(struct rtcp_sess *sess, uint32_t src)
+{
+	const uint32_t max = sess->member_max ? sess->member_max
+		: MAX_MEMBERS;
+	struct rtp_member *mbr;
+
+	mbr = find_member(sess, src);
+	if (mbr) {
+		mbr->epoch = sess->epoch;
 		return mbr;
+	}
 
-	if (sess->memberc >= MAX_MEMBERS)
+	if (sess->memberc >= max && !evict_member(sess))
 		return NULL;
 
 	mbr = member_add(sess->members, src);
 	if (!mbr)
 		return NULL;
 
+	mbr->epoch = sess->epoch;
+	sess->last = mbr;
 	++sess->memberc;
 
 	return mbr;
@@ -196,14 +292,9 @@ static void handle_incoming_bye(struct rtcp_sess *sess,
 
 		struct rtp_member *mbr;
 
-		mbr = member_find(sess->members, msg->r.bye.srcv[i]);
-		if (mbr) {
-			if (mbr->s)
-				--sess->senderc;
-
-			--sess->memberc;
-			mem_deref(mbr);
-		}
+		mbr = find_member(sess, msg->r.bye.srcv[i]);
+		if (mbr)
+			remove_member(sess, mbr);
 	}
 }
 
@@ -252,7 +343,7 @@ int rtcp_sess_alloc(struct rtcp_sess **sessp, struct rtp_sock *rs)
 	if (err)
 		goto out;
 
-	err  = hash_alloc(&sess->members, MAX_MEMBERS);
+	err  = hash_alloc_auto(&sess->members, MEMBER_HASH, member_key);
 	if (err)
 		goto out;
 
@@ -284,6 +375,24 @@ void rtcp_set_srate(struct rtp_sock *rs, uint32_t srate_tx, uint32_t srate_rx)
 }
 
 
+/**
+ * Set the maximum number of members of an RTCP Session. When the member
+ * table is full, a member that has been idle for two report intervals is
+ * replaced by the new member.
+ *
+ * @param rs  RTP Socket
+ * @param max Maximum number of members, 0 for the default
+ */
+void rtcp_set_max_members(struct rtp_sock *rs, uint32_t max)
+{
+	struct rtcp_sess *sess = rtp_rtcp_sess(rs);
+	if (!sess)
+		return;
+
+	sess->member_max = max;
+}
+
+
 /**
  * Set the transmit Sampling-rate on an RTCP Session
  *
@@ -328,15 +437,55 @@ int rtcp_enable(struct rtcp_sess *sess, bool enabled, const char *cname)
 	if (err)
 		return err;
 
-	if (enabled)
+	if (enabled && sess->sched) {
+		rtcp_sched_add(sess->sched, &sess->sched_le, sess);
+	}
+	else if (enabled) {
 		schedule(sess);
-	else
+	}
+	else {
 		tmr_cancel(&sess->tmr);
+		rtcp_sched_remove(sess->sched, &sess->sched_le);
+	}
 
 	return 0;
 }
 
 
+/**
+ * Use a shared scheduler for the RTCP reports of an RTP Socket, instead
+ * of a timer per session. A running RTCP session is moved to the new
+ * scheduler.
+ *
+ * @param rs    RTP Socket
+ * @param sched RTCP scheduler, or NULL to use a timer per session
+ */
+void rtcp_set_sched(struct rtp_sock *rs, struct rtcp_sched *sched)
+{
+	struct rtcp_sess *sess = rtp_rtcp_sess(rs);
+	bool run;
+
+	if (!sess || sess->sched == sched)
+		return;
+
+	run = tmr_isrunning(&sess->tmr) || sess->sched_le.list;
+
+	tmr_cancel(&sess->tmr);
+	rtcp_sched_remove(sess->sched, &sess->sched_le);
+
+	mem_deref(sess->sched);
+	sess->sched = mem_ref(sched);
+
+	if (!run)
+		return;
+
+	if (sched)
+		rtcp_sched_add(sched, &sess->sched_le, sess);
+	else
+		schedule(sess);
+}
+
+
 /** Calculate LSR (middle 32 bits out of 64 in the NTP timestamp) */
 static uint32_t calc_lsr(const struct ntp_time *last_sr)
 {
@@ -356,16 +505,34 @@ static uint32_t calc_dlsr(uint64_t sr_recv)
 }
 
 
+/** Report block encoder state */
+struct rr_enc {
+	struct mbuf *mb;
+	uint32_t skip;
+	uint32_t n;
+	uint32_t max;
+	int err;
+};
+
+
 static bool sender_apply_handler(struct le *le, void *arg)
 {
 	struct rtp_member *mbr = le->data;
 	struct rtp_source *s = mbr->s;
-	struct mbuf *mb = arg;
+	struct rr_enc *enc = arg;
 	struct rtcp_rr rr;
 
 	if (!s)
 		return false;
 
+	if (enc->skip) {
+		--enc->skip;
+		return false;
+	}
+
+	if (enc->n >= enc->max)
+		return true;
+
 	/* Initialise the members */
 	rr.ssrc     = mbr->src;
 	rr.fraction = source_calc_fraction_lost(s);
@@ -375,17 +542,48 @@ static bool sender_apply_handler(struct le *le, void *arg)
 	rr.lsr      = calc_lsr(&s->last_sr);
 	rr.dlsr     = calc_dlsr(s->sr_recv);
 
-	return 0 != rtcp_rr_encode(mb, &rr);
+	enc->err = rtcp_rr_encode(enc->mb, &rr);
+	if (enc->err)
+		return true;
+
+	++enc->n;
+
+	return false;
 }
 
 
+/*
+ * An SR holds at most RTCP_RR_MAX report blocks. With more senders, the
+ * report blocks are sent round-robin over successive report intervals,
+ * as described in RFC 3550 section 6.4.
+ */
 static int encode_handler(struct mbuf *mb, void *arg)
 {
-	struct hash *members = arg;
+	struct rtcp_sess *sess = arg;
+	struct rr_enc enc;
 
-	/* copy all report blocks */
-	if (hash_apply(members, sender_apply_handler, mb))
-		return ENOMEM;
+	enc.mb   = mb;
+	enc.skip = sess->rr_offset;
+	enc.n    = 0;
+	enc.max  = min(sess->senderc, (uint32_t)RTCP_RR_MAX);
+	enc.err  = 0;
+
+	(void)hash_apply(sess->members, sender_apply_handler, &enc);
+
+	/* wrap around to the first senders */
+	if (!enc.err && enc.n < enc.max) {
+		enc.skip = 0;
+		(void)hash_apply(sess->members, sender_apply_handler, &enc);
+	}
+
+	if (enc.err)
+		return enc.err;
+
+	if (enc.n != enc.max)
+		return EPROTO;
+
+	if (sess->senderc)
+		sess->rr_offset = (sess->rr_offset + enc.n) % sess->senderc;
 
 	return 0;
 }
@@ -394,6 +592,7 @@ static int encode_handler(struct mbuf *mb, void *arg)
 /** Create a Sender Report */
 static int mk_sr(struct rtcp_sess *sess, struct mbuf *mb)
 {
+	const uint32_t rrc = min(sess->senderc, (uint32_t)RTCP_RR_MAX);
 	struct ntp_time ntp = {0, 0};
 	struct txstat txstat;
 	uint32_t dur, rtp_ts = 0;
@@ -413,9 +612,9 @@ static int mk_sr(struct rtcp_sess *sess, struct mbuf *mb)
 		rtp_ts = txstat.ts_ref + dur * sess->srate_tx / 1000;
 	}
 
-	err = rtcp_encode(mb, RTCP_SR, sess->senderc, rtp_sess_ssrc(sess->rs),
+	err = rtcp_encode(mb, RTCP_SR, rrc, rtp_sess_ssrc(sess->rs),
 			  ntp.hi, ntp.lo, rtp_ts, txstat.psent, txstat.osent,
-			  encode_handler, sess->members);
+			  encode_handler, sess);
 	if (err)
 		return err;
 
@@ -491,15 +690,24 @@ static int send_bye_packet(struct rtcp_sess *sess)
 }
 
 
-static void timeout(void *arg)
+void rtcp_sess_report(struct rtcp_sess *sess)
 {
-	struct rtcp_sess *sess = arg;
 	int err;
 
+	++sess->epoch;
+
 	err = send_rtcp_report(sess);
 	if (err) {
 		DEBUG_WARNING("Send RTCP report failed: %m\n", err);
 	}
+}
+
+
+static void timeout(void *arg)
+{
+	struct rtcp_sess *sess = arg;
+
+	rtcp_sess_report(sess);
 
 	schedule(sess);
 }
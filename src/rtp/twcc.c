@@ -0,0 +1,549 @@
+/**
+ * @file rtp/twcc.c  Transport-wide congestion control
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <re_types.h>
+#include <re_fmt.h>
+#include <re_mem.h>
+#include <re_mbuf.h>
+#include <re_list.h>
+#include <re_tmr.h>
+#include <re_sa.h>
+#include <re_rtp.h>
+#include "rtcp.h"
+
+
+#define DEBUG_MODULE "rtp_twcc"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+/*
+ * The sender numbers all its RTP packets of a transport with the
+ * transport-wide sequence number header extension, and keeps the send
+ * time and size of each. The receiver keeps the arrival times, and
+ * reports them in RTCP transport-cc feedback every FB_INTERVAL.
+ *
+ * The send-side estimate is delay based: the one-way delay of each
+ * reported packet, less the smallest of the last two BASE_WIN, is the
+ * queuing delay; the windows let the base follow clock drift. When the
+ * smoothed queuing delay is above OVERUSE, the bitrate is set to a
+ * fraction of the acknowledged bitrate; when it is below UNDERUSE, the
+ * bitrate grows by INCREASE and ADDITIVE per second, but not far beyond
+ * what is acknowledged. It is not decreased again while the queue drains.
+ */
+
+
+/** Transport-wide CC values */
+enum {
+	TX_HIST      = 4096,     /**< Send history, power of two     */
+	FB_INTERVAL  = 100,      /**< Feedback interval [ms]         */
+	REFTIME_US   = 64000,    /**< Unit of the reference time     */
+	DELTA_US     = 250,      /**< Unit of the receive deltas     */
+	OVERUSE      = 20000,    /**< Queuing delay of overuse [us]  */
+	UNDERUSE     = 5000,     /**< Queuing delay to increase [us] */
+	HOLD_US      = 200000,   /**< Time between decreases [us]    */
+	DECREASE     = 85,       /**< Decrease to acked rate [%]     */
+	INCREASE     = 8,        /**< Increase per second [%]        */
+	ADDITIVE     = 10000,    /**< and [bit/s] per second         */
+	ACKED_WIN    = 250000,   /**< Acked bitrate window [us]      */
+	BASE_WIN     = 10000000, /**< Base delay window [us]         */
+	RATE_START   = 300000,
+	RATE_MIN     = 30000,
+	RATE_MAX     = 10000000,
+};
+
+
+/** Sent packet */
+struct twcc_tx {
+	uint64_t ts;      /**< Send time [us]            */
+	uint16_t seq;     /**< Transport-wide sequence   */
+	uint16_t size;    /**< Packet size [bytes]       */
+	bool sent;
+};
+
+/** Received packet */
+struct twcc_rx {
+	uint64_t ts;      /**< Arrival time [us]         */
+	uint16_t seq;     /**< Transport-wide sequence   */
+	bool rcvd;
+};
+
+/** Defines transport-wide congestion control of an RTP Socket */
+struct rtp_twcc {
+	struct tmr tmr;          /**< Feedback timer              */
+	struct rtp_sock *rs;     /**< RTP Socket                  */
+	struct twcc_tx *txv;     /**< Send history                */
+	struct twcc_rx *rxv;     /**< Arrivals not yet reported   */
+	uint8_t extid;           /**< Header extension ID         */
+
+	/* Receive side */
+	uint64_t rx_epoch;       /**< Time of first arrival [us]  */
+	uint32_t media_ssrc;     /**< Latest media SSRC           */
+	uint16_t rx_base;        /**< First unreported sequence   */
+	uint16_t rx_max;         /**< Highest received sequence   */
+	bool rx_pending;         /**< Arrivals to report          */
+	bool rx_started;
+	uint8_t fbc;             /**< Feedback packet count       */
+
+	/* Send side */
+	uint16_t tx_seq;         /**< Next sequence number        */
+	int64_t base_cur;        /**< Smallest delay, this window */
+	int64_t base_prev;       /**< Smallest delay, last window */
+	uint64_t base_ts;        /**< Start of this window [us]   */
+	int64_t qdelay;          /**< Smoothed queuing delay [us] */
+	uint64_t acked_bytes;    /**< Acked in current window     */
+	int64_t acked_start;     /**< Window start, remote [us]   */
+	int64_t acked_last;      /**< Last arrival, remote [us]   */
+	uint32_t acked_rate;     /**< Acked bitrate [bit/s]       */
+	uint64_t ts_update;      /**< Last estimate update [us]   */
+	uint64_t ts_decrease;    /**< Last decrease [us]          */
+	uint32_t bitrate;        /**< Estimate [bit/s]            */
+	uint32_t rate_min;
+	uint32_t rate_max;
+};
+
+
+static void destructor(void *arg)
+{
+	struct rtp_twcc *tw = arg;
+
+	tmr_cancel(&tw->tmr);
+	rtp_sock_twcc_set(tw->rs, NULL);
+	mem_deref(tw->rs);
+	mem_deref(tw->txv);
+	mem_deref(tw->rxv);
+}
+
+
+/* Encode the feedback of the unreported arrivals */
+static int fb_encode_handler(struct mbuf *mb, void *arg)
+{
+	struct rtp_twcc *tw = arg;
+	int32_t deltav[TWCC_MAX];
+	const uint16_t n = tw->rx_max - tw->rx_base + 1;
+	int64_t ref = -1;
+	uint16_t i;
+
+	for (i=0; i<n; i++) {
+
+		const uint16_t seq = tw->rx_base + i;
+		const struct twcc_rx *rx = &tw->rxv[seq % TWCC_MAX];
+
+		if (!rx->rcvd || rx->seq != seq) {
+			deltav[i] = TWCC_LOST;
+			continue;
+		}
+
+		if (ref < 0)
+			ref = (int64_t)(rx->ts - tw->rx_epoch) / REFTIME_US;
+
+		deltav[i] = (int32_t)(((int64_t)(rx->ts - tw->rx_epoch)
+				       - ref * REFTIME_US) / DELTA_US);
+	}
+
+	return rtcp_rtpfb_twcc_encode(mb, tw->rx_base, tw->fbc,
+				      (int32_t)ref, deltav, n);
+}
+
+
+static void fb_send(struct rtp_twcc *tw)
+{
+	struct mbuf *mb;
+	uint16_t i, n;
+	int err;
+
+	if (!tw->rx_pending)
+		return;
+
+	mb = mbuf_alloc(256);
+	if (!mb)
+		return;
+
+	mb->pos = RTCP_HEADROOM;
+
+	err = rtcp_encode(mb, RTCP_RTPFB, RTCP_RTPFB_TWCC,
+			  rtp_sess_ssrc(tw->rs), tw->media_ssrc,
+			  fb_encode_handler, tw);
+	if (err)
+		goto out;
+
+	mb->pos = RTCP_HEADROOM;
+
+	err = rtcp_send(tw->rs, mb);
+
+ out:
+	if (err)
+		DEBUG_NOTICE("feedback: %m\n", err);
+
+	/* The reported arrivals are not repeated */
+	n = tw->rx_max - tw->rx_base + 1;
+	for (i=0; i<n; i++)
+		tw->rxv[(uint16_t)(tw->rx_base + i) % TWCC_MAX].rcvd = false;
+
+	tw->rx_base    = tw->rx_max + 1;
+	tw->rx_pending = false;
+	++tw->fbc;
+
+	mem_deref(mb);
+}
+
+
+static void tmr_handler(void *arg)
+{
+	struct rtp_twcc *tw = arg;
+
+	fb_send(tw);
+}
+
+
+/* Find the transport-wide sequence number of an RTP packet */
+static bool seq_find(uint16_t *seqp, const struct rtp_twcc *tw,
+		     const struct rtp_header *hdr, const struct mbuf *mb)
+{
+	struct rtp_ext ext;
+
+	if (!rtp_ext_find(&ext, hdr, mb, tw->extid) || ext.len != 2)
+		return false;
+
+	*seqp = (uint16_t)(ext.data[0] << 8 | ext.data[1]);
+
+	return true;
+}
+
+
+/* Record the arrival of a received RTP packet */
+void rtp_twcc_rx(struct rtp_twcc *tw, const struct rtp_header *hdr,
+		 const struct mbuf *mb)
+{
+	const uint64_t now = tmr_jiffies_usec();
+	struct twcc_rx *rx;
+	uint16_t seq;
+
+	if (!seq_find(&seq, tw, hdr, mb))
+		return;
+
+	if (!tw->rx_started) {
+		tw->rx_started = true;
+		tw->rx_epoch   = now;
+		tw->rx_base    = seq;
+		tw->rx_max     = seq;
+	}
+	else if ((int16_t)(seq - tw->rx_base) < 0) {
+		/* Late, after it was reported as lost */
+		return;
+	}
+
+	/* The oldest arrivals are dropped if the window is full */
+	if ((uint16_t)(seq - tw->rx_base) >= TWCC_MAX)
+		tw->rx_base = seq - TWCC_MAX + 1;
+
+	if (!tw->rx_pending || (int16_t)(seq - tw->rx_max) > 0)
+		tw->rx_max = seq;
+
+	rx = &tw->rxv[seq % TWCC_MAX];
+	rx->ts   = now;
+	rx->seq  = seq;
+	rx->rcvd = true;
+
+	tw->media_ssrc = hdr->ssrc;
+	tw->rx_pending = true;
+
+	if (!tmr_isrunning(&tw->tmr))
+		tmr_start(&tw->tmr, FB_INTERVAL, tmr_handler, tw);
+}
+
+
+/* Record the send time of an RTP packet, at the start of the buffer */
+void rtp_twcc_tx(struct rtp_twcc *tw, const struct mbuf *mb)
+{
+	struct rtp_header hdr;
+	struct mbuf view = *mb;
+	struct twcc_tx *tx;
+	uint16_t seq;
+
+	if (rtp_hdr_decode(&hdr, &view) || !seq_find(&seq, tw, &hdr, &view))
+		return;
+
+	tx = &tw->txv[seq % TX_HIST];
+	if (tx->seq != seq)
+		return;
+
+	tx->ts   = tmr_jiffies_usec();
+	tx->size = (uint16_t)min(mbuf_get_left(mb), 0xffff);
+	tx->sent = true;
+}
+
+
+static void acked_update(struct rtp_twcc *tw, int64_t arr, uint16_t size)
+{
+	int64_t span;
+
+	if (!tw->acked_bytes || arr < tw->acked_start)
+		tw->acked_start = arr;
+
+	tw->acked_bytes += size;
+	if (arr > tw->acked_last)
+		tw->acked_last = arr;
+
+	span = tw->acked_last - tw->acked_start;
+	if (span < ACKED_WIN)
+		return;
+
+	tw->acked_rate  = (uint32_t)(tw->acked_bytes * 8 * 1000000 / span);
+	tw->acked_bytes = 0;
+}
+
+
+static void estimate_update(struct rtp_twcc *tw, int64_t qprev)
+{
+	const uint64_t now = tmr_jiffies_usec();
+	const uint64_t dt = tw->ts_update ? now - tw->ts_update : 0;
+	uint64_t rate = tw->bitrate;
+
+	tw->ts_update = now;
+
+	if (tw->qdelay > OVERUSE) {
+
+		/* Not again while the queue drains */
+		if (now - tw->ts_decrease < HOLD_US || tw->qdelay < qprev)
+			return;
+
+		if (tw->acked_rate)
+			rate = min(rate, tw->acked_rate);
+
+		rate = rate * DECREASE / 100;
+		tw->ts_decrease = now;
+	}
+	else if (tw->qdelay < UNDERUSE) {
+
+		rate += (rate * INCREASE / 100 + ADDITIVE)
+			* min(dt, (uint64_t)1000000) / 1000000;
+
+		/* Not far beyond what the path has carried */
+		if (tw->acked_rate)
+			rate = min(rate, (uint64_t)tw->acked_rate * 3 / 2
+				   + 10000);
+	}
+	else {
+		return;
+	}
+
+	tw->bitrate = (uint32_t)max(min(rate, (uint64_t)tw->rate_max),
+				    (uint64_t)tw->rate_min);
+}
+
+
+/* Smallest one-way delay of the last two windows */
+static int64_t base_update(struct rtp_twcc *tw, int64_t delay)
+{
+	const uint64_t now = tmr_jiffies_usec();
+
+	if (!tw->base_ts) {
+		tw->base_ts   = now;
+		tw->base_cur  = delay;
+		tw->base_prev = delay;
+	}
+	else if (now - tw->base_ts >= BASE_WIN) {
+		tw->base_ts   = now;
+		tw->base_prev = tw->base_cur;
+		tw->base_cur  = delay;
+	}
+
+	if (delay < tw->base_cur)
+		tw->base_cur = delay;
+
+	return min(tw->base_cur, tw->base_prev);
+}
+
+
+/* Handle transport-cc feedback from the receiver */
+void rtp_twcc_feedback(struct rtp_twcc *tw, const struct rtcp_msg *msg)
+{
+	int32_t deltav[TWCC_MAX];
+	struct mbuf *mb = msg->r.fb.fci.twcc;
+	uint16_t base, n = TWCC_MAX, i;
+	const int64_t qprev = tw->qdelay;
+	int64_t qsum = 0;
+	uint32_t qn = 0;
+	int32_t reftime;
+	uint8_t fbc;
+	size_t pos;
+	int err;
+
+	if (!mb)
+		return;
+
+	pos = mb->pos;
+	err = rtcp_rtpfb_twcc_decode(mb, &base, &fbc, &reftime, deltav, &n);
+	mb->pos = pos;
+	if (err) {
+		DEBUG_NOTICE("feedback decode: %m\n", err);
+		return;
+	}
+
+	for (i=0; i<n; i++) {
+
+		const uint16_t seq = base + i;
+		const struct twcc_tx *tx = &tw->txv[seq % TX_HIST];
+		int64_t arr, delay;
+
+		if (deltav[i] == TWCC_LOST || !tx->sent || tx->seq != seq)
+			continue;
+
+		arr = (int64_t)reftime * REFTIME_US
+			+ (int64_t)deltav[i] * DELTA_US;
+
+		/* Clock offset and path delay cancel out */
+		delay  = arr - (int64_t)tx->ts;
+		delay -= base_update(tw, delay);
+
+		qsum += delay;
+		++qn;
+
+		acked_update(tw, arr, tx->size);
+	}
+
+	if (!qn)
+		return;
+
+	tw->qdelay = (tw->qdelay + qsum / qn) / 2;
+
+	estimate_update(tw, qprev);
+}
+
+
+/**
+ * Allocate transport-wide congestion control for an RTP Socket. Received
+ * RTP packets with the transport-wide sequence number extension are
+ * reported to the sender with RTCP transport-cc feedback, and the
+ * feedback from the receiver updates the send-side bitrate estimate.
+ *
+ * @param twp   Pointer to allocated transport-wide CC
+ * @param rs    RTP Socket
+ * @param extid ID of the transport-wide sequence number extension
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtp_twcc_alloc(struct rtp_twcc **twp, struct rtp_sock *rs, uint8_t extid)
+{
+	struct rtp_twcc *tw;
+	int err = 0;
+
+	if (!twp || !rs || !extid)
+		return EINVAL;
+
+	tw = mem_zalloc(sizeof(*tw), destructor);
+	if (!tw)
+		return ENOMEM;
+
+	tmr_init(&tw->tmr);
+
+	tw->txv = mem_zalloc(TX_HIST * sizeof(*tw->txv), NULL);
+	tw->rxv = mem_zalloc(TWCC_MAX * sizeof(*tw->rxv), NULL);
+	if (!tw->txv || !tw->rxv) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	tw->rs       = mem_ref(rs);
+	tw->extid    = extid;
+	tw->tx_seq   = 1;
+	tw->bitrate  = RATE_START;
+	tw->rate_min = RATE_MIN;
+	tw->rate_max = RATE_MAX;
+
+	rtp_sock_twcc_set(rs, tw);
+
+ out:
+	if (err)
+		mem_deref(tw);
+	else
+		*twp = tw;
+
+	return err;
+}
+
+
+/**
+ * Write the next transport-wide sequence number to the header extension
+ * block of an RTP packet. Its send time is taken by rtp_send().
+ *
+ * @param tw  Transport-wide CC
+ * @param enc Header extension encoder
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtp_twcc_ext_write(struct rtp_twcc *tw, struct rtp_ext_enc *enc)
+{
+	struct twcc_tx *tx;
+	int err;
+
+	if (!tw || !enc)
+		return EINVAL;
+
+	err = rtp_ext_write_twcc(enc, tw->extid, tw->tx_seq);
+	if (err)
+		return err;
+
+	tx = &tw->txv[tw->tx_seq % TX_HIST];
+	tx->seq  = tw->tx_seq++;
+	tx->sent = false;
+
+	return 0;
+}
+
+
+/**
+ * Set the start bitrate and the limits of the send-side estimate
+ *
+ * @param tw    Transport-wide CC
+ * @param start Bitrate to use now [bit/s]
+ * @param rmin  Minimum bitrate [bit/s]
+ * @param rmax  Maximum bitrate [bit/s]
+ */
+void rtp_twcc_bitrate_set(struct rtp_twcc *tw, uint32_t start,
+			  uint32_t rmin, uint32_t rmax)
+{
+	if (!tw || !rmin || rmin > rmax)
+		return;
+
+	tw->rate_min = rmin;
+	tw->rate_max = rmax;
+	tw->bitrate  = max(min(start, rmax), rmin);
+}
+
+
+/**
+ * Get the send-side delay-based bitrate estimate, e.g. for the target
+ * bitrate of an RTP pacer
+ *
+ * @param tw Transport-wide CC
+ *
+ * @return Estimated bitrate in [bit/s]
+ */
+uint32_t rtp_twcc_bitrate(const struct rtp_twcc *tw)
+{
+	return tw ? tw->bitrate : 0;
+}
+
+
+/**
+ * Transport-wide CC debug handler, use with fmt %H
+ *
+ * @param pf Print function
+ * @param tw Transport-wide CC
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtp_twcc_debug(struct re_printf *pf, const struct rtp_twcc *tw)
+{
+	if (!tw)
+		return 0;
+
+	return re_hprintf(pf, "twcc: bitrate=%u acked=%u qdelay=%lldus"
+			  " tx_seq=%u fbc=%u\n",
+			  tw->bitrate, tw->acked_rate, tw->qdelay,
+			  tw->tx_seq, tw->fbc);
+}
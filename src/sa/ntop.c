@@ -4,24 +4,6 @@
  * Copyright (C) 2010 Creytiv.com
  */
 
-#define _BSD_SOURCE 1
-#define _DEFAULT_SOURCE 1
-
-#ifdef HAVE_INET_NTOP
-#ifdef WIN32
-#ifdef _MSC_VER
-#pragma warning (disable: 4090)
-#endif
-#include <windows.h>
-#else
-#define __USE_BSD 1    /**< Use BSD code */
-#include <sys/types.h>
-#include <sys/socket.h>
-#include <arpa/inet.h>
-#define __USE_POSIX 1  /**< Use POSIX code */
-#include <netdb.h>
-#endif /* WIN32 */
-#endif
 #include <string.h>
 #include <re_types.h>
 #include <re_fmt.h>
@@ -30,162 +12,111 @@
 #include "sa.h"
 
 
-#define DEBUG_MODULE "net_ntop"
-#define DEBUG_LEVEL 5
-#include <re_dbg.h>
-
+/*
+ * Addresses are formatted here rather than with inet_ntop(), which is
+ * slow on some platforms and missing on others. The output is the same.
+ */
 
-#ifndef HAVE_INET_NTOP
 
+/* Write a decimal octet, returns the number of characters */
+static size_t fmt_u8(char *p, unsigned v)
+{
+	if (v >= 100) {
+		p[0] = '0' + v / 100;
+		p[1] = '0' + v / 10 % 10;
+		p[2] = '0' + v % 10;
+		return 3;
+	}
+	else if (v >= 10) {
+		p[0] = '0' + v / 10;
+		p[1] = '0' + v % 10;
+		return 2;
+	}
 
-#define NS_IN6ADDRSZ     16      /**< IPv6 T_AAAA */
-#define NS_INT16SZ       2       /**< #/bytes of data in a u_int16_t */
+	p[0] = '0' + v;
+	return 1;
+}
 
 
-static const char*
-inet_ntop4(const u_char *src, char *dst, size_t size)
+static size_t fmt_in4(char *p, const uint8_t *a)
 {
-	if (re_snprintf(dst, size, "%u.%u.%u.%u",
-			src[0], src[1], src[2], src[3]) < 0) {
-		errno = ENOSPC;
-		dst[size-1] = 0;
-		return NULL;
-	}
+	size_t n;
+
+	n  = fmt_u8(p, a[0]);
+	p[n++] = '.';
+	n += fmt_u8(p + n, a[1]);
+	p[n++] = '.';
+	n += fmt_u8(p + n, a[2]);
+	p[n++] = '.';
+	n += fmt_u8(p + n, a[3]);
 
-	return dst;
+	return n;
 }
 
 
 #ifdef HAVE_INET6
-/* const char *
- * inet_ntop6(src, dst, size)
- *	convert IPv6 binary address into presentation (printable) format
- * author:
- *	Paul Vixie, 1996.
- */
-
-static const char *
-inet_ntop6(const u_char *src, char *dst, size_t size)
+/* Same output as inet_ntop(), with the longest run of zero words as :: */
+static size_t fmt_in6(char *p, const uint8_t *a)
 {
-	/*
-	 * Note that int32_t and int16_t need only be "at least" large enough
-	 * to contain a value of the specified size.  On some systems, like
-	 * Crays, there is no such thing as an integer variable with 16 bits.
-	 * Keep this in mind if you think this function should have been coded
-	 * to use pointer overlays.  All the world's not a VAX.
-	 */
-	char tmp[sizeof "ffff:ffff:ffff:ffff:ffff:ffff:255.255.255.255"], *tp;
-	struct { int base, len; } best, cur;
-	u_int words[NS_IN6ADDRSZ / NS_INT16SZ];
-	int i;
-
-	/*
-	 * Preprocess:
-	 *	Copy the input (bytewise) array into a wordwise array.
-	 *	Find the longest run of 0x00's in src[] for :: shorthanding.
-	 */
-	memset(words, '\0', sizeof words);
-	for (i = 0; i < NS_IN6ADDRSZ; i++)
-		words[i / 2] |= (src[i] << ((1 - (i % 2)) << 3));
-	best.base = -1;
-	best.len = 0;
-	cur.base = -1;
-	cur.len = 0;
-	for (i = 0; i < (NS_IN6ADDRSZ / NS_INT16SZ); i++) {
-		if (words[i] == 0) {
-			if (cur.base == -1)
-				cur.base = i, cur.len = 1;
-			else
-				cur.len++;
-		}
-		else {
-			if (cur.base != -1) {
-				if (best.base == -1 || cur.len > best.len)
-					best = cur;
-				cur.base = -1;
-			}
-		}
-	}
-	if (cur.base != -1) {
-		if (best.base == -1 || cur.len > best.len)
-			best = cur;
-	}
-	if (best.base != -1 && best.len < 2)
-		best.base = -1;
-
-	/*
-	 * Format the result.
-	 */
-	tp = tmp;
-	for (i = 0; i < (NS_IN6ADDRSZ / NS_INT16SZ); i++) {
-		/* Are we inside the best run of 0x00's? */
-		if (best.base != -1 && i >= best.base &&
-		    i < (best.base + best.len)) {
-			if (i == best.base)
-				*tp++ = ':';
+	static const char hex[] = "0123456789abcdef";
+	int best = -1, blen = 0, cur = -1, i;
+	uint16_t w[8];
+	size_t n = 0;
+
+	for (i=0; i<8; i++) {
+
+		w[i] = a[2*i] << 8 | a[2*i + 1];
+
+		if (w[i]) {
+			cur = -1;
 			continue;
 		}
-		/* Are we following an initial run of 0x00s or any real hex?*/
-		if (i != 0)
-			*tp++ = ':';
-		/* Is this address an encapsulated IPv4? */
-		if (i == 6 && best.base == 0 &&
-		    (best.len == 6 || (best.len == 5 && words[5] == 0xffff))) {
-			if (!inet_ntop4(src+12, tp, sizeof tmp - (tp - tmp)))
-				return NULL;
-			tp += strlen(tp);
-			break;
+
+		if (cur < 0)
+			cur = i;
+
+		if (i - cur + 1 > blen) {
+			best = cur;
+			blen = i - cur + 1;
 		}
-		tp += sprintf(tp, "%x", words[i]);
-	}
-	/* Was it a trailing run of 0x00's? */
-	if (best.base != -1 && (best.base + best.len) ==
-	    (NS_IN6ADDRSZ / NS_INT16SZ))
-		*tp++ = ':';
-	*tp++ = '\0';
-
-	/*
-	 * Check for overflow, copy, and we're done.
-	 */
-	if ((size_t)(tp - tmp) > size) {
-		errno = ENOSPC;
-		return NULL;
 	}
-	strcpy(dst, tmp);
-
-	return dst;
-}
-#endif
 
+	if (blen < 2)
+		best = -1;
 
-/*
- * Implementation of inet_ntop()
- */
-const char* inet_ntop(int af, const void *src, char *dst, size_t size);
-const char* inet_ntop(int af, const void *src, char *dst, size_t size)
-{
-	switch (af) {
+	for (i=0; i<8; i++) {
 
-	case AF_INET:
-		return inet_ntop4(src, dst, size);
+		unsigned v = w[i];
 
-#ifdef HAVE_INET6
-	case AF_INET6:
-		return inet_ntop6(src, dst, size);
-#endif
+		if (i == best) {
+			p[n++] = ':';
+			i += blen - 1;
+			continue;
+		}
 
-	default:
-		DEBUG_WARNING("inet_ntop: unknown address family %d\n", af);
-		return NULL;
+		if (i)
+			p[n++] = ':';
+
+		/* IPv4-compatible and IPv4-mapped addresses */
+		if (i == 6 && best == 0 &&
+		    (blen == 6 || (blen == 5 && w[5] == 0xffff)))
+			return n + fmt_in4(p + n, a + 12);
+
+		if (v >= 0x1000)
+			p[n++] = hex[v >> 12];
+		if (v >= 0x100)
+			p[n++] = hex[v >> 8 & 0xf];
+		if (v >= 0x10)
+			p[n++] = hex[v >> 4 & 0xf];
+		p[n++] = hex[v & 0xf];
 	}
-}
-#endif
 
+	if (best >= 0 && best + blen == 8)
+		p[n++] = ':';
 
-/*
- *  POSIX  1003.1-2001 marks gethostbyaddr() and gethostbyname() obsolescent.
- *  See getaddrinfo(3), getnameinfo(3), gai_strerror(3).
- */
+	return n;
+}
+#endif
 
 
 /**
@@ -199,18 +130,21 @@ const char* inet_ntop(int af, const void *src, char *dst, size_t size)
  */
 int net_inet_ntop(const struct sa *sa, char *buf, int size)
 {
-	if (!sa || !buf || !size)
+	char tmp[48];
+	size_t n;
+
+	if (!sa || !buf || size <= 0)
 		return EINVAL;
 
 	switch (sa->u.sa.sa_family) {
 
 	case AF_INET:
-		inet_ntop(AF_INET, &sa->u.in.sin_addr, buf, size);
+		n = fmt_in4(tmp, (const uint8_t *)&sa->u.in.sin_addr);
 		break;
 
 #ifdef HAVE_INET6
 	case AF_INET6:
-		inet_ntop(AF_INET6, &sa->u.in6.sin6_addr, buf, size);
+		n = fmt_in6(tmp, (const uint8_t *)&sa->u.in6.sin6_addr);
 		break;
 #endif
 
@@ -218,5 +152,11 @@ int net_inet_ntop(const struct sa *sa, char *buf, int size)
 		return EAFNOSUPPORT;
 	}
 
+	if (n >= (size_t)size)
+		return ENOSPC;
+
+	memcpy(buf, tmp, n);
+	buf[n] = '\0';
+
 	return 0;
 }
@@ -421,8 +421,11 @@ uint32_t sa_hash(const struct sa *sa, int flag)
 #ifdef HAVE_INET6
 	case AF_INET6:
 		if (flag & SA_ADDR) {
-			uint32_t *a = (uint32_t *)&sa->u.in6.sin6_addr;
-			v += a[0] ^ a[1] ^ a[2] ^ a[3];
+			uint64_t a[2];
+
+			memcpy(a, &sa->u.in6.sin6_addr, 16);
+			a[0] ^= a[1];
+			v += (uint32_t)(a[0] >> 32) ^ (uint32_t)a[0];
 		}
 		if (flag & SA_PORT)
 			v += ntohs(sa->u.in6.sin6_port);
@@ -486,13 +489,18 @@ bool sa_cmp(const struct sa *l, const struct sa *r, int flag)
 
 #ifdef HAVE_INET6
 	case AF_INET6:
-		if (flag & SA_ADDR)
-			if (memcmp(&l->u.in6.sin6_addr,
-				   &r->u.in6.sin6_addr, 16))
-				return false;
 		if (flag & SA_PORT)
 			if (l->u.in6.sin6_port != r->u.in6.sin6_port)
 				return false;
+		if (flag & SA_ADDR) {
+			uint64_t a[2], b[2];
+
+			/* Two 64-bit compares instead of memcmp() */
+			memcpy(a, &l->u.in6.sin6_addr, 16);
+			memcpy(b, &r->u.in6.sin6_addr, 16);
+			if ((a[0] ^ b[0]) | (a[1] ^ b[1]))
+				return false;
+		}
 		break;
 #endif
 
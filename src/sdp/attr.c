@@ -56,6 +56,43 @@ int sdp_attr_add(struct list *lst, struct pl *name, struct pl *val)
 }
 
 
+/* Add a remote attribute, reusing a spare one with the same name */
+int sdp_attr_radd(struct list *lst, struct list *spare, struct pl *name,
+		  struct pl *val)
+{
+	struct sdp_attr *attr = NULL;
+	struct le *le;
+
+	for (le = list_head(spare); le; le = le->next) {
+
+		struct sdp_attr *a = le->data;
+
+		if (!pl_strcmp(name, a->name)) {
+			attr = a;
+			break;
+		}
+	}
+
+	if (!attr)
+		return sdp_attr_add(lst, name, val);
+
+	list_unlink(&attr->le);
+	list_append(lst, &attr->le, attr);
+
+	if (!pl_isset(val)) {
+		attr->val = mem_deref(attr->val);
+		return 0;
+	}
+
+	if (attr->val && !pl_strcmp(val, attr->val))
+		return 0;
+
+	attr->val = mem_deref(attr->val);
+
+	return pl_strdup(&attr->val, val);
+}
+
+
 int sdp_attr_addv(struct list *lst, const char *name, const char *val,
 		  va_list ap)
 {
@@ -16,11 +16,16 @@
 #include "re_odict.h"
 
 
+/* Changed whenever a format may have changed, see sdp_encode() */
+static uint32_t fmt_gen;
+
+
 static void destructor(void *arg)
 {
 	struct sdp_format *fmt = arg;
 
 	list_unlink(&fmt->le);
+	++fmt_gen;
 
 	if (fmt->ref)
 		mem_deref(fmt->data);
@@ -107,6 +112,8 @@ int sdp_format_add(struct sdp_format **fmtp, struct sdp_media *m,
 	fmt->ref   = ref;
 	fmt->sup   = true;
 
+	++fmt_gen;
+
  out:
 	if (err)
 		mem_deref(fmt);
@@ -117,6 +124,25 @@ int sdp_format_add(struct sdp_format **fmtp, struct sdp_media *m,
 }
 
 
+/* Reuse a spare remote format, as if it was new */
+static void format_rreuse(struct sdp_media *m, struct sdp_format *fmt)
+{
+	list_unlink(&fmt->le);
+	list_append(&m->rfmtl, &fmt->le, fmt);
+
+	if (fmt->ref)
+		mem_deref(fmt->data);
+
+	fmt->params = mem_deref(fmt->params);
+	fmt->name   = mem_deref(fmt->name);
+	fmt->data   = NULL;
+	fmt->ref    = false;
+	fmt->sup    = false;
+	fmt->srate  = 0;
+	fmt->ch     = 0;
+}
+
+
 int sdp_format_radd(struct sdp_media *m, const struct pl *id)
 {
 	struct sdp_format *fmt;
@@ -125,6 +151,12 @@ int sdp_format_radd(struct sdp_media *m, const struct pl *id)
 	if (!m || !id)
 		return EINVAL;
 
+	fmt = sdp_format_find(&m->rfmtl_spare, id);
+	if (fmt) {
+		format_rreuse(m, fmt);
+		return 0;
+	}
+
 	fmt = mem_zalloc(sizeof(*fmt), destructor);
 	if (!fmt)
 		return ENOMEM;
@@ -166,6 +198,18 @@ struct sdp_format *sdp_format_find(const struct list *lst, const struct pl *id)
 }
 
 
+uint32_t sdp_format_gen(void)
+{
+	return fmt_gen;
+}
+
+
+void sdp_format_touch(void)
+{
+	++fmt_gen;
+}
+
+
 /**
  * Set the parameters of an SDP format
  *
@@ -182,6 +226,7 @@ int sdp_format_set_params(struct sdp_format *fmt, const char *params, ...)
 		return EINVAL;
 
 	fmt->params = mem_deref(fmt->params);
+	++fmt_gen;
 
 	if (params) {
 		va_list ap;
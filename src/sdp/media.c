@@ -23,11 +23,14 @@ static void destructor(void *arg)
 
 	list_flush(&m->lfmtl);
 	list_flush(&m->rfmtl);
+	list_flush(&m->rfmtl_spare);
 	list_flush(&m->rattrl);
+	list_flush(&m->rattrl_spare);
 	list_flush(&m->lattrl);
 
 	if (m->le.list) {
 		m->disabled = true;
+		m->dirty    = true;
 		m->ench     = NULL;
 		mem_ref(m);
 		return;
@@ -105,6 +108,8 @@ int sdp_media_add(struct sdp_media **mp, struct sdp_session *sess,
 
 	sa_set_port(&m->laddr, port);
 
+	sess->dirty = true;
+
  out:
 	if (err)
 		mem_deref(m);
@@ -167,8 +172,9 @@ void sdp_media_rreset(struct sdp_media *m)
 	sa_init(&m->raddr, AF_INET);
 	sa_init(&m->raddr_rtcp, AF_INET);
 
-	list_flush(&m->rfmtl);
-	list_flush(&m->rattrl);
+	/* formats and attributes are kept for the next decode */
+	sdp_list_move(&m->rfmtl_spare, &m->rfmtl);
+	sdp_list_move(&m->rattrl_spare, &m->rattrl);
 
 	m->rdir = SDP_SENDRECV;
 
@@ -177,6 +183,16 @@ void sdp_media_rreset(struct sdp_media *m)
 }
 
 
+void sdp_media_rspare_flush(struct sdp_media *m)
+{
+	if (!m)
+		return;
+
+	list_flush(&m->rfmtl_spare);
+	list_flush(&m->rattrl_spare);
+}
+
+
 /**
  * Compare media line protocols
  *
@@ -369,6 +385,8 @@ int sdp_media_set_alt_protos(struct sdp_media *m, unsigned protoc, ...)
 
 	va_end(ap);
 
+	m->dirty = true;
+
 	return err;
 }
 
@@ -386,8 +404,9 @@ void sdp_media_set_encode_handler(struct sdp_media *m, sdp_media_enc_h *ench,
 	if (!m)
 		return;
 
-	m->ench = ench;
-	m->arg  = arg;
+	m->ench  = ench;
+	m->arg   = arg;
+	m->dirty = true;
 }
 
 
@@ -403,6 +422,7 @@ void sdp_media_set_fmt_ignore(struct sdp_media *m, bool fmt_ignore)
 		return;
 
 	m->fmt_ignore = fmt_ignore;
+	m->dirty = true;
 }
 
 
@@ -418,6 +438,7 @@ void sdp_media_set_disabled(struct sdp_media *m, bool disabled)
 		return;
 
 	m->disabled = disabled;
+	m->dirty = true;
 }
 
 
@@ -449,6 +470,7 @@ void sdp_media_set_lport(struct sdp_media *m, uint16_t port)
 		return;
 
 	sa_set_port(&m->laddr, port);
+	m->dirty = true;
 }
 
 
@@ -464,6 +486,7 @@ void sdp_media_set_laddr(struct sdp_media *m, const struct sa *laddr)
 		return;
 
 	m->laddr = *laddr;
+	m->dirty = true;
 }
 
 
@@ -481,6 +504,7 @@ void sdp_media_set_lbandwidth(struct sdp_media *m, enum sdp_bandwidth type,
 		return;
 
 	m->lbwv[type] = bw;
+	m->dirty = true;
 }
 
 
@@ -496,6 +520,7 @@ void sdp_media_set_lport_rtcp(struct sdp_media *m, uint16_t port)
 		return;
 
 	sa_set_port(&m->laddr_rtcp, port);
+	m->dirty = true;
 }
 
 
@@ -511,6 +536,7 @@ void sdp_media_set_laddr_rtcp(struct sdp_media *m, const struct sa *laddr)
 		return;
 
 	m->laddr_rtcp = *laddr;
+	m->dirty = true;
 }
 
 
@@ -526,6 +552,7 @@ void sdp_media_set_ldir(struct sdp_media *m, enum sdp_dir dir)
 		return;
 
 	m->ldir = dir;
+	m->dirty = true;
 }
 
 
@@ -555,6 +582,8 @@ int sdp_media_set_lattr(struct sdp_media *m, bool replace,
 	err = sdp_attr_addv(&m->lattrl, name, value, ap);
 	va_end(ap);
 
+	m->dirty = true;
+
 	return err;
 }
 
@@ -571,6 +600,8 @@ void sdp_media_del_lattr(struct sdp_media *m, const char *name)
 		return;
 
 	sdp_attr_del(&m->lattrl, name);
+
+	m->dirty = true;
 }
 
 
@@ -814,6 +845,10 @@ struct sdp_format *sdp_media_format_apply(const struct sdp_media *m,
 
 	le = local ? m->lfmtl.head : m->rfmtl.head;
 
+	/* the handler may change the formats */
+	if (fmth && local)
+		sdp_format_touch();
+
 	while (le) {
 
 		struct sdp_format *fmt = le->data;
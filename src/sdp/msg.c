@@ -3,6 +3,7 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
+#include <string.h>
 #include <re_types.h>
 #include <re_fmt.h>
 #include <re_mem.h>
@@ -13,6 +14,68 @@
 #include "sdp.h"
 
 
+/*
+ * The lines are split with a few direct scans instead of regular
+ * expressions, as the decoder is called for every offer and answer.
+ */
+
+
+/* Split a line at the first separator, which is skipped */
+static bool split(const struct pl *pl, char sep, struct pl *a, struct pl *b)
+{
+	const char *p = pl_strchr(pl, sep);
+
+	if (!p)
+		return false;
+
+	a->p = pl->p;
+	a->l = p - pl->p;
+	b->p = p + 1;
+	b->l = pl->l - a->l - 1;
+
+	return true;
+}
+
+
+/* Get a leading token that ends at a space, or at the end of the line */
+static void token(struct pl *tok, struct pl *pl)
+{
+	const char *p = pl_strchr(pl, ' ');
+
+	tok->p = pl->p;
+	tok->l = p ? (size_t)(p - pl->p) : pl->l;
+
+	pl_advance(pl, tok->l);
+}
+
+
+/* Get a leading run of digits */
+static void digits(struct pl *num, struct pl *pl)
+{
+	num->p = pl->p;
+	num->l = 0;
+
+	while (num->l < pl->l && '0' <= pl->p[num->l] && pl->p[num->l] <= '9')
+		++num->l;
+
+	pl_advance(pl, num->l);
+}
+
+
+/* Decode "IN IP4 <addr>" or "IN IP6 <addr>" */
+static int addr_decode(struct pl *addr, struct pl *pl)
+{
+	if (pl->l < 7 || memcmp(pl->p, "IN IP", 5) ||
+	    (pl->p[5] != '4' && pl->p[5] != '6') || pl->p[6] != ' ')
+		return EBADMSG;
+
+	pl_advance(pl, 7);
+	token(addr, pl);
+
+	return addr->l ? 0 : EBADMSG;
+}
+
+
 static int attr_decode_fmtp(struct sdp_media *m, const struct pl *pl)
 {
 	struct sdp_format *fmt;
@@ -21,7 +84,7 @@ static int attr_decode_fmtp(struct sdp_media *m, const struct pl *pl)
 	if (!m)
 		return 0;
 
-	if (re_regex(pl->p, pl->l, "[^ ]+ [^]*", &id, &params))
+	if (!split(pl, ' ', &id, &params) || !id.l)
 		return EBADMSG;
 
 	fmt = sdp_format_find(&m->rfmtl, &id);
@@ -36,39 +99,53 @@ static int attr_decode_fmtp(struct sdp_media *m, const struct pl *pl)
 
 static int attr_decode_rtcp(struct sdp_media *m, const struct pl *pl)
 {
-	struct pl port, addr;
-	int err = 0;
+	struct pl v = *pl, port, addr;
 
 	if (!m)
 		return 0;
 
-	if (!re_regex(pl->p, pl->l, "[0-9]+ IN IP[46]1 [^ ]+",
-		      &port, NULL, &addr)) {
-		(void)sa_set(&m->raddr_rtcp, &addr, pl_u32(&port));
-	}
-	else if (!re_regex(pl->p, pl->l, "[0-9]+", &port)) {
-		sa_set_port(&m->raddr_rtcp, pl_u32(&port));
+	digits(&port, &v);
+	if (!port.l)
+		return EBADMSG;
+
+	if (v.l && v.p[0] == ' ') {
+
+		pl_advance(&v, 1);
+
+		if (!addr_decode(&addr, &v)) {
+			(void)sa_set(&m->raddr_rtcp, &addr, pl_u32(&port));
+			return 0;
+		}
 	}
-	else
-		err = EBADMSG;
 
-	return err;
+	sa_set_port(&m->raddr_rtcp, pl_u32(&port));
+
+	return 0;
 }
 
 
 static int attr_decode_rtpmap(struct sdp_media *m, const struct pl *pl)
 {
-	struct pl id, name, srate, ch;
+	struct pl id, v, name, srate;
 	struct sdp_format *fmt;
 	int err;
 
 	if (!m)
 		return 0;
 
-	if (re_regex(pl->p, pl->l, "[^ ]+ [^/]+/[0-9]+[/]*[^]*",
-		     &id, &name, &srate, NULL, &ch))
+	if (!split(pl, ' ', &id, &v) || !id.l)
+		return EBADMSG;
+
+	if (!split(&v, '/', &name, &v) || !name.l)
 		return EBADMSG;
 
+	digits(&srate, &v);
+	if (!srate.l)
+		return EBADMSG;
+
+	while (v.l && v.p[0] == '/')
+		pl_advance(&v, 1);
+
 	fmt = sdp_format_find(&m->rfmtl, &id);
 	if (!fmt)
 		return 0;
@@ -80,7 +157,7 @@ static int attr_decode_rtpmap(struct sdp_media *m, const struct pl *pl)
 		return err;
 
 	fmt->srate = pl_u32(&srate);
-	fmt->ch = ch.l ? pl_u32(&ch) : 1;
+	fmt->ch = v.l ? pl_u32(&v) : 1;
 
 	return 0;
 }
@@ -92,7 +169,7 @@ static int attr_decode(struct sdp_session *sess, struct sdp_media *m,
 	struct pl name, val;
 	int err = 0;
 
-	if (re_regex(pl->p, pl->l, "[^:]+:[^]+", &name, &val)) {
+	if (!split(pl, ':', &name, &val) || !name.l || !val.l) {
 		name = *pl;
 		val  = pl_null;
 	}
@@ -118,9 +195,12 @@ static int attr_decode(struct sdp_session *sess, struct sdp_media *m,
 	else if (!pl_strcmp(&name, "sendrecv"))
 		*dir = SDP_SENDRECV;
 
+	else if (m)
+		err = sdp_attr_radd(&m->rattrl, &m->rattrl_spare,
+				    &name, &val);
 	else
-		err = sdp_attr_add(m ? &m->rattrl : &sess->rattrl,
-				   &name, &val);
+		err = sdp_attr_radd(&sess->rattrl, &sess->rattrl_spare,
+				    &name, &val);
 
 	return err;
 }
@@ -128,9 +208,13 @@ static int attr_decode(struct sdp_session *sess, struct sdp_media *m,
 
 static int bandwidth_decode(int32_t *bwv, const struct pl *pl)
 {
-	struct pl type, bw;
+	struct pl type, v, bw;
+
+	if (!split(pl, ':', &type, &v) || !type.l)
+		return EBADMSG;
 
-	if (re_regex(pl->p, pl->l, "[^:]+:[0-9]+", &type, &bw))
+	digits(&bw, &v);
+	if (!bw.l)
 		return EBADMSG;
 
 	if (!pl_strcmp(&type, "CT"))
@@ -154,12 +238,14 @@ static int bandwidth_decode(int32_t *bwv, const struct pl *pl)
 
 static int conn_decode(struct sa *sa, const struct pl *pl)
 {
-	struct pl v;
+	struct pl v = *pl, addr;
+	int err;
 
-	if (re_regex(pl->p, pl->l, "IN IP[46]1 [^ ]+", NULL, &v))
-		return EBADMSG;
+	err = addr_decode(&addr, &v);
+	if (err)
+		return err;
 
-	(void)sa_set(sa, &v, sa_port(sa));
+	(void)sa_set(sa, &addr, sa_port(sa));
 
 	return 0;
 }
@@ -168,12 +254,26 @@ static int conn_decode(struct sa *sa, const struct pl *pl)
 static int media_decode(struct sdp_media **mp, struct sdp_session *sess,
 			bool offer, const struct pl *pl)
 {
-	struct pl name, port, proto, fmtv, fmt;
+	struct pl v = *pl, name, port, proto, fmt;
 	struct sdp_media *m;
 	int err;
 
-	if (re_regex(pl->p, pl->l, "[a-z]+ [^ ]+ [^ ]+[^]*",
-		     &name, &port, &proto, &fmtv))
+	name.p = v.p;
+	name.l = 0;
+	while (name.l < v.l && 'a' <= v.p[name.l] && v.p[name.l] <= 'z')
+		++name.l;
+
+	if (!name.l || name.l == v.l || v.p[name.l] != ' ')
+		return EBADMSG;
+
+	pl_advance(&v, name.l + 1);
+	token(&port, &v);
+	if (!port.l || !v.l)
+		return EBADMSG;
+
+	pl_advance(&v, 1);
+	token(&proto, &v);
+	if (!proto.l)
 		return EBADMSG;
 
 	m = list_ledata(*mp ? (*mp)->le.next : sess->medial.head);
@@ -208,9 +308,14 @@ static int media_decode(struct sdp_media **mp, struct sdp_session *sess,
 		}
 	}
 
-	while (!re_regex(fmtv.p, fmtv.l, " [^ ]+", &fmt)) {
+	/* the format list is the rest of the line, as " <fmt>" */
+	while (v.l > 1 && v.p[0] == ' ') {
 
-		pl_advance(&fmtv, fmt.p + fmt.l - fmtv.p);
+		pl_advance(&v, 1);
+
+		token(&fmt, &v);
+		if (!fmt.l)
+			continue;
 
 		err = sdp_format_radd(m, &fmt);
 		if (err)
@@ -254,6 +359,9 @@ int sdp_decode(struct sdp_session *sess, struct mbuf *mb, bool offer)
 	if (!sess || !mb)
 		return EINVAL;
 
+	/* the answer and the supported formats depend on the remote side */
+	sess->dirty = true;
+
 	sdp_session_rreset(sess);
 
 	for (le=sess->medial.head; le; le=le->next) {
@@ -333,16 +441,21 @@ int sdp_decode(struct sdp_session *sess, struct mbuf *mb, bool offer)
 		}
 	}
 
-	if (err)
-		return err;
+	if (!err && type)
+		err = EBADMSG;
 
-	if (type)
-		return EBADMSG;
+	/* the objects that were not reused by this message */
+	sdp_session_rspare_flush(sess);
+
+	for (le=sess->medial.head; le; le=le->next) {
 
-	for (le=sess->medial.head; le; le=le->next)
-		sdp_media_align_formats(le->data, offer);
+		sdp_media_rspare_flush(le->data);
 
-	return 0;
+		if (!err)
+			sdp_media_align_formats(le->data, offer);
+	}
+
+	return err;
 }
 
 
@@ -456,6 +569,108 @@ static int media_encode(const struct sdp_media *m, struct mbuf *mb, bool offer)
 }
 
 
+/* Check if the last encoded message is still valid */
+static bool encode_cached(const struct sdp_session *sess, bool offer)
+{
+	struct le *le;
+
+	if (!sess->encmb || sess->dirty || sess->enc_offer != offer ||
+	    sess->enc_fmtgen != sdp_format_gen())
+		return false;
+
+	/* an offer moves enabled local media to the session */
+	for (le=sess->lmedial.head; offer && le; le=le->next) {
+
+		const struct sdp_media *m = le->data;
+
+		if (!m->disabled)
+			return false;
+	}
+
+	for (le=sess->medial.head; le; le=le->next) {
+
+		const struct sdp_media *m = le->data;
+		struct le *lf;
+
+		if (m->dirty || m->ench)
+			return false;
+
+		/* the encode handlers may add something else every time */
+		for (lf=m->lfmtl.head; lf; lf=lf->next) {
+
+			const struct sdp_format *fmt = lf->data;
+
+			if (fmt->ench)
+				return false;
+		}
+	}
+
+	return true;
+}
+
+
+/* Copy the last encoded message, with the next session version */
+static int encode_copy(struct mbuf **mbp, struct sdp_session *sess)
+{
+	struct mbuf *cmb = sess->encmb;
+	struct mbuf *mb;
+	char ver[16];
+	int n;
+
+	n = re_snprintf(ver, sizeof(ver), "%u", sess->ver);
+	if (n <= 0 || (size_t)n != sess->enc_verlen)
+		return ENOENT;
+
+	memcpy(cmb->buf + sess->enc_verpos, ver, n);
+
+	mb = mbuf_alloc(cmb->end);
+	if (!mb)
+		return ENOMEM;
+
+	(void)mbuf_write_mem(mb, cmb->buf, cmb->end);
+
+	mb->pos = 0;
+
+	++sess->ver;
+
+	*mbp = mb;
+
+	return 0;
+}
+
+
+/* Keep a copy of the encoded message, to reuse it while nothing changes */
+static void encode_save(struct sdp_session *sess, const struct mbuf *mb,
+			bool offer)
+{
+	struct le *le;
+
+	sess->encmb = mem_deref(sess->encmb);
+
+	sess->encmb = mbuf_alloc(mb->end);
+	if (sess->encmb)
+		(void)mbuf_write_mem(sess->encmb, mb->buf, mb->end);
+
+	sess->enc_offer  = offer;
+	sess->enc_fmtgen = sdp_format_gen();
+	sess->dirty      = false;
+
+	for (le=sess->lmedial.head; le; le=le->next) {
+
+		struct sdp_media *m = le->data;
+
+		m->dirty = false;
+	}
+
+	for (le=sess->medial.head; le; le=le->next) {
+
+		struct sdp_media *m = le->data;
+
+		m->dirty = false;
+	}
+}
+
+
 /**
  * Encode an SDP Session into a memory buffer
  *
@@ -464,6 +679,11 @@ static int media_encode(const struct sdp_media *m, struct mbuf *mb, bool offer)
  * @param offer True if SDP Offer, False if SDP Answer
  *
  * @return 0 if success, otherwise errorcode
+ *
+ * @note The message is reused, with a new session version, as long as
+ * the session is not changed with any of the SDP functions and no encode
+ * handlers are used. Fields of struct sdp_format should only be changed
+ * with the SDP functions, or from a sdp_media_format_apply() handler.
  */
 int sdp_encode(struct mbuf **mbp, struct sdp_session *sess, bool offer)
 {
@@ -476,13 +696,19 @@ int sdp_encode(struct mbuf **mbp, struct sdp_session *sess, bool offer)
 	if (!mbp || !sess)
 		return EINVAL;
 
+	if (encode_cached(sess, offer) && !encode_copy(mbp, sess))
+		return 0;
+
 	mb = mbuf_alloc(512);
 	if (!mb)
 		return ENOMEM;
 
 	err  = mbuf_printf(mb, "v=%u\r\n", SDP_VERSION);
-	err |= mbuf_printf(mb, "o=- %u %u IN IP%d %j\r\n",
-			   sess->id, sess->ver++, ipver, &sess->laddr);
+	err |= mbuf_printf(mb, "o=- %u ", sess->id);
+	sess->enc_verpos = mb->end;
+	err |= mbuf_printf(mb, "%u", sess->ver++);
+	sess->enc_verlen = mb->end - sess->enc_verpos;
+	err |= mbuf_printf(mb, " IN IP%d %j\r\n", ipver, &sess->laddr);
 	err |= mbuf_write_str(mb, "s=-\r\n");
 	err |= mbuf_printf(mb, "c=IN IP%d %j\r\n", ipver, &sess->laddr);
 
@@ -522,10 +748,13 @@ int sdp_encode(struct mbuf **mbp, struct sdp_session *sess, bool offer)
 
 	mb->pos = 0;
 
-	if (err)
+	if (err) {
 		mem_deref(mb);
-	else
+	}
+	else {
+		encode_save(sess, mb, offer);
 		*mbp = mb;
+	}
 
 	return err;
 }
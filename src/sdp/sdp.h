@@ -16,21 +16,30 @@ struct sdp_session {
 	struct list medial;
 	struct list lattrl;
 	struct list rattrl;
+	struct list rattrl_spare;  /* reused by the next decode */
 	struct sa laddr;
 	struct sa raddr;
 	int32_t lbwv[SDP_BANDWIDTH_MAX];
 	int32_t rbwv[SDP_BANDWIDTH_MAX];
+	struct mbuf *encmb;        /* last encoded message */
+	size_t enc_verpos;
+	size_t enc_verlen;
+	uint32_t enc_fmtgen;
 	uint32_t id;
 	uint32_t ver;
 	enum sdp_dir rdir;
+	bool enc_offer;
+	bool dirty;                /* changed since last encode */
 };
 
 struct sdp_media {
 	struct le le;
 	struct list lfmtl;
 	struct list rfmtl;
+	struct list rfmtl_spare;   /* reused by the next decode */
 	struct list lattrl;
 	struct list rattrl;
+	struct list rattrl_spare;  /* reused by the next decode */
 	struct sa laddr;
 	struct sa raddr;
 	struct sa laddr_rtcp;
@@ -47,18 +56,21 @@ struct sdp_media {
 	enum sdp_dir rdir;
 	bool fmt_ignore;
 	bool disabled;
+	bool dirty;                /* changed since last encode */
 	int dynpt;
 };
 
 
 /* session */
 void sdp_session_rreset(struct sdp_session *sess);
+void sdp_session_rspare_flush(struct sdp_session *sess);
 
 
 /* media */
 int  sdp_media_radd(struct sdp_media **mp, struct sdp_session *sess,
 		    const struct pl *name, const struct pl *proto);
 void sdp_media_rreset(struct sdp_media *m);
+void sdp_media_rspare_flush(struct sdp_media *m);
 bool sdp_media_proto_cmp(struct sdp_media *m, const struct pl *proto,
 			 bool update);
 struct sdp_media *sdp_media_find(const struct sdp_session *sess,
@@ -70,6 +82,8 @@ void sdp_media_align_formats(struct sdp_media *m, bool offer);
 
 /* format */
 int  sdp_format_radd(struct sdp_media *m, const struct pl *id);
+uint32_t sdp_format_gen(void);
+void sdp_format_touch(void);
 struct sdp_format *sdp_format_find(const struct list *lst,
 				   const struct pl *id);
 
@@ -78,6 +92,8 @@ struct sdp_format *sdp_format_find(const struct list *lst,
 struct sdp_attr;
 
 int  sdp_attr_add(struct list *lst, struct pl *name, struct pl *val);
+int  sdp_attr_radd(struct list *lst, struct list *spare, struct pl *name,
+		   struct pl *val);
 int  sdp_attr_addv(struct list *lst, const char *name, const char *val,
 		   va_list ap);
 void sdp_attr_del(const struct list *lst, const char *name);
@@ -86,3 +102,7 @@ const char *sdp_attr_apply(const struct list *lst, const char *name,
 int sdp_attr_print(struct re_printf *pf, const struct sdp_attr *attr);
 int sdp_attr_debug(struct re_printf *pf, const struct sdp_attr *attr);
 int sdp_attr_json_api(struct odict *od, const struct sdp_attr *attr);
+
+
+/* util */
+void sdp_list_move(struct list *dst, struct list *src);
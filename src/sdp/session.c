@@ -23,7 +23,9 @@ static void destructor(void *arg)
 	list_flush(&sess->lmedial);
 	list_flush(&sess->medial);
 	list_flush(&sess->rattrl);
+	list_flush(&sess->rattrl_spare);
 	list_flush(&sess->lattrl);
+	mem_deref(sess->encmb);
 }
 
 
@@ -48,8 +50,8 @@ int sdp_session_alloc(struct sdp_session **sessp, const struct sa *laddr)
 		return ENOMEM;
 
 	sess->laddr = *laddr;
-	sess->id    = rand_u32();
-	sess->ver   = rand_u32() & 0x7fffffff;
+	sess->id    = rand_fast_u32();
+	sess->ver   = rand_fast_u32() & 0x7fffffff;
 	sess->rdir  = SDP_SENDRECV;
 
 	sa_init(&sess->raddr, AF_INET);
@@ -82,7 +84,7 @@ void sdp_session_rreset(struct sdp_session *sess)
 
 	sa_init(&sess->raddr, AF_INET);
 
-	list_flush(&sess->rattrl);
+	sdp_list_move(&sess->rattrl_spare, &sess->rattrl);
 
 	sess->rdir = SDP_SENDRECV;
 
@@ -91,6 +93,15 @@ void sdp_session_rreset(struct sdp_session *sess)
 }
 
 
+void sdp_session_rspare_flush(struct sdp_session *sess)
+{
+	if (!sess)
+		return;
+
+	list_flush(&sess->rattrl_spare);
+}
+
+
 /**
  * Set the local network address of an SDP Session
  *
@@ -103,6 +114,7 @@ void sdp_session_set_laddr(struct sdp_session *sess, const struct sa *laddr)
 		return;
 
 	sess->laddr = *laddr;
+	sess->dirty = true;
 }
 
 
@@ -120,6 +132,7 @@ void sdp_session_set_lbandwidth(struct sdp_session *sess,
 		return;
 
 	sess->lbwv[type] = bw;
+	sess->dirty = true;
 }
 
 
@@ -149,6 +162,8 @@ int sdp_session_set_lattr(struct sdp_session *sess, bool replace,
 	err = sdp_attr_addv(&sess->lattrl, name, value, ap);
 	va_end(ap);
 
+	sess->dirty = true;
+
 	return err;
 }
 
@@ -165,6 +180,8 @@ void sdp_session_del_lattr(struct sdp_session *sess, const char *name)
 		return;
 
 	sdp_attr_del(&sess->lattrl, name);
+
+	sess->dirty = true;
 }
 
 
@@ -9,6 +9,7 @@
 #include <re_list.h>
 #include <re_sa.h>
 #include <re_sdp.h>
+#include "sdp.h"
 
 
 /**
@@ -48,3 +49,15 @@ int sdp_extmap_decode(struct sdp_extmap *ext, const char *val)
 
 	return 0;
 }
+
+
+/* Move all entries of a list to the end of another list */
+void sdp_list_move(struct list *dst, struct list *src)
+{
+	struct le *le;
+
+	while ((le = list_head(src))) {
+		list_unlink(le);
+		list_append(dst, le, le->data);
+	}
+}
@@ -90,8 +90,22 @@ A million repetitions of "a"
 #include <re_types.h>
 #include <re_sha.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SHA1_NI 1
+#include <cpuid.h>
+#include <immintrin.h>
+#elif defined(__GNUC__) && defined(__aarch64__) && defined(__linux__)
+#define SHA1_ARMV8 1
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#include <arm_neon.h>
+#endif
+
 void SHA1_Transform(uint32_t state[5], const uint8_t buffer[64]);
 
+typedef void (sha1_blocks_h)(uint32_t state[5], const uint8_t *data,
+			     size_t blocks);
+
 #define rol(value, bits) (((value) << (bits)) | ((value) >> (32 - (bits))))
 
 #if defined (BYTE_ORDER) && defined(BIG_ENDIAN) && (BYTE_ORDER == BIG_ENDIAN)
@@ -186,6 +200,202 @@ void SHA1_Transform(uint32_t state[5], const uint8_t buffer[64])
 }
 
 
+static void blocks_sw(uint32_t state[5], const uint8_t *data, size_t blocks)
+{
+	for (; blocks; --blocks, data += 64)
+		SHA1_Transform(state, data);
+}
+
+
+#ifdef SHA1_NI
+/* Four rounds, and the message schedule for the rounds to come */
+#define NI_ROUNDS(ea, eb, m0, m1, m2, m3, f)		\
+	ea   = _mm_sha1nexte_epu32(ea, m0);		\
+	eb   = abcd;					\
+	m1   = _mm_sha1msg2_epu32(m1, m0);		\
+	abcd = _mm_sha1rnds4_epu32(abcd, ea, f);	\
+	m3   = _mm_sha1msg1_epu32(m3, m0);		\
+	m2   = _mm_xor_si128(m2, m0);
+
+
+__attribute__((target("sha,sse4.1")))
+static void blocks_ni(uint32_t state[5], const uint8_t *data, size_t blocks)
+{
+	const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL,
+					    0x08090a0b0c0d0e0fULL);
+	__m128i abcd, abcd_save, e0, e0_save, e1;
+	__m128i msg0, msg1, msg2, msg3;
+
+	abcd = _mm_loadu_si128((const __m128i *)(void *)state);
+	abcd = _mm_shuffle_epi32(abcd, 0x1b);
+	e0   = _mm_set_epi32((int)state[4], 0, 0, 0);
+
+	for (; blocks; --blocks, data += 64) {
+
+		abcd_save = abcd;
+		e0_save   = e0;
+
+		msg0 = _mm_loadu_si128((const __m128i *)(void *)data);
+		msg1 = _mm_loadu_si128((const __m128i *)(void *)(data + 16));
+		msg2 = _mm_loadu_si128((const __m128i *)(void *)(data + 32));
+		msg3 = _mm_loadu_si128((const __m128i *)(void *)(data + 48));
+		msg0 = _mm_shuffle_epi8(msg0, mask);
+		msg1 = _mm_shuffle_epi8(msg1, mask);
+		msg2 = _mm_shuffle_epi8(msg2, mask);
+		msg3 = _mm_shuffle_epi8(msg3, mask);
+
+		/* Rounds 0-11 */
+		e0   = _mm_add_epi32(e0, msg0);
+		e1   = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+		e1   = _mm_sha1nexte_epu32(e1, msg1);
+		e0   = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+		msg0 = _mm_sha1msg1_epu32(msg0, msg1);
+
+		e0   = _mm_sha1nexte_epu32(e0, msg2);
+		e1   = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+		msg1 = _mm_sha1msg1_epu32(msg1, msg2);
+		msg0 = _mm_xor_si128(msg0, msg2);
+
+		/* Rounds 12-67 */
+		NI_ROUNDS(e1, e0, msg3, msg0, msg1, msg2, 0);
+		NI_ROUNDS(e0, e1, msg0, msg1, msg2, msg3, 0);
+		NI_ROUNDS(e1, e0, msg1, msg2, msg3, msg0, 1);
+		NI_ROUNDS(e0, e1, msg2, msg3, msg0, msg1, 1);
+		NI_ROUNDS(e1, e0, msg3, msg0, msg1, msg2, 1);
+		NI_ROUNDS(e0, e1, msg0, msg1, msg2, msg3, 1);
+		NI_ROUNDS(e1, e0, msg1, msg2, msg3, msg0, 1);
+		NI_ROUNDS(e0, e1, msg2, msg3, msg0, msg1, 2);
+		NI_ROUNDS(e1, e0, msg3, msg0, msg1, msg2, 2);
+		NI_ROUNDS(e0, e1, msg0, msg1, msg2, msg3, 2);
+		NI_ROUNDS(e1, e0, msg1, msg2, msg3, msg0, 2);
+		NI_ROUNDS(e0, e1, msg2, msg3, msg0, msg1, 2);
+		NI_ROUNDS(e1, e0, msg3, msg0, msg1, msg2, 3);
+		NI_ROUNDS(e0, e1, msg0, msg1, msg2, msg3, 3);
+
+		/* Rounds 68-79 */
+		e1   = _mm_sha1nexte_epu32(e1, msg1);
+		e0   = abcd;
+		msg2 = _mm_sha1msg2_epu32(msg2, msg1);
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+		msg3 = _mm_xor_si128(msg3, msg1);
+
+		e0   = _mm_sha1nexte_epu32(e0, msg2);
+		e1   = abcd;
+		msg3 = _mm_sha1msg2_epu32(msg3, msg2);
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 3);
+
+		e1   = _mm_sha1nexte_epu32(e1, msg3);
+		e0   = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+
+		e0   = _mm_sha1nexte_epu32(e0, e0_save);
+		abcd = _mm_add_epi32(abcd, abcd_save);
+	}
+
+	abcd = _mm_shuffle_epi32(abcd, 0x1b);
+	_mm_storeu_si128((__m128i *)(void *)state, abcd);
+	state[4] = (uint32_t)_mm_extract_epi32(e0, 3);
+}
+
+
+static sha1_blocks_h *blocks_select(void)
+{
+	unsigned a, b, c, d;
+
+	if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_SSE4_1))
+		return blocks_sw;
+
+	if (!__get_cpuid_count(7, 0, &a, &b, &c, &d) || !(b & (1u << 29)))
+		return blocks_sw;
+
+	return blocks_ni;
+}
+#endif
+
+
+#ifdef SHA1_ARMV8
+__attribute__((target("+crypto")))
+static void blocks_armv8(uint32_t state[5], const uint8_t *data,
+			 size_t blocks)
+{
+	static const uint32_t k[4] = {
+		0x5a827999, 0x6ed9eba1, 0x8f1bbcdc, 0xca62c1d6
+	};
+	uint32x4_t abcd, abcd_save, w[20], t;
+	uint32_t e, e_save, e_next;
+	int i;
+
+	abcd = vld1q_u32(state);
+	e    = state[4];
+
+	for (; blocks; --blocks, data += 64) {
+
+		abcd_save = abcd;
+		e_save    = e;
+
+		for (i=0; i<4; i++) {
+			w[i] = vreinterpretq_u32_u8(vrev32q_u8(
+				       vld1q_u8(data + 16 * i)));
+		}
+
+		for (i=4; i<20; i++) {
+			w[i] = vsha1su1q_u32(vsha1su0q_u32(w[i-4], w[i-3],
+							   w[i-2]), w[i-1]);
+		}
+
+		/* 20 times four rounds */
+		for (i=0; i<20; i++) {
+
+			t = vaddq_u32(w[i], vdupq_n_u32(k[i / 5]));
+			e_next = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+
+			if (i < 5)
+				abcd = vsha1cq_u32(abcd, e, t);
+			else if (i >= 10 && i < 15)
+				abcd = vsha1mq_u32(abcd, e, t);
+			else
+				abcd = vsha1pq_u32(abcd, e, t);
+
+			e = e_next;
+		}
+
+		abcd = vaddq_u32(abcd, abcd_save);
+		e   += e_save;
+	}
+
+	vst1q_u32(state, abcd);
+	state[4] = e;
+}
+
+
+static sha1_blocks_h *blocks_select(void)
+{
+	return (getauxval(AT_HWCAP) & HWCAP_SHA1) ? blocks_armv8 : blocks_sw;
+}
+#endif
+
+
+/* Hash whole blocks, with the SHA instructions of the CPU if it has them */
+static void sha1_blocks(uint32_t state[5], const uint8_t *data,
+			size_t blocks)
+{
+#if defined(SHA1_NI) || defined(SHA1_ARMV8)
+	static sha1_blocks_h *blocksh;
+
+	if (!blocksh)
+		blocksh = blocks_select();
+
+	blocksh(state, data, blocks);
+#else
+	blocks_sw(state, data, blocks);
+#endif
+}
+
+
 /**
  * Initialize new context
  *
@@ -221,10 +431,9 @@ void SHA1_Update(SHA1_CTX* context, const void *p, size_t len)
 	context->count[1] += (uint32_t)(len >> 29);
 	if ((j + len) > 63) {
 		memcpy(&context->buffer[j], data, (i = 64-j));
-		SHA1_Transform(context->state, context->buffer);
-		for ( ; i + 63 < len; i += 64) {
-			SHA1_Transform(context->state, data + i);
-		}
+		sha1_blocks(context->state, context->buffer, 1);
+		sha1_blocks(context->state, data + i, (len - i) / 64);
+		i += (len - i) & ~(size_t)63;
 		j = 0;
 	}
 	else i = 0;
@@ -240,6 +449,7 @@ void SHA1_Update(SHA1_CTX* context, const void *p, size_t len)
  */
 void SHA1_Final(uint8_t digest[SHA1_DIGEST_SIZE], SHA1_CTX* context)
 {
+	static const uint8_t pad[64] = {0x80};
 	uint32_t i;
 	uint8_t  finalcount[8];
 
@@ -247,10 +457,9 @@ void SHA1_Final(uint8_t digest[SHA1_DIGEST_SIZE], SHA1_CTX* context)
 		finalcount[i] = (uint8_t)((context->count[(i >= 4 ? 0 : 1)]
 					   >> ((3-(i & 3)) * 8) ) & 255);
 	}
-	SHA1_Update(context, (uint8_t *)"\200", 1);
-	while ((context->count[0] & 504) != 448) {
-		SHA1_Update(context, (uint8_t *)"\0", 1);
-	}
+	/* pad with 0x80 and zeros up to 56 bytes modulo 64 */
+	i = (context->count[0] >> 3) & 63;
+	SHA1_Update(context, pad, i < 56 ? 56 - i : 120 - i);
 	SHA1_Update(context, finalcount, 8); /* Should cause SHA1_Transform */
 	for (i = 0; i < SHA1_DIGEST_SIZE; i++) {
 		digest[i] = (uint8_t)
@@ -10,8 +10,77 @@
 #include <re_uri.h>
 #include <re_list.h>
 #include <re_sa.h>
+#include <re_udp.h>
 #include <re_msg.h>
 #include <re_sip.h>
+#include "sip.h"
+
+
+/*
+ * "[~ \t\r\n<]*[ \t\r\n]*<[^>]+>[^]*" at p, returns ENOENT if there is
+ * no match at p, or ENODATA if there is no match at p or after it
+ */
+static int addr_match(struct sip_addr *addr, const char *p, const char *end)
+{
+	bool quote = false, esc = false;
+	const char *q;
+
+	/* display-name, with quotes and escapes */
+	for (q = p; q < end; q++) {
+
+		if (esc) {
+			esc = false;
+			continue;
+		}
+
+		if (*q == '\\') {
+			esc = true;
+			continue;
+		}
+
+		if (*q == '"') {
+			quote = !quote;
+			continue;
+		}
+
+		if (!quote && (sip_is_lws(*q) || *q == '<'))
+			break;
+	}
+
+	addr->dname.p = p;
+	addr->dname.l = q - p;
+
+	if (addr->dname.l > 1 && p[0] == '"' && q[-1] == '"') {
+		addr->dname.p += 1;
+		addr->dname.l -= 2;
+	}
+
+	q = sip_skip_lws(q, end);
+	if (q == end)
+		return ENODATA;
+
+	if (*q != '<')
+		return ENOENT;
+
+	p = ++q;
+	if (p == end)
+		return ENOENT;
+
+	q = memchr(p, '>', end - p);
+	if (!q)
+		return ENODATA;
+
+	if (q == p)
+		return ENOENT;
+
+	addr->auri.p = p;
+	addr->auri.l = q - p;
+
+	addr->params.p = q + 1;
+	addr->params.l = end - addr->params.p;
+
+	return 0;
+}
 
 
 /**
@@ -24,15 +93,23 @@
  */
 int sip_addr_decode(struct sip_addr *addr, const struct pl *pl)
 {
+	const char *p, *q, *end;
 	int err;
 
-	if (!addr || !pl)
+	if (!addr || !pl || !pl->p)
 		return EINVAL;
 
 	memset(addr, 0, sizeof(*addr));
 
-	if (0 == re_regex(pl->p, pl->l, "[~ \t\r\n<]*[ \t\r\n]*<[^>]+>[^]*",
-			  &addr->dname, NULL, &addr->auri, &addr->params)) {
+	end = pl->p + pl->l;
+
+	/* There is no name-addr without a '<' */
+	err = memchr(pl->p, '<', pl->l) ? ENOENT : ENODATA;
+
+	for (p = pl->p; p < end && err == ENOENT; p++)
+		err = addr_match(addr, p, end);
+
+	if (!err) {
 
 		if (!addr->dname.l)
 			addr->dname.p = NULL;
@@ -43,9 +120,21 @@ int sip_addr_decode(struct sip_addr *addr, const struct pl *pl)
 	else {
 		memset(addr, 0, sizeof(*addr));
 
-		if (re_regex(pl->p, pl->l, "[^;]+[^]*",
-			     &addr->auri, &addr->params))
+		/* addr-spec, "[^;]+[^]*" */
+		for (p = pl->p; p < end && *p == ';'; p++)
+			;
+
+		if (p == end)
 			return EBADMSG;
+
+		q = memchr(p, ';', end - p);
+		if (!q)
+			q = end;
+
+		addr->auri.p   = p;
+		addr->auri.l   = q - p;
+		addr->params.p = q;
+		addr->params.l = end - q;
 	}
 
 	err = uri_decode(&addr->uri, &addr->auri);
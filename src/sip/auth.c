@@ -17,9 +17,15 @@
 #include <re_udp.h>
 #include <re_msg.h>
 #include <re_sip.h>
+#include <re_snap.h>
 #include "sip.h"
 
 
+enum {
+	AUTH_BATCH = 4,
+};
+
+
 struct sip_auth {
 	struct list realml;
 	sip_auth_h *authh;
@@ -37,6 +43,7 @@ struct realm {
 	char *opaque;
 	char *user;
 	char *pass;
+	uint8_t ha1[MD5_SIZE];
 	uint32_t nc;
 	enum sip_hdrid hdr;
 };
@@ -78,33 +85,67 @@ static void auth_destructor(void *arg)
 }
 
 
-static int mkdigest(uint8_t *digest, const struct realm *realm,
-		    const char *met, const char *uri, uint64_t cnonce)
+static int mkdigest(struct mbuf *mb, const struct realm *realm,
+		    const uint8_t *ha2, uint64_t cnonce)
+{
+	const uint8_t *ha1 = realm->ha1;
+
+	if (realm->qop)
+		return mbuf_printf(mb, "%w:%s:%08x:%016llx:auth:%w",
+				   ha1, (size_t)MD5_SIZE,
+				   realm->nonce,
+				   realm->nc,
+				   cnonce,
+				   ha2, (size_t)MD5_SIZE);
+	else
+		return mbuf_printf(mb, "%w:%s:%w",
+				   ha1, (size_t)MD5_SIZE,
+				   realm->nonce,
+				   ha2, (size_t)MD5_SIZE);
+}
+
+
+static int encode_realm(struct mbuf *mb, struct realm *realm,
+			const char *uri, const uint8_t *digest,
+			uint64_t cnonce)
 {
-	uint8_t ha1[MD5_SIZE], ha2[MD5_SIZE];
 	int err;
 
-	err = md5_printf(ha1, "%s:%s:%s",
-			 realm->user, realm->realm, realm->pass);
-	if (err)
-		return err;
+	switch (realm->hdr) {
 
-	err = md5_printf(ha2, "%s:%s", met, uri);
-	if (err)
-		return err;
+	case SIP_HDR_WWW_AUTHENTICATE:
+		err = mbuf_write_str(mb, "Authorization: ");
+		break;
 
-	if (realm->qop)
-		return md5_printf(digest, "%w:%s:%08x:%016llx:auth:%w",
-				  ha1, sizeof(ha1),
-				  realm->nonce,
-				  realm->nc,
-				  cnonce,
-				  ha2, sizeof(ha2));
-	else
-		return md5_printf(digest, "%w:%s:%w",
-				  ha1, sizeof(ha1),
-				  realm->nonce,
-				  ha2, sizeof(ha2));
+	case SIP_HDR_PROXY_AUTHENTICATE:
+		err = mbuf_write_str(mb, "Proxy-Authorization: ");
+		break;
+
+	default:
+		return 0;
+	}
+
+	err |= mbuf_printf(mb, "Digest username=\"%s\"", realm->user);
+	err |= mbuf_printf(mb, ", realm=\"%s\"", realm->realm);
+	err |= mbuf_printf(mb, ", nonce=\"%s\"", realm->nonce);
+	err |= mbuf_printf(mb, ", uri=\"%s\"", uri);
+	err |= mbuf_printf(mb, ", response=\"%w\"",
+			   digest, (size_t)MD5_SIZE);
+
+	if (realm->opaque)
+		err |= mbuf_printf(mb, ", opaque=\"%s\"", realm->opaque);
+
+	if (realm->qop) {
+		err |= mbuf_printf(mb, ", cnonce=\"%016llx\"", cnonce);
+		err |= mbuf_write_str(mb, ", qop=auth");
+		err |= mbuf_printf(mb, ", nc=%08x", realm->nc);
+	}
+
+	++realm->nc;
+
+	err |= mbuf_write_str(mb, "\r\n");
+
+	return err;
 }
 
 
@@ -121,6 +162,28 @@ static bool cmp_handler(struct le *le, void *arg)
 }
 
 
+/* HA1 only depends on the credentials, it is computed once per realm */
+static int realm_credentials(struct realm *realm, struct sip_auth *auth)
+{
+	int err;
+
+	err = auth->authh(&realm->user, &realm->pass, realm->realm, auth->arg);
+	if (err)
+		return err;
+
+	return md5_printf(realm->ha1, "%s:%s:%s",
+			  realm->user, realm->realm, realm->pass);
+}
+
+
+static bool name_handler(struct le *le, void *arg)
+{
+	struct realm *realm = le->data;
+
+	return 0 == str_casecmp(realm->realm, arg);
+}
+
+
 static bool auth_handler(const struct sip_hdr *hdr, const struct sip_msg *msg,
 			 void *arg)
 {
@@ -155,8 +218,7 @@ static bool auth_handler(const struct sip_hdr *hdr, const struct sip_msg *msg,
 		if (err)
 			goto out;
 
-		err = auth->authh(&realm->user, &realm->pass,
-				  realm->realm, auth->arg);
+		err = realm_credentials(realm, auth);
 		if (err)
 			goto out;
 	}
@@ -222,57 +284,55 @@ int sip_auth_encode(struct mbuf *mb, struct sip_auth *auth, const char *met,
 		    const char *uri)
 {
 	struct le *le;
+	uint8_t ha2[MD5_SIZE];
 	int err = 0;
 
 	if (!mb || !auth || !met || !uri)
 		return EINVAL;
 
-	for (le = auth->realml.head; le; le = le->next) {
+	if (!auth->realml.head)
+		return 0;
 
-		const uint64_t cnonce = rand_u64();
-		struct realm *realm = le->data;
-		uint8_t digest[MD5_SIZE];
+	err = md5_printf(ha2, "%s:%s", met, uri);
+	if (err)
+		return err;
 
-		err = mkdigest(digest, realm, met, uri, cnonce);
-		if (err)
-			break;
+	/* the responses of a batch of realms are hashed together */
+	le = auth->realml.head;
+	while (le && !err) {
 
-		switch (realm->hdr) {
+		struct md5_buf bufv[AUTH_BATCH];
+		struct mbuf mbv[AUTH_BATCH];
+		uint64_t cnoncev[AUTH_BATCH];
+		struct le *first = le;
+		size_t i, n;
 
-		case SIP_HDR_WWW_AUTHENTICATE:
-			err = mbuf_write_str(mb, "Authorization: ");
-			break;
+		for (n=0; le && n<AUTH_BATCH; le = le->next, n++) {
 
-		case SIP_HDR_PROXY_AUTHENTICATE:
-			err = mbuf_write_str(mb, "Proxy-Authorization: ");
-			break;
+			mbuf_init(&mbv[n]);
+			cnoncev[n] = rand_u64();
 
-		default:
-			continue;
-		}
+			err = mkdigest(&mbv[n], le->data, ha2, cnoncev[n]);
+			if (err) {
+				++n;
+				break;
+			}
 
-		err |= mbuf_printf(mb, "Digest username=\"%s\"", realm->user);
-		err |= mbuf_printf(mb, ", realm=\"%s\"", realm->realm);
-		err |= mbuf_printf(mb, ", nonce=\"%s\"", realm->nonce);
-		err |= mbuf_printf(mb, ", uri=\"%s\"", uri);
-		err |= mbuf_printf(mb, ", response=\"%w\"",
-				   digest, sizeof(digest));
-
-		if (realm->opaque)
-			err |= mbuf_printf(mb, ", opaque=\"%s\"",
-					   realm->opaque);
-
-		if (realm->qop) {
-			err |= mbuf_printf(mb, ", cnonce=\"%016llx\"", cnonce);
-			err |= mbuf_write_str(mb, ", qop=auth");
-			err |= mbuf_printf(mb, ", nc=%08x", realm->nc);
+			bufv[n].d = mbv[n].buf;
+			bufv[n].n = mbv[n].end;
 		}
 
-		++realm->nc;
+		if (!err)
+			md5_multi(bufv, n);
 
-		err |= mbuf_write_str(mb, "\r\n");
-		if (err)
-			break;
+		for (i=0, le=first; i<n; i++, le = le->next) {
+
+			if (!err)
+				err = encode_realm(mb, le->data, uri,
+						   bufv[i].md, cnoncev[i]);
+
+			mbuf_reset(&mbv[i]);
+		}
 	}
 
 	return err;
@@ -323,3 +383,167 @@ void sip_auth_reset(struct sip_auth *auth)
 
 	list_flush(&auth->realml);
 }
+
+
+/**
+ * Take over the digest challenges of another SIP authentication state, so
+ * the next request carries credentials without a challenge round-trip.
+ * The credentials of a new realm are taken from the own handler.
+ *
+ * @param auth SIP Authentication state
+ * @param src  SIP Authentication state with the challenges
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sip_auth_import(struct sip_auth *auth, const struct sip_auth *src)
+{
+	struct le *le;
+	int err = 0;
+
+	if (!auth || !src)
+		return EINVAL;
+
+	for (le = src->realml.head; le; le = le->next) {
+
+		const struct realm *sr = le->data;
+		struct realm *realm;
+
+		realm = list_ledata(list_apply(&auth->realml, true,
+					       name_handler, sr->realm));
+		if (!realm) {
+			realm = mem_zalloc(sizeof(*realm), realm_destructor);
+			if (!realm)
+				return ENOMEM;
+
+			list_append(&auth->realml, &realm->le, realm);
+
+			err = str_dup(&realm->realm, sr->realm);
+			if (!err)
+				err = realm_credentials(realm, auth);
+			if (err) {
+				mem_deref(realm);
+				return err;
+			}
+		}
+
+		realm->nonce  = mem_deref(realm->nonce);
+		realm->qop    = mem_deref(realm->qop);
+		realm->opaque = mem_deref(realm->opaque);
+
+		err = str_dup(&realm->nonce, sr->nonce);
+
+		if (sr->qop)
+			err |= str_dup(&realm->qop, sr->qop);
+
+		if (sr->opaque)
+			err |= str_dup(&realm->opaque, sr->opaque);
+
+		if (err) {
+			mem_deref(realm);
+			return err;
+		}
+
+		realm->hdr = sr->hdr;
+		realm->nc  = 1;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Encode the digest challenges of a SIP authentication state for a
+ * snapshot. The credentials are not encoded.
+ *
+ * @param mb   Snapshot record buffer
+ * @param auth SIP Authentication state
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sip_auth_snap_encode(struct mbuf *mb, const struct sip_auth *auth)
+{
+	struct le *le;
+	int err;
+
+	if (!mb || !auth)
+		return EINVAL;
+
+	err = mbuf_write_u16(mb, htons((uint16_t)min(list_count(&auth->realml),
+						    (uint32_t)0xffff)));
+
+	for (le = auth->realml.head; le && !err; le = le->next) {
+
+		const struct realm *realm = le->data;
+
+		err  = snap_str_encode(mb, realm->realm);
+		err |= snap_str_encode(mb, realm->nonce);
+		err |= snap_str_encode(mb, realm->qop);
+		err |= snap_str_encode(mb, realm->opaque);
+		err |= mbuf_write_u32(mb, htonl(realm->nc));
+		err |= mbuf_write_u16(mb, htons((uint16_t)realm->hdr));
+	}
+
+	return err;
+}
+
+
+/**
+ * Decode the digest challenges of a snapshot into a SIP authentication
+ * state. The credentials of each realm are taken from the own handler,
+ * and the nonce count goes on from where it was.
+ *
+ * @param auth SIP Authentication state
+ * @param mb   Snapshot record buffer
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sip_auth_snap_decode(struct sip_auth *auth, struct mbuf *mb)
+{
+	uint16_t i, n;
+	int err = 0;
+
+	if (!auth || !mb)
+		return EINVAL;
+
+	if (mbuf_get_left(mb) < 2)
+		return EBADMSG;
+
+	n = ntohs(mbuf_read_u16(mb));
+
+	for (i=0; i<n && !err; i++) {
+
+		struct realm *realm;
+		uint16_t hdr;
+
+		realm = mem_zalloc(sizeof(*realm), realm_destructor);
+		if (!realm) {
+			err = ENOMEM;
+			break;
+		}
+
+		list_append(&auth->realml, &realm->le, realm);
+
+		err  = snap_str_decode(mb, &realm->realm);
+		err |= snap_str_decode(mb, &realm->nonce);
+		err |= snap_str_decode(mb, &realm->qop);
+		err |= snap_str_decode(mb, &realm->opaque);
+		if (err)
+			break;
+
+		if (!realm->realm || !realm->nonce || mbuf_get_left(mb) < 6) {
+			err = EBADMSG;
+			break;
+		}
+
+		realm->nc  = ntohl(mbuf_read_u32(mb));
+		hdr        = ntohs(mbuf_read_u16(mb));
+		realm->hdr = (enum sip_hdrid)hdr;
+
+		err = realm_credentials(realm, auth);
+	}
+
+	if (err)
+		sip_auth_reset(auth);
+
+	return err;
+}
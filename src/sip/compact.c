@@ -0,0 +1,163 @@
+/**
+ * @file compact.c  SIP Compact Header Form
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re_types.h>
+#include <re_fmt.h>
+#include <re_mbuf.h>
+#include <re_sa.h>
+#include <re_list.h>
+#include <re_uri.h>
+#include <re_udp.h>
+#include <re_msg.h>
+#include <re_sip.h>
+#include "sip.h"
+
+
+/** Header names with a compact form (RFC 3261 and extensions) */
+static const struct {
+	const char *name;
+	char c;
+} compactv[] = {
+	{"Accept-Contact",      'a'},
+	{"Allow-Events",        'u'},
+	{"Call-ID",             'i'},
+	{"Contact",             'm'},
+	{"Content-Encoding",    'e'},
+	{"Content-Length",      'l'},
+	{"Content-Type",        'c'},
+	{"Event",               'o'},
+	{"From",                'f'},
+	{"Identity",            'y'},
+	{"Identity-Info",       'n'},
+	{"Refer-To",            'r'},
+	{"Referred-By",         'b'},
+	{"Reject-Contact",      'j'},
+	{"Request-Disposition", 'd'},
+	{"Session-Expires",     'x'},
+	{"Subject",             's'},
+	{"Supported",           'k'},
+	{"To",                  't'},
+	{"Via",                 'v'},
+};
+
+
+static char compact_name(const char *p, size_t l)
+{
+	struct pl name;
+	size_t i;
+
+	name.p = p;
+	name.l = l;
+
+	for (i=0; i<ARRAY_SIZE(compactv); i++) {
+
+		if (!pl_strcasecmp(&name, compactv[i].name))
+			return compactv[i].c;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Rewrite the header names of an encoded SIP message with their compact
+ * forms, in place. The start line, unknown headers and the body are
+ * copied as they are.
+ *
+ * @param mb Buffer with the message from the current position
+ */
+void sip_msg_compact(struct mbuf *mb)
+{
+	char *r, *w, *end;
+
+	if (!mb)
+		return;
+
+	r   = (char *)mbuf_buf(mb);
+	end = (char *)mb->buf + mb->end;
+
+	/* The start line */
+	r = memchr(r, '\n', end - r);
+	if (!r)
+		return;
+
+	w = ++r;
+
+	while (r < end) {
+
+		char *eol = memchr(r, '\n', end - r);
+		char *colon, *nend;
+		char c = 0;
+
+		if (!eol)
+			break;
+
+		++eol;
+
+		/* The empty line, the body follows */
+		if (*r == '\r' || *r == '\n') {
+			memmove(w, r, end - r);
+			w += end - r;
+			r  = end;
+			break;
+		}
+
+		colon = memchr(r, ':', eol - r);
+
+		if (colon && *r != ' ' && *r != '\t') {
+
+			for (nend = colon; nend > r && sip_is_lws(nend[-1]);
+			     nend--)
+				;
+
+			c = compact_name(r, nend - r);
+		}
+
+		if (c) {
+			*w++ = c;
+			r = nend;
+		}
+
+		memmove(w, r, eol - r);
+		w += eol - r;
+		r  = eol;
+	}
+
+	if (r < end) {
+		memmove(w, r, end - r);
+		w += end - r;
+	}
+
+	mb->end = w - (char *)mb->buf;
+}
+
+
+/**
+ * Send SIP messages with the compact header forms, e.g. to keep messages
+ * with SDP below the MTU on UDP
+ *
+ * @param sip    SIP stack instance
+ * @param tp     SIP Transport, or SIP_TRANSP_NONE for all transports
+ * @param enable True to enable, false to disable
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sip_set_compact(struct sip *sip, enum sip_transp tp, bool enable)
+{
+	uint32_t mask;
+
+	if (!sip || tp >= SIP_TRANSPC)
+		return EINVAL;
+
+	mask = tp == SIP_TRANSP_NONE ? ~0u : 1u << tp;
+
+	if (enable)
+		sip->compact |= mask;
+	else
+		sip->compact &= ~mask;
+
+	return 0;
+}
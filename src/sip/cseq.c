@@ -9,8 +9,36 @@
 #include <re_uri.h>
 #include <re_list.h>
 #include <re_sa.h>
+#include <re_udp.h>
 #include <re_msg.h>
 #include <re_sip.h>
+#include "sip.h"
+
+
+/* "[0-9]+[ \t\r\n]+[^ \t\r\n]+" at p */
+static bool cseq_match(struct pl *num, struct pl *met,
+		       const char *p, const char *end)
+{
+	const char *q = p;
+
+	while (q < end && '0' <= *q && *q <= '9')
+		++q;
+
+	if (q == p || q == end || !sip_is_lws(*q))
+		return false;
+
+	num->p = p;
+	num->l = q - p;
+
+	met->p = q = sip_skip_lws(q, end);
+
+	while (q < end && !sip_is_lws(*q))
+		++q;
+
+	met->l = q - met->p;
+
+	return met->l > 0;
+}
 
 
 /**
@@ -23,18 +51,24 @@
  */
 int sip_cseq_decode(struct sip_cseq *cseq, const struct pl *pl)
 {
-	struct pl num;
-	int err;
+	const char *p, *end;
+	struct pl num, met;
 
-	if (!cseq || !pl)
+	if (!cseq || !pl || !pl->p)
 		return EINVAL;
 
-	err = re_regex(pl->p, pl->l, "[0-9]+[ \t\r\n]+[^ \t\r\n]+",
-		       &num, NULL, &cseq->met);
-	if (err)
-		return err;
+	end = pl->p + pl->l;
+
+	for (p = pl->p; p < end; p++) {
+
+		if (!cseq_match(&num, &met, p, end))
+			continue;
+
+		cseq->num = pl_u32(&num);
+		cseq->met = met;
 
-	cseq->num = pl_u32(&num);
+		return 0;
+	}
 
-	return 0;
+	return ENOENT;
 }
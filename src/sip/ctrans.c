@@ -17,6 +17,8 @@
 #include <re_udp.h>
 #include <re_msg.h>
 #include <re_sip.h>
+#include <re_trace.h>
+#include <re_metric.h>
 #include "sip.h"
 
 
@@ -34,7 +36,7 @@ enum {
 
 
 struct sip_ctrans {
-	struct le he;
+	struct le le;
 	struct sa dst;
 	struct tmr tmr;
 	struct tmr tmre;
@@ -54,6 +56,37 @@ struct sip_ctrans {
 };
 
 
+RE_METRIC_GAUGE_DEFINE(m_trying, "re_sip_client_transactions",
+		       "state=\"trying\"",
+		       "SIP client transactions by state");
+RE_METRIC_GAUGE_DEFINE(m_calling, "re_sip_client_transactions",
+		       "state=\"calling\"",
+		       "SIP client transactions by state");
+RE_METRIC_GAUGE_DEFINE(m_proceeding, "re_sip_client_transactions",
+		       "state=\"proceeding\"",
+		       "SIP client transactions by state");
+RE_METRIC_GAUGE_DEFINE(m_completed, "re_sip_client_transactions",
+		       "state=\"completed\"",
+		       "SIP client transactions by state");
+
+/* Indexed by the state */
+static struct re_metric *const statev[] = {
+	&m_trying,
+	&m_calling,
+	&m_proceeding,
+	&m_completed,
+};
+
+
+static void state_set(struct sip_ctrans *ct, enum state state)
+{
+	re_metric_gauge_add(statev[ct->state], -1);
+	re_metric_gauge_add(statev[state], 1);
+
+	ct->state = state;
+}
+
+
 static bool route_handler(const struct sip_hdr *hdr, const struct sip_msg *msg,
 			  void *arg)
 {
@@ -84,16 +117,19 @@ static int request_copy(struct mbuf **mbp, struct sip_ctrans *ct,
 	err |= sip_msg_hdr_apply(ct->req, true, SIP_HDR_ROUTE,
 				 route_handler, mb) ? ENOMEM : 0;
 	err |= mbuf_printf(mb, "To: %r\r\n",
-			   resp ? &resp->to.val : &ct->req->to.val);
-	err |= mbuf_printf(mb, "From: %r\r\n", &ct->req->from.val);
+			   &sip_msg_to(resp ? resp : ct->req)->val);
+	err |= mbuf_printf(mb, "From: %r\r\n", &sip_msg_from(ct->req)->val);
 	err |= mbuf_printf(mb, "Call-ID: %r\r\n", &ct->req->callid);
 	err |= mbuf_printf(mb, "CSeq: %u %s\r\n", ct->req->cseq.num, met);
-	if (ct->sip->software)
-		err |= mbuf_printf(mb, "User-Agent: %s\r\n",ct->sip->software);
+	if (ct->sip->uahdr)
+		err |= mbuf_write_str(mb, ct->sip->uahdr);
 	err |= mbuf_write_str(mb, "Content-Length: 0\r\n\r\n");
 
 	mb->pos = 0;
 
+	if (sip_compact(ct->sip, ct->tp))
+		sip_msg_compact(mb);
+
 	if (err)
 		mem_deref(mb);
 	else
@@ -107,7 +143,15 @@ static void destructor(void *arg)
 {
 	struct sip_ctrans *ct = arg;
 
-	hash_unlink(&ct->he);
+	RE_TRACE_ASYNC_END("sip", "ctrans", ct);
+
+	if (ct->sip)
+		re_metric_gauge_add(statev[ct->state], -1);
+
+	list_unlink(&ct->le);
+	if (ct->branch)
+		hmap_remove(ct->sip->map_ctrans, hash_fast_str(ct->branch),
+			    ct);
 	tmr_cancel(&ct->tmr);
 	tmr_cancel(&ct->tmre);
 	mem_deref(ct->met);
@@ -119,9 +163,9 @@ static void destructor(void *arg)
 }
 
 
-static bool cmp_handler(struct le *le, void *arg)
+static bool cmp_handler(const void *val, void *arg)
 {
-	struct sip_ctrans *ct = le->data;
+	const struct sip_ctrans *ct = val;
 	const struct sip_msg *msg = arg;
 
 	if (pl_strcmp(&msg->via.branch, ct->branch))
@@ -223,7 +267,7 @@ static void invite_response(struct sip_ctrans *ct, const struct sip_msg *msg)
 		/*@fallthrough@*/
 	case PROCEEDING:
 		if (msg->scode < 200) {
-			ct->state = PROCEEDING;
+			state_set(ct, PROCEEDING);
 			ct->resph(0, msg, ct->arg);
 		}
 		else if (msg->scode < 300) {
@@ -231,7 +275,7 @@ static void invite_response(struct sip_ctrans *ct, const struct sip_msg *msg)
 			mem_deref(ct);
 		}
 		else {
-			ct->state = COMPLETED;
+			state_set(ct, COMPLETED);
 
 			(void)request_copy(&ct->mb_ack, ct, "ACK", msg);
 			(void)sip_send(ct->sip, NULL, ct->tp, &ct->dst,
@@ -266,9 +310,8 @@ static bool response_handler(const struct sip_msg *msg, void *arg)
 	struct sip_ctrans *ct;
 	struct sip *sip = arg;
 
-	ct = list_ledata(hash_lookup(sip->ht_ctrans,
-				     hash_joaat_pl(&msg->via.branch),
-				     cmp_handler, (void *)msg));
+	ct = hmap_lookup(sip->map_ctrans, hash_fast_pl(&msg->via.branch),
+			 cmp_handler, (void *)msg);
 	if (!ct)
 		return false;
 
@@ -282,11 +325,11 @@ static bool response_handler(const struct sip_msg *msg, void *arg)
 	case TRYING:
 	case PROCEEDING:
 		if (msg->scode < 200) {
-			ct->state = PROCEEDING;
+			state_set(ct, PROCEEDING);
 			ct->resph(0, msg, ct->arg);
 		}
 		else {
-			ct->state = COMPLETED;
+			state_set(ct, COMPLETED);
 			ct->resph(0, msg, ct->arg);
 
 			if (sip_transp_reliable(ct->tp)) {
@@ -322,7 +365,9 @@ int sip_ctrans_request(struct sip_ctrans **ctp, struct sip *sip,
 	if (!ct)
 		return ENOMEM;
 
-	hash_append(sip->ht_ctrans, hash_joaat_str(branch), &ct->he, ct);
+	RE_TRACE_ASYNC_BEGIN("sip", "ctrans", ct);
+
+	list_append(&sip->ctransl, &ct->le, ct);
 
 	ct->invite = !strcmp(met, "INVITE");
 	ct->branch = mem_ref(branch);
@@ -335,6 +380,12 @@ int sip_ctrans_request(struct sip_ctrans **ctp, struct sip *sip,
 	ct->resph  = resph ? resph : dummy_handler;
 	ct->arg    = arg;
 
+	re_metric_gauge_add(statev[ct->state], 1);
+
+	err = hmap_insert(sip->map_ctrans, hash_fast_str(branch), ct);
+	if (err)
+		goto out;
+
 	err = sip_transp_send(&ct->qent, sip, NULL, tp, dst, mb,
 			      transport_handler, ct);
 	if (err)
@@ -406,7 +457,7 @@ int sip_ctrans_init(struct sip *sip, uint32_t sz)
 	if (err)
 		return err;
 
-	return hash_alloc(&sip->ht_ctrans, sz);
+	return hmap_alloc(&sip->map_ctrans, sz);
 }
 
 
@@ -443,7 +494,7 @@ int sip_ctrans_debug(struct re_printf *pf, const struct sip *sip)
 	int err;
 
 	err = re_hprintf(pf, "client transactions:\n");
-	hash_apply(sip->ht_ctrans, debug_handler, pf);
+	list_apply(&sip->ctransl, true, debug_handler, pf);
 
 	return err;
 }
@@ -17,6 +17,7 @@
 #include <re_udp.h>
 #include <re_msg.h>
 #include <re_sip.h>
+#include <re_snap.h>
 #include "sip.h"
 
 
@@ -45,6 +46,26 @@ struct route_enc {
 };
 
 
+/* The dialog key is combined from the hashes of the ID parts */
+static uint32_t key_combine(uint32_t key, const char *p, size_t l)
+{
+	return key * 33 ^ (l ? hash_fast(p, l) : 0);
+}
+
+
+/* The To or From header of the peer */
+static inline const struct sip_taddr *remote_taddr(const struct sip_msg *msg)
+{
+	return msg->req ? sip_msg_from(msg) : sip_msg_to(msg);
+}
+
+
+static inline const struct sip_taddr *local_taddr(const struct sip_msg *msg)
+{
+	return msg->req ? sip_msg_to(msg) : sip_msg_from(msg);
+}
+
+
 static int x64_strdup(char **strp, uint64_t val)
 {
 	char *str;
@@ -107,7 +128,7 @@ int sip_dialog_alloc(struct sip_dialog **dlgp,
 		return ENOMEM;
 
 	dlg->hash = hash_fast_str(from_uri);
-	dlg->lseq = rand_u16();
+	dlg->lseq = rand_fast_u16();
 
 	err = str_dup(&dlg->uri, uri);
 	if (err)
@@ -213,8 +234,8 @@ int sip_dialog_accept(struct sip_dialog **dlgp, const struct sip_msg *msg)
 	if (!dlg)
 		return ENOMEM;
 
-	dlg->hash = rand_u32();
-	dlg->lseq = rand_u16();
+	dlg->hash = rand_fast_u32();
+	dlg->lseq = rand_fast_u16();
 	dlg->rseq = msg->cseq.num;
 
 	err = pl_strdup(&dlg->uri, &addr.auri);
@@ -229,7 +250,7 @@ int sip_dialog_accept(struct sip_dialog **dlgp, const struct sip_msg *msg)
 	if (err)
 		goto out;
 
-	err = pl_strdup(&dlg->rtag, &msg->from.tag);
+	err = pl_strdup(&dlg->rtag, &sip_msg_from(msg)->tag);
 	if (err)
 		goto out;
 
@@ -244,9 +265,9 @@ int sip_dialog_accept(struct sip_dialog **dlgp, const struct sip_msg *msg)
 
 	err |= sip_msg_hdr_apply(msg, true, SIP_HDR_RECORD_ROUTE,
 				 record_route_handler, &renc) ? ENOMEM : 0;
-	err |= mbuf_printf(dlg->mb, "To: %r\r\n", &msg->from.val);
-	err |= mbuf_printf(dlg->mb, "From: %r;tag=%016llx\r\n", &msg->to.val,
-			   msg->tag);
+	err |= mbuf_printf(dlg->mb, "To: %r\r\n", &sip_msg_from(msg)->val);
+	err |= mbuf_printf(dlg->mb, "From: %r;tag=%016llx\r\n",
+			   &sip_msg_to(msg)->val, msg->tag);
 	if (err)
 		goto out;
 
@@ -309,7 +330,7 @@ int sip_dialog_create(struct sip_dialog *dlg, const struct sip_msg *msg)
 	if (err)
 		goto out;
 
-	err = pl_strdup(&rtag, msg->req ? &msg->from.tag : &msg->to.tag);
+	err = pl_strdup(&rtag, &remote_taddr(msg)->tag);
 	if (err)
 		goto out;
 
@@ -318,7 +339,7 @@ int sip_dialog_create(struct sip_dialog *dlg, const struct sip_msg *msg)
 	err |= sip_msg_hdr_apply(msg, msg->req, SIP_HDR_RECORD_ROUTE,
 				 record_route_handler, &renc) ? ENOMEM : 0;
 	err |= mbuf_printf(renc.mb, "To: %r\r\n",
-			   msg->req ? &msg->from.val : &msg->to.val);
+			   &remote_taddr(msg)->val);
 
 	dlg->mb->pos = dlg->cpos;
 	err |= mbuf_write_mem(renc.mb, mbuf_buf(dlg->mb),
@@ -412,7 +433,7 @@ int sip_dialog_fork(struct sip_dialog **dlgp, struct sip_dialog *odlg,
 	if (err)
 		goto out;
 
-	err = pl_strdup(&dlg->rtag, msg->req ? &msg->from.tag : &msg->to.tag);
+	err = pl_strdup(&dlg->rtag, &remote_taddr(msg)->tag);
 	if (err)
 		goto out;
 
@@ -428,7 +449,7 @@ int sip_dialog_fork(struct sip_dialog **dlgp, struct sip_dialog *odlg,
 	err |= sip_msg_hdr_apply(msg, msg->req, SIP_HDR_RECORD_ROUTE,
 				 record_route_handler, &renc) ? ENOMEM : 0;
 	err |= mbuf_printf(dlg->mb, "To: %r\r\n",
-			   msg->req ? &msg->from.val : &msg->to.val);
+			   &remote_taddr(msg)->val);
 
 	odlg->mb->pos = odlg->cpos;
 	err |= mbuf_write_mem(dlg->mb, mbuf_buf(odlg->mb),
@@ -625,10 +646,10 @@ bool sip_dialog_cmp(const struct sip_dialog *dlg, const struct sip_msg *msg)
 	if (pl_strcmp(&msg->callid, dlg->callid))
 		return false;
 
-	if (pl_strcmp(msg->req ? &msg->to.tag : &msg->from.tag, dlg->ltag))
+	if (pl_strcmp(&local_taddr(msg)->tag, dlg->ltag))
 		return false;
 
-	if (pl_strcmp(msg->req ? &msg->from.tag : &msg->to.tag, dlg->rtag))
+	if (pl_strcmp(&remote_taddr(msg)->tag, dlg->rtag))
 		return false;
 
 	return true;
@@ -652,8 +673,222 @@ bool sip_dialog_cmp_half(const struct sip_dialog *dlg,
 	if (pl_strcmp(&msg->callid, dlg->callid))
 		return false;
 
-	if (pl_strcmp(msg->req ? &msg->to.tag : &msg->from.tag, dlg->ltag))
+	if (pl_strcmp(&local_taddr(msg)->tag, dlg->ltag))
 		return false;
 
 	return true;
 }
+
+
+/**
+ * Get the lookup key of a SIP Dialog. The key is a hash over the
+ * Call-ID, the local tag and the remote tag, so the dialogs of one
+ * Call-ID, e.g. forked dialogs, have different keys. The key changes when
+ * the remote tag is set by sip_dialog_create(), and a dialog that is in
+ * a hashtable must then be added again.
+ *
+ * @param dlg SIP Dialog
+ *
+ * @return Dialog key
+ */
+uint32_t sip_dialog_key(const struct sip_dialog *dlg)
+{
+	uint32_t key;
+
+	if (!dlg)
+		return 0;
+
+	key = key_combine(0, dlg->callid, str_len(dlg->callid));
+	key = key_combine(key, dlg->ltag, str_len(dlg->ltag));
+
+	return key_combine(key, dlg->rtag, str_len(dlg->rtag));
+}
+
+
+/**
+ * Get the lookup key of the SIP Dialog that a SIP Message belongs to.
+ * Without the remote tag, the key is the one of the dialogs that are not
+ * established yet, as matched by sip_dialog_cmp_half().
+ *
+ * @param msg  SIP Message
+ * @param full True to include the remote tag
+ *
+ * @return Dialog key
+ */
+uint32_t sip_dialog_msg_key(const struct sip_msg *msg, bool full)
+{
+	const struct pl *ltag, *rtag;
+	uint32_t key;
+
+	if (!msg)
+		return 0;
+
+	ltag = &local_taddr(msg)->tag;
+	rtag = &remote_taddr(msg)->tag;
+
+	key = key_combine(0, msg->callid.p, msg->callid.l);
+	key = key_combine(key, ltag->p, ltag->l);
+
+	return key_combine(key, rtag->p, full ? rtag->l : 0);
+}
+
+
+/**
+ * Encode a SIP Dialog for a snapshot, with its identifiers, sequence
+ * numbers and route set
+ *
+ * @param mb  Snapshot record buffer
+ * @param dlg SIP Dialog
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sip_dialog_snap_encode(struct mbuf *mb, const struct sip_dialog *dlg)
+{
+	size_t len;
+	int err;
+
+	if (!mb || !dlg)
+		return EINVAL;
+
+	len = mbuf_get_left(dlg->mb);
+
+	err  = snap_str_encode(mb, dlg->callid);
+	err |= snap_str_encode(mb, dlg->ltag);
+	err |= snap_str_encode(mb, dlg->rtag);
+	err |= snap_str_encode(mb, dlg->uri);
+	err |= mbuf_write_u32(mb, htonl(dlg->hash));
+	err |= mbuf_write_u32(mb, htonl(dlg->lseq));
+	err |= mbuf_write_u32(mb, htonl(dlg->rseq));
+	err |= mbuf_write_u32(mb, htonl((uint32_t)dlg->cpos));
+	err |= mbuf_write_u32(mb, htonl((uint32_t)len));
+	err |= mbuf_write_mem(mb, mbuf_buf(dlg->mb), len);
+
+	return err;
+}
+
+
+/* The route is the first Route header, or the remote target */
+static int route_restore(struct sip_dialog *dlg)
+{
+	const char *p = (const char *)dlg->mb->buf;
+	const size_t n = dlg->mb->end;
+	struct sip_addr addr;
+	struct pl pl;
+	size_t end;
+	int err;
+
+	if (n > ROUTE_OFFSET && !memcmp(p, "Route: ", ROUTE_OFFSET)) {
+
+		for (end = ROUTE_OFFSET; end + 1 < n; end++) {
+			if (p[end] == '\r' && p[end+1] == '\n')
+				break;
+		}
+
+		pl.p = p + ROUTE_OFFSET;
+		pl.l = end - ROUTE_OFFSET;
+
+		err = sip_addr_decode(&addr, &pl);
+		if (!err)
+			dlg->route = addr.uri;
+	}
+	else {
+		pl_set_str(&pl, dlg->uri);
+		err = uri_decode(&dlg->route, &pl);
+	}
+
+	return err;
+}
+
+
+/**
+ * Decode a SIP Dialog from a snapshot, e.g. to end a call that was lost
+ * in a restart, or to go on with its sequence numbers
+ *
+ * @param dlgp Pointer to allocated SIP Dialog
+ * @param mb   Snapshot record buffer
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sip_dialog_snap_decode(struct sip_dialog **dlgp, struct mbuf *mb)
+{
+	struct sip_dialog *dlg;
+	size_t len;
+	int err;
+
+	if (!dlgp || !mb)
+		return EINVAL;
+
+	dlg = mem_zalloc(sizeof(*dlg), destructor);
+	if (!dlg)
+		return ENOMEM;
+
+	err  = snap_str_decode(mb, &dlg->callid);
+	err |= snap_str_decode(mb, &dlg->ltag);
+	err |= snap_str_decode(mb, &dlg->rtag);
+	err |= snap_str_decode(mb, &dlg->uri);
+	if (err)
+		goto out;
+
+	if (!dlg->callid || !dlg->ltag || !dlg->uri ||
+	    mbuf_get_left(mb) < 20) {
+		err = EBADMSG;
+		goto out;
+	}
+
+	dlg->hash = ntohl(mbuf_read_u32(mb));
+	dlg->lseq = ntohl(mbuf_read_u32(mb));
+	dlg->rseq = ntohl(mbuf_read_u32(mb));
+	dlg->cpos = ntohl(mbuf_read_u32(mb));
+	len       = ntohl(mbuf_read_u32(mb));
+
+	if (!len || len > mbuf_get_left(mb) || dlg->cpos > len) {
+		err = EBADMSG;
+		goto out;
+	}
+
+	dlg->mb = mbuf_alloc(len);
+	if (!dlg->mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = mbuf_read_mem(mb, dlg->mb->buf, len);
+	if (err)
+		goto out;
+
+	dlg->mb->end = len;
+
+	err = route_restore(dlg);
+
+ out:
+	if (err)
+		mem_deref(dlg);
+	else
+		*dlgp = dlg;
+
+	return err;
+}
+
+
+/**
+ * Add a SIP Dialog to a snapshot, as a record of type SNAP_DIALOG
+ *
+ * @param snap Snapshot
+ * @param dlg  SIP Dialog
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sip_dialog_snap(struct snap *snap, const struct sip_dialog *dlg)
+{
+	struct mbuf *mb;
+	int err;
+
+	if (!snap || !dlg)
+		return EINVAL;
+
+	err = snap_record_begin(snap, SNAP_DIALOG, &mb);
+	if (err)
+		return err;
+
+	return snap_record_end(snap, sip_dialog_snap_encode(mb, dlg));
+}
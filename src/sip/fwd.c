@@ -0,0 +1,322 @@
+/**
+ * @file fwd.c  SIP Stateless Forwarding
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re_types.h>
+#include <re_mem.h>
+#include <re_mbuf.h>
+#include <re_sa.h>
+#include <re_list.h>
+#include <re_hash.h>
+#include <re_fmt.h>
+#include <re_uri.h>
+#include <re_udp.h>
+#include <re_msg.h>
+#include <re_sip.h>
+#include "sip.h"
+
+
+/*
+ * The forwarded message is put together from the parts of the received
+ * message and a few edits, in one buffer of the exact size. The received
+ * buffer is not changed, since the caller still holds the decoded message
+ * and a stream buffer may hold the start of the next message.
+ */
+
+
+enum {
+	FWD_EDITS = 4,
+};
+
+/** Replace the bytes [p, p + del) with ins */
+struct edit {
+	const char *p;
+	size_t del;
+	const char *ins;
+	size_t insl;
+};
+
+struct fwd {
+	struct edit editv[FWD_EDITS];
+	uint32_t n;
+};
+
+
+static void edit_add(struct fwd *fwd, const char *p, size_t del,
+		     const char *ins, size_t insl)
+{
+	struct edit *e;
+	uint32_t i;
+
+	/* keep the edits sorted by position */
+	for (i = fwd->n++; i > 0 && fwd->editv[i-1].p > p; i--)
+		fwd->editv[i] = fwd->editv[i-1];
+
+	e = &fwd->editv[i];
+
+	e->p    = p;
+	e->del  = del;
+	e->ins  = ins;
+	e->insl = insl;
+}
+
+
+static int fwd_encode(struct mbuf **mbp, const struct fwd *fwd,
+		      const char *start, const char *end)
+{
+	const char *p = start;
+	struct mbuf *mb;
+	size_t size;
+	uint32_t i;
+	int err = 0;
+
+	size = end - start;
+	for (i=0; i<fwd->n; i++)
+		size += fwd->editv[i].insl - fwd->editv[i].del;
+
+	mb = mbuf_alloc(size);
+	if (!mb)
+		return ENOMEM;
+
+	for (i=0; i<fwd->n; i++) {
+
+		const struct edit *e = &fwd->editv[i];
+
+		err |= mbuf_write_mem(mb, (const uint8_t *)p, e->p - p);
+		if (e->insl)
+			err |= mbuf_write_mem(mb, (const uint8_t *)e->ins,
+					      e->insl);
+
+		p = e->p + e->del;
+	}
+
+	err |= mbuf_write_mem(mb, (const uint8_t *)p, end - p);
+
+	if (err) {
+		mem_deref(mb);
+		return err;
+	}
+
+	mb->pos = 0;
+	*mbp = mb;
+
+	return 0;
+}
+
+
+/* Add an edit that removes the first value of a Via or Route header */
+static const struct sip_hdr *strip_first(struct fwd *fwd,
+					 const struct sip_msg *msg,
+					 enum sip_hdrid id, const char *end)
+{
+	const struct sip_hdr *hdr, *next = NULL;
+	const char *p;
+	struct le *le;
+
+	hdr = sip_msg_hdr(msg, id);
+	if (!hdr)
+		return NULL;
+
+	for (le = hdr->he.next; le; le = le->next) {
+
+		const struct sip_hdr *h = le->data;
+
+		if (h->id == id) {
+			next = h;
+			break;
+		}
+	}
+
+	/* other values on the same line */
+	if (next && next->name.p == hdr->name.p) {
+		edit_add(fwd, hdr->val.p, next->val.p - hdr->val.p, NULL, 0);
+		return next;
+	}
+
+	p = hdr->val.p + hdr->val.l;
+	p = memchr(p, '\n', end - p);
+	p = p ? p + 1 : end;
+
+	edit_add(fwd, hdr->name.p, p - hdr->name.p, NULL, 0);
+
+	return next;
+}
+
+
+/* Stateless branch, same for retransmissions of the request */
+static uint64_t fwd_branch(const struct sip_msg *msg, const char *ruri,
+			   size_t ruril)
+{
+	uint32_t h1, h2;
+
+	if (msg->via.branch.l > 7 &&
+	    !memcmp(msg->via.branch.p, "z9hG4bK", 7)) {
+		h1 = hash_fast_pl(&msg->via.branch);
+	}
+	else {
+		const struct sip_taddr *from = sip_msg_from(msg);
+
+		h1  = hash_fast_pl(&msg->callid);
+		h1 ^= hash_fast_pl(&from->tag);
+		h1 ^= msg->cseq.num;
+	}
+
+	h2  = hash_fast_pl(&msg->via.sentby);
+	h2 ^= hash_fast(ruri, ruril);
+
+	return (uint64_t)h1 << 32 | h2;
+}
+
+
+static int forward_request(struct sip *sip, const struct sip_msg *msg,
+			   enum sip_transp tp, const struct sa *dst,
+			   const char *ruri, bool route_pop, const char *start,
+			   const char *end)
+{
+	const struct sip_hdr *via;
+	struct fwd fwd;
+	char vbuf[256], mfbuf[16];
+	const char *uri = msg->ruri.p;
+	size_t uril = msg->ruri.l;
+	const char *mf;
+	struct sa laddr;
+	struct mbuf *mb;
+	int vlen, mflen;
+	int err;
+
+	if (!dst)
+		return EINVAL;
+
+	via = sip_msg_hdr(msg, SIP_HDR_VIA);
+	if (!via)
+		return EBADMSG;
+
+	if (pl_isset(&msg->maxfwd) && pl_u32(&msg->maxfwd) == 0)
+		return ELOOP;
+
+	err = sip_transp_laddr(sip, &laddr, tp, dst);
+	if (err)
+		return err;
+
+	memset(&fwd, 0, sizeof(fwd));
+
+	if (ruri) {
+		uri  = ruri;
+		uril = strlen(ruri);
+		edit_add(&fwd, msg->ruri.p, msg->ruri.l, uri, uril);
+	}
+
+	mf = pl_isset(&msg->maxfwd) ? "" : "Max-Forwards: 70\r\n";
+
+	vlen = re_snprintf(vbuf, sizeof(vbuf), "%sVia: SIP/2.0/%s %J"
+			   ";branch=z9hG4bK%016llx;rport\r\n", mf,
+			   sip_transp_name(tp), &laddr,
+			   fwd_branch(msg, uri, uril));
+	if (vlen < 0 || vlen >= (int)sizeof(vbuf))
+		return ENOMEM;
+
+	edit_add(&fwd, via->name.p, 0, vbuf, vlen);
+
+	if (pl_isset(&msg->maxfwd)) {
+		mflen = re_snprintf(mfbuf, sizeof(mfbuf), "%u",
+				    pl_u32(&msg->maxfwd) - 1);
+		edit_add(&fwd, msg->maxfwd.p, msg->maxfwd.l, mfbuf, mflen);
+	}
+
+	if (route_pop)
+		(void)strip_first(&fwd, msg, SIP_HDR_ROUTE, end);
+
+	err = fwd_encode(&mb, &fwd, start, end);
+	if (err)
+		return err;
+
+	err = sip_send(sip, NULL, tp, dst, mb);
+	mem_deref(mb);
+
+	return err;
+}
+
+
+static int forward_response(struct sip *sip, const struct sip_msg *msg,
+			    const char *start, const char *end)
+{
+	const struct sip_hdr *next;
+	struct sip_via via;
+	struct fwd fwd;
+	struct mbuf *mb;
+	struct sa dst;
+	struct pl pl;
+	int err;
+
+	memset(&fwd, 0, sizeof(fwd));
+
+	next = strip_first(&fwd, msg, SIP_HDR_VIA, end);
+	if (!next)
+		return ENOENT;
+
+	err = sip_via_decode(&via, &next->val);
+	if (err)
+		return err;
+
+	dst = via.addr;
+
+	if (!msg_param_decode(&via.params, "received", &pl))
+		(void)sa_set(&dst, &pl, sa_port(&via.addr));
+
+	if (!msg_param_decode(&via.params, "rport", &pl) && pl_u32(&pl))
+		sa_set_port(&dst, pl_u32(&pl));
+	else
+		sa_set_port(&dst, sip_transp_port(via.tp, sa_port(&dst)));
+
+	if (!sa_isset(&dst, SA_ADDR))
+		return EADDRNOTAVAIL;
+
+	err = fwd_encode(&mb, &fwd, start, end);
+	if (err)
+		return err;
+
+	err = sip_send(sip, NULL, via.tp, &dst, mb);
+	mem_deref(mb);
+
+	return err;
+}
+
+
+/**
+ * Forward a SIP message without a transaction. A request gets a new top
+ * Via header with a stateless branch, and its Max-Forwards is decremented.
+ * The top Via header of a response is removed, and the response is sent
+ * to the address in the next Via header.
+ *
+ * The received buffer is not changed. A request with Max-Forwards zero is
+ * not forwarded, and ELOOP is returned so the caller can reply with 483.
+ *
+ * @param sip       SIP stack instance
+ * @param msg       Received SIP message
+ * @param tp        SIP transport to the next hop, for requests
+ * @param dst       Address of the next hop, for requests
+ * @param ruri      New Request-URI, or NULL to keep it
+ * @param route_pop True to remove the first Route value from a request
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sip_forward_stateless(struct sip *sip, const struct sip_msg *msg,
+			  enum sip_transp tp, const struct sa *dst,
+			  const char *ruri, bool route_pop)
+{
+	const char *start, *end;
+
+	if (!sip || !msg || !msg->mb)
+		return EINVAL;
+
+	start = msg->req ? msg->met.p : msg->ver.p;
+	end   = (const char *)msg->mb->buf + msg->mb->end;
+
+	if (msg->req)
+		return forward_request(sip, msg, tp, dst, ruri, route_pop,
+				       start, end);
+	else
+		return forward_response(sip, msg, start, end);
+}
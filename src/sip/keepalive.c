@@ -12,6 +12,7 @@
 #include <re_sa.h>
 #include <re_list.h>
 #include <re_sys.h>
+#include <re_tmr.h>
 #include <re_uri.h>
 #include <re_udp.h>
 #include <re_msg.h>
@@ -19,6 +20,32 @@
 #include "sip.h"
 
 
+/*
+ * The keepalive flows of a SIP stack with the same interval share one
+ * bucket. The interval of a bucket is divided into slots, and a flow is
+ * added to a random slot. One timer visits the slots in turn, and the
+ * probes of all flows in a slot are sent with the UDP transports corked,
+ * so the datagrams go out together with one system call.
+ */
+
+
+enum {
+	KA_SLOTS = 32,
+};
+
+
+/** Defines the keepalive flows with the same interval */
+struct sip_kabkt {
+	struct le le;
+	struct list slotv[KA_SLOTS];
+	struct list runl;            /**< Flows of the slot being visited  */
+	struct tmr tmr;
+	struct sip *sip;             /**< NULL when the stack is closed    */
+	uint32_t interval;           /**< Interval in seconds              */
+	unsigned slot;               /**< Slot visited next                */
+};
+
+
 static void destructor(void *arg)
 {
 	struct sip_keepalive *ka = arg;
@@ -52,7 +79,172 @@ void sip_keepalive_signal(struct list *kal, int err)
 
 uint64_t sip_keepalive_wait(uint32_t interval)
 {
-	return interval * (800 + rand_u16() % 201);
+	return interval * (800 + rand_fast_u16() % 201);
+}
+
+
+static uint64_t bkt_period(const struct sip_kabkt *bkt)
+{
+	return MAX(bkt->interval * 1000 / KA_SLOTS, 1);
+}
+
+
+static void bkt_destructor(void *arg)
+{
+	struct sip_kabkt *bkt = arg;
+
+	tmr_cancel(&bkt->tmr);
+	list_unlink(&bkt->le);
+}
+
+
+static void bkt_tmr_handler(void *arg)
+{
+	struct sip_kabkt *bkt = arg;
+	struct list *slot = &bkt->slotv[bkt->slot];
+	struct le *le;
+
+	bkt->slot = (bkt->slot + 1) % KA_SLOTS;
+
+	/* The flows may be stopped by the send handlers */
+	mem_ref(bkt);
+
+	if (bkt->sip)
+		sip_transp_cork(bkt->sip, true);
+
+	while ((le = list_head(slot))) {
+
+		struct sip_kaflow *kf = le->data;
+
+		list_unlink(le);
+		list_append(&bkt->runl, le, kf);
+
+		kf->sendh(kf->arg);
+	}
+
+	while ((le = list_head(&bkt->runl))) {
+		list_unlink(le);
+		list_append(slot, le, le->data);
+	}
+
+	if (bkt->sip)
+		sip_transp_cork(bkt->sip, false);
+
+	tmr_start(&bkt->tmr, bkt_period(bkt), bkt_tmr_handler, bkt);
+
+	mem_deref(bkt);
+}
+
+
+static struct sip_kabkt *bkt_find(struct sip *sip, uint32_t interval)
+{
+	struct le *le;
+
+	for (le = sip->kabktl.head; le; le = le->next) {
+
+		struct sip_kabkt *bkt = le->data;
+
+		if (bkt->interval == interval)
+			return bkt;
+	}
+
+	return NULL;
+}
+
+
+/**
+ * Start sending the probes of a keepalive flow every interval. The first
+ * probe is sent after 80 to 100 percent of the interval.
+ *
+ * @param kf       Keepalive flow
+ * @param sip      SIP stack instance
+ * @param interval Interval in seconds
+ * @param sendh    Handler that sends a probe
+ * @param arg      Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sip_kaflow_start(struct sip_kaflow *kf, struct sip *sip,
+		     uint32_t interval, sip_kaflow_h *sendh, void *arg)
+{
+	struct sip_kabkt *bkt;
+	unsigned slot;
+
+	if (!kf || !sip || !interval || !sendh)
+		return EINVAL;
+
+	if (kf->bkt)
+		return EALREADY;
+
+	bkt = bkt_find(sip, interval);
+	if (bkt) {
+		mem_ref(bkt);
+	}
+	else {
+		unsigned i;
+
+		bkt = mem_zalloc(sizeof(*bkt), bkt_destructor);
+		if (!bkt)
+			return ENOMEM;
+
+		for (i=0; i<KA_SLOTS; i++)
+			list_init(&bkt->slotv[i]);
+
+		bkt->sip      = sip;
+		bkt->interval = interval;
+
+		list_append(&sip->kabktl, &bkt->le, bkt);
+	}
+
+	/* One of the slots in the last fifth before the next one */
+	slot = bkt->slot + KA_SLOTS - 1 - rand_fast_u16() % (KA_SLOTS / 5);
+
+	kf->bkt   = bkt;
+	kf->sendh = sendh;
+	kf->arg   = arg;
+
+	list_append(&bkt->slotv[slot % KA_SLOTS], &kf->le, kf);
+
+	if (!tmr_isrunning(&bkt->tmr))
+		tmr_start(&bkt->tmr, bkt_period(bkt), bkt_tmr_handler, bkt);
+
+	return 0;
+}
+
+
+/**
+ * Stop a keepalive flow
+ *
+ * @param kf Keepalive flow
+ */
+void sip_kaflow_stop(struct sip_kaflow *kf)
+{
+	struct sip_kabkt *bkt;
+
+	if (!kf || !kf->bkt)
+		return;
+
+	bkt = kf->bkt;
+	kf->bkt = NULL;
+
+	/* The flows hold the references to their bucket */
+	list_unlink(&kf->le);
+	mem_deref(bkt);
+}
+
+
+/* The buckets outlive the stack while their flows are not stopped */
+void sip_kaflow_close(struct sip *sip)
+{
+	struct le *le;
+
+	while ((le = list_head(&sip->kabktl))) {
+
+		struct sip_kabkt *bkt = le->data;
+
+		list_unlink(le);
+		bkt->sip = NULL;
+	}
 }
 
 
@@ -28,14 +28,16 @@ enum {
 
 
 struct sip_udpconn {
-	struct le he;
+	struct le le;
 	struct list kal;
 	struct tmr tmr_ka;
+	struct sip_kaflow kaf;
 	struct sa maddr;
 	struct sa paddr;
 	struct udp_sock *us;
 	struct stun_ctrans *ct;
 	struct stun *stun;
+	struct sip *sip;
 	uint32_t ka_interval;
 };
 
@@ -43,13 +45,26 @@ struct sip_udpconn {
 static void udpconn_keepalive_handler(void *arg);
 
 
+static void udpconn_unlink(struct sip_udpconn *uc)
+{
+	list_unlink(&uc->le);
+
+	if (uc->sip) {
+		hmap_remove(uc->sip->map_udpconn, sa_hash(&uc->paddr, SA_ALL),
+			    uc);
+		uc->sip = NULL;
+	}
+}
+
+
 static void destructor(void *arg)
 {
 	struct sip_udpconn *uc = arg;
 
 	list_flush(&uc->kal);
-	hash_unlink(&uc->he);
+	udpconn_unlink(uc);
 	tmr_cancel(&uc->tmr_ka);
+	sip_kaflow_stop(&uc->kaf);
 	mem_deref(uc->ct);
 	mem_deref(uc->us);
 	mem_deref(uc->stun);
@@ -59,8 +74,9 @@ static void destructor(void *arg)
 static void udpconn_close(struct sip_udpconn *uc, int err)
 {
 	sip_keepalive_signal(&uc->kal, err);
-	hash_unlink(&uc->he);
+	udpconn_unlink(uc);
 	tmr_cancel(&uc->tmr_ka);
+	sip_kaflow_stop(&uc->kaf);
 	uc->ct = mem_deref(uc->ct);
 	uc->us = mem_deref(uc->us);
 	uc->stun = mem_deref(uc->stun);
@@ -96,15 +112,17 @@ static void stun_response_handler(int err, uint16_t scode, const char *reason,
 		goto out;
 	}
 
+	/* The next probes are sent with the other flows of the bucket */
+	if (!uc->kaf.bkt && uc->sip) {
+		err = sip_kaflow_start(&uc->kaf, uc->sip, uc->ka_interval,
+				       udpconn_keepalive_handler, uc);
+	}
+
  out:
 	if (err) {
 		udpconn_close(uc, err);
 		mem_deref(uc);
 	}
-	else {
-		tmr_start(&uc->tmr_ka, sip_keepalive_wait(uc->ka_interval),
-			  udpconn_keepalive_handler, uc);
-	}
 }
 
 
@@ -120,6 +138,10 @@ static void udpconn_keepalive_handler(void *arg)
 		return;
 	}
 
+	/* The previous probe is still being retransmitted */
+	if (uc->ct)
+		return;
+
 	err = stun_request(&uc->ct, uc->stun, IPPROTO_UDP, uc->us,
 			   &uc->paddr, 0, STUN_METHOD_BINDING, NULL, 0,
 			   false, stun_response_handler, uc, 1,
@@ -131,27 +153,31 @@ static void udpconn_keepalive_handler(void *arg)
 }
 
 
-static struct sip_udpconn *udpconn_find(struct sip *sip, struct udp_sock *us,
-					const struct sa *paddr)
-{
-	struct le *le;
+struct udpconn_key {
+	const struct udp_sock *us;
+	const struct sa *paddr;
+};
 
-	le = list_head(hash_list(sip->ht_udpconn, sa_hash(paddr, SA_ALL)));
 
-	for (; le; le = le->next) {
+static bool udpconn_cmp(const void *val, void *arg)
+{
+	const struct sip_udpconn *uc = val;
+	const struct udpconn_key *key = arg;
 
-		struct sip_udpconn *uc = le->data;
+	return uc->us == key->us && sa_cmp(&uc->paddr, key->paddr, SA_ALL);
+}
 
-		if (!sa_cmp(&uc->paddr, paddr, SA_ALL))
-			continue;
 
-		if (uc->us != us)
-			continue;
+static struct sip_udpconn *udpconn_find(struct sip *sip, struct udp_sock *us,
+					const struct sa *paddr)
+{
+	struct udpconn_key key;
 
-		return uc;
-	}
+	key.us    = us;
+	key.paddr = paddr;
 
-	return NULL;
+	return hmap_lookup(sip->map_udpconn, sa_hash(paddr, SA_ALL),
+			   udpconn_cmp, &key);
 }
 
 
@@ -160,6 +186,7 @@ int  sip_keepalive_udp(struct sip_keepalive *ka, struct sip *sip,
 		       uint32_t interval)
 {
 	struct sip_udpconn *uc;
+	int err;
 
 	if (!ka || !sip || !us || !paddr)
 		return EINVAL;
@@ -170,10 +197,18 @@ int  sip_keepalive_udp(struct sip_keepalive *ka, struct sip *sip,
 		if (!uc)
 			return ENOMEM;
 
-		hash_append(sip->ht_udpconn, sa_hash(paddr, SA_ALL),
-			    &uc->he, uc);
-
 		uc->paddr = *paddr;
+
+		err = hmap_insert(sip->map_udpconn, sa_hash(paddr, SA_ALL),
+				  uc);
+		if (err) {
+			mem_deref(uc);
+			return err;
+		}
+
+		list_append(&sip->udpconnl, &uc->le, uc);
+
+		uc->sip   = sip;
 		uc->stun  = mem_ref(sip->stun);
 		uc->us    = mem_ref(us);
 		uc->ka_interval = interval ? interval : UDP_KEEPALIVE_INTVAL;
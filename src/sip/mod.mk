@@ -6,13 +6,16 @@
 
 SRCS	+= sip/addr.c
 SRCS	+= sip/auth.c
+SRCS	+= sip/compact.c
 SRCS	+= sip/contact.c
 SRCS	+= sip/cseq.c
 SRCS	+= sip/ctrans.c
 SRCS	+= sip/dialog.c
+SRCS	+= sip/fwd.c
 SRCS	+= sip/keepalive.c
 SRCS	+= sip/keepalive_udp.c
 SRCS	+= sip/msg.c
+SRCS	+= sip/overload.c
 SRCS	+= sip/reply.c
 SRCS	+= sip/request.c
 SRCS	+= sip/sip.c
@@ -4,6 +4,12 @@
  * Copyright (C) 2010 Creytiv.com
  */
 #include <ctype.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 #include <re_types.h>
 #include <re_mem.h>
 #include <re_sys.h>
@@ -20,29 +26,304 @@
 
 
 enum {
-	HDR_HASH_SIZE = 32,
+	HDR_KNOWN     = 104,
+	HDR_BLOCK     = 32,
 	STARTLINE_MAX = 8192,
 };
 
 
-static void hdr_destructor(void *arg)
+/*
+ * The headers of a message are stored in blocks that belong to the
+ * message, and are kept in one list per known header ID. Index zero holds
+ * the headers with unknown IDs.
+ */
+
+
+/** Block of SIP Headers */
+struct hdr_block {
+	struct hdr_block *next;         /**< Next block                     */
+	uint32_t n;                     /**< Number of headers in use       */
+	struct sip_hdr hdrv[HDR_BLOCK]; /**< SIP Headers                    */
+};
+
+/** SIP Message with header storage */
+struct msg {
+	struct sip_msg msg;             /**< SIP Message, must be first     */
+	struct list hdrv[HDR_KNOWN];    /**< SIP Headers by index           */
+	struct hdr_block blk;           /**< First block of headers         */
+	struct hdr_block *blkl;         /**< Other blocks, newest first     */
+	bool lazy;                      /**< Decode some headers on access  */
+	bool to_dec;                    /**< To header was decoded          */
+	bool from_dec;                  /**< From header was decoded        */
+	bool ctyp_dec;                  /**< Content-Type was decoded       */
+};
+
+
+/** Index of the known SIP Header IDs in the header table */
+static const uint8_t hdr_index[0x1000] = {
+	[SIP_HDR_ACCEPT]                       =   1,
+	[SIP_HDR_ACCEPT_CONTACT]               =   2,
+	[SIP_HDR_ACCEPT_ENCODING]              =   3,
+	[SIP_HDR_ACCEPT_LANGUAGE]              =   4,
+	[SIP_HDR_ACCEPT_RESOURCE_PRIORITY]     =   5,
+	[SIP_HDR_ALERT_INFO]                   =   6,
+	[SIP_HDR_ALLOW]                        =   7,
+	[SIP_HDR_ALLOW_EVENTS]                 =   8,
+	[SIP_HDR_ANSWER_MODE]                  =   9,
+	[SIP_HDR_AUTHENTICATION_INFO]          =  10,
+	[SIP_HDR_AUTHORIZATION]                =  11,
+	[SIP_HDR_CALL_ID]                      =  12,
+	[SIP_HDR_CALL_INFO]                    =  13,
+	[SIP_HDR_CONTACT]                      =  14,
+	[SIP_HDR_CONTENT_DISPOSITION]          =  15,
+	[SIP_HDR_CONTENT_ENCODING]             =  16,
+	[SIP_HDR_CONTENT_LANGUAGE]             =  17,
+	[SIP_HDR_CONTENT_LENGTH]               =  18,
+	[SIP_HDR_CONTENT_TYPE]                 =  19,
+	[SIP_HDR_CSEQ]                         =  20,
+	[SIP_HDR_DATE]                         =  21,
+	[SIP_HDR_ENCRYPTION]                   =  22,
+	[SIP_HDR_ERROR_INFO]                   =  23,
+	[SIP_HDR_EVENT]                        =  24,
+	[SIP_HDR_EXPIRES]                      =  25,
+	[SIP_HDR_FLOW_TIMER]                   =  26,
+	[SIP_HDR_FROM]                         =  27,
+	[SIP_HDR_HIDE]                         =  28,
+	[SIP_HDR_HISTORY_INFO]                 =  29,
+	[SIP_HDR_IDENTITY]                     =  30,
+	[SIP_HDR_IDENTITY_INFO]                =  31,
+	[SIP_HDR_IN_REPLY_TO]                  =  32,
+	[SIP_HDR_JOIN]                         =  33,
+	[SIP_HDR_MAX_BREADTH]                  =  34,
+	[SIP_HDR_MAX_FORWARDS]                 =  35,
+	[SIP_HDR_MIME_VERSION]                 =  36,
+	[SIP_HDR_MIN_EXPIRES]                  =  37,
+	[SIP_HDR_MIN_SE]                       =  38,
+	[SIP_HDR_ORGANIZATION]                 =  39,
+	[SIP_HDR_P_ACCESS_NETWORK_INFO]        =  40,
+	[SIP_HDR_P_ANSWER_STATE]               =  41,
+	[SIP_HDR_P_ASSERTED_IDENTITY]          =  42,
+	[SIP_HDR_P_ASSOCIATED_URI]             =  43,
+	[SIP_HDR_P_CALLED_PARTY_ID]            =  44,
+	[SIP_HDR_P_CHARGING_FUNCTION_ADDRESSES]=  45,
+	[SIP_HDR_P_CHARGING_VECTOR]            =  46,
+	[SIP_HDR_P_DCS_TRACE_PARTY_ID]         =  47,
+	[SIP_HDR_P_DCS_OSPS]                   =  48,
+	[SIP_HDR_P_DCS_BILLING_INFO]           =  49,
+	[SIP_HDR_P_DCS_LAES]                   =  50,
+	[SIP_HDR_P_DCS_REDIRECT]               =  51,
+	[SIP_HDR_P_EARLY_MEDIA]                =  52,
+	[SIP_HDR_P_MEDIA_AUTHORIZATION]        =  53,
+	[SIP_HDR_P_PREFERRED_IDENTITY]         =  54,
+	[SIP_HDR_P_PROFILE_KEY]                =  55,
+	[SIP_HDR_P_REFUSED_URI_LIST]           =  56,
+	[SIP_HDR_P_SERVED_USER]                =  57,
+	[SIP_HDR_P_USER_DATABASE]              =  58,
+	[SIP_HDR_P_VISITED_NETWORK_ID]         =  59,
+	[SIP_HDR_PATH]                         =  60,
+	[SIP_HDR_PERMISSION_MISSING]           =  61,
+	[SIP_HDR_PRIORITY]                     =  62,
+	[SIP_HDR_PRIV_ANSWER_MODE]             =  63,
+	[SIP_HDR_PRIVACY]                      =  64,
+	[SIP_HDR_PROXY_AUTHENTICATE]           =  65,
+	[SIP_HDR_PROXY_AUTHORIZATION]          =  66,
+	[SIP_HDR_PROXY_REQUIRE]                =  67,
+	[SIP_HDR_RACK]                         =  68,
+	[SIP_HDR_REASON]                       =  69,
+	[SIP_HDR_RECORD_ROUTE]                 =  70,
+	[SIP_HDR_REFER_SUB]                    =  71,
+	[SIP_HDR_REFER_TO]                     =  72,
+	[SIP_HDR_REFERRED_BY]                  =  73,
+	[SIP_HDR_REJECT_CONTACT]               =  74,
+	[SIP_HDR_REPLACES]                     =  75,
+	[SIP_HDR_REPLY_TO]                     =  76,
+	[SIP_HDR_REQUEST_DISPOSITION]          =  77,
+	[SIP_HDR_REQUIRE]                      =  78,
+	[SIP_HDR_RESOURCE_PRIORITY]            =  79,
+	[SIP_HDR_RESPONSE_KEY]                 =  80,
+	[SIP_HDR_RETRY_AFTER]                  =  81,
+	[SIP_HDR_ROUTE]                        =  82,
+	[SIP_HDR_RSEQ]                         =  83,
+	[SIP_HDR_SECURITY_CLIENT]              =  84,
+	[SIP_HDR_SECURITY_SERVER]              =  85,
+	[SIP_HDR_SECURITY_VERIFY]              =  86,
+	[SIP_HDR_SERVER]                       =  87,
+	[SIP_HDR_SERVICE_ROUTE]                =  88,
+	[SIP_HDR_SESSION_EXPIRES]              =  89,
+	[SIP_HDR_SIP_ETAG]                     =  90,
+	[SIP_HDR_SIP_IF_MATCH]                 =  91,
+	[SIP_HDR_SUBJECT]                      =  92,
+	[SIP_HDR_SUBSCRIPTION_STATE]           =  93,
+	[SIP_HDR_SUPPORTED]                    =  94,
+	[SIP_HDR_TARGET_DIALOG]                =  95,
+	[SIP_HDR_TIMESTAMP]                    =  96,
+	[SIP_HDR_TO]                           =  97,
+	[SIP_HDR_TRIGGER_CONSENT]              =  98,
+	[SIP_HDR_UNSUPPORTED]                  =  99,
+	[SIP_HDR_USER_AGENT]                   = 100,
+	[SIP_HDR_VIA]                          = 101,
+	[SIP_HDR_WARNING]                      = 102,
+	[SIP_HDR_WWW_AUTHENTICATE]             = 103,
+};
+
+
+/** Is c a byte that the header decoder must look at? */
+static inline bool hdr_special(char c)
+{
+	return (uint8_t)c <= ' ' || c == ':' || c == ',' || c == '"';
+}
+
+
+/*
+ * Get the length of the run of bytes that are not special to the header
+ * decoder, i.e. the bytes of header names and values that can be skipped.
+ */
+static inline size_t hdr_run(const char *p, size_t l)
 {
-	struct sip_hdr *hdr = arg;
+	size_t n = 0;
+
+#if defined(__SSE2__)
+	const __m128i sp = _mm_set1_epi8(' ');
+	const __m128i co = _mm_set1_epi8(':');
+	const __m128i cm = _mm_set1_epi8(',');
+	const __m128i qu = _mm_set1_epi8('"');
+
+	for (; n + 16 <= l; n += 16) {
+
+		const __m128i x = _mm_loadu_si128((const __m128i *)(p + n));
+		__m128i m;
+		int mask;
+
+		m = _mm_cmpeq_epi8(_mm_min_epu8(x, sp), x);
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(x, co));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(x, cm));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(x, qu));
 
-	list_unlink(&hdr->le);
-	hash_unlink(&hdr->he);
+		mask = _mm_movemask_epi8(m);
+		if (mask)
+			return n + __builtin_ctz((unsigned)mask);
+	}
+#elif defined(__ARM_NEON)
+	const uint8x16_t sp = vdupq_n_u8(' ');
+	const uint8x16_t co = vdupq_n_u8(':');
+	const uint8x16_t cm = vdupq_n_u8(',');
+	const uint8x16_t qu = vdupq_n_u8('"');
+
+	for (; n + 16 <= l; n += 16) {
+
+		const uint8x16_t x = vld1q_u8((const uint8_t *)(p + n));
+		uint8x16_t m;
+		uint64_t mask;
+
+		m = vcleq_u8(x, sp);
+		m = vorrq_u8(m, vceqq_u8(x, co));
+		m = vorrq_u8(m, vceqq_u8(x, cm));
+		m = vorrq_u8(m, vceqq_u8(x, qu));
+
+		/* one nibble per byte */
+		mask = vget_lane_u64(vreinterpret_u64_u8(
+			     vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+		if (mask)
+			return n + __builtin_ctzll(mask) / 4;
+	}
+#endif
+
+	for (; n < l; n++) {
+		if (hdr_special(p[n]))
+			break;
+	}
+
+	return n;
+}
+
+
+/*
+ * Decode the start-line, which must be at the start of the buffer:
+ *
+ *   "[^ \t\r\n]+ [^ \t\r\n]+ [^\r\n]*[\r]*[\n]1"
+ */
+static int startline_decode(struct pl *x, struct pl *y, struct pl *z,
+			    const char **eolp, const char *p, size_t l)
+{
+	const char *lf, *q, *cr;
+
+	lf = memchr(p, '\n', l);
+	if (!lf)
+		return ENODATA;
+
+	x->p = q = p;
+	while (q < lf && *q != ' ' && *q != '\t' && *q != '\r')
+		++q;
+	x->l = q - x->p;
+	if (!x->l || q == lf || *q != ' ')
+		return EBADMSG;
+
+	y->p = ++q;
+	while (q < lf && *q != ' ' && *q != '\t' && *q != '\r')
+		++q;
+	y->l = q - y->p;
+	if (!y->l || q == lf || *q != ' ')
+		return EBADMSG;
+
+	z->p = ++q;
+	cr = memchr(q, '\r', lf - q);
+	z->l = (cr ? cr : lf) - z->p;
+
+	for (q = z->p + z->l; q < lf; q++) {
+		if (*q != '\r')
+			return EBADMSG;
+	}
+
+	*eolp = lf + 1;
+
+	return 0;
 }
 
 
 static void destructor(void *arg)
 {
-	struct sip_msg *msg = arg;
+	struct msg *m = arg;
+
+	while (m->blkl) {
+		struct hdr_block *blk = m->blkl;
+
+		m->blkl = blk->next;
+		mem_deref(blk);
+	}
 
-	list_flush(&msg->hdrl);
-	hash_flush(msg->hdrht);
-	mem_deref(msg->hdrht);
-	mem_deref(msg->sock);
-	mem_deref(msg->mb);
+	mem_deref(m->msg.sock);
+	mem_deref(m->msg.mb);
+}
+
+
+static inline struct list *hdr_list(const struct sip_msg *msg,
+				    enum sip_hdrid id)
+{
+	struct msg *m = (struct msg *)msg;
+
+	if ((unsigned)id >= ARRAY_SIZE(hdr_index))
+		return &m->hdrv[0];
+
+	return &m->hdrv[hdr_index[id]];
+}
+
+
+static struct sip_hdr *hdr_alloc(struct sip_msg *msg)
+{
+	struct msg *m = (struct msg *)msg;
+	struct hdr_block *blk = m->blkl ? m->blkl : &m->blk;
+
+	if (blk->n >= HDR_BLOCK) {
+
+		blk = mem_zalloc(sizeof(*blk), NULL);
+		if (!blk)
+			return NULL;
+
+		blk->next = m->blkl;
+		m->blkl = blk;
+	}
+
+	return &blk->hdrv[blk->n++];
 }
 
 
@@ -149,6 +430,21 @@ static inline bool hdr_comma_separated(enum sip_hdrid id)
 }
 
 
+static int taddr_decode(struct sip_taddr *taddr, const struct pl *pl)
+{
+	int err;
+
+	err = sip_addr_decode((struct sip_addr *)taddr, pl);
+	if (err)
+		return err;
+
+	(void)msg_param_decode(&taddr->params, "tag", &taddr->tag);
+	taddr->val = *pl;
+
+	return 0;
+}
+
+
 static inline int hdr_add(struct sip_msg *msg, const struct pl *name,
 			  enum sip_hdrid id, const char *p, ssize_t l,
 			  bool atomic, bool line)
@@ -156,7 +452,7 @@ static inline int hdr_add(struct sip_msg *msg, const struct pl *name,
 	struct sip_hdr *hdr;
 	int err = 0;
 
-	hdr = mem_zalloc(sizeof(*hdr), hdr_destructor);
+	hdr = hdr_alloc(msg);
 	if (!hdr)
 		return ENOMEM;
 
@@ -172,15 +468,15 @@ static inline int hdr_add(struct sip_msg *msg, const struct pl *name,
 		if (!atomic)
 			break;
 
-		hash_append(msg->hdrht, id, &hdr->he, mem_ref(hdr));
-		list_append(&msg->hdrl, &hdr->le, mem_ref(hdr));
+		list_append(hdr_list(msg, id), &hdr->he, hdr);
+		list_append(&msg->hdrl, &hdr->le, hdr);
 		break;
 
 	default:
 		if (atomic)
-			hash_append(msg->hdrht, id, &hdr->he, mem_ref(hdr));
+			list_append(hdr_list(msg, id), &hdr->he, hdr);
 		if (line)
-			list_append(&msg->hdrl, &hdr->le, mem_ref(hdr));
+			list_append(&msg->hdrl, &hdr->le, hdr);
 		break;
 	}
 
@@ -195,23 +491,13 @@ static inline int hdr_add(struct sip_msg *msg, const struct pl *name,
 		break;
 
 	case SIP_HDR_TO:
-		err = sip_addr_decode((struct sip_addr *)&msg->to, &hdr->val);
-		if (err)
-			break;
-
-		(void)msg_param_decode(&msg->to.params, "tag", &msg->to.tag);
-		msg->to.val = hdr->val;
+		if (!((struct msg *)msg)->lazy)
+			err = taddr_decode(&msg->to, &hdr->val);
 		break;
 
 	case SIP_HDR_FROM:
-		err = sip_addr_decode((struct sip_addr *)&msg->from,
-				      &hdr->val);
-		if (err)
-			break;
-
-		(void)msg_param_decode(&msg->from.params, "tag",
-				       &msg->from.tag);
-		msg->from.val = hdr->val;
+		if (!((struct msg *)msg)->lazy)
+			err = taddr_decode(&msg->from, &hdr->val);
 		break;
 
 	case SIP_HDR_CALL_ID:
@@ -227,7 +513,8 @@ static inline int hdr_add(struct sip_msg *msg, const struct pl *name,
 		break;
 
 	case SIP_HDR_CONTENT_TYPE:
-		err = msg_ctype_decode(&msg->ctyp, &hdr->val);
+		if (!((struct msg *)msg)->lazy)
+			err = msg_ctype_decode(&msg->ctyp, &hdr->val);
 		break;
 
 	case SIP_HDR_CONTENT_LENGTH:
@@ -243,29 +530,19 @@ static inline int hdr_add(struct sip_msg *msg, const struct pl *name,
 		break;
 	}
 
-	mem_deref(hdr);
-
 	return err;
 }
 
 
-/**
- * Decode a SIP message
- *
- * @param msgp Pointer to allocated SIP Message
- * @param mb   Buffer containing SIP Message
- *
- * @return 0 if success, otherwise errorcode
- */
-int sip_msg_decode(struct sip_msg **msgp, struct mbuf *mb)
+static int msg_decode(struct sip_msg **msgp, struct mbuf *mb, bool lazy)
 {
-	struct pl x, y, z, e, name;
-	const char *p, *v, *cv;
+	struct pl x, y, z, name;
+	const char *p, *v, *cv, *eol;
 	struct sip_msg *msg;
 	bool comsep, quote;
 	enum sip_hdrid id = SIP_HDR_NONE;
 	uint32_t ws, lf;
-	size_t l;
+	size_t l, n;
 	int err;
 
 	if (!msgp || !mb)
@@ -274,17 +551,14 @@ int sip_msg_decode(struct sip_msg **msgp, struct mbuf *mb)
 	p = (const char *)mbuf_buf(mb);
 	l = mbuf_get_left(mb);
 
-	if (re_regex(p, l, "[^ \t\r\n]+ [^ \t\r\n]+ [^\r\n]*[\r]*[\n]1",
-		     &x, &y, &z, NULL, &e) || x.p != (char *)mbuf_buf(mb))
+	if (startline_decode(&x, &y, &z, &eol, p, l))
 		return (l > STARTLINE_MAX) ? EBADMSG : ENODATA;
 
-	msg = mem_zalloc(sizeof(*msg), destructor);
+	msg = mem_zalloc(sizeof(struct msg), destructor);
 	if (!msg)
 		return ENOMEM;
 
-	err = hash_alloc(&msg->hdrht, HDR_HASH_SIZE);
-	if (err)
-		goto out;
+	((struct msg *)msg)->lazy = lazy;
 
 	msg->tag = rand_u64();
 	msg->mb  = mem_ref(mb);
@@ -312,8 +586,8 @@ int sip_msg_decode(struct sip_msg **msgp, struct mbuf *mb)
 		}
 	}
 
-	l -= e.p + e.l - p;
-	p = e.p + e.l;
+	l -= eol - p;
+	p = eol;
 
 	name.p = v = cv = NULL;
 	name.l = ws = lf = 0;
@@ -392,6 +666,9 @@ int sip_msg_decode(struct sip_msg **msgp, struct mbuf *mb)
 			if (!name.l) {
 				if (*p != ':') {
 					ws = 0;
+					n = hdr_run(p + 1, l - 1);
+					p += n;
+					l -= n;
 					break;
 				}
 
@@ -419,6 +696,9 @@ int sip_msg_decode(struct sip_msg **msgp, struct mbuf *mb)
 				quote = !quote;
 
 			ws = 0;
+			n = hdr_run(p + 1, l - 1);
+			p += n;
+			l -= n;
 			break;
 		}
 	}
@@ -437,6 +717,122 @@ int sip_msg_decode(struct sip_msg **msgp, struct mbuf *mb)
 }
 
 
+/**
+ * Decode a SIP message
+ *
+ * @param msgp Pointer to allocated SIP Message
+ * @param mb   Buffer containing SIP Message
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sip_msg_decode(struct sip_msg **msgp, struct mbuf *mb)
+{
+	return msg_decode(msgp, mb, false);
+}
+
+
+/**
+ * Decode a SIP message in lazy mode. Only the Via, CSeq and Call-ID
+ * headers are decoded up front, the To, From and Content-Type headers are
+ * decoded when they are first accessed with sip_msg_to(), sip_msg_from()
+ * and sip_msg_ctype(). A malformed lazy header does not fail the decode.
+ *
+ * @param msgp Pointer to allocated SIP Message
+ * @param mb   Buffer containing SIP Message
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sip_msg_decode_lazy(struct sip_msg **msgp, struct mbuf *mb)
+{
+	return msg_decode(msgp, mb, true);
+}
+
+
+/**
+ * Get the decoded To header of a SIP Message
+ *
+ * @param msg SIP Message
+ *
+ * @return To header, which is empty if it is missing or malformed
+ */
+const struct sip_taddr *sip_msg_to(const struct sip_msg *msg)
+{
+	struct msg *m = (struct msg *)msg;
+	const struct sip_hdr *hdr;
+
+	if (!msg)
+		return NULL;
+
+	if (m->lazy && !m->to_dec) {
+
+		m->to_dec = true;
+
+		hdr = sip_msg_hdr_apply(msg, false, SIP_HDR_TO, NULL, NULL);
+		if (hdr && taddr_decode(&m->msg.to, &hdr->val))
+			memset(&m->msg.to, 0, sizeof(m->msg.to));
+	}
+
+	return &msg->to;
+}
+
+
+/**
+ * Get the decoded From header of a SIP Message
+ *
+ * @param msg SIP Message
+ *
+ * @return From header, which is empty if it is missing or malformed
+ */
+const struct sip_taddr *sip_msg_from(const struct sip_msg *msg)
+{
+	struct msg *m = (struct msg *)msg;
+	const struct sip_hdr *hdr;
+
+	if (!msg)
+		return NULL;
+
+	if (m->lazy && !m->from_dec) {
+
+		m->from_dec = true;
+
+		hdr = sip_msg_hdr_apply(msg, false, SIP_HDR_FROM, NULL, NULL);
+		if (hdr && taddr_decode(&m->msg.from, &hdr->val))
+			memset(&m->msg.from, 0, sizeof(m->msg.from));
+	}
+
+	return &msg->from;
+}
+
+
+/**
+ * Get the decoded Content-Type header of a SIP Message
+ *
+ * @param msg SIP Message
+ *
+ * @return Content-Type, which is empty if it is missing or malformed
+ */
+const struct msg_ctype *sip_msg_ctype(const struct sip_msg *msg)
+{
+	struct msg *m = (struct msg *)msg;
+	const struct sip_hdr *hdr;
+
+	if (!msg)
+		return NULL;
+
+	if (m->lazy && !m->ctyp_dec) {
+
+		m->ctyp_dec = true;
+
+		hdr = sip_msg_hdr_apply(msg, false, SIP_HDR_CONTENT_TYPE,
+					NULL, NULL);
+		if (hdr && msg_ctype_decode(&m->msg.ctyp, &hdr->val))
+			memset(&m->msg.ctyp, 0, sizeof(m->msg.ctyp));
+	}
+
+	return &msg->ctyp;
+}
+
+
 /**
  * Get a SIP Header from a SIP Message
  *
@@ -472,7 +868,7 @@ const struct sip_hdr *sip_msg_hdr_apply(const struct sip_msg *msg,
 	if (!msg)
 		return NULL;
 
-	lst = hash_list(msg->hdrht, id);
+	lst = hdr_list(msg, id);
 
 	le = fwd ? list_head(lst) : list_tail(lst);
 
@@ -530,7 +926,7 @@ const struct sip_hdr *sip_msg_xhdr_apply(const struct sip_msg *msg,
 
 	pl_set_str(&pl, name);
 
-	lst = hash_list(msg->hdrht, hdr_hash(&pl));
+	lst = hdr_list(msg, hdr_hash(&pl));
 
 	le = fwd ? list_head(lst) : list_tail(lst);
 
@@ -655,9 +1051,9 @@ void sip_msg_dump(const struct sip_msg *msg)
 	if (!msg)
 		return;
 
-	for (i=0; i<HDR_HASH_SIZE; i++) {
+	for (i=0; i<HDR_KNOWN; i++) {
 
-		le = list_head(hash_list(msg->hdrht, i));
+		le = list_head(&((struct msg *)msg)->hdrv[i]);
 
 		while (le) {
 			const struct sip_hdr *hdr = le->data;
@@ -0,0 +1,220 @@
+/**
+ * @file overload.c  SIP Overload Control
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <re_types.h>
+#include <re_mem.h>
+#include <re_mbuf.h>
+#include <re_sa.h>
+#include <re_list.h>
+#include <re_fmt.h>
+#include <re_uri.h>
+#include <re_sys.h>
+#include <re_tmr.h>
+#include <re_udp.h>
+#include <re_msg.h>
+#include <re_sip.h>
+#include "sip.h"
+
+
+/*
+ * The load is measured by how late a periodic timer fires, which is the
+ * time that the main loop spends in other handlers, and by the number of
+ * server transactions. While the loop lags, the share of new dialogs
+ * that are rejected is raised in steps, and lowered again when it has
+ * caught up. This is the "loss" algorithm of RFC 7339, and clients that
+ * support it are told the reduction in the Via header of the responses.
+ */
+
+
+enum {
+	OC_PERIOD   = 100,  /* Lag timer period [ms]           */
+	OC_STEP     = 10,   /* Reduction step per period [%]    */
+	OC_MAX      = 90,   /* Maximum reduction [%]            */
+	OC_VALIDITY = 2000, /* Validity of the reduction [ms]   */
+};
+
+
+/** Defines the overload control state */
+struct sip_oc {
+	struct tmr tmr;
+	uint64_t due;          /**< When the lag timer is due [us]       */
+	uint64_t lag;          /**< Smoothed loop lag [us]               */
+	uint64_t seq;          /**< Changes of the reduction (oc-seq)    */
+	uint64_t rejected;     /**< Number of rejected requests          */
+	uint32_t lag_max;      /**< Maximum loop lag [ms]                */
+	uint32_t strans_max;   /**< Maximum server transactions          */
+	uint32_t retry_after;  /**< Retry-After of the 503 [s]           */
+	uint32_t reduction;    /**< Share of rejected new dialogs [%]    */
+	bool via_oc;           /**< Send RFC 7339 Via parameters         */
+};
+
+
+static void destructor(void *arg)
+{
+	struct sip_oc *oc = arg;
+
+	tmr_cancel(&oc->tmr);
+}
+
+
+static void lag_handler(void *arg)
+{
+	struct sip_oc *oc = arg;
+	uint64_t now = tmr_jiffies_usec();
+	uint64_t lag = now > oc->due ? now - oc->due : 0;
+	uint32_t reduction = oc->reduction;
+
+	oc->lag = (oc->lag * 7 + lag) / 8;
+
+	if (oc->lag_max && oc->lag > oc->lag_max * 1000ULL)
+		reduction = min(reduction + OC_STEP, OC_MAX);
+	else
+		reduction = reduction > OC_STEP ? reduction - OC_STEP : 0;
+
+	if (reduction != oc->reduction) {
+		oc->reduction = reduction;
+		++oc->seq;
+	}
+
+	oc->due = now + OC_PERIOD * 1000;
+	tmr_start(&oc->tmr, OC_PERIOD, lag_handler, oc);
+}
+
+
+/* Requests that create a dialog, and are not within one */
+static bool is_dialog_creating(const struct sip_msg *msg)
+{
+	if (pl_isset(&sip_msg_to(msg)->tag))
+		return false;
+
+	return !pl_strcmp(&msg->met, "INVITE") ||
+		!pl_strcmp(&msg->met, "SUBSCRIBE") ||
+		!pl_strcmp(&msg->met, "REFER");
+}
+
+
+/* Reject a new request with 503 if the stack is overloaded */
+bool sip_oc_reject(struct sip *sip, const struct sip_msg *msg)
+{
+	struct sip_oc *oc = sip->oc;
+	bool reject;
+
+	if (!oc || !is_dialog_creating(msg))
+		return false;
+
+	if (oc->strans_max && sip->stransc >= oc->strans_max)
+		reject = true;
+	else
+		reject = oc->reduction &&
+			rand_fast_u16() % 100 < oc->reduction;
+
+	if (!reject)
+		return false;
+
+	++oc->rejected;
+
+	(void)sip_replyf(sip, msg, 503, "Service Unavailable",
+			 "Retry-After: %u\r\n"
+			 "Content-Length: 0\r\n"
+			 "\r\n",
+			 oc->retry_after);
+
+	return true;
+}
+
+
+bool sip_oc_via(const struct sip *sip)
+{
+	return sip->oc && sip->oc->via_oc;
+}
+
+
+/* The RFC 7339 parameters for the Via header of a response */
+int sip_oc_print(struct re_printf *pf, const struct sip *sip)
+{
+	const struct sip_oc *oc = sip->oc;
+
+	return re_hprintf(pf, ";oc=%u;oc-validity=%u;oc-seq=%llu"
+			  ";oc-algo=\"loss\"",
+			  oc->reduction, oc->reduction ? OC_VALIDITY : 0,
+			  (unsigned long long)oc->seq);
+}
+
+
+/**
+ * Enable overload control for new dialogs of a SIP stack. New INVITE,
+ * SUBSCRIBE and REFER requests outside of a dialog are rejected with
+ * 503 and Retry-After, before a transaction is created, while the main
+ * loop lags or there are too many server transactions. A share of them
+ * is rejected, according to how long the lag has been too high.
+ *
+ * @param sip         SIP stack instance
+ * @param lag_max     Maximum smoothed loop lag in [ms], 0 to disable
+ * @param strans_max  Maximum number of server transactions, 0 to disable
+ * @param retry_after Retry-After value in [s]
+ * @param via_oc      Send the RFC 7339 Via parameters to clients that
+ *                    support them
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sip_overload_set(struct sip *sip, uint32_t lag_max, uint32_t strans_max,
+		     uint32_t retry_after, bool via_oc)
+{
+	struct sip_oc *oc;
+
+	if (!sip)
+		return EINVAL;
+
+	if (!lag_max && !strans_max) {
+		sip->oc = mem_deref(sip->oc);
+		return 0;
+	}
+
+	if (!sip->oc) {
+		sip->oc = mem_zalloc(sizeof(*sip->oc), destructor);
+		if (!sip->oc)
+			return ENOMEM;
+	}
+
+	oc = sip->oc;
+
+	oc->lag_max     = lag_max;
+	oc->strans_max  = strans_max;
+	oc->retry_after = retry_after;
+	oc->via_oc      = via_oc;
+
+	if (!lag_max) {
+		tmr_cancel(&oc->tmr);
+		oc->reduction = 0;
+		oc->lag       = 0;
+	}
+	else if (!tmr_isrunning(&oc->tmr)) {
+		oc->due = tmr_jiffies_usec() + OC_PERIOD * 1000;
+		tmr_start(&oc->tmr, OC_PERIOD, lag_handler, oc);
+	}
+
+	return 0;
+}
+
+
+/**
+ * Get the overload state of a SIP stack
+ *
+ * @param sip      SIP stack instance
+ * @param lag      Smoothed loop lag in [us] (optional)
+ * @param rejected Number of rejected requests (optional)
+ *
+ * @return Share of new dialogs that are rejected in [%]
+ */
+uint32_t sip_overload_get(const struct sip *sip, uint64_t *lag,
+			  uint64_t *rejected)
+{
+	if (lag)
+		*lag = (sip && sip->oc) ? sip->oc->lag : 0;
+	if (rejected)
+		*rejected = (sip && sip->oc) ? sip->oc->rejected : 0;
+
+	return (sip && sip->oc) ? sip->oc->reduction : 0;
+}
@@ -3,6 +3,7 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
+#include <string.h>
 #include <re_types.h>
 #include <re_mem.h>
 #include <re_mbuf.h>
@@ -16,54 +17,123 @@
 #include "sip.h"
 
 
-static int vreplyf(struct sip_strans **stp, struct mbuf **mbp, bool trans,
-		   struct sip *sip, const struct sip_msg *msg, bool rec_route,
-		   uint16_t scode, const char *reason,
-		   const char *fmt, va_list ap)
+/** Defines a pre-encoded SIP reply */
+struct sip_rtmpl {
+	struct mbuf *mb;   /**< Status line, then Server header and rest */
+	size_t hdr_pos;    /**< Start of the Server header and rest      */
+	uint16_t scode;    /**< Response status code                     */
+	bool rec_route;    /**< Copy Record-Route headers                */
+};
+
+
+static int write_tag(struct mbuf *mb, uint64_t tag)
+{
+	static const char hex[] = "0123456789abcdef";
+	char buf[5 + 16];
+	int i;
+
+	memcpy(buf, ";tag=", 5);
+
+	for (i=15; i>=0; i--) {
+		buf[5 + i] = hex[tag & 0xf];
+		tag >>= 4;
+	}
+
+	return mbuf_write_mem(mb, (uint8_t *)buf, sizeof(buf));
+}
+
+
+static int write_hdr(struct mbuf *mb, const struct sip_hdr *hdr)
 {
-	bool rport = false;
-	uint32_t viac = 0;
-	struct mbuf *mb;
-	struct sa dst;
-	struct le *le;
 	int err;
 
-	if (!sip || !msg || !reason)
-		return EINVAL;
+	err  = mbuf_write_pl(mb, &hdr->name);
+	err |= mbuf_write_str(mb, ": ");
+	err |= mbuf_write_pl(mb, &hdr->val);
 
-	if (!pl_strcmp(&msg->met, "ACK"))
-		return 0;
+	return err;
+}
 
-	mb = mbuf_alloc(1024);
-	if (!mb) {
-		err = ENOMEM;
-		goto out;
+
+/* Copy a header value without up to two parameters */
+static int write_skip2(struct mbuf *mb, const struct pl *val,
+		       const struct pl *s1, const struct pl *s2)
+{
+	struct pl head;
+	int err;
+
+	if (!s1) {
+		s1 = s2;
+		s2 = NULL;
 	}
 
-	err = mbuf_printf(mb, "SIP/2.0 %u %s\r\n", scode, reason);
+	if (!s1)
+		return mbuf_write_pl(mb, val);
+
+	if (!s2)
+		return mbuf_write_pl_skip(mb, val, s1);
+
+	if (s2->p < s1->p) {
+		const struct pl *t = s1;
+		s1 = s2;
+		s2 = t;
+	}
+
+	head.p = val->p;
+	head.l = s2->p - val->p;
+
+	err  = mbuf_write_pl_skip(mb, &head, s1);
+	err |= mbuf_write_mem(mb, (const uint8_t *)s2->p + s2->l,
+			      val->p + val->l - (s2->p + s2->l));
+
+	return err;
+}
+
+
+/* Copy the headers of the request that are echoed in the reply */
+static int echo_hdrs(struct mbuf *mb, bool *rportp, const struct sip *sip,
+		     const struct sip_msg *msg, bool rec_route, uint16_t scode)
+{
+	bool rport = false;
+	uint32_t viac = 0;
+	struct le *le;
+	int err = 0;
 
 	for (le = msg->hdrl.head; le; le = le->next) {
 
 		struct sip_hdr *hdr = le->data;
-		struct pl rp;
+		struct pl rp, op;
+		bool oc;
 
 		switch (hdr->id) {
 
 		case SIP_HDR_VIA:
-			err |= mbuf_printf(mb, "%r: ", &hdr->name);
 			if (viac++) {
-				err |= mbuf_printf(mb, "%r\r\n", &hdr->val);
+				err |= write_hdr(mb, hdr);
+				err |= mbuf_write_str(mb, "\r\n");
 				break;
 			}
 
-			if (!msg_param_exists(&msg->via.params, "rport", &rp)){
-				err |= mbuf_write_pl_skip(mb, &hdr->val, &rp);
+			err |= mbuf_write_pl(mb, &hdr->name);
+			err |= mbuf_write_str(mb, ": ");
+
+			rport = !msg_param_exists(&msg->via.params, "rport",
+						  &rp);
+
+			/* The client supports overload control */
+			oc = sip_oc_via(sip) &&
+				!msg_param_exists(&msg->via.params, "oc", &op);
+
+			err |= write_skip2(mb, &hdr->val, rport ? &rp : NULL,
+					   oc ? &op : NULL);
+
+			if (rport)
 				err |= mbuf_printf(mb, ";rport=%u",
 						   sa_port(&msg->src));
-				rport = true;
-			}
-			else
-				err |= mbuf_write_pl(mb, &hdr->val);
+
+			if (oc)
+				err |= mbuf_printf(mb, "%H", sip_oc_print,
+						   sip);
 
 			if (rport || !sa_cmp(&msg->src, &msg->via.addr,
 					     SA_ADDR))
@@ -74,11 +144,9 @@ static int vreplyf(struct sip_strans **stp, struct mbuf **mbp, bool trans,
 			break;
 
 		case SIP_HDR_TO:
-			err |= mbuf_printf(mb, "%r: %r", &hdr->name,
-					   &hdr->val);
-			if (!pl_isset(&msg->to.tag) && scode > 100)
-				err |= mbuf_printf(mb, ";tag=%016llx",
-						   msg->tag);
+			err |= write_hdr(mb, hdr);
+			if (!pl_isset(&sip_msg_to(msg)->tag) && scode > 100)
+				err |= write_tag(mb, msg->tag);
 			err |= mbuf_write_str(mb, "\r\n");
 			break;
 
@@ -91,8 +159,8 @@ static int vreplyf(struct sip_strans **stp, struct mbuf **mbp, bool trans,
 		case SIP_HDR_FROM:
 		case SIP_HDR_CALL_ID:
 		case SIP_HDR_CSEQ:
-			err |= mbuf_printf(mb, "%r: %r\r\n",
-					   &hdr->name, &hdr->val);
+			err |= write_hdr(mb, hdr);
+			err |= mbuf_write_str(mb, "\r\n");
 			break;
 
 		default:
@@ -100,6 +168,56 @@ static int vreplyf(struct sip_strans **stp, struct mbuf **mbp, bool trans,
 		}
 	}
 
+	*rportp = rport;
+
+	return err;
+}
+
+
+static int reply_send(struct sip_strans **stp, bool trans, struct sip *sip,
+		      const struct sip_msg *msg, bool rport, uint16_t scode,
+		      struct mbuf *mb)
+{
+	struct sa dst;
+
+	mb->pos = 0;
+
+	if (sip_compact(sip, msg->tp))
+		sip_msg_compact(mb);
+
+	sip_reply_addr(&dst, msg, rport);
+
+	if (trans)
+		return sip_strans_reply(stp, sip, msg, &dst, scode, mb);
+	else
+		return sip_send(sip, msg->sock, msg->tp, &dst, mb);
+}
+
+
+static int vreplyf(struct sip_strans **stp, struct mbuf **mbp, bool trans,
+		   struct sip *sip, const struct sip_msg *msg, bool rec_route,
+		   uint16_t scode, const char *reason,
+		   const char *fmt, va_list ap)
+{
+	bool rport = false;
+	struct mbuf *mb;
+	int err;
+
+	if (!sip || !msg || !reason)
+		return EINVAL;
+
+	if (!pl_strcmp(&msg->met, "ACK"))
+		return 0;
+
+	mb = mbuf_alloc(1024);
+	if (!mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err  = mbuf_printf(mb, "SIP/2.0 %u %s\r\n", scode, reason);
+	err |= echo_hdrs(mb, &rport, sip, msg, rec_route, scode);
+
 	if (sip->software)
 		err |= mbuf_printf(mb, "Server: %s\r\n", sip->software);
 
@@ -111,16 +229,7 @@ static int vreplyf(struct sip_strans **stp, struct mbuf **mbp, bool trans,
 	if (err)
 		goto out;
 
-	mb->pos = 0;
-
-	sip_reply_addr(&dst, msg, rport);
-
-	if (trans) {
-		err = sip_strans_reply(stp, sip, msg, &dst, scode, mb);
-	}
-	else {
-		err = sip_send(sip, msg->sock, msg->tp, &dst, mb);
-	}
+	err = reply_send(stp, trans, sip, msg, rport, scode, mb);
 
  out:
 	if (err && stp)
@@ -266,3 +375,149 @@ void sip_reply_addr(struct sa *addr, const struct sip_msg *msg, bool rport)
 		break;
 	}
 }
+
+
+static void rtmpl_destructor(void *arg)
+{
+	struct sip_rtmpl *tmpl = arg;
+
+	mem_deref(tmpl->mb);
+}
+
+
+/**
+ * Allocate a pre-encoded SIP reply. The status line, the Server header
+ * and the additional headers and body are encoded once, and only the
+ * headers that are echoed from the request are added for each reply.
+ *
+ * @param tmplp     Pointer to allocated reply template
+ * @param sip       SIP Stack instance
+ * @param rec_route True to copy Record-Route headers
+ * @param scode     Response status code
+ * @param reason    Response reason phrase
+ * @param fmt       Additional formatted SIP headers and body, otherwise NULL
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sip_rtmpl_alloc(struct sip_rtmpl **tmplp, struct sip *sip,
+		    bool rec_route, uint16_t scode, const char *reason,
+		    const char *fmt, ...)
+{
+	struct sip_rtmpl *tmpl;
+	va_list ap;
+	int err;
+
+	if (!tmplp || !sip || !reason)
+		return EINVAL;
+
+	tmpl = mem_zalloc(sizeof(*tmpl), rtmpl_destructor);
+	if (!tmpl)
+		return ENOMEM;
+
+	tmpl->mb = mbuf_alloc(256);
+	if (!tmpl->mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	tmpl->scode     = scode;
+	tmpl->rec_route = rec_route;
+
+	err = mbuf_printf(tmpl->mb, "SIP/2.0 %u %s\r\n", scode, reason);
+
+	tmpl->hdr_pos = tmpl->mb->end;
+
+	if (sip->software)
+		err |= mbuf_printf(tmpl->mb, "Server: %s\r\n", sip->software);
+
+	if (fmt) {
+		va_start(ap, fmt);
+		err |= mbuf_vprintf(tmpl->mb, fmt, ap);
+		va_end(ap);
+	}
+	else
+		err |= mbuf_write_str(tmpl->mb, "Content-Length: 0\r\n\r\n");
+
+ out:
+	if (err)
+		mem_deref(tmpl);
+	else
+		*tmplp = tmpl;
+
+	return err;
+}
+
+
+static int rtmpl_reply(struct sip_strans **stp, bool trans, struct sip *sip,
+		       const struct sip_rtmpl *tmpl, const struct sip_msg *msg)
+{
+	const uint8_t *buf;
+	bool rport = false;
+	struct mbuf *mb;
+	int err;
+
+	if (!sip || !tmpl || !msg)
+		return EINVAL;
+
+	if (!pl_strcmp(&msg->met, "ACK"))
+		return 0;
+
+	/* The echoed headers are never longer than the request */
+	mb = mbuf_alloc(tmpl->mb->end + msg->mb->end + 128);
+	if (!mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	buf = tmpl->mb->buf;
+
+	err  = mbuf_write_mem(mb, buf, tmpl->hdr_pos);
+	err |= echo_hdrs(mb, &rport, sip, msg, tmpl->rec_route, tmpl->scode);
+	err |= mbuf_write_mem(mb, buf + tmpl->hdr_pos,
+			      tmpl->mb->end - tmpl->hdr_pos);
+	if (err)
+		goto out;
+
+	err = reply_send(stp, trans, sip, msg, rport, tmpl->scode, mb);
+
+ out:
+	if (err && stp)
+		*stp = mem_deref(*stp);
+
+	mem_deref(mb);
+
+	return err;
+}
+
+
+/**
+ * Reply with a pre-encoded SIP reply using Server Transaction
+ *
+ * @param stp  Pointer to allocated SIP Server Transaction (optional)
+ * @param sip  SIP Stack instance
+ * @param tmpl Reply template
+ * @param msg  Incoming SIP message
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sip_rtmpl_treply(struct sip_strans **stp, struct sip *sip,
+		     const struct sip_rtmpl *tmpl, const struct sip_msg *msg)
+{
+	return rtmpl_reply(stp, true, sip, tmpl, msg);
+}
+
+
+/**
+ * Stateless reply with a pre-encoded SIP reply
+ *
+ * @param sip  SIP Stack instance
+ * @param tmpl Reply template
+ * @param msg  Incoming SIP message
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sip_rtmpl_reply(struct sip *sip, const struct sip_rtmpl *tmpl,
+		    const struct sip_msg *msg)
+{
+	return rtmpl_reply(NULL, false, sip, tmpl, msg);
+}
@@ -165,6 +165,7 @@ static int request(struct sip_request *req, enum sip_transp tp,
 	char *branch = NULL;
 	int err = ENOMEM;
 	struct sa laddr;
+	const char *via;
 
 	req->provrecv = false;
 
@@ -174,15 +175,19 @@ static int request(struct sip_request *req, enum sip_transp tp,
 	if (!branch || !mb)
 		goto out;
 
-	(void)re_snprintf(branch, 24, "z9hG4bK%016llx", rand_u64());
+	(void)re_snprintf(branch, 24, "z9hG4bK%016llx", rand_fast_u64());
 
-	err = sip_transp_laddr(req->sip, &laddr, tp, dst);
+	err = sip_transp_via(req->sip, &via, &laddr, tp, dst);
 	if (err)
 		goto out;
 
-	err  = mbuf_printf(mb, "%s %s SIP/2.0\r\n", req->met, req->uri);
-	err |= mbuf_printf(mb, "Via: SIP/2.0/%s %J;branch=%s;rport\r\n",
-			   sip_transp_name(tp), &laddr, branch);
+	err  = mbuf_write_str(mb, req->met);
+	err |= mbuf_write_u8(mb, ' ');
+	err |= mbuf_write_str(mb, req->uri);
+	err |= mbuf_write_str(mb, " SIP/2.0\r\n");
+	err |= mbuf_write_str(mb, via);
+	err |= mbuf_write_str(mb, branch);
+	err |= mbuf_write_str(mb, ";rport\r\n");
 	err |= req->sendh ? req->sendh(tp, &laddr, dst, mb, req->arg) : 0;
 	err |= mbuf_write_mem(mb, mbuf_buf(req->mb), mbuf_get_left(req->mb));
 	if (err)
@@ -190,6 +195,9 @@ static int request(struct sip_request *req, enum sip_transp tp,
 
 	mb->pos = 0;
 
+	if (sip_compact(req->sip, tp))
+		sip_msg_compact(mb);
+
 	if (!req->stateful)
 		err = sip_send(req->sip, NULL, tp, dst, mb);
 	else
@@ -779,6 +787,52 @@ int sip_requestf(struct sip_request **reqp, struct sip *sip, bool stateful,
 }
 
 
+static int vdrequestf(struct sip_request **reqp, struct sip *sip,
+		      bool stateful, const char *met, struct sip_dialog *dlg,
+		      uint32_t cseq, struct sip_auth *auth,
+		      const struct uri *route, sip_send_h *sendh,
+		      sip_resp_h *resph, void *arg, const char *fmt,
+		      va_list ap)
+{
+	struct mbuf *mb;
+	int err;
+
+	mb = mbuf_alloc(2048);
+	if (!mb)
+		return ENOMEM;
+
+	err = mbuf_write_str(mb, "Max-Forwards: 70\r\n");
+
+	if (auth)
+		err |= sip_auth_encode(mb, auth, met, sip_dialog_uri(dlg));
+
+	err |= sip_dialog_encode(mb, dlg, cseq, met);
+
+	if (sip->uahdr)
+		err |= mbuf_write_str(mb, sip->uahdr);
+
+	if (err)
+		goto out;
+
+	err = mbuf_vprintf(mb, fmt, ap);
+	if (err)
+		goto out;
+
+	mb->pos = 0;
+
+	err = sip_request(reqp, sip, stateful, met, -1, sip_dialog_uri(dlg),
+			  -1, route ? route : sip_dialog_route(dlg), mb,
+			  sip_dialog_hash(dlg), sendh, resph, arg);
+	if (err)
+		goto out;
+
+ out:
+	mem_deref(mb);
+
+	return err;
+}
+
+
 /**
  * Send a SIP dialog request with formatted arguments
  *
@@ -801,48 +855,59 @@ int sip_drequestf(struct sip_request **reqp, struct sip *sip, bool stateful,
 		  struct sip_auth *auth, sip_send_h *sendh, sip_resp_h *resph,
 		  void *arg, const char *fmt, ...)
 {
-	struct mbuf *mb;
 	va_list ap;
 	int err;
 
 	if (!sip || !met || !dlg || !fmt)
 		return EINVAL;
 
-	mb = mbuf_alloc(2048);
-	if (!mb)
-		return ENOMEM;
-
-	err = mbuf_write_str(mb, "Max-Forwards: 70\r\n");
+	va_start(ap, fmt);
+	err = vdrequestf(reqp, sip, stateful, met, dlg, cseq, auth, NULL,
+			 sendh, resph, arg, fmt, ap);
+	va_end(ap);
 
-	if (auth)
-		err |= sip_auth_encode(mb, auth, met, sip_dialog_uri(dlg));
+	return err;
+}
 
-	err |= sip_dialog_encode(mb, dlg, cseq, met);
 
-	if (sip->software)
-		err |= mbuf_printf(mb, "User-Agent: %s\r\n", sip->software);
+/**
+ * Send a SIP dialog request to a given next hop, with formatted arguments.
+ * The next hop is only used to find the destination, it is not added as
+ * a Route header.
+ *
+ * @param reqp     Pointer to allocated SIP request object
+ * @param sip      SIP Stack
+ * @param stateful Stateful client transaction
+ * @param met      Null-terminated SIP Method string
+ * @param dlg      SIP Dialog state
+ * @param cseq     CSeq number
+ * @param auth     SIP authentication state
+ * @param route    Next hop route URI, or NULL for the dialog route
+ * @param sendh    Send handler
+ * @param resph    Response handler
+ * @param arg      Handler argument
+ * @param fmt      Formatted SIP headers and body
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sip_drequestf_route(struct sip_request **reqp, struct sip *sip,
+			bool stateful, const char *met,
+			struct sip_dialog *dlg, uint32_t cseq,
+			struct sip_auth *auth, const struct uri *route,
+			sip_send_h *sendh, sip_resp_h *resph, void *arg,
+			const char *fmt, ...)
+{
+	va_list ap;
+	int err;
 
-	if (err)
-		goto out;
+	if (!sip || !met || !dlg || !fmt)
+		return EINVAL;
 
 	va_start(ap, fmt);
-	err = mbuf_vprintf(mb, fmt, ap);
+	err = vdrequestf(reqp, sip, stateful, met, dlg, cseq, auth, route,
+			 sendh, resph, arg, fmt, ap);
 	va_end(ap);
 
-	if (err)
-		goto out;
-
-	mb->pos = 0;
-
-	err = sip_request(reqp, sip, stateful, met, -1, sip_dialog_uri(dlg),
-			  -1, sip_dialog_route(dlg), mb, sip_dialog_hash(dlg),
-			  sendh, resph, arg);
-	if (err)
-		goto out;
-
- out:
-	mem_deref(mb);
-
 	return err;
 }
 
@@ -35,24 +35,28 @@ static void destructor(void *arg)
 	sip_request_close(sip);
 	sip_request_close(sip);
 
-	hash_flush(sip->ht_ctrans);
-	mem_deref(sip->ht_ctrans);
+	list_flush(&sip->ctransl);
+	mem_deref(sip->map_ctrans);
 
-	hash_flush(sip->ht_strans);
+	list_flush(&sip->stransl);
 	hash_clear(sip->ht_strans_mrg);
-	mem_deref(sip->ht_strans);
+	mem_deref(sip->map_strans);
 	mem_deref(sip->ht_strans_mrg);
 
 	hash_flush(sip->ht_conn);
 	mem_deref(sip->ht_conn);
 
-	hash_flush(sip->ht_udpconn);
-	mem_deref(sip->ht_udpconn);
+	list_flush(&sip->udpconnl);
+	mem_deref(sip->map_udpconn);
+
+	sip_kaflow_close(sip);
+	mem_deref(sip->oc);
 
 	list_flush(&sip->transpl);
 	list_flush(&sip->lsnrl);
 
 	mem_deref(sip->software);
+	mem_deref(sip->uahdr);
 	mem_deref(sip->dnsc);
 	mem_deref(sip->stun);
 }
@@ -109,7 +113,7 @@ int sip_alloc(struct sip **sipp, struct dnsc *dnsc, uint32_t ctsz,
 	if (err)
 		goto out;
 
-	err = hash_alloc(&sip->ht_udpconn, tcsz);
+	err = hmap_alloc(&sip->map_udpconn, tcsz);
 	if (err)
 		goto out;
 
@@ -121,6 +125,11 @@ int sip_alloc(struct sip **sipp, struct dnsc *dnsc, uint32_t ctsz,
 		err = str_dup(&sip->software, software);
 		if (err)
 			goto out;
+
+		err = re_sdprintf(&sip->uahdr, "User-Agent: %s\r\n",
+				  software);
+		if (err)
+			goto out;
 	}
 
 	sip->dnsc  = mem_ref(dnsc);
@@ -245,3 +254,19 @@ void sip_set_trace_handler(struct sip *sip, sip_trace_h *traceh)
 
 	sip->traceh = traceh;
 }
+
+
+/**
+ * Enable or disable lazy decoding of received SIP messages, see
+ * sip_msg_decode_lazy()
+ *
+ * @param sip  SIP stack instance
+ * @param lazy True to decode lazily, false to decode all headers
+ */
+void sip_set_lazy(struct sip *sip, bool lazy)
+{
+	if (!sip)
+		return;
+
+	sip->lazy = lazy;
+}
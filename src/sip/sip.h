@@ -9,18 +9,27 @@ struct sip {
 	struct list transpl;
 	struct list lsnrl;
 	struct list reql;
-	struct hash *ht_ctrans;
-	struct hash *ht_strans;
+	struct list ctransl;
+	struct list stransl;
+	struct list udpconnl;
+	struct list kabktl;
+	struct sip_oc *oc;
+	uint32_t stransc;
+	uint32_t compact;      /* Transports with compact headers */
+	struct hmap *map_ctrans;
+	struct hmap *map_strans;
 	struct hash *ht_strans_mrg;
 	struct hash *ht_conn;
-	struct hash *ht_udpconn;
+	struct hmap *map_udpconn;
 	struct dnsc *dnsc;
 	struct stun *stun;
 	char *software;
+	char *uahdr;           /* Rendered User-Agent header */
 	sip_exit_h *exith;
 	sip_trace_h *traceh;
 	void *arg;
 	bool closing;
+	bool lazy;
 };
 
 
@@ -60,6 +69,13 @@ int  sip_ctrans_debug(struct re_printf *pf, const struct sip *sip);
 /* strans */
 int  sip_strans_init(struct sip *sip, uint32_t sz);
 int  sip_strans_debug(struct re_printf *pf, const struct sip *sip);
+bool sip_strans_absorb(struct sip *sip, const struct mbuf *mb);
+
+
+/* overload */
+bool sip_oc_reject(struct sip *sip, const struct sip_msg *msg);
+bool sip_oc_via(const struct sip *sip);
+int  sip_oc_print(struct re_printf *pf, const struct sip *sip);
 
 
 /* transp */
@@ -71,10 +87,13 @@ int  sip_transp_init(struct sip *sip, uint32_t sz);
 int  sip_transp_send(struct sip_connqent **qentp, struct sip *sip, void *sock,
 		     enum sip_transp tp, const struct sa *dst, struct mbuf *mb,
 		     sip_transp_h *transph, void *arg);
+int  sip_transp_via(struct sip *sip, const char **via, struct sa *laddr,
+		    enum sip_transp tp, const struct sa *dst);
 bool sip_transp_supported(struct sip *sip, enum sip_transp tp, int af);
 const char *sip_transp_srvid(enum sip_transp tp);
 bool sip_transp_reliable(enum sip_transp tp);
 int  sip_transp_debug(struct re_printf *pf, const struct sip *sip);
+void sip_transp_cork(struct sip *sip, bool cork);
 
 
 /* auth */
@@ -100,3 +119,43 @@ int  sip_keepalive_tcp(struct sip_keepalive *ka, struct sip_conn *conn,
 int  sip_keepalive_udp(struct sip_keepalive *ka, struct sip *sip,
 		       struct udp_sock *us, const struct sa *paddr,
 		       uint32_t interval);
+
+typedef void (sip_kaflow_h)(void *arg);
+
+struct sip_kabkt;
+
+struct sip_kaflow {
+	struct le le;
+	struct sip_kabkt *bkt;
+	sip_kaflow_h *sendh;
+	void *arg;
+};
+
+int  sip_kaflow_start(struct sip_kaflow *kf, struct sip *sip,
+		      uint32_t interval, sip_kaflow_h *sendh, void *arg);
+void sip_kaflow_stop(struct sip_kaflow *kf);
+void sip_kaflow_close(struct sip *sip);
+
+
+/* compact */
+void sip_msg_compact(struct mbuf *mb);
+
+static inline bool sip_compact(const struct sip *sip, enum sip_transp tp)
+{
+	return tp != SIP_TRANSP_NONE && (sip->compact & (1u << tp));
+}
+
+
+/* scan */
+static inline bool sip_is_lws(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static inline const char *sip_skip_lws(const char *p, const char *end)
+{
+	while (p < end && sip_is_lws(*p))
+		++p;
+
+	return p;
+}
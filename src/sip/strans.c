@@ -3,6 +3,7 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
+#include <string.h>
 #include <re_types.h>
 #include <re_mem.h>
 #include <re_mbuf.h>
@@ -16,6 +17,8 @@
 #include <re_udp.h>
 #include <re_msg.h>
 #include <re_sip.h>
+#include <re_trace.h>
+#include <re_metric.h>
 #include "sip.h"
 
 
@@ -29,7 +32,7 @@ enum state {
 
 
 struct sip_strans {
-	struct le he;
+	struct le le;
 	struct le he_mrg;
 	struct tmr tmr;
 	struct tmr tmrg;
@@ -45,12 +48,57 @@ struct sip_strans {
 };
 
 
+RE_METRIC_GAUGE_DEFINE(m_trying, "re_sip_server_transactions",
+		       "state=\"trying\"",
+		       "SIP server transactions by state");
+RE_METRIC_GAUGE_DEFINE(m_proceeding, "re_sip_server_transactions",
+		       "state=\"proceeding\"",
+		       "SIP server transactions by state");
+RE_METRIC_GAUGE_DEFINE(m_accepted, "re_sip_server_transactions",
+		       "state=\"accepted\"",
+		       "SIP server transactions by state");
+RE_METRIC_GAUGE_DEFINE(m_completed, "re_sip_server_transactions",
+		       "state=\"completed\"",
+		       "SIP server transactions by state");
+RE_METRIC_GAUGE_DEFINE(m_confirmed, "re_sip_server_transactions",
+		       "state=\"confirmed\"",
+		       "SIP server transactions by state");
+
+/* Indexed by the state */
+static struct re_metric *const statev[] = {
+	&m_trying,
+	&m_proceeding,
+	&m_accepted,
+	&m_completed,
+	&m_confirmed,
+};
+
+
+static void state_set(struct sip_strans *st, enum state state)
+{
+	re_metric_gauge_add(statev[st->state], -1);
+	re_metric_gauge_add(statev[state], 1);
+
+	st->state = state;
+}
+
+
 static void destructor(void *arg)
 {
 	struct sip_strans *st = arg;
 
-	hash_unlink(&st->he);
+	RE_TRACE_ASYNC_END("sip", "strans", st);
+
+	if (st->sip) {
+		--st->sip->stransc;
+		re_metric_gauge_add(statev[st->state], -1);
+	}
+
+	list_unlink(&st->le);
 	hash_unlink(&st->he_mrg);
+	if (st->msg)
+		hmap_remove(st->sip->map_strans,
+			    hash_fast_pl(&st->msg->via.branch), st);
 	tmr_cancel(&st->tmr);
 	tmr_cancel(&st->tmrg);
 	mem_deref(st->msg);
@@ -70,9 +118,17 @@ static bool strans_cmp(const struct sip_msg *msg1, const struct sip_msg *msg2)
 }
 
 
-static bool cmp_handler(struct le *le, void *arg)
+static uint32_t key_merge_handler(const struct le *le)
 {
-	struct sip_strans *st = le->data;
+	const struct sip_strans *st = le->data;
+
+	return hash_fast_pl(&st->msg->callid);
+}
+
+
+static bool cmp_handler(const void *val, void *arg)
+{
+	const struct sip_strans *st = val;
 	const struct sip_msg *msg = arg;
 
 	if (!strans_cmp(st->msg, msg))
@@ -85,9 +141,9 @@ static bool cmp_handler(struct le *le, void *arg)
 }
 
 
-static bool cmp_ack_handler(struct le *le, void *arg)
+static bool cmp_ack_handler(const void *val, void *arg)
 {
-	struct sip_strans *st = le->data;
+	const struct sip_strans *st = val;
 	const struct sip_msg *msg = arg;
 
 	if (!strans_cmp(st->msg, msg))
@@ -100,9 +156,9 @@ static bool cmp_ack_handler(struct le *le, void *arg)
 }
 
 
-static bool cmp_cancel_handler(struct le *le, void *arg)
+static bool cmp_cancel_handler(const void *val, void *arg)
 {
-	struct sip_strans *st = le->data;
+	const struct sip_strans *st = val;
 	const struct sip_msg *msg = arg;
 
 	if (!strans_cmp(st->msg, msg))
@@ -115,6 +171,31 @@ static bool cmp_cancel_handler(struct le *le, void *arg)
 }
 
 
+/* Top Via and CSeq of a request that is not decoded */
+struct raw_key {
+	struct sip_via via;
+	struct sip_cseq cseq;
+};
+
+
+static bool cmp_raw_handler(const void *val, void *arg)
+{
+	const struct sip_strans *st = val;
+	const struct raw_key *key = arg;
+
+	if (pl_cmp(&st->msg->via.branch, &key->via.branch))
+		return false;
+
+	if (pl_cmp(&st->msg->via.sentby, &key->via.sentby))
+		return false;
+
+	if (pl_cmp(&st->msg->cseq.met, &key->cseq.met))
+		return false;
+
+	return true;
+}
+
+
 static bool cmp_merge_handler(struct le *le, void *arg)
 {
 	struct sip_strans *st = le->data;
@@ -129,7 +210,7 @@ static bool cmp_merge_handler(struct le *le, void *arg)
 	if (pl_cmp(&st->msg->callid, &msg->callid))
 		return false;
 
-	if (pl_cmp(&st->msg->from.tag, &msg->from.tag))
+	if (pl_cmp(&sip_msg_from(st->msg)->tag, &sip_msg_from(msg)->tag))
 		return false;
 
 	if (pl_cmp(&st->msg->ruri, &msg->ruri))
@@ -170,9 +251,8 @@ static bool ack_handler(struct sip *sip, const struct sip_msg *msg)
 {
 	struct sip_strans *st;
 
-	st = list_ledata(hash_lookup(sip->ht_strans,
-				     hash_joaat_pl(&msg->via.branch),
-				     cmp_ack_handler, (void *)msg));
+	st = hmap_lookup(sip->map_strans, hash_fast_pl(&msg->via.branch),
+			 cmp_ack_handler, (void *)msg);
 	if (!st)
 		return false;
 
@@ -190,7 +270,7 @@ static bool ack_handler(struct sip *sip, const struct sip_msg *msg)
 
 		tmr_start(&st->tmr, SIP_T4, tmr_handler, st);
 		tmr_cancel(&st->tmrg);
-		st->state = CONFIRMED;
+		state_set(st, CONFIRMED);
 		break;
 
 	default:
@@ -205,9 +285,8 @@ static bool cancel_handler(struct sip *sip, const struct sip_msg *msg)
 {
 	struct sip_strans *st;
 
-	st = list_ledata(hash_lookup(sip->ht_strans,
-				     hash_joaat_pl(&msg->via.branch),
-				     cmp_cancel_handler, (void *)msg));
+	st = hmap_lookup(sip->map_strans, hash_fast_pl(&msg->via.branch),
+			 cmp_cancel_handler, (void *)msg);
 	if (!st)
 		return false;
 
@@ -238,9 +317,8 @@ static bool request_handler(const struct sip_msg *msg, void *arg)
 	if (!pl_strcmp(&msg->met, "ACK"))
 		return ack_handler(sip, msg);
 
-	st = list_ledata(hash_lookup(sip->ht_strans,
-				     hash_joaat_pl(&msg->via.branch),
-				     cmp_handler, (void *)msg));
+	st = hmap_lookup(sip->map_strans, hash_fast_pl(&msg->via.branch),
+			 cmp_handler, (void *)msg);
 	if (st) {
 		switch (st->state) {
 
@@ -256,10 +334,10 @@ static bool request_handler(const struct sip_msg *msg, void *arg)
 
 		return true;
 	}
-	else if (!pl_isset(&msg->to.tag)) {
+	else if (!pl_isset(&sip_msg_to(msg)->tag)) {
 
 		st = list_ledata(hash_lookup(sip->ht_strans_mrg,
-					     hash_joaat_pl(&msg->callid),
+					     hash_fast_pl(&msg->callid),
 					     cmp_merge_handler, (void *)msg));
 		if (st) {
 			(void)sip_reply(sip, msg, 482, "Loop Detected");
@@ -270,7 +348,135 @@ static bool request_handler(const struct sip_msg *msg, void *arg)
 	if (!pl_strcmp(&msg->met, "CANCEL"))
 		return cancel_handler(sip, msg);
 
-	return false;
+	/* New dialogs are rejected before they create a transaction */
+	return sip_oc_reject(sip, msg);
+}
+
+
+/* Decode only the top Via and CSeq of a raw request */
+static int raw_decode(struct raw_key *key, const char *p, const char *end)
+{
+	bool via = false, cseq = false;
+	const char *sp;
+
+	if (end - p >= 4 && !memcmp(p, "SIP/", 4))
+		return EBADMSG;
+
+	sp = memchr(p, ' ', end - p);
+	if (!sp)
+		return EBADMSG;
+
+	/* ACK and CANCEL are matched by the full decoder */
+	if ((sp - p == 3 && !memcmp(p, "ACK", 3)) ||
+	    (sp - p == 6 && !memcmp(p, "CANCEL", 6)))
+		return ENOTSUP;
+
+	while (!via || !cseq) {
+
+		const char *eol, *colon;
+		struct pl name, val;
+
+		p = memchr(p, '\n', end - p);
+		if (!p)
+			return EBADMSG;
+
+		++p;
+
+		eol = memchr(p, '\n', end - p);
+		if (!eol)
+			return EBADMSG;
+
+		/* Empty line, end of headers */
+		if (p == eol || (*p == '\r' && p + 1 == eol))
+			return ENOENT;
+
+		/* Folded lines are not expected in these headers */
+		if (*p == ' ' || *p == '\t')
+			continue;
+
+		colon = memchr(p, ':', eol - p);
+		if (!colon)
+			return EBADMSG;
+
+		name.p = p;
+		name.l = colon - p;
+		while (name.l && sip_is_lws(name.p[name.l - 1]))
+			--name.l;
+
+		val.p = sip_skip_lws(colon + 1, eol);
+		val.l = eol - val.p;
+		while (val.l && sip_is_lws(val.p[val.l - 1]))
+			--val.l;
+
+		if (!via && (!pl_strcasecmp(&name, "Via") ||
+			     !pl_strcasecmp(&name, "v"))) {
+
+			const char *comma = memchr(val.p, ',', val.l);
+
+			if (comma)
+				val.l = comma - val.p;
+
+			if (sip_via_decode(&key->via, &val))
+				return EBADMSG;
+
+			via = true;
+		}
+		else if (!cseq && !pl_strcasecmp(&name, "CSeq")) {
+
+			if (sip_cseq_decode(&key->cseq, &val))
+				return EBADMSG;
+
+			cseq = true;
+		}
+	}
+
+	return 0;
+}
+
+
+/**
+ * Absorb a retransmitted request before it is decoded. Only the request
+ * line, the top Via and the CSeq are looked at, and the last response of
+ * a matching server transaction is sent again.
+ *
+ * @param sip SIP stack instance
+ * @param mb  Buffer with the received message
+ *
+ * @return True if it was a retransmission, false to decode it
+ */
+bool sip_strans_absorb(struct sip *sip, const struct mbuf *mb)
+{
+	struct sip_strans *st;
+	struct raw_key key;
+	const char *p;
+
+	/* Everything received is traced */
+	if (!sip || !mb || !sip->stransc || sip->traceh)
+		return false;
+
+	p = (const char *)mbuf_buf(mb);
+
+	if (raw_decode(&key, p, p + mbuf_get_left(mb)))
+		return false;
+
+	st = hmap_lookup(sip->map_strans, hash_fast_pl(&key.via.branch),
+			 cmp_raw_handler, &key);
+	if (!st)
+		return false;
+
+	switch (st->state) {
+
+	case PROCEEDING:
+	case COMPLETED:
+		(void)sip_send(st->sip, st->msg->sock, st->msg->tp,
+			       &st->dst, st->mb);
+		break;
+
+	default:
+		break;
+	}
+
+	return true;
 }
 
 
@@ -290,6 +496,7 @@ int sip_strans_alloc(struct sip_strans **stp, struct sip *sip,
 		     void *arg)
 {
 	struct sip_strans *st;
+	int err;
 
 	if (!stp || !sip || !msg)
 		return EINVAL;
@@ -298,10 +505,18 @@ int sip_strans_alloc(struct sip_strans **stp, struct sip *sip,
 	if (!st)
 		return ENOMEM;
 
-	hash_append(sip->ht_strans, hash_joaat_pl(&msg->via.branch),
-		    &st->he, st);
+	RE_TRACE_ASYNC_BEGIN("sip", "strans", st);
+
+	err = hmap_insert(sip->map_strans, hash_fast_pl(&msg->via.branch),
+			  st);
+	if (err) {
+		mem_deref(st);
+		return err;
+	}
+
+	list_append(&sip->stransl, &st->le, st);
 
-	hash_append(sip->ht_strans_mrg, hash_joaat_pl(&msg->callid),
+	hash_append(sip->ht_strans_mrg, hash_fast_pl(&msg->callid),
 		    &st->he_mrg, st);
 
 	st->invite  = !pl_strcmp(&msg->met, "INVITE");
@@ -311,6 +526,9 @@ int sip_strans_alloc(struct sip_strans **stp, struct sip *sip,
 	st->arg     = arg;
 	st->sip     = sip;
 
+	++sip->stransc;
+	re_metric_gauge_add(statev[st->state], 1);
+
 	*stp = st;
 
 	return 0;
@@ -364,15 +582,15 @@ int sip_strans_reply(struct sip_strans **stp, struct sip *sip,
 
 	if (st->invite) {
 		if (scode < 200) {
-			st->state = PROCEEDING;
+			state_set(st, PROCEEDING);
 		}
 		else if (scode < 300) {
 			tmr_start(&st->tmr, 64 * SIP_T1, tmr_handler, st);
-			st->state = ACCEPTED;
+			state_set(st, ACCEPTED);
 		}
 		else {
 			tmr_start(&st->tmr, 64 * SIP_T1, tmr_handler, st);
-			st->state = COMPLETED;
+			state_set(st, COMPLETED);
 
 			if (!sip_transp_reliable(st->msg->tp))
 				tmr_start(&st->tmrg, SIP_T1,
@@ -381,13 +599,13 @@ int sip_strans_reply(struct sip_strans **stp, struct sip *sip,
 	}
 	else {
 		if (scode < 200) {
-			st->state = PROCEEDING;
+			state_set(st, PROCEEDING);
 		}
 		else {
 			if (!sip_transp_reliable(st->msg->tp)) {
 				tmr_start(&st->tmr, 64 * SIP_T1, tmr_handler,
 					  st);
-				st->state = COMPLETED;
+				state_set(st, COMPLETED);
 			}
 			else {
 				mem_deref(st);
@@ -407,11 +625,11 @@ int sip_strans_init(struct sip *sip, uint32_t sz)
 	if (err)
 		return err;
 
-	err = hash_alloc(&sip->ht_strans_mrg, sz);
+	err = hash_alloc_auto(&sip->ht_strans_mrg, sz, key_merge_handler);
 	if (err)
 		return err;
 
-	return hash_alloc(&sip->ht_strans, sz);
+	return hmap_alloc(&sip->map_strans, sz);
 }
 
 
@@ -449,7 +667,7 @@ int sip_strans_debug(struct re_printf *pf, const struct sip *sip)
 	int err;
 
 	err = re_hprintf(pf, "server transactions:\n");
-	hash_apply(sip->ht_strans, debug_handler, pf);
+	list_apply(&sip->stransl, true, debug_handler, pf);
 
 	return err;
 }
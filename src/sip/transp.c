@@ -21,6 +21,7 @@
 #include <re_tls.h>
 #include <re_msg.h>
 #include <re_sip.h>
+#include <re_probe.h>
 #include "sip.h"
 
 
@@ -30,6 +31,7 @@ enum {
 	TCP_KEEPALIVE_TIMEOUT = 10,
 	TCP_KEEPALIVE_INTVAL  = 120,
 	TCP_BUFSIZE_MAX       = 65536,
+	TCP_RXBUF_SIZE        = 8192,
 };
 
 
@@ -39,6 +41,7 @@ struct sip_transport {
 	struct sip *sip;
 	struct tls *tls;
 	void *sock;
+	char *via;               /* Rendered Via header up to the branch */
 	enum sip_transp tp;
 };
 
@@ -48,14 +51,13 @@ struct sip_conn {
 	struct list ql;
 	struct list kal;
 	struct tmr tmr;
-	struct tmr tmr_ka;
+	struct sip_kaflow kaf;
 	struct sa laddr;
 	struct sa paddr;
 	struct tls_conn *sc;
 	struct tcp_conn *tc;
 	struct mbuf *mb;
 	struct sip *sip;
-	uint32_t ka_interval;
 	bool established;
 };
 
@@ -89,6 +91,7 @@ static void transp_destructor(void *arg)
 	list_unlink(&transp->le);
 	mem_deref(transp->sock);
 	mem_deref(transp->tls);
+	mem_deref(transp->via);
 }
 
 
@@ -96,7 +99,7 @@ static void conn_destructor(void *arg)
 {
 	struct sip_conn *conn = arg;
 
-	tmr_cancel(&conn->tmr_ka);
+	sip_kaflow_stop(&conn->kaf);
 	tmr_cancel(&conn->tmr);
 	list_flush(&conn->kal);
 	list_flush(&conn->ql);
@@ -173,7 +176,7 @@ static void conn_close(struct sip_conn *conn, int err)
 
 	conn->sc = mem_deref(conn->sc);
 	conn->tc = mem_deref(conn->tc);
-	tmr_cancel(&conn->tmr_ka);
+	sip_kaflow_stop(&conn->kaf);
 	tmr_cancel(&conn->tmr);
 	hash_unlink(&conn->he);
 
@@ -227,8 +230,6 @@ static void conn_keepalive_handler(void *arg)
 
 	tmr_start(&conn->tmr, TCP_KEEPALIVE_TIMEOUT * 1000,
 		  conn_tmr_handler, conn);
-	tmr_start(&conn->tmr_ka, sip_keepalive_wait(conn->ka_interval),
-		  conn_keepalive_handler, conn);
 }
 
 
@@ -236,6 +237,8 @@ static void sip_recv(struct sip *sip, const struct sip_msg *msg)
 {
 	struct le *le = sip->lsnrl.head;
 
+	RE_PROBE3(sip_recv, msg, (int)msg->req, msg->scode);
+
 	if (sip->traceh) {
 		sip->traceh(false, msg->tp, &msg->src, &msg->dst,
 			    msg->mb->buf, msg->mb->end, sip->arg);
@@ -311,7 +314,11 @@ static void udp_recv_handler(const struct sa *src, struct mbuf *mb, void *arg)
 		return;
 	}
 
-	err = sip_msg_decode(&msg, mb);
+	if (sip_strans_absorb(transp->sip, mb))
+		return;
+
+	err = transp->sip->lazy ? sip_msg_decode_lazy(&msg, mb) :
+		sip_msg_decode(&msg, mb);
 	if (err) {
 		(void)re_fprintf(stderr, "sip: msg decode err: %m\n", err);
 		return;
@@ -328,6 +335,52 @@ static void udp_recv_handler(const struct sa *src, struct mbuf *mb, void *arg)
 }
 
 
+/*
+ * A segment with whole messages is parsed in place, without a copy. The
+ * start of a split message is kept in a receive buffer with room for
+ * more segments, which are added at its end. Consumed space is released
+ * by moving the position, and only the split message is ever moved to
+ * the front, when the end of the buffer is reached. Received messages
+ * hold views of the buffer, so while there are views the split message
+ * goes to a new buffer instead.
+ */
+static int rxbuf_append(struct sip_conn *conn, const struct mbuf *mb)
+{
+	const size_t n = mbuf_get_left(mb);
+	struct mbuf *rb = conn->mb;
+	const size_t left = mbuf_get_left(rb);
+
+	if (left + n > TCP_BUFSIZE_MAX)
+		return EOVERFLOW;
+
+	if (mem_nrefs(rb) > 1 || rb->size < left + n) {
+
+		struct mbuf *rbn;
+
+		rbn = mbuf_alloc(MAX(left + n, TCP_RXBUF_SIZE));
+		if (!rbn)
+			return ENOMEM;
+
+		(void)mbuf_write_mem(rbn, mbuf_buf(rb), left);
+		rbn->pos = 0;
+
+		mem_deref(conn->mb);
+		conn->mb = rb = rbn;
+	}
+	else if (rb->size - rb->end < n) {
+
+		memmove(rb->buf, mbuf_buf(rb), left);
+		rb->pos = 0;
+		rb->end = left;
+	}
+
+	memcpy(rb->buf + rb->end, mbuf_buf(mb), n);
+	rb->end += n;
+
+	return 0;
+}
+
+
 static void tcp_recv_handler(struct mbuf *mb, void *arg)
 {
 	struct sip_conn *conn = arg;
@@ -335,20 +388,9 @@ static void tcp_recv_handler(struct mbuf *mb, void *arg)
 	int err = 0;
 
 	if (conn->mb) {
-		pos = conn->mb->pos;
-
-		conn->mb->pos = conn->mb->end;
-
-		err = mbuf_write_mem(conn->mb, mbuf_buf(mb),mbuf_get_left(mb));
+		err = rxbuf_append(conn, mb);
 		if (err)
 			goto out;
-
-		conn->mb->pos = pos;
-
-		if (mbuf_get_left(conn->mb) > TCP_BUFSIZE_MAX) {
-			err = EOVERFLOW;
-			goto out;
-		}
 	}
 	else {
 		conn->mb = mem_ref(mb);
@@ -356,6 +398,7 @@ static void tcp_recv_handler(struct mbuf *mb, void *arg)
 
 	for (;;) {
 		struct sip_msg *msg;
+		struct mbuf *view;
 		uint32_t clen;
 		size_t end;
 
@@ -395,7 +438,8 @@ static void tcp_recv_handler(struct mbuf *mb, void *arg)
 
 		pos = conn->mb->pos;
 
-		err = sip_msg_decode(&msg, conn->mb);
+		err = conn->sip->lazy ? sip_msg_decode_lazy(&msg, conn->mb) :
+			sip_msg_decode(&msg, conn->mb);
 		if (err) {
 			if (err == ENODATA)
 				err = 0;
@@ -419,9 +463,21 @@ static void tcp_recv_handler(struct mbuf *mb, void *arg)
 		tmr_start(&conn->tmr, TCP_IDLE_TIMEOUT * 1000,
 			  conn_tmr_handler, conn);
 
-		end = conn->mb->end;
+		end = conn->mb->pos + clen;
+
+		/* The message gets a view of its own bytes, no copy */
+		view = mbuf_slice(conn->mb, pos, end - pos);
+		if (!view) {
+			mem_deref(msg);
+			err = ENOMEM;
+			break;
+		}
+
+		view->pos = conn->mb->pos - pos;
+
+		mem_deref(msg->mb);
+		msg->mb = view;
 
-		msg->mb->end = msg->mb->pos + clen;
 		msg->sock = mem_ref(conn);
 		msg->src = conn->paddr;
 		msg->dst = conn->laddr;
@@ -430,24 +486,12 @@ static void tcp_recv_handler(struct mbuf *mb, void *arg)
 		sip_recv(conn->sip, msg);
 		mem_deref(msg);
 
-		if (end <= conn->mb->end) {
+		if (end >= conn->mb->end) {
 			conn->mb = mem_deref(conn->mb);
 			break;
 		}
 
-		mb = mbuf_alloc(end - conn->mb->end);
-		if (!mb) {
-			err = ENOMEM;
-			goto out;
-		}
-
-		(void)mbuf_write_mem(mb, &conn->mb->buf[conn->mb->end],
-				     end - conn->mb->end);
-
-		mb->pos = 0;
-
-		mem_deref(conn->mb);
-		conn->mb = mb;
+		conn->mb->pos = end;
 	}
 
  out:
@@ -744,6 +788,10 @@ int sip_transp_add(struct sip *sip, enum sip_transp tp,
 
 	va_end(ap);
 
+	if (!err)
+		err = re_sdprintf(&transp->via, "Via: SIP/2.0/%s %J;branch=",
+				  sip_transp_name(tp), &transp->laddr);
+
 	if (err)
 		mem_deref(transp);
 
@@ -751,6 +799,23 @@ int sip_transp_add(struct sip *sip, enum sip_transp tp,
 }
 
 
+/* Hold back the datagrams of the UDP transports, or send them */
+void sip_transp_cork(struct sip *sip, bool cork)
+{
+	struct le *le;
+
+	for (le = sip->transpl.head; le; le = le->next) {
+
+		struct sip_transport *transp = le->data;
+
+		if (transp->tp != SIP_TRANSP_UDP)
+			continue;
+
+		(void)udp_set_cork(transp->sock, cork);
+	}
+}
+
+
 /**
  * Flush all transports of a SIP stack instance
  *
@@ -839,6 +904,29 @@ int sip_transp_laddr(struct sip *sip, struct sa *laddr, enum sip_transp tp,
 }
 
 
+/*
+ * Get the local address of the transport to a destination, and its Via
+ * header, which is rendered when the transport is added
+ */
+int sip_transp_via(struct sip *sip, const char **via, struct sa *laddr,
+		   enum sip_transp tp, const struct sa *dst)
+{
+	const struct sip_transport *transp;
+
+	if (!sip || !via || !laddr)
+		return EINVAL;
+
+	transp = transp_find(sip, tp, sa_af(dst), dst);
+	if (!transp)
+		return EPROTONOSUPPORT;
+
+	*via   = transp->via;
+	*laddr = transp->laddr;
+
+	return 0;
+}
+
+
 bool sip_transp_supported(struct sip *sip, enum sip_transp tp, int af)
 {
 	if (!sip)
@@ -1024,18 +1112,20 @@ int  sip_keepalive_tcp(struct sip_keepalive *ka, struct sip_conn *conn,
 	if (!conn->tc || !conn->established)
 		return ENOTCONN;
 
-	list_append(&conn->kal, &ka->le, ka);
+	if (!conn->kaf.bkt) {
 
-	if (!tmr_isrunning(&conn->tmr_ka)) {
+		int err;
 
 		interval = MAX(interval ? interval : TCP_KEEPALIVE_INTVAL,
 			       TCP_KEEPALIVE_TIMEOUT * 2);
 
-		conn->ka_interval = interval;
-
-		tmr_start(&conn->tmr_ka, sip_keepalive_wait(conn->ka_interval),
-			  conn_keepalive_handler, conn);
+		err = sip_kaflow_start(&conn->kaf, conn->sip, interval,
+				       conn_keepalive_handler, conn);
+		if (err)
+			return err;
 	}
 
+	list_append(&conn->kal, &ka->le, ka);
+
 	return 0;
 }
@@ -9,21 +9,141 @@
 #include <re_uri.h>
 #include <re_list.h>
 #include <re_sa.h>
+#include <re_udp.h>
 #include <re_msg.h>
 #include <re_sip.h>
+#include "sip.h"
+
+
+static inline bool is_digit(char c)
+{
+	return '0' <= c && c <= '9';
+}
+
+
+static inline bool is_alpha(char c)
+{
+	return ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z');
+}
+
+
+static inline bool is_hex(char c)
+{
+	return is_digit(c) || ('a' <= c && c <= 'f') || ('A' <= c && c <= 'F');
+}
+
+
+static const char *skip_digits(const char *p, const char *end)
+{
+	while (p < end && is_digit(*p))
+		++p;
+
+	return p;
+}
 
 
 static int decode_hostport(const struct pl *hostport, struct pl *host,
 			   struct pl *port)
 {
-	/* Try IPv6 first */
-	if (!re_regex(hostport->p, hostport->l, "\\[[0-9a-f:]+\\][:]*[0-9]*",
-		      host, NULL, port))
+	const char *end = hostport->p + hostport->l;
+	const char *p, *q;
+
+	/* Try IPv6 first, "\\[[0-9a-f:]+\\][:]*[0-9]*" */
+	for (p = hostport->p; p < end; p++) {
+
+		if (*p != '[')
+			continue;
+
+		for (q = p + 1; q < end && (is_hex(*q) || *q == ':'); q++)
+			;
+
+		if (q == p + 1 || q == end || *q != ']')
+			continue;
+
+		host->p = p + 1;
+		host->l = q - host->p;
+
+		for (++q; q < end && *q == ':'; q++)
+			;
+
+		port->p = q;
+		port->l = skip_digits(q, end) - q;
+
 		return 0;
+	}
+
+	/* Then non-IPv6 host, "[^:]+[:]*[0-9]*" */
+	for (p = hostport->p; p < end && *p == ':'; p++)
+		;
+
+	if (p == end)
+		return ENOENT;
 
-	/* Then non-IPv6 host */
-	return re_regex(hostport->p, hostport->l, "[^:]+[:]*[0-9]*",
-			host, NULL, port);
+	for (q = p; q < end && *q != ':'; q++)
+		;
+
+	host->p = p;
+	host->l = q - p;
+
+	for (; q < end && *q == ':'; q++)
+		;
+
+	port->p = q;
+	port->l = skip_digits(q, end) - q;
+
+	return 0;
+}
+
+
+/*
+ * "SIP[ \t\r\n]*\/[ \t\r\n]*2.0[ \t\r\n]*\/[ \t\r\n]*"
+ * "[A-Z]+[ \t\r\n]*[^; \t\r\n]+[ \t\r\n]*[^]*" at p
+ */
+static bool via_match(struct pl *transp, struct pl *sentby, struct pl *params,
+		      const char *p, const char *end)
+{
+	const char *q;
+
+	if (end - p < 3 || (p[0] | 0x20) != 's' || (p[1] | 0x20) != 'i' ||
+	    (p[2] | 0x20) != 'p')
+		return false;
+
+	p = sip_skip_lws(p + 3, end);
+	if (p == end || *p != '/')
+		return false;
+
+	p = sip_skip_lws(p + 1, end);
+	if (end - p < 3 || p[0] != '2' || p[1] != '.' || p[2] != '0')
+		return false;
+
+	p = sip_skip_lws(p + 3, end);
+	if (p == end || *p != '/')
+		return false;
+
+	p = sip_skip_lws(p + 1, end);
+	for (q = p; q < end && is_alpha(*q); q++)
+		;
+
+	if (q == p)
+		return false;
+
+	transp->p = p;
+	transp->l = q - p;
+
+	p = sip_skip_lws(q, end);
+	for (q = p; q < end && *q != ';' && !sip_is_lws(*q); q++)
+		;
+
+	if (q == p)
+		return false;
+
+	sentby->p = p;
+	sentby->l = q - p;
+
+	params->p = sip_skip_lws(q, end);
+	params->l = end - params->p;
+
+	return true;
 }
 
 
@@ -38,18 +158,22 @@ static int decode_hostport(const struct pl *hostport, struct pl *host,
 int sip_via_decode(struct sip_via *via, const struct pl *pl)
 {
 	struct pl transp, host, port;
+	const char *p, *end;
 	int err;
 
-	if (!via || !pl)
+	if (!via || !pl || !pl->p)
 		return EINVAL;
 
-	err = re_regex(pl->p, pl->l,
-		       "SIP[  \t\r\n]*/[ \t\r\n]*2.0[ \t\r\n]*/[ \t\r\n]*"
-		       "[A-Z]+[ \t\r\n]*[^; \t\r\n]+[ \t\r\n]*[^]*",
-		       NULL, NULL, NULL, NULL, &transp,
-		       NULL, &via->sentby, NULL, &via->params);
-	if (err)
-		return err;
+	end = pl->p + pl->l;
+
+	for (p = pl->p; p < end; p++) {
+
+		if (via_match(&transp, &via->sentby, &via->params, p, end))
+			break;
+	}
+
+	if (p == end)
+		return ENOENT;
 
 	if (!pl_strcmp(&transp, "TCP"))
 		via->tp = SIP_TRANSP_TCP;
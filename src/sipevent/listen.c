@@ -106,7 +106,7 @@ static struct sipnot *sipnot_find(struct sipevent_sock *sock,
 	cmp.evt = evt;
 
 	return list_ledata(hash_lookup(sock->ht_not,
-				       hash_joaat_pl(&msg->callid),
+				       sip_dialog_msg_key(msg, true),
 				       not_cmp_handler, &cmp));
 }
 
@@ -121,7 +121,7 @@ struct sipsub *sipsub_find(struct sipevent_sock *sock,
 	cmp.evt = evt;
 
 	return list_ledata(hash_lookup(sock->ht_sub,
-				       hash_joaat_pl(&msg->callid), full ?
+				       sip_dialog_msg_key(msg, full), full ?
 				       sub_cmp_handler : sub_cmp_half_handler,
 				       &cmp));
 }
@@ -180,6 +180,8 @@ static void notify_handler(struct sipevent_sock *sock,
 						str_error(err, m, sizeof(m)));
 				return;
 			}
+
+			sipsub_rehash(sub);
 		}
 	}
 	else {
@@ -299,7 +301,7 @@ static bool request_handler(const struct sip_msg *msg, void *arg)
 
 	if (!pl_strcmp(&msg->met, "SUBSCRIBE")) {
 
-		if (pl_isset(&msg->to.tag)) {
+		if (pl_isset(&sip_msg_to(msg)->tag)) {
 			subscribe_handler(sock, msg);
 			return true;
 		}
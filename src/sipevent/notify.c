@@ -20,6 +20,7 @@
 
 
 static int notify_request(struct sipnot *not, bool reset_ls);
+static int notify_rated(struct sipnot *not);
 
 
 static void internal_close_handler(int err, const struct sip_msg *msg,
@@ -56,6 +57,7 @@ static void destructor(void *arg)
 	struct sipnot *not = arg;
 
 	tmr_cancel(&not->tmr);
+	tmr_cancel(&not->tmr_rate);
 
 	if (!not->terminated) {
 
@@ -89,6 +91,7 @@ static void sipnot_terminate(struct sipnot *not, int err,
 	arg    = not->arg;
 
 	tmr_cancel(&not->tmr);
+	tmr_cancel(&not->tmr_rate);
 	(void)terminate(not, reason);
 
 	closeh(err, msg, arg);
@@ -169,7 +172,7 @@ static void response_handler(int err, const struct sip_msg *msg, void *arg)
 		sipnot_terminate(not, err, msg, -1);
 	}
 	else if (not->notify_pending) {
-		(void)notify_request(not, true);
+		(void)notify_rated(not);
 	}
 }
 
@@ -251,6 +254,7 @@ static int notify_request(struct sipnot *not, bool reset_ls)
 		not->termsent = true;
 
 	not->notify_pending = false;
+	not->notify_last    = tmr_jiffies();
 
 	return sip_drequestf(&not->req, not->sip, true, "NOTIFY",
 			     not->dlg, 0, not->auth,
@@ -281,6 +285,49 @@ int sipnot_notify(struct sipnot *not)
 }
 
 
+static void rate_handler(void *arg)
+{
+	struct sipnot *not = arg;
+
+	/* A pending NOTIFY is also sent when the request completes */
+	if (not->req || !not->notify_pending || not->terminated)
+		return;
+
+	(void)notify_request(not, true);
+}
+
+
+/* Send a NOTIFY, or wait for the interval since the previous one */
+static int notify_rated(struct sipnot *not)
+{
+	uint64_t now, next;
+
+	if (not->expires == 0)
+		return 0;
+
+	if (not->req) {
+		not->notify_pending = true;
+		return 0;
+	}
+
+	now  = tmr_jiffies();
+	next = not->notify_last + not->notify_ival;
+
+	if (not->notify_ival && now < next) {
+
+		not->notify_pending = true;
+
+		if (!tmr_isrunning(&not->tmr_rate))
+			tmr_start(&not->tmr_rate, next - now, rate_handler,
+				  not);
+
+		return 0;
+	}
+
+	return notify_request(not, true);
+}
+
+
 int sipnot_reply(struct sipnot *not, const struct sip_msg *msg,
 		 uint16_t scode, const char *reason)
 {
@@ -359,8 +406,7 @@ int sipevent_accept(struct sipnot **notp, struct sipevent_sock *sock,
 			goto out;
 	}
 
-	hash_append(sock->ht_not,
-		    hash_joaat_str(sip_dialog_callid(not->dlg)),
+	hash_append(sock->ht_not, sip_dialog_key(not->dlg),
 		    &not->he, not);
 
 	err = sip_auth_alloc(&not->auth, authh, aarg, aref);
@@ -434,10 +480,11 @@ int sipevent_notify(struct sipnot *not, struct mbuf *mb,
 	case SIPEVENT_ACTIVE:
 	case SIPEVENT_PENDING:
 		not->substate = state;
-		return sipnot_notify(not);
+		return notify_rated(not);
 
 	case SIPEVENT_TERMINATED:
 		tmr_cancel(&not->tmr);
+		tmr_cancel(&not->tmr_rate);
 		not->retry_after = retry_after;
 		(void)terminate(not, reason);
 		return 0;
@@ -486,3 +533,31 @@ int sipevent_notifyf(struct sipnot *not, struct mbuf **mbp,
 
 	return err;
 }
+
+
+/**
+ * Set the minimum interval between the NOTIFY requests of a notifier.
+ * State changes within the interval are coalesced, and only the latest
+ * state and body are sent when it has passed. The final NOTIFY, and the
+ * NOTIFY that answers a SUBSCRIBE refresh, are sent without waiting.
+ *
+ * @param not      SIP Event Notifier
+ * @param interval Minimum interval in [ms], 0 to disable
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sipevent_notify_interval(struct sipnot *not, uint32_t interval)
+{
+	if (!not)
+		return EINVAL;
+
+	not->notify_ival = interval;
+
+	/* The pending NOTIFY may be due with the new interval */
+	if (tmr_isrunning(&not->tmr_rate)) {
+		tmr_cancel(&not->tmr_rate);
+		return notify_rated(not);
+	}
+
+	return 0;
+}
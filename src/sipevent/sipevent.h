@@ -22,6 +22,7 @@ struct sipnot {
 	struct le he;
 	struct sip_loopstate ls;
 	struct tmr tmr;
+	struct tmr tmr_rate;
 	struct sipevent_sock *sock;
 	struct sip_request *req;
 	struct sip_dialog *dlg;
@@ -40,6 +41,8 @@ struct sipnot {
 	uint32_t expires_dfl;
 	uint32_t expires_max;
 	uint32_t retry_after;
+	uint32_t notify_ival;
+	uint64_t notify_last;
 	enum sipevent_subst substate;
 	enum sipevent_reason reason;
 	bool notify_pending;
@@ -87,6 +90,7 @@ struct sipsub {
 struct sipsub *sipsub_find(struct sipevent_sock *sock,
 			   const struct sip_msg *msg,
 			   const struct sipevent_event *evt, bool full);
+void sipsub_rehash(struct sipsub *sub);
 void sipsub_reschedule(struct sipsub *sub, uint64_t wait);
 void sipsub_terminate(struct sipsub *sub, int err, const struct sip_msg *msg,
 		      const struct sipevent_substate *substate);
@@ -136,6 +136,15 @@ static void tmr_handler(void *arg)
 }
 
 
+/* Add the subscription again, when the remote tag has been set */
+void sipsub_rehash(struct sipsub *sub)
+{
+	hash_unlink(&sub->he);
+	hash_append(sub->sock->ht_sub, sip_dialog_key(sub->dlg),
+		    &sub->he, sub);
+}
+
+
 void sipsub_reschedule(struct sipsub *sub, uint64_t wait)
 {
 	tmr_start(&sub->tmr, wait, tmr_handler, sub);
@@ -196,6 +205,8 @@ static void response_handler(int err, const struct sip_msg *msg, void *arg)
 				sub->subscribed = false;
 				goto out;
 			}
+
+			sipsub_rehash(sub);
 		}
 		else {
 			/* Ignore 2xx responses for other dialogs
@@ -387,8 +398,7 @@ static int sipsub_alloc(struct sipsub **subp, struct sipevent_sock *sock,
 			goto out;
 	}
 
-	hash_append(sock->ht_sub,
-		    hash_joaat_str(sip_dialog_callid(sub->dlg)),
+	hash_append(sock->ht_sub, sip_dialog_key(sub->dlg),
 		    &sub->he, sub);
 
 	err = sip_auth_alloc(&sub->auth, authh, aarg, aref);
@@ -632,8 +642,7 @@ int sipevent_fork(struct sipsub **subp, struct sipsub *osub,
 	if (err)
 		goto out;
 
-	hash_append(osub->sock->ht_sub,
-		    hash_joaat_str(sip_dialog_callid(sub->dlg)),
+	hash_append(osub->sock->ht_sub, sip_dialog_key(sub->dlg),
 		    &sub->he, sub);
 
 	err = sip_auth_alloc(&sub->auth, authh, aarg, aref);
@@ -16,10 +16,53 @@
 #include <re_msg.h>
 #include <re_sip.h>
 #include <re_sipreg.h>
+#include <re_snap.h>
 
 
 enum {
 	DEFAULT_EXPIRES = 3600,
+	GROUP_HOP_TTL   = 3600,  /**< Lifetime of the shared next hop [s] */
+	RESUME_MIN      = 10,    /**< Shortest resumed binding [s]        */
+};
+
+
+/*
+ * The clients of a registration group send their requests in slots of
+ * 1/rate seconds, so a burst of registrations or refreshes is spread out.
+ * The destination of the first request is used as the next hop of the
+ * other requests, so the registrar is only resolved once per group, and
+ * the digest challenge of the last authenticated client is used for the
+ * first request of a new client.
+ *
+ * After a restart, a client of a group can take over the binding of its
+ * previous incarnation from a snapshot, instead of registering again.
+ * Only UDP bindings without outbound (RFC 5626) are resumed, as
+ * connection-oriented flows are gone with the old process.
+ */
+
+
+/** Defines a group of SIP Registration clients */
+struct sipreg_group {
+	struct sip *sip;
+	struct sip_auth *auth;  /**< Challenges of the last client        */
+	struct uri route;       /**< Shared next hop                      */
+	char *hop;              /**< Next hop URI string                  */
+	uint64_t hop_exp;       /**< Expiry time of the next hop [ms]     */
+	uint64_t next;          /**< Next free send slot [us]             */
+	uint32_t interval;      /**< Slot length [us]                     */
+	uint32_t jitter;        /**< Refresh jitter [%]                   */
+	bool authed;            /**< Challenges are set                   */
+	struct hash *rest;      /**< Restored bindings, by client identity */
+};
+
+
+/** Defines a binding restored from a snapshot, until it is taken over */
+struct reg_rest {
+	struct le he;
+	uint64_t id;            /**< Client identity                      */
+	uint64_t bexp;          /**< Binding expiry time [ms]             */
+	uint64_t refresh;       /**< Refresh time [ms]                    */
+	struct mbuf *mb;        /**< Remaining record contents            */
 };
 
 
@@ -33,6 +76,7 @@ struct sipreg {
 	struct sip_request *req;
 	struct sip_dialog *dlg;
 	struct sip_auth *auth;
+	struct sipreg_group *grp;
 	struct mbuf *hdrs;
 	char *cuser;
 	sip_resp_h *resph;
@@ -45,8 +89,12 @@ struct sipreg {
 	enum sip_transp tp;
 	bool registered;
 	bool terminated;
+	bool primed;
+	bool chall;
 	char *params;
 	int regid;
+	uint64_t id;            /**< Identity across restarts             */
+	uint64_t bexp;          /**< Binding expiry time [ms]             */
 };
 
 
@@ -90,16 +138,139 @@ static void destructor(void *arg)
 	mem_deref(reg->sip);
 	mem_deref(reg->hdrs);
 	mem_deref(reg->params);
+	mem_deref(reg->grp);
+}
+
+
+static void group_destructor(void *arg)
+{
+	struct sipreg_group *grp = arg;
+
+	hash_flush(grp->rest);
+	mem_deref(grp->rest);
+	mem_deref(grp->auth);
+	mem_deref(grp->hop);
+	mem_deref(grp->sip);
+}
+
+
+static void rest_destructor(void *arg)
+{
+	struct reg_rest *rr = arg;
+
+	hash_unlink(&rr->he);
+	mem_deref(rr->mb);
+}
+
+
+static uint32_t rest_key(const struct le *le)
+{
+	const struct reg_rest *rr = le->data;
+
+	return (uint32_t)rr->id;
+}
+
+
+static bool rest_cmp_handler(struct le *le, void *arg)
+{
+	const struct reg_rest *rr = le->data;
+
+	return rr->id == *(uint64_t *)arg;
+}
+
+
+static struct reg_rest *rest_lookup(const struct sipreg_group *grp,
+				    uint64_t id)
+{
+	if (!grp->rest)
+		return NULL;
+
+	return list_ledata(hash_lookup(grp->rest, (uint32_t)id,
+				       rest_cmp_handler, &id));
+}
+
+
+/* The group only keeps the challenges, it never sends credentials */
+static int group_auth_handler(char **user, char **pass, const char *rlm,
+			      void *arg)
+{
+	(void)rlm;
+	(void)arg;
+
+	return str_dup(user, "") | str_dup(pass, "");
+}
+
+
+/* Reserve the next send slot, returns the delay until the slot [us] */
+static uint64_t group_slot(struct sipreg_group *grp)
+{
+	uint64_t now, t;
+
+	if (!grp || !grp->interval)
+		return 0;
+
+	now = tmr_jiffies_usec();
+
+	if (grp->next < now)
+		grp->next = now;
+
+	t = grp->next;
+	grp->next += grp->interval;
+
+	return t - now;
+}
+
+
+static const struct uri *group_route(struct sipreg_group *grp)
+{
+	if (!grp || !grp->hop)
+		return NULL;
+
+	if (tmr_jiffies() >= grp->hop_exp) {
+		grp->hop = mem_deref(grp->hop);
+		return NULL;
+	}
+
+	return &grp->route;
+}
+
+
+static void group_learn(struct sipreg_group *grp, enum sip_transp tp,
+			const struct sa *dst)
+{
+	struct pl pl;
+	char *hop;
+
+	if (grp->hop)
+		return;
+
+	if (re_sdprintf(&hop, "sip:%J;transport=%s",
+			dst, sip_transp_name(tp)))
+		return;
+
+	pl_set_str(&pl, hop);
+
+	if (uri_decode(&grp->route, &pl)) {
+		mem_deref(hop);
+		return;
+	}
+
+	grp->hop     = hop;
+	grp->hop_exp = tmr_jiffies() + GROUP_HOP_TTL * 1000;
 }
 
 
 static uint32_t failwait(uint32_t failc)
 {
-	return min(1800, (30 * (1<<min(failc, 6)))) * (500 + rand_u16() % 501);
+	return min(1800, (30 * (1<<min(failc, 6)))) *
+		(500 + rand_fast_u16() % 501);
 }
 
 
-static void tmr_handler(void *arg)
+static void tmr_handler(void *arg);
+
+
+static void send_tmr_handler(void *arg)
 {
 	struct sipreg *reg = arg;
 	int err;
@@ -112,6 +283,21 @@ static void tmr_handler(void *arg)
 }
 
 
+static void tmr_handler(void *arg)
+{
+	struct sipreg *reg = arg;
+	uint64_t delay;
+
+	delay = group_slot(reg->grp);
+	if (delay) {
+		tmr_start_us(&reg->tmr, delay, send_tmr_handler, reg);
+		return;
+	}
+
+	send_tmr_handler(reg);
+}
+
+
 static void keepalive_handler(int err, void *arg)
 {
 	struct sipreg *reg = arg;
@@ -178,6 +364,9 @@ static void response_handler(int err, const struct sip_msg *msg, void *arg)
 	reg->wait = failwait(reg->failc + 1);
 
 	if (err || sip_request_loops(&reg->ls, msg->scode)) {
+		if (err && reg->grp)
+			reg->grp->hop = mem_deref(reg->grp->hop);
+
 		reg->failc++;
 		goto out;
 	}
@@ -191,9 +380,25 @@ static void response_handler(int err, const struct sip_msg *msg, void *arg)
 		sip_msg_hdr_apply(msg, true, SIP_HDR_CONTACT, contact_handler,
 				  reg);
 		reg->pexpires = reg->wait;
+		reg->bexp = tmr_jiffies() + (uint64_t)reg->pexpires * 1000;
 		reg->wait *= reg->rwait * (1000 / 100);
 		reg->failc = 0;
 
+		if (reg->grp) {
+			struct sipreg_group *grp = reg->grp;
+
+			reg->wait -= (uint32_t)((uint64_t)reg->wait *
+						grp->jitter * rand_fast_u16() /
+						(100 * 65536ULL));
+
+			if (reg->chall &&
+			    !sip_auth_import(grp->auth, reg->auth))
+				grp->authed = true;
+		}
+
+		reg->primed = false;
+		reg->chall  = false;
+
 		if (reg->regid > 0 && !reg->terminated && !reg->ka)
 			start_outbound(reg, msg);
 	}
@@ -205,12 +410,20 @@ static void response_handler(int err, const struct sip_msg *msg, void *arg)
 
 		case 401:
 		case 407:
+			/* the challenge of the group was not accepted */
+			if (reg->primed) {
+				sip_auth_reset(reg->auth);
+				reg->primed = false;
+			}
+
 			err = sip_auth_authenticate(reg->auth, msg);
 			if (err) {
 				err = (err == EAUTH) ? 0 : err;
 				break;
 			}
 
+			reg->chall = true;
+
 			err = request(reg, false);
 			if (err)
 				break;
@@ -259,13 +472,14 @@ static int send_handler(enum sip_transp tp, const struct sa *src,
 	struct sipreg *reg = arg;
 	int err;
 
-	(void)dst;
-
 	if (reg->expires > 0) {
 		reg->laddr = *src;
 		reg->tp = tp;
 	}
 
+	if (reg->grp)
+		group_learn(reg->grp, tp, dst);
+
 	err = mbuf_printf(mb, "Contact: <sip:%s@%J%s>;expires=%u%s%s",
 			  reg->cuser, &reg->laddr, sip_transp_param(reg->tp),
 			  reg->expires,
@@ -289,52 +503,170 @@ static int request(struct sipreg *reg, bool reset_ls)
 	if (reset_ls)
 		sip_loopstate_reset(&reg->ls);
 
-	return sip_drequestf(&reg->req, reg->sip, true, "REGISTER", reg->dlg,
-			     0, reg->auth, send_handler, response_handler, reg,
-			     "%s"
-			     "%b"
-			     "Content-Length: 0\r\n"
-			     "\r\n",
-			     reg->regid > 0
-			     ? "Supported: gruu, outbound, path\r\n" : "",
-			     reg->hdrs ? mbuf_buf(reg->hdrs) : NULL,
-			     reg->hdrs ? mbuf_get_left(reg->hdrs) : (size_t)0);
+	return sip_drequestf_route(&reg->req, reg->sip, true, "REGISTER",
+				   reg->dlg, 0, reg->auth,
+				   group_route(reg->grp),
+				   send_handler, response_handler, reg,
+				   "%s"
+				   "%b"
+				   "Content-Length: 0\r\n"
+				   "\r\n",
+				   reg->regid > 0
+				   ? "Supported: gruu, outbound, path\r\n" : "",
+				   reg->hdrs ? mbuf_buf(reg->hdrs) : NULL,
+				   reg->hdrs ? mbuf_get_left(reg->hdrs)
+				   : (size_t)0);
 }
 
 
-/**
- * Allocate a SIP Registration client
- *
- * @param regp     Pointer to allocated SIP Registration client
- * @param sip      SIP Stack instance
- * @param reg_uri  SIP Request URI
- * @param to_uri   SIP To-header URI
- * @param from_name  SIP From-header display name (optional)
- * @param from_uri SIP From-header URI
- * @param expires  Registration expiry time in [seconds]
- * @param cuser    Contact username
- * @param routev   Optional route vector
- * @param routec   Number of routes
- * @param regid    Register identification
- * @param authh    Authentication handler
- * @param aarg     Authentication handler argument
- * @param aref     True to ref argument
- * @param resph    Response handler
- * @param arg      Response handler argument
- * @param params   Optional Contact-header parameters
- * @param fmt      Formatted strings with extra SIP Headers
- *
- * @return 0 if success, otherwise errorcode
- */
-int sipreg_register(struct sipreg **regp, struct sip *sip, const char *reg_uri,
-		    const char *to_uri, const char *from_name,
-		    const char *from_uri, uint32_t expires,
-		    const char *cuser, const char *routev[], uint32_t routec,
-		    int regid, sip_auth_h *authh, void *aarg, bool aref,
-		    sip_resp_h *resph, void *arg,
-		    const char *params, const char *fmt, ...)
+static int start(struct sipreg *reg)
+{
+	struct sipreg_group *grp = reg->grp;
+
+	if (grp && grp->authed && !sip_auth_import(reg->auth, grp->auth))
+		reg->primed = true;
+
+	return request(reg, true);
+}
+
+
+static void start_handler(void *arg)
+{
+	struct sipreg *reg = arg;
+	int err;
+
+	err = start(reg);
+	if (err) {
+		tmr_start(&reg->tmr, failwait(++reg->failc), tmr_handler, reg);
+		reg->resph(err, NULL, reg->arg);
+	}
+}
+
+
+/* Identity of a client, from the parameters that define its binding */
+static uint64_t reg_id(const char *reg_uri, const char *to_uri,
+		       const char *from_name, const char *from_uri,
+		       const char *cuser, const char *routev[],
+		       uint32_t routec, int regid)
+{
+	struct mbuf *mb;
+	uint64_t id = 0;
+	uint32_t i;
+	int err;
+
+	mb = mbuf_alloc(256);
+	if (!mb)
+		return 0;
+
+	err = mbuf_printf(mb, "%s\n%s\n%s\n%s\n%s\n%d\n", reg_uri, to_uri,
+			  from_name ? from_name : "", from_uri, cuser, regid);
+
+	for (i=0; i<routec && !err; i++)
+		err = mbuf_printf(mb, "%s\n", routev[i]);
+
+	if (!err) {
+		id  = (uint64_t)hash_joaat(mb->buf, mb->end) << 32;
+		id |= hash_fast((const char *)mb->buf, mb->end);
+	}
+
+	mem_deref(mb);
+
+	return id;
+}
+
+
+/* Take over the restored binding of the client, if it is still valid */
+static int resume(struct sipreg *reg)
+{
+	struct sip_dialog *dlg = NULL;
+	char *cuser = NULL, *laddr = NULL;
+	struct reg_rest *rr;
+	uint32_t pexpires;
+	uint8_t tp;
+	struct sa sa;
+	uint64_t now;
+	int err;
+
+	if (!reg->grp || !reg->id || reg->regid > 0)
+		return ENOENT;
+
+	rr = rest_lookup(reg->grp, reg->id);
+	if (!rr)
+		return ENOENT;
+
+	now = tmr_jiffies();
+	if (rr->bexp <= now + RESUME_MIN * 1000) {
+		err = ETIMEDOUT;
+		goto out;
+	}
+
+	err = snap_str_decode(rr->mb, &cuser);
+	if (err)
+		goto out;
+
+	if (str_cmp(cuser, reg->cuser) || mbuf_get_left(rr->mb) < 5) {
+		err = EBADMSG;
+		goto out;
+	}
+
+	pexpires = ntohl(mbuf_read_u32(rr->mb));
+	tp       = mbuf_read_u8(rr->mb);
+
+	if (tp != SIP_TRANSP_UDP) {
+		err = ENOTSUP;
+		goto out;
+	}
+
+	err = snap_str_decode(rr->mb, &laddr);
+	if (err)
+		goto out;
+
+	err = sa_decode(&sa, laddr, str_len(laddr));
+	if (err)
+		goto out;
+
+	err = sip_dialog_snap_decode(&dlg, rr->mb);
+	if (err)
+		goto out;
+
+	err = sip_auth_snap_decode(reg->auth, rr->mb);
+	if (err)
+		goto out;
+
+	mem_deref(reg->dlg);
+	reg->dlg        = dlg;
+	dlg             = NULL;
+	reg->laddr      = sa;
+	reg->tp         = SIP_TRANSP_UDP;
+	reg->pexpires   = pexpires;
+	reg->bexp       = rr->bexp;
+	reg->registered = true;
+
+	/* the refresh still goes through the send slots of the group */
+	tmr_start(&reg->tmr, rr->refresh > now ? rr->refresh - now : 0,
+		  tmr_handler, reg);
+
+ out:
+	mem_deref(dlg);
+	mem_deref(cuser);
+	mem_deref(laddr);
+	mem_deref(rr);
+
+	return err;
+}
+
+
+static int reg_alloc(struct sipreg **regp, struct sip *sip,
+		     struct sipreg_group *grp, const char *reg_uri,
+		     const char *to_uri, const char *from_name,
+		     const char *from_uri, uint32_t expires,
+		     const char *cuser, const char *routev[], uint32_t routec,
+		     int regid, sip_auth_h *authh, void *aarg, bool aref,
+		     sip_resp_h *resph, void *arg,
+		     const char *params, const char *fmt, va_list ap)
 {
 	struct sipreg *reg;
+	uint64_t delay;
 	int err;
 
 	if (!regp || !sip || !reg_uri || !to_uri || !from_uri ||
@@ -362,31 +694,37 @@ int sipreg_register(struct sipreg **regp, struct sip *sip, const char *reg_uri,
 
 	/* Custom SIP headers */
 	if (fmt) {
-		va_list ap;
-
 		reg->hdrs = mbuf_alloc(256);
 		if (!reg->hdrs) {
 			err = ENOMEM;
 			goto out;
 		}
 
-		va_start(ap, fmt);
 		err = mbuf_vprintf(reg->hdrs, fmt, ap);
 		reg->hdrs->pos = 0;
-		va_end(ap);
 
 		if (err)
 			goto out;
 	}
 
 	reg->sip     = mem_ref(sip);
+	reg->grp     = mem_ref(grp);
 	reg->expires = expires;
 	reg->rwait   = 90;
 	reg->resph   = resph ? resph : dummy_handler;
 	reg->arg     = arg;
 	reg->regid   = regid;
+	reg->id      = reg_id(reg_uri, to_uri, from_name, from_uri, cuser,
+			      routev, routec, regid);
 
-	err = request(reg, true);
+	if (!resume(reg))
+		goto out;
+
+	delay = group_slot(grp);
+	if (delay)
+		tmr_start_us(&reg->tmr, delay, start_handler, reg);
+	else
+		err = start(reg);
 	if (err)
 		goto out;
 
@@ -400,6 +738,141 @@ int sipreg_register(struct sipreg **regp, struct sip *sip, const char *reg_uri,
 }
 
 
+/**
+ * Allocate a SIP Registration client
+ *
+ * @param regp     Pointer to allocated SIP Registration client
+ * @param sip      SIP Stack instance
+ * @param reg_uri  SIP Request URI
+ * @param to_uri   SIP To-header URI
+ * @param from_name  SIP From-header display name (optional)
+ * @param from_uri SIP From-header URI
+ * @param expires  Registration expiry time in [seconds]
+ * @param cuser    Contact username
+ * @param routev   Optional route vector
+ * @param routec   Number of routes
+ * @param regid    Register identification
+ * @param authh    Authentication handler
+ * @param aarg     Authentication handler argument
+ * @param aref     True to ref argument
+ * @param resph    Response handler
+ * @param arg      Response handler argument
+ * @param params   Optional Contact-header parameters
+ * @param fmt      Formatted strings with extra SIP Headers
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sipreg_register(struct sipreg **regp, struct sip *sip, const char *reg_uri,
+		    const char *to_uri, const char *from_name,
+		    const char *from_uri, uint32_t expires,
+		    const char *cuser, const char *routev[], uint32_t routec,
+		    int regid, sip_auth_h *authh, void *aarg, bool aref,
+		    sip_resp_h *resph, void *arg,
+		    const char *params, const char *fmt, ...)
+{
+	va_list ap;
+	int err;
+
+	va_start(ap, fmt);
+	err = reg_alloc(regp, sip, NULL, reg_uri, to_uri, from_name,
+			from_uri, expires, cuser, routev, routec, regid,
+			authh, aarg, aref, resph, arg, params, fmt, ap);
+	va_end(ap);
+
+	return err;
+}
+
+
+/**
+ * Allocate a group of SIP Registration clients. All clients in the group
+ * must use the same registrar and route set.
+ *
+ * @param grpp   Pointer to allocated registration group
+ * @param sip    SIP Stack instance
+ * @param rate   Maximum number of requests per second, 0 for no limit
+ * @param jitter Refresh jitter in [%] of the refresh interval, 0-50
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sipreg_group_alloc(struct sipreg_group **grpp, struct sip *sip,
+		       uint32_t rate, uint32_t jitter)
+{
+	struct sipreg_group *grp;
+	int err;
+
+	if (!grpp || !sip || jitter > 50)
+		return EINVAL;
+
+	grp = mem_zalloc(sizeof(*grp), group_destructor);
+	if (!grp)
+		return ENOMEM;
+
+	err = sip_auth_alloc(&grp->auth, group_auth_handler, NULL, false);
+	if (err) {
+		mem_deref(grp);
+		return err;
+	}
+
+	grp->sip      = mem_ref(sip);
+	grp->interval = rate ? 1000000 / rate : 0;
+	grp->jitter   = jitter;
+
+	*grpp = grp;
+
+	return 0;
+}
+
+
+/**
+ * Allocate a SIP Registration client in a registration group. The first
+ * request is sent in the next free slot of the group.
+ *
+ * @param regp     Pointer to allocated SIP Registration client
+ * @param grp      Registration group
+ * @param reg_uri  SIP Request URI
+ * @param to_uri   SIP To-header URI
+ * @param from_name  SIP From-header display name (optional)
+ * @param from_uri SIP From-header URI
+ * @param expires  Registration expiry time in [seconds]
+ * @param cuser    Contact username
+ * @param routev   Optional route vector
+ * @param routec   Number of routes
+ * @param regid    Register identification
+ * @param authh    Authentication handler
+ * @param aarg     Authentication handler argument
+ * @param aref     True to ref argument
+ * @param resph    Response handler
+ * @param arg      Response handler argument
+ * @param params   Optional Contact-header parameters
+ * @param fmt      Formatted strings with extra SIP Headers
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sipreg_group_register(struct sipreg **regp, struct sipreg_group *grp,
+			  const char *reg_uri, const char *to_uri,
+			  const char *from_name, const char *from_uri,
+			  uint32_t expires, const char *cuser,
+			  const char *routev[], uint32_t routec, int regid,
+			  sip_auth_h *authh, void *aarg, bool aref,
+			  sip_resp_h *resph, void *arg,
+			  const char *params, const char *fmt, ...)
+{
+	va_list ap;
+	int err;
+
+	if (!grp)
+		return EINVAL;
+
+	va_start(ap, fmt);
+	err = reg_alloc(regp, grp->sip, grp, reg_uri, to_uri, from_name,
+			from_uri, expires, cuser, routev, routec, regid,
+			authh, aarg, aref, resph, arg, params, fmt, ap);
+	va_end(ap);
+
+	return err;
+}
+
+
 /**
  * Set the relative registration interval in percent from proxy expiry time. A
  * value from 5-95% is accepted.
@@ -443,3 +916,143 @@ uint32_t sipreg_proxy_expires(const struct sipreg *reg)
 {
 	return reg ? reg->pexpires : 0;
 }
+
+
+/**
+ * Add the binding of a SIP Registration client to a snapshot, so that a
+ * new process can take it over with sipreg_group_restore()
+ *
+ * @param reg  SIP Registration client
+ * @param snap Snapshot
+ *
+ * @return 0 if success, ENOENT if not registered, ENOTSUP if the binding
+ *         can not be resumed, otherwise errorcode
+ */
+int sipreg_snap(const struct sipreg *reg, struct snap *snap)
+{
+	uint64_t now, brem, rrem;
+	char laddr[64];
+	struct mbuf *mb;
+	int err;
+
+	if (!reg || !snap)
+		return EINVAL;
+
+	now = tmr_jiffies();
+
+	if (!reg->registered || reg->terminated || reg->bexp <= now)
+		return ENOENT;
+
+	if (!reg->grp || !reg->id || reg->regid > 0 ||
+	    reg->tp != SIP_TRANSP_UDP)
+		return ENOTSUP;
+
+	if (re_snprintf(laddr, sizeof(laddr), "%J", &reg->laddr) < 0)
+		return ENOMEM;
+
+	brem = min(reg->bexp - now, (uint64_t)UINT32_MAX);
+	rrem = min(tmr_get_expire(&reg->tmr), (uint64_t)UINT32_MAX);
+
+	err = snap_record_begin(snap, SNAP_SIPREG, &mb);
+	if (err)
+		return err;
+
+	err  = mbuf_write_u64(mb, sys_htonll(reg->id));
+	err |= mbuf_write_u32(mb, htonl((uint32_t)brem));
+	err |= mbuf_write_u32(mb, htonl((uint32_t)rrem));
+	err |= snap_str_encode(mb, reg->cuser);
+	err |= mbuf_write_u32(mb, htonl(reg->pexpires));
+	err |= mbuf_write_u8(mb, (uint8_t)reg->tp);
+	err |= snap_str_encode(mb, laddr);
+	if (!err)
+		err = sip_dialog_snap_encode(mb, reg->dlg);
+	if (!err)
+		err = sip_auth_snap_encode(mb, reg->auth);
+
+	return snap_record_end(snap, err);
+}
+
+
+struct group_restore {
+	struct sipreg_group *grp;
+	uint64_t now;
+	uint64_t age;
+	uint32_t n;
+};
+
+
+static bool restore_handler(uint16_t type, struct mbuf *mb, void *arg)
+{
+	struct group_restore *r = arg;
+	uint64_t id, brem, rrem;
+	struct reg_rest *rr;
+	(void)type;
+
+	if (mbuf_get_left(mb) < 16)
+		return false;
+
+	id   = sys_ntohll(mbuf_read_u64(mb));
+	brem = ntohl(mbuf_read_u32(mb));
+	rrem = ntohl(mbuf_read_u32(mb));
+
+	/* expired while the process was down */
+	if (!id || brem <= r->age + RESUME_MIN * 1000)
+		return false;
+
+	if (rest_lookup(r->grp, id))
+		return false;
+
+	rr = mem_zalloc(sizeof(*rr), rest_destructor);
+	if (!rr)
+		return true;
+
+	rr->mb = mbuf_alloc(mbuf_get_left(mb));
+	if (!rr->mb || mbuf_write_mem(rr->mb, mbuf_buf(mb),
+				      mbuf_get_left(mb))) {
+		mem_deref(rr);
+		return true;
+	}
+
+	rr->mb->pos = 0;
+	rr->id      = id;
+	rr->bexp    = r->now + brem - r->age;
+	rr->refresh = r->now + (rrem > r->age ? rrem - r->age : 0);
+
+	hash_append(r->grp->rest, (uint32_t)id, &rr->he, rr);
+	++r->n;
+
+	return false;
+}
+
+
+/**
+ * Restore the bindings of a registration group from a snapshot. A client
+ * that is then allocated with sipreg_group_register() with the same
+ * parameters takes over its binding, and refreshes it when it is due,
+ * instead of registering again.
+ *
+ * @param grp  Registration group
+ * @param snap Snapshot
+ *
+ * @return Number of restored bindings
+ */
+uint32_t sipreg_group_restore(struct sipreg_group *grp,
+			      const struct snap *snap)
+{
+	struct group_restore r;
+
+	if (!grp || !snap)
+		return 0;
+
+	if (!grp->rest && hash_alloc_auto(&grp->rest, 16, rest_key))
+		return 0;
+
+	r.grp = grp;
+	r.now = tmr_jiffies();
+	r.age = (uint64_t)snap_age(snap) * 1000;
+	r.n   = 0;
+
+	(void)snap_apply(snap, SNAP_SIPREG, restore_handler, &r);
+
+	return r.n;
+}
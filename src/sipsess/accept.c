@@ -87,8 +87,7 @@ int sipsess_accept(struct sipsess **sessp, struct sipsess_sock *sock,
 	if (err)
 		goto out;
 
-	hash_append(sock->ht_sess,
-		    hash_joaat_str(sip_dialog_callid(sess->dlg)),
+	hash_append(sock->ht_sess, sip_dialog_key(sess->dlg),
 		    &sess->he, sess);
 
 	sess->msg = mem_ref((void *)msg);
@@ -89,7 +89,7 @@ int sipsess_ack(struct sipsess_sock *sock, struct sip_dialog *dlg,
 		return ENOMEM;
 
 	hash_append(sock->ht_ack,
-		    hash_joaat_str(sip_dialog_callid(dlg)),
+		    hash_fast_str(sip_dialog_callid(dlg)),
 		    &ack->he, ack);
 
 	ack->dlg  = mem_ref(dlg);
@@ -138,10 +138,18 @@ int sipsess_ack_again(struct sipsess_sock *sock, const struct sip_msg *msg)
 	struct sipsess_ack *ack;
 
 	ack = list_ledata(hash_lookup(sock->ht_ack,
-				      hash_joaat_pl(&msg->callid),
+				      hash_fast_pl(&msg->callid),
 				      cmp_handler, (void *)msg));
 	if (!ack)
 		return ENOENT;
 
 	return sip_send(sock->sip, NULL, ack->tp, &ack->dst, ack->mb);
 }
+
+
+uint32_t sipsess_ack_key(const struct le *le)
+{
+	const struct sipsess_ack *ack = le->data;
+
+	return hash_fast_str(sip_dialog_callid(ack->dlg));
+}
@@ -55,6 +55,11 @@ static void invite_resp_handler(int err, const struct sip_msg *msg, void *arg)
 		if (err)
 			goto out;
 
+		/* The remote tag is part of the key */
+		hash_unlink(&sess->he);
+		hash_append(sess->sock->ht_sess, sip_dialog_key(sess->dlg),
+			    &sess->he, sess);
+
 		if (sess->sent_offer)
 			err = sess->answerh(msg, sess->arg);
 		else {
@@ -227,8 +232,7 @@ int sipsess_connect(struct sipsess **sessp, struct sipsess_sock *sock,
 	if (err)
 		goto out;
 
-	hash_append(sock->ht_sess,
-		    hash_joaat_str(sip_dialog_callid(sess->dlg)),
+	hash_append(sock->ht_sess, sip_dialog_key(sess->dlg),
 		    &sess->he, sess);
 
 	err = invite(sess);
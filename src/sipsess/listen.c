@@ -39,6 +39,14 @@ static void internal_connect_handler(const struct sip_msg *msg, void *arg)
 }
 
 
+static uint32_t key_handler(const struct le *le)
+{
+	const struct sipsess *sess = le->data;
+
+	return sip_dialog_key(sess->dlg);
+}
+
+
 static bool cmp_handler(struct le *le, void *arg)
 {
 	struct sipsess *sess = le->data;
@@ -52,7 +60,7 @@ static struct sipsess *sipsess_find(struct sipsess_sock *sock,
 				    const struct sip_msg *msg)
 {
 	return list_ledata(hash_lookup(sock->ht_sess,
-				       hash_joaat_pl(&msg->callid),
+				       sip_dialog_msg_key(msg, true),
 				       cmp_handler, (void *)msg));
 }
 
@@ -251,7 +259,7 @@ static bool request_handler(const struct sip_msg *msg, void *arg)
 
 	if (!pl_strcmp(&msg->met, "INVITE")) {
 
-		if (pl_isset(&msg->to.tag))
+		if (pl_isset(&sip_msg_to(msg)->tag))
 			reinvite_handler(sock, msg);
 		else
 			invite_handler(sock, msg);
@@ -272,7 +280,7 @@ static bool request_handler(const struct sip_msg *msg, void *arg)
 	}
 	else if (!pl_strcmp(&msg->met, "REFER")) {
 
-		if (!pl_isset(&msg->to.tag))
+		if (!pl_isset(&sip_msg_to(msg)->tag))
 			return false;
 
 		refer_handler(sock, msg);
@@ -331,11 +339,11 @@ int sipsess_listen(struct sipsess_sock **sockp, struct sip *sip,
 	if (err)
 		goto out;
 
-	err = hash_alloc(&sock->ht_sess, htsize);
+	err = hash_alloc_auto(&sock->ht_sess, htsize, key_handler);
 	if (err)
 		goto out;
 
-	err = hash_alloc(&sock->ht_ack, htsize);
+	err = hash_alloc_auto(&sock->ht_ack, htsize, sipsess_ack_key);
 	if (err)
 		goto out;
 
@@ -77,6 +77,7 @@ int  sipsess_ack(struct sipsess_sock *sock, struct sip_dialog *dlg,
 		uint32_t cseq, struct sip_auth *auth,
 		const char *ctype, struct mbuf *desc);
 int  sipsess_ack_again(struct sipsess_sock *sock, const struct sip_msg *msg);
+uint32_t sipsess_ack_key(const struct le *le);
 int  sipsess_reply_2xx(struct sipsess *sess, const struct sip_msg *msg,
 		       uint16_t scode, const char *reason, struct mbuf *desc,
 		       const char *fmt, va_list *ap);
@@ -0,0 +1,595 @@
+/**
+ * @file snap.c  State snapshots for warm restarts
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_IO_H
+#include <io.h>
+#endif
+#include <re_types.h>
+#include <re_fmt.h>
+#include <re_mem.h>
+#include <re_mbuf.h>
+#include <re_sa.h>
+#include <re_sys.h>
+#include <re_crc32.h>
+#include <re_snap.h>
+
+
+#ifdef WIN32
+#define open  _open
+#define read  _read
+#define write _write
+#define close _close
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+
+/*
+ * A snapshot is a header followed by records, each of them a type, a
+ * length and the contents. The modules encode their own records, with
+ * times relative to when the snapshot was taken, and the header has the
+ * wall clock time of the snapshot. The records are covered by a CRC-32,
+ * so a torn or stale file is rejected as a whole and the process starts
+ * cold. The file is written next to the old one and renamed into place.
+ *
+ *   magic (4) version (2) reserved (2) time (8) count (4) crc (4)
+ *   type (2) length (4) contents ...
+ *
+ * The snapshot holds secrets such as TLS session keys, and the file is
+ * only readable by its owner.
+ */
+
+
+enum {
+	SNAP_MAGIC   = 0x52534e50,  /**< "RSNP" */
+	SNAP_VERSION = 1,
+	HDR_SIZE     = 24,
+	REC_SIZE     = 6,
+};
+
+/** Defines a state snapshot */
+struct snap {
+	struct mbuf *mb;        /**< Added records, or copy of the file */
+	void *map;              /**< Mapped snapshot file               */
+	size_t mapsz;           /**< Size of mapped file                */
+	const uint8_t *recs;    /**< Loaded records, read-only          */
+	size_t size;            /**< Size of loaded records             */
+	uint64_t time;          /**< Time of the snapshot [s]           */
+	uint32_t count;         /**< Number of records                  */
+	size_t rpos;            /**< Start of the open record, or 0     */
+};
+
+
+static void snap_destructor(void *data)
+{
+	struct snap *snap = data;
+
+	mem_deref(snap->mb);
+#ifdef HAVE_MMAP
+	if (snap->map)
+		(void)munmap(snap->map, snap->mapsz);
+#endif
+}
+
+
+/**
+ * Allocate an empty snapshot, for adding records
+ *
+ * @param snapp Pointer to allocated snapshot
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int snap_alloc(struct snap **snapp)
+{
+	struct snap *snap;
+
+	if (!snapp)
+		return EINVAL;
+
+	snap = mem_zalloc(sizeof(*snap), snap_destructor);
+	if (!snap)
+		return ENOMEM;
+
+	snap->mb = mbuf_alloc(4096);
+	if (!snap->mb) {
+		mem_deref(snap);
+		return ENOMEM;
+	}
+
+	*snapp = snap;
+
+	return 0;
+}
+
+
+/**
+ * Start a new record in a snapshot. The contents are written to the
+ * returned buffer, and the record is completed with snap_record_end().
+ *
+ * @param snap Snapshot
+ * @param type Record type (SNAP_*)
+ * @param mbp  Returned buffer for the record contents
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int snap_record_begin(struct snap *snap, uint16_t type, struct mbuf **mbp)
+{
+	int err;
+
+	if (!snap || !snap->mb || snap->recs || !type || !mbp)
+		return EINVAL;
+
+	if (snap->rpos)
+		return EALREADY;
+
+	snap->rpos = snap->mb->end + 1;
+	snap->mb->pos = snap->mb->end;
+
+	err  = mbuf_write_u16(snap->mb, htons(type));
+	err |= mbuf_write_u32(snap->mb, 0);
+	if (err) {
+		snap->mb->end = snap->rpos - 1;
+		snap->rpos = 0;
+		return err;
+	}
+
+	*mbp = snap->mb;
+
+	return 0;
+}
+
+
+/**
+ * Complete the open record of a snapshot
+ *
+ * @param snap Snapshot
+ * @param err  Result of encoding the contents, the record is dropped
+ *             if not zero
+ *
+ * @return The given errorcode, or an errorcode if the record is too long
+ */
+int snap_record_end(struct snap *snap, int err)
+{
+	size_t start, len;
+
+	if (!snap || !snap->rpos)
+		return err ? err : EINVAL;
+
+	start = snap->rpos - 1;
+	snap->rpos = 0;
+
+	len = snap->mb->end - start - REC_SIZE;
+	if (!err && len > UINT32_MAX)
+		err = EOVERFLOW;
+
+	if (err) {
+		snap->mb->end = snap->mb->pos = start;
+		return err;
+	}
+
+	snap->mb->pos = start + 2;
+	(void)mbuf_write_u32(snap->mb, htonl((uint32_t)len));
+	snap->mb->pos = snap->mb->end;
+
+	++snap->count;
+
+	return 0;
+}
+
+
+static int write_all(int fd, const uint8_t *p, size_t n)
+{
+	while (n) {
+
+		const unsigned bytes = (unsigned)min(n, (size_t)65536);
+		const ssize_t w = write(fd, p, bytes);
+		if (w < 0)
+			return errno;
+
+		p += w;
+		n -= w;
+	}
+
+	return 0;
+}
+
+
+static int hdr_encode(uint8_t *p, uint64_t t, uint32_t count,
+		      const struct mbuf *mb)
+{
+	struct mbuf hb;
+
+	hb.buf  = p;
+	hb.size = HDR_SIZE;
+	hb.pos  = 0;
+	hb.end  = 0;
+
+	return mbuf_write_u32(&hb, htonl(SNAP_MAGIC)) |
+		mbuf_write_u16(&hb, htons(SNAP_VERSION)) |
+		mbuf_write_u16(&hb, 0) |
+		mbuf_write_u64(&hb, sys_htonll(t)) |
+		mbuf_write_u32(&hb, htonl(count)) |
+		mbuf_write_u32(&hb, htonl(crc32(0, mb->buf,
+						(uint32_t)mb->end)));
+}
+
+
+/**
+ * Save a snapshot to a file. The file is replaced atomically, so a
+ * process that is killed while saving leaves the previous snapshot.
+ *
+ * @param snap Snapshot
+ * @param path Name of the snapshot file
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int snap_save(const struct snap *snap, const char *path)
+{
+	uint8_t hdr[HDR_SIZE];
+	char *tmp = NULL;
+	int fd, err;
+
+	if (!snap || !snap->mb || snap->recs || !path)
+		return EINVAL;
+
+	if (snap->rpos || snap->mb->end > UINT32_MAX)
+		return EINVAL;
+
+	err = hdr_encode(hdr, (uint64_t)time(NULL), snap->count, snap->mb);
+	if (err)
+		return err;
+
+	err = re_sdprintf(&tmp, "%s.tmp", path);
+	if (err)
+		return err;
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0600);
+	if (fd < 0) {
+		err = errno;
+		goto out;
+	}
+
+	err = write_all(fd, hdr, sizeof(hdr));
+	if (!err)
+		err = write_all(fd, snap->mb->buf, snap->mb->end);
+
+#ifdef HAVE_UNISTD_H
+	if (!err && fsync(fd))
+		err = errno;
+#endif
+
+	if (close(fd) && !err)
+		err = errno;
+
+	if (!err && rename(tmp, path))
+		err = errno;
+
+	if (err)
+		(void)remove(tmp);
+
+ out:
+	mem_deref(tmp);
+
+	return err;
+}
+
+
+static int load_file(struct mbuf *mb, int fd, size_t size)
+{
+	int err;
+
+	err = mbuf_resize(mb, size ? size : 1);
+	if (err)
+		return err;
+
+	while (mb->end < size) {
+
+		const ssize_t n = read(fd, mb->buf + mb->end,
+				       (unsigned)(size - mb->end));
+		if (n < 0)
+			return errno;
+		else if (n == 0)
+			return EBADMSG;
+
+		mb->end += n;
+	}
+
+	return 0;
+}
+
+
+/* Check the header, the checksum and the framing of all records */
+static int snap_index(struct snap *snap, const uint8_t *p, size_t size)
+{
+	struct mbuf mb;
+	uint32_t count, crc, i;
+
+	if (size < HDR_SIZE)
+		return EBADMSG;
+
+	mb.buf  = (uint8_t *)p;
+	mb.size = size;
+	mb.pos  = 0;
+	mb.end  = size;
+
+	if (ntohl(mbuf_read_u32(&mb)) != SNAP_MAGIC)
+		return EBADMSG;
+
+	if (ntohs(mbuf_read_u16(&mb)) != SNAP_VERSION)
+		return ENOTSUP;
+
+	(void)mbuf_read_u16(&mb);
+	snap->time = sys_ntohll(mbuf_read_u64(&mb));
+	count      = ntohl(mbuf_read_u32(&mb));
+	crc        = ntohl(mbuf_read_u32(&mb));
+
+	if (size - HDR_SIZE > UINT32_MAX ||
+	    crc != crc32(0, p + HDR_SIZE, (uint32_t)(size - HDR_SIZE)))
+		return EBADMSG;
+
+	for (i=0; i<count; i++) {
+
+		size_t len;
+
+		if (mbuf_get_left(&mb) < REC_SIZE)
+			return EBADMSG;
+
+		mb.pos += 2;
+		len = ntohl(mbuf_read_u32(&mb));
+
+		if (mbuf_get_left(&mb) < len)
+			return EBADMSG;
+
+		mb.pos += len;
+	}
+
+	if (mbuf_get_left(&mb))
+		return EBADMSG;
+
+	snap->recs  = p + HDR_SIZE;
+	snap->size  = size - HDR_SIZE;
+	snap->count = count;
+
+	return 0;
+}
+
+
+/**
+ * Load a snapshot from a file, by mapping it into memory where mmap()
+ * is available. The records are checked before the snapshot is used.
+ *
+ * @param snapp Pointer to loaded snapshot
+ * @param path  Name of the snapshot file
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int snap_load(struct snap **snapp, const char *path)
+{
+	struct snap *snap;
+	struct stat st;
+	int fd, err = 0;
+
+	if (!snapp || !path)
+		return EINVAL;
+
+	fd = open(path, O_RDONLY | O_BINARY);
+	if (fd < 0)
+		return errno;
+
+	if (fstat(fd, &st)) {
+		err = errno;
+		(void)close(fd);
+		return err;
+	}
+
+	if (!S_ISREG(st.st_mode) || st.st_size < HDR_SIZE) {
+		(void)close(fd);
+		return EBADMSG;
+	}
+
+	snap = mem_zalloc(sizeof(*snap), snap_destructor);
+	if (!snap) {
+		(void)close(fd);
+		return ENOMEM;
+	}
+
+#ifdef HAVE_MMAP
+	snap->mapsz = (size_t)st.st_size;
+	snap->map = mmap(NULL, snap->mapsz, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (snap->map == MAP_FAILED)
+		snap->map = NULL;
+#endif
+
+	if (snap->map) {
+		err = snap_index(snap, snap->map, snap->mapsz);
+	}
+	else {
+		snap->mb = mbuf_alloc((size_t)st.st_size);
+		if (!snap->mb)
+			err = ENOMEM;
+		else
+			err = load_file(snap->mb, fd, (size_t)st.st_size);
+
+		if (!err)
+			err = snap_index(snap, snap->mb->buf, snap->mb->end);
+	}
+
+	(void)close(fd);
+
+	if (err)
+		mem_deref(snap);
+	else
+		*snapp = snap;
+
+	return err;
+}
+
+
+/**
+ * Apply a handler to the records of a snapshot, in the order they were
+ * added
+ *
+ * @param snap Snapshot
+ * @param type Record type, or 0 for all records
+ * @param rh   Record handler
+ * @param arg  Handler argument
+ *
+ * @return 0 if all records were traversed, ECANCELED if the handler
+ *         stopped, otherwise errorcode
+ */
+int snap_apply(const struct snap *snap, uint16_t type, snap_record_h *rh,
+	       void *arg)
+{
+	struct mbuf mb, rec;
+
+	if (!snap || !rh)
+		return EINVAL;
+
+	if (snap->recs) {
+		mb.buf  = (uint8_t *)snap->recs;
+		mb.size = snap->size;
+	}
+	else {
+		mb.buf  = snap->mb->buf;
+		mb.size = snap->rpos ? snap->rpos - 1 : snap->mb->end;
+	}
+
+	mb.pos = 0;
+	mb.end = mb.size;
+
+	/* the framing was checked when the records were added or loaded */
+	while (mbuf_get_left(&mb) >= REC_SIZE) {
+
+		const uint16_t t = ntohs(mbuf_read_u16(&mb));
+		const size_t len = ntohl(mbuf_read_u32(&mb));
+
+		if (mbuf_get_left(&mb) < len)
+			return EBADMSG;
+
+		rec.buf  = mbuf_buf(&mb);
+		rec.size = len;
+		rec.pos  = 0;
+		rec.end  = len;
+
+		mb.pos += len;
+
+		if (type && t != type)
+			continue;
+
+		if (rh(t, &rec, arg))
+			return ECANCELED;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Get the number of records in a snapshot
+ *
+ * @param snap Snapshot
+ *
+ * @return Number of records
+ */
+uint32_t snap_count(const struct snap *snap)
+{
+	return snap ? snap->count : 0;
+}
+
+
+/**
+ * Get the age of a loaded snapshot, by the wall clock
+ *
+ * @param snap Snapshot
+ *
+ * @return Seconds since the snapshot was saved, 0 if it was not loaded
+ */
+uint32_t snap_age(const struct snap *snap)
+{
+	uint64_t now;
+
+	if (!snap || !snap->recs)
+		return 0;
+
+	now = (uint64_t)time(NULL);
+	if (now <= snap->time)
+		return 0;
+
+	return (uint32_t)min(now - snap->time, (uint64_t)UINT32_MAX);
+}
+
+
+/**
+ * Encode a string in a snapshot record, a NULL string is encoded as an
+ * empty string
+ *
+ * @param mb  Record buffer
+ * @param str String to encode (optional)
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int snap_str_encode(struct mbuf *mb, const char *str)
+{
+	const size_t len = str_len(str);
+	int err;
+
+	if (!mb)
+		return EINVAL;
+
+	if (len > 0xffff)
+		return EOVERFLOW;
+
+	err = mbuf_write_u16(mb, htons((uint16_t)len));
+	if (len)
+		err |= mbuf_write_mem(mb, (const uint8_t *)str, len);
+
+	return err;
+}
+
+
+/**
+ * Decode a string from a snapshot record
+ *
+ * @param mb   Record buffer
+ * @param strp Pointer to decoded string, or NULL for an empty string
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int snap_str_decode(struct mbuf *mb, char **strp)
+{
+	size_t len;
+
+	if (!mb || !strp)
+		return EINVAL;
+
+	if (mbuf_get_left(mb) < 2)
+		return EBADMSG;
+
+	len = ntohs(mbuf_read_u16(mb));
+
+	if (mbuf_get_left(mb) < len)
+		return EBADMSG;
+
+	if (!len) {
+		*strp = NULL;
+		return 0;
+	}
+
+	return mbuf_strdup(mb, strp, len);
+}
@@ -8,6 +8,7 @@
 #include <re_mem.h>
 #include <re_mbuf.h>
 #include <re_list.h>
+#include <re_bitv.h>
 #include <re_aes.h>
 #include <re_sa.h>
 #include <re_srtp.h>
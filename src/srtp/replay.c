@@ -3,26 +3,69 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
+#include <string.h>
 #include <re_types.h>
 #include <re_mbuf.h>
 #include <re_list.h>
+#include <re_bitv.h>
 #include <re_aes.h>
 #include <re_srtp.h>
 #include "srtp.h"
 
 
-enum {
-	SRTP_WINDOW_SIZE = 64
-};
+/*
+ * The replay window is a ring of bits, where index i is kept in bit
+ * (i mod size). Moving the window forward clears the bits of the skipped
+ * indices a word at a time, so the cost does not depend on the window
+ * size.
+ */
+
+
+static inline bool size_valid(uint32_t size)
+{
+	return size >= SRTP_REPLAY_MIN && size <= SRTP_REPLAY_MAX &&
+		!(size & (size - 1));
+}
+
+
+/* Clear n bits of the ring, starting at the bit after index ix */
+static void window_clear(struct replay *replay, uint64_t ix, uint64_t n)
+{
+	const uint32_t mask = replay->size - 1;
+	uint32_t i;
+
+	if (n >= replay->size) {
+		bitv_init(replay->bitv, replay->size, false);
+		return;
+	}
+
+	i = (uint32_t)(ix + 1) & mask;
 
+	while (n) {
 
-void srtp_replay_init(struct replay *replay)
+		if (!(i & BITS_MASK) && n >= BITS_SZ) {
+			replay->bitv[index2offset(i)] = 0;
+			i  = (i + BITS_SZ) & mask;
+			n -= BITS_SZ;
+		}
+		else {
+			bitv_clr(replay->bitv, i);
+			i = (i + 1) & mask;
+			--n;
+		}
+	}
+}
+
+
+void srtp_replay_init(struct replay *replay, uint32_t size)
 {
 	if (!replay)
 		return;
 
-	replay->bitmap = 0;
-	replay->lix    = 0;
+	replay->size = size_valid(size) ? size : SRTP_REPLAY_MIN;
+	replay->lix  = 0;
+
+	bitv_init(replay->bitv, replay->size, false);
 }
 
 
@@ -31,34 +74,94 @@ void srtp_replay_init(struct replay *replay)
  */
 bool srtp_replay_check(struct replay *replay, uint64_t ix)
 {
+	const uint32_t mask = replay ? replay->size - 1 : 0;
 	uint64_t diff;
 
 	if (!replay)
 		return false;
 
 	if (ix > replay->lix) {
-		diff = ix - replay->lix;
 
-		if (diff < SRTP_WINDOW_SIZE) {   /* In window */
-			replay->bitmap <<= diff;
-			replay->bitmap |= 1;     /* set bit for this packet */
-		}
-		else
-			replay->bitmap = 1;
+		window_clear(replay, replay->lix, ix - replay->lix);
+		bitv_set(replay->bitv, (uint32_t)ix & mask);
 
 		replay->lix = ix;
 		return true;
 	}
 
 	diff = replay->lix - ix;
-	if (diff >= SRTP_WINDOW_SIZE)
+	if (diff >= replay->size)
 		return false;
 
-	if (replay->bitmap & (1ULL << diff))
+	if (bitv_val(replay->bitv, (uint32_t)ix & mask))
 		return false; /* already seen */
 
 	/* mark as seen */
-	replay->bitmap |= (1ULL << diff);
+	bitv_set(replay->bitv, (uint32_t)ix & mask);
 
 	return true;
 }
+
+
+/*
+ * Check a burst of indices, in the order they were received. The window
+ * is moved once for a burst of increasing indices.
+ *
+ * Returns the number of permitted packets
+ */
+size_t srtp_replay_check_batch(struct replay *replay, const uint64_t *ixv,
+			       bool *okv, size_t n)
+{
+	const uint32_t mask = replay ? replay->size - 1 : 0;
+	size_t i, c = 0;
+
+	if (!replay || !ixv || !okv || !n)
+		return 0;
+
+	for (i=1; i<n; i++) {
+		if (ixv[i] <= ixv[i-1])
+			break;
+	}
+
+	if (i < n || ixv[0] <= replay->lix) {
+
+		for (i=0; i<n; i++) {
+			okv[i] = srtp_replay_check(replay, ixv[i]);
+			if (okv[i])
+				++c;
+		}
+
+		return c;
+	}
+
+	window_clear(replay, replay->lix, ixv[n-1] - replay->lix);
+
+	for (i=0; i<n; i++) {
+		bitv_set(replay->bitv, (uint32_t)ixv[i] & mask);
+		okv[i] = true;
+	}
+
+	replay->lix = ixv[n-1];
+
+	return n;
+}
+
+
+/**
+ * Set the size of the replay window of an SRTP session. The size applies
+ * to streams that are created after the call.
+ *
+ * @param srtp SRTP session
+ * @param size Window size in packets, a power of two from 64 to 1024
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int srtp_replay_window_set(struct srtp *srtp, uint32_t size)
+{
+	if (!srtp || !size_valid(size))
+		return EINVAL;
+
+	srtp->replay_win = size;
+
+	return 0;
+}
@@ -8,14 +8,22 @@
 #include <re_fmt.h>
 #include <re_mbuf.h>
 #include <re_list.h>
+#include <re_bitv.h>
 #include <re_hmac.h>
 #include <re_sha.h>
 #include <re_aes.h>
 #include <re_net.h>
 #include <re_srtp.h>
+#include <re_probe.h>
+#include <re_metric.h>
 #include "srtp.h"
 
 
+RE_METRIC_COUNTER_DEFINE(m_auth_fail, "re_srtp_auth_failures_total",
+			 "proto=\"srtcp\"",
+			 "Packets that failed authentication");
+
+
 static int get_rtcp_ssrc(uint32_t *ssrc, struct mbuf *mb)
 {
 	if (mbuf_get_left(mb) < 8)
@@ -183,16 +191,21 @@ int srtcp_decrypt(struct srtp *srtp, struct mbuf *mb)
 		if (err)
 			return err;
 
-		if (0 != memcmp(tag, tag_pkt, rtcp->tag_len))
+		if (0 != memcmp(tag, tag_pkt, rtcp->tag_len)) {
+			RE_PROBE2(srtcp_drop, srtp, EAUTH);
+			re_metric_inc(&m_auth_fail);
 			return EAUTH;
+		}
 
 		/*
 		 * SRTCP replay protection is as defined in Section 3.3.2,
 		 * but using the SRTCP index as the index i and a separate
 		 * Replay List that is specific to SRTCP.
 		 */
-		if (!srtp_replay_check(&strm->replay_rtcp, ix))
+		if (!srtp_replay_check(&strm->replay_rtcp, ix)) {
+			RE_PROBE2(srtcp_drop, srtp, EALREADY);
 			return EALREADY;
+		}
 	}
 
 	mb->end = eix_start;
@@ -242,8 +255,11 @@ int srtcp_decrypt(struct srtp *srtp, struct mbuf *mb)
 
 		err = aes_authenticate(rtcp->aes, &mb->buf[tag_start],
 				       GCM_TAGLEN);
-		if (err)
+		if (err) {
+			if (err == EAUTH)
+				re_metric_inc(&m_auth_fail);
 			return err;
+		}
 
 		mb->end = tag_start;
 	}
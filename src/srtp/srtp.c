@@ -9,21 +9,30 @@
 #include <re_mem.h>
 #include <re_mbuf.h>
 #include <re_list.h>
+#include <re_bitv.h>
 #include <re_hmac.h>
 #include <re_sha.h>
 #include <re_aes.h>
 #include <re_sa.h>
 #include <re_rtp.h>
 #include <re_srtp.h>
+#include <re_probe.h>
+#include <re_metric.h>
 #include "srtp.h"
 
 
 /** SRTP protocol values */
 enum {
-	MAX_KEYLEN  = 32,  /**< Maximum keylength in bytes     */
+	MAX_KEYLEN   = 32,    /**< Maximum keylength in bytes     */
+	SRTP_KS_SIZE = 8192,  /**< Batch keystream size in bytes  */
 };
 
 
+RE_METRIC_COUNTER_DEFINE(m_auth_fail, "re_srtp_auth_failures_total",
+			 "proto=\"srtp\"",
+			 "Packets that failed authentication");
+
+
 static inline int seq_diff(uint16_t x, uint16_t y)
 {
 	return (int)y - (int)x;
@@ -58,6 +67,11 @@ static int comp_init(struct comp *c, unsigned offs,
 		err = aes_alloc(&c->aes, mode, k_e, key_b*8, NULL);
 		if (err)
 			return err;
+
+		/* Optional, for the keystream of packet batches */
+		if (mode == AES_MODE_CTR &&
+		    aes_alloc(&c->ecb, AES_MODE_ECB, k_e, key_b*8, NULL))
+			c->ecb = NULL;
 	}
 
 	if (hash) {
@@ -76,10 +90,13 @@ static void destructor(void *arg)
 
 	mem_deref(srtp->rtp.aes);
 	mem_deref(srtp->rtcp.aes);
+	mem_deref(srtp->rtp.ecb);
+	mem_deref(srtp->rtcp.ecb);
 	mem_deref(srtp->rtp.hmac);
 	mem_deref(srtp->rtcp.hmac);
 
 	list_flush(&srtp->streaml);
+	mem_deref(srtp->strmv);
 }
 
 
@@ -178,21 +195,135 @@ int srtp_alloc(struct srtp **srtpp, enum srtp_suite suite,
 }
 
 
-int srtp_encrypt(struct srtp *srtp, struct mbuf *mb)
+/** Per-packet state of SRTP processing */
+struct pkt {
+	struct mbuf *mb;            /**< Packet                            */
+	struct srtp_stream *strm;   /**< SRTP stream                       */
+	size_t start;               /**< Start of RTP header               */
+	uint64_t ix;                /**< Packet index                      */
+	uint32_t roc;               /**< Roll-Over Counter for the tag     */
+	uint16_t seq;               /**< RTP sequence number               */
+};
+
+
+/* Keystream of one packet for AES-CM, using a precomputed IV */
+static int ctr_crypt(struct comp *comp, uint8_t *p, size_t len,
+		     const struct pkt *pkt)
+{
+	union vect128 iv;
+
+	srtp_iv_calc(&iv, &comp->k_s, pkt->strm->ssrc, pkt->ix);
+
+	aes_set_iv(comp->aes, iv.u8);
+
+	return aes_encr(comp->aes, p, p, len);
+}
+
+
+static void xor_ks(uint8_t *p, const uint8_t *ks, size_t len)
+{
+	size_t k;
+
+	for (k=0; k+8 <= len; k+=8) {
+		uint64_t x, y;
+
+		memcpy(&x, &p[k], 8);
+		memcpy(&y, &ks[k], 8);
+		x ^= y;
+		memcpy(&p[k], &x, 8);
+	}
+
+	for (; k<len; k++)
+		p[k] ^= ks[k];
+}
+
+
+/*
+ * AES-CM keystream for several packets in one pass. The counter blocks
+ * of all packets are encrypted with a single ECB call, so that the AES
+ * pipelines stay busy also for small packets.
+ */
+static void ctr_crypt_batch(struct comp *comp, struct pkt *pktv,
+			    int *errv, size_t n)
+{
+	uint8_t ks[SRTP_KS_SIZE];
+	size_t i = 0;
+
+	while (i < n) {
+
+		size_t j, k, nb = 0;
+
+		/* Fill the keystream buffer with counter blocks */
+		for (j = i; j < n; j++) {
+
+			struct mbuf *mb = pktv[j].mb;
+			const size_t len = mbuf_get_left(mb);
+			const size_t blocks = (len + 15) / 16;
+			union vect128 iv;
+
+			if (errv[j] || !len)
+				continue;
+
+			if (16 * (nb + blocks) > sizeof(ks))
+				break;
+
+			srtp_iv_calc(&iv, &comp->k_s, pktv[j].strm->ssrc,
+				     pktv[j].ix);
+
+			for (k=0; k<blocks; k++) {
+				iv.u16[7] = htons((uint16_t)k);
+				memcpy(&ks[16 * (nb + k)], iv.u8, 16);
+			}
+
+			nb += blocks;
+		}
+
+		/* A single packet larger than the keystream buffer */
+		if (j == i) {
+			struct mbuf *mb = pktv[i].mb;
+
+			errv[i] = ctr_crypt(comp, mbuf_buf(mb),
+					    mbuf_get_left(mb), &pktv[i]);
+			++i;
+			continue;
+		}
+
+		if (nb) {
+			int err = aes_encr(comp->ecb, ks, ks, 16 * nb);
+
+			for (k = i; err && k < j; k++) {
+				if (!errv[k] && mbuf_get_left(pktv[k].mb))
+					errv[k] = err;
+			}
+		}
+
+		nb = 0;
+
+		for (; i < j; i++) {
+
+			struct mbuf *mb = pktv[i].mb;
+			const size_t len = mbuf_get_left(mb);
+			uint8_t *p = mbuf_buf(mb);
+
+			if (errv[i] || !len)
+				continue;
+
+			xor_ks(p, &ks[16 * nb], len);
+
+			nb += (len + 15) / 16;
+		}
+	}
+}
+
+
+static int enc_begin(struct srtp *srtp, struct mbuf *mb, struct pkt *pkt)
 {
 	struct srtp_stream *strm;
 	struct rtp_header hdr;
-	struct comp *comp;
-	size_t start;
-	uint64_t ix;
 	int err;
 
-	if (!srtp || !mb)
-		return EINVAL;
-
-	comp = &srtp->rtp;
-
-	start = mb->pos;
+	pkt->mb    = mb;
+	pkt->start = mb->pos;
 
 	err = rtp_hdr_decode(&hdr, mb);
 	if (err)
@@ -208,31 +339,36 @@ int srtp_encrypt(struct srtp *srtp, struct mbuf *mb)
 		strm->s_l = 0;
 	}
 
-	ix = 65536ULL * strm->roc + hdr.seq;
+	pkt->strm = strm;
+	pkt->roc  = strm->roc;
+	pkt->seq  = hdr.seq;
+	pkt->ix   = 65536ULL * strm->roc + hdr.seq;
 
-	if (comp->aes && comp->mode == AES_MODE_CTR) {
-		union vect128 iv;
-		uint8_t *p = mbuf_buf(mb);
+	return 0;
+}
 
-		srtp_iv_calc(&iv, &comp->k_s, strm->ssrc, ix);
 
-		aes_set_iv(comp->aes, iv.u8);
-		err = aes_encr(comp->aes, p, p, mbuf_get_left(mb));
-		if (err)
-			return err;
+static int enc_cipher(struct comp *comp, const struct pkt *pkt)
+{
+	struct mbuf *mb = pkt->mb;
+	int err = 0;
+
+	if (comp->aes && comp->mode == AES_MODE_CTR) {
+
+		err = ctr_crypt(comp, mbuf_buf(mb), mbuf_get_left(mb), pkt);
 	}
 	else if (comp->aes && comp->mode == AES_MODE_GCM) {
 		union vect128 iv;
 		uint8_t *p = mbuf_buf(mb);
 		uint8_t tag[GCM_TAGLEN];
 
-		srtp_iv_calc_gcm(&iv, &comp->k_s, strm->ssrc, ix);
+		srtp_iv_calc_gcm(&iv, &comp->k_s, pkt->strm->ssrc, pkt->ix);
 
 		aes_set_iv(comp->aes, iv.u8);
 
 		/* The RTP Header is Associated Data */
-		err = aes_encr(comp->aes, NULL, &mb->buf[start],
-			       mb->pos - start);
+		err = aes_encr(comp->aes, NULL, &mb->buf[pkt->start],
+			       mb->pos - pkt->start);
 		if (err)
 			return err;
 
@@ -246,51 +382,56 @@ int srtp_encrypt(struct srtp *srtp, struct mbuf *mb)
 
 		mb->pos = mb->end;
 		err = mbuf_write_mem(mb, tag, sizeof(tag));
-		if (err)
-			return err;
 	}
 
-	if (comp->hmac) {
-		const size_t tag_start = mb->end;
-		uint8_t tag[SHA_DIGEST_LENGTH];
+	return err;
+}
 
-		mb->pos = tag_start;
 
-		err = mbuf_write_u32(mb, htonl(strm->roc));
-		if (err)
-			return err;
+static int enc_auth(struct comp *comp, const struct pkt *pkt)
+{
+	struct mbuf *mb = pkt->mb;
+	const size_t tag_start = mb->end;
+	uint8_t tag[SHA_DIGEST_LENGTH];
+	int err;
 
-		mb->pos = start;
+	if (!comp->hmac)
+		return 0;
 
-		err = hmac_digest(comp->hmac, tag, sizeof(tag),
-				  mbuf_buf(mb), mbuf_get_left(mb));
-		if (err)
-			return err;
+	mb->pos = tag_start;
 
-		mb->pos = mb->end = tag_start;
+	err = mbuf_write_u32(mb, htonl(pkt->roc));
+	if (err)
+		return err;
 
-		err = mbuf_write_mem(mb, tag, comp->tag_len);
-		if (err)
-			return err;
-	}
+	mb->pos = pkt->start;
+
+	err = hmac_digest(comp->hmac, tag, sizeof(tag),
+			  mbuf_buf(mb), mbuf_get_left(mb));
+	if (err)
+		return err;
 
-	if (hdr.seq > strm->s_l)
-		strm->s_l = hdr.seq;
+	mb->pos = mb->end = tag_start;
 
-	mb->pos = start;
+	return mbuf_write_mem(mb, tag, comp->tag_len);
+}
 
-	return 0;
+
+static void pkt_end(const struct pkt *pkt)
+{
+	struct srtp_stream *strm = pkt->strm;
+
+	if (pkt->seq > strm->s_l)
+		strm->s_l = pkt->seq;
+
+	pkt->mb->pos = pkt->start;
 }
 
 
-int srtp_decrypt(struct srtp *srtp, struct mbuf *mb)
+int srtp_encrypt(struct srtp *srtp, struct mbuf *mb)
 {
-	struct srtp_stream *strm;
-	struct rtp_header hdr;
 	struct comp *comp;
-	uint64_t ix;
-	size_t start;
-	int diff;
+	struct pkt pkt;
 	int err;
 
 	if (!srtp || !mb)
@@ -298,7 +439,33 @@ int srtp_decrypt(struct srtp *srtp, struct mbuf *mb)
 
 	comp = &srtp->rtp;
 
-	start = mb->pos;
+	err = enc_begin(srtp, mb, &pkt);
+	if (err)
+		return err;
+
+	err = enc_cipher(comp, &pkt);
+	if (err)
+		return err;
+
+	err = enc_auth(comp, &pkt);
+	if (err)
+		return err;
+
+	pkt_end(&pkt);
+
+	return 0;
+}
+
+
+static int dec_begin(struct srtp *srtp, struct mbuf *mb, struct pkt *pkt)
+{
+	struct srtp_stream *strm;
+	struct rtp_header hdr;
+	int diff;
+	int err;
+
+	pkt->mb    = mb;
+	pkt->start = mb->pos;
 
 	err = rtp_hdr_decode(&hdr, mb);
 	if (err)
@@ -318,65 +485,86 @@ int srtp_decrypt(struct srtp *srtp, struct mbuf *mb)
 		strm->s_l = 0;
 	}
 
-	ix = srtp_get_index(strm->roc, strm->s_l, hdr.seq);
+	pkt->strm = strm;
+	pkt->roc  = strm->roc;
+	pkt->seq  = hdr.seq;
+	pkt->ix   = srtp_get_index(strm->roc, strm->s_l, hdr.seq);
 
-	if (comp->hmac) {
-		uint8_t tag_calc[SHA_DIGEST_LENGTH];
-		uint8_t tag_pkt[SHA_DIGEST_LENGTH];
-		size_t pld_start, tag_start;
+	return 0;
+}
 
-		if (mbuf_get_left(mb) < comp->tag_len)
-			return EBADMSG;
 
-		pld_start = mb->pos;
-		tag_start = mb->end - comp->tag_len;
+static int dec_auth(struct comp *comp, const struct pkt *pkt)
+{
+	struct mbuf *mb = pkt->mb;
+	uint8_t tag_calc[SHA_DIGEST_LENGTH];
+	uint8_t tag_pkt[SHA_DIGEST_LENGTH];
+	size_t pld_start, tag_start;
+	int err;
 
-		mb->pos = tag_start;
+	if (!comp->hmac)
+		return 0;
 
-		err = mbuf_read_mem(mb, tag_pkt, comp->tag_len);
-		if (err)
-			return err;
+	if (mbuf_get_left(mb) < comp->tag_len)
+		return EBADMSG;
 
-		mb->pos = mb->end = tag_start;
+	pld_start = mb->pos;
+	tag_start = mb->end - comp->tag_len;
 
-		err = mbuf_write_u32(mb, htonl(strm->roc));
-		if (err)
-			return err;
+	mb->pos = tag_start;
 
-		mb->pos = start;
+	err = mbuf_read_mem(mb, tag_pkt, comp->tag_len);
+	if (err)
+		return err;
 
-		err = hmac_digest(comp->hmac, tag_calc, sizeof(tag_calc),
-				  mbuf_buf(mb), mbuf_get_left(mb));
-		if (err)
-			return err;
+	mb->pos = mb->end = tag_start;
 
-		mb->pos = pld_start;
-		mb->end = tag_start;
+	err = mbuf_write_u32(mb, htonl(pkt->roc));
+	if (err)
+		return err;
 
-		if (0 != memcmp(tag_calc, tag_pkt, comp->tag_len))
-			return EAUTH;
+	mb->pos = pkt->start;
 
-		/*
-		 * 3.3.2.  Replay Protection
-		 *
-		 * Secure replay protection is only possible when
-		 * integrity protection is present.
-		 */
-		if (!srtp_replay_check(&strm->replay_rtp, ix))
-			return EALREADY;
+	err = hmac_digest(comp->hmac, tag_calc, sizeof(tag_calc),
+			  mbuf_buf(mb), mbuf_get_left(mb));
+	if (err)
+		return err;
+
+	mb->pos = pld_start;
+	mb->end = tag_start;
+
+	if (0 != memcmp(tag_calc, tag_pkt, comp->tag_len)) {
+		re_metric_inc(&m_auth_fail);
+		return EAUTH;
 	}
 
-	if (comp->aes && comp->mode == AES_MODE_CTR) {
+	return 0;
+}
 
-		union vect128 iv;
-		uint8_t *p = mbuf_buf(mb);
 
-		srtp_iv_calc(&iv, &comp->k_s, strm->ssrc, ix);
+static int dec_replay(const struct comp *comp, const struct pkt *pkt)
+{
+	/*
+	 * 3.3.2.  Replay Protection
+	 *
+	 * Secure replay protection is only possible when
+	 * integrity protection is present.
+	 */
+	if (comp->hmac && !srtp_replay_check(&pkt->strm->replay_rtp, pkt->ix))
+		return EALREADY;
 
-		aes_set_iv(comp->aes, iv.u8);
-		err = aes_decr(comp->aes, p, p, mbuf_get_left(mb));
-		if (err)
-			return err;
+	return 0;
+}
+
+
+static int dec_cipher(struct comp *comp, const struct pkt *pkt)
+{
+	struct mbuf *mb = pkt->mb;
+	int err = 0;
+
+	if (comp->aes && comp->mode == AES_MODE_CTR) {
+
+		err = ctr_crypt(comp, mbuf_buf(mb), mbuf_get_left(mb), pkt);
 	}
 	else if (comp->aes && comp->mode == AES_MODE_GCM) {
 
@@ -384,13 +572,13 @@ int srtp_decrypt(struct srtp *srtp, struct mbuf *mb)
 		uint8_t *p = mbuf_buf(mb);
 		size_t tag_start;
 
-		srtp_iv_calc_gcm(&iv, &comp->k_s, strm->ssrc, ix);
+		srtp_iv_calc_gcm(&iv, &comp->k_s, pkt->strm->ssrc, pkt->ix);
 
 		aes_set_iv(comp->aes, iv.u8);
 
 		/* The RTP Header is Associated Data */
-		err = aes_decr(comp->aes, NULL, &mb->buf[start],
-			       mb->pos - start);
+		err = aes_decr(comp->aes, NULL, &mb->buf[pkt->start],
+			       mb->pos - pkt->start);
 		if (err)
 			return err;
 
@@ -405,8 +593,11 @@ int srtp_decrypt(struct srtp *srtp, struct mbuf *mb)
 
 		err = aes_authenticate(comp->aes, &mb->buf[tag_start],
 				       GCM_TAGLEN);
-		if (err)
+		if (err) {
+			if (err == EAUTH)
+				re_metric_inc(&m_auth_fail);
 			return err;
+		}
 
 		mb->end = tag_start;
 
@@ -416,15 +607,243 @@ int srtp_decrypt(struct srtp *srtp, struct mbuf *mb)
 		 * Secure replay protection is only possible when
 		 * integrity protection is present.
 		 */
-		if (!srtp_replay_check(&strm->replay_rtp, ix))
+		if (!srtp_replay_check(&pkt->strm->replay_rtp, pkt->ix))
 			return EALREADY;
 
 	}
 
-	if (hdr.seq > strm->s_l)
-		strm->s_l = hdr.seq;
+	return err;
+}
 
-	mb->pos = start;
 
-	return 0;
+int srtp_decrypt(struct srtp *srtp, struct mbuf *mb)
+{
+	struct comp *comp;
+	struct pkt pkt;
+	int err;
+
+	if (!srtp || !mb)
+		return EINVAL;
+
+	comp = &srtp->rtp;
+
+	err = dec_begin(srtp, mb, &pkt);
+	if (err)
+		goto out;
+
+	err = dec_auth(comp, &pkt);
+	if (err)
+		goto out;
+
+	err = dec_replay(comp, &pkt);
+	if (err)
+		goto out;
+
+	err = dec_cipher(comp, &pkt);
+	if (err)
+		goto out;
+
+	pkt_end(&pkt);
+
+ out:
+	if (err)
+		RE_PROBE2(srtp_drop, srtp, err);
+
+	return err;
+}
+
+
+/* Batches are processed in chunks of this many packets */
+#define SRTP_BATCH_CHUNK 32
+
+
+/* Check the replay windows for the authenticated packets of a chunk */
+static void dec_replay_batch(struct pkt *pktv, int *errc, size_t n)
+{
+	uint64_t ixv[SRTP_BATCH_CHUNK];
+	bool okv[SRTP_BATCH_CHUNK];
+	size_t i = 0, j, k, c;
+
+	while (i < n) {
+
+		struct srtp_stream *strm;
+
+		if (errc[i]) {
+			++i;
+			continue;
+		}
+
+		/* One call per run of packets of the same stream */
+		strm = pktv[i].strm;
+
+		for (j=i, c=0; j<n; j++) {
+
+			if (errc[j])
+				continue;
+
+			if (pktv[j].strm != strm)
+				break;
+
+			ixv[c++] = pktv[j].ix;
+		}
+
+		(void)srtp_replay_check_batch(&strm->replay_rtp, ixv, okv, c);
+
+		for (k=i, c=0; k<j; k++) {
+
+			if (errc[k])
+				continue;
+
+			if (!okv[c++])
+				errc[k] = EALREADY;
+		}
+
+		i = j;
+	}
+}
+
+
+/**
+ * Encrypt a batch of RTP packets of the same SRTP session. With AES-CM
+ * suites the keystream of all packets is generated in one pass.
+ *
+ * @param srtp SRTP session
+ * @param mbv  Vector of RTP packets, encrypted in place
+ * @param n    Number of packets
+ * @param errv Optional vector of results, one per packet
+ *
+ * @return 0 if all packets were encrypted, otherwise the first error
+ */
+int srtp_encrypt_batch(struct srtp *srtp, struct mbuf * const *mbv,
+		       size_t n, int *errv)
+{
+	struct pkt pktv[SRTP_BATCH_CHUNK];
+	int errc[SRTP_BATCH_CHUNK];
+	struct comp *comp;
+	size_t i, off;
+	int err = 0;
+
+	if (!srtp || !mbv)
+		return EINVAL;
+
+	comp = &srtp->rtp;
+
+	for (off = 0; off < n; off += SRTP_BATCH_CHUNK) {
+
+		const size_t c = min(n - off, (size_t)SRTP_BATCH_CHUNK);
+
+		for (i=0; i<c; i++) {
+
+			errc[i] = mbv[off+i] ? enc_begin(srtp, mbv[off+i],
+							 &pktv[i]) : EINVAL;
+
+			/* Later packets of the stream need the new s_l */
+			if (!errc[i] && pktv[i].seq > pktv[i].strm->s_l)
+				pktv[i].strm->s_l = pktv[i].seq;
+		}
+
+		if (comp->ecb) {
+			ctr_crypt_batch(comp, pktv, errc, c);
+		}
+		else {
+			for (i=0; i<c; i++) {
+				if (!errc[i])
+					errc[i] = enc_cipher(comp, &pktv[i]);
+			}
+		}
+
+		for (i=0; i<c; i++) {
+
+			if (!errc[i])
+				errc[i] = enc_auth(comp, &pktv[i]);
+
+			if (!errc[i])
+				pktv[i].mb->pos = pktv[i].start;
+			else if (!err)
+				err = errc[i];
+
+			if (errv)
+				errv[off+i] = errc[i];
+		}
+	}
+
+	return err;
+}
+
+
+/**
+ * Decrypt a batch of SRTP packets of the same SRTP session. With AES-CM
+ * suites all packets are authenticated first, the replay window is
+ * checked once per run of packets of a stream, and the keystream of the
+ * valid packets is generated in one pass.
+ *
+ * @param srtp SRTP session
+ * @param mbv  Vector of SRTP packets, decrypted in place
+ * @param n    Number of packets
+ * @param errv Optional vector of results, one per packet
+ *
+ * @return 0 if all packets were decrypted, otherwise the first error
+ */
+int srtp_decrypt_batch(struct srtp *srtp, struct mbuf * const *mbv,
+		       size_t n, int *errv)
+{
+	struct pkt pktv[SRTP_BATCH_CHUNK];
+	int errc[SRTP_BATCH_CHUNK];
+	struct comp *comp;
+	size_t i, off;
+	int err = 0;
+
+	if (!srtp || !mbv)
+		return EINVAL;
+
+	comp = &srtp->rtp;
+
+	for (off = 0; off < n; off += SRTP_BATCH_CHUNK) {
+
+		const size_t c = min(n - off, (size_t)SRTP_BATCH_CHUNK);
+
+		for (i=0; i<c; i++) {
+
+			errc[i] = mbv[off+i] ? dec_begin(srtp, mbv[off+i],
+							 &pktv[i]) : EINVAL;
+			if (errc[i])
+				continue;
+
+			if (comp->ecb) {
+				/* Later packets of the stream need s_l */
+				errc[i] = dec_auth(comp, &pktv[i]);
+				if (!errc[i] &&
+				    pktv[i].seq > pktv[i].strm->s_l)
+					pktv[i].strm->s_l = pktv[i].seq;
+				continue;
+			}
+
+			errc[i] = dec_auth(comp, &pktv[i]);
+			if (!errc[i])
+				errc[i] = dec_replay(comp, &pktv[i]);
+			if (!errc[i])
+				errc[i] = dec_cipher(comp, &pktv[i]);
+			if (!errc[i])
+				pkt_end(&pktv[i]);
+		}
+
+		if (comp->ecb) {
+			dec_replay_batch(pktv, errc, c);
+			ctr_crypt_batch(comp, pktv, errc, c);
+		}
+
+		for (i=0; i<c; i++) {
+
+			if (comp->ecb && !errc[i])
+				pktv[i].mb->pos = pktv[i].start;
+
+			if (errc[i] && !err)
+				err = errc[i];
+
+			if (errv)
+				errv[off+i] = errc[i];
+		}
+	}
+
+	return err;
 }
@@ -19,10 +19,17 @@ union vect128 {
 	uint8_t   u8[16];
 };
 
+/** Replay window sizes in packets */
+#define SRTP_REPLAY_MIN   (64)    /**< Default and minimum window size */
+#ifndef SRTP_REPLAY_MAX
+#define SRTP_REPLAY_MAX   (1024)  /**< Maximum window size             */
+#endif
+
 /** Replay protection */
 struct replay {
-	uint64_t bitmap;   /**< Session state - must be 64 bits */
-	uint64_t lix;      /**< Last received index             */
+	BITV_DECL(bitv, SRTP_REPLAY_MAX);  /**< Ring of received indices */
+	uint64_t lix;                      /**< Last received index      */
+	uint32_t size;                     /**< Window size, power of 2  */
 };
 
 /** SRTP stream/context -- shared state between RTP/RTCP */
@@ -41,6 +48,7 @@ struct srtp_stream {
 struct srtp {
 	struct comp {
 		struct aes *aes;    /**< AES Context                       */
+		struct aes *ecb;    /**< AES-ECB Context for batches       */
 		enum aes_mode mode; /**< AES encryption mode               */
 		struct hmac *hmac;  /**< HMAC Context                      */
 		union vect128 k_s;  /**< Derived salting key (14 bytes)    */
@@ -48,6 +56,12 @@ struct srtp {
 	} rtp, rtcp;
 
 	struct list streaml;        /**< SRTP-streams (struct srtp_stream) */
+	struct srtp_stream **strmv; /**< Streams indexed by SSRC           */
+	struct srtp_stream *last;   /**< Most recently used stream         */
+	uint32_t strmc;             /**< Number of streams                 */
+	uint32_t strm_max;          /**< Maximum number of streams         */
+	uint32_t strmv_mask;        /**< Index size minus one              */
+	uint32_t replay_win;        /**< Replay window size, 0 for default */
 };
 
 
@@ -68,5 +82,7 @@ uint64_t srtp_get_index(uint32_t roc, uint16_t s_l, uint16_t seq);
 
 /* Replay protection */
 
-void srtp_replay_init(struct replay *replay);
+void srtp_replay_init(struct replay *replay, uint32_t size);
 bool srtp_replay_check(struct replay *replay, uint64_t ix);
+size_t srtp_replay_check_batch(struct replay *replay, const uint64_t *ixv,
+			       bool *okv, size_t n);
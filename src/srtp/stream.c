@@ -3,10 +3,12 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
+#include <string.h>
 #include <re_types.h>
 #include <re_mem.h>
 #include <re_mbuf.h>
 #include <re_list.h>
+#include <re_bitv.h>
 #include <re_aes.h>
 #include <re_srtp.h>
 #include "srtp.h"
@@ -14,10 +16,17 @@
 
 /** SRTP protocol values */
 #ifndef SRTP_MAX_STREAMS
-#define SRTP_MAX_STREAMS  (8)  /**< Maximum number of SRTP streams */
+#define SRTP_MAX_STREAMS  (64)  /**< Maximum number of SRTP streams */
 #endif
 
 
+/*
+ * Streams are indexed by SSRC in an open-addressed table, which is kept
+ * at most half full. Streams are only removed when the SRTP session is
+ * destroyed, so the table needs no deletion.
+ */
+
+
 static void stream_destructor(void *arg)
 {
 	struct srtp_stream *strm = arg;
@@ -26,39 +35,100 @@ static void stream_destructor(void *arg)
 }
 
 
+static inline uint32_t ssrc_hash(uint32_t ssrc)
+{
+	return (ssrc * 0x9e3779b1u) >> 7;
+}
+
+
 static struct srtp_stream *stream_find(struct srtp *srtp, uint32_t ssrc)
 {
-	struct le *le;
+	struct srtp_stream *strm = srtp->last;
+	uint32_t i;
+
+	if (strm && strm->ssrc == ssrc)
+		return strm;
+
+	if (!srtp->strmv)
+		return NULL;
 
-	for (le = srtp->streaml.head; le; le = le->next) {
+	for (i = ssrc_hash(ssrc);; i++) {
 
-		struct srtp_stream *strm = le->data;
+		strm = srtp->strmv[i & srtp->strmv_mask];
 
-		if (strm->ssrc == ssrc)
+		if (!strm)
+			return NULL;
+
+		if (strm->ssrc == ssrc) {
+			srtp->last = strm;
 			return strm;
+		}
 	}
+}
+
+
+static void index_add(struct srtp_stream **strmv, uint32_t mask,
+		      struct srtp_stream *strm)
+{
+	uint32_t i = ssrc_hash(strm->ssrc);
+
+	while (strmv[i & mask])
+		++i;
+
+	strmv[i & mask] = strm;
+}
+
 
-	return NULL;
+static int index_grow(struct srtp *srtp)
+{
+	const uint32_t sz = srtp->strmv ? 2 * (srtp->strmv_mask + 1) : 8;
+	struct srtp_stream **strmv;
+	struct le *le;
+
+	strmv = mem_zalloc(sz * sizeof(*strmv), NULL);
+	if (!strmv)
+		return ENOMEM;
+
+	for (le = srtp->streaml.head; le; le = le->next)
+		index_add(strmv, sz - 1, le->data);
+
+	mem_deref(srtp->strmv);
+	srtp->strmv = strmv;
+	srtp->strmv_mask = sz - 1;
+
+	return 0;
 }
 
 
 static int stream_new(struct srtp_stream **strmp, struct srtp *srtp,
 		      uint32_t ssrc)
 {
+	const uint32_t max = srtp->strm_max ? srtp->strm_max
+		: SRTP_MAX_STREAMS;
 	struct srtp_stream *strm;
+	int err;
 
-	if (list_count(&srtp->streaml) >= SRTP_MAX_STREAMS)
+	if (srtp->strmc >= max)
 		return ENOSR;
 
+	if (!srtp->strmv || 2 * (srtp->strmc + 1) > srtp->strmv_mask + 1) {
+		err = index_grow(srtp);
+		if (err)
+			return err;
+	}
+
 	strm = mem_zalloc(sizeof(*strm), stream_destructor);
 	if (!strm)
 		return ENOMEM;
 
 	strm->ssrc = ssrc;
-	srtp_replay_init(&strm->replay_rtp);
-	srtp_replay_init(&strm->replay_rtcp);
+	srtp_replay_init(&strm->replay_rtp, srtp->replay_win);
+	srtp_replay_init(&strm->replay_rtcp, srtp->replay_win);
 
 	list_append(&srtp->streaml, &strm->le, strm);
+	index_add(srtp->strmv, srtp->strmv_mask, strm);
+	++srtp->strmc;
+	srtp->last = strm;
 
 	if (strmp)
 		*strmp = strm;
@@ -107,3 +177,18 @@ int stream_get_seq(struct srtp_stream **strmp, struct srtp *srtp,
 
 	return 0;
 }
+
+
+/**
+ * Set the maximum number of streams (SSRCs) of an SRTP session
+ *
+ * @param srtp SRTP session
+ * @param n    Maximum number of streams, 0 for the default
+ */
+void srtp_max_streams_set(struct srtp *srtp, uint32_t n)
+{
+	if (!srtp)
+		return;
+
+	srtp->strm_max = n;
+}
@@ -14,6 +14,7 @@
 #include <re_srtp.h>
 #include <re_tls.h>
 #include <re_list.h>
+#include <re_hash.h>
 #include <re_tmr.h>
 #include <re_md5.h>
 #include <re_stun.h>
@@ -41,13 +42,27 @@ struct stun_ctrans {
 };
 
 
+static inline uint32_t tid_key(const uint8_t *tid)
+{
+	return hash_joaat(tid, STUN_TID_SIZE);
+}
+
+
+uint32_t stun_ctrans_key(const struct le *le)
+{
+	const struct stun_ctrans *ct = le->data;
+
+	return tid_key(ct->tid);
+}
+
+
 static void completed(struct stun_ctrans *ct, int err, uint16_t scode,
 		      const char *reason, const struct stun_msg *msg)
 {
 	stun_resp_h *resph = ct->resph;
 	void *arg = ct->arg;
 
-	list_unlink(&ct->le);
+	hash_unlink(&ct->le);
 	tmr_cancel(&ct->tmr);
 
 	if (ct->ctp) {
@@ -69,7 +84,7 @@ static void destructor(void *arg)
 {
 	struct stun_ctrans *ct = arg;
 
-	list_unlink(&ct->le);
+	hash_unlink(&ct->le);
 	tmr_cancel(&ct->tmr);
 	mem_deref(ct->key);
 	mem_deref(ct->sock);
@@ -186,8 +201,9 @@ int stun_ctrans_recv(struct stun *stun, const struct stun_msg *msg,
 		/*@fallthrough@*/
 
 	case STUN_CLASS_SUCCESS_RESP:
-		ct = list_ledata(list_apply(&stun->ctl, true,
-					    match_handler, (void *)msg));
+		ct = list_ledata(hash_lookup(stun->ht_ctrans,
+					     tid_key(stun_msg_tid(msg)),
+					     match_handler, (void *)msg));
 		if (!ct) {
 			err = ENOENT;
 			break;
@@ -239,8 +255,8 @@ int stun_ctrans_request(struct stun_ctrans **ctp, struct stun *stun, int proto,
 	if (!ct)
 		return ENOMEM;
 
-	list_append(&stun->ctl, &ct->le, ct);
 	memcpy(ct->tid, tid, STUN_TID_SIZE);
+	hash_append(stun->ht_ctrans, tid_key(ct->tid), &ct->le, ct);
 	ct->proto = proto;
 	ct->sock  = mem_ref(sock);
 	ct->mb    = mem_ref(mb);
@@ -348,7 +364,7 @@ void stun_ctrans_close(struct stun *stun)
 	if (!stun)
 		return;
 
-	(void)list_apply(&stun->ctl, true, close_handler, NULL);
+	(void)hash_apply(stun->ht_ctrans, close_handler, NULL);
 }
 
 
@@ -370,17 +386,30 @@ static bool debug_handler(struct le *le, void *arg)
 }
 
 
+static bool count_handler(struct le *le, void *arg)
+{
+	uint32_t *n = arg;
+	(void)le;
+
+	++*n;
+
+	return false;
+}
+
+
 int stun_ctrans_debug(struct re_printf *pf, const struct stun *stun)
 {
+	uint32_t n = 0;
 	int err;
 
 	if (!stun)
 		return 0;
 
-	err = re_hprintf(pf, "STUN client transactions: (%u)\n",
-			 list_count(&stun->ctl));
+	(void)hash_apply(stun->ht_ctrans, count_handler, &n);
+
+	err = re_hprintf(pf, "STUN client transactions: (%u)\n", n);
 
-	(void)list_apply(&stun->ctl, true, debug_handler, pf);
+	(void)hash_apply(stun->ht_ctrans, debug_handler, pf);
 
 	return err;
 }
@@ -3,6 +3,7 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
+#include <string.h>
 #include <re_types.h>
 #include <re_mbuf.h>
 #include <re_sa.h>
@@ -13,17 +14,21 @@
 
 int stun_hdr_encode(struct mbuf *mb, const struct stun_hdr *hdr)
 {
-	int err = 0;
+	uint8_t *p;
 
 	if (!mb || !hdr)
 		return EINVAL;
 
-	err |= mbuf_write_u16(mb, htons(hdr->type & 0x3fff));
-	err |= mbuf_write_u16(mb, htons(hdr->len));
-	err |= mbuf_write_u32(mb, htonl(hdr->cookie));
-	err |= mbuf_write_mem(mb, hdr->tid, sizeof(hdr->tid));
+	p = mbuf_reserve(mb, STUN_HEADER_SIZE);
+	if (!p)
+		return ENOMEM;
 
-	return err;
+	p = mbuf_store_u16(p, hdr->type & 0x3fff);
+	p = mbuf_store_u16(p, hdr->len);
+	p = mbuf_store_u32(p, hdr->cookie);
+	memcpy(p, hdr->tid, sizeof(hdr->tid));
+
+	return 0;
 }
 
 
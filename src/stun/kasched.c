@@ -0,0 +1,288 @@
+/**
+ * @file stun/kasched.c  Shared scheduler for keepalives and consent
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <stdlib.h>
+#include <re_types.h>
+#include <re_mem.h>
+#include <re_mbuf.h>
+#include <re_list.h>
+#include <re_tmr.h>
+#include <re_sa.h>
+#include <re_udp.h>
+#include <re_sys.h>
+#include <re_stun.h>
+
+
+/*
+ * The interval is split into slots, and each entry is put in a random
+ * slot. One timer walks through the slots, so the sends of many
+ * sessions are spread evenly over the interval instead of arriving in
+ * waves. Datagrams that are queued while a slot is handled are sent
+ * together, with one batch per UDP socket.
+ */
+
+
+enum {
+	BATCH_SIZE = 32,
+};
+
+
+struct pkt {
+	struct udp_sock *us;
+	struct sa dst;
+	struct mbuf *mb;
+};
+
+/** Defines a shared keepalive scheduler */
+struct stun_kasched {
+	struct tmr tmr;
+	struct list *slotv;
+	uint32_t slotc;
+	uint32_t cur;
+	uint32_t ival;
+	struct pkt *pktv;
+	size_t pktc;
+	size_t pktsz;
+	bool tick;
+};
+
+/** Defines an entry in a keepalive scheduler */
+struct stun_kaent {
+	struct le le;
+	struct stun_kasched *ks;
+	stun_kasched_h *h;
+	void *arg;
+};
+
+
+static void tmr_handler(void *arg);
+
+
+static void sched_destructor(void *data)
+{
+	struct stun_kasched *ks = data;
+
+	tmr_cancel(&ks->tmr);
+	mem_deref(ks->slotv);
+	mem_deref(ks->pktv);
+}
+
+
+static void ent_destructor(void *data)
+{
+	struct stun_kaent *ent = data;
+
+	list_unlink(&ent->le);
+	mem_deref(ent->ks);
+}
+
+
+static int pkt_cmp(const void *a, const void *b)
+{
+	const struct pkt *pa = a, *pb = b;
+	const uintptr_t ua = (uintptr_t)pa->us, ub = (uintptr_t)pb->us;
+
+	return ua < ub ? -1 : ua > ub;
+}
+
+
+static void flush(struct stun_kasched *ks)
+{
+	struct udp_dgram dv[BATCH_SIZE];
+	size_t i, j, n;
+
+	if (ks->pktc > 1)
+		qsort(ks->pktv, ks->pktc, sizeof(*ks->pktv), pkt_cmp);
+
+	for (i=0; i<ks->pktc; i+=n) {
+
+		struct udp_sock *us = ks->pktv[i].us;
+
+		for (n=0; i+n < ks->pktc && n < BATCH_SIZE; n++) {
+
+			const struct pkt *pkt = &ks->pktv[i+n];
+
+			if (pkt->us != us)
+				break;
+
+			dv[n].dst   = &pkt->dst;
+			dv[n].mb    = pkt->mb;
+			dv[n].segsz = 0;
+		}
+
+		(void)udp_send_batch(us, dv, n, NULL);
+
+		for (j=0; j<n; j++) {
+			mem_deref(ks->pktv[i+j].mb);
+			mem_deref(ks->pktv[i+j].us);
+		}
+	}
+
+	ks->pktc = 0;
+}
+
+
+static void tmr_handler(void *arg)
+{
+	struct stun_kasched *ks = arg;
+	struct list *slot = &ks->slotv[ks->cur];
+	struct list tmp = LIST_INIT;
+	struct le *le;
+
+	/* the last entry may hold the last reference */
+	mem_ref(ks);
+
+	tmr_start(&ks->tmr, ks->ival, tmr_handler, ks);
+
+	ks->cur = (ks->cur + 1) % ks->slotc;
+
+	/* entries may be removed or added by the handlers */
+	while ((le = slot->head)) {
+		list_unlink(le);
+		list_append(&tmp, le, le->data);
+	}
+
+	ks->tick = true;
+
+	while ((le = tmp.head)) {
+
+		struct stun_kaent *ent = le->data;
+
+		list_unlink(le);
+		list_append(slot, le, ent);
+
+		ent->h(ent->arg);
+	}
+
+	ks->tick = false;
+
+	flush(ks);
+
+	mem_deref(ks);
+}
+
+
+/**
+ * Allocate a shared scheduler for keepalives and consent checks. Each
+ * entry is called once per interval, at a random offset.
+ *
+ * @param ksp      Pointer to allocated scheduler
+ * @param interval Interval in [ms]
+ * @param slotc    Number of slots the interval is split into
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int stun_kasched_alloc(struct stun_kasched **ksp, uint32_t interval,
+		       uint32_t slotc)
+{
+	struct stun_kasched *ks;
+	uint32_t i;
+
+	if (!ksp || !slotc || interval < slotc)
+		return EINVAL;
+
+	ks = mem_zalloc(sizeof(*ks), sched_destructor);
+	if (!ks)
+		return ENOMEM;
+
+	ks->slotv = mem_alloc(slotc * sizeof(*ks->slotv), NULL);
+	if (!ks->slotv) {
+		mem_deref(ks);
+		return ENOMEM;
+	}
+
+	for (i=0; i<slotc; i++)
+		list_init(&ks->slotv[i]);
+
+	ks->slotc = slotc;
+	ks->ival  = interval / slotc;
+
+	tmr_start(&ks->tmr, ks->ival, tmr_handler, ks);
+
+	*ksp = ks;
+
+	return 0;
+}
+
+
+/**
+ * Add an entry to a keepalive scheduler. The entry is removed when it
+ * is dereferenced.
+ *
+ * @param entp Pointer to allocated entry
+ * @param ks   Keepalive scheduler
+ * @param h    Handler called once per interval
+ * @param arg  Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int stun_kasched_add(struct stun_kaent **entp, struct stun_kasched *ks,
+		     stun_kasched_h *h, void *arg)
+{
+	struct stun_kaent *ent;
+
+	if (!entp || !ks || !h)
+		return EINVAL;
+
+	ent = mem_zalloc(sizeof(*ent), ent_destructor);
+	if (!ent)
+		return ENOMEM;
+
+	ent->ks  = mem_ref(ks);
+	ent->h   = h;
+	ent->arg = arg;
+
+	list_append(&ks->slotv[rand_fast_u32() % ks->slotc], &ent->le, ent);
+
+	*entp = ent;
+
+	return 0;
+}
+
+
+/**
+ * Send a UDP datagram from a keepalive handler. The datagrams of one
+ * slot are sent in batches after all its handlers were called. Outside
+ * of a handler the datagram is sent at once.
+ *
+ * @param ks  Keepalive scheduler
+ * @param us  UDP Socket
+ * @param dst Destination address
+ * @param mb  Buffer to send, from the current position
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int stun_kasched_send(struct stun_kasched *ks, struct udp_sock *us,
+		      const struct sa *dst, struct mbuf *mb)
+{
+	struct pkt *pkt;
+
+	if (!ks || !us || !dst || !mb)
+		return EINVAL;
+
+	if (!ks->tick)
+		return udp_send(us, dst, mb);
+
+	if (ks->pktc >= ks->pktsz) {
+
+		const size_t sz = ks->pktsz ? 2 * ks->pktsz : BATCH_SIZE;
+		struct pkt *pktv;
+
+		pktv = mem_reallocarray(ks->pktv, sz, sizeof(*pktv), NULL);
+		if (!pktv)
+			return ENOMEM;
+
+		ks->pktv  = pktv;
+		ks->pktsz = sz;
+	}
+
+	pkt = &ks->pktv[ks->pktc++];
+
+	pkt->us  = mem_ref(us);
+	pkt->dst = *dst;
+	pkt->mb  = mem_ref(mb);
+
+	return 0;
+}
@@ -27,6 +27,7 @@ struct stun_keepalive {
 	void *sock;
 	struct sa dst;
 	struct tmr tmr;           /**< Refresh timer                        */
+	struct stun_kaent *kae;   /**< Shared scheduler entry (optional)    */
 	uint32_t interval;        /**< Refresh interval in seconds          */
 	stun_mapped_addr_h *mah;  /**< Mapped address handler               */
 	void *arg;                /**< Handler argument                     */
@@ -44,6 +45,7 @@ static void keepalive_destructor(void *data)
 
 	tmr_cancel(&ska->tmr);
 
+	mem_deref(ska->kae);
 	mem_deref(ska->ct);
 	mem_deref(ska->uh);
 	mem_deref(ska->sock);
@@ -241,8 +243,34 @@ void stun_keepalive_enable(struct stun_keepalive *ska, uint32_t interval)
 		return;
 
 	ska->interval = interval;
+	ska->kae = mem_deref(ska->kae);
 
 	tmr_cancel(&ska->tmr);
 	if (interval > 0)
 		tmr_start(&ska->tmr, 1, timeout, ska);
 }
+
+
+/**
+ * Send the keepalives from a shared scheduler instead of a timer of
+ * their own. The interval of the scheduler is used.
+ *
+ * @param ska Keepalive object
+ * @param ks  Keepalive scheduler, NULL to stop
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int stun_keepalive_sched(struct stun_keepalive *ska, struct stun_kasched *ks)
+{
+	if (!ska)
+		return EINVAL;
+
+	ska->interval = 0;
+	ska->kae = mem_deref(ska->kae);
+	tmr_cancel(&ska->tmr);
+
+	if (!ks)
+		return 0;
+
+	return stun_kasched_add(&ska->kae, ks, timeout, ska);
+}
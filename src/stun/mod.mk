@@ -10,9 +10,11 @@ SRCS	+= stun/ctrans.c
 SRCS	+= stun/dnsdisc.c
 SRCS	+= stun/hdr.c
 SRCS	+= stun/ind.c
+SRCS	+= stun/kasched.c
 SRCS	+= stun/keepalive.c
 SRCS	+= stun/msg.c
 SRCS	+= stun/rep.c
 SRCS	+= stun/req.c
 SRCS	+= stun/stun.c
 SRCS	+= stun/stunstr.c
+SRCS	+= stun/view.c
@@ -376,20 +376,12 @@ int stun_msg_encode(struct mbuf *mb, uint16_t method, uint8_t class,
 }
 
 
-/**
- * Verify the Message-Integrity of a STUN message
- *
- * @param msg    STUN Message
- * @param key    Authentication key
- * @param keylen Number of bytes in authentication key
- *
- * @return 0 if verified, otherwise errorcode
- */
-int stun_msg_chk_mi(const struct stun_msg *msg, const uint8_t *key,
-		    size_t keylen)
+static int chk_mi(const struct stun_msg *msg, const uint8_t *key,
+		  size_t keylen, struct hmac *hc)
 {
 	uint8_t hmac[SHA_DIGEST_LENGTH];
 	struct stun_attr *mi, *fp;
+	int err = 0;
 
 	if (!msg)
 		return EINVAL;
@@ -407,9 +399,15 @@ int stun_msg_chk_mi(const struct stun_msg *msg, const uint8_t *key,
 		msg->mb->pos -= STUN_HEADER_SIZE;
 	}
 
-	hmac_sha1(key, keylen, mbuf_buf(msg->mb),
-		  STUN_HEADER_SIZE + msg->hdr.len - MI_SIZE,
-		  hmac, sizeof(hmac));
+	if (hc) {
+		err = hmac_digest(hc, hmac, sizeof(hmac), mbuf_buf(msg->mb),
+				  STUN_HEADER_SIZE + msg->hdr.len - MI_SIZE);
+	}
+	else {
+		hmac_sha1(key, keylen, mbuf_buf(msg->mb),
+			  STUN_HEADER_SIZE + msg->hdr.len - MI_SIZE,
+			  hmac, sizeof(hmac));
+	}
 
 	if (fp) {
 		((struct stun_msg *)msg)->hdr.len += FP_SIZE;
@@ -417,6 +415,9 @@ int stun_msg_chk_mi(const struct stun_msg *msg, const uint8_t *key,
 		msg->mb->pos -= STUN_HEADER_SIZE;
 	}
 
+	if (err)
+		return err;
+
 	if (memcmp(mi->v.msg_integrity, hmac, SHA_DIGEST_LENGTH))
 		return EBADMSG;
 
@@ -424,6 +425,41 @@ int stun_msg_chk_mi(const struct stun_msg *msg, const uint8_t *key,
 }
 
 
+/**
+ * Verify the Message-Integrity of a STUN message
+ *
+ * @param msg    STUN Message
+ * @param key    Authentication key
+ * @param keylen Number of bytes in authentication key
+ *
+ * @return 0 if verified, otherwise errorcode
+ */
+int stun_msg_chk_mi(const struct stun_msg *msg, const uint8_t *key,
+		    size_t keylen)
+{
+	return chk_mi(msg, key, keylen, NULL);
+}
+
+
+/**
+ * Verify the Message-Integrity of a STUN message, using an HMAC-SHA1
+ * context that was created with the authentication key. This is faster
+ * than stun_msg_chk_mi() when many messages use the same key.
+ *
+ * @param msg    STUN Message
+ * @param hmac   HMAC-SHA1 context
+ *
+ * @return 0 if verified, otherwise errorcode
+ */
+int stun_msg_chk_mi_hmac(const struct stun_msg *msg, struct hmac *hmac)
+{
+	if (!hmac)
+		return EINVAL;
+
+	return chk_mi(msg, NULL, 0, hmac);
+}
+
+
 /**
  * Check the Fingerprint of a STUN message
  *
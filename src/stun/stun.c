@@ -14,6 +14,7 @@
 #include <re_tls.h>
 #include <re_sys.h>
 #include <re_list.h>
+#include <re_hash.h>
 #include <re_stun.h>
 #include "stun.h"
 
@@ -35,6 +36,7 @@ static void destructor(void *arg)
 	struct stun *stun = arg;
 
 	stun_ctrans_close(stun);
+	mem_deref(stun->ht_ctrans);
 }
 
 
@@ -52,6 +54,7 @@ int stun_alloc(struct stun **stunp, const struct stun_conf *conf,
 	       stun_ind_h *indh, void *arg)
 {
 	struct stun *stun;
+	int err;
 
 	if (!stunp)
 		return EINVAL;
@@ -60,6 +63,12 @@ int stun_alloc(struct stun **stunp, const struct stun_conf *conf,
 	if (!stun)
 		return ENOMEM;
 
+	err = hash_alloc_auto(&stun->ht_ctrans, 16, stun_ctrans_key);
+	if (err) {
+		mem_deref(stun);
+		return err;
+	}
+
 	stun->conf = conf ? *conf : conf_default;
 	stun->indh = indh;
 	stun->arg  = arg;
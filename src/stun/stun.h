@@ -37,7 +37,7 @@ struct stun_hdr {
 
 
 struct stun {
-	struct list ctl;
+	struct hash *ht_ctrans;
 	struct stun_conf conf;
 	stun_ind_h *indh;
 	void *arg;
@@ -61,4 +61,5 @@ int stun_ctrans_request(struct stun_ctrans **ctp, struct stun *stun, int proto,
 			const uint8_t tid[], uint16_t met, const uint8_t *key,
 			size_t keylen, stun_resp_h *resph, void *arg);
 void stun_ctrans_close(struct stun *stun);
+uint32_t stun_ctrans_key(const struct le *le);
 int  stun_ctrans_debug(struct re_printf *pf, const struct stun *stun);
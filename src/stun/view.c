@@ -0,0 +1,430 @@
+/**
+ * @file stun/view.c  STUN message decoding in place
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re_types.h>
+#include <re_mbuf.h>
+#include <re_sa.h>
+#include <re_list.h>
+#include <re_fmt.h>
+#include <re_sys.h>
+#include <re_sha.h>
+#include <re_hmac.h>
+#include <re_crc32.h>
+#include <re_stun.h>
+#include "stun.h"
+
+
+enum {
+	MI_SIZE = 20,
+	FP_SIZE = 4,
+};
+
+
+static int attr_slot(uint16_t type)
+{
+	switch (type) {
+
+	case STUN_ATTR_MAPPED_ADDR:     return 0;
+	case STUN_ATTR_CHANGE_REQ:      return 1;
+	case STUN_ATTR_USERNAME:        return 2;
+	case STUN_ATTR_MSG_INTEGRITY:   return 3;
+	case STUN_ATTR_ERR_CODE:        return 4;
+	case STUN_ATTR_UNKNOWN_ATTR:    return 5;
+	case STUN_ATTR_CHANNEL_NUMBER:  return 6;
+	case STUN_ATTR_LIFETIME:        return 7;
+	case STUN_ATTR_XOR_PEER_ADDR:   return 8;
+	case STUN_ATTR_DATA:            return 9;
+	case STUN_ATTR_REALM:           return 10;
+	case STUN_ATTR_NONCE:           return 11;
+	case STUN_ATTR_XOR_RELAY_ADDR:  return 12;
+	case STUN_ATTR_REQ_ADDR_FAMILY: return 13;
+	case STUN_ATTR_EVEN_PORT:       return 14;
+	case STUN_ATTR_REQ_TRANSPORT:   return 15;
+	case STUN_ATTR_DONT_FRAGMENT:   return 16;
+	case STUN_ATTR_XOR_MAPPED_ADDR: return 17;
+	case STUN_ATTR_RSV_TOKEN:       return 18;
+	case STUN_ATTR_PRIORITY:        return 19;
+	case STUN_ATTR_USE_CAND:        return 20;
+	case STUN_ATTR_PADDING:         return 21;
+	case STUN_ATTR_RESP_PORT:       return 22;
+	case STUN_ATTR_SOFTWARE:        return 23;
+	case STUN_ATTR_ALT_SERVER:      return 24;
+	case STUN_ATTR_FINGERPRINT:     return 25;
+	case STUN_ATTR_CONTROLLED:      return 26;
+	case STUN_ATTR_CONTROLLING:     return 27;
+	case STUN_ATTR_RESP_ORIGIN:     return 28;
+	case STUN_ATTR_OTHER_ADDR:      return 29;
+	default:                        return -1;
+	}
+}
+
+
+static inline uint16_t rd16(const uint8_t *p)
+{
+	return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+
+static inline uint32_t rd32(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+		(uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
+
+
+/**
+ * Decode a buffer to a STUN message view. The view is filled in by the
+ * caller, and its attributes point into the buffer, so no memory is
+ * allocated. Only the first attribute of each known type is kept, and
+ * attribute values are checked when they are read.
+ *
+ * @param view STUN message view to decode into
+ * @param mb   Buffer containing the raw STUN packet
+ * @param ua   Unknown attributes (optional)
+ *
+ * @return 0 if success, otherwise errorcode
+ *
+ * @note `mb' is not referenced, and must outlive the view
+ */
+int stun_view_decode(struct stun_view *view, struct mbuf *mb,
+		     struct stun_unknown_attr *ua)
+{
+	size_t off, end;
+	uint8_t *p;
+
+	if (!view || !mb)
+		return EINVAL;
+
+	if (mbuf_get_left(mb) < STUN_HEADER_SIZE)
+		return EBADMSG;
+
+	p = mbuf_buf(mb);
+
+	view->type = rd16(p);
+	if (view->type & 0xc000)
+		return EBADMSG;
+
+	view->len = rd16(p + 2);
+	if (view->len & 0x3)
+		return EBADMSG;
+
+	if (mbuf_get_left(mb) - STUN_HEADER_SIZE < view->len)
+		return EBADMSG;
+
+	view->buf    = p;
+	view->cookie = rd32(p + 4);
+	view->tid    = p + 8;
+	memset(view->attrv, 0, sizeof(view->attrv));
+
+	if (ua)
+		ua->typec = 0;
+
+	off = STUN_HEADER_SIZE;
+	end = STUN_HEADER_SIZE + view->len;
+
+	while (end - off >= 4) {
+
+		const uint16_t type = rd16(p + off);
+		const size_t len = rd16(p + off + 2);
+		const int slot = attr_slot(type);
+
+		off += 4;
+
+		if (end - off < len)
+			return EBADMSG;
+
+		if (slot >= 0) {
+			struct stun_vattr *attr = &view->attrv[slot];
+
+			if (!attr->p) {
+				attr->p   = p + off;
+				attr->len = len;
+			}
+		}
+		else if (type < 0x8000) {
+			if (ua && ua->typec < ARRAY_SIZE(ua->typev))
+				ua->typev[ua->typec++] = type;
+		}
+
+		off += min((len + 3) & ~(size_t)3, end - off);
+	}
+
+	return 0;
+}
+
+
+/**
+ * Get the STUN message class of a STUN message view
+ *
+ * @param view STUN message view
+ *
+ * @return STUN Message class
+ */
+uint16_t stun_view_class(const struct stun_view *view)
+{
+	return view ? STUN_CLASS(view->type) : 0;
+}
+
+
+/**
+ * Get the STUN message method of a STUN message view
+ *
+ * @param view STUN message view
+ *
+ * @return STUN Message method
+ */
+uint16_t stun_view_method(const struct stun_view *view)
+{
+	return view ? STUN_METHOD(view->type) : 0;
+}
+
+
+/**
+ * Lookup a STUN attribute in a STUN message view
+ *
+ * @param view STUN message view
+ * @param type STUN Attribute type
+ *
+ * @return STUN Attribute if found, otherwise NULL
+ */
+const struct stun_vattr *stun_view_attr(const struct stun_view *view,
+					uint16_t type)
+{
+	const int slot = attr_slot(type);
+
+	if (!view || slot < 0 || !view->attrv[slot].p)
+		return NULL;
+
+	return &view->attrv[slot];
+}
+
+
+/**
+ * Decode an address attribute of a STUN message view
+ *
+ * @param view STUN message view
+ * @param type STUN Attribute type
+ * @param sa   Decoded address
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int stun_view_addr(const struct stun_view *view, uint16_t type,
+		   struct sa *sa)
+{
+	const struct stun_vattr *attr = stun_view_attr(view, type);
+	const uint8_t *tid;
+	struct mbuf mb;
+
+	if (!attr || !sa)
+		return attr ? EINVAL : ENOENT;
+
+	switch (type) {
+
+	case STUN_ATTR_XOR_PEER_ADDR:
+	case STUN_ATTR_XOR_RELAY_ADDR:
+	case STUN_ATTR_XOR_MAPPED_ADDR:
+		tid = view->tid;
+		break;
+
+	default:
+		tid = NULL;
+		break;
+	}
+
+	mb.buf  = view->buf;
+	mb.pos  = attr->p - view->buf;
+	mb.end  = mb.pos + attr->len;
+	mb.size = mb.end;
+
+	return stun_addr_decode(&mb, sa, tid);
+}
+
+
+/**
+ * Decode a 32-bit integer attribute of a STUN message view
+ *
+ * @param view STUN message view
+ * @param type STUN Attribute type
+ * @param v    Decoded value
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int stun_view_u32(const struct stun_view *view, uint16_t type,
+		  uint32_t *v)
+{
+	const struct stun_vattr *attr = stun_view_attr(view, type);
+
+	if (!attr || !v)
+		return attr ? EINVAL : ENOENT;
+
+	if (attr->len != 4)
+		return EBADMSG;
+
+	*v = rd32(attr->p);
+
+	return 0;
+}
+
+
+/**
+ * Decode a 64-bit integer attribute of a STUN message view
+ *
+ * @param view STUN message view
+ * @param type STUN Attribute type
+ * @param v    Decoded value
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int stun_view_u64(const struct stun_view *view, uint16_t type,
+		  uint64_t *v)
+{
+	const struct stun_vattr *attr = stun_view_attr(view, type);
+
+	if (!attr || !v)
+		return attr ? EINVAL : ENOENT;
+
+	if (attr->len != 8)
+		return EBADMSG;
+
+	*v = (uint64_t)rd32(attr->p) << 32 | rd32(attr->p + 4);
+
+	return 0;
+}
+
+
+/**
+ * Get a string attribute of a STUN message view
+ *
+ * @param view STUN message view
+ * @param type STUN Attribute type
+ * @param pl   String, pointing into the STUN message
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int stun_view_str(const struct stun_view *view, uint16_t type,
+		  struct pl *pl)
+{
+	const struct stun_vattr *attr = stun_view_attr(view, type);
+
+	if (!attr || !pl)
+		return attr ? EINVAL : ENOENT;
+
+	pl->p = (const char *)attr->p;
+	pl->l = attr->len;
+
+	return 0;
+}
+
+
+static int chk_mi(const struct stun_view *view, const uint8_t *key,
+		  size_t keylen, struct hmac *hc)
+{
+	const struct stun_vattr *mi;
+	uint8_t hmac[SHA_DIGEST_LENGTH];
+	uint8_t len[2];
+	size_t n;
+	int err = 0;
+
+	if (!view)
+		return EINVAL;
+
+	mi = stun_view_attr(view, STUN_ATTR_MSG_INTEGRITY);
+	if (!mi)
+		return EPROTO;
+
+	if (mi->len != MI_SIZE)
+		return EBADMSG;
+
+	/* the length in the header must end with MESSAGE-INTEGRITY */
+	n = mi->p - view->buf;
+
+	memcpy(len, view->buf + 2, sizeof(len));
+	view->buf[2] = (uint8_t)(n >> 8);
+	view->buf[3] = (uint8_t)n;
+
+	if (hc)
+		err = hmac_digest(hc, hmac, sizeof(hmac), view->buf, n - 4);
+	else
+		hmac_sha1(key, keylen, view->buf, n - 4, hmac, sizeof(hmac));
+
+	memcpy(view->buf + 2, len, sizeof(len));
+
+	if (err)
+		return err;
+
+	if (memcmp(mi->p, hmac, SHA_DIGEST_LENGTH))
+		return EBADMSG;
+
+	return 0;
+}
+
+
+/**
+ * Verify the Message-Integrity of a STUN message view
+ *
+ * @param view   STUN message view
+ * @param key    Authentication key
+ * @param keylen Number of bytes in authentication key
+ *
+ * @return 0 if verified, otherwise errorcode
+ */
+int stun_view_chk_mi(const struct stun_view *view, const uint8_t *key,
+		     size_t keylen)
+{
+	return chk_mi(view, key, keylen, NULL);
+}
+
+
+/**
+ * Verify the Message-Integrity of a STUN message view, using an
+ * HMAC-SHA1 context that was created with the authentication key
+ *
+ * @param view   STUN message view
+ * @param hmac   HMAC-SHA1 context
+ *
+ * @return 0 if verified, otherwise errorcode
+ */
+int stun_view_chk_mi_hmac(const struct stun_view *view, struct hmac *hmac)
+{
+	if (!hmac)
+		return EINVAL;
+
+	return chk_mi(view, NULL, 0, hmac);
+}
+
+
+/**
+ * Check the Fingerprint of a STUN message view
+ *
+ * @param view STUN message view
+ *
+ * @return 0 if fingerprint matches, otherwise errorcode
+ */
+int stun_view_chk_fingerprint(const struct stun_view *view)
+{
+	const struct stun_vattr *fp;
+	uint32_t fprnt;
+	size_t n;
+
+	if (!view)
+		return EINVAL;
+
+	fp = stun_view_attr(view, STUN_ATTR_FINGERPRINT);
+	if (!fp)
+		return EPROTO;
+
+	if (fp->len != FP_SIZE)
+		return EBADMSG;
+
+	n = fp->p - view->buf - 4;
+
+	fprnt = (uint32_t)crc32(0, view->buf, (unsigned int)n) ^ 0x5354554e;
+
+	if (fprnt != rd32(fp->p))
+		return EBADMSG;
+
+	return 0;
+}
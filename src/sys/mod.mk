@@ -10,3 +10,4 @@ SRCS	+= sys/fs.c
 SRCS	+= sys/rand.c
 SRCS	+= sys/sleep.c
 SRCS	+= sys/sys.c
+SRCS	+= sys/thread.c
@@ -4,6 +4,9 @@
  * Copyright (C) 2010 Creytiv.com
  */
 #include <stdlib.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 #ifdef USE_OPENSSL
 #include <openssl/rand.h>
 #include <openssl/err.h>
@@ -178,3 +181,128 @@ void rand_bytes(uint8_t *p, size_t size)
 	}
 #endif
 }
+
+
+/*
+ * Fast generator, for values that need to be well spread but not
+ * unpredictable, e.g. timer jitter and identifiers that are only unique.
+ * It is xoshiro256** with one state per thread, seeded from
+ * rand_bytes(), so concurrent threads do not share any state.
+ */
+
+
+/** State of the fast generator */
+struct rand_fast {
+	uint64_t s[4];
+};
+
+
+#ifdef HAVE_PTHREAD
+static pthread_once_t  fast_once = PTHREAD_ONCE_INIT;
+static pthread_key_t   fast_key;
+static bool            fast_key_ok;
+#endif
+static struct rand_fast fast_shared;  /* used when there is no key */
+
+
+static inline uint64_t rotl(uint64_t x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+
+static void fast_seed(struct rand_fast *r)
+{
+	rand_bytes((uint8_t *)r->s, sizeof(r->s));
+
+	/* the state must not be all zero */
+	if (!(r->s[0] | r->s[1] | r->s[2] | r->s[3]))
+		r->s[0] = 0x9e3779b97f4a7c15ULL;
+}
+
+
+#ifdef HAVE_PTHREAD
+static void fast_init(void)
+{
+	fast_key_ok = (0 == pthread_key_create(&fast_key, free));
+}
+#endif
+
+
+static struct rand_fast *fast_get(void)
+{
+	struct rand_fast *r = NULL;
+
+#ifdef HAVE_PTHREAD
+	pthread_once(&fast_once, fast_init);
+
+	if (fast_key_ok) {
+
+		r = pthread_getspecific(fast_key);
+		if (r)
+			return r;
+
+		r = malloc(sizeof(*r));
+		if (r && pthread_setspecific(fast_key, r)) {
+			free(r);
+			r = NULL;
+		}
+	}
+#endif
+	if (!r) {
+		r = &fast_shared;
+		if (r->s[0] | r->s[1] | r->s[2] | r->s[3])
+			return r;
+	}
+
+	fast_seed(r);
+
+	return r;
+}
+
+
+/**
+ * Generate an unsigned 64-bit value with the fast generator. The values
+ * are predictable and must not be used for keys, nonces or anything else
+ * that an attacker must not guess.
+ *
+ * @return 64-bit pseudo-random value
+ */
+uint64_t rand_fast_u64(void)
+{
+	struct rand_fast *r = fast_get();
+	uint64_t *s = r->s;
+	const uint64_t v = rotl(s[1] * 5, 7) * 9;
+	const uint64_t t = s[1] << 17;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rotl(s[3], 45);
+
+	return v;
+}
+
+
+/**
+ * Generate an unsigned 32-bit value with the fast generator
+ *
+ * @return 32-bit pseudo-random value
+ */
+uint32_t rand_fast_u32(void)
+{
+	return (uint32_t)(rand_fast_u64() >> 32);
+}
+
+
+/**
+ * Generate an unsigned 16-bit value with the fast generator
+ *
+ * @return 16-bit pseudo-random value
+ */
+uint16_t rand_fast_u16(void)
+{
+	return (uint16_t)(rand_fast_u64() >> 48);
+}
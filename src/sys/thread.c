@@ -0,0 +1,104 @@
+/**
+ * @file thread.c  Thread scheduling and placement
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#define _GNU_SOURCE 1
+#include <string.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#include <sched.h>
+#endif
+#ifdef LINUX
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+#include <re_types.h>
+#include <re_mbuf.h>
+#include <re_sys.h>
+
+
+#ifndef MPOL_LOCAL
+#define MPOL_LOCAL 4  /**< Allocate on the node of the running CPU */
+#endif
+
+
+/**
+ * Pin the calling thread to one CPU
+ *
+ * @param cpu CPU number
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sys_thread_affinity_set(int cpu)
+{
+#if defined (LINUX) && defined (HAVE_PTHREAD)
+	cpu_set_t set;
+
+	if (cpu < 0 || cpu >= CPU_SETSIZE)
+		return EINVAL;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+	(void)cpu;
+	return ENOSYS;
+#endif
+}
+
+
+/**
+ * Let the memory that the calling thread allocates from now on be placed
+ * on the NUMA node of the CPU it runs on. This is a hint, and is most
+ * useful after sys_thread_affinity_set().
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sys_thread_numa_local(void)
+{
+#if defined (LINUX) && defined (SYS_set_mempolicy)
+	if (syscall(SYS_set_mempolicy, MPOL_LOCAL, NULL, 0UL))
+		return errno;
+
+	return 0;
+#else
+	return ENOSYS;
+#endif
+}
+
+
+/**
+ * Set the real-time priority of the calling thread. A non-zero priority
+ * selects SCHED_FIFO, which usually needs privileges, e.g. CAP_SYS_NICE.
+ *
+ * @param prio SCHED_FIFO priority, or 0 for the normal scheduler
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sys_thread_priority_set(int prio)
+{
+#ifdef HAVE_PTHREAD
+	struct sched_param param;
+	int policy = SCHED_OTHER;
+
+	if (prio < 0)
+		return EINVAL;
+
+	memset(&param, 0, sizeof(param));
+
+	if (prio) {
+		const int pmin = sched_get_priority_min(SCHED_FIFO);
+		const int pmax = sched_get_priority_max(SCHED_FIFO);
+
+		policy = SCHED_FIFO;
+		param.sched_priority = max(pmin, min(prio, pmax));
+	}
+
+	return pthread_setschedparam(pthread_self(), policy, &param);
+#else
+	(void)prio;
+	return ENOSYS;
+#endif
+}
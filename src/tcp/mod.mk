@@ -6,3 +6,4 @@
 
 SRCS	+= tcp/tcp.c
 SRCS	+= tcp/tcp_high.c
+SRCS	+= tcp/tcp_he.c
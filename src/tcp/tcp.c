@@ -3,6 +3,9 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
+#ifdef LINUX
+#define _GNU_SOURCE 1
+#endif
 #include <stdlib.h>
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
@@ -20,6 +23,13 @@
 #include "TargetConditionals.h"
 #endif
 #include <string.h>
+#if !defined(WIN32)
+#include <sys/ioctl.h>
+#endif
+#ifdef LINUX
+#include <linux/errqueue.h>
+#include <sys/sendfile.h>
+#endif
 #include <re_types.h>
 #include <re_fmt.h>
 #include <re_mem.h>
@@ -29,6 +39,8 @@
 #include <re_sa.h>
 #include <re_net.h>
 #include <re_tcp.h>
+#include <re_probe.h>
+#include <re_metric.h>
 
 
 #define DEBUG_MODULE "tcp"
@@ -51,14 +63,66 @@
 
 enum {
 	TCP_TXQSZ_DEFAULT = 524288,
-	TCP_RXSZ_DEFAULT  = 8192
+	TCP_RXSZ_DEFAULT  = 8192,
+	TCP_RX_BUDGET     = 65536,
+	TCP_ACCEPT_MAX    = 32,
 };
 
 
+#if defined (LINUX) && defined (SOCK_NONBLOCK)
+#define HAVE_ACCEPT4 1
+#endif
+
+
+#ifdef LINUX
+#define HAVE_SENDFILE 1
+#endif
+
+
+/* TCP Fast Open, RFC 7413 */
+#ifdef LINUX
+#define HAVE_TCP_FASTOPEN 1
+#ifndef TCP_FASTOPEN
+#define TCP_FASTOPEN 23
+#endif
+#ifndef TCP_FASTOPEN_CONNECT
+#define TCP_FASTOPEN_CONNECT 30
+#endif
+#elif defined (__APPLE__)
+#include <netinet/tcp.h>
+#if defined (TCP_FASTOPEN) && defined (CONNECT_RESUME_ON_READ_WRITE)
+#define HAVE_TCP_FASTOPEN 1
+#define HAVE_CONNECTX 1
+#endif
+#endif
+
+
+/* Zero-copy send, see Documentation/networking/msg_zerocopy.rst */
+#ifdef LINUX
+#define HAVE_TCP_ZEROCOPY 1
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef IP_RECVERR
+#define IP_RECVERR 11
+#endif
+#ifndef IPV6_RECVERR
+#define IPV6_RECVERR 25
+#endif
+#endif
+
+
 /** Defines a listening TCP socket */
 struct tcp_sock {
 	int fd;               /**< Listening file descriptor         */
 	int fdc;              /**< Cached connection file descriptor */
+	unsigned accept_max;  /**< Connections accepted per event    */
 	tcp_conn_h *connh;    /**< TCP Connect handler               */
 	void *arg;            /**< Handler argument                  */
 };
@@ -75,8 +139,15 @@ struct tcp_conn {
 	tcp_close_h *closeh;  /**< Connection close handler          */
 	void *arg;            /**< Handler argument                  */
 	size_t rxsz;          /**< Maximum receive chunk size        */
+	struct mbuf *rxmb;    /**< Reused receive buffer             */
 	size_t txqsz;
 	size_t txqsz_max;
+	struct list zcq;      /**< Buffers held by zero-copy sends   */
+	uint32_t zc_seq;      /**< Next zero-copy send number        */
+	bool zc;              /**< Zero-copy send enabled            */
+	bool tfo;             /**< Fast Open on connect              */
+	bool corked;          /**< Sending is held back              */
+	bool txref;           /**< Queue references to sent buffers  */
 	bool active;          /**< We are connecting flag            */
 	bool connected;       /**< Connection is connected flag      */
 };
@@ -90,15 +161,40 @@ struct tcp_helper {
 	tcp_helper_send_h *sendh;
 	tcp_helper_recv_h *recvh;
 	void *arg;
+	bool passthru;        /**< Sent data is passed on unchanged  */
 };
 
 
+/** Defines an entry of the sending queue */
 struct tcp_qent {
 	struct le le;
-	struct mbuf mb;
+	struct mbuf mb;       /**< Copied data, or position in mbr   */
+	struct mbuf *mbr;     /**< Referenced buffer, or NULL        */
+};
+
+
+/** Defines a memory object held until a zero-copy send completes */
+struct tcp_zcent {
+	struct le le;
+	void *ref;            /**< Referenced memory object          */
+	uint32_t seq;         /**< Zero-copy send number             */
 };
 
 
+RE_METRIC_COUNTER_DEFINE(m_rx_bytes, "re_tcp_rx_bytes_total", NULL,
+			 "Bytes received on TCP connections");
+RE_METRIC_COUNTER_DEFINE(m_tx_bytes, "re_tcp_tx_bytes_total", NULL,
+			 "Bytes sent on TCP connections");
+RE_METRIC_COUNTER_DEFINE(m_tx_drops, "re_tcp_tx_drops_total", NULL,
+			 "Sends refused because the send queue was full");
+RE_METRIC_COUNTER_DEFINE(m_conn_errors, "re_tcp_conn_errors_total", NULL,
+			 "TCP connections closed with an error");
+
+
+/** Maximum number of queue entries sent with one system call */
+enum { TCP_IOV_MAX = 64 };
+
+
 static void tcp_recv_handler(int flags, void *arg);
 
 
@@ -150,6 +246,8 @@ static void conn_destructor(void *data)
 
 	list_flush(&tc->helpers);
 	list_flush(&tc->sendq);
+	list_flush(&tc->zcq);
+	mem_deref(tc->rxmb);
 
 	if (tc->fdc >= 0) {
 		fd_close(tc->fdc);
@@ -171,8 +269,126 @@ static void qent_destructor(void *arg)
 	struct tcp_qent *qe = arg;
 
 	list_unlink(&qe->le);
-	mem_deref(qe->mb.buf);
+
+	if (qe->mbr)
+		mem_deref(qe->mbr);
+	else
+		mem_deref(qe->mb.buf);
+}
+
+
+static inline uint8_t *qent_buf(const struct tcp_qent *qe)
+{
+	return (qe->mbr ? qe->mbr->buf : qe->mb.buf) + qe->mb.pos;
+}
+
+
+#ifdef HAVE_TCP_ZEROCOPY
+static void zcent_destructor(void *arg)
+{
+	struct tcp_zcent *ze = arg;
+
+	list_unlink(&ze->le);
+	mem_deref(ze->ref);
+}
+
+
+/* Hold a memory object until send number seq has completed */
+static void zc_hold(struct tcp_conn *tc, void *ref, uint32_t seq)
+{
+	struct tcp_zcent *ze;
+
+	ze = mem_zalloc(sizeof(*ze), zcent_destructor);
+	if (!ze)
+		return;
+
+	ze->ref = mem_ref(ref);
+	ze->seq = seq;
+
+	list_append(&tc->zcq, &ze->le, ze);
+}
+
+
+/* Release the buffers of zero-copy sends reported as completed */
+static void zc_reap(struct tcp_conn *tc)
+{
+	for (;;) {
+		union {
+			char buf[CMSG_SPACE(sizeof(struct sock_extended_err))
+				 + CMSG_SPACE(sizeof(struct sockaddr_in6))];
+			size_t align;
+		} ctl;
+		struct cmsghdr *cmsg;
+		struct msghdr msg;
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control    = ctl.buf;
+		msg.msg_controllen = sizeof(ctl.buf);
+
+		if (recvmsg(tc->fdc, &msg, MSG_ERRQUEUE) < 0)
+			return;
+
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+		     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+
+			struct sock_extended_err serr;
+
+			if (!(cmsg->cmsg_level == IPPROTO_IP &&
+			      cmsg->cmsg_type == IP_RECVERR) &&
+			    !(cmsg->cmsg_level == IPPROTO_IPV6 &&
+			      cmsg->cmsg_type == IPV6_RECVERR))
+				continue;
+
+			memcpy(&serr, CMSG_DATA(cmsg), sizeof(serr));
+
+			if (serr.ee_errno != 0 ||
+			    serr.ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+				continue;
+
+			/* Sends ee_info to ee_data have completed */
+			while (tc->zcq.head) {
+
+				struct tcp_zcent *ze = tc->zcq.head->data;
+
+				if ((int32_t)(ze->seq - serr.ee_data) > 0)
+					break;
+
+				mem_deref(ze);
+			}
+		}
+	}
+}
+
+
+/* Send with MSG_ZEROCOPY if enabled, zcp is set if buffers must be held */
+static ssize_t zc_send(struct tcp_conn *tc, struct iovec *iov, int iovcnt,
+		       int flags, bool *zcp)
+{
+	struct msghdr msg;
+	ssize_t n;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov    = iov;
+	msg.msg_iovlen = iovcnt;
+
+	*zcp = false;
+
+	if (tc->zc) {
+
+		n = sendmsg(tc->fdc, &msg, flags | MSG_ZEROCOPY);
+		if (n >= 0) {
+			*zcp = true;
+			return n;
+		}
+
+		/* Out of option memory for notifications */
+		if (ENOBUFS != errno)
+			return n;
+	}
+
+	return sendmsg(tc->fdc, &msg, flags);
 }
+#endif
 
 
 static int enqueue(struct tcp_conn *tc, struct mbuf *mb)
@@ -181,10 +397,12 @@ static int enqueue(struct tcp_conn *tc, struct mbuf *mb)
 	struct tcp_qent *qe;
 	int err;
 
-	if (tc->txqsz + n > tc->txqsz_max)
+	if (tc->txqsz + n > tc->txqsz_max) {
+		re_metric_inc(&m_tx_drops);
 		return ENOSPC;
+	}
 
-	if (!tc->sendq.head && !tc->sendh) {
+	if (!tc->sendq.head && !tc->sendh && !tc->corked) {
 
 		err = fd_listen(tc->fdc, FD_READ | FD_WRITE,
 				tcp_recv_handler, tc);
@@ -200,13 +418,21 @@ static int enqueue(struct tcp_conn *tc, struct mbuf *mb)
 
 	mbuf_init(&qe->mb);
 
-	err = mbuf_write_mem(&qe->mb, mbuf_buf(mb), n);
-	qe->mb.pos = 0;
+	if (tc->txref) {
+		qe->mbr    = mem_ref(mb);
+		qe->mb.pos = mb->pos;
+		qe->mb.end = mb->end;
+		err = 0;
+	}
+	else {
+		err = mbuf_write_mem(&qe->mb, mbuf_buf(mb), n);
+		qe->mb.pos = 0;
+	}
 
 	if (err)
 		mem_deref(qe);
 	else
-		tc->txqsz += qe->mb.end;
+		tc->txqsz += n;
 
 	return err;
 }
@@ -228,8 +454,47 @@ static int dequeue(struct tcp_conn *tc)
 		return 0;
 	}
 
-	n = send(tc->fdc, BUF_CAST mbuf_buf(&qe->mb),
+#ifdef WIN32
+	n = send(tc->fdc, BUF_CAST qent_buf(qe),
 		 qe->mb.end - qe->mb.pos, flags);
+#else
+	{
+		struct iovec iov[TCP_IOV_MAX];
+		struct le *le;
+		bool zc;
+		int c = 0;
+
+		/* Send as many queued entries as possible at once */
+		for (le = tc->sendq.head; le && c < TCP_IOV_MAX;
+		     le = le->next) {
+
+			struct tcp_qent *q = le->data;
+
+			iov[c].iov_base = qent_buf(q);
+			iov[c].iov_len  = q->mb.end - q->mb.pos;
+			++c;
+		}
+
+		n = zc_send(tc, iov, c, flags, &zc);
+
+		/* Hold the buffers of all entries that were sent from */
+		if (zc) {
+			const uint32_t seq = tc->zc_seq++;
+			ssize_t left = n;
+
+			for (le = tc->sendq.head; le && left > 0;
+			     le = le->next) {
+
+				struct tcp_qent *q = le->data;
+
+				zc_hold(tc, q->mbr ? (void *)q->mbr
+					: (void *)q->mb.buf, seq);
+
+				left -= q->mb.end - q->mb.pos;
+			}
+		}
+	}
+#endif
 	if (n < 0) {
 		if (EAGAIN == errno)
 			return 0;
@@ -240,11 +505,22 @@ static int dequeue(struct tcp_conn *tc)
 		return errno;
 	}
 
-	tc->txqsz  -= n;
-	qe->mb.pos += n;
+	tc->txqsz -= n;
+	re_metric_add(&m_tx_bytes, (uint64_t)n);
+
+	while (n > 0 && qe) {
+
+		const size_t len = min((size_t)n, qe->mb.end - qe->mb.pos);
+
+		qe->mb.pos += len;
+		n -= len;
+
+		if (qe->mb.pos < qe->mb.end)
+			break;
 
-	if (qe->mb.pos >= qe->mb.end)
 		mem_deref(qe);
+		qe = list_ledata(tc->sendq.head);
+	}
 
 	return 0;
 }
@@ -252,6 +528,9 @@ static int dequeue(struct tcp_conn *tc)
 
 static void conn_close(struct tcp_conn *tc, int err)
 {
+	if (err)
+		re_metric_inc(&m_conn_errors);
+
 	list_flush(&tc->sendq);
 	tc->txqsz = 0;
 
@@ -267,13 +546,165 @@ static void conn_close(struct tcp_conn *tc, int err)
 }
 
 
+/*
+ * Pass received data to the helpers from le upwards, and then to the
+ * receive handler. Returns false if the connection was closed, or
+ * destroyed by a handler.
+ */
+static bool conn_recv(struct tcp_conn *tc, struct mbuf *mb, struct le *le,
+		      bool hlp_estab)
+{
+	int err = 0;
+
+	while (le) {
+		struct tcp_helper *th = le->data;
+		bool hdld = false;
+
+		le = le->next;
+
+		if (hlp_estab) {
+
+			hdld |= th->estabh(&err, tc->active, th->arg);
+			if (err) {
+				conn_close(tc, err);
+				return false;
+			}
+		}
+
+		if (mb->pos < mb->end) {
+
+		        hdld |= th->recvh(&err, mb, &hlp_estab, th->arg);
+			if (err) {
+				conn_close(tc, err);
+				return false;
+			}
+		}
+
+		if (hdld)
+			return true;
+	}
+
+	if (hlp_estab && tc->estabh) {
+
+		tc->estabh(tc->arg);
+
+		/* check if connection was deref'ed from establish handler */
+		if (mem_nrefs(tc) == 1)
+			return false;
+	}
+
+	if (mb->pos < mb->end && tc->recvh) {
+		tc->recvh(mb, tc->arg);
+	}
+
+	return true;
+}
+
+
+/*
+ * Read one chunk of at most size bytes, and pass it to the helpers and
+ * the receive handler. Returns the number of bytes read, or 0. The
+ * caller holds a reference to the connection.
+ */
+static size_t conn_read(struct tcp_conn *tc, size_t size)
+{
+	struct mbuf *mb;
+	ssize_t n;
+
+	/* The buffer is reused, unless a handler kept a reference to it */
+	mb = tc->rxmb;
+	if (!mb || mem_nrefs(mb) > 1 || mb->size < size) {
+
+		mem_deref(tc->rxmb);
+
+		mb = tc->rxmb = mbuf_alloc(size);
+		if (!mb)
+			return 0;
+	}
+
+	mb->pos = 0;
+	mb->end = 0;
+
+	n = recv(tc->fdc, BUF_CAST mb->buf, size, 0);
+	if (0 == n) {
+		conn_close(tc, 0);
+		return 0;
+	}
+	else if (n < 0) {
+#ifdef WIN32
+		const int err = WSAGetLastError();
+		DEBUG_WARNING("recv handler: recv(): %d\n", err);
+		if (err == WSAECONNRESET || err == WSAECONNABORTED)
+			conn_close(tc, err);
+#else
+		if (EAGAIN != errno)
+			DEBUG_WARNING("recv handler: recv(): %m\n", errno);
+#endif
+		return 0;
+	}
+
+	mb->end = n;
+
+	RE_PROBE2(tcp_recv, tc, n);
+	re_metric_add(&m_rx_bytes, (uint64_t)n);
+
+	return conn_recv(tc, mb, tc->helpers.head, false) ? n : 0;
+}
+
+
+/* Bytes waiting in the receive queue, 0 if unknown */
+static size_t rx_pending(int fd)
+{
+#if defined (FIONREAD) && !defined (WIN32)
+	int n = 0;
+
+	if (0 == ioctl(fd, FIONREAD, &n) && n > 0)
+		return n;
+#else
+	(void)fd;
+#endif
+
+	return 0;
+}
+
+
+/*
+ * Read until the receive queue is drained, or the budget is spent. A
+ * short read means the queue is empty, and after a full read the next
+ * one is sized to the data that is waiting.
+ */
+static void conn_drain(struct tcp_conn *tc)
+{
+	size_t size = tc->rxsz, total = 0;
+
+	/* The connection may be closed or destroyed by the handlers */
+	mem_ref(tc);
+
+	while (total < TCP_RX_BUDGET) {
+
+		const size_t n = conn_read(tc, size);
+
+		if (!n || mem_nrefs(tc) == 1 || tc->fdc < 0)
+			break;
+
+		total += n;
+
+		if (n < size)
+			break;
+
+		size = min(rx_pending(tc->fdc), tc->rxsz);
+		if (!size)
+			break;
+	}
+
+	mem_deref(tc);
+}
+
+
 static void tcp_recv_handler(int flags, void *arg)
 {
 	struct tcp_conn *tc = arg;
-	struct mbuf *mb = NULL;
-	bool hlp_estab = false;
 	struct le *le;
-	ssize_t n;
 	int err;
 	socklen_t err_len = sizeof(err);
 
@@ -292,6 +723,16 @@ static void tcp_recv_handler(int flags, void *arg)
 		conn_close(tc, err);
 		return;
 	}
+
+#ifdef HAVE_TCP_ZEROCOPY
+	if (tc->zc && (flags & FD_EXCEPT)) {
+
+		zc_reap(tc);
+
+		if (!(flags & (FD_READ | FD_WRITE)))
+			return;
+	}
+#endif
 #if 0
 	if (EINPROGRESS != err && EALREADY != err) {
 		DEBUG_WARNING("recv handler: Socket error (%m)\n", err);
@@ -366,86 +807,7 @@ static void tcp_recv_handler(int flags, void *arg)
 	}
 
  read:
-	mb = mbuf_alloc(tc->rxsz);
-	if (!mb)
-		return;
-
-	n = recv(tc->fdc, BUF_CAST mb->buf, mb->size, 0);
-	if (0 == n) {
-		mem_deref(mb);
-		conn_close(tc, 0);
-		return;
-	}
-	else if (n < 0) {
-#ifdef WIN32
-		err = WSAGetLastError();
-		DEBUG_WARNING("recv handler: recv(): %d\n", err);
-		if (err == WSAECONNRESET || err == WSAECONNABORTED) {
-			mem_deref(mb);
-			conn_close(tc, err);
-			return;
-		}
-#else
-		DEBUG_WARNING("recv handler: recv(): %m\n", errno);
-#endif
-		goto out;
-	}
-
-	mb->end = n;
-
-	le = tc->helpers.head;
-	while (le) {
-		struct tcp_helper *th = le->data;
-		bool hdld = false;
-
-		le = le->next;
-
-		if (hlp_estab) {
-
-			hdld |= th->estabh(&err, tc->active, th->arg);
-			if (err) {
-				conn_close(tc, err);
-				goto out;
-			}
-		}
-
-		if (mb->pos < mb->end) {
-
-		        hdld |= th->recvh(&err, mb, &hlp_estab, th->arg);
-			if (err) {
-				conn_close(tc, err);
-				goto out;
-			}
-		}
-
-		if (hdld)
-			goto out;
-	}
-
-	mbuf_trim(mb);
-
-	if (hlp_estab && tc->estabh) {
-
-		uint32_t nrefs;
-
-		mem_ref(tc);
-
-		tc->estabh(tc->arg);
-
-		nrefs = mem_nrefs(tc);
-		mem_deref(tc);
-
-		/* check if connection was deref'ed from establish handler */
-		if (nrefs == 1)
-			goto out;
-	}
-
-	if (mb->pos < mb->end && tc->recvh) {
-		tc->recvh(mb, tc->arg);
-	}
-
- out:
-	mem_deref(mb);
+	conn_drain(tc);
 }
 
 
@@ -488,72 +850,114 @@ static void tcp_sockopt_set(int fd)
 }
 
 
+/* Accept one connection, returns file descriptor or -1 with errno */
+static int sock_accept(struct tcp_sock *ts, struct sa *peer)
+{
+	int fd, err;
+
+#ifdef HAVE_ACCEPT4
+	static bool no_accept4;
+
+	if (!no_accept4) {
+
+		fd = accept4(ts->fd, &peer->u.sa, &peer->len,
+			     SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd >= 0 || ENOSYS != errno)
+			return fd;
+
+		no_accept4 = true;
+	}
+#endif
+
+	fd = SOK_CAST accept(ts->fd, &peer->u.sa, &peer->len);
+	if (-1 == fd)
+		return -1;
+
+	err = net_sockopt_blocking_set(fd, false);
+	if (err) {
+		DEBUG_WARNING("conn handler: nonblock set: %m\n", err);
+		(void)close(fd);
+		errno = err;
+		return -1;
+	}
+
+	return fd;
+}
+
+
 /**
- * Handler for incoming TCP connections.
+ * Handler for incoming TCP connections. Pending connections are accepted
+ * until there are no more, or up to the limit per event.
  *
  * @param flags  Event flags.
  * @param arg    Handler argument.
  */
 static void tcp_conn_handler(int flags, void *arg)
 {
-	struct sa peer;
 	struct tcp_sock *ts = arg;
-	int err;
+	unsigned i;
 
 	(void)flags;
 
-	sa_init(&peer, AF_UNSPEC);
+	mem_ref(ts);
 
-	if (ts->fdc >= 0)
-		(void)close(ts->fdc);
+	for (i=0; i<ts->accept_max; i++) {
 
-	ts->fdc = SOK_CAST accept(ts->fd, &peer.u.sa, &peer.len);
-	if (-1 == ts->fdc) {
+		struct sa peer;
+
+		sa_init(&peer, AF_UNSPEC);
+
+		if (ts->fdc >= 0)
+			(void)close(ts->fdc);
+
+		ts->fdc = sock_accept(ts, &peer);
+		if (-1 == ts->fdc) {
 
 #if TARGET_OS_IPHONE
-		if (EAGAIN == errno) {
+			if (EAGAIN == errno && i == 0) {
 
-			struct tcp_sock *ts_new;
-			struct sa laddr;
+				struct tcp_sock *ts_new;
+				struct sa laddr;
+				int err;
 
-			err = tcp_sock_local_get(ts, &laddr);
-			if (err)
-				return;
+				err = tcp_sock_local_get(ts, &laddr);
+				if (err)
+					break;
 
-			if (ts->fd >= 0) {
-				fd_close(ts->fd);
-				(void)close(ts->fd);
-				ts->fd = -1;
-			}
+				if (ts->fd >= 0) {
+					fd_close(ts->fd);
+					(void)close(ts->fd);
+					ts->fd = -1;
+				}
 
-			err = tcp_listen(&ts_new, &laddr, NULL, NULL);
-			if (err)
-				return;
+				err = tcp_listen(&ts_new, &laddr, NULL, NULL);
+				if (err)
+					break;
 
-			ts->fd = ts_new->fd;
-			ts_new->fd = -1;
+				ts->fd = ts_new->fd;
+				ts_new->fd = -1;
 
-			mem_deref(ts_new);
+				mem_deref(ts_new);
 
-			fd_listen(ts->fd, FD_READ, tcp_conn_handler, ts);
-		}
+				fd_listen(ts->fd, FD_READ, tcp_conn_handler,
+					  ts);
+			}
 #endif
 
-		return;
-	}
+			break;
+		}
 
-	err = net_sockopt_blocking_set(ts->fdc, false);
-	if (err) {
-		DEBUG_WARNING("conn handler: nonblock set: %m\n", err);
-		(void)close(ts->fdc);
-		ts->fdc = -1;
-		return;
-	}
+		tcp_sockopt_set(ts->fdc);
 
-	tcp_sockopt_set(ts->fdc);
+		if (ts->connh)
+			ts->connh(&peer, ts->arg);
 
-	if (ts->connh)
-		ts->connh(&peer, ts->arg);
+		/* check if socket was deref'd from connect handler */
+		if (mem_nrefs(ts) == 1)
+			break;
+	}
+
+	mem_deref(ts);
 }
 
 
@@ -585,6 +989,7 @@ int tcp_sock_alloc(struct tcp_sock **tsp, const struct sa *local,
 
 	ts->fd  = -1;
 	ts->fdc = -1;
+	ts->accept_max = TCP_ACCEPT_MAX;
 
 	if (local) {
 		(void)re_snprintf(addr, sizeof(addr), "%H",
@@ -668,21 +1073,96 @@ int tcp_sock_alloc(struct tcp_sock **tsp, const struct sa *local,
  */
 struct tcp_sock *tcp_sock_dup(struct tcp_sock *tso)
 {
-	struct tcp_sock *ts;
-
-	if (!tso)
-		return NULL;
+	struct tcp_sock *ts;
+
+	if (!tso)
+		return NULL;
+
+	ts = mem_zalloc(sizeof(*ts), sock_destructor);
+	if (!ts)
+		return NULL;
+
+	ts->fd  = -1;
+	ts->fdc = tso->fdc;
+	ts->accept_max = tso->accept_max;
+
+	tso->fdc = -1;
+
+	return ts;
+}
+
+
+/**
+ * Set the maximum number of connections accepted per event on a TCP
+ * Socket. Bursts of incoming connections are then drained from the
+ * backlog without waiting for the next event loop iteration.
+ *
+ * @param ts TCP Socket
+ * @param n  Maximum number of connections, at least 1
+ */
+void tcp_sock_accept_max_set(struct tcp_sock *ts, unsigned n)
+{
+	if (!ts)
+		return;
+
+	ts->accept_max = max(n, 1u);
+}
+
+
+/**
+ * Share the local port of a TCP Socket with other sockets (SO_REUSEPORT),
+ * with the kernel distributing incoming connections between them. Must be
+ * called before tcp_sock_bind()
+ *
+ * @param ts    TCP Socket
+ * @param reuse true to share the port, false to not share it
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int tcp_sock_reuseport_set(struct tcp_sock *ts, bool reuse)
+{
+	if (!ts || ts->fd < 0)
+		return EINVAL;
+
+	return net_sockopt_reuseport_set(ts->fd, reuse);
+}
+
+
+/**
+ * Enable TCP Fast Open (RFC 7413) on a TCP Socket, so that clients with
+ * a cookie can send data in the SYN. Must be called before
+ * tcp_sock_listen(). On Linux the server side must also be enabled with
+ * the net.ipv4.tcp_fastopen sysctl.
+ *
+ * @param ts   TCP Socket
+ * @param qlen Maximum number of pending Fast Open connections, 0 to
+ *             disable
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int tcp_sock_fastopen_set(struct tcp_sock *ts, int qlen)
+{
+#ifdef HAVE_TCP_FASTOPEN
+#ifdef __APPLE__
+	const int v = qlen > 0;
+#else
+	const int v = qlen;
+#endif
 
-	ts = mem_zalloc(sizeof(*ts), sock_destructor);
-	if (!ts)
-		return NULL;
+	if (!ts || ts->fd < 0 || qlen < 0)
+		return EINVAL;
 
-	ts->fd  = -1;
-	ts->fdc = tso->fdc;
+	if (0 != setsockopt(ts->fd, IPPROTO_TCP, TCP_FASTOPEN,
+			    BUF_CAST &v, sizeof(v)))
+		return errno;
 
-	tso->fdc = -1;
+	return 0;
+#else
+	if (!ts || ts->fd < 0 || qlen < 0)
+		return EINVAL;
 
-	return ts;
+	return qlen ? ENOSYS : 0;
+#endif
 }
 
 
@@ -997,6 +1477,29 @@ int tcp_conn_bind(struct tcp_conn *tc, const struct sa *local)
 }
 
 
+/* With Fast Open the first data that is sent goes in the SYN */
+static int conn_connect(struct tcp_conn *tc, struct sockaddr *sa,
+			socklen_t len)
+{
+#ifdef HAVE_CONNECTX
+	if (tc->tfo) {
+		sa_endpoints_t ep;
+
+		memset(&ep, 0, sizeof(ep));
+		ep.sae_dstaddr    = sa;
+		ep.sae_dstaddrlen = len;
+
+		return connectx(tc->fdc, &ep, SAE_ASSOCID_ANY,
+				CONNECT_RESUME_ON_READ_WRITE |
+				CONNECT_DATA_IDEMPOTENT,
+				NULL, 0, NULL, NULL);
+	}
+#endif
+
+	return connect(tc->fdc, sa, SIZ_CAST len);
+}
+
+
 /**
  * Connect to a remote peer
  *
@@ -1044,7 +1547,7 @@ int tcp_conn_connect(struct tcp_conn *tc, const struct sa *peer)
 		struct sockaddr *sa = r->ai_addr;
 
 	again:
-		if (0 == connect(tc->fdc, sa, SIZ_CAST r->ai_addrlen)) {
+		if (0 == conn_connect(tc, sa, r->ai_addrlen)) {
 			err = 0;
 			goto out;
 		}
@@ -1115,9 +1618,23 @@ static int tcp_send_internal(struct tcp_conn *tc, struct mbuf *mb,
 			return err;
 	}
 
-	if (tc->sendq.head)
+	if (tc->sendq.head || tc->corked)
 		return enqueue(tc, mb);
 
+#ifdef HAVE_TCP_ZEROCOPY
+	if (tc->zc) {
+		struct iovec iov;
+		bool zc;
+
+		iov.iov_base = mbuf_buf(mb);
+		iov.iov_len  = mb->end - mb->pos;
+
+		n = zc_send(tc, &iov, 1, flags, &zc);
+		if (zc)
+			zc_hold(tc, mb, tc->zc_seq++);
+	}
+	else
+#endif
 	n = send(tc->fdc, BUF_CAST mbuf_buf(mb), mb->end - mb->pos, flags);
 	if (n < 0) {
 
@@ -1139,6 +1656,8 @@ static int tcp_send_internal(struct tcp_conn *tc, struct mbuf *mb,
 		return err;
 	}
 
+	re_metric_add(&m_tx_bytes, (uint64_t)n);
+
 	if ((size_t)n < mb->end - mb->pos) {
 
 		mb->pos += n;
@@ -1189,6 +1708,254 @@ int tcp_send_helper(struct tcp_conn *tc, struct mbuf *mb,
 }
 
 
+/**
+ * Resume the receive path above a helper without new data, e.g. when
+ * the helper has finished an asynchronous handshake. The receive
+ * handler of the helper is called with an empty buffer, and what it
+ * reports is passed on to the helpers above it.
+ *
+ * @param tc TCP Connection
+ * @param th TCP Helper
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int tcp_recv_helper(struct tcp_conn *tc, struct tcp_helper *th)
+{
+	bool hlp_estab = false, hdld;
+	struct mbuf *mb;
+	int err = 0;
+
+	if (!tc || !th)
+		return EINVAL;
+
+	if (tc->fdc < 0)
+		return ENOTCONN;
+
+	mb = mbuf_alloc(tc->rxsz);
+	if (!mb)
+		return ENOMEM;
+
+	/* The connection may be closed or destroyed by the handlers */
+	mem_ref(tc);
+
+	hdld = th->recvh(&err, mb, &hlp_estab, th->arg);
+	if (err)
+		conn_close(tc, err);
+	else if (!hdld)
+		(void)conn_recv(tc, mb, th->le.next, hlp_estab);
+
+	mem_deref(mb);
+	mem_deref(tc);
+
+	return 0;
+}
+
+
+/**
+ * Send data from a list of slices on a TCP Connection. When there are
+ * no helpers and nothing is queued, the slices are sent with one system
+ * call, without copying them to a buffer. What is not sent at once is
+ * copied, so the slices may be reused when the function returns.
+ *
+ * @param tc TCP Connection
+ * @param vv Array of slices
+ * @param vc Number of slices
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int tcp_sendv(struct tcp_conn *tc, const struct tcp_vec *vv, size_t vc)
+{
+	size_t i, len = 0, sent = 0;
+	struct mbuf *mb;
+	int err = 0;
+
+	if (!tc || !vv)
+		return EINVAL;
+
+	if (tc->fdc < 0)
+		return ENOTCONN;
+
+	for (i=0; i<vc; i++)
+		len += vv[i].len;
+
+	if (!len)
+		return EINVAL;
+
+#ifndef WIN32
+	if (!tc->helpers.head && !tc->sendq.head && !tc->corked &&
+	    !tc->zc && vc <= TCP_IOV_MAX) {
+
+		struct iovec iov[TCP_IOV_MAX];
+		struct msghdr msg;
+		ssize_t n;
+#ifdef MSG_NOSIGNAL
+		const int flags = MSG_NOSIGNAL; /* disable SIGPIPE signal */
+#else
+		const int flags = 0;
+#endif
+
+		for (i=0; i<vc; i++) {
+			iov[i].iov_base = (void *)vv[i].p;
+			iov[i].iov_len  = vv[i].len;
+		}
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov    = iov;
+		msg.msg_iovlen = vc;
+
+		n = sendmsg(tc->fdc, &msg, flags);
+		if (n < 0) {
+			if (EAGAIN != errno) {
+				err = errno;
+				DEBUG_WARNING("sendv: sendmsg(): %m"
+					      " (fdc=%d)\n", err, tc->fdc);
+				return err;
+			}
+
+			n = 0;
+		}
+
+		re_metric_add(&m_tx_bytes, (uint64_t)n);
+
+		sent = n;
+		if (sent == len)
+			return 0;
+	}
+#endif
+
+	/* copy the rest, to send it through the helpers or the queue */
+	mb = mbuf_alloc(len - sent);
+	if (!mb)
+		return ENOMEM;
+
+	for (i=0; i<vc && !err; i++) {
+
+		const size_t skip = min(sent, vv[i].len);
+
+		sent -= skip;
+		err = mbuf_write_mem(mb, vv[i].p + skip, vv[i].len - skip);
+	}
+
+	if (!err) {
+		mb->pos = 0;
+		err = tcp_send_internal(tc, mb, tc->helpers.tail);
+	}
+
+	mem_deref(mb);
+
+	return err;
+}
+
+
+/**
+ * Send the segments of a memory buffer chain on a TCP Connection, with
+ * one sendmsg() when possible (see tcp_sendv())
+ *
+ * @param tc TCP Connection
+ * @param mc Memory buffer chain to send
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int tcp_send_chain(struct tcp_conn *tc, const struct mbuf_chain *mc)
+{
+	struct tcp_vec vv[MBUF_CHAIN_MAX];
+	size_t i;
+
+	if (!tc || !mc)
+		return EINVAL;
+
+	for (i=0; i<mc->segc; i++) {
+		vv[i].p   = mc->segv[i].buf + mc->segv[i].pos;
+		vv[i].len = mc->segv[i].len;
+	}
+
+	return tcp_sendv(tc, vv, mc->segc);
+}
+
+
+/* True if no TCP-helper has to see the sent data */
+static bool helpers_passthru(const struct tcp_conn *tc)
+{
+	struct le *le;
+
+	for (le = tc->helpers.head; le; le = le->next) {
+
+		const struct tcp_helper *th = le->data;
+
+		if (!th->passthru)
+			return false;
+	}
+
+	return true;
+}
+
+
+/**
+ * Send a part of a file on a TCP Connection. The kernel copies the data
+ * from the file to the socket, without a buffer in user space.
+ *
+ * The data does not go through the TCP-helpers, so a file can only be
+ * sent this way if every helper passes its data through unchanged (see
+ * tcp_helper_set_passthru()), such as TLS with the record layer in the
+ * kernel.
+ *
+ * Nothing is sent while there is data in the sending queue, so the order
+ * of tcp_send() and tcp_send_file() is kept. Use tcp_set_send() to know
+ * when to try again.
+ *
+ * @param tc     TCP Connection
+ * @param fd     File descriptor, open for reading
+ * @param offset Offset in the file
+ * @param len    Number of bytes to send
+ * @param sentp  Returned number of bytes sent
+ *
+ * @return 0 if success, EAGAIN to try again later, ENOTSUP if a TCP-helper
+ *         must see the data, otherwise errorcode
+ */
+int tcp_send_file(struct tcp_conn *tc, int fd, uint64_t offset, size_t len,
+		  size_t *sentp)
+{
+#ifdef HAVE_SENDFILE
+	off_t off = (off_t)offset;
+	ssize_t n;
+#endif
+
+	if (!tc || fd < 0 || !len || !sentp)
+		return EINVAL;
+
+	*sentp = 0;
+
+	if (tc->fdc < 0)
+		return ENOTCONN;
+
+	if (!helpers_passthru(tc))
+		return ENOTSUP;
+
+#ifdef HAVE_SENDFILE
+	if (tc->sendq.head || tc->corked)
+		return EAGAIN;
+
+	n = sendfile(tc->fdc, fd, &off, len);
+	if (n < 0)
+		return errno;
+
+	re_metric_add(&m_tx_bytes, (uint64_t)n);
+
+	/* the file is shorter than expected */
+	if (n == 0)
+		return ENODATA;
+
+	*sentp = n;
+
+	return 0;
+#else
+	(void)offset;
+
+	return ENOSYS;
+#endif
+}
+
+
 /**
  * Set the send handler on a TCP Connection, which will be called
  * every time it is ready to send data
@@ -1321,6 +2088,138 @@ void tcp_conn_rxsz_set(struct tcp_conn *tc, size_t rxsz)
 }
 
 
+/**
+ * Let the send queue of a TCP Connection keep references to the buffers
+ * passed to tcp_send(), instead of copies of the data. The data in a
+ * buffer must then not be modified after it was sent.
+ *
+ * @param tc     TCP Connection
+ * @param enable True to queue references, false to queue copies
+ */
+void tcp_conn_txref_set(struct tcp_conn *tc, bool enable)
+{
+	if (!tc)
+		return;
+
+	tc->txref = enable;
+}
+
+
+/**
+ * Enable zero-copy sending (MSG_ZEROCOPY) on a TCP Connection. The sent
+ * buffers are referenced until the kernel reports that it is done with
+ * them, so the data in a buffer must not be modified after it was sent.
+ * This also enables tcp_conn_txref_set(). Zero-copy sending pays off for
+ * large buffers only, typically above 10 KB.
+ *
+ * @param tc     TCP Connection
+ * @param enable True to enable, false to disable
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int tcp_conn_zerocopy_set(struct tcp_conn *tc, bool enable)
+{
+#ifdef HAVE_TCP_ZEROCOPY
+	const int on = enable;
+
+	if (!tc)
+		return EINVAL;
+
+	if (enable && 0 != setsockopt(tc->fdc, SOL_SOCKET, SO_ZEROCOPY,
+				      &on, sizeof(on)))
+		return errno;
+
+	tc->zc = enable;
+
+	if (enable)
+		tc->txref = true;
+
+	return 0;
+#else
+	if (!tc)
+		return EINVAL;
+
+	return enable ? ENOSYS : 0;
+#endif
+}
+
+
+/**
+ * Enable TCP Fast Open (RFC 7413) on an outgoing TCP Connection. Must
+ * be called before tcp_conn_connect(). The connection is then reported
+ * as established at once, and the first data that is sent goes in the
+ * SYN if the peer has given a Fast Open cookie before; otherwise it is
+ * sent after the handshake. Only use it for requests that are safe to
+ * repeat, as the data in a SYN may be delivered twice.
+ *
+ * @param tc     TCP Connection
+ * @param enable True to enable, false to disable
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int tcp_conn_fastopen_set(struct tcp_conn *tc, bool enable)
+{
+#ifdef HAVE_TCP_FASTOPEN
+	if (!tc || tc->fdc < 0 || tc->active)
+		return EINVAL;
+
+#ifndef HAVE_CONNECTX
+	{
+		const int on = enable;
+
+		if (0 != setsockopt(tc->fdc, IPPROTO_TCP,
+				    TCP_FASTOPEN_CONNECT,
+				    BUF_CAST &on, sizeof(on)))
+			return errno;
+	}
+#endif
+
+	tc->tfo = enable;
+
+	return 0;
+#else
+	if (!tc)
+		return EINVAL;
+
+	return enable ? ENOSYS : 0;
+#endif
+}
+
+
+/**
+ * Cork or uncork a TCP Connection. While corked, sent data is queued, and
+ * uncorking sends all of it at once, so that several tcp_send() calls
+ * leave as full-sized segments.
+ *
+ * @param tc   TCP Connection
+ * @param cork True to cork, false to uncork
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int tcp_conn_cork(struct tcp_conn *tc, bool cork)
+{
+	int err;
+
+	if (!tc)
+		return EINVAL;
+
+	if (tc->corked == cork)
+		return 0;
+
+	tc->corked = cork;
+
+	if (cork || !tc->sendq.head || !tc->connected)
+		return 0;
+
+	err = dequeue(tc);
+	if (err)
+		return err;
+
+	/* Poll for writing if data is left, or until the queue is empty */
+	return fd_listen(tc->fdc, FD_READ | FD_WRITE, tcp_recv_handler, tc);
+}
+
+
 /**
  * Set the maximum send queue size on a TCP Connection
  *
@@ -1413,3 +2312,20 @@ int tcp_register_helper(struct tcp_helper **thp, struct tcp_conn *tc,
 
 	return 0;
 }
+
+
+/**
+ * Mark a TCP-helper as passing the sent data through unchanged, so that
+ * data which bypasses the helpers, such as a file sent with
+ * tcp_send_file(), can be sent on the TCP Connection
+ *
+ * @param th       TCP helper
+ * @param passthru True if the helper does not change the sent data
+ */
+void tcp_helper_set_passthru(struct tcp_helper *th, bool passthru)
+{
+	if (!th)
+		return;
+
+	th->passthru = passthru;
+}
@@ -0,0 +1,261 @@
+/**
+ * @file tcp_he.c  Happy Eyeballs TCP connect (RFC 8305)
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <re_types.h>
+#include <re_mem.h>
+#include <re_mbuf.h>
+#include <re_list.h>
+#include <re_sa.h>
+#include <re_tmr.h>
+#include <re_tcp.h>
+
+
+/*
+ * The addresses are tried with the address families alternating, IPv6
+ * first. A new attempt is started when the previous one has not been
+ * established within the connection attempt delay, or at once when it
+ * failed, and the attempts already started keep running. The first
+ * established connection is handed to the caller and the others are
+ * closed.
+ */
+
+
+enum {
+	HE_ADDR_MAX = 16,
+	HE_DELAY    = 250,  /**< Connection attempt delay [ms] */
+};
+
+
+/** Defines a Happy Eyeballs connect */
+struct tcp_he {
+	struct list attl;              /**< Running attempts             */
+	struct tmr tmr;                /**< Connection attempt delay     */
+	struct sa addrv[HE_ADDR_MAX];  /**< Addresses in the order tried */
+	uint32_t addrc;                /**< Number of addresses          */
+	uint32_t next;                 /**< Next address to try          */
+	int err;                       /**< Error of the last attempt    */
+	tcp_he_prep_h *preph;
+	tcp_he_h *heh;
+	void *arg;
+};
+
+/** Connection attempt */
+struct he_att {
+	struct le le;
+	struct sa peer;
+	struct tcp_he *he;
+	struct tcp_conn *tc;
+	void *ctx;
+};
+
+
+static void he_destructor(void *arg)
+{
+	struct tcp_he *he = arg;
+
+	tmr_cancel(&he->tmr);
+	list_flush(&he->attl);
+}
+
+
+static void att_destructor(void *arg)
+{
+	struct he_att *att = arg;
+
+	list_unlink(&att->le);
+	mem_deref(att->ctx);
+	mem_deref(att->tc);
+}
+
+
+static void he_complete(struct tcp_he *he, int err, struct tcp_conn *tc,
+			void *ctx, const struct sa *peer)
+{
+	tcp_he_h *heh = he->heh;
+
+	he->heh = NULL;
+	tmr_cancel(&he->tmr);
+	list_flush(&he->attl);
+
+	if (heh)
+		heh(err, tc, ctx, peer, he->arg);
+}
+
+
+static void att_estab_handler(void *arg)
+{
+	struct he_att *att = arg;
+	struct tcp_conn *tc = att->tc;
+	struct sa peer = att->peer;
+	void *ctx = att->ctx;
+
+	/* the caller sets its own handlers */
+	tcp_set_handlers(tc, NULL, NULL, NULL, NULL);
+
+	att->tc  = NULL;
+	att->ctx = NULL;
+
+	he_complete(att->he, 0, tc, ctx, &peer);
+}
+
+
+static bool he_next(struct tcp_he *he);
+
+
+static void att_close_handler(int err, void *arg)
+{
+	struct he_att *att = arg;
+	struct tcp_he *he = att->he;
+
+	he->err = err ? err : ECONNRESET;
+	mem_deref(att);
+
+	/* try the next address now */
+	if (!he_next(he) && list_isempty(&he->attl))
+		he_complete(he, he->err, NULL, NULL, NULL);
+}
+
+
+static void tmr_handler(void *arg)
+{
+	struct tcp_he *he = arg;
+
+	if (!he_next(he) && list_isempty(&he->attl))
+		he_complete(he, he->err, NULL, NULL, NULL);
+}
+
+
+static int att_start(struct tcp_he *he, const struct sa *peer)
+{
+	struct he_att *att;
+	int err;
+
+	att = mem_zalloc(sizeof(*att), att_destructor);
+	if (!att)
+		return ENOMEM;
+
+	list_append(&he->attl, &att->le, att);
+
+	att->peer = *peer;
+	att->he   = he;
+
+	err = tcp_connect(&att->tc, peer, att_estab_handler, NULL,
+			  att_close_handler, att);
+	if (err)
+		goto out;
+
+	if (he->preph)
+		err = he->preph(&att->ctx, att->tc, peer, he->arg);
+
+ out:
+	if (err)
+		mem_deref(att);
+
+	return err;
+}
+
+
+/* Start an attempt with the next address, false if none was started */
+static bool he_next(struct tcp_he *he)
+{
+	while (he->next < he->addrc) {
+
+		int err = att_start(he, &he->addrv[he->next++]);
+		if (err) {
+			he->err = err;
+			continue;
+		}
+
+		if (he->next < he->addrc)
+			tmr_start(&he->tmr, HE_DELAY, tmr_handler, he);
+		else
+			tmr_cancel(&he->tmr);
+
+		return true;
+	}
+
+	return false;
+}
+
+
+/* Alternate the address families, IPv6 first (RFC 8305 section 4) */
+static void addr_interleave(struct sa *addrv, uint32_t addrc)
+{
+	uint8_t v6[HE_ADDR_MAX], v4[HE_ADDR_MAX];
+	uint32_t i, n6 = 0, n4 = 0, i6 = 0, i4 = 0;
+	struct sa tmp[HE_ADDR_MAX];
+
+	for (i=0; i<addrc; i++) {
+
+		tmp[i] = addrv[i];
+
+		if (sa_af(&addrv[i]) == AF_INET6)
+			v6[n6++] = (uint8_t)i;
+		else
+			v4[n4++] = (uint8_t)i;
+	}
+
+	for (i=0; i<addrc; i++) {
+
+		const bool six = (i & 1) ? i4 >= n4 : i6 < n6;
+
+		addrv[i] = six ? tmp[v6[i6++]] : tmp[v4[i4++]];
+	}
+}
+
+
+/**
+ * Connect to one of several addresses of a peer, racing the connection
+ * attempts as described in RFC 8305. The handler is called once, from the
+ * main loop, with the first established connection. It must set its own
+ * handlers on the connection, with tcp_set_handlers().
+ *
+ * @param hep   Pointer to allocated Happy Eyeballs connect
+ * @param addrv Network addresses of peer
+ * @param addrc Number of addresses
+ * @param preph Optional prepare handler for each attempt
+ * @param heh   Happy Eyeballs handler
+ * @param arg   Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int tcp_he_connect(struct tcp_he **hep, const struct sa *addrv,
+		   uint32_t addrc, tcp_he_prep_h *preph, tcp_he_h *heh,
+		   void *arg)
+{
+	struct tcp_he *he;
+	uint32_t i;
+	int err;
+
+	if (!hep || !addrv || !addrc || !heh)
+		return EINVAL;
+
+	he = mem_zalloc(sizeof(*he), he_destructor);
+	if (!he)
+		return ENOMEM;
+
+	list_init(&he->attl);
+	tmr_init(&he->tmr);
+
+	he->addrc = min(addrc, (uint32_t)HE_ADDR_MAX);
+	for (i=0; i<he->addrc; i++)
+		he->addrv[i] = addrv[i];
+
+	addr_interleave(he->addrv, he->addrc);
+
+	he->preph = preph;
+	he->heh   = heh;
+	he->arg   = arg;
+
+	if (he_next(he)) {
+		*hep = he;
+		return 0;
+	}
+
+	err = he->err;
+	mem_deref(he);
+
+	return err;
+}
@@ -6,6 +6,7 @@
 #include <re_types.h>
 #include <re_mem.h>
 #include <re_mbuf.h>
+#include <re_sa.h>
 #include <re_tcp.h>
 
 
@@ -50,6 +51,53 @@ int tcp_listen(struct tcp_sock **tsp, const struct sa *local,
 }
 
 
+/**
+ * Create and listen on a TCP Socket that shares its local port with other
+ * sockets (SO_REUSEPORT). The kernel distributes the incoming connections
+ * between the sockets, so one socket can be opened per thread.
+ *
+ * @param tsp   Pointer to returned TCP Socket
+ * @param local Local listen address, with a non-zero port
+ * @param ch    Incoming connection handler
+ * @param arg   Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int tcp_listen_reuseport(struct tcp_sock **tsp, const struct sa *local,
+			 tcp_conn_h *ch, void *arg)
+{
+	struct tcp_sock *ts = NULL;
+	int err;
+
+	if (!tsp || !local || !sa_port(local))
+		return EINVAL;
+
+	err = tcp_sock_alloc(&ts, local, ch, arg);
+	if (err)
+		goto out;
+
+	err = tcp_sock_reuseport_set(ts, true);
+	if (err)
+		goto out;
+
+	err = tcp_sock_bind(ts, local);
+	if (err)
+		goto out;
+
+	err = tcp_sock_listen(ts, 5);
+	if (err)
+		goto out;
+
+ out:
+	if (err)
+		ts = mem_deref(ts);
+	else
+		*tsp = ts;
+
+	return err;
+}
+
+
 /**
  * Make a TCP Connection to a remote peer
  *
@@ -4,6 +4,7 @@
  * Copyright (C) 2010 Creytiv.com
  */
 #include <string.h>
+#include <time.h>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 #include <openssl/rsa.h>
@@ -15,12 +16,17 @@
 #include <re_fmt.h>
 #include <re_mem.h>
 #include <re_mbuf.h>
+#include <re_list.h>
+#include <re_hash.h>
+#include <re_lock.h>
 #include <re_main.h>
 #include <re_sa.h>
 #include <re_net.h>
 #include <re_srtp.h>
 #include <re_sys.h>
 #include <re_tcp.h>
+#include <re_tmr.h>
+#include <re_snap.h>
 #include <re_tls.h>
 #include "tls.h"
 
@@ -41,11 +47,311 @@ struct tls_conn {
 	SSL *ssl;
 };
 
+/** Maximum number of cached client sessions per TLS context */
+enum { TLS_SESS_MAX = 256 };
+
+/** Maximum number of cached verification results per TLS context */
+enum { TLS_VRFY_MAX = 256 };
+
+/** Cached client session */
+struct tls_sess {
+	struct le he;          /**< Hash element, keyed by peer      */
+	struct le le;          /**< List element, oldest first       */
+	char *key;             /**< Peer address and server name     */
+	SSL_SESSION *sess;     /**< OpenSSL session                  */
+};
+
+/** Cached certificate verification result */
+struct tls_vrfy {
+	struct le he;          /**< Hash element, keyed by leaf      */
+	struct le le;          /**< List element, oldest first       */
+	uint8_t md[32];        /**< SHA-256 fingerprint of the leaf  */
+	char *host;            /**< Verified hostname, or empty      */
+	uint64_t expires;      /**< Expiry time in [ms]              */
+};
+
+
+static void sess_destructor(void *data)
+{
+	struct tls_sess *ts = data;
+
+	hash_unlink(&ts->he);
+	list_unlink(&ts->le);
+	mem_deref(ts->key);
+	SSL_SESSION_free(ts->sess);
+}
+
+
+static bool sess_cmp(struct le *le, void *arg)
+{
+	const struct tls_sess *ts = le->data;
+
+	return 0 == str_cmp(ts->key, arg);
+}
+
+
+static struct tls_sess *sess_lookup(const struct tls *tls, const char *key)
+{
+	return list_ledata(hash_lookup(tls->sessh, hash_joaat_str(key),
+				       sess_cmp, (void *)key));
+}
+
+
+/* Cache a client session, which is owned by the cache if successful */
+static int sess_add(struct tls *tls, const char *key, SSL_SESSION *sess)
+{
+	struct tls_sess *ts;
+
+	ts = mem_zalloc(sizeof(*ts), sess_destructor);
+	if (!ts)
+		return ENOMEM;
+
+	if (str_dup(&ts->key, key)) {
+		mem_deref(ts);
+		return ENOMEM;
+	}
+
+	ts->sess = sess;
+
+	lock_write_get(tls->sesslock);
+
+	mem_deref(sess_lookup(tls, key));
+
+	if (list_count(&tls->sessl) >= TLS_SESS_MAX)
+		mem_deref(list_ledata(list_head(&tls->sessl)));
+
+	hash_append(tls->sessh, hash_joaat_str(key), &ts->he, ts);
+	list_append(&tls->sessl, &ts->le, ts);
+
+	lock_rel(tls->sesslock);
+
+	return 0;
+}
+
+
+/*
+ * Called by OpenSSL when a new client session was negotiated, or a new
+ * session ticket was received. Returns 1 if the cache took ownership.
+ */
+static int sess_new_handler(SSL *ssl, SSL_SESSION *sess)
+{
+	struct tls *tls = SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+	const char *key = SSL_get_app_data(ssl);
+
+	if (!tls || !key || SSL_is_server(ssl))
+		return 0;
+
+	return sess_add(tls, key, sess) ? 0 : 1;
+}
+
+
+static bool sess_expired(const SSL_SESSION *sess, uint64_t now)
+{
+	return (uint64_t)SSL_SESSION_get_time(sess) +
+		(uint64_t)SSL_SESSION_get_timeout(sess) <= now;
+}
+
+
+static int sess_init(struct tls *tls)
+{
+	int err;
+
+	err = hash_alloc(&tls->sessh, 32);
+	if (err)
+		return err;
+
+	err = lock_alloc(&tls->sesslock);
+	if (err)
+		return err;
+
+	SSL_CTX_set_app_data(tls->ctx, tls);
+	SSL_CTX_set_session_cache_mode(tls->ctx, SSL_SESS_CACHE_BOTH);
+	SSL_CTX_sess_set_new_cb(tls->ctx, sess_new_handler);
+
+	return 0;
+}
+
+
+/**
+ * Resume a cached client session, and cache the sessions negotiated on
+ * this connection. Must be called before the handshake is started.
+ *
+ * @param tls TLS Context
+ * @param ssl OpenSSL connection
+ * @param key Session key, must be valid during the connection lifetime
+ */
+void tls_sess_resume(struct tls *tls, SSL *ssl, const char *key)
+{
+	struct tls_sess *ts;
+
+	if (!tls || !ssl || !key || !tls->sessh)
+		return;
+
+	SSL_set_app_data(ssl, (void *)key);
+
+	lock_write_get(tls->sesslock);
+
+	ts = sess_lookup(tls, key);
+	if (ts) {
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L && \
+	!defined(LIBRESSL_VERSION_NUMBER)
+		if (!SSL_SESSION_is_resumable(ts->sess))
+			mem_deref(ts);
+		else
+#endif
+		if (1 != SSL_set_session(ssl, ts->sess)) {
+			ERR_clear_error();
+			mem_deref(ts);
+		}
+	}
+
+	lock_rel(tls->sesslock);
+}
+
+
+/**
+ * Add the cached client sessions of a TLS context to a snapshot, so that
+ * a restarted process can resume its sessions instead of doing full
+ * handshakes. The snapshot then holds the session secrets.
+ *
+ * @param tls  TLS Context
+ * @param snap Snapshot
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int tls_sess_snap(struct tls *tls, struct snap *snap)
+{
+	const uint64_t now = (uint64_t)time(NULL);
+	struct le *le;
+	int err = 0;
+
+	if (!tls || !snap)
+		return EINVAL;
+
+	if (!tls->sessh)
+		return 0;
+
+	lock_write_get(tls->sesslock);
+
+	for (le = tls->sessl.head; le && !err; le = le->next) {
+
+		const struct tls_sess *ts = le->data;
+		struct mbuf *mb;
+		uint8_t *der, *p;
+		int len;
+
+		if (sess_expired(ts->sess, now))
+			continue;
+
+		len = i2d_SSL_SESSION(ts->sess, NULL);
+		if (len <= 0)
+			continue;
+
+		der = mem_alloc(len, NULL);
+		if (!der) {
+			err = ENOMEM;
+			break;
+		}
+
+		p = der;
+		(void)i2d_SSL_SESSION(ts->sess, &p);
+
+		err = snap_record_begin(snap, SNAP_TLS_SESS, &mb);
+		if (!err) {
+			err  = snap_str_encode(mb, ts->key);
+			err |= mbuf_write_u32(mb, htonl((uint32_t)len));
+			err |= mbuf_write_mem(mb, der, len);
+
+			err = snap_record_end(snap, err);
+		}
+
+		mem_deref(der);
+	}
+
+	lock_rel(tls->sesslock);
+
+	return err;
+}
+
+
+struct sess_restore {
+	struct tls *tls;
+	uint64_t now;
+	uint32_t n;
+};
+
+
+static bool sess_restore_handler(uint16_t type, struct mbuf *mb, void *arg)
+{
+	struct sess_restore *r = arg;
+	const unsigned char *p;
+	SSL_SESSION *sess;
+	char *key = NULL;
+	size_t len;
+	(void)type;
+
+	if (snap_str_decode(mb, &key) || !key || mbuf_get_left(mb) < 4)
+		goto out;
+
+	len = ntohl(mbuf_read_u32(mb));
+	if (!len || len > mbuf_get_left(mb) || len > INT32_MAX)
+		goto out;
+
+	p = mbuf_buf(mb);
+	sess = d2i_SSL_SESSION(NULL, &p, (long)len);
+	if (!sess) {
+		ERR_clear_error();
+		goto out;
+	}
+
+	if (sess_expired(sess, r->now) || sess_add(r->tls, key, sess))
+		SSL_SESSION_free(sess);
+	else
+		++r->n;
+
+ out:
+	mem_deref(key);
+
+	return false;
+}
+
+
+/**
+ * Restore the cached client sessions of a TLS context from a snapshot.
+ * Sessions that have expired since are skipped.
+ *
+ * @param tls  TLS Context
+ * @param snap Snapshot
+ *
+ * @return Number of restored sessions
+ */
+uint32_t tls_sess_restore(struct tls *tls, const struct snap *snap)
+{
+	struct sess_restore r;
+
+	if (!tls || !snap || !tls->sessh)
+		return 0;
+
+	r.tls = tls;
+	r.now = (uint64_t)time(NULL);
+	r.n   = 0;
+
+	(void)snap_apply(snap, SNAP_TLS_SESS, sess_restore_handler, &r);
+
+	return r.n;
+}
+
 
 static void destructor(void *data)
 {
 	struct tls *tls = data;
 
+	hash_flush(tls->sessh);
+	mem_deref(tls->sessh);
+	hash_flush(tls->vrfyh);
+	mem_deref(tls->vrfyh);
+	mem_deref(tls->sesslock);
+
 	if (tls->ctx)
 		SSL_CTX_free(tls->ctx);
 
@@ -53,6 +359,7 @@ static void destructor(void *data)
 		X509_free(tls->cert);
 
 	mem_deref(tls->pass);
+	mem_deref(tls->alpn);
 }
 
 
@@ -159,6 +466,10 @@ int tls_alloc(struct tls **tlsp, enum tls_method method, const char *keyfile,
 		goto out;
 	}
 
+	err = sess_init(tls);
+	if (err)
+		goto out;
+
 #if (OPENSSL_VERSION_NUMBER < 0x00905100L)
 	SSL_CTX_set_verify_depth(tls->ctx, 1);
 #endif
@@ -950,6 +1261,227 @@ int tls_set_ciphers(struct tls *tls, const char *cipherv[], size_t count)
 }
 
 
+/**
+ * Enable or disable kernel TLS offload for TLS/TCP connections. When
+ * enabled, the record layer of a TLS 1.2 connection using AES-GCM or
+ * ChaCha20-Poly1305 is handed over to the kernel after the handshake,
+ * so that records are encrypted and decrypted in the kernel instead of
+ * passing through OpenSSL. Other connections stay in user space.
+ *
+ * @param tls    TLS Context
+ * @param enable True to enable, false to disable
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int tls_set_ktls(struct tls *tls, bool enable)
+{
+	if (!tls)
+		return EINVAL;
+
+#ifdef TLS_KTLS
+	tls->ktls = enable;
+
+	return 0;
+#else
+	return enable ? ENOSYS : 0;
+#endif
+}
+
+
+/**
+ * Enable or disable coalescing of sends on TLS/TCP connections. When
+ * enabled, the data of the tcp_send() calls made in one iteration of the
+ * main loop is written as full-sized TLS records, when it fills a record
+ * or at the end of the iteration, instead of one record per send. An
+ * error of a delayed write is returned by the next tcp_send().
+ *
+ * @param tls    TLS Context
+ * @param enable True to enable, false to disable
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int tls_set_coalesce(struct tls *tls, bool enable)
+{
+	if (!tls)
+		return EINVAL;
+
+	tls->coalesce = enable;
+
+	return 0;
+}
+
+
+/**
+ * Enable or disable asynchronous handshakes, with SSL_MODE_ASYNC. An
+ * engine that supports OpenSSL async jobs, e.g. for private keys in an
+ * HSM, can then pause the handshake of a TLS/TCP connection while it
+ * signs on another thread. The handshake is resumed from the main loop
+ * when the wait fd of the engine is readable, instead of blocking it.
+ *
+ * @param tls    TLS Context
+ * @param enable True to enable, false to disable
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int tls_set_async(struct tls *tls, bool enable)
+{
+	if (!tls)
+		return EINVAL;
+
+#ifdef TLS_ASYNC
+	if (enable)
+		SSL_CTX_set_mode(tls->ctx, SSL_MODE_ASYNC);
+	else
+		SSL_CTX_clear_mode(tls->ctx, SSL_MODE_ASYNC);
+
+	return 0;
+#else
+	return enable ? ENOSYS : 0;
+#endif
+}
+
+
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+/* The server picks the first of its protocols that the client offers */
+static int alpn_select_handler(SSL *ssl, const unsigned char **out,
+			       unsigned char *outlen, const unsigned char *in,
+			       unsigned int inlen, void *arg)
+{
+	struct tls *tls = arg;
+	unsigned char *sel;
+	int r;
+	(void)ssl;
+
+	if (!tls->alpn)
+		return SSL_TLSEXT_ERR_NOACK;
+
+	r = SSL_select_next_proto(&sel, outlen, tls->alpn,
+				  (unsigned int)tls->alpn_len, in, inlen);
+	if (r != OPENSSL_NPN_NEGOTIATED)
+		return SSL_TLSEXT_ERR_NOACK;
+
+	*out = sel;
+
+	return SSL_TLSEXT_ERR_OK;
+}
+#endif
+
+
+/**
+ * Set the application protocols for this TLS context (ALPN, RFC 7301).
+ * A client offers the protocols, and a server selects the first of the
+ * protocols that the client offers.
+ *
+ * @param tls    TLS Context
+ * @param protov Vector of protocol names, in order of priority
+ * @param protoc Number of protocol names, 0 to not use ALPN
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int tls_set_alpn(struct tls *tls, const char *protov[], size_t protoc)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+	struct mbuf *mb;
+	size_t i;
+	int err = 0;
+
+	if (!tls || (!protov && protoc))
+		return EINVAL;
+
+	tls->alpn = mem_deref(tls->alpn);
+	tls->alpn_len = 0;
+
+	if (!protoc) {
+		(void)SSL_CTX_set_alpn_protos(tls->ctx, NULL, 0);
+		SSL_CTX_set_alpn_select_cb(tls->ctx, NULL, NULL);
+		return 0;
+	}
+
+	mb = mbuf_alloc(16 * protoc);
+	if (!mb)
+		return ENOMEM;
+
+	for (i=0; i<protoc; i++) {
+
+		const size_t len = str_len(protov[i]);
+
+		if (!len || len > 255) {
+			err = EINVAL;
+			goto out;
+		}
+
+		err  = mbuf_write_u8(mb, (uint8_t)len);
+		err |= mbuf_write_str(mb, protov[i]);
+		if (err)
+			goto out;
+	}
+
+	/* returns 0 on success */
+	if (SSL_CTX_set_alpn_protos(tls->ctx, mb->buf,
+				    (unsigned int)mb->end)) {
+		ERR_clear_error();
+		err = EPROTO;
+		goto out;
+	}
+
+	tls->alpn = mem_alloc(mb->end, NULL);
+	if (!tls->alpn) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	memcpy(tls->alpn, mb->buf, mb->end);
+	tls->alpn_len = mb->end;
+
+	SSL_CTX_set_alpn_select_cb(tls->ctx, alpn_select_handler, tls);
+
+ out:
+	mem_deref(mb);
+
+	return err;
+#else
+	(void)tls;
+	(void)protov;
+
+	return protoc ? ENOSYS : 0;
+#endif
+}
+
+
+/**
+ * Get the application protocol that was selected with ALPN
+ *
+ * @param tc    TLS Connection
+ * @param proto Returned protocol name
+ *
+ * @return 0 if success, ENOENT if no protocol was selected
+ */
+int tls_alpn_get(const struct tls_conn *tc, struct pl *proto)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+	const unsigned char *p = NULL;
+	unsigned int len = 0;
+
+	if (!tc || !proto)
+		return EINVAL;
+
+	SSL_get0_alpn_selected(tc->ssl, &p, &len);
+	if (!p || !len)
+		return ENOENT;
+
+	proto->p = (const char *)p;
+	proto->l = len;
+
+	return 0;
+#else
+	(void)tc;
+	(void)proto;
+
+	return ENOSYS;
+#endif
+}
+
+
 /**
  * Set the server name on a TLS Connection, using TLS SNI extension.
  *
@@ -1007,6 +1539,173 @@ int tls_set_verify_server(struct tls_conn *tc, const char *host)
 }
 
 
+#ifdef TLS_VERIFY_CACHE
+struct vrfy_match {
+	const uint8_t *md;
+	const char *host;
+};
+
+
+static void vrfy_destructor(void *data)
+{
+	struct tls_vrfy *tv = data;
+
+	hash_unlink(&tv->he);
+	list_unlink(&tv->le);
+	mem_deref(tv->host);
+}
+
+
+static bool vrfy_cmp(struct le *le, void *arg)
+{
+	const struct tls_vrfy *tv = le->data;
+	const struct vrfy_match *m = arg;
+
+	return 0 == memcmp(tv->md, m->md, sizeof(tv->md)) &&
+		0 == str_cmp(tv->host, m->host);
+}
+
+
+static uint32_t vrfy_key(const uint8_t *md)
+{
+	return hash_joaat(md, 32);
+}
+
+
+/* Remember a verified leaf certificate and hostname */
+static void vrfy_add(struct tls *tls, const struct vrfy_match *m,
+		     uint64_t ttl)
+{
+	struct tls_vrfy *tv;
+
+	tv = mem_zalloc(sizeof(*tv), vrfy_destructor);
+	if (!tv)
+		return;
+
+	if (str_dup(&tv->host, m->host)) {
+		mem_deref(tv);
+		return;
+	}
+
+	memcpy(tv->md, m->md, sizeof(tv->md));
+	tv->expires = tmr_jiffies() + ttl;
+
+	lock_write_get(tls->sesslock);
+
+	mem_deref(list_ledata(hash_lookup(tls->vrfyh, vrfy_key(m->md),
+					  vrfy_cmp, (void *)m)));
+
+	if (list_count(&tls->vrfyl) >= TLS_VRFY_MAX)
+		mem_deref(list_ledata(list_head(&tls->vrfyl)));
+
+	hash_append(tls->vrfyh, vrfy_key(m->md), &tv->he, tv);
+	list_append(&tls->vrfyl, &tv->le, tv);
+
+	lock_rel(tls->sesslock);
+}
+
+
+/*
+ * Called by OpenSSL instead of X509_verify_cert(). A leaf certificate
+ * that was verified for the same hostname within the lifetime of the
+ * cache is trusted without verifying the chain again.
+ */
+static int cert_verify_handler(X509_STORE_CTX *ctx, void *arg)
+{
+	struct tls *tls = arg;
+	X509 *leaf = X509_STORE_CTX_get0_cert(ctx);
+	uint8_t md[32];
+	unsigned int len = sizeof(md);
+	struct vrfy_match m;
+	struct tls_vrfy *tv;
+	bool hit = false;
+	uint64_t ttl;
+	int r;
+
+	if (!leaf || 1 != X509_digest(leaf, EVP_sha256(), md, &len))
+		return X509_verify_cert(ctx);
+
+	m.md   = md;
+	m.host = X509_VERIFY_PARAM_get0_host(X509_STORE_CTX_get0_param(ctx),
+					     0);
+	if (!m.host)
+		m.host = "";
+
+	lock_write_get(tls->sesslock);
+
+	ttl = tls->vrfy_ttl;
+
+	tv = list_ledata(hash_lookup(tls->vrfyh, vrfy_key(md),
+				     vrfy_cmp, &m));
+	if (tv && tv->expires > tmr_jiffies())
+		hit = true;
+	else
+		mem_deref(tv);
+
+	lock_rel(tls->sesslock);
+
+	/* The leaf must not have expired since */
+	if (hit && X509_cmp_current_time(X509_get0_notAfter(leaf)) > 0) {
+		X509_STORE_CTX_set_error(ctx, X509_V_OK);
+		return 1;
+	}
+
+	r = X509_verify_cert(ctx);
+	if (ttl && r == 1 && X509_STORE_CTX_get_error(ctx) == X509_V_OK)
+		vrfy_add(tls, &m, ttl);
+
+	return r;
+}
+#endif
+
+
+/**
+ * Cache successful certificate verifications. A peer that presents a
+ * leaf certificate that was verified for the same hostname within the
+ * lifetime is trusted without verifying the certificate chain again.
+ * The verified chain of such a connection is not available.
+ *
+ * @param tls TLS Context
+ * @param ttl Cache lifetime in [seconds], 0 to disable the cache
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int tls_set_verify_cache(struct tls *tls, uint32_t ttl)
+{
+#ifdef TLS_VERIFY_CACHE
+	int err;
+
+	if (!tls)
+		return EINVAL;
+
+	if (!tls->vrfyh) {
+		err = hash_alloc(&tls->vrfyh, 32);
+		if (err)
+			return err;
+
+		SSL_CTX_set_cert_verify_callback(tls->ctx, cert_verify_handler,
+						 tls);
+	}
+
+	lock_write_get(tls->sesslock);
+
+	tls->vrfy_ttl = ttl * 1000ULL;
+
+	if (!ttl)
+		hash_flush(tls->vrfyh);
+
+	lock_rel(tls->sesslock);
+
+	return 0;
+#else
+	(void)tls;
+	(void)ttl;
+
+	return ENOSYS;
+#endif
+}
+
+
 static int print_error(const char *str, size_t len, void *unused)
 {
 	(void)unused;
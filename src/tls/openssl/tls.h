@@ -25,6 +25,33 @@
 #endif
 
 
+/* Stateless DTLSv1_listen() with cookie callbacks on the context */
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L && \
+	!defined(LIBRESSL_VERSION_NUMBER)
+#define TLS_DTLS_LISTEN 1
+#endif
+
+
+/* Verify cache needs the expected hostname of the verify parameters */
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && \
+	!defined(LIBRESSL_VERSION_NUMBER)
+#define TLS_VERIFY_CACHE 1
+#endif
+
+
+/* Kernel TLS offload needs the TLS 1.2 PRF and cipher digest APIs */
+#if defined (HAVE_KTLS) && OPENSSL_VERSION_NUMBER >= 0x10101000L && \
+	!defined(LIBRESSL_VERSION_NUMBER)
+#define TLS_KTLS 1
+#endif
+
+
+/* Handshakes that pause for asynchronous engine operations */
+#if defined (SSL_MODE_ASYNC) && !defined(LIBRESSL_VERSION_NUMBER)
+#define TLS_ASYNC 1
+#endif
+
+
 #if OPENSSL_VERSION_NUMBER >= 0x10100000L
 typedef X509_NAME*(tls_get_certfield_h)(const X509 *);
 #else
@@ -36,7 +63,18 @@ struct tls {
 	SSL_CTX *ctx;
 	X509 *cert;
 	char *pass;  /* password for private key */
+	bool ktls;   /* offload TLS/TCP record layer to kernel */
+	bool coalesce;   /* coalesce TLS/TCP sends into full records */
+	struct hash *sessh;  /* client session cache, keyed by peer */
+	struct list sessl;   /* client sessions, oldest first */
+	struct lock *sesslock;   /* also protects the verify cache */
+	struct hash *vrfyh;  /* verified certificates, keyed by fingerprint */
+	struct list vrfyl;   /* verified certificates, oldest first */
+	uint64_t vrfy_ttl;   /* verify cache lifetime in [ms], 0 if off */
+	uint8_t *alpn;       /* protocols in wire format, for the server */
+	size_t alpn_len;
 };
 
 
 void tls_flush_error(void);
+void tls_sess_resume(struct tls *tls, SSL *ssl, const char *key);
@@ -4,19 +4,33 @@
  * Copyright (C) 2010 Creytiv.com
  */
 
+#include <string.h>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 #include <re_types.h>
 #include <re_fmt.h>
 #include <re_mem.h>
 #include <re_mbuf.h>
+#include <re_list.h>
 #include <re_main.h>
 #include <re_sa.h>
+#include <re_tmr.h>
 #include <re_net.h>
 #include <re_srtp.h>
 #include <re_tcp.h>
 #include <re_tls.h>
+#include <re_trace.h>
 #include "tls.h"
+#ifdef TLS_ASYNC
+#include <openssl/async.h>
+#endif
+#ifdef TLS_KTLS
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/tls.h>
+#include <openssl/kdf.h>
+#endif
 
 
 #define DEBUG_MODULE "tls"
@@ -24,6 +38,12 @@
 #include <re_dbg.h>
 
 
+enum {
+	TLS_RECORD_MAX = 16384,  /**< Maximum plaintext of a TLS record */
+	ASYNC_FDS      = 8,      /**< Wait fds of one async job         */
+};
+
+
 /* NOTE: shadow struct defined in tls_*.c */
 struct tls_conn {
 	SSL *ssl;
@@ -34,17 +54,67 @@ struct tls_conn {
 	BIO *sbio_in;
 	struct tcp_helper *th;
 	struct tcp_conn *tcp;
+	struct tls *tls;
+	char *skey;
+	struct mbuf *txmb;  /**< Plaintext to coalesce into records */
+	struct tmr tmr_tx;  /**< Flushes txmb at the end of the loop  */
+	int txerr;          /**< Error of the last coalesced write    */
+	struct tmr tmr_hs;  /**< Reports the end of an async handshake */
+	int hserr;          /**< Error of a resumed handshake         */
+	bool async;         /**< Handshake paused for an async job    */
+	bool coalesce;
 	bool active;
 	bool up;
+	bool ktls;
+	bool ktls_rx;
+	bool ktls_tx;
+};
+
+
+#ifdef TLS_KTLS
+
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+
+/** Kernel TLS crypto parameters */
+union ktls_info {
+	struct tls_crypto_info info;
+	struct tls12_crypto_info_aes_gcm_128 gcm128;
+	struct tls12_crypto_info_aes_gcm_256 gcm256;
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+	struct tls12_crypto_info_chacha20_poly1305 chacha;
+#endif
+};
+
+/** Kernel TLS key material of one direction */
+struct ktls_key {
+	const uint8_t *key;
+	const uint8_t *iv;
 };
+#endif
+
+
+static int tx_flush(struct tls_conn *tc);
+static void async_close(struct tls_conn *tc);
 
 
 static void destructor(void *arg)
 {
 	struct tls_conn *tc = arg;
 
+	tmr_cancel(&tc->tmr_tx);
+	tmr_cancel(&tc->tmr_hs);
+
 	if (tc->ssl) {
-		int r = SSL_shutdown(tc->ssl);
+		async_close(tc);
+		(void)tx_flush(tc);
+
+		/* The kernel owns the sending record layer */
+		int r = tc->ktls_tx ? 1 : SSL_shutdown(tc->ssl);
 		if (r <= 0)
 			ERR_clear_error();
 
@@ -58,6 +128,9 @@ static void destructor(void *arg)
 
 	mem_deref(tc->th);
 	mem_deref(tc->tcp);
+	mem_deref(tc->tls);
+	mem_deref(tc->skey);
+	mem_deref(tc->txmb);
 }
 
 
@@ -173,74 +246,369 @@ static struct bio_method_st bio_tcp_send = {
 #endif
 
 
-static int tls_connect(struct tls_conn *tc)
+#ifdef TLS_ASYNC
+static void async_handler(int flags, void *arg);
+
+
+/* Follow the wait fds of the async job of the handshake */
+static int async_update(struct tls_conn *tc)
+{
+	OSSL_ASYNC_FD addv[ASYNC_FDS], delv[ASYNC_FDS];
+	size_t addn = 0, deln = 0, i;
+	int err = 0;
+
+	/* There is no wait context before the first async job */
+	if (!SSL_get_changed_async_fds(tc->ssl, NULL, &addn, NULL, &deln))
+		return 0;
+
+	if (addn > ASYNC_FDS || deln > ASYNC_FDS)
+		return EOVERFLOW;
+
+	if (!addn && !deln)
+		return 0;
+
+	if (!SSL_get_changed_async_fds(tc->ssl, addv, &addn, delv, &deln))
+		return EPROTO;
+
+	for (i=0; i<deln; i++)
+		fd_close(delv[i]);
+
+	for (i=0; i<addn && !err; i++)
+		err = fd_listen(addv[i], FD_READ, async_handler, tc);
+
+	return err;
+}
+
+
+static void async_close(struct tls_conn *tc)
+{
+	OSSL_ASYNC_FD fdv[ASYNC_FDS];
+	size_t n = 0, i;
+
+	if (!SSL_get_all_async_fds(tc->ssl, NULL, &n) || !n || n > ASYNC_FDS)
+		return;
+
+	if (!SSL_get_all_async_fds(tc->ssl, fdv, &n))
+		return;
+
+	for (i=0; i<n; i++)
+		fd_close(fdv[i]);
+}
+#else
+static void async_close(struct tls_conn *tc)
 {
-	int err = 0, r;
+	(void)tc;
+}
+#endif
+
+
+/* Handle the result of a handshake step */
+static int hs_result(struct tls_conn *tc, int r, const char *what)
+{
+	const int ssl_err = r <= 0 ? SSL_get_error(tc->ssl, r) : 0;
+	int err = 0;
 
 	ERR_clear_error();
 
-	r = SSL_connect(tc->ssl);
-	if (r <= 0) {
-		const int ssl_err = SSL_get_error(tc->ssl, r);
+	tc->async = false;
 
-		ERR_clear_error();
+	switch (ssl_err) {
 
-		switch (ssl_err) {
+	case 0:
+	case SSL_ERROR_WANT_READ:
+		break;
 
-		case SSL_ERROR_WANT_READ:
-			break;
+#ifdef TLS_ASYNC
+	case SSL_ERROR_WANT_ASYNC:
+		tc->async = true;
+		break;
+#endif
 
-		default:
-			DEBUG_WARNING("connect: error (r=%d, ssl_err=%d)\n",
-				      r, ssl_err);
-			err = EPROTO;
-			break;
-		}
+	default:
+		DEBUG_WARNING("%s: error (r=%d, ssl_err=%d)\n",
+			      what, r, ssl_err);
+		err = EPROTO;
+		break;
 	}
 
+#ifdef TLS_ASYNC
+	/* A failed job may have left wait fds to be released */
+	if (SSL_get_mode(tc->ssl) & SSL_MODE_ASYNC) {
+		const int uerr = async_update(tc);
+		if (!err)
+			err = uerr;
+	}
+#endif
+
 	return err;
 }
 
 
-static int tls_accept(struct tls_conn *tc)
+static int tls_connect(struct tls_conn *tc)
 {
-	int err = 0, r;
+	ERR_clear_error();
+
+	return hs_result(tc, SSL_connect(tc->ssl), "connect");
+}
+
 
+static int tls_accept(struct tls_conn *tc)
+{
 	ERR_clear_error();
 
-	r = SSL_accept(tc->ssl);
-	if (r <= 0) {
-		const int ssl_err = SSL_get_error(tc->ssl, r);
+	return hs_result(tc, SSL_accept(tc->ssl), "accept");
+}
 
-		ERR_clear_error();
 
-		switch (ssl_err) {
+#ifdef TLS_ASYNC
+static void hs_tmr_handler(void *arg)
+{
+	struct tls_conn *tc = arg;
+
+	(void)tcp_recv_helper(tc->tcp, tc->th);
+}
 
-		case SSL_ERROR_WANT_READ:
-			break;
 
-		default:
-			DEBUG_WARNING("accept error: (r=%d, ssl_err=%d)\n",
-				      r, ssl_err);
-			err = EPROTO;
-			break;
-		}
+/*
+ * The async job of the handshake is ready to resume. The peer may have
+ * nothing more to send, so the end of the handshake, or its error, is
+ * reported through the receive path from the main loop.
+ */
+static void async_handler(int flags, void *arg)
+{
+	struct tls_conn *tc = arg;
+	int err;
+
+	(void)flags;
+
+	if (!tc->async)
+		return;
+
+	err = tc->active ? tls_connect(tc) : tls_accept(tc);
+	if (err) {
+		DEBUG_WARNING("async handshake: %m\n", err);
+		tc->hserr = err;
 	}
 
+	if (err || (!tc->async && SSL_state(tc->ssl) == SSL_ST_OK))
+		tmr_start(&tc->tmr_hs, 0, hs_tmr_handler, tc);
+}
+#endif
+
+
+#ifdef TLS_KTLS
+/* Derive the TLS 1.2 key block (RFC 5246 section 6.3) */
+static int ktls_keyblock(SSL *ssl, const EVP_MD *md, uint8_t *kb, size_t len)
+{
+	static const uint8_t label[] = "key expansion";
+	uint8_t ms[SSL_MAX_MASTER_KEY_LENGTH];
+	uint8_t seed[2 * SSL3_RANDOM_SIZE];
+	EVP_PKEY_CTX *pctx;
+	size_t msl;
+	int err = EPROTO;
+
+	msl = SSL_SESSION_get_master_key(SSL_get_session(ssl), ms, sizeof(ms));
+	if (!msl || !md)
+		return EPROTO;
+
+	(void)SSL_get_server_random(ssl, seed, SSL3_RANDOM_SIZE);
+	(void)SSL_get_client_random(ssl, seed + SSL3_RANDOM_SIZE,
+				    SSL3_RANDOM_SIZE);
+
+	pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_TLS1_PRF, NULL);
+	if (!pctx)
+		goto out;
+
+	if (EVP_PKEY_derive_init(pctx) <= 0 ||
+	    EVP_PKEY_CTX_set_tls1_prf_md(pctx, md) <= 0 ||
+	    EVP_PKEY_CTX_set1_tls1_prf_secret(pctx, ms, (int)msl) <= 0 ||
+	    EVP_PKEY_CTX_add1_tls1_prf_seed(pctx, label,
+					    (int)sizeof(label) - 1) <= 0 ||
+	    EVP_PKEY_CTX_add1_tls1_prf_seed(pctx, seed,
+					    (int)sizeof(seed)) <= 0 ||
+	    EVP_PKEY_derive(pctx, kb, &len) <= 0)
+		goto out;
+
+	err = 0;
+
+ out:
+	EVP_PKEY_CTX_free(pctx);
+	OPENSSL_cleanse(ms, sizeof(ms));
+	ERR_clear_error();
+
 	return err;
 }
 
 
+static size_t ktls_info_set(union ktls_info *ki, int nid,
+			    const struct ktls_key *k, uint64_t seq)
+{
+	uint8_t rec_seq[8];
+	int i;
+
+	for (i=7; i>=0; i--) {
+		rec_seq[i] = (uint8_t)seq;
+		seq >>= 8;
+	}
+
+	memset(ki, 0, sizeof(*ki));
+	ki->info.version = TLS_1_2_VERSION;
+
+	/* The explicit nonce of AES-GCM starts at the sequence number */
+	switch (nid) {
+
+	case NID_aes_128_gcm:
+		ki->info.cipher_type = TLS_CIPHER_AES_GCM_128;
+		memcpy(ki->gcm128.key, k->key, sizeof(ki->gcm128.key));
+		memcpy(ki->gcm128.salt, k->iv, sizeof(ki->gcm128.salt));
+		memcpy(ki->gcm128.iv, rec_seq, sizeof(ki->gcm128.iv));
+		memcpy(ki->gcm128.rec_seq, rec_seq, sizeof(rec_seq));
+		return sizeof(ki->gcm128);
+
+	case NID_aes_256_gcm:
+		ki->info.cipher_type = TLS_CIPHER_AES_GCM_256;
+		memcpy(ki->gcm256.key, k->key, sizeof(ki->gcm256.key));
+		memcpy(ki->gcm256.salt, k->iv, sizeof(ki->gcm256.salt));
+		memcpy(ki->gcm256.iv, rec_seq, sizeof(ki->gcm256.iv));
+		memcpy(ki->gcm256.rec_seq, rec_seq, sizeof(rec_seq));
+		return sizeof(ki->gcm256);
+
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+	case NID_chacha20_poly1305:
+		ki->info.cipher_type = TLS_CIPHER_CHACHA20_POLY1305;
+		memcpy(ki->chacha.key, k->key, sizeof(ki->chacha.key));
+		memcpy(ki->chacha.iv, k->iv, sizeof(ki->chacha.iv));
+		memcpy(ki->chacha.rec_seq, rec_seq, sizeof(rec_seq));
+		return sizeof(ki->chacha);
+#endif
+
+	default:
+		return 0;
+	}
+}
+
+
+/*
+ * Hand the record layer over to the kernel, right after the handshake.
+ * Receiving is offloaded first, so that OpenSSL never has to read
+ * records after sending was offloaded. The Finished messages used
+ * sequence number 0, so application data starts at 1.
+ */
+static void ktls_enable(struct tls_conn *tc)
+{
+	const SSL_CIPHER *cipher = SSL_get_current_cipher(tc->ssl);
+	uint8_t kb[2 * 32 + 2 * 12];
+	struct ktls_key tx, rx;
+	union ktls_info ki;
+	size_t keylen, ivlen, len;
+	int fd, nid;
+
+	if (SSL_version(tc->ssl) != TLS1_2_VERSION || !cipher)
+		return;
+
+	/* Records that were already received must be read by OpenSSL */
+	if (BIO_ctrl_pending(tc->sbio_in) || SSL_pending(tc->ssl))
+		return;
+
+	/* Handshake data that is queued must not be encrypted again */
+	if (tcp_conn_txqsz(tc->tcp))
+		return;
+
+	nid = SSL_CIPHER_get_cipher_nid(cipher);
+	switch (nid) {
+
+	case NID_aes_128_gcm:       keylen = 16; ivlen =  4; break;
+	case NID_aes_256_gcm:       keylen = 32; ivlen =  4; break;
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+	case NID_chacha20_poly1305: keylen = 32; ivlen = 12; break;
+#endif
+	default:
+		return;
+	}
+
+	if (ktls_keyblock(tc->ssl, SSL_CIPHER_get_handshake_digest(cipher),
+			  kb, 2 * (keylen + ivlen)))
+		return;
+
+	/* Key block: client key, server key, client IV, server IV */
+	tx.key = kb;
+	rx.key = kb + keylen;
+	tx.iv  = kb + 2 * keylen;
+	rx.iv  = kb + 2 * keylen + ivlen;
+
+	if (!tc->active) {
+		struct ktls_key t = tx;
+
+		tx = rx;
+		rx = t;
+	}
+
+	fd = tcp_conn_fd(tc->tcp);
+
+	if (setsockopt(fd, IPPROTO_TCP, TCP_ULP, "tls", sizeof("tls"))) {
+		DEBUG_INFO("ktls: not available (%m)\n", errno);
+		goto out;
+	}
+
+	len = ktls_info_set(&ki, nid, &rx, 1);
+	if (setsockopt(fd, SOL_TLS, TLS_RX, &ki, (socklen_t)len)) {
+		DEBUG_INFO("ktls: rx offload failed (%m)\n", errno);
+		goto out;
+	}
+
+	tc->ktls_rx = true;
+
+	len = ktls_info_set(&ki, nid, &tx, 1);
+	if (setsockopt(fd, SOL_TLS, TLS_TX, &ki, (socklen_t)len)) {
+		DEBUG_INFO("ktls: tx offload failed (%m)\n", errno);
+		goto out;
+	}
+
+	tc->ktls_tx = true;
+	tcp_helper_set_passthru(tc->th, true);
+
+	DEBUG_INFO("ktls: offloaded %s\n", SSL_CIPHER_get_name(cipher));
+
+ out:
+	OPENSSL_cleanse(&ki, sizeof(ki));
+	OPENSSL_cleanse(kb, sizeof(kb));
+}
+#endif
+
+
+/* Client sessions are cached per peer address and server name */
+static void sess_resume(struct tls_conn *tc)
+{
+	const char *host;
+	struct sa peer;
+
+	if (tcp_conn_peer_get(tc->tcp, &peer))
+		return;
+
+	host = SSL_get_servername(tc->ssl, TLSEXT_NAMETYPE_host_name);
+
+	if (re_sdprintf(&tc->skey, "%J/%s", &peer, host ? host : ""))
+		return;
+
+	tls_sess_resume(tc->tls, tc->ssl, tc->skey);
+}
+
+
 static bool estab_handler(int *err, bool active, void *arg)
 {
 	struct tls_conn *tc = arg;
 
 	DEBUG_INFO("tcp established (active=%u)\n", active);
 
+	RE_TRACE_ASYNC_BEGIN("tls", "handshake", tc);
+
 	if (!active)
 		return true;
 
 	tc->active = true;
+
+	sess_resume(tc);
+
 	*err = tls_connect(tc);
 
 	return true;
@@ -252,37 +620,62 @@ static bool recv_handler(int *err, struct mbuf *mb, bool *estab, void *arg)
 	struct tls_conn *tc = arg;
 	int r;
 
-	/* feed SSL data to the BIO */
-	r = BIO_write(tc->sbio_in, mbuf_buf(mb), (int)mbuf_get_left(mb));
-	if (r <= 0) {
-		DEBUG_WARNING("recv: BIO_write %d\n", r);
-		ERR_clear_error();
-		*err = ENOMEM;
-		return true;
+	/* the kernel has decrypted the data */
+	if (tc->ktls_rx)
+		return false;
+
+	/* feed SSL data to the BIO, nothing is fed after an async job */
+	if (mbuf_get_left(mb)) {
+		r = BIO_write(tc->sbio_in, mbuf_buf(mb),
+			      (int)mbuf_get_left(mb));
+		if (r <= 0) {
+			DEBUG_WARNING("recv: BIO_write %d\n", r);
+			ERR_clear_error();
+			*err = ENOMEM;
+			return true;
+		}
 	}
 
-	if (SSL_state(tc->ssl) != SSL_ST_OK) {
+	if (tc->hserr) {
+		*err = tc->hserr;
+		return true;
+	}
 
-		if (tc->up) {
+	if (tc->up) {
+		if (SSL_state(tc->ssl) != SSL_ST_OK) {
 			*err = EPROTO;
 			return true;
 		}
+	}
+	else {
+		/* The data waits in the BIO while an async job runs */
+		if (tc->async)
+			return true;
 
-		if (tc->active) {
-			*err = tls_connect(tc);
-		}
-		else {
-			*err = tls_accept(tc);
-		}
+		/* The handshake may have finished from async_handler */
+		if (SSL_state(tc->ssl) != SSL_ST_OK) {
+
+			if (tc->active)
+				*err = tls_connect(tc);
+			else
+				*err = tls_accept(tc);
 
-		DEBUG_INFO("state=0x%04x\n", SSL_state(tc->ssl));
+			DEBUG_INFO("state=0x%04x\n", SSL_state(tc->ssl));
+		}
 
 		/* TLS connection is established */
-		if (SSL_state(tc->ssl) != SSL_ST_OK)
+		if (*err || SSL_state(tc->ssl) != SSL_ST_OK)
 			return true;
 
 		*estab = true;
 		tc->up = true;
+
+		RE_TRACE_ASYNC_END("tls", "handshake", tc);
+
+#ifdef TLS_KTLS
+		if (tc->ktls)
+			ktls_enable(tc);
+#endif
 	}
 
 	mbuf_set_pos(mb, 0);
@@ -328,20 +721,100 @@ static bool recv_handler(int *err, struct mbuf *mb, bool *estab, void *arg)
 }
 
 
-static bool send_handler(int *err, struct mbuf *mb, void *arg)
+static int ssl_write(struct tls_conn *tc, const uint8_t *buf, size_t len)
 {
-	struct tls_conn *tc = arg;
 	int r;
 
 	ERR_clear_error();
 
-	r = SSL_write(tc->ssl, mbuf_buf(mb), (int)mbuf_get_left(mb));
+	r = SSL_write(tc->ssl, buf, (int)len);
 	if (r <= 0) {
 		DEBUG_WARNING("SSL_write: %d\n", SSL_get_error(tc->ssl, r));
 		ERR_clear_error();
-		*err = EPROTO;
+		return EPROTO;
 	}
 
+	return 0;
+}
+
+
+/* Write the coalesced plaintext, as full-sized records */
+static int tx_flush(struct tls_conn *tc)
+{
+	struct mbuf *mb = tc->txmb;
+	int err;
+
+	tmr_cancel(&tc->tmr_tx);
+
+	if (!mb || !mb->end)
+		return 0;
+
+	err = ssl_write(tc, mb->buf, mb->end);
+
+	mb->pos = 0;
+	mb->end = 0;
+
+	return err;
+}
+
+
+static void tx_tmr_handler(void *arg)
+{
+	struct tls_conn *tc = arg;
+
+	tc->txerr = tx_flush(tc);
+}
+
+
+/*
+ * Plaintext that is sent while the main loop runs a handler is
+ * collected, and written when it fills a record or at the end of the
+ * loop iteration, from a zero timer. An error of a write that was
+ * delayed is returned by the next send.
+ */
+static int tx_coalesce(struct tls_conn *tc, struct mbuf *mb)
+{
+	int err;
+
+	if (tc->txerr) {
+		err = tc->txerr;
+		tc->txerr = 0;
+		return err;
+	}
+
+	if (!tc->txmb) {
+		tc->txmb = mbuf_alloc(TLS_RECORD_MAX);
+		if (!tc->txmb)
+			return ENOMEM;
+	}
+
+	err = mbuf_write_mem(tc->txmb, mbuf_buf(mb), mbuf_get_left(mb));
+	if (err)
+		return err;
+
+	if (tc->txmb->end >= TLS_RECORD_MAX)
+		return tx_flush(tc);
+
+	if (!tmr_isrunning(&tc->tmr_tx))
+		tmr_start(&tc->tmr_tx, 0, tx_tmr_handler, tc);
+
+	return 0;
+}
+
+
+static bool send_handler(int *err, struct mbuf *mb, void *arg)
+{
+	struct tls_conn *tc = arg;
+
+	/* the kernel encrypts the data */
+	if (tc->ktls_tx)
+		return false;
+
+	if (tc->coalesce && tc->up)
+		*err = tx_coalesce(tc, mb);
+	else
+		*err = ssl_write(tc, mbuf_buf(mb), mbuf_get_left(mb));
+
 	return true;
 }
 
@@ -375,6 +848,8 @@ int tls_start_tcp(struct tls_conn **ptc, struct tls *tls, struct tcp_conn *tcp,
 		goto out;
 
 	tc->tcp = mem_ref(tcp);
+	tc->tls = mem_ref(tls);
+	tc->coalesce = tls->coalesce;
 
 #ifdef TLS_BIO_OPAQUE
 	tc->biomet = bio_method_tcp();
@@ -422,6 +897,14 @@ int tls_start_tcp(struct tls_conn **ptc, struct tls *tls, struct tcp_conn *tcp,
 
 	SSL_set_bio(tc->ssl, tc->sbio_in, tc->sbio_out);
 
+#ifdef TLS_KTLS
+	/* The record layer must not change after it is offloaded */
+	if (tls->ktls) {
+		SSL_set_options(tc->ssl, SSL_OP_NO_RENEGOTIATION);
+		tc->ktls = true;
+	}
+#endif
+
 	err = 0;
 
  out:
@@ -432,3 +915,18 @@ int tls_start_tcp(struct tls_conn **ptc, struct tls *tls, struct tcp_conn *tcp,
 
 	return err;
 }
+
+
+/**
+ * Check if the record layer of a TLS/TCP connection is offloaded to the
+ * kernel, see tls_set_ktls(). Data sent on the TCP connection is then
+ * encrypted by the kernel, also when sent with sendfile().
+ *
+ * @param tc TLS Connection, started with tls_start_tcp()
+ *
+ * @return True if sending is offloaded, otherwise false
+ */
+bool tls_ktls_active(const struct tls_conn *tc)
+{
+	return tc ? tc->ktls_tx : false;
+}
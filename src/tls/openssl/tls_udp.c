@@ -17,7 +17,12 @@
 #include <re_srtp.h>
 #include <re_udp.h>
 #include <re_tmr.h>
+#include <re_hmac.h>
+#include <re_sys.h>
 #include <re_tls.h>
+#ifdef HAVE_PTHREAD
+#include <re_async.h>
+#endif
 #include "tls.h"
 
 
@@ -29,8 +34,35 @@
 enum {
 	MTU_DEFAULT  = 1400,
 	MTU_FALLBACK = 548,
+	RX_QUEUE_MAX = 65536,
+	COOKIE_SIZE  = 20,
+	SECRET_SIZE  = 20,
+	REC_HDR_SIZE = 13,
+	HS_HDR_SIZE  = 12,
 };
 
+enum {
+	CT_HANDSHAKE        = 22,
+	HS_CLIENT_HELLO     = 1,
+	HS_HELLO_VERIFY_REQ = 3,
+};
+
+
+/*
+ * With offload enabled on the DTLS Socket, the handshake steps run on the
+ * worker pool of re_async(). The loop thread does not touch the SSL
+ * object while a step is running: records that arrive are queued in
+ * rxmb, and records that OpenSSL writes to the BIO are queued in txmb,
+ * as a 16-bit length followed by the record. Both are handled when the
+ * step is completed on the loop thread.
+ *
+ * With cookies enabled, a ClientHello from an unknown peer is answered
+ * with a HelloVerifyRequest, without any state. The cookie is a HMAC of
+ * the peer address, and a connection is only offered to the connect
+ * handler once the ClientHello returns it. DTLSv1_listen() then checks
+ * the cookie again, and sets up the handshake sequence numbers.
+ */
+
 
 struct dtls_sock {
 	struct sa peer;
@@ -41,6 +73,9 @@ struct dtls_sock {
 	dtls_conn_h *connh;
 	void *arg;
 	size_t mtu;
+	uint8_t secret[SECRET_SIZE];
+	bool offload;
+	bool cookie;
 };
 
 
@@ -60,8 +95,11 @@ struct tls_conn {
 	dtls_recv_h *recvh;
 	dtls_close_h *closeh;
 	void *arg;
+	struct mbuf *rxmb;    /* Records received during a step   */
+	struct mbuf *txmb;    /* Records sent during a step       */
 	bool active;
 	bool up;
+	bool busy;            /* A handshake step is on a worker  */
 };
 
 
@@ -101,29 +139,64 @@ static int bio_destroy(BIO *b)
 }
 
 
-static int bio_write(BIO *b, const char *buf, int len)
+/* Get the connection of a BIO */
+static struct tls_conn *bio_conn(BIO *b)
 {
 #ifdef TLS_BIO_OPAQUE
-	struct tls_conn *tc = BIO_get_data(b);
+	return BIO_get_data(b);
 #else
-	struct tls_conn *tc = b->ptr;
+	return b->ptr;
 #endif
+}
+
+
+static int send_record(struct tls_conn *tc, const uint8_t *buf, size_t len)
+{
 	struct mbuf *mb;
 	enum {SPACE = 4};
 	int err;
 
 	mb = mbuf_alloc(SPACE + len);
 	if (!mb)
-		return -1;
+		return ENOMEM;
 
 	mb->pos = SPACE;
-	(void)mbuf_write_mem(mb, (void *)buf, len);
+	(void)mbuf_write_mem(mb, buf, len);
 	mb->pos = SPACE;
 
 	err = udp_send_helper(tc->sock->us, &tc->peer, mb, tc->sock->uh);
 
 	mem_deref(mb);
 
+	return err;
+}
+
+
+static int bio_write(BIO *b, const char *buf, int len)
+{
+	struct tls_conn *tc = bio_conn(b);
+	int err;
+
+	/* Called from a worker, the loop sends it later */
+	if (tc->busy) {
+
+		if (len > 0xffff)
+			return -1;
+
+		if (!tc->txmb) {
+			tc->txmb = mbuf_alloc(2 + len);
+			if (!tc->txmb)
+				return -1;
+		}
+
+		err  = mbuf_write_u16(tc->txmb, (uint16_t)len);
+		err |= mbuf_write_mem(tc->txmb, (const uint8_t *)buf, len);
+
+		return err ? -1 : len;
+	}
+
+	err = send_record(tc, (const uint8_t *)buf, len);
+
 	return err ? -1 : len;
 }
 
@@ -227,6 +300,8 @@ static void conn_destructor(void *arg)
 		BIO_meth_free(tc->biomet);
 #endif
 
+	mem_deref(tc->rxmb);
+	mem_deref(tc->txmb);
 	mem_deref(tc->sock);
 }
 
@@ -253,6 +328,10 @@ static void timeout(void *arg)
 
 	DEBUG_INFO("timeout\n");
 
+	/* The timer is checked again when the step is done */
+	if (tc->busy)
+		return;
+
 	if (0 <= DTLSv1_handle_timeout(tc->ssl)) {
 
 		check_timer(tc);
@@ -311,8 +390,6 @@ static int tls_connect(struct tls_conn *tc)
 		}
 	}
 
-	check_timer(tc);
-
 	return 0;
 }
 
@@ -340,8 +417,150 @@ static int tls_accept(struct tls_conn *tc)
 		}
 	}
 
+	return 0;
+}
+
+
+/* One handshake step, on the loop thread or on a worker */
+static int handshake(struct tls_conn *tc)
+{
+	return tc->active ? tls_connect(tc) : tls_accept(tc);
+}
+
+
+/*
+ * Called after a handshake step. Returns true if the connection is
+ * established, and was not dereferenced by the establish handler.
+ */
+static bool handshake_done(struct tls_conn *tc)
+{
 	check_timer(tc);
 
+	DEBUG_INFO("%s: state=0x%04x\n",
+		   tc->active ? "client" : "server",
+		   SSL_state(tc->ssl));
+
+	/* TLS connection is established */
+	if (SSL_state(tc->ssl) != SSL_ST_OK)
+		return false;
+
+	tc->up = true;
+
+	if (tc->estabh) {
+		uint32_t nrefs;
+
+		mem_ref(tc);
+
+		tc->estabh(tc->arg);
+
+		nrefs = mem_nrefs(tc);
+		mem_deref(tc);
+
+		/* check if connection was deref'd from handler */
+		if (nrefs == 1)
+			return false;
+	}
+
+	return true;
+}
+
+
+static void conn_recv(struct tls_conn *tc, struct mbuf *mb);
+
+
+#ifdef HAVE_PTHREAD
+static int handshake_work(void *arg)
+{
+	return handshake(arg);
+}
+
+
+static void handshake_complete(int err, void *arg)
+{
+	struct tls_conn *tc = arg;
+	struct mbuf *mb;
+
+	tc->busy = false;
+
+	/* Send the records of the step */
+	if (tc->txmb) {
+
+		struct mbuf *txmb = tc->txmb;
+
+		tc->txmb = NULL;
+		txmb->pos = 0;
+
+		while (mbuf_get_left(txmb) >= 2) {
+
+			const size_t len = mbuf_read_u16(txmb);
+
+			if (mbuf_get_left(txmb) < len)
+				break;
+
+			(void)send_record(tc, mbuf_buf(txmb), len);
+			mbuf_advance(txmb, len);
+		}
+
+		mem_deref(txmb);
+	}
+
+	/* The connection was dereferenced during the step */
+	if (mem_nrefs(tc) == 1)
+		goto out;
+
+	if (err) {
+		conn_close(tc, err);
+		goto out;
+	}
+
+	(void)handshake_done(tc);
+
+	/* Records that arrived during the step */
+	if (tc->rxmb && tc->ssl && mem_nrefs(tc) > 1) {
+
+		mb = tc->rxmb;
+		tc->rxmb = NULL;
+
+		mb->pos = 0;
+		conn_recv(tc, mb);
+		mem_deref(mb);
+	}
+
+ out:
+	mem_deref(tc);
+}
+#endif
+
+
+/* Run the next handshake step, on a worker if enabled */
+static int handshake_step(struct tls_conn *tc, bool *done)
+{
+	int err;
+
+	*done = false;
+
+#ifdef HAVE_PTHREAD
+	if (tc->sock->offload) {
+
+		tc->busy = true;
+
+		err = re_async(handshake_work, handshake_complete,
+			       mem_ref(tc));
+		if (!err)
+			return 0;
+
+		/* Run it here instead */
+		tc->busy = false;
+		mem_deref(tc);
+	}
+#endif
+
+	err = handshake(tc);
+	if (err)
+		return err;
+
+	*done = true;
+
 	return 0;
 }
 
@@ -353,6 +572,21 @@ static void conn_recv(struct tls_conn *tc, struct mbuf *mb)
 	if (!tc->ssl)
 		return;
 
+	/* A handshake step is running, the records are fed after it */
+	if (tc->busy) {
+
+		if (!tc->rxmb)
+			tc->rxmb = mbuf_alloc(mbuf_get_left(mb));
+
+		/* DTLS retransmits what is dropped */
+		if (!tc->rxmb || tc->rxmb->end > RX_QUEUE_MAX)
+			return;
+
+		(void)mbuf_write_mem(tc->rxmb, mbuf_buf(mb),
+				     mbuf_get_left(mb));
+		return;
+	}
+
 	/* feed SSL data to the BIO */
 	r = BIO_write(tc->sbio_in, mbuf_buf(mb), (int)mbuf_get_left(mb));
 	if (r <= 0) {
@@ -364,47 +598,21 @@ static void conn_recv(struct tls_conn *tc, struct mbuf *mb)
 
 	if (SSL_state(tc->ssl) != SSL_ST_OK) {
 
+		bool done;
+
 		if (tc->up) {
 			conn_close(tc, EPROTO);
 			return;
 		}
 
-		if (tc->active) {
-			err = tls_connect(tc);
-		}
-		else {
-			err = tls_accept(tc);
-		}
-
+		err = handshake_step(tc, &done);
 		if (err) {
 			conn_close(tc, err);
 			return;
 		}
 
-		DEBUG_INFO("%s: state=0x%04x\n",
-			   tc->active ? "client" : "server",
-			   SSL_state(tc->ssl));
-
-		/* TLS connection is established */
-		if (SSL_state(tc->ssl) != SSL_ST_OK)
+		if (!done || !handshake_done(tc))
 			return;
-
-		tc->up = true;
-
-		if (tc->estabh) {
-			uint32_t nrefs;
-
-			mem_ref(tc);
-
-			tc->estabh(tc->arg);
-
-                        nrefs = mem_nrefs(tc);
-                        mem_deref(tc);
-
-                        /* check if connection was deref'd from handler */
-                        if (nrefs == 1)
-                                return;
-		}
 	}
 
 	mbuf_set_pos(mb, 0);
@@ -557,6 +765,7 @@ int dtls_connect(struct tls_conn **ptc, struct tls *tls,
 		 dtls_close_h *closeh, void *arg)
 {
 	struct tls_conn *tc;
+	bool done;
 	int err;
 
 	if (!ptc || !tls || !sock || !peer)
@@ -568,10 +777,13 @@ int dtls_connect(struct tls_conn **ptc, struct tls *tls,
 
 	tc->active = true;
 
-	err = tls_connect(tc);
+	err = handshake_step(tc, &done);
 	if (err)
 		goto out;
 
+	if (done)
+		check_timer(tc);
+
  out:
 	if (err)
 		mem_deref(tc);
@@ -582,6 +794,100 @@ int dtls_connect(struct tls_conn **ptc, struct tls *tls,
 }
 
 
+/* HMAC of the peer address, with the secret of the DTLS Socket */
+static void cookie_gen(const struct dtls_sock *sock, const struct sa *peer,
+		       uint8_t *cookie)
+{
+	const uint16_t port = htons(sa_port(peer));
+	uint8_t buf[18];
+	size_t len = 0;
+
+	switch (sa_af(peer)) {
+
+	case AF_INET:
+		memcpy(buf, &peer->u.in.sin_addr, 4);
+		len = 4;
+		break;
+
+#ifdef HAVE_INET6
+	case AF_INET6:
+		memcpy(buf, &peer->u.in6.sin6_addr, 16);
+		len = 16;
+		break;
+#endif
+	}
+
+	memcpy(&buf[len], &port, 2);
+	len += 2;
+
+	hmac_sha1(sock->secret, sizeof(sock->secret), buf, len,
+		  cookie, COOKIE_SIZE);
+}
+
+
+#ifdef TLS_DTLS_LISTEN
+static int cookie_gen_handler(SSL *ssl, unsigned char *cookie,
+			      unsigned int *len)
+{
+	struct tls_conn *tc = bio_conn(SSL_get_wbio(ssl));
+
+	if (!tc)
+		return 0;
+
+	cookie_gen(tc->sock, &tc->peer, cookie);
+	*len = COOKIE_SIZE;
+
+	return 1;
+}
+
+
+static int cookie_verify_handler(SSL *ssl, const unsigned char *cookie,
+				 unsigned int len)
+{
+	struct tls_conn *tc = bio_conn(SSL_get_wbio(ssl));
+	uint8_t md[COOKIE_SIZE];
+
+	if (!tc || len != COOKIE_SIZE)
+		return 0;
+
+	cookie_gen(tc->sock, &tc->peer, md);
+
+	return 0 == mem_seccmp(md, cookie, len);
+}
+
+
+/* Take the verified ClientHello, after the HelloVerifyRequest */
+static int tls_listen(struct tls_conn *tc, struct tls *tls)
+{
+	BIO_ADDR *addr;
+	int r;
+
+	SSL_CTX_set_cookie_generate_cb(tls->ctx, cookie_gen_handler);
+	SSL_CTX_set_cookie_verify_cb(tls->ctx, cookie_verify_handler);
+
+	addr = BIO_ADDR_new();
+	if (!addr)
+		return ENOMEM;
+
+	ERR_clear_error();
+
+	SSL_set_accept_state(tc->ssl);
+
+	r = DTLSv1_listen(tc->ssl, addr);
+
+	BIO_ADDR_free(addr);
+
+	if (r <= 0) {
+		DEBUG_WARNING("listen error: %i\n", r);
+		tls_flush_error();
+		return EPROTO;
+	}
+
+	return 0;
+}
+#endif
+
+
 /**
  * DTLS Accept
  *
@@ -601,6 +907,7 @@ int dtls_accept(struct tls_conn **ptc, struct tls *tls,
 		dtls_close_h *closeh, void *arg)
 {
 	struct tls_conn *tc;
+	bool done;
 	int err, r;
 
 	if (!ptc || !tls || !sock || !sock->mb)
@@ -622,10 +929,21 @@ int dtls_accept(struct tls_conn **ptc, struct tls *tls,
 		goto out;
 	}
 
-	err = tls_accept(tc);
+#ifdef TLS_DTLS_LISTEN
+	if (sock->cookie) {
+		err = tls_listen(tc, tls);
+		if (err)
+			goto out;
+	}
+#endif
+
+	err = handshake_step(tc, &done);
 	if (err)
 		goto out;
 
+	if (done)
+		check_timer(tc);
+
 	sock->mb = mem_deref(sock->mb);
 
  out:
@@ -750,6 +1068,121 @@ static struct tls_conn *conn_lookup(struct dtls_sock *sock,
 }
 
 
+static uint32_t conn_key_handler(const struct le *le)
+{
+	const struct tls_conn *tc = le->data;
+
+	return sa_hash(&tc->peer, SA_ALL);
+}
+
+
+/* Send a HelloVerifyRequest for a ClientHello, it keeps no state */
+static int hello_verify_send(struct dtls_sock *sock, const struct sa *peer,
+			     const uint8_t *rec, const uint8_t *hs)
+{
+	const size_t body = 3 + COOKIE_SIZE;
+	uint8_t cookie[COOKIE_SIZE];
+	struct mbuf *mb;
+	enum {SPACE = 4};
+	int err;
+
+	mb = mbuf_alloc(SPACE + REC_HDR_SIZE + HS_HDR_SIZE + body);
+	if (!mb)
+		return ENOMEM;
+
+	mb->pos = SPACE;
+
+	/* Record header, with the sequence number of the ClientHello */
+	err  = mbuf_write_u8(mb, CT_HANDSHAKE);
+	err |= mbuf_write_u16(mb, htons(DTLS1_VERSION));
+	err |= mbuf_write_mem(mb, &rec[3], 8);
+	err |= mbuf_write_u16(mb, htons(HS_HDR_SIZE + body));
+
+	/* Handshake header, with the message_seq of the ClientHello */
+	err |= mbuf_write_u8(mb, HS_HELLO_VERIFY_REQ);
+	err |= mbuf_write_u8(mb, 0);
+	err |= mbuf_write_u16(mb, htons(body));
+	err |= mbuf_write_mem(mb, &hs[4], 2);
+	err |= mbuf_write_u8(mb, 0);
+	err |= mbuf_write_u16(mb, 0);
+	err |= mbuf_write_u8(mb, 0);
+	err |= mbuf_write_u16(mb, htons(body));
+
+	err |= mbuf_write_u16(mb, htons(DTLS1_VERSION));
+	cookie_gen(sock, peer, cookie);
+	err |= mbuf_write_u8(mb, COOKIE_SIZE);
+	err |= mbuf_write_mem(mb, cookie, sizeof(cookie));
+	if (err)
+		goto out;
+
+	mb->pos = SPACE;
+
+	err = udp_send_helper(sock->us, peer, mb, sock->uh);
+
+ out:
+	mem_deref(mb);
+
+	return err;
+}
+
+
+/*
+ * Check the cookie of a ClientHello from an unknown peer. Returns true
+ * if it is valid, otherwise a HelloVerifyRequest is sent, or the
+ * datagram is ignored.
+ */
+static bool hello_verify(struct dtls_sock *sock, const struct sa *peer,
+			 const struct mbuf *mb)
+{
+	const uint8_t *rec = mbuf_buf(mb);
+	const size_t n = mbuf_get_left(mb);
+	uint8_t cookie[COOKIE_SIZE];
+	const uint8_t *hs, *p;
+	size_t reclen, len, pos;
+
+	if (n < REC_HDR_SIZE + HS_HDR_SIZE)
+		return false;
+
+	reclen = rec[11] << 8 | rec[12];
+
+	/* A ClientHello in epoch 0, in one fragment */
+	if (rec[0] != CT_HANDSHAKE || rec[3] || rec[4] ||
+	    REC_HDR_SIZE + reclen > n || reclen < HS_HDR_SIZE)
+		return false;
+
+	hs = &rec[REC_HDR_SIZE];
+	len = hs[9] << 16 | hs[10] << 8 | hs[11];
+
+	if (hs[0] != HS_CLIENT_HELLO || hs[6] || hs[7] || hs[8] ||
+	    memcmp(&hs[1], &hs[9], 3) || HS_HDR_SIZE + len > reclen)
+		return false;
+
+	/* client_version, random, session_id and cookie */
+	p   = &hs[HS_HDR_SIZE];
+	pos = 2 + 32;
+
+	if (pos >= len)
+		return false;
+
+	pos += 1 + p[pos];
+
+	if (pos >= len || pos + 1 + p[pos] > len)
+		return false;
+
+	if (p[pos] == COOKIE_SIZE) {
+
+		cookie_gen(sock, peer, cookie);
+
+		if (0 == mem_seccmp(&p[pos + 1], cookie, COOKIE_SIZE))
+			return true;
+	}
+
+	(void)hello_verify_send(sock, peer, rec, hs);
+
+	return false;
+}
+
+
 static bool recv_handler(struct sa *src, struct mbuf *mb, void *arg)
 {
 	struct dtls_sock *sock = arg;
@@ -771,6 +1204,9 @@ static bool recv_handler(struct sa *src, struct mbuf *mb, void *arg)
 
 	if (sock->connh) {
 
+		if (sock->cookie && !hello_verify(sock, src, mb))
+			return true;
+
 		mem_deref(sock->mb);
 		sock->mb   = mem_ref(mb);
 		sock->peer = *src;
@@ -788,7 +1224,8 @@ static bool recv_handler(struct sa *src, struct mbuf *mb, void *arg)
  * @param sockp  Pointer to returned DTLS Socket
  * @param laddr  Local listen address (optional)
  * @param us     External UDP socket (optional)
- * @param htsize Connection hash table size
+ * @param htsize Initial connection hash table size, it grows with the
+ *               number of connections
  * @param layer  UDP protocol layer
  * @param connh  Connect handler
  * @param arg    Handler argument
@@ -823,10 +1260,13 @@ int dtls_listen(struct dtls_sock **sockp, const struct sa *laddr,
 	if (err)
 		goto out;
 
-	err = hash_alloc(&sock->ht, hash_valid_size(htsize));
+	err = hash_alloc_auto(&sock->ht, hash_valid_size(htsize),
+			      conn_key_handler);
 	if (err)
 		goto out;
 
+	rand_bytes(sock->secret, sizeof(sock->secret));
+
 	sock->mtu   = MTU_DEFAULT;
 	sock->connh = connh;
 	sock->arg   = arg;
@@ -869,6 +1309,59 @@ void dtls_set_mtu(struct dtls_sock *sock, size_t mtu)
 }
 
 
+/**
+ * Run the handshakes of the DTLS connections of a DTLS Socket on the
+ * worker pool of re_async(), so that the key exchange and certificate
+ * verification do not hold up the main loop. The TLS Context, and its
+ * verify handlers, are then used from worker threads.
+ *
+ * @param sock   DTLS Socket
+ * @param enable True to enable, false to run them in the main loop
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int dtls_set_offload(struct dtls_sock *sock, bool enable)
+{
+	if (!sock)
+		return EINVAL;
+
+#ifdef HAVE_PTHREAD
+	sock->offload = enable;
+
+	return 0;
+#else
+	return enable ? ENOSYS : 0;
+#endif
+}
+
+
+/**
+ * Enable stateless cookie exchange on a DTLS Socket. A ClientHello from
+ * an unknown peer is answered with a HelloVerifyRequest, and the connect
+ * handler is only called when the ClientHello returns a valid cookie,
+ * so spoofed peers cost no connection state. The cookie callbacks of
+ * the TLS Context are set by dtls_accept().
+ *
+ * @param sock   DTLS Socket
+ * @param enable True to enable, false to disable
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int dtls_set_cookie(struct dtls_sock *sock, bool enable)
+{
+	if (!sock)
+		return EINVAL;
+
+#ifdef TLS_DTLS_LISTEN
+	sock->cookie = enable;
+
+	return 0;
+#else
+	return enable ? ENOSYS : 0;
+#endif
+}
+
+
 void dtls_recv_packet(struct dtls_sock *sock, const struct sa *src,
 		      struct mbuf *mb)
 {
@@ -3,6 +3,7 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
+#define _GNU_SOURCE 1
 #include <string.h>
 #ifdef HAVE_SYS_TIME_H
 #include <sys/time.h>
@@ -21,6 +22,10 @@
 #include <re_fmt.h>
 #include <re_mem.h>
 #include <re_tmr.h>
+#include <re_main.h>
+#include <re_probe.h>
+#include <re_trace.h>
+#include <re_metric.h>
 
 
 #define DEBUG_MODULE "tmr"
@@ -37,24 +42,318 @@ enum {
 	MAX_BLOCKING = 100   /**< Maximum time spent in handler [ms] */
 };
 
+/** Timer wheel geometry */
+enum {
+	WHEEL_LEVELS = 6,                      /**< Number of levels       */
+	WHEEL_BITS0  = 8,                      /**< Level 0 slot bits      */
+	WHEEL_BITS   = 6,                      /**< Level 1-n slot bits    */
+	WHEEL_SIZE0  = 1 << WHEEL_BITS0,       /**< Level 0 slots (1 ms)   */
+	WHEEL_SIZE   = 1 << WHEEL_BITS,        /**< Level 1-n slots        */
+	WHEEL_SLOTS  = WHEEL_SIZE0 + (WHEEL_LEVELS-1) * WHEEL_SIZE,
+	WHEEL_WORDS  = WHEEL_SLOTS / 64,       /**< Occupancy bitmap words */
+	WHEEL_SPAN   = WHEEL_BITS0 + (WHEEL_LEVELS-1) * WHEEL_BITS
+};
+
+/**
+ * Hierarchical timer wheel
+ *
+ * Level 0 has one slot per millisecond, each higher level covers the whole
+ * range of the level below in one slot. Timers are placed in the level
+ * matching their distance from the wheel cursor, and are cascaded down to
+ * the lower levels when the cursor reaches the start of their slot. Expired
+ * timers are moved to the due-list of the thread, where they are executed
+ * in order.
+ *
+ * Microsecond timers are kept apart in a list sorted by expiry time, which
+ * is expected to be short as these timers are only used for pacing.
+ */
+struct tmrw {
+	struct list slot[WHEEL_SLOTS];  /**< Timer slots, all levels      */
+	struct list fine;               /**< Microsecond timers, sorted   */
+	uint64_t bitmap[WHEEL_WORDS];   /**< Non-empty slots              */
+	uint64_t cur;                   /**< Next tick to be processed    */
+	uint64_t defer;                 /**< Expiry of deferred timers    */
+	uint32_t nlvl[WHEEL_LEVELS];    /**< Number of timers per level   */
+	uint32_t n;                     /**< Number of timers in wheel    */
+};
+
+/** Upper bounds of the loop lag buckets [ms] */
+static const uint64_t lagv[] = {1, 2, 5, 10, 20, 50, 100, 200, 500, 1000};
+
+RE_METRIC_HISTOGRAM_DEFINE(m_lag, "re_loop_lag_ms", NULL,
+			   "Time from the expiry of a timer to its handler",
+			   lagv);
+RE_METRIC_HISTOGRAM_DEFINE(m_defer_lag, "re_loop_deferred_lag_ms", NULL,
+			   "Lag of timers deferred by the timer budget",
+			   lagv);
+RE_METRIC_COUNTER_DEFINE(m_deferred, "re_loop_deferred_timers_total", NULL,
+			 "Due timers deferred to the next loop iteration");
+
+/** Timer budget per call of tmr_poll(), 0 for no limit */
+static struct {
+	uint32_t count;  /**< Maximum number of handlers   */
+	uint32_t usec;   /**< Maximum time in handlers [us] */
+} budget;
+
 extern struct list *tmrl_get(void);
+extern struct tmrw **tmrw_get(void);
+extern struct hstats *hstats_get(void);
+extern uint64_t hstats_usec(void);
+extern void hstats_add(struct hstats *hs, re_hstat_fn *h, bool tmr,
+		       uint64_t usec);
+
+
+static inline unsigned lvl_shift(unsigned lvl)
+{
+	return lvl ? WHEEL_BITS0 + (lvl-1) * WHEEL_BITS : 0;
+}
+
+
+static inline unsigned slot_index(unsigned lvl, uint64_t jfs)
+{
+	if (!lvl)
+		return (unsigned)(jfs & (WHEEL_SIZE0-1));
+
+	return WHEEL_SIZE0 + (lvl-1) * WHEEL_SIZE
+		+ (unsigned)((jfs >> lvl_shift(lvl)) & (WHEEL_SIZE-1));
+}
+
+
+static inline unsigned slot_level(unsigned idx)
+{
+	if (idx < WHEEL_SIZE0)
+		return 0;
+
+	return 1 + (idx - WHEEL_SIZE0) / WHEEL_SIZE;
+}
+
+
+static inline unsigned bit_ffs(uint64_t v)
+{
+#if defined(__GNUC__)
+	return (unsigned)__builtin_ctzll(v);
+#else
+	unsigned n = 0;
+
+	while (!(v & 1)) {
+		v >>= 1;
+		++n;
+	}
+
+	return n;
+#endif
+}
+
+
+static void wheel_destructor(void *data)
+{
+	struct tmrw *w = data;
+	unsigned i;
+
+	for (i=0; i<WHEEL_SLOTS; i++)
+		list_clear(&w->slot[i]);
+
+	list_clear(&w->fine);
+}
+
+
+static struct tmrw *wheel_get(bool create)
+{
+	struct tmrw **wp = tmrw_get();
+
+	if (!*wp && create)
+		*wp = mem_zalloc(sizeof(**wp), wheel_destructor);
+
+	return *wp;
+}
+
+
+static inline bool wheel_contains(const struct tmrw *w,
+				  const struct le *le)
+{
+	return w && le->list >= &w->slot[0]
+		&& le->list < &w->slot[WHEEL_SLOTS];
+}
+
+
+static void wheel_insert(struct tmrw *w, struct tmr *tmr)
+{
+	const uint64_t span = (uint64_t)1 << WHEEL_SPAN;
+	uint64_t jfs = max(tmr->jfs, w->cur);
+	unsigned lvl, idx;
+
+	for (lvl=0; lvl<WHEEL_LEVELS-1; lvl++) {
+		if (jfs - w->cur < (uint64_t)1 << lvl_shift(lvl+1))
+			break;
+	}
+
+	/* Out of range, park it in the last slot of the top level */
+	if (jfs - w->cur >= span)
+		jfs = w->cur + span - 1;
+
+	idx = slot_index(lvl, jfs);
+
+	list_append(&w->slot[idx], &tmr->le, tmr);
+	w->bitmap[idx / 64] |= (uint64_t)1 << (idx % 64);
+	++w->nlvl[lvl];
+	++w->n;
+}
+
+
+static void wheel_unlink(struct tmrw *w, struct tmr *tmr)
+{
+	unsigned idx;
+
+	if (!wheel_contains(w, &tmr->le)) {
+		list_unlink(&tmr->le);
+		return;
+	}
+
+	idx = (unsigned)(tmr->le.list - w->slot);
 
+	list_unlink(&tmr->le);
 
-static bool inspos_handler(struct le *le, void *arg)
+	if (list_isempty(&w->slot[idx]))
+		w->bitmap[idx / 64] &= ~((uint64_t)1 << (idx % 64));
+
+	--w->nlvl[slot_level(idx)];
+	--w->n;
+}
+
+
+/* Find the next tick where a level 0 slot expires or a slot cascades */
+static bool wheel_next(const struct tmrw *w, uint64_t *tick)
 {
-	struct tmr *tmr = le->data;
-	const uint64_t now = *(uint64_t *)arg;
+	uint64_t next = ~(uint64_t)0;
+	unsigned pos, lvl, i;
+	bool found = false;
+
+	if (!w->n)
+		return false;
+
+	/* Level 0: scan 256 bits circularly from the cursor */
+	pos = (unsigned)(w->cur & (WHEEL_SIZE0-1));
+
+	for (i=0; i<=WHEEL_SIZE0/64; i++) {
+		const unsigned wi = ((pos / 64) + i) % (WHEEL_SIZE0/64);
+		uint64_t word = w->bitmap[wi];
+
+		if (i == 0)
+			word &= ~(uint64_t)0 << (pos % 64);
+		else if (i == WHEEL_SIZE0/64)
+			word &= ((uint64_t)1 << (pos % 64)) - 1;
+
+		if (word) {
+			const unsigned k = wi * 64 + bit_ffs(word);
+
+			next  = w->cur + ((k - pos) & (WHEEL_SIZE0-1));
+			found = true;
+			break;
+		}
+	}
+
+	/* Level 1-n: the cascade time of the first non-empty slot */
+	for (lvl=1; lvl<WHEEL_LEVELS; lvl++) {
+		const unsigned s = lvl_shift(lvl);
+		uint64_t word = w->bitmap[WHEEL_SIZE0/64 + lvl - 1];
+		uint64_t start, t;
 
-	return tmr->jfs <= now;
+		if (!word)
+			continue;
+
+		start = w->cur >> s;
+		if (w->cur & (((uint64_t)1 << s) - 1))
+			++start;
+
+		pos = (unsigned)(start & (WHEEL_SIZE-1));
+		if (pos)
+			word = (word >> pos) | (word << (WHEEL_SIZE - pos));
+
+		t = (start + bit_ffs(word)) << s;
+		if (t < next) {
+			next  = t;
+			found = true;
+		}
+	}
+
+	if (found)
+		*tick = next;
+
+	return found;
 }
 
 
-static bool inspos_handler_0(struct le *le, void *arg)
+static void wheel_cascade(struct tmrw *w, unsigned lvl, uint64_t tick)
 {
-	struct tmr *tmr = le->data;
-	const uint64_t now = *(uint64_t *)arg;
+	struct list *slot = &w->slot[slot_index(lvl, tick)];
+	struct list tmp = LIST_INIT;
+	struct le *le;
 
-	return tmr->jfs > now;
+	while ((le = slot->head)) {
+		wheel_unlink(w, le->data);
+		list_append(&tmp, le, le->data);
+	}
+
+	while ((le = tmp.head)) {
+		list_unlink(le);
+		wheel_insert(w, le->data);
+	}
+}
+
+
+/* Run the wheel up to and including tick 'now', collecting due timers */
+static void wheel_advance(struct tmrw *w, uint64_t now, struct list *due)
+{
+	uint64_t tick;
+
+	while (wheel_next(w, &tick) && tick <= now) {
+
+		struct list *slot;
+		struct le *le;
+		unsigned lvl;
+
+		w->cur = tick;
+
+		for (lvl=1; lvl<WHEEL_LEVELS; lvl++) {
+
+			if (tick & (((uint64_t)1 << lvl_shift(lvl)) - 1))
+				break;
+
+			wheel_cascade(w, lvl, tick);
+		}
+
+		slot = &w->slot[slot_index(0, tick)];
+
+		while ((le = slot->head)) {
+			wheel_unlink(w, le->data);
+			list_append(due, le, le->data);
+		}
+
+		w->cur = tick + 1;
+	}
+
+	if (w->cur <= now)
+		w->cur = now + 1;
+}
+
+
+/* Move the expired microsecond timers to the due-list */
+static void fine_advance(struct tmrw *w, uint64_t now, struct list *due)
+{
+	struct le *le;
+
+	while ((le = w->fine.head)) {
+		struct tmr *tmr = le->data;
+
+		if (tmr->jfs > now)
+			break;
+
+		list_unlink(le);
+
+		/* Due timers are in [ms], like the others */
+		tmr->jfs /= 1000;
+		list_append(due, le, tmr);
+	}
 }
 
 
@@ -77,23 +376,65 @@ static void call_handler(tmr_h *th, void *arg)
 #endif
 
 
+static inline bool budget_spent(uint32_t n, uint64_t start)
+{
+	if (budget.count && n >= budget.count)
+		return true;
+
+	return budget.usec && tmr_jiffies_usec() - start >= budget.usec;
+}
+
+
+/* Leave the rest of the due timers for the next iteration */
+static void defer(struct tmrw *w, struct list *tmrl, uint64_t jfs)
+{
+	if (!w)
+		w = wheel_get(true);
+	if (w)
+		w->defer = jfs;
+
+	re_metric_add(&m_deferred, list_count(tmrl));
+}
+
+
 /**
- * Poll all timers in the current thread
+ * Poll all timers in the current thread. If a timer budget is set with
+ * tmr_budget_set(), the call returns when it is spent, and the remaining
+ * due timers are run first in the next call.
  *
  * @param tmrl Timer list
  */
 void tmr_poll(struct list *tmrl)
 {
 	const uint64_t jfs = tmr_jiffies();
+	const uint64_t start = budget.usec ? tmr_jiffies_usec() : 0;
+	struct tmrw *w = wheel_get(false);
+	uint64_t deferred = 0;
+	uint32_t n = 0;
+
+	if (w) {
+		deferred = w->defer;
+		w->defer = 0;
+
+		wheel_advance(w, jfs, tmrl);
+
+		if (w->fine.head)
+			fine_advance(w, tmr_jiffies_usec(), tmrl);
+	}
 
 	for (;;) {
+		struct hstats *hs;
 		struct tmr *tmr;
+		uint64_t t0, lag;
 		tmr_h *th;
 		void *th_arg;
 
 		tmr = list_ledata(tmrl->head);
+		if (!tmr)
+			break;
 
-		if (!tmr || (tmr->jfs > jfs)) {
+		if (budget_spent(n, start)) {
+			defer(w, tmrl, jfs);
 			break;
 		}
 
@@ -107,17 +448,85 @@ void tmr_poll(struct list *tmrl)
 		if (!th)
 			continue;
 
+		++n;
+
+		lag = jfs > tmr->jfs ? jfs - tmr->jfs : 0;
+		re_metric_observe(&m_lag, lag);
+
+		/* Due in an earlier iteration, but over the budget */
+		if (deferred && tmr->jfs <= deferred)
+			re_metric_observe(&m_defer_lag, lag);
+
+		hs = hstats_get();
+		t0 = hs ? hstats_usec() : 0;
+
+		RE_TRACE_BEGIN("re", "tmr");
+		RE_PROBE1(tmr_begin, th);
+
 #if TMR_DEBUG
 		call_handler(th, th_arg);
 #else
 		th(th_arg);
 #endif
+
+		RE_PROBE1(tmr_end, th);
+		RE_TRACE_END("re", "tmr");
+
+		/* The handler may have disabled the accounting */
+		hs = hs ? hstats_get() : NULL;
+		if (hs) {
+			hstats_add(hs, (re_hstat_fn *)th, true,
+				   hstats_usec() - t0);
+		}
+	}
+}
+
+
+/**
+ * Set the timer budget of each call of tmr_poll(), so that a burst of
+ * expiring timers does not delay I/O events for the whole burst. Timers
+ * that are due but over the budget are deferred to the next iteration of
+ * the main loop, where they run before the newly expired timers.
+ *
+ * @param count Maximum number of timer handlers, 0 for no limit
+ * @param usec  Maximum time spent in timer handlers in [us], 0 for no
+ *              limit. The handler that runs over it is not interrupted.
+ */
+void tmr_budget_set(uint32_t count, uint32_t usec)
+{
+	budget.count = count;
+	budget.usec  = usec;
+}
+
+
+#if !defined(WIN32) && defined (CLOCK_MONOTONIC)
+/*
+ * The coarse clock is cheaper to read, and is used if the resolution is
+ * good enough for the timers. The first call is from libre_init().
+ */
+static clockid_t jfs_clock(void)
+{
+#if defined (CLOCK_MONOTONIC_COARSE)
+	static int coarse = -1;
+
+	if (coarse < 0) {
+		struct timespec res;
+
+		coarse = !clock_getres(CLOCK_MONOTONIC_COARSE, &res) &&
+			res.tv_sec == 0 && res.tv_nsec <= 1000000;
 	}
+
+	return coarse ? CLOCK_MONOTONIC_COARSE : CLOCK_MONOTONIC;
+#else
+	return CLOCK_MONOTONIC;
+#endif
 }
+#endif
 
 
 /**
- * Get the timer jiffies in milliseconds
+ * Get the timer jiffies in milliseconds, from a monotonic clock where
+ * available
  *
  * @return Jiffies in [ms]
  */
@@ -132,6 +541,16 @@ uint64_t tmr_jiffies(void)
 	li.LowPart = ft.dwLowDateTime;
 	li.HighPart = ft.dwHighDateTime;
 	jfs = li.QuadPart/10/1000;
+#elif defined (CLOCK_MONOTONIC)
+	struct timespec now;
+
+	if (0 != clock_gettime(jfs_clock(), &now)) {
+		DEBUG_WARNING("jiffies: clock_gettime() failed (%m)\n", errno);
+		return 0;
+	}
+
+	jfs  = (uint64_t)now.tv_sec * 1000;
+	jfs += now.tv_nsec / 1000000;
 #else
 	struct timeval now;
 
@@ -148,6 +567,28 @@ uint64_t tmr_jiffies(void)
 }
 
 
+/**
+ * Get a monotonic time stamp in microseconds
+ *
+ * @return Time in [us]
+ */
+uint64_t tmr_jiffies_usec(void)
+{
+#if !defined(WIN32) && defined (CLOCK_MONOTONIC)
+	struct timespec now;
+
+	if (0 != clock_gettime(CLOCK_MONOTONIC, &now)) {
+		DEBUG_WARNING("jiffies: clock_gettime() failed (%m)\n", errno);
+		return 0;
+	}
+
+	return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+#else
+	return tmr_jiffies() * 1000;
+#endif
+}
+
+
 /**
  * Get number of milliseconds until the next timer expires
  *
@@ -157,46 +598,104 @@ uint64_t tmr_jiffies(void)
  */
 uint64_t tmr_next_timeout(struct list *tmrl)
 {
-	const uint64_t jif = tmr_jiffies();
-	const struct tmr *tmr;
+	const uint64_t to = tmr_next_timeout_us(tmrl);
 
-	tmr = list_ledata(tmrl->head);
-	if (!tmr)
-		return 0;
+	return (to + 999) / 1000;
+}
+
+
+/**
+ * Get number of microseconds until the next timer expires
+ *
+ * @param tmrl Timer-list
+ *
+ * @return Number of [us], or 0 if no active timers
+ */
+uint64_t tmr_next_timeout_us(struct list *tmrl)
+{
+	const struct tmrw *w;
+	uint64_t jif, tick, to = 0;
 
-	if (tmr->jfs <= jif)
+	if (!list_isempty(tmrl))
 		return 1;
-	else
-		return tmr->jfs - jif;
+
+	w = wheel_get(false);
+	if (!w)
+		return 0;
+
+	if (wheel_next(w, &tick)) {
+
+		jif = tmr_jiffies();
+		to  = (tick <= jif) ? 1 : (tick - jif) * 1000;
+	}
+
+	if (w->fine.head) {
+
+		const struct tmr *tmr = w->fine.head->data;
+		uint64_t t;
+
+		jif = tmr_jiffies_usec();
+		t   = (tmr->jfs <= jif) ? 1 : tmr->jfs - jif;
+
+		if (!to || t < to)
+			to = t;
+	}
+
+	return to;
+}
+
+
+static int dump_timer(struct re_printf *pf, const struct tmr *tmr)
+{
+	return re_hprintf(pf, "  %p: th=%p expire=%llums\n",
+			  tmr, tmr->th,
+			  (unsigned long long)tmr_get_expire(tmr));
 }
 
 
 int tmr_status(struct re_printf *pf, void *unused)
 {
 	struct list *tmrl = tmrl_get();
+	const struct tmrw *w = wheel_get(false);
 	struct le *le;
 	uint32_t n;
+	unsigned i;
 	int err;
 
 	(void)unused;
 
-	n = list_count(tmrl);
+	n = list_count(tmrl) + (w ? w->n + list_count(&w->fine) : 0);
 	if (!n)
 		return 0;
 
 	err = re_hprintf(pf, "Timers (%u):\n", n);
 
-	for (le = tmrl->head; le; le = le->next) {
-		const struct tmr *tmr = le->data;
+	for (le = tmrl->head; le; le = le->next)
+		err |= dump_timer(pf, le->data);
 
-		err |= re_hprintf(pf, "  %p: th=%p expire=%llums\n",
-				  tmr, tmr->th,
-				  (unsigned long long)tmr_get_expire(tmr));
+	for (i=0; w && i<WHEEL_SLOTS; i++) {
+
+		for (le = w->slot[i].head; le; le = le->next)
+			err |= dump_timer(pf, le->data);
 	}
 
+	for (le = w ? w->fine.head : NULL; le; le = le->next)
+		err |= dump_timer(pf, le->data);
+
 	if (n > 100)
 		err |= re_hprintf(pf, "    (Dumped Timers: %u)\n", n);
 
+	if (w) {
+		err |= re_hprintf(pf, "  wheel: %u timers (levels:", w->n);
+
+		for (i=0; i<WHEEL_LEVELS; i++)
+			err |= re_hprintf(pf, " %u", w->nlvl[i]);
+
+		err |= re_hprintf(pf, ") due=%u cursor=%llu\n",
+				  list_count(tmrl),
+				  (unsigned long long)w->cur);
+	}
+
 	return err;
 }
 
@@ -206,7 +705,9 @@ int tmr_status(struct re_printf *pf, void *unused)
  */
 void tmr_debug(void)
 {
-	if (!list_isempty(tmrl_get()))
+	const struct tmrw *w = wheel_get(false);
+
+	if (!list_isempty(tmrl_get()) || (w && (w->n || w->fine.head)))
 		(void)re_fprintf(stderr, "%H", tmr_status, NULL);
 }
 
@@ -235,14 +736,14 @@ void tmr_init(struct tmr *tmr)
  */
 void tmr_start(struct tmr *tmr, uint64_t delay, tmr_h *th, void *arg)
 {
-	struct list *tmrl = tmrl_get();
-	struct le *le;
+	struct tmrw *w;
+	uint64_t jfs;
 
 	if (!tmr)
 		return;
 
 	if (tmr->th) {
-		list_unlink(&tmr->le);
+		wheel_unlink(wheel_get(false), tmr);
 	}
 
 	tmr->th  = th;
@@ -251,26 +752,76 @@ void tmr_start(struct tmr *tmr, uint64_t delay, tmr_h *th, void *arg)
 	if (!th)
 		return;
 
-	tmr->jfs = delay + tmr_jiffies();
+	w = wheel_get(true);
+	if (!w) {
+		DEBUG_WARNING("start: could not allocate timer wheel\n");
+		tmr->th = NULL;
+		return;
+	}
 
-	if (delay == 0) {
-		le = list_apply(tmrl, true, inspos_handler_0, &tmr->jfs);
-		if (le) {
-			list_insert_before(tmrl, le, &tmr->le, tmr);
-		}
-		else {
-			list_append(tmrl, &tmr->le, tmr);
-		}
+	jfs = tmr_jiffies();
+
+	/* An empty wheel can be moved freely */
+	if (!w->n)
+		w->cur = jfs;
+
+	tmr->jfs = delay + jfs;
+
+	if (tmr->jfs < w->cur && delay == 0) {
+		list_append(tmrl_get(), &tmr->le, tmr);
 	}
 	else {
-		le = list_apply(tmrl, false, inspos_handler, &tmr->jfs);
-		if (le) {
-			list_insert_after(tmrl, le, &tmr->le, tmr);
-		}
-		else {
-			list_prepend(tmrl, &tmr->le, tmr);
-		}
+		wheel_insert(w, tmr);
+	}
+}
+
+
+/**
+ * Start a timer with microsecond resolution. How close to the expiry time
+ * the handler is called depends on the polling method; poll() and epoll
+ * without epoll_pwait2() wait in whole milliseconds.
+ *
+ * @param tmr   Timer to start
+ * @param delay Timer delay in [us]
+ * @param th    Timeout handler
+ * @param arg   Handler argument
+ */
+void tmr_start_us(struct tmr *tmr, uint64_t delay, tmr_h *th, void *arg)
+{
+	struct tmrw *w;
+	struct le *le;
+
+	if (!tmr)
+		return;
+
+	tmr_cancel(tmr);
+
+	if (!th)
+		return;
+
+	w = wheel_get(true);
+	if (!w) {
+		DEBUG_WARNING("start: could not allocate timer wheel\n");
+		return;
+	}
+
+	tmr->th  = th;
+	tmr->arg = arg;
+	tmr->jfs = tmr_jiffies_usec() + delay;
+
+	/* Timers are mostly added at the end */
+	for (le = w->fine.tail; le; le = le->prev) {
+
+		const struct tmr *t = le->data;
+
+		if (t->jfs <= tmr->jfs)
+			break;
 	}
+
+	if (le)
+		list_insert_after(&w->fine, le, &tmr->le, tmr);
+	else
+		list_prepend(&w->fine, &tmr->le, tmr);
 }
 
 
@@ -294,11 +845,20 @@ void tmr_cancel(struct tmr *tmr)
  */
 uint64_t tmr_get_expire(const struct tmr *tmr)
 {
+	const struct tmrw *w;
 	uint64_t jfs;
 
 	if (!tmr || !tmr->th)
 		return 0;
 
+	w = wheel_get(false);
+	if (w && tmr->le.list == &w->fine) {
+
+		jfs = tmr_jiffies_usec();
+
+		return (tmr->jfs > jfs) ? (tmr->jfs - jfs + 999) / 1000 : 0;
+	}
+
 	jfs = tmr_jiffies();
 
 	return (tmr->jfs > jfs) ? (tmr->jfs - jfs) : 0;
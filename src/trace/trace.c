@@ -0,0 +1,446 @@
+/**
+ * @file trace.c  Event tracing, in the Chrome trace event format
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include <re_types.h>
+#include <re_fmt.h>
+#include <re_list.h>
+#include <re_tmr.h>
+#include <re_trace.h>
+
+
+/*
+ * Each thread adds its events to its own ring, without taking a lock.
+ * The rings are written to the JSON file by re_trace_flush(), which is
+ * also called by a thread that finds its ring full. The resulting file
+ * can be opened with chrome://tracing or https://ui.perfetto.dev
+ */
+
+
+enum {
+	TRACE_SLOTS = 8192,  /**< Events per thread, power of two */
+};
+
+
+#if defined (__ATOMIC_RELAXED)
+#define trace_load(p)     __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define trace_store(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define trace_inc(p)      __atomic_add_fetch((p), 1, __ATOMIC_RELAXED)
+#else
+#define trace_load(p)     (*(p))
+#define trace_store(p, v) (*(p) = (v))
+#define trace_inc(p)      (++*(p))
+#endif
+
+
+/** A trace event */
+struct trace_event {
+	const char *cat;
+	const char *name;
+	const void *id;
+	uint64_t ts;
+	char ph;
+};
+
+/** Event ring of one thread */
+struct trace_ring {
+	struct trace_ring *next;
+	uint32_t head;       /**< Written by the owner thread */
+	uint32_t tail;       /**< Written by the flush        */
+	uint32_t tid;
+	bool dead;           /**< The thread has exited       */
+	struct trace_event evv[TRACE_SLOTS];
+};
+
+/** Trace state, protected by the trace lock */
+static struct {
+	FILE *f;
+	struct trace_ring *ringl;
+	uint64_t ts0;
+	uint64_t dropped;
+	uint32_t tidc;
+	size_t evc;
+	int pid;
+	bool on;
+} trace;
+
+
+#ifdef HAVE_PTHREAD
+
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t  trace_once = PTHREAD_ONCE_INIT;
+static pthread_key_t   trace_key;
+static bool            trace_key_ok;
+
+
+static inline void trace_lock(void)
+{
+	pthread_mutex_lock(&trace_mutex);
+}
+
+
+static inline void trace_unlock(void)
+{
+	pthread_mutex_unlock(&trace_mutex);
+}
+
+#else
+
+#define trace_lock()    /**< Stub */
+#define trace_unlock()  /**< Stub */
+
+static struct trace_ring *trace_ring;
+
+#endif
+
+
+/* Called with the trace lock held */
+static void ring_free(struct trace_ring *ring)
+{
+	struct trace_ring **rp;
+
+	for (rp = &trace.ringl; *rp; rp = &(*rp)->next) {
+
+		if (*rp == ring) {
+			*rp = ring->next;
+			break;
+		}
+	}
+
+	free(ring);
+}
+
+
+#ifdef HAVE_PTHREAD
+static void ring_destructor(void *arg)
+{
+	struct trace_ring *ring = arg;
+
+	trace_lock();
+
+	/* the next flush writes its events and frees it */
+	if (trace.f)
+		trace_store(&ring->dead, true);
+	else
+		ring_free(ring);
+
+	trace_unlock();
+}
+
+
+static void trace_init(void)
+{
+	trace_key_ok = (0 == pthread_key_create(&trace_key, ring_destructor));
+}
+#endif
+
+
+static struct trace_ring *ring_get(void)
+{
+	struct trace_ring *ring;
+
+#ifdef HAVE_PTHREAD
+	pthread_once(&trace_once, trace_init);
+
+	if (!trace_key_ok)
+		return NULL;
+
+	ring = pthread_getspecific(trace_key);
+#else
+	ring = trace_ring;
+#endif
+	if (ring)
+		return ring;
+
+	ring = calloc(1, sizeof(*ring));
+	if (!ring)
+		return NULL;
+
+#ifdef HAVE_PTHREAD
+	if (pthread_setspecific(trace_key, ring)) {
+		free(ring);
+		return NULL;
+	}
+#else
+	trace_ring = ring;
+#endif
+
+	trace_lock();
+	ring->tid   = ++trace.tidc;
+	ring->next  = trace.ringl;
+	trace.ringl = ring;
+	trace_unlock();
+
+	return ring;
+}
+
+
+static void event_add(const char *cat, const char *name, char ph,
+		      const void *id)
+{
+	struct trace_ring *ring;
+	struct trace_event *ev;
+	uint32_t head;
+
+	if (!trace_load(&trace.on) || !cat || !name)
+		return;
+
+	ring = ring_get();
+	if (!ring)
+		return;
+
+	head = ring->head;
+
+	if (head - trace_load(&ring->tail) >= TRACE_SLOTS) {
+
+		(void)re_trace_flush();
+
+		if (head - trace_load(&ring->tail) >= TRACE_SLOTS) {
+			trace_inc(&trace.dropped);
+			return;
+		}
+	}
+
+	ev = &ring->evv[head % TRACE_SLOTS];
+
+	ev->cat  = cat;
+	ev->name = name;
+	ev->id   = id;
+	ev->ph   = ph;
+	ev->ts   = tmr_jiffies_usec();
+
+	trace_store(&ring->head, head + 1);
+}
+
+
+static void event_print(const struct trace_ring *ring,
+			const struct trace_event *ev)
+{
+	(void)re_fprintf(trace.f, "%s{\"cat\":\"%s\",\"name\":\"%s\","
+			 "\"ph\":\"%c\",\"ts\":%llu,\"pid\":%d,\"tid\":%u",
+			 trace.evc ? ",\n" : "", ev->cat, ev->name, ev->ph,
+			 ev->ts - trace.ts0, trace.pid, ring->tid);
+
+	switch (ev->ph) {
+
+	case 'b':
+	case 'e':
+		(void)re_fprintf(trace.f, ",\"id\":\"%p\"}", ev->id);
+		break;
+
+	case 'i':
+		(void)re_fprintf(trace.f, ",\"s\":\"t\"}");
+		break;
+
+	default:
+		(void)re_fprintf(trace.f, "}");
+		break;
+	}
+
+	++trace.evc;
+}
+
+
+/**
+ * Start tracing to a JSON file in the Chrome trace event format
+ *
+ * @param json_file Name of the trace file
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int re_trace_init(const char *json_file)
+{
+	struct trace_ring *ring;
+	int err = 0;
+
+	if (!json_file)
+		return EINVAL;
+
+	trace_lock();
+
+	if (trace.f) {
+		err = EALREADY;
+		goto out;
+	}
+
+	trace.f = fopen(json_file, "w");
+	if (!trace.f) {
+		err = errno;
+		goto out;
+	}
+
+	/* events from an earlier trace are discarded */
+	for (ring = trace.ringl; ring; ring = ring->next)
+		trace_store(&ring->tail, trace_load(&ring->head));
+
+	trace.ts0     = tmr_jiffies_usec();
+	trace.evc     = 0;
+	trace.dropped = 0;
+#ifdef HAVE_UNISTD_H
+	trace.pid     = (int)getpid();
+#endif
+
+	(void)re_fprintf(trace.f, "{\"traceEvents\":[\n");
+
+	trace_store(&trace.on, true);
+
+ out:
+	trace_unlock();
+
+	return err;
+}
+
+
+/**
+ * Stop tracing, and write and close the trace file
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int re_trace_close(void)
+{
+	int err;
+
+	trace_store(&trace.on, false);
+
+	err = re_trace_flush();
+
+	trace_lock();
+
+	if (trace.f) {
+		(void)re_fprintf(trace.f, "\n]}\n");
+
+		if (fclose(trace.f))
+			err = errno;
+
+		trace.f = NULL;
+	}
+
+	trace_unlock();
+
+	return err;
+}
+
+
+/**
+ * Write the events of all threads to the trace file
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int re_trace_flush(void)
+{
+	struct trace_ring *ring, *next;
+	int err = 0;
+
+	trace_lock();
+
+	if (!trace.f)
+		goto out;
+
+	for (ring = trace.ringl; ring; ring = next) {
+
+		const bool dead = trace_load(&ring->dead);
+		const uint32_t head = trace_load(&ring->head);
+		uint32_t tail = ring->tail;
+
+		next = ring->next;
+
+		for (; tail != head; ++tail)
+			event_print(ring, &ring->evv[tail % TRACE_SLOTS]);
+
+		trace_store(&ring->tail, tail);
+
+		if (dead)
+			ring_free(ring);
+	}
+
+	if (fflush(trace.f))
+		err = errno;
+
+ out:
+	trace_unlock();
+
+	return err;
+}
+
+
+/**
+ * Begin a duration event on the current thread
+ *
+ * @param cat  Category, a string literal
+ * @param name Event name, a string literal
+ */
+void re_trace_begin(const char *cat, const char *name)
+{
+	event_add(cat, name, 'B', NULL);
+}
+
+
+/**
+ * End a duration event on the current thread
+ *
+ * @param cat  Category, a string literal
+ * @param name Event name, a string literal
+ */
+void re_trace_end(const char *cat, const char *name)
+{
+	event_add(cat, name, 'E', NULL);
+}
+
+
+/**
+ * Add an instant event
+ *
+ * @param cat  Category, a string literal
+ * @param name Event name, a string literal
+ */
+void re_trace_instant(const char *cat, const char *name)
+{
+	event_add(cat, name, 'i', NULL);
+}
+
+
+/**
+ * Begin an asynchronous event, e.g. a transaction that ends later in a
+ * different handler
+ *
+ * @param cat  Category, a string literal
+ * @param name Event name, a string literal
+ * @param id   Event identifier, e.g. the transaction object
+ */
+void re_trace_async_begin(const char *cat, const char *name, const void *id)
+{
+	event_add(cat, name, 'b', id);
+}
+
+
+/**
+ * End an asynchronous event
+ *
+ * @param cat  Category, a string literal
+ * @param name Event name, a string literal
+ * @param id   Event identifier, as given to re_trace_async_begin()
+ */
+void re_trace_async_end(const char *cat, const char *name, const void *id)
+{
+	event_add(cat, name, 'e', id);
+}
+
+
+/**
+ * Get the number of events that were dropped because a ring was full
+ *
+ * @return Number of dropped events
+ */
+uint64_t re_trace_dropped(void)
+{
+	return trace_load(&trace.dropped);
+}
@@ -3,6 +3,7 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
+#include <string.h>
 #include <re_types.h>
 #include <re_mem.h>
 #include <re_mbuf.h>
@@ -21,22 +22,33 @@ enum {
 	CHAN_LIFETIME = 600,
 	CHAN_REFRESH = 250,
 	CHAN_NUMB_MIN = 0x4000,
-	CHAN_NUMB_MAX = 0x7fff
+	CHAN_NUMB_MAX = 0x7fff,
+	CHAN_CNT_SIZE = 64,
 };
 
 
+/* Packets sent to a peer without a channel */
+struct chan_cnt {
+	struct sa peer;
+	uint32_t n;
+};
+
 struct channels {
-	struct hash *ht_numb;
-	struct hash *ht_peer;
+	struct list chanl;
+	struct chan **numv;            /* indexed by number - 0x4000 */
+	size_t numc;
+	struct hmap *map_peer;
+	struct chan_cnt cntv[CHAN_CNT_SIZE];
+	uint32_t autoc;
 	uint16_t nr;
 };
 
 
 struct chan {
-	struct le he_numb;
-	struct le he_peer;
+	struct le le;
 	struct loop_state ls;
 	uint16_t nr;
+	bool bound;
 	struct sa peer;
 	struct tmr tmr;
 	struct turnc *turnc;
@@ -53,11 +65,10 @@ static void channels_destructor(void *data)
 {
 	struct channels *c = data;
 
-	/* flush from primary hash */
-	hash_flush(c->ht_numb);
+	list_flush(&c->chanl);
 
-	mem_deref(c->ht_numb);
-	mem_deref(c->ht_peer);
+	mem_deref(c->numv);
+	mem_deref(c->map_peer);
 }
 
 
@@ -67,23 +78,20 @@ static void chan_destructor(void *data)
 
 	tmr_cancel(&chan->tmr);
 	mem_deref(chan->ct);
-	hash_unlink(&chan->he_numb);
-	hash_unlink(&chan->he_peer);
-}
 
+	if (chan->le.list) {
+		struct channels *c = chan->turnc->chans;
 
-static bool numb_hash_cmp_handler(struct le *le, void *arg)
-{
-	const struct chan *chan = le->data;
-	const uint16_t *nr = arg;
-
-	return chan->nr == *nr;
+		list_unlink(&chan->le);
+		c->numv[chan->nr - CHAN_NUMB_MIN] = NULL;
+		hmap_remove(c->map_peer, sa_hash(&chan->peer, SA_ALL), chan);
+	}
 }
 
 
-static bool peer_hash_cmp_handler(struct le *le, void *arg)
+static bool peer_cmp_handler(const void *val, void *arg)
 {
-	const struct chan *chan = le->data;
+	const struct chan *chan = val;
 
 	return sa_cmp(&chan->peer, arg, SA_ALL);
 }
@@ -112,7 +120,10 @@ static void chanbind_resp_handler(int err, uint16_t scode, const char *reason,
 	switch (scode) {
 
 	case 0:
-		tmr_start(&chan->tmr, CHAN_REFRESH * 1000, timeout, chan);
+		chan->bound = true;
+		tmr_start(&chan->tmr,
+			  turnc_refresh_ms(chan->turnc, CHAN_REFRESH * 1000),
+			  timeout, chan);
 		if (chan->ch) {
 			chan->ch(chan->arg);
 			chan->ch  = NULL;
@@ -174,35 +185,59 @@ static int chanbind_request(struct chan *chan, bool reset_ls)
 int turnc_add_chan(struct turnc *turnc, const struct sa *peer,
 		   turnc_chan_h *ch, void *arg)
 {
+	struct channels *c;
 	struct chan *chan;
 	int err;
 
 	if (!turnc || !peer)
 		return EINVAL;
 
-	if (turnc->chans->nr >= CHAN_NUMB_MAX)
+	c = turnc->chans;
+
+	if (c->nr >= CHAN_NUMB_MAX)
 		return ERANGE;
 
 	if (turnc_chan_find_peer(turnc, peer))
 		return 0;
 
+	/* channel numbers are given in order, so the array is dense */
+	if ((size_t)(c->nr - CHAN_NUMB_MIN) >= c->numc) {
+
+		const size_t n = c->numc ? 2 * c->numc : 8;
+		struct chan **numv;
+
+		numv = mem_reallocarray(c->numv, n, sizeof(*numv), NULL);
+		if (!numv)
+			return ENOMEM;
+
+		memset(numv + c->numc, 0, (n - c->numc) * sizeof(*numv));
+
+		c->numv = numv;
+		c->numc = n;
+	}
+
 	chan = mem_zalloc(sizeof(*chan), chan_destructor);
 	if (!chan)
 		return ENOMEM;
 
-	chan->nr = turnc->chans->nr++;
+	chan->nr = c->nr++;
 	chan->peer = *peer;
 
-	hash_append(turnc->chans->ht_numb, chan->nr, &chan->he_numb, chan);
-	hash_append(turnc->chans->ht_peer, sa_hash(peer, SA_ALL),
-		    &chan->he_peer, chan);
-
 	tmr_init(&chan->tmr);
 	chan->turnc = turnc;
 	chan->ch = ch;
 	chan->arg = arg;
 
+	err = hmap_insert(c->map_peer, sa_hash(peer, SA_ALL), chan);
+	if (err)
+		goto out;
+
+	c->numv[chan->nr - CHAN_NUMB_MIN] = chan;
+	list_append(&c->chanl, &chan->le, chan);
+
 	err = chanbind_request(chan, true);
+
+ out:
 	if (err)
 		mem_deref(chan);
 
@@ -222,11 +257,7 @@ int turnc_chan_hash_alloc(struct channels **cp, uint32_t bsize)
 	if (!c)
 		return ENOMEM;
 
-	err = hash_alloc(&c->ht_numb, bsize);
-	if (err)
-		goto out;
-
-	err = hash_alloc(&c->ht_peer, bsize);
+	err = hmap_alloc(&c->map_peer, bsize);
 	if (err)
 		goto out;
 
@@ -242,13 +273,63 @@ int turnc_chan_hash_alloc(struct channels **cp, uint32_t bsize)
 }
 
 
+/**
+ * Bind a channel automatically for a peer that data is sent to with
+ * Send indications, after a number of packets
+ *
+ * @param turnc TURN Client
+ * @param pktc  Number of packets to a peer before a channel is bound,
+ *              0 to disable
+ */
+void turnc_set_autochan(struct turnc *turnc, uint32_t pktc)
+{
+	if (!turnc)
+		return;
+
+	turnc->chans->autoc = pktc;
+}
+
+
+/* Count a Send indication to a peer, and bind a channel if needed */
+void turnc_chan_autobind(struct turnc *turnc, const struct sa *peer)
+{
+	struct channels *c = turnc->chans;
+	struct chan_cnt *cnt;
+
+	if (!c->autoc)
+		return;
+
+	/* a collision restarts the count of the other peer */
+	cnt = &c->cntv[sa_hash(peer, SA_ALL) % CHAN_CNT_SIZE];
+
+	if (!sa_cmp(&cnt->peer, peer, SA_ALL)) {
+		cnt->peer = *peer;
+		cnt->n    = 0;
+	}
+
+	if (++cnt->n < c->autoc)
+		return;
+
+	sa_init(&cnt->peer, AF_UNSPEC);
+	cnt->n = 0;
+
+	(void)turnc_add_chan(turnc, peer, NULL, NULL);
+}
+
+
 struct chan *turnc_chan_find_numb(const struct turnc *turnc, uint16_t nr)
 {
+	const struct channels *c;
+
 	if (!turnc)
 		return NULL;
 
-	return list_ledata(hash_lookup(turnc->chans->ht_numb, nr,
-				       numb_hash_cmp_handler, &nr));
+	c = turnc->chans;
+
+	if (nr < CHAN_NUMB_MIN || (size_t)(nr - CHAN_NUMB_MIN) >= c->numc)
+		return NULL;
+
+	return c->numv[nr - CHAN_NUMB_MIN];
 }
 
 
@@ -258,9 +339,14 @@ struct chan *turnc_chan_find_peer(const struct turnc *turnc,
 	if (!turnc)
 		return NULL;
 
-	return list_ledata(hash_lookup(turnc->chans->ht_peer,
-				       sa_hash(peer, SA_ALL),
-				       peer_hash_cmp_handler, (void *)peer));
+	return hmap_lookup(turnc->chans->map_peer, sa_hash(peer, SA_ALL),
+			   peer_cmp_handler, (void *)peer);
+}
+
+
+bool turnc_chan_isbound(const struct chan *chan)
+{
+	return chan ? chan->bound : false;
 }
 
 
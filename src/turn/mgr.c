@@ -0,0 +1,246 @@
+/**
+ * @file mgr.c  TURN client manager, shared by many allocations
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re_types.h>
+#include <re_fmt.h>
+#include <re_mem.h>
+#include <re_mbuf.h>
+#include <re_list.h>
+#include <re_hash.h>
+#include <re_tmr.h>
+#include <re_sa.h>
+#include <re_md5.h>
+#include <re_sys.h>
+#include <re_stun.h>
+#include <re_turn.h>
+#include "turnc.h"
+
+
+/*
+ * The allocations of a manager share one STUN instance, so all their
+ * client transactions are in one table. The realm, nonce and key that
+ * are learned from a server are shared by the allocations with the same
+ * credentials, so only the first one is challenged, and the key is
+ * derived once. Refreshes are started at a random time before they are
+ * due, to spread them over the lifetime.
+ */
+
+
+enum {
+	SRV_HASH_SIZE = 16,
+};
+
+
+/** Defines a TURN client manager */
+struct turnc_mgr {
+	struct stun *stun;
+	struct hash *ht_srv;
+};
+
+/** Defines the shared state of a TURN server and credentials */
+struct turnc_srv {
+	struct le le;
+	struct sa srv;
+	char *username;
+	char *password;
+	char *realm;
+	char *nonce;
+	uint8_t md5_hash[MD5_SIZE];
+};
+
+
+static uint32_t srv_key(const struct sa *srv, const char *username)
+{
+	return sa_hash(srv, SA_ALL) ^
+		hash_joaat((const uint8_t *)username, strlen(username));
+}
+
+
+static uint32_t srv_key_handler(const struct le *le)
+{
+	const struct turnc_srv *ent = le->data;
+
+	return srv_key(&ent->srv, ent->username);
+}
+
+
+struct srv_match {
+	const struct sa *srv;
+	const char *username;
+	const char *password;
+};
+
+
+static bool srv_cmp_handler(struct le *le, void *arg)
+{
+	const struct turnc_srv *ent = le->data;
+	const struct srv_match *m = arg;
+
+	return sa_cmp(&ent->srv, m->srv, SA_ALL) &&
+		0 == str_cmp(ent->username, m->username) &&
+		0 == str_cmp(ent->password, m->password);
+}
+
+
+static void mgr_destructor(void *data)
+{
+	struct turnc_mgr *mgr = data;
+
+	/* the entries are owned by the TURN Clients */
+	hash_clear(mgr->ht_srv);
+	mem_deref(mgr->ht_srv);
+	mem_deref(mgr->stun);
+}
+
+
+static void srv_destructor(void *data)
+{
+	struct turnc_srv *ent = data;
+
+	hash_unlink(&ent->le);
+	mem_deref(ent->username);
+	mem_deref(ent->password);
+	mem_deref(ent->realm);
+	mem_deref(ent->nonce);
+}
+
+
+/**
+ * Allocate a TURN client manager. TURN Clients are added to it with
+ * turnc_mgr_add(), and may outlive it.
+ *
+ * @param mgrp Pointer to allocated TURN client manager
+ * @param conf Optional STUN Configuration
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int turnc_mgr_alloc(struct turnc_mgr **mgrp, const struct stun_conf *conf)
+{
+	struct turnc_mgr *mgr;
+	int err;
+
+	if (!mgrp)
+		return EINVAL;
+
+	mgr = mem_zalloc(sizeof(*mgr), mgr_destructor);
+	if (!mgr)
+		return ENOMEM;
+
+	err = stun_alloc(&mgr->stun, conf, NULL, NULL);
+	if (err)
+		goto out;
+
+	err = hash_alloc_auto(&mgr->ht_srv, SRV_HASH_SIZE, srv_key_handler);
+
+ out:
+	if (err)
+		mem_deref(mgr);
+	else
+		*mgrp = mgr;
+
+	return err;
+}
+
+
+struct stun *turnc_mgr_stun(const struct turnc_mgr *mgr)
+{
+	return mgr ? mgr->stun : NULL;
+}
+
+
+/* Get the shared state for a server and credentials, or add it */
+int turnc_mgr_srv(struct turnc_srv **entp, struct turnc_mgr *mgr,
+		  const struct sa *srv, const char *username,
+		  const char *password)
+{
+	struct turnc_srv *ent;
+	struct srv_match m;
+	int err;
+
+	if (!entp || !mgr || !srv || !username || !password)
+		return EINVAL;
+
+	m.srv      = srv;
+	m.username = username;
+	m.password = password;
+
+	ent = list_ledata(hash_lookup(mgr->ht_srv, srv_key(srv, username),
+				      srv_cmp_handler, &m));
+	if (ent) {
+		*entp = mem_ref(ent);
+		return 0;
+	}
+
+	ent = mem_zalloc(sizeof(*ent), srv_destructor);
+	if (!ent)
+		return ENOMEM;
+
+	ent->srv = *srv;
+
+	err  = str_dup(&ent->username, username);
+	err |= str_dup(&ent->password, password);
+	if (err) {
+		mem_deref(ent);
+		return err;
+	}
+
+	hash_append(mgr->ht_srv, srv_key(srv, username), &ent->le, ent);
+
+	*entp = ent;
+
+	return 0;
+}
+
+
+/* Copy the realm, nonce and key to a TURN Client, if known */
+void turnc_srv_apply(const struct turnc_srv *ent, struct turnc *turnc)
+{
+	if (!ent || !ent->realm || !ent->nonce)
+		return;
+
+	mem_deref(turnc->realm);
+	mem_deref(turnc->nonce);
+	turnc->realm = mem_ref(ent->realm);
+	turnc->nonce = mem_ref(ent->nonce);
+
+	memcpy(turnc->md5_hash, ent->md5_hash, sizeof(turnc->md5_hash));
+}
+
+
+/* Derive the key for a realm once, and save the nonce */
+int turnc_srv_keygen(struct turnc_srv *ent, char *realm, char *nonce)
+{
+	int err;
+
+	if (!ent || !realm || !nonce)
+		return EINVAL;
+
+	if (!ent->realm || strcmp(ent->realm, realm)) {
+
+		err = md5_printf(ent->md5_hash, "%s:%s:%s",
+				 ent->username, realm, ent->password);
+		if (err)
+			return err;
+
+		mem_deref(ent->realm);
+		ent->realm = mem_ref(realm);
+	}
+
+	mem_deref(ent->nonce);
+	ent->nonce = mem_ref(nonce);
+
+	return 0;
+}
+
+
+/* Managed TURN Clients refresh up to a fifth of the interval early */
+uint32_t turnc_refresh_ms(const struct turnc *turnc, uint32_t ms)
+{
+	if (!turnc->srvent || ms < 5)
+		return ms;
+
+	return ms - rand_fast_u32() % (ms / 5);
+}
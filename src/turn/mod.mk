@@ -5,5 +5,7 @@
 #
 
 SRCS	+= turn/chan.c
+SRCS	+= turn/mgr.c
 SRCS	+= turn/perm.c
 SRCS	+= turn/turnc.c
+SRCS	+= turn/turnsrv.c
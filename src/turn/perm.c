@@ -24,7 +24,7 @@ enum {
 
 
 struct perm {
-	struct le he;
+	struct le le;
 	struct loop_state ls;
 	struct sa peer;
 	struct tmr tmr;
@@ -44,13 +44,18 @@ static void destructor(void *arg)
 
 	tmr_cancel(&perm->tmr);
 	mem_deref(perm->ct);
-	hash_unlink(&perm->he);
+
+	if (perm->le.list) {
+		list_unlink(&perm->le);
+		hmap_remove(perm->turnc->perms, sa_hash(&perm->peer, SA_ADDR),
+			    perm);
+	}
 }
 
 
-static bool hash_cmp_handler(struct le *le, void *arg)
+static bool cmp_handler(const void *val, void *arg)
 {
-	const struct perm *perm = le->data;
+	const struct perm *perm = val;
 
 	return sa_cmp(&perm->peer, arg, SA_ADDR);
 }
@@ -58,8 +63,8 @@ static bool hash_cmp_handler(struct le *le, void *arg)
 
 static struct perm *perm_find(const struct turnc *turnc, const struct sa *peer)
 {
-	return list_ledata(hash_lookup(turnc->perms, sa_hash(peer, SA_ADDR),
-				       hash_cmp_handler, (void *)peer));
+	return hmap_lookup(turnc->perms, sa_hash(peer, SA_ADDR),
+			   cmp_handler, (void *)peer);
 }
 
 
@@ -87,7 +92,9 @@ static void createperm_resp_handler(int err, uint16_t scode,
 	switch (scode) {
 
 	case 0:
-		tmr_start(&perm->tmr, PERM_REFRESH * 1000, timeout, perm);
+		tmr_start(&perm->tmr,
+			  turnc_refresh_ms(perm->turnc, PERM_REFRESH * 1000),
+			  timeout, perm);
 		if (perm->ph) {
 			perm->ph(perm->arg);
 			perm->ph  = NULL;
@@ -161,14 +168,21 @@ int turnc_add_perm(struct turnc *turnc, const struct sa *peer,
 	if (!perm)
 		return ENOMEM;
 
-	hash_append(turnc->perms, sa_hash(peer, SA_ADDR), &perm->he, perm);
 	tmr_init(&perm->tmr);
 	perm->peer = *peer;
 	perm->turnc = turnc;
 	perm->ph = ph;
 	perm->arg = arg;
 
+	err = hmap_insert(turnc->perms, sa_hash(peer, SA_ADDR), perm);
+	if (err)
+		goto out;
+
+	list_append(&turnc->perml, &perm->le, perm);
+
 	err = createperm_request(perm, true);
+
+ out:
 	if (err)
 		mem_deref(perm);
 
@@ -176,7 +190,7 @@ int turnc_add_perm(struct turnc *turnc, const struct sa *peer,
 }
 
 
-int turnc_perm_hash_alloc(struct hash **ht, uint32_t bsize)
+int turnc_perm_hash_alloc(struct hmap **mapp, uint32_t size)
 {
-	return hash_alloc(ht, bsize);
+	return hmap_alloc(mapp, size);
 }
@@ -35,6 +35,13 @@ enum {
 	STUN_ATTR_ADDR6_SIZE = 20,
 };
 
+/** Headroom and tailroom of a Send Indication, with an IPv6 peer */
+enum {
+	SENDIND_HEADROOM = STUN_HEADER_SIZE + STUN_ATTR_HEADER_SIZE * 2
+			 + STUN_ATTR_ADDR6_SIZE,
+	SENDIND_TAILROOM = 3,
+};
+
 
 static const uint8_t sendind_tid[STUN_TID_SIZE];
 
@@ -55,9 +62,10 @@ static void destructor(void *arg)
 	tmr_cancel(&turnc->tmr);
 	mem_deref(turnc->ct);
 
-	hash_flush(turnc->perms);
+	list_flush(&turnc->perml);
 	mem_deref(turnc->perms);
 	mem_deref(turnc->chans);
+	mem_deref(turnc->srvent);
 	mem_deref(turnc->username);
 	mem_deref(turnc->password);
 	mem_deref(turnc->nonce);
@@ -82,7 +90,7 @@ static void timeout(void *arg)
 
 static void refresh_timer(struct turnc *turnc)
 {
-	const uint32_t t = turnc->lifetime*1000*3/4;
+	const uint32_t t = turnc_refresh_ms(turnc, turnc->lifetime*1000*3/4);
 
 	DEBUG_INFO("Start refresh timer.. %u seconds\n", t/1000);
 
@@ -130,6 +138,9 @@ static void allocate_resp_handler(int err, uint16_t scode, const char *reason,
 		turnc->psrv = turnc->srv;
 		turnc->srv = alt->v.alt_server;
 
+		/* the shared state is for the first server only */
+		turnc->srvent = mem_deref(turnc->srvent);
+
 		err = allocate_request(turnc);
 		if (err)
 			break;
@@ -274,7 +285,7 @@ static bool udp_send_handler(int *err, struct sa *dst, struct mbuf *mb,
 		return false;
 
 	chan = turnc_chan_find_peer(turnc, dst);
-	if (chan) {
+	if (turnc_chan_isbound(chan)) {
 		struct chan_hdr hdr;
 
 		hdr.nr  = turnc_chan_numb(chan);
@@ -289,6 +300,9 @@ static bool udp_send_handler(int *err, struct sa *dst, struct mbuf *mb,
 		return false;
 	}
 
+	if (!chan)
+		turnc_chan_autobind(turnc, dst);
+
 	indlen = stun_indlen(dst);
 
 	if (mb->pos < indlen)
@@ -308,96 +322,117 @@ static bool udp_send_handler(int *err, struct sa *dst, struct mbuf *mb,
 }
 
 
-static bool udp_recv_handler(struct sa *src, struct mbuf *mb, void *arg)
+/*
+ * Demultiplex a packet from the TURN server. ChannelData is told apart
+ * by the first byte (RFC 5766 section 11), and Data indications are
+ * read in place. Only responses are fully decoded.
+ *
+ * return: 0 for peer data in mb, ENOENT if consumed, otherwise errorcode
+ */
+static int recv_demux(struct turnc *turnc, struct sa *src, struct mbuf *mb)
 {
-	struct stun_attr *peer, *data;
+	const struct stun_vattr *data;
 	struct stun_unknown_attr ua;
-	struct turnc *turnc = arg;
+	struct stun_view view;
 	struct stun_msg *msg;
-	bool hdld = true;
+	const uint8_t *p;
+	struct chan *chan;
+	struct sa peer;
+	uint16_t nr, len;
+	int err;
 
-	if (!sa_cmp(&turnc->srv, src, SA_ALL) &&
-	    !sa_cmp(&turnc->psrv, src, SA_ALL))
-		return false;
+	if (mbuf_get_left(mb) < CHAN_HDR_SIZE)
+		return EBADMSG;
 
-	if (stun_msg_decode(&msg, mb, &ua)) {
+	p = mbuf_buf(mb);
 
-		struct chan_hdr hdr;
-		struct chan *chan;
+	switch (p[0] >> 6) {
 
-		if (turnc_chan_hdr_decode(&hdr, mb))
-			return true;
+	case 1:
+		nr  = (uint16_t)(p[0] << 8 | p[1]);
+		len = (uint16_t)(p[2] << 8 | p[3]);
 
-		if (mbuf_get_left(mb) < hdr.len)
-			return true;
+		if (mbuf_get_left(mb) - CHAN_HDR_SIZE < len)
+			return EBADMSG;
 
-		chan = turnc_chan_find_numb(turnc, hdr.nr);
+		chan = turnc_chan_find_numb(turnc, nr);
 		if (!chan)
-			return true;
+			return EBADMSG;
 
 		*src = *turnc_chan_peer(chan);
 
-		return false;
+		mb->pos += CHAN_HDR_SIZE;
+		mb->end  = mb->pos + len;
+
+		return 0;
+
+	case 0:
+		break;
+
+	default:
+		return EBADMSG;
 	}
 
-	switch (stun_msg_class(msg)) {
+	if (stun_view_decode(&view, mb, &ua))
+		return EBADMSG;
+
+	switch (stun_view_class(&view)) {
 
 	case STUN_CLASS_INDICATION:
 		if (ua.typec > 0)
-			break;
+			return ENOSYS;
 
-		if (stun_msg_method(msg) != STUN_METHOD_DATA)
-			break;
+		if (stun_view_method(&view) != STUN_METHOD_DATA)
+			return ENOSYS;
 
-		peer = stun_msg_attr(msg, STUN_ATTR_XOR_PEER_ADDR);
-		data = stun_msg_attr(msg, STUN_ATTR_DATA);
-		if (!peer || !data)
-			break;
+		data = stun_view_attr(&view, STUN_ATTR_DATA);
+		if (!data)
+			return EPROTO;
 
-		*src = peer->v.xor_peer_addr;
+		if (stun_view_addr(&view, STUN_ATTR_XOR_PEER_ADDR, &peer))
+			return EPROTO;
 
-		mb->pos = data->v.data.pos;
-		mb->end = data->v.data.end;
+		*src = peer;
 
-		hdld = false;
-		break;
+		mb->pos = data->p - mb->buf;
+		mb->end = mb->pos + data->len;
+
+		return 0;
 
 	case STUN_CLASS_ERROR_RESP:
 	case STUN_CLASS_SUCCESS_RESP:
+		err = stun_msg_decode(&msg, mb, &ua);
+		if (err)
+			return err;
+
 		(void)stun_ctrans_recv(turnc->stun, msg, &ua);
-		break;
+		mem_deref(msg);
+
+		return ENOENT;
 
 	default:
-		break;
+		return ENOSYS;
 	}
+}
+
+
+static bool udp_recv_handler(struct sa *src, struct mbuf *mb, void *arg)
+{
+	struct turnc *turnc = arg;
 
-	mem_deref(msg);
+	if (!sa_cmp(&turnc->srv, src, SA_ALL) &&
+	    !sa_cmp(&turnc->psrv, src, SA_ALL))
+		return false;
 
-	return hdld;
+	return 0 != recv_demux(turnc, src, mb);
 }
 
 
-/**
- * Allocate a TURN Client
- *
- * @param turncp    Pointer to allocated TURN Client
- * @param conf      Optional STUN Configuration
- * @param proto     Transport Protocol
- * @param sock      Transport socket
- * @param layer     Transport layer
- * @param srv       TURN Server IP-address
- * @param username  Authentication username
- * @param password  Authentication password
- * @param lifetime  Allocate lifetime in [seconds]
- * @param th        TURN handler
- * @param arg       Handler argument
- *
- * @return 0 if success, otherwise errorcode
- */
-int turnc_alloc(struct turnc **turncp, const struct stun_conf *conf, int proto,
-		void *sock, int layer, const struct sa *srv,
-		const char *username, const char *password,
-		uint32_t lifetime, turnc_h *th, void *arg)
+static int turnc_create(struct turnc **turncp, const struct stun_conf *conf,
+			struct turnc_mgr *mgr, int proto, void *sock,
+			int layer, const struct sa *srv,
+			const char *username, const char *password,
+			uint32_t lifetime, turnc_h *th, void *arg)
 {
 	struct turnc *turnc;
 	int err;
@@ -409,7 +444,15 @@ int turnc_alloc(struct turnc **turncp, const struct stun_conf *conf, int proto,
 	if (!turnc)
 		return ENOMEM;
 
-	err = stun_alloc(&turnc->stun, conf, NULL, NULL);
+	if (mgr) {
+		turnc->stun = mem_ref(turnc_mgr_stun(mgr));
+
+		err = turnc_mgr_srv(&turnc->srvent, mgr, srv,
+				    username, password);
+	}
+	else {
+		err = stun_alloc(&turnc->stun, conf, NULL, NULL);
+	}
 	if (err)
 		goto out;
 
@@ -444,6 +487,8 @@ int turnc_alloc(struct turnc **turncp, const struct stun_conf *conf, int proto,
 		err = udp_register_helper(&turnc->uh, sock, layer,
 					  udp_send_handler, udp_recv_handler,
 					  turnc);
+		udp_helper_room_set(turnc->uh, SENDIND_HEADROOM,
+				    SENDIND_TAILROOM);
 		break;
 
 	default:
@@ -454,6 +499,9 @@ int turnc_alloc(struct turnc **turncp, const struct stun_conf *conf, int proto,
 	if (err)
 		goto out;
 
+	/* skip the challenge if another allocation was challenged */
+	turnc_srv_apply(turnc->srvent, turnc);
+
 	err = allocate_request(turnc);
 	if (err)
 		goto out;
@@ -468,6 +516,65 @@ int turnc_alloc(struct turnc **turncp, const struct stun_conf *conf, int proto,
 }
 
 
+/**
+ * Allocate a TURN Client
+ *
+ * @param turncp    Pointer to allocated TURN Client
+ * @param conf      Optional STUN Configuration
+ * @param proto     Transport Protocol
+ * @param sock      Transport socket
+ * @param layer     Transport layer
+ * @param srv       TURN Server IP-address
+ * @param username  Authentication username
+ * @param password  Authentication password
+ * @param lifetime  Allocate lifetime in [seconds]
+ * @param th        TURN handler
+ * @param arg       Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int turnc_alloc(struct turnc **turncp, const struct stun_conf *conf, int proto,
+		void *sock, int layer, const struct sa *srv,
+		const char *username, const char *password,
+		uint32_t lifetime, turnc_h *th, void *arg)
+{
+	return turnc_create(turncp, conf, NULL, proto, sock, layer, srv,
+			    username, password, lifetime, th, arg);
+}
+
+
+/**
+ * Allocate a TURN Client that is managed by a TURN client manager. It
+ * shares the STUN instance of the manager, and the realm, nonce and key
+ * with other allocations on the same server with the same credentials.
+ *
+ * @param turncp    Pointer to allocated TURN Client
+ * @param mgr       TURN client manager
+ * @param proto     Transport Protocol
+ * @param sock      Transport socket
+ * @param layer     Transport layer
+ * @param srv       TURN Server IP-address
+ * @param username  Authentication username
+ * @param password  Authentication password
+ * @param lifetime  Allocate lifetime in [seconds]
+ * @param th        TURN handler
+ * @param arg       Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int turnc_mgr_add(struct turnc **turncp, struct turnc_mgr *mgr, int proto,
+		  void *sock, int layer, const struct sa *srv,
+		  const char *username, const char *password,
+		  uint32_t lifetime, turnc_h *th, void *arg)
+{
+	if (!mgr)
+		return EINVAL;
+
+	return turnc_create(turncp, NULL, mgr, proto, sock, layer, srv,
+			    username, password, lifetime, th, arg);
+}
+
+
 int turnc_send(struct turnc *turnc, const struct sa *dst, struct mbuf *mb)
 {
 	size_t pos, indlen;
@@ -478,7 +585,7 @@ int turnc_send(struct turnc *turnc, const struct sa *dst, struct mbuf *mb)
 		return EINVAL;
 
 	chan = turnc_chan_find_peer(turnc, dst);
-	if (chan) {
+	if (turnc_chan_isbound(chan)) {
 		struct chan_hdr hdr;
 
 		if (mb->pos < CHAN_HDR_SIZE)
@@ -509,6 +616,9 @@ int turnc_send(struct turnc *turnc, const struct sa *dst, struct mbuf *mb)
 		mb->pos = pos;
 	}
 	else {
+		if (!chan)
+			turnc_chan_autobind(turnc, dst);
+
 		indlen = stun_indlen(dst);
 
 		if (mb->pos < indlen)
@@ -555,73 +665,17 @@ int turnc_send(struct turnc *turnc, const struct sa *dst, struct mbuf *mb)
 
 int turnc_recv(struct turnc *turnc, struct sa *src, struct mbuf *mb)
 {
-	struct stun_attr *peer, *data;
-	struct stun_unknown_attr ua;
-	struct stun_msg *msg;
-	int err = 0;
+	int err;
 
 	if (!turnc || !src || !mb)
 		return EINVAL;
 
-	if (stun_msg_decode(&msg, mb, &ua)) {
-
-		struct chan_hdr hdr;
-		struct chan *chan;
-
-		if (turnc_chan_hdr_decode(&hdr, mb))
-			return EBADMSG;
-
-		if (mbuf_get_left(mb) < hdr.len)
-			return EBADMSG;
-
-		chan = turnc_chan_find_numb(turnc, hdr.nr);
-		if (!chan)
-			return EBADMSG;
-
-		*src = *turnc_chan_peer(chan);
-
-		return 0;
-	}
-
-	switch (stun_msg_class(msg)) {
-
-	case STUN_CLASS_INDICATION:
-		if (ua.typec > 0) {
-			err = ENOSYS;
-			break;
-		}
-
-		if (stun_msg_method(msg) != STUN_METHOD_DATA) {
-			err = ENOSYS;
-			break;
-		}
-
-		peer = stun_msg_attr(msg, STUN_ATTR_XOR_PEER_ADDR);
-		data = stun_msg_attr(msg, STUN_ATTR_DATA);
-		if (!peer || !data) {
-			err = EPROTO;
-			break;
-		}
-
-		*src = peer->v.xor_peer_addr;
-
-		mb->pos = data->v.data.pos;
-		mb->end = data->v.data.end;
-		break;
-
-	case STUN_CLASS_ERROR_RESP:
-	case STUN_CLASS_SUCCESS_RESP:
-		(void)stun_ctrans_recv(turnc->stun, msg, &ua);
+	err = recv_demux(turnc, src, mb);
+	if (err == ENOENT) {
 		mb->pos = mb->end;
-		break;
-
-	default:
-		err = ENOSYS;
-		break;
+		return 0;
 	}
 
-	mem_deref(msg);
-
 	return err;
 }
 
@@ -666,12 +720,24 @@ void turnc_loopstate_reset(struct loop_state *ls)
 int turnc_keygen(struct turnc *turnc, const struct stun_msg *msg)
 {
 	struct stun_attr *realm, *nonce;
+	int err;
 
 	realm = stun_msg_attr(msg, STUN_ATTR_REALM);
 	nonce = stun_msg_attr(msg, STUN_ATTR_NONCE);
 	if (!realm || !nonce)
 		return EPROTO;
 
+	if (turnc->srvent) {
+		err = turnc_srv_keygen(turnc->srvent, realm->v.realm,
+				       nonce->v.nonce);
+		if (err)
+			return err;
+
+		turnc_srv_apply(turnc->srvent, turnc);
+
+		return 0;
+	}
+
 	mem_deref(turnc->realm);
 	mem_deref(turnc->nonce);
 	turnc->realm = mem_ref(realm->v.realm);
@@ -12,6 +12,7 @@ struct loop_state {
 };
 
 struct channels;
+struct turnc_srv;
 
 /** Defines a TURN Client */
 struct turnc {
@@ -32,8 +33,10 @@ struct turnc {
 	uint8_t md5_hash[MD5_SIZE];    /**< Cached MD5-sum of credentials   */
 	char *nonce;                   /**< Saved NONCE value from server   */
 	char *realm;                   /**< Saved REALM value from server   */
-	struct hash *perms;            /**< Hash-table of permissions       */
+	struct list perml;             /**< List of permissions             */
+	struct hmap *perms;            /**< Map of permissions              */
 	struct channels *chans;        /**< TURN Channels                   */
+	struct turnc_srv *srvent;      /**< Shared server state, if managed */
 	bool allocated;                /**< Allocation was done flag        */
 };
 
@@ -44,8 +47,18 @@ void turnc_loopstate_reset(struct loop_state *ls);
 int  turnc_keygen(struct turnc *turnc, const struct stun_msg *msg);
 
 
+/* Manager */
+struct stun *turnc_mgr_stun(const struct turnc_mgr *mgr);
+int  turnc_mgr_srv(struct turnc_srv **entp, struct turnc_mgr *mgr,
+		   const struct sa *srv, const char *username,
+		   const char *password);
+void turnc_srv_apply(const struct turnc_srv *ent, struct turnc *turnc);
+int  turnc_srv_keygen(struct turnc_srv *ent, char *realm, char *nonce);
+uint32_t turnc_refresh_ms(const struct turnc *turnc, uint32_t ms);
+
+
 /* Permission */
-int turnc_perm_hash_alloc(struct hash **ht, uint32_t bsize);
+int turnc_perm_hash_alloc(struct hmap **mapp, uint32_t size);
 
 
 /* Channels */
@@ -64,6 +77,8 @@ int turnc_chan_hash_alloc(struct channels **cp, uint32_t bsize);
 struct chan *turnc_chan_find_numb(const struct turnc *turnc, uint16_t nr);
 struct chan *turnc_chan_find_peer(const struct turnc *turnc,
 				  const struct sa *peer);
+void turnc_chan_autobind(struct turnc *turnc, const struct sa *peer);
+bool turnc_chan_isbound(const struct chan *chan);
 uint16_t turnc_chan_numb(const struct chan *chan);
 const struct sa *turnc_chan_peer(const struct chan *chan);
 int turnc_chan_hdr_encode(const struct chan_hdr *hdr, struct mbuf *mb);
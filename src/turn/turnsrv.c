@@ -0,0 +1,1090 @@
+/**
+ * @file turnsrv.c  TURN relay server
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re_types.h>
+#include <re_fmt.h>
+#include <re_mem.h>
+#include <re_mbuf.h>
+#include <re_list.h>
+#include <re_hash.h>
+#include <re_tmr.h>
+#include <re_sa.h>
+#include <re_md5.h>
+#include <re_sys.h>
+#include <re_udp.h>
+#include <re_stun.h>
+#include <re_turn.h>
+
+
+#define DEBUG_MODULE "turnsrv"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+/*
+ * A TURN server over UDP, with UDP relays (RFC 5766). Each allocation
+ * has its own relay socket, and all state of an allocation lives in
+ * the server that received its Allocate request. With SO_REUSEPORT the
+ * kernel sends all datagrams of a client 5-tuple to the same socket,
+ * so one server per thread shards the allocations between the threads.
+ *
+ * Datagrams to clients are queued and sent in batches with
+ * udp_send_batch(), when the queue is full or after the current round
+ * of the main loop. Permissions and channels expire lazily, when they
+ * are looked up.
+ */
+
+
+enum {
+	HT_SIZE          = 64,
+	BATCH_SIZE       = 32,
+	NONCE_SIZE       = 16,
+	NONCE_LIFETIME   = 3600,
+	PERM_LIFETIME    = 300,
+	CHAN_LIFETIME    = 600,
+	CHAN_NUMB_MIN    = 0x4000,
+	CHAN_NUMB_MAX    = 0x7fff,
+	CHAN_HDR_SIZE    = 4,
+	ATTR_ADDR6_SIZE  = 20,
+	DATAIND_HEADROOM = STUN_HEADER_SIZE + STUN_ATTR_HEADER_SIZE * 2
+			 + ATTR_ADDR6_SIZE,
+};
+
+
+struct pkt {
+	struct udp_sock *us;
+	struct sa dst;
+	struct mbuf *mb;
+};
+
+/** Defines a TURN relay server */
+struct turnsrv {
+	struct udp_sock *us;
+	struct sa relay;
+	struct hash *ht_alloc;
+	struct hash *ht_perm;
+	struct hash *ht_chan_nr;
+	struct hash *ht_chan_peer;
+	char *realm;
+	char nonce[NONCE_SIZE + 1];
+	uint64_t nonce_exp;
+	uint32_t lifetime_max;
+	unsigned rxbatch;
+	struct tmr tmr_tx;
+	struct pkt *pktv;
+	size_t pktc;
+	uint32_t nallocs;
+	turnsrv_auth_h *authh;
+	void *arg;
+};
+
+struct allocation {
+	struct le le;
+	struct list perml;
+	struct list chanl;
+	struct turnsrv *ts;
+	struct udp_sock *rel;
+	struct sa cli;
+	struct sa rel_addr;
+	struct tmr tmr;
+	uint8_t tid[STUN_TID_SIZE];
+	char *username;
+	uint8_t key[MD5_SIZE];
+};
+
+struct perm {
+	struct le le_hash;
+	struct le le_alloc;
+	struct allocation *al;
+	struct sa peer;
+	uint64_t expires;
+};
+
+struct chan {
+	struct le le_nr;
+	struct le le_peer;
+	struct le le_alloc;
+	struct allocation *al;
+	struct sa peer;
+	uint16_t nr;
+	uint64_t expires;
+};
+
+
+static inline uint32_t alloc_hash(const struct allocation *al)
+{
+	return (uint32_t)(uintptr_t)al * 0x9e3779b1;
+}
+
+
+static uint32_t alloc_key_handler(const struct le *le)
+{
+	const struct allocation *al = le->data;
+
+	return sa_hash(&al->cli, SA_ALL);
+}
+
+
+static uint32_t perm_key_handler(const struct le *le)
+{
+	const struct perm *perm = le->data;
+
+	return alloc_hash(perm->al) ^ sa_hash(&perm->peer, SA_ADDR);
+}
+
+
+static uint32_t chan_nr_key_handler(const struct le *le)
+{
+	const struct chan *chan = le->data;
+
+	return alloc_hash(chan->al) ^ chan->nr;
+}
+
+
+static uint32_t chan_peer_key_handler(const struct le *le)
+{
+	const struct chan *chan = le->data;
+
+	return alloc_hash(chan->al) ^ sa_hash(&chan->peer, SA_ALL);
+}
+
+
+static bool alloc_cmp_handler(struct le *le, void *arg)
+{
+	const struct allocation *al = le->data;
+
+	return sa_cmp(&al->cli, arg, SA_ALL);
+}
+
+
+struct peer_match {
+	const struct allocation *al;
+	const struct sa *peer;
+	uint16_t nr;
+};
+
+
+static bool perm_cmp_handler(struct le *le, void *arg)
+{
+	const struct perm *perm = le->data;
+	const struct peer_match *m = arg;
+
+	return perm->al == m->al && sa_cmp(&perm->peer, m->peer, SA_ADDR);
+}
+
+
+static bool chan_nr_cmp_handler(struct le *le, void *arg)
+{
+	const struct chan *chan = le->data;
+	const struct peer_match *m = arg;
+
+	return chan->al == m->al && chan->nr == m->nr;
+}
+
+
+static bool chan_peer_cmp_handler(struct le *le, void *arg)
+{
+	const struct chan *chan = le->data;
+	const struct peer_match *m = arg;
+
+	return chan->al == m->al && sa_cmp(&chan->peer, m->peer, SA_ALL);
+}
+
+
+static void perm_destructor(void *data)
+{
+	struct perm *perm = data;
+
+	hash_unlink(&perm->le_hash);
+	list_unlink(&perm->le_alloc);
+}
+
+
+static void chan_destructor(void *data)
+{
+	struct chan *chan = data;
+
+	hash_unlink(&chan->le_nr);
+	hash_unlink(&chan->le_peer);
+	list_unlink(&chan->le_alloc);
+}
+
+
+static void alloc_destructor(void *data)
+{
+	struct allocation *al = data;
+
+	tmr_cancel(&al->tmr);
+	if (al->le.list)
+		--al->ts->nallocs;
+	hash_unlink(&al->le);
+	list_flush(&al->perml);
+	list_flush(&al->chanl);
+	mem_deref(al->rel);
+	mem_deref(al->username);
+}
+
+
+static void srv_destructor(void *data)
+{
+	struct turnsrv *ts = data;
+	size_t i;
+
+	tmr_cancel(&ts->tmr_tx);
+
+	for (i=0; i<ts->pktc; i++) {
+		mem_deref(ts->pktv[i].us);
+		mem_deref(ts->pktv[i].mb);
+	}
+
+	hash_flush(ts->ht_alloc);
+	mem_deref(ts->ht_alloc);
+	mem_deref(ts->ht_perm);
+	mem_deref(ts->ht_chan_nr);
+	mem_deref(ts->ht_chan_peer);
+	mem_deref(ts->pktv);
+	mem_deref(ts->realm);
+	mem_deref(ts->us);
+}
+
+
+static struct allocation *alloc_find(const struct turnsrv *ts,
+				     const struct sa *cli)
+{
+	return list_ledata(hash_lookup(ts->ht_alloc, sa_hash(cli, SA_ALL),
+				       alloc_cmp_handler, (void *)cli));
+}
+
+
+static struct perm *perm_find(const struct allocation *al,
+			      const struct sa *peer)
+{
+	struct peer_match m;
+	struct perm *perm;
+
+	m.al   = al;
+	m.peer = peer;
+
+	perm = list_ledata(hash_lookup(al->ts->ht_perm,
+				       alloc_hash(al) ^ sa_hash(peer, SA_ADDR),
+				       perm_cmp_handler, &m));
+	if (perm && perm->expires <= tmr_jiffies())
+		perm = mem_deref(perm);
+
+	return perm;
+}
+
+
+static struct chan *chan_find_nr(const struct allocation *al, uint16_t nr)
+{
+	struct peer_match m;
+	struct chan *chan;
+
+	m.al = al;
+	m.nr = nr;
+
+	chan = list_ledata(hash_lookup(al->ts->ht_chan_nr,
+				       alloc_hash(al) ^ nr,
+				       chan_nr_cmp_handler, &m));
+	if (chan && chan->expires <= tmr_jiffies())
+		chan = mem_deref(chan);
+
+	return chan;
+}
+
+
+static struct chan *chan_find_peer(const struct allocation *al,
+				   const struct sa *peer)
+{
+	struct peer_match m;
+	struct chan *chan;
+
+	m.al   = al;
+	m.peer = peer;
+
+	chan = list_ledata(hash_lookup(al->ts->ht_chan_peer,
+				       alloc_hash(al) ^ sa_hash(peer, SA_ALL),
+				       chan_peer_cmp_handler, &m));
+	if (chan && chan->expires <= tmr_jiffies())
+		chan = mem_deref(chan);
+
+	return chan;
+}
+
+
+static int perm_install(struct allocation *al, const struct sa *peer)
+{
+	struct perm *perm;
+
+	perm = perm_find(al, peer);
+	if (!perm) {
+		perm = mem_zalloc(sizeof(*perm), perm_destructor);
+		if (!perm)
+			return ENOMEM;
+
+		perm->al   = al;
+		perm->peer = *peer;
+
+		list_append(&al->perml, &perm->le_alloc, perm);
+		hash_append(al->ts->ht_perm,
+			    alloc_hash(al) ^ sa_hash(peer, SA_ADDR),
+			    &perm->le_hash, perm);
+	}
+
+	perm->expires = tmr_jiffies() + PERM_LIFETIME * 1000;
+
+	return 0;
+}
+
+
+static void tx_flush(struct turnsrv *ts)
+{
+	struct udp_dgram dv[BATCH_SIZE];
+	size_t i, j, n;
+
+	tmr_cancel(&ts->tmr_tx);
+
+	for (i=0; i<ts->pktc; i+=n) {
+
+		struct udp_sock *us = ts->pktv[i].us;
+
+		for (n=0; i+n < ts->pktc && n < BATCH_SIZE; n++) {
+
+			const struct pkt *pkt = &ts->pktv[i+n];
+
+			if (pkt->us != us)
+				break;
+
+			dv[n].dst   = &pkt->dst;
+			dv[n].mb    = pkt->mb;
+			dv[n].segsz = 0;
+		}
+
+		(void)udp_send_batch(us, dv, n, NULL);
+
+		for (j=0; j<n; j++) {
+			mem_deref(ts->pktv[i+j].mb);
+			mem_deref(ts->pktv[i+j].us);
+		}
+	}
+
+	ts->pktc = 0;
+}
+
+
+static void tx_timeout(void *arg)
+{
+	tx_flush(arg);
+}
+
+
+/* Queue a datagram, which is sent after the current main loop round */
+static void tx_queue(struct turnsrv *ts, struct udp_sock *us,
+		     const struct sa *dst, struct mbuf *mb)
+{
+	struct pkt *pkt;
+
+	if (ts->pktc >= BATCH_SIZE)
+		tx_flush(ts);
+
+	if (!ts->pktv) {
+		ts->pktv = mem_alloc(BATCH_SIZE * sizeof(*ts->pktv), NULL);
+		if (!ts->pktv) {
+			(void)udp_send(us, dst, mb);
+			return;
+		}
+	}
+
+	pkt = &ts->pktv[ts->pktc++];
+
+	pkt->us  = mem_ref(us);
+	pkt->dst = *dst;
+	pkt->mb  = mem_ref(mb);
+
+	if (!tmr_isrunning(&ts->tmr_tx))
+		tmr_start(&ts->tmr_tx, 0, tx_timeout, ts);
+}
+
+
+static inline size_t dataind_len(const struct sa *peer)
+{
+	size_t len = STUN_HEADER_SIZE + STUN_ATTR_HEADER_SIZE * 2;
+
+	return len + (sa_af(peer) == AF_INET ? 8 : ATTR_ADDR6_SIZE);
+}
+
+
+/* Data from a peer, relayed to the client */
+static void relay_recv_handler(const struct sa *src, struct mbuf *mb,
+			       void *arg)
+{
+	static const uint8_t tid[STUN_TID_SIZE];
+	struct allocation *al = arg;
+	struct chan *chan;
+	size_t pos, len;
+
+	if (!perm_find(al, src))
+		return;
+
+	len = mbuf_get_left(mb);
+
+	chan = chan_find_peer(al, src);
+	if (chan) {
+		if (mb->pos < CHAN_HDR_SIZE)
+			return;
+
+		mb->pos -= CHAN_HDR_SIZE;
+		pos = mb->pos;
+
+		(void)mbuf_write_u16(mb, htons(chan->nr));
+		(void)mbuf_write_u16(mb, htons((uint16_t)len));
+
+		mb->pos = pos;
+	}
+	else {
+		const size_t indlen = dataind_len(src);
+
+		if (mb->pos < indlen)
+			return;
+
+		mb->pos -= indlen;
+		pos = mb->pos;
+
+		if (stun_msg_encode(mb, STUN_METHOD_DATA,
+				    STUN_CLASS_INDICATION, tid,
+				    NULL, NULL, 0, false, 0x00, 2,
+				    STUN_ATTR_XOR_PEER_ADDR, src,
+				    STUN_ATTR_DATA, mb))
+			return;
+
+		mb->pos = pos;
+	}
+
+	tx_queue(al->ts, al->ts->us, &al->cli, mb);
+}
+
+
+static void alloc_timeout(void *arg)
+{
+	struct allocation *al = arg;
+
+	DEBUG_INFO("allocation expired: %J\n", &al->cli);
+
+	mem_deref(al);
+}
+
+
+static void nonce_update(struct turnsrv *ts)
+{
+	const uint64_t now = tmr_jiffies();
+
+	if (ts->nonce_exp > now)
+		return;
+
+	rand_str(ts->nonce, sizeof(ts->nonce));
+	ts->nonce_exp = now + NONCE_LIFETIME * 1000;
+}
+
+
+static void unauthorized(struct turnsrv *ts, const struct sa *src,
+			 const struct stun_msg *msg, uint16_t scode,
+			 const char *reason)
+{
+	(void)stun_ereply(IPPROTO_UDP, ts->us, src, 0, msg, scode, reason,
+			  NULL, 0, false, 3,
+			  STUN_ATTR_REALM, ts->realm,
+			  STUN_ATTR_NONCE, ts->nonce,
+			  STUN_ATTR_SOFTWARE, stun_software);
+}
+
+
+/*
+ * Check the long-term credentials of a request (RFC 5389 section 10.2).
+ * The key of the allocation is used, if there is one.
+ *
+ * return: 0 if authenticated, otherwise an error response was sent
+ */
+static int auth_check(struct turnsrv *ts, const struct sa *src,
+		      const struct stun_msg *msg, const struct allocation *al,
+		      uint8_t *key)
+{
+	struct stun_attr *user, *realm, *nonce;
+	int err;
+
+	nonce_update(ts);
+
+	if (!stun_msg_attr(msg, STUN_ATTR_MSG_INTEGRITY)) {
+		unauthorized(ts, src, msg, 401, "Unauthorized");
+		return EAUTH;
+	}
+
+	user  = stun_msg_attr(msg, STUN_ATTR_USERNAME);
+	realm = stun_msg_attr(msg, STUN_ATTR_REALM);
+	nonce = stun_msg_attr(msg, STUN_ATTR_NONCE);
+	if (!user || !realm || !nonce) {
+		(void)stun_ereply(IPPROTO_UDP, ts->us, src, 0, msg,
+				  400, "Bad Request", NULL, 0, false, 1,
+				  STUN_ATTR_SOFTWARE, stun_software);
+		return EBADMSG;
+	}
+
+	if (strcmp(nonce->v.nonce, ts->nonce)) {
+		unauthorized(ts, src, msg, 438, "Stale Nonce");
+		return EAUTH;
+	}
+
+	if (al) {
+		if (strcmp(user->v.username, al->username)) {
+			(void)stun_ereply(IPPROTO_UDP, ts->us, src, 0, msg,
+					  441, "Wrong Credentials",
+					  NULL, 0, false, 1,
+					  STUN_ATTR_SOFTWARE, stun_software);
+			return EAUTH;
+		}
+
+		memcpy(key, al->key, MD5_SIZE);
+	}
+	else {
+		err = ts->authh(user->v.username, realm->v.realm, key,
+				ts->arg);
+		if (err) {
+			unauthorized(ts, src, msg, 401, "Unauthorized");
+			return err;
+		}
+	}
+
+	if (stun_msg_chk_mi(msg, key, MD5_SIZE)) {
+		unauthorized(ts, src, msg, 401, "Unauthorized");
+		return EAUTH;
+	}
+
+	return 0;
+}
+
+
+static uint32_t lifetime_get(const struct turnsrv *ts,
+			     const struct stun_msg *msg)
+{
+	struct stun_attr *ltm = stun_msg_attr(msg, STUN_ATTR_LIFETIME);
+	uint32_t lifetime = TURN_DEFAULT_LIFETIME;
+
+	if (ltm)
+		lifetime = ltm->v.lifetime;
+
+	return min(lifetime, ts->lifetime_max);
+}
+
+
+static void allocate_handler(struct turnsrv *ts, const struct sa *src,
+			     const struct stun_msg *msg)
+{
+	struct stun_attr *user, *rtp;
+	struct allocation *al;
+	uint8_t key[MD5_SIZE];
+	uint32_t lifetime;
+	int err;
+
+	al = alloc_find(ts, src);
+	if (al) {
+		/* a retransmission gets the same answer */
+		if (memcmp(al->tid, stun_msg_tid(msg), STUN_TID_SIZE)) {
+			(void)stun_ereply(IPPROTO_UDP, ts->us, src, 0, msg,
+					  437, "Allocation Mismatch",
+					  NULL, 0, false, 1,
+					  STUN_ATTR_SOFTWARE, stun_software);
+			return;
+		}
+
+		if (auth_check(ts, src, msg, al, key))
+			return;
+
+		lifetime = (uint32_t)(tmr_get_expire(&al->tmr) / 1000);
+		goto reply;
+	}
+
+	if (auth_check(ts, src, msg, NULL, key))
+		return;
+
+	rtp = stun_msg_attr(msg, STUN_ATTR_REQ_TRANSPORT);
+	if (!rtp) {
+		(void)stun_ereply(IPPROTO_UDP, ts->us, src, 0, msg,
+				  400, "Bad Request", key, sizeof(key), false,
+				  1, STUN_ATTR_SOFTWARE, stun_software);
+		return;
+	}
+
+	if (rtp->v.req_transport != IPPROTO_UDP) {
+		(void)stun_ereply(IPPROTO_UDP, ts->us, src, 0, msg,
+				  442, "Unsupported Transport Protocol",
+				  key, sizeof(key), false,
+				  1, STUN_ATTR_SOFTWARE, stun_software);
+		return;
+	}
+
+	user = stun_msg_attr(msg, STUN_ATTR_USERNAME);
+
+	al = mem_zalloc(sizeof(*al), alloc_destructor);
+	if (!al)
+		return;
+
+	al->ts  = ts;
+	al->cli = *src;
+	memcpy(al->tid, stun_msg_tid(msg), STUN_TID_SIZE);
+	memcpy(al->key, key, sizeof(al->key));
+
+	err = str_dup(&al->username, user->v.username);
+	if (err)
+		goto out;
+
+	err = udp_listen(&al->rel, &ts->relay, relay_recv_handler, al);
+	if (err)
+		goto out;
+
+	udp_rxbuf_presz_set(al->rel, DATAIND_HEADROOM);
+
+	if (ts->rxbatch)
+		(void)udp_rxbatch_set(al->rel, ts->rxbatch);
+
+	err = udp_local_get(al->rel, &al->rel_addr);
+	if (err)
+		goto out;
+
+	hash_append(ts->ht_alloc, sa_hash(src, SA_ALL), &al->le, al);
+	++ts->nallocs;
+
+	lifetime = lifetime_get(ts, msg);
+	tmr_start(&al->tmr, lifetime * 1000, alloc_timeout, al);
+
+ reply:
+	(void)stun_reply(IPPROTO_UDP, ts->us, src, 0, msg,
+			 key, sizeof(key), false, 4,
+			 STUN_ATTR_XOR_RELAY_ADDR, &al->rel_addr,
+			 STUN_ATTR_XOR_MAPPED_ADDR, src,
+			 STUN_ATTR_LIFETIME, &lifetime,
+			 STUN_ATTR_SOFTWARE, stun_software);
+	return;
+
+ out:
+	DEBUG_WARNING("allocate: %J: %m\n", src, err);
+
+	mem_deref(al);
+
+	(void)stun_ereply(IPPROTO_UDP, ts->us, src, 0, msg,
+			  508, "Insufficient Capacity", key, sizeof(key),
+			  false, 1, STUN_ATTR_SOFTWARE, stun_software);
+}
+
+
+static void refresh_handler(struct allocation *al, const struct sa *src,
+			    const struct stun_msg *msg, const uint8_t *key)
+{
+	struct turnsrv *ts = al->ts;
+	uint32_t lifetime;
+
+	lifetime = lifetime_get(ts, msg);
+
+	if (lifetime)
+		tmr_start(&al->tmr, lifetime * 1000, alloc_timeout, al);
+	else
+		mem_deref(al);
+
+	(void)stun_reply(IPPROTO_UDP, ts->us, src, 0, msg,
+			 key, MD5_SIZE, false, 2,
+			 STUN_ATTR_LIFETIME, &lifetime,
+			 STUN_ATTR_SOFTWARE, stun_software);
+}
+
+
+static bool peer_apply_handler(const struct stun_attr *attr, void *arg)
+{
+	struct allocation *al = arg;
+
+	if (attr->type != STUN_ATTR_XOR_PEER_ADDR)
+		return false;
+
+	return 0 != perm_install(al, &attr->v.xor_peer_addr);
+}
+
+
+static void createperm_handler(struct allocation *al, const struct sa *src,
+			       const struct stun_msg *msg,
+			       const uint8_t *key)
+{
+	struct turnsrv *ts = al->ts;
+
+	if (!stun_msg_attr(msg, STUN_ATTR_XOR_PEER_ADDR)) {
+		(void)stun_ereply(IPPROTO_UDP, ts->us, src, 0, msg,
+				  400, "Bad Request", key, MD5_SIZE, false,
+				  1, STUN_ATTR_SOFTWARE, stun_software);
+		return;
+	}
+
+	if (stun_msg_attr_apply(msg, peer_apply_handler, al)) {
+		(void)stun_ereply(IPPROTO_UDP, ts->us, src, 0, msg,
+				  508, "Insufficient Capacity",
+				  key, MD5_SIZE, false,
+				  1, STUN_ATTR_SOFTWARE, stun_software);
+		return;
+	}
+
+	(void)stun_reply(IPPROTO_UDP, ts->us, src, 0, msg,
+			 key, MD5_SIZE, false, 1,
+			 STUN_ATTR_SOFTWARE, stun_software);
+}
+
+
+static void chanbind_handler(struct allocation *al, const struct sa *src,
+			     const struct stun_msg *msg, const uint8_t *key)
+{
+	struct stun_attr *nr, *peer;
+	struct turnsrv *ts = al->ts;
+	struct chan *chan, *chan2;
+
+	nr   = stun_msg_attr(msg, STUN_ATTR_CHANNEL_NUMBER);
+	peer = stun_msg_attr(msg, STUN_ATTR_XOR_PEER_ADDR);
+	if (!nr || !peer)
+		goto badreq;
+
+	if (nr->v.channel_number < CHAN_NUMB_MIN ||
+	    nr->v.channel_number > CHAN_NUMB_MAX)
+		goto badreq;
+
+	/* a channel is bound to one peer, and a peer to one channel */
+	chan  = chan_find_nr(al, nr->v.channel_number);
+	chan2 = chan_find_peer(al, &peer->v.xor_peer_addr);
+	if (chan != chan2)
+		goto badreq;
+
+	if (!chan) {
+		chan = mem_zalloc(sizeof(*chan), chan_destructor);
+		if (!chan)
+			goto nomem;
+
+		chan->al   = al;
+		chan->nr   = nr->v.channel_number;
+		chan->peer = peer->v.xor_peer_addr;
+
+		list_append(&al->chanl, &chan->le_alloc, chan);
+		hash_append(ts->ht_chan_nr, alloc_hash(al) ^ chan->nr,
+			    &chan->le_nr, chan);
+		hash_append(ts->ht_chan_peer,
+			    alloc_hash(al) ^ sa_hash(&chan->peer, SA_ALL),
+			    &chan->le_peer, chan);
+	}
+
+	chan->expires = tmr_jiffies() + CHAN_LIFETIME * 1000;
+
+	if (perm_install(al, &chan->peer))
+		goto nomem;
+
+	(void)stun_reply(IPPROTO_UDP, ts->us, src, 0, msg,
+			 key, MD5_SIZE, false, 1,
+			 STUN_ATTR_SOFTWARE, stun_software);
+	return;
+
+ badreq:
+	(void)stun_ereply(IPPROTO_UDP, ts->us, src, 0, msg,
+			  400, "Bad Request", key, MD5_SIZE, false,
+			  1, STUN_ATTR_SOFTWARE, stun_software);
+	return;
+
+ nomem:
+	(void)stun_ereply(IPPROTO_UDP, ts->us, src, 0, msg,
+			  508, "Insufficient Capacity", key, MD5_SIZE, false,
+			  1, STUN_ATTR_SOFTWARE, stun_software);
+}
+
+
+static void request_handler(struct turnsrv *ts, const struct sa *src,
+			    struct mbuf *mb)
+{
+	struct stun_unknown_attr ua;
+	struct allocation *al;
+	uint8_t key[MD5_SIZE];
+	struct stun_msg *msg;
+
+	if (stun_msg_decode(&msg, mb, &ua))
+		return;
+
+	if (stun_msg_class(msg) != STUN_CLASS_REQUEST)
+		goto out;
+
+	if (ua.typec > 0) {
+		(void)stun_ereply(IPPROTO_UDP, ts->us, src, 0, msg,
+				  420, "Unknown Attribute", NULL, 0, false, 2,
+				  STUN_ATTR_UNKNOWN_ATTR, &ua,
+				  STUN_ATTR_SOFTWARE, stun_software);
+		goto out;
+	}
+
+	switch (stun_msg_method(msg)) {
+
+	case STUN_METHOD_BINDING:
+		(void)stun_reply(IPPROTO_UDP, ts->us, src, 0, msg,
+				 NULL, 0, false, 2,
+				 STUN_ATTR_XOR_MAPPED_ADDR, src,
+				 STUN_ATTR_SOFTWARE, stun_software);
+		goto out;
+
+	case STUN_METHOD_ALLOCATE:
+		allocate_handler(ts, src, msg);
+		goto out;
+
+	case STUN_METHOD_REFRESH:
+	case STUN_METHOD_CREATEPERM:
+	case STUN_METHOD_CHANBIND:
+		break;
+
+	default:
+		(void)stun_ereply(IPPROTO_UDP, ts->us, src, 0, msg,
+				  400, "Bad Request", NULL, 0, false, 1,
+				  STUN_ATTR_SOFTWARE, stun_software);
+		goto out;
+	}
+
+	al = alloc_find(ts, src);
+	if (!al) {
+		(void)stun_ereply(IPPROTO_UDP, ts->us, src, 0, msg,
+				  437, "Allocation Mismatch", NULL, 0, false,
+				  1, STUN_ATTR_SOFTWARE, stun_software);
+		goto out;
+	}
+
+	if (auth_check(ts, src, msg, al, key))
+		goto out;
+
+	switch (stun_msg_method(msg)) {
+
+	case STUN_METHOD_REFRESH:
+		refresh_handler(al, src, msg, key);
+		break;
+
+	case STUN_METHOD_CREATEPERM:
+		createperm_handler(al, src, msg, key);
+		break;
+
+	case STUN_METHOD_CHANBIND:
+		chanbind_handler(al, src, msg, key);
+		break;
+	}
+
+ out:
+	mem_deref(msg);
+}
+
+
+/* Send indication, read in place */
+static void sendind_handler(struct turnsrv *ts, const struct sa *src,
+			    struct mbuf *mb)
+{
+	const struct stun_vattr *data;
+	struct allocation *al;
+	struct stun_view view;
+	struct sa peer;
+
+	if (stun_view_decode(&view, mb, NULL))
+		return;
+
+	if (stun_view_class(&view) != STUN_CLASS_INDICATION ||
+	    stun_view_method(&view) != STUN_METHOD_SEND)
+		return;
+
+	al = alloc_find(ts, src);
+	if (!al)
+		return;
+
+	data = stun_view_attr(&view, STUN_ATTR_DATA);
+	if (!data)
+		return;
+
+	if (stun_view_addr(&view, STUN_ATTR_XOR_PEER_ADDR, &peer))
+		return;
+
+	if (!perm_find(al, &peer))
+		return;
+
+	mb->pos = data->p - mb->buf;
+	mb->end = mb->pos + data->len;
+
+	(void)udp_send(al->rel, &peer, mb);
+}
+
+
+static void chandata_handler(struct turnsrv *ts, const struct sa *src,
+			     struct mbuf *mb)
+{
+	struct allocation *al;
+	struct chan *chan;
+	uint16_t nr, len;
+
+	if (mbuf_get_left(mb) < CHAN_HDR_SIZE)
+		return;
+
+	nr  = ntohs(mbuf_read_u16(mb));
+	len = ntohs(mbuf_read_u16(mb));
+
+	if (mbuf_get_left(mb) < len)
+		return;
+
+	al = alloc_find(ts, src);
+	if (!al)
+		return;
+
+	chan = chan_find_nr(al, nr);
+	if (!chan || !perm_find(al, &chan->peer))
+		return;
+
+	mb->end = mb->pos + len;
+
+	(void)udp_send(al->rel, &chan->peer, mb);
+}
+
+
+static void udp_recv_handler(const struct sa *src, struct mbuf *mb,
+			     void *arg)
+{
+	struct turnsrv *ts = arg;
+	const uint8_t *p = mbuf_buf(mb);
+
+	if (mbuf_get_left(mb) < CHAN_HDR_SIZE)
+		return;
+
+	/* RFC 5766 section 11: ChannelData starts with 0b01 */
+	switch (p[0] >> 6) {
+
+	case 0:
+		if ((p[0] << 8 | p[1]) == (STUN_METHOD_SEND | 0x0010))
+			sendind_handler(ts, src, mb);
+		else
+			request_handler(ts, src, mb);
+		break;
+
+	case 1:
+		chandata_handler(ts, src, mb);
+		break;
+
+	default:
+		break;
+	}
+}
+
+
+/**
+ * Allocate a TURN relay server on UDP. Allocations are authenticated
+ * with long-term credentials, and relays are allocated on the relay
+ * address.
+ *
+ * To share the load between threads, a server is allocated in each
+ * thread with the same local address and reuseport set. The kernel
+ * then sends all datagrams of a client to the same server.
+ *
+ * @param tsp       Pointer to allocated TURN server
+ * @param laddr     Local address of the listening socket
+ * @param relay     Local address for relays, the port is ignored
+ * @param realm     Authentication realm
+ * @param reuseport Share the local port with other servers
+ * @param authh     Handler to get the key of a username
+ * @param arg       Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int turnsrv_alloc(struct turnsrv **tsp, const struct sa *laddr,
+		  const struct sa *relay, const char *realm, bool reuseport,
+		  turnsrv_auth_h *authh, void *arg)
+{
+	struct turnsrv *ts;
+	int err;
+
+	if (!tsp || !laddr || !relay || !realm || !authh)
+		return EINVAL;
+
+	ts = mem_zalloc(sizeof(*ts), srv_destructor);
+	if (!ts)
+		return ENOMEM;
+
+	err  = hash_alloc_auto(&ts->ht_alloc, HT_SIZE, alloc_key_handler);
+	err |= hash_alloc_auto(&ts->ht_perm, HT_SIZE, perm_key_handler);
+	err |= hash_alloc_auto(&ts->ht_chan_nr, HT_SIZE,
+			       chan_nr_key_handler);
+	err |= hash_alloc_auto(&ts->ht_chan_peer, HT_SIZE,
+			       chan_peer_key_handler);
+	if (err)
+		goto out;
+
+	err = str_dup(&ts->realm, realm);
+	if (err)
+		goto out;
+
+	ts->relay = *relay;
+	sa_set_port(&ts->relay, 0);
+
+	ts->lifetime_max = TURN_MAX_LIFETIME;
+	ts->authh = authh;
+	ts->arg   = arg;
+
+	tmr_init(&ts->tmr_tx);
+	nonce_update(ts);
+
+	if (reuseport)
+		err = udp_listen_reuseport(&ts->us, laddr, udp_recv_handler,
+					   ts);
+	else
+		err = udp_listen(&ts->us, laddr, udp_recv_handler, ts);
+
+ out:
+	if (err)
+		mem_deref(ts);
+	else
+		*tsp = ts;
+
+	return err;
+}
+
+
+/**
+ * Set the number of datagrams received per system call, on the
+ * listening socket and on the relays that are allocated after this
+ *
+ * @param ts TURN server
+ * @param n  Maximum number of datagrams per batch, 0 to disable
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int turnsrv_rxbatch_set(struct turnsrv *ts, unsigned n)
+{
+	if (!ts)
+		return EINVAL;
+
+	ts->rxbatch = n;
+
+	return udp_rxbatch_set(ts->us, n);
+}
+
+
+/**
+ * Get the listening UDP socket of a TURN server
+ *
+ * @param ts TURN server
+ *
+ * @return UDP socket
+ */
+struct udp_sock *turnsrv_sock(const struct turnsrv *ts)
+{
+	return ts ? ts->us : NULL;
+}
+
+
+/**
+ * Get the number of allocations of a TURN server
+ *
+ * @param ts TURN server
+ *
+ * @return Number of allocations
+ */
+uint32_t turnsrv_nallocs(const struct turnsrv *ts)
+{
+	return ts ? ts->nallocs : 0;
+}
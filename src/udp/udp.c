@@ -3,6 +3,9 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
+#ifdef HAVE_MMSG
+#define _GNU_SOURCE 1
+#endif
 #include <stdlib.h>
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
@@ -19,6 +22,13 @@
 #ifdef HAVE_STRINGS_H
 #include <strings.h>
 #endif
+#ifdef LINUX
+#include <time.h>
+#include <linux/filter.h>
+#endif
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 #ifdef __APPLE__
 #include "TargetConditionals.h"
 #endif
@@ -31,6 +41,8 @@
 #include <re_sa.h>
 #include <re_net.h>
 #include <re_udp.h>
+#include <re_probe.h>
+#include <re_metric.h>
 
 
 #define DEBUG_MODULE "udp"
@@ -52,7 +64,56 @@
 
 
 enum {
-	UDP_RXSZ_DEFAULT = 8192
+	UDP_RXSZ_DEFAULT = 8192,
+	UDP_BATCH_MAX    = 64,
+	UDP_CORK_MAX     = 1024,
+	UDP_GRO_RXSZ     = 65536,
+};
+
+
+/* UDP segmentation offload, see udp(7) */
+#ifdef LINUX
+#define HAVE_UDP_GSO 1
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+/** Control message with the segment size */
+union gso_ctl {
+	char buf[CMSG_SPACE(sizeof(uint16_t))];
+	size_t align;
+};
+
+/* Kernel receive timestamps and drop counters, see socket(7) */
+#ifndef SO_TIMESTAMPNS
+#define SO_TIMESTAMPNS 35
+#endif
+#ifndef SCM_TIMESTAMPNS
+#define SCM_TIMESTAMPNS SO_TIMESTAMPNS
+#endif
+#ifndef SO_RXQ_OVFL
+#define SO_RXQ_OVFL 40
+#endif
+
+/** Control messages of a received datagram */
+union rx_ctl {
+	char buf[CMSG_SPACE(sizeof(int))
+		 + CMSG_SPACE(sizeof(struct timespec))
+		 + CMSG_SPACE(sizeof(uint32_t))];
+	size_t align;
+};
+#endif
+
+/** Ancillary data of a received datagram */
+struct rxmeta {
+	size_t segsz;        /**< Coalesced segment size, or 0  */
+	uint64_t ts;         /**< Kernel receive time [ns]      */
 };
 
 
@@ -60,13 +121,41 @@ enum {
 struct udp_sock {
 	struct list helpers; /**< List of UDP Helpers         */
 	udp_recv_h *rh;      /**< Receive handler             */
+	udp_recv_ts_h *rhts; /**< Timestamped receive handler */
 	udp_error_h *eh;     /**< Error handler               */
+	udp_burst_h *bh;     /**< End of burst handler        */
 	void *arg;           /**< Handler argument            */
 	int fd;              /**< Socket file descriptor      */
 	int fd6;             /**< IPv6 socket file descriptor */
 	bool conn;           /**< Connected socket flag       */
+	int fdc;             /**< Connected sibling socket    */
+	struct sa cpeer;     /**< Peer of the sibling socket  */
 	size_t rxsz;         /**< Maximum receive chunk size  */
 	size_t rx_presz;     /**< Preallocated rx buffer size */
+	struct mbuf **rxv;   /**< Batched receive buffers     */
+	unsigned rxn;        /**< Size of receive batch       */
+	struct mbuf *rxmb;   /**< Recycled receive buffer     */
+	bool rxrecycle;      /**< Recycle receive buffers     */
+	bool gro;            /**< Receive offload enabled     */
+	bool rxts;           /**< Receive timestamps enabled  */
+	uint32_t rx_drops;   /**< Datagrams dropped by kernel */
+	unsigned budget;     /**< Edge-triggered read budget  */
+	struct list corkq;   /**< Datagrams held back by cork */
+	unsigned corkc;      /**< Number of held datagrams    */
+	bool corked;         /**< Sending is held back        */
+};
+
+/** Datagram held back by a corked UDP socket */
+struct cork_dgram {
+	struct le le;
+	struct sa dst;
+	struct mbuf *mb;
+};
+
+/** Cached sockets for anonymous sending, one set per thread */
+struct anon {
+	int fd;              /**< IPv4 socket file descriptor */
+	int fd6;             /**< IPv6 socket file descriptor */
 };
 
 /** Defines a UDP helper */
@@ -76,9 +165,35 @@ struct udp_helper {
 	udp_helper_send_h *sendh;
 	udp_helper_recv_h *recvh;
 	void *arg;
+	size_t headroom;
+	size_t tailroom;
 };
 
 
+RE_METRIC_COUNTER_DEFINE(m_rx_bytes, "re_udp_rx_bytes_total", NULL,
+			 "Bytes received on UDP sockets");
+RE_METRIC_COUNTER_DEFINE(m_tx_bytes, "re_udp_tx_bytes_total", NULL,
+			 "Bytes sent on UDP sockets");
+RE_METRIC_COUNTER_DEFINE(m_rx_drops, "re_udp_rx_drops_total", NULL,
+			 "Datagrams dropped by the kernel receive queues");
+RE_METRIC_COUNTER_DEFINE(m_tx_drops, "re_udp_tx_drops_total", NULL,
+			 "Datagrams that could not be sent");
+
+
+/* Count the result of a send call; returns 0 or the error */
+static int tx_account(ssize_t n)
+{
+	const int err = n < 0 ? errno : 0;
+
+	if (err)
+		re_metric_inc(&m_tx_drops);
+	else
+		re_metric_add(&m_tx_bytes, (uint64_t)n);
+
+	return err;
+}
+
+
 static void dummy_udp_recv_handler(const struct sa *src,
 				   struct mbuf *mb, void *arg)
 {
@@ -109,12 +224,53 @@ static bool helper_recv_handler(struct sa *src,
 }
 
 
+static void rxv_flush(struct udp_sock *us)
+{
+	unsigned i;
+
+	for (i=0; i<us->rxn; i++)
+		mem_deref(us->rxv[i]);
+
+	us->rxv = mem_deref(us->rxv);
+	us->rxn = 0;
+}
+
+
+/* Get a receive buffer, unless something kept a reference to it */
+static struct mbuf *rxbuf_get(struct mbuf **mbp, size_t size)
+{
+	struct mbuf *mb = *mbp;
+
+	if (!mb || mem_nrefs(mb) > 1 || mb->size != size) {
+
+		mem_deref(mb);
+
+		mb = *mbp = mbuf_alloc(size);
+	}
+
+	return mb;
+}
+
+
+static void cork_destructor(void *data)
+{
+	struct cork_dgram *cd = data;
+
+	list_unlink(&cd->le);
+	mem_deref(cd->mb);
+}
+
+
 static void udp_destructor(void *data)
 {
 	struct udp_sock *us = data;
 
+	list_flush(&us->corkq);
 	list_flush(&us->helpers);
 
+	rxv_flush(us);
+	mem_deref(us->rxmb);
+
 	if (-1 != us->fd) {
 		fd_close(us->fd);
 		(void)close(us->fd);
@@ -124,21 +280,297 @@ static void udp_destructor(void *data)
 		fd_close(us->fd6);
 		(void)close(us->fd6);
 	}
+
+	if (-1 != us->fdc) {
+		fd_close(us->fdc);
+		(void)close(us->fdc);
+	}
 }
 
 
-static void udp_read(struct udp_sock *us, int fd)
+static void udp_recv_dgram(struct udp_sock *us, struct sa *src,
+			   struct mbuf *mb, uint64_t ts)
 {
-	struct mbuf *mb = mbuf_alloc(us->rxsz);
-	struct sa src;
 	struct le *le;
+
+	/* call helpers */
+	le = us->helpers.head;
+	while (le) {
+		struct udp_helper *uh = le->data;
+		bool hdld;
+
+		le = le->next;
+
+		hdld = uh->recvh(src, mb, uh->arg);
+		if (hdld)
+			return;
+	}
+
+	if (us->rhts)
+		us->rhts(src, mb, ts, us->arg);
+	else
+		us->rh(src, mb, us->arg);
+}
+
+
+#ifdef HAVE_UDP_GSO
+static void rxmeta_parse(struct udp_sock *us, struct msghdr *msg,
+			 struct rxmeta *meta)
+{
+	struct cmsghdr *cmsg;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg;
+	     cmsg = CMSG_NXTHDR(msg, cmsg)) {
+
+		if (cmsg->cmsg_level == SOL_UDP &&
+		    cmsg->cmsg_type == UDP_GRO) {
+
+			int segsz;
+
+			memcpy(&segsz, CMSG_DATA(cmsg), sizeof(segsz));
+			meta->segsz = segsz > 0 ? (size_t)segsz : 0;
+		}
+		else if (cmsg->cmsg_level == SOL_SOCKET &&
+			 cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+
+			struct timespec ts;
+
+			memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+			meta->ts = (uint64_t)ts.tv_sec * 1000000000
+				+ ts.tv_nsec;
+		}
+		else if (cmsg->cmsg_level == SOL_SOCKET &&
+			 cmsg->cmsg_type == SO_RXQ_OVFL) {
+
+			uint32_t drops;
+
+			memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+
+			re_metric_add(&m_rx_drops, drops - us->rx_drops);
+			us->rx_drops = drops;
+		}
+	}
+}
+#endif
+
+
+#ifdef HAVE_MMSG
+/*
+ * Receive up to one batch of datagrams with a single system call.
+ * Returns EAGAIN if the receive queue was drained.
+ */
+static int udp_read_batch(struct udp_sock *us, int fd)
+{
+	struct mmsghdr msgv[UDP_BATCH_MAX];
+	struct iovec iov[UDP_BATCH_MAX];
+	struct mbuf *mbv[UDP_BATCH_MAX];
+	struct sa srcv[UDP_BATCH_MAX];
+#ifdef HAVE_UDP_GSO
+	union rx_ctl ctlv[UDP_BATCH_MAX];
+#endif
+	unsigned i, c;
+	int n;
+
+	memset(msgv, 0, sizeof(msgv));
+
+	for (c=0; c<us->rxn; c++) {
+
+		struct mbuf *mb = rxbuf_get(&us->rxv[c], us->rxsz);
+		if (!mb)
+			break;
+
+		iov[c].iov_base = mb->buf + us->rx_presz;
+		iov[c].iov_len  = mb->size - us->rx_presz;
+
+		msgv[c].msg_hdr.msg_name    = &srcv[c].u.sa;
+		msgv[c].msg_hdr.msg_namelen = sizeof(srcv[c].u);
+		msgv[c].msg_hdr.msg_iov     = &iov[c];
+		msgv[c].msg_hdr.msg_iovlen  = 1;
+
+#ifdef HAVE_UDP_GSO
+		if (us->rxts) {
+			msgv[c].msg_hdr.msg_control    = ctlv[c].buf;
+			msgv[c].msg_hdr.msg_controllen = sizeof(ctlv[c].buf);
+		}
+#endif
+	}
+
+	if (!c)
+		return ENOMEM;
+
+	n = recvmmsg(fd, msgv, c, 0, NULL);
+	if (n < 0) {
+		const int err = errno;
+
+		if (EAGAIN == err || EWOULDBLOCK == err)
+			return EAGAIN;
+
+		if (us->eh)
+			us->eh(err, us->arg);
+
+		return err;
+	}
+
+	for (i=0; i<(unsigned)n; i++)
+		mbv[i] = mem_ref(us->rxv[i]);
+
+	/* The socket may be destroyed by one of the handlers */
+	mem_ref(us);
+
+	for (i=0; i<(unsigned)n; i++) {
+
+		struct mbuf *mb = mbv[i];
+		struct rxmeta meta = {0, 0};
+
+		srcv[i].len = msgv[i].msg_hdr.msg_namelen;
+
+		mb->pos = us->rx_presz;
+		mb->end = us->rx_presz + msgv[i].msg_len;
+
+		RE_PROBE2(udp_recv, us, msgv[i].msg_len);
+		re_metric_add(&m_rx_bytes, msgv[i].msg_len);
+
+#ifdef HAVE_UDP_GSO
+		if (us->rxts)
+			rxmeta_parse(us, &msgv[i].msg_hdr, &meta);
+#endif
+
+		udp_recv_dgram(us, &srcv[i], mb, meta.ts);
+
+		if (mem_nrefs(us) == 1)
+			break;
+	}
+
+	for (i=0; i<(unsigned)n; i++)
+		mem_deref(mbv[i]);
+
+	mem_deref(us);
+
+	/* A short batch means that the queue is empty */
+	return (unsigned)n < c ? EAGAIN : 0;
+}
+#endif
+
+
+#ifdef HAVE_UDP_GSO
+/* Receive one datagram with its ancillary data */
+static ssize_t recv_meta(struct udp_sock *us, int fd, struct mbuf *mb,
+			 struct sa *src, struct rxmeta *meta)
+{
+	union rx_ctl ctl;
+	struct msghdr msg;
+	struct iovec iov;
+	ssize_t n;
+
+	iov.iov_base = mb->buf + us->rx_presz;
+	iov.iov_len  = mb->size - us->rx_presz;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name       = &src->u.sa;
+	msg.msg_namelen    = src->len;
+	msg.msg_iov        = &iov;
+	msg.msg_iovlen     = 1;
+	msg.msg_control    = ctl.buf;
+	msg.msg_controllen = sizeof(ctl.buf);
+
+	n = recvmsg(fd, &msg, 0);
+	if (n < 0)
+		return n;
+
+	src->len = msg.msg_namelen;
+
+	rxmeta_parse(us, &msg, meta);
+
+	return n;
+}
+#endif
+
+
+/*
+ * Deliver a buffer coalesced by the kernel as separate datagrams. Each
+ * datagram is a view into the same buffer, until a handler keeps a
+ * reference; then the rest is copied to a new buffer.
+ */
+static void udp_recv_segments(struct udp_sock *us, const struct sa *src,
+			      struct mbuf *mb, size_t segsz, uint64_t ts)
+{
+	struct mbuf *cur = mem_ref(mb);
+	uint32_t nrefs = mem_nrefs(cur);
+	size_t pos = mb->pos, end = mb->end;
+
+	mem_ref(us);
+
+	while (pos < end) {
+
+		const size_t len = min(segsz, end - pos);
+		struct sa seg_src = *src;
+
+		if (mem_nrefs(cur) > nrefs) {
+
+			struct mbuf *mb2;
+
+			mb2 = mbuf_alloc(us->rx_presz + end - pos);
+			if (!mb2)
+				break;
+
+			memcpy(mb2->buf + us->rx_presz, cur->buf + pos,
+			       end - pos);
+
+			mem_deref(cur);
+			cur   = mb2;
+			nrefs = 1;
+
+			end = us->rx_presz + end - pos;
+			pos = us->rx_presz;
+		}
+
+		cur->pos = pos;
+		cur->end = pos + len;
+
+		udp_recv_dgram(us, &seg_src, cur, ts);
+
+		/* The socket may be destroyed by one of the handlers */
+		if (mem_nrefs(us) == 1)
+			break;
+
+		pos += len;
+	}
+
+	mem_deref(us);
+	mem_deref(cur);
+}
+
+
+/* Returns EAGAIN if there was nothing to read */
+static int udp_read(struct udp_sock *us, int fd)
+{
+	struct mbuf *mb;
+	struct sa src;
+	struct rxmeta meta = {0, 0};
+	size_t size;
 	int err = 0;
 	ssize_t n;
 
+#ifdef HAVE_MMSG
+	if (us->rxn && !us->gro)
+		return udp_read_batch(us, fd);
+#endif
+
+	size = us->gro ? max(us->rxsz, (size_t)UDP_GRO_RXSZ) : us->rxsz;
+
+	if (us->rxrecycle)
+		mb = mem_ref(rxbuf_get(&us->rxmb, size));
+	else
+		mb = mbuf_alloc(size);
 	if (!mb)
-		return;
+		return ENOMEM;
 
 	src.len = sizeof(src.u);
+#ifdef HAVE_UDP_GSO
+	if (us->gro || us->rxts)
+		n = recv_meta(us, fd, mb, &src, &meta);
+	else
+#endif
 	n = recvfrom(fd, BUF_CAST mb->buf + us->rx_presz,
 		     mb->size - us->rx_presz, 0,
 		     &src.u.sa, &src.len);
@@ -201,25 +633,62 @@ static void udp_read(struct udp_sock *us, int fd)
 	mb->pos = us->rx_presz;
 	mb->end = n + us->rx_presz;
 
-	(void)mbuf_resize(mb, mb->end);
+	RE_PROBE2(udp_recv, us, n);
+	re_metric_add(&m_rx_bytes, (uint64_t)n);
 
-	/* call helpers */
-	le = us->helpers.head;
-	while (le) {
-		struct udp_helper *uh = le->data;
-		bool hdld;
+	if (!us->rxrecycle)
+		(void)mbuf_resize(mb, mb->end);
 
-		le = le->next;
+	if (meta.segsz && meta.segsz < (size_t)n)
+		udp_recv_segments(us, &src, mb, meta.segsz, meta.ts);
+	else
+		udp_recv_dgram(us, &src, mb, meta.ts);
 
-		hdld = uh->recvh(&src, mb, uh->arg);
-		if (hdld)
+ out:
+	mem_deref(mb);
+
+	return err;
+}
+
+
+/*
+ * Read until the socket is drained, or the budget is spent. The rest
+ * is read in the next iteration of the main loop.
+ */
+static void udp_drain(struct udp_sock *us, int fd)
+{
+	unsigned i;
+
+	if (!us->budget && !us->bh) {
+		(void)udp_read(us, fd);
+		return;
+	}
+
+	/* The socket may be destroyed by one of the handlers */
+	mem_ref(us);
+
+	if (!us->budget) {
+		(void)udp_read(us, fd);
+		goto out;
+	}
+
+	for (i=0; i<us->budget; i++) {
+
+		if (udp_read(us, fd))
+			goto out;
+
+		if (mem_nrefs(us) == 1 ||
+		    (fd != us->fd && fd != us->fd6 && fd != us->fdc))
 			goto out;
 	}
 
-	us->rh(&src, mb, us->arg);
+	fd_ready(fd);
 
  out:
-	mem_deref(mb);
+	if (us->bh && mem_nrefs(us) > 1)
+		us->bh(us->arg);
+
+	mem_deref(us);
 }
 
 
@@ -229,7 +698,7 @@ static void udp_read_handler(int flags, void *arg)
 
 	(void)flags;
 
-	udp_read(us, us->fd);
+	udp_drain(us, us->fd);
 }
 
 
@@ -239,22 +708,22 @@ static void udp_read_handler6(int flags, void *arg)
 
 	(void)flags;
 
-	udp_read(us, us->fd6);
+	udp_drain(us, us->fd6);
 }
 
 
-/**
- * Create and listen on a UDP Socket
- *
- * @param usp   Pointer to returned UDP Socket
- * @param local Local network address
- * @param rh    Receive handler
- * @param arg   Handler argument
- *
- * @return 0 if success, otherwise errorcode
- */
-int udp_listen(struct udp_sock **usp, const struct sa *local,
-	       udp_recv_h *rh, void *arg)
+static void udp_read_handler_conn(int flags, void *arg)
+{
+	struct udp_sock *us = arg;
+
+	(void)flags;
+
+	udp_drain(us, us->fdc);
+}
+
+
+static int udp_listen_internal(struct udp_sock **usp, const struct sa *local,
+			       bool reuseport, udp_recv_h *rh, void *arg)
 {
 	struct addrinfo hints, *res = NULL, *r;
 	struct udp_sock *us = NULL;
@@ -273,6 +742,7 @@ int udp_listen(struct udp_sock **usp, const struct sa *local,
 
 	us->fd  = -1;
 	us->fd6 = -1;
+	us->fdc = -1;
 
 	if (local) {
 		af = sa_af(local);
@@ -329,6 +799,14 @@ int udp_listen(struct udp_sock **usp, const struct sa *local,
 			continue;
 		}
 
+		if (reuseport) {
+			err = net_sockopt_reuseport_set(fd, true);
+			if (err) {
+				(void)close(fd);
+				continue;
+			}
+		}
+
 		if (bind(fd, r->ai_addr, SIZ_CAST r->ai_addrlen) < 0) {
 			err = errno;
 			DEBUG_INFO("listen: bind(): %m (%J)\n", err, local);
@@ -392,99 +870,913 @@ int udp_listen(struct udp_sock **usp, const struct sa *local,
 
 
 /**
- * Connect a UDP Socket to a specific peer.
- * When connected, this UDP Socket will only receive data from that peer.
+ * Create and listen on a UDP Socket
  *
- * @param us   UDP Socket
- * @param peer Peer network address
+ * @param usp   Pointer to returned UDP Socket
+ * @param local Local network address
+ * @param rh    Receive handler
+ * @param arg   Handler argument
  *
  * @return 0 if success, otherwise errorcode
  */
-int udp_connect(struct udp_sock *us, const struct sa *peer)
+int udp_listen(struct udp_sock **usp, const struct sa *local,
+	       udp_recv_h *rh, void *arg)
 {
-	int fd;
+	return udp_listen_internal(usp, local, false, rh, arg);
+}
 
-	if (!us || !peer)
-		return EINVAL;
 
-	/* choose a socket */
-	if (AF_INET6 == sa_af(peer) && -1 != us->fd6)
-		fd = us->fd6;
-	else
+/**
+ * Create and listen on a UDP Socket that shares its local port with other
+ * sockets (SO_REUSEPORT). The kernel distributes the incoming datagrams
+ * between the sockets, so one socket can be opened per thread.
+ *
+ * @param usp   Pointer to returned UDP Socket
+ * @param local Local network address, with a non-zero port
+ * @param rh    Receive handler
+ * @param arg   Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int udp_listen_reuseport(struct udp_sock **usp, const struct sa *local,
+			 udp_recv_h *rh, void *arg)
+{
+	if (!local || !sa_port(local))
+		return EINVAL;
+
+	return udp_listen_internal(usp, local, true, rh, arg);
+}
+
+
+#ifdef LINUX
+#ifndef SO_ATTACH_REUSEPORT_CBPF
+#define SO_ATTACH_REUSEPORT_CBPF 51
+#endif
+#ifndef SO_DETACH_REUSEPORT_BPF
+#define SO_DETACH_REUSEPORT_BPF 68
+#endif
+
+/*
+ * Classic BPF program for UDP_STEER_ID, run on the UDP payload. RTP
+ * and RTCP are steered by SSRC, and STUN by the first four octets of
+ * a USERNAME attribute that comes first. Other datagrams return an
+ * index out of range, and the kernel then falls back to the hash.
+ */
+static const struct sock_filter steer_id[] = {
+	BPF_STMT(BPF_LD  | BPF_W   | BPF_LEN, 0),
+	BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, 8, 0, 22),
+	BPF_STMT(BPF_LD  | BPF_B   | BPF_ABS, 0),
+	BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0xc0),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x80, 9, 0),
+
+	/* STUN */
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x00, 0, 18),
+	BPF_STMT(BPF_LD  | BPF_W   | BPF_LEN, 0),
+	BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, 28, 0, 16),
+	BPF_STMT(BPF_LD  | BPF_W   | BPF_ABS, 4),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x2112a442, 0, 14),
+	BPF_STMT(BPF_LD  | BPF_H   | BPF_ABS, 20),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x0006, 0, 12),
+	BPF_STMT(BPF_LD  | BPF_W   | BPF_ABS, 24),
+	BPF_STMT(BPF_JMP | BPF_JA, 8),
+
+	/* RTCP has packet types 192-223, RFC 5761 */
+	BPF_STMT(BPF_LD  | BPF_B   | BPF_ABS, 1),
+	BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, 192, 0, 3),
+	BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, 223, 2, 0),
+	BPF_STMT(BPF_LD  | BPF_W   | BPF_ABS, 4),
+	BPF_STMT(BPF_JMP | BPF_JA, 3),
+
+	/* RTP */
+	BPF_STMT(BPF_LD  | BPF_W   | BPF_LEN, 0),
+	BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, 12, 0, 3),
+	BPF_STMT(BPF_LD  | BPF_W   | BPF_ABS, 8),
+
+	/* index, patched with the number of sockets */
+	BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, 1),
+	BPF_STMT(BPF_RET | BPF_A, 0),
+	BPF_STMT(BPF_RET | BPF_K, 0xffffffff),
+};
+
+static const struct sock_filter steer_cpu[] = {
+	BPF_STMT(BPF_LD  | BPF_W   | BPF_ABS, SKF_AD_OFF + SKF_AD_CPU),
+	BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, 1),
+	BPF_STMT(BPF_RET | BPF_A, 0),
+};
+
+
+static int steer_attach(int fd, const struct sock_filter *prog, size_t len,
+			unsigned n)
+{
+	struct sock_filter code[ARRAY_SIZE(steer_id)];
+	struct sock_fprog fprog;
+	size_t i;
+
+	for (i=0; i<len; i++) {
+		code[i] = prog[i];
+		if (code[i].code == (BPF_ALU | BPF_MOD | BPF_K))
+			code[i].k = n;
+	}
+
+	fprog.len    = (unsigned short)len;
+	fprog.filter = code;
+
+	if (0 != setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+			    &fprog, sizeof(fprog)))
+		return errno;
+
+	return 0;
+}
+
+
+static int steer_set(int fd, enum udp_steer steer, unsigned n)
+{
+	const int v = 0;
+	int err;
+
+	switch (steer) {
+
+	case UDP_STEER_HASH:
+		if (0 == setsockopt(fd, SOL_SOCKET, SO_DETACH_REUSEPORT_BPF,
+				    &v, sizeof(v)))
+			return 0;
+
+		/* no program was attached */
+		err = errno;
+		return err == ENOENT ? 0 : err;
+
+	case UDP_STEER_CPU:
+		return steer_attach(fd, steer_cpu, ARRAY_SIZE(steer_cpu), n);
+
+	case UDP_STEER_ID:
+		return steer_attach(fd, steer_id, ARRAY_SIZE(steer_id), n);
+
+	default:
+		return EINVAL;
+	}
+}
+#endif
+
+
+/**
+ * Steer the incoming datagrams of a SO_REUSEPORT group of UDP Sockets,
+ * e.g. one socket per thread from udp_listen_reuseport(). The sockets
+ * are indexed in the order they were opened, and a datagram goes to
+ * socket udp_steer_index(key, n). With UDP_STEER_ID the key is the SSRC
+ * of RTP and RTCP, or the first four octets of the STUN username, so
+ * all the packets of a session reach the thread that owns it. The
+ * program applies to the whole group, and is set on one socket.
+ *
+ * @param us    UDP Socket of the group
+ * @param steer Steering method, UDP_STEER_HASH for the kernel default
+ * @param n     Number of sockets in the group
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int udp_reuseport_steer(struct udp_sock *us, enum udp_steer steer,
+			unsigned n)
+{
+#ifdef LINUX
+	int err = 0;
+
+	if (!us || !n)
+		return EINVAL;
+
+	if (-1 != us->fd)
+		err = steer_set(us->fd, steer, n);
+
+	if (!err && -1 != us->fd6)
+		err = steer_set(us->fd6, steer, n);
+
+	return err;
+#else
+	if (!us || !n)
+		return EINVAL;
+
+	return steer == UDP_STEER_HASH ? 0 : ENOSYS;
+#endif
+}
+
+
+/**
+ * Get the index of the socket that udp_reuseport_steer() steers a key
+ * to, e.g. to choose a local ICE username for the thread of a session
+ *
+ * @param id Steering key, e.g. an SSRC, in host byte order
+ * @param n  Number of sockets in the group
+ *
+ * @return Socket index
+ */
+unsigned udp_steer_index(uint32_t id, unsigned n)
+{
+	return n ? id % n : 0;
+}
+
+
+/**
+ * Connect a UDP Socket to a specific peer.
+ * When connected, this UDP Socket will only receive data from that peer.
+ *
+ * @param us   UDP Socket
+ * @param peer Peer network address
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int udp_connect(struct udp_sock *us, const struct sa *peer)
+{
+	int fd;
+
+	if (!us || !peer)
+		return EINVAL;
+
+	/* choose a socket */
+	if (AF_INET6 == sa_af(peer) && -1 != us->fd6)
+		fd = us->fd6;
+	else
 		fd = us->fd;
 
-	if (0 != connect(fd, &peer->u.sa, peer->len))
-		return errno;
+	if (0 != connect(fd, &peer->u.sa, peer->len))
+		return errno;
+
+	us->conn = true;
+
+	return 0;
+}
+
+
+/* choose a socket */
+static int udp_fd(const struct udp_sock *us, const struct sa *dst)
+{
+	if (AF_INET6 == sa_af(dst) && -1 != us->fd6)
+		return us->fd6;
+	else
+		return us->fd;
+}
+
+
+static void fastpath_close(struct udp_sock *us)
+{
+	if (-1 == us->fdc)
+		return;
+
+	fd_close(us->fdc);
+	(void)close(us->fdc);
+	us->fdc = -1;
+	sa_init(&us->cpeer, AF_UNSPEC);
+}
+
+
+/**
+ * Open a connected sibling socket for one peer of a UDP Socket. The
+ * sibling is bound to the same local address and port, and the kernel
+ * delivers the datagrams from the peer to it. Datagrams to the peer are
+ * then sent on the sibling with send(), so the route is looked up once
+ * instead of for every datagram. Other peers still use the socket.
+ *
+ * @param us   UDP Socket
+ * @param peer Peer network address, NULL to close the sibling socket
+ *
+ * @return 0 if success, otherwise errorcode
+ *
+ * @note Socket options set on the UDP Socket are not copied
+ */
+int udp_fastpath_set(struct udp_sock *us, const struct sa *peer)
+{
+	const int flags = FD_READ | (us && us->budget ? FD_EDGE : 0);
+	struct sa local;
+	int fd, lfd, err;
+
+	if (!us)
+		return EINVAL;
+
+	if (peer && us->fdc != -1 && sa_cmp(peer, &us->cpeer, SA_ALL))
+		return 0;
+
+	fastpath_close(us);
+
+	if (!peer)
+		return 0;
+
+	if (us->conn)
+		return EISCONN;
+
+	lfd = udp_fd(us, peer);
+	if (-1 == lfd)
+		return EAFNOSUPPORT;
+
+	local.len = sizeof(local.u);
+	if (0 != getsockname(lfd, &local.u.sa, &local.len))
+		return errno;
+
+	if (sa_af(&local) != sa_af(peer))
+		return EAFNOSUPPORT;
+
+	/* both sockets must allow the port to be shared */
+	err = net_sockopt_reuse_set(lfd, true);
+	if (err)
+		return err;
+
+	fd = SOK_CAST socket(sa_af(peer), SOCK_DGRAM, IPPROTO_UDP);
+	if (fd < 0)
+		return errno;
+
+	err  = net_sockopt_blocking_set(fd, false);
+	err |= net_sockopt_reuse_set(fd, true);
+	if (err)
+		goto out;
+
+	if (bind(fd, &local.u.sa, SIZ_CAST local.len) < 0 ||
+	    connect(fd, &peer->u.sa, SIZ_CAST peer->len) < 0) {
+		err = errno;
+		goto out;
+	}
+
+	err = fd_listen(fd, flags, udp_read_handler_conn, us);
+	if (err)
+		goto out;
+
+	us->fdc   = fd;
+	us->cpeer = *peer;
+
+ out:
+	if (err)
+		(void)close(fd);
+
+	return err;
+}
+
+
+/* call helpers in reverse order, returns true if handled */
+static bool send_helpers(int *err, struct sa *dst, struct mbuf *mb,
+			 struct le *le)
+{
+	while (le) {
+		struct udp_helper *uh = le->data;
+
+		le = le->prev;
+
+		if (uh->sendh(err, dst, mb, uh->arg) || *err)
+			return true;
+	}
+
+	return false;
+}
+
+
+static int udp_send_internal(struct udp_sock *us, const struct sa *dst,
+			     struct mbuf *mb, struct le *le)
+{
+	struct sa hdst;
+	int err = 0, fd;
+	ssize_t n;
+
+	fd = udp_fd(us, dst);
+
+	if (le) {
+		sa_cpy(&hdst, dst);
+		dst = &hdst;
+
+		if (send_helpers(&err, &hdst, mb, le))
+			return err;
+	}
+
+	/* Connected sibling for the peer? */
+	if (-1 != us->fdc && sa_cmp(dst, &us->cpeer, SA_ALL)) {
+		n = send(us->fdc, BUF_CAST mb->buf + mb->pos,
+			 mb->end - mb->pos, 0);
+	}
+	else if (us->conn) {
+		n = send(fd, BUF_CAST mb->buf + mb->pos, mb->end - mb->pos,
+			 0);
+	}
+	else {
+		n = sendto(fd, BUF_CAST mb->buf + mb->pos, mb->end - mb->pos,
+			   0, &dst->u.sa, dst->len);
+	}
+
+	return tx_account(n);
+}
+
+
+/* Send the held back datagrams with udp_send_batch() */
+static int cork_flush(struct udp_sock *us)
+{
+	struct udp_dgram *dv;
+	struct le *le;
+	size_t n = 0;
+	int err;
+
+	if (!us->corkc)
+		return 0;
+
+	dv = mem_alloc(us->corkc * sizeof(*dv), NULL);
+	if (!dv) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	for (le = us->corkq.head; le; le = le->next) {
+
+		struct cork_dgram *cd = le->data;
+
+		dv[n].dst   = &cd->dst;
+		dv[n].mb    = cd->mb;
+		dv[n].segsz = 0;
+		++n;
+	}
+
+	err = udp_send_batch(us, dv, n, NULL);
+
+	mem_deref(dv);
+
+ out:
+	list_flush(&us->corkq);
+	us->corkc = 0;
+
+	return err;
+}
+
+
+/* Hold back a copy of a datagram */
+static int cork_push(struct udp_sock *us, const struct sa *dst,
+		     const struct mbuf *mb)
+{
+	struct cork_dgram *cd;
+	size_t n;
+
+	/* The queue is sent when it is full */
+	if (us->corkc >= UDP_CORK_MAX) {
+		int err = cork_flush(us);
+		if (err)
+			return err;
+	}
+
+	cd = mem_zalloc(sizeof(*cd), cork_destructor);
+	if (!cd)
+		return ENOMEM;
+
+	n = mbuf_get_left(mb);
+
+	/* Keep the headroom for the helpers */
+	cd->mb = mbuf_alloc(mb->pos + n);
+	if (!cd->mb) {
+		mem_deref(cd);
+		return ENOMEM;
+	}
+
+	cd->mb->pos = mb->pos;
+	cd->mb->end = mb->pos;
+	(void)mbuf_write_mem(cd->mb, mbuf_buf(mb), n);
+	cd->mb->pos = mb->pos;
+
+	cd->dst = *dst;
+
+	list_append(&us->corkq, &cd->le, cd);
+	++us->corkc;
+
+	return 0;
+}
+
+
+/**
+ * Send a UDP Datagram to a peer
+ *
+ * @param us  UDP Socket
+ * @param dst Destination network address
+ * @param mb  Buffer to send
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int udp_send(struct udp_sock *us, const struct sa *dst, struct mbuf *mb)
+{
+	if (!us || !dst || !mb)
+		return EINVAL;
+
+	if (us->corked)
+		return cork_push(us, dst, mb);
+
+	return udp_send_internal(us, dst, mb, us->helpers.tail);
+}
+
+
+/**
+ * Send a UDP Datagram from the segments of a memory buffer chain. It is
+ * sent with one sendmsg() if the UDP Socket has no UDP-helpers, otherwise
+ * the segments are copied to one buffer for the helpers.
+ *
+ * @param us  UDP Socket
+ * @param dst Destination network address
+ * @param mc  Memory buffer chain to send
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int udp_send_chain(struct udp_sock *us, const struct sa *dst,
+		   const struct mbuf_chain *mc)
+{
+	struct mbuf *mb;
+	int err;
+
+	if (!us || !dst || !mc)
+		return EINVAL;
+
+#ifndef WIN32
+	if (!us->helpers.head) {
+
+		struct iovec iov[MBUF_CHAIN_MAX];
+		struct msghdr msg;
+		size_t i;
+
+		for (i=0; i<mc->segc; i++) {
+			iov[i].iov_base = mc->segv[i].buf + mc->segv[i].pos;
+			iov[i].iov_len  = mc->segv[i].len;
+		}
+
+		memset(&msg, 0, sizeof(msg));
+		if (!us->conn) {
+			msg.msg_name    = (void *)&dst->u.sa;
+			msg.msg_namelen = dst->len;
+		}
+		msg.msg_iov    = iov;
+		msg.msg_iovlen = mc->segc;
+
+		return tx_account(sendmsg(udp_fd(us, dst), &msg, 0));
+	}
+#endif
+
+	err = mbuf_chain_linearize(&mb, mc, udp_headroom(us));
+	if (err)
+		return err;
+
+	err = udp_send_internal(us, dst, mb, us->helpers.tail);
+
+	mem_deref(mb);
+
+	return err;
+}
+
+
+/**
+ * Cork or uncork a UDP Socket. While corked, datagrams sent with
+ * udp_send() are copied and held back, and uncorking sends all of them
+ * with udp_send_batch(), e.g. to send many small probes together.
+ *
+ * @param us   UDP Socket
+ * @param cork True to cork, false to uncork
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int udp_set_cork(struct udp_sock *us, bool cork)
+{
+	if (!us)
+		return EINVAL;
+
+	us->corked = cork;
+
+	return cork ? 0 : cork_flush(us);
+}
+
+
+#ifdef HAVE_UDP_GSO
+static void gso_ctl_set(struct msghdr *msg, union gso_ctl *ctl, uint16_t segsz)
+{
+	struct cmsghdr *cmsg;
+
+	memset(ctl, 0, sizeof(*ctl));
+
+	msg->msg_control    = ctl->buf;
+	msg->msg_controllen = sizeof(ctl->buf);
+
+	cmsg = CMSG_FIRSTHDR(msg);
+	cmsg->cmsg_level = SOL_UDP;
+	cmsg->cmsg_type  = UDP_SEGMENT;
+	cmsg->cmsg_len   = CMSG_LEN(sizeof(segsz));
+	memcpy(CMSG_DATA(cmsg), &segsz, sizeof(segsz));
+}
+
+
+static int send_gso(const struct udp_sock *us, int fd, const struct sa *dst,
+		    const struct mbuf *mb, uint16_t segsz)
+{
+	union gso_ctl ctl;
+	struct msghdr msg;
+	struct iovec iov;
+
+	iov.iov_base = mb->buf + mb->pos;
+	iov.iov_len  = mb->end - mb->pos;
+
+	memset(&msg, 0, sizeof(msg));
+	if (!us->conn) {
+		msg.msg_name    = (void *)&dst->u.sa;
+		msg.msg_namelen = dst->len;
+	}
+	msg.msg_iov    = &iov;
+	msg.msg_iovlen = 1;
+
+	gso_ctl_set(&msg, &ctl, segsz);
+
+	return tx_account(sendmsg(fd, &msg, 0));
+}
+#endif
+
+
+/* Send each segment as a separate datagram */
+static int send_segments(struct udp_sock *us, const struct sa *dst,
+			 struct mbuf *mb, uint16_t segsz)
+{
+	const size_t pos = mb->pos, end = mb->end;
+	size_t off;
+	int err = 0;
+
+	for (off = pos; off < end && !err; off += segsz) {
+
+		const size_t len = min((size_t)segsz, end - off);
+		struct mbuf *seg;
+
+		/* Helpers may modify the buffer, so they get a copy */
+		if (us->helpers.tail) {
+
+			seg = mbuf_alloc(pos + len);
+			if (!seg)
+				return ENOMEM;
+
+			seg->pos = pos;
+			(void)mbuf_write_mem(seg, mb->buf + off, len);
+			seg->pos = pos;
+
+			err = udp_send_internal(us, dst, seg,
+						us->helpers.tail);
+			mem_deref(seg);
+		}
+		else {
+			mb->pos = off;
+			mb->end = off + len;
+
+			err = udp_send_internal(us, dst, mb, NULL);
+		}
+	}
+
+	mb->pos = pos;
+	mb->end = end;
+
+	return err;
+}
+
+
+/**
+ * Send a buffer as a train of UDP Datagrams of the same size to a peer.
+ * Where supported, the kernel splits the buffer with UDP segmentation
+ * offload (GSO), otherwise one datagram is sent at a time. Only the last
+ * datagram may be shorter than the segment size.
+ *
+ * @param us    UDP Socket
+ * @param dst   Destination network address
+ * @param mb    Buffer to send
+ * @param segsz Size of each datagram in bytes
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int udp_send_gso(struct udp_sock *us, const struct sa *dst,
+		 struct mbuf *mb, uint16_t segsz)
+{
+	if (!us || !dst || !mb || !segsz)
+		return EINVAL;
+
+	if (mbuf_get_left(mb) <= segsz)
+		return udp_send_internal(us, dst, mb, us->helpers.tail);
+
+#ifdef HAVE_UDP_GSO
+	/* Helpers work on single datagrams */
+	if (!us->helpers.tail) {
+
+		const int err = send_gso(us, udp_fd(us, dst), dst, mb, segsz);
+
+		/* No segmentation offload for this socket or route */
+		if (err != EIO && err != EINVAL && err != ENOPROTOOPT)
+			return err;
+	}
+#endif
+
+	return send_segments(us, dst, mb, segsz);
+}
+
+
+/**
+ * Send a batch of UDP Datagrams. Where supported, consecutive datagrams
+ * on the same socket are sent with a single system call.
+ *
+ * @param us    UDP Socket
+ * @param dv    Vector of datagrams
+ * @param n     Number of datagrams
+ * @param sentp Optional number of datagrams sent
+ *
+ * @return 0 if success, otherwise errorcode of the first failed datagram
+ */
+int udp_send_batch(struct udp_sock *us, const struct udp_dgram *dv,
+		   size_t n, size_t *sentp)
+{
+	size_t i = 0, sent = 0;
+	int err = 0;
+
+	if (!us || (n && !dv))
+		return EINVAL;
+
+#ifdef HAVE_MMSG
+	while (i < n && !err) {
+
+		struct mmsghdr msgv[UDP_BATCH_MAX];
+		struct iovec iov[UDP_BATCH_MAX];
+		struct sa dstv[UDP_BATCH_MAX];
+#ifdef HAVE_UDP_GSO
+		union gso_ctl ctlv[UDP_BATCH_MAX];
+#endif
+		unsigned c = 0, off = 0;
+		int fd = -1;
+
+		memset(msgv, 0, sizeof(msgv));
+
+		for (; i < n && c < UDP_BATCH_MAX; i++) {
+
+			const struct udp_dgram *d = &dv[i];
+			struct mbuf *mb = d->mb;
+			struct sa *dst = &dstv[c];
+
+			if (!d->dst || !mb) {
+				err = EINVAL;
+				break;
+			}
+
+			if (fd != -1 && udp_fd(us, d->dst) != fd)
+				break;
+
+			/* Segmented datagrams with helpers go one by one */
+			if (d->segsz && us->helpers.tail) {
+
+				if (c)
+					break;
+
+				err = udp_send_gso(us, d->dst, mb, d->segsz);
+				if (!err)
+					++sent;
+
+				++i;
+				break;
+			}
+
+			fd = udp_fd(us, d->dst);
+
+			sa_cpy(dst, d->dst);
+
+			if (send_helpers(&err, dst, mb, us->helpers.tail)) {
+				if (err)
+					break;
+
+				++sent;
+				continue;
+			}
+
+			iov[c].iov_base = mb->buf + mb->pos;
+			iov[c].iov_len  = mb->end - mb->pos;
+
+			if (!us->conn) {
+				msgv[c].msg_hdr.msg_name    = &dst->u.sa;
+				msgv[c].msg_hdr.msg_namelen = dst->len;
+			}
+			msgv[c].msg_hdr.msg_iov    = &iov[c];
+			msgv[c].msg_hdr.msg_iovlen = 1;
+
+#ifdef HAVE_UDP_GSO
+			if (d->segsz && iov[c].iov_len > d->segsz)
+				gso_ctl_set(&msgv[c].msg_hdr, &ctlv[c],
+					    d->segsz);
+#endif
+
+			++c;
+		}
+
+		while (off < c) {
+
+			int r = sendmmsg(fd, msgv + off, c - off, 0);
+			if (r < 0) {
+				if (!err)
+					err = errno;
+				re_metric_add(&m_tx_drops, c - off);
+				break;
+			}
+
+			for (r += off; off < (unsigned)r; off++)
+				re_metric_add(&m_tx_bytes,
+					      msgv[off].msg_len);
+		}
+
+		sent += off;
+	}
+#else
+	for (; i < n; i++) {
+
+		if (!dv[i].dst || !dv[i].mb) {
+			err = EINVAL;
+			break;
+		}
+
+		if (dv[i].segsz)
+			err = udp_send_gso(us, dv[i].dst, dv[i].mb,
+					   dv[i].segsz);
+		else
+			err = udp_send_internal(us, dv[i].dst, dv[i].mb,
+						us->helpers.tail);
+		if (err)
+			break;
+
+		++sent;
+	}
+#endif
+
+	if (sentp)
+		*sentp = sent;
+
+	return err;
+}
 
-	us->conn = true;
 
-	return 0;
+#ifdef HAVE_PTHREAD
+
+static void anon_close(struct anon *anon)
+{
+	if (-1 != anon->fd)
+		(void)close(anon->fd);
+
+	if (-1 != anon->fd6)
+		(void)close(anon->fd6);
+
+	anon->fd  = -1;
+	anon->fd6 = -1;
 }
 
 
-static int udp_send_internal(struct udp_sock *us, const struct sa *dst,
-			     struct mbuf *mb, struct le *le)
+static pthread_once_t anon_once = PTHREAD_ONCE_INIT;
+static pthread_key_t  anon_key;
+static bool           anon_key_ok;
+
+
+static void anon_destructor(void *arg)
 {
-	struct sa hdst;
-	int err = 0, fd;
+	struct anon *anon = arg;
 
-	/* choose a socket */
-	if (AF_INET6 == sa_af(dst) && -1 != us->fd6)
-		fd = us->fd6;
-	else
-		fd = us->fd;
+	anon_close(anon);
+	free(anon);
+}
 
-	/* call helpers in reverse order */
-	while (le) {
-		struct udp_helper *uh = le->data;
 
-		le = le->prev;
+static void anon_init(void)
+{
+	anon_key_ok = (0 == pthread_key_create(&anon_key, anon_destructor));
+}
 
-		if (dst != &hdst) {
-			sa_cpy(&hdst, dst);
-			dst = &hdst;
-		}
 
-		if (uh->sendh(&err, &hdst, mb, uh->arg) || err)
-			return err;
-	}
+static struct anon *anon_get(void)
+{
+	struct anon *anon;
 
-	/* Connected socket? */
-	if (us->conn) {
-		if (send(fd, BUF_CAST mb->buf + mb->pos, mb->end - mb->pos,
-			 0) < 0)
-			return errno;
-	}
-	else {
-		if (sendto(fd, BUF_CAST mb->buf + mb->pos, mb->end - mb->pos,
-			   0, &dst->u.sa, dst->len) < 0)
-			return errno;
+	pthread_once(&anon_once, anon_init);
+
+	if (!anon_key_ok)
+		return NULL;
+
+	anon = pthread_getspecific(anon_key);
+	if (anon)
+		return anon;
+
+	anon = malloc(sizeof(*anon));
+	if (!anon)
+		return NULL;
+
+	anon->fd  = -1;
+	anon->fd6 = -1;
+
+	if (pthread_setspecific(anon_key, anon)) {
+		free(anon);
+		return NULL;
 	}
 
-	return 0;
+	return anon;
 }
 
+#else
 
-/**
- * Send a UDP Datagram to a peer
- *
- * @param us  UDP Socket
- * @param dst Destination network address
- * @param mb  Buffer to send
- *
- * @return 0 if success, otherwise errorcode
- */
-int udp_send(struct udp_sock *us, const struct sa *dst, struct mbuf *mb)
+static struct anon *anon_get(void)
 {
-	if (!us || !dst || !mb)
-		return EINVAL;
+	static struct anon anon = {-1, -1};
 
-	return udp_send_internal(us, dst, mb, us->helpers.tail);
+	return &anon;
 }
 
+#endif
+
 
 /**
- * Send an anonymous UDP Datagram to a peer
+ * Send an anonymous UDP Datagram to a peer. The sockets used for this are
+ * created on first use, one per thread and address family, and are kept
+ * until the thread exits.
  *
  * @param dst Destination network address
  * @param mb  Buffer to send
@@ -493,20 +1785,37 @@ int udp_send(struct udp_sock *us, const struct sa *dst, struct mbuf *mb)
  */
 int udp_send_anon(const struct sa *dst, struct mbuf *mb)
 {
-	struct udp_sock *us;
-	int err;
+	struct anon *anon;
+	int *fdp, fd;
 
 	if (!dst || !mb)
 		return EINVAL;
 
-	err = udp_listen(&us, NULL, NULL, NULL);
-	if (err)
-		return err;
+	anon = anon_get();
+	if (!anon)
+		return ENOMEM;
 
-	err = udp_send_internal(us, dst, mb, NULL);
-	mem_deref(us);
+	fdp = (AF_INET6 == sa_af(dst)) ? &anon->fd6 : &anon->fd;
 
-	return err;
+	if (-1 == *fdp) {
+
+		int err;
+
+		fd = SOK_CAST socket(sa_af(dst), SOCK_DGRAM, IPPROTO_UDP);
+		if (fd < 0)
+			return errno;
+
+		err = net_sockopt_blocking_set(fd, false);
+		if (err) {
+			(void)close(fd);
+			return err;
+		}
+
+		*fdp = fd;
+	}
+
+	return tx_account(sendto(*fdp, BUF_CAST mb->buf + mb->pos,
+				 mb->end - mb->pos, 0, &dst->u.sa, dst->len));
 }
 
 
@@ -609,6 +1918,193 @@ void udp_rxsz_set(struct udp_sock *us, size_t rxsz)
 }
 
 
+/**
+ * Enable or disable recycling of receive buffers on a UDP Socket. The
+ * receive buffer is then reused after the handlers return, unless one of
+ * them keeps a reference to it, and is not shrunk to fit the datagram.
+ *
+ * @param us     UDP Socket
+ * @param enable True to enable, false to disable
+ */
+void udp_rxbuf_recycle_set(struct udp_sock *us, bool enable)
+{
+	if (!us)
+		return;
+
+	us->rxrecycle = enable;
+
+	if (!enable)
+		us->rxmb = mem_deref(us->rxmb);
+}
+
+
+/**
+ * Enable kernel receive timestamps on a UDP Socket. The timestamped
+ * receive handler replaces the receive handler, and gets the time the
+ * datagram arrived at the socket, in [ns] since the epoch. This also
+ * enables the counter of datagrams dropped by the kernel.
+ *
+ * @param us  UDP Socket
+ * @param rh  Timestamped receive handler
+ * @param arg Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int udp_rxts_enable(struct udp_sock *us, udp_recv_ts_h *rh, void *arg)
+{
+#ifdef HAVE_UDP_GSO
+	const int on = 1;
+	int i;
+
+	if (!us || !rh)
+		return EINVAL;
+
+	for (i=0; i<2; i++) {
+
+		const int fd = i ? us->fd6 : us->fd;
+
+		if (-1 == fd)
+			continue;
+
+		if (0 != setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS,
+				    &on, sizeof(on)))
+			return errno;
+
+		/* Drop counter is optional */
+		(void)setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL,
+				 &on, sizeof(on));
+	}
+
+	us->rhts = rh;
+	us->arg  = arg;
+	us->rxts = true;
+
+	return 0;
+#else
+	(void)rh;
+	(void)arg;
+
+	return us ? ENOSYS : EINVAL;
+#endif
+}
+
+
+/**
+ * Get the number of datagrams dropped by the kernel on a UDP Socket,
+ * because the socket receive buffer was full. Updated on receive when
+ * receive timestamps are enabled.
+ *
+ * @param us UDP Socket
+ *
+ * @return Number of dropped datagrams
+ */
+uint32_t udp_rx_drops(const struct udp_sock *us)
+{
+	return us ? us->rx_drops : 0;
+}
+
+
+/**
+ * Set the number of datagrams received per system call on a UDP Socket.
+ * Receive buffers are reused between batches, unless a handler keeps a
+ * reference to them.
+ *
+ * @param us UDP Socket
+ * @param n  Maximum number of datagrams per batch, 0 to disable
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int udp_rxbatch_set(struct udp_sock *us, unsigned n)
+{
+	if (!us)
+		return EINVAL;
+
+#ifdef HAVE_MMSG
+	rxv_flush(us);
+
+	if (!n)
+		return 0;
+
+	n = min(n, (unsigned)UDP_BATCH_MAX);
+
+	us->rxv = mem_zalloc(n * sizeof(*us->rxv), NULL);
+	if (!us->rxv)
+		return ENOMEM;
+
+	us->rxn = n;
+
+	return 0;
+#else
+	return n ? ENOSYS : 0;
+#endif
+}
+
+
+/**
+ * Set the read budget of a UDP Socket, for edge-triggered polling. The
+ * socket is then read until it is drained, but at most budget times per
+ * iteration of the main loop, so that one busy socket does not delay
+ * the others. Each read is one datagram, or one batch with
+ * udp_rxbatch_set(). The socket is attached to the current thread.
+ *
+ * @param us     UDP Socket
+ * @param budget Maximum reads per loop iteration, 0 for level-triggered
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int udp_rxbudget_set(struct udp_sock *us, unsigned budget)
+{
+	if (!us)
+		return EINVAL;
+
+	us->budget = budget;
+
+	return udp_thread_attach(us);
+}
+
+
+/**
+ * Enable or disable UDP receive offload (GRO) on a UDP Socket. The kernel
+ * may then coalesce datagrams of the same size from the same peer into
+ * one buffer, which is split again before the helpers and the receive
+ * handler are called. Handlers must not write beyond the end of a
+ * received buffer.
+ *
+ * @param us     UDP Socket
+ * @param enable True to enable, false to disable
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int udp_gro_set(struct udp_sock *us, bool enable)
+{
+#ifdef HAVE_UDP_GSO
+	const int on = enable;
+	int err = 0;
+
+	if (!us)
+		return EINVAL;
+
+	if (-1 != us->fd && 0 != setsockopt(us->fd, SOL_UDP, UDP_GRO,
+					    &on, sizeof(on)))
+		err = errno;
+
+	if (-1 != us->fd6 && 0 != setsockopt(us->fd6, SOL_UDP, UDP_GRO,
+					     &on, sizeof(on)))
+		err = errno;
+
+	if (!err)
+		us->gro = enable;
+
+	return err;
+#else
+	if (!us)
+		return EINVAL;
+
+	return enable ? ENOSYS : 0;
+#endif
+}
+
+
 /**
  * Set preallocated space on receive buffer.
  *
@@ -636,8 +2132,26 @@ void udp_handler_set(struct udp_sock *us, udp_recv_h *rh, void *arg)
 	if (!us)
 		return;
 
-	us->rh  = rh ? rh : dummy_udp_recv_handler;
-	us->arg = arg;
+	us->rh   = rh ? rh : dummy_udp_recv_handler;
+	us->rhts = NULL;
+	us->arg  = arg;
+}
+
+
+/**
+ * Set the end of burst handler on a UDP Socket. It is called with the
+ * argument of the receive handler, after the datagrams of one read
+ * event are delivered, so that a receiver can process them together.
+ *
+ * @param us  UDP Socket
+ * @param bh  End of burst handler, NULL to remove
+ */
+void udp_burst_handler_set(struct udp_sock *us, udp_burst_h *bh)
+{
+	if (!us)
+		return;
+
+	us->bh = bh;
 }
 
 
@@ -687,19 +2201,35 @@ int udp_sock_fd(const struct udp_sock *us, int af)
  */
 int udp_thread_attach(struct udp_sock *us)
 {
-	int err = 0;
+	const uint32_t busy = re_busy_poll();
+	int flags, err = 0;
 
 	if (!us)
 		return EINVAL;
 
+	flags = FD_READ | (us->budget ? FD_EDGE : 0);
+
+	if (busy) {
+		if (-1 != us->fd)
+			(void)net_sockopt_busy_poll_set(us->fd, busy);
+		if (-1 != us->fd6)
+			(void)net_sockopt_busy_poll_set(us->fd6, busy);
+	}
+
 	if (-1 != us->fd) {
-		err = fd_listen(us->fd, FD_READ, udp_read_handler, us);
+		err = fd_listen(us->fd, flags, udp_read_handler, us);
 		if (err)
 			goto out;
 	}
 
 	if (-1 != us->fd6) {
-		err = fd_listen(us->fd6, FD_READ, udp_read_handler6, us);
+		err = fd_listen(us->fd6, flags, udp_read_handler6, us);
+		if (err)
+			goto out;
+	}
+
+	if (-1 != us->fdc) {
+		err = fd_listen(us->fdc, flags, udp_read_handler_conn, us);
 		if (err)
 			goto out;
 	}
@@ -727,6 +2257,9 @@ void udp_thread_detach(struct udp_sock *us)
 
 	if (-1 != us->fd6)
 		fd_close(us->fd6);
+
+	if (-1 != us->fdc)
+		fd_close(us->fdc);
 }
 
 
@@ -835,3 +2368,76 @@ struct udp_helper *udp_helper_find(const struct udp_sock *us, int layer)
 
 	return NULL;
 }
+
+
+/**
+ * Set the number of bytes a UDP-helper adds in front of and after the
+ * data it sends
+ *
+ * @param uh       UDP-helper
+ * @param headroom Maximum number of bytes added in front of the data
+ * @param tailroom Maximum number of bytes added after the data
+ */
+void udp_helper_room_set(struct udp_helper *uh, size_t headroom,
+			 size_t tailroom)
+{
+	if (!uh)
+		return;
+
+	uh->headroom = headroom;
+	uh->tailroom = tailroom;
+}
+
+
+/**
+ * Get the headroom needed by all UDP-helpers of a UDP socket. A buffer
+ * with this many bytes before the data can be sent through the helpers
+ * without moving the data.
+ *
+ * @param us UDP socket
+ *
+ * @return Headroom in bytes
+ */
+size_t udp_headroom(const struct udp_sock *us)
+{
+	struct le *le;
+	size_t n = 0;
+
+	if (!us)
+		return 0;
+
+	for (le = us->helpers.head; le; le = le->next) {
+
+		const struct udp_helper *uh = le->data;
+
+		n += uh->headroom;
+	}
+
+	return n;
+}
+
+
+/**
+ * Get the tailroom needed by all UDP-helpers of a UDP socket
+ *
+ * @param us UDP socket
+ *
+ * @return Tailroom in bytes
+ */
+size_t udp_tailroom(const struct udp_sock *us)
+{
+	struct le *le;
+	size_t n = 0;
+
+	if (!us)
+		return 0;
+
+	for (le = us->helpers.head; le; le = le->next) {
+
+		const struct udp_helper *uh = le->data;
+
+		n += uh->tailroom;
+	}
+
+	return n;
+}
@@ -3,6 +3,7 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
+#include <ctype.h>
 #include <string.h>
 #include <re_types.h>
 #include <re_fmt.h>
@@ -72,6 +73,80 @@ int uri_encode(struct re_printf *pf, const struct uri *uri)
 }
 
 
+/* Index of the first of chars in p, or n. A NUL byte is not one of them */
+static size_t span_until(const char *p, size_t n, const char *chars)
+{
+	size_t i;
+
+	for (i=0; i<n; i++) {
+		if (p[i] && strchr(chars, p[i]))
+			break;
+	}
+
+	return i;
+}
+
+
+static size_t span_digits(const char *p, size_t n)
+{
+	size_t i;
+
+	for (i=0; i<n; i++) {
+		if (p[i] < '0' || p[i] > '9')
+			break;
+	}
+
+	return i;
+}
+
+
+/*
+ * Decode the common forms of host-port without a regular expression.
+ * Returns false for the others, which the regular expressions decode.
+ */
+static bool hostport_fast(const struct pl *hostport, struct pl *host,
+			  struct pl *port)
+{
+	const char *p = hostport->p;
+	const size_t n = hostport->l;
+	size_t i;
+
+	if (!n || memchr(p + 1, '[', n - 1))
+		return false;
+
+	if (p[0] == '[') {
+
+		for (i=1; i<n; i++) {
+			if (!isxdigit((unsigned char)p[i]) && p[i] != ':')
+				break;
+		}
+
+		if (i == 1 || i == n || p[i] != ']')
+			return false;
+
+		host->p = p + 1;
+		host->l = i - 1;
+		++i;
+	}
+	else {
+		i = span_until(p, n, ":");
+		if (!i)
+			return false;
+
+		host->p = p;
+		host->l = i;
+	}
+
+	while (i < n && p[i] == ':')
+		++i;
+
+	port->p = p + i;
+	port->l = span_digits(p + i, n - i);
+
+	return true;
+}
+
+
 /**
  * Decode host-port portion of a URI (if present)
  *
@@ -87,6 +162,9 @@ int uri_decode_hostport(const struct pl *hostport, struct pl *host,
 	if (!hostport || !host || !port)
 		return EINVAL;
 
+	if (hostport_fast(hostport, host, port))
+		return 0;
+
 	/* Try IPv6 first */
 	if (!re_regex(hostport->p, hostport->l, "\\[[0-9a-f:]+\\][:]*[0-9]*",
 		      host, NULL, port))
@@ -98,6 +176,70 @@ int uri_decode_hostport(const struct pl *hostport, struct pl *host,
 }
 
 
+/*
+ * Split a URI in one pass, where the regular expressions of uri_decode()
+ * would match from the first character. Returns false otherwise.
+ */
+static bool decode_fast(struct uri *uri, const struct pl *pl,
+			struct pl *port)
+{
+	const char *p = pl->p, *end = pl->p + pl->l;
+	const char *at;
+	struct pl hostport;
+	size_t n;
+
+	n = span_until(p, pl->l, ":");
+	if (!n || p + n == end)
+		return false;
+
+	uri->scheme.p = p;
+	uri->scheme.l = n;
+	p += n + 1;
+
+	at = memchr(p, '@', end - p);
+	if (at) {
+		n = span_until(p, at - p, ":");
+
+		uri->user.p = p;
+		uri->user.l = n;
+		p += n;
+
+		while (p < at && *p == ':')
+			++p;
+
+		uri->password.p = p;
+		uri->password.l = at - p;
+		p = at + 1;
+	}
+
+	n = span_until(p, end - p, "/;? ");
+	if (!n)
+		return false;
+
+	hostport.p = p;
+	hostport.l = n;
+	p += n;
+
+	if (!hostport_fast(&hostport, &uri->host, port))
+		return false;
+
+	n = span_until(p, end - p, ";? ");
+	uri->path.p = p;
+	uri->path.l = n;
+	p += n;
+
+	n = span_until(p, end - p, "?");
+	uri->params.p = p;
+	uri->params.l = n;
+	p += n;
+
+	uri->headers.p = p;
+	uri->headers.l = end - p;
+
+	return true;
+}
+
+
 /**
  * Decode a pointer-length object into a URI object
  *
@@ -117,6 +259,11 @@ int uri_decode(struct uri *uri, const struct pl *pl)
 		return EINVAL;
 
 	memset(uri, 0, sizeof(*uri));
+	if (decode_fast(uri, pl, &port))
+		goto out;
+
+	memset(uri, 0, sizeof(*uri));
+	port = pl_null;
 	if (0 == re_regex(pl->p, pl->l,
 			  "[^:]+:[^@:]*[:]*[^@]*@[^/;? ]+[^;? ]*[^?]*[^]*",
 			  &uri->scheme, &uri->user, NULL, &uri->password,
@@ -153,6 +300,43 @@ int uri_decode(struct uri *uri, const struct pl *pl)
 }
 
 
+/* Get the next ";name[=value]" parameter, skipping empty names */
+static bool param_next(struct pl *plr, struct pl *name, struct pl *val)
+{
+	while (plr->l) {
+		const char *p, *semi;
+		size_t n;
+
+		p = memchr(plr->p, ';', plr->l);
+		if (!p)
+			break;
+
+		pl_advance(plr, p + 1 - plr->p);
+
+		semi = memchr(plr->p, ';', plr->l);
+		n = semi ? (size_t)(semi - plr->p) : plr->l;
+
+		name->p = plr->p;
+		name->l = span_until(plr->p, n, "=");
+
+		val->p = name->p + name->l;
+		val->l = n - name->l;
+
+		while (val->l && *val->p == '=') {
+			++val->p;
+			--val->l;
+		}
+
+		pl_advance(plr, n);
+
+		if (name->l)
+			return true;
+	}
+
+	return false;
+}
+
+
 /**
  * Get a URI parameter and possibly the value of it
  *
@@ -165,14 +349,22 @@ int uri_decode(struct uri *uri, const struct pl *pl)
 int uri_param_get(const struct pl *pl, const struct pl *pname,
 		  struct pl *pvalue)
 {
-	char expr[128];
+	struct pl plr, name, val;
 
 	if (!pl || !pname || !pvalue)
 		return EINVAL;
 
-	(void)re_snprintf(expr, sizeof(expr), ";%r[=]*[^;]*", pname);
+	plr = *pl;
 
-	return re_regex(pl->p, pl->l, expr, NULL, pvalue);
+	while (param_next(&plr, &name, &val)) {
+
+		if (0 == pl_casecmp(&name, pname)) {
+			*pvalue = val;
+			return 0;
+		}
+	}
+
+	return ENOENT;
 }
 
 
@@ -187,7 +379,7 @@ int uri_param_get(const struct pl *pl, const struct pl *pname,
  */
 int uri_params_apply(const struct pl *pl, uri_apply_h *ah, void *arg)
 {
-	struct pl plr, pname, eq, pvalue;
+	struct pl plr, pname, pvalue;
 	int err = 0;
 
 	if (!pl || !ah)
@@ -195,14 +387,7 @@ int uri_params_apply(const struct pl *pl, uri_apply_h *ah, void *arg)
 
 	plr = *pl;
 
-	while (plr.l > 0) {
-
-		err = re_regex(plr.p, plr.l, ";[^;=]+[=]*[^;]*",
-			       &pname, &eq, &pvalue);
-		if (err)
-			break;
-
-		pl_advance(&plr, 1 + pname.l + eq.l + pvalue.l);
+	while (param_next(&plr, &pname, &pvalue)) {
 
 		err = ah(&pname, &pvalue, arg);
 		if (err)
@@ -213,6 +398,68 @@ int uri_params_apply(const struct pl *pl, uri_apply_h *ah, void *arg)
 }
 
 
+/**
+ * Decode the URI Parameters of a URI once, for looking up several of
+ * them with uri_params_find()
+ *
+ * @param up Decoded parameters, pointing into pl
+ * @param pl Pointer-length string containing parameters
+ *
+ * @return 0 if success, EOVERFLOW if there were more than URI_PARAMS_MAX
+ */
+int uri_params_decode(struct uri_params *up, const struct pl *pl)
+{
+	struct pl plr, name, val;
+
+	if (!up || !pl)
+		return EINVAL;
+
+	up->n = 0;
+	plr = *pl;
+
+	while (param_next(&plr, &name, &val)) {
+
+		if (up->n >= URI_PARAMS_MAX)
+			return EOVERFLOW;
+
+		up->namev[up->n] = name;
+		up->valv[up->n]  = val;
+		++up->n;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Find a URI Parameter that was decoded with uri_params_decode()
+ *
+ * @param up     Decoded parameters
+ * @param pname  URI Parameter name
+ * @param pvalue Returned URI Parameter value
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int uri_params_find(const struct uri_params *up, const struct pl *pname,
+		    struct pl *pvalue)
+{
+	uint32_t i;
+
+	if (!up || !pname || !pvalue)
+		return EINVAL;
+
+	for (i=0; i<up->n; i++) {
+
+		if (0 == pl_casecmp(&up->namev[i], pname)) {
+			*pvalue = up->valv[i];
+			return 0;
+		}
+	}
+
+	return ENOENT;
+}
+
+
 /**
  * Get a URI header and possibly the value of it
  *
@@ -3,7 +3,6 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
-#include <ctype.h>
 #include <re_types.h>
 #include <re_fmt.h>
 #include <re_uri.h>
@@ -14,162 +13,106 @@
 #include <re_dbg.h>
 
 
-/** Defines the URI escape handler */
-typedef bool (esc_h)(char c);
-
-
-static bool is_mark(int c)
-{
-	switch (c) {
-
-	case '-':
-	case '_':
-	case '.':
-	case '!':
-	case '~':
-	case '*':
-	case '\'':
-	case '(':
-	case ')':
-		return true;
-	default:
-		return false;
-	}
-}
-
+/*
+ * The characters that a component may contain unescaped are looked up
+ * in one table, with a bit for each component. Runs of such characters
+ * are passed to the print function at once.
+ */
 
-static bool is_unreserved(char c)
-{
-	return isalnum(c) || is_mark(c);
-}
 
+enum {
+	C_UNRESERVED = 1<<0,  /**< alphanum / mark                      */
+	C_USER       = 1<<1,  /**< unreserved / user-unreserved          */
+	C_PASSWORD   = 1<<2,  /**< unreserved / & = + $ ,                */
+	C_PARAM      = 1<<3,  /**< unreserved / param-unreserved         */
+	C_HVALUE     = 1<<4,  /**< unreserved / hnv-unreserved           */
+};
+
+
+/** Character classes of the URI components (RFC 3261 25.1) */
+static const uint8_t uric_tab[256] = {
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x1f, 0x00, 0x00, 0x1e, 0x00, 0x0e, 0x1f,  /* 20   !"#$%&' */
+	0x1f, 0x1f, 0x1f, 0x1e, 0x06, 0x1f, 0x1f, 0x1a,  /* 28  ()*+,-./ */
+	0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f,  /* 30  01234567 */
+	0x1f, 0x1f, 0x18, 0x02, 0x00, 0x06, 0x00, 0x12,  /* 38  89:;<=>? */
+	0x00, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f,  /* 40  @ABCDEFG */
+	0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f,  /* 48  HIJKLMNO */
+	0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f,  /* 50  PQRSTUVW */
+	0x1f, 0x1f, 0x1f, 0x18, 0x00, 0x18, 0x00, 0x1f,  /* 58  XYZ[\]^_ */
+	0x00, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f,  /* 60  `abcdefg */
+	0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f,  /* 68  hijklmno */
+	0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f,  /* 70  pqrstuvw */
+	0x1f, 0x1f, 0x1f, 0x00, 0x00, 0x00, 0x1f, 0x00,  /* 78  xyz{|}~. */
+};
+
+
+static int comp_escape(struct re_printf *pf, const struct pl *pl,
+		       uint8_t mask)
+{
+	static const char hex[] = "0123456789ABCDEF";
+	size_t i = 0, j;
+	int err = 0;
 
-static bool is_user_unreserved(int c)
-{
-	switch (c) {
-
-	case '&':
-	case '=':
-	case '+':
-	case '$':
-	case ',':
-	case ';':
-	case '?':
-	case '/':
-		return true;
-	default:
-		return false;
-	}
-}
+	if (!pf || !pl)
+		return EINVAL;
 
-static bool is_hnv_unreserved(char c)
-{
-	switch (c) {
-
-	case '[':
-	case ']':
-	case '/':
-	case '?':
-	case ':':
-	case '+':
-	case '$':
-		return true;
-	default:
-		return false;
-	}
-}
+	while (i < pl->l && !err) {
 
+		for (j=i; j<pl->l; j++) {
+			if (!(uric_tab[(uint8_t)pl->p[j]] & mask))
+				break;
+		}
 
-static bool is_user(char c)
-{
-	return is_unreserved(c) || is_user_unreserved(c);
-}
+		if (j > i)
+			err = pf->vph(pl->p + i, j - i, pf->arg);
 
+		if (j < pl->l && !err) {
+			const uint8_t c = pl->p[j++];
+			char esc[3];
 
-static bool is_password(char c)
-{
-	switch (c) {
-
-	case '&':
-	case '=':
-	case '+':
-	case '$':
-	case ',':
-		return true;
-	default:
-		return is_unreserved(c);
-	}
-}
+			esc[0] = '%';
+			esc[1] = hex[c >> 4];
+			esc[2] = hex[c & 0xf];
 
+			err = pf->vph(esc, sizeof(esc), pf->arg);
+		}
 
-static bool is_param_unreserved(char c)
-{
-	switch (c) {
-
-	case '[':
-	case ']':
-	case '/':
-	case ':':
-	case '&':
-	case '+':
-	case '$':
-		return true;
-	default:
-		return false;
+		i = j;
 	}
-}
 
-
-static bool is_paramchar(char c)
-{
-	return is_param_unreserved(c) || is_unreserved(c);
-}
-
-
-static bool is_hvalue(char c)
-{
-	return is_hnv_unreserved(c) || is_unreserved(c);
+	return err;
 }
 
 
-static int comp_escape(struct re_printf *pf, const struct pl *pl, esc_h *eh)
+static int comp_unescape(struct re_printf *pf, const struct pl *pl,
+			 uint8_t mask)
 {
-	size_t i;
+	size_t i = 0, j;
 	int err = 0;
 
-	if (!pf || !pl || !eh)
+	if (!pf || !pl)
 		return EINVAL;
 
-	for (i=0; i<pl->l && !err; i++) {
-		const char c = pl->p[i];
+	while (i < pl->l && !err) {
+		char c;
 
-		if (eh(c)) {
-			err = pf->vph(&c, 1, pf->arg);
-		}
-		else {
-			err = re_hprintf(pf, "%%%02X", c);
+		for (j=i; j<pl->l; j++) {
+			if (!(uric_tab[(uint8_t)pl->p[j]] & mask))
+				break;
 		}
-	}
 
-	return err;
-}
+		if (j > i)
+			err = pf->vph(pl->p + i, j - i, pf->arg);
 
+		if (j == pl->l || err)
+			break;
 
-static int comp_unescape(struct re_printf *pf, const struct pl *pl, esc_h *eh)
-{
-	size_t i;
-	int err = 0;
-
-	if (!pf || !pl || !eh)
-		return EINVAL;
-
-	for (i=0; i<pl->l && !err; i++) {
-		const char c = pl->p[i];
-
-		if (eh(c)) {
-			err = pf->vph(&c, 1, pf->arg);
-			continue;
-		}
+		i = j;
+		c = pl->p[i];
 
 		if ('%' == c) {
 			if (i+2 < pl->l) {
@@ -177,6 +120,7 @@ static int comp_unescape(struct re_printf *pf, const struct pl *pl, esc_h *eh)
 				const uint8_t lo = ch_hex(pl->p[++i]);
 				const char b = hi<<4 | lo;
 				err = pf->vph(&b, 1, pf->arg);
+				++i;
 			}
 			else {
 				DEBUG_WARNING("unescape: short uri (%u)\n", i);
@@ -204,7 +148,7 @@ static int comp_unescape(struct re_printf *pf, const struct pl *pl, esc_h *eh)
  */
 int uri_user_escape(struct re_printf *pf, const struct pl *pl)
 {
-	return comp_escape(pf, pl, is_user);
+	return comp_escape(pf, pl, C_USER);
 }
 
 
@@ -218,7 +162,7 @@ int uri_user_escape(struct re_printf *pf, const struct pl *pl)
  */
 int uri_user_unescape(struct re_printf *pf, const struct pl *pl)
 {
-	return comp_unescape(pf, pl, is_user);
+	return comp_unescape(pf, pl, C_USER);
 }
 
 
@@ -232,7 +176,7 @@ int uri_user_unescape(struct re_printf *pf, const struct pl *pl)
  */
 int uri_password_escape(struct re_printf *pf, const struct pl *pl)
 {
-	return comp_escape(pf, pl, is_password);
+	return comp_escape(pf, pl, C_PASSWORD);
 }
 
 
@@ -246,7 +190,7 @@ int uri_password_escape(struct re_printf *pf, const struct pl *pl)
  */
 int uri_password_unescape(struct re_printf *pf, const struct pl *pl)
 {
-	return comp_unescape(pf, pl, is_password);
+	return comp_unescape(pf, pl, C_PASSWORD);
 }
 
 
@@ -260,7 +204,7 @@ int uri_password_unescape(struct re_printf *pf, const struct pl *pl)
  */
 int uri_param_escape(struct re_printf *pf, const struct pl *pl)
 {
-	return comp_escape(pf, pl, is_paramchar);
+	return comp_escape(pf, pl, C_PARAM);
 }
 
 
@@ -274,7 +218,7 @@ int uri_param_escape(struct re_printf *pf, const struct pl *pl)
  */
 int uri_param_unescape(struct re_printf *pf, const struct pl *pl)
 {
-	return comp_unescape(pf, pl, is_paramchar);
+	return comp_unescape(pf, pl, C_PARAM);
 }
 
 
@@ -288,7 +232,7 @@ int uri_param_unescape(struct re_printf *pf, const struct pl *pl)
  */
 int uri_header_escape(struct re_printf *pf, const struct pl *pl)
 {
-	return comp_escape(pf, pl, is_hvalue);
+	return comp_escape(pf, pl, C_HVALUE);
 }
 
 
@@ -302,5 +246,5 @@ int uri_header_escape(struct re_printf *pf, const struct pl *pl)
  */
 int uri_header_unescape(struct re_printf *pf, const struct pl *pl)
 {
-	return comp_unescape(pf, pl, is_hvalue);
+	return comp_unescape(pf, pl, C_HVALUE);
 }
@@ -0,0 +1,599 @@
+/**
+ * @file deflate.c  WebSocket permessage-deflate (RFC 7692)
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <zlib.h>
+#include <re_types.h>
+#include <re_fmt.h>
+#include <re_mem.h>
+#include <re_mbuf.h>
+#include <re_list.h>
+#include <re_sa.h>
+#include <re_msg.h>
+#include <re_http.h>
+#include <re_websock.h>
+#include "websock.h"
+
+
+/*
+ * Each message is compressed with a raw deflate stream that is flushed at
+ * the end of the message, without the 0x00 0x00 0xff 0xff tail of the
+ * flush. The streams keep their history from message to message, unless
+ * a side asked for no context takeover.
+ *
+ * The LZ77 windows are made smaller to fit the memory limit. zlib cannot
+ * compress with a window of 8 bits, so offers that ask for it are
+ * declined.
+ */
+
+
+enum {
+	BITS_MAX = 15,
+	BITS_MIN = 9,
+	MSG_MAX  = 1048576,
+};
+
+/** Extension parameters, the window bits are -1 if absent, 0 if empty */
+struct pmd_param {
+	bool srv_nct;
+	bool cli_nct;
+	int srv_bits;
+	int cli_bits;
+};
+
+/** permessage-deflate state of a connection */
+struct ws_deflate {
+	z_stream tx;            /**< Compressor                        */
+	z_stream rx;            /**< Decompressor                      */
+	struct pmd_param prm;   /**< Parameters of the server response */
+	size_t msg_max;         /**< Inflated message size limit       */
+	size_t rx_len;          /**< Inflated length of this message   */
+	bool tx_nct;            /**< Reset the compressor per message  */
+	bool tx_init;
+	bool rx_init;
+};
+
+
+static const uint8_t flush_tail[4] = {0x00, 0x00, 0xff, 0xff};
+
+
+static void destructor(void *arg)
+{
+	struct ws_deflate *wd = arg;
+
+	if (wd->tx_init)
+		(void)deflateEnd(&wd->tx);
+
+	if (wd->rx_init)
+		(void)inflateEnd(&wd->rx);
+}
+
+
+/* zlib memory of a compressor and a decompressor with the window */
+static size_t mem_size(int bits)
+{
+	return ((size_t)1 << (bits + 2)) * 2 + ((size_t)1 << bits) + 7168;
+}
+
+
+/* The largest window that fits the memory limit, 0 if none does */
+static int conf_bits(const struct websock_deflate_conf *conf)
+{
+	int bits;
+
+	if (!conf->mem_max)
+		return BITS_MAX;
+
+	for (bits = BITS_MAX; bits >= BITS_MIN; bits--) {
+
+		if (mem_size(bits) <= conf->mem_max)
+			return bits;
+	}
+
+	return 0;
+}
+
+
+static void tok_trim(struct pl *pl)
+{
+	while (pl->l && (pl->p[0] == ' ' || pl->p[0] == '\t'))
+		pl_advance(pl, 1);
+
+	while (pl->l && (pl->p[pl->l-1] == ' ' || pl->p[pl->l-1] == '\t'))
+		--pl->l;
+}
+
+
+static int bits_decode(int *bitsp, const struct pl *val)
+{
+	struct pl v = *val;
+	uint32_t n;
+
+	if (*bitsp >= 0)
+		return EPROTO;
+
+	if (!v.p) {
+		*bitsp = 0;
+		return 0;
+	}
+
+	if (v.l >= 2 && v.p[0] == '"' && v.p[v.l-1] == '"') {
+		v.p += 1;
+		v.l -= 2;
+	}
+
+	if (v.l < 1 || v.l > 2 || re_regex(v.p, v.l, "[0-9]+", NULL))
+		return EPROTO;
+
+	n = pl_u32(&v);
+	if (n < 8 || n > BITS_MAX)
+		return EPROTO;
+
+	*bitsp = (int)n;
+
+	return 0;
+}
+
+
+/* Decode one extension, ENOENT if it is not permessage-deflate */
+static int param_decode(struct pmd_param *prm, const struct pl *ext)
+{
+	struct pl pl = *ext;
+	bool first = true;
+
+	prm->srv_nct  = false;
+	prm->cli_nct  = false;
+	prm->srv_bits = -1;
+	prm->cli_bits = -1;
+
+	while (pl.l) {
+
+		const char *sc = pl_strchr(&pl, ';');
+		struct pl tok, name, val = PL_INIT;
+		const char *eq;
+		int err = 0;
+
+		tok.p = pl.p;
+		tok.l = sc ? (size_t)(sc - pl.p) : pl.l;
+		pl_advance(&pl, sc ? tok.l + 1 : tok.l);
+
+		name = tok;
+		eq = pl_strchr(&tok, '=');
+		if (eq) {
+			name.l = eq - tok.p;
+			val.p  = eq + 1;
+			val.l  = tok.l - name.l - 1;
+			tok_trim(&val);
+		}
+
+		tok_trim(&name);
+
+		if (first) {
+			if (eq || pl_strcasecmp(&name, "permessage-deflate"))
+				return ENOENT;
+
+			first = false;
+			continue;
+		}
+
+		if (!pl_strcasecmp(&name, "server_no_context_takeover")) {
+			err = (eq || prm->srv_nct) ? EPROTO : 0;
+			prm->srv_nct = true;
+		}
+		else if (!pl_strcasecmp(&name, "client_no_context_takeover")) {
+			err = (eq || prm->cli_nct) ? EPROTO : 0;
+			prm->cli_nct = true;
+		}
+		else if (!pl_strcasecmp(&name, "server_max_window_bits")) {
+			err = eq ? bits_decode(&prm->srv_bits, &val) : EPROTO;
+		}
+		else if (!pl_strcasecmp(&name, "client_max_window_bits")) {
+			err = bits_decode(&prm->cli_bits, &val);
+		}
+		else {
+			err = EPROTO;
+		}
+
+		if (err)
+			return err;
+	}
+
+	return first ? ENOENT : 0;
+}
+
+
+static int wd_alloc(struct ws_deflate **wdp,
+		    const struct websock_deflate_conf *conf,
+		    int tx_bits, int rx_bits, bool tx_nct)
+{
+	struct ws_deflate *wd;
+	int err = 0;
+
+	wd = mem_zalloc(sizeof(*wd), destructor);
+	if (!wd)
+		return ENOMEM;
+
+	if (Z_OK != deflateInit2(&wd->tx, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+				 -tx_bits, tx_bits - 7, Z_DEFAULT_STRATEGY)) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	wd->tx_init = true;
+
+	/* a larger window can always be used to inflate */
+	if (Z_OK != inflateInit2(&wd->rx, -max(rx_bits, BITS_MIN))) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	wd->rx_init = true;
+
+	wd->prm.srv_bits = -1;
+	wd->prm.cli_bits = -1;
+	wd->msg_max = conf->msg_max ? conf->msg_max : MSG_MAX;
+	wd->tx_nct  = tx_nct;
+
+ out:
+	if (err)
+		mem_deref(wd);
+	else
+		*wdp = wd;
+
+	return err;
+}
+
+
+/**
+ * Print the permessage-deflate offer of a client
+ *
+ * @param pf   Print function
+ * @param conf Configuration
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int ws_deflate_offer(struct re_printf *pf,
+		     const struct websock_deflate_conf *conf)
+{
+	const int bits = conf_bits(conf);
+	int err;
+
+	if (!bits)
+		return 0;
+
+	err = re_hprintf(pf, "Sec-WebSocket-Extensions: permessage-deflate"
+			 "; client_max_window_bits");
+
+	if (bits < BITS_MAX)
+		err |= re_hprintf(pf, "=%d; server_max_window_bits=%d",
+				  bits, bits);
+
+	if (conf->no_context_takeover)
+		err |= re_hprintf(pf, "; client_no_context_takeover");
+
+	if (conf->peer_no_context_takeover)
+		err |= re_hprintf(pf, "; server_no_context_takeover");
+
+	err |= re_hprintf(pf, "\r\n");
+
+	return err;
+}
+
+
+/**
+ * Check the extension response of a server to the offer of a client
+ *
+ * @param wdp  Pointer to allocated state, NULL if not accepted
+ * @param conf Configuration of the offer
+ * @param msg  HTTP response
+ *
+ * @return 0 if success, EPROTO if the connection must fail
+ */
+int ws_deflate_confirm(struct ws_deflate **wdp,
+		       const struct websock_deflate_conf *conf,
+		       const struct http_msg *msg)
+{
+	const int bits = conf_bits(conf);
+	struct pmd_param prm;
+	bool found = false;
+	struct le *le;
+	int tx_bits, rx_bits;
+
+	for (le = list_head(&msg->hdrl); le; le = le->next) {
+
+		const struct http_hdr *hdr = le->data;
+		int err;
+
+		if (hdr->id != HTTP_HDR_SEC_WEBSOCKET_EXTENSIONS)
+			continue;
+
+		/* only an offered extension may be in the response */
+		err = param_decode(&prm, &hdr->val);
+		if (err || found)
+			return EPROTO;
+
+		found = true;
+	}
+
+	if (!found)
+		return 0;
+
+	if (!bits || !prm.srv_bits || !prm.cli_bits)
+		return EPROTO;
+
+	if (prm.srv_bits > bits || (bits < BITS_MAX && prm.srv_bits < 0))
+		return EPROTO;
+
+	tx_bits = prm.cli_bits > 0 ? min(bits, prm.cli_bits) : bits;
+	if (tx_bits < BITS_MIN)
+		return EPROTO;
+
+	rx_bits = prm.srv_bits > 0 ? prm.srv_bits : BITS_MAX;
+
+	return wd_alloc(wdp, conf, tx_bits, rx_bits,
+			prm.cli_nct || conf->no_context_takeover);
+}
+
+
+/**
+ * Accept the first permessage-deflate offer of a client that fits the
+ * configuration
+ *
+ * @param wdp  Pointer to allocated state, NULL if none was accepted
+ * @param conf Configuration
+ * @param msg  HTTP request
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int ws_deflate_accept(struct ws_deflate **wdp,
+		      const struct websock_deflate_conf *conf,
+		      const struct http_msg *msg)
+{
+	const int bits = conf_bits(conf);
+	struct le *le;
+
+	if (!bits)
+		return 0;
+
+	for (le = list_head(&msg->hdrl); le; le = le->next) {
+
+		const struct http_hdr *hdr = le->data;
+		struct pmd_param prm, resp;
+		int tx_bits, rx_bits, err;
+
+		if (hdr->id != HTTP_HDR_SEC_WEBSOCKET_EXTENSIONS)
+			continue;
+
+		if (param_decode(&prm, &hdr->val))
+			continue;
+
+		/* the window of the compressor of the server */
+		if (!prm.srv_bits)
+			continue;
+		else if (prm.srv_bits > 0 && prm.srv_bits < BITS_MIN)
+			continue;
+
+		tx_bits = prm.srv_bits > 0 ? min(bits, prm.srv_bits) : bits;
+
+		/* the window of the client is only limited if offered */
+		if (prm.cli_bits > 0)
+			rx_bits = min(bits, prm.cli_bits);
+		else if (prm.cli_bits == 0)
+			rx_bits = bits;
+		else if (bits < BITS_MAX)
+			continue;
+		else
+			rx_bits = BITS_MAX;
+
+		resp.srv_nct  = prm.srv_nct || conf->no_context_takeover;
+		resp.cli_nct  = prm.cli_nct || conf->peer_no_context_takeover;
+		resp.srv_bits = prm.srv_bits > 0 ? tx_bits : -1;
+		resp.cli_bits = prm.cli_bits >= 0 && rx_bits < BITS_MAX ?
+			rx_bits : -1;
+
+		err = wd_alloc(wdp, conf, tx_bits, rx_bits, resp.srv_nct);
+		if (err)
+			return err;
+
+		(*wdp)->prm = resp;
+
+		return 0;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Print the permessage-deflate response of a server
+ *
+ * @param pf Print function
+ * @param wd Accepted state, or NULL
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int ws_deflate_print(struct re_printf *pf, const struct ws_deflate *wd)
+{
+	const struct pmd_param *prm;
+	int err;
+
+	if (!wd)
+		return 0;
+
+	prm = &wd->prm;
+
+	err = re_hprintf(pf, "Sec-WebSocket-Extensions: permessage-deflate");
+
+	if (prm->srv_nct)
+		err |= re_hprintf(pf, "; server_no_context_takeover");
+
+	if (prm->cli_nct)
+		err |= re_hprintf(pf, "; client_no_context_takeover");
+
+	if (prm->srv_bits > 0)
+		err |= re_hprintf(pf, "; server_max_window_bits=%d",
+				  prm->srv_bits);
+
+	if (prm->cli_bits > 0)
+		err |= re_hprintf(pf, "; client_max_window_bits=%d",
+				  prm->cli_bits);
+
+	err |= re_hprintf(pf, "\r\n");
+
+	return err;
+}
+
+
+/**
+ * Compress a frame of a message
+ *
+ * @param wd  permessage-deflate state
+ * @param mb  Buffer to write the compressed frame to, at mb->pos
+ * @param buf Frame payload
+ * @param len Length of frame payload
+ * @param fin True for the last frame of the message
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int ws_deflate_encode(struct ws_deflate *wd, struct mbuf *mb,
+		      const uint8_t *buf, size_t len, bool fin)
+{
+	z_stream *z = &wd->tx;
+	int err = 0;
+
+	z->next_in  = (Bytef *)buf;
+	z->avail_in = (uInt)len;
+
+	do {
+		int ret;
+
+		if (mb->size - mb->pos < 64) {
+			err = mbuf_resize(mb, mb->size * 2 + 64);
+			if (err)
+				break;
+		}
+
+		z->next_out  = mb->buf + mb->pos;
+		z->avail_out = (uInt)(mb->size - mb->pos);
+
+		ret = deflate(z, Z_SYNC_FLUSH);
+		if (ret != Z_OK && ret != Z_BUF_ERROR) {
+			err = EPROTO;
+			break;
+		}
+
+		mb->pos = mb->size - z->avail_out;
+
+	} while (!z->avail_out);
+
+	z->next_in  = NULL;
+	z->avail_in = 0;
+
+	if (err)
+		return err;
+
+	mb->end = mb->pos;
+
+	/* the empty block of a flush is kept until the last frame */
+	if (!fin)
+		return 0;
+
+	/* the flush always ends with the tail */
+	mb->pos -= sizeof(flush_tail);
+	mb->end  = mb->pos;
+
+	if (wd->tx_nct)
+		(void)deflateReset(z);
+
+	return 0;
+}
+
+
+static int inflate_buf(struct ws_deflate *wd, struct mbuf *mb,
+		       const uint8_t *buf, size_t len, size_t max)
+{
+	z_stream *z = &wd->rx;
+
+	z->next_in  = (Bytef *)buf;
+	z->avail_in = (uInt)len;
+
+	for (;;) {
+
+		int ret;
+
+		if (mb->end == mb->size) {
+
+			int err;
+
+			if (mb->size >= max)
+				return EOVERFLOW;
+
+			err = mbuf_resize(mb, min(mb->size * 2, max));
+			if (err)
+				return err;
+		}
+
+		z->next_out  = mb->buf + mb->end;
+		z->avail_out = (uInt)(mb->size - mb->end);
+
+		ret = inflate(z, Z_SYNC_FLUSH);
+
+		mb->end = mb->size - z->avail_out;
+
+		if (ret == Z_STREAM_END)
+			(void)inflateReset(z);
+		else if (ret == Z_BUF_ERROR)
+			break;
+		else if (ret != Z_OK)
+			return EPROTO;
+
+		if (!z->avail_in && z->avail_out)
+			break;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Decompress a frame of a compressed message
+ *
+ * @param wd  permessage-deflate state
+ * @param mbp Pointer to allocated buffer with the inflated frame
+ * @param mb  Frame payload
+ * @param fin True for the last frame of the message
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int ws_deflate_decode(struct ws_deflate *wd, struct mbuf **mbp,
+		      struct mbuf *mb, bool fin)
+{
+	const size_t max = wd->msg_max - wd->rx_len;
+	const size_t len = mbuf_get_left(mb);
+	struct mbuf *out;
+	int err;
+
+	out = mbuf_alloc(max(min(len * 4 + 256, max), (size_t)1));
+	if (!out)
+		return ENOMEM;
+
+	err = inflate_buf(wd, out, mbuf_buf(mb), len, max);
+	if (!err && fin)
+		err = inflate_buf(wd, out, flush_tail, sizeof(flush_tail),
+				  max);
+
+	wd->rx.next_in  = NULL;
+	wd->rx.avail_in = 0;
+
+	if (err) {
+		mem_deref(out);
+		return err;
+	}
+
+	wd->rx_len = fin ? 0 : wd->rx_len + out->end;
+
+	*mbp = out;
+
+	return 0;
+}
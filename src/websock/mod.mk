@@ -5,3 +5,7 @@
 #
 
 SRCS	+= websock/websock.c
+
+ifneq ($(USE_ZLIB),)
+SRCS	+= websock/deflate.c
+endif
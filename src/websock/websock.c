@@ -4,6 +4,12 @@
  * Copyright (C) 2010 Creytiv.com
  */
 
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 #include <re_types.h>
 #include <re_fmt.h>
 #include <re_mem.h>
@@ -20,6 +26,7 @@
 #include <re_sha.h>
 #include <re_sys.h>
 #include <re_websock.h>
+#include "websock.h"
 
 
 enum {
@@ -36,9 +43,11 @@ enum websock_state {
 };
 
 struct websock {
+	struct websock_deflate_conf dconf;
 	websock_shutdown_h *shuth;
 	void *arg;
 	bool shutdown;
+	bool deflate;
 };
 
 struct websock_conn {
@@ -50,6 +59,11 @@ struct websock_conn {
 	struct tls_conn *sc;
 	struct mbuf *mb;
 	struct http_req *req;
+	struct ws_deflate *wd;
+	struct websock_hdr rx_hdr;
+	uint64_t rx_off;
+	uint8_t rx_utf8[4];         /**< Incomplete UTF-8 sequence    */
+	size_t rx_utf8n;
 	websock_estab_h *estabh;
 	websock_recv_h *recvh;
 	websock_close_h *closeh;
@@ -57,6 +71,11 @@ struct websock_conn {
 	enum websock_state state;
 	unsigned kaint;
 	bool active;
+	bool rx_deflate;
+	bool rx_partial;
+	bool rx_part;
+	bool rx_text;
+	bool tx_frag;
 };
 
 
@@ -123,6 +142,7 @@ static void conn_destructor(void *arg)
 	mem_deref(conn->tc);
 	mem_deref(conn->mb);
 	mem_deref(conn->req);
+	mem_deref(conn->wd);
 	mem_deref(conn->sock);
 }
 
@@ -163,15 +183,69 @@ static enum websock_scode websock_err2scode(int err)
 	case EOVERFLOW: return WEBSOCK_MESSAGE_TOO_BIG;
 	case EPROTO:    return WEBSOCK_PROTOCOL_ERROR;
 	case EBADMSG:   return WEBSOCK_PROTOCOL_ERROR;
+	case EILSEQ:    return WEBSOCK_INVALID_PAYLOAD;
 	default:        return WEBSOCK_INTERNAL_ERROR;
 	}
 }
 
 
-static int websock_decode(struct websock_hdr *hdr, struct mbuf *mb)
+/*
+ * XOR the payload with the masking key (RFC 6455 section 5.3). The key is
+ * repeated over a vector or a word, so it lines up with every fourth byte.
+ */
+static void mask_apply(uint8_t *p, size_t len, const uint8_t mkey[4])
 {
-	uint8_t v, *p;
-	size_t i;
+	uint32_t k32;
+	uint64_t k64;
+	size_t i = 0;
+
+	memcpy(&k32, mkey, sizeof(k32));
+	k64 = (uint64_t)k32 << 32 | k32;
+
+#if defined(__SSE2__)
+	{
+		const __m128i k = _mm_set1_epi32((int)k32);
+
+		for (; i + 16 <= len; i += 16) {
+
+			__m128i x = _mm_loadu_si128((const __m128i *)(p + i));
+
+			x = _mm_xor_si128(x, k);
+			_mm_storeu_si128((__m128i *)(p + i), x);
+		}
+	}
+#elif defined(__ARM_NEON)
+	{
+		const uint8x16_t k = vreinterpretq_u8_u32(vdupq_n_u32(k32));
+
+		for (; i + 16 <= len; i += 16)
+			vst1q_u8(p + i, veorq_u8(vld1q_u8(p + i), k));
+	}
+#endif
+
+	for (; i + 8 <= len; i += 8) {
+
+		uint64_t w;
+
+		memcpy(&w, p + i, sizeof(w));
+		w ^= k64;
+		memcpy(p + i, &w, sizeof(w));
+	}
+
+	for (; i < len; i++)
+		p[i] ^= mkey[i & 3];
+}
+
+
+/*
+ * Decode a frame header. The payload of a data frame may be incomplete
+ * when partial is set, and is then left masked.
+ */
+static int websock_decode(struct websock_hdr *hdr, struct mbuf *mb,
+			  bool partial)
+{
+	uint64_t need;
+	uint8_t v;
 
 	if (mbuf_get_left(mb) < 2)
 		return ENODATA;
@@ -202,9 +276,12 @@ static int websock_decode(struct websock_hdr *hdr, struct mbuf *mb)
 		hdr->len = sys_ntohll(mbuf_read_u64(mb));
 	}
 
+	partial = partial && hdr->opcode <= WEBSOCK_BIN;
+	need    = partial ? 0 : hdr->len;
+
 	if (hdr->mask) {
 
-		if (mbuf_get_left(mb) < (4 + hdr->len))
+		if (mbuf_get_left(mb) < (4 + need))
 			return ENODATA;
 
 		hdr->mkey[0] = mbuf_read_u8(mb);
@@ -212,11 +289,11 @@ static int websock_decode(struct websock_hdr *hdr, struct mbuf *mb)
 		hdr->mkey[2] = mbuf_read_u8(mb);
 		hdr->mkey[3] = mbuf_read_u8(mb);
 
-		for (i=0, p=mbuf_buf(mb); i<hdr->len; i++)
-			p[i] = p[i] ^ hdr->mkey[i%4];
+		if (!partial)
+			mask_apply(mbuf_buf(mb), (size_t)hdr->len, hdr->mkey);
 	}
 	else {
-		if (mbuf_get_left(mb) < hdr->len)
+		if (mbuf_get_left(mb) < need)
 			return ENODATA;
 	}
 
@@ -224,6 +301,194 @@ static int websock_decode(struct websock_hdr *hdr, struct mbuf *mb)
 }
 
 
+/* Replace a frame of a compressed message with the inflated frame */
+static int frame_inflate(struct websock_conn *conn, struct websock_hdr *hdr,
+			 struct mbuf **mbp)
+{
+#ifdef USE_ZLIB
+	struct mbuf *mb;
+	int err;
+
+	err = ws_deflate_decode(conn->wd, &mb, *mbp, hdr->fin);
+	if (err)
+		return err;
+
+	mem_deref(*mbp);
+	*mbp = mb;
+
+	hdr->rsv1 = 0;
+	hdr->len  = mbuf_get_left(mb);
+
+	return 0;
+#else
+	(void)conn;
+	(void)hdr;
+	(void)mbp;
+
+	return EPROTO;
+#endif
+}
+
+
+/* Detach the first len bytes of the receive buffer */
+static int frame_split(struct websock_conn *conn, size_t len,
+		       struct mbuf **mbp)
+{
+	struct mbuf *mb = conn->mb;
+	size_t end;
+
+	end     = mb->end;
+	mb->end = mb->pos + len;
+
+	if (end > mb->end) {
+		struct mbuf *mbn = mbuf_alloc(end - mb->end);
+		if (!mbn)
+			return ENOMEM;
+
+		(void)mbuf_write_mem(mbn, mb->buf + mb->end, end - mb->end);
+		mbn->pos = 0;
+
+		conn->mb = mbn;
+	}
+	else {
+		conn->mb = NULL;
+	}
+
+	*mbp = mb;
+
+	return 0;
+}
+
+
+/*
+ * The payload of a text message must be UTF-8 (RFC 6455 section 8.1).
+ * A sequence that continues in the next fragment or part is kept.
+ */
+static int text_check(struct websock_conn *conn,
+		      const struct websock_hdr *hdr, const struct mbuf *mb)
+{
+	const char *p = (const char *)mbuf_buf(mb);
+	size_t len = mbuf_get_left(mb), tail;
+
+	/* the parts of the first frame have its opcode */
+	if (hdr->opcode != WEBSOCK_CONT)
+		conn->rx_text = hdr->opcode == WEBSOCK_TEXT;
+
+	if (!conn->rx_text)
+		return 0;
+
+	/* complete the sequence from the last fragment */
+	while (conn->rx_utf8n && len) {
+
+		conn->rx_utf8[conn->rx_utf8n++] = *p++;
+		--len;
+
+		if (utf8_tail((char *)conn->rx_utf8, conn->rx_utf8n))
+			continue;
+
+		if (!utf8_validate((char *)conn->rx_utf8, conn->rx_utf8n))
+			return EILSEQ;
+
+		conn->rx_utf8n = 0;
+	}
+
+	tail = utf8_tail(p, len);
+
+	if (!utf8_validate(p, len - tail))
+		return EILSEQ;
+
+	memcpy(conn->rx_utf8 + conn->rx_utf8n, p + len - tail, tail);
+	conn->rx_utf8n += tail;
+
+	if (hdr->fin && conn->rx_utf8n)
+		return EILSEQ;
+
+	return 0;
+}
+
+
+static void data_recv(struct websock_conn *conn,
+		      const struct websock_hdr *hdr, struct mbuf *mb)
+{
+	mem_ref(conn);
+	conn->recvh(hdr, mb, conn->arg);
+
+	if (mem_nrefs(conn) == 1) {
+
+		if (conn->state == OPEN)
+			(void)websock_close(conn, WEBSOCK_GOING_AWAY,
+					    "Going Away");
+
+		/*
+		 * This is a hack. We enforce CLOSING state so we know
+		 * the connection will continue to live.
+		 */
+		conn->state = CLOSING;
+	}
+	mem_deref(conn);
+}
+
+
+/* Give the received part of a data frame payload to the handler */
+static int part_recv(struct websock_conn *conn)
+{
+	struct websock_hdr hdr = conn->rx_hdr;
+	const uint64_t rem = hdr.len - conn->rx_off;
+	size_t n = mbuf_get_left(conn->mb);
+	struct mbuf *mb;
+	int err;
+
+	if (rem && !n) {
+		conn->mb = mem_deref(conn->mb);
+		return 0;
+	}
+
+	if (n > rem)
+		n = (size_t)rem;
+
+	err = frame_split(conn, n, &mb);
+	if (err)
+		return err;
+
+	if (hdr.mask) {
+		uint8_t mkey[4];
+		size_t i;
+
+		/* the key continues at the offset of the part */
+		for (i=0; i<sizeof(mkey); i++)
+			mkey[i] = hdr.mkey[(conn->rx_off + i) & 3];
+
+		mask_apply(mbuf_buf(mb), n, mkey);
+	}
+
+	conn->rx_off += n;
+	conn->rx_part = conn->rx_off < hdr.len;
+
+	/* the end of the message is set on its last part only */
+	hdr.fin = hdr.fin && !conn->rx_part;
+	hdr.len = n;
+
+	if (conn->rx_deflate) {
+		err = frame_inflate(conn, &hdr, &mb);
+		if (err) {
+			mem_deref(mb);
+			return err;
+		}
+	}
+
+	err = text_check(conn, &hdr, mb);
+	if (err) {
+		mem_deref(mb);
+		return err;
+	}
+
+	data_recv(conn, &hdr, mb);
+	mem_deref(mb);
+
+	return 0;
+}
+
+
 static void recv_handler(struct mbuf *mb, void *arg)
 {
 	struct websock_conn *conn = arg;
@@ -253,11 +518,19 @@ static void recv_handler(struct mbuf *mb, void *arg)
 	while (conn->mb) {
 
 		struct websock_hdr hdr;
-		size_t pos, end;
+		size_t pos;
+
+		if (conn->rx_part) {
+			err = part_recv(conn);
+			if (err)
+				goto out;
+
+			continue;
+		}
 
 		pos = conn->mb->pos;
 
-		err = websock_decode(&hdr, conn->mb);
+		err = websock_decode(&hdr, conn->mb, conn->rx_partial);
 		if (err) {
 			if (err == ENODATA) {
 				conn->mb->pos = pos;
@@ -273,56 +546,54 @@ static void recv_handler(struct mbuf *mb, void *arg)
 			goto out;
 		}
 
-		if (hdr.rsv1 || hdr.rsv2 || hdr.rsv3) {
+		if (hdr.rsv2 || hdr.rsv3) {
 			err = EPROTO;
 			goto out;
 		}
 
-		mb = conn->mb;
-
-		end     = mb->end;
-		mb->end = mb->pos + (size_t)hdr.len;
+		/* set on the first frame of a compressed message */
+		if (hdr.rsv1 && (!conn->wd || hdr.opcode == WEBSOCK_CONT ||
+				 hdr.opcode >= WEBSOCK_CLOSE)) {
+			err = EPROTO;
+			goto out;
+		}
 
-		if (end > mb->end) {
-			struct mbuf *mbn = mbuf_alloc(end - mb->end);
-			if (!mbn) {
-				err = ENOMEM;
-				goto out;
-			}
+		if (conn->rx_partial && hdr.opcode <= WEBSOCK_BIN) {
 
-			(void)mbuf_write_mem(mbn, mb->buf + mb->end,
-					     end - mb->end);
-			mbn->pos = 0;
+			if (hdr.opcode != WEBSOCK_CONT)
+				conn->rx_deflate = hdr.rsv1;
 
-			conn->mb = mbn;
-		}
-		else {
-			conn->mb = NULL;
+			conn->rx_hdr  = hdr;
+			conn->rx_off  = 0;
+			conn->rx_part = true;
+			continue;
 		}
 
+		err = frame_split(conn, (size_t)hdr.len, &mb);
+		if (err)
+			goto out;
+
 		switch (hdr.opcode) {
 
 		case WEBSOCK_CONT:
 		case WEBSOCK_TEXT:
 		case WEBSOCK_BIN:
-			mem_ref(conn);
-			conn->recvh(&hdr, mb, conn->arg);
-
-			if (mem_nrefs(conn) == 1) {
-
-				if (conn->state == OPEN)
-					(void)websock_close(conn,
-						            WEBSOCK_GOING_AWAY,
-							    "Going Away");
-
-				/*
-				 * This is a hack. We enforce CLOSING
-				 * state so we know the connection will
-				 * continue to live.
-				 */
-				conn->state = CLOSING;
+			if (hdr.opcode != WEBSOCK_CONT)
+				conn->rx_deflate = hdr.rsv1;
+
+			if (conn->rx_deflate) {
+				err = frame_inflate(conn, &hdr, &mb);
+				if (err)
+					goto out;
 			}
-			mem_deref(conn);
+
+			err = text_check(conn, &hdr, mb);
+			if (err) {
+				mem_deref(mb);
+				goto out;
+			}
+
+			data_recv(conn, &hdr, mb);
 			break;
 
 		case WEBSOCK_CLOSE:
@@ -409,6 +680,14 @@ static void http_resp_handler(int err, const struct http_msg *msg, void *arg)
 	if (pl_strcmp(&hdr->val, buf))
 		goto fail;
 
+#ifdef USE_ZLIB
+	if (conn->sock->deflate) {
+		err = ws_deflate_confirm(&conn->wd, &conn->sock->dconf, msg);
+		if (err)
+			goto fail;
+	}
+#endif
+
 	/* here we are ok */
 
 	conn->state = OPEN;
@@ -437,6 +716,34 @@ static void http_conn_handler(struct tcp_conn *tc, struct tls_conn *sc,
 }
 
 
+static int offer_print(struct re_printf *pf, const struct websock *sock)
+{
+#ifdef USE_ZLIB
+	if (sock->deflate)
+		return ws_deflate_offer(pf, &sock->dconf);
+#else
+	(void)pf;
+	(void)sock;
+#endif
+
+	return 0;
+}
+
+
+static int answer_print(struct re_printf *pf,
+			const struct websock_conn *conn)
+{
+#ifdef USE_ZLIB
+	return ws_deflate_print(pf, conn->wd);
+#else
+	(void)pf;
+	(void)conn;
+
+	return 0;
+#endif
+}
+
+
 int websock_connect(struct websock_conn **connp, struct websock *sock,
 		    struct http_cli *cli, const char *uri, unsigned kaint,
 		    websock_estab_h *estabh, websock_recv_h *recvh,
@@ -482,9 +789,11 @@ int websock_connect(struct websock_conn **connp, struct websock *sock,
 			   "Connection: upgrade\r\n"
 			   "Sec-WebSocket-Key: %b\r\n"
 			   "Sec-WebSocket-Version: 13\r\n"
+			   "%H"
 			   "%v"
 			   "\r\n",
 			   conn->nonce, sizeof(conn->nonce),
+			   offer_print, sock,
 			   fmt, &ap);
 	va_end(ap);
 	if (err)
@@ -531,12 +840,22 @@ int websock_accept(struct websock_conn **connp, struct websock *sock,
 	if (!conn)
 		return ENOMEM;
 
+#ifdef USE_ZLIB
+	if (sock->deflate) {
+		err = ws_deflate_accept(&conn->wd, &sock->dconf, msg);
+		if (err)
+			goto out;
+	}
+#endif
+
 	err = http_reply(htconn, 101, "Switching Protocols",
 			 "Upgrade: websocket\r\n"
 			 "Connection: Upgrade\r\n"
 			 "Sec-WebSocket-Accept: %H\r\n"
+			 "%H"
 			 "\r\n",
-			 accept_print, &key->val);
+			 accept_print, &key->val,
+			 answer_print, conn);
 	if (err)
 		goto out;
 
@@ -554,6 +873,9 @@ int websock_accept(struct websock_conn **connp, struct websock *sock,
 	tcp_set_handlers(conn->tc, NULL, recv_handler, close_handler, conn);
 	http_conn_close(htconn);
 
+	/* the sent frames are not modified, and may be shared */
+	tcp_conn_txref_set(conn->tc, true);
+
 	if (conn->kaint)
 		tmr_start(&conn->tmr, conn->kaint, keepalive_handler, conn);
 
@@ -567,12 +889,12 @@ int websock_accept(struct websock_conn **connp, struct websock *sock,
 }
 
 
-static int websock_encode(struct mbuf *mb, bool fin,
+static int websock_encode(struct mbuf *mb, bool fin, bool rsv1,
 			  enum websock_opcode opcode, bool mask, size_t len)
 {
 	int err;
 
-	err = mbuf_write_u8(mb, (fin<<7) | (opcode & 0x0f));
+	err = mbuf_write_u8(mb, (fin<<7) | (rsv1<<6) | (opcode & 0x0f));
 
 	if (len > 0xffff) {
 		err |= mbuf_write_u8(mb, (mask<<7) | 127);
@@ -588,32 +910,72 @@ static int websock_encode(struct mbuf *mb, bool fin,
 
 	if (mask) {
 		uint8_t mkey[4];
-		uint8_t *p;
-		size_t i;
 
 		rand_bytes(mkey, sizeof(mkey));
 
 		err |= mbuf_write_mem(mb, mkey, sizeof(mkey));
 
-		for (i=0, p=mbuf_buf(mb); i<len; i++)
-			p[i] = p[i] ^ mkey[i%4];
+		mask_apply(mbuf_buf(mb), len, mkey);
 	}
 
 	return err;
 }
 
 
-static int websock_vsend(struct websock_conn *conn, enum websock_opcode opcode,
-			 enum websock_scode scode, const char *fmt, va_list ap)
+/* Compress the payload after the header space of a frame */
+static int payload_deflate(const struct websock_conn *conn,
+			   struct mbuf **mbp, size_t hsz, size_t *lenp,
+			   bool fin)
+{
+#ifdef USE_ZLIB
+	struct mbuf *mb;
+	int err;
+
+	mb = mbuf_alloc(hsz + *lenp / 2 + 64);
+	if (!mb)
+		return ENOMEM;
+
+	mb->pos = hsz;
+
+	err = ws_deflate_encode(conn->wd, mb, (*mbp)->buf + hsz, *lenp, fin);
+	if (err) {
+		mem_deref(mb);
+		return err;
+	}
+
+	*lenp = mb->pos - hsz;
+
+	mem_deref(*mbp);
+	*mbp = mb;
+
+	return 0;
+#else
+	(void)conn;
+	(void)mbp;
+	(void)hsz;
+	(void)lenp;
+	(void)fin;
+
+	return ENOSYS;
+#endif
+}
+
+
+/*
+ * Print a whole frame, masked for the client side. The frames of a
+ * fragmented message are compressed when it is started by a data frame.
+ */
+static int frame_print(struct mbuf **mbp, const struct websock_conn *conn,
+		       enum websock_opcode opcode, bool fin,
+		       enum websock_scode scode, const char *fmt, va_list ap)
 {
-	const size_t hsz = conn->active ? 14 : 10;
+	const bool mask = conn ? conn->active : false;
+	const size_t hsz = mask ? 14 : 10;
 	size_t len, start;
 	struct mbuf *mb;
+	bool deflate;
 	int err = 0;
 
-	if (conn->state != OPEN)
-		return ENOTCONN;
-
 	mb = mbuf_alloc(2048);
 	if (!mb)
 		return ENOMEM;
@@ -629,6 +991,15 @@ static int websock_vsend(struct websock_conn *conn, enum websock_opcode opcode,
 
 	len = mb->pos - hsz;
 
+	deflate = conn && conn->wd &&
+		(opcode == WEBSOCK_TEXT || opcode == WEBSOCK_BIN ||
+		 (opcode == WEBSOCK_CONT && conn->tx_frag));
+	if (deflate) {
+		err = payload_deflate(conn, &mb, hsz, &len, fin);
+		if (err)
+			goto out;
+	}
+
 	if (len > 0xffff)
 		start = mb->pos = 0;
 	else if (len > 125)
@@ -636,23 +1007,47 @@ static int websock_vsend(struct websock_conn *conn, enum websock_opcode opcode,
 	else
 		start = mb->pos = 8;
 
-	err = websock_encode(mb, true, opcode, conn->active, len);
+	err = websock_encode(mb, fin, deflate && opcode != WEBSOCK_CONT,
+			     opcode, mask, len);
 	if (err)
 		goto out;
 
 	mb->pos = start;
 
-	err = tcp_send(conn->tc, mb);
+ out:
 	if (err)
-		goto out;
+		mem_deref(mb);
+	else
+		*mbp = mb;
+
+	return err;
+}
+
+
+static int websock_vsend(struct websock_conn *conn, enum websock_opcode opcode,
+			 enum websock_scode scode, const char *fmt, va_list ap)
+{
+	struct mbuf *mb;
+	int err;
+
+	if (conn->state != OPEN)
+		return ENOTCONN;
+
+	/* a fragmented message is being sent */
+	if (conn->tx_frag && opcode <= WEBSOCK_BIN)
+		return EBUSY;
+
+	err = frame_print(&mb, conn, opcode, true, scode, fmt, ap);
+	if (err)
+		return err;
+
+	err = tcp_send(conn->tc, mb);
 
- out:
 	mem_deref(mb);
 
 	return err;
 }
 
-
 int websock_send(struct websock_conn *conn, enum websock_opcode opcode,
 		 const char *fmt, ...)
 {
@@ -670,6 +1065,143 @@ int websock_send(struct websock_conn *conn, enum websock_opcode opcode,
 }
 
 
+/**
+ * Send the same message to several WebSocket connections. The frame is
+ * printed once and queued by reference on the TCP connections of the
+ * server side. Frames that are masked or compressed are made for each
+ * connection, as websock_send() does.
+ *
+ * @param connv  Array of WebSocket connections
+ * @param connc  Number of connections
+ * @param opcode Opcode of the message
+ * @param fmt    Formatted message payload
+ *
+ * @return 0 if sent to all, otherwise the error of the last failed one
+ */
+int websock_broadcast(struct websock_conn * const *connv, size_t connc,
+		      enum websock_opcode opcode, const char *fmt, ...)
+{
+	struct mbuf *mb = NULL;
+	va_list ap;
+	size_t i;
+	int err = 0;
+
+	if (!connv && connc)
+		return EINVAL;
+
+	for (i=0; i<connc; i++) {
+
+		struct websock_conn *conn = connv[i];
+		int e;
+
+		if (!conn)
+			continue;
+
+		if (conn->state != OPEN) {
+			e = ENOTCONN;
+		}
+		else if (conn->active || conn->wd || conn->tx_frag) {
+			va_start(ap, fmt);
+			e = websock_vsend(conn, opcode, 0, fmt, ap);
+			va_end(ap);
+		}
+		else {
+			if (!mb) {
+				va_start(ap, fmt);
+				e = frame_print(&mb, NULL, opcode, true, 0,
+						fmt, ap);
+				va_end(ap);
+				if (e)
+					return e;
+			}
+
+			e = tcp_send(conn->tc, mb);
+		}
+
+		if (e)
+			err = e;
+	}
+
+	mem_deref(mb);
+
+	return err;
+}
+
+
+static int frame_printf(struct mbuf **mbp, const struct websock_conn *conn,
+			enum websock_opcode opcode, bool fin,
+			const char *fmt, ...)
+{
+	va_list ap;
+	int err;
+
+	va_start(ap, fmt);
+	err = frame_print(mbp, conn, opcode, fin, 0, fmt, ap);
+	va_end(ap);
+
+	return err;
+}
+
+
+/**
+ * Send a frame of a fragmented message, as the data is produced. The
+ * message is started with a WEBSOCK_TEXT or WEBSOCK_BIN frame, continued
+ * with WEBSOCK_CONT frames and ends with the frame where fin is set.
+ * Control frames may be sent with websock_send() in between.
+ *
+ * @param conn   WebSocket connection
+ * @param opcode Opcode of the frame
+ * @param fin    True for the last frame of the message
+ * @param buf    Frame payload
+ * @param len    Length of frame payload
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int websock_send_frame(struct websock_conn *conn, enum websock_opcode opcode,
+		       bool fin, const uint8_t *buf, size_t len)
+{
+	struct mbuf *mb;
+	int err;
+
+	if (!conn || (!buf && len))
+		return EINVAL;
+
+	if (conn->state != OPEN)
+		return ENOTCONN;
+
+	switch (opcode) {
+
+	case WEBSOCK_TEXT:
+	case WEBSOCK_BIN:
+		if (conn->tx_frag)
+			return EBUSY;
+		break;
+
+	case WEBSOCK_CONT:
+		if (!conn->tx_frag)
+			return EPROTO;
+		break;
+
+	default:
+		return EINVAL;
+	}
+
+	err = frame_printf(&mb, conn, opcode, fin, len ? "%b" : NULL,
+			   buf, len);
+	if (err)
+		return err;
+
+	err = tcp_send(conn->tc, mb);
+
+	mem_deref(mb);
+
+	if (!err)
+		conn->tx_frag = !fin;
+
+	return err;
+}
+
+
 int websock_close(struct websock_conn *conn, enum websock_scode scode,
 		  const char *fmt, ...)
 {
@@ -727,3 +1259,51 @@ void websock_shutdown(struct websock *sock)
 	sock->shutdown = true;
 	mem_deref(sock);
 }
+
+
+/**
+ * Give the payload of data frames to the receive handler as it arrives,
+ * instead of after the whole frame. The handler is called for each part,
+ * with the length of the part in hdr->len, and hdr->fin is only set on
+ * the last part of a message. The frame being received is not affected.
+ *
+ * @param conn   WebSocket connection
+ * @param enable True to receive partial payloads
+ */
+void websock_set_recv_partial(struct websock_conn *conn, bool enable)
+{
+	if (!conn)
+		return;
+
+	conn->rx_partial = enable;
+}
+
+
+/**
+ * Enable the permessage-deflate extension (RFC 7692) for the connections
+ * of a WebSocket. It is offered by websock_connect() and accepted by
+ * websock_accept(), and messages are then compressed and inflated
+ * transparently. The LZ77 windows are made smaller to fit the zlib memory
+ * limit.
+ *
+ * @param sock WebSocket
+ * @param conf Configuration, or NULL to disable compression
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int websock_set_deflate(struct websock *sock,
+			const struct websock_deflate_conf *conf)
+{
+	if (!sock)
+		return EINVAL;
+
+#ifdef USE_ZLIB
+	sock->deflate = conf != NULL;
+	if (conf)
+		sock->dconf = *conf;
+
+	return 0;
+#else
+	return conf ? ENOSYS : 0;
+#endif
+}
@@ -0,0 +1,23 @@
+/**
+ * @file websock.h  WebSocket internal interface
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+
+/* permessage-deflate (RFC 7692) */
+struct ws_deflate;
+
+int  ws_deflate_offer(struct re_printf *pf,
+		      const struct websock_deflate_conf *conf);
+int  ws_deflate_confirm(struct ws_deflate **wdp,
+			const struct websock_deflate_conf *conf,
+			const struct http_msg *msg);
+int  ws_deflate_accept(struct ws_deflate **wdp,
+		       const struct websock_deflate_conf *conf,
+		       const struct http_msg *msg);
+int  ws_deflate_print(struct re_printf *pf, const struct ws_deflate *wd);
+int  ws_deflate_encode(struct ws_deflate *wd, struct mbuf *mb,
+		       const uint8_t *buf, size_t len, bool fin);
+int  ws_deflate_decode(struct ws_deflate *wd, struct mbuf **mbp,
+		       struct mbuf *mb, bool fin);